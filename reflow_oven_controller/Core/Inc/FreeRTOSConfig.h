@@ -62,13 +62,13 @@
 #define configUSE_PREEMPTION                     1
 #define configSUPPORT_STATIC_ALLOCATION          1
 #define configSUPPORT_DYNAMIC_ALLOCATION         1
-#define configUSE_IDLE_HOOK                      0
+#define configUSE_IDLE_HOOK                      1 /* Background jobs, see bgjob.h. */
 #define configUSE_TICK_HOOK                      0
 #define configCPU_CLOCK_HZ                       ( SystemCoreClock )
 #define configTICK_RATE_HZ                       ((TickType_t)1000)
 #define configMAX_PRIORITIES                     ( 56 )
 #define configMINIMAL_STACK_SIZE                 ((uint16_t)128)
-#define configTOTAL_HEAP_SIZE                    ((size_t)15000)
+#define configTOTAL_HEAP_SIZE                    ((size_t)15000) /* Budget of the block pools of heap.c, which replaces heap_4.c. */
 #define configMAX_TASK_NAME_LEN                  ( 16 )
 #define configUSE_TRACE_FACILITY                 1
 #define configUSE_16_BIT_TICKS                   0
@@ -76,6 +76,7 @@
 #define configQUEUE_REGISTRY_SIZE                8
 #define configUSE_RECURSIVE_MUTEXES              1
 #define configUSE_COUNTING_SEMAPHORES            1
+#define configUSE_QUEUE_SETS                     1 /* Active objects waiting on several sources, see Active_start_set(). */
 #define configUSE_PORT_OPTIMISED_TASK_SELECTION  0
 /* USER CODE BEGIN MESSAGE_BUFFER_LENGTH_TYPE */
 /* Defaults to size_t for backward compatibility, but can be changed
@@ -89,7 +90,7 @@
 
 /* Software timer definitions. */
 #define configUSE_TIMERS                         1
-#define configTIMER_TASK_PRIORITY                ( 2 )
+#define configTIMER_TASK_PRIORITY                ( 40 ) /* osPriorityHigh, PRIO_ACQUISITION of prio.h */
 #define configTIMER_QUEUE_LENGTH                 10
 #define configTIMER_TASK_STACK_DEPTH             256
 
@@ -165,6 +166,32 @@ standard names. */
 
 /* USER CODE BEGIN Defines */
 /* Section where parameter definitions can be added (for instance, to override default ones in FreeRTOS.h) */
+
+/* Run-time statistics in CPU cycles from the DWT cycle counter (wraps every ~53 s at 80 MHz,
+ * task times are only compared over shorter windows), see sys.h. */
+#define configGENERATE_RUN_TIME_STATS 1
+#define portCONFIGURE_TIMER_FOR_RUN_TIME_STATS() sys_runtime_init()
+#define portGET_RUN_TIME_COUNTER_VALUE() (*(volatile uint32_t *)0xE0001004UL) // DWT->CYCCNT
+#define traceTASK_SWITCHED_IN()                           \
+    do                                                    \
+    {                                                     \
+        sys_task_switched_in(pxCurrentTCB->uxTCBNumber);   \
+        trace_task_switched_in(pxCurrentTCB->uxTCBNumber); \
+        stackguard_switched_in(pxCurrentTCB->pxStack);     \
+    } while (0)
+
+/* Tickless idle, the idle task sleeps in sleep mode or STOP2 timed by LPTIM1, see power.h. */
+#define configUSE_TICKLESS_IDLE 2
+#define configEXPECTED_IDLE_TIME_BEFORE_SLEEP 4
+#define portSUPPRESS_TICKS_AND_SLEEP(xExpectedIdleTime) power_suppress_ticks_and_sleep(xExpectedIdleTime)
+
+#if defined(__ICCARM__) || defined(__CC_ARM) || defined(__GNUC__)
+void sys_runtime_init(void);
+void sys_task_switched_in(uint32_t task_number);
+void trace_task_switched_in(uint32_t task_number);
+void stackguard_switched_in(void *stack);
+void power_suppress_ticks_and_sleep(uint32_t expected_idle_ticks);
+#endif
 /* USER CODE END Defines */
 
 #endif /* FREERTOS_CONFIG_H */
@@ -23,6 +23,20 @@
 
 #include "stm32l4xx_hal.h"
 #include "stm32l476xx.h"
+#include "spibus.h"
+
+/* Configuration parameters */
+#define MAX31855K_SPI_TIMEOUT_MS 5U // Longest blocking read, a 4 byte transfer takes about 7 us at 5 MHz.
+#define MAX31855K_CONVERSION_S 0.1f  // Longest conversion time (s), reads in between return the last conversion.
+#define MAX31855K_CONVERSION_MIN_S 0.05f // Shortest plausible conversion time (s), 70 ms typical.
+#define MAX31855K_SPI_MAX_HZ 5000000U // Fastest serial clock of the MAX31855K (Hz).
+#ifndef MAX31855K_HW_NSS
+#define MAX31855K_HW_NSS 0 // Set to 1 to select the thermocouple with SPI2 NSS output (PB12) instead of MAX_CS.
+#endif
+
+/* Temperature resolutions, of the integer readings */
+#define MAX31855K_HJ_RES 0.25f   // Hot junction temperature resolution in degrees Celsius.
+#define MAX31855K_CJ_RES 0.0625f // Cold junction temperature resolution in degrees Celsius.
 
 // MAX31855K thermocouple device error definitions.
 typedef enum
@@ -33,6 +47,7 @@ typedef enum
     MAX_OPEN,         // Thermocouple connection is open.
     MAX_ZEROS,        // SPI read only 0s.
     MAX_SPI_DMA_FAIL, // Error during SPI DMA RX transfer.
+    MAX_SPI_FAIL,     // SPI bus busy or error during blocking transfer.
 
 	MAX_NUM_ERRORS
 } MAX31855K_err_t;
@@ -42,39 +57,92 @@ typedef enum
 typedef struct
 {
 	SPI_HandleTypeDef *hspi;   // SPI Handler instance.
-	GPIO_TypeDef *max_cs_port; // GPIO port for MAX31855K chip-select.
+	GPIO_TypeDef *max_cs_port; // GPIO port for MAX31855K chip-select, NULL for NSS output of SPI, see spi_ll.h.
 	uint16_t max_cs_pin;       // GPIO pin number of MAX31855K chip-select.
 } MAX31855K_cfg_t;
 
+// MAX31885K thermocouple device structure definition.
+typedef struct MAX31855K
+{
+    /* SPI Configuration Parameters */
+    SPI_HandleTypeDef *spi_handle; // SPI handler
+    GPIO_TypeDef *cs_port;         // Chip-select GPIO port.
+    uint16_t cs_pin;               // Chip-select pin number.
+
+    /* Data */
+    uint8_t tx_buf[4];   // SPI Transmit buffer.
+    uint8_t rx_buf[4];   // SPI Receive buffer.
+    uint32_t data32;     // Conversion of raw temperature reading to uint32.
+    spibus_xfer_t xfer;  // DMA read of rx_buf, see spibus.h.
+
+    /* Error value */
+    MAX31855K_err_t err; // Thermocouple error value of most recent reading.
+
+    struct MAX31855K_scan *scan; // Scan device is read by, see MAX31855K_Scan_Init().
+} MAX31855K_t;
+
+/* Callback function prototype, invoked from ISR context once every device of a scan has been read. */
+typedef void (*MAX31855K_scan_cb_t)(void *ctx, MAX31855K_t const *devs, uint8_t num_devs);
+
+/* DMA scan instance, only one scan of an instance is in flight at a time. Instances on the
+ * same SPI bus scan independently, their transfers are queued by the bus manager. */
+typedef struct MAX31855K_scan
+{
+    MAX31855K_t *devs;                // Scanned devices.
+    uint8_t num_devs;                 // Number of scanned devices.
+    volatile uint8_t remaining;       // Devices not yet read.
+    volatile bool busy;               // Scan in progress.
+    MAX31855K_scan_cb_t scan_cplt_cb; // Scan complete callback.
+    void *ctx;                        // Context passed to scan_cplt_cb.
+} MAX31855K_scan_t;
+
 /**
- * @brief Initialize MAX31885K driver.
+ * @brief Initialize MAX31885K device instance.
  * 
- * @param max_cfg Configuration parameters.
+ * @param[out] max Device instance.
+ * @param[in] max_cfg Configuration parameters.
  */
-void MAX31855K_Init(MAX31855K_cfg_t const * const max_cfg);
+void MAX31855K_Init(MAX31855K_t * const max, MAX31855K_cfg_t const * const max_cfg);
 
 /**
  * @brief Read data from MAX31855K in blocking mode and check for errors.
  * 
- * @return MAX31855K_err_t Error value.
+ * @param max Device instance.
+ *
+ * @return MAX31855K_err_t Error value, MAX_SPI_FAIL if queued DMA transfers hold the bus or
+ *         the transfer did not complete within MAX31855K_SPI_TIMEOUT_MS.
  * 
- * SPI instance must be initialized prior to function call.
+ * SPI instance must be initialized prior to function call. The read is polled at register
+ * level, see spi_ll.h, and takes microseconds.
  */
-MAX31855K_err_t MAX31855K_RxBlocking();
+MAX31855K_err_t MAX31855K_RxBlocking(MAX31855K_t * const max);
 
 /**
- * @brief Read data from MAX31855K in non-blocking mode through DMA controller.
+ * @brief Register devices sharing one SPI bus for DMA scanning.
+ *
+ * @param[out] scan Scan instance.
+ * @param devs Initialized device instances, all on the same SPI managed by spibus_init(), read by no other scan.
+ * @param num_devs Number of devices.
+ * @param scan_cplt_cb Scan complete callback (NULL for none).
+ * @param ctx Context passed to scan_cplt_cb.
  */
-void MAX31855K_RxDMA();
+void MAX31855K_Scan_Init(MAX31855K_scan_t *scan, MAX31855K_t *devs, uint8_t num_devs, MAX31855K_scan_cb_t scan_cplt_cb,
+                         void *ctx);
 
 /**
- * @brief Format data received and check for errors after DMA transfer.
- * 
- * @param max Pointer to MAX321885K_t structure containing configuration parameters and data.
- * 
- * Function should be called from within a SPI_RX_Cplt callback function.
+ * @brief Read every scanned device in turn through the DMA controller.
+ *
+ * @param scan Scan instance.
+ *
+ * @return MAX_OK if scan was started, MAX_SPI_DMA_FAIL if a scan is in progress.
+ *
+ * One transfer per device is queued on the SPI bus manager, which runs them back-to-back
+ * behind transfers of other devices on the bus. Each transfer complete interrupt checks the
+ * device's data for errors. Once the last device has been read, the device readings form a
+ * snapshot of one scan and scan_cplt_cb is invoked from ISR context, or from the caller if
+ * no transfer could be started. A device whose transfer failed reports MAX_SPI_DMA_FAIL.
  */
-void MAX31885K_RxDMA_Complete();
+MAX31855K_err_t MAX31855K_Scan_Start(MAX31855K_scan_t *scan);
 
 /**
  * @brief Parse HJ temperature from raw data.
@@ -85,7 +153,45 @@ void MAX31885K_RxDMA_Complete();
  *
  * @return float Hot junction temperature.
  */
-float MAX31855K_Get_HJ();
+float MAX31855K_Get_HJ(MAX31855K_t const * const max);
+
+/**
+ * @brief Parse HJ temperature from raw data in the chip's own 0.25 deg C steps.
+ * 
+ * @pre Check that max's error value equals MAX_OK.
+ *
+ * @param max Pointer to MAX321885K_t structure containing configuration parameters and data.
+ *
+ * @return int16_t Hot junction temperature in quarter degrees Celsius, exact.
+ */
+int16_t MAX31855K_Get_HJ_q2(MAX31855K_t const * const max);
+
+/**
+ * @brief Parse HJ temperature from raw data, corrected with NIST ITS-90 type K tables.
+ *
+ * The MAX31855K converts thermocouple voltage with a constant 41.276 uV/deg C slope,
+ * which reads several degrees low at reflow peak temperatures. The correction uses
+ * the cold junction temperature and costs a table lookup and one polynomial.
+ *
+ * @pre Check that max's error value equals MAX_OK.
+ *
+ * @param max Pointer to MAX321885K_t structure containing configuration parameters and data.
+ *
+ * @return float Hot junction temperature, chip value if beyond the type K range.
+ */
+float MAX31855K_Get_HJ_NIST(MAX31855K_t const * const max);
+
+/**
+ * @brief Correct chip HJ temperature with NIST ITS-90 type K tables, see MAX31855K_Get_HJ_NIST().
+ *
+ * For temperatures not taken from a single reading, eg. means of several readings.
+ *
+ * @param hj Hot junction temperature as converted by the chip.
+ * @param cj Cold junction temperature.
+ *
+ * @return float Hot junction temperature, hj if beyond the type K range.
+ */
+float MAX31855K_NIST(float hj, float cj);
 
 /**
  * @brief Parse CJ temperature from raw data.
@@ -96,13 +202,39 @@ float MAX31855K_Get_HJ();
  *
  * @return float Cold junction temperature.
  */
-float MAX31855K_Get_CJ();
+float MAX31855K_Get_CJ(MAX31855K_t const * const max);
+
+/**
+ * @brief Parse CJ temperature from raw data in the chip's own 0.0625 deg C steps.
+ * 
+ * @pre Check that max's error value equals MAX_OK.
+ *
+ * @param max Pointer to MAX321885K_t structure containing configuration parameters and data.
+ *
+ * @return int16_t Cold junction temperature in sixteenths of a degree Celsius, exact.
+ */
+int16_t MAX31855K_Get_CJ_q4(MAX31855K_t const * const max);
 
 /**
- * @brief Get current error value as a character string.
+ * @brief Get error value as a character string.
+ *
+ * @param err Error value.
  *
  * @return Error value formatted as character string.
  */
-const char * MAX31855K_Err_Str();
+const char * MAX31855K_Err_Str(MAX31855K_err_t err);
+
+/**
+ * @brief Check whether error may clear on the next read.
+ *
+ * Reads of only zeros and failed SPI transfers come from bus noise or contention, a
+ * reading of the next conversion is likely good. Open and shorted thermocouples are
+ * reported by the device itself and persist until the wiring is fixed.
+ *
+ * @param err Error value, not MAX_OK.
+ *
+ * @return true for a transient error, false for a hard fault.
+ */
+bool MAX31855K_Err_Transient(MAX31855K_err_t err);
 
 #endif
@@ -10,9 +10,21 @@
 #define _ACTIVE_H_
 
 #include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+#include <sys/queue.h>
 #include "common.h"
 #include "cmsis_os.h"
 
+/* Extra wake-up sources through queue sets, see Active_start_set(). Off where the kernel
+ * is built without them, eg. the host simulation. */
+#if defined(configUSE_QUEUE_SETS) && configUSE_QUEUE_SETS
+#define ACTIVE_SOURCES 1
+#include "queue.h"
+#else
+#define ACTIVE_SOURCES 0
+#endif
+
 /**
  * @brief Generic signal type definition.
  * 
@@ -20,11 +32,58 @@
  */
 typedef int32_t Signal;
 
+/* Scheduler configuration parameters */
+#ifndef ACTIVE_COOPERATIVE
+#define ACTIVE_COOPERATIVE 0 // Set to 1 to run all active objects on one thread.
+#endif
+#define ACTIVE_COOP_STACK_SZ 2048 // Stack size of cooperative kernel thread (bytes).
+
+/* Thread stack storage to declare for an active object (bytes). Active objects run on
+ * the cooperative kernel thread's stack when ACTIVE_COOPERATIVE is set, so none is needed. */
+#if ACTIVE_COOPERATIVE
+#define ACTIVE_STACK_STORAGE_SZ(stack_sz) 8U
+#else
+#define ACTIVE_STACK_STORAGE_SZ(stack_sz) (stack_sz)
+#endif
+
+/* Event deferral configuration parameters */
+#define ACTIVE_DEFER_DEPTH 4 // Maximum number of deferred events per active object.
+
+/* Stale event configuration parameters */
+#define ACTIVE_MAX_AGE_SIGS 2 // Maximum number of signals with a maximum age per active object.
+
+/* Publish/subscribe configuration parameters */
+#define ACTIVE_MAX_AOS 10      // Maximum number of active objects, at most 32.
+#define ACTIVE_MAX_PUB_SIGS 32 // Published signals must be less than this value.
+
+/* Event pool configuration parameters */
+#define EVENT_POOL_SMALL_BLOCK_SZ 16U   // Block size of small event pool (bytes), multiple of 8.
+#define EVENT_POOL_SMALL_NUM_BLOCKS 8U  // Number of small event blocks.
+#define EVENT_POOL_LARGE_BLOCK_SZ 64U   // Block size of large event pool (bytes), multiple of 8.
+#define EVENT_POOL_LARGE_NUM_BLOCKS 12U // Number of large event blocks, streamed command lines may hold up to 6.
+#define EVENT_POOL_LINE_BLOCK_SZ 520U   // Block size of line event pool (bytes), fits a CONSOLE_CMD_BUF_SIZE command line.
+#define EVENT_POOL_LINE_NUM_BLOCKS 2U   // Number of line event blocks, for command lines too long for large blocks.
+
+/* Time event units, timeouts are given in milliseconds */
+#define TIME_EVENT_MS(ms) ((uint32_t)(ms))           // Timeout in milliseconds.
+#define TIME_EVENT_SEC(s) ((uint32_t)(s) * 1000U)    // Timeout in seconds.
+
+/* Time event resolution limits (ms) */
+#define TIME_EVENT_RES_MIN_MS 1U    // Finest resolution, one kernel tick at 1 kHz.
+#define TIME_EVENT_RES_MAX_MS 1000U // Coarsest resolution.
+
+/* Time event request ring, see TimeEvent_arm() */
+#define TIME_EVENT_REQ_RING_SIZE 16U // Arm and disarm requests pending for the timer daemon, power of two.
+
+/* Virtual time scale limit, see Active_time_scale_set() */
+#define ACTIVE_TIME_SCALE_MAX 100U // Fastest virtual time, relative to wall-clock time.
+
 /* Reserved signals */
 enum ReservedSignals
 {
     INIT_SIG,  // Dispatched to AO before entering event-loop
     ENTRY_SIG, // Trigger action upon entry into state.
+    EXIT_SIG,  // Trigger action upon exit from state.
     USER_SIG   // First signal available to the users
 };
 
@@ -32,12 +91,24 @@ enum ReservedSignals
  * @brief Event base class.
  *
  * Modules may inherit base class and add relevant private event parameters.
+ * Events are either immutable statics (pool_id is 0) or allocated from an
+ * event pool with Event_new(), which carry a reference count and are
+ * recycled once every active object they were posted to has handled them.
  */
 typedef struct
 {
-    Signal sig; // Event signal.
+    Signal sig;               // Event signal.
+    uint8_t pool_id;          // Owning event pool + 1, 0 for static events.
+    volatile uint8_t ref_cnt; // Number of pending deliveries, pool events only.
 } Event;
 
+/* Event queue message, declare msg_count of these as static queue storage. */
+typedef struct
+{
+    Event const *evt;  // Posted event.
+    uint32_t post_cyc; // Cycle counter when event was posted.
+} Active_msg;
+
 /* Forward declaration */
 typedef struct Active Active;
 
@@ -46,19 +117,93 @@ typedef struct Active Active;
  * 
  * Timeout event is posted to specified active object 
  * once timeout value reaches 0.
+ *
+ * Armed time events are kept in a list sorted by expiry, each storing its
+ * timeout relative to the preceding time event. A single one-shot OS timer
+ * is programmed to the head's deadline and stays stopped while no time
+ * event is armed, so there are no periodic wakeups.
+ *
+ * Each time event has a resolution. Expiry is rounded up to a multiple of it,
+ * so coarse time events that are due around the same time coalesce into one
+ * timer wakeup.
+ *
+ * Only the timer daemon touches the armed list. Arming and disarming publish a
+ * request, stamped with the kernel tick count, in a lock-free ring with exclusive
+ * load/stores and pend one call of the daemon to apply the requests in order,
+ * so they are callable from interrupts and never lock the kernel.
  */
-typedef struct
+typedef struct TimeEvent
 {
     Event base; // Inherit base Event class.
 
     Active *ao;       // Active object that requested the time event.
-    uint32_t timeout; // Timeout counter in ms; 0 means not armed.
-    uint32_t reload;  // Reload value for periodic time events, 0 means one-shot.
+    uint32_t delta;   // Kernel ticks remaining after preceding armed time event expires.
+    uint32_t reload;  // Reload value for periodic time events (kernel ticks), 0 means one-shot.
+    uint32_t resolution; // Expiry granularity (kernel ticks).
+    bool armed;       // Time event is in armed list (timer daemon).
+
+    SLIST_ENTRY(TimeEvent) next; // Next armed time event.
 } TimeEvent;
 
+/**
+ * @brief Condition class.
+ *
+ * Tracks a set of flags, eg. one per zone, in an RTOS event flags object (a FreeRTOS event
+ * group) and posts its event to the active object once, when every flag of its mask becomes
+ * set. The producers of the flags update them on every sample, the active object only sees
+ * the transition, eg. "all zones reached temperature" is one dispatch rather than one per
+ * zone per sample. Clearing a flag of the mask re-arms the condition.
+ *
+ * Threads that are not active objects may block on the same condition with
+ * osEventFlagsWait(cond->flags_id, cond->mask, osFlagsWaitAll | osFlagsNoClear, timeout).
+ */
+typedef struct
+{
+    Event base; // Inherit base Event class, posted when the condition becomes true.
+
+    Active *ao;                    // Active object notified.
+    osEventFlagsId_t flags_id;     // Event flags holding the condition's flags.
+    StaticEventGroup_t flags_cb;   // Event flags control block.
+    uint32_t mask;                 // Flags that must all be set.
+    bool met;                      // Condition held at last update.
+} ActiveCond;
+
+/**
+ * @brief Active object runtime statistics, times in CPU cycles.
+ *
+ * Times are measured with the DWT cycle counter, so they wrap
+ * for intervals longer than 2^32 cycles (~53 s at 80 MHz).
+ */
+typedef struct
+{
+    uint32_t dispatched;    // Number of events dispatched, excluding INIT_SIG.
+    uint32_t post_fails;    // Number of events dropped because the queue was full.
+    uint32_t coalesced;     // Number of posts merged into an identical pending event, see Active_coalesce().
+    uint32_t stale;         // Number of events dropped older than their maximum age, see Active_max_age().
+    uint32_t queue_hwm;     // Event queue high-water mark.
+    uint32_t latency_max;   // Maximum time from post to dispatch.
+    uint64_t latency_total; // Total time from post to dispatch.
+    uint32_t handler_max;   // Maximum event handler execution time.
+} Active_stats;
+
 /* Event handler function pointer typedef. */
 typedef void (*EventHandler)(Active *const ao, Event const *const evt);
 
+#if ACTIVE_SOURCES
+/* Source handler function pointer typedef, see Active_start_set(). */
+typedef void (*SourceHandler)(Active *const ao, QueueSetMemberHandle_t source);
+
+/**
+ * @brief Wake-up source of an active object besides its event queue.
+ */
+typedef struct
+{
+    QueueSetMemberHandle_t handle; // Queue or semaphore, empty when the active object starts.
+    uint32_t length;               // Items it holds, 1 for a binary semaphore.
+    SourceHandler handler;         // Takes one item of the source without waiting.
+} Active_source;
+#endif
+
 /**
  * @brief Active object base class.
  *
@@ -68,26 +213,89 @@ struct Active
 {
     /* Private variables */
     osThreadId_t thread_id;      // Event loop thread ID.
-    osMessageQueueId_t queue_id; // Event message queue ID.
+    osMessageQueueId_t queue_id; // Event message queue ID, NULL with a notification ring.
+    uint8_t id;                  // Index in active object registry, used for subscriptions.
+    uint8_t rank;                // Cooperative kernel priority rank, higher dispatches first.
+    osPriority_t prio;           // Requested thread priority.
+    const char *name;            // Name for statistics, taken from thread attributes.
+    Active_stats stats;          // Runtime statistics.
+
+    /* Liveness, see Active_stalled() */
+    volatile uint32_t progress_tick; // Kernel tick of last dispatch start or end, or post to empty queue.
+    volatile bool busy;              // Event handler is running.
+
+    /* Notification ring, see Active_start_ring() */
+    Active_msg *ring;             // Ring storage, NULL if events go through queue_id.
+    uint32_t ring_size;           // Number of messages ring holds.
+    volatile uint32_t ring_head;  // Index of oldest message.
+    volatile uint32_t ring_count; // Number of messages queued.
+
+    /* Coalescing of periodic signals, see Active_coalesce() */
+    uint32_t coalesce_sigs;         // Bitmask of signals queued at most once.
+    volatile uint32_t pending_sigs; // Bitmask of coalescing signals queued and not yet dispatched.
+
+    /* Stale event dropping, see Active_max_age() */
+    Signal max_age_sigs[ACTIVE_MAX_AGE_SIGS];  // Signals with a maximum age.
+    uint32_t max_age_us[ACTIVE_MAX_AGE_SIGS];  // Maximum time from post to dispatch (us).
+    uint8_t num_max_age;                       // Number of signals with a maximum age.
+
+#if ACTIVE_SOURCES
+    /* Extra wake-up sources, see Active_start_set() */
+    QueueSetHandle_t set;          // Queue set of event queue and sources, NULL without sources.
+    Active_source const *sources;  // Sources besides the event queue.
+    uint8_t num_sources;           // Number of sources.
+#endif
+
+    /* Deferred events, only accessed from the active object's own handler */
+    Event const *deferred[ACTIVE_DEFER_DEPTH]; // Ring of deferred events, oldest at defer_head.
+    uint8_t defer_head;                        // Index of oldest deferred event.
+    uint8_t defer_count;                       // Number of deferred events.
 
     /* Virtual functions */
     EventHandler evt_handler; // Event handler function.
 };
 
+/**
+ * @brief Initialize active object statistics and register "ao" commands.
+ *
+ * @return MOD_OK if successful, otherwise a "MOD_ERR" value.
+ */
+mod_err_t Active_init(void);
+
 /**
  * @brief Active object constructor.
  * 
  * @param[in/out] ao Base active object.
  * @param[in] evt_handler Event handler function.
  * 
- * @return MOD_OK if successful, a "MOD_ERR" value otherwise.
+ * @return MOD_OK if successful, MOD_ERR_ARG if arguments are invalid,
+ *         MOD_ERR_RESOURCE if ACTIVE_MAX_AOS active objects are already constructed.
  */
 mod_err_t Active_ctor(Active *const ao, EventHandler evt_handler);
 
 /**
  * @brief Start active object's thread and message queue.
  * 
+ * With ACTIVE_COOPERATIVE set, active objects share a single kernel thread
+ * instead: each handler runs to completion on its stack and the highest
+ * priority active object with a queued event is dispatched next. Only prio
+ * is used, active objects of equal priority are ranked in start order.
+ * Handlers must not block in this mode, as that stalls every active object.
+ *
+ * Thread and queue are allocated statically when the attributes provide
+ * control blocks (StaticTask_t, StaticQueue_t) and storage, declare them
+ * alongside the active object:
+ *
+ * static StaticTask_t foo_thread_cb;
+ * static uint64_t SRAM2_BSS foo_stack[ACTIVE_STACK_STORAGE_SZ(FOO_STACK_SZ) / sizeof(uint64_t)];
+ * static StaticQueue_t foo_queue_cb;
+ * static Active_msg foo_queue_mem[FOO_MSG_COUNT];
+ *
+ * SRAM2_BSS (sections.h) keeps the stack in SRAM2, away from DMA traffic.
+ * Without them, or with NULL attributes, both are taken from the FreeRTOS heap.
+ * 
  * @param[in/out] ao Base active object.
+ * @param[in] prio Thread priority, a PRIO_ value of prio.h. Overrides that of thread_attr.
  * @param[in] thread_attr Thread attributes (NULL for default).
  * @param[in] msg_count Maximum number of messages/events in queue.
  * @param[in] queue_attr Queue attributes (NULL for default).
@@ -97,22 +305,294 @@ mod_err_t Active_ctor(Active *const ao, EventHandler evt_handler);
  * @note Function does not start thread scheduler.
  */
 mod_err_t Active_start(Active *const ao,
+                       osPriority_t prio,
                        const osThreadAttr_t *const thread_attr,
                        uint32_t msg_count,
                        const osMessageQueueAttr_t *const queue_attr);
 
 /**
- * @brief Post message to active object (non-blocking).
+ * @brief Start active object's thread with a notification ring instead of a message queue.
+ *
+ * Posts copy the message into a ring of the active object's own and wake its thread
+ * with a task notification, so neither side goes through the kernel's queue code: a
+ * post masks interrupts for a few instructions only, and a thread with events queued
+ * dispatches them without any kernel call. Otherwise behaves as Active_start(), events
+ * may be posted to front and from ISRs alike.
+ *
+ * The thread's task notification is taken by the event loop, so handlers must not
+ * wait on it. Declare the ring storage alongside the active object:
+ *
+ * static Active_msg foo_ring[FOO_MSG_COUNT];
+ *
+ * @param[in/out] ao Base active object.
+ * @param[in] prio Thread priority, a PRIO_ value of prio.h. Overrides that of thread_attr.
+ * @param[in] thread_attr Thread attributes (NULL for default).
+ * @param[in] ring_mem Ring storage of msg_count messages.
+ * @param[in] msg_count Maximum number of messages/events in ring.
+ *
+ * @return MOD_OK if successful, a "MOD_ERR" value otherwise.
+ *
+ * @note Function does not start thread scheduler.
+ */
+mod_err_t Active_start_ring(Active *const ao,
+                            osPriority_t prio,
+                            const osThreadAttr_t *const thread_attr,
+                            Active_msg *const ring_mem,
+                            uint32_t msg_count);
+
+#if ACTIVE_SOURCES
+/**
+ * @brief Start active object's thread waiting on its message queue and other sources.
+ *
+ * The event queue and every source, eg. a binary semaphore given by a receive interrupt or a
+ * queue of raw frames, join a FreeRTOS queue set. The thread blocks on the set alone and
+ * dispatches whichever member has an item: events to the event handler as Active_start()
+ * does, a source to its handler, which must take exactly one item without waiting. Source
+ * handlers run to completion like event handlers, so a module reading a byte stream needs no
+ * thread of its own beside its active object.
+ *
+ * Sources must be empty when added and only be taken by their handler. Stream and message
+ * buffers cannot join a queue set, signal them through a semaphore instead. The active object
+ * keeps a thread of its own with ACTIVE_COOPERATIVE set, as waiting on the set blocks.
+ * Declare the set storage, of msg_count plus the sources' lengths items, alongside the
+ * active object:
+ *
+ * static StaticQueue_t foo_set_cb;
+ * static QueueSetMemberHandle_t foo_set_mem[FOO_MSG_COUNT + 1];
+ *
+ * @param[in/out] ao Base active object.
+ * @param[in] prio Thread priority, a PRIO_ value of prio.h. Overrides that of thread_attr.
+ * @param[in] thread_attr Thread attributes (NULL for default).
+ * @param[in] msg_count Maximum number of messages/events in queue.
+ * @param[in] queue_attr Queue attributes (NULL for default).
+ * @param[in] sources Sources, must remain valid.
+ * @param[in] num_sources Number of sources.
+ * @param[in] set_attr Set attributes, cb_mem and mq_mem for static allocation (NULL for heap).
+ *
+ * @return MOD_OK if successful, MOD_ERR_ARG if arguments are invalid, a "MOD_ERR" value otherwise.
+ *
+ * @note Function does not start thread scheduler.
+ */
+mod_err_t Active_start_set(Active *const ao,
+                           osPriority_t prio,
+                           const osThreadAttr_t *const thread_attr,
+                           uint32_t msg_count,
+                           const osMessageQueueAttr_t *const queue_attr,
+                           Active_source const *const sources,
+                           uint8_t num_sources,
+                           const osMessageQueueAttr_t *const set_attr);
+#endif
+
+/**
+ * @brief Post message to back of active object's queue (non-blocking, thread or ISR).
  * 
  * @param ao Base active object to post message to.
  * @param evt Event information.
  * 
- * @return MOD_OK if successful, MOD_ERR_TIMEOUT if queue is full.
+ * @return MOD_OK if successful or coalesced, MOD_ERR_TIMEOUT if queue is full.
  * 
- * @note Race condition may occur if event object is modified while event is being processed.
+ * @note Race condition may occur if a static event object is modified while event is being processed.
+ *       Allocate events carrying payloads with Event_new() instead.
  */
 mod_err_t Active_post(Active *const ao, Event const *const evt);
 
+/**
+ * @brief Post message to front of active object's queue (non-blocking, thread or ISR).
+ *
+ * Urgent events (eg. stop or fault) are dispatched next, ahead of any backlog.
+ * Urgent events posted back to back are dispatched in reverse order.
+ *
+ * @param ao Base active object to post message to.
+ * @param evt Event information.
+ *
+ * @return MOD_OK if successful, MOD_ERR_TIMEOUT if queue is full.
+ */
+mod_err_t Active_postUrgent(Active *const ao, Event const *const evt);
+
+/**
+ * @brief Post message to back of active object's queue from ISR without yielding.
+ *
+ * @param[in] ao Base active object to post message to.
+ * @param[in] evt Event information.
+ * @param[in/out] woken Set to pdTRUE if a higher priority thread was woken, initialize
+ *                      to pdFALSE and pass to portYIELD_FROM_ISR() before returning from ISR.
+ *
+ * @return MOD_OK if successful, MOD_ERR_TIMEOUT if queue is full.
+ */
+mod_err_t Active_postFromISR(Active *const ao, Event const *const evt, BaseType_t *const woken);
+
+/**
+ * @brief Post message to front of active object's queue from ISR without yielding.
+ *
+ * @param[in] ao Base active object to post message to.
+ * @param[in] evt Event information.
+ * @param[in/out] woken See Active_postFromISR().
+ *
+ * @return MOD_OK if successful, MOD_ERR_TIMEOUT if queue is full.
+ */
+mod_err_t Active_postUrgentFromISR(Active *const ao, Event const *const evt, BaseType_t *const woken);
+
+/**
+ * @brief Queue signal at most once, merging posts while an identical event is pending.
+ *
+ * Periodic signals (eg. samples or ticks) that arrive faster than they are handled
+ * would otherwise fill the queue and push out one-shot events like a stop request.
+ * A post of a coalescing signal that is already queued is dropped and counted in the
+ * statistics, the pending event stands for it. The signal may be queued again once
+ * its event is dispatched, so one posted while it is being handled is kept.
+ *
+ * Only the pending event's payload is delivered, so coalesce signals whose handlers
+ * tolerate skipped events, eg. measure the time since the previous one.
+ *
+ * @param ao Base active object.
+ * @param sig Signal to coalesce, less than 32.
+ *
+ * @note Call before the active object is started.
+ */
+void Active_coalesce(Active *const ao, Signal sig);
+
+/**
+ * @brief Drop events of a signal that waited in the queue longer than a maximum age.
+ *
+ * Every queued event carries the cycle counter of its post (Active_msg). An event of
+ * the signal dequeued more than max_age_us after it was posted, eg. a sample delayed
+ * behind a backlog of commands or a long handler, is recycled without reaching the
+ * handler and counted in the statistics. The handler therefore never acts on data
+ * older than max_age_us, the next event of the signal brings current data.
+ *
+ * Combined with Active_coalesce(), which keeps the oldest pending event, a stall ends
+ * with the stale event dropped rather than handled.
+ *
+ * @param ao Base active object.
+ * @param sig Signal to check, not INIT_SIG.
+ * @param max_age_us Maximum time from post to dispatch (us), 0 to stop checking the signal.
+ *
+ * @note Ages are measured with the DWT cycle counter and compared at the core clock of
+ *       the dispatch, so a clock switch (see clock.h) keeps the maximum age in time.
+ *       max_age_us must stay below 2^32 cycles (~53 s at 80 MHz). May be called again to
+ *       change the maximum age from the active object's own handler.
+ */
+void Active_max_age(Active *const ao, Signal sig, uint32_t max_age_us);
+
+/**
+ * @brief Defer event currently being handled, to be recalled in a later state.
+ *
+ * Pool events are kept by reference, so they stay allocated until recalled or flushed.
+ *
+ * @param ao Base active object handling the event.
+ * @param evt Event to defer.
+ *
+ * @return MOD_OK if successful, MOD_ERR_RESOURCE if ACTIVE_DEFER_DEPTH events are already deferred.
+ *
+ * @note Call from the active object's own event handler only.
+ */
+mod_err_t Active_defer(Active *const ao, Event const *const evt);
+
+/**
+ * @brief Recall oldest deferred event, posting it to the front of the active object's queue.
+ *
+ * Recalled event is dispatched after current handler completes, ahead of queued events.
+ * Typically called from a state's entry action, once per event the state can consume.
+ *
+ * @param ao Base active object.
+ *
+ * @return true if an event was recalled, false if none was deferred or queue is full.
+ *
+ * @note Call from the active object's own event handler only.
+ */
+bool Active_recall(Active *const ao);
+
+/**
+ * @brief Discard every deferred event.
+ *
+ * @param ao Base active object.
+ *
+ * @note Call from the active object's own event handler only.
+ */
+void Active_flush_deferred(Active *const ao);
+
+/**
+ * @brief Subscribe active object to published signal.
+ *
+ * @param ao Base active object.
+ * @param sig Signal to subscribe to, less than ACTIVE_MAX_PUB_SIGS.
+ *
+ * @note A published signal means the same to every subscriber, so it must not
+ *       collide with a private signal of any subscribing active object.
+ */
+void Active_subscribe(Active const *const ao, Signal sig);
+
+/**
+ * @brief Unsubscribe active object from published signal.
+ *
+ * @param ao Base active object.
+ * @param sig Previously subscribed signal.
+ */
+void Active_unsubscribe(Active const *const ao, Signal sig);
+
+/**
+ * @brief Multicast event to every active object subscribed to its signal (ISR-safe).
+ *
+ * Pool events are delivered by reference, each subscriber holding one reference,
+ * and are recycled once every subscriber has handled them or if there are no subscribers.
+ *
+ * @param evt Event to publish, signal less than ACTIVE_MAX_PUB_SIGS.
+ *
+ * @return Number of subscribers event was posted to.
+ */
+uint32_t Active_publish(Event const *const evt);
+
+/**
+ * @brief Publish event and deliver it to one more active object, which need not subscribe (ISR-safe).
+ *
+ * For events of a signal several instances publish, each instance taking only its own:
+ * a subscribed instance would receive those of the others as well, and coalesce its own
+ * with them. The event is delivered once to ao even if it subscribes.
+ *
+ * @param ao Active object receiving the event besides the subscribers.
+ * @param evt Event to publish, signal less than ACTIVE_MAX_PUB_SIGS.
+ *
+ * @return Number of active objects event was posted to.
+ */
+uint32_t Active_publish_to(Active *const ao, Event const *const evt);
+
+/**
+ * @brief Get active object by registry index.
+ *
+ * @param id Index, see Active.id.
+ *
+ * @return Active object, NULL if fewer were constructed.
+ */
+Active *Active_by_id(uint32_t id);
+
+/**
+ * @brief Find an active object that stopped making progress.
+ *
+ * An active object is stalled if its event handler has been running, or an event has
+ * been waiting in its queue without any being dispatched, for longer than timeout.
+ * Idle active objects are never stalled, so they need no periodic events to prove
+ * liveness.
+ *
+ * @param timeout Longest handler run or queue wait (ms).
+ *
+ * @return Stalled active object, one whose handler is stuck first, NULL if none is stalled.
+ */
+Active const *Active_stalled(uint32_t timeout);
+
+/**
+ * @brief Allocate event from smallest event pool that fits (ISR-safe).
+ *
+ * @param size Size of event in bytes, including inherited Event base.
+ * @param sig Event signal.
+ *
+ * @return Event with signal set and payload uninitialized, NULL if no pool block is available.
+ *
+ * @note Post event with Active_post() once payload is filled in. It is returned to its
+ *       pool after the event handler of each active object it was posted to has run,
+ *       so it must not be referenced past that point.
+ */
+Event *Event_new(size_t size, Signal sig);
+
 /**
  * @brief Time event constructor.
  * 
@@ -120,24 +600,130 @@ mod_err_t Active_post(Active *const ao, Event const *const evt);
  * @param[in] sig User-defined signal which is posted when timeout value reaches 0.
  * @param[in] ao Active object instance registered to timer event.
  * 
- * Timer event is initially disarmed.
+ * Timer event is initially disarmed with TIME_EVENT_RES_MIN_MS resolution.
+ * There is no limit on the number of time events.
  */
 void TimeEvent_ctor(TimeEvent *const time_evt, Signal sig, Active *ao);
 
 /**
- * @brief Arm specific time event instance.
+ * @brief Arm specific time event instance, re-arming it if already armed.
  * 
+ * The timeout counts from the call, the timer daemon applies the request shortly after.
+ *
  * @param[in/out] time_evt Timer event instance.
- * @param[in] timeout Timeout value (ms).
- * @param[in] reload Auto-reload value (0 for one-shot).
+ * @param[in] timeout Timeout value (ms), 0 disarms time event. See TIME_EVENT_MS() and TIME_EVENT_SEC().
+ * @param[in] reload Auto-reload value (ms), 0 for one-shot.
+ * @return True if request was queued, false if the request ring was full and the time event
+ *         keeps its previous state.
+ *
+ * @note Callable from threads and from interrupts at or below
+ *       configLIBRARY_MAX_SYSCALL_INTERRUPT_PRIORITY.
  */
-void TimeEvent_arm(TimeEvent *const time_evt, uint32_t timeout, uint32_t reload);
+bool TimeEvent_arm(TimeEvent *const time_evt, uint32_t timeout, uint32_t reload);
+
+/**
+ * @brief Set expiry granularity of time event, applied from next arming.
+ *
+ * @param[in/out] time_evt Timer event instance.
+ * @param[in] resolution Resolution (ms), within TIME_EVENT_RES_MIN_MS and TIME_EVENT_RES_MAX_MS.
+ */
+void TimeEvent_set_resolution(TimeEvent *const time_evt, uint32_t resolution);
 
 /**
  * @brief Disarm specific time event instance.
  * 
+ * A timeout the daemon posted before applying the request may still be dispatched.
+ *
  * @param[in/out] time_evt Timer event instance.
+ * @return True if request was queued, false if the request ring was full, as TimeEvent_arm().
+ *
+ * @note Callable from the same contexts as TimeEvent_arm().
+ */
+bool TimeEvent_disarm(TimeEvent *const time_evt);
+
+/**
+ * @brief Condition constructor, all flags initially clear.
+ *
+ * @param[in/out] cond Condition instance.
+ * @param[in] sig Signal posted when the condition becomes true.
+ * @param[in] ao Active object notified.
+ * @param[in] mask Flags that must all be set, at most the low 24 bits (event group size).
+ */
+void ActiveCond_ctor(ActiveCond *const cond, Signal sig, Active *ao, uint32_t mask);
+
+/**
+ * @brief Set flags, posting the condition's event if this completes the mask (thread context).
+ *
+ * Setting flags that are already set posts nothing, so producers may set their flag on
+ * every sample.
+ *
+ * @param[in/out] cond Condition instance.
+ * @param[in] flags Flags to set.
+ *
+ * @return true if the condition became true and its event was posted.
+ */
+bool ActiveCond_set(ActiveCond *const cond, uint32_t flags);
+
+/**
+ * @brief Clear flags, re-arming the condition if one of them is in the mask (thread context).
+ *
+ * @param[in/out] cond Condition instance.
+ * @param[in] flags Flags to clear.
+ */
+void ActiveCond_clear(ActiveCond *const cond, uint32_t flags);
+
+/**
+ * @brief Check whether every flag of the mask is set.
+ *
+ * The event posted on the transition may be dispatched after a flag was cleared again,
+ * handlers acting on a lasting condition check it here.
+ *
+ * @param[in] cond Condition instance.
+ *
+ * @return true if the condition holds.
+ */
+bool ActiveCond_met(ActiveCond const *const cond);
+
+/**
+ * @brief Set virtual time scale, the number of virtual milliseconds per wall-clock millisecond.
+ *
+ * Time event timeouts, reloads and resolutions are virtual time, so at a scale of 50 a
+ * 120 s time event expires after 2.4 s. Modules with their own time base (e.g. a control
+ * loop sampling timer) read the scale with Active_time_scale() when they program it.
+ *
+ * @param scale Virtual time scale, 1 (wall-clock time) up to ACTIVE_TIME_SCALE_MAX.
+ *
+ * @return MOD_OK if set, MOD_ERR_ARG if scale is out of range.
+ *
+ * @note Time events armed before the change keep their remaining kernel ticks until they
+ *       are re-armed, and periodic ones keep their reload. Change the scale while the
+ *       modules depending on virtual time are idle.
+ */
+mod_err_t Active_time_scale_set(uint32_t scale);
+
+/**
+ * @brief Get virtual time scale (ISR-safe).
+ *
+ * @return Virtual milliseconds per wall-clock millisecond, 1 unless accelerated.
+ */
+uint32_t Active_time_scale(void);
+
+/**
+ * @brief Get virtual time since kernel start (ISR-safe).
+ *
+ * Virtual time advances at the time scale and is continuous across scale changes.
+ *
+ * @return Virtual time (ms), wraps after 2^32 ms.
+ */
+uint32_t Active_time_ms(void);
+
+/**
+ * @brief Convert DWT cycle count between two timestamps to virtual seconds (ISR-safe).
+ *
+ * @param cycles CPU cycles elapsed.
+ *
+ * @return Virtual time elapsed (s).
  */
-void TimeEvent_disarm(TimeEvent *const time_evt);
+float Active_cycles_to_s(uint32_t cycles);
 
 #endif
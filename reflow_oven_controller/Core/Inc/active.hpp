@@ -0,0 +1,354 @@
+/**
+ * @file active.hpp
+ * @author Timothy Nguyen
+ * @brief Typed C++ layer over the active object framework, header-only.
+ * @version 0.1
+ * @date 2021-09-20
+ *
+ * Optional, for modules written in C++ (C++17). Active objects and events remain those of
+ * active.h, so C++ and C active objects post to each other, subscribe to the same published
+ * signals and share the event pools, registry, statistics and "ao" commands.
+ *
+ * Events are types carrying their signal:
+ *
+ *      struct HeatEvt : active::EventOf<HEAT_SIG>
+ *      {
+ *          float setpoint;
+ *      };
+ *      using StopSig = active::SignalOf<STOP_SIG>; // No payload, eg. static or time events.
+ *
+ * An active object derives from ActiveObject, naming the events it handles, and defines one
+ * on() overload per event:
+ *
+ *      class Oven : public active::ActiveObject<Oven, OVEN_MSG_COUNT, OVEN_STACK_SZ,
+ *                                               active::InitSig, HeatEvt, StopSig>
+ *      {
+ *      public:
+ *          void on(active::InitSig);
+ *          void on(HeatEvt const &evt);
+ *          void on(StopSig);
+ *      };
+ *      static Oven oven;
+ *
+ *      oven.ctor();
+ *      oven.start(PRIO_REFLOW, "oven");
+ *      HeatEvt *evt = active::Event_make<HeatEvt>();
+ *      evt->setpoint = 150.0f;
+ *      oven.post(*evt);
+ *
+ * Dispatch is resolved at compile time: the signals of the event list build a constexpr
+ * table of handler thunks, indexed by signal, so an event costs a bounds check and one
+ * indirect call, and no handler casts its event. A missing on() overload, a duplicate or
+ * negative signal, or posting an event the active object does not list fails to compile.
+ * Signals not listed, eg. posted by C code, go to on_unhandled(), which Derived may hide.
+ *
+ * Queue storage, the thread control block and the stack are members sized by template
+ * parameters, so nothing comes from the FreeRTOS heap. Define the active object in SRAM2_BSS
+ * (sections.h) to keep its stack away from DMA traffic like C active objects do.
+ *
+ * Notes:
+ * - Construct with ctor() from the module's init function, not from a C++ constructor, as
+ *   registration with Active_ctor() must follow Active_init().
+ * - Pool events are recycled without running destructors, so event types must be trivially
+ *   destructible.
+ * - active() gives the C base object for the rest of active.h, eg. Active_subscribe() or
+ *   TimeEvent_ctor().
+ */
+
+#ifndef _ACTIVE_HPP_
+#define _ACTIVE_HPP_
+
+#include <array>
+#include <new>
+#include <type_traits>
+
+extern "C"
+{
+#include "active.h"
+}
+
+namespace active
+{
+
+/**
+ * @brief Event type with payload, derive from it and add fields.
+ *
+ * @tparam S Signal of the event.
+ */
+template <Signal S>
+struct EventOf : Event
+{
+    static constexpr Signal signal = S;
+
+    EventOf() : Event{S, 0U, 0U} {}
+};
+
+/**
+ * @brief Event without payload, handled by value. Also stands for C events of the signal
+ *        whose payload is not needed, eg. time events.
+ *
+ * @tparam S Signal of the event.
+ */
+template <Signal S>
+struct SignalOf
+{
+    static constexpr Signal signal = S;
+};
+
+/* Reserved signal dispatched before the event loop starts. */
+using InitSig = SignalOf<INIT_SIG>;
+
+/**
+ * @brief Allocate typed event from smallest event pool that fits (ISR-safe), see Event_new().
+ *
+ * @tparam E Event type, derived from EventOf.
+ *
+ * @return Event with signal set and fields value-initialized, nullptr if no pool block is available.
+ */
+template <typename E>
+E *Event_make()
+{
+    static_assert(std::is_base_of_v<Event, E>, "Pool events derive from active::EventOf");
+    static_assert(std::is_trivially_destructible_v<E>, "Pool events are recycled without destruction");
+    static_assert(sizeof(E) <= EVENT_POOL_LINE_BLOCK_SZ, "Event larger than the largest pool block");
+    static_assert(alignof(E) <= 8U, "Pool blocks are 8-byte aligned");
+
+    Event *const block = Event_new(sizeof(E), E::signal);
+    if (block == nullptr)
+    {
+        return nullptr;
+    }
+    uint8_t const pool_id = block->pool_id;
+    uint8_t const ref_cnt = block->ref_cnt;
+    E *const evt = new (block) E{};
+    evt->pool_id = pool_id; // Construction reset the fields Event_new() set.
+    evt->ref_cnt = ref_cnt;
+    return evt;
+}
+
+/**
+ * @brief Post typed event to any active object, C or C++ (non-blocking, thread or ISR).
+ *
+ * @param ao Base active object.
+ * @param evt Event, derived from EventOf.
+ *
+ * @return See Active_post().
+ */
+template <typename E>
+mod_err_t post(Active *const ao, E const &evt)
+{
+    static_assert(std::is_base_of_v<Event, E>, "Only events derived from active::EventOf are posted");
+    return Active_post(ao, &evt);
+}
+
+/**
+ * @brief Active object with statically sized queue and stack, and compile-time dispatch.
+ *
+ * @tparam Derived Active object class, derived from this one (CRTP), defining on() per event.
+ * @tparam QueueDepth Number of events its queue holds.
+ * @tparam StackBytes Thread stack size (bytes), see ACTIVE_STACK_STORAGE_SZ().
+ * @tparam Events Event types handled, EventOf or SignalOf.
+ */
+template <typename Derived, uint32_t QueueDepth, uint32_t StackBytes, typename... Events>
+class ActiveObject
+{
+public:
+    /**
+     * @brief Register active object, see Active_ctor().
+     *
+     * @return See Active_ctor().
+     */
+    mod_err_t ctor()
+    {
+        static_assert(std::is_standard_layout_v<ActiveObject>, "Base object must start the active object");
+        static_assert(std::is_base_of_v<ActiveObject, Derived>, "Derived must derive from ActiveObject");
+        return Active_ctor(&base_, &ActiveObject::trampoline);
+    }
+
+    /**
+     * @brief Start thread and queue in member storage, see Active_start().
+     *
+     * @param prio Thread priority, a PRIO_ value of prio.h.
+     * @param name Name for statistics, must remain valid.
+     *
+     * @return See Active_start().
+     */
+    mod_err_t start(osPriority_t prio, const char *name)
+    {
+        osThreadAttr_t thread_attr{};
+        thread_attr.name = name;
+        thread_attr.cb_mem = &thread_cb_;
+        thread_attr.cb_size = sizeof(thread_cb_);
+        thread_attr.stack_mem = stack_;
+        thread_attr.stack_size = sizeof(stack_);
+        osMessageQueueAttr_t queue_attr{};
+        queue_attr.cb_mem = &queue_cb_;
+        queue_attr.cb_size = sizeof(queue_cb_);
+        queue_attr.mq_mem = queue_mem_;
+        queue_attr.mq_size = sizeof(queue_mem_);
+        return Active_start(&base_, prio, &thread_attr, QueueDepth, &queue_attr);
+    }
+
+    /**
+     * @brief Post event handled by this active object, see Active_post().
+     */
+    template <typename E>
+    mod_err_t post(E const &evt)
+    {
+        static_assert(handles<E>(), "Active object does not handle this event");
+        return active::post(&base_, evt);
+    }
+
+    /**
+     * @brief Post event to front of queue, see Active_postUrgent().
+     */
+    template <typename E>
+    mod_err_t post_urgent(E const &evt)
+    {
+        static_assert(handles<E>(), "Active object does not handle this event");
+        static_assert(std::is_base_of_v<Event, E>, "Only events derived from active::EventOf are posted");
+        return Active_postUrgent(&base_, &evt);
+    }
+
+    /**
+     * @brief Post event from ISR without yielding, see Active_postFromISR().
+     */
+    template <typename E>
+    mod_err_t post_from_isr(E const &evt, BaseType_t *const woken)
+    {
+        static_assert(handles<E>(), "Active object does not handle this event");
+        static_assert(std::is_base_of_v<Event, E>, "Only events derived from active::EventOf are posted");
+        return Active_postFromISR(&base_, &evt, woken);
+    }
+
+    /**
+     * @brief Queue event's signal at most once, see Active_coalesce(). Call before start().
+     */
+    template <typename E>
+    void coalesce()
+    {
+        static_assert(handles<E>(), "Active object does not handle this event");
+        Active_coalesce(&base_, E::signal);
+    }
+
+    /**
+     * @brief Drop event's signal queued longer than max_age_us, see Active_max_age().
+     */
+    template <typename E>
+    void max_age(uint32_t max_age_us)
+    {
+        static_assert(handles<E>(), "Active object does not handle this event");
+        Active_max_age(&base_, E::signal, max_age_us);
+    }
+
+    /**
+     * @brief Subscribe to published event's signal, see Active_subscribe().
+     */
+    template <typename E>
+    void subscribe() const
+    {
+        static_assert(handles<E>(), "Active object does not handle this event");
+        Active_subscribe(&base_, E::signal);
+    }
+
+    /**
+     * @brief Get C base object, for the rest of active.h.
+     */
+    Active *active()
+    {
+        return &base_;
+    }
+
+    /**
+     * @brief Check whether event type is in the event list.
+     */
+    template <typename E>
+    static constexpr bool handles()
+    {
+        return (std::is_same_v<E, Events> || ...);
+    }
+
+protected:
+    /**
+     * @brief Handle event of a signal not in the event list, hide in Derived to act on it.
+     *
+     * @param evt Event.
+     */
+    void on_unhandled(Event const *evt)
+    {
+        (void)evt;
+    }
+
+private:
+    using Thunk = void (*)(Derived &self, Event const *evt);
+
+    static_assert(sizeof...(Events) > 0, "Active object handles no event");
+    static_assert(((Events::signal >= 0) && ...), "Signals must not be negative");
+
+    static constexpr Signal max_signal()
+    {
+        Signal max = 0;
+        ((max = Events::signal > max ? Events::signal : max), ...);
+        return max;
+    }
+
+    static constexpr bool signals_unique()
+    {
+        std::array<bool, max_signal() + 1> seen{};
+        bool unique = true;
+        ((unique = unique && !seen[Events::signal], seen[Events::signal] = true), ...);
+        return unique;
+    }
+    static_assert(signals_unique(), "Two events of the list share a signal");
+
+    /* Call handler of event type E, with its typed event or, without payload, its tag. */
+    template <typename E>
+    static void thunk(Derived &self, Event const *evt)
+    {
+        if constexpr (std::is_base_of_v<Event, E>)
+        {
+            self.on(*static_cast<E const *>(evt));
+        }
+        else
+        {
+            (void)evt;
+            self.on(E{});
+        }
+    }
+
+    static constexpr std::array<Thunk, max_signal() + 1> make_table()
+    {
+        std::array<Thunk, max_signal() + 1> table{};
+        ((table[Events::signal] = &thunk<Events>), ...);
+        return table;
+    }
+
+    /* Handler thunk per signal, nullptr for signals not in the event list. */
+    static constexpr std::array<Thunk, max_signal() + 1> table_ = make_table();
+
+    /* Event handler of the C base object. */
+    static void trampoline(Active *const ao, Event const *const evt)
+    {
+        /* base_ is the first member of a standard-layout class. */
+        Derived &self = static_cast<Derived &>(*reinterpret_cast<ActiveObject *>(ao));
+        Signal const sig = evt->sig;
+        if (sig >= 0 && sig <= max_signal() && table_[sig] != nullptr)
+        {
+            table_[sig](self, evt);
+        }
+        else
+        {
+            self.on_unhandled(evt);
+        }
+    }
+
+    Active base_; // C base object, must stay first.
+    StaticTask_t thread_cb_;
+    uint64_t stack_[ACTIVE_STACK_STORAGE_SZ(StackBytes) / sizeof(uint64_t)];
+    StaticQueue_t queue_cb_;
+    Active_msg queue_mem_[QueueDepth];
+};
+
+} // namespace active
+
+#endif
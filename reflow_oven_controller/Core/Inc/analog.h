@@ -0,0 +1,80 @@
+/**
+ * @file analog.h
+ * @author Timothy Nguyen
+ * @brief Analog inputs: continuous ADC1 scan by DMA of heater current, ambient NTC, VREFINT and die temperature.
+ * @version 0.1
+ * @date 2021-09-06
+ *
+ * ADC1 converts its scan sequence continuously, each result the hardware oversampled sum
+ * of ANALOG_OVERSAMPLE conversions, and DMA1 channel 1 streams the results into a circular
+ * buffer of ANALOG_SCANS scans. No interrupt or thread runs per conversion: analog_read()
+ * averages the buffer and converts it to physical units when asked, so a reading spans
+ * the last ANALOG_SCANS scans, about half a second at an 80 MHz system clock, long enough
+ * to average heater current over most of a PWM period.
+ *
+ * Inputs:
+ * - Heater current, PC0 (A5 on Nucleo header, ADC1_IN1): a current transformer with an
+ *   RMS-to-DC converter, or a shunt amplifier, ANALOG_CURRENT_V_PER_A volts per amp above
+ *   ANALOG_CURRENT_OFFSET_V. Read as NAN unless ANALOG_CURRENT_ENABLE, an unfitted input
+ *   would otherwise read as an open heater.
+ * - Ambient NTC, PC1 (A4 on Nucleo header, ADC1_IN2): thermistor to ground with a pull-up
+ *   of ANALOG_NTC_PULLUP_OHM to VDDA, read ratiometrically with the beta equation.
+ * - VREFINT (ADC1_IN0): gives VDDA from its factory calibration, the supply all other
+ *   voltages are scaled by.
+ * - Die temperature sensor (ADC1_IN17), from its two-point factory calibration.
+ *
+ * Heater power is the measured current times ANALOG_MAINS_V, the nominal heater supply.
+ *
+ * Notes:
+ * - ADC1 is configured with registers, it is not enabled within CubeMX (no HAL ADC driver).
+ * - The ADC is clocked synchronously by HCLK / 4, so a scan takes longer while the clock
+ *   manager runs the system clock low. Readings hold their last values while the CPU is in
+ *   STOP2, reflow runs hold a stop lock.
+ */
+
+#ifndef _ANALOG_H_
+#define _ANALOG_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "common.h"
+
+/* Configuration parameters */
+#define ANALOG_CURRENT_ENABLE 0        // Heater current sensor fitted.
+#define ANALOG_CURRENT_V_PER_A 0.1f    // Current sensor output per amp (V/A).
+#define ANALOG_CURRENT_OFFSET_V 0.0f   // Current sensor output at zero current (V).
+#define ANALOG_MAINS_V 230.0f          // Nominal heater supply voltage (V RMS).
+#define ANALOG_NTC_PULLUP_OHM 10000.0f // NTC divider pull-up to VDDA (ohm).
+#define ANALOG_NTC_R25_OHM 10000.0f    // NTC resistance at 25 deg C (ohm).
+#define ANALOG_NTC_BETA 3950.0f        // NTC beta constant (K).
+#define ANALOG_OVERSAMPLE 64U          // Conversions summed by hardware per result.
+#define ANALOG_SCANS 64U               // Scans held in the DMA buffer and averaged per reading.
+
+/* Analog reading, averaged over the DMA buffer */
+typedef struct
+{
+    float current;  // Heater current (A), NAN if not fitted.
+    float power;    // Heater power at nominal supply (W), NAN if not fitted.
+    float ambient;  // Ambient NTC temperature (deg C), NAN if open or shorted.
+    float vdda;     // Analog supply voltage (V).
+    float die_temp; // MCU die temperature (deg C).
+} Analog_t;
+
+/**
+ * @brief Power up ADC1, start its continuous DMA scan and register analog commands.
+ *
+ * @return MOD_OK if successful, MOD_ERR_TIMEOUT if the ADC did not calibrate or become ready.
+ */
+mod_err_t analog_init(void);
+
+/**
+ * @brief Average latest scans and convert to physical units (any thread).
+ *
+ * Before analog_init() or the first complete scan every value is NAN.
+ *
+ * @param[out] dst Reading.
+ */
+void analog_read(Analog_t *const dst);
+
+#endif
@@ -0,0 +1,124 @@
+/**
+ * @file archive.h
+ * @author Timothy Nguyen
+ * @brief Run archive: append-only record log on external SPI NOR flash.
+ * @version 0.1
+ * @date 2021-08-28
+ *
+ * Records are appended to one of two ARCHIVE_BLOCK_SIZE RAM buffers. A full buffer is
+ * sealed and handed to the archive thread, which erases the next flash sector and programs
+ * the block page by page through SPI TX DMA, while further records go to the other buffer.
+ * archive_append() only copies into RAM and never waits on the flash: if both buffers are
+ * full, the record is dropped and counted.
+ *
+ * Each flash sector holds one block:
+ *
+ *      uint32_t magic;   // ARCHIVE_MAGIC.
+ *      uint32_t seq;     // Block sequence number, increases by one per block.
+ *      uint16_t used;    // Bytes of block in use, header included.
+ *      uint16_t crc;     // CRC-16/CCITT-FALSE of the records.
+ *      records           // uint16_t length followed by that many record bytes, repeated.
+ *
+ * The log wraps around the whole device, overwriting the oldest sector. At startup the
+ * archive thread reads every sector header and continues after the highest sequence
+ * number, so nothing is lost across resets except records not yet written.
+ *
+ * "archive dump" sends blocks as COBS frames on the console, ARCHIVE_DUMP_CHUNK bytes each,
+ * one frame per resumable command step (see cmd_async_start()), so "cmd cancel" stops it:
+ *
+ *      uint8_t  type;      // ARCHIVE_DUMP_TYPE.
+ *      uint32_t seq;       // Block sequence number.
+ *      uint16_t offset;    // Offset of data within block.
+ *      uint8_t  data[];    // Block bytes, header included.
+ *
+ * A batch label, kept with the stored parameters, tags the records of a production batch
+ * for traceability, see archive_batch().
+ *
+ * Notes:
+ * - Expects a JEDEC-compliant NOR flash with 4 Kbyte sector erase (0x20), 256 byte page
+ *   program (0x02) and 3-byte addresses, eg. W25Q128. Capacity is read from the JEDEC ID.
+ * - Without a flash device records are dropped, the controller runs as before.
+ * - Appends must come from thread context.
+ */
+
+#ifndef _ARCHIVE_H_
+#define _ARCHIVE_H_
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include "common.h"
+#include "stm32l4xx_hal.h"
+
+/* Configuration parameters */
+#define ARCHIVE_THREAD_STACK_SZ 1024U // Archive thread stack size (bytes).
+#define ARCHIVE_BLOCK_SIZE 4096U      // Block size, one flash sector (bytes).
+#define ARCHIVE_PAGE_SIZE 256U        // Flash program page size (bytes).
+#define ARCHIVE_ERASE_TIMEOUT_MS 500U // Longest sector erase (ms).
+#define ARCHIVE_CHIP_ERASE_TIMEOUT_MS 200000U // Longest chip erase (ms).
+#define ARCHIVE_PAGE_TIMEOUT_MS 10U   // Longest page transfer and program (ms).
+#define ARCHIVE_DUMP_CHUNK 240U       // Block bytes per dump frame, encoded frame fits CMD_ASYNC_CHUNK.
+#define ARCHIVE_BATCH_LEN 16U         // Batch label buffer size, including terminator.
+#define ARCHIVE_DUMP_TYPE 0x05U       // First payload byte of an archive dump frame.
+#define ARCHIVE_MAGIC 0x41524330U     // "ARC0"
+
+/* Header at the start of every block */
+typedef struct
+{
+    uint32_t magic; // ARCHIVE_MAGIC.
+    uint32_t seq;   // Block sequence number.
+    uint16_t used;  // Bytes in use, header included.
+    uint16_t crc;   // CRC-16 of records.
+} archive_hdr_t;
+
+/* Longest record accepted by archive_append(). */
+#define ARCHIVE_MAX_RECORD (ARCHIVE_BLOCK_SIZE - sizeof(archive_hdr_t) - sizeof(uint16_t))
+
+/**
+ * @brief Flash device connection.
+ */
+typedef struct
+{
+    SPI_HandleTypeDef *hspi; // SPI handle with TX DMA linked, mode 0, 8-bit.
+    GPIO_TypeDef *cs_port;   // Chip select GPIO port.
+    uint16_t cs_pin;         // Chip select GPIO pin, active low.
+} archive_cfg_t;
+
+/**
+ * @brief Start archive thread, which identifies the flash device and finds the end of the
+ *        log, and register archive commands.
+ *
+ * Call after nvs_init(). Records appended before the log end is found are dropped.
+ *
+ * @param cfg Flash device connection.
+ *
+ * @return MOD_OK if successful, otherwise a "MOD_ERR" value.
+ */
+mod_err_t archive_init(archive_cfg_t const *cfg);
+
+/**
+ * @brief Append record to the current block without waiting.
+ *
+ * @param rec Record bytes.
+ * @param len Number of bytes, at most ARCHIVE_MAX_RECORD.
+ *
+ * @return MOD_OK if record was buffered, MOD_ERR_ARG if it is too long, MOD_ERR_NOT_INIT
+ *         if no flash device is ready, MOD_ERR_BUF_OVERRUN if both buffers are full.
+ */
+mod_err_t archive_append(const void *rec, size_t len);
+
+/**
+ * @brief Seal the current block and write it in the background, eg. at the end of a run.
+ *
+ * Does nothing if the block is empty. The block is written after the one being written, if any.
+ */
+void archive_flush(void);
+
+/**
+ * @brief Get batch label tagging records of the current production batch.
+ *
+ * @return Null-terminated label, empty if unset.
+ */
+const char *archive_batch(void);
+
+#endif
@@ -0,0 +1,90 @@
+/**
+ * @file autotune.h
+ * @author Timothy Nguyen
+ * @brief Relay-feedback PID autotuner.
+ * @version 0.1
+ * @date 2021-08-14
+ *
+ *      Åström–Hägglund relay experiment: the output is switched between two levels
+ *      whenever the measurement crosses the setpoint by more than a hysteresis band,
+ *      which drives the plant into a limit cycle at its ultimate period. For relay
+ *      amplitude d and oscillation amplitude a, the ultimate gain is approximately
+ *      Ku = 4d / (pi * sqrt(a^2 - h^2)) with hysteresis h, and gains follow from
+ *      Ziegler–Nichols rules.
+ */
+
+#ifndef _AUTOTUNE_H_
+#define _AUTOTUNE_H_
+
+#include <stdint.h>
+
+#include "pid.h"
+
+/* Number of initial limit cycles discarded while the plant approaches steady oscillation. */
+#define AUTOTUNE_SETTLE_CYCLES 1U
+
+/* Autotuner status */
+typedef enum
+{
+	AUTOTUNE_RUNNING,     // Relay experiment in progress.
+	AUTOTUNE_DONE,        // Limit cycle measured, gains are valid.
+	AUTOTUNE_ERR_LIMIT,   // Measurement exceeded limit, output forced low.
+	AUTOTUNE_ERR_TIMEOUT, // No steady limit cycle within timeout.
+} Autotune_status_t;
+
+/* Autotuner configuration structure */
+typedef struct
+{
+	float setpoint;      // Relay switching point.
+	float hysteresis;    // Half-width of relay switching band, rejects measurement noise.
+	float out_high;      // Relay output while below setpoint.
+	float out_low;       // Relay output while above setpoint.
+	float limit;         // Measurement aborting experiment.
+	float timeout;       // Maximum experiment duration (s).
+	uint8_t num_cycles;  // Limit cycles averaged after settling, at least 1.
+} Autotune_cfg_t;
+
+/* Autotuner structure */
+typedef struct
+{
+	Autotune_cfg_t cfg;
+	Autotune_status_t status;
+
+	/* Relay state */
+	float out;           // Relay output.
+	float time;          // Time since start (s).
+	float last_rise;     // Time of last switch to out_high (s), negative before first one.
+	float peak_max;      // Highest measurement of current cycle.
+	float peak_min;      // Lowest measurement of current cycle.
+	uint8_t cycles;      // Completed limit cycles, including settling ones.
+
+	/* Averaged over measured cycles */
+	float sum_period;    // Sum of cycle periods (s).
+	float sum_amplitude; // Sum of cycle half peak-to-peak amplitudes.
+
+	/* Results, valid once status is AUTOTUNE_DONE */
+	float Ku;            // Ultimate gain.
+	float Tu;            // Ultimate period (s).
+	PID_gains_t gains;   // Proposed Ziegler–Nichols PID gains.
+} Autotune_t;
+
+/**
+ * @brief Start relay experiment with output high.
+ *
+ * @param at Autotuner instance.
+ * @param cfg Autotuner configuration parameters.
+ */
+void Autotune_Init(Autotune_t * const at, Autotune_cfg_t const * const cfg);
+
+/**
+ * @brief Feed measurement and advance relay experiment.
+ *
+ * @param at Autotuner instance.
+ * @param measurement Measured value, same units as setpoint.
+ * @param Ts Time since previous measurement (s).
+ * @return Autotune_status_t AUTOTUNE_RUNNING until experiment completes or fails,
+ *         relay output to apply is at->out.
+ */
+Autotune_status_t Autotune_Step(Autotune_t * const at, float measurement, float Ts);
+
+#endif
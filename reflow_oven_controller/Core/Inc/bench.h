@@ -0,0 +1,65 @@
+/**
+ * @file bench.h
+ * @author Timothy Nguyen
+ * @brief On-target micro-benchmarks of hot paths, measured with the DWT cycle counter.
+ * @version 0.1
+ * @date 2021-08-31
+ *
+ * Benchmarks run on the command thread with "bench run [name|all] [iterations]" and report
+ * minimum, average and maximum CPU cycles per iteration. Interrupts stay enabled, so the
+ * maximum includes preemption while the minimum is the undisturbed cost. "bench list" shows
+ * the benchmarks and their default number of iterations:
+ *
+ * - pid:       PID_Calculate() of a running controller.
+ * - pid_inc:   PID_Calculate() of the same controller in PID_FORM_INCREMENTAL.
+ * - filter:    Filter_Update() with median of 3, outlier rejection and alpha IIR.
+ * - biquad:    Filter_Update() with the IIR replaced by a Butterworth biquad.
+ * - printf:    snprintf_() of a float with "%.2f", formatting without console output.
+ * - log_miss:  LOGD() filtered out by the log level of its tag.
+ * - log_hit:   LOGI() passing the filter, printed on the null log sink.
+ * - tokenize:  Tokenizing a command line in place with cmd_tokenize().
+ * - ao_trip:   Active_post() to the bench active object until its handler ran, round trip.
+ * - ao_ring:   ao_trip to a second bench active object started with Active_start_ring().
+ * - tevt_arm:  TimeEvent_arm() and TimeEvent_disarm() with BENCH_NUM_TIMERS time events armed.
+ * - putc:      BENCH_TX_LEN characters with uart_putc(), UART console only.
+ * - write:     BENCH_TX_LEN characters with one uart_write(), UART console only.
+ *
+ * "bench ao [round trips] [burst]" measures the framework itself: two active objects pass
+ * events back and forth with Active_post(), burst of them in flight at once, first on message
+ * queues and then on notification rings (Active_start_ring()). Each row shows the events
+ * handled per second, post to dispatch latency and the posts refused by a full queue.
+ *
+ * Notes:
+ * - Cycles include the call through the benchmark table and two DWT reads, a few cycles.
+ * - Output benchmarks wait for the transmit buffer to drain between iterations, so the
+ *   transmit buffer never overflows and each iteration takes the same path.
+ * - ao_trip, ao_ring and "bench ao" are not available with ACTIVE_COOPERATIVE, as the bench
+ *   active objects then share the command thread.
+ * - Both round trips include the reply through thread flags, ao_trip less ao_ring is the
+ *   saving of the notification ring on post and dispatch.
+ */
+
+#ifndef _BENCH_H_
+#define _BENCH_H_
+
+#include "common.h"
+
+/* Configuration parameters */
+#define BENCH_THREAD_STACK_SZ 512U     // Bench active object stack size (bytes).
+#define BENCH_EVENT_MSG_COUNT 2U       // Maximum number of messages in event message queue.
+#define BENCH_MAX_ITERATIONS 10000U    // Largest number of iterations per benchmark.
+#define BENCH_NUM_TIMERS 8U            // Time events armed during tevt_arm.
+#define BENCH_TX_LEN 8U                // Characters written per iteration of putc and write.
+#define BENCH_TX_DRAIN_MS 50U          // Longest wait for transmit buffer to drain (ms).
+#define BENCH_REPLY_TIMEOUT_MS 10U     // Longest wait for bench active object to handle ping (ms).
+#define BENCH_PONG_TRIPS 1000U         // Default round trips of "bench ao".
+#define BENCH_PONG_MAX_BURST 4U        // Most ping-pong events in flight, taken from the small event pool.
+
+/**
+ * @brief Initialize bench module, start bench active object and register "bench" commands.
+ *
+ * @return MOD_OK if successful, otherwise a "MOD_ERR" value.
+ */
+mod_err_t bench_init(void);
+
+#endif
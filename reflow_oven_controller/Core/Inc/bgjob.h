@@ -0,0 +1,96 @@
+/**
+ * @file bgjob.h
+ * @author Timothy Nguyen
+ * @brief Background jobs: cooperative work run from the idle hook, only when no thread is ready.
+ * @version 0.1
+ * @date 2021-09-06
+ *
+ * Work that has no deadline, such as flash commits of the parameter store, is split into
+ * steps and handed to bgjob_submit(), from any thread, eg. an active object's handler. The
+ * FreeRTOS idle hook runs steps of queued jobs for at most BGJOB_SLICE_US per call, then
+ * returns to the idle task, so the CPU only works on jobs when it would otherwise be idle
+ * and every thread that becomes ready preempts them at once. Jobs take turns: a job that
+ * has more to do goes behind the other queued jobs after each step.
+ *
+ * static bgjob_status_t foo_step(void *arg);  // One bounded piece of work.
+ * static bgjob_t foo_job = {.name = "foo", .step = foo_step};
+ *
+ * bgjob_submit(&foo_job);                     // Again while queued: runs at least once more.
+ *
+ * Notes:
+ * - Steps run on the idle task and must never block, not even with a timeout: take mutexes
+ *   with a zero timeout and return BGJOB_MORE to be retried if they are held.
+ * - A step should take well below BGJOB_SLICE_US, the slice is only checked between steps.
+ * - The idle task does not sleep while a job is queued, see power.h.
+ * - Steps use the idle task stack of BGJOB_IDLE_STACK_SZ.
+ */
+
+#ifndef _BGJOB_H_
+#define _BGJOB_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "common.h"
+
+/* Configuration parameters */
+#define BGJOB_SLICE_US 1000U     // Longest run of steps per idle hook call (us).
+#define BGJOB_IDLE_STACK_SZ 1024U // Idle task stack size (bytes).
+
+/* Step result */
+typedef enum
+{
+    BGJOB_DONE, // Job finished, it is dequeued.
+    BGJOB_MORE, // Job has more to do or waits for a resource, it is run again.
+} bgjob_status_t;
+
+typedef struct bgjob bgjob_t;
+
+/* Step function, does one bounded piece of work */
+typedef bgjob_status_t (*bgjob_step_t)(void *arg);
+
+/* Background job, owned by its submitter */
+struct bgjob
+{
+    const char *name;     // Job name.
+    bgjob_step_t step;    // Step function.
+    void *arg;            // Argument of step.
+
+    bgjob_t *next;        // Next queued job, private to the scheduler.
+    volatile bool queued; // Submitted and not done yet.
+    volatile bool rerun;  // Submitted again since its step started.
+};
+
+/**
+ * @brief Register background job measurements.
+ *
+ * Jobs may be submitted before, they run once the scheduler starts.
+ *
+ * @return MOD_OK if successful, otherwise a "MOD_ERR" value.
+ */
+mod_err_t bgjob_init(void);
+
+/**
+ * @brief Queue job, run from the idle hook until its step returns BGJOB_DONE.
+ *
+ * @param job Job, untouched by the caller until done.
+ *
+ * @return MOD_OK if queued, MOD_DID_NOTHING if it is queued already. It then runs another
+ *         step even if the current one returns BGJOB_DONE, so work handed to the job just
+ *         before it finishes is not left behind.
+ */
+mod_err_t bgjob_submit(bgjob_t *job);
+
+/**
+ * @brief Check whether any job is queued.
+ */
+bool bgjob_pending(void);
+
+/**
+ * @brief Check whether the caller runs on the idle task, ie. within a job step.
+ *
+ * @return true if the caller must not block.
+ */
+bool bgjob_in_idle(void);
+
+#endif
@@ -0,0 +1,84 @@
+/**
+ * @file board.h
+ * @author Timothy Nguyen
+ * @brief Board temperature observer: two-node thermal model of an assembly heated by oven air.
+ * @version 0.1
+ * @date 2021-09-06
+ *
+ *      Solder joints lag the air thermocouple by the time the board takes to soak up heat.
+ *      The observer models the assembly as two lumped nodes in series, the surface
+ *      exchanging heat with the air and the joints with the surface:
+ *
+ *          d surface / dt = (air - surface) / tau_surface
+ *          d joint / dt = (surface - joint) / tau_joint
+ *
+ *      Both are stepped exactly for a zero-order-hold air temperature, a = e^(-Ts / tau),
+ *      so any sample time is stable. A board mass class is a pair of time constants,
+ *      heavier boards having longer ones.
+ *
+ *      Without a board probe the observer runs open loop on the model. With one, eg. a
+ *      thermocouple taped to a sacrificial board of the same class, every sample pulls
+ *      both nodes towards the probe reading by gain, which corrects a class that does
+ *      not quite fit the board while the estimate stays smoother than the probe.
+ */
+
+#ifndef _BOARD_H_
+#define _BOARD_H_
+
+#include <stdbool.h>
+
+/* Board mass class, thermal time constants of its nodes */
+typedef struct
+{
+	float tau_surface; // Air to surface time constant (s), positive.
+	float tau_joint;   // Surface to joint time constant (s), positive.
+} Board_class_t;
+
+/* Board temperature observer */
+typedef struct
+{
+	Board_class_t cls; // Mass class.
+	float gain;        // Probe correction gain per sample, 0 to 1.
+	bool primed;       // Nodes were initialized from the air temperature.
+	float surface;     // Surface temperature estimate (deg C).
+	float joint;       // Joint temperature estimate (deg C).
+} Board_t;
+
+/**
+ * @brief Initialize observer, nodes are primed by the next air temperature.
+ *
+ * @param obs Observer.
+ * @param cls Mass class with positive time constants.
+ * @param gain Probe correction gain per sample, 0 to 1.
+ */
+void Board_Init(Board_t * const obs, Board_class_t const * const cls, float gain);
+
+/**
+ * @brief Forget estimate, board is taken to be at the next air temperature.
+ *
+ * @param obs Observer.
+ */
+void Board_Reset(Board_t * const obs);
+
+/**
+ * @brief Advance model over sample time with the air temperature held.
+ *
+ * @param obs Observer.
+ * @param air Oven air temperature (deg C).
+ * @param Ts Time since previous update (s).
+ *
+ * @return Joint temperature estimate (deg C).
+ */
+float Board_Update(Board_t * const obs, float air, float Ts);
+
+/**
+ * @brief Correct estimate with a board probe reading taken at the last update.
+ *
+ * @param obs Observer.
+ * @param probe Board probe temperature (deg C).
+ *
+ * @return Joint temperature estimate (deg C).
+ */
+float Board_Correct(Board_t * const obs, float probe);
+
+#endif
@@ -0,0 +1,157 @@
+/**
+ * @file can.h
+ * @author Timothy Nguyen
+ * @brief CAN node: periodic status frames, alarms, commands and time base sync for multi-oven networks.
+ * @version 0.1
+ * @date 2021-09-06
+ *
+ * The oven is node "can.node" on a CAN bus at CAN_BITRATE. Every "can.period_ms" it sends
+ * its status and zone temperatures from the status snapshot of "reflow status bin", and an
+ * alarm frame whenever its trip or thermocouple error state changes. A supervisor commands
+ * ovens and aligns their time bases with a sync frame. Identifiers are 11-bit, a function
+ * base plus the node, so frames of one oven keep their bus priority relative to another's:
+ *
+ * | ID            | Dir | Payload, little-endian                                             |
+ * |---------------|-----|--------------------------------------------------------------------|
+ * | 0x080         | in  | SYNC: u32 supervisor time (ms).                                    |
+ * | 0x080 + node  | out | ALARM: u8 safety_reason_t, u8 MAX31855K_err_t, u8 state, u32 time. |
+ * | 0x180 + node  | out | STATUS: u8 state, u8 flags, i16 setpoint, i16 temp, u16 time.      |
+ * | 0x280 + node  | out | ZONES: i16 zone temperatures, one per REFLOW_MAX_ZONES.            |
+ * | 0x580 + node  | out | RESPONSE: u8 op, u8 can_result_t, u16 param ID, u32 value.         |
+ * | 0x600 + node  | in  | COMMAND: u8 can_op_t, u16 param ID, u32 value. Node 0 for all.     |
+ *
+ * - Temperatures are tenths of a deg C, CAN_NAN if not read. State is the Reflow_State.
+ * - STATUS flags: bit 0 running, bit 1 safety tripped, bit 2 thermocouple error,
+ *   bits 4 to 7 profile segment.
+ * - Times are the synchronized time base (can_time()), STATUS carries its low 16 bits.
+ * - Broadcast commands (node 0) are executed without response.
+ *
+ * Time sync: a SYNC frame sets the offset of the synchronized time base from the kernel
+ * tick count to the supervisor time it carries, taken at its reception interrupt. The
+ * supervisor sends SYNC at the lowest ID, so it wins arbitration and arrives within a frame
+ * time of being queued. Until the first SYNC the time base is the kernel tick count.
+ *
+ * The port accepts only SYNC and its own and broadcast COMMAND identifiers in hardware,
+ * other traffic on the bus costs no CPU time. Commands are executed by the command active
+ * object (CMD_CAN_SIG), parameters being written by the command thread only.
+ *
+ * "can status" shows counters and the time base, "can rx <id> <hex bytes>" handles a frame
+ * as if received.
+ */
+
+#ifndef _CAN_H_
+#define _CAN_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "common.h"
+#include "active.h"
+
+/* Configuration parameters */
+#ifndef CAN_ENABLE
+#define CAN_ENABLE 0 // Set to 1 for the node on CAN1 and PB8/PB9, it keeps the CPU out of STOP2 (see power.h).
+#endif
+#define CAN_NODE 1U             // Default node ID, "can.node", 1 to 127.
+#define CAN_OVEN 0U             // Oven the node reports and commands, see reflow_init().
+#define CAN_PERIOD_MS 500U      // Default status period, "can.period_ms".
+#define CAN_PERIOD_MIN_MS 50U   // Shortest status period settable.
+#define CAN_PERIOD_MAX_MS 10000U // Longest status period settable.
+#define CAN_BITRATE 500000U     // Bus bit rate (bit/s).
+#define CAN_NAN ((int16_t)INT16_MIN) // Temperature not read.
+
+/* Function bases of identifiers */
+#define CAN_ID_SYNC 0x080U
+#define CAN_ID_ALARM 0x080U
+#define CAN_ID_STATUS 0x180U
+#define CAN_ID_ZONES 0x280U
+#define CAN_ID_RESPONSE 0x580U
+#define CAN_ID_COMMAND 0x600U
+
+/* Command operations */
+typedef enum
+{
+    CAN_OP_START = 1,     // Start loaded profile, as "reflow start".
+    CAN_OP_STOP = 2,      // Stop running process, as "reflow stop".
+    CAN_OP_PARAM_GET = 3, // Read parameter by ID.
+    CAN_OP_PARAM_SET = 4, // Set parameter by ID, range checked and persisted as "param set".
+} can_op_t;
+
+/* Command results */
+typedef enum
+{
+    CAN_OK,           // Executed.
+    CAN_ERR_OP,       // Unknown operation or short frame.
+    CAN_ERR_PARAM,    // No parameter with ID.
+    CAN_ERR_RANGE,    // Value out of range.
+    CAN_ERR_FAILED,   // Event queue full or store failed.
+} can_result_t;
+
+/* Frame */
+typedef struct
+{
+    uint16_t id;     // Standard identifier.
+    uint8_t len;     // Data length (bytes), at most 8.
+    uint8_t data[8]; // Data.
+} can_frame_t;
+
+/* Command frame event posted to the command active object with CMD_CAN_SIG */
+typedef struct
+{
+    Event base;        // Inherit base event class.
+    can_frame_t frame; // Command frame.
+} Can_Event;
+
+/**
+ * @brief Start status timer and CAN port at the persisted node ID, register CAN commands.
+ *
+ * Call from a thread once parameters are loaded and the command active object runs.
+ *
+ * @return MOD_OK if successful, otherwise a "MOD_ERR" value.
+ */
+mod_err_t can_init(void);
+
+/**
+ * @brief Handle received frame, SYNC in place, commands posted (ISR-safe).
+ *
+ * @param frame Received frame.
+ */
+void can_receive(can_frame_t const *const frame);
+
+/**
+ * @brief Execute command and send response (command thread).
+ *
+ * @param evt Command frame event.
+ */
+void can_execute(Can_Event const *const evt);
+
+/**
+ * @brief Get synchronized time base (ms), the kernel tick count until the first SYNC (any context).
+ */
+uint32_t can_time(void);
+
+/**
+ * @brief Configure CAN1 at CAN_BITRATE and accept frames for node (firmware only).
+ *
+ * CAN1_RX on PB8 and CAN1_TX on PB9 (AF9), to a transceiver. Received frames are passed to
+ * can_receive() from the FIFO 0 interrupt.
+ *
+ * @param node Node ID, its COMMAND identifier is accepted with SYNC and broadcasts.
+ *
+ * @return MOD_OK if successful, MOD_ERR_TIMEOUT if CAN1 did not enter or leave initialization.
+ */
+mod_err_t can_port_init(uint8_t node);
+
+/**
+ * @brief Change node ID whose COMMAND identifier is accepted (thread context).
+ */
+void can_port_filter(uint8_t node);
+
+/**
+ * @brief Queue frame in a free transmit mailbox (thread context).
+ *
+ * @return MOD_OK if queued, MOD_ERR_BUF_OVERRUN if every mailbox is pending.
+ */
+mod_err_t can_port_send(can_frame_t const *const frame);
+
+#endif
@@ -0,0 +1,95 @@
+/**
+ * @file clock.h
+ * @author Timothy Nguyen
+ * @brief Clock manager: low system clock while idle, full speed while heaters are controlled.
+ * @version 0.1
+ * @date 2021-08-22
+ *
+ * Two operating points:
+ * - CLOCK_LOW: SYSCLK from HSI16, voltage range 2, 2 flash wait states.
+ * - CLOCK_HIGH: SYSCLK from PLL at 80 MHz, voltage range 1, 4 flash wait states
+ *   (SystemClock_Config()).
+ *
+ * The high point is used while at least one module holds a boost, the reflow active object
+ * does so while running a profile or autotune, so the clock is low whenever it is in its
+ * reset state. On every transition the clock manager waits for the console to finish
+ * transmitting and for the configured SPIs to be idle, then switches with interrupts
+ * masked and rescales, relative to the bus clock, the baud rate register of the configured
+ * UARTs, the baud rate prescaler of the configured SPIs and the prescaler of the configured
+ * timers, the bit rate prescaler of the configured CAN, as well as the SysTick reload and
+ * the HAL tick timer (TIM7).
+ *
+ * Notes:
+ * - APB1 and APB2 run at HCLK in both operating points, peripherals on either bus are scaled.
+ * - SPI baud rates never increase: the closest baud rate at or below the original is used.
+ * - The prescaler of a running timer takes effect at its next update event.
+ * - CAN leaves the bus for initialization after the frame in progress, then resynchronizes
+ *   on 11 recessive bits. Its bit time must be a whole number of bus clocks at both points.
+ * - Cycle counts (DWT) measured across a transition mix both clock rates.
+ */
+
+#ifndef _CLOCK_H_
+#define _CLOCK_H_
+
+#include <stdint.h>
+
+#include "common.h"
+#include "stm32l4xx_hal.h"
+
+/* Configuration parameters */
+#define CLOCK_MAX_PERIPHS 4U    // Maximum number of UARTs, SPIs and timers each.
+#define CLOCK_TX_DRAIN_MS 200U  // Longest wait for console transmission and SPIs before switching.
+#define CLOCK_CAN_INIT_SPINS 20000U // Longest poll for CAN to finish a frame and enter initialization.
+
+/**
+ * @brief Operating points.
+ */
+typedef enum
+{
+    CLOCK_LOW,  // 16 MHz HSI16, voltage range 2.
+    CLOCK_HIGH, // 80 MHz PLL, voltage range 1.
+} clock_mode_t;
+
+/**
+ * @brief Peripherals whose timing is kept across transitions, unused entries are NULL.
+ */
+typedef struct
+{
+    USART_TypeDef *uarts[CLOCK_MAX_PERIPHS];    // UARTs, baud rate register is rescaled.
+    SPI_HandleTypeDef *spis[CLOCK_MAX_PERIPHS]; // SPIs, baud rate prescaler is rescaled.
+    TIM_HandleTypeDef *tims[CLOCK_MAX_PERIPHS]; // Timers, prescaler is rescaled.
+    CAN_TypeDef *can;                           // CAN, bit rate prescaler is rescaled.
+} clock_cfg_t;
+
+/**
+ * @brief Register clock commands and drop to CLOCK_LOW.
+ *
+ * Must be called after peripherals were configured by SystemClock_Config() and MX_*_Init(),
+ * from a thread.
+ *
+ * @param cfg Peripherals to rescale.
+ *
+ * @return MOD_OK if successful, otherwise a "MOD_ERR" value.
+ */
+mod_err_t clock_init(clock_cfg_t const *cfg);
+
+/**
+ * @brief Request CLOCK_HIGH, nesting. Switches before returning if clock was low.
+ *
+ * @note Blocks for at most CLOCK_TX_DRAIN_MS, not callable from ISRs.
+ */
+void clock_boost_acquire(void);
+
+/**
+ * @brief Release boost taken with clock_boost_acquire(), clock drops to CLOCK_LOW with the last one.
+ */
+void clock_boost_release(void);
+
+/**
+ * @brief Get current operating point.
+ *
+ * @return Current operating point.
+ */
+clock_mode_t clock_mode_get(void);
+
+#endif
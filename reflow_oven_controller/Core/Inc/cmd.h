@@ -5,7 +5,34 @@
  * @version 0.1
  * @date 2021-07-16
  * 
- * Clients that wish to have commands invoked from user should register their callback functions here.
+ * Clients that wish to have commands invoked from user define their callback functions with
+ * CMD_CLIENT_DEFINE(). The linker collects client descriptors into the cmd_clients section
+ * sorted by name (see the .cmd_clients output section of the linker scripts), so clients are
+ * found by binary search of a table in flash and nothing is registered at boot.
+ *
+ * In JSON mode ("cmd mode json") every command line produces one record:
+ *
+ *      {"id":7,"status":0,"rc":0,"data":{"temp":25.5},"text":"..."}
+ *
+ * id is taken from an optional leading "#<id>" token, else counted per line. status is the
+ * "MOD_ERR" value of dispatch, rc the command callback return value. data holds fields written
+ * with cmd_out_*() and text the printed output of the command.
+ *
+ * Hosts may also send binary requests as frames (see frame.h) on the same serial line. The
+ * console switches to a frame on its leading delimiter byte, which text never contains.
+ * Payloads are little-endian:
+ *
+ *      Request:  u8 CMD_RPC_REQ, u16 id, u8 argc, argc * arg
+ *      Response: u8 CMD_RPC_RSP, u16 id, u8 status, u8 flags, i32 rc, u8 num_fields,
+ *                num_fields * field, u16 text_len, text
+ *
+ * An arg is a type byte followed by its value: 's' u8 len + chars, 'u' u32, 'i' i32 or 'f' float,
+ * or 'b' u8 len + bytes, which becomes a hex token, so binary data such as firmware images
+ * (see fwup.h) travels at full density. Args are the tokens of the equivalent command line,
+ * so every client command, help and pm are reachable. A field is a type byte, u8 key_len,
+ * key and a value of the same encoding, plus 'q' u64. flags has bit 0 set if rc is valid and
+ * bit 1 if fields or text were truncated. Frames with a bad CRC or layout are dropped without
+ * response.
  */
 
 #ifndef _CMD_H_
@@ -14,13 +41,18 @@
 #include "common.h"
 #include "cmd.h"
 #include "active.h"
+#include "console.h"
 
 /* Configuration parameters */
-#define CMD_MAX_CLIENTS 10 // Maximum number of clients/modules using the command module.
-#define CMD_MAX_TOKENS 10  // Maximum number of command tokens.
+#define CMD_MAX_TOKENS 64  // Maximum number of command tokens, enough for a whole reflow profile.
+#define CMD_MAX_COMMANDS 224 // Maximum number of client commands in dispatch table, every oven adds its reflow and tc commands.
+#define CMD_JSON_TEXT_SIZE 1024 // Printed output kept per command line in JSON mode.
+#define CMD_JSON_DATA_SIZE 512  // Structured fields kept per command line in JSON mode.
 
 #define CMD_THREAD_SIZE 1024  // Command active object thread size.
 #define CMD_EVENT_MSG_COUNT 5 // Maximum number of messages in event message queue.
+#define CMD_ASYNC_CHUNK 256U       // Most characters a resumable command step writes, see cmd_async_start().
+#define CMD_ASYNC_RETRY_MS 1U      // Poll period of transmit buffer while it has less than CMD_ASYNC_CHUNK free.
 
 /* Function signature for a command handler function. */
 typedef uint32_t (*cmd_cb_t)(uint32_t argc, const char **argv);
@@ -33,6 +65,53 @@ typedef struct
     const char *const help;     // Command help string
 } cmd_cmd_info;
 
+/* Performance measurement types */
+typedef enum
+{
+    CMD_PM_U32,    // uint32_t counter, increment with INC_SAT_U32().
+    CMD_PM_U64,    // uint64_t counter, increment with cmd_pm_add_u64().
+    CMD_PM_GAUGE,  // int32_t current value, written directly and never cleared.
+    CMD_PM_MINMAX, // cmd_pm_minmax_t of recorded values, record with cmd_pm_record().
+    CMD_PM_HIST,   // cmd_pm_hist_t of recorded values, record with cmd_pm_record_hist().
+} cmd_pm_type_t;
+
+/* Minimum, maximum and mean of recorded values, all zero until first value is recorded. */
+typedef struct
+{
+    uint32_t min;   // Smallest recorded value.
+    uint32_t max;   // Largest recorded value.
+    uint32_t count; // Number of recorded values.
+    uint64_t sum;   // Sum of recorded values.
+} cmd_pm_minmax_t;
+
+/* Log-linear histogram resolution, each power of two is split into 2^CMD_PM_HIST_SUB_BITS buckets. */
+#define CMD_PM_HIST_SUB_BITS 2U
+#define CMD_PM_HIST_SUB (1U << CMD_PM_HIST_SUB_BITS)
+#define CMD_PM_HIST_BUCKETS ((33U - CMD_PM_HIST_SUB_BITS) * CMD_PM_HIST_SUB) // Covers every uint32_t value.
+
+/**
+ * @brief Log-linear histogram of recorded values, e.g. latencies.
+ *
+ *      Values below CMD_PM_HIST_SUB have a bucket each. Larger values are bucketed by
+ *      their highest set bit and the CMD_PM_HIST_SUB_BITS bits below it, so a bucket
+ *      spans at most 1 / CMD_PM_HIST_SUB of its values (25% by default). Percentiles
+ *      are reported as the upper bound of the bucket holding them, the maximum is exact.
+ */
+typedef struct
+{
+    uint32_t count;                        // Number of recorded values.
+    uint32_t max;                          // Largest recorded value.
+    uint32_t buckets[CMD_PM_HIST_BUCKETS]; // Number of recorded values per bucket.
+} cmd_pm_hist_t;
+
+/* Information about a single performance measurement, provided by the client */
+typedef struct
+{
+    const char *const name;   // Measurement name.
+    const cmd_pm_type_t type; // Measurement type.
+    void *const val;          // Measurement storage of type's C type.
+} cmd_pm_info;
+
 /* Information about the client. */
 typedef struct
 {
@@ -42,23 +121,81 @@ typedef struct
     const uint32_t num_u16_pms;            // Number of performance measurement values.
     uint16_t *const u16_pms;               // Performance measurement values.
     const char *const *const u16_pm_names; // Performance measurement names.
+    const uint32_t num_pms;                // Number of typed performance measurements.
+    const cmd_pm_info *const pms;          // Typed performance measurements.
+    void *const ctx;                       // Instance the commands act on, see cmd_ctx().
 } cmd_client_info;
 
+/* Bounds of cmd_clients section, set by the linker. */
+extern const cmd_client_info __start_cmd_clients[];
+extern const cmd_client_info __stop_cmd_clients[];
+
+/**
+ * @brief Define command client cmd_client_<name>, its client name is name.
+ *
+ * @param name Client name, a lower case identifier, so sorting by section name sorts by client name.
+ * @param ... Designated initializers of the remaining cmd_client_info fields.
+ */
+#define CMD_CLIENT_DEFINE(name, ...)                                                                   \
+    static const cmd_client_info cmd_client_##name                                                   \
+        __attribute__((used, section("cmd_clients." #name), aligned(__alignof__(cmd_client_info)))) = { \
+            .client_name = #name, __VA_ARGS__}
+
+/* Command response modes */
+typedef enum
+{
+    CMD_MODE_TEXT, // Human-readable output.
+    CMD_MODE_JSON,   // One JSON record per command line.
+    CMD_MODE_BINARY, // Binary request frame being executed.
+} cmd_mode_t;
+
+/* Binary protocol message types, first payload byte of a frame. */
+#define CMD_RPC_REQ 0x10U // Command request from host.
+#define CMD_RPC_RSP 0x11U // Command response to host.
+
+#define CMD_RPC_TEXT_SIZE 256U    // Printed output kept per binary request.
+#define CMD_RPC_PAYLOAD_SIZE 800U // Largest response payload, must fit UART transmit buffer once encoded.
+#define CMD_RPC_TX_TIMEOUT_MS 100 // Longest wait for transmit buffer space before a response is dropped.
+
 /* Command event signals */
 enum cmd_signals
 {
     CMD_RX_SIG = USER_SIG, // Command received from user over serial.
+    CMD_RPC_SIG,           // Encoded binary request frame received over serial.
+    CMD_RESUME_SIG,        // Run next step of resumable command.
+    CMD_MODBUS_SIG,        // Modbus request frame received, a Modbus_Event (see modbus.h).
+    CMD_CAN_SIG,           // CAN command frame received, a Can_Event (see can.h).
 };
 
-/* Derived command event class */
+/* Resumable command step result */
+typedef enum
+{
+    CMD_ASYNC_DONE, // Command finished.
+    CMD_ASYNC_MORE, // Command has more output, step is called again.
+} cmd_async_status_t;
+
+/**
+ * @brief Step of resumable command, writes at most CMD_ASYNC_CHUNK characters.
+ *
+ * @param ctx Context given to cmd_async_start().
+ * @param cancel Set once on "cmd cancel", the step then cleans up and returns CMD_ASYNC_DONE.
+ */
+typedef cmd_async_status_t (*cmd_async_step_t)(void *ctx, bool cancel);
+
+/* Derived command event class, allocated from event pool per command line.
+ * Only the line and its terminator are allocated, see CMD_EVENT_SIZE(). */
 typedef struct
 {
     Event base; // Inherit base event class.
 
     /* Private attributes */
-    char *cmd_line; // Pointer to command string.
+    uint8_t session; // Console session the line came from, receives the output (console_session_t).
+    char cmd_line[]; // Command string, tokenized in place by command module, or encoded frame for CMD_RPC_SIG.
 } Cmd_Event;
 
+/* Size of command event holding a line of len characters. */
+#define CMD_EVENT_SIZE(len) (offsetof(Cmd_Event, cmd_line) + (len) + 1U)
+
 /* Argument representations */
 typedef struct
 {
@@ -71,10 +208,18 @@ typedef struct
         uint32_t *p32;
         int32_t i;
         uint32_t u;
+        float f;
         const char *s;
     } val;
 } cmd_arg_val;
 
+/* Key/value argument specification for cmd_parse_kv() */
+typedef struct
+{
+    const char *key; // Key name, matched case insensitively.
+    char type;       // Value type, a cmd_parse_args() format letter.
+} cmd_kv_spec;
+
 /**
  * @brief Base active class attribute of command active object.
  *
@@ -98,16 +243,106 @@ mod_err_t cmd_init(void);
  */
 mod_err_t cmd_start(void);
 
-/** 
- * @brief Register a client.
+/**
+ * @brief Get command response mode.
  *
- * @param _client_info The client's configuration (eg. command metadata).
+ * Command handlers may skip human-readable decoration in JSON mode. Reads CMD_MODE_BINARY
+ * while a binary request is executed, whatever mode was set.
+ */
+cmd_mode_t cmd_get_mode(void);
+
+/**
+ * @brief Get instance of client whose command handler runs, call from command handler only.
  *
- * @return MOD_OK for success, else a "MOD_ERR" value.
- * 
- * @note cmd_client_info should be declared static since module stores a copy of the pointer.
+ * Clients of one module sharing a command table, eg. one per controller instance, set ctx
+ * in CMD_CLIENT_DEFINE() and their handlers act on the instance returned here.
+ *
+ * @return ctx of client, NULL if it has none.
+ */
+void *cmd_ctx(void);
+
+/**
+ * @brief Continue command in steps between other command lines, call from command handler only.
+ *
+ * Commands with a lot of output, eg. a run history dump, return from their handler after
+ * starting and are resumed by the command thread one step at a time, each time the console
+ * transmit buffer has CMD_ASYNC_CHUNK characters free. Lines received meanwhile are executed
+ * between steps, so the console stays responsive, and "cmd cancel" stops the command.
+ *
+ * In JSON and binary modes the response record follows all output of its command: output
+ * of the steps is captured like that of the handler, and the record is sent after the last
+ * step. Lines and frames received meanwhile are deferred, up to ACTIVE_DEFER_DEPTH, and
+ * executed once the command finished, further ones are answered with MOD_ERR_RESOURCE. Such
+ * a command is therefore not cancelled by "cmd cancel".
+ *
+ * @param step Step function, first called once the handler returned.
+ * @param ctx Context passed to step, must stay valid until the command finished.
+ *
+ * @return MOD_OK if started, MOD_ERR_RESOURCE if another resumable command runs (a message
+ *         is printed).
+ */
+mod_err_t cmd_async_start(cmd_async_step_t step, void *ctx);
+
+/**
+ * @brief Split command line into whitespace separated tokens, terminating them in place.
+ *
+ * @param[in/out] line Command line, modified.
+ * @param[out] tokens Array of CMD_MAX_TOKENS token pointers into line.
+ * @param[out] num_tokens Number of tokens gathered.
+ *
+ * @return MOD_OK if successful, MOD_ERR_BAD_CMD if line has more than CMD_MAX_TOKENS tokens.
+ *
+ * Same tokenizer as used on received command lines, for benchmarks.
+ */
+mod_err_t cmd_tokenize(char *line, const char **tokens, uint32_t *num_tokens);
+
+/**
+ * @brief Output structured field of command response, call from command handler only.
+ *
+ * Printed as "key: value" line in text mode, added to record's data object in JSON mode.
+ * Fields that do not fit in CMD_JSON_DATA_SIZE are dropped and the record marked truncated.
+ *
+ * @param key Field name, printed verbatim.
+ * @param val Field value.
+ */
+void cmd_out_u32(const char *key, uint32_t val);
+void cmd_out_i32(const char *key, int32_t val);
+void cmd_out_float(const char *key, float val); // Non-finite values are null in JSON mode.
+void cmd_out_str(const char *key, const char *val);
+
+/**
+ * @brief Add to 64-bit performance counter (ISR-safe).
+ *
+ * @param pm Counter.
+ * @param n Amount to add.
  */
-mod_err_t cmd_register(const cmd_client_info *_client_info);
+void cmd_pm_add_u64(uint64_t *pm, uint32_t n);
+
+/**
+ * @brief Record value in minimum/maximum performance measurement (ISR-safe).
+ *
+ * @param pm Measurement.
+ * @param val Recorded value.
+ */
+void cmd_pm_record(cmd_pm_minmax_t *pm, uint32_t val);
+
+/**
+ * @brief Record value in histogram performance measurement (ISR-safe).
+ *
+ * @param pm Histogram.
+ * @param val Recorded value.
+ */
+void cmd_pm_record_hist(cmd_pm_hist_t *pm, uint32_t val);
+
+/**
+ * @brief Find percentile of histogram.
+ *
+ * @param hist Histogram.
+ * @param pct Percentile (1 to 100).
+ *
+ * @return Upper bound of bucket holding percentile, at most the maximum value. 0 if histogram is empty.
+ */
+uint32_t cmd_pm_hist_percentile(const cmd_pm_hist_t *hist, uint32_t pct);
 
 /**
  * @brief Parse and validate command arguments
@@ -117,7 +352,7 @@ mod_err_t cmd_register(const cmd_client_info *_client_info);
  * @param[in]  fmt String indicating expected argument types
  * @param[out] arg_vals Pointer to array of parsed argument values
  *
- * @return Number of parsed arguments, negative value if error.
+ * @return Number of parsed arguments, negative "MOD_ERR" value if error.
  *
  * @note In case of error, an error message is always printed to the
  * console.
@@ -133,6 +368,7 @@ mod_err_t cmd_register(const cmd_client_info *_client_info);
  * - u Unsigned value, in either decimal, octal, or hex formats. Octal values
  *     must start with 0, and hex values must start with 0x.
  * - p Pointer, in hex format. No leading 0x is necessary (but allowed).
+ * - f Float, in decimal or exponent format. Non-finite values are rejected.
  * - s String
  *
  * In addition:
@@ -152,9 +388,29 @@ mod_err_t cmd_register(const cmd_client_info *_client_info);
  *   "i[ii" - Requires either one or three integer arguments.
  *   "i[ii]" - Same as above (matched brackets).
  *
- * @return On success, the number of arguments present (>=0), a "MOD_ERR" value
+ * @return On success, the number of arguments present (>=0), a negated "MOD_ERR" value
  *         (<0). See code for details.
  */
 int32_t cmd_parse_args(int32_t argc, const char **argv, const char *fmt, cmd_arg_val *arg_vals);
 
+/**
+ * @brief Parse and validate key/value command arguments.
+ *
+ * @param[in]  argc The number of arguments to be parsed.
+ * @param[in]  argv Pointer string array of arguments to be be parsed.
+ * @param[in]  specs Accepted keys and their value types.
+ * @param[in]  num_specs Number of accepted keys.
+ * @param[out] arg_vals Parsed value of each spec, type is '\0' for keys not given.
+ *
+ * @return Number of keys given, negated "MOD_ERR" value if error.
+ *
+ * @note In case of error, an error message is always printed to the console and
+ * arg_vals should be discarded, so callers can apply all values or none.
+ *
+ * Each key is given once, either as a single "key=value" argument or as a "key value"
+ * argument pair, eg. "Kp=1.5 Ki 0.05". Value types are cmd_parse_args() format letters.
+ */
+int32_t cmd_parse_kv(int32_t argc, const char **argv, const cmd_kv_spec *specs, uint32_t num_specs,
+                     cmd_arg_val *arg_vals);
+
 #endif
@@ -39,6 +39,13 @@ typedef enum
         (a) += ((a) == UINT16_MAX ? 0 : 1); \
     } while (0)
 
+// Increment a uint32_t, saturating at the maximum value.
+#define INC_SAT_U32(a)                      \
+    do                                      \
+    {                                       \
+        (a) += ((a) == UINT32_MAX ? 0 : 1); \
+    } while (0)
+
 /* Clamp a numeric value between a lower and upper limit, inclusive. */
 #define CLAMP(a, low, high) ((a) <= (low) ? (low) : ((a) > (high) ? (high) : (a)))
 
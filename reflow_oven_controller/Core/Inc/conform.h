@@ -0,0 +1,108 @@
+/**
+ * @file conform.h
+ * @author Timothy Nguyen
+ * @brief Profile conformance scoring: reflow run metrics checked against paste limits.
+ * @version 0.1
+ * @date 2021-08-29
+ *
+ *      Metrics are updated on every sample in constant time, so the result is ready
+ *      as soon as a run completes:
+ *
+ *      - Peak: highest temperature.
+ *      - Time above liquidus (TAL): time spent at or above liquidus.
+ *      - Soak: time spent in [soak_lo, soak_hi) before liquidus is first reached.
+ *      - Ramp: highest rate of rise, taken over the last CONFORM_RATE_WINDOW samples
+ *        so that thermocouple noise does not count as ramp rate.
+ *      - RMS tracking error: root mean square of setpoint - temperature, over samples
+ *        of heating ramps with a set rate. Stepped setpoints and cooling at the oven's own
+ *        rate leave the oven behind the setpoint by design, so they are not scored.
+ *
+ *      Every metric has its limits, a run passes if all metrics are within them.
+ *      Defaults are for eutectic Sn63/Pb37 paste, which suits the default profile.
+ */
+
+#ifndef _CONFORM_H_
+#define _CONFORM_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+
+/* Samples spanned by ramp rate, 2 s at 0.5 s sampling period. */
+#define CONFORM_RATE_WINDOW 4U
+
+/* Metrics */
+typedef enum
+{
+	CONFORM_PEAK, // Peak temperature (deg C).
+	CONFORM_TAL,  // Time above liquidus (s).
+	CONFORM_SOAK, // Soak duration (s).
+	CONFORM_RAMP, // Maximum ramp rate (deg C/s).
+	CONFORM_RMS,  // RMS tracking error (deg C).
+
+	CONFORM_NUM_METRICS
+} Conform_metric_t;
+
+/* Conformance limits */
+typedef struct
+{
+	float liquidus;                      // Paste liquidus temperature (deg C).
+	float soak_lo;                       // Soak band lower bound (deg C).
+	float soak_hi;                       // Soak band upper bound (deg C).
+	float min[CONFORM_NUM_METRICS];      // Lowest passing value of every metric.
+	float max[CONFORM_NUM_METRICS];      // Highest passing value of every metric.
+} Conform_cfg_t;
+
+/* Conformance scorer structure */
+typedef struct
+{
+	Conform_cfg_t cfg;
+
+	/* Run metrics */
+	float value[CONFORM_NUM_METRICS]; // Metric values, RMS is kept as sum of squares until Conform_Finish().
+	uint32_t tracked;                 // Samples scored for RMS tracking error.
+	bool liquidus_reached;            // Liquidus was reached, soak has ended.
+
+	/* Ramp rate window, oldest sample at head */
+	float win_temp[CONFORM_RATE_WINDOW + 1]; // Temperatures (deg C).
+	float win_dt[CONFORM_RATE_WINDOW + 1];   // Time since preceding sample (s).
+	float win_span;                          // Sum of win_dt after head (s).
+	uint8_t head;                            // Index of oldest sample.
+	uint8_t count;                           // Samples in window.
+} Conform_t;
+
+/**
+ * @brief Set conformance limits and start scoring a new run.
+ *
+ * @param conf Conformance scorer instance.
+ * @param cfg Conformance limits.
+ */
+void Conform_Init(Conform_t * const conf, Conform_cfg_t const * const cfg);
+
+/**
+ * @brief Erase metrics and start scoring a new run.
+ *
+ * @param conf Conformance scorer instance.
+ */
+void Conform_Reset(Conform_t * const conf);
+
+/**
+ * @brief Score sample.
+ *
+ * @param conf Conformance scorer instance.
+ * @param temp Measured temperature (deg C).
+ * @param setpoint Setpoint temperature (deg C).
+ * @param Ts Time since previous sample (s).
+ * @param tracked Setpoint follows a heating ramp with a set rate, sample counts for RMS tracking error.
+ */
+void Conform_Update(Conform_t * const conf, float temp, float setpoint, float Ts, bool tracked);
+
+/**
+ * @brief Complete run and check metrics against limits.
+ *
+ * @param conf Conformance scorer instance.
+ * @param[out] value Final metric values.
+ * @return uint32_t Bit mask of failed metrics (1 << Conform_metric_t), 0 if the run passes.
+ */
+uint32_t Conform_Finish(Conform_t const * const conf, float value[CONFORM_NUM_METRICS]);
+
+#endif
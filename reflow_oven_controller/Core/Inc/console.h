@@ -7,21 +7,96 @@
  * 
  * Console module processes characters over serial and executes
  * appropriate command once Enter key is pressed.
+ *
+ * Characters are accumulated in a ring buffer from the UART ISR and the
+ * console active object is woken through a binary semaphore, a source of its queue set
+ * (see Active_start_set()), only on a newline, an idle receive line or a half-full ring
+ * buffer, rather than once per character.
+ *
+ * Each completed line is copied into its own pool-allocated command event, so a host
+ * may stream lines back to back without waiting for each command to finish. Between
+ * "batch begin" and "batch end" lines characters are not echoed, and the command
+ * module reports one summary for the batch.
+ *
+ * The line is edited in place: left/right arrows, Home/End, Backspace and Delete move
+ * the cursor or edit at it, up/down arrows recall the last CONSOLE_HISTORY_DEPTH lines
+ * that fit CONSOLE_HISTORY_LINE_SIZE.
+ * Echo is written as raw bytes to the transport's transmit buffer, bypassing the log formatter.
+ *
+ * The transport is USART2 by default, the USB CDC virtual COM port when built with
+ * CONSOLE_USB_CDC set to 1 (see usb_cdc.h), or the debug probe's RTT channel when built with
+ * CONSOLE_RTT set to 1 (see rtt.h). Setting CONSOLE_UART to 1 as well keeps USART2 next to
+ * them. Every transport carries its own session, with its own receive ring, line, history and
+ * batch mode, and writes to its transport's own transmit buffer:
+ *
+ * - Command output (console_write(), printf()) goes to the session of the command being
+ *   executed, set by the command module with console_reply_set() per command line, so a
+ *   response returns on the link its request came in on.
+ * - Log messages of the console sink and telemetry frames go only to the sessions subscribed
+ *   to them (console_sub_write()), so a link is not loaded with traffic nobody reads there.
+ *   The first session subscribes to both after reset, "console sub" changes the subscriptions
+ *   of the session it is typed on and "console sessions" lists them.
+ *
+ * A FRAME_DELIMITER byte switches the console to collecting a binary request frame until
+ * the next delimiter, the frame is posted to the command module undecoded (see cmd.h).
  */
 
 #ifndef _CONSOLE_H_
 #define _CONSOLE_H_
 
 #include "common.h"
+#include <stdbool.h>
+#include <stddef.h>
+
 #include "cmsis_os.h"
 
 /* Configuration parameters */
-#define CONSOLE_MSG_QUEUE_SIZE 1024    // Size of message queue for UART serial characters to be processed.
-#define CONSOLE_CMD_BUF_SIZE 40        // Size of buffer to hold processed command line characters.
+#define CONSOLE_RX_BUF_SIZE 512        // Size of ring buffer for UART serial characters to be processed, must be a power of two.
+#define CONSOLE_CMD_BUF_SIZE 512       // Size of buffer to hold processed command line characters, at most EVENT_POOL_LINE_BLOCK_SZ - 8.
 #define CONSOLE_THREAD_STACK_SIZE 1024 // Stack size for console thread.
+#define CONSOLE_MSG_COUNT 2            // Console event queue size.
+#define CONSOLE_POST_TIMEOUT_MS 1000   // Longest wait for command queue space before a line is dropped.
+#define CONSOLE_RETRY_MS 2             // Retry interval of a line waiting for command queue space (ms).
+#define CONSOLE_HISTORY_DEPTH 4        // Number of previous command lines kept for recall.
+#define CONSOLE_HISTORY_LINE_SIZE 64   // Size of history line buffers, longer (uploaded) lines are not kept.
+
+/* Console transport: 0 for USART2, 1 for USB CDC virtual COM port (in addition to USART2 with CONSOLE_UART). */
+#ifndef CONSOLE_USB_CDC
+#define CONSOLE_USB_CDC 0
+#endif
+
+/* Console transport: 0 for USART2, 1 for RTT channel of the debug probe (in addition to USART2 with CONSOLE_UART). */
+#ifndef CONSOLE_RTT
+#define CONSOLE_RTT 0
+#endif
+
+/* Whether a console session is on USART2, by default unless another transport is selected. */
+#ifndef CONSOLE_UART
+#define CONSOLE_UART (!CONSOLE_USB_CDC && !CONSOLE_RTT)
+#endif
 
 #define PROMPT "> "
 
+/**
+ * @brief Console sessions, one per transport. Sessions of transports not built in are never used.
+ */
+typedef enum
+{
+    CONSOLE_SESSION_UART, // USART2.
+    CONSOLE_SESSION_USB,  // USB CDC virtual COM port.
+    CONSOLE_SESSION_RTT,  // RTT channel of the debug probe.
+
+    CONSOLE_NUM_SESSIONS // Number of sessions.
+} console_session_t;
+
+/**
+ * @brief Output subscriptions of a session, bit mask.
+ */
+#define CONSOLE_SUB_LOG 0x01U       // Log messages of the console log sink.
+#define CONSOLE_SUB_TELEMETRY 0x02U // Telemetry frames, unless they have their own UART (UART_TELEMETRY_ENABLE).
+
+#define CONSOLE_SESSIONS_ALL ((1UL << CONSOLE_NUM_SESSIONS) - 1U) // Every session, see console_sub_offer().
+
 /**
  * @brief Initialize console module instance.
  *
@@ -30,7 +105,7 @@
 mod_err_t console_init(void);
 
 /**
- * @brief Create command thread and message queue.
+ * @brief Start console active object and transports.
  *
  * @return MOD_OK for success, a "MOD_ERR" value otherwise.
  *
@@ -39,12 +114,134 @@ mod_err_t console_init(void);
 mod_err_t console_start(void);
 
 /**
- * @brief Post character to console's message queue (non-blocking).
+ * @brief Post character to session's receive ring buffer (non-blocking).
  *
+ * @param session Session of the transport the character was received on.
  * @param c Character to transmit.
  *
- * @return MOD_OK if successful, MOD_ERR_TIMEOUT if message queue is full.
+ * @return MOD_OK if successful, MOD_ERR_TIMEOUT if ring buffer is full.
+ *
+ * @note Each session's ring buffer has a single producer, so call from one context only (eg. UART ISR).
+ *
+ * Console active object is only woken once a line is complete (newline character received)
+ * or ring buffer is half full. Remaining characters are processed on console_rx_idle().
+ */
+mod_err_t console_post(console_session_t session, char c);
+
+/**
+ * @brief Wake console active object as session's receive line went idle (non-blocking).
+ *
+ * Call from UART ISR once IDLE line is detected so that characters typed
+ * interactively are echoed without waiting for the Enter key.
+ *
+ * @param session Session of the transport.
+ */
+void console_rx_idle(console_session_t session);
+
+/**
+ * @brief USART2 receive callbacks for uart_config_t, console_post() and console_rx_idle() of its session.
+ */
+mod_err_t console_uart_post(char c);
+void console_uart_rx_idle(void);
+
+/**
+ * @brief Select session receiving command output.
+ *
+ * Called by the command module before it executes a line or a step of a resumable command.
+ * Output of other threads, outside commands, also goes to the session of the latest command.
+ *
+ * @param session Session the command came from, ignored if its transport is not built in.
+ */
+void console_reply_set(console_session_t session);
+
+/**
+ * @brief Get session receiving command output.
+ *
+ * @return Session selected with console_reply_set(), the first session after reset.
+ */
+console_session_t console_reply_get(void);
+
+/**
+ * @brief Put a block in the transmit buffer of every session subscribed to it (non-blocking).
+ *
+ * @param sub Subscription, CONSOLE_SUB_x.
+ * @param buf Characters to transmit.
+ * @param len Number of characters.
+ *
+ * @return MOD_OK if every subscribed session took the block, MOD_ERR_BUF_OVERRUN if one dropped it.
+ */
+mod_err_t console_sub_write(uint8_t sub, const char *buf, size_t len);
+
+/**
+ * @brief Put a block in the transmit buffer of each listed session subscribed to it that has room for it (non-blocking).
+ *
+ * For writers that wait for room: a full session does not hold the block back from the others,
+ * pass the returned sessions again to retry only those.
+ *
+ * @param sub Subscription, CONSOLE_SUB_x.
+ * @param sessions Sessions to offer the block to, bit (1 << console_session_t) each, CONSOLE_SESSIONS_ALL for every session.
+ * @param buf Characters to transmit.
+ * @param len Number of characters.
+ *
+ * @return Listed sessions subscribed to sub that had no room for the block, 0 once every one took it.
+ */
+uint32_t console_sub_offer(uint8_t sub, uint32_t sessions, const char *buf, size_t len);
+
+/**
+ * @brief Put a block of characters in the reply session's transmit buffer (non-blocking).
+ *
+ * The block is committed whole or dropped, like uart_write().
+ *
+ * @param buf Characters to transmit.
+ * @param len Number of characters to transmit.
+ *
+ * @return MOD_OK for success, MOD_ERR_BUF_OVERRUN if block was dropped or truncated.
+ */
+mod_err_t console_write(const char *buf, size_t len);
+
+/**
+ * @brief Queue a block for transmission on the console transport by reference (non-blocking).
+ *
+ * Sent to the reply session in order with console_write() output without copying it, see
+ * uart_write_ref(). On USB CDC and RTT the block is copied like console_write() and done is
+ * called before returning.
+ *
+ * @param buf Bytes to transmit, unchanged until done is called.
+ * @param len Number of bytes.
+ * @param done Called with ctx once the block was sent, may be called from interrupt context, may be NULL.
+ * @param ctx Argument of done.
+ *
+ * @return MOD_OK if queued, MOD_ERR_BUF_OVERRUN if the block was dropped (done is not called).
+ */
+mod_err_t console_write_ref(const void *buf, size_t len, void (*done)(void *ctx), void *ctx);
+
+/**
+ * @brief Put a binary telemetry frame in the telemetry pipeline (non-blocking).
+ *
+ * Frames go to their own UART with UART_TELEMETRY_ENABLE, batched by the telemetry sender
+ * (telemetry.h), so streaming does not compete with interactive console output, and are interleaved with the console output of the sessions
+ * subscribed to telemetry otherwise.
+ *
+ * @param buf Encoded frames.
+ * @param len Number of bytes.
+ *
+ * @return MOD_OK for success, MOD_ERR_BUF_OVERRUN if frames were dropped.
+ */
+mod_err_t console_telemetry_write(const char *buf, size_t len);
+
+/**
+ * @brief Check whether console transport finished transmitting.
+ *
+ * @return true if nothing is waiting or being sent on the USART2 session. Always true
+ *         without it, USB CDC and RTT do not depend on the system clock.
+ */
+bool console_tx_idle(void);
+
+/**
+ * @brief Get free space in the reply session's transmit buffer.
+ *
+ * @return Number of characters console_write() would currently accept as one block.
  */
-mod_err_t console_post(char c);
+size_t console_tx_free(void);
 
 #endif
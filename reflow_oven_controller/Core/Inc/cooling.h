@@ -0,0 +1,65 @@
+/**
+ * @file cooling.h
+ * @author Timothy Nguyen
+ * @brief Cooling actuator controller: proportional fan or door output with slew-rate limit.
+ * @version 0.1
+ * @date 2021-08-24
+ *
+ *      While active, the controller demands out = Kp * (temp - setpoint), clamped to
+ *      [0, out_max], so the actuator only opens up while the oven is hotter than the
+ *      setpoint. Inactive controllers demand 0.
+ *
+ *      The output moves towards the demand by at most slew_rate * Ts per update, in
+ *      both directions. Airflow changes gradually, so boards are not thermally
+ *      shocked and the zone controllers see no step disturbance.
+ */
+
+#ifndef _COOLING_H_
+#define _COOLING_H_
+
+#include <stdbool.h>
+
+/* Cooling controller configuration structure */
+typedef struct
+{
+	float Kp;        // Output per deg C the oven is above setpoint.
+	float slew_rate; // Largest output change per second, in either direction.
+	float out_max;   // Maximum output.
+} Cooling_cfg_t;
+
+/* Cooling controller structure */
+typedef struct
+{
+	Cooling_cfg_t cfg;
+	float demand; // Output before slew-rate limit.
+	float out;    // Controller output.
+} Cooling_t;
+
+/**
+ * @brief Set cooling controller configuration, output is off.
+ *
+ * @param cool Cooling controller instance.
+ * @param cfg Cooling controller configuration parameters.
+ */
+void Cooling_Init(Cooling_t * const cool, Cooling_cfg_t const * const cfg);
+
+/**
+ * @brief Update cooling controller output.
+ *
+ * @param cool Cooling controller instance.
+ * @param active Cooling is wanted, otherwise output ramps down to 0.
+ * @param setpoint Setpoint temperature (deg C).
+ * @param temp Measured temperature (deg C).
+ * @param Ts Time since previous update (s).
+ * @return float Controller output, 0 to out_max.
+ */
+float Cooling_Calculate(Cooling_t * const cool, bool active, float setpoint, float temp, float Ts);
+
+/**
+ * @brief Switch controller output off immediately.
+ *
+ * @param cool Cooling controller instance.
+ */
+void Cooling_Reset(Cooling_t * const cool);
+
+#endif
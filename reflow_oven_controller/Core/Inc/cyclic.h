@@ -0,0 +1,120 @@
+/**
+ * @file cyclic.h
+ * @author Timothy Nguyen
+ * @brief Rate groups: periodic callbacks run by rate-monotonic threads released from one hardware timer.
+ * @version 0.1
+ * @date 2021-09-15
+ *
+ * Modules register callbacks into one of three rate groups instead of starting their own
+ * software timers:
+ *
+ *      Group   Period  Thread     Priority (prio.h)  Intended for
+ *      100hz   10 ms   cyc100hz   PRIO_CYCLIC_100HZ  Acquisition, polling.
+ *      10hz    100 ms  cyc10hz    PRIO_CYCLIC_10HZ   Control, filtering.
+ *      1hz     1 s     cyc1hz     PRIO_CYCLIC_1HZ    Supervision, statistics.
+ *
+ * The update interrupt of the base timer (TIM15, CYCLIC_BASE_HZ) counts minor frames and
+ * releases every group whose period starts with the frame by setting its thread's flag, so
+ * all groups share one timebase and stay in phase. Periods are harmonic and the faster
+ * group has the higher priority (rate-monotonic), so the 100hz callbacks of a frame run
+ * first and preempt slower groups still running. A group runs its callbacks in
+ * registration order, then waits for its next release.
+ *
+ * A release that finds the group still running its previous release is an overrun: it is
+ * counted and skipped, the group is released again at its next period. "cyclic status"
+ * lists groups and callbacks with releases, overruns and the longest run of each callback,
+ * "cmd pm cyclic" reports per group the release latency (timer interrupt to thread start)
+ * and run time (all callbacks) histograms, in CPU cycles.
+ *
+ * Notes:
+ * - Callbacks run in thread context and must not block: a blocked callback delays every
+ *   callback behind it and makes its group overrun.
+ * - The base timer only runs while a callback is registered, and keeps the CPU out of STOP2
+ *   meanwhile (power_stop_lock()), as TIM15 halts there. Registering the first callback starts
+ *   it, unregistering the last one stops it.
+ * - The clock manager rescales the base timer prescaler, see clock_cfg in main.c.
+ */
+
+#ifndef _CYCLIC_H_
+#define _CYCLIC_H_
+
+#include <stdint.h>
+
+#include "common.h"
+#include "prio.h"
+#include "stm32l4xx_hal.h"
+
+/* Configuration parameters */
+#define CYCLIC_BASE_HZ 100U          // Minor frame rate, rate of the fastest group.
+#define CYCLIC_MAX_CBS 6U            // Callbacks per group.
+#define CYCLIC_THREAD_STACK_SZ 1024U // Stack size of each group thread (bytes).
+
+/**
+ * @brief Rate groups, fastest first.
+ */
+typedef enum
+{
+    CYCLIC_100HZ, // Every minor frame.
+    CYCLIC_10HZ,  // Every 10th minor frame.
+    CYCLIC_1HZ,   // Every 100th minor frame.
+
+    CYCLIC_NUM_GROUPS
+} cyclic_group_t;
+
+/* Periodic callback */
+typedef void (*cyclic_fn_t)(void *arg);
+
+/* Rate group configuration structure */
+typedef struct
+{
+    TIM_HandleTypeDef *timer_handle; // Base timer, counting at 10 kHz with CYCLIC_BASE_HZ updates (MX_TIM15_Init()).
+} cyclic_cfg_t;
+
+/**
+ * @brief Start group threads and register rate group commands.
+ *
+ * The base timer stays stopped until the first callback is registered.
+ *
+ * @param cfg Configuration.
+ *
+ * @return MOD_OK if successful, otherwise a "MOD_ERR" value.
+ */
+mod_err_t cyclic_init(cyclic_cfg_t const *cfg);
+
+/**
+ * @brief Add callback to the end of a rate group.
+ *
+ * @param group Rate group.
+ * @param name Name listed by "cyclic status", must remain valid.
+ * @param fn Callback.
+ * @param arg Argument passed to fn.
+ *
+ * @return MOD_OK if registered, MOD_ERR_RESOURCE if the group is full, MOD_ERR_NOT_INIT
+ *         if cyclic_init() was not called.
+ *
+ * @note Thread context only. The callback first runs at the next release of the group.
+ */
+mod_err_t cyclic_register(cyclic_group_t group, const char *name, cyclic_fn_t fn, void *arg);
+
+/**
+ * @brief Remove callback from its rate group.
+ *
+ * @param group Rate group.
+ * @param fn Callback.
+ * @param arg Argument it was registered with.
+ *
+ * @return MOD_OK if removed, MOD_ERR_ARG if it was not registered.
+ *
+ * @note Thread context only. The callback may still run once more if its group was
+ *       released before, group threads run a copy of the callbacks taken at release.
+ */
+mod_err_t cyclic_unregister(cyclic_group_t group, cyclic_fn_t fn, void *arg);
+
+/**
+ * @brief Base timer update, releases due groups (ISR context).
+ *
+ * @param htim Timer whose period elapsed, ignored unless it is the base timer.
+ */
+void cyclic_timer_elapsed(TIM_HandleTypeDef *htim);
+
+#endif
@@ -0,0 +1,122 @@
+/**
+ * @file evlog.h
+ * @author Timothy Nguyen
+ * @brief Event stream recorder: events dispatched to chosen active objects, with payloads, for replay.
+ * @version 0.1
+ * @date 2021-09-06
+ *
+ * "evlog start reflow" clears the ring and records every event the reflow active object
+ * dispatches, in dispatch order, which is the order its handler saw them in whatever urgent
+ * posts, coalescing and deferral made of the post order. Each record is a fixed slot holding
+ * the kernel tick of dispatch, active object id, signal and the leading EVLOG_PAYLOAD_LEN
+ * bytes of a pool event's payload, static events have none. The newest EVLOG_BUF_EVENTS
+ * records are kept ("evlog start once ..." stops when the ring is full instead).
+ *
+ * "evlog dump" stops recording and sends the ring, oldest record first, as COBS frames on
+ * the console, one per command step (see cmd_async_start()), records trimmed to their payload:
+ *
+ *      uint8_t  type;      // EVLOG_TELEMETRY_TYPE.
+ *      uint16_t first;     // Index of first record of frame within dump.
+ *      uint16_t total;     // Number of records in dump.
+ *      uint8_t  recs[];    // Up to EVLOG_DUMP_CHUNK records, each an evlog_hdr_t and len payload bytes.
+ *
+ * followed by text lines mapping active object ids to names. The host simulation replays
+ * a captured dump against the same active object ("replay" in Sim/Src/sim_main.c): live
+ * posts to it are dropped while recorded events are posted at their recorded tick offsets.
+ * Data a handler reads from outside its event, such as parameters staged in shared buffers
+ * behind a static event, is not recorded and comes from the replaying image.
+ *
+ * Recording costs a mask test per dispatch when off, and a slot header and payload copy
+ * with interrupts masked when on. Set EVLOG_ENABLE to 0 to compile it out.
+ */
+
+#ifndef _EVLOG_H_
+#define _EVLOG_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "common.h"
+#include "active.h"
+
+/* Configuration parameters */
+#ifndef EVLOG_ENABLE
+#define EVLOG_ENABLE 1 // Set to 0 to compile the recorder out.
+#endif
+
+#define EVLOG_BUF_EVENTS 64U          // Number of records in ring, must be a power of two.
+#define EVLOG_PAYLOAD_LEN 56U         // Payload bytes kept per record, Sample_Event fits.
+#define EVLOG_DUMP_CHUNK 3U           // Records per dump frame, an encoded frame fits CMD_ASYNC_CHUNK.
+#define EVLOG_TELEMETRY_TYPE 0x08U    // First payload byte of an event log dump frame.
+
+/* Record header, payload follows */
+typedef struct __attribute__((packed))
+{
+    uint32_t tick; // Kernel tick of dispatch.
+    uint16_t sig;  // Event signal.
+    uint8_t ao_id; // Active object id.
+    uint8_t len;   // Payload bytes following header, 0 for a static event.
+} evlog_hdr_t;
+
+/* Active objects recorded, bit per id, and the active objects replayed. */
+extern volatile uint32_t evlog_rec_mask;
+extern volatile uint32_t evlog_replay_mask;
+
+#if EVLOG_ENABLE
+#define EVLOG_DISPATCH(ao, evt, payload_len)                        \
+    do                                                              \
+    {                                                               \
+        if (evlog_rec_mask & (1UL << (ao)->id))                     \
+        {                                                           \
+            evlog_record((ao), (evt), (payload_len));               \
+        }                                                           \
+    } while (0)
+#define EVLOG_REPLAYED(ao) ((evlog_replay_mask & (1UL << (ao)->id)) != 0U && !evlog_replay_posting())
+#else
+#define EVLOG_DISPATCH(ao, evt, payload_len)
+#define EVLOG_REPLAYED(ao) false
+#endif
+
+/**
+ * @brief Register event log commands, recording is off until "evlog start".
+ *
+ * @return MOD_OK if successful, otherwise a "MOD_ERR" value.
+ */
+mod_err_t evlog_init(void);
+
+/**
+ * @brief Add dispatched event to ring, called by the dispatching thread through EVLOG_DISPATCH().
+ *
+ * @param ao Active object about to handle event, its progress_tick is the dispatch tick.
+ * @param evt Event.
+ * @param payload_len Payload bytes following the Event base, 0 for a static event.
+ */
+void evlog_record(Active const *const ao, Event const *const evt, size_t payload_len);
+
+/**
+ * @brief Replace live events of active object with replayed ones, or return it to live events.
+ *
+ * While replayed, posts to the active object are dropped, except those of evlog_replay_post().
+ *
+ * @param ao Active object.
+ * @param on Replay if true.
+ */
+void evlog_replay(Active const *const ao, bool on);
+
+/**
+ * @brief Post recorded event to replayed active object (ISR-safe).
+ *
+ * @param ao Active object.
+ * @param hdr Record header.
+ * @param payload Record payload, hdr->len bytes.
+ *
+ * @return MOD_OK if posted, MOD_ERR_RESOURCE if no pool block fits, otherwise the post error.
+ */
+mod_err_t evlog_replay_post(Active *const ao, evlog_hdr_t const *hdr, const uint8_t *payload);
+
+/**
+ * @brief Check whether the current post comes from evlog_replay_post().
+ */
+bool evlog_replay_posting(void);
+
+#endif // _EVLOG_H_
@@ -0,0 +1,94 @@
+/**
+ * @file excite.h
+ * @author Timothy Nguyen
+ * @brief Open-loop excitation sequences for plant identification experiments.
+ * @version 0.1
+ * @date 2021-08-31
+ *
+ *      The output starts with one hold at out_low as baseline, then follows either
+ *      - a step sequence, alternating between out_high and out_low every hold, or
+ *      - a pseudo-random binary sequence (PRBS) from a maximal-length shift register of
+ *        given order, each bit held for hold. One period of 2^order - 1 bits has a flat
+ *        spectrum up to about 1 / (2 * hold), so hold should be around a third of the
+ *        fastest plant time constant of interest and the period longer than the slowest.
+ *      The measured response is recorded by the caller, identification happens offline.
+ */
+
+#ifndef _EXCITE_H_
+#define _EXCITE_H_
+
+#include <stdint.h>
+
+/* PRBS shift register orders */
+#define EXCITE_PRBS_ORDER_MIN 3U  // Shortest register, period of 7 bits.
+#define EXCITE_PRBS_ORDER_MAX 15U // Longest register, period of 32767 bits.
+
+/* Excitation sequence type */
+typedef enum
+{
+	EXCITE_STEP, // Alternating steps.
+	EXCITE_PRBS, // Pseudo-random binary sequence.
+} Excite_type_t;
+
+/* Excitation status */
+typedef enum
+{
+	EXCITE_RUNNING,   // Sequence in progress.
+	EXCITE_DONE,      // Sequence completed, output forced low.
+	EXCITE_ERR_LIMIT, // Measurement exceeded limit, output forced low.
+} Excite_status_t;
+
+/* Excitation configuration structure */
+typedef struct
+{
+	Excite_type_t type;
+	float out_low;      // Low output level, also the baseline.
+	float out_high;     // High output level.
+	float hold;         // Time each step or bit is held (s).
+	float limit;        // Measurement aborting sequence.
+	uint16_t num_steps; // Steps or bits after baseline, at least 1.
+	uint8_t order;      // PRBS shift register order, EXCITE_PRBS_ORDER_MIN to EXCITE_PRBS_ORDER_MAX.
+} Excite_cfg_t;
+
+/* Excitation structure */
+typedef struct
+{
+	Excite_cfg_t cfg;
+	Excite_status_t status;
+	float out;       // Output to apply.
+	float held;      // Time current step or bit has been held (s).
+	uint16_t step;   // Current step, 0 is the baseline.
+	uint16_t lfsr;   // PRBS shift register, never 0.
+} Excite_t;
+
+/**
+ * @brief Start excitation sequence with baseline at out_low.
+ *
+ * @param ex Excitation instance.
+ * @param cfg Excitation configuration parameters.
+ */
+void Excite_Init(Excite_t * const ex, Excite_cfg_t const * const cfg);
+
+/**
+ * @brief Feed measurement and advance excitation sequence.
+ *
+ * @param ex Excitation instance.
+ * @param measurement Measured value, same units as limit.
+ * @param Ts Time since previous measurement (s).
+ * @return Excite_status_t EXCITE_RUNNING until sequence completes or fails,
+ *         output to apply is ex->out.
+ */
+Excite_status_t Excite_Step(Excite_t * const ex, float measurement, float Ts);
+
+/**
+ * @brief Number of bits in one period of a PRBS.
+ *
+ * @param order Shift register order, EXCITE_PRBS_ORDER_MIN to EXCITE_PRBS_ORDER_MAX.
+ * @return 2^order - 1.
+ */
+static inline uint16_t Excite_PRBS_Period(uint8_t order)
+{
+	return (uint16_t)((1UL << order) - 1UL);
+}
+
+#endif
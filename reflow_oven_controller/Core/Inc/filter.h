@@ -0,0 +1,100 @@
+/**
+ * @file filter.h
+ * @author Timothy Nguyen
+ * @brief Measurement filter: outlier rejection, median-of-N and first-order IIR.
+ * @version 0.1
+ * @date 2021-08-16
+ *
+ *      Each raw reading passes three stages in order:
+ *
+ *      1. Outlier rejection: a reading further than outlier_limit from the current
+ *         median is replaced by that median. Only median_len consecutive readings are
+ *         rejected, so a genuine step in the measurement is accepted shortly after.
+ *      2. Median of the last median_len readings, removing single-reading glitches.
+ *      3. First-order IIR low-pass, out += alpha * (median - out), or a cascade of
+ *         biquads in transposed direct form II, the kernel of CMSIS-DSP
+ *         arm_biquad_cascade_df2T_f32() with its coefficient layout:
+ *             y = b0 * x + d1
+ *             d1 = b1 * x + a1 * y + d2
+ *             d2 = b2 * x + a2 * y
+ *         Filter_LowPass() designs a second-order Butterworth stage.
+ *
+ *      The first reading after a reset primes every stage, so the output does not
+ *      ramp up from zero.
+ */
+
+#ifndef _FILTER_H_
+#define _FILTER_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+
+/* Longest median window. */
+#define FILTER_MAX_MEDIAN 7U
+
+/* Most biquad stages. */
+#define FILTER_MAX_BIQUADS 2U
+
+/* Filter configuration structure */
+typedef struct
+{
+	uint8_t median_len;  // Median window length, 1 (off) to FILTER_MAX_MEDIAN, odd.
+	float alpha;         // IIR coefficient in (0, 1], 1 (off) passes median through.
+	float outlier_limit; // Largest accepted deviation from median, 0 disables rejection.
+	uint8_t num_biquads; // Biquad stages replacing IIR, 0 for IIR.
+	float biquad[FILTER_MAX_BIQUADS][5]; // Coefficients {b0, b1, b2, a1, a2} of each stage.
+} Filter_cfg_t;
+
+/* Filter structure */
+typedef struct
+{
+	Filter_cfg_t cfg;
+
+	/* Filter memory */
+	float window[FILTER_MAX_MEDIAN]; // Recent accepted readings, ring buffer.
+	uint8_t head;                    // Index of oldest reading.
+	uint8_t rejects;                 // Consecutive rejected readings.
+	bool primed;                     // Memory holds at least one reading.
+	float median;                    // Median of window.
+	float state[FILTER_MAX_BIQUADS][2]; // Biquad state {d1, d2} of each stage.
+	float out;                       // Filter output.
+
+	/* Statistics */
+	uint32_t num_rejected; // Readings rejected as outliers since initialization.
+} Filter_t;
+
+/**
+ * @brief Set filter configuration and erase filter memory.
+ *
+ * @param filt Filter instance.
+ * @param cfg Filter configuration parameters.
+ */
+void Filter_Init(Filter_t * const filt, Filter_cfg_t const * const cfg);
+
+/**
+ * @brief Replace IIR stage of configuration with a second-order Butterworth low-pass biquad.
+ *
+ * @param cfg Filter configuration.
+ * @param cutoff Cutoff frequency (Hz), below 0.5 / Ts, 0 to return to the IIR.
+ * @param Ts Sample time (s).
+ * @return true if successful, false if cutoff is out of range.
+ */
+bool Filter_LowPass(Filter_cfg_t * const cfg, float cutoff, float Ts);
+
+/**
+ * @brief Filter one raw reading.
+ *
+ * @param filt Filter instance.
+ * @param x Raw reading.
+ * @return float Filter output.
+ */
+float Filter_Update(Filter_t * const filt, float x);
+
+/**
+ * @brief Erase filter memory, next reading primes filter.
+ *
+ * @param filt Filter instance.
+ */
+void Filter_Reset(Filter_t * const filt);
+
+#endif
@@ -0,0 +1,65 @@
+/**
+ * @file frame.h
+ * @author Timothy Nguyen
+ * @brief COBS framing with CRC-16 for binary data over a byte stream.
+ * @version 0.1
+ * @date 2021-08-06
+ *
+ * A frame on the wire is COBS(payload | CRC-16/CCITT-FALSE(payload), little-endian) followed
+ * by a single 0x00 delimiter. COBS guarantees the encoded bytes contain no zeros, so binary
+ * frames can share a UART with ASCII console output and receivers resynchronize on the next
+ * delimiter after any corruption.
+ */
+
+#ifndef _FRAME_H_
+#define _FRAME_H_
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include "common.h"
+
+/* Number of CRC bytes appended to payload. */
+#define FRAME_CRC_SIZE 2U
+
+/* Frame delimiter byte. */
+#define FRAME_DELIMITER 0x00U
+
+/* Worst-case encoded size of a payload of len bytes, including CRC and delimiter. */
+#define FRAME_ENCODED_SIZE(len) ((len) + FRAME_CRC_SIZE + ((len) + FRAME_CRC_SIZE) / 254U + 2U)
+
+/**
+ * @brief Compute CRC-16/CCITT-FALSE (poly 0x1021, init 0xFFFF).
+ *
+ * @param data Bytes to compute CRC over.
+ * @param len Number of bytes.
+ *
+ * @return CRC value.
+ */
+uint16_t frame_crc16(const uint8_t *data, size_t len);
+
+/**
+ * @brief Append CRC to payload, COBS-encode it and terminate with delimiter.
+ *
+ * @param[in] payload Payload bytes.
+ * @param[in] len Number of payload bytes.
+ * @param[out] out Encoded frame, at least FRAME_ENCODED_SIZE(len) bytes.
+ * @param[in] out_size Size of out in bytes.
+ *
+ * @return Number of bytes written to out including the delimiter, 0 if out is too small.
+ */
+size_t frame_encode(const uint8_t *payload, size_t len, uint8_t *out, size_t out_size);
+
+/**
+ * @brief Decode COBS frame and verify its CRC.
+ *
+ * @param[in] frame Encoded frame bytes, without the delimiter.
+ * @param[in] len Number of encoded bytes.
+ * @param[out] payload Decoded payload, at least len bytes.
+ * @param[out] payload_len Number of decoded payload bytes, excluding CRC.
+ *
+ * @return MOD_OK if frame is valid, MOD_ERR_ARG if it is malformed or its CRC does not match.
+ */
+mod_err_t frame_decode(const uint8_t *frame, size_t len, uint8_t *payload, size_t *payload_len);
+
+#endif
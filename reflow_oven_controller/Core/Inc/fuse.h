@@ -0,0 +1,121 @@
+/**
+ * @file fuse.h
+ * @author Timothy Nguyen
+ * @brief Sensor fusion: median vote of redundant thermocouples and a Kalman filter of temperature and rate.
+ * @version 0.1
+ * @date 2021-09-06
+ *
+ *      A zone fitted with several thermocouples reads the median of them, so one probe
+ *      that drifts, detaches from its fixture or reads a wrong but plausible value is
+ *      outvoted as long as most agree.
+ *
+ *      The voted reading then updates a two-state Kalman filter of zone temperature and
+ *      its rate of change, x = [temp, rate]. Between samples the estimate follows the
+ *      oven's FOPDT model, G(s) = K e^(-Ls) / (Ts + 1), as the Smith predictor does: the
+ *      rate decays with the time constant and steps by K / T per count the heater output
+ *      changed one dead time ago.
+ *
+ *          temp[k+1] = temp[k] + Ts * rate[k]
+ *          rate[k+1] = a * rate[k] + K / T * (u[k-d] - u[k-d-1]),   a = e^(-Ts / T)
+ *
+ *      Without a model the rate is held constant between samples (a = 1, no input).
+ *      Process noise is white acceleration of spectral density q, measurement noise
+ *      has variance r. A filter with a model follows heater steps without waiting for
+ *      the measurement to move, so the estimate can be smoothed harder than a
+ *      measurement filter without lagging. The rate estimate is the derivative the PID
+ *      uses in place of differencing noisy samples (see PID_SetRate()).
+ */
+
+#ifndef _FUSE_H_
+#define _FUSE_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "smith.h"
+
+/* Configuration parameters */
+#define FUSE_MAX_VOTERS 8U     // Most readings voted on.
+#define FUSE_Q_DEFAULT 0.01f   // Rate process noise density ((deg C/s)^2 / s).
+#define FUSE_R_DEFAULT 0.0625f // Measurement variance (deg C^2), 0.25 deg C deviation.
+
+/* Filter configuration */
+typedef struct
+{
+	float q; // Rate process noise density ((deg C/s)^2 / s), positive.
+	float r; // Measurement variance (deg C^2), positive.
+} Fuse_cfg_t;
+
+/* Kalman filter of temperature and rate */
+typedef struct
+{
+	Fuse_cfg_t cfg;                   // Noise configuration.
+	float K;                          // Model gain (deg C/count), 0 without model.
+	float T;                          // Model time constant (s).
+	uint32_t delay;                   // Model dead time (samples).
+	float history[SMITH_MAX_DELAY];   // Last delay outputs, oldest at head.
+	uint32_t head;                    // Index of oldest output.
+	float prev_u;                     // Delayed output of previous update.
+
+	bool primed;                      // Estimate was initialized from a measurement.
+	float temp;                       // Temperature estimate (deg C).
+	float rate;                       // Rate estimate (deg C/s).
+	float p00, p01, p11;              // Estimate covariance, symmetric.
+} Fuse_t;
+
+/**
+ * @brief Median of readings, mean of the middle two for an even count.
+ *
+ * @param vals Readings, left unchanged.
+ * @param n Number of readings, 1 to FUSE_MAX_VOTERS.
+ *
+ * @return Median reading.
+ */
+float Fuse_Vote(float const * const vals, uint32_t n);
+
+/**
+ * @brief Initialize filter, estimate is primed by the next measurement.
+ *
+ * @param f Filter.
+ * @param cfg Noise configuration.
+ * @param model Oven model, NULL or one with a non-positive time constant for none.
+ * @param Ts Nominal sample time (s), converts dead time to samples.
+ *
+ * @return MOD_OK if successful, MOD_ERR_ARG if noise is not positive or dead time exceeds SMITH_MAX_DELAY samples.
+ */
+mod_err_t Fuse_Init(Fuse_t * const f, Fuse_cfg_t const * const cfg, Smith_model_t const * const model, float Ts);
+
+/**
+ * @brief Forget estimate and output history, keeping configuration.
+ *
+ * @param f Filter.
+ */
+void Fuse_Reset(Fuse_t * const f);
+
+/**
+ * @brief Predict over the sample time and correct with measurement.
+ *
+ * @param f Filter.
+ * @param meas Voted temperature reading (deg C).
+ * @param u Heater output applied since the previous update (counts).
+ * @param Ts Time since the previous update (s).
+ *
+ * @return Temperature estimate (deg C), f->rate holds the rate estimate.
+ */
+float Fuse_Update(Fuse_t * const f, float meas, float u, float Ts);
+
+/**
+ * @brief Predict over the sample time without a measurement, eg. while a reading is missing.
+ *
+ * The estimate follows the model and its covariance grows, so the next measurement weighs
+ * more. Without a model the temperature follows the last rate estimate.
+ *
+ * @param f Filter.
+ * @param u Heater output applied since the previous update (counts).
+ * @param Ts Time since the previous update (s).
+ *
+ * @return Temperature estimate (deg C), unchanged if the filter is not primed.
+ */
+float Fuse_Predict(Fuse_t * const f, float u, float Ts);
+
+#endif
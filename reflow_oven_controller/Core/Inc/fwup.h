@@ -0,0 +1,72 @@
+/**
+ * @file fwup.h
+ * @author Timothy Nguyen
+ * @brief Firmware update: new image written to the other flash bank while running, swapped at the RESET state.
+ * @version 0.1
+ * @date 2021-09-06
+ *
+ * The 1 MB flash is two 512 KB banks, each laid out alike: the image (FWUP_IMAGE_MAX) then
+ * the two parameter store pages (see nvs.h). The bank booted from is mapped at 0x08000000,
+ * the other one at FWUP_IMAGE_ADDR, so an image linked as usual runs from either bank and
+ * updates always go to FWUP_IMAGE_ADDR, which execution never touches. Flash erases and
+ * programming of one bank do not stall reads of the other, the controller keeps running.
+ *
+ * A host sends the image with commands, as binary requests (see cmd.h) whose data args are
+ * 'b' so each frame carries up to FWUP_WRITE_MAX bytes:
+ *
+ *      fwup begin <size> <crc32>       Erase pages for size bytes in the background.
+ *      fwup status                     Poll until state is RECEIVING.
+ *      fwup write <offset> <hex> ...   In order, offsets multiple of 8. A resent chunk is accepted.
+ *      fwup end                        Verify CRC-32 (zlib) of size bytes and the vector table.
+ *      fwup status                     READY, or FAILED with the reason.
+ *
+ * Once READY the swap waits for the RESET state: a background job commits and copies the
+ * parameter store to the new bank, toggles the BFB2 option bit and reloads option bytes,
+ * which resets into the new image. "fwup abort" drops the update until then.
+ *
+ * Notes:
+ * - Erasing, verifying and swapping run as background jobs (see bgjob.h), so only idle time
+ *   is spent. Writes program flash in the command thread, a few ms per frame.
+ * - With BFB2 set the system bootloader starts the image in bank 2 if its stack pointer is
+ *   valid, else the one in bank 1, so a blank bank never bricks the controller.
+ * - The CRC is the only integrity check: images are not signed.
+ */
+
+#ifndef _FWUP_H_
+#define _FWUP_H_
+
+#include <stdint.h>
+
+#include "common.h"
+
+/* Configuration parameters */
+#define FWUP_IMAGE_ADDR 0x08080000U // Other bank in the address map.
+#define FWUP_IMAGE_MAX (508U * 1024U) // Largest image, the bank without its parameter store pages (bytes).
+#define FWUP_WRITE_MAX 240U          // Most bytes per write, a 'b' arg of an encoded request frame.
+#define FWUP_VERIFY_CHUNK 4096U      // Bytes checked per background job step.
+#define FWUP_SWAP_POLL_MS 500U       // Period of RESET state checks while a swap is pending.
+
+/* Update states */
+typedef enum
+{
+    FWUP_IDLE,      // No update.
+    FWUP_ERASING,   // Erasing other bank.
+    FWUP_RECEIVING, // Accepting writes.
+    FWUP_VERIFYING, // Checking image.
+    FWUP_READY,     // Verified, swap pending the RESET state.
+    FWUP_FAILED,    // Update dropped, see "fwup status".
+} fwup_state_t;
+
+/**
+ * @brief Register update commands and swap timer.
+ *
+ * @return MOD_OK if successful, otherwise a "MOD_ERR" value.
+ */
+mod_err_t fwup_init(void);
+
+/**
+ * @brief Get bank the firmware was booted from, 1 or 2 (any context).
+ */
+uint8_t fwup_bank(void);
+
+#endif
@@ -0,0 +1,78 @@
+/**
+ * @file heap.h
+ * @author Timothy Nguyen
+ * @brief FreeRTOS heap of fixed-size block pools, constant time allocation and release.
+ * @version 0.1
+ * @date 2021-09-06
+ *
+ * Replaces heap_4 as the pvPortMalloc()/vPortFree() backend. The heap is one pool per size
+ * class of HEAP_CLASSES(), powers of two from HEAP_MIN_BLOCK, each a free list of equal
+ * blocks. A request is served from the smallest class whose blocks hold it, or spills to the
+ * next larger class with a free block, found with one bit scan of the classes that have
+ * any. Releasing finds the block's class from its address. Neither walks a free list or
+ * coalesces, so both take the same few dozen cycles whatever the heap's history, and
+ * blocks of one class never fragment the others.
+ *
+ * The cost is internal fragmentation, the unused tail of each block, and spills into larger
+ * classes. "heap status" shows, per class, blocks in use and their peak, spills into it,
+ * requests it failed, and bytes requested against bytes held, so pool counts can be tuned
+ * to what the firmware actually allocates.
+ *
+ * Notes:
+ * - Kernel objects are allocated statically where possible, the heap serves the rest, eg.
+ *   the CubeMX default task, freed again once it terminates.
+ * - malloc(), free(), calloc() and realloc() of the C library map onto the same pools,
+ *   including the allocations newlib makes internally, so there is no second heap.
+ * - Like heap_4, allocation suspends the scheduler and must not be called from an ISR.
+ */
+
+#ifndef _HEAP_H_
+#define _HEAP_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "common.h"
+
+/* Size classes: X(block size in bytes, number of blocks). Block sizes are powers of two,
+ * doubling from HEAP_MIN_BLOCK, and multiples of the 8-byte alignment of the port. */
+#define HEAP_CLASSES(X) \
+    X(32U, 32U)         \
+    X(64U, 24U)         \
+    X(128U, 16U)        \
+    X(256U, 8U)         \
+    X(512U, 4U)         \
+    X(1024U, 2U)        \
+    X(2048U, 2U)
+
+#define HEAP_MIN_BLOCK 32U // Smallest block size, that of the first class.
+
+/* Number of size classes and total bytes of their pools. */
+#define HEAP_CLASS_ONE(size, count) +1U
+#define HEAP_CLASS_BYTES(size, count) +(size) * (count)
+#define HEAP_NUM_CLASSES (0U HEAP_CLASSES(HEAP_CLASS_ONE))
+#define HEAP_BYTES (0U HEAP_CLASSES(HEAP_CLASS_BYTES))
+
+/* Statistics of a size class */
+typedef struct
+{
+    uint32_t size;      // Block size (bytes).
+    uint32_t count;     // Blocks in pool.
+    uint32_t used;      // Blocks allocated.
+    uint32_t peak;      // Most blocks allocated at once.
+    uint32_t spills;    // Allocations served here for lack of a free block in a smaller fitting class.
+    uint32_t failed;    // Requests fitting this class that found no free block here or above.
+    uint32_t requested; // Bytes requested by allocated blocks, at most used * size.
+} heap_class_stats_t;
+
+/**
+ * @brief Get statistics of size class (thread context).
+ *
+ * @param cls Class index, 0 to HEAP_NUM_CLASSES - 1, smallest first.
+ * @param[out] stats Statistics.
+ *
+ * @return MOD_OK if successful, MOD_ERR_ARG if cls is out of range.
+ */
+mod_err_t heap_class_stats(uint32_t cls, heap_class_stats_t *const stats);
+
+#endif
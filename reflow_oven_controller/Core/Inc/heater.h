@@ -0,0 +1,259 @@
+/**
+ * @file heater.h
+ * @author Timothy Nguyen
+ * @brief Heater output drivers: timer PWM, DMA-scheduled PWM, burst-fire or phase-angle.
+ * @version 0.1
+ * @date 2021-08-23
+ *
+ * Heater outputs range from 0 (off) to HEATER_OUT_MAX (full power), matching the PID
+ * output limits. Each heater is driven in one of four ways:
+ * - HEATER_PWM: timer PWM channel, the output is its compare value. TIM3 runs a period of
+ *   4095 ticks at about 2 Hz, so a 50% output is 250 ms on, 250 ms off.
+ * - HEATER_PWM_SCHED: timer PWM channel with HEATER_SCHED_LEN shorter periods per control
+ *   period. Heater_Set() writes a duty schedule ramping linearly from the previous output
+ *   to the new one, and the timer's update DMA request streams it into the preloaded
+ *   compare register, one entry per PWM period. Power steps are spread over the control
+ *   period without interrupts, and the last entry holds until the next Heater_Set().
+ * - HEATER_BURST: SSR control GPIO switched at mains zero crossings, for AC heaters. On
+ *   every zero crossing, detected on HEATER_ZC_PIN, each heater adds its output to an
+ *   accumulator and conducts for the next half cycle when the accumulator reaches
+ *   HEATER_OUT_MAX (Bresenham distribution). Conducting half cycles are spread as evenly
+ *   as the output allows, a 50% output conducts every other half cycle. Switching at zero
+ *   crossings only keeps conducted EMI and lamp flicker low.
+ * - HEATER_PHASE: triac gate fired at a delay after every zero crossing, for AC heaters
+ *   that need the fastest response. TIM2 does all of it in hardware: the zero-crossing
+ *   detector on TIM2_CH1 (same pin, HEATER_ZC_PIN) triggers the counter (slave trigger
+ *   mode, one-pulse mode), each heater's channel goes active at its compare value (PWM
+ *   mode 2) and the counter stops HEATER_PHASE_GUARD_US before the next zero crossing,
+ *   releasing the gates. Heater_Set() only writes the preloaded compare, taken at the
+ *   end of the current half cycle, so there is no per-cycle CPU work. The firing delay
+ *   comes from a power-to-angle table inverting P(a) = 1 - a + sin(2 pi a) / (2 pi), the
+ *   integral of sin^2 over the conducting part a of the half cycle, so the delivered
+ *   power is linear in the output.
+ *
+ * Edge-aligned PWM channels of a timer all switch on at the counter reset, so every heater
+ * draws current at once and the peak is the sum of their ratings. PWM heaters given a
+ * rating (watts) are staggered instead: alternate rated heaters of a timer, in init order,
+ * are aligned to the end of the period (PWM mode 2, compare ARR + 1 - duty) rather than its
+ * start, so two heaters below 50% never overlap and two above only overlap by the excess.
+ * A total power budget per instant (Heater_Set_Budget(), "heater budget") caps the rated
+ * power switched on at any point of the period: Heater_Set() works out the peak of the
+ * staggered schedule and, while it exceeds the budget, scales the on time of every
+ * rated heater down by the same factor, leaving the outputs as asked. Timers are not
+ * synchronized, so heaters of different timers are taken to peak together.
+ *
+ * PWM heaters may be given a linearization table (see pwmlin.h) with Heater_Linearize(),
+ * which maps the output to the duty delivering that fraction of full power. The output stays
+ * what the controller asked for, the compare value is the duty.
+ *
+ * The zero-crossing detector (optocoupler, open collector) pulls HEATER_ZC_PIN low once
+ * per half cycle. Edges closer than HEATER_ZC_MIN_US to the previous one are rejected as
+ * noise. If no zero crossing was seen for HEATER_ZC_TIMEOUT_MS, the next Heater_Set()
+ * switches burst heaters off and counts a mains fault, they resume once zero crossings
+ * return.
+ *
+ * Heater_Trip() is the safety path: it forces the output inactive at the register level at
+ * once, without waiting for the end of the PWM period or half cycle, and latches the heater
+ * off until Heater_Clear_Trip(). It is safe to call from any context.
+ *
+ * Notes:
+ * - HEATER_PWM_SCHED divides the timer prescaler by HEATER_SCHED_LEN, which shortens the
+ *   period of every channel of that timer. The timer's update request may serve only one
+ *   scheduled heater (TIM3_UP is DMA1 channel 3, request 5). Zero-cross SSRs round each
+ *   period to whole half cycles, 16 Hz PWM leaves about 6 half cycles per period.
+ * - Heater_Set_Period() reprograms the timer prescaler, so it also changes the period of every
+ *   other channel of that timer, eg. a fan on TIM3. Zero-cross SSRs need a period of several
+ *   half cycles, a linearization table measured at another period no longer applies.
+ * - A burst heater's SSR GPIO is reconfigured as push-pull output, it may be the pin
+ *   CubeMX assigned to the timer channel (PA6, TIM3_CH1).
+ * - Phase-angle heaters need a random-phase SSR or optotriac, a zero-cross SSR only turns
+ *   on at zero crossings. Gate outputs are TIM2_CH2 (PA1) and TIM2_CH4 (PB11), TIM2_CH3
+ *   pins are taken by USART2 and SPI2.
+ * - Phase-angle timing assumes HEATER_MAINS_HZ mains. Without zero crossings TIM2 is not
+ *   triggered and phase-angle gates stay off.
+ * - Single half cycles carry a DC component, which resistive heaters tolerate. Transformer
+ *   or inductive loads should be driven with PWM.
+ * - The zero-crossing interrupt runs above configMAX_SYSCALL_INTERRUPT_PRIORITY and makes
+ *   no kernel calls.
+ */
+
+#ifndef _HEATER_H_
+#define _HEATER_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "common.h"
+#include "pwmlin.h"
+#include "stm32l4xx_hal.h"
+
+/* Configuration parameters */
+#define HEATER_OUT_MAX 4095U         // Full-scale output, PWM period of TIM3.
+#define HEATER_MAX_BURST 4U          // Maximum number of burst-fire heaters.
+#define HEATER_MAX_PWM 4U            // Maximum number of rated (budgeted) PWM heaters.
+#define HEATER_MAX_SCHED 2U          // Maximum number of DMA-scheduled PWM heaters, one per timer.
+#define HEATER_SCHED_LEN 8U          // PWM periods per duty schedule.
+#define HEATER_ZC_PORT GPIOA         // Zero-crossing detector input port.
+#define HEATER_ZC_PIN GPIO_PIN_0     // Zero-crossing detector input pin (A0 on Nucleo header), EXTI0.
+#define HEATER_ZC_MIN_US 4000U       // Shortest accepted half cycle (us), 70 Hz mains is 7143 us.
+#define HEATER_ZC_TIMEOUT_MS 100U    // Time without zero crossing before burst heaters are switched off.
+#define HEATER_MAINS_HZ 50U          // Mains frequency for phase-angle timing.
+#define HEATER_MAX_PHASE 3U          // Maximum number of phase-angle heaters, TIM2 channels 2 to 4.
+#define HEATER_PHASE_MIN_US 200U     // Shortest firing delay (us), triac needs voltage to latch.
+#define HEATER_PHASE_GUARD_US 500U   // Gates are released this long before the next zero crossing (us).
+
+/**
+ * @brief Heater drives.
+ */
+typedef enum
+{
+    HEATER_PWM,       // Timer PWM channel.
+    HEATER_PWM_SCHED, // Timer PWM channel, compare streamed by DMA from duty schedule.
+    HEATER_BURST,     // Zero-cross synchronized burst-fire on GPIO.
+    HEATER_PHASE,     // Phase-angle firing on TIM2 channel.
+
+    HEATER_NUM_DRIVES
+} Heater_drive_t;
+
+/* Heater configuration structure */
+typedef struct
+{
+    Heater_drive_t drive;                // Output drive.
+    TIM_HandleTypeDef *pwm_timer_handle; // PWM timer handle (HEATER_PWM, HEATER_PWM_SCHED).
+    uint32_t pwm_channel;                // PWM timer channel (HEATER_PWM, HEATER_PWM_SCHED).
+    DMA_TypeDef *sched_dma;              // DMA controller of timer update request (HEATER_PWM_SCHED).
+    uint32_t sched_dma_channel;          // DMA channel, LL_DMA_CHANNEL_x (HEATER_PWM_SCHED).
+    uint32_t sched_dma_request;          // DMA request, LL_DMA_REQUEST_x (HEATER_PWM_SCHED).
+    uint32_t phase_channel;              // TIM2 channel, TIM_CHANNEL_2 to TIM_CHANNEL_4 (HEATER_PHASE).
+    GPIO_TypeDef *ssr_port;              // SSR control or gate GPIO port (HEATER_BURST, HEATER_PHASE).
+    uint16_t ssr_pin;                    // SSR control or gate GPIO pin (HEATER_BURST, HEATER_PHASE).
+    float watts;                         // Rated power (W), staggered and budgeted if nonzero (HEATER_PWM).
+} Heater_cfg_t;
+
+/* Heater instance */
+typedef struct
+{
+    Heater_cfg_t cfg;        // Configuration.
+    volatile uint16_t out;   // Output, at most HEATER_OUT_MAX.
+    uint16_t duty;           // Compare value of output after linearization (HEATER_PWM, HEATER_PWM_SCHED).
+    uint16_t on;             // On ticks per period after power budget (HEATER_PWM).
+    bool trail;              // On time aligned to end of period (HEATER_PWM).
+    Pwmlin_t const *lin;     // Linearization table, NULL if duty is the output.
+    volatile bool enabled;   // Output is driven.
+    volatile bool tripped;   // Output forced inactive by Heater_Trip().
+    uint32_t acc;            // Burst-fire accumulator, written by zero-crossing interrupt only.
+    volatile uint32_t fired; // Conducted half cycles (HEATER_BURST).
+    uint8_t sched_id;        // Duty schedule buffer (HEATER_PWM_SCHED).
+    uint16_t sched_prev;     // Duty at end of last duty schedule.
+} Heater_t;
+
+/**
+ * @brief Configure zero-crossing input and register heater commands.
+ *
+ * @return MOD_OK if successful, otherwise a "MOD_ERR" value.
+ */
+mod_err_t heater_init(void);
+
+/**
+ * @brief Initialize heater instance, output is off and disabled.
+ *
+ * @param[out] heater Heater instance.
+ * @param[in] heater_cfg Configuration parameters.
+ *
+ * @return MOD_OK if successful, MOD_ERR_RESOURCE if HEATER_MAX_BURST burst heaters,
+ *         HEATER_MAX_SCHED scheduled heaters, HEATER_MAX_PHASE phase-angle heaters or
+ *         HEATER_MAX_PWM rated PWM heaters exist,
+ *         MOD_ERR_ARG for an invalid channel.
+ */
+mod_err_t Heater_Init(Heater_t *const heater, Heater_cfg_t const *const heater_cfg);
+
+/**
+ * @brief Start driving heater output, beginning at the current output, unless tripped.
+ *
+ * @param heater Heater instance.
+ */
+void Heater_Enable(Heater_t *const heater);
+
+/**
+ * @brief Switch heater off and stop driving its output.
+ *
+ * @param heater Heater instance.
+ */
+void Heater_Disable(Heater_t *const heater);
+
+/**
+ * @brief Set heater output.
+ *
+ * PWM and phase-angle heaters take the output at the end of the current period, scheduled
+ * PWM heaters ramp to it over the next HEATER_SCHED_LEN periods, burst heaters take it at
+ * the next zero crossing.
+ *
+ * @param heater Heater instance.
+ * @param out Output, clamped to HEATER_OUT_MAX.
+ */
+void Heater_Set(Heater_t *const heater, uint16_t out);
+
+/**
+ * @brief Set linearization table of PWM heater, applied from the next Heater_Set().
+ *
+ * @param heater Heater instance.
+ * @param lin Table, kept by reference, NULL to drive the output as duty.
+ */
+void Heater_Linearize(Heater_t *const heater, Pwmlin_t const *const lin);
+
+/**
+ * @brief Set PWM period of PWM heater, taken at the end of the current period.
+ *
+ * The timer clock is the current one, the clock manager keeps the period across clock
+ * changes. A scheduled PWM heater streams its schedule over the period.
+ *
+ * @param heater Heater instance.
+ * @param period PWM period (s).
+ *
+ * @return MOD_OK if successful, MOD_ERR_ARG if not a PWM heater or the period does not fit
+ *         the timer prescaler.
+ */
+mod_err_t Heater_Set_Period(Heater_t *const heater, float period);
+
+/**
+ * @brief Set total power budget of rated PWM heaters, applied from the next Heater_Set().
+ *
+ * A heater rated above the budget stays off.
+ *
+ * @param watts Most rated power switched on at once (W), 0 for no budget.
+ *
+ * @return MOD_OK if successful, MOD_ERR_ARG if negative.
+ */
+mod_err_t Heater_Set_Budget(float watts);
+
+/**
+ * @brief Force heater output inactive at once and latch it off (thread or ISR).
+ *
+ * PWM channels are forced inactive in their output compare mode, so pending compare
+ * values and DMA-streamed schedules have no effect. Burst-fire SSRs are switched off and
+ * skipped by the zero-crossing interrupt, phase-angle gates are forced inactive.
+ * While tripped, Heater_Enable() does nothing and Heater_Set() only stores the output.
+ *
+ * @param heater Heater instance.
+ */
+void Heater_Trip(Heater_t *const heater);
+
+/**
+ * @brief Release tripped heater, it stays off until enabled again.
+ *
+ * @param heater Heater instance.
+ *
+ * @return MOD_OK if successful, MOD_ERR if heater is still enabled.
+ */
+mod_err_t Heater_Clear_Trip(Heater_t *const heater);
+
+/**
+ * @brief Get drive name.
+ *
+ * @param drive Heater drive.
+ *
+ * @return Drive name.
+ */
+const char *Heater_Drive_Name(Heater_drive_t drive);
+
+#endif
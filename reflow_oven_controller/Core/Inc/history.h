@@ -0,0 +1,94 @@
+/**
+ * @file history.h
+ * @author Timothy Nguyen
+ * @brief Run recorder: delta-encoded sample history in a fixed RAM ring.
+ * @version 0.1
+ * @date 2021-08-27
+ *
+ *      Every sample stores temperature, a 12-bit output and a 4-bit state. Samples are
+ *      grouped into blocks of HISTORY_BLOCK_SAMPLES:
+ *
+ *      - temp: temperature of the block's first sample, in 1/HISTORY_TEMP_SCALE deg C.
+ *      - delta[i]: change from sample i - 1, in the same unit, 0 for the first sample.
+ *      - out_state[i]: output in bits 0 to 11, state in bits 12 to 15.
+ *
+ *      That is about 3 bytes per sample, so HISTORY_NUM_BLOCKS blocks hold a full
+ *      reflow run in under 5 Kbytes. Once every block is used, the oldest block is
+ *      overwritten. Blocks decode on their own, so dropping one never corrupts the rest.
+ *
+ *      A change larger than a delta can hold is spread over the following samples, the
+ *      encoder tracks the decoded temperature so the error never accumulates.
+ */
+
+#ifndef _HISTORY_H_
+#define _HISTORY_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+
+/* Configuration parameters */
+#define HISTORY_BLOCK_SAMPLES 32U // Samples per block.
+#define HISTORY_NUM_BLOCKS 48U    // Blocks in ring, 1536 samples or 12.8 min at 2 Hz.
+#define HISTORY_TEMP_SCALE 16.0f  // Temperature units per deg C.
+#define HISTORY_OUT_MAX 4095U     // Largest recorded output, 12 bits.
+#define HISTORY_STATE_MAX 15U     // Largest recorded state, 4 bits.
+
+/* Number of samples the ring holds. */
+#define HISTORY_MAX_SAMPLES (HISTORY_BLOCK_SAMPLES * HISTORY_NUM_BLOCKS)
+
+/* Encoded block of consecutive samples */
+typedef struct
+{
+	int16_t temp;                                // First sample temperature (deg C * HISTORY_TEMP_SCALE).
+	uint16_t out_state[HISTORY_BLOCK_SAMPLES];   // Output (bits 0 to 11) and state (bits 12 to 15).
+	int8_t delta[HISTORY_BLOCK_SAMPLES];         // Temperature change from previous sample.
+} History_block_t;
+
+/* Run recorder structure */
+typedef struct
+{
+	History_block_t blocks[HISTORY_NUM_BLOCKS]; // Block ring, block of sample n is n / HISTORY_BLOCK_SAMPLES modulo HISTORY_NUM_BLOCKS.
+	uint32_t count;                             // Samples recorded since reset.
+	int16_t last;                               // Decoded temperature of most recent sample.
+	float period;                               // Sampling period (s).
+} History_t;
+
+/**
+ * @brief Erase recorded samples and start a new run.
+ *
+ * @param hist Run recorder instance.
+ * @param period Sampling period (s), used to timestamp samples.
+ */
+void History_Reset(History_t * const hist, float period);
+
+/**
+ * @brief Record sample, overwriting the oldest block if the ring is full.
+ *
+ * @param hist Run recorder instance.
+ * @param temp Temperature (deg C), clamped to the int16_t range of the encoding.
+ * @param out Output, clamped to HISTORY_OUT_MAX.
+ * @param state State, clamped to HISTORY_STATE_MAX.
+ */
+void History_Add(History_t * const hist, float temp, float out, uint8_t state);
+
+/**
+ * @brief Get index of oldest sample still held.
+ *
+ * @param hist Run recorder instance.
+ * @return uint32_t Index of oldest sample, counted from reset.
+ */
+uint32_t History_First(History_t const * const hist);
+
+/**
+ * @brief Decode a held sample.
+ *
+ * @param hist Run recorder instance.
+ * @param index Sample index, History_First() to count - 1.
+ * @param[out] temp Temperature (deg C).
+ * @param[out] out Output.
+ * @param[out] state State.
+ * @return true if sample is held, false if it was overwritten or not recorded yet.
+ */
+bool History_Get(History_t const * const hist, uint32_t index, float * const temp, uint16_t * const out, uint8_t * const state);
+
+#endif
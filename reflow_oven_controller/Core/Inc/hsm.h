@@ -0,0 +1,137 @@
+/**
+ * @file hsm.h
+ * @author Timothy Nguyen
+ * @brief Hierarchical state machine engine for active objects.
+ * @version 0.1
+ * @date 2021-08-10
+ *
+ * States are constant objects placed in flash, each naming its superstate and a
+ * single handler that receives the reserved ENTRY_SIG, EXIT_SIG and INIT_SIG
+ * signals as well as user signals. A handler returns HSM_UNHANDLED for events
+ * it does not handle, which passes them on to its superstate, so an event
+ * handled in a superstate applies to every substate:
+ *
+ * static const Hsm_State running = HSM_STATE(NULL, running_handler, 0);
+ * static const Hsm_State heating = HSM_STATE(&running, heating_handler, 1);
+ *
+ * static Hsm_Status heating_handler(My_Active *const ao, Event const *const evt)
+ * {
+ *     switch (evt->sig)
+ *     {
+ *     case ENTRY_SIG: heater_on(); return HSM_HANDLED;
+ *     case EXIT_SIG: heater_off(); return HSM_HANDLED;
+ *     case HOT_SIG: return Hsm_tran(&ao->hsm, &cooling);
+ *     default: return HSM_UNHANDLED;
+ *     }
+ * }
+ *
+ * A transition exits states from the current state up to the least common
+ * ancestor of source and target, enters states down to the target and then
+ * follows the target's initial transitions (INIT_SIG) down to a leaf state.
+ * Dispatch and transitions are O(depth) of the state hierarchy.
+ */
+
+#ifndef _HSM_H_
+#define _HSM_H_
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+#include "active.h"
+
+/* Maximum nesting depth of states */
+#define HSM_MAX_DEPTH 8
+
+/* State handler return status */
+typedef enum
+{
+    HSM_HANDLED,   // Event was handled, no state transition was taken.
+    HSM_UNHANDLED, // Event is passed on to superstate, ignored at top level.
+    HSM_TRAN,      // State transition to target set by Hsm_tran() was taken.
+} Hsm_Status;
+
+/**
+ * @brief State handler.
+ *
+ * Owning object is passed as first argument, so handlers may be declared
+ * with a derived type and cast, like active object event handlers.
+ */
+typedef Hsm_Status (*Hsm_Handler)(void *const me, Event const *const evt);
+
+/* State, constant and placed in flash */
+typedef struct Hsm_State
+{
+    struct Hsm_State const *parent; // Superstate, NULL for top-level state.
+    Hsm_Handler handler;            // State handler.
+    uint8_t id;                     // User-defined state identifier.
+} Hsm_State;
+
+/**
+ * @brief Define a state.
+ *
+ * @param parent_ Superstate, NULL for top-level state.
+ * @param handler_ State handler, cast to Hsm_Handler.
+ * @param id_ User-defined state identifier.
+ */
+#define HSM_STATE(parent_, handler_, id_) {.parent = (parent_), .handler = (Hsm_Handler)(handler_), .id = (id_)}
+
+/* Hierarchical state machine instance */
+typedef struct
+{
+    Hsm_State const *state;  // Current leaf state.
+    Hsm_State const *target; // Target of transition in progress.
+    void *me;                // Owning object passed to state handlers.
+} Hsm;
+
+/**
+ * @brief Hierarchical state machine constructor.
+ *
+ * @param[out] hsm State machine instance.
+ * @param[in] me Owning object passed to state handlers.
+ */
+void Hsm_ctor(Hsm *const hsm, void *me);
+
+/**
+ * @brief Enter initial state and follow its initial transitions.
+ *
+ * @param hsm State machine instance.
+ * @param initial Initial state.
+ */
+void Hsm_init(Hsm *const hsm, Hsm_State const *initial);
+
+/**
+ * @brief Dispatch event to current state, falling back to superstates, and run to completion.
+ *
+ * @param hsm State machine instance.
+ * @param evt Event to dispatch.
+ */
+void Hsm_dispatch(Hsm *const hsm, Event const *const evt);
+
+/**
+ * @brief Check if current state is state or one of its substates.
+ *
+ * @param hsm State machine instance.
+ * @param state State to check.
+ *
+ * @return true if in state.
+ */
+bool Hsm_is_in(Hsm const *const hsm, Hsm_State const *state);
+
+/**
+ * @brief Request transition, to be returned from a state handler.
+ *
+ * From an INIT_SIG handler, target must be a substate of the handling state.
+ *
+ * @param hsm State machine instance.
+ * @param target Target state.
+ *
+ * @return HSM_TRAN.
+ */
+static inline Hsm_Status Hsm_tran(Hsm *const hsm, Hsm_State const *target)
+{
+    hsm->target = target;
+    return HSM_TRAN;
+}
+
+#endif
@@ -0,0 +1,125 @@
+/**
+ * @file irq.h
+ * @author Timothy Nguyen
+ * @brief Interrupt priority map and entry latency probe.
+ * @version 0.1
+ * @date 2021-09-02
+ *
+ * All NVIC priorities are defined here, lower numbers preempt higher ones. Interrupts above
+ * configLIBRARY_MAX_SYSCALL_INTERRUPT_PRIORITY (numerically below it) are never masked by
+ * kernel critical sections, so their latency does not depend on the kernel, but they must
+ * not call the FreeRTOS API:
+ *
+ *      Priority  Interrupts                               FreeRTOS API
+ *      0         Latency probe timer (TIM16)              No
+ *      2         Mains zero crossing (EXTI0)              No
+ *      5         Sampling timer (TIM6), thermocouple      Yes
+ *                SPI DMA (DMA1 channels 4 and 5),
+ *                rate group base timer (TIM15)
+ *      6         Console UART, its DMA channels, USB      Yes
+ *      7         Archive flash SPI DMA (DMA2 channel 2)   Yes
+ *                Telemetry UART, Modbus USART, CAN RX
+ *      14        Work queue wake (SWPMI1, pended)         Yes
+ *      15        Wakeup from STOP2 (LPTIM1, EXTI3)        Yes
+ *
+ * The HAL tick (TIM7) keeps TICK_INT_PRIORITY.
+ *
+ * "irq probe <source> [count]" measures entry latency of an interrupt at its priority: a
+ * timer at priority 0 fires every IRQ_PROBE_INTERVAL_US plus a pseudo-random jitter, notes
+ * the DWT cycle counter and pends the interrupt in the NVIC. The handler, instrumented with
+ * IRQ_LATENCY(), records the cycles until its entry in a histogram reported by "cmd pm irq".
+ * Latency therefore includes time the interrupt spent masked by critical sections or behind
+ * handlers of equal or higher priority. A probe still pending when the next one is due
+ * counts as missed. Handlers must tolerate entries without a peripheral event.
+ *
+ * With IRQ_PROBE_PIN_ENABLE, IRQ_PROBE_PIN is driven high while a probe is pending, so its
+ * pulse width can also be measured with a scope.
+ */
+
+#ifndef _IRQ_H_
+#define _IRQ_H_
+
+#include <stdint.h>
+
+#include "common.h"
+#include "stm32l4xx_hal.h"
+
+/* Interrupt priorities */
+#define IRQ_PRIO_PROBE 0U    // Latency probe timer.
+#define IRQ_PRIO_ZC 2U       // Mains zero crossing, times burst firing.
+#define IRQ_PRIO_SAMPLE 5U   // Sampling timer and thermocouple SPI DMA.
+#define IRQ_PRIO_CYCLIC 5U   // Rate group base timer, releases group threads.
+#define IRQ_PRIO_CONSOLE 6U  // Console UART, its DMA channels, and USB.
+#define IRQ_PRIO_ARCHIVE 7U  // Archive flash SPI DMA.
+#define IRQ_PRIO_TELEMETRY 7U // Telemetry UART and its DMA channel, below the console.
+#define IRQ_PRIO_MODBUS 7U   // Modbus RS485 USART, end of frame and line errors.
+#define IRQ_PRIO_CAN 7U      // CAN receive FIFO 0.
+#define IRQ_PRIO_WORK 14U    // Work queue wake, after every other handler but the wakeup.
+#define IRQ_PRIO_WAKEUP 15U  // Wakeup from STOP2.
+
+/* Configuration parameters */
+#ifndef IRQ_PROBE_ENABLE
+#define IRQ_PROBE_ENABLE 1 // Set to 0 to compile latency probe points out.
+#endif
+#define IRQ_PROBE_INTERVAL_US 1000U // Shortest time between probes (us).
+#define IRQ_PROBE_JITTER_US 511U    // Largest random time added to interval (us), all ones.
+#define IRQ_PROBE_DEFAULT 1000U     // Probes sent by "irq probe" without count.
+#define IRQ_PROBE_MAX 100000U       // Largest count accepted by "irq probe".
+#ifndef IRQ_PROBE_PIN_ENABLE
+#define IRQ_PROBE_PIN_ENABLE 0 // Set to 1 to drive IRQ_PROBE_PIN while a probe is pending.
+#endif
+#define IRQ_PROBE_PORT GPIOC    // Probe pin port.
+#define IRQ_PROBE_PIN GPIO_PIN_8 // Probe pin (CN10 pin 2 on Nucleo).
+
+/* Interrupt sources that can be probed */
+typedef enum
+{
+    IRQ_SRC_ZC,      // Mains zero crossing.
+    IRQ_SRC_SAMPLE,  // Sampling timer.
+    IRQ_SRC_SPI_DMA, // Thermocouple SPI receive DMA.
+    IRQ_SRC_UART,    // Console UART.
+    IRQ_SRC_USB,     // USB OTG FS.
+
+    IRQ_NUM_SRCS // Number of interrupt sources.
+} irq_src_t;
+
+/**
+ * @brief Apply priority map to interrupts configured by generated code, register "irq" commands.
+ *
+ * Drivers set priorities of interrupts they enable themselves from the map above.
+ *
+ * @return MOD_OK if successful, otherwise a "MOD_ERR" value.
+ */
+mod_err_t irq_init(void);
+
+/**
+ * @brief Record latency of probe that entered handler, see IRQ_LATENCY().
+ *
+ * @param src Interrupt source of handler.
+ */
+void irq_probe_hit(irq_src_t src);
+
+/* Private variable for IRQ_LATENCY(), source of pending probe + 1 or 0. Do not modify. */
+extern volatile uint32_t _irq_probe_pending;
+
+/**
+ * @brief Record latency at entry of interrupt handler, if a probe of src is pending.
+ *
+ * @param src Interrupt source of handler, an irq_src_t.
+ *
+ * @note Place first in handler, before anything that takes time.
+ */
+#if IRQ_PROBE_ENABLE
+#define IRQ_LATENCY(src)                                \
+    do                                                  \
+    {                                                   \
+        if (_irq_probe_pending == (uint32_t)(src) + 1U) \
+        {                                               \
+            irq_probe_hit(src);                         \
+        }                                               \
+    } while (0)
+#else
+#define IRQ_LATENCY(src)
+#endif
+
+#endif
@@ -5,15 +5,51 @@
  * @version 0.1
  * @date 2021-07-16
  * 
- * Currently supports logging messages over UART with timestamps and configurable global log level.
+ * Currently supports logging messages with timestamps and configurable global log level. Messages
+ * of the LOGE..LOGV macros go to a log sink selected at runtime with "log sink": the console
+ * (default), ITM stimulus port LOG_ITM_PORT for SWO capture by a debugger, the RTT channel a
+ * debug probe reads from RAM (see rtt.h), or nowhere. LOG()
+ * output such as command responses always goes to the console.
+ *
+ * Fault storms are kept off the console twice: every call site is rate limited (see
+ * log_rate_allow()), and a message identical to the previous one is counted instead of
+ * printed. The count follows as "Last message repeated N times" with the next different
+ * message, or after LOG_REPEAT_FLUSH_MS.
+ *
+ * Each message is formatted whole, level and timestamp included, and committed to the sink in
+ * one piece, so a full transmit buffer never leaves partial lines. Messages longer than
+ * LOG_LINE_LEN are cut short and end in "...". Messages that find no room, in the deferred
+ * record ring or in the console transmit buffer, are handled by the overflow policy selected
+ * with "log overflow" (see log_overflow_t) and counted per level.
  * 
- * In each module that uses logging functionality, define a TAG variable like so: 
+ * In each module that uses logging functionality, define its tag like so: 
  *
- * static const char* TAG = "MyModule";
+ * LOG_TAG_DEFINE("MyModule");
  *
  * Then use one of logging macros to produce output, e.g: 
  * 
  * LOGW(TAG, "Baud rate error %.1f%%. Requested: %d baud, actual: %d baud", error * 100, baud_req, baud_real);
+ *
+ * Tag descriptors are collected by the linker into the log_tags section (see the .log_tags
+ * output section of the linker scripts), so every tag has an index, its position there, into
+ * a dense array of levels. Filtering a message is a single load, and "log status" lists every
+ * tag of the image whether it logged yet or not.
+ *
+ * Interrupt handlers log with LOGE_ISR..LOGV_ISR instead, eg. from a UART or DMA handler:
+ *
+ * LOGW_ISR(TAG, "Error flags 0x%lx", status & ERROR_FLAGS);
+ *
+ * These take up to LOG_ISR_MAX_ARGS integer or pointer arguments, which are copied with the tag,
+ * level, format string and tick into a fixed-size record of a lock-free ring. They make no
+ * kernel calls, so handlers above configLIBRARY_MAX_SYSCALL_INTERRUPT_PRIORITY may use them.
+ * They never wait: a record that finds the ring full is dropped and counted, in "ISR DROPPED"
+ * of "cmd pm log" and its level's counter. The log thread prints the records, woken through
+ * the deferred work queue (see work.h). Without LOG_DEFERRED, as in the host simulation, they
+ * are printed by the next message logged from a thread.
+ *
+ * With LOG_INTERNED the image holds no format strings and formats no messages: each message
+ * leaves as a binary frame of a few bytes, which Tools/logdecode formats on the host from the
+ * ELF file of the image. See LOG_INTERNED below.
  */
 
 #ifndef _LOG_H_
@@ -27,6 +63,83 @@
 
 /* Configuration parameters */
 #define LOG_TOGGLE_CHAR '\t' // Press LOG_TOGGLE_CHAR to toggle logging on and off.
+#define LOG_MAX_TAG_ENTRIES 16 // Maximum number of tags with their own log level.
+#define LOG_MAX_TAGS 40        // Maximum number of tags defined with LOG_TAG_DEFINE() in the image.
+
+/**
+ * @brief Deferred logging.
+ *
+ * When enabled, log_printf() only captures the tag, level, format string pointer and
+ * raw variadic argument words into a record ring. A low priority log thread formats
+ * and prints the records later, so callers do not pay for vprintf().
+ *
+ * Strings formatted with %s are copied into the record, LOG_DEFERRED_STR_LEN characters of
+ * all of a message's strings together, terminators included. Longer strings are cut short.
+ */
+#ifndef LOG_DEFERRED
+#define LOG_DEFERRED 1
+#endif
+/**
+ * @brief Interned logging.
+ *
+ * When enabled, the format strings of LOGE..LOGV are placed in the log_fmt section, which the
+ * linker scripts keep in the ELF file but out of flash, at address 0. A message is sent on the
+ * log sink as a COBS frame (see frame.h) preceded by a delimiter, carrying the address of its
+ * format string, 16 bits, instead of the formatted text:
+ *
+ *      uint8_t  type;   // LOG_TELEMETRY_TYPE.
+ *      uint8_t  level;  // log_level_t.
+ *      uint8_t  tag;    // Position of tag in log_tags section.
+ *      uint16_t fmt;    // Address of format string in log_fmt section.
+ *      uint32_t tick;   // Kernel tick when message was logged (ms).
+ *      uint8_t  args[]; // Arguments, see log_arg_kind_t.
+ *
+ * Formatting, colour, level and tag prefixes and timestamps move to the host: Tools/logdecode
+ * reads format strings and tag names from the ELF file of the same build, eg.
+ * Debug/reflow_oven_controller.elf, and passes console text around the frames through.
+ * A message of a few numbers is some 20 bytes on the wire instead of 60 to 100.
+ *
+ * @note Messages take at most LOG_INTERNED_MAX_ARGS arguments, integers of up to 64 bits,
+ *       doubles (sent as floats) and strings (cut to LOG_INTERNED_STR_LEN characters).
+ *       Timestamps are uptime, the host has no RTC reading to convert them.
+ */
+#ifndef LOG_INTERNED
+#define LOG_INTERNED 0
+#endif
+#define LOG_TELEMETRY_TYPE 0x0BU // First payload byte of an interned log frame.
+#define LOG_INTERNED_MAX_ARGS 8  // Most arguments of a message.
+#define LOG_INTERNED_STR_LEN 24U // Longest string argument sent, longer ones are cut short.
+
+#define LOG_ISR_RECORDS 16U        // Records of interrupt handler messages, must be a power of two.
+#define LOG_ISR_MAX_ARGS 4         // Most arguments of an interrupt handler message.
+#define LOG_DEFERRED_RECORDS 32    // Number of records in ring, must be a power of two.
+#define LOG_DEFERRED_ARG_WORDS 20  // Maximum number of argument words captured per record, must be even.
+#define LOG_DEFERRED_STR_LEN 32U   // Bytes of string arguments copied per record.
+#define LOG_THREAD_STACK_SIZE 1024 // Log thread stack size.
+#define LOG_FLUSH_PERIOD_MS 20     // Maximum time records wait in ring before log thread prints them.
+#define LOG_ITM_PORT 0U            // ITM stimulus port of ITM log sink.
+#define LOG_ITM_WAIT_POLLS 100U    // Polls of busy ITM stimulus port per character before message is dropped.
+#define LOG_RATE_BURST 10U         // Messages a call site may log back to back.
+#define LOG_RATE_PERIOD_MS 200U    // Sustained rate of a call site, one message per period (ms).
+#define LOG_LINE_LEN 192U          // Longest message after tag, longer ones are cut short and never collapsed.
+#define LOG_BLOCK_TIMEOUT_MS 100U  // Longest wait for room before a message is dropped (ms).
+#define LOG_REPEAT_FLUSH_MS 1000U  // Longest wait for a different message before repeats are reported (ms).
+
+/**
+ * @brief Compile-time log level.
+ *
+ * Messages above this level compile to nothing, so neither their format strings
+ * nor their calls to log_printf() end up in the image. Must be given as the numeric
+ * value of a log_level_t (eg. -DLOG_COMPILE_LEVEL=3 for LOG_INFO), since it is
+ * evaluated by the preprocessor. Runtime log levels can only lower it further.
+ */
+#ifndef LOG_COMPILE_LEVEL
+#ifdef NDEBUG
+#define LOG_COMPILE_LEVEL 3 // LOG_INFO
+#else
+#define LOG_COMPILE_LEVEL 5 // LOG_VERBOSE
+#endif
+#endif
 
 /**
  * @brief Logging levels.
@@ -43,6 +156,61 @@ typedef enum
     LOG_DEFAULT = LOG_INFO // Default log level.
 } log_level_t;
 
+/**
+ * @brief Log sinks.
+ */
+typedef enum
+{
+    LOG_SINK_CONSOLE, // Console transport (UART or USB CDC).
+    LOG_SINK_ITM,     // ITM stimulus port, dropped while no debugger enabled it or its FIFO stays full.
+    LOG_SINK_RTT,     // RTT up buffer read by the debug probe, dropped while it is full (see rtt.h).
+    LOG_SINK_NULL,    // Discard messages.
+
+    LOG_NUM_SINKS // Number of log sinks.
+} log_sink_t;
+
+/**
+ * @brief Overflow policies, what happens to a message that finds no room.
+ *
+ * The log thread always waits up to LOG_BLOCK_TIMEOUT_MS for room in the console transmit
+ * buffer, so with LOG_DEFERRED the policies apply to the record ring. Without it messages are
+ * printed by the caller, and the transmit buffer holds characters rather than messages, so
+ * LOG_OVERFLOW_DROP_OLDEST drops the new message there.
+ */
+typedef enum
+{
+    LOG_OVERFLOW_DROP_NEWEST, // Drop the new message.
+    LOG_OVERFLOW_DROP_OLDEST, // Overwrite the oldest message not printed yet.
+    LOG_OVERFLOW_BLOCK,       // Wait up to LOG_BLOCK_TIMEOUT_MS for room, threads only, then drop the new message.
+
+    LOG_NUM_OVERFLOW_POLICIES // Number of overflow policies.
+} log_overflow_t;
+
+#ifndef LOG_OVERFLOW_DEFAULT
+#define LOG_OVERFLOW_DEFAULT LOG_OVERFLOW_DROP_NEWEST // Overflow policy after reset.
+#endif
+
+/**
+ * @brief Tag descriptor, placed in the log_tags section by LOG_TAG_DEFINE().
+ */
+typedef struct
+{
+    const char *name; // Unique module tag.
+} log_tag_t;
+
+/* Bounds of log_tags section, set by the linker. */
+extern const log_tag_t __start_log_tags[];
+extern const log_tag_t __stop_log_tags[];
+
+/**
+ * @brief Define module tag TAG.
+ *
+ * @param tag_name Tag string, at most 9 characters so "log set" can name it.
+ */
+#define LOG_TAG_DEFINE(tag_name)                                                                     \
+    static const log_tag_t _log_tag __attribute__((used, section("log_tags"))) = {.name = tag_name}; \
+    static const log_tag_t *const TAG = &_log_tag
+
 /* Logging text colours */
 #define LOG_COLOUR_BLACK "30"
 #define LOG_COLOUR_RED "31"
@@ -64,12 +232,115 @@ typedef enum
 /**
  * @brief Runtime macro to format string with additional information.
  * 
- * @param level First letter of log level.
  * @param format Format string before additional information is prepended.
  * 
- * Additional information prepended from left-to-right: Colour, Log level, Time (ms), Tag. 
+ * Additional information prepended from left-to-right: Colour, Log level, Time, Tag. Colour,
+ * level and time are printed by log_printf(), time as "YYYY-MM-DD hh:mm:ss.mmm" once the RTC
+ * is set (see rtc.h), otherwise as seconds since reset with milliseconds.
  */
-#define LOG_FORMAT(letter, format) "\r" LOG_COLOUR_##letter #letter " (%lu.%03lu) %s: " format "\r\n"
+#define LOG_FORMAT(format) "%s: " format "\r\n"
+
+/**
+ * @brief Kinds of interned message arguments, 4 bits each in the shape of a message.
+ *
+ * Arguments are encoded one after the other, little-endian and unaligned.
+ */
+typedef enum
+{
+    LOG_ARG_END,    // No more arguments.
+    LOG_ARG_U32,    // 32-bit integer, pointer or character, 4 bytes.
+    LOG_ARG_U64,    // 64-bit integer, 8 bytes.
+    LOG_ARG_DOUBLE, // Floating point, as float, 4 bytes.
+    LOG_ARG_STR,    // String, characters and terminating zero.
+} log_arg_kind_t;
+
+/**
+ * @brief Kind of an interned message argument, from its type after default argument promotion.
+ *
+ * @param x Argument, not evaluated.
+ */
+#define LOG_ARG_KIND(x)                                         \
+    _Generic((x) + 0,                                           \
+             float: LOG_ARG_DOUBLE,                             \
+             double: LOG_ARG_DOUBLE,                            \
+             long long: LOG_ARG_U64,                            \
+             unsigned long long: LOG_ARG_U64,                   \
+             char *: LOG_ARG_STR,                               \
+             const char *: LOG_ARG_STR,                         \
+             default: LOG_ARG_U32)
+
+/**
+ * @brief Shape of an interned message, the kinds of its arguments, first in the low nibble.
+ *
+ * Compile-time constant. More than LOG_INTERNED_MAX_ARGS arguments do not compile.
+ */
+#define LOG_SHAPE(...) LOG_SHAPE_CAT(LOG_SHAPE_, LOG_SHAPE_NARGS(__VA_ARGS__))(__VA_ARGS__)
+#define LOG_SHAPE_NARGS(...) LOG_SHAPE_NARGS_(0, ##__VA_ARGS__, 8, 7, 6, 5, 4, 3, 2, 1, 0)
+#define LOG_SHAPE_NARGS_(_0, _1, _2, _3, _4, _5, _6, _7, _8, n, ...) n
+#define LOG_SHAPE_CAT(a, b) LOG_SHAPE_CAT_(a, b)
+#define LOG_SHAPE_CAT_(a, b) a##b
+#define LOG_SHAPE_0() 0U
+#define LOG_SHAPE_1(x) ((uint32_t)LOG_ARG_KIND(x))
+#define LOG_SHAPE_2(x, ...) (LOG_SHAPE_1(x) | LOG_SHAPE_1(__VA_ARGS__) << 4)
+#define LOG_SHAPE_3(x, ...) (LOG_SHAPE_1(x) | LOG_SHAPE_2(__VA_ARGS__) << 4)
+#define LOG_SHAPE_4(x, ...) (LOG_SHAPE_1(x) | LOG_SHAPE_3(__VA_ARGS__) << 4)
+#define LOG_SHAPE_5(x, ...) (LOG_SHAPE_1(x) | LOG_SHAPE_4(__VA_ARGS__) << 4)
+#define LOG_SHAPE_6(x, ...) (LOG_SHAPE_1(x) | LOG_SHAPE_5(__VA_ARGS__) << 4)
+#define LOG_SHAPE_7(x, ...) (LOG_SHAPE_1(x) | LOG_SHAPE_6(__VA_ARGS__) << 4)
+#define LOG_SHAPE_8(x, ...) (LOG_SHAPE_1(x) | LOG_SHAPE_7(__VA_ARGS__) << 4)
+
+/**
+ * @brief Call site of an interned message: format string address, tag position and level.
+ *
+ * Places the format string in the log_fmt section, which is not loaded, only its address
+ * ends up in the image.
+ *
+ * @param tag Module tag.
+ * @param level Message's log level.
+ * @param fmt Format string literal.
+ */
+#define LOG_SITE(tag, level, fmt)                                                            \
+    ({                                                                                       \
+        static const char _log_fmt[] __attribute__((used, section("log_fmt"))) = fmt;       \
+        (uint32_t)(uintptr_t)_log_fmt | (uint32_t)((tag) - __start_log_tags) << 16 |          \
+            (uint32_t)(level) << 24;                                                         \
+    })
+
+/* Fields of an interned call site */
+#define LOG_SITE_FMT(site) ((site) & 0xFFFFU)
+#define LOG_SITE_TAG(site) (((site) >> 16) & 0xFFU)
+#define LOG_SITE_LEVEL(site) ((log_level_t)((site) >> 24))
+
+/**
+ * @brief Log message, formatted as text or interned, without filtering.
+ *
+ * @param tag Module tag.
+ * @param level Message's log level.
+ * @param fmt Format string literal.
+ * @param ... Variable arguments.
+ */
+#if LOG_INTERNED
+#define LOG_MESSAGE(tag, level, fmt, ...) \
+    log_interned(LOG_SITE(tag, level, fmt), LOG_SHAPE(__VA_ARGS__), ##__VA_ARGS__)
+#else
+#define LOG_MESSAGE(tag, level, fmt, ...) log_printf(tag, level, LOG_FORMAT(fmt), (tag)->name, ##__VA_ARGS__)
+#endif
+
+/**
+ * @brief Log message from interrupt context, formatted as text or interned, without filtering.
+ *
+ * @param tag Module tag.
+ * @param level Message's log level.
+ * @param fmt Format string literal.
+ * @param ... Up to LOG_ISR_MAX_ARGS integer or pointer arguments.
+ */
+#if LOG_INTERNED
+#define LOG_ISR_MESSAGE(tag, level, fmt, ...) \
+    log_interned_isr(LOG_SITE(tag, level, fmt), LOG_SHAPE_NARGS(__VA_ARGS__), ##__VA_ARGS__)
+#else
+#define LOG_ISR_MESSAGE(tag, level, fmt, ...) \
+    log_printf_isr(tag, level, LOG_FORMAT(fmt), LOG_SHAPE_NARGS(__VA_ARGS__), ##__VA_ARGS__)
+#endif
 
 #define ASSERTION_FORMAT LOG_COLOUR_E "E (%lu.%03lu) Assertion failed at %s, line %d" \
                                       "\r\n"
@@ -81,6 +352,57 @@ typedef enum
  */
 mod_err_t log_init(void);
 
+/**
+ * @brief Restore global and tag log levels stored by "log set".
+ *
+ * Must be called after nvs_init().
+ *
+ * @return MOD_OK if levels were restored, MOD_DID_NOTHING if none are stored,
+ *         otherwise a "MOD_ERR" value.
+ */
+mod_err_t log_load_levels(void);
+
+/**
+ * @brief Create log thread, which prints deferred log records.
+ *
+ * @return MOD_OK if successful, otherwise a "MOD_ERR" value.
+ *
+ * @note Does nothing if LOG_DEFERRED is disabled. Function does not start scheduler.
+ */
+mod_err_t log_start(void);
+
+/**
+ * @brief Select output of log messages.
+ *
+ * @param sink New log sink.
+ *
+ * @return MOD_OK if successful, MOD_ERR_ARG if sink is not a log_sink_t.
+ */
+mod_err_t log_sink_set(log_sink_t sink);
+
+/**
+ * @brief Get output of log messages.
+ *
+ * @return Current log sink.
+ */
+log_sink_t log_sink_get(void);
+
+/**
+ * @brief Select overflow policy.
+ *
+ * @param policy New overflow policy.
+ *
+ * @return MOD_OK if successful, MOD_ERR_ARG if policy is not a log_overflow_t.
+ */
+mod_err_t log_overflow_set(log_overflow_t policy);
+
+/**
+ * @brief Get overflow policy.
+ *
+ * @return Current overflow policy.
+ */
+log_overflow_t log_overflow_get(void);
+
 /**
  * @brief Toggle data logging.
  * 
@@ -100,78 +422,271 @@ bool log_is_active(void);
 /** 
  * @brief Base "printf" style function for logging.
  *
- * @param tag Unique module tag.
+ * @param tag Module tag.
  * @param level Message's log level.
  * @param fmt Format string.
  * @param ... Variable arguments.
  *
  * This function is not intended to be used directly. Instead, use one of 
- * LOGE, LOGW, LOGI, LOGD, LOGV macros below.
+ * LOGE, LOGW, LOGI, LOGD, LOGV macros below, which filter by log level at the call site.
+ * The kernel tick is captured here, it is only formatted into a timestamp when the message
+ * is printed, by the log thread if LOG_DEFERRED is enabled.
+ */
+void log_printf(const log_tag_t *tag, log_level_t level, const char *fmt, ...);
+
+/**
+ * @brief Base function for interned logging, see LOG_INTERNED.
+ *
+ * @param site Call site, see LOG_SITE().
+ * @param shape Kinds of arguments, see LOG_SHAPE().
+ * @param ... Variable arguments.
+ *
+ * Like log_printf(), not intended to be used directly. Arguments are encoded into the
+ * message right away, so strings need not outlive the call, even with LOG_DEFERRED.
+ */
+void log_interned(uint32_t site, uint32_t shape, ...);
+
+/**
+ * @brief Base function for logging from interrupt handlers, see LOGE_ISR..LOGV_ISR.
+ *
+ * @param tag Module tag.
+ * @param level Message's log level.
+ * @param fmt Format string.
+ * @param nargs Number of variable arguments, at most LOG_ISR_MAX_ARGS.
+ * @param ... Integer or pointer arguments.
+ *
+ * Not intended to be used directly. Safe to call at any interrupt priority.
  */
-void log_printf(const char *tag, log_level_t level, const char *fmt, ...);
+void log_printf_isr(const log_tag_t *tag, log_level_t level, const char *fmt, uint32_t nargs, ...);
+
+/**
+ * @brief Base function for interned logging from interrupt handlers, see log_printf_isr().
+ *
+ * @param site Call site, see LOG_SITE().
+ * @param nargs Number of variable arguments, at most LOG_ISR_MAX_ARGS.
+ * @param ... Integer or pointer arguments.
+ */
+void log_interned_isr(uint32_t site, uint32_t nargs, ...);
+
+/**
+ * @brief Get tag's log level.
+ *
+ * @param tag Module tag.
+ *
+ * @return Tag's log level, or global log level if tag has none.
+ */
+log_level_t log_level_get(const log_tag_t *tag);
+
+/**
+ * @brief Rate limit state of a logging macro call site, see log_rate_allow().
+ */
+typedef struct
+{
+    bool primed;         // Site logged before, last_tick is valid.
+    uint32_t last_tick;  // Kernel tick of last message logged or suppressed.
+    uint32_t credit;     // Time accumulated for messages (ms), each spends LOG_RATE_PERIOD_MS.
+    uint32_t suppressed; // Messages suppressed since the last one logged.
+} log_rate_t;
+
+/**
+ * @brief Token bucket rate limit of a call site.
+ *
+ * @param rate Rate limit state of call site.
+ * @param tag Module tag of call site.
+ *
+ * @return true if message may be logged, false if it is suppressed.
+ *
+ * Each call site may log LOG_RATE_BURST messages back to back and one every
+ * LOG_RATE_PERIOD_MS on average, so a fault repeating at the sample rate cannot flood the
+ * console. The number of suppressed messages is logged ahead of the next one let through.
+ * This function is not intended to be used directly, logging macros call it.
+ */
+bool log_rate_allow(log_rate_t *const rate, const log_tag_t *tag);
 
 /* Private variables for logging macros. Do not modify. */
-extern bool _log_active;          // Is data logging active or inactive?
-extern int32_t _global_log_level; // Only print messages at or below the global log level.
+extern bool _log_active;                  // Is data logging active or inactive?
+extern int32_t _global_log_level;          // Only print messages at or below the global log level.
+extern volatile uint8_t _log_tag_levels[LOG_MAX_TAGS]; // Level of every tag, indexed by position in log_tags section.
+
+/**
+ * @brief Get tag's log level, resolved from patterns and global level whenever a level is set.
+ */
+#define LOG_TAG_LEVEL(tag) ((log_level_t)_log_tag_levels[(tag) - __start_log_tags])
+
+/**
+ * @brief Rate limit messages of the macro call site, see log_rate_allow().
+ */
+#define LOG_SITE_RATE(tag)                    \
+    ({                                        \
+        static log_rate_t _log_rate;          \
+        log_rate_allow(&_log_rate, tag);      \
+    })
 
 /**
  * @brief Runtime macros to output a log message at a specified level.
  * 
- * @param tag Unique tag associated with module.
+ * @param tag Module tag, defined with LOG_TAG_DEFINE().
  * @param fmt Format string.
  * @param ... Variable arguments. 
  * 
- * @note tag should have static storage duration.
+ * @note Macros above LOG_COMPILE_LEVEL expand to an empty statement.
  */
+#if LOG_COMPILE_LEVEL >= 1 // LOG_ERROR
 #define LOGE(tag, fmt, ...)                                                                           \
     do                                                                                                \
     {                                                                                                 \
-        if (_log_active)                                            \
+        if (_log_active && LOG_ERROR <= LOG_TAG_LEVEL(tag) && LOG_SITE_RATE(tag))                     \
         {                                                                                             \
-            uint32_t ms = HAL_GetTick();                                                              \
-            log_printf(tag, LOG_ERROR, LOG_FORMAT(E, fmt), ms / 1000, ms % 1000, tag, ##__VA_ARGS__); \
+            LOG_MESSAGE(tag, LOG_ERROR, fmt, ##__VA_ARGS__);                                          \
         }                                                                                             \
     } while (0)
+#else
+#define LOGE(tag, fmt, ...) \
+    do                      \
+    {                       \
+    } while (0)
+#endif
 
+#if LOG_COMPILE_LEVEL >= 2 // LOG_WARNING
 #define LOGW(tag, fmt, ...)                                                                             \
     do                                                                                                  \
     {                                                                                                   \
-        if (_log_active)                                                                                \
+        if (_log_active && LOG_WARNING <= LOG_TAG_LEVEL(tag) && LOG_SITE_RATE(tag))                     \
         {                                                                                               \
-            uint32_t ms = HAL_GetTick();                                                                \
-            log_printf(tag, LOG_WARNING, LOG_FORMAT(W, fmt), ms / 1000, ms % 1000, tag, ##__VA_ARGS__); \
+            LOG_MESSAGE(tag, LOG_WARNING, fmt, ##__VA_ARGS__);                                          \
         }                                                                                               \
     } while (0)
+#else
+#define LOGW(tag, fmt, ...) \
+    do                      \
+    {                       \
+    } while (0)
+#endif
 
+#if LOG_COMPILE_LEVEL >= 3 // LOG_INFO
 #define LOGI(tag, fmt, ...)                                                                          \
     do                                                                                               \
     {                                                                                                \
-        if (_log_active)                                                                             \
+        if (_log_active && LOG_INFO <= LOG_TAG_LEVEL(tag) && LOG_SITE_RATE(tag))                     \
         {                                                                                            \
-            uint32_t ms = HAL_GetTick();                                                             \
-            log_printf(tag, LOG_INFO, LOG_FORMAT(I, fmt), ms / 1000, ms % 1000, tag, ##__VA_ARGS__); \
+            LOG_MESSAGE(tag, LOG_INFO, fmt, ##__VA_ARGS__);                                          \
         }                                                                                            \
     } while (0)
+#else
+#define LOGI(tag, fmt, ...) \
+    do                      \
+    {                       \
+    } while (0)
+#endif
 
+#if LOG_COMPILE_LEVEL >= 4 // LOG_DEBUG
 #define LOGD(tag, fmt, ...)                                                                           \
     do                                                                                                \
     {                                                                                                 \
-        if (_log_active)                                                                              \
+        if (_log_active && LOG_DEBUG <= LOG_TAG_LEVEL(tag) && LOG_SITE_RATE(tag))                     \
         {                                                                                             \
-            uint32_t ms = HAL_GetTick();                                                              \
-            log_printf(tag, LOG_DEBUG, LOG_FORMAT(D, fmt), ms / 1000, ms % 1000, tag, ##__VA_ARGS__); \
+            LOG_MESSAGE(tag, LOG_DEBUG, fmt, ##__VA_ARGS__);                                          \
         }                                                                                             \
     } while (0)
+#else
+#define LOGD(tag, fmt, ...) \
+    do                      \
+    {                       \
+    } while (0)
+#endif
 
+#if LOG_COMPILE_LEVEL >= 5 // LOG_VERBOSE
 #define LOGV(tag, fmt, ...)                                                                             \
     do                                                                                                  \
     {                                                                                                   \
-        if (_log_active)                                                                                \
+        if (_log_active && LOG_VERBOSE <= LOG_TAG_LEVEL(tag) && LOG_SITE_RATE(tag))                     \
         {                                                                                               \
-            uint32_t ms = HAL_GetTick();                                                                \
-            log_printf(tag, LOG_VERBOSE, LOG_FORMAT(V, fmt), ms / 1000, ms % 1000, tag, ##__VA_ARGS__); \
+            LOG_MESSAGE(tag, LOG_VERBOSE, fmt, ##__VA_ARGS__);                                          \
         }                                                                                               \
     } while (0)
+#else
+#define LOGV(tag, fmt, ...) \
+    do                      \
+    {                       \
+    } while (0)
+#endif
+
+/**
+ * @brief Log message from interrupt handler, if its tag's level allows it.
+ *
+ * Not rate limited per call site like LOGE..LOGV, the fixed ring bounds a storm instead.
+ * Arguments other than up to LOG_ISR_MAX_ARGS integers or pointers do not compile.
+ *
+ * @param tag Module tag, defined with LOG_TAG_DEFINE().
+ * @param level Message's log level.
+ * @param fmt Format string.
+ * @param ... Variable arguments.
+ */
+#define LOG_FROM_ISR(tag, level, fmt, ...)                                                        \
+    do                                                                                            \
+    {                                                                                             \
+        _Static_assert((LOG_SHAPE(__VA_ARGS__) & 0xEEEEEEEEU) == 0U &&                            \
+                           LOG_SHAPE_NARGS(__VA_ARGS__) <= LOG_ISR_MAX_ARGS,                      \
+                       "Interrupt handler messages take up to LOG_ISR_MAX_ARGS integer arguments"); \
+        if (_log_active && (level) <= LOG_TAG_LEVEL(tag))                                         \
+        {                                                                                         \
+            LOG_ISR_MESSAGE(tag, level, fmt, ##__VA_ARGS__);                                      \
+        }                                                                                         \
+    } while (0)
+
+/**
+ * @brief Runtime macros to log a message from an interrupt handler at a specified level.
+ *
+ * @param tag Module tag, defined with LOG_TAG_DEFINE().
+ * @param fmt Format string.
+ * @param ... Up to LOG_ISR_MAX_ARGS integer or pointer arguments.
+ *
+ * @note Macros above LOG_COMPILE_LEVEL expand to an empty statement.
+ */
+#if LOG_COMPILE_LEVEL >= 1 // LOG_ERROR
+#define LOGE_ISR(tag, fmt, ...) LOG_FROM_ISR(tag, LOG_ERROR, fmt, ##__VA_ARGS__)
+#else
+#define LOGE_ISR(tag, fmt, ...) \
+    do                          \
+    {                           \
+    } while (0)
+#endif
+
+#if LOG_COMPILE_LEVEL >= 2 // LOG_WARNING
+#define LOGW_ISR(tag, fmt, ...) LOG_FROM_ISR(tag, LOG_WARNING, fmt, ##__VA_ARGS__)
+#else
+#define LOGW_ISR(tag, fmt, ...) \
+    do                          \
+    {                           \
+    } while (0)
+#endif
+
+#if LOG_COMPILE_LEVEL >= 3 // LOG_INFO
+#define LOGI_ISR(tag, fmt, ...) LOG_FROM_ISR(tag, LOG_INFO, fmt, ##__VA_ARGS__)
+#else
+#define LOGI_ISR(tag, fmt, ...) \
+    do                          \
+    {                           \
+    } while (0)
+#endif
+
+#if LOG_COMPILE_LEVEL >= 4 // LOG_DEBUG
+#define LOGD_ISR(tag, fmt, ...) LOG_FROM_ISR(tag, LOG_DEBUG, fmt, ##__VA_ARGS__)
+#else
+#define LOGD_ISR(tag, fmt, ...) \
+    do                          \
+    {                           \
+    } while (0)
+#endif
+
+#if LOG_COMPILE_LEVEL >= 5 // LOG_VERBOSE
+#define LOGV_ISR(tag, fmt, ...) LOG_FROM_ISR(tag, LOG_VERBOSE, fmt, ##__VA_ARGS__)
+#else
+#define LOGV_ISR(tag, fmt, ...) \
+    do                          \
+    {                           \
+    } while (0)
+#endif
 
 /**
  * @brief Runtime macro to output message with no specified level.
@@ -183,6 +698,26 @@ extern int32_t _global_log_level; // Only print messages at or below the global
  */
 #define LOG(format, ...) printf(LOG_RESET_COLOUR format, ##__VA_ARGS__)
 
+/**
+ * @brief Runtime macro to output a string as is, eg. help text.
+ *
+ * @param str String, not a format: no arguments, no colour reset prefix.
+ *
+ * Skips the formatter, the string is copied straight into the console transmit buffer, see
+ * printf_puts(). Start a response with LOG() or LOG_STR(LOG_RESET_COLOUR) for the reset.
+ */
+#define LOG_STR(str) printf_puts(str)
+
+/**
+ * @brief Halt after failed assertion, forever loop unless overridden (host simulation aborts).
+ */
+#ifndef ASSERT_HALT
+#define ASSERT_HALT() \
+    while (1)         \
+    {                 \
+    }
+#endif
+
 /**
  * @brief Assertion macro.
  *
@@ -195,9 +730,7 @@ extern int32_t _global_log_level; // Only print messages at or below the global
         {                                                                       \
             uint32_t ms = HAL_GetTick();                                        \
             printf(ASSERTION_FORMAT, ms / 1000, ms % 1000, __FILE__, __LINE__); \
-            while (1)                                                           \
-            {                                                                   \
-            }                                                                   \
+            ASSERT_HALT();                                                      \
         }                                                                       \
     } while (0)
 
@@ -0,0 +1,169 @@
+/**
+ * @file modbus.h
+ * @author Timothy Nguyen
+ * @brief Modbus RTU slave: register map of the parameter registry and controller status.
+ * @version 0.1
+ * @date 2021-09-06
+ *
+ * The slave answers on an RS485 line (see modbus_port_init()) at address "modbus.addr".
+ * The receiver times out after 3.5 character times of silence, which ends a frame in
+ * hardware, and the port drops frames addressed to other slaves in its interrupt, before
+ * checking their CRC, so a bus polling many ovens costs each one an interrupt per frame.
+ * Frames for this slave are posted to the command active object (CMD_MODBUS_SIG), which
+ * executes them with modbus_execute() like console commands, parameters being written by
+ * the command thread only. Broadcasts (address 0) are executed without response.
+ *
+ * Register map, addresses from 0:
+ *
+ * Coils (read 0x01, write 0x05 / 0x0F):
+ * - 0 RUN: reads 1 while a reflow process runs. Writing 1 starts the loaded profile, as
+ *   "reflow start", writing 0 stops the process, as "reflow stop".
+ *
+ * Discrete inputs (read 0x02):
+ * - 0 running, 1 safety tripped, 2 thermocouple error.
+ *
+ * Input registers (read 0x04), from the status snapshot of "reflow status bin":
+ * - MODBUS_IR_* below. Temperatures are signed tenths of a deg C, MODBUS_NAN if not read.
+ *
+ * Holding registers (read 0x03, write 0x06 / 0x10), generated from the parameter registry:
+ * - Parameter ID n is the register pair 2n (high word) and 2n + 1 (low word), its 32-bit
+ *   value as stored, IEEE 754 for PARAM_FLOAT. A pair is written at once with 0x10, the
+ *   value is range checked and persisted as by "param set". Writes of half a pair, and
+ *   every write with 0x06, answer ILLEGAL DATA ADDRESS.
+ *
+ * "modbus req <hex bytes>" executes a request given without its CRC and prints the response,
+ * "modbus pm" shows frame counters.
+ */
+
+#ifndef _MODBUS_H_
+#define _MODBUS_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "common.h"
+#include "active.h"
+
+/* Configuration parameters */
+#ifndef MODBUS_ENABLE
+#define MODBUS_ENABLE 0 // Set to 1 for the slave on USART3 and DMA1 channels 2 and 3, it keeps the CPU out of STOP2 (see power.h).
+#endif
+#define MODBUS_ADDR 1U        // Default slave address, "modbus.addr".
+#define MODBUS_OVEN 0U        // Oven whose coils and registers the slave serves, see reflow_init().
+#define MODBUS_BAUD 19200U    // Line baud rate, 8 data bits, even parity, 1 stop bit.
+#define MODBUS_ADU_MAX 256U   // Largest frame, address to CRC (bytes).
+#define MODBUS_NAN 0x8000U    // Input register value of a temperature not read.
+
+/* Function codes */
+#define MODBUS_FC_READ_COILS 0x01U
+#define MODBUS_FC_READ_DISCRETE 0x02U
+#define MODBUS_FC_READ_HOLDING 0x03U
+#define MODBUS_FC_READ_INPUT 0x04U
+#define MODBUS_FC_WRITE_COIL 0x05U
+#define MODBUS_FC_WRITE_REGISTER 0x06U
+#define MODBUS_FC_WRITE_COILS 0x0FU
+#define MODBUS_FC_WRITE_REGISTERS 0x10U
+
+/* Exception codes */
+#define MODBUS_EX_ILLEGAL_FUNCTION 0x01U
+#define MODBUS_EX_ILLEGAL_ADDRESS 0x02U
+#define MODBUS_EX_ILLEGAL_VALUE 0x03U
+#define MODBUS_EX_DEVICE_FAILURE 0x04U
+
+/* Input registers */
+typedef enum
+{
+    MODBUS_IR_STATE,                                      // Reflow_State, 0 while idle.
+    MODBUS_IR_SEGMENT,                                    // Profile segment index.
+    MODBUS_IR_SETPOINT,                                   // Setpoint (0.1 deg C).
+    MODBUS_IR_TEMP,                                       // Oven temperature (0.1 deg C).
+    MODBUS_IR_ERR,                                        // MAX31855K_err_t of latest acquisition.
+    MODBUS_IR_NUM_ZONES,                                  // Number of zones.
+    MODBUS_IR_ACQ_HI,                                     // Acquisitions since boot, high word.
+    MODBUS_IR_ACQ_LO,                                     // Acquisitions since boot, low word.
+    MODBUS_IR_COOLING,                                    // Cooling output (counts), MODBUS_NAN if none fitted.
+    MODBUS_IR_ZONE_TEMP,                                  // Zone temperatures (0.1 deg C), one per REFLOW_MAX_ZONES.
+    MODBUS_IR_ZONE_OUT = MODBUS_IR_ZONE_TEMP + 4,         // Zone heater outputs (counts), one per REFLOW_MAX_ZONES.
+    MODBUS_NUM_IR = MODBUS_IR_ZONE_OUT + 4
+} modbus_ir_t;
+
+/* Frame counters, "modbus pm" */
+typedef enum
+{
+    MODBUS_CNT_REQUESTS,   // Requests executed, broadcasts included.
+    MODBUS_CNT_EXCEPTIONS, // Exception responses sent.
+    MODBUS_CNT_CRC,        // Frames for this slave dropped with a bad CRC.
+    MODBUS_CNT_OTHER,      // Frames for other slaves dropped by the port.
+    MODBUS_CNT_RX_ERR,     // Frames dropped by the port for framing, parity, noise, overrun or length.
+    MODBUS_CNT_RX_DROP,    // Requests dropped by the port, event pool or command queue full.
+    MODBUS_CNT_TX_DROP,    // Responses dropped, transmitter busy.
+
+    MODBUS_NUM_CNTS
+} modbus_cnt_t;
+
+/* Frame event posted to the command active object with CMD_MODBUS_SIG */
+typedef struct
+{
+    Event base;     // Inherit base event class.
+    uint16_t len;   // Frame length, address to CRC (bytes).
+    uint8_t adu[];  // Frame.
+} Modbus_Event;
+
+/* Size of frame event holding len bytes. */
+#define MODBUS_EVENT_SIZE(len) (offsetof(Modbus_Event, adu) + (len))
+
+/**
+ * @brief Get slave address frames are accepted for (ISR-safe).
+ */
+uint8_t modbus_addr(void);
+
+/**
+ * @brief Count frame event (ISR-safe, each counter incremented from one context only).
+ */
+void modbus_count(modbus_cnt_t cnt);
+
+/**
+ * @brief Check frame CRC, execute request and send response (command thread).
+ *
+ * @param evt Frame event received by the port.
+ */
+void modbus_execute(Modbus_Event const *const evt);
+
+/**
+ * @brief Execute request and build response.
+ *
+ * @param req Request frame, address to CRC.
+ * @param len Request length (bytes).
+ * @param[out] rsp Response frame, at least MODBUS_ADU_MAX bytes.
+ *
+ * @return Response length, 0 for none (bad CRC, other slave or broadcast).
+ */
+size_t modbus_process(const uint8_t *req, size_t len, uint8_t *rsp);
+
+/**
+ * @brief Compute Modbus CRC-16 (poly 0xA001 reflected, init 0xFFFF), sent low byte first.
+ */
+uint16_t modbus_crc16(const uint8_t *data, size_t len);
+
+/**
+ * @brief Configure USART3 with DMA as RS485 port and start receiving (firmware only).
+ *
+ * USART3_TX on PC4, USART3_RX on PC5 and driver enable (USART3_DE) on PB14, all AF7,
+ * DMA1 channel 2 transmits and channel 3 receives (request 2).
+ *
+ * @return MOD_OK if successful, otherwise a "MOD_ERR" value.
+ */
+mod_err_t modbus_port_init(void);
+
+/**
+ * @brief Transmit response frame (command thread).
+ *
+ * @param buf Frame, copied before returning.
+ * @param len Frame length (bytes).
+ *
+ * @return MOD_OK if sending, MOD_ERR_BUF_OVERRUN if dropped as the previous response is still being sent.
+ */
+mod_err_t modbus_port_send(const uint8_t *buf, size_t len);
+
+#endif
@@ -0,0 +1,147 @@
+/**
+ * @file nvs.h
+ * @author Timothy Nguyen
+ * @brief Flash-backed key/value store for persistent parameters.
+ * @version 0.1
+ * @date 2021-08-12
+ *
+ * Values are appended as CRC-protected records to one of two flash pages reserved
+ * by the linker script (NVS region, last pages of the bank the firmware runs from,
+ * see fwup.h). A newer record of a key
+ * supersedes older ones. When the active page is full, the latest record of every
+ * key is copied to the other page, whose header is written last, so a reset at any
+ * point leaves one complete page. Pages alternate, so erases are spread over both.
+ *
+ * nvs_init() locates the latest record of every key in a single scan of the active
+ * page, after which nvs_get() reads values directly from flash.
+ *
+ * Values are stored as raw bytes and must be read back with the length they were
+ * written with, so changing a stored structure makes its old value unreadable
+ * rather than misinterpreted.
+ *
+ * nvs_set_deferred() copies a value into one of NVS_DEFER_SLOTS staging slots and
+ * returns, a background job commits staged values while the CPU is idle, see bgjob.h.
+ * Active objects use it so flash erases and programming never hold up their handlers.
+ *
+ * The store mutex serializes every use of the flash controller: other modules programming
+ * flash take it with nvs_flash_acquire(). Before a bank swap nvs_mirror() copies the store
+ * to the same pages of the other bank, and nvs_init() adopts a store found only there.
+ */
+
+#ifndef _NVS_H_
+#define _NVS_H_
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include "common.h"
+
+/* Configuration parameters */
+#define NVS_MAX_VALUE_LEN 256U // Maximum value length (bytes).
+#define NVS_DEFER_SLOTS 2U      // Values staged by nvs_set_deferred() at a time.
+#define NVS_MAX_OVENS 4U        // Reflow ovens with keys of their own, see NVS_KEY_OVENS.
+#define NVS_OVEN_KEYS 7U        // Reflow keys per oven, those commented "per oven" below.
+
+/* Keys, values persist across firmware updates so existing keys must not be renumbered. */
+typedef enum
+{
+    NVS_KEY_PID_GAINS,    // Reflow zone PID gains, per oven.
+    NVS_KEY_PROFILE,      // Reflow profile, per oven.
+    NVS_KEY_LOG_LEVELS,   // Global and tag log levels.
+    NVS_KEY_PID_SCHEDULE, // Reflow PID gain schedule, per oven.
+    NVS_KEY_ARCHIVE_BATCH, // Run archive batch label.
+    NVS_KEY_PWM_CAL,       // Heater PWM power curve, per oven.
+    NVS_KEY_TIMING,        // Reflow sampling and heater PWM periods, per oven.
+    NVS_KEY_RECIPE,        // Reflow recipe program, per oven.
+    NVS_KEY_PARAMS,        // Persistent registry parameters, see param.h.
+    NVS_KEY_TC_CAL,        // Thermocouple reference points, see tccal.h, per oven.
+    NVS_KEY_OVENS,         // Per oven keys of the second oven on, NVS_OVEN_KEYS per oven in the order above.
+
+    NUM_NVS_KEYS = NVS_KEY_OVENS + (NVS_MAX_OVENS - 1U) * NVS_OVEN_KEYS
+} nvs_key_t;
+
+/**
+ * @brief Locate active page and index latest record of every key.
+ *
+ * An unformatted store is formatted. A page ending in a torn record is
+ * compacted on the next write.
+ *
+ * @return MOD_OK if successful, MOD_ERR_PERIPH if flash could not be programmed.
+ */
+mod_err_t nvs_init(void);
+
+/**
+ * @brief Read value of key.
+ *
+ * @param[in] key Key.
+ * @param[out] value Value buffer.
+ * @param[in] len Expected value length (bytes).
+ *
+ * @return MOD_OK if successful, MOD_DID_NOTHING if key has no value,
+ *         MOD_ERR_ARG if stored value has a different length.
+ */
+mod_err_t nvs_get(nvs_key_t key, void *value, size_t len);
+
+/**
+ * @brief Write value of key, unless it is unchanged.
+ *
+ * May erase a flash page, blocking for tens of milliseconds. Code keeps running
+ * from bank 1 meanwhile.
+ *
+ * @param key Key.
+ * @param value Value.
+ * @param len Value length (bytes), at most NVS_MAX_VALUE_LEN.
+ *
+ * @return MOD_OK if successful, MOD_ERR_ARG if arguments are invalid,
+ *         MOD_ERR_PERIPH if flash could not be programmed.
+ */
+mod_err_t nvs_set(nvs_key_t key, const void *value, size_t len);
+
+/**
+ * @brief Stage value of key, written by a background job once the CPU is idle.
+ *
+ * A value staged again before it is written replaces the staged one, only the latest
+ * reaches flash. With every slot staging another key, the value is written at once.
+ * Failures of the background write are logged.
+ *
+ * @param key Key.
+ * @param value Value, copied.
+ * @param len Value length (bytes), at most NVS_MAX_VALUE_LEN.
+ *
+ * @return MOD_OK if staged or written, otherwise as nvs_set().
+ *
+ * @note Call from threads only, eg. active object handlers.
+ */
+mod_err_t nvs_set_deferred(nvs_key_t key, const void *value, size_t len);
+
+/**
+ * @brief Get HAL bank (FLASH_BANK_1 or FLASH_BANK_2) of a flash address.
+ *
+ * The banks trade places in the address map while booted from bank 2.
+ */
+uint32_t nvs_flash_bank(uint32_t addr);
+
+/**
+ * @brief Take the flash controller, shared with the store.
+ *
+ * @param timeout_ms Longest wait, 0 from background jobs.
+ *
+ * @return MOD_OK if taken, MOD_ERR_TIMEOUT otherwise.
+ */
+mod_err_t nvs_flash_acquire(uint32_t timeout_ms);
+
+/**
+ * @brief Release flash controller taken with nvs_flash_acquire().
+ */
+void nvs_flash_release(void);
+
+/**
+ * @brief Commit staged values and copy the store to the same pages of the other bank.
+ *
+ * Call with the flash controller taken, and keep it until the bank swap.
+ *
+ * @return MOD_OK if successful, MOD_ERR_PERIPH if flash could not be programmed.
+ */
+mod_err_t nvs_mirror(void);
+
+#endif
@@ -0,0 +1,90 @@
+/**
+ * @file pack.h
+ * @author Timothy Nguyen
+ * @brief Packed streams: deltas as zigzag varints, for compact dumps over the console.
+ * @version 0.1
+ * @date 2021-09-06
+ *
+ * Values are written as unsigned LEB128 varints, 7 bits per byte starting with the least
+ * significant, bit 7 set on every byte but the last. Signed values, mostly deltas from the
+ * previous record, are zigzag mapped first (0, -1, 1, -2 ... to 0, 1, 2, 3 ...), so small
+ * changes of either sign take one byte. Slowly varying series such as temperatures pack to
+ * one or two bytes per value, against several characters of CSV.
+ *
+ * A writer fills a caller buffer, typically the payload of one COBS frame (see frame.h), and
+ * refuses values that do not fit whole. Records of several values are kept whole by
+ * rewinding to pack_mark() when one of them did not fit:
+ *
+ *      size_t mark = pack_mark(&pack);
+ *      if (!pack_i32(&pack, temp - prev_temp) || !pack_u32(&pack, state))
+ *      {
+ *          pack_rewind(&pack, mark); // Record goes into next frame.
+ *      }
+ */
+
+#ifndef _PACK_H_
+#define _PACK_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/* Most bytes of a 32-bit varint. */
+#define PACK_VARINT_MAX 5U
+
+/* Packed stream writer */
+typedef struct
+{
+    uint8_t *buf; // Output buffer.
+    size_t size;  // Size of buf (bytes).
+    size_t len;   // Bytes written.
+} pack_t;
+
+/**
+ * @brief Map signed value to unsigned, small magnitudes to small values.
+ */
+static inline uint32_t pack_zigzag(int32_t v)
+{
+    return ((uint32_t)v << 1) ^ (uint32_t)(v >> 31);
+}
+
+/**
+ * @brief Start writing into buffer.
+ *
+ * @param p Writer.
+ * @param buf Output buffer.
+ * @param size Size of buf (bytes).
+ */
+void pack_init(pack_t *const p, uint8_t *buf, size_t size);
+
+/**
+ * @brief Append unsigned varint.
+ *
+ * @return true if written, false if it does not fit (nothing written).
+ */
+bool pack_u32(pack_t *const p, uint32_t v);
+
+/**
+ * @brief Append signed value as zigzag varint.
+ *
+ * @return true if written, false if it does not fit (nothing written).
+ */
+bool pack_i32(pack_t *const p, int32_t v);
+
+/**
+ * @brief Get position to rewind to if a record does not fit whole.
+ */
+static inline size_t pack_mark(pack_t const *const p)
+{
+    return p->len;
+}
+
+/**
+ * @brief Drop bytes written since mark.
+ */
+static inline void pack_rewind(pack_t *const p, size_t mark)
+{
+    p->len = mark;
+}
+
+#endif
@@ -0,0 +1,150 @@
+/**
+ * @file param.h
+ * @author Timothy Nguyen
+ * @brief Parameter registry: tunables addressed by ID, range checked, persisted and set alike from text and RPC.
+ * @version 0.1
+ * @date 2021-09-06
+ *
+ * A module keeps a tunable in a 32-bit variable of its own, read directly where it is used,
+ * and describes it with PARAM_DEFINE(), which places the descriptor in a linker section:
+ *
+ * static float max_temp = SAFETY_MAX_TEMP;
+ * PARAM_DEFINE(PARAM_SAFETY_MAX_TEMP, "safety.max_temp", PARAM_FLOAT, &max_temp, PARAM_FLAG_PERSIST,
+ *              .def.f = SAFETY_MAX_TEMP, .min.f = 100.0f, .max.f = 350.0f, .on_change = limit_changed);
+ *
+ * "param get/set/reset" read and change parameters by ID or name, from the console or as
+ * binary requests (see cmd.h), where "param get" replies with a typed field. IDs are listed
+ * below and never reused, so host tooling may keep them, lookup by ID is a table index.
+ *
+ * Values are written by the command thread only. A 32-bit aligned store is atomic, so the
+ * owning thread reads either the old or the new value without locking, and a change callback
+ * runs in the command thread after the store. Parameters flagged PARAM_FLAG_PERSIST are
+ * stored with NVS_KEY_PARAMS whenever set, and restored by param_load() after reset.
+ */
+
+#ifndef _PARAM_H_
+#define _PARAM_H_
+
+#include <stdint.h>
+
+#include "common.h"
+
+/* Configuration parameters */
+#define PARAM_MAX_STORED 31U // Persisted parameters, stored set must fit NVS_MAX_VALUE_LEN.
+
+/* Parameter IDs, append only */
+typedef enum
+{
+    PARAM_SAFETY_MAX_TEMP,     // Highest allowed thermocouple temperature (deg C).
+    PARAM_SAFETY_MAX_RISE,     // Highest allowed rate of rise (deg C/s).
+    PARAM_SAFETY_SAT_TIME,     // Longest time at full output without the minimum rise (s).
+    PARAM_SAFETY_SAT_MIN_RISE, // Rise expected from a heater at full output (deg C).
+    PARAM_CONVEYOR_BAND,       // Conveyor zone error of a stable zone (deg C).
+    PARAM_CONVEYOR_SETTLE,     // Time within band before a conveyor zone is stable (s).
+    PARAM_SAFETY_OPEN_MIN_A,   // Least heater current at full output (A).
+    PARAM_MODBUS_ADDR,         // Modbus slave address.
+    PARAM_CAN_NODE,            // CAN node ID.
+    PARAM_CAN_PERIOD_MS,       // CAN status frame period (ms).
+
+    NUM_PARAMS
+} param_id_t;
+
+/* Value types */
+typedef enum
+{
+    PARAM_U32,
+    PARAM_I32,
+    PARAM_FLOAT,
+
+    NUM_PARAM_TYPES
+} param_type_t;
+
+/* Flags */
+#define PARAM_FLAG_PERSIST 0x01U // Stored in flash when set.
+
+/* Value of any type */
+typedef union
+{
+    uint32_t u;
+    int32_t i;
+    float f;
+} param_val_t;
+
+typedef struct param_def param_def_t;
+
+/* Parameter descriptor, in section params */
+struct param_def
+{
+    uint16_t id;                               // param_id_t.
+    uint8_t type;                              // param_type_t.
+    uint8_t flags;                             // PARAM_FLAG_* bits.
+    const char *name;                          // Name, "<module>.<parameter>".
+    void *addr;                                // Value storage, 32-bit aligned.
+    param_val_t def;                           // Default value.
+    param_val_t min;                           // Lowest value.
+    param_val_t max;                           // Highest value.
+    void (*on_change)(param_def_t const *def); // Called after value changed, NULL for none.
+};
+
+/* Bounds of parameter descriptors, provided by the linker. */
+extern const param_def_t __start_params[];
+extern const param_def_t __stop_params[];
+
+/**
+ * @brief Define parameter.
+ *
+ * Descriptors are aligned to their type, as compilers may otherwise pad larger objects
+ * and the section would no longer be an array.
+ *
+ * @param param_id param_id_t.
+ * @param param_name Name string.
+ * @param param_type param_type_t.
+ * @param param_addr Address of value storage, holding the default value initially.
+ * @param param_flags PARAM_FLAG_* bits.
+ * @param ... Designated initializers of def, min, max and on_change.
+ */
+#define PARAM_DEFINE(param_id, param_name, param_type, param_addr, param_flags, ...)                \
+    static const param_def_t _param_##param_id                                                      \
+        __attribute__((used, section("params"), aligned(__alignof__(param_def_t)))) = {            \
+            .id = (param_id), .type = (param_type), .flags = (param_flags), .name = (param_name), \
+            .addr = (param_addr), __VA_ARGS__}
+
+/**
+ * @brief Initialize parameter registry, indexing descriptors by ID.
+ *
+ * @return MOD_OK if successful, otherwise a "MOD_ERR" value.
+ */
+mod_err_t param_init(void);
+
+/**
+ * @brief Restore persisted parameters, calling their change callbacks.
+ *
+ * Call once modules owning parameters are initialized.
+ *
+ * @return MOD_OK if successful, MOD_DID_NOTHING if none are stored, otherwise a "MOD_ERR" value.
+ */
+mod_err_t param_load(void);
+
+/**
+ * @brief Get parameter descriptor by ID.
+ *
+ * @return Descriptor, NULL if id is not defined.
+ */
+param_def_t const *param_find(uint32_t id);
+
+/**
+ * @brief Get current value of parameter.
+ */
+param_val_t param_get(param_def_t const *def);
+
+/**
+ * @brief Set parameter, call its change callback and store it if persistent (command thread).
+ *
+ * @param def Parameter.
+ * @param val Value.
+ *
+ * @return MOD_OK if set, MOD_ERR_ARG if out of range, or the error storing it.
+ */
+mod_err_t param_set(param_def_t const *def, param_val_t val);
+
+#endif // _PARAM_H_
@@ -9,16 +9,92 @@
  * 
  *      Integrator anti-windup method based on Bryan Douglas' PID video: https://www.youtube.com/watch?v=NVLXCwc8HzM
  * 
+ *      The float controller optionally uses back-calculation anti-windup and 2-DOF setpoint
+ *      weighting (Astrom & Hagglund, Advanced PID Control, ch. 3):
+ *          P = Kp * (b * r - y)
+ *          D filtered derivative of Kd * (c * r - y)
+ *          dI/dt = Ki * (r - y) + (u - v) / Tt
+ *      where v is the unsaturated and u the saturated output. b < 1 softens the proportional
+ *      kick of setpoint changes, so ramps into a hold overshoot less at the same Kp. With
+ *      back-calculation the integral term is pulled back while the output saturates, instead
+ *      of freezing only once the output sits exactly at a limit.
+ *
+ *      PID_FORM_INCREMENTAL instead updates the output by weighted errors, the kernel of
+ *      CMSIS-DSP arm_pid_f32() with per-sample gains Ki * Ts and Kd / Ts:
+ *          u[n] = u[n-1] + A0 * e[n] + A1 * e[n-1] + A2 * e[n-2]
+ *          A0 = Kp + Ki * Ts + Kd / Ts, A1 = -Kp - 2 * Kd / Ts, A2 = Kd / Ts
+ *      Saturating u[n] is its anti-windup. It has no derivative filter, setpoint weights or
+ *      feed-forward, so tau, b, c, Kff and the anti-windup method are ignored, and costs
+ *      three multiply-accumulates per iteration. Gain schedules apply to both forms.
  */
 
 #ifndef _PID_H_
 #define _PID_H_
 
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+/* Q16.16 fixed-point value, range [-32768, 32768) with resolution 2^-16. */
+typedef int32_t q16_t;
+
+#define Q16_ONE (1 << 16)                                   // 1.0 in Q16.16.
+#define Q16_FROM_FLOAT(x) ((q16_t)((x) * (float)Q16_ONE))   // Convert float to Q16.16.
+#define Q16_TO_FLOAT(x) ((float)(x) / (float)Q16_ONE)       // Convert Q16.16 to float.
+
+/* Relative sample time change below which PID_SetSampleTime() keeps derived coefficients. */
+#define PID_TS_TOLERANCE 0.001f
+
+/* Band index of a controller without a selected schedule band. */
+#define PID_NO_BAND 0xFFU
+
+/* Integrator anti-windup method */
+typedef enum
+{
+	PID_ANTIWINDUP_CLAMP,    // Stop integrating while output saturates in direction of error.
+	PID_ANTIWINDUP_BACKCALC, // Feed saturation excess back into integral with time constant Tt.
+} PID_antiwindup_t;
+
+/* Controller form */
+typedef enum
+{
+	PID_FORM_POSITIONAL,  // Sum of filtered terms, with anti-windup, weights and feed-forward.
+	PID_FORM_INCREMENTAL, // Output updated by weighted errors, as arm_pid_f32().
+} PID_form_t;
+
+/* Controller gains */
+typedef struct
+{
+	float Kp;  // Proportional gain.
+	float Ki;  // Integral gain.
+	float Kd;  // Derivative gain.
+	float Kff; // Setpoint derivative feed-forward gain.
+} PID_gains_t;
+
+/* Gain schedule band, applies while setpoint is below upper and above the previous band's upper. */
+typedef struct
+{
+	float upper;       // Upper setpoint bound of band, exclusive.
+	PID_gains_t gains; // Gains applied within band.
+} PID_band_t;
+
+/**
+ * @brief Gain schedule, a small table of setpoint bands in increasing order of upper bound.
+ *
+ * The last band also applies above its upper bound.
+ */
+typedef struct
+{
+	uint8_t num_bands;       // Number of bands.
+	PID_band_t const *bands; // Bands, sorted by upper bound.
+} PID_schedule_t;
+
 /* PID controller structure */
 typedef struct {
 	float Kp;   // Proportional gain.
 	float Ki;	// Integral gain.
 	float Kd;	// Derivative gain.
+	float Kff;	// Setpoint derivative feed-forward gain.
 
 	float tau; 			// Derivative low-pass filter time constant
 	float Ts; 			// Sample time (s).
@@ -26,14 +102,41 @@ typedef struct {
 	float out_lim_max;  // Output maximum saturation limit.
 	float out_lim_min;	// Output minimum saturation limit.
 
+	PID_form_t form;	// Controller form.
+	PID_antiwindup_t antiwindup; // Integrator anti-windup method.
+	float Tt;			// Back-calculation tracking time constant (s).
+	float b;			// Proportional setpoint weight.
+	float c;			// Derivative setpoint weight.
+
+	/* Derived coefficients, recomputed only when gains or sample time change */
+	float ki_ts;		// Ki * Ts / 2, trapezoidal integrator coefficient.
+	float kd_coeff;		// 2 * Kd / (2 * tau + Ts), derivative coefficient.
+	float lpf_coeff;	// (2 * tau - Ts) / (2 * tau + Ts), derivative low-pass filter coefficient.
+	float kff_ts;		// Kff / Ts, feed-forward coefficient.
+	float kt_ts;		// Ts / Tt, back-calculation tracking coefficient.
+	float A0;			// Kp + Ki * Ts + Kd / Ts, incremental form error coefficient.
+	float A1;			// -Kp - 2 * Kd / Ts, incremental form previous error coefficient.
+	float A2;			// Kd / Ts, incremental form second previous error coefficient.
+
+	/* Gain scheduling, gains above follow the schedule band of the setpoint if one is set */
+	PID_gains_t base;				// Gains applied without schedule.
+	PID_schedule_t const *schedule; // Gain schedule, NULL for fixed gains.
+	uint8_t band;					// Index of applied schedule band, PID_NO_BAND if none.
+
 	/* Controller memory */
 	float integral;			// Integral term.
 	float derivative;		// Derivative term.
     float prev_error;		// Previous error, required for integrator.
+	float prev_error2;		// Error before previous error, incremental form only.
 	float prev_measurement; // Previous measurement, required for differentiator.
+	float prev_setpoint;	// Previous setpoint, required for feed-forward.
+	bool prev_setpoint_valid; // prev_setpoint was set since last reset.
+	float rate;				// Measured rate of next iteration, see PID_SetRate().
+	bool rate_valid;		// rate was set for next iteration.
 
     /* Solely for data logging */
     float proportional;
+	float feedforward;
 
 	float out; // Controller output.
 } PID_t;
@@ -45,12 +148,20 @@ typedef struct
 	float Kp;
 	float Ki;
 	float Kd;
+	float Kff; // Feed-forward gain, float controller only.
 
 	float tau;
 	float Ts;
 
 	float out_max;
 	float out_min;
+
+	/* Form, anti-windup and setpoint weighting, float controller only */
+	PID_form_t form;             // Controller form, PID_FORM_POSITIONAL if not set.
+	PID_antiwindup_t antiwindup; // Integrator anti-windup method.
+	float Tt;                    // Tracking time constant (s), > 0 with PID_ANTIWINDUP_BACKCALC.
+	float b;                     // Proportional setpoint weight, 1 is plain error feedback.
+	float c;                     // Derivative setpoint weight, 0 is derivative on measurement.
 } PID_cfg_t;
 
 /**
@@ -61,6 +172,75 @@ typedef struct
  */
 void PID_Init(PID_t * const pid, PID_cfg_t const * const pid_cfg);
 
+/**
+ * @brief Update controller gains without erasing controller memory.
+ *
+ * Gains are applied once no gain schedule is set, tau applies immediately.
+ *
+ * @param pid PID structure containing controller parameters.
+ * @param Kp Proportional gain.
+ * @param Ki Integral gain.
+ * @param Kd Derivative gain.
+ * @param tau Derivative low-pass filter time constant.
+ */
+void PID_SetGains(PID_t * const pid, float Kp, float Ki, float Kd, float tau);
+
+/**
+ * @brief Update feed-forward gain without erasing controller memory.
+ *
+ * The feed-forward term Kff * d(setpoint)/dt supplies the output a ramp needs
+ * without waiting for error to build up. Applied once no gain schedule is set.
+ *
+ * @param pid PID structure containing controller parameters.
+ * @param Kff Setpoint derivative feed-forward gain, 0 to disable.
+ */
+void PID_SetFeedForward(PID_t * const pid, float Kff);
+
+/**
+ * @brief Update output saturation limits without erasing controller memory.
+ *
+ * @param pid PID structure containing controller parameters.
+ * @param out_min Output minimum saturation limit.
+ * @param out_max Output maximum saturation limit, above out_min.
+ */
+void PID_SetLimits(PID_t * const pid, float out_min, float out_max);
+
+/**
+ * @brief Schedule gains by setpoint band, or return to fixed gains.
+ *
+ * Bands are selected by setpoint rather than measurement, so noise does not
+ * chatter between bands. The schedule is referenced, not copied.
+ *
+ * @param pid PID structure containing controller parameters.
+ * @param schedule Gain schedule with at least one band, NULL to apply gains of
+ *        PID_SetGains() and PID_SetFeedForward() again.
+ */
+void PID_SetSchedule(PID_t * const pid, PID_schedule_t const * const schedule);
+
+/**
+ * @brief Update sample time without erasing controller memory.
+ *
+ * Derived coefficients are only recomputed if Ts differs from the current sample time
+ * by more than PID_TS_TOLERANCE, so sampling jitter does not cost a division per iteration.
+ *
+ * @param pid PID structure containing controller parameters.
+ * @param Ts Sample time (s).
+ */
+void PID_SetSampleTime(PID_t * const pid, float Ts);
+
+/**
+ * @brief Supply measured rate of change to next iteration, eg. from a state estimator.
+ *
+ * The positional form's derivative term acts on rate * Ts in place of the difference of
+ * the last two measurements, still through the derivative low-pass filter. The rate
+ * applies to the next PID_Calculate() only, which differences measurements again unless
+ * a rate is supplied before every iteration. The incremental form ignores it.
+ *
+ * @param pid PID structure containing controller parameters.
+ * @param rate Rate of change of measurement (units/s).
+ */
+void PID_SetRate(PID_t * const pid, float rate);
+
 /**
  * @brief Perform PID iteration.
  * 
@@ -79,6 +259,73 @@ float PID_Calculate(PID_t * const pid, float setpoint, float measurement);
  */
 void PID_Reset(PID_t * const pid);
 
+/* Fixed-point PID controller structure */
+typedef struct {
+	/* Derived coefficients, computed once by PIDq_Init() */
+	q16_t Kp;		// Proportional gain.
+	q16_t ki_ts;	// Ki * Ts / 2, trapezoidal integrator coefficient.
+	q16_t kd_coeff;	// 2 * Kd / (2 * tau + Ts), derivative coefficient.
+	q16_t lpf_coeff;// (2 * tau - Ts) / (2 * tau + Ts), derivative low-pass filter coefficient.
+
+	q16_t out_lim_max;  // Output maximum saturation limit.
+	q16_t out_lim_min;	// Output minimum saturation limit.
+
+	/* Controller memory */
+	q16_t integral;			// Integral term.
+	q16_t derivative;		// Derivative term.
+	q16_t prev_error;		// Previous error, required for integrator.
+	q16_t prev_measurement; // Previous measurement, required for differentiator.
+
+	/* Solely for data logging */
+	q16_t proportional;
+
+	q16_t out; // Controller output.
+} PIDq_t;
+
+/**
+ * @brief Set/update fixed-point PID controller parameters and erase controller memory.
+ *
+ * @param[in/out] pid Fixed-point PID instance to initialize.
+ * @param[in] pid_cfg PID configuration parameters, shared with float controller.
+ *
+ * @note Sample time is folded into coefficients, so call again if Ts changes.
+ */
+void PIDq_Init(PIDq_t * const pid, PID_cfg_t const * const pid_cfg);
+
+/**
+ * @brief Perform fixed-point PID iteration.
+ *
+ * Same clamping anti-windup and filtered derivative as PID_Calculate() with unit
+ * proportional and zero derivative setpoint weights, using integer
+ * arithmetic only, so it is safe to call from ISRs without FPU context stacking.
+ *
+ * @param pid Fixed-point PID structure.
+ * @param setpoint Setpoint value for current iteration.
+ * @param measurement Measured value for current iteration.
+ * @return q16_t Output of PID calculation.
+ */
+q16_t PIDq_Calculate(PIDq_t * const pid, q16_t setpoint, q16_t measurement);
+
+/**
+ * @brief Clear fixed-point PID memory but retain controller parameters.
+ *
+ * @param pid Fixed-point PID structure.
+ */
+void PIDq_Reset(PIDq_t * const pid);
+
+/**
+ * @brief Run float and fixed-point controllers over a recorded trace and compare outputs.
+ *
+ * Both controllers start from cleared memory with the same configuration.
+ *
+ * @param pid_cfg PID configuration parameters.
+ * @param setpoints Setpoint of each sample.
+ * @param measurements Measurement of each sample.
+ * @param len Number of samples.
+ * @return float Maximum absolute difference between controller outputs.
+ */
+float PIDq_Compare(PID_cfg_t const * const pid_cfg, const float *setpoints, const float *measurements, uint32_t len);
+
 #endif
 
 
@@ -0,0 +1,85 @@
+/**
+ * @file power.h
+ * @author Timothy Nguyen
+ * @brief Low-power idle: tickless kernel idle with sleep or STOP2 entry, LPTIM1 wake-up timebase.
+ * @version 0.1
+ * @date 2021-08-21
+ *
+ * The kernel runs tickless (configUSE_TICKLESS_IDLE 2). When the idle task expects no
+ * thread to run for a while, power_suppress_ticks_and_sleep() stops the SysTick and the
+ * HAL tick (TIM7), programs the LPTIM1 compare for the next kernel timeout and waits for
+ * an interrupt, then steps both ticks by the time LPTIM1 measured. While background jobs
+ * are queued the idle task keeps running them instead, see bgjob.h.
+ *
+ * The CPU waits in STOP2 if all of these hold, otherwise in sleep mode:
+ * - STOP2 is enabled ("power stop on", default).
+ * - No module holds a stop lock. Reflow and autotune runs hold one, since heater PWM
+ *   (TIM3) and the sampling timer (TIM6) halt in STOP2 and the heater output would freeze.
+ *   The Modbus slave and the CAN node hold one for good when built in (MODBUS_ENABLE,
+ *   CAN_ENABLE), USART3 and CAN1 would miss requests and frames in STOP2.
+ * - No debugger is connected, STOP2 would drop the SWD/SWO connection.
+ * - The console is the UART, its transmit buffer is empty and nothing was received for
+ *   POWER_RX_HOLD_MS. A falling edge on the USART2 RX pin (PA3, EXTI3) wakes the CPU from
+ *   STOP2, the first character received while stopped is lost.
+ *
+ * STOP2 keeps SPI2, USART2 and TIM3 registers and GPIO state, and the CPU wakes on HSI16.
+ * Restoring the PLL as system clock gives these peripherals their PCLK back unchanged,
+ * so they are not reinitialized.
+ *
+ * Notes:
+ * - LPTIM1 is configured with registers, it is not enabled within CubeMX. It is clocked
+ *   by the LSE divided by 16, or the LSI if no 32.768 kHz crystal starts.
+ * - The DWT cycle counter stops in STOP2, so run-time statistics ("sys top") only count
+ *   time spent awake.
+ */
+
+#ifndef _POWER_H_
+#define _POWER_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "common.h"
+
+/* Configuration parameters */
+#define POWER_LPTIM_PRESC_DIV 16U  // LPTIM1 clock prescaler, matches LPTIM_CFGR PRESC setting.
+#define POWER_MAX_IDLE_MS 30000U   // Longest single sleep, below LPTIM1 counter period (32 s with LSE).
+#define POWER_STOP_MIN_MS 5U       // Shortest expected idle time worth entering STOP2.
+#define POWER_RX_HOLD_MS 10000U    // Time without console reception before STOP2 is allowed.
+
+/**
+ * @brief Start LPTIM1 wake-up timebase and register power commands.
+ *
+ * Until called, the idle task does not sleep.
+ *
+ * @return MOD_OK if successful, otherwise a "MOD_ERR" value.
+ */
+mod_err_t power_init(void);
+
+/**
+ * @brief Stop ticks and sleep until the next kernel timeout or an interrupt.
+ *
+ * @param expected_idle_ticks Kernel ticks until the next thread unblocks.
+ *
+ * @note Called by the idle task with the scheduler suspended (portSUPPRESS_TICKS_AND_SLEEP).
+ */
+void power_suppress_ticks_and_sleep(uint32_t expected_idle_ticks);
+
+/**
+ * @brief Keep CPU out of STOP2, nesting. Sleep mode is still entered.
+ */
+void power_stop_lock(void);
+
+/**
+ * @brief Release lock taken with power_stop_lock().
+ */
+void power_stop_unlock(void);
+
+/**
+ * @brief Keep CPU out of STOP2 for at least a given time (ISR-safe).
+ *
+ * @param ms Time from now (ms).
+ */
+void power_stop_hold(uint32_t ms);
+
+#endif
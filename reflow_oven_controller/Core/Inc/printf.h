@@ -49,6 +49,21 @@ extern "C" {
 void _putchar(char character);
 
 
+/**
+ * Capture hook for printf() output, called with each character before it is buffered
+ * for the uart. A character the hook returns non-zero for is consumed and not sent.
+ * \param capture Hook function, NULL (default) sends every character to the uart
+ */
+void printf_set_capture(int (*capture)(char character));
+
+
+/**
+ * Check whether a capture hook is installed.
+ * \return Non-zero if printf() output currently passes through a capture hook
+ */
+int printf_capturing(void);
+
+
 /**
  * Tiny printf implementation
  * You have to implement _putchar if you use printf()
@@ -61,6 +76,16 @@ void _putchar(char character);
 int printf_(const char* format, ...);
 
 
+/**
+ * Output a string as is, without formatting
+ * The string is copied straight into the uart transmit buffer, one block instead of
+ * PRINTF_OUT_BUFFER_SIZE chunks, or passed to the capture hook like printf() output
+ * \param str String to output, eg. help text in flash
+ * \return The number of characters written
+ */
+int printf_puts(const char* str);
+
+
 /**
  * Tiny sprintf implementation
  * Due to security reasons (buffer overflow) YOU SHOULD CONSIDER USING (V)SNPRINTF INSTEAD!
@@ -109,6 +134,17 @@ int vprintf_(const char* format, va_list va);
 int fctprintf(void (*out)(char character, void* arg), void* arg, const char* format, ...);
 
 
+/**
+ * vprintf with output function
+ * \param out An output function which takes one character and an argument pointer
+ * \param arg An argument pointer for user data passed to output function
+ * \param format A string that specifies the format of the output
+ * \param va A value identifying a variable arguments list
+ * \return The number of characters that are sent to the output function, not counting the terminating null character
+ */
+int vfctprintf(void (*out)(char character, void* arg), void* arg, const char* format, va_list va);
+
+
 #ifdef __cplusplus
 }
 #endif
@@ -0,0 +1,58 @@
+/**
+ * @file prio.h
+ * @author Timothy Nguyen
+ * @brief Thread priority plan, every thread's priority in one place.
+ * @version 0.1
+ * @date 2021-09-06
+ *
+ * Highest first:
+ *
+ *  PRIO_SAFETY       safety            Checks each sample before the controller uses it.
+ *  PRIO_SUPERVISOR   wdg               Above every thread it supervises, runs for microseconds.
+ *  PRIO_ACQUISITION  Tmr Svc, work     Timer daemon (sample trigger, time events) and interrupt
+ *                                      bottom halves, so samples start on time.
+ *  PRIO_CYCLIC_x     cyc100hz, cyc10hz Rate groups released by the base timer, faster first
+ *                    cyc1hz            (rate-monotonic), see cyclic.h.
+ *  PRIO_CONTROL      reflow, bench     PID, heater outputs, profile.
+ *  PRIO_CMD          cmd, defaultTask  Commands, boot.
+ *  PRIO_CONSOLE      console,          Line editing and output, telemetry chunks to the UART.
+ *                    telemetry
+ *  PRIO_ARCHIVE      archive           Flash writes.
+ *  PRIO_LOG          log               Deferred log formatting.
+ *
+ * Each thread passes its PRIO_ value explicitly, Active_start() and Active_start_ring() take
+ * it as an argument. The control loop therefore preempts command handling, console output
+ * and log formatting, whatever they are doing. "sys top" lists each thread's priority next
+ * to its CPU share and context switches, to check the plan holds on a running board.
+ *
+ * Notes:
+ * - configTIMER_TASK_PRIORITY in FreeRTOSConfig.h is PRIO_ACQUISITION as a number, it cannot
+ *   include this file. A static assert below keeps both equal.
+ * - Timer callbacks run at PRIO_ACQUISITION and must stay short, eg. sample, publish or poll
+ *   and post an event.
+ */
+
+#ifndef _PRIO_H_
+#define _PRIO_H_
+
+#include "cmsis_os.h"
+
+#define PRIO_SAFETY osPriorityRealtime        // Safety active object.
+#define PRIO_SUPERVISOR osPriorityHigh1       // Watchdog supervisor.
+#define PRIO_ACQUISITION osPriorityHigh       // Timer daemon, deferred work.
+#define PRIO_CYCLIC_100HZ osPriorityAboveNormal3 // 100 Hz rate group.
+#define PRIO_CYCLIC_10HZ osPriorityAboveNormal2  // 10 Hz rate group.
+#define PRIO_CYCLIC_1HZ osPriorityAboveNormal1   // 1 Hz rate group.
+#define PRIO_CONTROL osPriorityAboveNormal    // Reflow active object.
+#define PRIO_CMD osPriorityNormal             // Command active object.
+#define PRIO_CONSOLE osPriorityBelowNormal1   // Console thread.
+#define PRIO_ARCHIVE osPriorityBelowNormal    // Archive thread.
+#define PRIO_LOG osPriorityLow                // Log thread.
+
+_Static_assert(configTIMER_TASK_PRIORITY == PRIO_ACQUISITION, "Timer daemon runs at acquisition priority");
+_Static_assert(PRIO_SAFETY > PRIO_ACQUISITION && PRIO_ACQUISITION > PRIO_CYCLIC_100HZ && PRIO_CYCLIC_1HZ > PRIO_CONTROL &&
+                   PRIO_CONTROL > PRIO_CMD &&
+                   PRIO_CMD > PRIO_CONSOLE && PRIO_CONSOLE > PRIO_LOG,
+               "Priority plan: safety > acquisition > rate groups > control > cmd > console > logging");
+
+#endif
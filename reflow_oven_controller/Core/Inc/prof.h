@@ -0,0 +1,114 @@
+/**
+ * @file prof.h
+ * @author Timothy Nguyen
+ * @brief Cycle-accurate code profiling using the DWT cycle counter.
+ * @version 0.1
+ * @date 2021-08-04
+ *
+ * Each probe measures the number of CPU cycles spent between PROF_BEGIN and PROF_END
+ * and keeps count, minimum, maximum and total cycles in a fixed table. Probes are
+ * named after the identifier passed to the macros, and register themselves the
+ * first time they are hit:
+ *
+ * PROF_BEGIN(pid_calc);
+ * out = PID_Calculate(&pid, setpoint, measurement);
+ * PROF_END(pid_calc);
+ *
+ * A probe's PROF_BEGIN and PROF_END must be placed in the same scope.
+ * Probe statistics are displayed with "prof status" and reset with "prof clear".
+ */
+
+#ifndef _PROF_H_
+#define _PROF_H_
+
+#include <stdint.h>
+
+#include "common.h"
+#include "stm32l4xx.h"
+
+/* Configuration parameters */
+#ifndef PROF_ENABLE
+#define PROF_ENABLE 1 // Set to 0 to compile probes out.
+#endif
+
+#define PROF_MAX_PROBES 16 // Maximum number of distinct probes.
+
+/* Probe statistics */
+typedef struct
+{
+    const char *name; // Probe name.
+    uint32_t count;   // Number of measurements.
+    uint32_t min;     // Minimum cycles.
+    uint32_t max;     // Maximum cycles.
+    uint64_t total;   // Total cycles.
+} prof_probe_t;
+
+/**
+ * @brief Initialize profiling module and enable DWT cycle counter.
+ *
+ * @return MOD_OK if successful, otherwise a "MOD_ERR" value.
+ */
+mod_err_t prof_init(void);
+
+/**
+ * @brief Find probe by name, adding it to probe table if absent.
+ *
+ * @param name Probe name, must have static storage duration.
+ *
+ * @return Probe instance, NULL if the probe table is full.
+ *
+ * This function is not intended to be used directly. Use PROF_END instead.
+ */
+prof_probe_t *prof_probe_get(const char *name);
+
+/**
+ * @brief Record a measurement. Safe to call from ISRs.
+ *
+ * @param probe Probe instance, measurement is dropped if NULL.
+ * @param cycles Elapsed cycles.
+ *
+ * This function is not intended to be used directly. Use PROF_END instead.
+ */
+void prof_probe_record(prof_probe_t *probe, uint32_t cycles);
+
+#if PROF_ENABLE
+
+/**
+ * @brief Start measurement of probe.
+ *
+ * @param name Probe identifier (not a string).
+ */
+#define PROF_BEGIN(name) uint32_t _prof_start_##name = DWT->CYCCNT
+
+/**
+ * @brief End measurement of probe and record elapsed cycles.
+ *
+ * @param name Probe identifier given to PROF_BEGIN.
+ */
+#define PROF_END(name)                                                        \
+    do                                                                        \
+    {                                                                         \
+        uint32_t _prof_cycles = DWT->CYCCNT - _prof_start_##name;             \
+        static prof_probe_t *_prof_probe = NULL;                              \
+        if (_prof_probe == NULL)                                              \
+        {                                                                     \
+            _prof_probe = prof_probe_get(#name);                              \
+        }                                                                     \
+        prof_probe_record(_prof_probe, _prof_cycles);                         \
+    } while (0)
+
+#else
+
+#define PROF_BEGIN(name) \
+    do                   \
+    {                    \
+    } while (0)
+
+#define PROF_END(name) \
+    do                 \
+    {                  \
+    } while (0)
+
+#endif // PROF_ENABLE
+
+#endif // _PROF_H_
@@ -0,0 +1,99 @@
+/**
+ * @file profopt.h
+ * @author Timothy Nguyen
+ * @brief Profile optimizer: fastest segment table an oven model can follow within paste limits.
+ * @version 0.1
+ * @date 2021-09-06
+ *
+ *      The oven is the identified FOPDT model, heating towards ambient + K * out at rate
+ *      (ambient + K * out - temp) / T, so it heats slower as the temperature rises.
+ *
+ *      The profile has the usual four phases, each as short as the limits allow:
+ *
+ *      1. Preheat to the soak band.
+ *      2. Soak across the band at the rate giving the shortest soak accepted.
+ *      3. Ramp to the lowest peak accepted.
+ *      4. Dwell at peak just long enough for the shortest time above liquidus accepted,
+ *         counting the rise above liquidus, the dead time and the fall back through
+ *         it with heaters off, then cool to the end temperature.
+ *
+ *      A heating ramp is fastest at full output, so once full output heats no faster than
+ *      the phase's rate limit the rest of the ramp is a step segment, the oven heating at
+ *      full output. Below that the setpoint ramps at the rate limit, or where the oven
+ *      could not follow it with only headroom of the output, the rest being left to the
+ *      controller, in pieces of at most PROFOPT_PIECE_SPAN, each at the rate the oven can
+ *      follow at its end. Every limit is planned margin of its band inside the band, rate
+ *      limits margin below the limit.
+ */
+
+#ifndef _PROFOPT_H_
+#define _PROFOPT_H_
+
+#include <stdint.h>
+
+#include "smith.h"
+#include "conform.h"
+
+/* Configuration parameters */
+#define PROFOPT_MAX_SEGMENTS 16U   // Most segments of a solution.
+#define PROFOPT_PIECE_SPAN 20.0f   // Widest piece of a heating ramp the oven limits (deg C).
+#define PROFOPT_REACH_MARGIN 5.0f  // Least margin of full output settling temperature above peak (deg C).
+
+/* Result of optimization */
+typedef enum
+{
+	PROFOPT_OK,       // Profile meets every limit.
+	PROFOPT_ERR_ARG,  // Model or plan configuration invalid.
+	PROFOPT_ERR_PEAK, // Oven cannot reach the lowest peak accepted, or follow a ramp with planned headroom.
+	PROFOPT_ERR_SOAK, // Oven crosses the soak band too slowly for the longest soak accepted.
+	PROFOPT_ERR_TAL,  // Rise and fall through liquidus alone exceed the longest time above liquidus accepted.
+} Profopt_status_t;
+
+/* Plan configuration */
+typedef struct
+{
+	Smith_model_t model; // Identified oven model, K in deg C per output count.
+	float ambient;       // Temperature with heaters off (deg C).
+	float out_max;       // Full heater output (counts).
+	float headroom;      // Fraction of full output planned with, 0 to 1.
+	float margin;        // Fraction of every limit band kept clear, 0 to 0.5.
+	float start;         // Oven temperature at start (deg C).
+	float end;           // Cool-down target, above ambient (deg C).
+} Profopt_cfg_t;
+
+/* Planned segment, as a reflow profile segment */
+typedef struct
+{
+	float ramp_rate; // Setpoint ramp rate (deg C/s), 0 to step and wait for the oven.
+	float target;    // Target temperature (deg C).
+	uint32_t dwell;  // Time held at target (s).
+} Profopt_segment_t;
+
+/* Planned profile and its predicted metrics */
+typedef struct
+{
+	uint8_t num_segments;                           // Number of segments.
+	Profopt_segment_t segments[PROFOPT_MAX_SEGMENTS]; // Segments, in run order.
+	float duration;                                 // Predicted run time (s).
+	float soak;                                     // Predicted soak time (s).
+	float tal;                                      // Predicted time above liquidus (s).
+	float peak;                                     // Planned peak temperature (deg C).
+} Profopt_t;
+
+/**
+ * @brief Plan fastest profile the model can follow within paste limits.
+ *
+ * @param[out] plan Planned profile, complete only if PROFOPT_OK is returned.
+ * @param cfg Plan configuration.
+ * @param limits Paste limits, of conformance scoring.
+ *
+ * @return PROFOPT_OK if a profile meets every limit, otherwise the limit that cannot be met.
+ */
+Profopt_status_t Profopt_Solve(Profopt_t * const plan, Profopt_cfg_t const * const cfg, Conform_cfg_t const * const limits);
+
+/**
+ * @brief Describe optimization result.
+ */
+const char *Profopt_Status_Str(Profopt_status_t status);
+
+#endif
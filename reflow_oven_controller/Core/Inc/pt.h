@@ -0,0 +1,95 @@
+/**
+ * @file pt.h
+ * @author Timothy Nguyen
+ * @brief Protothreads: stackless coroutines for sequential code run by an event handler.
+ * @version 0.1
+ * @date 2021-09-06
+ *
+ * A protothread is a function that returns wherever it waits and continues there on its
+ * next call. It is called again on every event of interest, eg. every sample, so logic such
+ * as "heat to 150, then hold for 60 s unless ..." reads top to bottom instead of spreading
+ * over states and flags, and runs on the stack of the calling thread:
+ *
+ * static pt_status_t foo(foo_t *const me)
+ * {
+ *     PT_BEGIN(&me->pt);
+ *     heater_on();
+ *     PT_WAIT_UNTIL(&me->pt, me->temp >= 150.0f); // Returns PT_WAITING until then.
+ *     me->mark = me->time;
+ *     PT_WAIT_UNTIL(&me->pt, me->time - me->mark >= 60.0f);
+ *     heater_off();
+ *     PT_END(&me->pt);                              // Returns PT_ENDED.
+ * }
+ *
+ * The resume point is the line of the last wait, kept in a pt_t of two bytes, and resuming
+ * is a switch on it (Duff's device).
+ *
+ * Notes:
+ * - Local variables are not kept across waits, keep state in the object instead.
+ * - The body must not use switch statements of its own, and at most one wait per line.
+ */
+
+#ifndef _PT_H_
+#define _PT_H_
+
+#include <stdint.h>
+
+/* Protothread state */
+typedef struct
+{
+    uint16_t lc; // Line to resume at, 0 to start from the beginning.
+} pt_t;
+
+/* Protothread function result */
+typedef enum
+{
+    PT_WAITING, // Blocked in a wait, call again.
+    PT_EXITED,  // Left through PT_EXIT().
+    PT_ENDED,   // Ran to PT_END().
+} pt_status_t;
+
+/* Restart protothread from the beginning. */
+#define PT_INIT(pt) ((pt)->lc = 0U)
+
+/* Start of protothread body, resumes at the last wait. */
+#define PT_BEGIN(pt) \
+    switch ((pt)->lc) \
+    {                 \
+    case 0U:
+
+/* End of protothread body, restarts it on the next call. */
+#define PT_END(pt) \
+    }              \
+    PT_INIT(pt);   \
+    return PT_ENDED
+
+/* Return PT_WAITING until cond holds, it is checked again on every call. */
+#define PT_WAIT_UNTIL(pt, cond)      \
+    do                               \
+    {                                \
+        (pt)->lc = (uint16_t)__LINE__; \
+    case __LINE__:                   \
+        if (!(cond))                 \
+        {                            \
+            return PT_WAITING;       \
+        }                            \
+    } while (0)
+
+/* Return PT_WAITING once, continue on the next call. */
+#define PT_YIELD(pt)                 \
+    do                               \
+    {                                \
+        (pt)->lc = (uint16_t)__LINE__; \
+        return PT_WAITING;           \
+    case __LINE__:;                  \
+    } while (0)
+
+/* Leave protothread early, restarts it on the next call. */
+#define PT_EXIT(pt)       \
+    do                    \
+    {                     \
+        PT_INIT(pt);      \
+        return PT_EXITED; \
+    } while (0)
+
+#endif
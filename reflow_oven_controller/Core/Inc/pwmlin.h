@@ -0,0 +1,135 @@
+/**
+ * @file pwmlin.h
+ * @author Timothy Nguyen
+ * @brief Heater PWM power linearization table and its calibration experiment.
+ * @version 0.1
+ * @date 2021-09-04
+ *
+ *      Heater power is not proportional to PWM duty: an SSR turns on and off late, and a
+ *      zero-cross SSR rounds every on time to whole mains half cycles, so short duties deliver
+ *      less than their share and the curve steps. The table maps an output, the fraction of
+ *      full power the controller asks for, to the duty delivering it. Its PWMLIN_LUT_SIZE
+ *      entries are evenly spaced in output, a lookup interpolates linearly between the two
+ *      entries around the output in constant time.
+ *
+ *      The table inverts a power curve measured at PWMLIN_CAL_POINTS evenly spaced duties.
+ *      The calibration experiment applies each duty for a fixed window, starting from the
+ *      same state every time: heated above a start temperature, then cooling past it with
+ *      heaters off. The oven being linear in power, the temperature rise over the window
+ *      less the rise at zero duty is proportional to the power the duty delivers.
+ */
+
+#ifndef _PWMLIN_H_
+#define _PWMLIN_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/* Configuration parameters */
+#define PWMLIN_OUT_MAX 4095U   // Full-scale output and duty, HEATER_OUT_MAX.
+#define PWMLIN_LUT_SIZE 256U   // Table entries, entry i is the duty of output i / (PWMLIN_LUT_SIZE - 1).
+#define PWMLIN_CAL_POINTS 9U   // Measured duties, point i is duty i / (PWMLIN_CAL_POINTS - 1).
+#define PWMLIN_MIN_RISE 1.0f   // Smallest rise of full over zero duty accepted as a curve (deg C).
+
+/* Linearization table */
+typedef struct
+{
+	uint16_t duty[PWMLIN_LUT_SIZE]; // Duty of every output step, nondecreasing, 0 and PWMLIN_OUT_MAX at the ends.
+} Pwmlin_t;
+
+/* Calibration status */
+typedef enum
+{
+	PWMLIN_CAL_RUNNING,     // Experiment in progress.
+	PWMLIN_CAL_DONE,        // Every duty measured, power curve is valid.
+	PWMLIN_CAL_ERR_LIMIT,   // Measurement exceeded limit, output forced off.
+	PWMLIN_CAL_ERR_TIMEOUT, // Start temperature not reached within timeout.
+	PWMLIN_CAL_ERR_CURVE,   // Full duty heated no more than zero duty.
+} Pwmlin_cal_status_t;
+
+/* Calibration phases, repeated for every duty */
+typedef enum
+{
+	PWMLIN_PHASE_HEAT,    // Full power until start plus preheat.
+	PWMLIN_PHASE_COOL,    // Heaters off until start.
+	PWMLIN_PHASE_MEASURE, // Duty applied for window.
+} Pwmlin_phase_t;
+
+/* Calibration configuration structure */
+typedef struct
+{
+	float start;   // Temperature every window starts at, crossed downwards (deg C).
+	float preheat; // Rise above start heated to before cooling to it (deg C).
+	float window;  // Time every duty is applied (s).
+	float limit;   // Measurement aborting experiment.
+	float timeout; // Longest heat or cool phase (s).
+} Pwmlin_cal_cfg_t;
+
+/* Calibration experiment */
+typedef struct
+{
+	Pwmlin_cal_cfg_t cfg;
+	Pwmlin_cal_status_t status;
+	Pwmlin_phase_t phase;
+
+	float out;        // Duty to apply.
+	uint8_t point;    // Duty measured or next measured.
+	float time;       // Time in phase (s).
+	float rise_start; // Measurement when window started.
+	float rise[PWMLIN_CAL_POINTS]; // Rise over window of every duty measured.
+
+	/* Result, valid once status is PWMLIN_CAL_DONE */
+	float power[PWMLIN_CAL_POINTS]; // Power of every duty, fraction of full power.
+} Pwmlin_cal_t;
+
+/**
+ * @brief Fill table with duties equal to outputs.
+ *
+ * @param[out] lin Table.
+ */
+void Pwmlin_Identity(Pwmlin_t * const lin);
+
+/**
+ * @brief Fill table inverting a measured power curve.
+ *
+ * Power is made nondecreasing first. An output within a flat stretch of the curve, eg. the
+ * duties too short to turn an SSR on, maps to the stretch's first duty, outputs just above
+ * it to duties past the stretch.
+ *
+ * @param[out] lin Table.
+ * @param power Power of every calibrated duty, fraction of full power.
+ *
+ * @return false if curve does not start at 0 and end at 1, table unchanged.
+ */
+bool Pwmlin_Build(Pwmlin_t * const lin, float const power[PWMLIN_CAL_POINTS]);
+
+/**
+ * @brief Get duty delivering output, interpolated between table entries.
+ *
+ * @param lin Table.
+ * @param out Output, at most PWMLIN_OUT_MAX.
+ *
+ * @return Duty, at most PWMLIN_OUT_MAX.
+ */
+uint16_t Pwmlin_Apply(Pwmlin_t const * const lin, uint16_t out);
+
+/**
+ * @brief Start calibration experiment, heating towards start temperature.
+ *
+ * @param cal Calibration experiment.
+ * @param cfg Calibration configuration parameters.
+ */
+void Pwmlin_Cal_Init(Pwmlin_cal_t * const cal, Pwmlin_cal_cfg_t const * const cfg);
+
+/**
+ * @brief Feed measurement and advance calibration experiment.
+ *
+ * @param cal Calibration experiment.
+ * @param measurement Oven temperature (deg C).
+ * @param Ts Time since previous measurement (s).
+ *
+ * @return PWMLIN_CAL_RUNNING until experiment completes or fails, duty to apply is cal->out.
+ */
+Pwmlin_cal_status_t Pwmlin_Cal_Step(Pwmlin_cal_t * const cal, float measurement, float Ts);
+
+#endif
@@ -0,0 +1,70 @@
+/**
+ * @file rate.h
+ * @author Timothy Nguyen
+ * @brief Adaptive control rate: slower sampling while the oven tracks a steady setpoint.
+ * @version 0.1
+ * @date 2021-09-05
+ *
+ *      The scheduler picks a divider, the number of nominal sampling periods per control
+ *      iteration. While every zone error stays within band and the setpoint moves no faster
+ *      than slope, e.g. on a soak or dwell, the divider doubles after every settle time up to
+ *      div_max. An error or setpoint rate past its limit, or a phase transition, returns to
+ *      full rate at once, so ramps and disturbances are handled at the nominal period.
+ *
+ *      The controllers stay consistent across changes as they take the measured time since
+ *      the previous iteration, see PID_SetSampleTime().
+ */
+
+#ifndef _RATE_H_
+#define _RATE_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/* Adaptive rate configuration structure */
+typedef struct
+{
+	uint8_t div_max; // Largest divider, 1 keeps full rate.
+	float band;      // Largest zone error of a steady oven (deg C).
+	float slope;     // Largest setpoint rate of a steady oven (deg C/s).
+	float settle;    // Time steady before every doubling of the divider (s).
+} Rate_cfg_t;
+
+/* Adaptive rate scheduler */
+typedef struct
+{
+	Rate_cfg_t cfg;
+	uint8_t div;         // Nominal sampling periods per control iteration.
+	float steady_time;   // Time steady since divider last changed (s).
+	float prev_setpoint; // Setpoint of previous update.
+	bool prev_valid;     // prev_setpoint is set.
+} Rate_t;
+
+/**
+ * @brief Set adaptive rate configuration, at full rate.
+ *
+ * @param rate Adaptive rate scheduler.
+ * @param cfg Configuration parameters.
+ */
+void Rate_Init(Rate_t * const rate, Rate_cfg_t const * const cfg);
+
+/**
+ * @brief Return to full rate, on a phase transition or when sampling starts.
+ *
+ * @param rate Adaptive rate scheduler.
+ */
+void Rate_Reset(Rate_t * const rate);
+
+/**
+ * @brief Update divider on a control iteration.
+ *
+ * @param rate Adaptive rate scheduler.
+ * @param error Largest absolute zone error (deg C).
+ * @param setpoint Setpoint (deg C).
+ * @param Ts Time since previous update (s).
+ *
+ * @return Divider for the following iterations, 1 to div_max.
+ */
+uint8_t Rate_Update(Rate_t * const rate, float error, float setpoint, float Ts);
+
+#endif
@@ -0,0 +1,144 @@
+/**
+ * @file recipe.h
+ * @author Timothy Nguyen
+ * @brief Reflow recipes: uploaded bytecode programs run by a bounded interpreter, one slice per sample.
+ * @version 0.1
+ * @date 2021-09-06
+ *
+ *      A recipe drives a scripted profile (see script.h) from a program uploaded by the host
+ *      rather than built in, so process engineers can add conditions such as "extend soak until
+ *      zones are within 3 deg C of each other" without a firmware update:
+ *
+ *           0: RAMP   to 150.0 at 1.00                  Setpoint to soak.
+ *           1: WAIT   temp >= 145.0                     Oven reached soak.
+ *           2: WAIT   spread < 3.0, after 120 s to 3    Zones even, or give up waiting.
+ *           3: HOLD   30 s
+ *           4: RAMP   to 220.0 at 2.00
+ *           ...
+ *
+ *      Each sample runs instructions until one waits, at most RECIPE_INSNS_PER_TICK, each of
+ *      constant cost, so the interpreter adds a bounded and fixed amount of time to a control
+ *      iteration whatever the program. A program that loops without waiting simply continues
+ *      on the next sample.
+ *
+ *      Instructions are 8 bytes, little-endian, operands are scaled integers:
+ *
+ *          u8 op, u8 arg, u8 jump, u8 reserved, i16 a, i16 b
+ *
+ *      Temperatures are in 0.1 deg C, rates in 0.01 deg C/s and times in seconds. A condition
+ *      (arg of WAIT and BRANCH) is a Recipe_src_t in bits 0 to 3, compared "less than" a if
+ *      RECIPE_COND_LT is set, else "at least" a.
+ */
+
+#ifndef _RECIPE_H_
+#define _RECIPE_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "common.h"
+#include "pt.h"
+#include "script.h"
+
+/* Configuration parameters */
+#define RECIPE_MAX_INSNS 30U     // Instructions per program, stored program must fit NVS_MAX_VALUE_LEN.
+#define RECIPE_INSNS_PER_TICK 8U // Most instructions run per sample.
+
+/* Opcodes */
+typedef enum
+{
+	RECIPE_OP_END,    // Program completed.
+	RECIPE_OP_RAMP,   // Ramp setpoint to a at rate b, 0 steps it, and go on.
+	RECIPE_OP_HOLD,   // Wait a seconds.
+	RECIPE_OP_WAIT,   // Wait until condition holds, jump after b seconds unless b is 0.
+	RECIPE_OP_BRANCH, // Jump if condition holds.
+	RECIPE_OP_JUMP,   // Jump.
+	RECIPE_OP_SET,    // Set actuator arg to a.
+	RECIPE_OP_MARK,   // Restart time of RECIPE_SRC_ELAPSED.
+	RECIPE_OP_ABORT,  // Stop reflow process as failed.
+
+	NUM_RECIPE_OPS
+} Recipe_op_t;
+
+/* Condition sources */
+typedef enum
+{
+	RECIPE_SRC_TEMP,     // Oven temperature (0.1 deg C).
+	RECIPE_SRC_SPREAD,   // Largest difference between zone temperatures (0.1 deg C).
+	RECIPE_SRC_SETPOINT, // Setpoint (0.1 deg C).
+	RECIPE_SRC_ELAPSED,  // Time since last MARK or start (s).
+
+	NUM_RECIPE_SRCS
+} Recipe_src_t;
+
+#define RECIPE_COND_SRC 0x0FU // Source bits of condition.
+#define RECIPE_COND_LT 0x80U  // Condition holds while source is below a.
+
+/* Actuators */
+typedef enum
+{
+	RECIPE_ACT_COOLING, // Cooling actuator driven if a is not 0, until the next RAMP.
+
+	NUM_RECIPE_ACTS
+} Recipe_act_t;
+
+/* Instruction */
+typedef struct
+{
+	uint8_t op;   // Recipe_op_t.
+	uint8_t arg;  // Condition or Recipe_act_t.
+	uint8_t jump; // Jump target, instruction index.
+	uint8_t rsv;  // Reserved, 0.
+	int16_t a;    // First operand.
+	int16_t b;    // Second operand.
+} Recipe_insn_t;
+
+/* Program, stored as is */
+typedef struct
+{
+	uint8_t num_insns;                     // Number of instructions, 1 to RECIPE_MAX_INSNS.
+	uint8_t rsv[3];                        // Reserved, 0.
+	Recipe_insn_t insns[RECIPE_MAX_INSNS]; // Instructions, running past the last one ends the program.
+} Recipe_t;
+
+/* Interpreter */
+typedef struct
+{
+	Recipe_t const *prog; // Program being run.
+	uint8_t pc;           // Instruction to run next.
+	bool waiting;         // Instruction at pc waits, since wait_start.
+	float wait_start;     // Script time the wait began (s).
+} Recipe_vm_t;
+
+/**
+ * @brief Validate program.
+ *
+ * @param prog Program.
+ * @param max_target Highest allowed ramp target (deg C).
+ * @param[out] bad Index of first invalid instruction, num_insns if the count is invalid.
+ * @return MOD_OK if program is valid, MOD_ERR_ARG otherwise.
+ */
+mod_err_t Recipe_Check(Recipe_t const *const prog, float max_target, uint32_t *const bad);
+
+/**
+ * @brief Start validated program from its first instruction.
+ *
+ * @param vm Interpreter.
+ * @param prog Program, unchanged while it runs.
+ */
+void Recipe_Start(Recipe_vm_t *const vm, Recipe_t const *const prog);
+
+/**
+ * @brief Script body running the program of the interpreter in ctx of the script.
+ *
+ * @param s Script instance, ctx is a started Recipe_vm_t.
+ * @return pt_status_t PT_WAITING until the program ends (PT_ENDED) or aborts (PT_EXITED).
+ */
+pt_status_t Recipe_Script(Script_t *const s);
+
+/**
+ * @brief Print program, one instruction per line.
+ */
+void Recipe_Print(Recipe_t const *const prog);
+
+#endif
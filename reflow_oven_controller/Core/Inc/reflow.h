@@ -10,56 +10,224 @@
 #define __REFLOW_H__
 
 #include <stdint.h>
+#include <stdbool.h>
 
 #include "active.h"
 #include "stm32l4xx.h"
 #include "MAX31855K.h"
+#include "heater.h"
+#include "analog.h"
 
 /* Configuration parameters */
 #define REFLOW_THREAD_STACK_SZ 1024 * 2
+#define REFLOW_EVENT_MSG_COUNT 5 // Maximum number of messages in event message queue.
 
 #define KP_INIT 10.0f 		 // Kp gain.
 #define KI_INIT 0.0f  		 // Ki gain.
 #define KD_INIT 0.0f  		 // Kd gain.
 #define TAU_INIT 1.0f 		 // Low-pass filter time constant.
 #define TS_INIT  0.5f 		 // Sampling period (s).
+#define TS_MIN   0.02f 		 // Shortest sampling period settable, 50 Hz control loop (s).
+#define TS_MAX   2.0f 		 // Longest sampling period settable (s).
+#define PWM_PERIOD_MIN 0.02f // Shortest zone heater PWM period settable (s), TIM3 runs TS_INIT until set.
 #define OUT_MAX_INIT 4095.0f // Maximum output saturation limit.
 #define OUT_MIN_INIT 0.0f    // Minimum output saturation limit.
+#define FORM_INIT PID_FORM_POSITIONAL // Controller form, see pid.h.
+#define ANTIWINDUP_INIT PID_ANTIWINDUP_CLAMP // Integrator anti-windup method, see pid.h.
+#define TT_INIT 20.0f        // Back-calculation tracking time constant (s).
+#define B_INIT 1.0f          // Proportional setpoint weight.
+#define C_INIT 0.0f          // Derivative setpoint weight.
+
+#define CASCADE_KP_INIT 20.0f      // Inner (heater element) loop Kp gain.
+#define CASCADE_KI_INIT 0.5f       // Inner loop Ki gain.
+#define CASCADE_KD_INIT 0.0f       // Inner loop Kd gain.
+#define CASCADE_DIV_INIT 4U        // Outer (air) loop runs every Nth sample.
+#define CASCADE_DIV_MAX 20U        // Largest outer loop divider.
+#define CASCADE_ELEMENT_MAX 400.0f // Highest heater element setpoint (deg C).
+
+#define SAMPLE_TIMER_CLK_HZ 10000U // Hardware sampling timer counter clock (after prescaler).
+#define REFLOW_OVERSAMPLE 5U       // Most thermocouple scans averaged per control tick, at most one per MAX31855K conversion.
+
+#define REFLOW_MAX_ZONES 4         // Maximum number of independently controlled heater zones.
+#define REFLOW_MAX_THERMOCOUPLES 4 // Maximum number of thermocouples scanned per control tick.
+#define REFLOW_RIDE_SAMPLES 3U     // Most consecutive samples with transient thermocouple errors ridden through.
+#ifndef REFLOW_NUM_OVENS
+#define REFLOW_NUM_OVENS 1U        // Independent ovens controlled, at most NVS_MAX_OVENS, see reflow_init().
+#endif
 
 /* Reflow controller signals. */
 enum ReflowSignal
 {
     START_REFLOW_SIG = USER_SIG, // Start reflow process.
-    REACH_TIME_SIG,			     // Timeout event.
-	REACH_TEMP_SIG,			     // Reached specific temperature.
+    REACH_TIME_SIG,			     // Segment dwell timeout event.
     STOP_REFLOW_SIG,				 // Stop reflow process.
+	PROFILE_LOAD_SIG,			 // Apply uploaded reflow profile.
+	SAMPLE_READY_SIG,			 // Thermocouple sample acquired through DMA.
+	AUTOTUNE_SIG,				 // Start relay autotune experiment.
+	SAFETY_TRIP_SIG,			 // Safety supervisor forced heaters off, published.
+	STEPRESP_SIG,				 // Start step response experiment.
+	GAINS_SIG,					 // Apply zone gains published by "reflow set".
+	CONVEYOR_SIG,				 // Start continuous conveyor mode.
+	SCHEDULE_SIG,				 // Add scheduled job or clear schedule, see "reflow schedule".
+	SCHEDULE_TICK_SIG,			 // Periodic schedule check while jobs are queued.
+	CALIBRATE_SIG,				 // Start PWM power calibration or drop its table, see "reflow calibrate".
+	TIMING_SIG,					 // Apply sampling and PWM periods set by "reflow set".
+	REFRESH_SIG,				 // Read thermocouples into latest sample while idle, see "reflow status".
+	SCRIPT_SIG,					 // Start scripted profile, see "reflow script".
+	WATCH_SIG,					 // Apply status push rate set by "reflow watch".
+	WATCH_TICK_SIG,				 // Periodic status push, see "reflow watch".
+	ZONES_STABLE_SIG,			 // Every conveyor zone became stable, raised once by an ActiveCond.
+	ALIGN_TICK_SIG,				 // Next read of the conversion boundary search, see "reflow align".
 
 	NUM_REFLOW_SIGS
 };
 
+/* Thermocouple sample event published with SAMPLE_READY_SIG, allocated from event pool
+ * in SPI DMA transfer complete ISR. The controller of the oven sampled takes it without
+ * subscribing, so it never sees samples of other ovens (see Active_publish_to()). */
+typedef struct
+{
+    Event base;          // Inherit base Event class.
+    MAX31855K_err_t err; // First thermocouple read error of sample's scans.
+    uint8_t err_tc;      // Index of thermocouple that reported err.
+    uint8_t err_mask;    // Thermocouples with a read error in any of the sample's scans, bit per index.
+    uint8_t num_scans;   // Number of scans averaged into temp.
+    uint8_t num_thermocouples; // Number of thermocouples in temp.
+    float temp[REFLOW_MAX_THERMOCOUPLES]; // Mean hot junction temperatures (deg C), valid for thermocouples not in err_mask.
+    Analog_t analog;     // Heater current, ambient and supply when sample was posted.
+    uint32_t timestamp;  // DWT cycle count when last scan of sample was triggered.
+    uint32_t ready_timestamp; // DWT cycle count when DMA transfer completed.
+    uint8_t oven;        // Index of oven sampled.
+} Sample_Event;
+
+/* Trip event published with SAFETY_TRIP_SIG, one static event per oven. */
+typedef struct
+{
+    Event base;   // Inherit base Event class.
+    uint8_t oven; // Index of oven whose heaters were forced off.
+} Trip_Event;
+
+/* Status snapshot record type, first byte of a snapshot. */
+#define REFLOW_STATUS_TYPE 0x06U
+
+/* Reflow_State of status snapshot while no process runs. */
+#define REFLOW_STATE_RESET 0U
+
+/* Status snapshot, written by the reflow thread after every event and read through a seqlock,
+ * so status polls copy it instead of formatting live controller fields. Sent as is by "reflow status bin" and "reflow watch". */
+typedef struct __attribute__((packed))
+{
+    uint8_t type;                       // REFLOW_STATUS_TYPE.
+    uint32_t tick;                      // Kernel tick count of snapshot (ms).
+    uint8_t state;                      // Reflow_State, REFLOW_STATE_RESET while idle.
+    uint8_t segment;                    // Profile segment index.
+    uint8_t num_zones;                  // Number of zones in zone_temp and zone_out.
+    uint8_t err;                        // MAX31855K_err_t of latest acquisition.
+    uint32_t acq_count;                 // Acquisitions since boot, 0 if none yet.
+    uint32_t acq_tick;                  // Kernel tick count of latest acquisition (ms).
+    float setpoint;                     // Setpoint temperature (deg C).
+    float temp;                         // Oven temperature (deg C), NAN if not read.
+    float script_time;                  // Time since start of scripted profile (s), 0 otherwise.
+    float cooling_out;                  // Cooling actuator output, NAN if none fitted.
+    float zone_temp[REFLOW_MAX_ZONES];  // Zone temperatures (deg C), NAN while idle.
+    float zone_out[REFLOW_MAX_ZONES];   // Zone heater outputs.
+    uint8_t oven;                       // Index of oven.
+} Reflow_Status;
+
+/* Heater zone configuration structure */
+typedef struct
+{
+	const char * name;                    // Zone name shown in logs and status.
+	Heater_cfg_t heater;                  // Heater output drive.
+	uint8_t thermocouple;                 // Index of zone thermocouple, less than num_thermocouples.
+	uint8_t vote_mask;                    // Bit per redundant thermocouple voted with thermocouple, 0 for none.
+	bool cascade;                         // Heater element thermocouple fitted, zone may run cascade control.
+	uint8_t element_thermocouple;         // Index of heater element thermocouple, if cascade.
+} Reflow_zone_cfg_t;
+
 /* Reflow oven controller configuration structure */
 typedef struct
 {
-	TIM_HandleTypeDef * pwm_timer_handle;   // PWM Timer handle.
-	uint32_t pwm_channel;					// PWM Timer channel.
-	MAX31855K_cfg_t max_cfg;                // MAX31855K Thermocouple IC configuration structure.
+	uint8_t num_zones;                          // Number of heater zones, at most REFLOW_MAX_ZONES.
+	Reflow_zone_cfg_t zones[REFLOW_MAX_ZONES];  // Heater zone configurations.
+	bool has_fan;                               // Cooling fan or door actuator fitted.
+	Heater_cfg_t fan;                           // Cooling actuator output drive, if has_fan.
+	bool has_belt;                              // Conveyor belt drive fitted.
+	Heater_cfg_t belt;                          // Conveyor belt speed output drive, if has_belt.
+	TIM_HandleTypeDef * sample_timer_handle; // Hardware sampling timer handle, NULL to sample from an RTOS timer.
+	uint8_t num_thermocouples;                          // Number of thermocouples, at most REFLOW_MAX_THERMOCOUPLES.
+	MAX31855K_cfg_t max_cfg[REFLOW_MAX_THERMOCOUPLES]; // MAX31855K Thermocouple IC configurations, all on one SPI bus.
 } Reflow_cfg_t;
 
 /**
- * @brief Initialize reflow oven controller.
+ * @brief Initialize reflow oven controller of one oven.
+ *
+ * Every one of the REFLOW_NUM_OVENS ovens has its own controller thread, thermocouples,
+ * heaters, sampling timer, stored settings and commands: "reflow" and "tc" with one oven,
+ * "reflow<oven>" and "tc<oven>" with several. Ovens share the SPI bus manager, the
+ * event pools, the safety supervisor, the run archive and the console.
  *
+ * @param oven Index of oven, less than REFLOW_NUM_OVENS, each initialized once.
  * @param reflow_cfg Reflow oven configuration parameters.
  *
- * @note Make sure that timer period is 4095 ticks or 12-bit PWM resolution
- * 	     with PWM frequency of around 2 Hz.
+ * @note Make sure that zone PWM timer periods are 4095 ticks or 12-bit PWM resolution
+ * 	     with PWM frequency of around 2 Hz. Burst-fire zones require heater_init() first.
+ *       The cooling actuator is driven during segments whose target is below the previous
+ *       one, its drive may share the zone PWM timer (spare channel).
+ *       With "reflow cascade on", zones with a heater element thermocouple run the zone
+ *       controller on air temperature every few samples to set the element setpoint, and an
+ *       inner controller on element temperature every sample to drive the heater.
+ *       Conveyor ovens run "reflow conveyor start" instead of profiles: every zone holds its own
+ *       setpoint until stopped and the belt drive, if fitted, is driven at a set output.
  */
-void reflow_init(Reflow_cfg_t const * const reflow_cfg);
+void reflow_init(uint8_t oven, Reflow_cfg_t const * const reflow_cfg);
 
 /**
  * @brief Start reflow oven active object instance.
  *
+ * @param oven Index of initialized oven.
+ *
  * This function does not start the scheduler.
  */
-void reflow_start();
+void reflow_start(uint8_t oven);
+
+/**
+ * @brief Trigger thermocouple sample on hardware sampling timer update.
+ *
+ * @param htim Timer handle passed to HAL_TIM_PeriodElapsedCallback().
+ *
+ * @note Call from HAL_TIM_PeriodElapsedCallback(), timers of no oven are ignored.
+ */
+void reflow_sample_timer_elapsed(TIM_HandleTypeDef *htim);
+
+/**
+ * @brief Copy status snapshot without waiting on the reflow thread (thread context).
+ *
+ * While idle nothing samples the thermocouples, so a reading is requested for the next poll
+ * instead of waited for: polled periodically, the temperature is at most one poll old.
+ *
+ * @param oven Index of oven.
+ * @param[out] dst Copy of status snapshot.
+ */
+void reflow_status_get(uint8_t oven, Reflow_Status *const dst);
+
+/**
+ * @brief Start loaded profile or stop running process, as "reflow start" and "reflow stop" (any thread).
+ *
+ * A start is ignored unless idle and cooled, see the RESET state, a stop jumps the event queue.
+ *
+ * @param oven Index of oven.
+ * @param run true to start, false to stop.
+ *
+ * @return MOD_OK if posted, otherwise the error posting to the reflow event queue.
+ */
+mod_err_t reflow_post_run(uint8_t oven, bool run);
+
+/**
+ * @brief Check whether the controller of every oven is in its RESET state, from the latest status snapshots (any context).
+ *
+ * Unlike reflow_status_get() the snapshot is not refreshed, so frequent polling costs nothing.
+ */
+bool reflow_idle(void);
 
 #endif
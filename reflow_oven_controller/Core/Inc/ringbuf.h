@@ -0,0 +1,237 @@
+/**
+ * @file ringbuf.h
+ * @author Timothy Nguyen
+ * @brief Lock-free single-producer/single-consumer ring buffer.
+ * @version 0.1
+ * @date 2021-08-02
+ *
+ * Notes:
+ * - Buffer size must be a power of two so that indices wrap using a mask
+ *   rather than a modulo division.
+ * - Put and get indices are free-running. Only the producer writes the put index
+ *   and only the consumer writes the get index, so one producer (eg. a thread) and
+ *   one consumer (eg. an ISR) may access the ring concurrently without locking.
+ * - Multiple producers or multiple consumers must serialize access themselves.
+ *
+ * Declare a ring buffer and its storage like so:
+ *
+ * static uint8_t rx_storage[256];
+ * static ringbuf_t rx_ring;
+ *
+ * ringbuf_init(&rx_ring, rx_storage, sizeof(rx_storage));
+ */
+
+#ifndef _RINGBUF_H_
+#define _RINGBUF_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+
+#include "common.h"
+#include "stm32l4xx.h"
+
+/* Ring buffer structure */
+typedef struct
+{
+    volatile uint32_t put_idx; // Free-running put index, written by producer only.
+    volatile uint32_t get_idx; // Free-running get index, written by consumer only.
+    uint32_t mask;             // Buffer size - 1.
+    uint8_t *buf;              // Buffer storage.
+} ringbuf_t;
+
+/**
+ * @brief Initialize ring buffer.
+ *
+ * @param[out] rb Ring buffer instance.
+ * @param[in] buf Buffer storage.
+ * @param[in] size Size of buffer storage in bytes, must be a power of two.
+ *
+ * @return MOD_OK if successful, MOD_ERR_ARG if size is not a power of two.
+ */
+static inline mod_err_t ringbuf_init(ringbuf_t *const rb, uint8_t *buf, uint32_t size)
+{
+    if (buf == NULL || size == 0 || (size & (size - 1)) != 0)
+    {
+        return MOD_ERR_ARG;
+    }
+
+    rb->buf = buf;
+    rb->mask = size - 1;
+    rb->put_idx = 0;
+    rb->get_idx = 0;
+    return MOD_OK;
+}
+
+/**
+ * @brief Get capacity of ring buffer in bytes.
+ */
+static inline uint32_t ringbuf_size(ringbuf_t const *const rb)
+{
+    return rb->mask + 1;
+}
+
+/**
+ * @brief Get number of bytes available to consumer.
+ */
+static inline uint32_t ringbuf_count(ringbuf_t const *const rb)
+{
+    return rb->put_idx - rb->get_idx;
+}
+
+/**
+ * @brief Get number of bytes available to producer.
+ */
+static inline uint32_t ringbuf_free(ringbuf_t const *const rb)
+{
+    return ringbuf_size(rb) - ringbuf_count(rb);
+}
+
+/**
+ * @brief Check if ring buffer is empty.
+ */
+static inline bool ringbuf_is_empty(ringbuf_t const *const rb)
+{
+    return rb->put_idx == rb->get_idx;
+}
+
+/**
+ * @brief Push a block of bytes (producer only).
+ *
+ * @param rb Ring buffer instance.
+ * @param data Bytes to push.
+ * @param len Number of bytes to push.
+ *
+ * @return Number of bytes pushed, less than len if ring buffer ran out of space.
+ */
+static inline uint32_t ringbuf_push(ringbuf_t *const rb, const void *data, uint32_t len)
+{
+    uint32_t put_idx = rb->put_idx;
+    uint32_t free_space = ringbuf_size(rb) - (put_idx - rb->get_idx);
+    if (len > free_space)
+    {
+        len = free_space;
+    }
+
+    /* Copy in at most two segments, splitting at wrap-around. */
+    uint32_t offset = put_idx & rb->mask;
+    uint32_t first_len = ringbuf_size(rb) - offset;
+    if (first_len > len)
+    {
+        first_len = len;
+    }
+    memcpy(&rb->buf[offset], data, first_len);
+    memcpy(&rb->buf[0], (const uint8_t *)data + first_len, len - first_len);
+
+    __DMB(); // Data must be visible before consumer observes new put index.
+    rb->put_idx = put_idx + len;
+    return len;
+}
+
+/**
+ * @brief Push a single byte (producer only).
+ *
+ * @return true if byte was pushed, false if ring buffer is full.
+ */
+static inline bool ringbuf_push_byte(ringbuf_t *const rb, uint8_t byte)
+{
+    uint32_t put_idx = rb->put_idx;
+    if (put_idx - rb->get_idx == ringbuf_size(rb))
+    {
+        return false;
+    }
+
+    rb->buf[put_idx & rb->mask] = byte;
+    __DMB(); // Data must be visible before consumer observes new put index.
+    rb->put_idx = put_idx + 1;
+    return true;
+}
+
+/**
+ * @brief Get contiguous region of bytes available to consumer without removing them.
+ *
+ * Region ends at the end of the buffer storage if data wraps around,
+ * which makes it suitable for handing to a DMA channel.
+ *
+ * @param[in] rb Ring buffer instance.
+ * @param[out] data Start of contiguous region.
+ *
+ * @return Number of bytes in contiguous region.
+ */
+static inline uint32_t ringbuf_peek_contig(ringbuf_t const *const rb, const uint8_t **data)
+{
+    uint32_t get_idx = rb->get_idx;
+    uint32_t count = rb->put_idx - get_idx;
+    __DMB(); // Read put index before reading data.
+
+    uint32_t offset = get_idx & rb->mask;
+    uint32_t contig_len = ringbuf_size(rb) - offset;
+    *data = &rb->buf[offset];
+    return count < contig_len ? count : contig_len;
+}
+
+/**
+ * @brief Release bytes previously peeked back to producer (consumer only).
+ *
+ * @param rb Ring buffer instance.
+ * @param len Number of bytes to release, must not exceed ringbuf_count().
+ */
+static inline void ringbuf_advance(ringbuf_t *const rb, uint32_t len)
+{
+    __DMB(); // Finish reading data before producer may overwrite it.
+    rb->get_idx = rb->get_idx + len;
+}
+
+/**
+ * @brief Pop a block of bytes (consumer only).
+ *
+ * @param rb Ring buffer instance.
+ * @param data Destination of popped bytes.
+ * @param len Maximum number of bytes to pop.
+ *
+ * @return Number of bytes popped.
+ */
+static inline uint32_t ringbuf_pop(ringbuf_t *const rb, void *data, uint32_t len)
+{
+    uint32_t get_idx = rb->get_idx;
+    uint32_t count = rb->put_idx - get_idx;
+    __DMB(); // Read put index before reading data.
+    if (len > count)
+    {
+        len = count;
+    }
+
+    /* Copy out in at most two segments, splitting at wrap-around. */
+    uint32_t offset = get_idx & rb->mask;
+    uint32_t first_len = ringbuf_size(rb) - offset;
+    if (first_len > len)
+    {
+        first_len = len;
+    }
+    memcpy(data, &rb->buf[offset], first_len);
+    memcpy((uint8_t *)data + first_len, &rb->buf[0], len - first_len);
+
+    ringbuf_advance(rb, len);
+    return len;
+}
+
+/**
+ * @brief Pop a single byte (consumer only).
+ *
+ * @return true if a byte was popped, false if ring buffer is empty.
+ */
+static inline bool ringbuf_pop_byte(ringbuf_t *const rb, uint8_t *byte)
+{
+    uint32_t get_idx = rb->get_idx;
+    if (rb->put_idx == get_idx)
+    {
+        return false;
+    }
+    __DMB(); // Read put index before reading data.
+
+    *byte = rb->buf[get_idx & rb->mask];
+    ringbuf_advance(rb, 1);
+    return true;
+}
+
+#endif
@@ -0,0 +1,57 @@
+/**
+ * @file rls.h
+ * @author Timothy Nguyen
+ * @brief Recursive least squares estimator with exponential forgetting.
+ * @version 0.1
+ * @date 2021-08-15
+ *
+ *      Estimates theta in y = phi' * theta from a stream of (phi, y) pairs. Each update
+ *      costs O(n^2) for n = RLS_N parameters and needs no matrix inversion:
+ *
+ *          k = P phi / (lambda + phi' P phi)
+ *          theta += k (y - phi' theta)
+ *          P = (P - k phi' P) / lambda
+ *
+ *      P is kept symmetric, so phi' P is taken as (P phi)'.
+ */
+
+#ifndef _RLS_H_
+#define _RLS_H_
+
+#include <stdint.h>
+
+/* Number of estimated parameters. */
+#define RLS_N 3U
+
+/* Covariance trace beyond which forgetting is suspended, bounds windup while input is not exciting. */
+#define RLS_TRACE_MAX 1.0e6f
+
+/* RLS estimator structure */
+typedef struct
+{
+	float theta[RLS_N];    // Parameter estimate.
+	float P[RLS_N][RLS_N]; // Covariance matrix, scaled by noise variance.
+	float lambda;          // Forgetting factor in (0, 1], 1 keeps all history.
+	float error;           // Most recent a priori prediction error.
+	uint32_t updates;      // Number of updates since initialization.
+} RLS_t;
+
+/**
+ * @brief Erase estimate and set covariance to p0 * I.
+ *
+ * @param rls RLS estimator instance.
+ * @param lambda Forgetting factor in (0, 1].
+ * @param p0 Initial covariance, large values trust initial samples more.
+ */
+void RLS_Init(RLS_t * const rls, float lambda, float p0);
+
+/**
+ * @brief Update estimate with one observation.
+ *
+ * @param rls RLS estimator instance.
+ * @param phi Regressor vector of RLS_N elements.
+ * @param y Observed output.
+ */
+void RLS_Update(RLS_t * const rls, const float phi[RLS_N], float y);
+
+#endif
@@ -0,0 +1,72 @@
+/**
+ * @file rtc.h
+ * @author Timothy Nguyen
+ * @brief Wall-clock time from the RTC calendar, clocked by the LSE.
+ * @version 0.1
+ * @date 2021-09-01
+ *
+ * The RTC lives in the backup domain, so once set with "rtc set" it keeps counting across
+ * resets as long as the board stays powered. Time is exchanged as seconds since
+ * 2000-01-01 00:00:00 plus milliseconds, from the sub-second register, and is whatever
+ * time zone it was set in. The calendar covers the years 2000 to 2099.
+ *
+ * Log timestamps are wall-clock time once the RTC is set, uptime before.
+ *
+ * Notes:
+ * - Shadow registers are bypassed, so reads right after wakeup from STOP2 are current.
+ * - With the default prescalers the sub-second register counts in 1/256 s, so
+ *   milliseconds step by about 4 ms.
+ */
+
+#ifndef _RTC_H_
+#define _RTC_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "common.h"
+
+/* Configuration parameters */
+#define RTC_LSE_TIMEOUT_MS 5000U // Longest LSE startup (ms).
+#define RTC_INIT_TIMEOUT_MS 10U  // Longest wait for calendar initialization mode (ms).
+#define RTC_TEXT_LEN 20U         // Length of "YYYY-MM-DD hh:mm:ss" including terminator.
+
+/**
+ * @brief Start LSE and RTC if not running yet and register "rtc" commands.
+ *
+ * @return MOD_OK if successful, MOD_ERR_PERIPH if the LSE did not start or the RTC runs
+ *         from another clock, otherwise a "MOD_ERR" value.
+ */
+mod_err_t rtc_init(void);
+
+/**
+ * @brief Read wall-clock time.
+ *
+ * @param[out] sec Seconds since 2000-01-01 00:00:00.
+ * @param[out] ms Milliseconds into second.
+ *
+ * @return true if successful, false if RTC was never set.
+ */
+bool rtc_read(uint32_t *const sec, uint32_t *const ms);
+
+/**
+ * @brief Set wall-clock time.
+ *
+ * @param sec Seconds since 2000-01-01 00:00:00, before 2100.
+ *
+ * @return MOD_OK if successful, MOD_ERR_ARG if out of range, MOD_ERR_PERIPH if RTC is not
+ *         running or did not enter initialization mode.
+ */
+mod_err_t rtc_set(uint32_t sec);
+
+/**
+ * @brief Format wall-clock time as "YYYY-MM-DD hh:mm:ss".
+ *
+ * @param sec Seconds since 2000-01-01 00:00:00.
+ * @param buf Output buffer.
+ * @param size Size of buf, RTC_TEXT_LEN for the whole text.
+ */
+void rtc_format(uint32_t sec, char *buf, size_t size);
+
+#endif
@@ -0,0 +1,78 @@
+/**
+ * @file rtt.h
+ * @author Timothy Nguyen
+ * @brief Memory-mapped console channel read and written by the debug probe (SEGGER RTT layout).
+ * @version 0.1
+ * @date 2021-09-14
+ *
+ * A control block in RAM holds one up (target to host) and one down (host to target) ring
+ * buffer in the layout of SEGGER RTT, so J-Link RTT Viewer, "rtt" of OpenOCD or probe-rs
+ * find it, by the _SEGGER_RTT symbol or by scanning RAM for its "SEGGER RTT" ID, and read
+ * and write it in the background through the debug port while the core runs. Writing costs
+ * a copy into RAM, so logs leave at the rate the probe polls, megabytes per second, instead
+ * of the UART's baud rate.
+ *
+ * Used two ways:
+ * - As log sink, "log sink rtt", while the console stays on USART2: log messages go to up
+ *   buffer 0, command responses to the console.
+ * - As console transport, built with CONSOLE_RTT set to 1 (see console.h): the output of its
+ *   console session goes to up buffer 0 and the down buffer is polled every RTT_POLL_MS for
+ *   received characters, the same interfaces as uart.c and usb_cdc.c.
+ *
+ * Notes:
+ * - Up buffer 0 never blocks: a block that does not fit in the free space is dropped
+ *   entirely, only blocks larger than the whole buffer are truncated. Without a probe
+ *   reading, the buffer fills and stays full.
+ * - "cmd pm rtt" counts dropped blocks and transferred bytes.
+ */
+
+#ifndef _RTT_H_
+#define _RTT_H_
+
+#include <stddef.h>
+
+#include "common.h"
+
+/* Configuration parameters */
+#ifndef RTT_ENABLE
+#define RTT_ENABLE 1 // Set to 0 to leave out the control block and its buffers.
+#endif
+#define RTT_UP_BUF_SIZE 2048U // Bytes of up buffer, about a millisecond poll interval of output at MB/s.
+#define RTT_DOWN_BUF_SIZE 64U // Bytes of down buffer, characters typed between polls.
+#define RTT_POLL_MS 10U       // Period of polling the down buffer as console transport (ms).
+
+/**
+ * @brief Initialize control block, the probe finds it from now on.
+ *
+ * @return MOD_OK for success.
+ */
+mod_err_t rtt_init(void);
+
+/**
+ * @brief Start polling down buffer for characters to post to the console.
+ *
+ * @return MOD_OK for success, MOD_ERR_NOT_INIT if rtt_init() was not called.
+ */
+mod_err_t rtt_start(void);
+
+/**
+ * @brief Put a block of characters in up buffer (non-blocking).
+ *
+ * Same semantics as uart_write(): a block that does not fit in the free space of the up
+ * buffer is dropped entirely, only blocks larger than the whole buffer are truncated.
+ *
+ * @param buf Characters to transmit.
+ * @param len Number of characters to transmit.
+ *
+ * @return MOD_OK for success, MOD_ERR_BUF_OVERRUN if block was dropped or truncated.
+ */
+mod_err_t rtt_write(const char *buf, size_t len);
+
+/**
+ * @brief Get free space in up buffer.
+ *
+ * @return Number of characters rtt_write() would currently accept as one block.
+ */
+size_t rtt_tx_free(void);
+
+#endif
@@ -0,0 +1,127 @@
+/**
+ * @file safety.h
+ * @author Timothy Nguyen
+ * @brief Safety supervisor: thermal runaway and sensor fault trips forcing heaters off.
+ * @version 0.1
+ * @date 2021-08-26
+ *
+ * The safety active object subscribes to published thermocouple samples (SAMPLE_READY_SIG)
+ * and runs at the highest thread priority, so it checks every sample before the reflow
+ * controller computes outputs from it. It trips on the first of:
+ * - Sensor fault: a hard thermocouple read error (MAX_OPEN, MAX_SHORT_VCC, MAX_SHORT_GND), or
+ *   transient errors (see MAX31855K_Err_Transient()) on more than REFLOW_RIDE_SAMPLES
+ *   consecutive samples. A sample with a transient error is left out of the rate of rise and
+ *   heater checks, its thermocouples that read correctly are still checked for over-temperature.
+ *   The reflow controller holds its zones on the model over it, so a one-off SPI glitch does
+ *   not abort a run.
+ * - Over-temperature: a thermocouple above SAFETY_MAX_TEMP.
+ * - Runaway: a thermocouple rising faster than SAFETY_MAX_RISE over the last
+ *   SAFETY_RISE_WINDOW samples, eg. a welded SSR.
+ * - No rise: a watched heater at full output for SAFETY_SAT_TIME_S while its thermocouple
+ *   rose less than SAFETY_SAT_MIN_RISE, eg. a thermocouple fallen out of the oven or a
+ *   burnt-out element.
+ * - Open heater: watched heaters at SAFETY_OPEN_MIN_OUT of full output or more for
+ *   SAFETY_OPEN_TIME_S while the heater current, scaled to full output, stayed below
+ *   SAFETY_OPEN_MIN_A, eg. a burnt-out element or an SSR that does not close. Only with a
+ *   heater current sensor fitted (see analog.h), the sample carries NAN otherwise.
+ *
+ * Each oven (see REFLOW_NUM_OVENS) is checked on its own samples and trips on its own: a trip
+ * calls Heater_Trip() on every watched heater of that oven, forcing the outputs inactive in
+ * hardware within the sample that showed the fault, then publishes SAFETY_TRIP_SIG (a
+ * Trip_Event naming the oven) so its reflow controller aborts. The one heater current sensor
+ * carries every oven's heaters, so an open heater trips every oven. Trips are latched: heaters
+ * stay off and new runs are refused until "safety clear", accepted once the heaters are disabled.
+ *
+ * Notes:
+ * - Handling a sample is bounded by SAFETY_MAX_HEATERS, REFLOW_MAX_THERMOCOUPLES and
+ *   REFLOW_NUM_OVENS, without blocking calls.
+ * - Samples only arrive while the reflow controller samples, heaters are disabled otherwise.
+ */
+
+#ifndef _SAFETY_H_
+#define _SAFETY_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "common.h"
+#include "heater.h"
+
+/* Configuration parameters */
+#define SAFETY_THREAD_STACK_SZ 1024U // Safety active object stack size (bytes).
+#define SAFETY_EVENT_MSG_COUNT 4U    // Maximum number of messages in event message queue.
+#define SAFETY_MAX_HEATERS 4U        // Maximum number of watched heaters per oven.
+#define SAFETY_MAX_TEMP 320.0f       // Highest allowed thermocouple temperature (deg C).
+#define SAFETY_MAX_RISE 5.0f         // Highest allowed rate of rise (deg C/s).
+#define SAFETY_RISE_WINDOW 4U        // Samples spanned by rate of rise, 2 s at 0.5 s sampling period.
+#define SAFETY_SAT_TIME_S 60.0f      // Longest time at full output without SAFETY_SAT_MIN_RISE (s).
+#define SAFETY_SAT_MIN_RISE 5.0f     // Rise expected from a heater at full output (deg C).
+#define SAFETY_GAP_S 2.0f            // Samples further apart start a new rate of rise window (s).
+#define SAFETY_OPEN_MIN_OUT 0.5f     // Least output fraction of watched heaters the open heater check runs at.
+#define SAFETY_OPEN_MIN_A 1.0f       // Least heater current at full output (A).
+#define SAFETY_OPEN_TIME_S 10.0f     // Longest time with heater current below SAFETY_OPEN_MIN_A (s).
+/* Limits above are defaults of "safety.*" parameters (see param.h), which only tighten them. */
+
+/**
+ * @brief Trip reasons.
+ */
+typedef enum
+{
+    SAFETY_OK,           // Not tripped.
+    SAFETY_SENSOR_FAULT, // Thermocouple read error.
+    SAFETY_OVER_TEMP,    // Temperature above SAFETY_MAX_TEMP.
+    SAFETY_RUNAWAY,      // Rate of rise above SAFETY_MAX_RISE.
+    SAFETY_NO_RISE,      // Heater saturated without temperature rise.
+    SAFETY_MANUAL,       // Tripped by "safety trip".
+    SAFETY_OPEN_HEATER,  // Heater current too low for output.
+
+    SAFETY_NUM_REASONS
+} safety_reason_t;
+
+/**
+ * @brief Construct and start safety active object and register safety commands.
+ *
+ * Call before the reflow controller is initialized, which registers its heaters.
+ *
+ * @return MOD_OK if successful, otherwise a "MOD_ERR" value.
+ */
+mod_err_t safety_init(void);
+
+/**
+ * @brief Add heater to the outputs of oven forced off on trip.
+ *
+ * @param oven Oven heater belongs to, less than REFLOW_NUM_OVENS.
+ * @param heater Initialized heater instance.
+ * @param thermocouple Index of oven's thermocouple measuring heater, for the no-rise check.
+ *
+ * @return MOD_OK if successful, MOD_ERR_RESOURCE if SAFETY_MAX_HEATERS heaters of oven are watched.
+ */
+mod_err_t safety_watch(uint8_t oven, Heater_t *const heater, uint8_t thermocouple);
+
+/**
+ * @brief Check whether a trip of oven is latched.
+ *
+ * @param oven Oven, less than REFLOW_NUM_OVENS.
+ *
+ * @return true if heaters of oven are forced off.
+ */
+bool safety_tripped(uint8_t oven);
+
+/**
+ * @brief Get reason of latched trip of oven.
+ *
+ * @param oven Oven, less than REFLOW_NUM_OVENS.
+ *
+ * @return First reason of the latched trip, SAFETY_OK if not tripped.
+ */
+safety_reason_t safety_reason(uint8_t oven);
+
+/**
+ * @brief Force every watched heater of every oven off without latching a trip or notifying anyone.
+ *
+ * For fault handlers: no kernel calls, callable from any context, including a faulting
+ * thread or HardFault/MemManage handlers (see stackguard.h).
+ */
+void safety_force_off(void);
+
+#endif
@@ -0,0 +1,93 @@
+/**
+ * @file scope.h
+ * @author Timothy Nguyen
+ * @brief Live variable scope: registered variables sampled once per control iteration into binary frames.
+ * @version 0.1
+ * @date 2021-09-06
+ *
+ * Modules expose variables with SCOPE_VAR(), which places a descriptor in a linker section,
+ * so the registry takes no RAM and no registration calls:
+ *
+ * SCOPE_VAR(setpoint, &reflow_ovens[0].setpoint, SCOPE_FLOAT);
+ *
+ * "scope add setpoint" selects a variable and "scope rate 1" samples every control iteration.
+ * Each sample is a COBS frame on the telemetry channel holding the raw bytes of the selected
+ * variables, in selection order, so the target formats nothing:
+ *
+ *      uint8_t  type;      // SCOPE_TELEMETRY_TYPE.
+ *      uint32_t timestamp; // Sample time (ms).
+ *      uint8_t  num_vars;  // Number of values.
+ *      uint8_t  values[];  // Raw little-endian values, sized by type, see "scope list".
+ *
+ * Variables are read without locking, a multi-byte variable written by another thread may be
+ * sampled mid-update.
+ */
+
+#ifndef _SCOPE_H_
+#define _SCOPE_H_
+
+#include <stdint.h>
+
+#include "common.h"
+
+/* Configuration parameters */
+#define SCOPE_MAX_VARS 8U            // Most variables selected at once.
+#define SCOPE_TELEMETRY_TYPE 0x07U   // First payload byte of a scope frame.
+
+/* Variable types */
+typedef enum
+{
+    SCOPE_U8,
+    SCOPE_U16,
+    SCOPE_U32,
+    SCOPE_I16,
+    SCOPE_I32,
+    SCOPE_FLOAT,
+
+    NUM_SCOPE_TYPES
+} scope_type_t;
+
+/* Registered variable, in section scope_vars */
+typedef struct
+{
+    const char *name; // Variable name, unique.
+    const void *addr; // Variable address.
+    uint8_t type;     // scope_type_t.
+} scope_var_t;
+
+/* Bounds of registered variables, provided by the linker. */
+extern const scope_var_t __start_scope_vars[];
+extern const scope_var_t __stop_scope_vars[];
+
+/**
+ * @brief Register variable for sampling.
+ *
+ * Descriptors are aligned to their type, as compilers may otherwise pad larger objects
+ * and the section would no longer be an array.
+ *
+ * @param var_name Variable name, an identifier unique within the image.
+ * @param var_addr Address of a variable of static storage duration.
+ * @param var_type scope_type_t of variable.
+ */
+#define SCOPE_VAR(var_name, var_addr, var_type)                                                     \
+    static const scope_var_t _scope_var_##var_name                                                  \
+        __attribute__((used, section("scope_vars"), aligned(__alignof__(scope_var_t)))) = {         \
+            .name = #var_name, .addr = (var_addr), .type = (var_type)}
+
+/**
+ * @brief Initialize scope module, checks registered variables.
+ *
+ * @return MOD_OK if successful, otherwise a "MOD_ERR" value.
+ */
+mod_err_t scope_init(void);
+
+/**
+ * @brief Sample selected variables and send them as one frame, every "scope rate" calls.
+ *
+ * Call once per control iteration from the thread that runs it.
+ *
+ * @param timestamp Sample time (ms).
+ */
+void scope_sample(uint32_t timestamp);
+
+#endif // _SCOPE_H_
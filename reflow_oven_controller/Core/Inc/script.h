@@ -0,0 +1,158 @@
+/**
+ * @file script.h
+ * @author Timothy Nguyen
+ * @brief Scripted reflow profiles: sequential profile logic run as a protothread, one step per sample.
+ * @version 0.1
+ * @date 2021-09-06
+ *
+ *      A segment table covers ramp-and-hold profiles. Profiles that wait for the oven, time out
+ *      or branch on what they measured are written as a protothread (see pt.h) instead, called
+ *      once per sample by the reflow active object, so they need no thread stack of their own:
+ *
+ *      static pt_status_t script_foo(Script_t *const s)
+ *      {
+ *          PT_BEGIN(&s->pt);
+ *          Script_Ramp(s, 150.0f, 1.0f);                       // Setpoint moves at 1 deg C/s.
+ *          PT_WAIT_UNTIL(&s->pt, s->temp >= 145.0f);           // Oven caught up.
+ *          Script_Mark(s);
+ *          PT_WAIT_UNTIL(&s->pt, Script_Since(s) >= 60.0f);    // Hold 60 s.
+ *          PT_END(&s->pt);
+ *      }
+ *
+ *      Scripts are built in, listed in the table of script.c. Time is the sum of sample periods,
+ *      so it follows virtual time in hardware-in-the-loop runs, and waits resolve to a sample.
+ */
+
+#ifndef _SCRIPT_H_
+#define _SCRIPT_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "pt.h"
+
+/* Script status */
+typedef enum
+{
+	SCRIPT_RUNNING, // Script waits for a later sample.
+	SCRIPT_DONE,    // Script ran to its end.
+	SCRIPT_ABORTED, // Script gave up through PT_EXIT(), reason logged.
+} Script_status_t;
+
+typedef struct Script Script_t;
+
+/* Script body, a protothread resumed on every sample */
+typedef pt_status_t (*Script_fn_t)(Script_t *const s);
+
+/* Built-in script */
+typedef struct
+{
+	const char *name; // Name given to "reflow script".
+	const char *help; // One line description.
+	Script_fn_t fn;   // Script body.
+} Script_def_t;
+
+/* Running script */
+struct Script
+{
+	pt_t pt;                 // Resume point of script body.
+	Script_def_t const *def; // Script being run.
+	void *ctx;               // Context of script body, eg. a recipe interpreter.
+
+	/* Inputs, updated before every step */
+	float temp;   // Oven temperature (deg C).
+	float spread; // Largest difference between zone temperatures (deg C).
+	float time;   // Time since start (s).
+
+	/* Outputs */
+	float setpoint; // Setpoint to apply (deg C).
+	bool cooling;   // Setpoint falls, cooling actuator is driven.
+
+	/* Setpoint ramp, moved before every step */
+	float target; // Ramp target (deg C).
+	float rate;   // Ramp rate (deg C/s), 0 once setpoint is at target.
+
+	/* Script state kept across waits */
+	float mark;  // Time of last Script_Mark() (s).
+	float value; // Free for the script, eg. a hold time it chose.
+};
+
+/**
+ * @brief Find built-in script by name, case insensitively.
+ *
+ * @return Script, NULL if there is none of that name.
+ */
+Script_def_t const *Script_Find(const char *name);
+
+/**
+ * @brief Get built-in script by index, for listing.
+ *
+ * @return Script, NULL past the last one.
+ */
+Script_def_t const *Script_Get(uint32_t index);
+
+/**
+ * @brief Start script, setpoint begins at oven temperature.
+ *
+ * @param s Script instance.
+ * @param def Script to run.
+ * @param ctx Context of script body, NULL for built-in scripts.
+ * @param start_temp Oven temperature (deg C).
+ */
+void Script_Init(Script_t *const s, Script_def_t const *def, void *ctx, float start_temp);
+
+/**
+ * @brief Move setpoint ramp and resume script on a sample.
+ *
+ * @param s Script instance.
+ * @param temp Oven temperature (deg C).
+ * @param spread Largest difference between zone temperatures (deg C).
+ * @param Ts Time since previous sample (s).
+ * @return Script_status_t SCRIPT_RUNNING until the script ends, setpoint to apply is s->setpoint.
+ */
+Script_status_t Script_Step(Script_t *const s, float temp, float spread, float Ts);
+
+/**
+ * @brief Ramp setpoint to target from its current value.
+ *
+ * @param s Script instance.
+ * @param target Target (deg C).
+ * @param rate Ramp rate (deg C/s), 0 steps setpoint to target.
+ */
+static inline void Script_Ramp(Script_t *const s, float target, float rate)
+{
+	s->cooling = target < s->setpoint;
+	s->target = target;
+	s->rate = rate;
+	if (rate <= 0.0f)
+	{
+		s->setpoint = target;
+		s->rate = 0.0f;
+	}
+}
+
+/**
+ * @brief Check whether setpoint got to ramp target.
+ */
+static inline bool Script_Ramped(Script_t const *const s)
+{
+	return s->rate == 0.0f;
+}
+
+/**
+ * @brief Remember current time, for holds and timeouts.
+ */
+static inline void Script_Mark(Script_t *const s)
+{
+	s->mark = s->time;
+}
+
+/**
+ * @brief Get time since last Script_Mark() (s).
+ */
+static inline float Script_Since(Script_t const *const s)
+{
+	return s->time - s->mark;
+}
+
+#endif
@@ -0,0 +1,48 @@
+/**
+ * @file sections.h
+ * @author Timothy Nguyen
+ * @brief Memory placement macros for sections of the linker scripts.
+ * @version 0.1
+ * @date 2021-08-22
+ *
+ * Time-critical functions are placed in SRAM2 with RAMFUNC:
+ *
+ * void RAMFUNC PID_Calculate(...)
+ * {
+ *     ...
+ * }
+ *
+ * The startup code copies the .ramfunc section from flash into SRAM2 before main() and
+ * relocates the vector table into SRAM2 as well, so interrupt entry and these functions
+ * run without flash wait states or ART cache misses. SRAM2 is fetched through the I-Code
+ * and D-Code buses, so code there does not contend with DMA transfers into SRAM1.
+ *
+ * Data is split by bus traffic with two zero-initialized sections, which the startup code
+ * clears like .bss:
+ * - SRAM2_BSS: thread stacks and event pools. Stack and pool accesses are CPU-only and go
+ *   to SRAM2, so they do not wait on DMA transfers into SRAM1.
+ * - SRAM1_DMA: buffers read or written by DMA and telemetry rings. They are kept together
+ *   at the start of SRAM1 .bss, aligned to 32 bytes.
+ *
+ * static uint64_t SRAM2_BSS foo_stack[FOO_STACK_SZ / sizeof(uint64_t)];
+ *
+ * "sys mem" displays the use of both sections.
+ *
+ * Notes:
+ * - Only zero-initialized variables may be placed with SRAM2_BSS or SRAM1_DMA, initial
+ *   values are not copied from flash.
+ * - SRAM2 holds the vector table copy, .ramfunc and SRAM2_BSS, 32 Kbytes in total. The FreeRTOS
+ *   heap (ucHeap) stays in SRAM1 .bss.
+ * - Calls between flash and SRAM2 are out of direct branch range, the linker inserts
+ *   long-branch veneers.
+ * - RAMFUNC functions are never inlined, an inlined copy would run from flash.
+ */
+
+#ifndef _SECTIONS_H_
+#define _SECTIONS_H_
+
+#define RAMFUNC __attribute__((section(".ramfunc"), noinline)) // Run function from SRAM2.
+#define SRAM2_BSS __attribute__((section(".sram2_bss")))          // Place zero-initialized variable in SRAM2.
+#define SRAM1_DMA __attribute__((section(".sram1_dma")))          // Place zero-initialized DMA buffer in SRAM1.
+
+#endif
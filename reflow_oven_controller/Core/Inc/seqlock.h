@@ -0,0 +1,90 @@
+/**
+ * @file seqlock.h
+ * @author Timothy Nguyen
+ * @brief Sequence lock for data written by one writer and read by any number of lock-free readers.
+ * @version 0.1
+ * @date 2021-09-06
+ *
+ * The writer makes the sequence odd before changing the data and even again afterwards.
+ * A reader copies the data between two loads of the sequence and retries if it was odd
+ * or moved meanwhile, so it never sees a torn copy and never blocks the writer.
+ *
+ * static seqlock_t lock;
+ * static foo_t shared;
+ *
+ * seqlock_write_begin(&lock);    // Writer, in an ISR or with interrupts masked.
+ * shared = new_value;
+ * seqlock_write_end(&lock);
+ *
+ * foo_t copy;                    // Reader, in a thread.
+ * uint32_t seq;
+ * do
+ * {
+ *     seq = seqlock_read_begin(&lock);
+ *     copy = shared;
+ * } while (seqlock_read_retry(&lock, seq));
+ *
+ * Notes:
+ * - A reader preempting a writer would retry until the writer resumes, so writers must not
+ *   be preempted by readers: write from an ISR, or from a thread with interrupts masked.
+ * - Writers must not be concurrent with each other.
+ */
+
+#ifndef _SEQLOCK_H_
+#define _SEQLOCK_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "stm32l4xx.h"
+
+/* Sequence lock */
+typedef struct
+{
+    volatile uint32_t seq; // Odd while data is being written, incremented twice per write.
+} seqlock_t;
+
+/**
+ * @brief Start writing data, readers retry until seqlock_write_end().
+ */
+static inline void seqlock_write_begin(seqlock_t *const lock)
+{
+    lock->seq++;
+    __DMB();
+}
+
+/**
+ * @brief Finish writing data.
+ */
+static inline void seqlock_write_end(seqlock_t *const lock)
+{
+    __DMB();
+    lock->seq++;
+}
+
+/**
+ * @brief Start reading data.
+ *
+ * @return Sequence to pass to seqlock_read_retry() once data is copied.
+ */
+static inline uint32_t seqlock_read_begin(seqlock_t const *const lock)
+{
+    uint32_t seq = lock->seq;
+    __DMB();
+    return seq;
+}
+
+/**
+ * @brief Check whether data copied since seqlock_read_begin() may be torn.
+ *
+ * @param seq Sequence returned by seqlock_read_begin().
+ *
+ * @return true if a write was in progress or happened meanwhile, the copy must be retried.
+ */
+static inline bool seqlock_read_retry(seqlock_t const *const lock, uint32_t seq)
+{
+    __DMB();
+    return (seq & 1U) != 0U || lock->seq != seq;
+}
+
+#endif
@@ -0,0 +1,81 @@
+/**
+ * @file simd.h
+ * @author Timothy Nguyen
+ * @brief Packed 16-bit arithmetic on pairs of channels, with Cortex-M4 SIMD instructions.
+ * @version 0.1
+ * @date 2021-09-03
+ *
+ * A 32-bit word holds two signed 16-bit lanes, the even channel in the low half. Each
+ * operation handles both lanes in one instruction on the target (__PKHBT, __QADD16) and
+ * falls back to scalar code where the DSP extension is missing, eg. in the host simulation.
+ * Both variants give the same results bit for bit.
+ *
+ * Summing readings of an even number of channels:
+ *
+ * uint32_t sum[NUM_CHANNELS / 2] = {0};
+ * sum[i / 2] = simd_qadd16(sum[i / 2], simd_pack16(reading[i], reading[i + 1]));
+ * int16_t sum_odd = simd_hi16(sum[i / 2]);
+ */
+
+#ifndef _SIMD_H_
+#define _SIMD_H_
+
+#include <stdint.h>
+
+#include "stm32l4xx.h"
+
+/**
+ * @brief Pack two lanes into a word.
+ *
+ * @param lo Low lane, even channel.
+ * @param hi High lane, odd channel.
+ *
+ * @return Packed word.
+ */
+static inline uint32_t simd_pack16(int16_t lo, int16_t hi)
+{
+#if defined(__ARM_FEATURE_DSP) && (__ARM_FEATURE_DSP == 1)
+    return __PKHBT((uint32_t)(uint16_t)lo, (uint32_t)(uint16_t)hi, 16);
+#else
+    return (uint32_t)(uint16_t)lo | ((uint32_t)(uint16_t)hi << 16);
+#endif
+}
+
+/**
+ * @brief Get low lane of word.
+ */
+static inline int16_t simd_lo16(uint32_t x)
+{
+    return (int16_t)(uint16_t)x;
+}
+
+/**
+ * @brief Get high lane of word.
+ */
+static inline int16_t simd_hi16(uint32_t x)
+{
+    return (int16_t)(uint16_t)(x >> 16);
+}
+
+/**
+ * @brief Add lanes of two words, saturating to the int16_t range.
+ *
+ * @param a First packed word.
+ * @param b Second packed word.
+ *
+ * @return Packed lane sums.
+ */
+static inline uint32_t simd_qadd16(uint32_t a, uint32_t b)
+{
+#if defined(__ARM_FEATURE_DSP) && (__ARM_FEATURE_DSP == 1)
+    return __QADD16(a, b);
+#else
+    int32_t lo = (int32_t)simd_lo16(a) + simd_lo16(b);
+    int32_t hi = (int32_t)simd_hi16(a) + simd_hi16(b);
+    lo = lo > INT16_MAX ? INT16_MAX : (lo < INT16_MIN ? INT16_MIN : lo);
+    hi = hi > INT16_MAX ? INT16_MAX : (hi < INT16_MIN ? INT16_MIN : hi);
+    return simd_pack16((int16_t)lo, (int16_t)hi);
+#endif
+}
+
+#endif
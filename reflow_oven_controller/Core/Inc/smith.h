@@ -0,0 +1,84 @@
+/**
+ * @file smith.h
+ * @author Timothy Nguyen
+ * @brief Smith predictor for PID control of plants with dead time.
+ * @version 0.1
+ * @date 2021-08-15
+ *
+ *      A first-order-plus-dead-time (FOPDT) plant model G(s) = K e^(-Ls) / (Ts + 1) runs
+ *      alongside the plant. The PID controller is fed the measurement corrected by the
+ *      difference between the undelayed and delayed model outputs:
+ *
+ *          feedback = measurement + y_model(t) - y_model(t - L)
+ *
+ *      With an accurate model the controller sees the plant without dead time, so it
+ *      can be tuned tighter without overshoot. Model errors appear in the feedback as
+ *      an ordinary disturbance, which the PID integral still rejects.
+ */
+
+#ifndef _SMITH_H_
+#define _SMITH_H_
+
+#include <stdint.h>
+
+#include "common.h"
+#include "pid.h"
+
+/* Longest modelled dead time in samples, 64 s at 0.5 s sampling period. */
+#define SMITH_MAX_DELAY 128U
+
+/* FOPDT plant model */
+typedef struct
+{
+	float K;   // Steady-state gain (plant units per output unit).
+	float T;   // Time constant (s).
+	float L;   // Dead time (s).
+} Smith_model_t;
+
+/* Smith predictor structure */
+typedef struct
+{
+	Smith_model_t model;
+
+	/* Derived coefficients, recomputed when model or sample time change */
+	float alpha;    // e^(-Ts/T), discrete model pole.
+	uint32_t delay; // Dead time in samples, at most SMITH_MAX_DELAY.
+
+	/* Predictor memory */
+	float y_model;                  // Undelayed model output, deviation from operating point.
+	float history[SMITH_MAX_DELAY]; // Past model outputs, ring buffer.
+	uint32_t head;                  // Index of oldest model output.
+
+	/* Solely for data logging */
+	float correction; // y_model(t) - y_model(t - L) added to measurement.
+} Smith_t;
+
+/**
+ * @brief Set plant model and erase predictor memory.
+ *
+ * @param sp Smith predictor instance.
+ * @param model FOPDT plant model, T must be positive.
+ * @param Ts Sample time (s).
+ * @return MOD_OK if successful, MOD_ERR_ARG if model is invalid or its dead time exceeds SMITH_MAX_DELAY samples.
+ */
+mod_err_t Smith_Init(Smith_t * const sp, Smith_model_t const * const model, float Ts);
+
+/**
+ * @brief Perform PID iteration on predicted measurement and advance plant model.
+ *
+ * @param sp Smith predictor instance.
+ * @param pid PID controller, tuned for the plant without dead time.
+ * @param setpoint Setpoint value for current iteration.
+ * @param measurement Measured value for current iteration.
+ * @return float Saturated controller output.
+ */
+float Smith_Calculate(Smith_t * const sp, PID_t * const pid, float setpoint, float measurement);
+
+/**
+ * @brief Clear predictor memory but retain plant model.
+ *
+ * @param sp Smith predictor instance.
+ */
+void Smith_Reset(Smith_t * const sp);
+
+#endif
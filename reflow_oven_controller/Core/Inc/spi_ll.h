@@ -0,0 +1,67 @@
+/**
+ * @file spi_ll.h
+ * @author Timothy Nguyen
+ * @brief Lean polled SPI receive at register level, for short reads where HAL overhead dominates.
+ * @version 0.1
+ * @date 2021-09-02
+ *
+ * HAL_SPI_Receive() spends more time in argument checks, locking and per-frame bookkeeping
+ * than on the bus for a 4 byte read. spi_ll_receive() drives chip select through BRR/BSRR,
+ * keeps the 8-bit frame format of the handle and moves two frames per data register access:
+ * with the receive FIFO threshold at 16 bits, every write of 16 bits clocks two frames and
+ * every read of 16 bits takes two, first frame in the low byte.
+ *
+ * The handle is marked busy for the duration of the transfer, so HAL transfers started
+ * meanwhile, eg. a DMA scan from an interrupt, fail with HAL_BUSY instead of corrupting it.
+ *
+ * Chip select is either a GPIO pin or, with a NULL port, the NSS output of the SPI itself.
+ * The handle must then be configured with SPI_NSS_HARD_OUTPUT and SPI_NSS_PULSE_DISABLE: NSS
+ * is low while the SPI is enabled, so spi_ll_select() enables it and spi_ll_deselect()
+ * disables it once idle. NSS pulse mode is of no use to devices like the MAX31855K, it raises
+ * NSS between frames of at most 16 bits and would split a longer read.
+ */
+
+#ifndef _SPI_LL_H_
+#define _SPI_LL_H_
+
+#include <stdint.h>
+
+#include "stm32l4xx_hal.h"
+
+/**
+ * @brief Drive chip select low.
+ *
+ * @param hspi SPI the device is on.
+ * @param cs_port Chip select GPIO port, NULL for NSS output of SPI.
+ * @param cs_pin Chip select GPIO pin, unused for NSS output.
+ */
+void spi_ll_select(SPI_HandleTypeDef *hspi, GPIO_TypeDef *cs_port, uint16_t cs_pin);
+
+/**
+ * @brief Drive chip select high, after the last frame is shifted out for NSS output.
+ *
+ * @param hspi SPI the device is on.
+ * @param cs_port Chip select GPIO port, NULL for NSS output of SPI.
+ * @param cs_pin Chip select GPIO pin, unused for NSS output.
+ *
+ * @note Callable from ISR context.
+ */
+void spi_ll_deselect(SPI_HandleTypeDef *hspi, GPIO_TypeDef *cs_port, uint16_t cs_pin);
+
+/**
+ * @brief Select device, clock bytes in while sending zeros, deselect device.
+ *
+ * @param hspi Full-duplex master SPI with 8-bit frames.
+ * @param cs_port Chip select GPIO port, active low, NULL for NSS output of SPI.
+ * @param cs_pin Chip select GPIO pin, unused for NSS output.
+ * @param[out] data Receive buffer.
+ * @param size Number of bytes, even.
+ * @param timeout_ms Longest transfer (ms).
+ *
+ * @return HAL_OK if successful, HAL_BUSY if another transfer is in progress, HAL_TIMEOUT if
+ *         the transfer did not complete in time.
+ */
+HAL_StatusTypeDef spi_ll_receive(SPI_HandleTypeDef *hspi, GPIO_TypeDef *cs_port, uint16_t cs_pin,
+                                 uint8_t *data, uint16_t size, uint32_t timeout_ms);
+
+#endif
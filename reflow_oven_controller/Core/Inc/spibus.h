@@ -0,0 +1,111 @@
+/**
+ * @file spibus.h
+ * @author Timothy Nguyen
+ * @brief SPI bus manager: queued transfers of devices sharing an SPI, chained by DMA interrupts.
+ * @version 0.1
+ * @date 2021-09-06
+ *
+ * Every device on a bus describes its transfers with a descriptor: chip select, fastest clock
+ * and mode it accepts, buffers and a completion callback. spibus_submit() links a descriptor
+ * into the queue of the bus and returns at once. The transfer at the head of the queue runs
+ * by DMA; its transfer complete interrupt deselects the device, calls the callback and starts
+ * the next queued transfer, setting baud rate prescaler and clock mode of its device first.
+ * Devices therefore share a bus without mutexes and without the CPU waiting on it.
+ *
+ * The queue is intrusive: descriptors are owned by their devices and linked in place, so a
+ * bus holds any number of queued transfers without storage of its own. A descriptor must stay
+ * untouched from submission until its callback.
+ *
+ * Polled transfers, eg. spi_ll_receive(), claim the bus with spibus_acquire() first. Transfers
+ * submitted meanwhile queue up and start once spibus_release() hands the bus back.
+ *
+ * Notes:
+ * - Callbacks run in ISR context, or in the context calling spibus_submit() or
+ *   spibus_release() if the transfer failed to start. A callback may submit transfers.
+ * - The baud rate prescaler is derived from the SPI kernel clock at the start of every
+ *   transfer, so device clock limits hold across system clock changes, see clock.h.
+ * - Buses hold 8-bit full-duplex master SPIs with DMA on both directions.
+ */
+
+#ifndef _SPIBUS_H_
+#define _SPIBUS_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "stm32l4xx_hal.h"
+
+/* Configuration parameters */
+#define SPIBUS_MAX_BUSES 2U // Maximum number of managed SPIs.
+#define SPIBUS_KEEP_HZ 0U   // Device clock limit keeping baud rate prescaler of the bus.
+
+/* SPI clock modes, clock polarity and phase */
+typedef enum
+{
+    SPIBUS_MODE_0, // Clock idles low, data sampled on rising edge.
+    SPIBUS_MODE_1, // Clock idles low, data sampled on falling edge.
+    SPIBUS_MODE_2, // Clock idles high, data sampled on falling edge.
+    SPIBUS_MODE_3, // Clock idles high, data sampled on rising edge.
+} spibus_mode_t;
+
+typedef struct spibus_xfer spibus_xfer_t;
+
+/* Transfer complete callback, ok is false if the transfer failed or could not be started. */
+typedef void (*spibus_cb_t)(spibus_xfer_t *xfer, bool ok);
+
+/* Transfer descriptor */
+struct spibus_xfer
+{
+    GPIO_TypeDef *cs_port; // Chip select GPIO port, active low, NULL for NSS output of SPI, see spi_ll.h.
+    uint16_t cs_pin;       // Chip select GPIO pin, unused for NSS output.
+    uint32_t max_hz;       // Fastest clock the device accepts (Hz), SPIBUS_KEEP_HZ for the bus setting.
+    spibus_mode_t mode;    // Clock mode of the device.
+    uint8_t *tx;           // Bytes to send, NULL to send the initial content of rx.
+    uint8_t *rx;           // Received bytes, may equal tx.
+    uint16_t len;          // Number of bytes.
+    spibus_cb_t cb;        // Completion callback (NULL for none).
+    void *arg;             // Callback argument, eg. the device.
+
+    spibus_xfer_t *next;   // Next queued transfer, private to the bus.
+    volatile bool queued;  // Submitted and not yet completed.
+};
+
+/**
+ * @brief Manage an SPI.
+ *
+ * @param hspi Initialized full-duplex master SPI with RX and TX DMA channels.
+ *
+ * @return HAL_OK if successful, HAL_ERROR if SPIBUS_MAX_BUSES are managed already.
+ */
+HAL_StatusTypeDef spibus_init(SPI_HandleTypeDef *hspi);
+
+/**
+ * @brief Queue transfer, started at once if the bus is idle.
+ *
+ * @param hspi Managed SPI the device is on.
+ * @param xfer Transfer descriptor.
+ *
+ * @return HAL_OK if queued, HAL_BUSY if the descriptor is queued already,
+ *         HAL_ERROR if the SPI is not managed.
+ *
+ * @note Callable from ISR context.
+ */
+HAL_StatusTypeDef spibus_submit(SPI_HandleTypeDef *hspi, spibus_xfer_t *xfer);
+
+/**
+ * @brief Claim idle bus for a polled transfer, queued transfers wait for spibus_release().
+ *
+ * @param hspi Managed SPI.
+ *
+ * @return true if claimed, false if a transfer is queued or the bus is claimed already.
+ */
+bool spibus_acquire(SPI_HandleTypeDef *hspi);
+
+/**
+ * @brief Hand claimed bus back, starting transfers queued meanwhile.
+ *
+ * @param hspi Managed SPI claimed with spibus_acquire().
+ */
+void spibus_release(SPI_HandleTypeDef *hspi);
+
+#endif
@@ -0,0 +1,93 @@
+/**
+ * @file stackguard.h
+ * @author Timothy Nguyen
+ * @brief Stack overflow guard: MPU region below the running thread's stack and the main stack.
+ * @version 0.1
+ * @date 2021-09-21
+ *
+ * Two MPU regions of STACKGUARD_SIZE bytes are read-only:
+ * - STACKGUARD_REGION_THREAD: the lowest STACKGUARD_SIZE-aligned block of the running
+ *   thread's stack. The task switch hook (traceTASK_SWITCHED_IN, FreeRTOSConfig.h) moves it
+ *   to the stack of the thread switched in, a single MPU register write.
+ * - STACKGUARD_REGION_MAIN: the lowest block of the main stack reserved by the linker
+ *   script (_Min_Stack_Size below _estack), used by interrupts.
+ *
+ * Any write into a guard, a push of the thread's own code or the exception entry stacking
+ * its registers, raises a MemManage fault before the overflow corrupts the memory below.
+ * If stackguard_hit() confirms the fault hit a guard, the handler calls stackguard_fault(),
+ * which forces the heaters off (safety_force_off()),
+ * records the thread and faulting address in the RTC backup registers, which survive a
+ * system reset, and resets the controller. stackguard_init() reports and clears the record
+ * of the previous reset, "stackguard status" shows it until the next one. Other MemManage
+ * faults, eg. executing from an XN address, stop in the handler like any other fault.
+ *
+ * Detection costs nothing per instruction and one register write per context switch, unlike
+ * the stack checks of configCHECK_FOR_STACK_OVERFLOW, which stays off. Stack sizes may be
+ * trimmed towards the high-water marks of "sys tasks": an overflow now ends in a logged reset
+ * rather than silent corruption.
+ *
+ * Notes:
+ * - Guards are read-only rather than no-access, so high-water mark scans, which read a stack
+ *   from its bottom, still work. A stray read below a stack is not caught.
+ * - Each stack gives up between STACKGUARD_SIZE and 2 * STACKGUARD_SIZE - 1 bytes to its
+ *   guard, depending on the stack's alignment. Frames skipping the whole guard, eg. a local
+ *   array larger than it that is never written, are not caught.
+ * - The rest of the memory map keeps its default attributes (PRIVDEFENA), threads run
+ *   privileged with the ARM_CM4F port.
+ * - DMA transfers are not checked by the MPU.
+ */
+
+#ifndef _STACKGUARD_H_
+#define _STACKGUARD_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "common.h"
+
+/* Configuration parameters */
+#define STACKGUARD_SIZE 32U         // Guard size, a power of two of at least 32 (bytes).
+#define STACKGUARD_REGION_THREAD 7U // MPU region guarding running thread's stack.
+#define STACKGUARD_REGION_MAIN 6U   // MPU region guarding main stack.
+#define STACKGUARD_NAME_LEN 12U     // Thread name characters kept in backup registers.
+
+/**
+ * @brief Enable MPU guards and MemManage fault, report previous stack overflow reset and
+ *        register stack guard commands.
+ *
+ * Call from the first thread, once the scheduler has started, as early as possible.
+ *
+ * @return MOD_OK if successful, otherwise a "MOD_ERR" value.
+ */
+mod_err_t stackguard_init(void);
+
+/**
+ * @brief Move thread guard to bottom of stack of thread switched in.
+ *
+ * Called by the kernel from traceTASK_SWITCHED_IN, only with the scheduler suspended or from
+ * PendSV.
+ *
+ * @param stack Lowest address of thread's stack (pxStack of its TCB).
+ */
+void stackguard_switched_in(void *stack);
+
+/**
+ * @brief Check whether the MemManage fault being handled hit a stack guard.
+ *
+ * A data access must have faulted within a guard (MMFAR valid). Failed exception entry
+ * or lazy FP stacking reports no address, it can only have hit a guard since the guards
+ * are the only MPU regions.
+ *
+ * @return True if a guard was hit, false for any other MemManage fault.
+ */
+bool stackguard_hit(void);
+
+/**
+ * @brief Handle guard violation: force heaters off, record culprit and reset controller.
+ *
+ * Call from MemManage_Handler, and from HardFault_Handler for a MemManage fault escalated
+ * by an overflowing main stack. Takes no kernel locks.
+ */
+void stackguard_fault(void) __attribute__((noreturn));
+
+#endif
@@ -0,0 +1,97 @@
+/**
+ * @file sys.h
+ * @author Timothy Nguyen
+ * @brief System resource monitor: thread stacks and heaps.
+ * @version 0.1
+ * @date 2021-08-19
+ *
+ * "sys mem" reports, for every kernel thread, the least free stack space seen since
+ * the thread started (FreeRTOS stack high-water mark), the FreeRTOS heap_4 free and
+ * minimum ever free sizes, and the newlib heap grown by _sbrk() towards the main stack.
+ * Stack sizes can be trimmed to the measured usage plus a safety margin.
+ *
+ * "sys top [seconds]" reports each thread's share of CPU time and number of times it was
+ * switched in over the last seconds, at most SYS_TOP_WINDOW. FreeRTOS run-time statistics
+ * are clocked by the DWT cycle counter, and a software timer samples them every
+ * SYS_TOP_PERIOD_MS into a ring, so the window slides without blocking the command.
+ *
+ * "sys boot" reports the reset cause and how long each boot stage took. StartDefaultTask()
+ * brings the reflow controller up first, so heater outputs are driven again soon after a
+ * reset, then the console, commands and logging, then diagnostics and power management:
+ *
+ * sys_boot_begin(SYS_BOOT_CONTROL);
+ * reflow_init(&reflow_cfg);
+ * ...
+ * sys_boot_end(SYS_BOOT_CONTROL);
+ *
+ * Stage times are measured with the DWT cycle counter at the system clock of the stage
+ * start, the system clock is only lowered at the end of the last stage (clock_init()).
+ */
+
+#ifndef _SYS_H_
+#define _SYS_H_
+
+#include "common.h"
+
+/* Configuration parameters */
+#define SYS_MAX_THREADS 16      // Maximum number of kernel threads reported by "sys mem" and "sys top".
+#define SYS_MAX_TASK_NUMBER 32  // Context switches are counted for kernel task numbers below this.
+#define SYS_TOP_PERIOD_MS 1000U // Run-time statistics sampling period.
+#define SYS_TOP_WINDOW 5U       // Longest "sys top" window (sampling periods), at most 50 s.
+
+/**
+ * @brief Boot stages, in order.
+ */
+typedef enum
+{
+    SYS_BOOT_CONTROL,  // Active objects, watchdog, stored parameters, safety and reflow controller.
+    SYS_BOOT_CONSOLE,  // Logging, console and command active object.
+    SYS_BOOT_SERVICES, // Profiling, system monitor, trace, run archive, power and clock management.
+    SYS_BOOT_NUM_STAGES
+} sys_boot_stage_t;
+
+/**
+ * @brief Register system commands.
+ *
+ * @return MOD_OK if successful, otherwise a "MOD_ERR" value.
+ */
+mod_err_t sys_init(void);
+
+/**
+ * @brief Enable run-time statistics clock (DWT cycle counter).
+ *
+ * @note Called by the kernel before the scheduler starts (portCONFIGURE_TIMER_FOR_RUN_TIME_STATS).
+ */
+void sys_runtime_init(void);
+
+/**
+ * @brief Count context switch into a task.
+ *
+ * @param task_number Kernel task number of task switched in.
+ *
+ * @note Called by the kernel with interrupts masked (traceTASK_SWITCHED_IN).
+ */
+void sys_task_switched_in(uint32_t task_number);
+
+/**
+ * @brief Mark start of boot stage.
+ *
+ * The first call also captures and clears the reset cause flags. Callable before sys_init().
+ *
+ * @param stage Boot stage.
+ */
+void sys_boot_begin(sys_boot_stage_t stage);
+
+/**
+ * @brief Mark end of boot stage.
+ *
+ * @param stage Boot stage.
+ */
+void sys_boot_end(sys_boot_stage_t stage);
+
+/**
+ * @brief Log reset cause and boot stage times at info level.
+ */
+void sys_boot_report(void);
+
+#endif
@@ -0,0 +1,94 @@
+/**
+ * @file tccal.h
+ * @author Timothy Nguyen
+ * @brief Thermocouple calibration: reading corrected through reference points, one multiply-add per reading.
+ * @version 0.1
+ * @date 2021-09-06
+ *
+ *      A channel is calibrated by holding its probe next to a reference thermometer and
+ *      entering the reference temperature, which pairs it with the channel's reading. One
+ *      point corrects an offset, two an offset and gain, and further points make the
+ *      correction piecewise linear, a small lookup table for a probe that is off by varying
+ *      amounts over the range. Readings beyond the outer points extend the outer segments.
+ *
+ *      Tccal_Build() turns the points into a gain and offset per segment once, so applying
+ *      the correction finds the segment with at most TCCAL_MAX_POINTS - 2 compares and does
+ *      one multiply-add, cheap enough for every sample.
+ */
+
+#ifndef _TCCAL_H_
+#define _TCCAL_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/* Configuration parameters */
+#define TCCAL_MAX_POINTS 4U   // Reference points per channel.
+#define TCCAL_MIN_SPAN 5.0f   // Readings closer than this replace a point rather than add one (deg C).
+#define TCCAL_GAIN_MIN 0.8f   // Lowest segment gain accepted.
+#define TCCAL_GAIN_MAX 1.2f   // Highest segment gain accepted.
+#define TCCAL_OFFSET_MAX 20.0f // Largest correction accepted at any point (deg C).
+
+/* Reference points of a channel, stored */
+typedef struct
+{
+	uint32_t num_points;             // Number of points, 0 if uncalibrated.
+	float reading[TCCAL_MAX_POINTS]; // Channel readings, ascending (deg C).
+	float ref[TCCAL_MAX_POINTS];     // Reference temperatures (deg C).
+} Tccal_points_t;
+
+/* Correction of a channel, built from its points */
+typedef struct
+{
+	uint8_t num_segments;                  // Number of segments, at least 1.
+	float bound[TCCAL_MAX_POINTS - 2U];    // Reading at which segment i + 1 starts (deg C).
+	float gain[TCCAL_MAX_POINTS - 1U];     // Gain of every segment.
+	float offset[TCCAL_MAX_POINTS - 1U];   // Offset of every segment (deg C).
+} Tccal_t;
+
+/**
+ * @brief Add reference point, replacing one within TCCAL_MIN_SPAN of the reading.
+ *
+ * @param[in/out] pts Reference points, unchanged unless the result is accepted.
+ * @param reading Channel reading (deg C).
+ * @param ref Reference temperature (deg C).
+ *
+ * @return false if all points are taken, or the points would give a gain or correction
+ *         outside the accepted limits.
+ */
+bool Tccal_Add(Tccal_points_t * const pts, float reading, float ref);
+
+/**
+ * @brief Check reference points, eg. restored from flash.
+ *
+ * @return true if points are ascending, TCCAL_MIN_SPAN apart and within the accepted limits.
+ */
+bool Tccal_Check(Tccal_points_t const * const pts);
+
+/**
+ * @brief Build correction from reference points, no points giving the identity.
+ *
+ * @param[out] cal Correction.
+ * @param pts Checked reference points.
+ */
+void Tccal_Build(Tccal_t * const cal, Tccal_points_t const * const pts);
+
+/**
+ * @brief Correct reading (ISR-safe).
+ *
+ * @param cal Correction.
+ * @param reading Channel reading (deg C).
+ *
+ * @return Calibrated temperature (deg C).
+ */
+static inline float Tccal_Apply(Tccal_t const * const cal, float reading)
+{
+	uint8_t s = 0;
+	while (s + 1U < cal->num_segments && reading >= cal->bound[s])
+	{
+		s++;
+	}
+	return reading * cal->gain[s] + cal->offset[s];
+}
+
+#endif
@@ -0,0 +1,64 @@
+/**
+ * @file telemetry.h
+ * @author Timothy Nguyen
+ * @brief Telemetry pipeline: framed records batched in a stream buffer, sent in chunks by DMA.
+ * @version 0.1
+ * @date 2021-09-22
+ *
+ * Producers, eg. the control loop's PID records, scope samples and status snapshots, write
+ * encoded frames with telemetry_write() (through console_telemetry_write()). A frame is copied
+ * whole into a FreeRTOS stream buffer, or dropped whole if it does not fit, so the link never
+ * carries a partial frame.
+ *
+ * A single sender thread drains the stream buffer into one of two TELEMETRY_CHUNK_SZ buffers
+ * and queues it on the telemetry UART by reference (uart_write_ref()), so the transmit DMA
+ * reads the chunk directly. While one chunk is on the line, frames gather for the next one:
+ * under load chunks grow towards TELEMETRY_CHUNK_SZ and the line does not idle between them.
+ * An idle sender wakes on the first frame of a batch, then sleeps again until
+ * TELEMETRY_TRIGGER_LEVEL bytes are waiting or TELEMETRY_FLUSH_MS passed, which bounds the
+ * latency of a lone frame. Wake-ups and DMA transfers therefore scale with the volume of
+ * telemetry rather than with the number of frames, and nothing runs while it is quiet.
+ *
+ * "tlm" performance measurements count frames, drops, chunks and the highest stream buffer fill.
+ *
+ * Notes:
+ * - Used with UART_TELEMETRY_ENABLE. Without it, frames go to the console sessions subscribed
+ *   to telemetry.
+ * - telemetry_write() may be called by any number of threads and interrupts, writers are
+ *   serialized by masking interrupts up to configMAX_SYSCALL_INTERRUPT_PRIORITY.
+ */
+
+#ifndef _TELEMETRY_H_
+#define _TELEMETRY_H_
+
+#include <stddef.h>
+
+#include "common.h"
+
+/* Configuration parameters */
+#define TELEMETRY_BUF_SZ 2048U         // Stream buffer size (bytes).
+#define TELEMETRY_TRIGGER_LEVEL 256U   // Bytes waiting that wake an idle sender.
+#define TELEMETRY_CHUNK_SZ 512U        // Largest chunk per DMA transfer (bytes).
+#define TELEMETRY_FLUSH_MS 20U         // Longest wait of frames below trigger level (ms).
+#define TELEMETRY_THREAD_STACK_SZ 384U // Sender thread stack size (bytes).
+
+/**
+ * @brief Create stream buffer, start sender thread and register telemetry measurements.
+ *
+ * Call once the telemetry UART is started.
+ *
+ * @return MOD_OK if successful, otherwise a "MOD_ERR" value.
+ */
+mod_err_t telemetry_init(void);
+
+/**
+ * @brief Put encoded frames in stream buffer (non-blocking, thread or ISR).
+ *
+ * @param buf Encoded frames.
+ * @param len Number of bytes.
+ *
+ * @return MOD_OK if queued, MOD_ERR_BUF_OVERRUN if dropped, MOD_ERR_NOT_INIT before telemetry_init().
+ */
+mod_err_t telemetry_write(const void *buf, size_t len);
+
+#endif
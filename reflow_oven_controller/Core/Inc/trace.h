@@ -0,0 +1,138 @@
+/**
+ * @file trace.h
+ * @author Timothy Nguyen
+ * @brief Binary event trace recorder: task switches, ISRs, active object dispatch and marks.
+ * @version 0.1
+ * @date 2021-08-20
+ *
+ * Each event is an 8-byte record timestamped with the DWT cycle counter and stored in a RAM
+ * ring. "trace start" clears the ring and records continuously, keeping the newest
+ * TRACE_BUF_RECORDS records ("trace start once" stops when the ring is full instead), and
+ * "trace stop" freezes it. "trace dump" stops recording and sends the ring, oldest record
+ * first, as COBS frames on the console, one per command step (see cmd_async_start()):
+ *
+ *      uint8_t  type;        // TRACE_TELEMETRY_TYPE.
+ *      uint16_t first;       // Index of first record of frame within dump.
+ *      uint16_t total;       // Number of records in dump.
+ *      uint32_t clock_hz;    // Timestamp clock (SystemCoreClock).
+ *      trace_rec_t recs[];   // Up to TRACE_DUMP_CHUNK records.
+ *
+ * followed by text lines mapping task numbers to names. "trace dump pack" sends the same
+ * records in frames of about half the bytes, as varints (see pack.h):
+ *
+ *      uint8_t  type;        // TRACE_PACK_TYPE.
+ *      uint16_t first;       // Index of first record of frame within dump.
+ *      uint16_t count;       // Number of records in frame.
+ *      uint16_t total;       // Number of records in dump.
+ *      uint32_t clock_hz;    // Timestamp clock (SystemCoreClock).
+ *      uint8_t  data[];      // Per record: timestamp change from the previous record of the
+ *                            // frame (from 0 for the first), id << 3 | type, then arg.
+ *
+ * With "trace itm on", every record
+ * is also written to ITM stimulus port TRACE_ITM_PORT when a debugger enabled it, records
+ * are dropped rather than waiting for the SWO FIFO.
+ *
+ * Instrument code with the macros below, which compile out with TRACE_ENABLE set to 0:
+ *
+ * TRACE_MARK_BEGIN(TRACE_MARK_PID);
+ * out = PID_Calculate(&pid, setpoint, measurement);
+ * TRACE_MARK_END(TRACE_MARK_PID);
+ */
+
+#ifndef _TRACE_H_
+#define _TRACE_H_
+
+#include <stdint.h>
+
+#include "common.h"
+
+/* Configuration parameters */
+#ifndef TRACE_ENABLE
+#define TRACE_ENABLE 1 // Set to 0 to compile trace points out.
+#endif
+
+#define TRACE_BUF_RECORDS 512U      // Number of records in ring, must be a power of two.
+#define TRACE_DUMP_CHUNK 32U        // Records per dump frame.
+#define TRACE_ITM_PORT 1U           // ITM stimulus port for streaming, port 0 is left for text.
+#define TRACE_TELEMETRY_TYPE 0x02U  // First payload byte of a trace dump frame.
+#define TRACE_PACK_TYPE 0x0AU       // First payload byte of a packed trace dump frame.
+
+/* Record types */
+typedef enum
+{
+    TRACE_REC_TASK_IN,    // Task switched in, id is kernel task number.
+    TRACE_REC_ISR_ENTER,  // Interrupt handler entered, id is a trace_isr_t.
+    TRACE_REC_ISR_EXIT,   // Interrupt handler left.
+    TRACE_REC_AO_BEGIN,   // Active object handler started, id is active object id, arg is signal.
+    TRACE_REC_AO_END,     // Active object handler returned.
+    TRACE_REC_MARK_BEGIN, // Code section started, id is a trace_mark_t.
+    TRACE_REC_MARK_END,   // Code section ended.
+} trace_type_t;
+
+/* Interrupt sources */
+typedef enum
+{
+    TRACE_ISR_UART,    // Console UART.
+    TRACE_ISR_SPI_DMA, // Thermocouple SPI DMA transfer complete.
+    TRACE_ISR_USB,     // USB OTG FS.
+    TRACE_ISR_ZC,      // Mains zero crossing.
+    TRACE_ISR_CAN,     // CAN receive FIFO 0.
+} trace_isr_t;
+
+/* Code sections */
+typedef enum
+{
+    TRACE_MARK_PID, // PID calculation.
+} trace_mark_t;
+
+/* Trace record */
+typedef struct __attribute__((packed))
+{
+    uint32_t timestamp; // DWT cycle counter.
+    uint8_t type;       // trace_type_t.
+    uint8_t id;         // Task number, trace_isr_t, active object id or trace_mark_t.
+    uint16_t arg;       // Type specific argument, signal for active objects.
+} trace_rec_t;
+
+#if TRACE_ENABLE
+#define TRACE_ISR_ENTER(isr) trace_record(TRACE_REC_ISR_ENTER, (isr), 0)
+#define TRACE_ISR_EXIT(isr) trace_record(TRACE_REC_ISR_EXIT, (isr), 0)
+#define TRACE_AO_BEGIN(ao_id, sig) trace_record(TRACE_REC_AO_BEGIN, (ao_id), (uint16_t)(sig))
+#define TRACE_AO_END(ao_id, sig) trace_record(TRACE_REC_AO_END, (ao_id), (uint16_t)(sig))
+#define TRACE_MARK_BEGIN(mark) trace_record(TRACE_REC_MARK_BEGIN, (mark), 0)
+#define TRACE_MARK_END(mark) trace_record(TRACE_REC_MARK_END, (mark), 0)
+#else
+#define TRACE_ISR_ENTER(isr)
+#define TRACE_ISR_EXIT(isr)
+#define TRACE_AO_BEGIN(ao_id, sig)
+#define TRACE_AO_END(ao_id, sig)
+#define TRACE_MARK_BEGIN(mark)
+#define TRACE_MARK_END(mark)
+#endif
+
+/**
+ * @brief Register trace commands, recording is off until "trace start".
+ *
+ * @return MOD_OK if successful, otherwise a "MOD_ERR" value.
+ */
+mod_err_t trace_init(void);
+
+/**
+ * @brief Add record to trace ring (ISR-safe).
+ *
+ * @param type Record type, a trace_type_t.
+ * @param id Record source.
+ * @param arg Type specific argument.
+ */
+void trace_record(uint8_t type, uint8_t id, uint16_t arg);
+
+/**
+ * @brief Record task switch.
+ *
+ * @param task_number Kernel task number of task switched in.
+ *
+ * @note Called by the kernel with interrupts masked (traceTASK_SWITCHED_IN).
+ */
+void trace_task_switched_in(uint32_t task_number);
+
+#endif
@@ -5,52 +5,207 @@
  * @version 0.1
  * @date 2021-07-12
  *
+ * Each port, eg. the human console and the binary telemetry link, is a separate instance
+ * driving its own UART peripheral, with its own transmit buffer, DMA channels and
+ * performance measurements ("cmd pm uart", "cmd pm telem"), so telemetry bulk does not
+ * compete with interactive commands for buffer space or drain time.
+ *
  * Notes:
  * - A UART peripheral must be initialized prior to using this module.
  * - Do not enable UART interrupts within CubeMX.
+ * - If DMA transmit or receive channels are given, do not configure them within CubeMX either,
+ *   the module configures the channels and their interrupts itself.
+ * - In DMA receive mode, characters are drained from a circular DMA buffer to the console
+ *   on half-transfer, transfer complete and IDLE line events, so reception does not depend
+ *   on servicing one RXNE interrupt per character.
+ * - "uart bench <bytes> [char|block|all]" measures the transmit path: it writes bytes of
+ *   a pattern leaving no trace on a terminal with uart_putc() (char) or UART_BENCH_BLOCK
+ *   byte uart_write() blocks (block), whenever the transmit buffer has room, and waits for
+ *   the line to go idle. "telem bench" measures the telemetry port the same way. It reports
+ *   the sustained rate, CPU cycles per byte spent writing and in the UART and transmit DMA
+ *   ISRs, the ISR share of CPU time, and the overruns other writers, eg. logs, suffered
+ *   while the buffer was kept full. Whether the buffer drains through DMA or TXE interrupts
+ *   follows the configuration.
+ * - uart_write_ref() queues a block by reference instead of copying it, eg. a large dump
+ *   frame. The block goes out in order with bytes written before and after it: transmission
+ *   of the buffer stops where the block was queued, the DMA channel sends the block from its
+ *   own memory, then the buffer resumes. The block's done callback runs once it was sent.
+ * - "uart baud <rate>" switches the console to another baud rate once it finished transmitting,
+ *   eg. for a host tool about to export bulk data. The change must be confirmed at the new rate
+ *   with "uart baud confirm" within UART_BAUD_CONFIRM_MS, otherwise the previous rate comes back,
+ *   so a rate the link cannot carry does not lock the host out. "uart baud auto" arms the USART
+ *   auto baud rate detection instead: the host sends 'U' (0x55) at the rate it wants, then
+ *   confirms. "telem baud <rate>" switches the telemetry port, confirmed on the console. The
+ *   baud rate register is computed from the port's current bus clock, and the clock manager
+ *   keeps the rate across operating points, hence rates are limited to what CLOCK_LOW carries.
  */
 
 #ifndef _UART_H_
 #define _UART_H_
 
+#include <stdbool.h>
+#include <stddef.h>
+
 #include "common.h"
 #include "stm32l4xx_ll_usart.h"
+#include "stm32l4xx_ll_dma.h"
 
 /* Configuration parameters */
-#define UART_TX_BUF_SIZE 1024 // Maximum number of bytes in UART's transmit circular buffer.
+#define UART_TX_BUF_SIZE 1024    // Maximum number of bytes in UART's transmit circular buffer, must be a power of two.
+#define UART_RX_DMA_BUF_SIZE 256 // Number of bytes in UART's circular DMA receive buffer.
+#define UART_BENCH_MAX_BYTES 4096U // Most bytes written by "uart bench" per mode.
+#define UART_BENCH_BLOCK 32U       // Block size of "uart bench" block mode (bytes).
+#define UART_TX_REFS 4U            // Most blocks queued by reference per port, must be a power of two.
+#ifndef UART_TELEMETRY_ENABLE
+#define UART_TELEMETRY_ENABLE 1 // Set to 0 to send telemetry frames to the console instead of their own port.
+#endif
+#define UART_TELEMETRY_BAUD 921600U // Baud rate of telemetry port.
+#define UART_BAUD_MIN 2400U          // Lowest baud rate of "uart baud", the baud rate register holds 16 bits at 80 MHz.
+#define UART_BAUD_MAX 1000000U       // Highest baud rate of "uart baud", 16 MHz bus clock with 16x oversampling.
+#define UART_BAUD_CONFIRM_MS 5000U   // Time to confirm a baud rate change before it is reverted (ms).
+#define UART_BAUD_DRAIN_MS 200U      // Longest wait for transmission to finish before a baud rate change (ms).
+
+/* Ports */
+typedef enum
+{
+    UART_CONSOLE,   // Human console, commands and logs.
+    UART_TELEMETRY, // Binary telemetry frames, transmit only, USART1 on PB6.
+
+    UART_NUM_PORTS
+} uart_port_t;
+
+/* Called once a block queued by reference was sent or dropped, from interrupt context. */
+typedef void (*uart_ref_done_t)(void *ctx);
 
 /* Configuration structure */
 typedef struct
 {
     USART_TypeDef *uart_reg_base; // Address of UARTn peripheral's base register.
     IRQn_Type irq_num;            // Interrupt request number (IRQn) of UARTn peripheral.
+    uint32_t irq_prio;            // Priority of UARTn and DMA channel interrupts (IRQ_PRIO_x).
+
+    /* Receiver of characters, called from interrupt context. Leave rx_post as NULL to leave the receiver off. */
+    mod_err_t (*rx_post)(char c); // Pass received character, returns MOD_ERR_TIMEOUT if it was dropped.
+    void (*rx_idle)(void);        // Receive line went idle, may be NULL.
+
+    /* Optional DMA transmit path. Leave tx_dma as NULL to transmit using TXE interrupts. */
+    DMA_TypeDef *tx_dma;      // DMA controller connected to UARTn_TX (DMA1 or DMA2).
+    uint32_t tx_dma_channel;  // DMA channel connected to UARTn_TX (LL_DMA_CHANNEL_x).
+    uint32_t tx_dma_request;  // DMA channel request mapping of UARTn_TX (LL_DMA_REQUEST_x).
+    IRQn_Type tx_dma_irq_num; // Interrupt request number (IRQn) of DMA channel.
+
+    /* Optional circular DMA receive path. Leave rx_dma as NULL to receive using RXNE interrupts. */
+    DMA_TypeDef *rx_dma;      // DMA controller connected to UARTn_RX (DMA1 or DMA2).
+    uint32_t rx_dma_channel;  // DMA channel connected to UARTn_RX (LL_DMA_CHANNEL_x).
+    uint32_t rx_dma_request;  // DMA channel request mapping of UARTn_RX (LL_DMA_REQUEST_x).
+    IRQn_Type rx_dma_irq_num; // Interrupt request number (IRQn) of DMA channel.
 } uart_config_t;
 
 /**
- * @brief Initialize UART module with configuration structure.
+ * @brief Initialize UART port with configuration structure.
  * 
+ * @param port Port.
  * @param uart_cfg UART configuration structure containing hardware definitions.
  * 
  * @return MOD_OK if initialization was successful, else a "MOD_ERR" value.
  */
-mod_err_t uart_init(uart_config_t *uart_cfg);
+mod_err_t uart_init(uart_port_t port, uart_config_t *uart_cfg);
 
 /**
- * @brief Start reception and transmision of characters over UART by enabling interrupts.
+ * @brief Start reception and transmision of characters over UART port by enabling interrupts.
  * 
+ * @param port Port.
+ *
  * @return MOD_OK for success, else a "MOD_ERR" value.
  */
-mod_err_t uart_start(void);
+mod_err_t uart_start(uart_port_t port);
 
 /** 
- * @brief Put a character for transmission in transmit buffer (non-blocking).
+ * @brief Put a character for transmission in transmit buffer of port (non-blocking).
  *
+ * @param port Port.
  * @param c Character to transmit.
  * 
  * @return MOD_OK for success, else a "MOD_ERR" value.
  * 
  * @note Characters may be placed in transmit buffer before interrupts are enabled to start transmission.
  */
-mod_err_t uart_putc(char c);
+mod_err_t uart_putc(uart_port_t port, char c);
+
+/**
+ * @brief Put a block of characters for transmission in transmit buffer of port (non-blocking).
+ *
+ * Space is reserved in the transmit buffer once and the block is copied in at most
+ * two segments within a single critical section, so blocks written by different
+ * threads do not interleave.
+ *
+ * @param port Port.
+ * @param buf Characters to transmit.
+ * @param len Number of characters to transmit.
+ *
+ * @return MOD_OK for success, MOD_ERR_BUF_OVERRUN if block was dropped or truncated.
+ *
+ * @note A block that does not fit in the free space of the transmit buffer is dropped
+ *       entirely so partial lines are never committed. Only blocks larger than the
+ *       whole transmit buffer are truncated.
+ */
+mod_err_t uart_write(uart_port_t port, const char *buf, size_t len);
+
+/**
+ * @brief Queue a block for transmission by reference, without copying it (non-blocking).
+ *
+ * The block is sent after bytes already written, and before bytes written later, with the
+ * transmit DMA channel reading buf directly. Ports transmitting with TXE interrupts send it
+ * from buf a character at a time. buf must stay unchanged until done is called.
+ *
+ * @param port Port.
+ * @param buf Bytes to transmit, in memory the DMA controller reads.
+ * @param len Number of bytes, 1 to 65535.
+ * @param done Called with ctx once the block was sent, or dropped on a transfer error, may be NULL.
+ * @param ctx Argument of done.
+ *
+ * @return MOD_OK if queued, MOD_ERR_BUF_OVERRUN if UART_TX_REFS blocks are pending (done is not called).
+ */
+mod_err_t uart_write_ref(uart_port_t port, const void *buf, size_t len, uart_ref_done_t done, void *ctx);
+
+/**
+ * @brief Check whether transmission of port is complete.
+ *
+ * @param port Port.
+ *
+ * @return true if transmit buffer and block queue are empty and the last character left the shift register,
+ *         or port is not initialized.
+ */
+bool uart_tx_idle(uart_port_t port);
+
+/**
+ * @brief Set baud rate of port, computing the baud rate register from its current bus clock.
+ *
+ * Characters in transmission are cut short, wait for uart_tx_idle() first.
+ *
+ * @param port Port.
+ * @param baud Baud rate, UART_BAUD_MIN to UART_BAUD_MAX.
+ *
+ * @return MOD_OK for success, MOD_ERR_ARG if baud is out of range, MOD_ERR_NOT_INIT if port is not initialized.
+ */
+mod_err_t uart_baud_set(uart_port_t port, uint32_t baud);
+
+/**
+ * @brief Get baud rate of port.
+ *
+ * @param port Port.
+ *
+ * @return Baud rate from baud rate register and bus clock, 0 if port is not initialized.
+ */
+uint32_t uart_baud_get(uart_port_t port);
+
+/**
+ * @brief Get free space in transmit buffer of port.
+ *
+ * @param port Port.
+ *
+ * @return Number of characters uart_write() would currently accept as one block.
+ */
+size_t uart_tx_free(uart_port_t port);
 
 #endif
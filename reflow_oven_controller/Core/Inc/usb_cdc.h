@@ -0,0 +1,78 @@
+/**
+ * @file usb_cdc.h
+ * @author Timothy Nguyen
+ * @brief Interface for USB CDC ACM virtual COM port on the USB OTG FS peripheral.
+ * @version 0.1
+ * @date 2021-08-18
+ *
+ * Alternative console transport to uart.c with the same write and receive interfaces,
+ * selected with CONSOLE_USB_CDC (see console.h), carrying a console session of its own. The device enumerates as a full-speed
+ * CDC ACM function, received packets are posted to the console directly from the OTG FS
+ * ISR and transmitted characters are collected in a ring buffer, which is moved to the
+ * bulk IN endpoint one multi-packet transfer at a time.
+ *
+ * Notes:
+ * - Do not enable the USB peripheral within CubeMX, the module configures the OTG FS core,
+ *   PA11/PA12 and its interrupt itself using registers.
+ * - The 48 MHz USB clock is taken from the MSI at 48 MHz, trimmed by the LSE in PLL mode,
+ *   so a 32.768 kHz crystal must be fitted.
+ * - VBUS is not sensed, the B-session valid signal is overridden instead.
+ */
+
+#ifndef _USB_CDC_H_
+#define _USB_CDC_H_
+
+#include <stddef.h>
+
+#include "common.h"
+
+/* Configuration parameters */
+#define USB_CDC_TX_BUF_SIZE 2048 // Maximum number of bytes in transmit circular buffer, must be a power of two.
+#define USB_CDC_VID 0x0483U      // USB vendor ID.
+#define USB_CDC_PID 0x5740U      // USB product ID (virtual COM port).
+
+/**
+ * @brief Initialize USB clock, pins and OTG FS core in device mode, disconnected.
+ *
+ * @return MOD_OK if initialization was successful, else a "MOD_ERR" value.
+ */
+mod_err_t usb_cdc_init(void);
+
+/**
+ * @brief Connect to host by enabling pull-up and interrupts.
+ *
+ * @return MOD_OK for success, else a "MOD_ERR" value.
+ */
+mod_err_t usb_cdc_start(void);
+
+/**
+ * @brief Put a character for transmission in transmit buffer (non-blocking).
+ *
+ * @param c Character to transmit.
+ *
+ * @return MOD_OK for success, else a "MOD_ERR" value.
+ */
+mod_err_t usb_cdc_putc(char c);
+
+/**
+ * @brief Put a block of characters for transmission in transmit buffer (non-blocking).
+ *
+ * Same semantics as uart_write(): a block that does not fit in the free space of the
+ * transmit buffer is dropped entirely, only blocks larger than the whole buffer are truncated.
+ * Characters are kept until the host configures the device.
+ *
+ * @param buf Characters to transmit.
+ * @param len Number of characters to transmit.
+ *
+ * @return MOD_OK for success, MOD_ERR_BUF_OVERRUN if block was dropped or truncated.
+ */
+mod_err_t usb_cdc_write(const char *buf, size_t len);
+
+/**
+ * @brief Get free space in transmit buffer.
+ *
+ * @return Number of characters usb_cdc_write() would currently accept as one block.
+ */
+size_t usb_cdc_tx_free(void);
+
+#endif
@@ -0,0 +1,95 @@
+/**
+ * @file wdg.h
+ * @author Timothy Nguyen
+ * @brief Watchdog supervisor: IWDG fed only while every active object and heartbeat client is alive.
+ * @version 0.1
+ * @date 2021-08-25
+ *
+ * A supervisor thread checks liveness every WDG_CHECK_MS and reloads the independent
+ * watchdog (IWDG) only if all of these hold:
+ * - No active object is stalled (Active_stalled()): none has run one event handler, or
+ *   left an event waiting in its queue, for longer than WDG_AO_TIMEOUT_MS. Idle active
+ *   objects are alive without sending anything.
+ * - Every armed heartbeat client checked in within its own timeout. Periodic work that
+ *   must keep happening, such as the reflow control loop, registers a client with
+ *   wdg_register(), arms it with its first wdg_checkin() and disarms it with
+ *   wdg_suspend() when it stops on purpose.
+ *
+ * The first failed check is latched: the supervisor records its culprit's name in the
+ * RTC backup registers, which survive a system reset, and stops feeding. IWDG resets the
+ * controller WDG_TIMEOUT_MS later, switching the heater outputs off. wdg_init() reports
+ * and clears the record of the previous reset, "wdg status" shows it until the next one.
+ *
+ * Since a hung thread now ends in a reset, blocking calls take bounded timeouts rather
+ * than waiting forever.
+ *
+ * Notes:
+ * - IWDG cannot be stopped once started and keeps running in STOP2, so the supervisor
+ *   wakes the CPU every WDG_CHECK_MS. It is frozen while the core is halted by a debugger.
+ * - IWDG is clocked by the LSI (32 kHz nominal, 29.5 to 34 kHz), the timeout is approximate.
+ * - The supervisor thread runs above every active object but the safety supervisor, so a
+ *   busy handler does not delay feeding. A handler never yielding the CPU is caught as a stall.
+ */
+
+#ifndef _WDG_H_
+#define _WDG_H_
+
+#include <stdint.h>
+
+#include "common.h"
+
+/* Configuration parameters */
+#define WDG_TIMEOUT_MS 1000U      // IWDG timeout after last feed, at most 4095 (ms).
+#define WDG_CHECK_MS 250U         // Liveness check and feed period (ms).
+#define WDG_AO_TIMEOUT_MS 500U    // Longest event handler run or queue wait of an active object (ms).
+#define WDG_MAX_CLIENTS 4U        // Maximum number of heartbeat clients.
+#define WDG_THREAD_STACK_SZ 512U  // Supervisor thread stack size (bytes).
+#define WDG_NAME_LEN 12U          // Culprit name characters kept in backup registers.
+
+/**
+ * @brief Start supervisor thread and IWDG, report previous watchdog reset and register
+ *        watchdog commands.
+ *
+ * Call once active objects may be constructed (after Active_init()), as early as possible.
+ *
+ * @return MOD_OK if successful, otherwise a "MOD_ERR" value.
+ */
+mod_err_t wdg_init(void);
+
+/**
+ * @brief Register heartbeat client, initially suspended.
+ *
+ * @param[in] name Client name, reported as culprit.
+ * @param[in] timeout Longest time between check-ins (ms), more than WDG_CHECK_MS.
+ * @param[out] id Client id for wdg_checkin() and wdg_suspend().
+ *
+ * @return MOD_OK if successful, MOD_ERR_ARG if timeout is too short,
+ *         MOD_ERR_RESOURCE if WDG_MAX_CLIENTS clients are registered.
+ */
+mod_err_t wdg_register(const char *name, uint32_t timeout, uint8_t *const id);
+
+/**
+ * @brief Change heartbeat client timeout, eg. when its period changes, best while suspended.
+ *
+ * @param id Client id.
+ * @param timeout Longest time between check-ins (ms), more than WDG_CHECK_MS.
+ *
+ * @return MOD_OK if successful, MOD_ERR_ARG if timeout is too short.
+ */
+mod_err_t wdg_set_timeout(uint8_t id, uint32_t timeout);
+
+/**
+ * @brief Check in heartbeat client, arming it if suspended (thread or ISR).
+ *
+ * @param id Client id.
+ */
+void wdg_checkin(uint8_t id);
+
+/**
+ * @brief Stop checking heartbeat client until its next check-in (thread or ISR).
+ *
+ * @param id Client id.
+ */
+void wdg_suspend(uint8_t id);
+
+#endif
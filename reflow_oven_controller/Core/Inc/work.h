@@ -0,0 +1,72 @@
+/**
+ * @file work.h
+ * @author Timothy Nguyen
+ * @brief Deferred work queue: interrupt bottom halves run by a high-priority worker thread.
+ * @version 0.1
+ * @date 2021-09-06
+ *
+ * An interrupt handler hands everything but its time-critical part to work_submit(), which
+ * copies a function and its argument into a lock-free ring and returns. The worker thread
+ * runs queued items in submission order, so kernel calls such as posting events or waking
+ * threads leave the handlers, and interrupts at and below their priority are masked for
+ * less time.
+ *
+ * Submitting never calls the kernel from interrupt context: it pends WORK_WAKE_IRQn, an
+ * otherwise unused interrupt at IRQ_PRIO_WORK, whose handler wakes the worker once the
+ * interrupts it tail-chains behind have returned. Handlers above
+ * configLIBRARY_MAX_SYSCALL_INTERRUPT_PRIORITY, which must not call the kernel at all, may
+ * therefore submit work as well.
+ *
+ * The ring is multi-producer, single-consumer: producers reserve a slot with an exclusive
+ * load/store on the put index, fill it and publish it with its sequence number. The worker
+ * takes slots in order once published, a slot reserved by a preempted producer holds the
+ * items behind it back until that producer resumes.
+ *
+ * "cmd pm work" reports how long items waited from submission until they started (latency)
+ * and how long they ran, in CPU cycles, and how many were dropped because the ring was full.
+ *
+ * Notes:
+ * - Items run in thread context at WORK_THREAD_PRIO, above every active object, and must
+ *   not block: a blocked item holds up every item behind it.
+ * - An item may submit work, eg. to retry later.
+ */
+
+#ifndef _WORK_H_
+#define _WORK_H_
+
+#include <stdint.h>
+
+#include "common.h"
+#include "prio.h"
+
+/* Configuration parameters */
+#define WORK_RING_SIZE 32U          // Items the ring holds, power of two.
+#define WORK_THREAD_STACK_SZ 1024U  // Worker thread stack size (bytes).
+#define WORK_THREAD_PRIO PRIO_ACQUISITION // Worker thread priority, see prio.h.
+#define WORK_WAKE_IRQn SWPMI1_IRQn  // Software-pended interrupt waking the worker, peripheral unused.
+
+/* Work item function */
+typedef void (*work_fn_t)(void *arg);
+
+/**
+ * @brief Start worker thread and register work queue measurements.
+ *
+ * Items submitted earlier run once the thread starts.
+ *
+ * @return MOD_OK if successful, otherwise a "MOD_ERR" value.
+ */
+mod_err_t work_init(void);
+
+/**
+ * @brief Queue function to run in the worker thread.
+ *
+ * @param fn Function.
+ * @param arg Argument passed to fn.
+ *
+ * @return MOD_OK if queued, MOD_ERR_BUF_OVERRUN if the ring is full and the item is dropped.
+ *
+ * @note Callable from any interrupt priority and from threads.
+ */
+mod_err_t work_submit(work_fn_t fn, void *arg);
+
+#endif
@@ -20,146 +20,250 @@
 
 #include "MAX31855K.h"
 #include "string.h"
+#include <stdbool.h>
 #include "log.h"
+#include "prof.h"
+#include "sections.h"
+#include "spi_ll.h"
 
-// Temperature resolutions:
-#define HJ_RES 0.25   // Hot junction temperature resolution in degrees Celsius.
-#define CJ_RES 0.0625 // Cold junction temperature resolution in degrees Celsius.
+// Type K linearization:
+#define K_SENSITIVITY 0.041276f // Thermocouple sensitivity assumed by the MAX31855K in mV per degree Celsius.
+#define CJ_LUT_MIN -60.0f       // Temperature of first cold junction table entry in degrees Celsius.
+#define CJ_LUT_STEP 10.0f       // Cold junction table temperature step in degrees Celsius.
+#define NIST_EMF_MIN -5.891f    // Lowest EMF of inverse polynomials in mV (-200 degrees Celsius).
+#define NIST_EMF_MID 20.644f    // EMF where inverse polynomials change over in mV (500 degrees Celsius).
+#define NIST_EMF_MAX 54.886f    // Highest EMF of inverse polynomials in mV (1372 degrees Celsius).
 
-#define MAX_ERR_NAMES_CSV "MAX_OK", "MAX_SHORT_VCC", "MAX_SHORT_GND", "MAX_OPEN", "MAX_ZEROS", "MAX_SPI_DMA_FAIL"
-
-// MAX31885K thermocouple device structure definition.
-typedef struct
-{
-    /* SPI Configuration Parameters */
-    SPI_HandleTypeDef *spi_handle; // SPI handler
-    GPIO_TypeDef *cs_port;         // Chip-select GPIO port.
-    uint16_t cs_pin;               // Chip-select pin number.
-
-    /* Data */
-    uint8_t tx_buf[4];   // SPI Transmit buffer.
-    uint8_t rx_buf[4];   // SPI Receive buffer.
-    uint32_t data32;     // Conversion of raw temperature reading to uint32.
-
-    /* Error value */
-    MAX31855K_err_t err; // Thermocouple error value of most recent reading.
-
-} MAX31855K_t;
+#define MAX_ERR_NAMES_CSV "MAX_OK", "MAX_SHORT_VCC", "MAX_SHORT_GND", "MAX_OPEN", "MAX_ZEROS", "MAX_SPI_DMA_FAIL", "MAX_SPI_FAIL"
 
 /* Static function prototypes */
-static void MAX31855K_error_check(); // Check data for device faults or SPI read error.
-
-/* MAX31855K_t instance. */
-static MAX31855K_t max;
+static void MAX31855K_error_check(MAX31855K_t * const max); // Check data for device faults or SPI read error.
+static void MAX31855K_Scan_Cplt(spibus_xfer_t *xfer, bool ok); // Device read of scan complete.
+static float MAX31855K_cj_emf(float cj);                    // Type K EMF of cold junction temperature.
+static float MAX31855K_poly(const float *c, uint8_t n, float x); // Evaluate polynomial of n coefficients.
 
 static const char* max_err_names[MAX_NUM_ERRORS] = {MAX_ERR_NAMES_CSV};
 
-void MAX31855K_Init(MAX31855K_cfg_t const * const max_cfg)
+/* NIST ITS-90 type K EMF (mV) at CJ_LUT_MIN + i * CJ_LUT_STEP, covers the MAX31855K die temperature range. */
+static const float cj_lut_mv[] = {
+    -2.242821f, -1.889383f, -1.526948f, -1.156131f, -0.777540f, -0.391854f, 0.000000f, 0.396862f, 0.798120f, 1.203275f,
+    1.611792f, 2.023078f, 2.436472f, 2.851249f, 3.266642f, 3.681879f, 4.096230f, 4.509060f, 4.919882f, 5.328395f,
+};
+
+/* NIST ITS-90 type K inverse polynomial coefficients, temperature (deg C) from EMF (mV), lowest order first. */
+static const float nist_inv_low[] = { // -200 to 0 deg C.
+    0.0f, 2.5173462E+01f, -1.1662878E+00f, -1.0833638E+00f, -8.9773540E-01f,
+    -3.7342377E-01f, -8.6632643E-02f, -1.0450598E-02f, -5.1920577E-04f,
+};
+static const float nist_inv_mid[] = { // 0 to 500 deg C.
+    0.0f, 2.508355E+01f, 7.860106E-02f, -2.503131E-01f, 8.315270E-02f,
+    -1.228034E-02f, 9.804036E-04f, -4.413030E-05f, 1.057734E-06f, -1.052755E-08f,
+};
+static const float nist_inv_high[] = { // 500 to 1372 deg C.
+    -1.318058E+02f, 4.830222E+01f, -1.646031E+00f, 5.464731E-02f,
+    -9.650715E-04f, 8.802193E-06f, -3.110810E-08f,
+};
+
+void MAX31855K_Init(MAX31855K_t * const max, MAX31855K_cfg_t const * const max_cfg)
 {
-    max.spi_handle = max_cfg->hspi;
-    max.cs_port = max_cfg->max_cs_port;
-    max.cs_pin = max_cfg->max_cs_pin;
-    memset(max.tx_buf, 0, sizeof(max.tx_buf));
-    memset(max.rx_buf, 0, sizeof(max.rx_buf));
-    max.data32 = 0;
-    max.err = MAX_OK;
+    max->spi_handle = max_cfg->hspi;
+    max->cs_port = max_cfg->max_cs_port;
+    max->cs_pin = max_cfg->max_cs_pin;
+    memset(max->tx_buf, 0, sizeof(max->tx_buf));
+    memset(max->rx_buf, 0, sizeof(max->rx_buf));
+    max->data32 = 0;
+    max->err = MAX_OK;
+    max->scan = NULL;
+    max->xfer = (spibus_xfer_t){.cs_port = max->cs_port,
+                                .cs_pin = max->cs_pin,
+                                .max_hz = MAX31855K_SPI_MAX_HZ,
+                                .mode = SPIBUS_MODE_0,
+                                .tx = max->tx_buf,
+                                .rx = max->rx_buf,
+                                .len = sizeof(max->rx_buf),
+                                .cb = MAX31855K_Scan_Cplt,
+                                .arg = max};
 }
 
-MAX31855K_err_t MAX31855K_RxBlocking()
+MAX31855K_err_t MAX31855K_RxBlocking(MAX31855K_t * const max)
 {
     /* Acquire data from MAX31855K */
-    HAL_GPIO_WritePin(max.cs_port, max.cs_pin, GPIO_PIN_RESET); // Assert CS line to start transaction.
-    HAL_SPI_Receive(max.spi_handle,                              // Sample 4 bytes off MISO line.
-                    max.rx_buf,
-                    sizeof(max.rx_buf),
-                    HAL_MAX_DELAY);
-    HAL_GPIO_WritePin(max.cs_port, max.cs_pin, GPIO_PIN_SET); // Deassert CS line to end transaction.
-    max.data32 = max.rx_buf[0] << 24 | (max.rx_buf[1] << 16) | (max.rx_buf[2] << 8) | max.rx_buf[3];
+    if (!spibus_acquire(max->spi_handle))
+    {
+        max->err = MAX_SPI_FAIL;
+        return max->err;
+    }
+    PROF_BEGIN(max_rx_blocking);
+    HAL_StatusTypeDef status = spi_ll_receive(max->spi_handle, max->cs_port, max->cs_pin, // Sample 4 bytes off MISO line.
+                                              max->rx_buf, sizeof(max->rx_buf), MAX31855K_SPI_TIMEOUT_MS);
+    PROF_END(max_rx_blocking);
+    spibus_release(max->spi_handle);
+    if (status != HAL_OK)
+    {
+        /* SPI is busy with a transfer outside the bus manager or timed out. */
+        max->err = MAX_SPI_FAIL;
+        return max->err;
+    }
+    max->data32 = max->rx_buf[0] << 24 | (max->rx_buf[1] << 16) | (max->rx_buf[2] << 8) | max->rx_buf[3];
 
     /* Check for faults. */
-    MAX31855K_error_check();
+    MAX31855K_error_check(max);
+
+    return max->err;
+}
 
-    return max.err;
+void MAX31855K_Scan_Init(MAX31855K_scan_t *scan, MAX31855K_t *devs, uint8_t num_devs, MAX31855K_scan_cb_t scan_cplt_cb,
+                         void *ctx)
+{
+    ASSERT(num_devs > 0);
+    for (uint8_t i = 0; i < num_devs; i++)
+    {
+        ASSERT(devs[i].spi_handle == devs[0].spi_handle); // Devices must share one bus.
+        ASSERT(devs[i].scan == NULL);                     // Read by one scan only.
+        devs[i].scan = scan;
+    }
+    scan->devs = devs;
+    scan->num_devs = num_devs;
+    scan->remaining = 0;
+    scan->busy = false;
+    scan->scan_cplt_cb = scan_cplt_cb;
+    scan->ctx = ctx;
 }
 
-void MAX31855K_RxDMA()
+MAX31855K_err_t MAX31855K_Scan_Start(MAX31855K_scan_t *scan)
 {
-    /* Pull CS line low */
-    HAL_GPIO_WritePin(max.cs_port, max.cs_pin, GPIO_PIN_RESET);
+    uint32_t primask = __get_PRIMASK();
+    __disable_irq();
+    if (scan->busy)
+    {
+        __set_PRIMASK(primask);
+        return MAX_SPI_DMA_FAIL;
+    }
+    scan->busy = true;
+    scan->remaining = scan->num_devs;
 
-    /* Execute DMA transfer */
-    HAL_StatusTypeDef err = HAL_SPI_TransmitReceive_DMA(max.spi_handle, max.tx_buf, max.rx_buf, sizeof(max.rx_buf));
-    if (err != HAL_OK)
+    /* Queue every read at once, the bus chains them from its transfer complete interrupt. */
+    for (uint8_t i = 0; i < scan->num_devs; i++)
     {
-        HAL_GPIO_WritePin(max.cs_port, max.cs_pin, GPIO_PIN_SET);
-        max.err = MAX_SPI_DMA_FAIL;
+        MAX31855K_t *max = &scan->devs[i];
+        if (spibus_submit(max->spi_handle, &max->xfer) != HAL_OK)
+        {
+            MAX31855K_Scan_Cplt(&max->xfer, false);
+        }
     }
+    __set_PRIMASK(primask);
+
+    return MAX_OK;
+}
+
+float MAX31855K_Get_HJ(MAX31855K_t const * const max)
+{
+    return (float)MAX31855K_Get_HJ_q2(max) * MAX31855K_HJ_RES;
+}
+
+int16_t MAX31855K_Get_HJ_q2(MAX31855K_t const * const max)
+{
+    /* Extract HJ temperature, sign-extend 14-bit field with arithmetic shift. */
+    return (int16_t)(max->data32 >> 16) >> 2;
+}
+
+float MAX31855K_Get_CJ(MAX31855K_t const * const max)
+{
+    return (float)MAX31855K_Get_CJ_q4(max) * MAX31855K_CJ_RES;
+}
+
+int16_t MAX31855K_Get_CJ_q4(MAX31855K_t const * const max)
+{
+    /* Extract CJ temperature, sign-extend 12-bit field with arithmetic shift. */
+    return (int16_t)max->data32 >> 4;
 }
 
-void MAX31885K_RxDMA_Complete()
+float MAX31855K_Get_HJ_NIST(MAX31855K_t const * const max)
 {
-    HAL_GPIO_WritePin(max.cs_port, max.cs_pin, GPIO_PIN_SET);
-    max.data32 = max.rx_buf[0] << 24 | (max.rx_buf[1] << 16) | (max.rx_buf[2] << 8) | max.rx_buf[3];
-    MAX31855K_error_check();
+    return MAX31855K_NIST(MAX31855K_Get_HJ(max), MAX31855K_Get_CJ(max));
 }
 
-float MAX31855K_Get_HJ()
+float MAX31855K_NIST(float hj, float cj)
 {
-    /* Extract HJ temperature. */
-    uint32_t data = max.data32;    // Capture latest data reading.
-    int16_t val = 0;                // Value prior to temperature conversion.
-    if (data & ((uint32_t)1 << 31)) // Perform sign-extension.
+    /* Undo the chip's linear conversion, then add the cold junction EMF back to get the total EMF. */
+    float emf = (hj - cj) * K_SENSITIVITY + MAX31855K_cj_emf(cj);
+
+    if (emf < NIST_EMF_MIN || emf > NIST_EMF_MAX)
     {
-        val = 0xC000 | ((data >> 18) & 0x3FFF);
+        return hj; // Outside NIST type K range, nothing better to offer.
     }
-    else
+    else if (emf < 0.0f)
     {
-        val = data >> 18;
+        return MAX31855K_poly(nist_inv_low, sizeof(nist_inv_low) / sizeof(nist_inv_low[0]), emf);
     }
-    return val * HJ_RES;
+    else if (emf < NIST_EMF_MID)
+    {
+        return MAX31855K_poly(nist_inv_mid, sizeof(nist_inv_mid) / sizeof(nist_inv_mid[0]), emf);
+    }
+    return MAX31855K_poly(nist_inv_high, sizeof(nist_inv_high) / sizeof(nist_inv_high[0]), emf);
 }
 
-float MAX31855K_Get_CJ()
+const char * MAX31855K_Err_Str(MAX31855K_err_t err)
 {
-    /* Extract CJ temperature. */
-    uint32_t data = max.data32;    // Capture latest data reading.
-    int16_t val = 0;                // Value prior to temperature conversion.
-    if (data & ((uint32_t)1 << 15)) // Perform sign-extension.
+	ASSERT(err < MAX_NUM_ERRORS);
+	return max_err_names[err];
+}
+
+bool MAX31855K_Err_Transient(MAX31855K_err_t err)
+{
+	return err == MAX_ZEROS || err == MAX_SPI_DMA_FAIL || err == MAX_SPI_FAIL;
+}
+
+/**
+ * @brief Check data of scanned device, finish scan once every device is read (ISR context).
+ *
+ * @param xfer Completed transfer of device.
+ * @param ok true if the transfer completed.
+ */
+static void RAMFUNC MAX31855K_Scan_Cplt(spibus_xfer_t *xfer, bool ok)
+{
+    MAX31855K_t *max = xfer->arg;
+    MAX31855K_scan_t *const scan = max->scan;
+    if (ok)
     {
-        val = 0xF000 | ((data >> 4) & 0xFFF);
+        max->data32 = max->rx_buf[0] << 24 | (max->rx_buf[1] << 16) | (max->rx_buf[2] << 8) | max->rx_buf[3];
+        MAX31855K_error_check(max);
     }
     else
     {
-        val = (data >> 4) & 0xFFF;
+        max->err = MAX_SPI_DMA_FAIL;
     }
-    return val * CJ_RES;
-}
 
-const char * MAX31855K_Err_Str()
-{
-	ASSERT(max.err < MAX_NUM_ERRORS);
-	return max_err_names[max.err];
+    /* All devices read, hand snapshot to callback before another scan may start. */
+    if (--scan->remaining == 0U)
+    {
+        if (scan->scan_cplt_cb != NULL)
+        {
+            scan->scan_cplt_cb(scan->ctx, scan->devs, scan->num_devs);
+        }
+        scan->busy = false;
+    }
 }
 
-static void MAX31855K_error_check()
+static void RAMFUNC MAX31855K_error_check(MAX31855K_t * const max)
 {
-    if (max.data32 == 0)
+    if (max->data32 == 0)
     {
-        max.err = MAX_ZEROS;
+        max->err = MAX_ZEROS;
     }
-    else if (max.data32 & ((uint32_t)1 << 16))
+    else if (max->data32 & ((uint32_t)1 << 16))
     {
-        uint8_t fault = max.data32 & 0x7;
+        uint8_t fault = max->data32 & 0x7;
         switch (fault)
         {
         case 0x4:
-            max.err = MAX_SHORT_VCC;
+            max->err = MAX_SHORT_VCC;
             break;
         case 0x2:
-            max.err = MAX_SHORT_GND;
+            max->err = MAX_SHORT_GND;
             break;
         case 0x1:
-            max.err = MAX_OPEN;
+            max->err = MAX_OPEN;
             break;
         default:
         	ASSERT(0); // Should never reach this point.
@@ -168,7 +272,45 @@ static void MAX31855K_error_check()
     }
     else
     {
-        max.err = MAX_OK;
+        max->err = MAX_OK;
+    }
+}
+
+/**
+ * @brief Interpolate type K EMF (mV) of cold junction temperature from table.
+ *
+ * Linear interpolation between 10 degree entries is within 0.03 degrees Celsius of
+ * the NIST polynomial, temperatures beyond the table are extrapolated from its ends.
+ */
+static float MAX31855K_cj_emf(float cj)
+{
+    const int32_t last = (int32_t)(sizeof(cj_lut_mv) / sizeof(cj_lut_mv[0])) - 2;
+    float pos = (cj - CJ_LUT_MIN) / CJ_LUT_STEP;
+    int32_t i = (int32_t)pos;
+    if (pos < 0.0f)
+    {
+        i = 0;
     }
+    else if (i > last)
+    {
+        i = last;
+    }
+    return cj_lut_mv[i] + (pos - (float)i) * (cj_lut_mv[i + 1] - cj_lut_mv[i]);
 }
 
+/**
+ * @brief Evaluate polynomial with Horner's method.
+ *
+ * @param c Coefficients, lowest order first.
+ * @param n Number of coefficients.
+ * @param x Polynomial variable.
+ */
+static float MAX31855K_poly(const float *c, uint8_t n, float x)
+{
+    float y = c[n - 1];
+    for (int32_t i = n - 2; i >= 0; i--)
+    {
+        y = y * x + c[i];
+    }
+    return y;
+}
@@ -8,41 +8,199 @@
  * Event and active object sizing.
  */
 
+#include <string.h>
+
 #include "active.h"
+#include "cmd.h"
 #include "log.h"
+#include "trace.h"
+#include "evlog.h"
+#include "prio.h"
+#include "sections.h"
 #include "cmsis_os.h"
+#include "queue.h"
+#include "task.h"
+#include "timers.h"
+#include "stm32l4xx.h"
 
 ////////////////////////////////////////////////////////////////////////////////
 // Private (static) function declarations
 ////////////////////////////////////////////////////////////////////////////////
 
 static void Active_event_loop(void *argument); // Common event loop thread function.
+static void Active_dispatch(Active *const ao, Active_msg const *const msg); // Run event handler and record statistics.
+#if ACTIVE_SOURCES
+static void Active_dispatch_source(Active *const ao, QueueSetMemberHandle_t member); // Run source handler.
+#endif
+#if ACTIVE_COOPERATIVE
+static void Active_coop_loop(void *argument);  // Cooperative kernel thread function.
+static void Active_coop_rank(Active *const ao); // Insert active object into priority ranking.
+#endif
+static inline void Active_ready(Active *const ao, BaseType_t *const woken); // Flag active object as ready.
+static mod_err_t Active_start_thread(Active *const ao, osPriority_t prio, const osThreadAttr_t *const thread_attr); // Start event loop.
+static inline uint32_t Active_ring_put(Active *const ao, Active_msg const *const msg, bool urgent); // Add message to ring.
+static inline bool Active_get(Active *const ao, Active_msg *const msg); // Dequeue message without waiting.
+static inline uint32_t Active_count(Active const *const ao);          // Number of messages queued.
+
+static void Event_pools_init(void);      // Thread free lists through event pool blocks.
+static void Event_gc(Event const *evt);  // Drop reference to event, recycling it if unreferenced.
+static inline void Event_ref(Event const *evt); // Take reference to pool event.
+static inline void Active_record_post(Active *const ao, uint32_t depth); // Update post statistics.
+static inline bool Active_claim(Active *const ao, Signal sig);          // Mark coalescing signal pending.
+static inline void Active_release(Active *const ao, Signal sig);        // Clear pending coalescing signal.
+
+static mod_err_t Active_put(Active *const ao, Event const *const evt, bool urgent);                  // Queue event from thread.
+static mod_err_t Active_putFromISR(Active *const ao, Event const *const evt, bool urgent, BaseType_t *const woken); // Queue event from ISR.
+static uint32_t Active_multicast(Event const *const evt, uint32_t mask); // Post event to set of active objects.
+
+/* Command callback functions */
+static uint32_t cmd_ao_status(uint32_t argc, const char **argv); // Display active object statistics.
+static uint32_t cmd_ao_clear(uint32_t argc, const char **argv);  // Reset active object statistics.
+static uint32_t cmd_ao_timescale(uint32_t argc, const char **argv); // Show or set virtual time scale.
 
-static void TimeEvent_tick(void *argument); // Simulate a timer tick.
+static void TimeEvent_expire(void *argument); // Post expired time events and program next deadline.
+static void TimeEvent_service(void *param1, uint32_t param2); // Apply requests, pended timer daemon call.
+static bool TimeEvent_request(TimeEvent *const time_evt, uint32_t timeout, uint32_t reload); // Publish request.
+static void TimeEvent_kick(void);  // Pend timer daemon call unless pending.
+static void TimeEvent_apply(void); // Apply published requests to armed list.
+
+static void TimeEvent_insert(TimeEvent *const time_evt, uint32_t timeout); // Insert time event into armed list.
+static void TimeEvent_remove(TimeEvent *const time_evt);                   // Remove time event from armed list.
+static void TimeEvent_elapse(void);                                        // Consume time elapsed since timer was programmed.
+static void TimeEvent_schedule(void);                                      // Program timer to nearest deadline.
+static inline uint32_t ms_to_ticks(uint32_t ms);                           // Convert milliseconds to kernel ticks.
 
 ////////////////////////////////////////////////////////////////////////////////
 // Private (static) variables
 ////////////////////////////////////////////////////////////////////////////////
 
 /* Unique tag for logging information */
-static const char *TAG = "ACTIVE";
+LOG_TAG_DEFINE("ACTIVE");
+
+/* Fixed-block event pool */
+typedef struct
+{
+    uint64_t *storage;   // Block storage, 8-byte aligned.
+    uint32_t block_sz;   // Block size (bytes).
+    uint32_t num_blocks; // Number of blocks.
+    void *free_head;     // First free block, each free block holds pointer to next.
+} Event_pool;
+
+/* Event pool block storage */
+static uint64_t SRAM2_BSS small_pool_storage[EVENT_POOL_SMALL_NUM_BLOCKS * EVENT_POOL_SMALL_BLOCK_SZ / sizeof(uint64_t)];
+static uint64_t SRAM2_BSS large_pool_storage[EVENT_POOL_LARGE_NUM_BLOCKS * EVENT_POOL_LARGE_BLOCK_SZ / sizeof(uint64_t)];
+static uint64_t SRAM2_BSS line_pool_storage[EVENT_POOL_LINE_NUM_BLOCKS * EVENT_POOL_LINE_BLOCK_SZ / sizeof(uint64_t)];
+
+/* Event pools in increasing block size */
+static Event_pool event_pools[] = {
+    {.storage = small_pool_storage, .block_sz = EVENT_POOL_SMALL_BLOCK_SZ, .num_blocks = EVENT_POOL_SMALL_NUM_BLOCKS},
+    {.storage = large_pool_storage, .block_sz = EVENT_POOL_LARGE_BLOCK_SZ, .num_blocks = EVENT_POOL_LARGE_NUM_BLOCKS},
+    {.storage = line_pool_storage, .block_sz = EVENT_POOL_LINE_BLOCK_SZ, .num_blocks = EVENT_POOL_LINE_NUM_BLOCKS}};
+
+/* Active object command information */
+static cmd_cmd_info ao_cmds[] = {
+    {.cmd_name = "status",
+     .cb = cmd_ao_status,
+     .help = "Display active object queue, latency and handler statistics."},
+    {.cmd_name = "clear",
+     .cb = cmd_ao_clear,
+     .help = "Reset active object statistics."},
+    {.cmd_name = "timescale",
+     .cb = cmd_ao_timescale,
+     .help = "Show or set virtual time scale of time events, 1 is wall-clock time.\r\n"
+             "Usage: ao timescale [scale]"}};
+
+/* Time from post to dispatch of every active object (CPU cycles) */
+static cmd_pm_hist_t post_latency;
+
+/* Active object performance measurement info */
+static const cmd_pm_info ao_pm_info[] = {
+    {"post latency cycles", CMD_PM_HIST, &post_latency}};
+
+/* Active object client info */
+CMD_CLIENT_DEFINE(ao,
+                  .num_cmds = 3,
+                  .cmds = ao_cmds,
+                  .num_u16_pms = 0,
+                  .u16_pms = NULL,
+                  .u16_pm_names = NULL,
+                  .num_pms = 1,
+                  .pms = ao_pm_info);
+
+/* Registered active objects, indexed by Active id */
+static Active *active_objects[ACTIVE_MAX_AOS];
+
+/* Number of registered active objects */
+static uint8_t num_active_objects;
+
+/* Bitmask of subscribed active object ids per published signal */
+static volatile uint32_t subscribers[ACTIVE_MAX_PUB_SIGS];
 
-/* View current Time_Event instances */
-static TimeEvent *time_events[10];
+#if ACTIVE_COOPERATIVE
+/* Started active objects in increasing priority, indexed by rank */
+static Active *ranked_objects[ACTIVE_MAX_AOS];
 
-/* Number of time events */
-static uint8_t num_time_events;
+/* Number of started active objects */
+static uint8_t num_ranked_objects;
 
-/* Software timer instance */
-osTimerId_t ms_timer_inst;
+/* Bitmask of ranks with events queued */
+static volatile uint32_t ready_set;
 
-/* Condition so that 1 ms timer is started once */
-static bool first_arm = false;
+/* Bitmask of active object ids started but not yet initialized */
+static volatile uint32_t init_pending;
+
+/* Cooperative kernel thread */
+static osThreadId_t coop_thread;
+static StaticTask_t coop_thread_cb;
+static uint64_t SRAM2_BSS coop_stack[ACTIVE_COOP_STACK_SZ / sizeof(uint64_t)];
+#endif
+
+/* Armed time events sorted by expiry, timeouts are relative to predecessor. */
+static SLIST_HEAD(TimeEvent_head_t, TimeEvent) armed_head = SLIST_HEAD_INITIALIZER(armed_head);
+
+/* One-shot software timer, programmed to expire at the head of the armed list. */
+static osTimerId_t deadline_timer;
+static StaticTimer_t deadline_timer_cb;
+
+/* Kernel tick count when deadline timer was last programmed or armed list last updated. */
+static uint32_t last_update_tick;
+
+/* Arm or disarm request, applied to the armed list by the timer daemon */
+typedef struct
+{
+    TimeEvent *time_evt;   // Time event.
+    uint32_t timeout;      // Timeout (kernel ticks from tick), 0 disarms.
+    uint32_t reload;       // Reload (kernel ticks), 0 for one-shot.
+    uint32_t tick;         // Kernel tick count when requested.
+    volatile uint32_t seq; // Ring position + 1 once published.
+} TimeEvent_req;
+
+/* Multi-producer ring of requests, single consumer is the timer daemon. */
+static TimeEvent_req tevt_reqs[TIME_EVENT_REQ_RING_SIZE];
+static volatile uint32_t tevt_req_put; // Next slot reserved by requesters.
+static volatile uint32_t tevt_req_get; // Next slot applied by timer daemon.
+static volatile uint32_t tevt_kick;    // Timer daemon call pended and not started yet.
+
+/* Virtual milliseconds per wall-clock millisecond. */
+static volatile uint32_t time_scale = 1U;
+
+/* Kernel tick count and virtual time (ms) when time scale was last set. */
+static uint32_t scale_tick;
+static uint32_t scale_ms;
 
 ////////////////////////////////////////////////////////////////////////////////
 // Public (global) functions
 ////////////////////////////////////////////////////////////////////////////////
 
+mod_err_t Active_init(void)
+{
+    /* Enable DWT cycle counter for latency and handler timing */
+    CoreDebug->DEMCR |= CoreDebug_DEMCR_TRCENA_Msk;
+    DWT->CTRL |= DWT_CTRL_CYCCNTENA_Msk;
+
+    return MOD_OK;
+}
+
 mod_err_t Active_ctor(Active *const ao, EventHandler evt_handler)
 {
     if (evt_handler == NULL || ao == NULL)
@@ -50,78 +208,459 @@ mod_err_t Active_ctor(Active *const ao, EventHandler evt_handler)
         return MOD_ERR_ARG;
     }
 
+    /* Active objects are constructed before multitasking starts, as are the pools. */
+    static bool pools_initialized = false;
+    if (!pools_initialized)
+    {
+        Event_pools_init();
+        pools_initialized = true;
+    }
+
+    /* Register active object for subscriptions. */
+    if (num_active_objects >= ACTIVE_MAX_AOS)
+    {
+        return MOD_ERR_RESOURCE;
+    }
+    ao->id = num_active_objects;
+    active_objects[num_active_objects++] = ao;
+
+    ao->name = "ao";
+    memset(&ao->stats, 0, sizeof(ao->stats));
+    ao->coalesce_sigs = 0;
+    ao->pending_sigs = 0;
+    ao->num_max_age = 0;
+    ao->defer_head = 0;
+    ao->defer_count = 0;
+    ao->thread_id = NULL;
+    ao->queue_id = NULL;
+    ao->ring = NULL;
+    ao->ring_size = 0;
+    ao->ring_head = 0;
+    ao->ring_count = 0;
+#if ACTIVE_SOURCES
+    ao->set = NULL;
+    ao->sources = NULL;
+    ao->num_sources = 0;
+#endif
+    ao->progress_tick = 0;
+    ao->busy = false;
     ao->evt_handler = evt_handler;
     return MOD_OK;
 }
 
 mod_err_t Active_start(Active *const ao,
+                       osPriority_t prio,
                        const osThreadAttr_t *const thread_attr,
                        uint32_t msg_count,
                        const osMessageQueueAttr_t *const queue_attr)
 {
-    ao->thread_id = osThreadNew(Active_event_loop, (void *)ao, thread_attr);
-    ao->queue_id = osMessageQueueNew(msg_count, sizeof(Event *), queue_attr);
+    if (prio <= osPriorityIdle || prio >= osPriorityISR)
+    {
+        return MOD_ERR_ARG;
+    }
+    ao->queue_id = osMessageQueueNew(msg_count, sizeof(Active_msg), queue_attr);
+    ASSERT(ao->queue_id != NULL);
+
+    return Active_start_thread(ao, prio, thread_attr);
+}
+
+mod_err_t Active_start_ring(Active *const ao,
+                            osPriority_t prio,
+                            const osThreadAttr_t *const thread_attr,
+                            Active_msg *const ring_mem,
+                            uint32_t msg_count)
+{
+    if (ring_mem == NULL || msg_count == 0U || prio <= osPriorityIdle || prio >= osPriorityISR)
+    {
+        return MOD_ERR_ARG;
+    }
+    ao->ring = ring_mem;
+    ao->ring_size = msg_count;
+    ao->ring_head = 0;
+    ao->ring_count = 0;
 
-    ASSERT(ao->thread_id != NULL && ao->queue_id != NULL);
+    return Active_start_thread(ao, prio, thread_attr);
+}
 
-    return MOD_OK;
+#if ACTIVE_SOURCES
+mod_err_t Active_start_set(Active *const ao,
+                           osPriority_t prio,
+                           const osThreadAttr_t *const thread_attr,
+                           uint32_t msg_count,
+                           const osMessageQueueAttr_t *const queue_attr,
+                           Active_source const *const sources,
+                           uint8_t num_sources,
+                           const osMessageQueueAttr_t *const set_attr)
+{
+    if ((sources == NULL && num_sources > 0U) || prio <= osPriorityIdle || prio >= osPriorityISR)
+    {
+        return MOD_ERR_ARG;
+    }
+
+    /* Every item of every member may be pending at once. */
+    uint32_t set_len = msg_count;
+    for (uint8_t i = 0; i < num_sources; i++)
+    {
+        if (sources[i].handle == NULL || sources[i].handler == NULL || sources[i].length == 0U)
+        {
+            return MOD_ERR_ARG;
+        }
+        set_len += sources[i].length;
+    }
+
+    if (set_attr != NULL && set_attr->cb_mem != NULL && set_attr->mq_mem != NULL)
+    {
+        if (set_attr->cb_size < sizeof(StaticQueue_t) || set_attr->mq_size < set_len * sizeof(QueueSetMemberHandle_t))
+        {
+            return MOD_ERR_ARG;
+        }
+        ao->set = xQueueGenericCreateStatic(set_len, sizeof(QueueSetMemberHandle_t), (uint8_t *)set_attr->mq_mem,
+                                            (StaticQueue_t *)set_attr->cb_mem, queueQUEUE_TYPE_SET);
+    }
+    else
+    {
+        ao->set = xQueueCreateSet(set_len);
+    }
+    ASSERT(ao->set != NULL);
+
+    ao->queue_id = osMessageQueueNew(msg_count, sizeof(Active_msg), queue_attr);
+    ASSERT(ao->queue_id != NULL);
+
+    /* Members must be empty when added, nothing is posted before the thread starts. */
+    if (xQueueAddToSet((QueueSetMemberHandle_t)ao->queue_id, ao->set) != pdPASS)
+    {
+        return MOD_ERR;
+    }
+    for (uint8_t i = 0; i < num_sources; i++)
+    {
+        if (xQueueAddToSet(sources[i].handle, ao->set) != pdPASS)
+        {
+            return MOD_ERR_ARG;
+        }
+    }
+    ao->sources = sources;
+    ao->num_sources = num_sources;
+
+    return Active_start_thread(ao, prio, thread_attr);
 }
+#endif
 
 mod_err_t Active_post(Active *const ao, Event const *const evt)
 {
-    /* Put pointer to event object */
-    osStatus_t err = osMessageQueuePut(ao->queue_id, &evt, 0U, 0U);
-    if (err != osOK)
+    if (__get_IPSR() != 0U)
     {
-        return MOD_ERR_TIMEOUT;
+        BaseType_t woken = pdFALSE;
+        mod_err_t err = Active_putFromISR(ao, evt, false, &woken);
+        portYIELD_FROM_ISR(woken);
+        return err;
+    }
+    return Active_put(ao, evt, false);
+}
+
+mod_err_t Active_postUrgent(Active *const ao, Event const *const evt)
+{
+    if (__get_IPSR() != 0U)
+    {
+        BaseType_t woken = pdFALSE;
+        mod_err_t err = Active_putFromISR(ao, evt, true, &woken);
+        portYIELD_FROM_ISR(woken);
+        return err;
+    }
+    return Active_put(ao, evt, true);
+}
+
+mod_err_t Active_postFromISR(Active *const ao, Event const *const evt, BaseType_t *const woken)
+{
+    return Active_putFromISR(ao, evt, false, woken);
+}
+
+mod_err_t Active_postUrgentFromISR(Active *const ao, Event const *const evt, BaseType_t *const woken)
+{
+    return Active_putFromISR(ao, evt, true, woken);
+}
+
+void Active_coalesce(Active *const ao, Signal sig)
+{
+    ASSERT(sig >= USER_SIG && sig < 32);
+    ao->coalesce_sigs |= (1UL << sig);
+}
+
+void Active_max_age(Active *const ao, Signal sig, uint32_t max_age_us)
+{
+    ASSERT(sig >= USER_SIG);
+    for (uint8_t i = 0; i < ao->num_max_age; i++)
+    {
+        if (ao->max_age_sigs[i] == sig)
+        {
+            ao->max_age_us[i] = max_age_us;
+            return;
+        }
+    }
+    ASSERT(ao->num_max_age < ACTIVE_MAX_AGE_SIGS);
+    ao->max_age_sigs[ao->num_max_age] = sig;
+    ao->max_age_us[ao->num_max_age] = max_age_us;
+    ao->num_max_age++;
+}
+
+mod_err_t Active_defer(Active *const ao, Event const *const evt)
+{
+    if (ao->defer_count >= ACTIVE_DEFER_DEPTH)
+    {
+        return MOD_ERR_RESOURCE;
     }
 
+    /* Deferred reference keeps pool event alive past its dispatch. */
+    Event_ref(evt);
+    ao->deferred[(ao->defer_head + ao->defer_count) % ACTIVE_DEFER_DEPTH] = evt;
+    ao->defer_count++;
     return MOD_OK;
 }
 
+bool Active_recall(Active *const ao)
+{
+    if (ao->defer_count == 0U)
+    {
+        return false;
+    }
+
+    Event const *const evt = ao->deferred[ao->defer_head];
+    if (Active_put(ao, evt, true) != MOD_OK)
+    {
+        return false; // Stays deferred.
+    }
+
+    ao->defer_head = (ao->defer_head + 1U) % ACTIVE_DEFER_DEPTH;
+    ao->defer_count--;
+    Event_gc(evt); // Queue now holds its own reference.
+    return true;
+}
+
+void Active_flush_deferred(Active *const ao)
+{
+    while (ao->defer_count > 0U)
+    {
+        Event_gc(ao->deferred[ao->defer_head]);
+        ao->defer_head = (ao->defer_head + 1U) % ACTIVE_DEFER_DEPTH;
+        ao->defer_count--;
+    }
+}
+
+void Active_subscribe(Active const *const ao, Signal sig)
+{
+    ASSERT(sig >= 0 && sig < ACTIVE_MAX_PUB_SIGS);
+    uint32_t primask = __get_PRIMASK();
+    __disable_irq();
+    subscribers[sig] |= (1UL << ao->id);
+    __set_PRIMASK(primask);
+}
+
+void Active_unsubscribe(Active const *const ao, Signal sig)
+{
+    ASSERT(sig >= 0 && sig < ACTIVE_MAX_PUB_SIGS);
+    uint32_t primask = __get_PRIMASK();
+    __disable_irq();
+    subscribers[sig] &= ~(1UL << ao->id);
+    __set_PRIMASK(primask);
+}
+
+uint32_t Active_publish(Event const *const evt)
+{
+    ASSERT(evt->sig >= 0 && evt->sig < ACTIVE_MAX_PUB_SIGS);
+    return Active_multicast(evt, subscribers[evt->sig]);
+}
+
+uint32_t Active_publish_to(Active *const ao, Event const *const evt)
+{
+    ASSERT(evt->sig >= 0 && evt->sig < ACTIVE_MAX_PUB_SIGS);
+    return Active_multicast(evt, subscribers[evt->sig] | (1UL << ao->id));
+}
+
+Active *Active_by_id(uint32_t id)
+{
+    return id < num_active_objects ? active_objects[id] : NULL;
+}
+
+Active const *Active_stalled(uint32_t timeout)
+{
+    uint32_t now = osKernelGetTickCount();
+    Active const *waiting = NULL;
+    for (uint8_t i = 0; i < num_active_objects; i++)
+    {
+        Active const *const ao = active_objects[i];
+        if (ao->thread_id == NULL || now - ao->progress_tick <= timeout)
+        {
+            continue;
+        }
+        if (ao->busy)
+        {
+            return ao; // Stuck handler, any waiting ones are its victims in cooperative mode.
+        }
+        if (waiting == NULL && Active_count(ao) > 0U)
+        {
+            waiting = ao;
+        }
+    }
+    return waiting;
+}
+
+Event *Event_new(size_t size, Signal sig)
+{
+    for (uint8_t i = 0; i < ARRAY_SIZE(event_pools); i++)
+    {
+        Event_pool *const pool = &event_pools[i];
+        if (size > pool->block_sz)
+        {
+            continue;
+        }
+
+        /* Pop block off free list, events may be allocated from ISRs. */
+        uint32_t primask = __get_PRIMASK();
+        __disable_irq();
+        Event *evt = (Event *)pool->free_head;
+        if (evt != NULL)
+        {
+            pool->free_head = *(void **)evt;
+        }
+        __set_PRIMASK(primask);
+
+        if (evt != NULL)
+        {
+            evt->sig = sig;
+            evt->pool_id = i + 1U;
+            evt->ref_cnt = 0U;
+            return evt;
+        }
+    }
+
+    return NULL;
+}
+
 void TimeEvent_ctor(TimeEvent *const time_evt, Signal sig, Active *ao)
 {
     /* No critical section because it is presumed that all Time_Events
      * are created *before* multitasking has started. */
     time_evt->base.sig = sig;
+    time_evt->base.pool_id = 0U; // Time events are never recycled.
     time_evt->ao = ao;
-    time_evt->timeout = 0U;
+    time_evt->delta = 0U;
     time_evt->reload = 0U;
+    time_evt->resolution = ms_to_ticks(TIME_EVENT_RES_MIN_MS);
+    time_evt->armed = false;
+
+    /* Create timer with first time event, it only runs while a time event is armed. */
+    if (deadline_timer == NULL)
+    {
+        static const osTimerAttr_t timer_attr = {.name = "time evt",
+                                                 .cb_mem = &deadline_timer_cb,
+                                                 .cb_size = sizeof(deadline_timer_cb)};
+        deadline_timer = osTimerNew(TimeEvent_expire, osTimerOnce, NULL, &timer_attr);
+        ASSERT(deadline_timer != NULL);
+    }
+}
+
+bool RAMFUNC TimeEvent_arm(TimeEvent *const time_evt, uint32_t timeout, uint32_t reload)
+{
+    return TimeEvent_request(time_evt, ms_to_ticks(timeout), ms_to_ticks(reload));
+}
+
+void TimeEvent_set_resolution(TimeEvent *const time_evt, uint32_t resolution)
+{
+    ASSERT(resolution >= TIME_EVENT_RES_MIN_MS && resolution <= TIME_EVENT_RES_MAX_MS);
+    uint32_t ticks = ms_to_ticks(resolution);
+    time_evt->resolution = ticks > 0U ? ticks : 1U; // Word store, read by timer daemon.
+}
+
+bool RAMFUNC TimeEvent_disarm(TimeEvent *const time_evt)
+{
+    return TimeEvent_request(time_evt, 0U, 0U);
+}
+
+void ActiveCond_ctor(ActiveCond *const cond, Signal sig, Active *ao, uint32_t mask)
+{
+    ASSERT(mask != 0U && (mask & ~0x00FFFFFFUL) == 0U);
+    cond->base.sig = sig;
+    cond->base.pool_id = 0U; // Posted again on every transition, never recycled.
+    cond->ao = ao;
+    cond->mask = mask;
+    cond->met = false;
+
+    const osEventFlagsAttr_t flags_attr = {.name = "cond", .cb_mem = &cond->flags_cb, .cb_size = sizeof(cond->flags_cb)};
+    cond->flags_id = osEventFlagsNew(&flags_attr);
+    ASSERT(cond->flags_id != NULL);
+}
+
+bool ActiveCond_set(ActiveCond *const cond, uint32_t flags)
+{
+    osEventFlagsSet(cond->flags_id, flags);
+
+    /* Producers race each other, only the update completing the mask posts. */
+    uint32_t primask = __get_PRIMASK();
+    __disable_irq();
+    bool met = ActiveCond_met(cond);
+    bool raised = met && !cond->met;
+    cond->met = met;
+    __set_PRIMASK(primask);
+
+    if (raised)
+    {
+        Active_post(cond->ao, &cond->base);
+    }
+    return raised;
+}
+
+void ActiveCond_clear(ActiveCond *const cond, uint32_t flags)
+{
+    osEventFlagsClear(cond->flags_id, flags);
 
-    /* Register TimeEvent instance. */
-    ASSERT(num_time_events < ARRAY_SIZE(time_events));
-    time_events[num_time_events++] = time_evt;
+    uint32_t primask = __get_PRIMASK();
+    __disable_irq();
+    cond->met = ActiveCond_met(cond);
+    __set_PRIMASK(primask);
 }
 
-void TimeEvent_arm(TimeEvent *const time_evt, uint32_t timeout, uint32_t reload)
+bool ActiveCond_met(ActiveCond const *const cond)
 {
-	LOGI(TAG, "Arming time event for %lu seconds (%s)", timeout, reload == 0 ? "One-shot":"Periodic");
-    osKernelLock(); // Data shared between threads and timer ISR
-    time_evt->timeout = timeout;
-    time_evt->reload = reload;
-    osKernelUnlock();
+    return (osEventFlagsGet(cond->flags_id) & cond->mask) == cond->mask;
+}
 
-    /* Start 1 ms timer if first arming of timer. */
-    if(first_arm == false)
+mod_err_t Active_time_scale_set(uint32_t scale)
+{
+    if (scale == 0U || scale > ACTIVE_TIME_SCALE_MAX)
     {
-	    ms_timer_inst = osTimerNew(TimeEvent_tick, osTimerPeriodic, NULL, NULL);
-		ASSERT(ms_timer_inst != NULL);
-		LOGI(TAG, "Starting 1 ms periodic timer.");
-		osStatus_t err = osTimerStart(ms_timer_inst, 1000);
-		ASSERT(err == osOK);
-		first_arm = true;
+        return MOD_ERR_ARG;
     }
+
+    /* Rebase virtual time so it stays continuous, readers may run in ISRs. */
+    uint32_t primask = __get_PRIMASK();
+    __disable_irq();
+    scale_ms = Active_time_ms();
+    scale_tick = osKernelGetTickCount();
+    time_scale = scale;
+    __set_PRIMASK(primask);
+
+    LOGI(TAG, "Virtual time scale set to %lu.", scale);
+    return MOD_OK;
 }
 
-void TimeEvent_disarm(TimeEvent *const time_evt)
+uint32_t Active_time_scale(void)
 {
-	LOGI(TAG, "Disarming time event.");
-    osKernelLock(); // Data shared between threads and timer ISR.
-    time_evt->timeout = 0U;
-    osKernelUnlock();
+    return time_scale;
 }
 
+uint32_t Active_time_ms(void)
+{
+    uint32_t primask = __get_PRIMASK();
+    __disable_irq();
+    uint32_t elapsed = osKernelGetTickCount() - scale_tick;
+    uint32_t ms = scale_ms + (uint32_t)(((uint64_t)elapsed * 1000U * time_scale) / osKernelGetTickFreq());
+    __set_PRIMASK(primask);
+    return ms;
+}
 
+float Active_cycles_to_s(uint32_t cycles)
+{
+    return (float)cycles * (float)time_scale / (float)SystemCoreClock;
+}
 
 ////////////////////////////////////////////////////////////////////////////////
 // Private (static) functions
@@ -145,43 +684,1069 @@ static void Active_event_loop(void *argument)
     while (1)
     {
         /* Get pointer to event object. */
-        Event *evt;
-        osStatus_t err = osMessageQueueGet(ao->queue_id, &evt, NULL, osWaitForever);
-        LOGI(TAG, "Event received.");
-        if (err != osOK)
+        Active_msg msg;
+#if ACTIVE_SOURCES
+        if (ao->set != NULL)
+        {
+            /* One set item per queued item, so every member selected has one waiting. */
+            QueueSetMemberHandle_t const member = xQueueSelectFromSet(ao->set, portMAX_DELAY);
+            if (member == (QueueSetMemberHandle_t)ao->queue_id)
+            {
+                if (Active_get(ao, &msg))
+                {
+                    Active_dispatch(ao, &msg);
+                }
+            }
+            else if (member != NULL)
+            {
+                Active_dispatch_source(ao, member);
+            }
+            continue;
+        }
+#endif
+        if (ao->ring != NULL)
+        {
+            /* Notifications only wake the thread, every queued event is taken from the ring. */
+            if (!Active_get(ao, &msg))
+            {
+                ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+                continue;
+            }
+        }
+        else if (osMessageQueueGet(ao->queue_id, &msg, NULL, osWaitForever) != osOK)
         {
             LOGE(TAG, "Message queue error.");
+            continue;
         }
 
-        /* Dispatch to event handler and run to completion. */
-        ao->evt_handler(ao, evt);
+        Active_dispatch(ao, &msg);
     }
 }
 
 /**
- * @brief Simulate a 1 s timer tick.
- * 
- * If TimeEvent instance's timeout value reaches zero on decrement,
- * a user-defined timeout signal is posted to the registered active object.
- *
- * @note This function should be called from within a 1 s timer ISR
- *       or using a 1 s OS-specific software timer.
- */
-static void TimeEvent_tick(void *argument)
-{
-    for (uint8_t i = 0U; i < num_time_events; ++i)
-    {
-        TimeEvent *const t = time_events[i];
-        ASSERT(t);
-        
-        if (t->timeout > 0U)
-        { 
-            t->timeout = t->timeout - 1; // Down-counting timer.
-            if (t->timeout == 0U)
-            {   
-                Active_post(t->ao, &(t->base));
-                t->timeout = t->reload;
+ * @brief Start event loop of active object whose queue or ring is set up.
+ *
+ * @param ao Base active object.
+ * @param prio Thread priority.
+ * @param thread_attr Thread attributes (NULL for default).
+ *
+ * @return MOD_OK.
+ */
+static mod_err_t Active_start_thread(Active *const ao, osPriority_t prio, const osThreadAttr_t *const thread_attr)
+{
+    ao->prio = prio;
+    if (thread_attr != NULL && thread_attr->name != NULL)
+    {
+        ao->name = thread_attr->name;
+    }
+
+#if ACTIVE_COOPERATIVE
+#if ACTIVE_SOURCES
+    bool const shared = ao->set == NULL; // Waiting on a queue set blocks, so it keeps its own thread.
+#else
+    bool const shared = true;
+#endif
+    if (shared)
+    {
+        if (coop_thread == NULL)
+        {
+            /* Below acquisition, so samples are still triggered on time while a handler runs. */
+            static const osThreadAttr_t coop_attr = {.name = "active",
+                                                     .cb_mem = &coop_thread_cb,
+                                                     .cb_size = sizeof(coop_thread_cb),
+                                                     .stack_mem = coop_stack,
+                                                     .stack_size = sizeof(coop_stack),
+                                                     .priority = PRIO_CONTROL};
+            coop_thread = osThreadNew(Active_coop_loop, NULL, &coop_attr);
+        }
+        ao->thread_id = coop_thread;
+        Active_coop_rank(ao);
+
+        /* Kernel thread dispatches INIT_SIG before any event of this active object. */
+        uint32_t primask = __get_PRIMASK();
+        __disable_irq();
+        init_pending |= (1UL << ao->id);
+        __set_PRIMASK(primask);
+        if (coop_thread != NULL)
+        {
+            xTaskNotifyGive((TaskHandle_t)coop_thread);
+        }
+        ASSERT(ao->thread_id != NULL);
+        return MOD_OK;
+    }
+#endif
+
+    osThreadAttr_t attr = thread_attr != NULL ? *thread_attr : (osThreadAttr_t){0};
+    attr.priority = prio;
+    ao->thread_id = osThreadNew(Active_event_loop, (void *)ao, &attr);
+
+    ASSERT(ao->thread_id != NULL);
+
+    return MOD_OK;
+}
+
+/**
+ * @brief Dispatch event to handler, run it to completion and record statistics.
+ *
+ * @param ao Base active object.
+ * @param msg Dequeued event message.
+ */
+static void Active_dispatch(Active *const ao, Active_msg const *const msg)
+{
+    /* Drop event older than its signal's maximum age, see Active_max_age(). Converted at the
+     * current core clock, which may have been switched since the maximum age was set. */
+    uint32_t const age_cyc = DWT->CYCCNT - msg->post_cyc;
+    uint32_t const cycles_per_us = SystemCoreClock / 1000000U;
+    for (uint8_t i = 0; i < ao->num_max_age; i++)
+    {
+        if (ao->max_age_sigs[i] == msg->evt->sig && ao->max_age_us[i] != 0U && age_cyc > ao->max_age_us[i] * cycles_per_us)
+        {
+            Active_release(ao, msg->evt->sig);
+            ao->progress_tick = osKernelGetTickCount();
+            Event_gc(msg->evt);
+            uint32_t primask = __get_PRIMASK();
+            __disable_irq();
+            ao->stats.stale++;
+            __set_PRIMASK(primask);
+            return;
+        }
+    }
+
+    TRACE_AO_BEGIN(ao->id, msg->evt->sig);
+    Active_release(ao, msg->evt->sig); // Posts from here on are new events.
+    ao->progress_tick = osKernelGetTickCount();
+    EVLOG_DISPATCH(ao, msg->evt, msg->evt->pool_id != 0U ? event_pools[msg->evt->pool_id - 1U].block_sz - sizeof(Event) : 0U);
+    ao->busy = true;
+    uint32_t start = DWT->CYCCNT;
+    ao->evt_handler(ao, msg->evt);
+    uint32_t handler_cyc = DWT->CYCCNT - start;
+    ao->busy = false;
+    ao->progress_tick = osKernelGetTickCount();
+    TRACE_AO_END(ao->id, msg->evt->sig);
+    uint32_t latency_cyc = start - msg->post_cyc;
+
+    /* Recycle pool event once no other active object holds it. */
+    Event_gc(msg->evt);
+    cmd_pm_record_hist(&post_latency, latency_cyc);
+
+    /* Only the dispatching thread writes these, but "ao clear" may reset them. */
+    uint32_t primask = __get_PRIMASK();
+    __disable_irq();
+    Active_stats *const stats = &ao->stats;
+    stats->dispatched++;
+    stats->latency_total += latency_cyc;
+    if (latency_cyc > stats->latency_max)
+    {
+        stats->latency_max = latency_cyc;
+    }
+    if (handler_cyc > stats->handler_max)
+    {
+        stats->handler_max = handler_cyc;
+    }
+    __set_PRIMASK(primask);
+}
+
+#if ACTIVE_SOURCES
+/**
+ * @brief Run handler of source selected from active object's queue set.
+ *
+ * @param ao Base active object.
+ * @param member Set member with an item waiting.
+ */
+static void Active_dispatch_source(Active *const ao, QueueSetMemberHandle_t member)
+{
+    for (uint8_t i = 0; i < ao->num_sources; i++)
+    {
+        if (ao->sources[i].handle == member)
+        {
+            ao->progress_tick = osKernelGetTickCount();
+            ao->busy = true;
+            uint32_t start = DWT->CYCCNT;
+            ao->sources[i].handler(ao, member);
+            uint32_t handler_cyc = DWT->CYCCNT - start;
+            ao->busy = false;
+            ao->progress_tick = osKernelGetTickCount();
+
+            uint32_t primask = __get_PRIMASK();
+            __disable_irq();
+            if (handler_cyc > ao->stats.handler_max)
+            {
+                ao->stats.handler_max = handler_cyc;
             }
+            __set_PRIMASK(primask);
+            return;
+        }
+    }
+    LOGE(TAG, "Queue set member of no source.");
+}
+#endif
+
+/**
+ * @brief Display statistics of every started active object to user.
+ *
+ * @param argc Number of arguments.
+ * @param argv Argument values.
+ *
+ * @return 0 if successful, 1 otherwise.
+ */
+static uint32_t cmd_ao_status(uint32_t argc, const char **argv)
+{
+    uint32_t cycles_per_us = SystemCoreClock / 1000000U;
+
+    LOG("%-10s %10s %6s %6s %6s %6s %6s %10s %10s %10s\r\n",
+        "AO", "Dispatched", "Queued", "HWM", "Fails", "Merged", "Stale", "Lat max", "Lat avg", "Hdlr max");
+    LOG("%-10s %10s %6s %6s %6s %6s %6s %10s %10s %10s\r\n",
+        "", "", "", "", "", "", "", "(us)", "(us)", "(us)");
+    for (uint8_t i = 0; i < num_active_objects; i++)
+    {
+        Active *const ao = active_objects[i];
+        if (ao->thread_id == NULL)
+        {
+            continue; // Not started.
         }
+
+        /* Take snapshot so values do not change mid-print. */
+        uint32_t primask = __get_PRIMASK();
+        __disable_irq();
+        Active_stats stats = ao->stats;
+        __set_PRIMASK(primask);
+
+        uint32_t latency_avg = stats.dispatched ? (uint32_t)(stats.latency_total / stats.dispatched) : 0;
+        LOG("%-10s %10lu %6lu %6lu %6lu %6lu %6lu %10lu %10lu %10lu\r\n",
+            ao->name,
+            stats.dispatched,
+            Active_count(ao),
+            stats.queue_hwm,
+            stats.post_fails,
+            stats.coalesced,
+            stats.stale,
+            stats.latency_max / cycles_per_us,
+            latency_avg / cycles_per_us,
+            stats.handler_max / cycles_per_us);
     }
+
+    return 0;
+}
+
+/**
+ * @brief Reset statistics of every active object.
+ *
+ * @param argc Number of arguments.
+ * @param argv Argument values.
+ *
+ * @return 0 if successful, 1 otherwise.
+ */
+static uint32_t cmd_ao_clear(uint32_t argc, const char **argv)
+{
+    for (uint8_t i = 0; i < num_active_objects; i++)
+    {
+        uint32_t primask = __get_PRIMASK();
+        __disable_irq();
+        memset(&active_objects[i]->stats, 0, sizeof(Active_stats));
+        __set_PRIMASK(primask);
+    }
+
+    LOG("Cleared %u active objects\r\n", num_active_objects);
+    return 0;
+}
+
+/**
+ * @brief Show or set virtual time scale.
+ *
+ * @param argc Number of arguments.
+ * @param argv Argument values.
+ *
+ * @return 0 if successful, 1 otherwise.
+ */
+static uint32_t cmd_ao_timescale(uint32_t argc, const char **argv)
+{
+    if (argc > 0)
+    {
+        cmd_arg_val arg_vals[1];
+        if (cmd_parse_args(argc, argv, "u", arg_vals) != 1)
+        {
+            return 1;
+        }
+        if (Active_time_scale_set(arg_vals[0].val.u) != MOD_OK)
+        {
+            LOG("Time scale must be 1 to %u\r\n", ACTIVE_TIME_SCALE_MAX);
+            return 1;
+        }
+    }
+
+    cmd_out_u32("scale", Active_time_scale());
+    cmd_out_u32("time_ms", Active_time_ms());
+    return 0;
+}
+
+#if ACTIVE_COOPERATIVE
+/**
+ * @brief Cooperative kernel thread function, runs every active object.
+ *
+ * Each pass dispatches one event of the highest ranked ready active object,
+ * so a higher priority event posted by a handler is dispatched right after
+ * that handler completes. The thread sleeps while no event is queued.
+ *
+ * @param argument Unused.
+ */
+static void Active_coop_loop(void *argument)
+{
+    static const Event initEvt = {.sig = INIT_SIG};
+
+    while (1)
+    {
+        /* Initialize newly started active objects first. */
+        uint32_t pending = init_pending;
+        if (pending != 0U)
+        {
+            uint32_t id = (uint32_t)__builtin_ctz(pending);
+            uint32_t primask = __get_PRIMASK();
+            __disable_irq();
+            init_pending &= ~(1UL << id);
+            __set_PRIMASK(primask);
+
+            active_objects[id]->evt_handler(active_objects[id], &initEvt);
+            continue;
+        }
+
+        uint32_t ready = ready_set;
+        if (ready == 0U)
+        {
+            ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+            continue;
+        }
+
+        Active *const ao = ranked_objects[31U - (uint32_t)__builtin_clz(ready)];
+        Active_msg msg;
+        if (!Active_get(ao, &msg))
+        {
+            /* Clear ready bit unless a post raced with the empty check. */
+            uint32_t primask = __get_PRIMASK();
+            __disable_irq();
+            if (Active_count(ao) == 0U)
+            {
+                ready_set &= ~(1UL << ao->rank);
+            }
+            __set_PRIMASK(primask);
+            continue;
+        }
+
+        Active_dispatch(ao, &msg);
+    }
+}
+
+/**
+ * @brief Insert started active object into priority ranking.
+ *
+ * Active objects of equal priority keep their start order, earlier ranked higher.
+ * Ranks of already started active objects may shift, so their ready bits are
+ * moved along with them.
+ *
+ * @param ao Base active object, not yet posted to.
+ */
+static void Active_coop_rank(Active *const ao)
+{
+    ASSERT(num_ranked_objects < ACTIVE_MAX_AOS);
+
+    /* Posters read ranks and ready set, including from ISRs. */
+    uint32_t primask = __get_PRIMASK();
+    __disable_irq();
+
+    uint8_t pos = num_ranked_objects;
+    while (pos > 0U && ranked_objects[pos - 1U]->prio >= ao->prio)
+    {
+        ranked_objects[pos] = ranked_objects[pos - 1U];
+        pos--;
+    }
+    ranked_objects[pos] = ao;
+    num_ranked_objects++;
+
+    uint32_t ready = 0;
+    for (uint8_t i = 0; i < num_ranked_objects; i++)
+    {
+        Active *const r = ranked_objects[i];
+        if (r != ao && (ready_set & (1UL << r->rank)) != 0U)
+        {
+            ready |= (1UL << i);
+        }
+        r->rank = i;
+    }
+    ready_set = ready;
+
+    __set_PRIMASK(primask);
+}
+#endif
+
+/**
+ * @brief Flag active object as having an event queued, waking the cooperative kernel.
+ *
+ * @param ao Base active object.
+ * @param woken NULL from thread context, otherwise set to pdTRUE if kernel thread should run.
+ */
+static inline void Active_ready(Active *const ao, BaseType_t *const woken)
+{
+#if ACTIVE_COOPERATIVE
+#if ACTIVE_SOURCES
+    /* Queue set wakes the active object's own thread, see Active_start_set(). */
+    if (ao->set != NULL)
+    {
+        return;
+    }
+#endif
+    uint32_t primask = __get_PRIMASK();
+    __disable_irq();
+    ready_set |= (1UL << ao->rank);
+    __set_PRIMASK(primask);
+
+    if (woken == NULL)
+    {
+        xTaskNotifyGive((TaskHandle_t)coop_thread);
+    }
+    else
+    {
+        vTaskNotifyGiveFromISR((TaskHandle_t)coop_thread, woken);
+    }
+#else
+    /* Queue wakes its waiting thread itself, a ring relies on the notification. */
+    if (ao->ring == NULL)
+    {
+        return;
+    }
+    if (woken == NULL)
+    {
+        xTaskNotifyGive((TaskHandle_t)ao->thread_id);
+    }
+    else
+    {
+        vTaskNotifyGiveFromISR((TaskHandle_t)ao->thread_id, woken);
+    }
+#endif
+}
+
+/**
+ * @brief Add message to back or front of active object's ring (ISR-safe).
+ *
+ * @param ao Base active object with a ring.
+ * @param msg Message.
+ * @param urgent Add at front rather than back.
+ *
+ * @return Ring depth after adding message, 0 if ring is full.
+ */
+static inline uint32_t Active_ring_put(Active *const ao, Active_msg const *const msg, bool urgent)
+{
+    uint32_t depth = 0U;
+    uint32_t primask = __get_PRIMASK();
+    __disable_irq();
+    if (ao->ring_count < ao->ring_size)
+    {
+        uint32_t slot;
+        if (urgent)
+        {
+            slot = ao->ring_head == 0U ? ao->ring_size - 1U : ao->ring_head - 1U;
+            ao->ring_head = slot;
+        }
+        else
+        {
+            slot = ao->ring_head + ao->ring_count;
+            slot = slot >= ao->ring_size ? slot - ao->ring_size : slot;
+        }
+        ao->ring[slot] = *msg;
+        depth = ++ao->ring_count;
+    }
+    __set_PRIMASK(primask);
+    return depth;
+}
+
+/**
+ * @brief Take oldest message of active object's queue or ring without waiting.
+ *
+ * @param ao Base active object.
+ * @param[out] msg Message.
+ *
+ * @return true if a message was taken, false if none is queued.
+ */
+static inline bool Active_get(Active *const ao, Active_msg *const msg)
+{
+    if (ao->ring == NULL)
+    {
+        return xQueueReceive((QueueHandle_t)ao->queue_id, msg, 0U) == pdPASS;
+    }
+
+    bool taken = false;
+    uint32_t primask = __get_PRIMASK();
+    __disable_irq();
+    if (ao->ring_count > 0U)
+    {
+        *msg = ao->ring[ao->ring_head];
+        ao->ring_head = ao->ring_head + 1U == ao->ring_size ? 0U : ao->ring_head + 1U;
+        ao->ring_count--;
+        taken = true;
+    }
+    __set_PRIMASK(primask);
+    return taken;
+}
+
+/**
+ * @brief Get number of messages in active object's queue or ring (thread context).
+ */
+static inline uint32_t Active_count(Active const *const ao)
+{
+    return ao->ring != NULL ? ao->ring_count : uxQueueMessagesWaiting((QueueHandle_t)ao->queue_id);
+}
+
+/**
+ * @brief Queue event from thread context and update queue high-water mark.
+ *
+ * @param ao Base active object.
+ * @param evt Event information.
+ * @param urgent Queue at front rather than back.
+ *
+ * @return MOD_OK if successful, MOD_ERR_TIMEOUT if queue is full.
+ */
+static mod_err_t Active_put(Active *const ao, Event const *const evt, bool urgent)
+{
+    if (EVLOG_REPLAYED(ao))
+    {
+        Event_ref(evt);
+        Event_gc(evt); // Replayed active objects only take recorded events.
+        return MOD_OK;
+    }
+    if (!Active_claim(ao, evt->sig))
+    {
+        return MOD_OK; // Merged into pending event.
+    }
+
+    /* Pool event stays allocated until this delivery is handled. */
+    Event_ref(evt);
+
+    Active_msg msg = {.evt = evt, .post_cyc = DWT->CYCCNT};
+    uint32_t depth;
+    if (ao->ring != NULL)
+    {
+        depth = Active_ring_put(ao, &msg, urgent);
+    }
+    else
+    {
+        QueueHandle_t queue = (QueueHandle_t)ao->queue_id;
+        BaseType_t ok = urgent ? xQueueSendToFront(queue, &msg, 0U) : xQueueSendToBack(queue, &msg, 0U);
+        depth = ok == pdPASS ? uxQueueMessagesWaiting(queue) : 0U;
+        depth = ok == pdPASS && depth == 0U ? 1U : depth; // Receiver preempted poster and took it already.
+    }
+    if (depth == 0U)
+    {
+        Active_release(ao, evt->sig);
+        Event_gc(evt);
+        Active_record_post(ao, 0U);
+        return MOD_ERR_TIMEOUT;
+    }
+
+    Active_ready(ao, NULL);
+    Active_record_post(ao, depth);
+    return MOD_OK;
+}
+
+/**
+ * @brief Queue event from ISR and update queue high-water mark.
+ *
+ * @param ao Base active object.
+ * @param evt Event information.
+ * @param urgent Queue at front rather than back.
+ * @param woken Set to pdTRUE if a higher priority thread was woken.
+ *
+ * @return MOD_OK if successful, MOD_ERR_TIMEOUT if queue is full.
+ */
+static mod_err_t Active_putFromISR(Active *const ao, Event const *const evt, bool urgent, BaseType_t *const woken)
+{
+    if (EVLOG_REPLAYED(ao))
+    {
+        Event_ref(evt);
+        Event_gc(evt);
+        return MOD_OK;
+    }
+    if (!Active_claim(ao, evt->sig))
+    {
+        return MOD_OK;
+    }
+
+    Event_ref(evt);
+
+    Active_msg msg = {.evt = evt, .post_cyc = DWT->CYCCNT};
+    uint32_t depth;
+    if (ao->ring != NULL)
+    {
+        depth = Active_ring_put(ao, &msg, urgent);
+    }
+    else
+    {
+        QueueHandle_t queue = (QueueHandle_t)ao->queue_id;
+        BaseType_t ok = urgent ? xQueueSendToFrontFromISR(queue, &msg, woken) :
+                                 xQueueSendToBackFromISR(queue, &msg, woken);
+        depth = ok == pdPASS ? uxQueueMessagesWaitingFromISR(queue) : 0U;
+        depth = ok == pdPASS && depth == 0U ? 1U : depth;
+    }
+    if (depth == 0U)
+    {
+        Active_release(ao, evt->sig);
+        Event_gc(evt);
+        Active_record_post(ao, 0U);
+        return MOD_ERR_TIMEOUT;
+    }
+
+    Active_ready(ao, woken);
+    Active_record_post(ao, depth);
+    return MOD_OK;
+}
+
+/**
+ * @brief Post event to every active object of a set, by reference for pool events (ISR-safe).
+ *
+ * @param evt Event to post.
+ * @param mask Bit per active object registry index.
+ *
+ * @return Number of active objects event was posted to.
+ */
+static uint32_t Active_multicast(Event const *const evt, uint32_t mask)
+{
+    /* Hold a reference while multicasting, so the first subscriber
+     * cannot recycle the event before the last one receives it. */
+    Event_ref(evt);
+
+    /* From ISR, yield once after all subscribers are posted. */
+    bool isr = __get_IPSR() != 0U;
+    BaseType_t woken = pdFALSE;
+    uint32_t num_posted = 0;
+    while (mask != 0U)
+    {
+        uint32_t id = (uint32_t)__builtin_ctz(mask);
+        mask &= mask - 1U; // Clear lowest set bit.
+        mod_err_t err = isr ? Active_putFromISR(active_objects[id], evt, false, &woken) :
+                              Active_put(active_objects[id], evt, false);
+        if (err == MOD_OK)
+        {
+            num_posted++;
+        }
+    }
+
+    Event_gc(evt);
+    if (isr)
+    {
+        portYIELD_FROM_ISR(woken);
+    }
+    return num_posted;
+}
+
+/**
+ * @brief Record outcome of post in active object statistics and liveness (ISR-safe).
+ *
+ * @param ao Base active object.
+ * @param depth Queue depth after successful post, 0 if queue was full.
+ */
+static inline void Active_record_post(Active *const ao, uint32_t depth)
+{
+    uint32_t primask = __get_PRIMASK();
+    __disable_irq();
+    if (depth == 0U)
+    {
+        ao->stats.post_fails++;
+    }
+    else if (depth > ao->stats.queue_hwm)
+    {
+        ao->stats.queue_hwm = depth;
+    }
+    if (depth == 1U && !ao->busy)
+    {
+        ao->progress_tick = osKernelGetTickCount(); // Queue wait starts now, not at last dispatch.
+    }
+    __set_PRIMASK(primask);
+}
+
+/**
+ * @brief Mark signal as queued if it coalesces (ISR-safe).
+ *
+ * @param ao Base active object.
+ * @param sig Signal about to be queued.
+ *
+ * @return false if an identical coalescing event is already pending, true otherwise.
+ */
+static inline bool Active_claim(Active *const ao, Signal sig)
+{
+    if (sig < 0 || sig >= 32 || (ao->coalesce_sigs & (1UL << sig)) == 0U)
+    {
+        return true;
+    }
+
+    uint32_t primask = __get_PRIMASK();
+    __disable_irq();
+    bool claimed = (ao->pending_sigs & (1UL << sig)) == 0U;
+    if (claimed)
+    {
+        ao->pending_sigs |= (1UL << sig);
+    }
+    else
+    {
+        ao->stats.coalesced++;
+    }
+    __set_PRIMASK(primask);
+    return claimed;
+}
+
+/**
+ * @brief Clear pending mark of coalescing signal, once dispatched or if it could not be queued (ISR-safe).
+ *
+ * @param ao Base active object.
+ * @param sig Signal.
+ */
+static inline void Active_release(Active *const ao, Signal sig)
+{
+    if (sig < 0 || sig >= 32 || (ao->coalesce_sigs & (1UL << sig)) == 0U)
+    {
+        return;
+    }
+
+    uint32_t primask = __get_PRIMASK();
+    __disable_irq();
+    ao->pending_sigs &= ~(1UL << sig);
+    __set_PRIMASK(primask);
+}
+
+/**
+ * @brief Take a reference to event, static events are ignored.
+ */
+static inline void Event_ref(Event const *evt)
+{
+    if (evt->pool_id != 0U)
+    {
+        uint32_t primask = __get_PRIMASK();
+        __disable_irq();
+        ((Event *)evt)->ref_cnt++;
+        __set_PRIMASK(primask);
+    }
+}
+
+/**
+ * @brief Build free list of every event pool.
+ */
+static void Event_pools_init(void)
+{
+    for (uint8_t i = 0; i < ARRAY_SIZE(event_pools); i++)
+    {
+        Event_pool *const pool = &event_pools[i];
+        uint8_t *block = (uint8_t *)pool->storage;
+        pool->free_head = NULL;
+        for (uint32_t j = 0; j < pool->num_blocks; j++)
+        {
+            *(void **)block = pool->free_head;
+            pool->free_head = block;
+            block += pool->block_sz;
+        }
+    }
+}
+
+/**
+ * @brief Drop one reference to event, returning it to its pool once unreferenced.
+ *
+ * @param evt Event instance, static events are ignored.
+ */
+static void Event_gc(Event const *evt)
+{
+    if (evt->pool_id == 0U)
+    {
+        return;
+    }
+
+    Event_pool *const pool = &event_pools[evt->pool_id - 1U];
+    uint32_t primask = __get_PRIMASK();
+    __disable_irq();
+    Event *const e = (Event *)evt;
+    ASSERT(e->ref_cnt > 0U);
+    if (--e->ref_cnt == 0U)
+    {
+        *(void **)e = pool->free_head;
+        pool->free_head = e;
+    }
+    __set_PRIMASK(primask);
+}
+
+/**
+ * @brief Deadline timer callback (timer daemon task).
+ * 
+ * Every time event whose timeout has elapsed expires: a user-defined timeout signal is
+ * posted to the registered active object and periodic time events are re-inserted.
+ * The timer is then reprogrammed to the next deadline, or left stopped if none is armed.
+ * Requests published meanwhile are applied first, so a time event disarmed before its
+ * expiry is not posted.
+ */
+static void RAMFUNC TimeEvent_expire(void *argument)
+{
+    TimeEvent_elapse();
+    TimeEvent_apply();
+    TimeEvent *t;
+    while ((t = SLIST_FIRST(&armed_head)) != NULL && t->delta == 0U)
+    {
+        SLIST_REMOVE_HEAD(&armed_head, next);
+        t->armed = false;
+        Active_post(t->ao, &(t->base));
+        if (t->reload > 0U)
+        {
+            TimeEvent_insert(t, t->reload);
+        }
+    }
+    TimeEvent_schedule();
+}
+
+/**
+ * @brief Apply published requests and reprogram deadline timer (pended timer daemon call).
+ *
+ * @param param1 Unused.
+ * @param param2 Unused.
+ */
+static void RAMFUNC TimeEvent_service(void *param1, uint32_t param2)
+{
+    (void)param1;
+    (void)param2;
+    tevt_kick = 0U; // Requests published from here on pend another call.
+    __DMB();
+    TimeEvent_elapse();
+    TimeEvent_apply();
+    TimeEvent_schedule();
+}
+
+/**
+ * @brief Publish arm or disarm request and have the timer daemon apply it.
+ *
+ * A slot is reserved with an exclusive load/store on the put index, filled and published
+ * with its sequence number, as in work_submit(). The daemon applies slots in order, so
+ * the last request for a time event wins.
+ *
+ * A full ring means the daemon has not run for a while, so the daemon call is pended again
+ * in case pending it failed before.
+ *
+ * @param time_evt Time event instance.
+ * @param timeout Timeout (kernel ticks), 0 disarms.
+ * @param reload Reload (kernel ticks), 0 for one-shot.
+ * @return True if request was published, false if the ring was full.
+ */
+static bool RAMFUNC TimeEvent_request(TimeEvent *const time_evt, uint32_t timeout, uint32_t reload)
+{
+    uint32_t put;
+    do
+    {
+        put = __LDREXW(&tevt_req_put);
+        if (put - tevt_req_get >= TIME_EVENT_REQ_RING_SIZE)
+        {
+            __CLREX();
+            TimeEvent_kick();
+            return false;
+        }
+    } while (__STREXW(put + 1U, &tevt_req_put) != 0U);
+
+    TimeEvent_req *const req = &tevt_reqs[put & (TIME_EVENT_REQ_RING_SIZE - 1U)];
+    req->time_evt = time_evt;
+    req->timeout = timeout;
+    req->reload = reload;
+    req->tick = osKernelGetTickCount();
+    __DMB(); // Request must be visible before the daemon observes its sequence.
+    req->seq = put + 1U;
+
+    TimeEvent_kick();
+    return true;
+}
+
+/**
+ * @brief Pend a timer daemon call applying requests, unless one is pending already.
+ *
+ * A burst of requests is applied by one call. The daemon command queue holding the
+ * call is the one osTimerStart() used to share with the deadline timer. If that queue is
+ * full the call is not pended, and the next request kicks again.
+ */
+static void RAMFUNC TimeEvent_kick(void)
+{
+    do
+    {
+        if (__LDREXW(&tevt_kick) != 0U)
+        {
+            __CLREX();
+            return;
+        }
+    } while (__STREXW(1U, &tevt_kick) != 0U);
+
+    BaseType_t ok;
+    if (__get_IPSR() != 0U)
+    {
+        BaseType_t woken = pdFALSE;
+        ok = xTimerPendFunctionCallFromISR(TimeEvent_service, NULL, 0U, &woken);
+        portYIELD_FROM_ISR(woken);
+    }
+    else
+    {
+        ok = xTimerPendFunctionCall(TimeEvent_service, NULL, 0U, 0U);
+    }
+    if (ok != pdPASS)
+    {
+        tevt_kick = 0U; // Published requests wait for the next kick.
+    }
+}
+
+/**
+ * @brief Apply published requests to the armed list in order, up to the first slot not
+ *        published yet.
+ *
+ * A reserved slot holds the requests behind it back until its requester resumes and
+ * publishes it, then pends another call. Timeouts count from the request's tick.
+ *
+ * @note Timer daemon only, after TimeEvent_elapse().
+ */
+static void RAMFUNC TimeEvent_apply(void)
+{
+    uint32_t get = tevt_req_get;
+    TimeEvent_req *req = &tevt_reqs[get & (TIME_EVENT_REQ_RING_SIZE - 1U)];
+    while (req->seq == get + 1U)
+    {
+        __DMB();
+        TimeEvent *const t = req->time_evt;
+        uint32_t timeout = req->timeout;
+        uint32_t reload = req->reload;
+        uint32_t tick = req->tick;
+        tevt_req_get = ++get; // Slot may be reused from here on.
+
+        if ((int32_t)(tick - last_update_tick) > 0)
+        {
+            TimeEvent_elapse(); // Requested after the list was last updated.
+        }
+        TimeEvent_remove(t);
+        t->reload = reload;
+        if (timeout > 0U)
+        {
+            uint32_t late = last_update_tick - tick;
+            TimeEvent_insert(t, timeout > late ? timeout - late : 1U);
+        }
+        req = &tevt_reqs[get & (TIME_EVENT_REQ_RING_SIZE - 1U)];
+    }
+}
+
+/**
+ * @brief Insert time event into armed list in order of expiry.
+ *
+ * Expiry is rounded up to a multiple of the time event's resolution.
+ * Time events expiring on the same tick keep their arming order.
+ *
+ * @param time_evt Disarmed time event instance.
+ * @param timeout Timeout value in kernel ticks, greater than 0.
+ *
+ * @note Timer daemon only, after TimeEvent_elapse().
+ */
+static void TimeEvent_insert(TimeEvent *const time_evt, uint32_t timeout)
+{
+    /* Align absolute deadline so coarse time events share timer wakeups. */
+    uint32_t res = time_evt->resolution;
+    if (res > 1U)
+    {
+        uint32_t deadline = last_update_tick + timeout;
+        timeout += (res - deadline % res) % res;
+    }
+
+    TimeEvent *prev = NULL;
+    TimeEvent *p;
+    SLIST_FOREACH(p, &armed_head, next)
+    {
+        if (timeout < p->delta)
+        {
+            p->delta -= timeout; // Successor now expires relative to inserted time event.
+            break;
+        }
+        timeout -= p->delta;
+        prev = p;
+    }
+
+    time_evt->delta = timeout;
+    time_evt->armed = true;
+    if (prev == NULL)
+    {
+        SLIST_INSERT_HEAD(&armed_head, time_evt, next);
+    }
+    else
+    {
+        SLIST_INSERT_AFTER(prev, time_evt, next);
+    }
+}
+
+/**
+ * @brief Remove time event from armed list if armed.
+ *
+ * @param time_evt Time event instance.
+ *
+ * @note Timer daemon only.
+ */
+static void TimeEvent_remove(TimeEvent *const time_evt)
+{
+    if (!time_evt->armed)
+    {
+        return;
+    }
+
+    /* Successor inherits remaining relative timeout. */
+    TimeEvent *succ = SLIST_NEXT(time_evt, next);
+    if (succ != NULL)
+    {
+        succ->delta += time_evt->delta;
+    }
+    SLIST_REMOVE(&armed_head, time_evt, TimeEvent, next);
+    time_evt->armed = false;
+}
+
+/**
+ * @brief Subtract kernel ticks elapsed since last update from armed list.
+ *
+ * Time events that are due are left at the head of the list with zero
+ * relative timeout until TimeEvent_expire() posts them.
+ *
+ * @note Timer daemon only.
+ */
+static void RAMFUNC TimeEvent_elapse(void)
+{
+    uint32_t now = osKernelGetTickCount();
+    uint32_t elapsed = now - last_update_tick;
+    last_update_tick = now;
+
+    TimeEvent *p;
+    SLIST_FOREACH(p, &armed_head, next)
+    {
+        if (elapsed < p->delta)
+        {
+            p->delta -= elapsed;
+            break;
+        }
+        elapsed -= p->delta;
+        p->delta = 0U;
+    }
+}
+
+/**
+ * @brief Program deadline timer to expire at head of armed list, or stop it if idle.
+ *
+ * @pre TimeEvent_elapse() was called since the armed list was last updated.
+ *
+ * @note Timer daemon only.
+ */
+static void TimeEvent_schedule(void)
+{
+    TimeEvent *head = SLIST_FIRST(&armed_head);
+    if (head == NULL)
+    {
+        osTimerStop(deadline_timer);
+        return;
+    }
+
+    /* Already due time events are posted on the next timer daemon run. */
+    osStatus_t err = osTimerStart(deadline_timer, head->delta > 0U ? head->delta : 1U);
+    ASSERT(err == osOK);
+}
+
+/**
+ * @brief Convert virtual milliseconds to kernel ticks, at least one tick if ms is non-zero.
+ */
+static inline uint32_t ms_to_ticks(uint32_t ms)
+{
+    uint32_t ticks = (uint32_t)(((uint64_t)ms * osKernelGetTickFreq()) / (1000U * time_scale));
+    return (ticks == 0U && ms > 0U) ? 1U : ticks;
 }
@@ -0,0 +1,272 @@
+/**
+ * @file analog.c
+ * @author Timothy Nguyen
+ * @brief Analog inputs: continuous ADC1 scan by DMA of heater current, ambient NTC, VREFINT and die temperature.
+ * @version 0.1
+ * @date 2021-09-06
+ */
+
+#include <math.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "analog.h"
+#include "cmd.h"
+#include "log.h"
+#include "sections.h"
+#include "stm32l4xx.h"
+#include "stm32l4xx_hal.h"
+#include "stm32l4xx_ll_dma.h"
+
+////////////////////////////////////////////////////////////////////////////////
+// Common macros
+////////////////////////////////////////////////////////////////////////////////
+
+#define ANALOG_FULL_SCALE (4095.0f * 16.0f) // Oversampled result of full scale, 12 bits shifted to 16.
+#define ANALOG_OVSR 5U                      // Oversampling ratio field, 64 conversions.
+#define ANALOG_OVSS 2U                      // Oversampling shift, 64 x 12 bits to 16 bits.
+#define ANALOG_SMP_640 7U                   // Sampling time field, 640.5 ADC clock cycles.
+#define ANALOG_TIMEOUT_MS 10U               // Longest calibration or enable (ms).
+
+/* Factory calibration, taken at VDDA = 3.0 V */
+#define ANALOG_CAL_VDDA 3.0f
+#define ANALOG_VREFINT_CAL (*(const uint16_t *)0x1FFF75AAU) // VREFINT result.
+#define ANALOG_TS_CAL1 (*(const uint16_t *)0x1FFF75A8U)     // Temperature sensor result at 30 deg C.
+#define ANALOG_TS_CAL2 (*(const uint16_t *)0x1FFF75CAU)     // Temperature sensor result at 110 deg C.
+#define ANALOG_TS_CAL1_TEMP 30.0f
+#define ANALOG_TS_CAL2_TEMP 110.0f
+
+#define ANALOG_KELVIN 273.15f
+
+_Static_assert(ANALOG_OVERSAMPLE == 64U, "Oversampling fields are set for 64 conversions");
+
+////////////////////////////////////////////////////////////////////////////////
+// Type definitions
+////////////////////////////////////////////////////////////////////////////////
+
+/* Scan sequence, in conversion order */
+typedef enum
+{
+    ANALOG_IN_CURRENT, // Heater current, ADC1_IN1 (PC0).
+    ANALOG_IN_NTC,     // Ambient NTC, ADC1_IN2 (PC1).
+    ANALOG_IN_VREFINT, // Internal reference, ADC1_IN0.
+    ANALOG_IN_DIE,     // Temperature sensor, ADC1_IN17.
+
+    ANALOG_NUM_INPUTS
+} Analog_input_t;
+
+////////////////////////////////////////////////////////////////////////////////
+// Private (static) function declarations
+////////////////////////////////////////////////////////////////////////////////
+
+/* Command callback functions */
+static uint32_t cmd_analog_status(uint32_t argc, const char **argv); // Display analog readings.
+
+static mod_err_t analog_wait(__IO uint32_t *reg, uint32_t mask, bool set); // Wait for register bits.
+
+////////////////////////////////////////////////////////////////////////////////
+// Private (static) variables
+////////////////////////////////////////////////////////////////////////////////
+
+/* Oversampled results, written by DMA one scan after another */
+static uint16_t SRAM1_DMA analog_buf[ANALOG_SCANS][ANALOG_NUM_INPUTS];
+
+/* ADC channel of each input */
+static const uint8_t analog_channels[ANALOG_NUM_INPUTS] = {1U, 2U, 0U, 17U};
+
+/* Scan is running */
+static bool analog_running;
+
+/* Analog command information. */
+static cmd_cmd_info analog_cmds[] = {
+    {.cmd_name = "status",
+     .cb = cmd_analog_status,
+     .help = "Display heater current and power, ambient temperature, VDDA and die temperature."}};
+
+/* Analog module client info */
+CMD_CLIENT_DEFINE(analog,
+                  .num_cmds = sizeof(analog_cmds) / sizeof(analog_cmds[0]),
+                  .cmds = analog_cmds);
+
+/* Unique tag for analog module. */
+LOG_TAG_DEFINE("ANALOG");
+
+////////////////////////////////////////////////////////////////////////////////
+// Public (global) functions
+////////////////////////////////////////////////////////////////////////////////
+
+mod_err_t analog_init(void)
+{
+    /* Inputs connected to the ADC through their analog switches. */
+    __HAL_RCC_GPIOC_CLK_ENABLE();
+    GPIO_InitTypeDef gpio_init = {.Pin = GPIO_PIN_0 | GPIO_PIN_1, .Mode = GPIO_MODE_ANALOG_ADC_CONTROL, .Pull = GPIO_NOPULL};
+    HAL_GPIO_Init(GPIOC, &gpio_init);
+
+    /* Conversions clocked by HCLK / 4, ADCSEL also selects a kernel clock as the ADC clock gate stays shut without one. */
+    MODIFY_REG(RCC->CCIPR, RCC_CCIPR_ADCSEL, RCC_CCIPR_ADCSEL);
+    SET_BIT(RCC->AHB2ENR, RCC_AHB2ENR_ADCEN);
+    (void)READ_BIT(RCC->AHB2ENR, RCC_AHB2ENR_ADCEN);
+    ADC123_COMMON->CCR = ADC_CCR_CKMODE_1 | ADC_CCR_CKMODE_0 | ADC_CCR_VREFEN | ADC_CCR_TSEN;
+
+    /* Leave deep power-down, regulator and temperature sensor start within a tick. */
+    ADC1->CR = 0;
+    ADC1->CR = ADC_CR_ADVREGEN;
+    HAL_Delay(1);
+
+    SET_BIT(ADC1->CR, ADC_CR_ADCAL);
+    if (analog_wait(&ADC1->CR, ADC_CR_ADCAL, false) != MOD_OK)
+    {
+        LOGE(TAG, "ADC calibration timed out");
+        return MOD_ERR_TIMEOUT;
+    }
+
+    WRITE_REG(ADC1->ISR, ADC_ISR_ADRDY);
+    SET_BIT(ADC1->CR, ADC_CR_ADEN);
+    if (analog_wait(&ADC1->ISR, ADC_ISR_ADRDY, true) != MOD_OK)
+    {
+        LOGE(TAG, "ADC enable timed out");
+        return MOD_ERR_TIMEOUT;
+    }
+
+    /* Continuous scan, circular DMA, results overwritten if DMA falls behind. */
+    ADC1->CFGR = ADC_CFGR_CONT | ADC_CFGR_DMAEN | ADC_CFGR_DMACFG | ADC_CFGR_OVRMOD | ADC_CFGR_JQDIS;
+    ADC1->CFGR2 = ADC_CFGR2_ROVSE | (ANALOG_OVSR << ADC_CFGR2_OVSR_Pos) | (ANALOG_OVSS << ADC_CFGR2_OVSS_Pos);
+    uint32_t sqr1 = ANALOG_NUM_INPUTS - 1U;
+    for (uint32_t i = 0; i < ANALOG_NUM_INPUTS; i++)
+    {
+        /* SQ1 at bit 6, sequence fields 6 bits apart. Slowest sampling, the sensors need at least 5 us. */
+        uint32_t ch = analog_channels[i];
+        sqr1 |= ch << (ADC_SQR1_SQ1_Pos + 6U * i);
+        if (ch < 10U)
+        {
+            ADC1->SMPR1 |= ANALOG_SMP_640 << (3U * ch);
+        }
+        else
+        {
+            ADC1->SMPR2 |= ANALOG_SMP_640 << (3U * (ch - 10U));
+        }
+    }
+    ADC1->SQR1 = sqr1;
+
+    /* ADC1 is DMA1 channel 1, request 0. */
+    __HAL_RCC_DMA1_CLK_ENABLE();
+    LL_DMA_DisableChannel(DMA1, LL_DMA_CHANNEL_1);
+    LL_DMA_SetPeriphRequest(DMA1, LL_DMA_CHANNEL_1, LL_DMA_REQUEST_0);
+    LL_DMA_ConfigTransfer(DMA1, LL_DMA_CHANNEL_1,
+                          LL_DMA_DIRECTION_PERIPH_TO_MEMORY | LL_DMA_PRIORITY_LOW | LL_DMA_MODE_CIRCULAR |
+                              LL_DMA_PERIPH_NOINCREMENT | LL_DMA_MEMORY_INCREMENT |
+                              LL_DMA_PDATAALIGN_HALFWORD | LL_DMA_MDATAALIGN_HALFWORD);
+    LL_DMA_SetPeriphAddress(DMA1, LL_DMA_CHANNEL_1, (uint32_t)&ADC1->DR);
+    LL_DMA_SetMemoryAddress(DMA1, LL_DMA_CHANNEL_1, (uint32_t)analog_buf);
+    LL_DMA_SetDataLength(DMA1, LL_DMA_CHANNEL_1, ANALOG_SCANS * ANALOG_NUM_INPUTS);
+    LL_DMA_ClearFlag_TC1(DMA1);
+    LL_DMA_EnableChannel(DMA1, LL_DMA_CHANNEL_1);
+
+    SET_BIT(ADC1->CR, ADC_CR_ADSTART);
+    analog_running = true;
+    LOGI(TAG, "Initialized analog module");
+    return MOD_OK;
+}
+
+void analog_read(Analog_t *const dst)
+{
+    /* Transfer complete is never cleared after start, it marks a buffer of complete scans. */
+    if (!analog_running || !LL_DMA_IsActiveFlag_TC1(DMA1))
+    {
+        *dst = (Analog_t){.current = NAN, .power = NAN, .ambient = NAN, .vdda = NAN, .die_temp = NAN};
+        return;
+    }
+
+    uint32_t sums[ANALOG_NUM_INPUTS] = {0};
+    for (uint32_t s = 0; s < ANALOG_SCANS; s++)
+    {
+        for (uint32_t i = 0; i < ANALOG_NUM_INPUTS; i++)
+        {
+            sums[i] += analog_buf[s][i];
+        }
+    }
+    float ratio[ANALOG_NUM_INPUTS];
+    for (uint32_t i = 0; i < ANALOG_NUM_INPUTS; i++)
+    {
+        ratio[i] = (float)sums[i] / ((float)ANALOG_SCANS * ANALOG_FULL_SCALE);
+    }
+
+    /* VREFINT scales every other input from a fraction of VDDA to volts. */
+    float vdda = ratio[ANALOG_IN_VREFINT] > 0.0f
+                     ? ANALOG_CAL_VDDA * ((float)ANALOG_VREFINT_CAL / 4095.0f) / ratio[ANALOG_IN_VREFINT]
+                     : NAN;
+    dst->vdda = vdda;
+
+    float ts = ratio[ANALOG_IN_DIE] * 4095.0f * vdda / ANALOG_CAL_VDDA;
+    dst->die_temp = ANALOG_TS_CAL1_TEMP + (ANALOG_TS_CAL2_TEMP - ANALOG_TS_CAL1_TEMP) *
+                                              (ts - (float)ANALOG_TS_CAL1) / (float)(ANALOG_TS_CAL2 - ANALOG_TS_CAL1);
+
+#if ANALOG_CURRENT_ENABLE
+    float amps = (ratio[ANALOG_IN_CURRENT] * vdda - ANALOG_CURRENT_OFFSET_V) / ANALOG_CURRENT_V_PER_A;
+    dst->current = amps > 0.0f ? amps : 0.0f;
+    dst->power = dst->current * ANALOG_MAINS_V;
+#else
+    dst->current = NAN;
+    dst->power = NAN;
+#endif
+
+    /* Divider ratio x = R / (R + pullup), independent of VDDA. */
+    float x = ratio[ANALOG_IN_NTC];
+    if (x > 0.001f && x < 0.999f)
+    {
+        float r = ANALOG_NTC_PULLUP_OHM * x / (1.0f - x);
+        float inv_t = 1.0f / (25.0f + ANALOG_KELVIN) + logf(r / ANALOG_NTC_R25_OHM) / ANALOG_NTC_BETA;
+        dst->ambient = 1.0f / inv_t - ANALOG_KELVIN;
+    }
+    else
+    {
+        dst->ambient = NAN;
+    }
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Private (static) functions
+////////////////////////////////////////////////////////////////////////////////
+
+/**
+ * @brief Display analog readings.
+ *
+ * @param argc Number of arguments.
+ * @param argv Argument values.
+ *
+ * @return 0 if successful.
+ */
+static uint32_t cmd_analog_status(uint32_t argc, const char **argv)
+{
+    Analog_t reading;
+    analog_read(&reading);
+    cmd_out_str("state", analog_running ? "running" : "off");
+    cmd_out_float("heater a", reading.current);
+    cmd_out_float("heater w", reading.power);
+    cmd_out_float("ambient c", reading.ambient);
+    cmd_out_float("vdda v", reading.vdda);
+    cmd_out_float("die c", reading.die_temp);
+    return 0;
+}
+
+/**
+ * @brief Wait for register bits to be set or cleared.
+ *
+ * @param reg Register.
+ * @param mask Bits waited for.
+ * @param set Wait for bits set if true, cleared otherwise.
+ *
+ * @return MOD_OK if done, MOD_ERR_TIMEOUT otherwise.
+ */
+static mod_err_t analog_wait(__IO uint32_t *reg, uint32_t mask, bool set)
+{
+    uint32_t start = HAL_GetTick();
+    while (((*reg & mask) == mask) != set)
+    {
+        if (HAL_GetTick() - start > ANALOG_TIMEOUT_MS)
+        {
+            return MOD_ERR_TIMEOUT;
+        }
+    }
+    return MOD_OK;
+}
@@ -0,0 +1,780 @@
+/**
+ * @file archive.c
+ * @author Timothy Nguyen
+ * @brief Run archive: append-only record log on external SPI NOR flash.
+ * @version 0.1
+ * @date 2021-08-28
+ */
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include <stdlib.h>
+
+#include "archive.h"
+#include "cmd.h"
+#include "log.h"
+#include "nvs.h"
+#include "frame.h"
+#include "console.h"
+#include "power.h"
+#include "prio.h"
+#include "sections.h"
+#include "cmsis_os.h"
+
+////////////////////////////////////////////////////////////////////////////////
+// Common macros
+////////////////////////////////////////////////////////////////////////////////
+
+/* NOR flash commands */
+#define FLASH_CMD_READ 0x03U       // Read data.
+#define FLASH_CMD_PAGE_PROG 0x02U  // Page program.
+#define FLASH_CMD_SECTOR_ERASE 0x20U // 4 Kbyte sector erase.
+#define FLASH_CMD_CHIP_ERASE 0xC7U // Chip erase.
+#define FLASH_CMD_WREN 0x06U       // Write enable.
+#define FLASH_CMD_RDSR 0x05U       // Read status register 1.
+#define FLASH_CMD_JEDEC_ID 0x9FU   // Read manufacturer and device ID.
+#define FLASH_SR_WIP 0x01U         // Status register write in progress bit.
+
+#define FLASH_MIN_DENSITY 16U // Smallest accepted JEDEC capacity code, 64 Kbytes.
+#define FLASH_MAX_DENSITY 24U // Largest capacity code reachable with 3-byte addresses, 16 Mbytes.
+
+#define SPI_TIMEOUT_MS 10U         // Longest polled command transfer (ms).
+
+/* Archive thread flags */
+#define ARCHIVE_BLOCK_FLAG 0x01U // Block sealed.
+#define ARCHIVE_FLUSH_FLAG 0x02U // Seal partial block once the other buffer is free.
+#define ARCHIVE_ERASE_FLAG 0x04U // Erase whole device.
+#define ARCHIVE_DMA_FLAG 0x08U   // Page transfer complete.
+
+////////////////////////////////////////////////////////////////////////////////
+// Type definitions
+////////////////////////////////////////////////////////////////////////////////
+
+/* Archive state */
+typedef struct
+{
+    archive_cfg_t cfg;
+
+    /* Device */
+    uint32_t jedec_id;     // Manufacturer, memory type and capacity code.
+    uint32_t num_sectors;  // Sectors in device.
+    volatile bool mounted; // Log end found, records are accepted.
+
+    /* Double buffer, blocks are built in buf[fill] and written from the other */
+    uint8_t buf[2][ARCHIVE_BLOCK_SIZE]; // Block buffers, header first.
+    uint16_t used[2];                   // Bytes in use, header included.
+    volatile uint8_t fill;              // Buffer records are appended to.
+    volatile bool sealed[2];            // Buffer waits for or is being written to flash.
+    bool flush_pending;                 // Partial block sealed once the other buffer is free.
+
+    /* Log position */
+    uint32_t next_sector; // Sector written next.
+    uint32_t next_seq;    // Sequence number of next block.
+
+    /* Statistics */
+    uint32_t blocks;      // Blocks written since reset.
+    uint32_t drops;       // Records dropped, both buffers full or no device.
+    uint32_t errors;      // Failed block writes.
+    uint32_t write_ms_max; // Longest block erase and program (ms).
+    char batch[ARCHIVE_BATCH_LEN]; // Batch label.
+} archive_t;
+
+/* Dump frame payload */
+typedef struct __attribute__((packed))
+{
+    uint8_t type;                     // ARCHIVE_DUMP_TYPE.
+    uint32_t seq;                     // Block sequence number.
+    uint16_t offset;                  // Offset of data within block.
+    uint8_t data[ARCHIVE_DUMP_CHUNK]; // Block bytes.
+} archive_dump_t;
+
+_Static_assert(FRAME_ENCODED_SIZE(sizeof(archive_dump_t)) <= CMD_ASYNC_CHUNK,
+               "A dump step writes one frame into the space it is resumed with");
+
+/* Dump in progress, one frame per command step */
+typedef struct
+{
+    uint32_t sector; // Sector visited next.
+    uint32_t left;   // Sectors still to visit.
+    uint32_t addr;   // Address of block being sent.
+    uint32_t seq;    // Sequence number of block being sent.
+    uint32_t used;   // Bytes of block being sent, 0 between blocks.
+    uint32_t offset; // Offset of next chunk within block.
+    uint32_t sent;   // Blocks sent.
+} archive_dump_ctx_t;
+
+////////////////////////////////////////////////////////////////////////////////
+// Private (static) function declarations
+////////////////////////////////////////////////////////////////////////////////
+
+static void Archive_thread(void *argument);                          // Find log end and write sealed blocks.
+static void archive_mount(void);                                     // Identify device and find log end.
+static void archive_write(uint8_t b);                                // Write sealed buffer to next sector.
+static void archive_seal(uint8_t b);                                 // Hand buffer to archive thread, call with kernel locked.
+static void archive_erase_all(void);                                 // Erase whole device.
+static mod_err_t flash_read(uint32_t addr, uint8_t *data, size_t len); // Read bytes.
+static mod_err_t flash_cmd_addr(uint8_t cmd, uint32_t addr);         // Write enable and send addressed command.
+static mod_err_t flash_program(uint32_t addr, uint8_t const *data);  // Program one page through DMA.
+static mod_err_t flash_wait(uint32_t timeout_ms);                    // Wait until write in progress clears.
+static mod_err_t flash_send(uint8_t const *tx, size_t len, bool release); // Send bytes with chip selected.
+static void archive_header_put(uint8_t b, uint32_t seq);            // Fill block header before writing.
+static cmd_async_status_t dump_step(void *ctx, bool cancel);         // Send next dump frame.
+
+/* Command callback functions */
+static uint32_t cmd_archive_status(uint32_t argc, const char **argv); // Display device and log state.
+static uint32_t cmd_archive_dump(uint32_t argc, const char **argv);   // Send newest blocks as COBS frames.
+static uint32_t cmd_archive_batch(uint32_t argc, const char **argv);  // Show or set batch label.
+static uint32_t cmd_archive_erase(uint32_t argc, const char **argv);  // Erase whole device.
+
+////////////////////////////////////////////////////////////////////////////////
+// Private (static) variables
+////////////////////////////////////////////////////////////////////////////////
+
+/* Archive state, block buffers are read by DMA */
+static archive_t SRAM1_DMA arch;
+
+/* Statically allocated archive thread and bus mutex */
+static osThreadId_t archive_thread_id;
+static StaticTask_t archive_thread_cb;
+static uint64_t SRAM2_BSS archive_stack[ARCHIVE_THREAD_STACK_SZ / sizeof(uint64_t)];
+static osMutexId_t archive_mutex;
+static StaticSemaphore_t archive_mutex_cb;
+
+/* Dump frame, its encoding and progress */
+static archive_dump_t dump;
+static uint8_t dump_frame[FRAME_ENCODED_SIZE(sizeof(archive_dump_t))];
+static archive_dump_ctx_t dump_ctx;
+
+/* Archive command information. */
+static cmd_cmd_info archive_cmds[] = {
+    {.cmd_name = "status",
+     .cb = cmd_archive_status,
+     .help = "Display flash device, log position and dropped records."},
+    {.cmd_name = "dump",
+     .cb = cmd_archive_dump,
+     .help = "Send newest blocks, oldest first, as COBS frames.\r\nUsage: archive dump [blocks]"},
+    {.cmd_name = "batch",
+     .cb = cmd_archive_batch,
+     .help = "Show or set batch label of archived runs, \"-\" clears it.\r\nUsage: archive batch [label]"},
+    {.cmd_name = "erase",
+     .cb = cmd_archive_erase,
+     .help = "Erase whole flash device, takes up to minutes."}};
+
+/* Archive module client info */
+CMD_CLIENT_DEFINE(archive,
+                  .num_cmds = sizeof(archive_cmds) / sizeof(archive_cmds[0]),
+                  .cmds = archive_cmds);
+
+/* Unique tag for archive module. */
+LOG_TAG_DEFINE("ARCHIVE");
+
+////////////////////////////////////////////////////////////////////////////////
+// Public (global) functions
+////////////////////////////////////////////////////////////////////////////////
+
+mod_err_t archive_init(archive_cfg_t const *cfg)
+{
+    arch.cfg = *cfg;
+    arch.used[0] = sizeof(archive_hdr_t);
+    arch.used[1] = sizeof(archive_hdr_t);
+    if (nvs_get(NVS_KEY_ARCHIVE_BATCH, arch.batch, sizeof(arch.batch)) != MOD_OK)
+    {
+        arch.batch[0] = '\0';
+    }
+    arch.batch[ARCHIVE_BATCH_LEN - 1] = '\0';
+
+    static const osMutexAttr_t mutex_attr = {.name = "archive", .cb_mem = &archive_mutex_cb, .cb_size = sizeof(archive_mutex_cb)};
+    archive_mutex = osMutexNew(&mutex_attr);
+    ASSERT(archive_mutex != NULL);
+
+    /* Below every active object, flash writes only use idle time. */
+    static const osThreadAttr_t thread_attr = {.name = "archive",
+                                               .cb_mem = &archive_thread_cb,
+                                               .cb_size = sizeof(archive_thread_cb),
+                                               .stack_mem = archive_stack,
+                                               .stack_size = sizeof(archive_stack),
+                                               .priority = PRIO_ARCHIVE};
+    archive_thread_id = osThreadNew(Archive_thread, NULL, &thread_attr);
+    ASSERT(archive_thread_id != NULL);
+
+    return MOD_OK;
+}
+
+mod_err_t archive_append(const void *rec, size_t len)
+{
+    if (len > ARCHIVE_MAX_RECORD)
+    {
+        return MOD_ERR_ARG;
+    }
+    if (!arch.mounted)
+    {
+        arch.drops++;
+        return MOD_ERR_NOT_INIT;
+    }
+
+    mod_err_t err = MOD_OK;
+    bool sealed = false;
+    osKernelLock(); // Archive thread may seal the fill buffer on flush.
+    uint8_t b = arch.fill;
+    if (arch.used[b] + sizeof(uint16_t) + len > ARCHIVE_BLOCK_SIZE)
+    {
+        if (arch.sealed[b ^ 1U])
+        {
+            err = MOD_ERR_BUF_OVERRUN;
+        }
+        else
+        {
+            archive_seal(b);
+            b ^= 1U;
+            sealed = true;
+        }
+    }
+    if (err == MOD_OK)
+    {
+        uint16_t rec_len = (uint16_t)len;
+        memcpy(&arch.buf[b][arch.used[b]], &rec_len, sizeof(rec_len));
+        memcpy(&arch.buf[b][arch.used[b] + sizeof(rec_len)], rec, len);
+        arch.used[b] += (uint16_t)(sizeof(rec_len) + len);
+    }
+    else
+    {
+        arch.drops++;
+    }
+    osKernelUnlock();
+
+    if (sealed)
+    {
+        osThreadFlagsSet(archive_thread_id, ARCHIVE_BLOCK_FLAG);
+    }
+    return err;
+}
+
+void archive_flush(void)
+{
+    if (arch.mounted)
+    {
+        osThreadFlagsSet(archive_thread_id, ARCHIVE_FLUSH_FLAG);
+    }
+}
+
+const char *archive_batch(void)
+{
+    return arch.batch;
+}
+
+/**
+ * @brief SPI transmit DMA complete callback (overrides HAL weak function).
+ */
+void HAL_SPI_TxCpltCallback(SPI_HandleTypeDef *hspi)
+{
+    if (archive_thread_id != NULL && hspi == arch.cfg.hspi)
+    {
+        osThreadFlagsSet(archive_thread_id, ARCHIVE_DMA_FLAG);
+    }
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Private (static) functions
+////////////////////////////////////////////////////////////////////////////////
+
+/**
+ * @brief Archive thread, finds log end, then writes sealed blocks as they come.
+ */
+static void Archive_thread(void *argument)
+{
+    (void)argument;
+    archive_mount();
+    while (1)
+    {
+        uint32_t flags = osThreadFlagsWait(ARCHIVE_BLOCK_FLAG | ARCHIVE_FLUSH_FLAG | ARCHIVE_ERASE_FLAG,
+                                           osFlagsWaitAny, osWaitForever);
+        if (flags & ARCHIVE_ERASE_FLAG)
+        {
+            archive_erase_all();
+        }
+        if (flags & ARCHIVE_FLUSH_FLAG)
+        {
+            arch.flush_pending = true;
+        }
+
+        /* At most one buffer is sealed at a time, the one not being filled. */
+        while (1)
+        {
+            osKernelLock();
+            uint8_t b = arch.fill;
+            if (!arch.sealed[b ^ 1U] && arch.flush_pending)
+            {
+                arch.flush_pending = false;
+                if (arch.used[b] > sizeof(archive_hdr_t))
+                {
+                    archive_seal(b);
+                }
+            }
+            bool pending = arch.sealed[arch.fill ^ 1U];
+            osKernelUnlock();
+            if (!pending)
+            {
+                break;
+            }
+            archive_write(arch.fill ^ 1U);
+        }
+    }
+}
+
+/**
+ * @brief Identify flash device and continue log after the block with the highest sequence number.
+ */
+static void archive_mount(void)
+{
+    osMutexAcquire(archive_mutex, osWaitForever);
+    uint8_t cmd = FLASH_CMD_JEDEC_ID;
+    uint8_t id[3] = {0};
+    if (flash_send(&cmd, 1, false) == MOD_OK)
+    {
+        HAL_SPI_Receive(arch.cfg.hspi, id, sizeof(id), SPI_TIMEOUT_MS);
+        HAL_GPIO_WritePin(arch.cfg.cs_port, arch.cfg.cs_pin, GPIO_PIN_SET);
+    }
+    arch.jedec_id = ((uint32_t)id[0] << 16) | ((uint32_t)id[1] << 8) | id[2];
+    if (id[0] == 0x00U || id[0] == 0xFFU || id[2] < FLASH_MIN_DENSITY)
+    {
+        osMutexRelease(archive_mutex);
+        LOGW(TAG, "No flash device found (JEDEC ID %06lx), runs are not archived.", arch.jedec_id);
+        return;
+    }
+    uint8_t density = id[2] > FLASH_MAX_DENSITY ? FLASH_MAX_DENSITY : id[2];
+    arch.num_sectors = (1UL << density) / ARCHIVE_BLOCK_SIZE;
+
+    /* Newest block has the highest sequence number, wrapping is taken into account. */
+    bool found = false;
+    uint32_t newest_seq = 0;
+    uint32_t newest_sector = 0;
+    for (uint32_t s = 0; s < arch.num_sectors; s++)
+    {
+        archive_hdr_t hdr;
+        if (flash_read(s * ARCHIVE_BLOCK_SIZE, (uint8_t *)&hdr, sizeof(hdr)) != MOD_OK)
+        {
+            break;
+        }
+        if (hdr.magic == ARCHIVE_MAGIC && (!found || (int32_t)(hdr.seq - newest_seq) > 0))
+        {
+            found = true;
+            newest_seq = hdr.seq;
+            newest_sector = s;
+        }
+    }
+    osMutexRelease(archive_mutex);
+
+    arch.next_sector = found ? (newest_sector + 1U) % arch.num_sectors : 0;
+    arch.next_seq = found ? newest_seq + 1U : 0;
+    arch.mounted = true;
+    LOGI(TAG, "Flash %06lx, %lu sectors, continuing at sector %lu, block %lu.",
+         arch.jedec_id, arch.num_sectors, arch.next_sector, arch.next_seq);
+}
+
+/**
+ * @brief Hand full buffer to archive thread and continue in the other one.
+ *
+ * @param b Buffer being filled, the other one must be free.
+ *
+ * @note Call with kernel locked.
+ */
+static void archive_seal(uint8_t b)
+{
+    arch.sealed[b] = true;
+    arch.used[b ^ 1U] = sizeof(archive_hdr_t);
+    arch.fill = b ^ 1U;
+}
+
+/**
+ * @brief Erase next sector and program sealed buffer into it, then release buffer.
+ *
+ * A failed block is dropped and its sector skipped, the log continues with the next one.
+ *
+ * @param b Sealed buffer.
+ */
+static void archive_write(uint8_t b)
+{
+    uint32_t start = osKernelGetTickCount();
+    uint32_t addr = arch.next_sector * ARCHIVE_BLOCK_SIZE;
+    archive_header_put(b, arch.next_seq);
+
+    power_stop_lock(); // SPI and DMA halt in STOP2.
+    osMutexAcquire(archive_mutex, osWaitForever);
+    mod_err_t err = flash_cmd_addr(FLASH_CMD_SECTOR_ERASE, addr);
+    if (err == MOD_OK)
+    {
+        err = flash_wait(ARCHIVE_ERASE_TIMEOUT_MS);
+    }
+    for (uint32_t page = 0; err == MOD_OK && page * ARCHIVE_PAGE_SIZE < arch.used[b]; page++)
+    {
+        err = flash_program(addr + page * ARCHIVE_PAGE_SIZE, &arch.buf[b][page * ARCHIVE_PAGE_SIZE]);
+    }
+    osMutexRelease(archive_mutex);
+    power_stop_unlock();
+
+    uint32_t elapsed = osKernelGetTickCount() - start;
+    if (elapsed > arch.write_ms_max)
+    {
+        arch.write_ms_max = elapsed;
+    }
+    if (err == MOD_OK)
+    {
+        arch.blocks++;
+    }
+    else
+    {
+        arch.errors++;
+        LOGE(TAG, "Writing block %lu to sector %lu failed (%d).", arch.next_seq, arch.next_sector, err);
+    }
+    arch.next_sector = (arch.next_sector + 1U) % arch.num_sectors;
+    arch.next_seq++;
+    arch.sealed[b] = false;
+}
+
+/**
+ * @brief Fill block header of sealed buffer.
+ *
+ * @param b Sealed buffer.
+ * @param seq Block sequence number.
+ */
+static void archive_header_put(uint8_t b, uint32_t seq)
+{
+    archive_hdr_t hdr = {.magic = ARCHIVE_MAGIC,
+                         .seq = seq,
+                         .used = arch.used[b],
+                         .crc = frame_crc16(&arch.buf[b][sizeof(archive_hdr_t)], arch.used[b] - sizeof(archive_hdr_t))};
+    memcpy(arch.buf[b], &hdr, sizeof(hdr));
+}
+
+/**
+ * @brief Erase whole device and restart the log at sector 0, block sequence continues.
+ */
+static void archive_erase_all(void)
+{
+    LOGI(TAG, "Erasing flash...");
+    power_stop_lock();
+    osMutexAcquire(archive_mutex, osWaitForever);
+    uint8_t cmd[] = {FLASH_CMD_WREN, FLASH_CMD_CHIP_ERASE};
+    mod_err_t err = flash_send(&cmd[0], 1, true);
+    if (err == MOD_OK)
+    {
+        err = flash_send(&cmd[1], 1, true);
+    }
+    if (err == MOD_OK)
+    {
+        err = flash_wait(ARCHIVE_CHIP_ERASE_TIMEOUT_MS);
+    }
+    osMutexRelease(archive_mutex);
+    power_stop_unlock();
+
+    arch.next_sector = 0;
+    if (err == MOD_OK)
+    {
+        LOGI(TAG, "Flash erased.");
+    }
+    else
+    {
+        LOGE(TAG, "Erasing flash failed (%d).", err);
+    }
+}
+
+/**
+ * @brief Read bytes from flash, call with bus mutex held.
+ *
+ * @param addr Flash address.
+ * @param[out] data Bytes read.
+ * @param len Number of bytes.
+ *
+ * @return MOD_OK if successful, MOD_ERR_PERIPH otherwise.
+ */
+static mod_err_t flash_read(uint32_t addr, uint8_t *data, size_t len)
+{
+    uint8_t tx[] = {FLASH_CMD_READ, (uint8_t)(addr >> 16), (uint8_t)(addr >> 8), (uint8_t)addr};
+    mod_err_t err = flash_send(tx, sizeof(tx), false);
+    if (err == MOD_OK && HAL_SPI_Receive(arch.cfg.hspi, data, (uint16_t)len, SPI_TIMEOUT_MS) != HAL_OK)
+    {
+        err = MOD_ERR_PERIPH;
+    }
+    HAL_GPIO_WritePin(arch.cfg.cs_port, arch.cfg.cs_pin, GPIO_PIN_SET);
+    return err;
+}
+
+/**
+ * @brief Enable writes and send erase command with its address, call with bus mutex held.
+ *
+ * @param cmd Command byte.
+ * @param addr Flash address.
+ *
+ * @return MOD_OK if successful, MOD_ERR_PERIPH otherwise.
+ */
+static mod_err_t flash_cmd_addr(uint8_t cmd, uint32_t addr)
+{
+    uint8_t wren = FLASH_CMD_WREN;
+    uint8_t tx[] = {cmd, (uint8_t)(addr >> 16), (uint8_t)(addr >> 8), (uint8_t)addr};
+    mod_err_t err = flash_send(&wren, 1, true);
+    return err == MOD_OK ? flash_send(tx, sizeof(tx), true) : err;
+}
+
+/**
+ * @brief Program one page, its data through TX DMA, and wait until it is programmed.
+ *
+ * The archive thread sleeps during the transfer and while the flash is busy.
+ *
+ * @param addr Page address.
+ * @param data ARCHIVE_PAGE_SIZE bytes.
+ *
+ * @return MOD_OK if successful, MOD_ERR_PERIPH or MOD_ERR_TIMEOUT otherwise.
+ */
+static mod_err_t flash_program(uint32_t addr, uint8_t const *data)
+{
+    uint8_t wren = FLASH_CMD_WREN;
+    uint8_t tx[] = {FLASH_CMD_PAGE_PROG, (uint8_t)(addr >> 16), (uint8_t)(addr >> 8), (uint8_t)addr};
+    mod_err_t err = flash_send(&wren, 1, true);
+    if (err == MOD_OK)
+    {
+        err = flash_send(tx, sizeof(tx), false);
+    }
+    if (err == MOD_OK)
+    {
+        osThreadFlagsClear(ARCHIVE_DMA_FLAG);
+        if (HAL_SPI_Transmit_DMA(arch.cfg.hspi, (uint8_t *)data, ARCHIVE_PAGE_SIZE) != HAL_OK)
+        {
+            err = MOD_ERR_PERIPH;
+        }
+        else if (osThreadFlagsWait(ARCHIVE_DMA_FLAG, osFlagsWaitAny, ARCHIVE_PAGE_TIMEOUT_MS) != ARCHIVE_DMA_FLAG)
+        {
+            HAL_SPI_Abort(arch.cfg.hspi);
+            err = MOD_ERR_TIMEOUT;
+        }
+    }
+    HAL_GPIO_WritePin(arch.cfg.cs_port, arch.cfg.cs_pin, GPIO_PIN_SET);
+    return err == MOD_OK ? flash_wait(ARCHIVE_PAGE_TIMEOUT_MS) : err;
+}
+
+/**
+ * @brief Poll status register until write in progress clears, sleeping between polls.
+ *
+ * @param timeout_ms Longest wait (ms).
+ *
+ * @return MOD_OK if flash is ready, MOD_ERR_TIMEOUT or MOD_ERR_PERIPH otherwise.
+ */
+static mod_err_t flash_wait(uint32_t timeout_ms)
+{
+    uint8_t cmd = FLASH_CMD_RDSR;
+    for (uint32_t waited = 0;; waited++)
+    {
+        uint8_t sr = FLASH_SR_WIP;
+        mod_err_t err = flash_send(&cmd, 1, false);
+        if (err == MOD_OK && HAL_SPI_Receive(arch.cfg.hspi, &sr, 1, SPI_TIMEOUT_MS) != HAL_OK)
+        {
+            err = MOD_ERR_PERIPH;
+        }
+        HAL_GPIO_WritePin(arch.cfg.cs_port, arch.cfg.cs_pin, GPIO_PIN_SET);
+        if (err != MOD_OK || !(sr & FLASH_SR_WIP))
+        {
+            return err;
+        }
+        if (waited >= timeout_ms)
+        {
+            return MOD_ERR_TIMEOUT;
+        }
+        osDelay(1);
+    }
+}
+
+/**
+ * @brief Select chip and send bytes by polling.
+ *
+ * @param tx Bytes to send.
+ * @param len Number of bytes.
+ * @param release Deselect chip afterwards, otherwise it stays selected for the data phase.
+ *
+ * @return MOD_OK if successful, MOD_ERR_PERIPH otherwise (chip deselected).
+ */
+static mod_err_t flash_send(uint8_t const *tx, size_t len, bool release)
+{
+    HAL_GPIO_WritePin(arch.cfg.cs_port, arch.cfg.cs_pin, GPIO_PIN_RESET);
+    HAL_StatusTypeDef status = HAL_SPI_Transmit(arch.cfg.hspi, (uint8_t *)tx, (uint16_t)len, SPI_TIMEOUT_MS);
+    if (release || status != HAL_OK)
+    {
+        HAL_GPIO_WritePin(arch.cfg.cs_port, arch.cfg.cs_pin, GPIO_PIN_SET);
+    }
+    return status == HAL_OK ? MOD_OK : MOD_ERR_PERIPH;
+}
+
+/**
+ * @brief Display flash device, log position and statistics.
+ *
+ * @param argc Number of arguments.
+ * @param argv Argument values.
+ *
+ * @return 0 if successful.
+ */
+static uint32_t cmd_archive_status(uint32_t argc, const char **argv)
+{
+    cmd_out_str("state", arch.mounted ? "ready" : (arch.num_sectors == 0 ? "no device" : "mounting"));
+    cmd_out_u32("jedec id", arch.jedec_id);
+    cmd_out_u32("sectors", arch.num_sectors);
+    cmd_out_u32("next sector", arch.next_sector);
+    cmd_out_u32("next block", arch.next_seq);
+    cmd_out_u32("buffered bytes", arch.used[arch.fill] - sizeof(archive_hdr_t));
+    cmd_out_u32("blocks written", arch.blocks);
+    cmd_out_u32("records dropped", arch.drops);
+    cmd_out_u32("write errors", arch.errors);
+    cmd_out_u32("write ms max", arch.write_ms_max);
+    cmd_out_str("batch", arch.batch);
+    return 0;
+}
+
+/**
+ * @brief Send newest written blocks, oldest first, as COBS frames, one per command step.
+ *
+ * @param argc Number of arguments.
+ * @param argv Argument values.
+ *
+ * @return 0 if successful, 1 otherwise.
+ */
+static uint32_t cmd_archive_dump(uint32_t argc, const char **argv)
+{
+    uint32_t count = argc == 1 ? strtoul(argv[0], NULL, 0) : 1U;
+    if (!arch.mounted)
+    {
+        LOG("No flash device\r\n");
+        return 1;
+    }
+    if (argc > 1 || count == 0)
+    {
+        LOG("Format: archive dump [blocks]\r\n");
+        return 1;
+    }
+
+    uint32_t const left = count < arch.num_sectors ? count : arch.num_sectors;
+    dump_ctx = (archive_dump_ctx_t){.sector = (arch.next_sector + arch.num_sectors - left) % arch.num_sectors,
+                                    .left = left};
+    return cmd_async_start(dump_step, &dump_ctx) == MOD_OK ? 0 : 1;
+}
+
+/**
+ * @brief Show or set batch label, stored with parameters.
+ *
+ * @param argc Number of arguments.
+ * @param argv Argument values.
+ *
+ * @return 0 if successful, 1 otherwise.
+ */
+static uint32_t cmd_archive_batch(uint32_t argc, const char **argv)
+{
+    if (argc > 1)
+    {
+        LOG("Format: archive batch [label]\r\n");
+        return 1;
+    }
+    if (argc == 1)
+    {
+        char batch[ARCHIVE_BATCH_LEN] = {0};
+        if (strcmp(argv[0], "-") != 0)
+        {
+            strncpy(batch, argv[0], ARCHIVE_BATCH_LEN - 1);
+        }
+        memcpy(arch.batch, batch, sizeof(batch)); // Read by reflow thread at run start only.
+        if (nvs_set(NVS_KEY_ARCHIVE_BATCH, batch, sizeof(batch)) != MOD_OK)
+        {
+            LOGW(TAG, "Batch label will not persist across resets.");
+        }
+    }
+    LOG("Batch: %s\r\n", arch.batch[0] != '\0' ? arch.batch : "(none)");
+    return 0;
+}
+
+/**
+ * @brief Erase whole device in archive thread.
+ *
+ * @param argc Number of arguments.
+ * @param argv Argument values.
+ *
+ * @return 0 if successful, 1 otherwise.
+ */
+static uint32_t cmd_archive_erase(uint32_t argc, const char **argv)
+{
+    if (!arch.mounted)
+    {
+        LOG("No flash device\r\n");
+        return 1;
+    }
+    osThreadFlagsSet(archive_thread_id, ARCHIVE_ERASE_FLAG);
+    return 0;
+}
+
+/**
+ * @brief Send next dump frame, or read the header of the next sector.
+ *
+ * A step reads at most one header or one chunk, and never waits: while the archive thread
+ * writes a block, or the frame does not fit the transmit buffer, it is retried on the next
+ * step. Never written or erased sectors are skipped.
+ *
+ * @param ctx Dump progress, archive_dump_ctx_t.
+ * @param cancel Stop the dump.
+ *
+ * @return CMD_ASYNC_MORE until every sector was visited.
+ */
+static cmd_async_status_t dump_step(void *ctx, bool cancel)
+{
+    archive_dump_ctx_t *const d = ctx;
+    if (cancel)
+    {
+        LOG("Dump cancelled after %lu blocks\r\n", d->sent);
+        return CMD_ASYNC_DONE;
+    }
+    if (d->used == 0 && d->left == 0)
+    {
+        LOG("Dumped %lu blocks\r\n", d->sent);
+        return CMD_ASYNC_DONE;
+    }
+    if (osMutexAcquire(archive_mutex, 0U) != osOK)
+    {
+        return CMD_ASYNC_MORE;
+    }
+
+    if (d->used == 0)
+    {
+        archive_hdr_t hdr;
+        d->addr = d->sector * ARCHIVE_BLOCK_SIZE;
+        d->sector = (d->sector + 1U) % arch.num_sectors;
+        d->left--;
+        mod_err_t err = flash_read(d->addr, (uint8_t *)&hdr, sizeof(hdr));
+        osMutexRelease(archive_mutex);
+        if (err == MOD_OK && hdr.magic == ARCHIVE_MAGIC && hdr.used <= ARCHIVE_BLOCK_SIZE)
+        {
+            d->seq = hdr.seq;
+            d->used = hdr.used;
+            d->offset = 0;
+        }
+        return CMD_ASYNC_MORE;
+    }
+
+    uint32_t const n = d->used - d->offset < ARCHIVE_DUMP_CHUNK ? d->used - d->offset : ARCHIVE_DUMP_CHUNK;
+    mod_err_t err = flash_read(d->addr + d->offset, dump.data, n);
+    osMutexRelease(archive_mutex);
+    if (err != MOD_OK)
+    {
+        LOG("Dump aborted after %lu blocks\r\n", d->sent);
+        return CMD_ASYNC_DONE;
+    }
+
+    dump.type = ARCHIVE_DUMP_TYPE;
+    dump.seq = d->seq;
+    dump.offset = (uint16_t)d->offset;
+    size_t len = frame_encode((const uint8_t *)&dump, offsetof(archive_dump_t, data) + n, dump_frame, sizeof(dump_frame));
+    if (console_write((const char *)dump_frame, len) != MOD_OK)
+    {
+        return CMD_ASYNC_MORE; // Frame is committed whole, chunk is read again.
+    }
+    d->offset += n;
+    if (d->offset >= d->used)
+    {
+        d->used = 0;
+        d->sent++;
+    }
+    return CMD_ASYNC_MORE;
+}
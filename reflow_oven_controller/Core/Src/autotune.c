@@ -0,0 +1,108 @@
+/**
+ * @file autotune.c
+ * @author Timothy Nguyen
+ * @brief Relay-feedback PID autotuner.
+ * @version 0.1
+ * @date 2021-08-14
+ */
+
+#include <math.h>
+
+#include "autotune.h"
+#include "log.h"
+
+/* Ziegler–Nichols classic PID rules from ultimate gain and period. */
+#define ZN_KP(Ku, Tu) (0.6f * (Ku))
+#define ZN_KI(Ku, Tu) (1.2f * (Ku) / (Tu))
+#define ZN_KD(Ku, Tu) (0.075f * (Ku) * (Tu))
+
+/* Derive ultimate gain and period from averaged limit cycles. */
+static inline void autotune_finish(Autotune_t * const at)
+{
+	uint8_t n = at->cfg.num_cycles;
+	float a = at->sum_amplitude / (float)n;
+	float h = at->cfg.hysteresis;
+	float d = 0.5f * (at->cfg.out_high - at->cfg.out_low);
+
+	/* Describing function of a relay with hysteresis, falls back to ideal relay if a is within band. */
+	float a_eff = (a > h) ? sqrtf(a * a - h * h) : a;
+	at->Ku = 4.0f * d / ((float)M_PI * a_eff);
+	at->Tu = at->sum_period / (float)n;
+	at->gains.Kp = ZN_KP(at->Ku, at->Tu);
+	at->gains.Ki = ZN_KI(at->Ku, at->Tu);
+	at->gains.Kd = ZN_KD(at->Ku, at->Tu);
+	at->gains.Kff = 0.0f;
+	at->status = AUTOTUNE_DONE;
+}
+
+void Autotune_Init(Autotune_t * const at, Autotune_cfg_t const * const cfg)
+{
+	ASSERT(cfg->num_cycles > 0 && cfg->out_high > cfg->out_low && cfg->hysteresis >= 0.0f);
+
+	at->cfg = *cfg;
+	at->status = AUTOTUNE_RUNNING;
+	at->out = cfg->out_high;
+	at->time = 0.0f;
+	at->last_rise = -1.0f;
+	at->peak_max = -INFINITY;
+	at->peak_min = INFINITY;
+	at->cycles = 0;
+	at->sum_period = 0.0f;
+	at->sum_amplitude = 0.0f;
+}
+
+Autotune_status_t Autotune_Step(Autotune_t * const at, float measurement, float Ts)
+{
+	if (at->status != AUTOTUNE_RUNNING)
+	{
+		return at->status;
+	}
+
+	at->time += Ts;
+	if (measurement >= at->cfg.limit)
+	{
+		at->out = at->cfg.out_low;
+		at->status = AUTOTUNE_ERR_LIMIT;
+		return at->status;
+	}
+	if (at->time >= at->cfg.timeout)
+	{
+		at->out = at->cfg.out_low;
+		at->status = AUTOTUNE_ERR_TIMEOUT;
+		return at->status;
+	}
+
+	/* Peaks are only meaningful once the first rising switch starts a full cycle. */
+	if (at->last_rise >= 0.0f)
+	{
+		at->peak_max = fmaxf(at->peak_max, measurement);
+		at->peak_min = fminf(at->peak_min, measurement);
+	}
+
+	if (at->out == at->cfg.out_high && measurement > at->cfg.setpoint + at->cfg.hysteresis)
+	{
+		at->out = at->cfg.out_low;
+	}
+	else if (at->out == at->cfg.out_low && measurement < at->cfg.setpoint - at->cfg.hysteresis)
+	{
+		/* Rising switch ends one limit cycle and starts the next. */
+		at->out = at->cfg.out_high;
+		if (at->last_rise >= 0.0f)
+		{
+			if (++at->cycles > AUTOTUNE_SETTLE_CYCLES)
+			{
+				at->sum_period += at->time - at->last_rise;
+				at->sum_amplitude += 0.5f * (at->peak_max - at->peak_min);
+			}
+			if (at->cycles >= AUTOTUNE_SETTLE_CYCLES + at->cfg.num_cycles)
+			{
+				autotune_finish(at);
+			}
+		}
+		at->last_rise = at->time;
+		at->peak_max = measurement;
+		at->peak_min = measurement;
+	}
+
+	return at->status;
+}
@@ -0,0 +1,1018 @@
+/**
+ * @file bench.c
+ * @author Timothy Nguyen
+ * @brief On-target micro-benchmarks of hot paths, measured with the DWT cycle counter.
+ * @version 0.1
+ * @date 2021-08-31
+ */
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "bench.h"
+#include "active.h"
+#include "cmd.h"
+#include "filter.h"
+#include "console.h"
+#include "log.h"
+#include "pid.h"
+#include "printf.h"
+#include "prio.h"
+#include "sections.h"
+#include "uart.h"
+#include "wdg.h"
+#include "cmsis_os.h"
+#include "stm32l4xx.h"
+
+////////////////////////////////////////////////////////////////////////////////
+// Common macros
+////////////////////////////////////////////////////////////////////////////////
+
+#define BENCH_REPLY_FLAG 0x0100U                  // Thread flag set once bench active object handled ping.
+#define BENCH_BUDGET_MS (WDG_AO_TIMEOUT_MS / 2U) // Longest run of one "bench run" command (ms).
+
+////////////////////////////////////////////////////////////////////////////////
+// Type definitions
+////////////////////////////////////////////////////////////////////////////////
+
+/* Bench active object signals, only posted directly. */
+enum BenchSignal
+{
+    BENCH_PING_SIG = USER_SIG, // Round trip request, answered with BENCH_REPLY_FLAG.
+    BENCH_TIMEOUT_SIG,         // Expiry of benchmark time events, never expected.
+    BENCH_PONG_SIG,            // Ping-pong event of "bench ao", forwarded to peer.
+};
+
+/* Bench active object */
+typedef struct Bench_Active
+{
+    Active base; // Inherited base Active object class.
+
+    osThreadId_t waiter;       // Thread waiting for ping to be handled.
+    struct Bench_Active *peer; // Active object ping-pong events are forwarded to.
+} Bench_Active;
+
+/* Ping-pong event, allocated from event pool and passed back and forth */
+typedef struct
+{
+    Event base;        // Inherit base Event class.
+    uint32_t post_cyc; // Cycle counter when last posted.
+} Bench_Pong_Event;
+
+/* Ping-pong run of "bench ao", shared by both active objects of a pair */
+typedef struct
+{
+    osThreadId_t waiter;          // Thread waiting for every event to retire.
+    volatile uint32_t remaining;  // Forwards left to make.
+    volatile uint32_t in_flight;  // Events not yet retired.
+    volatile uint32_t dispatched; // Events handled.
+    volatile uint32_t full;       // Posts refused by a full queue.
+    volatile uint32_t end_cyc;    // Cycle counter when last event retired.
+    cmd_pm_hist_t latency;        // Post to dispatch latency (CPU cycles).
+} bench_pong_t;
+
+/* Benchmark */
+typedef struct
+{
+    const char *name;                    // Benchmark name.
+    uint32_t iterations;                 // Default number of iterations.
+    mod_err_t (*setup)(void);            // Prepare benchmark, NULL if not needed.
+    mod_err_t (*run)(uint32_t *cycles);  // Run one iteration, measuring only the hot path.
+    void (*teardown)(void);              // Undo setup, NULL if not needed.
+} bench_t;
+
+////////////////////////////////////////////////////////////////////////////////
+// Private (static) function declarations
+////////////////////////////////////////////////////////////////////////////////
+
+static void bench_evt_handler(Bench_Active *const ao, Event const *const evt); // Event handler.
+static bool bench_run(bench_t const *const bench, uint32_t iterations, uint32_t deadline); // Run and report benchmark.
+
+/* Benchmarks */
+static mod_err_t bench_pid_setup(void);               // Initialize controller.
+static mod_err_t bench_pid(uint32_t *cycles);         // PID_Calculate().
+static mod_err_t bench_pid_inc_setup(void);           // Initialize incremental form controller.
+static mod_err_t bench_filter_setup(void);            // Initialize filter with alpha IIR.
+static mod_err_t bench_biquad_setup(void);            // Initialize filter with Butterworth biquad.
+static mod_err_t bench_filter(uint32_t *cycles);      // Filter_Update().
+static mod_err_t bench_printf(uint32_t *cycles);      // snprintf_() with "%.2f".
+static mod_err_t bench_log_miss_setup(void);          // Check that LOGD() is filtered.
+static mod_err_t bench_log_miss(uint32_t *cycles);    // Filtered LOGD().
+static mod_err_t bench_log_hit_setup(void);           // Select null log sink.
+static mod_err_t bench_log_hit(uint32_t *cycles);     // Printed LOGI().
+static void bench_log_hit_teardown(void);             // Restore log sink.
+static mod_err_t bench_tokenize(uint32_t *cycles);    // cmd_tokenize().
+#if !ACTIVE_COOPERATIVE
+static mod_err_t bench_ao_trip_setup(void);           // Register waiting thread.
+static mod_err_t bench_ao_trip(uint32_t *cycles);     // Active_post() until handled.
+static mod_err_t bench_ao_ring(uint32_t *cycles);     // Active_post() to notification ring until handled.
+static mod_err_t bench_ping(Bench_Active *const ao, uint32_t *cycles); // Round trip to active object.
+static void bench_pong(Bench_Active *const ao, Bench_Pong_Event *const evt); // Forward ping-pong event to peer.
+static void bench_pong_retire(bool full);             // Retire ping-pong event.
+static bool bench_pong_run(const char *name, Bench_Active *const ao, uint32_t trips, uint32_t burst,
+                           uint32_t timeout);         // Run and report ping-pong between ao and its peer.
+#endif
+static mod_err_t bench_tevt_setup(void);              // Arm BENCH_NUM_TIMERS time events.
+static mod_err_t bench_tevt(uint32_t *cycles);        // TimeEvent_arm() and TimeEvent_disarm().
+static void bench_tevt_teardown(void);                // Disarm time events.
+#if CONSOLE_UART
+static mod_err_t bench_putc(uint32_t *cycles);        // uart_putc() per character.
+static mod_err_t bench_write(uint32_t *cycles);       // uart_write() of whole block.
+static void bench_tx_drain(void);                     // Wait for transmit buffer to drain.
+#endif
+
+/* Command callback functions */
+static uint32_t cmd_bench_list(uint32_t argc, const char **argv); // List benchmarks.
+static uint32_t cmd_bench_run(uint32_t argc, const char **argv);  // Run benchmarks.
+#if !ACTIVE_COOPERATIVE
+static uint32_t cmd_bench_ao(uint32_t argc, const char **argv);   // Run ping-pong between active objects.
+#endif
+
+////////////////////////////////////////////////////////////////////////////////
+// Private (static) variables
+////////////////////////////////////////////////////////////////////////////////
+
+/* Bench active objects, on message queues and on notification rings, with ping-pong peers. */
+static Bench_Active bench_ao;
+static Bench_Active bench_ring_ao;
+static Bench_Active bench_peer_ao;
+static Bench_Active bench_ring_peer_ao;
+
+/* Statically allocated threads, event queue and event ring */
+static StaticTask_t bench_thread_cb;
+static uint64_t SRAM2_BSS bench_stack[ACTIVE_STACK_STORAGE_SZ(BENCH_THREAD_STACK_SZ) / sizeof(uint64_t)];
+static StaticQueue_t bench_queue_cb;
+static Active_msg bench_queue_mem[BENCH_EVENT_MSG_COUNT];
+static StaticTask_t bench_ring_thread_cb;
+static uint64_t SRAM2_BSS bench_ring_stack[ACTIVE_STACK_STORAGE_SZ(BENCH_THREAD_STACK_SZ) / sizeof(uint64_t)];
+static Active_msg bench_ring[BENCH_EVENT_MSG_COUNT];
+static StaticTask_t bench_peer_thread_cb;
+static uint64_t SRAM2_BSS bench_peer_stack[ACTIVE_STACK_STORAGE_SZ(BENCH_THREAD_STACK_SZ) / sizeof(uint64_t)];
+static StaticQueue_t bench_peer_queue_cb;
+static Active_msg bench_peer_queue_mem[BENCH_EVENT_MSG_COUNT];
+static StaticTask_t bench_ring_peer_thread_cb;
+static uint64_t SRAM2_BSS bench_ring_peer_stack[ACTIVE_STACK_STORAGE_SZ(BENCH_THREAD_STACK_SZ) / sizeof(uint64_t)];
+static Active_msg bench_ring_peer[BENCH_EVENT_MSG_COUNT];
+
+#if !ACTIVE_COOPERATIVE
+/* Static events */
+static const Event ping_evt = {.sig = BENCH_PING_SIG};
+
+/* Ping-pong run in progress */
+static bench_pong_t pong;
+#endif
+
+/* Benchmark table */
+static const bench_t benches[] = {
+    {.name = "pid", .iterations = 1000, .setup = bench_pid_setup, .run = bench_pid},
+    {.name = "pid_inc", .iterations = 1000, .setup = bench_pid_inc_setup, .run = bench_pid},
+    {.name = "filter", .iterations = 1000, .setup = bench_filter_setup, .run = bench_filter},
+    {.name = "biquad", .iterations = 1000, .setup = bench_biquad_setup, .run = bench_filter},
+    {.name = "printf", .iterations = 1000, .run = bench_printf},
+    {.name = "log_miss", .iterations = 1000, .setup = bench_log_miss_setup, .run = bench_log_miss},
+    {.name = "log_hit", .iterations = 64, .setup = bench_log_hit_setup, .run = bench_log_hit,
+     .teardown = bench_log_hit_teardown},
+    {.name = "tokenize", .iterations = 1000, .run = bench_tokenize},
+#if !ACTIVE_COOPERATIVE
+    {.name = "ao_trip", .iterations = 1000, .setup = bench_ao_trip_setup, .run = bench_ao_trip},
+    {.name = "ao_ring", .iterations = 1000, .setup = bench_ao_trip_setup, .run = bench_ao_ring},
+#endif
+    {.name = "tevt_arm", .iterations = 1000, .setup = bench_tevt_setup, .run = bench_tevt,
+     .teardown = bench_tevt_teardown},
+#if CONSOLE_UART
+    {.name = "putc", .iterations = 16, .run = bench_putc},
+    {.name = "write", .iterations = 16, .run = bench_write},
+#endif
+};
+
+/* Benchmark state */
+static PID_t pid;                            // Controller of pid benchmark.
+static uint32_t pid_step;                    // Iteration of pid benchmark, varies measurement.
+static Filter_t filt;                        // Filter of filter benchmarks.
+static char fmt_buf[16];                     // Output of printf benchmark.
+static log_sink_t saved_sink;                // Log sink before log_hit benchmark.
+static uint32_t log_hits;                    // Iteration of log_hit benchmark.
+static const char *tokens[CMD_MAX_TOKENS];   // Tokens of tokenize benchmark.
+static TimeEvent timers[BENCH_NUM_TIMERS];   // Armed time events of tevt_arm benchmark.
+static TimeEvent probe;                      // Time event armed and disarmed by tevt_arm benchmark.
+static volatile float result;                // Keeps results of benchmarked calls alive.
+
+/* Command line of tokenize benchmark */
+static const char token_line[] = "reflow set Kp=100 Ki=1.5 Kd=20 tau=2";
+
+#if CONSOLE_UART
+/* Characters of output benchmarks, space and backspace pairs leave no trace on a terminal. */
+static const char tx_chars[BENCH_TX_LEN] = " \b \b \b \b";
+#endif
+
+/* Bench command information. */
+static cmd_cmd_info bench_cmds[] = {
+    {.cmd_name = "list",
+     .cb = cmd_bench_list,
+     .help = "List benchmarks and their default number of iterations."},
+    {.cmd_name = "run",
+     .cb = cmd_bench_run,
+     .help = "Run benchmarks and display CPU cycles per iteration, usage: bench run [name|all] [iterations]."},
+#if !ACTIVE_COOPERATIVE
+    {.cmd_name = "ao",
+     .cb = cmd_bench_ao,
+     .help = "Pass events back and forth between two active objects, on message queues and on notification rings.\r\n"
+             "Displays events per second, post to dispatch latency and posts refused by a full queue,\r\n"
+             "with burst events in flight at once. Usage: bench ao [round trips] [burst]"},
+#endif
+};
+
+/* Bench module client info */
+CMD_CLIENT_DEFINE(bench,
+                  .num_cmds = sizeof(bench_cmds) / sizeof(bench_cmds[0]),
+                  .cmds = bench_cmds);
+
+/* Unique tag for bench module. */
+LOG_TAG_DEFINE("BENCH");
+
+////////////////////////////////////////////////////////////////////////////////
+// Public (global) functions
+////////////////////////////////////////////////////////////////////////////////
+
+mod_err_t bench_init(void)
+{
+    mod_err_t err = Active_ctor((Active *)&bench_ao, (EventHandler)bench_evt_handler);
+    if (err != MOD_OK)
+    {
+        return err;
+    }
+
+    /* At control priority, above command thread, so a ping is handled as soon as it is posted. */
+    static const osThreadAttr_t thread_attr = {.name = "bench",
+                                               .cb_mem = &bench_thread_cb,
+                                               .cb_size = sizeof(bench_thread_cb),
+                                               .stack_mem = bench_stack,
+                                               .stack_size = sizeof(bench_stack)};
+    static const osMessageQueueAttr_t queue_attr = {.cb_mem = &bench_queue_cb,
+                                                    .cb_size = sizeof(bench_queue_cb),
+                                                    .mq_mem = bench_queue_mem,
+                                                    .mq_size = sizeof(bench_queue_mem)};
+    err = Active_start((Active *)&bench_ao, PRIO_CONTROL, &thread_attr, BENCH_EVENT_MSG_COUNT, &queue_attr);
+    if (err != MOD_OK)
+    {
+        return err;
+    }
+
+    /* Same handler and priority, posts go through a notification ring instead. */
+    err = Active_ctor((Active *)&bench_ring_ao, (EventHandler)bench_evt_handler);
+    if (err != MOD_OK)
+    {
+        return err;
+    }
+    static const osThreadAttr_t ring_thread_attr = {.name = "bench ring",
+                                                    .cb_mem = &bench_ring_thread_cb,
+                                                    .cb_size = sizeof(bench_ring_thread_cb),
+                                                    .stack_mem = bench_ring_stack,
+                                                    .stack_size = sizeof(bench_ring_stack)};
+    err = Active_start_ring((Active *)&bench_ring_ao, PRIO_CONTROL, &ring_thread_attr, bench_ring, BENCH_EVENT_MSG_COUNT);
+    if (err != MOD_OK)
+    {
+        return err;
+    }
+
+    /* Ping-pong peers, one per backend at the same priority. */
+    err = Active_ctor((Active *)&bench_peer_ao, (EventHandler)bench_evt_handler);
+    if (err != MOD_OK)
+    {
+        return err;
+    }
+    static const osThreadAttr_t peer_thread_attr = {.name = "bench peer",
+                                                    .cb_mem = &bench_peer_thread_cb,
+                                                    .cb_size = sizeof(bench_peer_thread_cb),
+                                                    .stack_mem = bench_peer_stack,
+                                                    .stack_size = sizeof(bench_peer_stack)};
+    static const osMessageQueueAttr_t peer_queue_attr = {.cb_mem = &bench_peer_queue_cb,
+                                                         .cb_size = sizeof(bench_peer_queue_cb),
+                                                         .mq_mem = bench_peer_queue_mem,
+                                                         .mq_size = sizeof(bench_peer_queue_mem)};
+    err = Active_start((Active *)&bench_peer_ao, PRIO_CONTROL, &peer_thread_attr, BENCH_EVENT_MSG_COUNT, &peer_queue_attr);
+    if (err != MOD_OK)
+    {
+        return err;
+    }
+
+    err = Active_ctor((Active *)&bench_ring_peer_ao, (EventHandler)bench_evt_handler);
+    if (err != MOD_OK)
+    {
+        return err;
+    }
+    static const osThreadAttr_t ring_peer_thread_attr = {.name = "bench ring peer",
+                                                         .cb_mem = &bench_ring_peer_thread_cb,
+                                                         .cb_size = sizeof(bench_ring_peer_thread_cb),
+                                                         .stack_mem = bench_ring_peer_stack,
+                                                         .stack_size = sizeof(bench_ring_peer_stack)};
+    err = Active_start_ring((Active *)&bench_ring_peer_ao, PRIO_CONTROL, &ring_peer_thread_attr, bench_ring_peer, BENCH_EVENT_MSG_COUNT);
+    if (err != MOD_OK)
+    {
+        return err;
+    }
+    bench_ao.peer = &bench_peer_ao;
+    bench_peer_ao.peer = &bench_ao;
+    bench_ring_ao.peer = &bench_ring_peer_ao;
+    bench_ring_peer_ao.peer = &bench_ring_ao;
+
+    LOGI(TAG, "Initialized bench module");
+    return MOD_OK;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Private (static) functions
+////////////////////////////////////////////////////////////////////////////////
+
+/**
+ * @brief Bench active object event handler, answers pings and forwards ping-pong events.
+ *
+ * @param ao Bench active object.
+ * @param evt Event.
+ */
+static void bench_evt_handler(Bench_Active *const ao, Event const *const evt)
+{
+    if (evt->sig == BENCH_PING_SIG && ao->waiter != NULL)
+    {
+        osThreadFlagsSet(ao->waiter, BENCH_REPLY_FLAG);
+    }
+#if !ACTIVE_COOPERATIVE
+    else if (evt->sig == BENCH_PONG_SIG)
+    {
+        bench_pong(ao, (Bench_Pong_Event *)evt);
+    }
+#endif
+}
+
+/**
+ * @brief Run benchmark and print its row of cycle statistics.
+ *
+ * @param bench Benchmark.
+ * @param iterations Number of iterations.
+ * @param deadline Kernel tick at which remaining iterations are skipped.
+ *
+ * @return true if all iterations ran, false if benchmark failed or ran out of time.
+ */
+static bool bench_run(bench_t const *const bench, uint32_t iterations, uint32_t deadline)
+{
+    if (bench->setup != NULL && bench->setup() != MOD_OK)
+    {
+        LOG("%-10s %10s\r\n", bench->name, "skipped");
+        return false;
+    }
+
+    uint32_t count = 0;
+    uint32_t min = UINT32_MAX;
+    uint32_t max = 0;
+    uint64_t total = 0;
+    mod_err_t err = MOD_OK;
+    while (count < iterations && (int32_t)(osKernelGetTickCount() - deadline) < 0)
+    {
+        uint32_t cycles;
+        err = bench->run(&cycles);
+        if (err != MOD_OK)
+        {
+            break;
+        }
+        count++;
+        total += cycles;
+        min = cycles < min ? cycles : min;
+        max = cycles > max ? cycles : max;
+    }
+
+    if (bench->teardown != NULL)
+    {
+        bench->teardown();
+    }
+
+    uint32_t avg = count ? (uint32_t)(total / count) : 0;
+    LOG("%-10s %10lu %10lu %10lu %10lu %10.2f%s\r\n",
+        bench->name,
+        count,
+        count ? min : 0,
+        max,
+        avg,
+        avg * 1e6f / SystemCoreClock,
+        err != MOD_OK ? " (failed)" : count < iterations ? " (out of time)" : "");
+    return err == MOD_OK && count == iterations;
+}
+
+/**
+ * @brief Initialize controller of pid benchmark with the reflow controller's sample time.
+ *
+ * @return MOD_OK.
+ */
+static mod_err_t bench_pid_setup(void)
+{
+    static const PID_cfg_t cfg = {.Kp = 100.0f, .Ki = 1.5f, .Kd = 20.0f, .tau = 2.0f, .Ts = 0.5f,
+                                  .out_max = 4095.0f, .out_min = 0.0f, .b = 1.0f};
+    PID_Init(&pid, &cfg);
+    pid_step = 0;
+    return MOD_OK;
+}
+
+/**
+ * @brief Initialize incremental form controller with the gains of the pid benchmark.
+ *
+ * @return MOD_OK.
+ */
+static mod_err_t bench_pid_inc_setup(void)
+{
+    static const PID_cfg_t cfg = {.Kp = 100.0f, .Ki = 1.5f, .Kd = 20.0f, .tau = 2.0f, .Ts = 0.5f,
+                                  .out_max = 4095.0f, .out_min = 0.0f, .b = 1.0f,
+                                  .form = PID_FORM_INCREMENTAL};
+    PID_Init(&pid, &cfg);
+    pid_step = 0;
+    return MOD_OK;
+}
+
+/**
+ * @brief Initialize thermocouple filter with median, outlier rejection and alpha IIR.
+ *
+ * @return MOD_OK.
+ */
+static mod_err_t bench_filter_setup(void)
+{
+    static const Filter_cfg_t cfg = {.median_len = 3, .alpha = 0.5f, .outlier_limit = 20.0f};
+    Filter_Init(&filt, &cfg);
+    pid_step = 0;
+    return MOD_OK;
+}
+
+/**
+ * @brief Initialize thermocouple filter with a 0.2 Hz Butterworth biquad in place of the IIR.
+ *
+ * @return MOD_OK.
+ */
+static mod_err_t bench_biquad_setup(void)
+{
+    Filter_cfg_t cfg = {.median_len = 3, .alpha = 0.5f, .outlier_limit = 20.0f};
+    if (!Filter_LowPass(&cfg, 0.2f, 0.5f))
+    {
+        return MOD_ERR_ARG;
+    }
+    Filter_Init(&filt, &cfg);
+    pid_step = 0;
+    return MOD_OK;
+}
+
+/**
+ * @brief Measure Filter_Update() with a reading that changes every iteration.
+ *
+ * @param[out] cycles Elapsed cycles.
+ *
+ * @return MOD_OK.
+ */
+static mod_err_t bench_filter(uint32_t *cycles)
+{
+    float reading = 150.0f + (float)(pid_step++ & 0xFU);
+
+    uint32_t start = DWT->CYCCNT;
+    float out = Filter_Update(&filt, reading);
+    *cycles = DWT->CYCCNT - start;
+
+    result = out;
+    return MOD_OK;
+}
+
+/**
+ * @brief Measure PID_Calculate() with a measurement that changes every iteration.
+ *
+ * @param[out] cycles Elapsed cycles.
+ *
+ * @return MOD_OK.
+ */
+static mod_err_t bench_pid(uint32_t *cycles)
+{
+    float measurement = 150.0f + (float)(pid_step++ & 0xFU);
+
+    uint32_t start = DWT->CYCCNT;
+    float out = PID_Calculate(&pid, 160.0f, measurement);
+    *cycles = DWT->CYCCNT - start;
+
+    result = out;
+    return MOD_OK;
+}
+
+/**
+ * @brief Measure formatting of a float with "%.2f" into a buffer.
+ *
+ * @param[out] cycles Elapsed cycles.
+ *
+ * @return MOD_OK.
+ */
+static mod_err_t bench_printf(uint32_t *cycles)
+{
+    float val = result + 183.25f;
+
+    uint32_t start = DWT->CYCCNT;
+    snprintf_(fmt_buf, sizeof(fmt_buf), "%.2f", val);
+    *cycles = DWT->CYCCNT - start;
+
+    return MOD_OK;
+}
+
+/**
+ * @brief Check that debug messages of bench tag are filtered out.
+ *
+ * @return MOD_OK if they are, MOD_ERR otherwise.
+ */
+static mod_err_t bench_log_miss_setup(void)
+{
+    if (log_level_get(TAG) >= LOG_DEBUG)
+    {
+        LOG("Set %s log level below debug to measure a filtered message\r\n", TAG->name);
+        return MOD_ERR;
+    }
+    return MOD_OK;
+}
+
+/**
+ * @brief Measure a debug message filtered out by log level.
+ *
+ * @param[out] cycles Elapsed cycles.
+ *
+ * @return MOD_OK.
+ *
+ * @note Measures nothing but the two DWT reads if LOG_COMPILE_LEVEL removes LOGD().
+ */
+static mod_err_t bench_log_miss(uint32_t *cycles)
+{
+    uint32_t start = DWT->CYCCNT;
+    LOGD(TAG, "Filtered %lu", start);
+    *cycles = DWT->CYCCNT - start;
+
+    return MOD_OK;
+}
+
+/**
+ * @brief Select null log sink so measured messages are not printed.
+ *
+ * @return MOD_OK if logging is active, MOD_ERR otherwise.
+ */
+static mod_err_t bench_log_hit_setup(void)
+{
+    if (!log_is_active())
+    {
+        LOG("Logging is off\r\n");
+        return MOD_ERR;
+    }
+    saved_sink = log_sink_get();
+    log_sink_set(LOG_SINK_NULL);
+    log_hits = 0;
+    return MOD_OK;
+}
+
+/**
+ * @brief Measure an info message that passes the log level filter.
+ *
+ * The log thread is let run whenever half of the deferred record ring was used, so
+ * records are not dropped and every iteration takes the same path.
+ *
+ * @param[out] cycles Elapsed cycles.
+ *
+ * @return MOD_OK.
+ */
+static mod_err_t bench_log_hit(uint32_t *cycles)
+{
+    if (++log_hits % (LOG_DEFERRED_RECORDS / 2U) == 0U)
+    {
+        osDelay(1);
+    }
+
+    uint32_t start = DWT->CYCCNT;
+    LOGI(TAG, "Benchmark %lu", log_hits);
+    *cycles = DWT->CYCCNT - start;
+
+    return MOD_OK;
+}
+
+/**
+ * @brief Restore log sink once deferred records were printed on the null sink.
+ */
+static void bench_log_hit_teardown(void)
+{
+    osDelay(2U * LOG_FLUSH_PERIOD_MS);
+    log_sink_set(saved_sink);
+}
+
+/**
+ * @brief Measure tokenizing of a typical command line.
+ *
+ * @param[out] cycles Elapsed cycles.
+ *
+ * @return MOD_OK if successful, otherwise a "MOD_ERR" value.
+ */
+static mod_err_t bench_tokenize(uint32_t *cycles)
+{
+    char line[sizeof(token_line)];
+    memcpy(line, token_line, sizeof(line));
+    uint32_t num_tokens;
+
+    uint32_t start = DWT->CYCCNT;
+    mod_err_t err = cmd_tokenize(line, tokens, &num_tokens);
+    *cycles = DWT->CYCCNT - start;
+
+    return err;
+}
+
+#if !ACTIVE_COOPERATIVE
+
+/**
+ * @brief Let bench active objects answer pings of the calling thread.
+ *
+ * @return MOD_OK.
+ */
+static mod_err_t bench_ao_trip_setup(void)
+{
+    bench_ao.waiter = osThreadGetId();
+    bench_ring_ao.waiter = bench_ao.waiter;
+    osThreadFlagsClear(BENCH_REPLY_FLAG);
+    return MOD_OK;
+}
+
+/**
+ * @brief Measure posting an event until the message queue active object handled it.
+ *
+ * @param[out] cycles Elapsed cycles.
+ *
+ * @return MOD_OK if successful, MOD_ERR_TIMEOUT if ping was not answered.
+ */
+static mod_err_t bench_ao_trip(uint32_t *cycles)
+{
+    return bench_ping(&bench_ao, cycles);
+}
+
+/**
+ * @brief Measure posting an event until the notification ring active object handled it.
+ *
+ * @param[out] cycles Elapsed cycles.
+ *
+ * @return MOD_OK if successful, MOD_ERR_TIMEOUT if ping was not answered.
+ */
+static mod_err_t bench_ao_ring(uint32_t *cycles)
+{
+    return bench_ping(&bench_ring_ao, cycles);
+}
+
+/**
+ * @brief Measure posting an event until the receiving active object handled it.
+ *
+ * @param ao Bench active object to ping.
+ * @param[out] cycles Elapsed cycles.
+ *
+ * @return MOD_OK if successful, MOD_ERR_TIMEOUT if ping was not answered.
+ */
+static mod_err_t bench_ping(Bench_Active *const ao, uint32_t *cycles)
+{
+    uint32_t start = DWT->CYCCNT;
+    Active_post((Active *)ao, &ping_evt);
+    uint32_t flags = osThreadFlagsWait(BENCH_REPLY_FLAG, osFlagsWaitAny, BENCH_REPLY_TIMEOUT_MS);
+    *cycles = DWT->CYCCNT - start;
+
+    return flags == BENCH_REPLY_FLAG ? MOD_OK : MOD_ERR_TIMEOUT;
+}
+
+/**
+ * @brief Record latency of ping-pong event and forward it to peer, or retire it once the run is complete.
+ *
+ * @param ao Bench active object handling event.
+ * @param evt Ping-pong event, held only by this handler.
+ */
+static void bench_pong(Bench_Active *const ao, Bench_Pong_Event *const evt)
+{
+    cmd_pm_record_hist(&pong.latency, DWT->CYCCNT - evt->post_cyc);
+
+    /* Both active objects of the pair update the run, they may preempt each other. */
+    uint32_t primask = __get_PRIMASK();
+    __disable_irq();
+    pong.dispatched++;
+    bool forward = pong.remaining > 0U;
+    if (forward)
+    {
+        pong.remaining--;
+    }
+    __set_PRIMASK(primask);
+
+    if (!forward)
+    {
+        bench_pong_retire(false);
+        return;
+    }
+    evt->post_cyc = DWT->CYCCNT;
+    if (Active_post((Active *)ao->peer, &evt->base) != MOD_OK)
+    {
+        bench_pong_retire(true);
+    }
+}
+
+/**
+ * @brief Retire ping-pong event, waking the waiting thread once every event retired.
+ *
+ * @param full Event retired because the peer's queue was full.
+ */
+static void bench_pong_retire(bool full)
+{
+    uint32_t primask = __get_PRIMASK();
+    __disable_irq();
+    pong.full += full ? 1U : 0U;
+    bool done = --pong.in_flight == 0U;
+    if (done)
+    {
+        pong.end_cyc = DWT->CYCCNT;
+    }
+    __set_PRIMASK(primask);
+
+    if (done)
+    {
+        osThreadFlagsSet(pong.waiter, BENCH_REPLY_FLAG);
+    }
+}
+
+/**
+ * @brief Pass events back and forth between active object and its peer, then print a row of results.
+ *
+ * The calling thread posts burst events to ao, each handler forwards the event to the other
+ * active object until 2 * trips posts were made. Events forwarded to a full queue retire early.
+ *
+ * @param name Backend name.
+ * @param ao Bench active object, forwarding to its peer.
+ * @param trips Round trips, 2 posts each.
+ * @param burst Events in flight at once, at most 2 * trips.
+ * @param timeout Longest run (ms).
+ *
+ * @return true if every event retired within timeout, false otherwise.
+ */
+static bool bench_pong_run(const char *name, Bench_Active *const ao, uint32_t trips, uint32_t burst,
+                           uint32_t timeout)
+{
+    memset(&pong.latency, 0, sizeof(pong.latency));
+    pong.waiter = osThreadGetId();
+    pong.remaining = 2U * trips - burst;
+    pong.in_flight = burst;
+    pong.dispatched = 0;
+    pong.full = 0;
+    osThreadFlagsClear(BENCH_REPLY_FLAG);
+
+    uint32_t start = DWT->CYCCNT;
+    pong.end_cyc = start;
+    for (uint32_t i = 0; i < burst; i++)
+    {
+        Bench_Pong_Event *const evt = (Bench_Pong_Event *)Event_new(sizeof(Bench_Pong_Event), BENCH_PONG_SIG);
+        if (evt == NULL)
+        {
+            bench_pong_retire(false); // Pool exhausted, run with fewer events in flight.
+            continue;
+        }
+        evt->post_cyc = DWT->CYCCNT;
+        if (Active_post((Active *)ao, &evt->base) != MOD_OK)
+        {
+            bench_pong_retire(true);
+        }
+    }
+
+    /* Out of time, stop forwarding and let events in flight retire. */
+    bool done = osThreadFlagsWait(BENCH_REPLY_FLAG, osFlagsWaitAny, timeout) == BENCH_REPLY_FLAG;
+    if (!done)
+    {
+        uint32_t primask = __get_PRIMASK();
+        __disable_irq();
+        pong.remaining = 0;
+        __set_PRIMASK(primask);
+        osThreadFlagsWait(BENCH_REPLY_FLAG, osFlagsWaitAny, BENCH_REPLY_TIMEOUT_MS);
+    }
+
+    float cycles_per_us = (float)SystemCoreClock / 1e6f;
+    float elapsed_s = (float)(pong.end_cyc - start) / (float)SystemCoreClock;
+    LOG("%-8s %8lu %10.0f %8.2f %8.2f %8.2f %6lu%s\r\n",
+        name,
+        pong.dispatched,
+        elapsed_s > 0.0f ? (float)pong.dispatched / elapsed_s : 0.0f,
+        cmd_pm_hist_percentile(&pong.latency, 50) / cycles_per_us,
+        cmd_pm_hist_percentile(&pong.latency, 99) / cycles_per_us,
+        pong.latency.max / cycles_per_us,
+        pong.full,
+        done ? "" : " (out of time)");
+    return done;
+}
+
+#endif // !ACTIVE_COOPERATIVE
+
+/**
+ * @brief Arm BENCH_NUM_TIMERS time events far enough out never to expire during the benchmark.
+ *
+ * @return MOD_OK.
+ */
+static mod_err_t bench_tevt_setup(void)
+{
+    TimeEvent_ctor(&probe, BENCH_TIMEOUT_SIG, (Active *)&bench_ao);
+    for (uint32_t i = 0; i < BENCH_NUM_TIMERS; i++)
+    {
+        TimeEvent_ctor(&timers[i], BENCH_TIMEOUT_SIG, (Active *)&bench_ao);
+        TimeEvent_arm(&timers[i], TIME_EVENT_SEC(60U + i), 0);
+    }
+    return MOD_OK;
+}
+
+/**
+ * @brief Measure arming a time event behind all armed ones, and disarming it.
+ *
+ * Both only publish a request and pend the timer daemon, which runs above the benchmark at
+ * PRIO_ACQUISITION, so the cycles include applying them: arming behind all armed time events
+ * walks the whole sorted list, the worst case.
+ *
+ * @param[out] cycles Elapsed cycles.
+ *
+ * @return MOD_OK.
+ */
+static mod_err_t bench_tevt(uint32_t *cycles)
+{
+    uint32_t start = DWT->CYCCNT;
+    TimeEvent_arm(&probe, TIME_EVENT_SEC(120U), 0);
+    TimeEvent_disarm(&probe);
+    *cycles = DWT->CYCCNT - start;
+
+    return MOD_OK;
+}
+
+/**
+ * @brief Disarm time events armed by bench_tevt_setup().
+ */
+static void bench_tevt_teardown(void)
+{
+    for (uint32_t i = 0; i < BENCH_NUM_TIMERS; i++)
+    {
+        TimeEvent_disarm(&timers[i]);
+    }
+}
+
+#if CONSOLE_UART
+
+/**
+ * @brief Measure writing BENCH_TX_LEN characters one at a time.
+ *
+ * @param[out] cycles Elapsed cycles.
+ *
+ * @return MOD_OK if successful, MOD_ERR_BUF_OVERRUN if characters were dropped.
+ */
+static mod_err_t bench_putc(uint32_t *cycles)
+{
+    bench_tx_drain();
+
+    mod_err_t err = MOD_OK;
+    uint32_t start = DWT->CYCCNT;
+    for (uint32_t i = 0; i < BENCH_TX_LEN; i++)
+    {
+        if (uart_putc(UART_CONSOLE, tx_chars[i]) != MOD_OK)
+        {
+            err = MOD_ERR_BUF_OVERRUN;
+        }
+    }
+    *cycles = DWT->CYCCNT - start;
+
+    return err;
+}
+
+/**
+ * @brief Measure writing BENCH_TX_LEN characters as one block.
+ *
+ * @param[out] cycles Elapsed cycles.
+ *
+ * @return MOD_OK if successful, MOD_ERR_BUF_OVERRUN if block was dropped.
+ */
+static mod_err_t bench_write(uint32_t *cycles)
+{
+    bench_tx_drain();
+
+    uint32_t start = DWT->CYCCNT;
+    mod_err_t err = uart_write(UART_CONSOLE, tx_chars, BENCH_TX_LEN);
+    *cycles = DWT->CYCCNT - start;
+
+    return err;
+}
+
+/**
+ * @brief Wait up to BENCH_TX_DRAIN_MS for the transmit buffer to drain.
+ */
+static void bench_tx_drain(void)
+{
+    for (uint32_t waited = 0; !uart_tx_idle(UART_CONSOLE) && waited < BENCH_TX_DRAIN_MS; waited++)
+    {
+        osDelay(1);
+    }
+}
+
+#endif // CONSOLE_UART
+
+/**
+ * @brief List benchmarks and their default number of iterations.
+ *
+ * @param argc Number of arguments.
+ * @param argv Argument values.
+ *
+ * @return 0 if successful, 1 otherwise.
+ */
+static uint32_t cmd_bench_list(uint32_t argc, const char **argv)
+{
+    LOG("%-10s %10s\r\n", "Benchmark", "Iterations");
+    for (uint32_t i = 0; i < ARRAY_SIZE(benches); i++)
+    {
+        LOG("%-10s %10lu\r\n", benches[i].name, benches[i].iterations);
+    }
+    return 0;
+}
+
+/**
+ * @brief Run one or all benchmarks and display their cycle statistics.
+ *
+ * All benchmarks of one command share BENCH_BUDGET_MS, so the command thread stays within
+ * the active object watchdog timeout. Benchmarks beyond the budget report fewer iterations.
+ *
+ * @param argc Number of arguments.
+ * @param argv Argument values.
+ *
+ * @return 0 if successful, 1 otherwise.
+ */
+static uint32_t cmd_bench_run(uint32_t argc, const char **argv)
+{
+    cmd_arg_val arg_vals[2];
+    int32_t num_args = cmd_parse_args(argc, argv, "[s[u", arg_vals);
+    if (num_args < 0)
+    {
+        return 1;
+    }
+    const char *name = num_args >= 1 ? arg_vals[0].val.s : "all";
+    uint32_t iterations = num_args >= 2 ? arg_vals[1].val.u : 0;
+    if (num_args >= 2 && (iterations == 0 || iterations > BENCH_MAX_ITERATIONS))
+    {
+        LOG("Iterations must be 1 to %lu\r\n", (uint32_t)BENCH_MAX_ITERATIONS);
+        return 1;
+    }
+
+    bool all = strcmp(name, "all") == 0;
+    bench_t const *bench = NULL;
+    for (uint32_t i = 0; i < ARRAY_SIZE(benches) && !all; i++)
+    {
+        if (strcmp(name, benches[i].name) == 0)
+        {
+            bench = &benches[i];
+        }
+    }
+    if (!all && bench == NULL)
+    {
+        LOG("Unknown benchmark: %s\r\n", name);
+        return 1;
+    }
+
+    uint32_t deadline = osKernelGetTickCount() + BENCH_BUDGET_MS;
+    bool ok = true;
+    LOG("%-10s %10s %10s %10s %10s %10s\r\n", "Benchmark", "Iterations", "Min", "Max", "Avg", "Avg (us)");
+    for (uint32_t i = 0; i < ARRAY_SIZE(benches); i++)
+    {
+        if (all || bench == &benches[i])
+        {
+            ok &= bench_run(&benches[i], iterations ? iterations : benches[i].iterations, deadline);
+        }
+    }
+
+    return ok ? 0 : 1;
+}
+
+#if !ACTIVE_COOPERATIVE
+/**
+ * @brief Run ping-pong between two active objects on each queue backend and display throughput and latency.
+ *
+ * Both backends share BENCH_BUDGET_MS, so the command thread stays within the active object
+ * watchdog timeout.
+ *
+ * @param argc Number of arguments.
+ * @param argv Argument values.
+ *
+ * @return 0 if successful, 1 otherwise.
+ */
+static uint32_t cmd_bench_ao(uint32_t argc, const char **argv)
+{
+    cmd_arg_val arg_vals[2];
+    int32_t num_args = cmd_parse_args(argc, argv, "[u[u", arg_vals);
+    if (num_args < 0)
+    {
+        return 1;
+    }
+    uint32_t trips = num_args >= 1 ? arg_vals[0].val.u : BENCH_PONG_TRIPS;
+    uint32_t burst = num_args >= 2 ? arg_vals[1].val.u : 1U;
+    if (trips == 0 || trips > BENCH_MAX_ITERATIONS || burst == 0 || burst > BENCH_PONG_MAX_BURST ||
+        burst > 2U * trips)
+    {
+        LOG("Round trips must be 1 to %lu, burst 1 to %lu\r\n", (uint32_t)BENCH_MAX_ITERATIONS,
+            (uint32_t)BENCH_PONG_MAX_BURST);
+        return 1;
+    }
+
+    LOG("%-8s %8s %10s %8s %8s %8s %6s\r\n", "Backend", "Events", "Events/s", "p50", "p99", "Max", "Full");
+    LOG("%-8s %8s %10s %8s %8s %8s %6s\r\n", "", "", "", "(us)", "(us)", "(us)", "");
+    bool ok = bench_pong_run("queue", &bench_ao, trips, burst, BENCH_BUDGET_MS / 2U);
+    ok &= bench_pong_run("ring", &bench_ring_ao, trips, burst, BENCH_BUDGET_MS / 2U);
+    return ok ? 0 : 1;
+}
+#endif
@@ -0,0 +1,183 @@
+/**
+ * @file bgjob.c
+ * @author Timothy Nguyen
+ * @brief Background jobs: cooperative work run from the idle hook, only when no thread is ready.
+ * @version 0.1
+ * @date 2021-09-06
+ */
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "bgjob.h"
+#include "cmd.h"
+#include "log.h"
+#include "FreeRTOS.h"
+#include "task.h"
+#include "cmsis_os.h"
+#include "stm32l4xx.h"
+
+////////////////////////////////////////////////////////////////////////////////
+// Type definitions
+////////////////////////////////////////////////////////////////////////////////
+
+/* Counters */
+typedef enum
+{
+    CNT_SUBMITTED, // Jobs queued.
+    CNT_STEPS,     // Steps run.
+    CNT_DONE,      // Jobs finished.
+
+    NUM_U32_PMS
+} bgjob_u32_pms_t;
+
+////////////////////////////////////////////////////////////////////////////////
+// Private (static) variables
+////////////////////////////////////////////////////////////////////////////////
+
+/* Job queue, head runs next */
+static bgjob_t *head;
+static bgjob_t *tail;
+
+/* Idle task, known once the idle hook ran */
+static osThreadId_t idle_thread_id;
+
+/* Idle task memory, larger than the kernel's configMINIMAL_STACK_SIZE default for job steps */
+static StaticTask_t idle_tcb;
+static StackType_t idle_stack[BGJOB_IDLE_STACK_SZ / sizeof(StackType_t)];
+
+/* Performance measurements */
+static uint32_t bgjob_pms[NUM_U32_PMS];
+static cmd_pm_hist_t bgjob_slice_cycles; // Cycles of idle hook calls that ran steps.
+
+/* Performance measurement info */
+static const cmd_pm_info bgjob_pm_info[] = {
+    {"submitted", CMD_PM_U32, &bgjob_pms[CNT_SUBMITTED]},
+    {"steps", CMD_PM_U32, &bgjob_pms[CNT_STEPS]},
+    {"done", CMD_PM_U32, &bgjob_pms[CNT_DONE]},
+    {"slice cycles", CMD_PM_HIST, &bgjob_slice_cycles}};
+
+/* Background job module client info */
+CMD_CLIENT_DEFINE(bgjob,
+                  .num_cmds = 0,
+                  .cmds = NULL,
+                  .num_pms = ARRAY_SIZE(bgjob_pm_info),
+                  .pms = bgjob_pm_info);
+
+////////////////////////////////////////////////////////////////////////////////
+// Public (global) functions
+////////////////////////////////////////////////////////////////////////////////
+
+mod_err_t bgjob_init(void)
+{
+    return MOD_OK;
+}
+
+mod_err_t bgjob_submit(bgjob_t *job)
+{
+    ASSERT(job->step != NULL);
+
+    uint32_t primask = __get_PRIMASK();
+    __disable_irq();
+    if (job->queued)
+    {
+        job->rerun = true;
+        __set_PRIMASK(primask);
+        return MOD_DID_NOTHING;
+    }
+    job->queued = true;
+    job->rerun = false;
+    job->next = NULL;
+    if (head == NULL)
+    {
+        head = job;
+    }
+    else
+    {
+        tail->next = job;
+    }
+    tail = job;
+    __set_PRIMASK(primask);
+
+    INC_SAT_U32(bgjob_pms[CNT_SUBMITTED]);
+    return MOD_OK;
+}
+
+bool bgjob_pending(void)
+{
+    return head != NULL;
+}
+
+bool bgjob_in_idle(void)
+{
+    return idle_thread_id != NULL && osThreadGetId() == idle_thread_id;
+}
+
+/**
+ * @brief Run steps of queued jobs for at most BGJOB_SLICE_US (idle task, overrides weak hook).
+ *
+ * Only the idle task dequeues jobs, so the head stays valid between the checks below.
+ */
+void vApplicationIdleHook(void)
+{
+    idle_thread_id = osThreadGetId();
+    if (head == NULL)
+    {
+        return;
+    }
+
+    uint32_t start = DWT->CYCCNT;
+    uint32_t budget = BGJOB_SLICE_US * (SystemCoreClock / 1000000U);
+    do
+    {
+        bgjob_t *job = head;
+        job->rerun = false;
+        bgjob_status_t status = job->step(job->arg);
+        INC_SAT_U32(bgjob_pms[CNT_STEPS]);
+
+        uint32_t primask = __get_PRIMASK();
+        __disable_irq();
+        if (job->rerun)
+        {
+            status = BGJOB_MORE;
+        }
+        if (status == BGJOB_DONE || job->next != NULL)
+        {
+            head = job->next;
+            if (head == NULL)
+            {
+                tail = NULL;
+            }
+            if (status == BGJOB_DONE)
+            {
+                job->queued = false;
+            }
+            else
+            {
+                /* Take turns with the other queued jobs. */
+                job->next = NULL;
+                tail->next = job;
+                tail = job;
+            }
+        }
+        __set_PRIMASK(primask);
+
+        if (status == BGJOB_DONE)
+        {
+            INC_SAT_U32(bgjob_pms[CNT_DONE]);
+        }
+    } while (head != NULL && DWT->CYCCNT - start < budget);
+
+    cmd_pm_record_hist(&bgjob_slice_cycles, DWT->CYCCNT - start);
+}
+
+/**
+ * @brief Provide idle task memory (overrides weak function of cmsis_os2.c).
+ */
+void vApplicationGetIdleTaskMemory(StaticTask_t **ppxIdleTaskTCBBuffer, StackType_t **ppxIdleTaskStackBuffer,
+                                   uint32_t *pulIdleTaskStackSize)
+{
+    *ppxIdleTaskTCBBuffer = &idle_tcb;
+    *ppxIdleTaskStackBuffer = idle_stack;
+    *pulIdleTaskStackSize = ARRAY_SIZE(idle_stack);
+}
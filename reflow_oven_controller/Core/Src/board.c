@@ -0,0 +1,57 @@
+/**
+ * @file board.c
+ * @author Timothy Nguyen
+ * @brief Board temperature observer: two-node thermal model of an assembly heated by oven air.
+ * @version 0.1
+ * @date 2021-09-06
+ */
+
+#include <math.h>
+
+#include "board.h"
+
+void Board_Init(Board_t * const obs, Board_class_t const * const cls, float gain)
+{
+	obs->cls = *cls;
+	obs->gain = gain;
+	Board_Reset(obs);
+}
+
+void Board_Reset(Board_t * const obs)
+{
+	obs->primed = false;
+	obs->surface = 0.0f;
+	obs->joint = 0.0f;
+}
+
+float Board_Update(Board_t * const obs, float air, float Ts)
+{
+	if (!obs->primed)
+	{
+		obs->primed = true;
+		obs->surface = air;
+		obs->joint = air;
+		return obs->joint;
+	}
+
+	/* Exact step of the series pair for air held over Ts, joint first as it uses the old surface. */
+	float a_s = expf(-Ts / obs->cls.tau_surface);
+	float a_j = expf(-Ts / obs->cls.tau_joint);
+	float surface_next = air + a_s * (obs->surface - air);
+
+	/* Joint response to the surface decaying from its old value towards air. */
+	float tau_diff = obs->cls.tau_surface - obs->cls.tau_joint;
+	float forced = fabsf(tau_diff) > 1e-3f
+	                   ? (a_s - a_j) * obs->cls.tau_surface / tau_diff
+	                   : (Ts / obs->cls.tau_joint) * a_j;
+	obs->joint = air + a_j * (obs->joint - air) + forced * (obs->surface - air);
+	obs->surface = surface_next;
+	return obs->joint;
+}
+
+float Board_Correct(Board_t * const obs, float probe)
+{
+	obs->surface += obs->gain * (probe - obs->joint);
+	obs->joint += obs->gain * (probe - obs->joint);
+	return obs->joint;
+}
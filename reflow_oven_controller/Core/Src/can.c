@@ -0,0 +1,390 @@
+/**
+ * @file can.c
+ * @author Timothy Nguyen
+ * @brief CAN node: periodic status frames, alarms, commands and time base sync for multi-oven networks.
+ * @version 0.1
+ * @date 2021-09-06
+ */
+
+#include <ctype.h>
+#include <math.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "cmsis_os.h"
+#include "can.h"
+#include "reflow.h"
+#include "safety.h"
+#include "MAX31855K.h"
+#include "param.h"
+#include "cmd.h"
+#include "log.h"
+
+////////////////////////////////////////////////////////////////////////////////
+// Common macros
+////////////////////////////////////////////////////////////////////////////////
+
+#define CAN_MAX_NODE 127U // Highest node ID, COMMAND identifiers stay below 0x680.
+
+_Static_assert(2U * REFLOW_MAX_ZONES <= 8U, "ZONES frame holds every zone");
+
+////////////////////////////////////////////////////////////////////////////////
+// Private (static) function declarations
+////////////////////////////////////////////////////////////////////////////////
+
+static uint32_t can_status_cmd(uint32_t argc, const char **argv); // Print node, time base and counters.
+static uint32_t can_rx_cmd(uint32_t argc, const char **argv);     // Handle frame given in hex as if received.
+
+static void can_publish(void *arg);                      // Send STATUS and ZONES, ALARM on change.
+static void can_send(uint16_t id, const uint8_t *data, uint8_t len);
+static void can_node_changed(param_def_t const *def);
+static void can_period_changed(param_def_t const *def);
+static int16_t can_temp(float temp);                     // Temperature as signed tenths of a deg C.
+static inline uint32_t get32(const uint8_t *p);          // Little-endian field.
+static inline void put16(uint8_t *p, uint16_t val);
+static inline void put32(uint8_t *p, uint32_t val);
+
+////////////////////////////////////////////////////////////////////////////////
+// Private (static) variables
+////////////////////////////////////////////////////////////////////////////////
+
+/* Node ID, 32-bit so the receive interrupt reads it atomically */
+static uint32_t node_id = CAN_NODE;
+PARAM_DEFINE(PARAM_CAN_NODE, "can.node", PARAM_U32, &node_id, PARAM_FLAG_PERSIST,
+             .def.u = CAN_NODE, .min.u = 1U, .max.u = CAN_MAX_NODE, .on_change = can_node_changed);
+
+/* Status period (ms) */
+static uint32_t period_ms = CAN_PERIOD_MS;
+PARAM_DEFINE(PARAM_CAN_PERIOD_MS, "can.period_ms", PARAM_U32, &period_ms, PARAM_FLAG_PERSIST,
+             .def.u = CAN_PERIOD_MS, .min.u = CAN_PERIOD_MIN_MS, .max.u = CAN_PERIOD_MAX_MS,
+             .on_change = can_period_changed);
+
+/* Status timer */
+static osTimerId_t publish_timer;
+static StaticTimer_t publish_timer_cb;
+
+/* Time base: synchronized time minus kernel tick count, written by the receive interrupt */
+static volatile uint32_t time_offset;
+static volatile uint32_t sync_tick; // Kernel tick count at the latest SYNC.
+
+/* Latest alarm sent, safety reason in bits 0 to 7 and thermocouple error in bits 8 to 15 */
+static uint32_t alarm_key;
+static bool alarm_sent;
+
+/* Counters, "can status" */
+static uint32_t tx_frames; // Frames queued.
+static uint32_t tx_drops;  // Frames dropped, every mailbox pending or port not initialized.
+static volatile uint32_t syncs;    // SYNC frames received.
+static volatile uint32_t commands; // COMMAND frames posted.
+static volatile uint32_t rx_drops; // COMMAND frames dropped, event pool or command queue full.
+
+static cmd_cmd_info can_cmds[] = {
+    {.cmd_name = "status",
+     .cb = can_status_cmd,
+     .help = "Print node, synchronized time base and frame counters.\r\n"
+             "Usage: can status"},
+    {.cmd_name = "rx",
+     .cb = can_rx_cmd,
+     .help = "Handle frame as if received from the bus, responses are sent to the bus.\r\n"
+             "Usage: can rx <hex id> [hex data], eg. can rx 601 03 0500"},
+};
+
+CMD_CLIENT_DEFINE(can,
+                  .num_cmds = ARRAY_SIZE(can_cmds),
+                  .cmds = can_cmds);
+
+/* Unique tag for logging module */
+LOG_TAG_DEFINE("CAN");
+
+////////////////////////////////////////////////////////////////////////////////
+// Public (global) functions
+////////////////////////////////////////////////////////////////////////////////
+
+mod_err_t can_init(void)
+{
+    static const osTimerAttr_t timer_attr = {.name = "can", .cb_mem = &publish_timer_cb, .cb_size = sizeof(publish_timer_cb)};
+    publish_timer = osTimerNew(can_publish, osTimerPeriodic, NULL, &timer_attr);
+    ASSERT(publish_timer != NULL);
+
+    mod_err_t err = can_port_init((uint8_t)node_id);
+    if (err != MOD_OK)
+    {
+        LOGW(TAG, "Port not started: %d", err);
+        return err;
+    }
+    osTimerStart(publish_timer, period_ms);
+
+    LOGI(TAG, "Initialized CAN node %lu", (unsigned long)node_id);
+    return MOD_OK;
+}
+
+void can_receive(can_frame_t const *const frame)
+{
+    if (frame->id == CAN_ID_SYNC)
+    {
+        if (frame->len >= 4U)
+        {
+            uint32_t now = osKernelGetTickCount();
+            time_offset = get32(frame->data) - now;
+            sync_tick = now;
+            INC_SAT_U32(syncs);
+        }
+        return;
+    }
+    if (frame->id != CAN_ID_COMMAND && frame->id != CAN_ID_COMMAND + node_id)
+    {
+        return;
+    }
+
+    Can_Event *const evt = (Can_Event *)Event_new(sizeof(Can_Event), CMD_CAN_SIG);
+    if (evt == NULL)
+    {
+        INC_SAT_U32(rx_drops);
+        return;
+    }
+    evt->frame = *frame;
+    if (Active_post(cmd_base, &evt->base) != MOD_OK)
+    {
+        INC_SAT_U32(rx_drops);
+        return;
+    }
+    INC_SAT_U32(commands);
+}
+
+void can_execute(Can_Event const *const evt)
+{
+    can_frame_t const *const f = &evt->frame;
+    uint8_t op = f->len >= 1U ? f->data[0] : 0U;
+    uint16_t id = f->len >= 3U ? (uint16_t)(f->data[1] | (f->data[2] << 8)) : 0U;
+    uint32_t val = 0;
+    can_result_t result = CAN_OK;
+
+    switch (op)
+    {
+    case CAN_OP_START:
+    case CAN_OP_STOP:
+        if (reflow_post_run(CAN_OVEN, op == CAN_OP_START) != MOD_OK)
+        {
+            result = CAN_ERR_FAILED;
+        }
+        break;
+
+    case CAN_OP_PARAM_GET:
+    case CAN_OP_PARAM_SET:
+    {
+        if (f->len < (op == CAN_OP_PARAM_SET ? 7U : 3U))
+        {
+            result = CAN_ERR_OP;
+            break;
+        }
+        param_def_t const *def = param_find(id);
+        if (def == NULL)
+        {
+            result = CAN_ERR_PARAM;
+            break;
+        }
+        if (op == CAN_OP_PARAM_SET)
+        {
+            mod_err_t err = param_set(def, (param_val_t){.u = get32(&f->data[3])});
+            if (err == MOD_ERR_ARG)
+            {
+                result = CAN_ERR_RANGE;
+            }
+            else if (err != MOD_OK)
+            {
+                result = CAN_ERR_FAILED;
+            }
+        }
+        val = param_get(def).u;
+        break;
+    }
+
+    default:
+        result = CAN_ERR_OP;
+        break;
+    }
+
+    if (f->id == CAN_ID_COMMAND)
+    {
+        return; // Broadcast, executed without response.
+    }
+    uint8_t rsp[8] = {op, (uint8_t)result};
+    put16(&rsp[2], id);
+    put32(&rsp[4], val);
+    can_send(CAN_ID_RESPONSE, rsp, sizeof(rsp));
+}
+
+uint32_t can_time(void)
+{
+    return osKernelGetTickCount() + time_offset;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Private (static) functions
+////////////////////////////////////////////////////////////////////////////////
+
+/**
+ * @brief Send STATUS and ZONES frames from the status snapshot, and ALARM if trip or thermocouple error changed.
+ *
+ * Timer callback, every "can.period_ms".
+ */
+static void can_publish(void *arg)
+{
+    (void)arg;
+    Reflow_Status snap;
+    reflow_status_get(CAN_OVEN, &snap);
+    uint32_t now = can_time();
+    bool tripped = safety_tripped(CAN_OVEN);
+    safety_reason_t reason = safety_reason(CAN_OVEN);
+
+    uint8_t status[8];
+    status[0] = snap.state;
+    status[1] = (uint8_t)((snap.state != REFLOW_STATE_RESET ? 0x01U : 0U) | (tripped ? 0x02U : 0U) |
+                          (snap.err != MAX_OK ? 0x04U : 0U) | ((snap.segment & 0x0FU) << 4));
+    put16(&status[2], (uint16_t)can_temp(snap.setpoint));
+    put16(&status[4], (uint16_t)can_temp(snap.temp));
+    put16(&status[6], (uint16_t)now);
+    can_send(CAN_ID_STATUS, status, sizeof(status));
+
+    uint8_t zones[2U * REFLOW_MAX_ZONES];
+    for (uint8_t z = 0; z < REFLOW_MAX_ZONES; z++)
+    {
+        put16(&zones[2U * z], (uint16_t)(z < snap.num_zones ? can_temp(snap.zone_temp[z]) : CAN_NAN));
+    }
+    can_send(CAN_ID_ZONES, zones, sizeof(zones));
+
+    uint32_t key = (uint32_t)reason | ((uint32_t)snap.err << 8);
+    if (!alarm_sent || key != alarm_key)
+    {
+        uint8_t alarm[7] = {(uint8_t)reason, (uint8_t)snap.err, snap.state};
+        put32(&alarm[3], now);
+        can_send(CAN_ID_ALARM, alarm, sizeof(alarm));
+        alarm_key = key;
+        alarm_sent = true;
+    }
+}
+
+/**
+ * @brief Queue frame of function base id for this node and count it.
+ */
+static void can_send(uint16_t id, const uint8_t *data, uint8_t len)
+{
+    can_frame_t frame = {.id = (uint16_t)(id + node_id), .len = len};
+    memcpy(frame.data, data, len);
+    if (can_port_send(&frame) == MOD_OK)
+    {
+        INC_SAT_U32(tx_frames);
+    }
+    else
+    {
+        INC_SAT_U32(tx_drops);
+    }
+}
+
+static void can_node_changed(param_def_t const *def)
+{
+    (void)def;
+    can_port_filter((uint8_t)node_id);
+    alarm_sent = false; // Announce under the new ID.
+}
+
+static void can_period_changed(param_def_t const *def)
+{
+    (void)def;
+    if (publish_timer != NULL && osTimerIsRunning(publish_timer))
+    {
+        osTimerStart(publish_timer, period_ms);
+    }
+}
+
+/**
+ * @brief Convert temperature to signed tenths of a deg C, CAN_NAN if not read or out of range.
+ */
+static int16_t can_temp(float temp)
+{
+    float tenths = temp * 10.0f;
+    if (!(tenths > (float)INT16_MIN && tenths <= (float)INT16_MAX))
+    {
+        return CAN_NAN;
+    }
+    return (int16_t)lrintf(tenths);
+}
+
+static inline uint32_t get32(const uint8_t *p)
+{
+    return (uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+static inline void put16(uint8_t *p, uint16_t val)
+{
+    p[0] = (uint8_t)val;
+    p[1] = (uint8_t)(val >> 8);
+}
+
+static inline void put32(uint8_t *p, uint32_t val)
+{
+    put16(p, (uint16_t)val);
+    put16(&p[2], (uint16_t)(val >> 16));
+}
+
+/**
+ * @brief Print node, synchronized time base and frame counters.
+ */
+static uint32_t can_status_cmd(uint32_t argc, const char **argv)
+{
+    (void)argv;
+    if (argc != 0)
+    {
+        LOG("Usage: can status\r\n");
+        return 1;
+    }
+    uint32_t n_syncs = syncs;
+    cmd_out_u32("node", node_id);
+    cmd_out_u32("period ms", period_ms);
+    cmd_out_u32("time ms", can_time());
+    cmd_out_u32("syncs", n_syncs);
+    if (n_syncs > 0U)
+    {
+        cmd_out_u32("sync age ms", osKernelGetTickCount() - sync_tick);
+    }
+    cmd_out_u32("tx frames", tx_frames);
+    cmd_out_u32("tx drops", tx_drops);
+    cmd_out_u32("commands", commands);
+    cmd_out_u32("rx drops", rx_drops);
+    return 0;
+}
+
+/**
+ * @brief Handle frame given in hex as if received, COMMAND frames are executed once this command returns.
+ *
+ * Data hex digits may be split across arguments at byte boundaries, eg. "03 0500".
+ */
+static uint32_t can_rx_cmd(uint32_t argc, const char **argv)
+{
+    char *end;
+    can_frame_t frame = {0};
+    unsigned long id = argc >= 1U ? strtoul(argv[0], &end, 16) : 0UL;
+    if (argc < 1U || *end != '\0' || id > 0x7FFUL)
+    {
+        LOG("Usage: can rx <hex id> [hex data]\r\n");
+        return 1;
+    }
+    frame.id = (uint16_t)id;
+    for (uint32_t i = 1; i < argc; i++)
+    {
+        for (const char *c = argv[i]; *c != '\0'; c += 2)
+        {
+            if (!isxdigit((unsigned char)c[0]) || !isxdigit((unsigned char)c[1]) || frame.len >= sizeof(frame.data))
+            {
+                LOG("Usage: can rx <hex id> [hex data]\r\n");
+                return 1;
+            }
+            char byte[3] = {c[0], c[1], '\0'};
+            frame.data[frame.len++] = (uint8_t)strtoul(byte, NULL, 16);
+        }
+    }
+    can_receive(&frame);
+    return 0;
+}
@@ -0,0 +1,245 @@
+/**
+ * @file can_port.c
+ * @author Timothy Nguyen
+ * @brief CAN bus: bxCAN CAN1 with hardware identifier filters and three transmit mailboxes.
+ * @version 0.1
+ * @date 2021-09-06
+ *
+ * Filter bank 0 holds four standard identifiers in 16-bit list mode: SYNC, broadcast
+ * COMMAND and this node's COMMAND twice. Only those data frames reach receive FIFO 0,
+ * whose interrupt reads them out and passes them to can_receive(). Frames are queued in any
+ * free transmit mailbox, sent in request order, and retransmitted by the hardware until
+ * acknowledged.
+ *
+ * Notes:
+ * - CAN1 is configured at register level, it is not enabled within CubeMX.
+ * - Bit time is 16 time quanta, sampled at 87.5 %. The bus clock must be a multiple of
+ *   16 * CAN_BITRATE at both clock operating points, the clock manager rescales the prescaler.
+ * - Bus-off is left automatically after 128 occurrences of 11 recessive bits.
+ * - CAN1 stops in STOP2, so the port holds a stop lock.
+ */
+
+#include <string.h>
+
+#include "can.h"
+#include "power.h"
+#include "trace.h"
+#include "irq.h"
+#include "stm32l4xx_ll_bus.h"
+#include "stm32l4xx_ll_gpio.h"
+#include "stm32l4xx_hal.h"
+
+#if CAN_ENABLE
+
+////////////////////////////////////////////////////////////////////////////////
+// Common macros
+////////////////////////////////////////////////////////////////////////////////
+
+#define CAN_PORT CAN1
+#define CAN_TQ 16U              // Time quanta per bit: sync segment, CAN_TS1 and CAN_TS2.
+#define CAN_TS1 13U             // Time quanta before the sample point, after the sync segment.
+#define CAN_TS2 2U              // Time quanta after the sample point.
+#define CAN_SJW 1U              // Resynchronization jump width (time quanta).
+#define CAN_MODE_TIMEOUT_MS 10U // Longest wait to enter or leave initialization.
+#define CAN_FILTER_BANK 0U      // Filter bank of accepted identifiers.
+
+_Static_assert(1U + CAN_TS1 + CAN_TS2 == CAN_TQ, "Bit time segments add up to CAN_TQ");
+
+/* Standard identifier in a 16-bit filter, data frame */
+#define CAN_FILTER_ID(id) ((uint32_t)(id) << 5)
+
+////////////////////////////////////////////////////////////////////////////////
+// Private (static) function declarations
+////////////////////////////////////////////////////////////////////////////////
+
+static bool can_wait_inak(bool set); // Wait for initialization acknowledge to reach set.
+
+////////////////////////////////////////////////////////////////////////////////
+// Private (static) variables
+////////////////////////////////////////////////////////////////////////////////
+
+/* Port initialized */
+static bool port_ready;
+
+////////////////////////////////////////////////////////////////////////////////
+// Public (global) functions
+////////////////////////////////////////////////////////////////////////////////
+
+mod_err_t can_port_init(uint8_t node)
+{
+    uint32_t pclk1 = HAL_RCC_GetPCLK1Freq();
+    if (pclk1 % (CAN_TQ * CAN_BITRATE) != 0U)
+    {
+        return MOD_ERR_PERIPH; // Bit rate not reachable from the bus clock.
+    }
+
+    LL_APB1_GRP1_EnableClock(LL_APB1_GRP1_PERIPH_CAN1);
+    LL_AHB2_GRP1_EnableClock(LL_AHB2_GRP1_PERIPH_GPIOB);
+
+    /**CAN1 GPIO Configuration
+    PB8   ------> CAN1_RX
+    PB9   ------> CAN1_TX
+    */
+    LL_GPIO_InitTypeDef GPIO_InitStruct = {0};
+    GPIO_InitStruct.Pin = LL_GPIO_PIN_8 | LL_GPIO_PIN_9;
+    GPIO_InitStruct.Mode = LL_GPIO_MODE_ALTERNATE;
+    GPIO_InitStruct.Speed = LL_GPIO_SPEED_FREQ_HIGH;
+    GPIO_InitStruct.OutputType = LL_GPIO_OUTPUT_PUSHPULL;
+    GPIO_InitStruct.Pull = LL_GPIO_PULL_UP; // Recessive without a transceiver.
+    GPIO_InitStruct.Alternate = LL_GPIO_AF_9;
+    LL_GPIO_Init(GPIOB, &GPIO_InitStruct);
+
+    /* Leave sleep for initialization, CAN1 starts in sleep mode after reset. */
+    CLEAR_BIT(CAN_PORT->MCR, CAN_MCR_SLEEP);
+    SET_BIT(CAN_PORT->MCR, CAN_MCR_INRQ);
+    if (!can_wait_inak(true))
+    {
+        return MOD_ERR_TIMEOUT;
+    }
+    CAN_PORT->MCR = CAN_MCR_INRQ | CAN_MCR_ABOM | CAN_MCR_TXFP; // Automatic retransmission, FIFO overwrites on overrun.
+    CAN_PORT->BTR = ((CAN_SJW - 1U) << CAN_BTR_SJW_Pos) | ((CAN_TS2 - 1U) << CAN_BTR_TS2_Pos) |
+                    ((CAN_TS1 - 1U) << CAN_BTR_TS1_Pos) | (pclk1 / (CAN_TQ * CAN_BITRATE) - 1U);
+
+    /* Filter bank in 16-bit list mode to FIFO 0, the other banks stay inactive. */
+    SET_BIT(CAN_PORT->FMR, CAN_FMR_FINIT);
+    CLEAR_BIT(CAN_PORT->FA1R, 1UL << CAN_FILTER_BANK);
+    SET_BIT(CAN_PORT->FM1R, 1UL << CAN_FILTER_BANK);
+    CLEAR_BIT(CAN_PORT->FS1R, 1UL << CAN_FILTER_BANK);
+    CLEAR_BIT(CAN_PORT->FFA1R, 1UL << CAN_FILTER_BANK);
+    CAN_PORT->sFilterRegister[CAN_FILTER_BANK].FR1 = CAN_FILTER_ID(CAN_ID_SYNC) | (CAN_FILTER_ID(CAN_ID_COMMAND) << 16);
+    CAN_PORT->sFilterRegister[CAN_FILTER_BANK].FR2 = CAN_FILTER_ID(CAN_ID_COMMAND + node) * 0x00010001UL;
+    SET_BIT(CAN_PORT->FA1R, 1UL << CAN_FILTER_BANK);
+    CLEAR_BIT(CAN_PORT->FMR, CAN_FMR_FINIT);
+
+    CAN_PORT->IER = CAN_IER_FMPIE0;
+    __NVIC_SetPriority(CAN1_RX0_IRQn, NVIC_EncodePriority(NVIC_GetPriorityGrouping(), IRQ_PRIO_CAN, 0));
+    __NVIC_EnableIRQ(CAN1_RX0_IRQn);
+
+    /* Join the bus after 11 recessive bits. */
+    CLEAR_BIT(CAN_PORT->MCR, CAN_MCR_INRQ);
+    if (!can_wait_inak(false))
+    {
+        return MOD_ERR_TIMEOUT;
+    }
+
+    power_stop_lock();
+    port_ready = true;
+    return MOD_OK;
+}
+
+void can_port_filter(uint8_t node)
+{
+    if (!port_ready)
+    {
+        return;
+    }
+    SET_BIT(CAN_PORT->FMR, CAN_FMR_FINIT);
+    CLEAR_BIT(CAN_PORT->FA1R, 1UL << CAN_FILTER_BANK);
+    CAN_PORT->sFilterRegister[CAN_FILTER_BANK].FR2 = CAN_FILTER_ID(CAN_ID_COMMAND + node) * 0x00010001UL;
+    SET_BIT(CAN_PORT->FA1R, 1UL << CAN_FILTER_BANK);
+    CLEAR_BIT(CAN_PORT->FMR, CAN_FMR_FINIT);
+}
+
+mod_err_t can_port_send(can_frame_t const *const frame)
+{
+    if (!port_ready)
+    {
+        return MOD_ERR_NOT_INIT;
+    }
+
+    /* Mailbox is claimed by setting its request, senders run in several threads. */
+    uint32_t primask = __get_PRIMASK();
+    __disable_irq();
+    uint32_t tsr = CAN_PORT->TSR;
+    if (!(tsr & (CAN_TSR_TME0 | CAN_TSR_TME1 | CAN_TSR_TME2)))
+    {
+        __set_PRIMASK(primask);
+        return MOD_ERR_BUF_OVERRUN;
+    }
+    CAN_TxMailBox_TypeDef *mb = &CAN_PORT->sTxMailBox[(tsr & CAN_TSR_CODE) >> CAN_TSR_CODE_Pos];
+    uint8_t len = frame->len > 8U ? 8U : frame->len;
+    uint8_t data[8] = {0};
+    memcpy(data, frame->data, len);
+    mb->TDTR = len;
+    mb->TDLR = (uint32_t)data[0] | ((uint32_t)data[1] << 8) | ((uint32_t)data[2] << 16) | ((uint32_t)data[3] << 24);
+    mb->TDHR = (uint32_t)data[4] | ((uint32_t)data[5] << 8) | ((uint32_t)data[6] << 16) | ((uint32_t)data[7] << 24);
+    mb->TIR = ((uint32_t)frame->id << CAN_TI0R_STID_Pos) | CAN_TI0R_TXRQ;
+    __set_PRIMASK(primask);
+    return MOD_OK;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Private (static) functions
+////////////////////////////////////////////////////////////////////////////////
+
+/**
+ * @brief Wait for initialization acknowledge (thread context).
+ *
+ * @param set true to wait for initialization mode, false for normal mode.
+ *
+ * @return true if reached within CAN_MODE_TIMEOUT_MS.
+ */
+static bool can_wait_inak(bool set)
+{
+    uint32_t start = HAL_GetTick();
+    while (((CAN_PORT->MSR & CAN_MSR_INAK) != 0U) != set)
+    {
+        if (HAL_GetTick() - start > CAN_MODE_TIMEOUT_MS)
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Interrupt handlers
+////////////////////////////////////////////////////////////////////////////////
+
+/**
+ * @brief Frame pending in receive FIFO 0.
+ *
+ * Every pending frame is read out and released, the filter only passes standard data frames.
+ */
+void CAN1_RX0_IRQHandler(void)
+{
+    TRACE_ISR_ENTER(TRACE_ISR_CAN);
+    while (CAN_PORT->RF0R & CAN_RF0R_FMP0)
+    {
+        CAN_FIFOMailBox_TypeDef const *mb = &CAN_PORT->sFIFOMailBox[0];
+        uint32_t rdlr = mb->RDLR;
+        uint32_t rdhr = mb->RDHR;
+        can_frame_t frame = {
+            .id = (uint16_t)(mb->RIR >> CAN_RI0R_STID_Pos),
+            .len = (uint8_t)(mb->RDTR & CAN_RDT0R_DLC),
+        };
+        frame.len = frame.len > 8U ? 8U : frame.len; // DLC 9 to 15 carry 8 bytes.
+        for (uint8_t i = 0; i < 4U; i++)
+        {
+            frame.data[i] = (uint8_t)(rdlr >> (8U * i));
+            frame.data[4U + i] = (uint8_t)(rdhr >> (8U * i));
+        }
+        CAN_PORT->RF0R = CAN_RF0R_RFOM0;
+        can_receive(&frame);
+    }
+    CAN_PORT->RF0R = CAN_RF0R_FOVR0 | CAN_RF0R_FULL0; // Written 1 to clear.
+    TRACE_ISR_EXIT(TRACE_ISR_CAN);
+}
+
+#else
+
+mod_err_t can_port_init(uint8_t node)
+{
+    return MOD_DID_NOTHING;
+}
+
+void can_port_filter(uint8_t node)
+{
+}
+
+mod_err_t can_port_send(can_frame_t const *const frame)
+{
+    return MOD_ERR_NOT_INIT;
+}
+
+#endif
@@ -0,0 +1,360 @@
+/**
+ * @file clock.c
+ * @author Timothy Nguyen
+ * @brief Clock manager: low system clock while idle, full speed while heaters are controlled.
+ * @version 0.1
+ * @date 2021-08-22
+ */
+
+#include <stdbool.h>
+#include <string.h>
+
+#include "clock.h"
+#include "cmd.h"
+#include "log.h"
+#include "console.h"
+#include "cmsis_os.h"
+#include "FreeRTOS.h"
+#include "task.h"
+
+////////////////////////////////////////////////////////////////////////////////
+// Type definitions
+////////////////////////////////////////////////////////////////////////////////
+
+/* Clock manager state */
+typedef struct
+{
+    clock_cfg_t cfg;                    // Peripherals to rescale.
+    uint32_t spi_hz[CLOCK_MAX_PERIPHS]; // SPI serial clocks set by MX_*_Init(), held across transitions.
+    clock_mode_t mode;                  // Current operating point.
+    uint32_t boosts;                    // Number of boosts held.
+    uint32_t transitions;               // Number of operating point changes.
+    uint32_t errors;                    // Number of failed clock configuration steps.
+    uint32_t forced;                    // Number of transitions made before peripherals were idle.
+} clock_state_t;
+
+////////////////////////////////////////////////////////////////////////////////
+// Private (static) function declarations
+////////////////////////////////////////////////////////////////////////////////
+
+/* Command callback functions */
+static uint32_t cmd_clock_status(uint32_t argc, const char **argv); // Display operating point.
+
+static void clock_switch(clock_mode_t mode);                // Change operating point and rescale peripherals.
+static bool periphs_idle(void);                             // Check console and SPIs are idle.
+static bool sysclk_high(void);                              // Switch to PLL, voltage range 1.
+static bool sysclk_low(void);                               // Switch to HSI16, voltage range 2.
+static void periphs_rescale(uint32_t old_hz, uint32_t new_hz); // Keep peripheral timings across bus clock change.
+static inline uint32_t scale(uint32_t val, uint32_t old_hz, uint32_t new_hz); // Rounded val * new_hz / old_hz.
+
+////////////////////////////////////////////////////////////////////////////////
+// Private (static) variables
+////////////////////////////////////////////////////////////////////////////////
+
+/* Clock manager state */
+static clock_state_t clk;
+
+/* Operating point names */
+static const char *mode_names[] = {"LOW", "HIGH"};
+
+/* Clock command information. */
+static cmd_cmd_info clock_cmds[] = {
+    {.cmd_name = "status",
+     .cb = cmd_clock_status,
+     .help = "Display system clock operating point and transitions."}};
+
+/* Clock module client info */
+CMD_CLIENT_DEFINE(clock,
+                  .num_cmds = sizeof(clock_cmds) / sizeof(clock_cmds[0]),
+                  .cmds = clock_cmds);
+
+/* Unique tag for clock module. */
+LOG_TAG_DEFINE("CLOCK");
+
+////////////////////////////////////////////////////////////////////////////////
+// Public (global) functions
+////////////////////////////////////////////////////////////////////////////////
+
+mod_err_t clock_init(clock_cfg_t const *cfg)
+{
+    memset(&clk, 0, sizeof(clk));
+    clk.cfg = *cfg;
+    clk.mode = CLOCK_HIGH; // Set by SystemClock_Config().
+    for (uint32_t i = 0; i < CLOCK_MAX_PERIPHS && clk.cfg.spis[i] != NULL; i++)
+    {
+        uint32_t br = (clk.cfg.spis[i]->Instance->CR1 & SPI_CR1_BR) >> SPI_CR1_BR_Pos;
+        clk.spi_hz[i] = HAL_RCC_GetPCLK1Freq() >> (br + 1U);
+    }
+
+    clock_switch(CLOCK_LOW);
+    LOGI(TAG, "Initialized clock module, SYSCLK %lu Hz", SystemCoreClock);
+    return MOD_OK;
+}
+
+void clock_boost_acquire(void)
+{
+    if (clk.boosts++ == 0)
+    {
+        clock_switch(CLOCK_HIGH);
+    }
+}
+
+void clock_boost_release(void)
+{
+    if (clk.boosts > 0 && --clk.boosts == 0)
+    {
+        clock_switch(CLOCK_LOW);
+    }
+}
+
+clock_mode_t clock_mode_get(void)
+{
+    return clk.mode;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Private (static) functions
+////////////////////////////////////////////////////////////////////////////////
+
+/**
+ * @brief Display system clock operating point and transitions.
+ *
+ * @param argc Number of arguments.
+ * @param argv Argument values.
+ *
+ * @return 0 if successful, 1 otherwise.
+ */
+static uint32_t cmd_clock_status(uint32_t argc, const char **argv)
+{
+    cmd_out_str("mode", mode_names[clk.mode]);
+    cmd_out_u32("sysclk hz", SystemCoreClock);
+    cmd_out_u32("boosts", clk.boosts);
+    cmd_out_u32("transitions", clk.transitions);
+    cmd_out_u32("forced", clk.forced);
+    cmd_out_u32("errors", clk.errors);
+    return 0;
+}
+
+/**
+ * @brief Change operating point, once console and SPIs are idle or CLOCK_TX_DRAIN_MS passed.
+ *
+ * Other threads are kept out from the idle check to the switch, interrupts are masked
+ * while clocks and peripheral registers change.
+ *
+ * @param mode New operating point.
+ */
+static void clock_switch(clock_mode_t mode)
+{
+    if (mode == clk.mode)
+    {
+        return;
+    }
+
+    bool idle = false;
+    for (uint32_t waited = 0;; waited++)
+    {
+        vTaskSuspendAll();
+        idle = periphs_idle();
+        if (idle || waited >= CLOCK_TX_DRAIN_MS)
+        {
+            break;
+        }
+        xTaskResumeAll();
+        osDelay(1);
+    }
+
+    uint32_t primask = __get_PRIMASK();
+    __disable_irq();
+
+    uint32_t old_hz = HAL_RCC_GetPCLK1Freq();
+    bool ok = mode == CLOCK_HIGH ? sysclk_high() : sysclk_low();
+    uint32_t new_hz = HAL_RCC_GetPCLK1Freq();
+    if (new_hz != old_hz)
+    {
+        periphs_rescale(old_hz, new_hz);
+        SysTick->LOAD = SystemCoreClock / configTICK_RATE_HZ - 1U;
+        SysTick->VAL = 0U;
+    }
+
+    if (ok)
+    {
+        clk.mode = mode;
+        clk.transitions++;
+    }
+    else
+    {
+        clk.errors++;
+    }
+    if (!idle)
+    {
+        clk.forced++;
+    }
+
+    __set_PRIMASK(primask);
+    xTaskResumeAll();
+
+    if (!ok)
+    {
+        LOGE(TAG, "Switch to %s failed, SYSCLK %lu Hz", mode_names[mode], SystemCoreClock);
+    }
+    else
+    {
+        LOGD(TAG, "Switched to %s, SYSCLK %lu Hz", mode_names[mode], SystemCoreClock);
+    }
+}
+
+/**
+ * @brief Check that no console transmission or SPI transfer is in progress.
+ *
+ * @return true if peripherals may be rescaled.
+ */
+static bool periphs_idle(void)
+{
+    if (!console_tx_idle())
+    {
+        return false;
+    }
+    for (uint32_t i = 0; i < CLOCK_MAX_PERIPHS && clk.cfg.spis[i] != NULL; i++)
+    {
+        if (clk.cfg.spis[i]->State != HAL_SPI_STATE_READY)
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+/**
+ * @brief Raise voltage range, start PLL and make it system clock.
+ *
+ * PLL configuration of SystemClock_Config() is kept in RCC_PLLCFGR while the PLL is off.
+ *
+ * @return true if successful.
+ */
+static bool sysclk_high(void)
+{
+    if (HAL_PWREx_ControlVoltageScaling(PWR_REGULATOR_VOLTAGE_SCALE1) != HAL_OK)
+    {
+        return false;
+    }
+
+    __HAL_RCC_PLL_ENABLE();
+    while (!__HAL_RCC_GET_FLAG(RCC_FLAG_PLLRDY))
+    {
+    }
+
+    RCC_ClkInitTypeDef clk_init = {.ClockType = RCC_CLOCKTYPE_HCLK | RCC_CLOCKTYPE_SYSCLK | RCC_CLOCKTYPE_PCLK1 | RCC_CLOCKTYPE_PCLK2,
+                                   .SYSCLKSource = RCC_SYSCLKSOURCE_PLLCLK,
+                                   .AHBCLKDivider = RCC_SYSCLK_DIV1,
+                                   .APB1CLKDivider = RCC_HCLK_DIV1,
+                                   .APB2CLKDivider = RCC_HCLK_DIV1};
+    return HAL_RCC_ClockConfig(&clk_init, FLASH_LATENCY_4) == HAL_OK; // Also reconfigures HAL tick timer.
+}
+
+/**
+ * @brief Make HSI16 system clock, stop PLL and lower voltage range.
+ *
+ * @return true if successful.
+ */
+static bool sysclk_low(void)
+{
+    RCC_ClkInitTypeDef clk_init = {.ClockType = RCC_CLOCKTYPE_HCLK | RCC_CLOCKTYPE_SYSCLK | RCC_CLOCKTYPE_PCLK1 | RCC_CLOCKTYPE_PCLK2,
+                                   .SYSCLKSource = RCC_SYSCLKSOURCE_HSI,
+                                   .AHBCLKDivider = RCC_SYSCLK_DIV1,
+                                   .APB1CLKDivider = RCC_HCLK_DIV1,
+                                   .APB2CLKDivider = RCC_HCLK_DIV1};
+    if (HAL_RCC_ClockConfig(&clk_init, FLASH_LATENCY_2) != HAL_OK) // Also reconfigures HAL tick timer.
+    {
+        return false;
+    }
+
+    __HAL_RCC_PLL_DISABLE();
+    while (__HAL_RCC_GET_FLAG(RCC_FLAG_PLLRDY))
+    {
+    }
+    return HAL_PWREx_ControlVoltageScaling(PWR_REGULATOR_VOLTAGE_SCALE2) == HAL_OK;
+}
+
+/**
+ * @brief Rescale UART baud rate registers, SPI baud rate prescalers, timer prescalers and CAN bit timing.
+ *
+ * @param old_hz Bus clock before transition.
+ * @param new_hz Bus clock after transition.
+ */
+static void periphs_rescale(uint32_t old_hz, uint32_t new_hz)
+{
+    /* Baud rate register can only be written while UART is disabled. */
+    for (uint32_t i = 0; i < CLOCK_MAX_PERIPHS && clk.cfg.uarts[i] != NULL; i++)
+    {
+        USART_TypeDef *uart = clk.cfg.uarts[i];
+        uint32_t cr1 = uart->CR1;
+        CLEAR_BIT(uart->CR1, USART_CR1_UE);
+        uart->BRR = scale(uart->BRR, old_hz, new_hz);
+        uart->CR1 = cr1;
+    }
+
+    /* Closest SPI baud rate at or below the one set at init, so slave timing limits still hold.
+     * Derived from the init rate rather than the current one, which is already rounded down. */
+    for (uint32_t i = 0; i < CLOCK_MAX_PERIPHS && clk.cfg.spis[i] != NULL; i++)
+    {
+        SPI_HandleTypeDef *hspi = clk.cfg.spis[i];
+        uint32_t new_br = 0;
+        while (new_br < 7U && (new_hz >> (new_br + 1U)) > clk.spi_hz[i])
+        {
+            new_br++;
+        }
+
+        uint32_t cr1 = hspi->Instance->CR1;
+        CLEAR_BIT(hspi->Instance->CR1, SPI_CR1_SPE);
+        hspi->Instance->CR1 = (cr1 & ~SPI_CR1_BR) | (new_br << SPI_CR1_BR_Pos);
+        hspi->Init.BaudRatePrescaler = new_br << SPI_CR1_BR_Pos;
+    }
+
+    /* Stopped timers load the prescaler at once, without setting their update flag. */
+    for (uint32_t i = 0; i < CLOCK_MAX_PERIPHS && clk.cfg.tims[i] != NULL; i++)
+    {
+        TIM_HandleTypeDef *htim = clk.cfg.tims[i];
+        uint32_t psc = scale(htim->Instance->PSC + 1U, old_hz, new_hz);
+        psc = psc < 1U ? 1U : (psc > 0x10000U ? 0x10000U : psc);
+        htim->Instance->PSC = psc - 1U;
+        htim->Init.Prescaler = psc - 1U;
+        if (!(htim->Instance->CR1 & TIM_CR1_CEN))
+        {
+            uint32_t cr1 = htim->Instance->CR1;
+            SET_BIT(htim->Instance->CR1, TIM_CR1_URS);
+            htim->Instance->EGR = TIM_EGR_UG;
+            htim->Instance->CR1 = cr1;
+        }
+    }
+
+    /* Bit timing can only be written in initialization mode, entered once the bus frame ends. */
+    if (clk.cfg.can != NULL)
+    {
+        CAN_TypeDef *can = clk.cfg.can;
+        SET_BIT(can->MCR, CAN_MCR_INRQ);
+        for (uint32_t n = 0; n < CLOCK_CAN_INIT_SPINS && !(can->MSR & CAN_MSR_INAK); n++)
+        {
+        }
+        if (can->MSR & CAN_MSR_INAK)
+        {
+            uint32_t brp = scale((can->BTR & CAN_BTR_BRP) + 1U, old_hz, new_hz);
+            brp = brp < 1U ? 1U : (brp > 1024U ? 1024U : brp);
+            MODIFY_REG(can->BTR, CAN_BTR_BRP, brp - 1U);
+        }
+        CLEAR_BIT(can->MCR, CAN_MCR_INRQ);
+    }
+}
+
+/**
+ * @brief Scale register value by clock ratio, rounded to nearest.
+ *
+ * @param val Value at old clock.
+ * @param old_hz Old clock.
+ * @param new_hz New clock.
+ *
+ * @return Value at new clock.
+ */
+static inline uint32_t scale(uint32_t val, uint32_t old_hz, uint32_t new_hz)
+{
+    return (uint32_t)(((uint64_t)val * new_hz + old_hz / 2U) / old_hz);
+}
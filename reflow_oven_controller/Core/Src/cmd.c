@@ -11,12 +11,20 @@
 #include <stdlib.h>
 #include <string.h>
 #include <stdbool.h>
+#include <math.h>
+#include <stdarg.h>
 
 #include "cmd.h"
 #include "log.h"
 #include "printf.h"
 #include "active.h"
+#include "prio.h"
 #include "console.h"
+#include "prof.h"
+#include "frame.h"
+#include "modbus.h"
+#include "can.h"
+#include "sections.h"
 
 ////////////////////////////////////////////////////////////////////////////////
 // Common macros
@@ -26,22 +34,108 @@
 // Type definitions
 ////////////////////////////////////////////////////////////////////////////////
 
+/* Binary request performance measurements */
+enum
+{
+    CNT_RPC_REQS,      // Requests executed.
+    CNT_RPC_BAD,       // Frames dropped for bad CRC or layout.
+    CNT_RPC_TX_DROPS,  // Responses dropped for lack of transmit buffer space.
+    CNT_ASYNC_STEPS,   // Resumable command steps run.
+    CNT_ASYNC_CANCELS, // Resumable commands cancelled.
+
+    NUM_CMD_PMS
+};
+
 /* Command active object class */
 typedef struct
 {
     Active base; // Inherited base active object class
 
     /* Private attributes */
-    char cmd_buf[CONSOLE_CMD_BUF_SIZE]; // Command line buffer.
+    const char *tokens[CMD_MAX_TOKENS]; // Tokens of command line being executed.
+    bool batch;                         // Between "batch begin" and "batch end".
+    uint32_t batch_cmds;                // Commands executed in batch.
+    uint32_t batch_errors;              // Commands of batch that failed.
+
+    /* Machine-readable responses */
+    cmd_mode_t mode;                        // Response mode.
+    uint32_t seq;                           // Request ID of next line without "#<id>" token.
+    bool capture;                           // Command thread output goes to json_text.
+    bool rpc;                               // Executing binary request, capture is raw and fields binary.
+    uint8_t num_fields;                     // Binary fields in json_data.
+    bool capture_esc;                       // Skipping terminal escape sequence.
+    uint32_t text_len;                      // Characters in json_text.
+    uint32_t data_len;                      // Characters in json_data.
+    bool truncated;                         // Text or fields were dropped.
+    bool rc_valid;                          // Command callback ran.
+    uint32_t rc;                            // Command callback return value.
+    void *ctx;                              // Client instance of running command callback.
+    char json_text[CMD_JSON_TEXT_SIZE];     // Escaped printed output of command.
+    char json_data[CMD_JSON_DATA_SIZE];     // Structured fields of command.
+
+    /* Binary requests */
+    uint8_t rpc_buf[CMD_RPC_PAYLOAD_SIZE];                          // Decoded request, then response payload.
+    char rpc_args[CONSOLE_CMD_BUF_SIZE];                            // Request arguments as token strings.
+    uint8_t rpc_frame[FRAME_ENCODED_SIZE(CMD_RPC_PAYLOAD_SIZE)];    // Encoded response frame.
+    uint32_t rpc_pms[NUM_CMD_PMS];                                  // Binary request counters.
+
+    /* Resumable command */
+    cmd_async_step_t async_step; // Step of running resumable command, NULL if none.
+    void *async_ctx;             // Context of step.
+    console_session_t async_session; // Console session the command came from.
+    bool async_resume;           // Resume event posted or time event armed.
+    TimeEvent async_time_evt;    // Resumes command once transmit buffer drained.
+    bool async_capture;          // Output is captured, record is sent once the command finished.
+    bool async_rpc;              // Captured command is a binary request.
+    uint32_t async_id;           // Request ID of captured command.
+    mod_err_t async_err;         // Dispatch result of captured command.
 } Cmd_Active;
 
+/* Dispatch table entry of one client command */
+typedef struct
+{
+    uint8_t rank;              // Position of client in cmd_clients section.
+    const cmd_cmd_info *cci;   // Command information.
+} cmd_dispatch_entry;
+
 ////////////////////////////////////////////////////////////////////////////////
 // Private (static) function declarations
 ////////////////////////////////////////////////////////////////////////////////
 
 static mod_err_t tokenize(char *str_to_tokenize, const char **tokens, uint32_t *num_tokens); // Tokenize string.
+static inline char *next_token(char **cursor);                                                // Split next token off line.
 static mod_err_t help_handler(const char **tokens);                                          // Handle global help command.
+static mod_err_t batch_handler(const char **tokens, uint32_t num_tokens);                    // Handle global batch command.
+static mod_err_t cmd_dispatch(const char **tokens, uint32_t num_tokens);                     // Run builtin or client command.
+static mod_err_t parse_arg(const char *arg, char type, cmd_arg_val *arg_val);                // Convert argument to typed value.
+static int json_capture(char c);                                                             // Capture command output into JSON text.
+static bool json_put(char *buf, uint32_t *len, uint32_t size, char c);                       // Append JSON-escaped character.
+static void json_field(const char *key, const char *fmt, ...);                               // Append field to JSON data.
+static void capture_begin(bool rpc);                                                         // Start capturing command output.
+static void capture_end(void);                                                               // Stop capturing command output.
+static void capture_resume(void);                                                            // Capture step of resumable command.
+static void json_record(uint32_t id, mod_err_t err);                                         // Print JSON record of command.
+static void bin_field(char type, const char *key, const void *val, uint32_t len);            // Append field to binary data.
+static void out_sub_u32(const char *key, const char *sub, uint32_t val);                     // Output "key.sub" field.
+static void rpc_execute(const char *frame);                                                  // Execute binary request frame.
+static bool rpc_args_parse(const uint8_t *p, const uint8_t *end, const char **tokens, uint32_t *num_tokens); // Convert request args to tokens.
+static void rpc_respond(uint16_t id, mod_err_t err);                                         // Send response frame.
+static void rpc_busy(uint16_t id);                                                           // Send busy response frame.
+static void rpc_send(uint32_t len);                                                          // Encode and send response payload.
+static uint32_t cmd_mode_cmd(uint32_t argc, const char **argv);                              // Show or set response mode.
+static uint32_t cmd_cancel_cmd(uint32_t argc, const char **argv);                            // Cancel resumable command.
+static void async_resume(void);                                                              // Run step of resumable command.
+static void async_schedule(void);                                                            // Resume command once output fits.
+static void async_finish(void);                                                              // End resumable command, send its record.
+static bool cmd_defer(Cmd_Active *const ao, Cmd_Event const *const evt);                     // Defer line behind captured command.
+static mod_err_t pm_handler(const char **tokens, uint32_t num_tokens);                       // Handle global pm command.
+static void pm_dump(const cmd_client_info *ci, bool clear, bool prefix);                     // Print client's pms.
+static inline bool has_pms(const cmd_client_info *ci);                                       // Client provided pm info.
+static void help_print(const cmd_client_info *ci, const cmd_cmd_info *cci);                  // Print help line of command.
 static mod_err_t client_command_handler();                                                   // Handle client command.
+static void dispatch_build(void);                                                            // Sort commands for lookup.
+static int32_t client_find(const char *name);                                                // Find client by name.
+static const cmd_cmd_info *command_find(uint8_t rank, const char *name);                     // Find client command by name.
 
 /* Active object event handler */
 static void Cmd_Event_Handler(Cmd_Active *const ao, Cmd_Event const *const evt);
@@ -50,15 +144,53 @@ static void Cmd_Event_Handler(Cmd_Active *const ao, Cmd_Event const *const evt);
 // Private (static) variables
 ////////////////////////////////////////////////////////////////////////////////
 
-/* Hold information about each client */
-static const cmd_client_info *client_infos[CMD_MAX_CLIENTS];
+/* Dispatch table, sorted by name and built by command thread on its first command. Clients are
+ * sorted by the linker already, see CMD_CLIENT_DEFINE(). */
+static cmd_dispatch_entry cmd_table[CMD_MAX_COMMANDS];  // Commands sorted by client rank, then command name.
+static uint32_t num_table_cmds;                         // Number of commands in cmd_table.
+static bool dispatch_built;                             // cmd_table was built.
 
 /* Unique tag for logging module */
-static const char *TAG = "CMD";
+LOG_TAG_DEFINE("CMD");
 
 /* Command active object */
 static Cmd_Active cmd_ao;
 
+/* Statically allocated thread and event queue */
+static StaticTask_t cmd_thread_cb;
+static uint64_t SRAM2_BSS cmd_stack[ACTIVE_STACK_STORAGE_SZ(CMD_THREAD_SIZE) / sizeof(uint64_t)];
+static StaticQueue_t cmd_queue_cb;
+static Active_msg cmd_queue_mem[CMD_EVENT_MSG_COUNT];
+
+/* Command module's own commands */
+static cmd_cmd_info cmd_cmd_infos[] = {
+    {.cmd_name = "mode",
+     .cb = &cmd_mode_cmd,
+     .help = "Show or set response mode, json prints one record per command line, optionally prefixed by #<id>.\r\n"
+             "Usage: cmd mode [text | json]"},
+    {.cmd_name = "cancel",
+     .cb = &cmd_cancel_cmd,
+     .help = "Cancel running resumable command, eg. a history dump.\r\n"
+             "Usage: cmd cancel"}};
+
+/* Command module performance measurement info */
+static const cmd_pm_info cmd_pm_infos[] = {
+    {"RPC REQS", CMD_PM_U32, &cmd_ao.rpc_pms[CNT_RPC_REQS]},
+    {"RPC BAD FRAMES", CMD_PM_U32, &cmd_ao.rpc_pms[CNT_RPC_BAD]},
+    {"RPC TX DROPS", CMD_PM_U32, &cmd_ao.rpc_pms[CNT_RPC_TX_DROPS]},
+    {"ASYNC STEPS", CMD_PM_U32, &cmd_ao.rpc_pms[CNT_ASYNC_STEPS]},
+    {"ASYNC CANCELS", CMD_PM_U32, &cmd_ao.rpc_pms[CNT_ASYNC_CANCELS]}};
+
+/* Client information for command module */
+CMD_CLIENT_DEFINE(cmd,
+                  .num_cmds = ARRAY_SIZE(cmd_cmd_infos),
+                  .cmds = cmd_cmd_infos,
+                  .num_u16_pms = 0,
+                  .u16_pms = NULL,
+                  .u16_pm_names = NULL,
+                  .num_pms = ARRAY_SIZE(cmd_pm_infos),
+                  .pms = cmd_pm_infos);
+
 ////////////////////////////////////////////////////////////////////////////////
 // Public (global) variables and externs
 ////////////////////////////////////////////////////////////////////////////////
@@ -78,35 +210,235 @@ mod_err_t cmd_init(void)
 {
     Active_ctor((Active *)&cmd_ao, (EventHandler)&Cmd_Event_Handler); // Call base active object constructor.
     cmd_base = &(cmd_ao.base);
-    memset(cmd_ao.cmd_buf, 0, CONSOLE_CMD_BUF_SIZE); // Initialize private variables.
+    memset(cmd_ao.tokens, 0, sizeof(cmd_ao.tokens)); // Initialize private variables.
+    cmd_ao.mode = CMD_MODE_TEXT;
+    TimeEvent_ctor(&cmd_ao.async_time_evt, CMD_RESUME_SIG, cmd_base);
+
+    /* Client names must be unique and lower case, else lookup misses clients. */
+    for (const cmd_client_info *ci = __start_cmd_clients + 1; ci < __stop_cmd_clients; ci++)
+    {
+        ASSERT(strcasecmp(ci[-1].client_name, ci->client_name) < 0);
+    }
     LOGI(TAG, "Initialized command.");
     return MOD_OK;
 }
 
 mod_err_t cmd_start()
 {
-    static const osThreadAttr_t thread_attr = {.stack_size = CMD_THREAD_SIZE};
-    return Active_start((Active *)&cmd_ao, &thread_attr, CMD_EVENT_MSG_COUNT, NULL);
+    static const osThreadAttr_t thread_attr = {.name = "cmd",
+                                               .cb_mem = &cmd_thread_cb,
+                                               .cb_size = sizeof(cmd_thread_cb),
+                                               .stack_mem = cmd_stack,
+                                               .stack_size = sizeof(cmd_stack)};
+    static const osMessageQueueAttr_t queue_attr = {.cb_mem = &cmd_queue_cb,
+                                                    .cb_size = sizeof(cmd_queue_cb),
+                                                    .mq_mem = cmd_queue_mem,
+                                                    .mq_size = sizeof(cmd_queue_mem)};
+    return Active_start((Active *)&cmd_ao, PRIO_CMD, &thread_attr, CMD_EVENT_MSG_COUNT, &queue_attr);
+}
+
+void *cmd_ctx(void)
+{
+    return cmd_ao.ctx;
+}
+
+cmd_mode_t cmd_get_mode(void)
+{
+    return cmd_ao.rpc ? CMD_MODE_BINARY : cmd_ao.mode;
+}
+
+mod_err_t cmd_async_start(cmd_async_step_t step, void *ctx)
+{
+    ASSERT(step != NULL);
+    if (cmd_ao.async_step != NULL)
+    {
+        LOG("Another command is running, cmd cancel first\r\n");
+        return MOD_ERR_RESOURCE;
+    }
+
+    cmd_ao.async_step = step;
+    cmd_ao.async_ctx = ctx;
+    cmd_ao.async_session = console_reply_get();
+
+    /* Record must follow all output, so steps are captured too and it is sent by async_finish(). */
+    cmd_ao.async_capture = cmd_ao.capture;
+    cmd_ao.async_rpc = cmd_ao.rpc;
+    async_schedule();
+    return MOD_OK;
+}
+
+mod_err_t cmd_tokenize(char *line, const char **tokens, uint32_t *num_tokens)
+{
+    return tokenize(line, tokens, num_tokens);
+}
+
+void cmd_out_u32(const char *key, uint32_t val)
+{
+    if (cmd_ao.rpc)
+    {
+        bin_field('u', key, &val, sizeof(val));
+    }
+    else if (cmd_ao.capture)
+    {
+        json_field(key, "%lu", val);
+    }
+    else
+    {
+        LOG("%s: %lu\r\n", key, val);
+    }
+}
+
+void cmd_out_i32(const char *key, int32_t val)
+{
+    if (cmd_ao.rpc)
+    {
+        bin_field('i', key, &val, sizeof(val));
+    }
+    else if (cmd_ao.capture)
+    {
+        json_field(key, "%ld", val);
+    }
+    else
+    {
+        LOG("%s: %ld\r\n", key, val);
+    }
+}
+
+void cmd_out_float(const char *key, float val)
+{
+    if (cmd_ao.rpc)
+    {
+        bin_field('f', key, &val, sizeof(val)); // Non-finite values are sent as they are.
+    }
+    else if (!cmd_ao.capture)
+    {
+        LOG("%s: %.4f\r\n", key, val);
+    }
+    else if (isfinite(val))
+    {
+        json_field(key, "%.6g", val);
+    }
+    else
+    {
+        json_field(key, "null");
+    }
+}
+
+void cmd_out_str(const char *key, const char *val)
+{
+    if (cmd_ao.rpc)
+    {
+        size_t len = strlen(val);
+        bin_field('s', key, val, len > UINT8_MAX ? UINT8_MAX : len);
+        return;
+    }
+    if (!cmd_ao.capture)
+    {
+        LOG("%s: %s\r\n", key, val);
+        return;
+    }
+
+    uint32_t start = cmd_ao.data_len;
+    json_field(key, "\"");
+    bool fits = cmd_ao.data_len > start;
+    while (fits && *val != '\0')
+    {
+        fits = json_put(cmd_ao.json_data, &cmd_ao.data_len, CMD_JSON_DATA_SIZE, *val++);
+    }
+    fits = fits && cmd_ao.data_len + 1U < CMD_JSON_DATA_SIZE;
+    if (!fits)
+    {
+        cmd_ao.data_len = start; // Drop partial field.
+        cmd_ao.json_data[start] = '\0';
+        cmd_ao.truncated = true;
+        return;
+    }
+    cmd_ao.json_data[cmd_ao.data_len++] = '"';
+    cmd_ao.json_data[cmd_ao.data_len] = '\0';
+}
+
+void cmd_pm_add_u64(uint64_t *pm, uint32_t n)
+{
+    uint32_t primask = __get_PRIMASK();
+    __disable_irq();
+    *pm += n;
+    __set_PRIMASK(primask);
+}
+
+void cmd_pm_record(cmd_pm_minmax_t *pm, uint32_t val)
+{
+    uint32_t primask = __get_PRIMASK();
+    __disable_irq();
+    if (pm->count == 0 || val < pm->min)
+    {
+        pm->min = val;
+    }
+    if (pm->count == 0 || val > pm->max)
+    {
+        pm->max = val;
+    }
+    if (pm->count < UINT32_MAX)
+    {
+        pm->count++;
+        pm->sum += val;
+    }
+    __set_PRIMASK(primask);
+}
+
+void cmd_pm_record_hist(cmd_pm_hist_t *pm, uint32_t val)
+{
+    uint32_t idx = val;
+    if (val >= CMD_PM_HIST_SUB)
+    {
+        uint32_t msb = 31U - __CLZ(val);
+        uint32_t shift = msb - CMD_PM_HIST_SUB_BITS;
+        idx = (shift + 1U) * CMD_PM_HIST_SUB + ((val >> shift) & (CMD_PM_HIST_SUB - 1U));
+    }
+
+    uint32_t primask = __get_PRIMASK();
+    __disable_irq();
+    if (pm->count < UINT32_MAX)
+    {
+        pm->count++;
+        pm->buckets[idx]++;
+    }
+    if (val > pm->max)
+    {
+        pm->max = val;
+    }
+    __set_PRIMASK(primask);
 }
 
-mod_err_t cmd_register(const cmd_client_info *_client_info)
+uint32_t cmd_pm_hist_percentile(const cmd_pm_hist_t *hist, uint32_t pct)
 {
-    for (uint8_t i = 0; i < CMD_MAX_CLIENTS; i++)
+    if (hist->count == 0)
     {
-        if (client_infos[i] == NULL || strcasecmp(client_infos[i]->client_name, _client_info->client_name) == 0)
+        return 0;
+    }
+
+    /* Rank of percentile value, rounded up. */
+    uint32_t rank = (uint32_t)(((uint64_t)hist->count * pct + 99U) / 100U);
+    uint32_t seen = 0;
+    for (uint32_t i = 0; i < CMD_PM_HIST_BUCKETS; i++)
+    {
+        seen += hist->buckets[i];
+        if (seen >= rank)
         {
-            client_infos[i] = _client_info;
-            LOGI(TAG, "Registered commands for %s module", client_infos[i]->client_name);
-            return MOD_OK;
+            if (i < CMD_PM_HIST_SUB)
+            {
+                return i;
+            }
+            uint32_t shift = i / CMD_PM_HIST_SUB - 1U;
+            uint64_t upper = ((uint64_t)(CMD_PM_HIST_SUB + i % CMD_PM_HIST_SUB + 1U) << shift) - 1U;
+            return upper < hist->max ? (uint32_t)upper : hist->max;
         }
     }
-    return MOD_ERR_RESOURCE;
+    return hist->max;
 }
 
 int32_t cmd_parse_args(int32_t argc, const char **argv, const char *fmt, cmd_arg_val *arg_vals)
 {
     int32_t arg_cnt = 0;
-    char *endptr;
     bool opt_args = false;
 
     while (*fmt)
@@ -130,7 +462,7 @@ int32_t cmd_parse_args(int32_t argc, const char **argv, const char *fmt, cmd_arg
                 return arg_cnt;
             }
             printf("Insufficient arguments\r\n");
-            return MOD_ERR_BAD_CMD;
+            return -(int32_t)MOD_ERR_BAD_CMD;
         }
 
         // These error conditions should not occur, but we check them for
@@ -138,41 +470,13 @@ int32_t cmd_parse_args(int32_t argc, const char **argv, const char *fmt, cmd_arg
         if (*argv == NULL || **argv == '\0')
         {
             printf("Invalid empty arguments\r\n");
-            return MOD_ERR_BAD_CMD;
+            return -(int32_t)MOD_ERR_BAD_CMD;
         }
 
-        switch (*fmt)
+        mod_err_t err = parse_arg(*argv, *fmt, arg_vals);
+        if (err != MOD_OK)
         {
-        case 'i':
-            arg_vals->val.i = strtol(*argv, &endptr, 0);
-            if (*endptr)
-            {
-                printf("Argument '%s' not a valid integer\r\n", *argv);
-                return MOD_ERR_ARG;
-            }
-            break;
-        case 'u':
-            arg_vals->val.u = strtoul(*argv, &endptr, 0);
-            if (*endptr)
-            {
-                printf("Argument '%s' not a valid unsigned integer\r\n", *argv);
-                return MOD_ERR_ARG;
-            }
-            break;
-        case 'p':
-            arg_vals->val.p = (void *)strtoul(*argv, &endptr, 16);
-            if (*endptr)
-            {
-                printf("Argument '%s' not a valid pointer\r\n", *argv);
-                return MOD_ERR_ARG;
-            }
-            break;
-        case 's':
-            arg_vals->val.s = *argv;
-            break;
-        default:
-            printf("Bad argument format '%c'\n", *fmt);
-            return MOD_ERR_ARG;
+            return -(int32_t)err;
         }
         arg_vals->type = *fmt;
         arg_vals++;
@@ -184,15 +488,129 @@ int32_t cmd_parse_args(int32_t argc, const char **argv, const char *fmt, cmd_arg
     if (arg_cnt < argc)
     {
         printf("Too many arguments \r\n");
-        return MOD_ERR_BAD_CMD;
+        return -(int32_t)MOD_ERR_BAD_CMD;
     }
     return arg_cnt;
 }
 
+int32_t cmd_parse_kv(int32_t argc, const char **argv, const cmd_kv_spec *specs, uint32_t num_specs,
+                     cmd_arg_val *arg_vals)
+{
+    for (uint32_t k = 0; k < num_specs; k++)
+    {
+        arg_vals[k].type = '\0';
+    }
+
+    int32_t num_keys = 0;
+    int32_t i = 0;
+    while (i < argc)
+    {
+        /* Split "key=value" argument, else value is the next argument. */
+        const char *arg = argv[i++];
+        const char *eq = strchr(arg, '=');
+        size_t key_len = (eq != NULL) ? (size_t)(eq - arg) : strlen(arg);
+        const char *value = NULL;
+        if (eq != NULL)
+        {
+            value = eq + 1;
+        }
+        else if (i < argc)
+        {
+            value = argv[i++];
+        }
+
+        uint32_t k = 0;
+        while (k < num_specs && !(strlen(specs[k].key) == key_len && strncasecmp(arg, specs[k].key, key_len) == 0))
+        {
+            k++;
+        }
+        if (k == num_specs)
+        {
+            printf("Unknown argument '%.*s'\r\n", (int)key_len, arg);
+            return -(int32_t)MOD_ERR_ARG;
+        }
+        if (arg_vals[k].type != '\0')
+        {
+            printf("Argument '%s' given twice\r\n", specs[k].key);
+            return -(int32_t)MOD_ERR_ARG;
+        }
+        if (value == NULL || *value == '\0')
+        {
+            printf("Missing value for '%s'\r\n", specs[k].key);
+            return -(int32_t)MOD_ERR_BAD_CMD;
+        }
+
+        mod_err_t err = parse_arg(value, specs[k].type, &arg_vals[k]);
+        if (err != MOD_OK)
+        {
+            return -(int32_t)err;
+        }
+        arg_vals[k].type = specs[k].type;
+        num_keys++;
+    }
+    return num_keys;
+}
+
 ////////////////////////////////////////////////////////////////////////////////
 // Private (static) functions
 ////////////////////////////////////////////////////////////////////////////////
 
+/**
+ * @brief Convert one argument string to a value of a cmd_parse_args() format letter type.
+ *
+ * @param arg Argument string, not empty.
+ * @param type Format letter.
+ * @param[out] arg_val Parsed value.
+ *
+ * @return MOD_OK if successful, else a "MOD_ERR" value. Error message is printed.
+ */
+static mod_err_t parse_arg(const char *arg, char type, cmd_arg_val *arg_val)
+{
+    char *endptr;
+    switch (type)
+    {
+    case 'i':
+        arg_val->val.i = strtol(arg, &endptr, 0);
+        if (*endptr)
+        {
+            printf("Argument '%s' not a valid integer\r\n", arg);
+            return MOD_ERR_ARG;
+        }
+        break;
+    case 'u':
+        arg_val->val.u = strtoul(arg, &endptr, 0);
+        if (*endptr)
+        {
+            printf("Argument '%s' not a valid unsigned integer\r\n", arg);
+            return MOD_ERR_ARG;
+        }
+        break;
+    case 'p':
+        arg_val->val.p = (void *)strtoul(arg, &endptr, 16);
+        if (*endptr)
+        {
+            printf("Argument '%s' not a valid pointer\r\n", arg);
+            return MOD_ERR_ARG;
+        }
+        break;
+    case 'f':
+        arg_val->val.f = strtof(arg, &endptr);
+        if (*endptr || !isfinite(arg_val->val.f))
+        {
+            printf("Argument '%s' not a valid number\r\n", arg);
+            return MOD_ERR_ARG;
+        }
+        break;
+    case 's':
+        arg_val->val.s = arg;
+        break;
+    default:
+        printf("Bad argument format '%c'\n", type);
+        return MOD_ERR_ARG;
+    }
+    return MOD_OK;
+}
+
 /**
  * @brief Execute a command line.
  *
@@ -205,9 +623,10 @@ int32_t cmd_parse_args(int32_t argc, const char **argv, const char *fmt, cmd_arg
  */
 static mod_err_t cmd_execute(char *cmd_line)
 {
-    LOGI(TAG, "Command received: %s", cmd_line);
+    /* Line is recycled with its event, so it must not be passed to a deferred log record. */
+    LOGI(TAG, "Command received, %lu characters", (uint32_t)strlen(cmd_line));
     uint32_t num_tokens = 0;
-    const char *tokens[CMD_MAX_TOKENS] = {0}; // Store individual tokens as strings.
+    const char **tokens = cmd_ao.tokens; // Too large for command thread stack.
 
     /* Tokenize command line */
     mod_err_t err = tokenize(cmd_line, tokens, &num_tokens);
@@ -216,20 +635,120 @@ static mod_err_t cmd_execute(char *cmd_line)
         return err;
     }
 
+    /* Take request ID from leading "#<id>" token. */
+    const char **args = tokens;
+    uint32_t id = cmd_ao.seq++;
+    if (num_tokens > 0 && args[0][0] == '#')
+    {
+        char *end;
+        id = strtoul(args[0] + 1, &end, 10);
+        if (args[0][1] == '\0' || *end != '\0')
+        {
+            LOG("Invalid request ID: %s\r\n", args[0]);
+            return MOD_ERR_BAD_CMD;
+        }
+        args++;
+        num_tokens--;
+    }
+
     /* If there are no tokens, nothing to do. */
     if (num_tokens == 0)
     {
         return MOD_OK;
     }
 
+    /* Deferral ring was full, output and record of the captured command must not be mixed. */
+    if (cmd_ao.async_capture)
+    {
+        if (cmd_ao.mode == CMD_MODE_JSON)
+        {
+            printf("{\"id\":%lu,\"status\":%d,\"data\":{},\"text\":\"Another command is running\"}\r\n", id,
+                   (int)MOD_ERR_RESOURCE);
+        }
+        else
+        {
+            LOG("Another command is running, line dropped\r\n");
+        }
+        return MOD_ERR_RESOURCE;
+    }
+
+    if (cmd_ao.mode != CMD_MODE_JSON)
+    {
+        return cmd_dispatch(args, num_tokens);
+    }
+
+    /* Collect output of command, then print it as a single record. */
+    capture_begin(false);
+    err = cmd_dispatch(args, num_tokens);
+    capture_end();
+
+    if (cmd_ao.async_capture)
+    {
+        cmd_ao.async_id = id;
+        cmd_ao.async_err = err;
+        return err;
+    }
+    json_record(id, err);
+    return err;
+}
+
+/**
+ * @brief Print captured output and fields of command as a single JSON record.
+ *
+ * @param id Request ID.
+ * @param err Dispatch result.
+ */
+static void json_record(uint32_t id, mod_err_t err)
+{
+    printf("{\"id\":%lu,\"status\":%d", id, (int)err);
+    if (cmd_ao.rc_valid)
+    {
+        printf(",\"rc\":%ld", (int32_t)cmd_ao.rc);
+    }
+    printf(",\"data\":{%s},\"text\":\"%s\"%s}\r\n", cmd_ao.json_data, cmd_ao.json_text,
+           cmd_ao.truncated ? ",\"truncated\":true" : "");
+}
+
+/**
+ * @brief Run builtin or client command of tokenized command line.
+ *
+ * @param tokens Array of token strings, at least one.
+ * @param num_tokens Number of tokens.
+ *
+ * @return MOD_OK for success, else a "MOD_ERR" value.
+ */
+static mod_err_t cmd_dispatch(const char **tokens, uint32_t num_tokens)
+{
     /* Handle help/? command. */
-    err = help_handler(tokens);
+    mod_err_t err = help_handler(tokens);
+    if (err != MOD_DID_NOTHING)
+    {
+        return err;
+    }
+
+    /* Handle batch command. */
+    err = batch_handler(tokens, num_tokens);
+    if (err != MOD_DID_NOTHING)
+    {
+        return err;
+    }
+
+    /* Handle pm all command. */
+    err = pm_handler(tokens, num_tokens);
     if (err != MOD_DID_NOTHING)
     {
         return err;
     }
 
     err = client_command_handler(tokens, num_tokens);
+    if (cmd_ao.batch)
+    {
+        cmd_ao.batch_cmds++;
+        if (err != MOD_OK)
+        {
+            cmd_ao.batch_errors++;
+        }
+    }
     return err;
 }
 
@@ -246,50 +765,19 @@ static mod_err_t cmd_execute(char *cmd_line)
  */
 static inline mod_err_t tokenize(char *str_to_tokenize, const char **tokens, uint32_t *num_tokens)
 {
-    char *ptr = str_to_tokenize;
+    char *cursor = str_to_tokenize;
     uint32_t token_count = 0;
 
     /* Iterate through each token. */
-    while (1)
+    char *token;
+    while ((token = next_token(&cursor)) != NULL)
     {
-        /* Find start of token. */
-        while (*ptr != '\0' && isspace((unsigned char)*ptr))
-        {
-            ptr++;
-        }
-
-        if (*ptr == '\0') // Found end of line.
-        {
-            break;
-        }
-        else
+        if (token_count >= CMD_MAX_TOKENS)
         {
-            if (token_count >= CMD_MAX_TOKENS)
-            {
-                LOGW(TAG, "Too many tokens");
-                return MOD_ERR_BAD_CMD;
-            }
-            else
-            {
-                /* Record pointer to start of token, then find end of token. */
-                tokens[token_count] = ptr;
-                ptr++;
-                token_count++;
-                while (*ptr != '\0' && !isspace((unsigned char)*ptr))
-                {
-                    ptr++;
-                }
-                if (*ptr != '\0')
-                {
-                    *ptr = '\0'; // Terminate end of token.
-                    ptr++;
-                }
-                else
-                {
-                    break; // Found end of line ('\0'), no more tokens.
-                }
-            }
+            LOGW(TAG, "Too many tokens");
+            return MOD_ERR_BAD_CMD;
         }
+        tokens[token_count++] = token;
     }
 
     *num_tokens = token_count;
@@ -297,31 +785,72 @@ static inline mod_err_t tokenize(char *str_to_tokenize, const char **tokens, uin
 }
 
 /**
- * @brief Handle global help command.
- * 
- * @param tokens Array of token strings.
- * 
- * @return MOD_OK if successful, 
- *         MOD_DID_NOTHING if not a global help command, 
- *         otherwise a "MOD_ERR" value.
- * 
- * Iterates through each client infos 
+ * @brief Split next token off line, terminating it in place.
+ *
+ * Line is scanned once, each call resumes where the previous token ended.
+ *
+ * @param cursor Scan position in line, advanced past token.
+ *
+ * @return Token, NULL once end of line is reached.
  */
-static inline mod_err_t help_handler(const char **tokens)
+static inline char *next_token(char **cursor)
 {
-    if (strcasecmp("help", tokens[0]) == 0 || strcasecmp("?", tokens[0]) == 0)
+    char *ptr = *cursor;
+
+    /* Find start of token. */
+    while (*ptr != '\0' && isspace((unsigned char)*ptr))
+    {
+        ptr++;
+    }
+    if (*ptr == '\0') // Found end of line.
+    {
+        *cursor = ptr;
+        return NULL;
+    }
+
+    /* Find end of token. */
+    char *token = ptr;
+    while (*ptr != '\0' && !isspace((unsigned char)*ptr))
+    {
+        ptr++;
+    }
+    if (*ptr != '\0')
     {
+        *ptr++ = '\0'; // Terminate end of token.
+    }
+    *cursor = ptr;
+    return token;
+}
+
+/**
+ * @brief Handle global help command.
+ * 
+ * @param tokens Array of token strings.
+ * 
+ * @return MOD_OK if successful, 
+ *         MOD_DID_NOTHING if not a global help command, 
+ *         otherwise a "MOD_ERR" value.
+ * 
+ * Iterates through each client infos 
+ */
+static inline mod_err_t help_handler(const char **tokens)
+{
+    if (strcasecmp("help", tokens[0]) == 0 || strcasecmp("?", tokens[0]) == 0)
+    {
+        /* Names and help text are constant, they are streamed without formatting. */
+        LOG_STR(LOG_RESET_COLOUR);
+
         /* Iterate through commands of each client. */
-        for (uint8_t i = 0; client_infos[i] != NULL && i < CMD_MAX_CLIENTS; i++)
+        for (const cmd_client_info *ci = __start_cmd_clients; ci < __stop_cmd_clients; ci++)
         {
-            const cmd_client_info *ci = client_infos[i];
 
-            LOG("%s (", ci->client_name);
+            LOG_STR(ci->client_name);
+            LOG_STR(" (");
 
-            if (ci->num_u16_pms > 0 && ci->num_cmds == 0)
+            if (has_pms(ci) && ci->num_cmds == 0)
             {
                 /* If client provided pm info only, display pm command. */
-                LOG("pm)\r\n");
+                LOG_STR("pm)\r\n");
                 continue;
             }
             else if (ci->num_cmds == 0)
@@ -334,22 +863,64 @@ static inline mod_err_t help_handler(const char **tokens)
                 for (i2 = 0; i2 < ci->num_cmds; i2++)
                 {
                     const cmd_cmd_info *cci = &(ci->cmds[i2]);
-                    LOG("%s%s", i2 == 0 ? "" : ", ", cci->cmd_name);
+                    LOG_STR(i2 == 0 ? "" : ", ");
+                    LOG_STR(cci->cmd_name);
                 }
-                if (ci->num_u16_pms > 0)
+                if (has_pms(ci))
                 {
-                    LOG(", pm");
+                    LOG_STR(", pm");
                 }
-                LOG(")\r\n");
+                LOG_STR(")\r\n");
             }
         }
 
+        LOG_STR("batch (begin, end)\r\n"
+                "pm (all)\r\n");
         return MOD_OK;
     }
 
     return MOD_DID_NOTHING; // Not a top-level help command.
 }
 
+/**
+ * @brief Handle global batch command.
+ *
+ * @param tokens Array of token strings.
+ * @param num_tokens Number of tokens.
+ *
+ * @return MOD_OK if successful,
+ *         MOD_DID_NOTHING if not a batch command,
+ *         otherwise a "MOD_ERR" value.
+ *
+ * Console stops echoing between "batch begin" and "batch end". Commands of a
+ * batch are counted and "batch end" reports how many were executed and failed.
+ */
+static inline mod_err_t batch_handler(const char **tokens, uint32_t num_tokens)
+{
+    if (strcasecmp("batch", tokens[0]) != 0)
+    {
+        return MOD_DID_NOTHING;
+    }
+
+    if (num_tokens == 2 && strcasecmp(tokens[1], "begin") == 0)
+    {
+        cmd_ao.batch = true;
+        cmd_ao.batch_cmds = 0;
+        cmd_ao.batch_errors = 0;
+        LOG("<Batch begin>\r\n");
+        return MOD_OK;
+    }
+    if (num_tokens == 2 && strcasecmp(tokens[1], "end") == 0)
+    {
+        LOG("<Batch end: %lu commands, %lu failed>\r\n", cmd_ao.batch_cmds, cmd_ao.batch_errors);
+        cmd_ao.batch = false;
+        return MOD_OK;
+    }
+
+    LOG("batch: begin or end a batch of commands without echo, args: begin | end\r\n");
+    return MOD_ERR_BAD_CMD;
+}
+
 /**
  * @brief Handle client-specific commands.
  * 
@@ -362,15 +933,16 @@ static inline mod_err_t help_handler(const char **tokens)
  */
 static inline mod_err_t client_command_handler(const char **tokens, uint32_t num_tokens)
 {
-    for (uint8_t i = 0; client_infos[i] != NULL && i < CMD_MAX_CLIENTS; i++)
+    if (!dispatch_built)
     {
-        const cmd_client_info *ci = client_infos[i];
+        dispatch_build();
+    }
 
-        /* Look for correct client first */
-        if (strcasecmp(tokens[0], ci->client_name) != 0)
-        {
-            continue;
-        }
+    /* Look for correct client first */
+    int32_t rank = client_find(tokens[0]);
+    if (rank >= 0)
+    {
+        const cmd_client_info *ci = &__start_cmd_clients[rank];
 
         /* If there is no command with client, assume they want help. */
         if (num_tokens == 1)
@@ -382,17 +954,17 @@ static inline mod_err_t client_command_handler(const char **tokens, uint32_t num
         if (strcasecmp(tokens[1], "help") == 0 || strcasecmp(tokens[1], "?") == 0)
         {
             /* Print out all commands associated with client */
+            LOG_STR(LOG_RESET_COLOUR);
             for (uint8_t i2 = 0; i2 < ci->num_cmds; i2++)
             {
-                const cmd_cmd_info *cci = &(ci->cmds[i2]);
-                LOG("%s %s: %s\r\n", ci->client_name, cci->cmd_name, cci->help);
+                help_print(ci, &ci->cmds[i2]);
             }
             /* If client provided pm info, print help for pm command also. */
-            if (ci->num_u16_pms > 0)
+            if (has_pms(ci))
             {
-                LOG("%s pm: get or clear performance measurements, "
-                    "args: [clear] \r\n",
-                    ci->client_name);
+                LOG_STR(ci->client_name);
+                LOG_STR(" pm: get performance measurements, clear resets them after printing, "
+                        "args: [clear] \r\n");
             }
 
             return MOD_OK;
@@ -401,48 +973,37 @@ static inline mod_err_t client_command_handler(const char **tokens, uint32_t num
         /* Handle pm command directly. */
         if (strcasecmp(tokens[1], "pm") == 0)
         {
-            if (ci->num_u16_pms > 0)
+            if (has_pms(ci))
             {
                 bool clear = (num_tokens >= 3 && strcasecmp(tokens[2], "clear") == 0);
-                if (clear)
-                {
-                    LOG("Clearing %s performance measurements\r\n", ci->client_name);
-                }
-                else
-                {
-                    LOG("%s pms:\r\n", ci->client_name);
-                }
-                for (uint8_t i2 = 0; i2 < ci->num_u16_pms; i2++)
-                {
-                    if (clear)
-                    {
-                        ci->u16_pms[i2] = 0;
-                    }
-                    else
-                    {
-                        LOG("%s: %d\r\n", ci->u16_pm_names[i2], ci->u16_pms[i2]);
-                    }
-                }
+                LOG("%s pms%s:\r\n", ci->client_name, clear ? " (cleared)" : "");
+                pm_dump(ci, clear, false);
             }
 
             return MOD_OK;
         }
 
         /* Look for command within client. */
-        for (uint8_t i2 = 0; i2 < ci->num_cmds; i2++)
+        const cmd_cmd_info *cci = command_find((uint8_t)rank, tokens[1]);
+        if (cci != NULL)
         {
-            if (strcasecmp(tokens[1], ci->cmds[i2].cmd_name) == 0)
+            if (num_tokens == 3 && (strcasecmp(tokens[2], "help") == 0 || strcasecmp(tokens[2], "?") == 0))
             {
-                if (num_tokens == 3 && (strcasecmp(tokens[2], "help") == 0 || strcasecmp(tokens[2], "?") == 0))
-                {
-                    LOG("%s %s: %s\r\n", ci->client_name, ci->cmds[i2].cmd_name, ci->cmds[i2].help);
-                }
-                else
+                LOG_STR(LOG_RESET_COLOUR);
+                help_print(ci, cci);
+            }
+            else
+            {
+                cmd_ao.ctx = ci->ctx;
+                cmd_ao.rc = cci->cb(num_tokens - 2, tokens + 2); // Ignore client and command tokens.
+                cmd_ao.ctx = NULL;
+                cmd_ao.rc_valid = true;
+                if (cmd_ao.rc != 0)
                 {
-                    ci->cmds[i2].cb(num_tokens - 2, tokens + 2); // Ignore client and command tokens.
+                    return MOD_ERR;
                 }
-                return MOD_OK;
             }
+            return MOD_OK;
         }
 
         LOG("No such command (%s %s)\r\n", tokens[0], tokens[1]);
@@ -459,6 +1020,863 @@ static inline mod_err_t client_command_handler(const char **tokens, uint32_t num
     return MOD_ERR_BAD_CMD;
 }
 
+/**
+ * @brief Build sorted command table for binary search dispatch.
+ *
+ * Runs in the command thread, so the table never changes under a lookup. Commands are sorted
+ * by insertion, which is cheap for one build.
+ */
+static void dispatch_build(void)
+{
+    dispatch_built = true;
+
+    /* Sort commands by client rank, then by name. */
+    num_table_cmds = 0;
+    for (const cmd_client_info *ci = __start_cmd_clients; ci < __stop_cmd_clients; ci++)
+    {
+        uint8_t rank = (uint8_t)(ci - __start_cmd_clients);
+        for (uint32_t c = 0; c < ci->num_cmds; c++)
+        {
+            if (num_table_cmds >= CMD_MAX_COMMANDS)
+            {
+                LOGE(TAG, "Dispatch table full, %s %s and later commands unavailable", ci->client_name, ci->cmds[c].cmd_name);
+                return;
+            }
+            uint32_t j = num_table_cmds++;
+            while (j > 0 && cmd_table[j - 1].rank == rank &&
+                   strcasecmp(cmd_table[j - 1].cci->cmd_name, ci->cmds[c].cmd_name) > 0)
+            {
+                cmd_table[j] = cmd_table[j - 1];
+                j--;
+            }
+            cmd_table[j] = (cmd_dispatch_entry){.rank = rank, .cci = &ci->cmds[c]};
+        }
+    }
+}
+
+/**
+ * @brief Find client by name.
+ *
+ * @param name Client name, case insensitive.
+ *
+ * @return Position of client in cmd_clients section, -1 if there is none of that name.
+ */
+static int32_t client_find(const char *name)
+{
+    int32_t lo = 0;
+    int32_t hi = (int32_t)(__stop_cmd_clients - __start_cmd_clients) - 1;
+    while (lo <= hi)
+    {
+        int32_t mid = (lo + hi) / 2;
+        int cmp = strcasecmp(name, __start_cmd_clients[mid].client_name);
+        if (cmp == 0)
+        {
+            return mid;
+        }
+        else if (cmp < 0)
+        {
+            hi = mid - 1;
+        }
+        else
+        {
+            lo = mid + 1;
+        }
+    }
+    return -1;
+}
+
+/**
+ * @brief Find client command by name.
+ *
+ * @param rank Position of client in cmd_clients section.
+ * @param name Command name, case insensitive.
+ *
+ * @return Command information, NULL if client has no such command.
+ */
+static const cmd_cmd_info *command_find(uint8_t rank, const char *name)
+{
+    int32_t lo = 0;
+    int32_t hi = (int32_t)num_table_cmds - 1;
+    while (lo <= hi)
+    {
+        int32_t mid = (lo + hi) / 2;
+        const cmd_dispatch_entry *e = &cmd_table[mid];
+        int cmp = (rank != e->rank) ? (int)rank - (int)e->rank : strcasecmp(name, e->cci->cmd_name);
+        if (cmp == 0)
+        {
+            return e->cci;
+        }
+        else if (cmp < 0)
+        {
+            hi = mid - 1;
+        }
+        else
+        {
+            lo = mid + 1;
+        }
+    }
+    return NULL;
+}
+
+/**
+ * @brief Capture output printed by command thread into JSON text (printf capture hook).
+ *
+ * Terminal escape sequences (log colours) and carriage returns are dropped, other
+ * characters are escaped. Output of other threads and ISRs is printed as usual.
+ *
+ * @return Non-zero if character was consumed.
+ */
+static int json_capture(char c)
+{
+    if (__get_IPSR() != 0U || osThreadGetId() != cmd_ao.base.thread_id)
+    {
+        return 0;
+    }
+
+    if (cmd_ao.capture_esc)
+    {
+        cmd_ao.capture_esc = !isalpha((unsigned char)c); // Sequence ends with a letter.
+        return 1;
+    }
+    if (c == '\033')
+    {
+        cmd_ao.capture_esc = true;
+        return 1;
+    }
+    if (c == '\r')
+    {
+        return 1;
+    }
+
+    if (cmd_ao.rpc)
+    {
+        if (cmd_ao.text_len < CMD_RPC_TEXT_SIZE)
+        {
+            cmd_ao.json_text[cmd_ao.text_len++] = c; // Sent raw, length is prefixed.
+        }
+        else
+        {
+            cmd_ao.truncated = true;
+        }
+        return 1;
+    }
+
+    if (!json_put(cmd_ao.json_text, &cmd_ao.text_len, CMD_JSON_TEXT_SIZE, c))
+    {
+        cmd_ao.truncated = true;
+    }
+    return 1;
+}
+
+/**
+ * @brief Append JSON-escaped character to string buffer, keeping it terminated.
+ *
+ * @param buf String buffer.
+ * @param[in/out] len Characters in buffer.
+ * @param size Buffer size.
+ * @param c Character.
+ *
+ * @return true if appended, false if buffer is full.
+ */
+static bool json_put(char *buf, uint32_t *len, uint32_t size, char c)
+{
+    char esc[7];
+    uint32_t n = 0;
+    if (c == '"' || c == '\\')
+    {
+        esc[n++] = '\\';
+        esc[n++] = c;
+    }
+    else if (c == '\n')
+    {
+        esc[n++] = '\\';
+        esc[n++] = 'n';
+    }
+    else if (c == '\t')
+    {
+        esc[n++] = '\\';
+        esc[n++] = 't';
+    }
+    else if ((unsigned char)c < 0x20U)
+    {
+        n = (uint32_t)snprintf(esc, sizeof(esc), "\\u%04x", (unsigned)c);
+    }
+    else
+    {
+        esc[n++] = c;
+    }
+
+    if (*len + n >= size)
+    {
+        return false;
+    }
+    memcpy(&buf[*len], esc, n);
+    *len += n;
+    buf[*len] = '\0';
+    return true;
+}
+
+/**
+ * @brief Append "key":value field to JSON data, value formatted from fmt.
+ *
+ * Field is dropped and record marked truncated if it does not fit.
+ */
+static void json_field(const char *key, const char *fmt, ...)
+{
+    uint32_t start = cmd_ao.data_len;
+    uint32_t space = CMD_JSON_DATA_SIZE - start;
+    int n = snprintf(&cmd_ao.json_data[start], space, "%s\"%s\":", start > 0 ? "," : "", key);
+    if (n > 0 && (uint32_t)n < space)
+    {
+        va_list va;
+        va_start(va, fmt);
+        int m = vsnprintf(&cmd_ao.json_data[start + n], space - n, fmt, va);
+        va_end(va);
+        if (m >= 0 && (uint32_t)(n + m) < space)
+        {
+            cmd_ao.data_len = start + n + m;
+            return;
+        }
+    }
+    cmd_ao.json_data[start] = '\0';
+    cmd_ao.truncated = true;
+}
+
+/**
+ * @brief Start capturing output of command thread, clearing previous output.
+ *
+ * @param rpc Capture for binary response, else JSON record.
+ */
+static void capture_begin(bool rpc)
+{
+    cmd_ao.text_len = 0;
+    cmd_ao.data_len = 0;
+    cmd_ao.num_fields = 0;
+    cmd_ao.json_text[0] = '\0';
+    cmd_ao.json_data[0] = '\0';
+    cmd_ao.truncated = false;
+    cmd_ao.rc_valid = false;
+    cmd_ao.capture_esc = false;
+    cmd_ao.rpc = rpc;
+    cmd_ao.capture = true;
+    printf_set_capture(json_capture);
+}
+
+/**
+ * @brief Stop capturing output of command thread.
+ */
+static void capture_end(void)
+{
+    printf_set_capture(NULL);
+    cmd_ao.capture = false;
+    cmd_ao.rpc = false;
+}
+
+/**
+ * @brief Resume capturing output of captured resumable command for its next step, keeping
+ *        output collected so far.
+ */
+static void capture_resume(void)
+{
+    cmd_ao.rpc = cmd_ao.async_rpc;
+    cmd_ao.capture = true;
+    printf_set_capture(json_capture);
+}
+
+/**
+ * @brief Append type, key and value of field to binary data.
+ *
+ * Field is dropped and response marked truncated if it does not fit.
+ *
+ * @param type Field type character.
+ * @param key Field key.
+ * @param val Value bytes, little-endian.
+ * @param len Number of value bytes, strings are prefixed with it.
+ */
+static void bin_field(char type, const char *key, const void *val, uint32_t len)
+{
+    size_t key_len = strlen(key);
+    uint32_t size = 2U + (uint32_t)key_len + (type == 's' ? 1U : 0U) + len;
+    if (key_len > UINT8_MAX || cmd_ao.num_fields == UINT8_MAX || cmd_ao.data_len + size > CMD_JSON_DATA_SIZE)
+    {
+        cmd_ao.truncated = true;
+        return;
+    }
+
+    uint8_t *p = (uint8_t *)&cmd_ao.json_data[cmd_ao.data_len];
+    *p++ = (uint8_t)type;
+    *p++ = (uint8_t)key_len;
+    memcpy(p, key, key_len);
+    p += key_len;
+    if (type == 's')
+    {
+        *p++ = (uint8_t)len;
+    }
+    memcpy(p, val, len);
+    cmd_ao.data_len += size;
+    cmd_ao.num_fields++;
+}
+
+/**
+ * @brief Output field named "key.sub", for measurements with several values.
+ */
+static void out_sub_u32(const char *key, const char *sub, uint32_t val)
+{
+    char sub_key[48];
+    snprintf(sub_key, sizeof(sub_key), "%s.%s", key, sub);
+    cmd_out_u32(sub_key, val);
+}
+
+/**
+ * @brief Decode and execute binary request frame, then send response frame.
+ *
+ * @param frame Encoded frame without delimiter, terminated by '\0' (COBS never encodes zeros).
+ */
+static void rpc_execute(const char *frame)
+{
+    size_t len = 0;
+    size_t frame_len = strlen(frame);
+    if (frame_len > sizeof(cmd_ao.rpc_buf) ||
+        frame_decode((const uint8_t *)frame, frame_len, cmd_ao.rpc_buf, &len) != MOD_OK ||
+        len < 4U || cmd_ao.rpc_buf[0] != CMD_RPC_REQ)
+    {
+        INC_SAT_U32(cmd_ao.rpc_pms[CNT_RPC_BAD]);
+        return;
+    }
+
+    const uint8_t *p = cmd_ao.rpc_buf;
+    uint16_t id = (uint16_t)(p[1] | (p[2] << 8));
+    uint32_t num_tokens = 0;
+    const char **tokens = cmd_ao.tokens;
+    if (!rpc_args_parse(&p[3], &p[len], tokens, &num_tokens))
+    {
+        INC_SAT_U32(cmd_ao.rpc_pms[CNT_RPC_BAD]);
+        return;
+    }
+    INC_SAT_U32(cmd_ao.rpc_pms[CNT_RPC_REQS]);
+
+    /* Deferral ring was full, output of the captured command must not be mixed. */
+    if (cmd_ao.async_capture)
+    {
+        rpc_busy(id);
+        return;
+    }
+
+    capture_begin(true);
+    mod_err_t err = num_tokens > 0 ? cmd_dispatch(tokens, num_tokens) : MOD_OK;
+    capture_end();
+    if (cmd_ao.async_capture)
+    {
+        cmd_ao.async_id = id;
+        cmd_ao.async_err = err;
+        return;
+    }
+    rpc_respond(id, err);
+}
+
+/**
+ * @brief Convert binary request arguments to token strings in rpc_args.
+ *
+ * @param p Argument count byte of decoded request.
+ * @param end End of decoded request.
+ * @param[out] tokens Token strings.
+ * @param[out] num_tokens Number of tokens.
+ *
+ * @return true if every argument is well-formed and fits.
+ */
+static bool rpc_args_parse(const uint8_t *p, const uint8_t *end, const char **tokens, uint32_t *num_tokens)
+{
+    uint32_t argc = *p++;
+    if (argc > CMD_MAX_TOKENS)
+    {
+        return false;
+    }
+
+    char *arg = cmd_ao.rpc_args;
+    char *const args_end = &cmd_ao.rpc_args[sizeof(cmd_ao.rpc_args)];
+    for (uint32_t i = 0; i < argc; i++)
+    {
+        if (p >= end)
+        {
+            return false;
+        }
+        char type = (char)*p++;
+        uint32_t space = (uint32_t)(args_end - arg);
+        int n = -1;
+        if (type == 's')
+        {
+            uint32_t str_len = p < end ? *p++ : UINT32_MAX;
+            if (str_len > (uint32_t)(end - p) || str_len >= space)
+            {
+                return false;
+            }
+            memcpy(arg, p, str_len);
+            arg[str_len] = '\0';
+            p += str_len;
+            n = (int)str_len;
+        }
+        else if (type == 'b')
+        {
+            static const char digits[] = "0123456789abcdef";
+            uint32_t bin_len = p < end ? *p++ : UINT32_MAX;
+            if (bin_len > (uint32_t)(end - p) || 2U * bin_len >= space)
+            {
+                return false;
+            }
+            for (uint32_t j = 0; j < bin_len; j++)
+            {
+                arg[2U * j] = digits[p[j] >> 4];
+                arg[2U * j + 1U] = digits[p[j] & 0x0FU];
+            }
+            arg[2U * bin_len] = '\0';
+            p += bin_len;
+            n = (int)(2U * bin_len);
+        }
+        else if ((type == 'u' || type == 'i' || type == 'f') && end - p >= 4)
+        {
+            uint32_t raw = (uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+            p += 4;
+            if (type == 'u')
+            {
+                n = snprintf(arg, space, "%lu", raw);
+            }
+            else if (type == 'i')
+            {
+                n = snprintf(arg, space, "%ld", (int32_t)raw);
+            }
+            else
+            {
+                float f;
+                memcpy(&f, &raw, sizeof(f));
+                n = snprintf(arg, space, "%.9g", f); // Enough digits to parse back to the same float.
+            }
+        }
+        if (n < 0 || (uint32_t)n >= space)
+        {
+            return false;
+        }
+        tokens[i] = arg;
+        arg += n + 1;
+    }
+
+    *num_tokens = argc;
+    return p == end;
+}
+
+/**
+ * @brief Build response of executed binary request and send it as one frame.
+ *
+ * @param id Request ID.
+ * @param err Dispatch result.
+ */
+static void rpc_respond(uint16_t id, mod_err_t err)
+{
+    uint8_t *const buf = cmd_ao.rpc_buf;
+    uint32_t len = 0;
+    buf[len++] = CMD_RPC_RSP;
+    buf[len++] = (uint8_t)id;
+    buf[len++] = (uint8_t)(id >> 8);
+    buf[len++] = (uint8_t)err;
+    buf[len++] = (cmd_ao.rc_valid ? 0x01U : 0U) | (cmd_ao.truncated ? 0x02U : 0U);
+    memcpy(&buf[len], &cmd_ao.rc, sizeof(cmd_ao.rc));
+    len += sizeof(cmd_ao.rc);
+    buf[len++] = cmd_ao.num_fields;
+    memcpy(&buf[len], cmd_ao.json_data, cmd_ao.data_len);
+    len += cmd_ao.data_len;
+    buf[len++] = (uint8_t)cmd_ao.text_len;
+    buf[len++] = (uint8_t)(cmd_ao.text_len >> 8);
+    memcpy(&buf[len], cmd_ao.json_text, cmd_ao.text_len);
+    len += cmd_ao.text_len;
+    rpc_send(len);
+}
+
+/**
+ * @brief Answer binary request with MOD_ERR_RESOURCE, without fields or text, while a
+ *        captured command runs.
+ *
+ * @param id Request ID.
+ */
+static void rpc_busy(uint16_t id)
+{
+    uint8_t *const buf = cmd_ao.rpc_buf;
+    uint32_t len = 0;
+    buf[len++] = CMD_RPC_RSP;
+    buf[len++] = (uint8_t)id;
+    buf[len++] = (uint8_t)(id >> 8);
+    buf[len++] = (uint8_t)MOD_ERR_RESOURCE;
+    buf[len++] = 0U;
+    memset(&buf[len], 0, sizeof(cmd_ao.rc));
+    len += sizeof(cmd_ao.rc);
+    buf[len++] = 0U; // No fields.
+    buf[len++] = 0U; // No text.
+    buf[len++] = 0U;
+    rpc_send(len);
+}
+
+/**
+ * @brief Encode response payload of rpc_buf and send it as one frame.
+ *
+ * @param len Payload length.
+ */
+static void rpc_send(uint32_t len)
+{
+    size_t frame_len = frame_encode(cmd_ao.rpc_buf, len, cmd_ao.rpc_frame, sizeof(cmd_ao.rpc_frame));
+
+    /* Frame is written whole or not at all, wait while console output drains. */
+    for (uint32_t waited = 0; console_write((const char *)cmd_ao.rpc_frame, frame_len) == MOD_ERR_BUF_OVERRUN; waited++)
+    {
+        if (waited >= CMD_RPC_TX_TIMEOUT_MS)
+        {
+            INC_SAT_U32(cmd_ao.rpc_pms[CNT_RPC_TX_DROPS]);
+            return;
+        }
+        osDelay(1);
+    }
+}
+
+/**
+ * @brief Handle global pm command, "pm all [clear]" dumps pms of every client.
+ *
+ * @return MOD_OK if successful,
+ *         MOD_DID_NOTHING if not a global pm command,
+ *         otherwise a "MOD_ERR" value.
+ */
+static mod_err_t pm_handler(const char **tokens, uint32_t num_tokens)
+{
+    if (strcasecmp("pm", tokens[0]) != 0)
+    {
+        return MOD_DID_NOTHING;
+    }
+
+    bool clear = num_tokens == 3 && strcasecmp(tokens[2], "clear") == 0;
+    if (num_tokens < 2 || strcasecmp(tokens[1], "all") != 0 || (num_tokens == 3 && !clear) || num_tokens > 3)
+    {
+        LOG("pm: get performance measurements of every client, args: all [clear]\r\n");
+        return MOD_ERR_BAD_CMD;
+    }
+
+    for (const cmd_client_info *ci = __start_cmd_clients; ci < __stop_cmd_clients; ci++)
+    {
+        if (has_pms(ci))
+        {
+            pm_dump(ci, clear, true);
+        }
+    }
+    return MOD_OK;
+}
+
+/**
+ * @brief Print performance measurements of client, optionally clearing them.
+ *
+ * Each measurement is copied and cleared with interrupts masked, so increments
+ * from ISRs between printing and clearing are never lost. Gauges are not cleared.
+ *
+ * @param ci Client information.
+ * @param clear Reset measurements once copied.
+ * @param prefix Prefix names with client name.
+ */
+static void pm_dump(const cmd_client_info *ci, bool clear, bool prefix)
+{
+    char key[40];
+    for (uint32_t i = 0; i < ci->num_u16_pms; i++)
+    {
+        uint32_t primask = __get_PRIMASK();
+        __disable_irq();
+        uint16_t val = ci->u16_pms[i];
+        if (clear)
+        {
+            ci->u16_pms[i] = 0;
+        }
+        __set_PRIMASK(primask);
+
+        snprintf(key, sizeof(key), "%s%s%s", prefix ? ci->client_name : "", prefix ? "." : "", ci->u16_pm_names[i]);
+        cmd_out_u32(key, val);
+    }
+
+    for (uint32_t i = 0; i < ci->num_pms; i++)
+    {
+        const cmd_pm_info *pm = &ci->pms[i];
+        snprintf(key, sizeof(key), "%s%s%s", prefix ? ci->client_name : "", prefix ? "." : "", pm->name);
+
+        /* Histograms are too large for the command thread stack, only it dumps pms. */
+        static cmd_pm_hist_t hist;
+        union
+        {
+            uint32_t u32;
+            uint64_t u64;
+            int32_t gauge;
+            cmd_pm_minmax_t minmax;
+        } snap;
+        uint32_t primask = __get_PRIMASK();
+        __disable_irq();
+        switch (pm->type)
+        {
+        case CMD_PM_U32:
+            snap.u32 = *(uint32_t *)pm->val;
+            if (clear)
+            {
+                *(uint32_t *)pm->val = 0;
+            }
+            break;
+        case CMD_PM_U64:
+            snap.u64 = *(uint64_t *)pm->val;
+            if (clear)
+            {
+                *(uint64_t *)pm->val = 0;
+            }
+            break;
+        case CMD_PM_GAUGE:
+            snap.gauge = *(int32_t *)pm->val;
+            break;
+        case CMD_PM_MINMAX:
+            snap.minmax = *(cmd_pm_minmax_t *)pm->val;
+            if (clear)
+            {
+                memset(pm->val, 0, sizeof(cmd_pm_minmax_t));
+            }
+            break;
+        case CMD_PM_HIST:
+            hist = *(cmd_pm_hist_t *)pm->val;
+            if (clear)
+            {
+                memset(pm->val, 0, sizeof(cmd_pm_hist_t));
+            }
+            break;
+        }
+        __set_PRIMASK(primask);
+
+        switch (pm->type)
+        {
+        case CMD_PM_U32:
+            cmd_out_u32(key, snap.u32);
+            break;
+        case CMD_PM_U64:
+            if (cmd_ao.rpc)
+            {
+                bin_field('q', key, &snap.u64, sizeof(snap.u64));
+            }
+            else if (cmd_ao.capture)
+            {
+                json_field(key, "%llu", snap.u64);
+            }
+            else
+            {
+                LOG("%s: %llu\r\n", key, snap.u64);
+            }
+            break;
+        case CMD_PM_GAUGE:
+            cmd_out_i32(key, snap.gauge);
+            break;
+        case CMD_PM_MINMAX:
+        {
+            uint32_t mean = snap.minmax.count > 0 ? (uint32_t)(snap.minmax.sum / snap.minmax.count) : 0;
+            if (cmd_ao.rpc)
+            {
+                out_sub_u32(key, "min", snap.minmax.min);
+                out_sub_u32(key, "max", snap.minmax.max);
+                out_sub_u32(key, "mean", mean);
+                out_sub_u32(key, "count", snap.minmax.count);
+            }
+            else if (cmd_ao.capture)
+            {
+                json_field(key, "{\"min\":%lu,\"max\":%lu,\"mean\":%lu,\"count\":%lu}",
+                           snap.minmax.min, snap.minmax.max, mean, snap.minmax.count);
+            }
+            else
+            {
+                LOG("%s: min %lu max %lu mean %lu (%lu values)\r\n",
+                    key, snap.minmax.min, snap.minmax.max, mean, snap.minmax.count);
+            }
+            break;
+        }
+        case CMD_PM_HIST:
+        {
+            uint32_t p50 = cmd_pm_hist_percentile(&hist, 50);
+            uint32_t p99 = cmd_pm_hist_percentile(&hist, 99);
+            if (cmd_ao.rpc)
+            {
+                out_sub_u32(key, "p50", p50);
+                out_sub_u32(key, "p99", p99);
+                out_sub_u32(key, "max", hist.max);
+                out_sub_u32(key, "count", hist.count);
+            }
+            else if (cmd_ao.capture)
+            {
+                json_field(key, "{\"p50\":%lu,\"p99\":%lu,\"max\":%lu,\"count\":%lu}",
+                           p50, p99, hist.max, hist.count);
+            }
+            else
+            {
+                LOG("%s: p50 %lu p99 %lu max %lu (%lu values)\r\n", key, p50, p99, hist.max, hist.count);
+            }
+            break;
+        }
+        }
+    }
+}
+
+/**
+ * @brief Client provided performance measurement info.
+ */
+static inline bool has_pms(const cmd_client_info *ci)
+{
+    return ci->num_u16_pms > 0 || ci->num_pms > 0;
+}
+
+/**
+ * @brief Print "client cmd: help" line of a command, streamed without formatting.
+ *
+ * @param ci Client info.
+ * @param cci Command info of client.
+ */
+static void help_print(const cmd_client_info *ci, const cmd_cmd_info *cci)
+{
+    LOG_STR(ci->client_name);
+    LOG_STR(" ");
+    LOG_STR(cci->cmd_name);
+    LOG_STR(": ");
+    LOG_STR(cci->help);
+    LOG_STR("\r\n");
+}
+
+/**
+ * @brief Show or set response mode.
+ */
+static uint32_t cmd_mode_cmd(uint32_t argc, const char **argv)
+{
+    if (argc == 1 && strcasecmp(argv[0], "text") == 0)
+    {
+        cmd_ao.mode = CMD_MODE_TEXT;
+    }
+    else if (argc == 1 && strcasecmp(argv[0], "json") == 0)
+    {
+        cmd_ao.mode = CMD_MODE_JSON;
+    }
+    else if (argc != 0)
+    {
+        LOG("Invalid mode, expected text or json\r\n");
+        return 1;
+    }
+    cmd_out_str("mode", cmd_ao.mode == CMD_MODE_JSON ? "json" : "text");
+    return 0;
+}
+
+/**
+ * @brief Cancel running resumable command.
+ */
+static uint32_t cmd_cancel_cmd(uint32_t argc, const char **argv)
+{
+    (void)argv;
+    if (argc != 0)
+    {
+        LOG("Usage: cmd cancel\r\n");
+        return 1;
+    }
+    if (cmd_ao.async_step == NULL)
+    {
+        LOG("No command running\r\n");
+        return 1;
+    }
+
+    /* A pending resume event finds no command and is ignored. */
+    cmd_async_step_t step = cmd_ao.async_step;
+    cmd_ao.async_step = NULL;
+    step(cmd_ao.async_ctx, true);
+    INC_SAT_U32(cmd_ao.rpc_pms[CNT_ASYNC_CANCELS]);
+    return 0;
+}
+
+/**
+ * @brief Run next step of resumable command once transmit buffer has room for it.
+ */
+static void async_resume(void)
+{
+    cmd_ao.async_resume = false;
+    if (cmd_ao.async_step == NULL)
+    {
+        return;
+    }
+    console_reply_set(cmd_ao.async_session); // Output continues on the session of the command.
+    if (console_tx_free() >= CMD_ASYNC_CHUNK)
+    {
+        INC_SAT_U32(cmd_ao.rpc_pms[CNT_ASYNC_STEPS]);
+        if (cmd_ao.async_capture)
+        {
+            capture_resume();
+        }
+        cmd_async_status_t status = cmd_ao.async_step(cmd_ao.async_ctx, false);
+        if (cmd_ao.async_capture)
+        {
+            capture_end(); // Lines of other sessions print between steps.
+        }
+        if (status == CMD_ASYNC_DONE)
+        {
+            async_finish();
+            return;
+        }
+    }
+    async_schedule();
+}
+
+/**
+ * @brief End resumable command, sending the record of a captured one, and recall the first
+ *        line deferred behind it.
+ */
+static void async_finish(void)
+{
+    cmd_ao.async_step = NULL;
+    if (!cmd_ao.async_capture)
+    {
+        return;
+    }
+    cmd_ao.async_capture = false;
+    if (cmd_ao.async_rpc)
+    {
+        rpc_respond((uint16_t)cmd_ao.async_id, cmd_ao.async_err);
+    }
+    else
+    {
+        json_record(cmd_ao.async_id, cmd_ao.async_err);
+    }
+    Active_recall(cmd_base);
+}
+
+/**
+ * @brief Defer command line or request frame while output of a resumable command is captured.
+ *
+ * Deferred events are recalled one at a time, each once the one before it executed, so they
+ * keep their order ahead of lines queued meanwhile.
+ *
+ * @param ao Command active object.
+ * @param evt Command event.
+ *
+ * @return true if deferred, false if it is to be executed now.
+ */
+static bool cmd_defer(Cmd_Active *const ao, Cmd_Event const *const evt)
+{
+    return ao->async_capture && Active_defer(&ao->base, &evt->base) == MOD_OK;
+}
+
+/**
+ * @brief Resume command behind queued lines, or poll until the transmit buffer drained.
+ *
+ * Only one resume is outstanding, so lines and steps take turns in the event queue.
+ */
+static void async_schedule(void)
+{
+    if (cmd_ao.async_resume)
+    {
+        return;
+    }
+    cmd_ao.async_resume = true;
+
+    static const Event resume_evt = {.sig = CMD_RESUME_SIG};
+    if (console_tx_free() < CMD_ASYNC_CHUNK || Active_post(cmd_base, &resume_evt) != MOD_OK)
+    {
+        TimeEvent_arm(&cmd_ao.async_time_evt, TIME_EVENT_MS(CMD_ASYNC_RETRY_MS), 0);
+    }
+}
+
 /**
  * Command event handler.
  *
@@ -470,12 +1888,47 @@ static void Cmd_Event_Handler(Cmd_Active *const ao, Cmd_Event const *const evt)
     switch (evt->base.sig)
     {
     case INIT_SIG:
+        dispatch_build();
     	LOGI(TAG, "Command active object initialized.");
         break;
     case CMD_RX_SIG:
-        /* Copy command line to avoid race conditions. */
-        strncpy(cmd_ao.cmd_buf, evt->cmd_line, CONSOLE_CMD_BUF_SIZE);
-        cmd_execute(cmd_ao.cmd_buf);
+        if (cmd_defer(ao, evt))
+        {
+            break;
+        }
+        /* Event is only posted to the command active object and
+         * recycled after this handler, so tokenize its line in place. */
+        console_reply_set((console_session_t)evt->session);
+        PROF_BEGIN(cmd_execute);
+        cmd_execute((char *)evt->cmd_line);
+        PROF_END(cmd_execute);
+        if (!ao->async_capture)
+        {
+            Active_recall(&ao->base); // Next line deferred behind a captured command, if any.
+        }
+        break;
+    case CMD_RPC_SIG:
+        if (cmd_defer(ao, evt))
+        {
+            break;
+        }
+        console_reply_set((console_session_t)evt->session);
+        PROF_BEGIN(rpc_execute);
+        rpc_execute(evt->cmd_line);
+        PROF_END(rpc_execute);
+        if (!ao->async_capture)
+        {
+            Active_recall(&ao->base);
+        }
+        break;
+    case CMD_RESUME_SIG:
+        async_resume();
+        break;
+    case CMD_MODBUS_SIG:
+        modbus_execute((Modbus_Event const *)evt);
+        break;
+    case CMD_CAN_SIG:
+        can_execute((Can_Event const *)evt);
         break;
     default:
         LOGW(TAG, "Unknown event signal");
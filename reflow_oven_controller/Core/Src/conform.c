@@ -0,0 +1,95 @@
+/**
+ * @file conform.c
+ * @author Timothy Nguyen
+ * @brief Profile conformance scoring: reflow run metrics checked against paste limits.
+ * @version 0.1
+ * @date 2021-08-29
+ */
+
+#include <math.h>
+
+#include "conform.h"
+#include "log.h"
+
+#define CONFORM_WINDOW_LEN (CONFORM_RATE_WINDOW + 1U)
+
+void Conform_Init(Conform_t * const conf, Conform_cfg_t const * const cfg)
+{
+	ASSERT(cfg->soak_lo < cfg->soak_hi);
+
+	conf->cfg = *cfg;
+	Conform_Reset(conf);
+}
+
+void Conform_Reset(Conform_t * const conf)
+{
+	for (uint8_t m = 0; m < CONFORM_NUM_METRICS; m++)
+	{
+		conf->value[m] = 0.0f;
+	}
+	conf->value[CONFORM_PEAK] = -INFINITY;
+	conf->tracked = 0;
+	conf->liquidus_reached = false;
+	conf->win_span = 0.0f;
+	conf->head = 0;
+	conf->count = 0;
+}
+
+void Conform_Update(Conform_t * const conf, float temp, float setpoint, float Ts, bool tracked)
+{
+	float *const value = conf->value;
+	value[CONFORM_PEAK] = fmaxf(value[CONFORM_PEAK], temp);
+	if (temp >= conf->cfg.liquidus)
+	{
+		value[CONFORM_TAL] += Ts;
+		conf->liquidus_reached = true;
+	}
+	else if (!conf->liquidus_reached && temp >= conf->cfg.soak_lo && temp < conf->cfg.soak_hi)
+	{
+		value[CONFORM_SOAK] += Ts;
+	}
+	if (tracked)
+	{
+		float err = setpoint - temp;
+		value[CONFORM_RMS] += err * err;
+		conf->tracked++;
+	}
+
+	/* Ramp rate over window ending at this sample, oldest sample drops out once it is full. */
+	uint8_t idx = (conf->head + conf->count) % CONFORM_WINDOW_LEN;
+	if (conf->count == CONFORM_WINDOW_LEN)
+	{
+		conf->head = (conf->head + 1U) % CONFORM_WINDOW_LEN;
+		conf->win_span -= conf->win_dt[conf->head];
+	}
+	else
+	{
+		conf->count++;
+	}
+	conf->win_temp[idx] = temp;
+	conf->win_dt[idx] = conf->count > 1 ? Ts : 0.0f;
+	conf->win_span += conf->win_dt[idx];
+	if (conf->count == CONFORM_WINDOW_LEN && conf->win_span > 0.0f)
+	{
+		float rate = (temp - conf->win_temp[conf->head]) / conf->win_span;
+		value[CONFORM_RAMP] = fmaxf(value[CONFORM_RAMP], rate);
+	}
+}
+
+uint32_t Conform_Finish(Conform_t const * const conf, float value[CONFORM_NUM_METRICS])
+{
+	uint32_t failed = 0;
+	for (uint8_t m = 0; m < CONFORM_NUM_METRICS; m++)
+	{
+		value[m] = conf->value[m];
+	}
+	value[CONFORM_RMS] = conf->tracked > 0 ? sqrtf(conf->value[CONFORM_RMS] / (float)conf->tracked) : 0.0f;
+	for (uint8_t m = 0; m < CONFORM_NUM_METRICS; m++)
+	{
+		if (!(value[m] >= conf->cfg.min[m] && value[m] <= conf->cfg.max[m]))
+		{
+			failed |= 1UL << m;
+		}
+	}
+	return failed;
+}
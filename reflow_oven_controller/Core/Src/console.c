@@ -8,6 +8,7 @@
 
 #include <ctype.h>
 #include <string.h>
+#include <strings.h>
 #include <stdbool.h>
 #include <stdint.h>
 #include <stdio.h>
@@ -15,56 +16,219 @@
 #include "console.h"
 #include "common.h"
 #include "uart.h"
+#include "telemetry.h"
+#include "usb_cdc.h"
+#include "rtt.h"
 #include "cmd.h"
 #include "log.h"
 #include "printf.h"
 #include "active.h"
+#include "ringbuf.h"
+#include "frame.h"
+#include "prio.h"
+#include "sections.h"
+#include "work.h"
 
 ////////////////////////////////////////////////////////////////////////////////
 // Common macros
 ////////////////////////////////////////////////////////////////////////////////
 
+_Static_assert(ACTIVE_SOURCES, "Console waits on its receive semaphore through a queue set");
+
+/* Console signals */
+enum console_signals
+{
+    CONSOLE_RETRY_SIG = USER_SIG, // Retry posting held lines and frames.
+};
+
+#define ESC_SEQ_MAX_PARAM 99U // Largest escape sequence parameter kept, larger ones are clamped.
+
+#define ECHO_FILL_SIZE 64U // Backspaces or blanks written to terminal per block.
+
 ////////////////////////////////////////////////////////////////////////////////
 // Type definitions
 ////////////////////////////////////////////////////////////////////////////////
 
+/* Escape sequence parser states */
+typedef enum
+{
+    ESC_NONE, // Not in escape sequence.
+    ESC_ESC,  // ESC received.
+    ESC_CSI,  // ESC [ received, collecting parameter digits.
+} Esc_state_t;
+
+/* Console session structure, one per transport */
+typedef struct
+{
+    console_session_t id; // Session of transport.
+    uint32_t rx_drops;    // Characters dropped because receive ring buffer was full.
+    uint32_t tx_drops;    // Blocks dropped by transport's transmit buffer.
+
+    ringbuf_t rx_ring;                       // Received characters, filled by transport ISR.
+    uint8_t rx_ring_buf[CONSOLE_RX_BUF_SIZE]; // Receive ring buffer storage.
+    char cmd_buf[CONSOLE_CMD_BUF_SIZE]; // Hold command characters as they are entered by user over serial.
+    uint16_t num_cmd_buf_chars;         // Holds number of characters currently in command buffer.
+    uint16_t cursor;                    // Cursor position in command buffer, at most num_cmd_buf_chars.
+
+    /* Command history */
+    char history[CONSOLE_HISTORY_DEPTH][CONSOLE_HISTORY_LINE_SIZE]; // Previous lines, ring buffer.
+    char draft[CONSOLE_HISTORY_LINE_SIZE];                          // Line being edited before history was browsed.
+    uint8_t hist_head;                                         // Index where next line is stored.
+    uint8_t hist_count;                                        // Number of stored lines.
+    uint8_t hist_pos;                                          // Recalled line, 1 is most recent, 0 is the draft.
+
+    /* Binary request frame, see cmd.h */
+    char frame_buf[CONSOLE_CMD_BUF_SIZE]; // Encoded frame bytes, without delimiters.
+    uint16_t frame_len;                   // Number of bytes in frame buffer.
+    bool in_frame;                        // Delimiter received, bytes belong to frame.
+    bool frame_overflow;                  // Frame exceeded buffer, dropped at its end.
+
+    /* Escape sequence parser */
+    Esc_state_t esc_state; // Parser state.
+    uint8_t esc_param;     // Numeric parameter of CSI sequence.
+
+    bool batch;                         // Batch mode, characters are not echoed.
+
+    /* Line or frame waiting for command queue space, see console_release() */
+    bool held;          // Completed line or frame (in_frame) not yet posted, ring is not read.
+    uint32_t held_tick; // Kernel tick of first post attempt.
+} Console_session_t;
+
 /* Console active object structure */
 typedef struct
 {
+    Active base; // Inherit base active object class.
+
     /* OS objects */
-    osThreadId_t console_thread_id;      // Console thread ID.
-    osMessageQueueId_t console_queue_id; // Console message queue ID.
-    osSemaphoreId_t console_sem_id;      // Console semaphore ID.
+    osSemaphoreId_t rx_sem; // Given when received characters are ready to be processed.
+    TimeEvent retry_evt;    // Retries posting held lines and frames.
 
     /* Private attributes */
-    char rx_char;                       // Received character from message queue.
-    char cmd_buf[CONSOLE_CMD_BUF_SIZE]; // Hold command characters as they are entered by user over serial.
-    uint16_t num_cmd_buf_chars;         // Holds number of characters currently in command buffer.
-    bool first_run_done;                // First run, print PROMPT before checking for command characters
+    Console_session_t *sessions[CONSOLE_NUM_SESSIONS]; // Sessions of built in transports, NULL for others.
+    uint8_t subs[CONSOLE_NUM_SESSIONS];                // Output subscriptions of sessions, CONSOLE_SUB_x.
+    console_session_t reply;                           // Session receiving command output.
 } Console_t;
 
 ////////////////////////////////////////////////////////////////////////////////
 // Private (static) function declarations
 ////////////////////////////////////////////////////////////////////////////////
 
-static inline void post_cmd_event(void); // Post command event to command active object.
+static inline bool post_cmd_event(Console_session_t *s, Signal sig, const char *buf, uint16_t len); // Post command event to command active object.
+
+static bool console_release(Console_session_t *s); // Post completed line or frame, or hold it for a retry.
+
+static void console_drain(Console_session_t *s); // Process received characters of session.
 
-static void Console_thread(void *argument); // Console thread function.
+static inline void console_frame(Console_session_t *s, char c); // Collect binary request frame.
 
-static inline mod_err_t console_process(char c); // Process received character from UART queue.
+static inline void console_batch_check(Console_session_t *s, const char *line); // Enter or leave batch mode on batch line.
+
+static void console_evt_handler(Active *const ao, Event const *const evt); // Console event handler.
+
+static void console_rx_handler(Active *const ao, QueueSetMemberHandle_t source); // Process received characters.
+
+static inline mod_err_t console_process(Console_session_t *s, char c); // Process received character of session.
+
+static inline bool console_escape(Console_session_t *s, char c); // Feed character to escape sequence parser.
+
+static void console_echo(Console_session_t *s, const char *buf, size_t len); // Write raw characters to terminal.
+
+static void console_back(Console_session_t *s, uint16_t n); // Move terminal cursor left.
+
+static void console_blank(Console_session_t *s, uint16_t n); // Blank characters after terminal cursor.
+
+static void console_redraw_tail(Console_session_t *s, uint16_t erased); // Redraw line from cursor.
+
+static void console_history_add(Console_session_t *s); // Store completed line in history.
+
+static void console_history_recall(Console_session_t *s, int8_t dir); // Replace line with older or newer history line.
+
+static inline void console_notify(void); // Wake console active object to process received characters.
+
+static mod_err_t session_write(console_session_t session, const char *buf, size_t len); // Write block to session's transport.
+
+static size_t session_tx_free(console_session_t session); // Free space of session's transmit buffer.
+
+static uint32_t console_sessions_cmd(uint32_t argc, const char **argv); // List sessions.
+
+static uint32_t console_sub_cmd(uint32_t argc, const char **argv); // Show or set subscriptions of session.
+
+static void console_wake(void *arg); // Give receive semaphore, work item of console_notify().
 
 ////////////////////////////////////////////////////////////////////////////////
 // Private (static) variables
 ////////////////////////////////////////////////////////////////////////////////
 
-/* Console_t object */
-static Console_t console;
+/* Statically allocated console thread, kept with ACTIVE_COOPERATIVE as it waits on a queue set */
+static StaticTask_t console_thread_cb;
+static uint64_t SRAM2_BSS console_stack[CONSOLE_THREAD_STACK_SIZE / sizeof(uint64_t)];
+
+/* Statically allocated event queue, receive semaphore and queue set of both */
+static StaticQueue_t console_queue_cb;
+static Active_msg console_queue_mem[CONSOLE_MSG_COUNT];
+static StaticSemaphore_t console_rx_sem_cb;
+static StaticQueue_t console_set_cb;
+static QueueSetMemberHandle_t console_set_mem[CONSOLE_MSG_COUNT + 1U];
+
+/* Sources of console active object besides its event queue */
+static Active_source console_sources[1];
+
+/* Sessions of built in transports */
+#if CONSOLE_UART
+static Console_session_t session_uart;
+#define SESSION_UART (&session_uart)
+#else
+#define SESSION_UART NULL
+#endif
+#if CONSOLE_USB_CDC
+static Console_session_t session_usb;
+#define SESSION_USB (&session_usb)
+#else
+#define SESSION_USB NULL
+#endif
+#if CONSOLE_RTT
+static Console_session_t session_rtt;
+#define SESSION_RTT (&session_rtt)
+#else
+#define SESSION_RTT NULL
+#endif
+
+/* Session of USART2, else of USB CDC, else of RTT */
+#define SESSION_FIRST (CONSOLE_UART ? CONSOLE_SESSION_UART : CONSOLE_USB_CDC ? CONSOLE_SESSION_USB : CONSOLE_SESSION_RTT)
+
+/* Console_t object. The first session subscribes to logs and telemetry statically, so messages
+ * logged before console_init() reach it. */
+static Console_t console = {
+    .sessions = {[CONSOLE_SESSION_UART] = SESSION_UART, [CONSOLE_SESSION_USB] = SESSION_USB, [CONSOLE_SESSION_RTT] = SESSION_RTT},
+    .subs = {[SESSION_FIRST] = CONSOLE_SUB_LOG | CONSOLE_SUB_TELEMETRY},
+    .reply = SESSION_FIRST};
+
+/* Session names */
+static const char *const session_names[CONSOLE_NUM_SESSIONS] = {
+    [CONSOLE_SESSION_UART] = "uart", [CONSOLE_SESSION_USB] = "usb", [CONSOLE_SESSION_RTT] = "rtt"};
+
+/* Command info */
+static const cmd_cmd_info console_cmd_infos[] = {
+    {.cmd_name = "sessions",
+     .cb = console_sessions_cmd,
+     .help = "List console sessions, one per transport, with their subscriptions, * marks this one."},
+    {.cmd_name = "sub",
+     .cb = console_sub_cmd,
+     .help = "Show or set which output this session receives besides command responses: log messages, "
+             "telemetry frames.\r\nUsage: console sub [none | log | telemetry ...]"},
+};
+
+/* Command module client info */
+CMD_CLIENT_DEFINE(console,
+                  .num_cmds = sizeof(console_cmd_infos) / sizeof(console_cmd_infos[0]),
+                  .cmds = console_cmd_infos);
 
 /* Unique tag for logging module */
-static const char *TAG = "CONSOLE";
+LOG_TAG_DEFINE("CONSOLE");
 
-/* Command event object to send when Enter key is pressed. */
-static Cmd_Event cmd_evt = {.base = {CMD_RX_SIG}, .cmd_line = console.cmd_buf};
+/* Cursor movement and erase fill, written to terminal in one block */
+static char backspaces[ECHO_FILL_SIZE];
+static char blanks[ECHO_FILL_SIZE];
 
 ////////////////////////////////////////////////////////////////////////////////
 // Public (global) variables and externs
@@ -81,39 +245,198 @@ static Cmd_Event cmd_evt = {.base = {CMD_RX_SIG}, .cmd_line = console.cmd_buf};
  */
 mod_err_t console_init(void)
 {
-    memset(&console, 0, sizeof(console));
+    for (uint32_t i = 0; i < CONSOLE_NUM_SESSIONS; i++)
+    {
+        Console_session_t *const s = console.sessions[i];
+        if (s != NULL)
+        {
+            s->id = (console_session_t)i;
+            ringbuf_init(&s->rx_ring, s->rx_ring_buf, sizeof(s->rx_ring_buf));
+        }
+    }
+    memset(backspaces, '\b', sizeof(backspaces));
+    memset(blanks, ' ', sizeof(blanks));
+    Active_ctor(&console.base, console_evt_handler);
+    TimeEvent_ctor(&console.retry_evt, CONSOLE_RETRY_SIG, &console.base);
     LOGI(TAG, "Initialized console.");
     return MOD_OK;
 }
 
 mod_err_t console_start(void)
 {
-    /* Create OS objects */
-    static const osThreadAttr_t thread_attr = {.stack_size = CONSOLE_THREAD_STACK_SIZE};
-    console.console_thread_id = osThreadNew(Console_thread, NULL, &thread_attr);
-    console.console_queue_id = osMessageQueueNew(CONSOLE_MSG_QUEUE_SIZE, sizeof(char), NULL);
+    /* Create OS objects, the receive semaphore must exist before any transport receives. */
+    static const osSemaphoreAttr_t sem_attr = {.name = "console",
+                                               .cb_mem = &console_rx_sem_cb,
+                                               .cb_size = sizeof(console_rx_sem_cb)};
+    osSemaphoreId_t const rx_sem = osSemaphoreNew(1U, 0U, &sem_attr);
+    ASSERT(rx_sem != NULL);
+    console_sources[0] = (Active_source){.handle = (QueueSetMemberHandle_t)rx_sem,
+                                         .length = 1U,
+                                         .handler = console_rx_handler};
 
-    ASSERT(console.console_queue_id != NULL && console.console_thread_id != NULL);
+    static const osThreadAttr_t thread_attr = {.name = "console",
+                                               .cb_mem = &console_thread_cb,
+                                               .cb_size = sizeof(console_thread_cb),
+                                               .stack_mem = console_stack,
+                                               .stack_size = sizeof(console_stack)};
+    static const osMessageQueueAttr_t queue_attr = {.cb_mem = &console_queue_cb,
+                                                    .cb_size = sizeof(console_queue_cb),
+                                                    .mq_mem = console_queue_mem,
+                                                    .mq_size = sizeof(console_queue_mem)};
+    static const osMessageQueueAttr_t set_attr = {.cb_mem = &console_set_cb,
+                                                  .cb_size = sizeof(console_set_cb),
+                                                  .mq_mem = console_set_mem,
+                                                  .mq_size = sizeof(console_set_mem)};
+    mod_err_t err = Active_start_set(&console.base, PRIO_CONSOLE, &thread_attr, CONSOLE_MSG_COUNT, &queue_attr,
+                                     console_sources, 1U, &set_attr);
+    if (err != MOD_OK)
+    {
+        return err;
+    }
+    console.rx_sem = rx_sem; // Transports wake the active object from here on.
 
-    uart_start();
+#if CONSOLE_USB_CDC
+    usb_cdc_start();
+#endif
+#if CONSOLE_RTT
+    rtt_start();
+#endif
+#if CONSOLE_UART
+    uart_start(UART_CONSOLE);
+#endif
 
     return MOD_OK;
 }
 
-mod_err_t console_post(char c)
+mod_err_t console_post(console_session_t session, char c)
 {
-    osStatus_t err = osMessageQueuePut(console.console_queue_id, &c, 0U, 0U);
-    if (err != osOK)
+    Console_session_t *const s = console.sessions[session];
+    if (!ringbuf_push_byte(&s->rx_ring, (uint8_t)c))
     {
+        INC_SAT_U32(s->rx_drops);
+        console_notify();
         return MOD_ERR_TIMEOUT;
     }
 
+    /* Only wake console active object once line is complete or ring buffer is filling up. */
+    if (c == '\n' || c == '\r' || c == (char)FRAME_DELIMITER || ringbuf_count(&s->rx_ring) >= CONSOLE_RX_BUF_SIZE / 2)
+    {
+        console_notify();
+    }
+
     return MOD_OK;
 }
 
-void console_signal(void)
+void console_rx_idle(console_session_t session)
+{
+    if (!ringbuf_is_empty(&console.sessions[session]->rx_ring))
+    {
+        console_notify();
+    }
+}
+
+mod_err_t console_uart_post(char c)
+{
+    return console_post(CONSOLE_SESSION_UART, c);
+}
+
+void console_uart_rx_idle(void)
+{
+    console_rx_idle(CONSOLE_SESSION_UART);
+}
+
+void console_reply_set(console_session_t session)
+{
+    if (session < CONSOLE_NUM_SESSIONS && console.sessions[session] != NULL)
+    {
+        console.reply = session;
+    }
+}
+
+console_session_t console_reply_get(void)
+{
+    return console.reply;
+}
+
+mod_err_t console_sub_write(uint8_t sub, const char *buf, size_t len)
+{
+    mod_err_t err = MOD_OK;
+    for (uint32_t i = 0; i < CONSOLE_NUM_SESSIONS; i++)
+    {
+        if (console.sessions[i] != NULL && (console.subs[i] & sub) &&
+            session_write((console_session_t)i, buf, len) != MOD_OK)
+        {
+            err = MOD_ERR_BUF_OVERRUN;
+        }
+    }
+    return err;
+}
+
+uint32_t console_sub_offer(uint8_t sub, uint32_t sessions, const char *buf, size_t len)
+{
+    uint32_t waiting = 0;
+    for (uint32_t i = 0; i < CONSOLE_NUM_SESSIONS; i++)
+    {
+        if (!(sessions & (1UL << i)) || console.sessions[i] == NULL || !(console.subs[i] & sub))
+        {
+            continue;
+        }
+        /* A session short of room keeps waiting without holding up the others. */
+        if (session_tx_free((console_session_t)i) < len || session_write((console_session_t)i, buf, len) != MOD_OK)
+        {
+            waiting |= 1UL << i;
+        }
+    }
+    return waiting;
+}
+
+mod_err_t console_write(const char *buf, size_t len)
 {
-    osSemaphoreRelease(console.console_sem_id);
+    return session_write(console.reply, buf, len);
+}
+
+mod_err_t console_write_ref(const void *buf, size_t len, void (*done)(void *ctx), void *ctx)
+{
+#if CONSOLE_UART
+    if (console.reply == CONSOLE_SESSION_UART)
+    {
+        mod_err_t err = uart_write_ref(UART_CONSOLE, buf, len, done, ctx);
+        if (err != MOD_OK)
+        {
+            INC_SAT_U32(console.sessions[CONSOLE_SESSION_UART]->tx_drops);
+        }
+        return err;
+    }
+#endif
+    mod_err_t err = console_write(buf, len);
+    if (err == MOD_OK && done != NULL)
+    {
+        done(ctx);
+    }
+    return err;
+}
+
+mod_err_t console_telemetry_write(const char *buf, size_t len)
+{
+#if UART_TELEMETRY_ENABLE
+    return telemetry_write(buf, len);
+#else
+    return console_sub_write(CONSOLE_SUB_TELEMETRY, buf, len);
+#endif
+}
+
+bool console_tx_idle(void)
+{
+#if !CONSOLE_UART
+    return true;
+#else
+    return uart_tx_idle(UART_CONSOLE);
+#endif
+}
+
+size_t console_tx_free(void)
+{
+    return session_tx_free(console.reply);
 }
 
 ////////////////////////////////////////////////////////////////////////////////
@@ -121,77 +444,284 @@ void console_signal(void)
 ////////////////////////////////////////////////////////////////////////////////
 
 /**
- * @brief Console thread.
+ * @brief Console event handler, writes the first prompt of every session and retries held posts.
+ *
+ * @param ao Base active object.
+ * @param evt Event.
+ */
+static void console_evt_handler(Active *const ao, Event const *const evt)
+{
+    (void)ao;
+    switch (evt->sig)
+    {
+    case INIT_SIG:
+        for (uint32_t i = 0; i < CONSOLE_NUM_SESSIONS; i++)
+        {
+            if (console.sessions[i] != NULL)
+            {
+                session_write((console_session_t)i, LOG_RESET_COLOUR PROMPT, sizeof(LOG_RESET_COLOUR PROMPT) - 1U);
+            }
+        }
+        break;
+    case CONSOLE_RETRY_SIG:
+        for (uint32_t i = 0; i < CONSOLE_NUM_SESSIONS; i++)
+        {
+            Console_session_t *const s = console.sessions[i];
+            if (s != NULL && s->held && console_release(s))
+            {
+                console_drain(s); // Characters received meanwhile.
+            }
+        }
+        break;
+    default:
+        break;
+    }
+}
+
+/**
+ * @brief Take receive semaphore, then process every character in ring buffers.
+ *
+ * Sessions are served in turn, every character received on one before the next.
+ *
+ * @param ao Base active object.
+ * @param source Receive semaphore.
  */
-static void Console_thread(void *argument)
+static void console_rx_handler(Active *const ao, QueueSetMemberHandle_t source)
 {
-    LOG(PROMPT);
-    while (1)
+    (void)ao;
+    if (osSemaphoreAcquire((osSemaphoreId_t)source, 0U) != osOK)
     {
-        /* Read character from message queue, then process character */
-        char char_to_process = 0;
-        osStatus_t status = osMessageQueueGet(console.console_queue_id, &char_to_process, NULL, osWaitForever);
+        LOGE(TAG, "Could not take receive semaphore.");
+    }
 
-        if (status != osOK)
+    for (uint32_t i = 0; i < CONSOLE_NUM_SESSIONS; i++)
+    {
+        if (console.sessions[i] != NULL)
         {
-            LOGE(TAG, "Could not read character from queue.");
+            console_drain(console.sessions[i]);
         }
-        else
+    }
+}
+
+/**
+ * @brief Process received characters of session until its ring is empty or a line is held.
+ *
+ * @param s Session.
+ */
+static void console_drain(Console_session_t *s)
+{
+    uint8_t char_to_process = 0;
+    while (!s->held && ringbuf_pop_byte(&s->rx_ring, &char_to_process))
+    {
+        console_process(s, (char)char_to_process);
+    }
+}
+
+/**
+ * @brief Put a block in the transmit buffer of a session's transport (non-blocking).
+ *
+ * @param session Session.
+ * @param buf Characters to transmit.
+ * @param len Number of characters.
+ *
+ * @return MOD_OK for success, MOD_ERR_BUF_OVERRUN if the block was dropped or truncated.
+ */
+static mod_err_t session_write(console_session_t session, const char *buf, size_t len)
+{
+    mod_err_t err = MOD_ERR_ARG;
+    switch (session)
+    {
+#if CONSOLE_UART
+    case CONSOLE_SESSION_UART:
+        err = uart_write(UART_CONSOLE, buf, len);
+        break;
+#endif
+#if CONSOLE_USB_CDC
+    case CONSOLE_SESSION_USB:
+        err = usb_cdc_write(buf, len);
+        break;
+#endif
+#if CONSOLE_RTT
+    case CONSOLE_SESSION_RTT:
+        err = rtt_write(buf, len);
+        break;
+#endif
+    default:
+        return err;
+    }
+    if (err != MOD_OK)
+    {
+        INC_SAT_U32(console.sessions[session]->tx_drops);
+    }
+    return err;
+}
+
+/**
+ * @brief Get free space in the transmit buffer of a session's transport.
+ *
+ * @param session Session.
+ *
+ * @return Number of characters session_write() would currently accept as one block.
+ */
+static size_t session_tx_free(console_session_t session)
+{
+    switch (session)
+    {
+#if CONSOLE_UART
+    case CONSOLE_SESSION_UART:
+        return uart_tx_free(UART_CONSOLE);
+#endif
+#if CONSOLE_USB_CDC
+    case CONSOLE_SESSION_USB:
+        return usb_cdc_tx_free();
+#endif
+#if CONSOLE_RTT
+    case CONSOLE_SESSION_RTT:
+        return rtt_tx_free();
+#endif
+    default:
+        return 0;
+    }
+}
+
+/**
+ * @brief List sessions with their subscriptions and counters.
+ */
+static uint32_t console_sessions_cmd(uint32_t argc, const char **argv)
+{
+    (void)argv;
+    if (argc != 0)
+    {
+        LOG("Usage: console sessions\r\n");
+        return 1;
+    }
+    for (uint32_t i = 0; i < CONSOLE_NUM_SESSIONS; i++)
+    {
+        const Console_session_t *const s = console.sessions[i];
+        if (s == NULL)
+        {
+            continue;
+        }
+        const uint8_t subs = console.subs[i];
+        LOG("%c %-5s sub:%s%s%s tx free %lu, rx drops %lu, tx drops %lu\r\n",
+            i == console.reply ? '*' : ' ', session_names[i],
+            subs == 0 ? " none" : "",
+            (subs & CONSOLE_SUB_LOG) ? " log" : "",
+            (subs & CONSOLE_SUB_TELEMETRY) ? " telemetry" : "",
+            (unsigned long)session_tx_free((console_session_t)i), s->rx_drops, s->tx_drops);
+    }
+    return 0;
+}
+
+/**
+ * @brief Show or set output subscriptions of the session the command was typed on.
+ */
+static uint32_t console_sub_cmd(uint32_t argc, const char **argv)
+{
+    uint8_t subs = 0;
+    for (uint32_t i = 0; i < argc; i++)
+    {
+        if (strcasecmp(argv[i], "log") == 0)
+        {
+            subs |= CONSOLE_SUB_LOG;
+        }
+        else if (strcasecmp(argv[i], "telemetry") == 0)
         {
-            console_process(char_to_process);
+            subs |= CONSOLE_SUB_TELEMETRY;
+        }
+        else if (strcasecmp(argv[i], "none") != 0)
+        {
+            LOG("Usage: console sub [none | log | telemetry ...]\r\n");
+            return 1;
         }
     }
+    if (argc > 0)
+    {
+        console.subs[console.reply] = subs;
+    }
+    subs = console.subs[console.reply];
+    LOG("%s subscribed to:%s%s%s\r\n", session_names[console.reply], subs == 0 ? " none" : "",
+        (subs & CONSOLE_SUB_LOG) ? " log" : "", (subs & CONSOLE_SUB_TELEMETRY) ? " telemetry" : "");
+    return 0;
 }
 
 /**
- * @brief Process received character from UART peripheral.
+ * @brief Process received character of a session.
  *
+ * @param s Session the character was received on.
  * @param c Character to process.
  *
  * @return MOD_OK if successful, otherwise a "MOD_ERR" value.
  */
-static mod_err_t console_process(char c)
+static mod_err_t console_process(Console_session_t *s, char c)
 {
+    /* A delimiter, which text never contains, starts a binary request frame. */
+    if (s->in_frame || c == (char)FRAME_DELIMITER)
+    {
+        console_frame(s, c);
+        return MOD_OK;
+    }
+
+    /* Cursor and history keys arrive as escape sequences. */
+    if (console_escape(s, c))
+    {
+        return MOD_OK;
+    }
 
     /* Execute command once Enter key is pressed. */
     if (c == '\n' || c == '\r')
     {
-        console.cmd_buf[console.num_cmd_buf_chars] = '\0'; // Signal end of command string.
-        LOG("\r\n");
-        post_cmd_event();
-        console.num_cmd_buf_chars = 0;
+        s->cmd_buf[s->num_cmd_buf_chars] = '\0'; // Signal end of command string.
+        console_echo(s, "\r\n", 2);
+        console_batch_check(s, s->cmd_buf);
+        if (!s->batch)
+        {
+            console_history_add(s);
+        }
+        console_release(s);
         return MOD_OK;
     }
-    /* Delete a character when Backspace key is pressed. */
+    /* Delete character before cursor when Backspace key is pressed. */
     if (c == '\b' || c == '\x7f')
     {
-        if (console.num_cmd_buf_chars > 0)
+        if (s->cursor > 0)
         {
-            LOG("\x7f");
-            console.num_cmd_buf_chars--; // "Overwrite" last character.
+            s->cursor--;
+            memmove(&s->cmd_buf[s->cursor], &s->cmd_buf[s->cursor + 1],
+                    s->num_cmd_buf_chars - s->cursor - 1U);
+            s->num_cmd_buf_chars--;
+            console_echo(s, "\b", 1);
+            console_redraw_tail(s, 1);
         }
         return MOD_OK;
     }
     /* Toggle logging on and off LOG_TOGGLE_CHAR key is pressed. */
     if (c == LOG_TOGGLE_CHAR)
     {
+        static const char on[] = LOG_RESET_COLOUR "<Logging on>\r\n";
+        static const char off[] = LOG_RESET_COLOUR "<Logging off>\r\n";
         bool log_active = log_toggle();
-        LOG("<Logging %s>\r\n", log_active ? "on" : "off");
+        session_write(s->id, log_active ? on : off, log_active ? sizeof(on) - 1U : sizeof(off) - 1U);
         return MOD_OK;
     }
-    /* Echo the character back. */
+    /* Insert character at cursor and echo it back. */
     if (isprint(c))
     {
-        if (console.num_cmd_buf_chars < (CONSOLE_CMD_BUF_SIZE - 1))
+        if (s->num_cmd_buf_chars < (CONSOLE_CMD_BUF_SIZE - 1))
         {
-            console.cmd_buf[console.num_cmd_buf_chars++] = c;
-            LOG("%c", c);
+            memmove(&s->cmd_buf[s->cursor + 1], &s->cmd_buf[s->cursor],
+                    s->num_cmd_buf_chars - s->cursor);
+            s->cmd_buf[s->cursor] = c;
+            s->num_cmd_buf_chars++;
+            s->cursor++;
+            console_echo(s, &c, 1);
+            console_redraw_tail(s, 0);
         }
         else
         {
             /* No space in buffer, so ring terminal bell. */
             LOGW(TAG, "No more space in command buffer.");
-            LOG("\a");
+            console_echo(s, "\a", 1);
         }
         return MOD_OK;
     }
@@ -200,9 +730,417 @@ static mod_err_t console_process(char c)
 }
 
 /**
- * @brief Post command event to command active object.
+ * @brief Feed character to escape sequence parser and act on complete sequences.
+ *
+ * Handles ESC [ A/B (up/down, history), ESC [ C/D (right/left), ESC [ H/F and
+ * ESC [ 1~/4~ (Home/End) and ESC [ 3~ (Delete). Other sequences are swallowed.
+ *
+ * @param s Session.
+ * @param c Received character.
+ *
+ * @return True if character was part of an escape sequence.
+ */
+static inline bool console_escape(Console_session_t *s, char c)
+{
+    switch (s->esc_state)
+    {
+    case ESC_NONE:
+        if (c == '\x1b')
+        {
+            s->esc_state = ESC_ESC;
+            return true;
+        }
+        return false;
+
+    case ESC_ESC:
+        /* ESC O x is sent for cursor keys in application mode, treat it as CSI. */
+        if (c == '[' || c == 'O')
+        {
+            s->esc_state = ESC_CSI;
+            s->esc_param = 0;
+        }
+        else
+        {
+            s->esc_state = ESC_NONE;
+        }
+        return true;
+
+    case ESC_CSI:
+        if (isdigit((unsigned char)c))
+        {
+            uint32_t param = s->esc_param * 10U + (uint32_t)(c - '0');
+            s->esc_param = (uint8_t)(param > ESC_SEQ_MAX_PARAM ? ESC_SEQ_MAX_PARAM : param);
+            return true;
+        }
+        if (c == ';')
+        {
+            return true; // Modifier parameters are ignored.
+        }
+        s->esc_state = ESC_NONE;
+        break;
+    }
+
+    /* Final character of CSI sequence */
+    if (c == '~')
+    {
+        c = s->esc_param == 1 ? 'H' : s->esc_param == 4 ? 'F' : s->esc_param == 3 ? 'P' : '\0';
+    }
+    switch (c)
+    {
+    case 'A':
+        console_history_recall(s, 1);
+        break;
+    case 'B':
+        console_history_recall(s, -1);
+        break;
+    case 'C':
+        if (s->cursor < s->num_cmd_buf_chars)
+        {
+            console_echo(s, &s->cmd_buf[s->cursor], 1); // Rewriting character moves cursor right.
+            s->cursor++;
+        }
+        break;
+    case 'D':
+        if (s->cursor > 0)
+        {
+            console_back(s, 1);
+            s->cursor--;
+        }
+        break;
+    case 'H':
+        console_back(s, s->cursor);
+        s->cursor = 0;
+        break;
+    case 'F':
+        console_echo(s, &s->cmd_buf[s->cursor], s->num_cmd_buf_chars - s->cursor);
+        s->cursor = s->num_cmd_buf_chars;
+        break;
+    case 'P':
+        if (s->cursor < s->num_cmd_buf_chars)
+        {
+            memmove(&s->cmd_buf[s->cursor], &s->cmd_buf[s->cursor + 1],
+                    s->num_cmd_buf_chars - s->cursor - 1U);
+            s->num_cmd_buf_chars--;
+            console_redraw_tail(s, 1);
+        }
+        break;
+    default:
+        break;
+    }
+    return true;
+}
+
+/**
+ * @brief Write raw characters to session's terminal, unless in batch mode.
+ *
+ * @param s Session.
+ * @param buf Characters.
+ * @param len Number of characters.
+ */
+static void console_echo(Console_session_t *s, const char *buf, size_t len)
+{
+    if (!s->batch && len > 0)
+    {
+        session_write(s->id, buf, len);
+    }
+}
+
+/**
+ * @brief Move terminal cursor left with backspaces, which terminals never treat as erase.
+ *
+ * @param s Session.
+ * @param n Number of characters.
+ */
+static void console_back(Console_session_t *s, uint16_t n)
+{
+    for (uint16_t chunk; n > 0; n -= chunk)
+    {
+        chunk = n < ECHO_FILL_SIZE ? n : ECHO_FILL_SIZE;
+        console_echo(s, backspaces, chunk);
+    }
+}
+
+/**
+ * @brief Overwrite characters after terminal cursor with blanks and return cursor.
+ *
+ * @param s Session.
+ * @param n Number of characters.
+ */
+static void console_blank(Console_session_t *s, uint16_t n)
+{
+    for (uint16_t chunk, left = n; left > 0; left -= chunk)
+    {
+        chunk = left < ECHO_FILL_SIZE ? left : ECHO_FILL_SIZE;
+        console_echo(s, blanks, chunk);
+    }
+    console_back(s, n);
+}
+
+/**
+ * @brief Rewrite line from cursor to its end and return terminal cursor.
+ *
+ * @param s Session.
+ * @param erased Number of characters the line shrank by, blanked after its end.
+ */
+static void console_redraw_tail(Console_session_t *s, uint16_t erased)
+{
+    uint16_t tail = s->num_cmd_buf_chars - s->cursor;
+    if (tail == 0 && erased == 0)
+    {
+        return; // Appending at end of line, nothing to redraw.
+    }
+
+    console_echo(s, &s->cmd_buf[s->cursor], tail);
+    console_blank(s, erased);
+    console_back(s, tail);
+}
+
+/**
+ * @brief Store completed line in history, skipping empty, long lines and repeats of the most recent line.
+ *
+ * @param s Session.
+ */
+static void console_history_add(Console_session_t *s)
+{
+    if (s->num_cmd_buf_chars == 0 || s->num_cmd_buf_chars >= CONSOLE_HISTORY_LINE_SIZE)
+    {
+        return;
+    }
+    uint8_t last = (s->hist_head + CONSOLE_HISTORY_DEPTH - 1U) % CONSOLE_HISTORY_DEPTH;
+    if (s->hist_count > 0 && strcmp(s->history[last], s->cmd_buf) == 0)
+    {
+        return;
+    }
+
+    memcpy(s->history[s->hist_head], s->cmd_buf, s->num_cmd_buf_chars + 1U);
+    s->hist_head = (s->hist_head + 1U) % CONSOLE_HISTORY_DEPTH;
+    if (s->hist_count < CONSOLE_HISTORY_DEPTH)
+    {
+        s->hist_count++;
+    }
+}
+
+/**
+ * @brief Replace line being edited with older or newer history line.
+ *
+ * The line being edited is kept as a draft while browsing and restored past the newest line.
+ *
+ * @param s Session.
+ * @param dir 1 for older line, -1 for newer line.
+ */
+static void console_history_recall(Console_session_t *s, int8_t dir)
+{
+    int32_t pos = (int32_t)s->hist_pos + dir;
+    if (pos < 0 || pos > (int32_t)s->hist_count)
+    {
+        return;
+    }
+    if (s->hist_pos == 0)
+    {
+        if (s->num_cmd_buf_chars >= CONSOLE_HISTORY_LINE_SIZE)
+        {
+            console_echo(s, "\a", 1); // Line too long to keep as draft, so ring terminal bell.
+            return;
+        }
+        s->cmd_buf[s->num_cmd_buf_chars] = '\0';
+        memcpy(s->draft, s->cmd_buf, s->num_cmd_buf_chars + 1U);
+    }
+    s->hist_pos = (uint8_t)pos;
+
+    const char *line = s->draft;
+    if (pos > 0)
+    {
+        uint8_t idx = (s->hist_head + CONSOLE_HISTORY_DEPTH - (uint8_t)pos) % CONSOLE_HISTORY_DEPTH;
+        line = s->history[idx];
+    }
+
+    /* Return to start of line, write new line and blank whatever it does not cover. */
+    uint16_t old_len = s->num_cmd_buf_chars;
+    uint16_t len = (uint16_t)strlen(line);
+    console_back(s, s->cursor);
+    memmove(s->cmd_buf, line, len + 1U);
+    console_echo(s, s->cmd_buf, len);
+    console_blank(s, old_len > len ? old_len - len : 0);
+    s->num_cmd_buf_chars = len;
+    s->cursor = len;
+}
+
+/**
+ * @brief Wake console active object to process received characters.
+ *
+ * Receive interrupts defer the kernel call to the work queue, directly only if it is full.
+ */
+static inline void console_notify(void)
+{
+    if (__get_IPSR() != 0U && work_submit(console_wake, NULL) == MOD_OK)
+    {
+        return;
+    }
+    console_wake(NULL);
+}
+
+/**
+ * @brief Give receive semaphore, which its queue set hands to the console active object.
+ *
+ * A wake-up already pending covers the new characters, so a failed give is not an error.
+ */
+static void console_wake(void *arg)
+{
+    (void)arg;
+    if (console.rx_sem != NULL)
+    {
+        osSemaphoreRelease(console.rx_sem);
+    }
+}
+
+/**
+ * @brief Post command event to command active object, without waiting.
+ *
+ * A failed post recycles the event, so a new one is allocated for each attempt.
+ *
+ * @param s Session the line or frame was received on, receives the command output.
+ * @param sig CMD_RX_SIG for a command line, CMD_RPC_SIG for an encoded frame.
+ * @param buf Line or frame, terminated after len characters.
+ * @param len Number of characters.
+ *
+ * @return true if posted, false if no event block or command queue space is free.
  */
-static inline void post_cmd_event(void)
+static inline bool post_cmd_event(Console_session_t *s, Signal sig, const char *buf, uint16_t len)
 {
-    Active_post(cmd_base, (Event const *)&cmd_evt);
+    Cmd_Event *const evt = (Cmd_Event *)Event_new(CMD_EVENT_SIZE(len), sig);
+    if (evt == NULL)
+    {
+        return false;
+    }
+    evt->session = (uint8_t)s->id;
+    memcpy(evt->cmd_line, buf, len + 1U);
+    return Active_post(cmd_base, &evt->base) == MOD_OK;
+}
+
+/**
+ * @brief Post session's completed line, or its frame if in_frame, to command active object.
+ *
+ * While a streamed batch is being executed, the command queue or event pool may be full. The
+ * line or frame is then held in its buffer, and the session's received characters keep
+ * collecting in its ring, until a CONSOLE_RETRY_SIG posts it. Nothing waits in the handler,
+ * which the active object watchdog would report as a stall. After CONSOLE_POST_TIMEOUT_MS
+ * it is dropped.
+ *
+ * @param s Session.
+ *
+ * @return true if posted or dropped, false if held.
+ */
+static bool console_release(Console_session_t *s)
+{
+    uint16_t const len = s->in_frame ? s->frame_len : s->num_cmd_buf_chars;
+    bool const posted = s->in_frame ? post_cmd_event(s, CMD_RPC_SIG, s->frame_buf, len)
+                                    : post_cmd_event(s, CMD_RX_SIG, s->cmd_buf, len);
+    if (!posted)
+    {
+        uint32_t const now = osKernelGetTickCount();
+        if (!s->held)
+        {
+            s->held = true;
+            s->held_tick = now;
+        }
+        if (now - s->held_tick < pdMS_TO_TICKS(CONSOLE_POST_TIMEOUT_MS))
+        {
+            TimeEvent_arm(&console.retry_evt, TIME_EVENT_MS(CONSOLE_RETRY_MS), 0);
+            return false;
+        }
+        LOGW(TAG, "Command queue full, dropped %u characters", len);
+    }
+
+    s->held = false;
+    if (s->in_frame)
+    {
+        s->in_frame = false;
+    }
+    else
+    {
+        s->num_cmd_buf_chars = 0;
+        s->cursor = 0;
+        s->hist_pos = 0;
+    }
+    return true;
+}
+
+/**
+ * @brief Collect binary request frame between delimiters and post it to command active object.
+ *
+ * Repeated delimiters are skipped, so hosts may send one ahead of every frame to resynchronize.
+ * The console returns to text once the frame is posted or dropped.
+ *
+ * @param s Session.
+ * @param c Received character.
+ */
+static inline void console_frame(Console_session_t *s, char c)
+{
+    if (c != (char)FRAME_DELIMITER)
+    {
+        if (s->frame_len < sizeof(s->frame_buf) - 1U)
+        {
+            s->frame_buf[s->frame_len++] = c;
+        }
+        else
+        {
+            s->frame_overflow = true;
+        }
+        return;
+    }
+
+    if (!s->in_frame || s->frame_len == 0)
+    {
+        s->in_frame = true;
+        s->frame_len = 0;
+        s->frame_overflow = false;
+        return;
+    }
+
+    if (s->frame_overflow)
+    {
+        s->in_frame = false;
+        return;
+    }
+    s->frame_buf[s->frame_len] = '\0'; // Encoded frame has no zeros.
+    console_release(s);
+}
+
+/**
+ * @brief Enter batch mode on "batch begin" line, leave it on "batch end" line.
+ *
+ * Line is still posted, so the command module can report the batch in order with its commands.
+ *
+ * @param s Session.
+ * @param line Completed command line.
+ */
+static inline void console_batch_check(Console_session_t *s, const char *line)
+{
+    while (isspace((unsigned char)*line))
+    {
+        line++;
+    }
+    if (strncasecmp(line, "batch", 5) != 0 || !isspace((unsigned char)line[5]))
+    {
+        return;
+    }
+    line += 5;
+    while (isspace((unsigned char)*line))
+    {
+        line++;
+    }
+
+    size_t len = strlen(line);
+    while (len > 0 && isspace((unsigned char)line[len - 1]))
+    {
+        len--;
+    }
+    if (len == 5 && strncasecmp(line, "begin", 5) == 0)
+    {
+        s->batch = true;
+    }
+    else if (len == 3 && strncasecmp(line, "end", 3) == 0)
+    {
+        s->batch = false;
+    }
 }
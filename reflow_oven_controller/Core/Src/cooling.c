@@ -0,0 +1,40 @@
+/**
+ * @file cooling.c
+ * @author Timothy Nguyen
+ * @brief Cooling actuator controller: proportional fan or door output with slew-rate limit.
+ * @version 0.1
+ * @date 2021-08-24
+ */
+
+#include <math.h>
+
+#include "cooling.h"
+#include "log.h"
+
+void Cooling_Init(Cooling_t * const cool, Cooling_cfg_t const * const cfg)
+{
+	ASSERT(cfg->Kp >= 0.0f && cfg->slew_rate > 0.0f && cfg->out_max > 0.0f);
+
+	cool->cfg = *cfg;
+	Cooling_Reset(cool);
+}
+
+float Cooling_Calculate(Cooling_t * const cool, bool active, float setpoint, float temp, float Ts)
+{
+	cool->demand = 0.0f;
+	if (active)
+	{
+		cool->demand = fminf(fmaxf(cool->cfg.Kp * (temp - setpoint), 0.0f), cool->cfg.out_max);
+	}
+
+	float max_step = cool->cfg.slew_rate * Ts;
+	float step = fminf(fmaxf(cool->demand - cool->out, -max_step), max_step);
+	cool->out += step;
+	return cool->out;
+}
+
+void Cooling_Reset(Cooling_t * const cool)
+{
+	cool->demand = 0.0f;
+	cool->out = 0.0f;
+}
@@ -0,0 +1,335 @@
+/**
+ * @file cyclic.c
+ * @author Timothy Nguyen
+ * @brief Rate groups: periodic callbacks run by rate-monotonic threads released from one hardware timer.
+ * @version 0.1
+ * @date 2021-09-15
+ */
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "cyclic.h"
+#include "cmd.h"
+#include "irq.h"
+#include "log.h"
+#include "power.h"
+#include "sections.h"
+#include "cmsis_os.h"
+
+////////////////////////////////////////////////////////////////////////////////
+// Common macros
+////////////////////////////////////////////////////////////////////////////////
+
+#define CYCLIC_RELEASE_FLAG 0x1U // Group thread flag, group was released.
+
+_Static_assert(PRIO_CYCLIC_100HZ > PRIO_CYCLIC_10HZ && PRIO_CYCLIC_10HZ > PRIO_CYCLIC_1HZ,
+               "Rate-monotonic: faster groups have higher priority");
+
+////////////////////////////////////////////////////////////////////////////////
+// Type definitions
+////////////////////////////////////////////////////////////////////////////////
+
+/* Registered callback */
+typedef struct
+{
+    const char *name;    // Name listed by "cyclic status".
+    cyclic_fn_t fn;      // Callback.
+    void *arg;           // Argument of fn.
+    uint32_t max_cycles; // Longest run (CPU cycles).
+} cyclic_cb_t;
+
+/* Rate group */
+typedef struct
+{
+    const char *name;                 // Group name, also of its thread.
+    uint32_t frames;                  // Minor frames per period.
+    osPriority_t prio;                // Thread priority.
+    cyclic_cb_t cbs[CYCLIC_MAX_CBS];  // Callbacks in run order.
+    uint32_t num_cbs;                 // Number of valid entries in cbs.
+    osThreadId_t thread_id;           // Group thread.
+    volatile bool busy;               // Released and not yet done, set by base timer interrupt only.
+    uint32_t release_stamp;           // DWT cycle counter at latest release.
+    uint32_t releases;                // Releases, overruns excluded.
+    uint32_t overruns;                // Releases skipped, group was still running.
+} cyclic_group_info_t;
+
+////////////////////////////////////////////////////////////////////////////////
+// Private (static) function declarations
+////////////////////////////////////////////////////////////////////////////////
+
+static void Cyclic_thread(void *argument); // Run callbacks of a group once per release.
+static void cyclic_timer_start(void);      // Start base timer and keep CPU out of STOP2.
+static void cyclic_timer_stop(void);       // Stop base timer and allow STOP2.
+
+/* Command callback functions */
+static uint32_t cmd_cyclic_status(uint32_t argc, const char **argv); // Display groups and callbacks.
+
+////////////////////////////////////////////////////////////////////////////////
+// Private (static) variables
+////////////////////////////////////////////////////////////////////////////////
+
+/* Rate groups, indexed by cyclic_group_t */
+static cyclic_group_info_t groups[CYCLIC_NUM_GROUPS] = {
+    [CYCLIC_100HZ] = {.name = "cyc100hz", .frames = CYCLIC_BASE_HZ / 100U, .prio = PRIO_CYCLIC_100HZ},
+    [CYCLIC_10HZ] = {.name = "cyc10hz", .frames = CYCLIC_BASE_HZ / 10U, .prio = PRIO_CYCLIC_10HZ},
+    [CYCLIC_1HZ] = {.name = "cyc1hz", .frames = CYCLIC_BASE_HZ, .prio = PRIO_CYCLIC_1HZ}};
+
+/* Statically allocated group threads */
+static StaticTask_t thread_cbs[CYCLIC_NUM_GROUPS];
+static uint64_t SRAM2_BSS thread_stacks[CYCLIC_NUM_GROUPS][CYCLIC_THREAD_STACK_SZ / sizeof(uint64_t)];
+
+/* Base timer */
+static TIM_HandleTypeDef *base_tim;
+static uint32_t frame;       // Minor frames since base timer start, base timer interrupt only.
+static uint32_t total_cbs;   // Callbacks registered in all groups.
+static bool initialized;
+
+/* Performance measurements */
+static cmd_pm_hist_t latency[CYCLIC_NUM_GROUPS];    // Cycles from release until group thread started.
+static cmd_pm_hist_t run_cycles[CYCLIC_NUM_GROUPS]; // Cycles all callbacks of a release ran.
+
+/* Performance measurement info */
+static const cmd_pm_info cyclic_pm_info[] = {
+    {"100hz latency cycles", CMD_PM_HIST, &latency[CYCLIC_100HZ]},
+    {"100hz run cycles", CMD_PM_HIST, &run_cycles[CYCLIC_100HZ]},
+    {"100hz overruns", CMD_PM_U32, &groups[CYCLIC_100HZ].overruns},
+    {"10hz latency cycles", CMD_PM_HIST, &latency[CYCLIC_10HZ]},
+    {"10hz run cycles", CMD_PM_HIST, &run_cycles[CYCLIC_10HZ]},
+    {"10hz overruns", CMD_PM_U32, &groups[CYCLIC_10HZ].overruns},
+    {"1hz latency cycles", CMD_PM_HIST, &latency[CYCLIC_1HZ]},
+    {"1hz run cycles", CMD_PM_HIST, &run_cycles[CYCLIC_1HZ]},
+    {"1hz overruns", CMD_PM_U32, &groups[CYCLIC_1HZ].overruns}};
+
+/* Rate group command information. */
+static cmd_cmd_info cyclic_cmds[] = {
+    {.cmd_name = "status",
+     .cb = cmd_cyclic_status,
+     .help = "Display rate groups with releases and overruns, and the longest run of each callback (us)."}};
+
+/* Rate group module client info */
+CMD_CLIENT_DEFINE(cyclic,
+                  .num_cmds = ARRAY_SIZE(cyclic_cmds),
+                  .cmds = cyclic_cmds,
+                  .num_pms = ARRAY_SIZE(cyclic_pm_info),
+                  .pms = cyclic_pm_info);
+
+/* Unique tag for rate group module. */
+LOG_TAG_DEFINE("CYCLIC");
+
+////////////////////////////////////////////////////////////////////////////////
+// Public (global) functions
+////////////////////////////////////////////////////////////////////////////////
+
+mod_err_t cyclic_init(cyclic_cfg_t const *cfg)
+{
+    ASSERT(cfg != NULL && cfg->timer_handle != NULL);
+    base_tim = cfg->timer_handle;
+
+    for (uint32_t g = 0; g < CYCLIC_NUM_GROUPS; g++)
+    {
+        const osThreadAttr_t thread_attr = {.name = groups[g].name,
+                                            .cb_mem = &thread_cbs[g],
+                                            .cb_size = sizeof(thread_cbs[g]),
+                                            .stack_mem = thread_stacks[g],
+                                            .stack_size = sizeof(thread_stacks[g]),
+                                            .priority = groups[g].prio};
+        groups[g].thread_id = osThreadNew(Cyclic_thread, &groups[g], &thread_attr);
+        ASSERT(groups[g].thread_id != NULL);
+    }
+    HAL_NVIC_SetPriority(TIM1_BRK_TIM15_IRQn, IRQ_PRIO_CYCLIC, 0);
+
+    initialized = true;
+    LOGI(TAG, "Rate groups started, %u Hz base", CYCLIC_BASE_HZ);
+    return MOD_OK;
+}
+
+mod_err_t cyclic_register(cyclic_group_t group, const char *name, cyclic_fn_t fn, void *arg)
+{
+    ASSERT(group < CYCLIC_NUM_GROUPS && fn != NULL);
+    if (!initialized)
+    {
+        return MOD_ERR_NOT_INIT;
+    }
+
+    cyclic_group_info_t *const grp = &groups[group];
+    bool first = false;
+    osKernelLock(); // Table shared with group threads and other registering threads.
+    if (grp->num_cbs == CYCLIC_MAX_CBS)
+    {
+        osKernelUnlock();
+        LOGE(TAG, "Group %s full, %s not registered", grp->name, name);
+        return MOD_ERR_RESOURCE;
+    }
+    grp->cbs[grp->num_cbs++] = (cyclic_cb_t){.name = name, .fn = fn, .arg = arg};
+    first = total_cbs++ == 0U;
+    osKernelUnlock();
+
+    if (first)
+    {
+        cyclic_timer_start();
+    }
+    return MOD_OK;
+}
+
+mod_err_t cyclic_unregister(cyclic_group_t group, cyclic_fn_t fn, void *arg)
+{
+    ASSERT(group < CYCLIC_NUM_GROUPS);
+    cyclic_group_info_t *const grp = &groups[group];
+    bool found = false;
+    bool last = false;
+    osKernelLock();
+    for (uint32_t i = 0; i < grp->num_cbs; i++)
+    {
+        if (!found && grp->cbs[i].fn == fn && grp->cbs[i].arg == arg)
+        {
+            found = true;
+        }
+        if (found && i + 1U < grp->num_cbs)
+        {
+            grp->cbs[i] = grp->cbs[i + 1U];
+        }
+    }
+    if (found)
+    {
+        grp->num_cbs--;
+        last = --total_cbs == 0U;
+    }
+    osKernelUnlock();
+
+    if (last)
+    {
+        cyclic_timer_stop();
+    }
+    return found ? MOD_OK : MOD_ERR_ARG;
+}
+
+void cyclic_timer_elapsed(TIM_HandleTypeDef *htim)
+{
+    if (base_tim == NULL || htim->Instance != base_tim->Instance)
+    {
+        return;
+    }
+
+    uint32_t now = DWT->CYCCNT;
+    for (uint32_t g = 0; g < CYCLIC_NUM_GROUPS; g++)
+    {
+        cyclic_group_info_t *const grp = &groups[g];
+        if (frame % grp->frames != 0U)
+        {
+            continue;
+        }
+        if (grp->busy)
+        {
+            INC_SAT_U32(grp->overruns);
+            continue;
+        }
+        grp->busy = true;
+        grp->release_stamp = now;
+        grp->releases++;
+        osThreadFlagsSet(grp->thread_id, CYCLIC_RELEASE_FLAG);
+    }
+    frame = frame + 1U == CYCLIC_BASE_HZ ? 0U : frame + 1U; // Every period divides CYCLIC_BASE_HZ frames.
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Private (static) functions
+////////////////////////////////////////////////////////////////////////////////
+
+/**
+ * @brief Group thread, runs the callbacks registered at release once each.
+ *
+ * Callbacks are copied before running, so registering from a thread of higher priority
+ * never changes the table under the group thread.
+ *
+ * @param argument Rate group.
+ */
+static void Cyclic_thread(void *argument)
+{
+    cyclic_group_info_t *const grp = argument;
+    const uint32_t g = (uint32_t)(grp - groups);
+    cyclic_cb_t cbs[CYCLIC_MAX_CBS];
+
+    while (1)
+    {
+        osThreadFlagsWait(CYCLIC_RELEASE_FLAG, osFlagsWaitAny, osWaitForever);
+        uint32_t start = DWT->CYCCNT;
+        cmd_pm_record_hist(&latency[g], start - grp->release_stamp);
+
+        osKernelLock();
+        uint32_t num_cbs = grp->num_cbs;
+        for (uint32_t i = 0; i < num_cbs; i++)
+        {
+            cbs[i] = grp->cbs[i];
+        }
+        osKernelUnlock();
+
+        for (uint32_t i = 0; i < num_cbs; i++)
+        {
+            uint32_t cb_start = DWT->CYCCNT;
+            cbs[i].fn(cbs[i].arg);
+            uint32_t cycles = DWT->CYCCNT - cb_start;
+            if (cycles > grp->cbs[i].max_cycles && grp->cbs[i].fn == cbs[i].fn)
+            {
+                grp->cbs[i].max_cycles = cycles; // Dropped if the table changed meanwhile.
+            }
+        }
+
+        cmd_pm_record_hist(&run_cycles[g], DWT->CYCCNT - start);
+        grp->busy = false;
+    }
+}
+
+/**
+ * @brief Start base timer from the first minor frame, keeping the CPU out of STOP2 where it halts.
+ */
+static void cyclic_timer_start(void)
+{
+    power_stop_lock();
+    frame = 0;
+    __HAL_TIM_SET_COUNTER(base_tim, 0);
+    HAL_TIM_Base_Start_IT(base_tim);
+    LOGI(TAG, "Base timer started");
+}
+
+/**
+ * @brief Stop base timer once no callback is registered, allowing STOP2 again.
+ */
+static void cyclic_timer_stop(void)
+{
+    HAL_TIM_Base_Stop_IT(base_tim);
+    power_stop_unlock();
+    LOGI(TAG, "Base timer stopped");
+}
+
+/**
+ * @brief Display rate groups and their callbacks.
+ *
+ * @param argc Number of arguments.
+ * @param argv Argument values.
+ *
+ * @return 0 if successful, 1 otherwise.
+ */
+static uint32_t cmd_cyclic_status(uint32_t argc, const char **argv)
+{
+    (void)argv;
+    if (argc != 0)
+    {
+        LOG("Usage: cyclic status\r\n");
+        return 1;
+    }
+
+    const float us_per_cycle = 1e6f / (float)SystemCoreClock;
+    LOG("Group\tPeriod (ms)\tPrio\tReleases\tOverruns\tMax run (us)\r\n");
+    for (uint32_t g = 0; g < CYCLIC_NUM_GROUPS; g++)
+    {
+        const cyclic_group_info_t *const grp = &groups[g];
+        LOG("%s\t%lu\t\t%d\t%lu\t\t%lu\t\t%.1f\r\n", grp->name, grp->frames * 1000U / CYCLIC_BASE_HZ, (int)grp->prio,
+            grp->releases, grp->overruns, (float)run_cycles[g].max * us_per_cycle);
+        for (uint32_t i = 0; i < grp->num_cbs; i++)
+        {
+            LOG("  %s\t\t\t\t\t\t\t%.1f\r\n", grp->cbs[i].name, (float)grp->cbs[i].max_cycles * us_per_cycle);
+        }
+    }
+    return 0;
+}
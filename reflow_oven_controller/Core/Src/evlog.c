@@ -0,0 +1,358 @@
+/**
+ * @file evlog.c
+ * @author Timothy Nguyen
+ * @brief Event stream recorder: events dispatched to chosen active objects, with payloads, for replay.
+ * @version 0.1
+ * @date 2021-09-06
+ */
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <string.h>
+#include <strings.h>
+
+#include "evlog.h"
+#include "cmd.h"
+#include "log.h"
+#include "console.h"
+#include "frame.h"
+#include "cmsis_os.h"
+#include "stm32l4xx.h"
+#include "sections.h"
+
+////////////////////////////////////////////////////////////////////////////////
+// Type definitions
+////////////////////////////////////////////////////////////////////////////////
+
+/* Ring slot */
+typedef struct
+{
+    evlog_hdr_t hdr;                    // Record header.
+    uint8_t payload[EVLOG_PAYLOAD_LEN]; // Leading payload bytes, hdr.len of them valid.
+} evlog_slot_t;
+
+/* Dump frame payload header, records follow */
+typedef struct __attribute__((packed))
+{
+    uint8_t type;   // EVLOG_TELEMETRY_TYPE.
+    uint16_t first; // Index of first record of frame within dump.
+    uint16_t total; // Number of records in dump.
+} evlog_dump_hdr_t;
+
+/* Dump in progress, one frame or name line per command step */
+typedef struct
+{
+    uint32_t oldest; // Free-running number of oldest record dumped.
+    uint32_t total;  // Number of records in dump.
+    uint32_t first;  // Index of first record of next frame within dump.
+    uint32_t id;     // Active object id of next name line, once records are sent.
+} evlog_dump_ctx_t;
+
+/* Recorder state */
+typedef struct
+{
+    bool once;              // Stop once ring is full instead of overwriting oldest records.
+    bool dumping;           // "evlog dump" is sending the ring, which must not be cleared.
+    uint32_t put;           // Free-running number of records added since start.
+    volatile bool posting;  // evlog_replay_post() is posting.
+} evlog_t;
+
+////////////////////////////////////////////////////////////////////////////////
+// Private (static) function declarations
+////////////////////////////////////////////////////////////////////////////////
+
+/* Command callback functions */
+static uint32_t cmd_evlog_start(uint32_t argc, const char **argv);  // Clear ring and start recording.
+static uint32_t cmd_evlog_stop(uint32_t argc, const char **argv);   // Freeze ring.
+static uint32_t cmd_evlog_dump(uint32_t argc, const char **argv);   // Send ring as frames.
+static uint32_t cmd_evlog_status(uint32_t argc, const char **argv); // Display recorder state.
+
+static cmd_async_status_t dump_step(void *ctx, bool cancel); // Send next dump frame or name line.
+
+////////////////////////////////////////////////////////////////////////////////
+// Private (static) variables
+////////////////////////////////////////////////////////////////////////////////
+
+/* Recorder state and record ring */
+static evlog_t evlog;
+static evlog_slot_t SRAM1_DMA ring[EVLOG_BUF_EVENTS];
+
+/* Dump progress and buffers, static to keep them off the command thread's stack. */
+static evlog_dump_ctx_t dump_ctx;
+static uint8_t dump[sizeof(evlog_dump_hdr_t) + EVLOG_DUMP_CHUNK * sizeof(evlog_slot_t)];
+static uint8_t dump_frame[FRAME_ENCODED_SIZE(sizeof(dump))];
+_Static_assert(sizeof(dump_frame) <= CMD_ASYNC_CHUNK, "A dump step writes one frame into the space it is resumed with");
+
+/* Event log command information. */
+static cmd_cmd_info evlog_cmds[] = {
+    {.cmd_name = "start",
+     .cb = cmd_evlog_start,
+     .help = "Clear event log and record events of active objects, all if none named, keeping newest records.\r\n"
+             "Usage: evlog start [once] [ao]..., once stops when full."},
+    {.cmd_name = "stop",
+     .cb = cmd_evlog_stop,
+     .help = "Stop recording."},
+    {.cmd_name = "dump",
+     .cb = cmd_evlog_dump,
+     .help = "Stop recording and send records as binary frames, followed by active object names."},
+    {.cmd_name = "status",
+     .cb = cmd_evlog_status,
+     .help = "Display recorder state."}};
+
+/* Event log module client info */
+CMD_CLIENT_DEFINE(evlog,
+                  .num_cmds = ARRAY_SIZE(evlog_cmds),
+                  .cmds = evlog_cmds);
+
+/* Unique tag for event log module. */
+LOG_TAG_DEFINE("EVLOG");
+
+////////////////////////////////////////////////////////////////////////////////
+// Public (global) variables and externs
+////////////////////////////////////////////////////////////////////////////////
+
+/* Active objects recorded and replayed, tested on every dispatch and post. */
+volatile uint32_t evlog_rec_mask;
+volatile uint32_t evlog_replay_mask;
+
+////////////////////////////////////////////////////////////////////////////////
+// Public (global) functions
+////////////////////////////////////////////////////////////////////////////////
+
+mod_err_t evlog_init(void)
+{
+    ASSERT(sizeof(evlog_hdr_t) + EVLOG_PAYLOAD_LEN <= sizeof(evlog_slot_t) && EVLOG_PAYLOAD_LEN <= UINT8_MAX);
+    evlog_rec_mask = 0;
+    evlog_replay_mask = 0;
+    memset(&evlog, 0, sizeof(evlog));
+    LOGI(TAG, "Initialized event log module");
+    return MOD_OK;
+}
+
+void evlog_record(Active const *const ao, Event const *const evt, size_t payload_len)
+{
+    uint8_t len = (uint8_t)(payload_len < EVLOG_PAYLOAD_LEN ? payload_len : EVLOG_PAYLOAD_LEN);
+
+    uint32_t primask = __get_PRIMASK();
+    __disable_irq();
+    if (evlog_rec_mask & (1UL << ao->id))
+    {
+        evlog_slot_t *const slot = &ring[evlog.put & (EVLOG_BUF_EVENTS - 1U)];
+        slot->hdr = (evlog_hdr_t){.tick = ao->progress_tick, .sig = (uint16_t)evt->sig, .ao_id = ao->id, .len = len};
+        memcpy(slot->payload, (const uint8_t *)evt + sizeof(Event), len);
+        evlog.put++;
+        if (evlog.once && evlog.put == EVLOG_BUF_EVENTS)
+        {
+            evlog_rec_mask = 0;
+        }
+    }
+    __set_PRIMASK(primask);
+}
+
+void evlog_replay(Active const *const ao, bool on)
+{
+    uint32_t primask = __get_PRIMASK();
+    __disable_irq();
+    if (on)
+    {
+        evlog_replay_mask |= 1UL << ao->id;
+    }
+    else
+    {
+        evlog_replay_mask &= ~(1UL << ao->id);
+    }
+    __set_PRIMASK(primask);
+}
+
+mod_err_t evlog_replay_post(Active *const ao, evlog_hdr_t const *hdr, const uint8_t *payload)
+{
+    Event *const evt = Event_new(sizeof(Event) + hdr->len, (Signal)hdr->sig);
+    if (evt == NULL)
+    {
+        return MOD_ERR_RESOURCE;
+    }
+    memcpy((uint8_t *)evt + sizeof(Event), payload, hdr->len);
+
+    /* No other post may slip through while the gate is open. */
+    uint32_t primask = __get_PRIMASK();
+    __disable_irq();
+    evlog.posting = true;
+    mod_err_t err = Active_post(ao, evt);
+    evlog.posting = false;
+    __set_PRIMASK(primask);
+    return err;
+}
+
+bool evlog_replay_posting(void)
+{
+    return evlog.posting;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Private (static) functions
+////////////////////////////////////////////////////////////////////////////////
+
+/**
+ * @brief Clear ring and start recording events of named active objects.
+ *
+ * @param argc Number of arguments.
+ * @param argv Argument values.
+ *
+ * @return 0 if successful, 1 otherwise.
+ */
+static uint32_t cmd_evlog_start(uint32_t argc, const char **argv)
+{
+    bool once = argc > 0 && strcasecmp(argv[0], "once") == 0;
+    uint32_t mask = 0;
+    for (uint32_t a = once ? 1U : 0U; a < argc; a++)
+    {
+        Active const *ao = NULL;
+        for (uint32_t id = 0; (ao = Active_by_id(id)) != NULL; id++)
+        {
+            if (ao->name != NULL && strcasecmp(ao->name, argv[a]) == 0)
+            {
+                break;
+            }
+        }
+        if (ao == NULL)
+        {
+            LOG("No active object named %s, see \"ao status\"\r\n", argv[a]);
+            return 1;
+        }
+        mask |= 1UL << ao->id;
+    }
+    if (mask == 0U)
+    {
+        mask = UINT32_MAX;
+    }
+    if (evlog.dumping)
+    {
+        LOG("Dump in progress, see \"cmd cancel\"\r\n");
+        return 1;
+    }
+
+    uint32_t primask = __get_PRIMASK();
+    __disable_irq();
+    evlog.put = 0;
+    evlog.once = once;
+    evlog_rec_mask = mask;
+    __set_PRIMASK(primask);
+
+    LOG("Event log recording%s\r\n", once ? " until full" : "");
+    return 0;
+}
+
+/**
+ * @brief Stop recording, ring keeps its records.
+ *
+ * @param argc Number of arguments.
+ * @param argv Argument values.
+ *
+ * @return 0 if successful, 1 otherwise.
+ */
+static uint32_t cmd_evlog_stop(uint32_t argc, const char **argv)
+{
+    evlog_rec_mask = 0;
+    LOG("Event log stopped, %lu records\r\n", evlog.put < EVLOG_BUF_EVENTS ? evlog.put : EVLOG_BUF_EVENTS);
+    return 0;
+}
+
+/**
+ * @brief Stop recording and send records oldest first as COBS frames, then active object names as text,
+ *        one frame or line per command step.
+ *
+ * @param argc Number of arguments.
+ * @param argv Argument values.
+ *
+ * @return 0 if successful, 1 otherwise.
+ */
+static uint32_t cmd_evlog_dump(uint32_t argc, const char **argv)
+{
+    if (evlog.dumping)
+    {
+        LOG("Dump in progress\r\n");
+        return 1;
+    }
+    evlog_rec_mask = 0; // Ring is no longer written once stored to.
+
+    uint32_t const total = evlog.put < EVLOG_BUF_EVENTS ? evlog.put : EVLOG_BUF_EVENTS;
+    dump_ctx = (evlog_dump_ctx_t){.oldest = evlog.put - total, .total = total};
+    if (cmd_async_start(dump_step, &dump_ctx) != MOD_OK)
+    {
+        return 1;
+    }
+    evlog.dumping = true;
+    return 0;
+}
+
+/**
+ * @brief Display recorder state.
+ *
+ * @param argc Number of arguments.
+ * @param argv Argument values.
+ *
+ * @return 0 if successful, 1 otherwise.
+ */
+static uint32_t cmd_evlog_status(uint32_t argc, const char **argv)
+{
+    uint32_t put = evlog.put;
+    cmd_out_str("recording", evlog_rec_mask != 0U ? "yes" : "no");
+    cmd_out_u32("records", put < EVLOG_BUF_EVENTS ? put : EVLOG_BUF_EVENTS);
+    cmd_out_u32("overwritten", put > EVLOG_BUF_EVENTS ? put - EVLOG_BUF_EVENTS : 0);
+    cmd_out_u32("replay mask", evlog_replay_mask);
+    return 0;
+}
+
+/**
+ * @brief Send next dump frame, or once records are sent the next active object name line.
+ *
+ * A frame that does not fit the transmit buffer is built again on the next step, the step
+ * never waits.
+ *
+ * @param ctx Dump progress, evlog_dump_ctx_t.
+ * @param cancel Stop the dump.
+ *
+ * @return CMD_ASYNC_MORE until every record and name was sent.
+ */
+static cmd_async_status_t dump_step(void *ctx, bool cancel)
+{
+    evlog_dump_ctx_t *const d = ctx;
+    if (cancel)
+    {
+        LOG("Dump cancelled after %lu records\r\n", d->first);
+        evlog.dumping = false;
+        return CMD_ASYNC_DONE;
+    }
+
+    if (d->first < d->total)
+    {
+        uint32_t n = d->total - d->first < EVLOG_DUMP_CHUNK ? d->total - d->first : EVLOG_DUMP_CHUNK;
+        const evlog_dump_hdr_t hdr = {.type = EVLOG_TELEMETRY_TYPE, .first = (uint16_t)d->first, .total = (uint16_t)d->total};
+        memcpy(dump, &hdr, sizeof(hdr));
+        size_t len = sizeof(hdr);
+        for (uint32_t i = 0; i < n; i++)
+        {
+            evlog_slot_t const *const slot = &ring[(d->oldest + d->first + i) & (EVLOG_BUF_EVENTS - 1U)];
+            memcpy(&dump[len], slot, sizeof(slot->hdr) + slot->hdr.len);
+            len += sizeof(slot->hdr) + slot->hdr.len;
+        }
+
+        size_t frame_len = frame_encode(dump, len, dump_frame, sizeof(dump_frame));
+        if (console_write((const char *)dump_frame, frame_len) == MOD_OK)
+        {
+            d->first += n;
+        }
+        return CMD_ASYNC_MORE;
+    }
+
+    Active const *const ao = Active_by_id(d->id);
+    if (ao != NULL)
+    {
+        LOG("AO %lu: %s\r\n", d->id, ao->name != NULL ? ao->name : "?");
+        d->id++;
+        return CMD_ASYNC_MORE;
+    }
+    LOG("Dumped %lu records\r\n", d->total);
+    evlog.dumping = false;
+    return CMD_ASYNC_DONE;
+}
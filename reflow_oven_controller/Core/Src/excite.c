@@ -0,0 +1,83 @@
+/**
+ * @file excite.c
+ * @author Timothy Nguyen
+ * @brief Open-loop excitation sequences for plant identification experiments.
+ * @version 0.1
+ * @date 2021-08-31
+ */
+
+#include <stdbool.h>
+
+#include "excite.h"
+#include "log.h"
+
+/* Galois feedback masks of maximal-length shift registers, indexed by order. */
+static const uint16_t prbs_masks[EXCITE_PRBS_ORDER_MAX + 1U] = {
+	[3] = 0x0006, [4] = 0x000C, [5] = 0x0014, [6] = 0x0030, [7] = 0x0060,
+	[8] = 0x00B8, [9] = 0x0110, [10] = 0x0240, [11] = 0x0500, [12] = 0x0E08,
+	[13] = 0x1C80, [14] = 0x3802, [15] = 0x6000};
+
+/* Output level of next step or bit. */
+static inline float excite_next(Excite_t * const ex)
+{
+	bool high;
+	if (ex->cfg.type == EXCITE_PRBS)
+	{
+		high = (ex->lfsr & 1U) != 0U;
+		ex->lfsr >>= 1;
+		if (high)
+		{
+			ex->lfsr ^= prbs_masks[ex->cfg.order];
+		}
+	}
+	else
+	{
+		high = (ex->step % 2U) != 0U; // First step after baseline goes high.
+	}
+	return high ? ex->cfg.out_high : ex->cfg.out_low;
+}
+
+void Excite_Init(Excite_t * const ex, Excite_cfg_t const * const cfg)
+{
+	ASSERT(cfg->num_steps > 0 && cfg->out_high > cfg->out_low && cfg->hold > 0.0f);
+	ASSERT(cfg->type != EXCITE_PRBS ||
+	       (cfg->order >= EXCITE_PRBS_ORDER_MIN && cfg->order <= EXCITE_PRBS_ORDER_MAX));
+
+	ex->cfg = *cfg;
+	ex->status = EXCITE_RUNNING;
+	ex->out = cfg->out_low;
+	ex->held = 0.0f;
+	ex->step = 0;
+	ex->lfsr = 1U;
+}
+
+Excite_status_t Excite_Step(Excite_t * const ex, float measurement, float Ts)
+{
+	if (ex->status != EXCITE_RUNNING)
+	{
+		return ex->status;
+	}
+
+	if (measurement >= ex->cfg.limit)
+	{
+		ex->out = ex->cfg.out_low;
+		ex->status = EXCITE_ERR_LIMIT;
+		return ex->status;
+	}
+
+	/* Steps change on the first sample at or past their hold time, so hold is quantized to samples. */
+	ex->held += Ts;
+	if (ex->held < ex->cfg.hold)
+	{
+		return ex->status;
+	}
+	ex->held -= ex->cfg.hold;
+	if (ex->step++ == ex->cfg.num_steps)
+	{
+		ex->out = ex->cfg.out_low;
+		ex->status = EXCITE_DONE;
+		return ex->status;
+	}
+	ex->out = excite_next(ex);
+	return ex->status;
+}
@@ -0,0 +1,152 @@
+/**
+ * @file filter.c
+ * @author Timothy Nguyen
+ * @brief Measurement filter: outlier rejection, median-of-N and first-order IIR.
+ * @version 0.1
+ * @date 2021-08-16
+ */
+
+#include <string.h>
+#include <math.h>
+
+#include "filter.h"
+#include "log.h"
+
+/* Median of window by insertion sort of a copy, window is at most FILTER_MAX_MEDIAN long. */
+static inline float filter_median(Filter_t const * const filt)
+{
+	uint8_t n = filt->cfg.median_len;
+	float sorted[FILTER_MAX_MEDIAN];
+	for (uint8_t i = 0; i < n; i++)
+	{
+		float v = filt->window[i];
+		uint8_t j = i;
+		while (j > 0 && sorted[j - 1] > v)
+		{
+			sorted[j] = sorted[j - 1];
+			j--;
+		}
+		sorted[j] = v;
+	}
+	return sorted[n / 2];
+}
+
+/* Biquad cascade in transposed direct form II, priming state for a constant input on first call. */
+static inline float filter_biquads(Filter_t * const filt, float x, bool prime)
+{
+	for (uint8_t i = 0; i < filt->cfg.num_biquads; i++)
+	{
+		float const *c = filt->cfg.biquad[i];
+		float *d = filt->state[i];
+		float y;
+		if (prime)
+		{
+			/* Steady state, gain (b0 + b1 + b2) / (1 - a1 - a2). */
+			y = x * (c[0] + c[1] + c[2]) / (1.0f - c[3] - c[4]);
+			d[0] = y - c[0] * x;
+			d[1] = c[2] * x + c[4] * y;
+		}
+		else
+		{
+			y = c[0] * x + d[0];
+			d[0] = c[1] * x + c[3] * y + d[1];
+			d[1] = c[2] * x + c[4] * y;
+		}
+		x = y;
+	}
+	return x;
+}
+
+void Filter_Init(Filter_t * const filt, Filter_cfg_t const * const cfg)
+{
+	ASSERT(cfg->median_len >= 1 && cfg->median_len <= FILTER_MAX_MEDIAN && (cfg->median_len & 1U));
+	ASSERT(cfg->alpha > 0.0f && cfg->alpha <= 1.0f && cfg->outlier_limit >= 0.0f);
+	ASSERT(cfg->num_biquads <= FILTER_MAX_BIQUADS);
+
+	filt->cfg = *cfg;
+	filt->num_rejected = 0;
+	Filter_Reset(filt);
+}
+
+float Filter_Update(Filter_t * const filt, float x)
+{
+	if (!filt->primed)
+	{
+		for (uint8_t i = 0; i < filt->cfg.median_len; i++)
+		{
+			filt->window[i] = x;
+		}
+		filt->head = 0;
+		filt->median = x;
+		filt->out = filter_biquads(filt, x, true);
+		filt->primed = true;
+		return filt->out;
+	}
+
+	/* Reject reading far from median, unless the measurement has really moved there. Once
+	 * median_len readings in a row were rejected, far readings are accepted until the median
+	 * follows them. */
+	if (filt->cfg.outlier_limit > 0.0f && fabsf(x - filt->median) > filt->cfg.outlier_limit)
+	{
+		if (filt->rejects < filt->cfg.median_len)
+		{
+			filt->rejects++;
+			filt->num_rejected++;
+			x = filt->median;
+		}
+	}
+	else
+	{
+		filt->rejects = 0;
+	}
+
+	filt->window[filt->head] = x;
+	filt->head = (filt->head + 1 == filt->cfg.median_len) ? 0 : filt->head + 1;
+	filt->median = filter_median(filt);
+
+	if (filt->cfg.num_biquads > 0)
+	{
+		filt->out = filter_biquads(filt, filt->median, false);
+	}
+	else
+	{
+		filt->out += filt->cfg.alpha * (filt->median - filt->out);
+	}
+	return filt->out;
+}
+
+bool Filter_LowPass(Filter_cfg_t * const cfg, float cutoff, float Ts)
+{
+	if (!(cutoff >= 0.0f && cutoff < 0.5f / Ts))
+	{
+		return false;
+	}
+	if (cutoff == 0.0f)
+	{
+		cfg->num_biquads = 0;
+		return true;
+	}
+
+	/* Bilinear transform of analog Butterworth prototype, prewarped to cutoff. */
+	float k = tanf((float)M_PI * cutoff * Ts);
+	float norm = 1.0f / (1.0f + (float)M_SQRT2 * k + k * k);
+	float *c = cfg->biquad[0];
+	c[0] = k * k * norm;
+	c[1] = 2.0f * c[0];
+	c[2] = c[0];
+	c[3] = -2.0f * (k * k - 1.0f) * norm;
+	c[4] = -(1.0f - (float)M_SQRT2 * k + k * k) * norm;
+	cfg->num_biquads = 1;
+	return true;
+}
+
+void Filter_Reset(Filter_t * const filt)
+{
+	memset(filt->window, 0, sizeof(filt->window));
+	memset(filt->state, 0, sizeof(filt->state));
+	filt->head = 0;
+	filt->rejects = 0;
+	filt->primed = false;
+	filt->median = 0.0f;
+	filt->out = 0.0f;
+}
@@ -0,0 +1,133 @@
+/**
+ * @file frame.c
+ * @author Timothy Nguyen
+ * @brief COBS framing with CRC-16 for binary data over a byte stream.
+ * @version 0.1
+ * @date 2021-08-06
+ */
+
+#include "frame.h"
+
+////////////////////////////////////////////////////////////////////////////////
+// Private (static) function declarations
+////////////////////////////////////////////////////////////////////////////////
+
+static inline uint16_t crc16_update(uint16_t crc, uint8_t byte); // Feed one byte into CRC.
+
+////////////////////////////////////////////////////////////////////////////////
+// Public (global) functions
+////////////////////////////////////////////////////////////////////////////////
+
+uint16_t frame_crc16(const uint8_t *data, size_t len)
+{
+    uint16_t crc = 0xFFFFU;
+    for (size_t i = 0; i < len; i++)
+    {
+        crc = crc16_update(crc, data[i]);
+    }
+    return crc;
+}
+
+size_t frame_encode(const uint8_t *payload, size_t len, uint8_t *out, size_t out_size)
+{
+    if (out_size < FRAME_ENCODED_SIZE(len))
+    {
+        return 0;
+    }
+
+    uint16_t crc = frame_crc16(payload, len);
+    size_t total = len + FRAME_CRC_SIZE;
+
+    size_t code_idx = 0; // Position of current block's code byte.
+    size_t out_idx = 1;
+    uint8_t code = 1;    // Block length + 1.
+
+    for (size_t i = 0; i < total; i++)
+    {
+        /* CRC is sent little-endian after payload. */
+        uint8_t byte = i < len ? payload[i] : (uint8_t)(crc >> (8U * (i - len)));
+
+        if (byte == 0)
+        {
+            out[code_idx] = code;
+            code_idx = out_idx++;
+            code = 1;
+        }
+        else
+        {
+            out[out_idx++] = byte;
+            if (++code == 0xFFU)
+            {
+                /* Maximum block length reached, start a new block. */
+                out[code_idx] = code;
+                code_idx = out_idx++;
+                code = 1;
+            }
+        }
+    }
+    out[code_idx] = code;
+    out[out_idx++] = FRAME_DELIMITER;
+
+    return out_idx;
+}
+
+mod_err_t frame_decode(const uint8_t *frame, size_t len, uint8_t *payload, size_t *payload_len)
+{
+    size_t in_idx = 0;
+    size_t out_idx = 0;
+
+    while (in_idx < len)
+    {
+        uint8_t code = frame[in_idx++];
+        if (code == 0 || in_idx + code - 1 > len)
+        {
+            return MOD_ERR_ARG;
+        }
+        for (uint8_t i = 1; i < code; i++)
+        {
+            payload[out_idx++] = frame[in_idx++];
+        }
+        /* A block shorter than maximum length implies a zero, except at end of frame. */
+        if (code != 0xFFU && in_idx < len)
+        {
+            payload[out_idx++] = 0;
+        }
+    }
+
+    if (out_idx < FRAME_CRC_SIZE)
+    {
+        return MOD_ERR_ARG;
+    }
+
+    size_t data_len = out_idx - FRAME_CRC_SIZE;
+    uint16_t crc = (uint16_t)payload[data_len] | ((uint16_t)payload[data_len + 1] << 8);
+    if (crc != frame_crc16(payload, data_len))
+    {
+        return MOD_ERR_ARG;
+    }
+
+    *payload_len = data_len;
+    return MOD_OK;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Private (static) functions
+////////////////////////////////////////////////////////////////////////////////
+
+/**
+ * @brief Feed one byte into CRC-16/CCITT-FALSE.
+ *
+ * @param crc Current CRC value.
+ * @param byte Next data byte.
+ *
+ * @return Updated CRC value.
+ */
+static inline uint16_t crc16_update(uint16_t crc, uint8_t byte)
+{
+    crc ^= (uint16_t)byte << 8;
+    for (uint8_t bit = 0; bit < 8; bit++)
+    {
+        crc = (crc & 0x8000U) ? (uint16_t)((crc << 1) ^ 0x1021U) : (uint16_t)(crc << 1);
+    }
+    return crc;
+}
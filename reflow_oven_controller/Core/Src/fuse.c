@@ -0,0 +1,164 @@
+/**
+ * @file fuse.c
+ * @author Timothy Nguyen
+ * @brief Sensor fusion: median vote of redundant thermocouples and a Kalman filter of temperature and rate.
+ * @version 0.1
+ * @date 2021-09-06
+ */
+
+#include <math.h>
+#include <string.h>
+
+#include "fuse.h"
+#include "prof.h"
+
+/* Rate variance of a freshly primed estimate ((deg C/s)^2), nothing is known of the rate yet. */
+#define FUSE_RATE_VAR_INIT 1.0f
+
+static void fuse_predict(Fuse_t * const f, float u, float Ts); // Advance estimate and covariance over Ts.
+
+float Fuse_Vote(float const * const vals, uint32_t n)
+{
+	/* Insertion sort of a copy, a handful of readings. */
+	float sorted[FUSE_MAX_VOTERS];
+	for (uint32_t i = 0; i < n; i++)
+	{
+		uint32_t j = i;
+		for (; j > 0 && sorted[j - 1U] > vals[i]; j--)
+		{
+			sorted[j] = sorted[j - 1U];
+		}
+		sorted[j] = vals[i];
+	}
+	return (n & 1U) ? sorted[n / 2U] : 0.5f * (sorted[n / 2U - 1U] + sorted[n / 2U]);
+}
+
+mod_err_t Fuse_Init(Fuse_t * const f, Fuse_cfg_t const * const cfg, Smith_model_t const * const model, float Ts)
+{
+	if (!(cfg->q > 0.0f) || !(cfg->r > 0.0f) || !(Ts > 0.0f))
+	{
+		return MOD_ERR_ARG;
+	}
+
+	f->cfg = *cfg;
+	f->K = 0.0f;
+	f->T = 0.0f;
+	f->delay = 0;
+	if (model != NULL && model->T > 0.0f)
+	{
+		float delay = roundf(model->L / Ts);
+		if (!(delay <= (float)SMITH_MAX_DELAY))
+		{
+			return MOD_ERR_ARG;
+		}
+		f->K = model->K;
+		f->T = model->T;
+		f->delay = (uint32_t)delay;
+	}
+	Fuse_Reset(f);
+	return MOD_OK;
+}
+
+void Fuse_Reset(Fuse_t * const f)
+{
+	f->primed = false;
+	f->temp = 0.0f;
+	f->rate = 0.0f;
+	f->p00 = 0.0f;
+	f->p01 = 0.0f;
+	f->p11 = 0.0f;
+	f->head = 0;
+	f->prev_u = 0.0f;
+	memset(f->history, 0, sizeof(f->history));
+}
+
+float Fuse_Update(Fuse_t * const f, float meas, float u, float Ts)
+{
+	PROF_BEGIN(fuse_update);
+
+	/* First measurement primes the estimate, output so far counts as no change. */
+	if (!f->primed)
+	{
+		f->primed = true;
+		f->temp = meas;
+		f->rate = 0.0f;
+		f->p00 = f->cfg.r;
+		f->p01 = 0.0f;
+		f->p11 = FUSE_RATE_VAR_INIT;
+		for (uint32_t i = 0; i < f->delay; i++)
+		{
+			f->history[i] = u;
+		}
+		f->prev_u = u;
+		PROF_END(fuse_update);
+		return f->temp;
+	}
+
+	fuse_predict(f, u, Ts);
+
+	/* Correct with measurement of temperature, H = [1 0]. */
+	float p00 = f->p00;
+	float p01 = f->p01;
+	float p11 = f->p11;
+	float s = p00 + f->cfg.r;
+	float k0 = p00 / s;
+	float k1 = p01 / s;
+	float innovation = meas - f->temp;
+	f->temp += k0 * innovation;
+	f->rate += k1 * innovation;
+	f->p00 = (1.0f - k0) * p00;
+	f->p01 = (1.0f - k0) * p01;
+	f->p11 = p11 - k1 * p01;
+
+	PROF_END(fuse_update);
+	return f->temp;
+}
+
+float Fuse_Predict(Fuse_t * const f, float u, float Ts)
+{
+	if (f->primed)
+	{
+		fuse_predict(f, u, Ts);
+	}
+	return f->temp;
+}
+
+/**
+ * @brief Advance estimate over the sample time along the model, covariance grows by the process noise.
+ *
+ * @param f Primed filter.
+ * @param u Heater output applied since the previous update (counts).
+ * @param Ts Time since the previous update (s).
+ */
+static void fuse_predict(Fuse_t * const f, float u, float Ts)
+{
+	/* Output one dead time ago, ring holds the last delay outputs. */
+	float u_delayed = u;
+	if (f->delay > 0)
+	{
+		u_delayed = f->history[f->head];
+		f->history[f->head] = u;
+		f->head = (f->head + 1 == f->delay) ? 0 : f->head + 1;
+	}
+
+	/* Predict, x = F x + B du with F = [1 Ts; 0 a]. */
+	float a = 1.0f;
+	float b = 0.0f;
+	if (f->T > 0.0f)
+	{
+		a = expf(-Ts / f->T);
+		b = f->K / f->T;
+	}
+	f->temp += Ts * f->rate;
+	f->rate = a * f->rate + b * (u_delayed - f->prev_u);
+	f->prev_u = u_delayed;
+
+	/* P = F P F' + Q, Q of white acceleration q over Ts. */
+	float Ts2 = Ts * Ts;
+	float p00 = f->p00 + 2.0f * Ts * f->p01 + Ts2 * f->p11 + f->cfg.q * Ts2 * Ts / 3.0f;
+	float p01 = a * (f->p01 + Ts * f->p11) + f->cfg.q * Ts2 / 2.0f;
+	float p11 = a * a * f->p11 + f->cfg.q * Ts;
+	f->p00 = p00;
+	f->p01 = p01;
+	f->p11 = p11;
+}
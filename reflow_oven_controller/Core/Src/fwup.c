@@ -0,0 +1,522 @@
+/**
+ * @file fwup.c
+ * @author Timothy Nguyen
+ * @brief Firmware update: new image written to the other flash bank while running, swapped at the RESET state.
+ * @version 0.1
+ * @date 2021-09-06
+ */
+
+#include <ctype.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "fwup.h"
+#include "nvs.h"
+#include "bgjob.h"
+#include "reflow.h"
+#include "cmd.h"
+#include "log.h"
+#include "cmsis_os.h"
+#include "stm32l4xx_hal.h"
+
+////////////////////////////////////////////////////////////////////////////////
+// Common macros
+////////////////////////////////////////////////////////////////////////////////
+
+#define FWUP_SRAM_END (SRAM1_BASE + SRAM1_SIZE_MAX) // Highest initial stack pointer of an image.
+
+_Static_assert(FWUP_WRITE_MAX % sizeof(uint64_t) == 0U, "Writes are whole double-words");
+
+////////////////////////////////////////////////////////////////////////////////
+// Type definitions
+////////////////////////////////////////////////////////////////////////////////
+
+/* Reasons of a failed update */
+typedef enum
+{
+    FWUP_FAIL_NONE,    // Not failed.
+    FWUP_FAIL_ERASE,   // Page erase failed.
+    FWUP_FAIL_PROGRAM, // Programming failed.
+    FWUP_FAIL_CRC,     // CRC mismatch.
+    FWUP_FAIL_VECTORS, // Stack pointer or reset vector outside the image.
+    FWUP_FAIL_STORE,   // Parameter store could not be copied.
+    FWUP_FAIL_OPTION,  // Option bytes could not be programmed.
+
+    FWUP_NUM_FAILS
+} fwup_fail_t;
+
+////////////////////////////////////////////////////////////////////////////////
+// Private (static) function declarations
+////////////////////////////////////////////////////////////////////////////////
+
+static uint32_t fwup_status_cmd(uint32_t argc, const char **argv); // Print update state.
+static uint32_t fwup_begin_cmd(uint32_t argc, const char **argv);  // Start update.
+static uint32_t fwup_write_cmd(uint32_t argc, const char **argv);  // Program image chunk.
+static uint32_t fwup_end_cmd(uint32_t argc, const char **argv);    // Verify image.
+static uint32_t fwup_abort_cmd(uint32_t argc, const char **argv);  // Drop update.
+
+static bgjob_status_t fwup_erase_step(void *arg);  // Erase one page.
+static bgjob_status_t fwup_verify_step(void *arg); // Check one chunk.
+static bgjob_status_t fwup_swap_step(void *arg);   // Copy store and swap banks.
+static void fwup_poll(void *arg);                  // Start swap once in the RESET state.
+static bool fwup_advance(fwup_state_t from, fwup_state_t to); // Change state unless it changed meanwhile.
+static void fwup_fail(fwup_state_t from, fwup_fail_t reason);
+static mod_err_t fwup_program(uint32_t addr, const uint64_t *data, uint32_t num_dwords);
+
+////////////////////////////////////////////////////////////////////////////////
+// Private (static) variables
+////////////////////////////////////////////////////////////////////////////////
+
+/* Update state, changed by the command thread and background jobs */
+static volatile fwup_state_t state;
+static volatile fwup_fail_t fail;
+static uint32_t image_size;   // Bytes to receive.
+static uint32_t image_crc;    // Expected CRC-32.
+static uint32_t written;      // Bytes received, in order.
+static uint32_t erase_next;   // Next page offset to erase.
+static uint32_t verify_next;  // Next offset to check.
+static uint32_t crc_computed; // CRC-32 of verified bytes, not yet inverted.
+
+/* Chunk being programmed */
+static uint64_t chunk[FWUP_WRITE_MAX / sizeof(uint64_t)];
+
+/* Background jobs and swap poll timer */
+static bgjob_t erase_job = {.name = "fwup erase", .step = fwup_erase_step};
+static bgjob_t verify_job = {.name = "fwup verify", .step = fwup_verify_step};
+static bgjob_t swap_job = {.name = "fwup swap", .step = fwup_swap_step};
+static osTimerId_t poll_timer;
+static StaticTimer_t poll_timer_cb;
+
+static const char *state_names[] = {"IDLE", "ERASING", "RECEIVING", "VERIFYING", "READY", "FAILED"};
+static const char *fail_names[] = {"none", "erase", "program", "CRC", "vectors", "store", "option bytes"};
+
+_Static_assert(ARRAY_SIZE(fail_names) == FWUP_NUM_FAILS, "fail_names out of sync with fwup_fail_t");
+
+static cmd_cmd_info fwup_cmds[] = {
+    {.cmd_name = "status",
+     .cb = fwup_status_cmd,
+     .help = "Print update state, running bank and progress.\r\n"
+             "Usage: fwup status"},
+    {.cmd_name = "begin",
+     .cb = fwup_begin_cmd,
+     .help = "Start update of size bytes, erasing the other bank in the background.\r\n"
+             "Usage: fwup begin <size> <crc32>"},
+    {.cmd_name = "write",
+     .cb = fwup_write_cmd,
+     .help = "Program image bytes given in hex at offset, in order, offset a multiple of 8.\r\n"
+             "Usage: fwup write <offset> <hex bytes>"},
+    {.cmd_name = "end",
+     .cb = fwup_end_cmd,
+     .help = "Verify received image, the banks swap at the next RESET state.\r\n"
+             "Usage: fwup end"},
+    {.cmd_name = "abort",
+     .cb = fwup_abort_cmd,
+     .help = "Drop update, including a pending swap.\r\n"
+             "Usage: fwup abort"},
+};
+
+CMD_CLIENT_DEFINE(fwup,
+                  .num_cmds = ARRAY_SIZE(fwup_cmds),
+                  .cmds = fwup_cmds);
+
+/* Unique tag for logging module */
+LOG_TAG_DEFINE("FWUP");
+
+////////////////////////////////////////////////////////////////////////////////
+// Public (global) functions
+////////////////////////////////////////////////////////////////////////////////
+
+mod_err_t fwup_init(void)
+{
+    static const osTimerAttr_t timer_attr = {.name = "fwup", .cb_mem = &poll_timer_cb, .cb_size = sizeof(poll_timer_cb)};
+    poll_timer = osTimerNew(fwup_poll, osTimerPeriodic, NULL, &timer_attr);
+    ASSERT(poll_timer != NULL);
+
+    LOGI(TAG, "Initialized firmware update, running from bank %u", fwup_bank());
+    return MOD_OK;
+}
+
+uint8_t fwup_bank(void)
+{
+    return READ_BIT(SYSCFG->MEMRMP, SYSCFG_MEMRMP_FB_MODE) != 0U ? 2U : 1U;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Private (static) functions
+////////////////////////////////////////////////////////////////////////////////
+
+/**
+ * @brief Erase the next page of the image area (background job step, idle task).
+ */
+static bgjob_status_t fwup_erase_step(void *arg)
+{
+    (void)arg;
+    if (state != FWUP_ERASING)
+    {
+        return BGJOB_DONE;
+    }
+    if (nvs_flash_acquire(0) != MOD_OK)
+    {
+        return BGJOB_MORE; // Idle task must not block, the store is writing.
+    }
+
+    uint32_t addr = FWUP_IMAGE_ADDR + erase_next;
+    FLASH_EraseInitTypeDef erase = {.TypeErase = FLASH_TYPEERASE_PAGES,
+                                    .Banks = nvs_flash_bank(addr),
+                                    .Page = ((addr - FLASH_BASE) % FLASH_BANK_SIZE) / FLASH_PAGE_SIZE,
+                                    .NbPages = 1};
+    uint32_t page_err;
+    HAL_FLASH_Unlock();
+    __HAL_FLASH_CLEAR_FLAG(FLASH_FLAG_ALL_ERRORS);
+    HAL_StatusTypeDef status = HAL_FLASHEx_Erase(&erase, &page_err);
+    HAL_FLASH_Lock();
+    nvs_flash_release();
+
+    if (status != HAL_OK)
+    {
+        fwup_fail(FWUP_ERASING, FWUP_FAIL_ERASE);
+        return BGJOB_DONE;
+    }
+    erase_next += FLASH_PAGE_SIZE;
+    if (erase_next < image_size)
+    {
+        return BGJOB_MORE;
+    }
+    fwup_advance(FWUP_ERASING, FWUP_RECEIVING);
+    return BGJOB_DONE;
+}
+
+/**
+ * @brief Add the next chunk of the image to its CRC, check vectors at the end (background job step, idle task).
+ *
+ * The CRC unit computes CRC-32 of zlib with bytes and result bit-reversed.
+ */
+static bgjob_status_t fwup_verify_step(void *arg)
+{
+    (void)arg;
+    if (state != FWUP_VERIFYING)
+    {
+        return BGJOB_DONE;
+    }
+
+    /* Resume from the previous chunk, the CRC unit is used by this job only. */
+    CRC->INIT = crc_computed;
+    CRC->CR = CRC_CR_REV_IN | CRC_CR_REV_OUT | CRC_CR_RESET; // Words reflected whole, as little-endian bytes.
+    const uint8_t *p = (const uint8_t *)(FWUP_IMAGE_ADDR + verify_next);
+    uint32_t n = image_size - verify_next < FWUP_VERIFY_CHUNK ? image_size - verify_next : FWUP_VERIFY_CHUNK;
+    uint32_t i = 0;
+    for (; i + 4U <= n; i += 4U)
+    {
+        CRC->DR = *(const uint32_t *)&p[i];
+    }
+    CRC->CR = CRC_CR_REV_IN_0 | CRC_CR_REV_OUT; // Bytes of the tail reflected one by one.
+    for (; i < n; i++)
+    {
+        *(volatile uint8_t *)&CRC->DR = p[i];
+    }
+    crc_computed = __RBIT(CRC->DR); // Unreflected again, to seed the next chunk.
+    verify_next += n;
+    if (verify_next < image_size)
+    {
+        return BGJOB_MORE;
+    }
+
+    uint32_t crc = ~__RBIT(crc_computed);
+    uint32_t sp = ((const uint32_t *)FWUP_IMAGE_ADDR)[0];
+    uint32_t reset = ((const uint32_t *)FWUP_IMAGE_ADDR)[1];
+    if (crc != image_crc)
+    {
+        crc_computed = crc;
+        fwup_fail(FWUP_VERIFYING, FWUP_FAIL_CRC);
+    }
+    else if (sp <= SRAM1_BASE || sp > FWUP_SRAM_END || (sp & 3U) != 0U ||
+             (reset & 1U) == 0U || reset < FLASH_BASE || reset >= FLASH_BASE + image_size)
+    {
+        fwup_fail(FWUP_VERIFYING, FWUP_FAIL_VECTORS);
+    }
+    else if (fwup_advance(FWUP_VERIFYING, FWUP_READY))
+    {
+        LOGI(TAG, "Image of %lu bytes verified, swapping banks at the next RESET state", image_size);
+        osTimerStart(poll_timer, FWUP_SWAP_POLL_MS);
+    }
+    crc_computed = crc;
+    return BGJOB_DONE;
+}
+
+/**
+ * @brief Copy the parameter store to the new bank and boot it (background job step, idle task).
+ *
+ * Reloading the option bytes resets the device, this step only returns on failure.
+ */
+static bgjob_status_t fwup_swap_step(void *arg)
+{
+    (void)arg;
+    if (state != FWUP_READY || !reflow_idle())
+    {
+        return BGJOB_DONE;
+    }
+    if (nvs_flash_acquire(0) != MOD_OK)
+    {
+        return BGJOB_MORE;
+    }
+
+    /* Store stays taken, no value is written after its copy. */
+    if (nvs_mirror() != MOD_OK)
+    {
+        nvs_flash_release();
+        fwup_fail(FWUP_READY, FWUP_FAIL_STORE);
+        return BGJOB_DONE;
+    }
+
+    FLASH_OBProgramInitTypeDef ob = {.OptionType = OPTIONBYTE_USER,
+                                     .USERType = OB_USER_BFB2,
+                                     .USERConfig = fwup_bank() == 1U ? OB_BFB2_ENABLE : OB_BFB2_DISABLE};
+    HAL_FLASH_Unlock();
+    HAL_FLASH_OB_Unlock();
+    __HAL_FLASH_CLEAR_FLAG(FLASH_FLAG_ALL_ERRORS);
+    if (HAL_FLASHEx_OBProgram(&ob) == HAL_OK)
+    {
+        HAL_FLASH_OB_Launch();
+    }
+    HAL_FLASH_OB_Lock();
+    HAL_FLASH_Lock();
+    nvs_flash_release();
+    fwup_fail(FWUP_READY, FWUP_FAIL_OPTION);
+    return BGJOB_DONE;
+}
+
+/**
+ * @brief Start swap job once the controller is in its RESET state (timer callback).
+ */
+static void fwup_poll(void *arg)
+{
+    (void)arg;
+    if (state != FWUP_READY)
+    {
+        osTimerStop(poll_timer);
+    }
+    else if (reflow_idle())
+    {
+        bgjob_submit(&swap_job);
+    }
+}
+
+/**
+ * @brief Change state if it is still from, so a job step never overrides an abort.
+ *
+ * @return true if changed.
+ */
+static bool fwup_advance(fwup_state_t from, fwup_state_t to)
+{
+    osKernelLock();
+    bool changed = state == from;
+    if (changed)
+    {
+        state = to;
+    }
+    osKernelUnlock();
+    return changed;
+}
+
+static void fwup_fail(fwup_state_t from, fwup_fail_t reason)
+{
+    if (fwup_advance(from, FWUP_FAILED))
+    {
+        fail = reason;
+        LOGE(TAG, "Update failed: %s", fail_names[reason]);
+    }
+}
+
+/**
+ * @brief Program double-words into the erased image area, flash taken from the store (command thread).
+ *
+ * @return MOD_OK if successful, MOD_ERR_PERIPH otherwise.
+ */
+static mod_err_t fwup_program(uint32_t addr, const uint64_t *data, uint32_t num_dwords)
+{
+    HAL_StatusTypeDef status = HAL_OK;
+    nvs_flash_acquire(osWaitForever);
+    HAL_FLASH_Unlock();
+    __HAL_FLASH_CLEAR_FLAG(FLASH_FLAG_ALL_ERRORS);
+    for (uint32_t i = 0; i < num_dwords && status == HAL_OK; i++)
+    {
+        status = HAL_FLASH_Program(FLASH_TYPEPROGRAM_DOUBLEWORD, addr + i * sizeof(uint64_t), data[i]);
+    }
+    HAL_FLASH_Lock();
+    nvs_flash_release();
+    return status == HAL_OK ? MOD_OK : MOD_ERR_PERIPH;
+}
+
+static uint32_t fwup_status_cmd(uint32_t argc, const char **argv)
+{
+    (void)argv;
+    if (argc != 0)
+    {
+        LOG("Usage: fwup status\r\n");
+        return 1;
+    }
+    fwup_state_t s = state;
+    cmd_out_str("state", state_names[s]);
+    cmd_out_u32("bank", fwup_bank());
+    if (s == FWUP_IDLE)
+    {
+        return 0;
+    }
+    cmd_out_u32("size", image_size);
+    cmd_out_u32("erased", erase_next < image_size ? erase_next : image_size);
+    cmd_out_u32("written", written);
+    cmd_out_u32("verified", verify_next);
+    if (s == FWUP_FAILED)
+    {
+        cmd_out_str("reason", fail_names[fail]);
+        if (fail == FWUP_FAIL_CRC)
+        {
+            cmd_out_u32("crc", crc_computed);
+        }
+    }
+    return 0;
+}
+
+static uint32_t fwup_begin_cmd(uint32_t argc, const char **argv)
+{
+    char *end_size;
+    char *end_crc;
+    unsigned long size = argc == 2U ? strtoul(argv[0], &end_size, 0) : 0UL;
+    unsigned long crc = argc == 2U ? strtoul(argv[1], &end_crc, 0) : 0UL;
+    if (argc != 2U || *end_size != '\0' || *end_crc != '\0' || size == 0UL || size > FWUP_IMAGE_MAX)
+    {
+        LOG("Usage: fwup begin <size up to %lu> <crc32>\r\n", (unsigned long)FWUP_IMAGE_MAX);
+        return 1;
+    }
+    fwup_state_t s = state;
+    if (s == FWUP_ERASING || s == FWUP_VERIFYING)
+    {
+        LOG("Update %s, abort it first\r\n", state_names[s]);
+        return 1;
+    }
+
+    state = FWUP_IDLE; // Jobs of a previous update stop at their next step.
+    image_size = (uint32_t)size;
+    image_crc = (uint32_t)crc;
+    written = 0;
+    erase_next = 0;
+    verify_next = 0;
+    crc_computed = 0;
+    fail = FWUP_FAIL_NONE;
+    state = FWUP_ERASING;
+    bgjob_submit(&erase_job);
+    cmd_out_str("state", state_names[FWUP_ERASING]);
+    return 0;
+}
+
+/**
+ * @brief Program chunk at offset, in order. A chunk already programmed is accepted if it matches.
+ *
+ * Hex digits may be split across arguments at byte boundaries. Chunks are whole double-words but
+ * the last, which is padded with erased bytes.
+ */
+static uint32_t fwup_write_cmd(uint32_t argc, const char **argv)
+{
+    char *end;
+    unsigned long offset = argc >= 2U ? strtoul(argv[0], &end, 0) : 0UL;
+    if (argc < 2U || *end != '\0' || (offset % sizeof(uint64_t)) != 0UL)
+    {
+        LOG("Usage: fwup write <offset, multiple of 8> <hex bytes>\r\n");
+        return 1;
+    }
+    uint8_t *const bytes = (uint8_t *)chunk;
+    uint32_t len = 0;
+    for (uint32_t i = 1; i < argc; i++)
+    {
+        for (const char *c = argv[i]; *c != '\0'; c += 2)
+        {
+            if (!isxdigit((unsigned char)c[0]) || !isxdigit((unsigned char)c[1]) || len >= FWUP_WRITE_MAX)
+            {
+                LOG("Usage: fwup write <offset> <up to %u hex bytes>\r\n", FWUP_WRITE_MAX);
+                return 1;
+            }
+            char byte[3] = {c[0], c[1], '\0'};
+            bytes[len++] = (uint8_t)strtoul(byte, NULL, 16);
+        }
+    }
+
+    if (state != FWUP_RECEIVING)
+    {
+        LOG("Not receiving, state %s\r\n", state_names[state]);
+        return 1;
+    }
+    if (len == 0U || offset + len > image_size || ((len % sizeof(uint64_t)) != 0U && offset + len != image_size))
+    {
+        LOG("Chunk beyond image or not whole double-words\r\n");
+        return 1;
+    }
+    if (offset + len <= written)
+    {
+        if (memcmp((const void *)(FWUP_IMAGE_ADDR + offset), bytes, len) != 0)
+        {
+            LOG("Chunk differs from the one written at offset %lu\r\n", offset);
+            return 1;
+        }
+        cmd_out_u32("written", written);
+        return 0; // Resent, eg. after a lost response.
+    }
+    if (offset != written)
+    {
+        LOG("Expected offset %lu\r\n", written);
+        return 1;
+    }
+
+    uint32_t num_dwords = (len + sizeof(uint64_t) - 1U) / sizeof(uint64_t);
+    memset(&bytes[len], 0xFF, num_dwords * sizeof(uint64_t) - len);
+    if (fwup_program(FWUP_IMAGE_ADDR + offset, chunk, num_dwords) != MOD_OK)
+    {
+        fwup_fail(FWUP_RECEIVING, FWUP_FAIL_PROGRAM);
+        return 1;
+    }
+    written = offset + len;
+    cmd_out_u32("written", written);
+    return 0;
+}
+
+static uint32_t fwup_end_cmd(uint32_t argc, const char **argv)
+{
+    (void)argv;
+    if (argc != 0)
+    {
+        LOG("Usage: fwup end\r\n");
+        return 1;
+    }
+    if (state != FWUP_RECEIVING || written != image_size)
+    {
+        LOG("Image incomplete, %lu of %lu bytes written\r\n", written, image_size);
+        return 1;
+    }
+
+    /* Lines of the data cache may hold the area from before it was programmed. */
+    __HAL_FLASH_DATA_CACHE_DISABLE();
+    __HAL_FLASH_DATA_CACHE_RESET();
+    __HAL_FLASH_DATA_CACHE_ENABLE();
+    __HAL_RCC_CRC_CLK_ENABLE();
+    verify_next = 0;
+    crc_computed = UINT32_MAX;
+    fwup_advance(FWUP_RECEIVING, FWUP_VERIFYING);
+    bgjob_submit(&verify_job);
+    cmd_out_str("state", state_names[FWUP_VERIFYING]);
+    return 0;
+}
+
+static uint32_t fwup_abort_cmd(uint32_t argc, const char **argv)
+{
+    (void)argv;
+    if (argc != 0)
+    {
+        LOG("Usage: fwup abort\r\n");
+        return 1;
+    }
+    state = FWUP_IDLE;
+    osTimerStop(poll_timer);
+    cmd_out_str("state", state_names[FWUP_IDLE]);
+    return 0;
+}
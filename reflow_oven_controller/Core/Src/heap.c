@@ -0,0 +1,432 @@
+/**
+ * @file heap.c
+ * @author Timothy Nguyen
+ * @brief FreeRTOS heap of fixed-size block pools, constant time allocation and release.
+ * @version 0.1
+ * @date 2021-09-06
+ */
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "heap.h"
+#include "cmd.h"
+#include "log.h"
+#include "FreeRTOS.h"
+#include "task.h"
+
+////////////////////////////////////////////////////////////////////////////////
+// Common macros
+////////////////////////////////////////////////////////////////////////////////
+
+#define HEAP_CLASS_BLOCKS(size, count) +(count)
+#define HEAP_CLASS_SIZE(size, count) (size),
+#define HEAP_CLASS_COUNT(size, count) (count),
+
+#define HEAP_NUM_BLOCKS (0U HEAP_CLASSES(HEAP_CLASS_BLOCKS)) // Blocks of every class.
+#define HEAP_MIN_SHIFT ((uint32_t)__builtin_ctz(HEAP_MIN_BLOCK)) // log2(HEAP_MIN_BLOCK).
+
+_Static_assert(HEAP_BYTES <= configTOTAL_HEAP_SIZE, "Pools fit the heap budget of FreeRTOSConfig.h");
+_Static_assert((HEAP_MIN_BLOCK & (HEAP_MIN_BLOCK - 1U)) == 0U && HEAP_MIN_BLOCK % portBYTE_ALIGNMENT == 0U,
+               "Blocks are aligned powers of two");
+_Static_assert(HEAP_NUM_CLASSES <= 32U, "Classes with free blocks fit a 32-bit mask");
+
+////////////////////////////////////////////////////////////////////////////////
+// Type definitions
+////////////////////////////////////////////////////////////////////////////////
+
+/* Free block, linked through its first word */
+typedef struct heap_block
+{
+    struct heap_block *next; // Next free block of class, NULL at the end.
+} heap_block_t;
+
+/* Pool of a size class */
+typedef struct
+{
+    uint8_t *base;      // First block.
+    uint8_t *end;       // Past last block.
+    heap_block_t *free; // Free list.
+    uint32_t first;     // Index of first block within requested[].
+    uint32_t used;      // Blocks allocated.
+    uint32_t peak;      // Most blocks allocated at once.
+    uint32_t spills;    // Allocations for a smaller class.
+    uint32_t failed;    // Requests for this class that found no block.
+    uint32_t requested; // Bytes requested by allocated blocks.
+} heap_class_t;
+
+////////////////////////////////////////////////////////////////////////////////
+// Private (static) function declarations
+////////////////////////////////////////////////////////////////////////////////
+
+static void heap_init(void);                            // Build free lists, on first allocation.
+static inline uint32_t heap_class_at(const uint8_t *p); // Class of pool holding address.
+static inline uint32_t heap_class_of(size_t size);      // Smallest class holding size bytes.
+static uint32_t heap_status_cmd(uint32_t argc, const char **argv); // Print class statistics.
+
+////////////////////////////////////////////////////////////////////////////////
+// Private (static) variables
+////////////////////////////////////////////////////////////////////////////////
+
+/* Pools of every class, smallest blocks first */
+static uint64_t arena[HEAP_BYTES / sizeof(uint64_t)];
+
+static const uint32_t class_size[HEAP_NUM_CLASSES] = {HEAP_CLASSES(HEAP_CLASS_SIZE)};
+static const uint32_t class_count[HEAP_NUM_CLASSES] = {HEAP_CLASSES(HEAP_CLASS_COUNT)};
+
+/* Heap state, changed with the scheduler suspended */
+static heap_class_t classes[HEAP_NUM_CLASSES];
+static uint16_t requested[HEAP_NUM_BLOCKS]; // Bytes requested per allocated block.
+static uint32_t nonempty;                   // Bit per class with a free block.
+static size_t free_bytes;                   // Bytes in free blocks.
+static size_t min_free_bytes;               // Least free_bytes since reset.
+static size_t num_allocs;                   // Successful allocations.
+static size_t num_frees;                    // Blocks freed.
+static bool ready;                          // Free lists built.
+
+static cmd_cmd_info heap_cmds[] = {
+    {.cmd_name = "status",
+     .cb = heap_status_cmd,
+     .help = "Display blocks used, peak, spills and failures per size class, bytes requested against held.\r\n"
+             "Usage: heap status"},
+};
+
+CMD_CLIENT_DEFINE(heap,
+                  .num_cmds = ARRAY_SIZE(heap_cmds),
+                  .cmds = heap_cmds);
+
+////////////////////////////////////////////////////////////////////////////////
+// Public (global) functions
+////////////////////////////////////////////////////////////////////////////////
+
+void *pvPortMalloc(size_t xWantedSize)
+{
+    if (xWantedSize == 0)
+    {
+        return NULL;
+    }
+
+    heap_block_t *block = NULL;
+    vTaskSuspendAll();
+    if (!ready)
+    {
+        heap_init();
+    }
+
+    uint32_t want = heap_class_of(xWantedSize);
+    uint32_t avail = want < HEAP_NUM_CLASSES ? nonempty & ~((1UL << want) - 1U) : 0U;
+    if (avail == 0U)
+    {
+        classes[want < HEAP_NUM_CLASSES ? want : HEAP_NUM_CLASSES - 1U].failed++;
+    }
+    else
+    {
+        uint32_t cls = (uint32_t)__builtin_ctz(avail); // Smallest class with a free block.
+        heap_class_t *c = &classes[cls];
+        block = c->free;
+        c->free = block->next;
+        if (c->free == NULL)
+        {
+            nonempty &= ~(1UL << cls);
+        }
+
+        c->used++;
+        c->peak = c->used > c->peak ? c->used : c->peak;
+        c->spills += cls != want ? 1U : 0U;
+        c->requested += xWantedSize;
+        requested[c->first + (((uint8_t *)block - c->base) >> (cls + HEAP_MIN_SHIFT))] = (uint16_t)xWantedSize;
+        free_bytes -= class_size[cls];
+        min_free_bytes = free_bytes < min_free_bytes ? free_bytes : min_free_bytes;
+        num_allocs++;
+    }
+    traceMALLOC(block, xWantedSize);
+    (void)xTaskResumeAll();
+
+#if (configUSE_MALLOC_FAILED_HOOK == 1)
+    if (block == NULL)
+    {
+        extern void vApplicationMallocFailedHook(void);
+        vApplicationMallocFailedHook();
+    }
+#endif
+    return block;
+}
+
+void vPortFree(void *pv)
+{
+    if (pv == NULL)
+    {
+        return;
+    }
+
+    uint8_t *p = pv;
+    vTaskSuspendAll();
+
+    uint32_t cls = heap_class_at(p);
+    heap_class_t *c = &classes[cls];
+    configASSERT(p >= c->base && p < c->end && ((p - c->base) & (class_size[cls] - 1U)) == 0);
+
+    uint32_t index = c->first + ((p - c->base) >> (cls + HEAP_MIN_SHIFT));
+    heap_block_t *block = pv;
+    block->next = c->free;
+    c->free = block;
+    nonempty |= 1UL << cls;
+    c->used--;
+    c->requested -= requested[index];
+    requested[index] = 0;
+    free_bytes += class_size[cls];
+    num_frees++;
+    traceFREE(pv, class_size[cls]);
+    (void)xTaskResumeAll();
+}
+
+size_t xPortGetFreeHeapSize(void)
+{
+    return ready ? free_bytes : HEAP_BYTES;
+}
+
+size_t xPortGetMinimumEverFreeHeapSize(void)
+{
+    return ready ? min_free_bytes : HEAP_BYTES;
+}
+
+void vPortInitialiseBlocks(void)
+{
+    /* Free lists are built on the first allocation. */
+}
+
+void vPortGetHeapStats(HeapStats_t *pxHeapStats)
+{
+    vTaskSuspendAll();
+    size_t num_free = 0;
+    for (uint32_t cls = 0; cls < HEAP_NUM_CLASSES; cls++)
+    {
+        num_free += ready ? class_count[cls] - classes[cls].used : class_count[cls];
+    }
+    uint32_t mask = ready ? nonempty : (1UL << HEAP_NUM_CLASSES) - 1U;
+    pxHeapStats->xAvailableHeapSpaceInBytes = xPortGetFreeHeapSize();
+    pxHeapStats->xSizeOfLargestFreeBlockInBytes = mask != 0U ? class_size[31U - (uint32_t)__builtin_clz(mask)] : 0U;
+    pxHeapStats->xSizeOfSmallestFreeBlockInBytes = mask != 0U ? class_size[__builtin_ctz(mask)] : 0U;
+    pxHeapStats->xNumberOfFreeBlocks = num_free;
+    pxHeapStats->xMinimumEverFreeBytesRemaining = xPortGetMinimumEverFreeHeapSize();
+    pxHeapStats->xNumberOfSuccessfulAllocations = num_allocs;
+    pxHeapStats->xNumberOfSuccessfulFrees = num_frees;
+    (void)xTaskResumeAll();
+}
+
+mod_err_t heap_class_stats(uint32_t cls, heap_class_stats_t *const stats)
+{
+    if (cls >= HEAP_NUM_CLASSES)
+    {
+        return MOD_ERR_ARG;
+    }
+
+    vTaskSuspendAll();
+    heap_class_t const *c = &classes[cls];
+    *stats = (heap_class_stats_t){.size = class_size[cls],
+                                  .count = class_count[cls],
+                                  .used = c->used,
+                                  .peak = c->peak,
+                                  .spills = c->spills,
+                                  .failed = c->failed,
+                                  .requested = c->requested};
+    (void)xTaskResumeAll();
+    return MOD_OK;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// C library allocator
+////////////////////////////////////////////////////////////////////////////////
+
+/* The malloc family, and the reentrant variants newlib calls internally, eg. for the bignums
+ * of strtof() or stdio buffers, are served from the same pools, so there is one heap and
+ * _sbrk() is never called (see sysmem.c). Unlike newlib's, these are thread-safe. */
+
+struct _reent;
+
+void *malloc(size_t size)
+{
+    return pvPortMalloc(size);
+}
+
+void free(void *p)
+{
+    vPortFree(p);
+}
+
+void *calloc(size_t num, size_t size)
+{
+    if (size != 0U && num > SIZE_MAX / size)
+    {
+        return NULL;
+    }
+    void *p = pvPortMalloc(num * size);
+    if (p != NULL)
+    {
+        memset(p, 0, num * size);
+    }
+    return p;
+}
+
+void *realloc(void *p, size_t size)
+{
+    if (p == NULL)
+    {
+        return pvPortMalloc(size);
+    }
+    if (size == 0U)
+    {
+        vPortFree(p);
+        return NULL;
+    }
+
+    uint32_t cls = heap_class_at(p);
+    size_t held = class_size[cls];
+    if (size <= held)
+    {
+        /* Block already holds it, only the bytes requested change. */
+        vTaskSuspendAll();
+        heap_class_t *c = &classes[cls];
+        uint32_t index = c->first + (((uint8_t *)p - c->base) >> (cls + HEAP_MIN_SHIFT));
+        c->requested += size - requested[index];
+        requested[index] = (uint16_t)size;
+        (void)xTaskResumeAll();
+        return p;
+    }
+    void *q = pvPortMalloc(size);
+    if (q != NULL)
+    {
+        memcpy(q, p, held);
+        vPortFree(p);
+    }
+    return q;
+}
+
+void *_malloc_r(struct _reent *r, size_t size)
+{
+    (void)r;
+    return malloc(size);
+}
+
+void _free_r(struct _reent *r, void *p)
+{
+    (void)r;
+    free(p);
+}
+
+void *_calloc_r(struct _reent *r, size_t num, size_t size)
+{
+    (void)r;
+    return calloc(num, size);
+}
+
+void *_realloc_r(struct _reent *r, void *p, size_t size)
+{
+    (void)r;
+    return realloc(p, size);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Private (static) functions
+////////////////////////////////////////////////////////////////////////////////
+
+/**
+ * @brief Get class of pool holding address, pools being laid out by class.
+ *
+ * @return Class index, at most HEAP_NUM_CLASSES - 1 comparisons.
+ */
+static inline uint32_t heap_class_at(const uint8_t *p)
+{
+    uint32_t cls = 0;
+    while (cls < HEAP_NUM_CLASSES - 1U && p >= classes[cls].end)
+    {
+        cls++;
+    }
+    return cls;
+}
+
+/**
+ * @brief Lay out pools in the arena and link their blocks into free lists (scheduler suspended).
+ */
+static void heap_init(void)
+{
+    uint8_t *p = (uint8_t *)arena;
+    uint32_t first = 0;
+    for (uint32_t cls = 0; cls < HEAP_NUM_CLASSES; cls++)
+    {
+        configASSERT(class_size[cls] == HEAP_MIN_BLOCK << cls); // Classes double in size.
+        heap_class_t *c = &classes[cls];
+        c->base = p;
+        c->first = first;
+        c->free = NULL;
+        for (uint32_t i = class_count[cls]; i-- > 0U;)
+        {
+            heap_block_t *block = (heap_block_t *)(p + i * class_size[cls]);
+            block->next = c->free;
+            c->free = block;
+        }
+        p += class_size[cls] * class_count[cls];
+        c->end = p;
+        first += class_count[cls];
+        nonempty |= class_count[cls] > 0U ? 1UL << cls : 0U;
+    }
+    free_bytes = HEAP_BYTES;
+    min_free_bytes = HEAP_BYTES;
+    ready = true;
+}
+
+/**
+ * @brief Get smallest size class whose blocks hold size bytes.
+ *
+ * @return Class index, HEAP_NUM_CLASSES or more if size exceeds the largest block.
+ */
+static inline uint32_t heap_class_of(size_t size)
+{
+    if (size <= HEAP_MIN_BLOCK)
+    {
+        return 0;
+    }
+    if (size > (size_t)HEAP_MIN_BLOCK << (HEAP_NUM_CLASSES - 1U))
+    {
+        return HEAP_NUM_CLASSES;
+    }
+    return 32U - (uint32_t)__builtin_clz((uint32_t)size - 1U) - HEAP_MIN_SHIFT;
+}
+
+/**
+ * @brief Display statistics of every size class and heap totals.
+ *
+ * @param argc Number of arguments.
+ * @param argv Argument values.
+ *
+ * @return 0 if successful, 1 otherwise.
+ */
+static uint32_t heap_status_cmd(uint32_t argc, const char **argv)
+{
+    (void)argv;
+    if (argc != 0)
+    {
+        LOG("Usage: heap status\r\n");
+        return 1;
+    }
+
+    LOG("%6s %6s %6s %6s %6s %6s %9s %9s\r\n", "Size", "Blocks", "Used", "Peak", "Spills", "Failed", "Requested", "Held");
+    for (uint32_t cls = 0; cls < HEAP_NUM_CLASSES; cls++)
+    {
+        heap_class_stats_t s;
+        heap_class_stats(cls, &s);
+        LOG("%6lu %6lu %6lu %6lu %6lu %6lu %9lu %9lu\r\n", s.size, s.count, s.used, s.peak, s.spills, s.failed,
+            s.requested, s.used * s.size);
+    }
+
+    HeapStats_t stats;
+    vPortGetHeapStats(&stats);
+    cmd_out_u32("heap size", HEAP_BYTES);
+    cmd_out_u32("heap free", stats.xAvailableHeapSpaceInBytes);
+    cmd_out_u32("heap min free", stats.xMinimumEverFreeBytesRemaining);
+    cmd_out_u32("largest free block", stats.xSizeOfLargestFreeBlockInBytes);
+    cmd_out_u32("allocations", stats.xNumberOfSuccessfulAllocations);
+    cmd_out_u32("frees", stats.xNumberOfSuccessfulFrees);
+    return 0;
+}
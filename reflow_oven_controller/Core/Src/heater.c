@@ -0,0 +1,985 @@
+/**
+ * @file heater.c
+ * @author Timothy Nguyen
+ * @brief Heater output drivers: timer PWM, DMA-scheduled PWM, burst-fire or phase-angle.
+ * @version 0.1
+ * @date 2021-08-23
+ */
+
+#include <math.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "heater.h"
+#include "cmd.h"
+#include "log.h"
+#include "trace.h"
+#include "irq.h"
+#include "sections.h"
+#include "stm32l4xx_ll_dma.h"
+
+////////////////////////////////////////////////////////////////////////////////
+// Common macros
+////////////////////////////////////////////////////////////////////////////////
+
+#define PHASE_TIMER_HZ 1000000U                                       // TIM2 counter clock, 1 us resolution.
+#define PHASE_HALF_CYCLE_US (1000000U / (2U * HEATER_MAINS_HZ))       // Mains half cycle (us).
+#define PHASE_END_US (PHASE_HALF_CYCLE_US - HEATER_PHASE_GUARD_US)    // Counter period, gates released.
+#define PHASE_OFF (PHASE_END_US + 1U)                                 // Compare value never reached.
+#define PHASE_LUT_SIZE 65U                                            // Power-to-angle table entries.
+#define PWM_BUDGET_ITERATIONS 12U                                     // Bisection steps of budget scale, 1/4096 resolution.
+
+_Static_assert(PWMLIN_OUT_MAX == HEATER_OUT_MAX, "Linearization table scale differs from heater output");
+
+////////////////////////////////////////////////////////////////////////////////
+// Type definitions
+////////////////////////////////////////////////////////////////////////////////
+
+/* Zero-crossing detector state */
+typedef struct
+{
+    Heater_t *burst[HEATER_MAX_BURST]; // Burst-fire heaters, switched on every zero crossing.
+    uint8_t num_burst;                 // Number of burst-fire heaters.
+    uint8_t num_enabled;               // Number of enabled burst-fire heaters, detector runs while nonzero.
+    uint32_t last_cycles;              // DWT cycle count at last accepted zero crossing.
+    volatile uint32_t last_ms;         // HAL tick at last accepted zero crossing.
+    volatile uint32_t half_cycle_us;   // Last measured half cycle.
+    volatile bool lost;                // Zero crossings timed out, burst heaters are off.
+
+    /* Statistics */
+    volatile uint32_t count;    // Accepted zero crossings since detector started.
+    volatile uint32_t glitches; // Rejected edges.
+    uint32_t faults;            // Zero-crossing timeouts.
+} Heater_zc_t;
+
+/* Phase-angle timer (TIM2) state */
+typedef struct
+{
+    Heater_t *heaters[HEATER_MAX_PHASE]; // Phase-angle heaters.
+    uint8_t num_heaters;                 // Number of phase-angle heaters.
+    uint8_t num_enabled;                 // Number of enabled phase-angle heaters, prescaler set on first.
+} Heater_phase_t;
+
+/* Rated PWM heater schedule */
+typedef struct
+{
+    Heater_t *heaters[HEATER_MAX_PWM]; // Rated PWM heaters, staggered and budgeted.
+    uint8_t num_heaters;               // Number of rated PWM heaters.
+    volatile float budget;             // Most rated power switched on at once (W), 0 for none.
+    float scale;                       // On time scale last applied, 1 within budget.
+} Heater_pwm_t;
+
+////////////////////////////////////////////////////////////////////////////////
+// Private (static) function declarations
+////////////////////////////////////////////////////////////////////////////////
+
+/* Command callback functions */
+static uint32_t cmd_heater_status(uint32_t argc, const char **argv); // Display heater outputs and mains timing.
+static uint32_t cmd_heater_budget(uint32_t argc, const char **argv); // Show or set PWM power budget.
+
+static void zc_check(void); // Switch burst heaters off if zero crossings stopped.
+
+static void sched_load(Heater_t *const heater); // Stream duty schedule ramping to output.
+
+static void pwm_budget_apply(void);                                  // Scale rated heaters into budget, write compares.
+static float pwm_peak(float scale);                                  // Peak rated power of staggered schedule.
+static void pwm_compare(Heater_t *const heater, uint16_t on);        // Write compare for on ticks, by alignment.
+
+static void phase_timer_init(void);                      // Configure TIM2 for triggered one-pulse firing.
+static void phase_output_mode(uint32_t channel, bool on); // Set channel to PWM mode 2 or forced inactive.
+static void pwm_output_mode(Heater_t const *const heater, bool on); // Set channel to PWM mode 1/2 or forced inactive.
+static inline volatile uint32_t *phase_ccr(uint32_t channel); // Channel compare register.
+static uint32_t timer_clock_hz(TIM_TypeDef *tim);        // Timer kernel clock.
+static uint32_t phase_delay_us(uint16_t out);            // Firing delay for output.
+static bool phase_monotonic(void);                       // Check delay falls as output rises.
+
+////////////////////////////////////////////////////////////////////////////////
+// Private (static) variables
+////////////////////////////////////////////////////////////////////////////////
+
+/* Zero-crossing detector state */
+static Heater_zc_t zc;
+
+/* Phase-angle timer state */
+static Heater_phase_t phase;
+
+/* Rated PWM heater schedule */
+static Heater_pwm_t pwm = {.scale = 1.0f};
+
+/* Duty schedules streamed to compare registers */
+static uint32_t SRAM1_DMA sched_bufs[HEATER_MAX_SCHED][HEATER_SCHED_LEN];
+static uint8_t num_sched;
+
+/* Firing angle, fraction of half cycle (Q16), for power i / (PHASE_LUT_SIZE - 1), inverse of
+   P(a) = 1 - a + sin(2 pi a) / (2 pi). Falls from a full half cycle at no power to 0 at full power. */
+static const uint16_t phase_lut[PHASE_LUT_SIZE] = {
+    65535, 56686, 54304, 52597, 51212, 50021, 48963, 48000,
+    47112, 46281, 45498, 44754, 44043, 43360, 42701, 42063,
+    41442, 40838, 40248, 39670, 39103, 38545, 37996, 37453,
+    36918, 36388, 35862, 35340, 34822, 34306, 33792, 33280,
+    32768, 32255, 31743, 31229, 30713, 30195, 29673, 29147,
+    28617, 28082, 27539, 26990, 26432, 25865, 25287, 24697,
+    24093, 23472, 22834, 22175, 21492, 20781, 20037, 19254,
+    18423, 17535, 16572, 15514, 14323, 12938, 11231, 8849,
+    0};
+
+/* Drive names, indexed by Heater_drive_t */
+static const char *drive_names[HEATER_NUM_DRIVES] = {"pwm", "sched", "burst", "phase"};
+
+/* Heater command information. */
+static cmd_cmd_info heater_cmds[] = {
+    {.cmd_name = "status",
+     .cb = cmd_heater_status,
+     .help = "Display burst-fire and phase-angle heater outputs, conducted half cycles and mains zero-crossing timing."},
+    {.cmd_name = "budget",
+     .cb = cmd_heater_budget,
+     .help = "Show or set total power budget of rated PWM heaters. Usage: heater budget [watts], 0 for none."}};
+
+/* Heater module client info */
+CMD_CLIENT_DEFINE(heater,
+                  .num_cmds = sizeof(heater_cmds) / sizeof(heater_cmds[0]),
+                  .cmds = heater_cmds);
+
+/* Unique tag for heater module. */
+LOG_TAG_DEFINE("HEATER");
+
+////////////////////////////////////////////////////////////////////////////////
+// Public (global) functions
+////////////////////////////////////////////////////////////////////////////////
+
+mod_err_t heater_init(void)
+{
+    /* Detector interrupt is enabled while a burst heater is. */
+    GPIO_InitTypeDef gpio_init = {.Pin = HEATER_ZC_PIN, .Mode = GPIO_MODE_IT_FALLING, .Pull = GPIO_PULLUP};
+    HAL_GPIO_Init(HEATER_ZC_PORT, &gpio_init);
+    HAL_NVIC_SetPriority(EXTI0_IRQn, IRQ_PRIO_ZC, 0);
+
+    /* Zero-crossing timestamps */
+    CoreDebug->DEMCR |= CoreDebug_DEMCR_TRCENA_Msk;
+    DWT->CTRL |= DWT_CTRL_CYCCNTENA_Msk;
+
+    /* An inverted table would fire near fully at low output. */
+    ASSERT(phase_monotonic());
+
+    LOGI(TAG, "Initialized heater module");
+    return MOD_OK;
+}
+
+mod_err_t Heater_Init(Heater_t *const heater, Heater_cfg_t const *const heater_cfg)
+{
+    heater->cfg = *heater_cfg;
+    heater->out = 0;
+    heater->duty = 0;
+    heater->lin = NULL;
+    heater->enabled = false;
+    heater->tripped = false;
+    heater->acc = 0;
+    heater->fired = 0;
+    heater->sched_prev = 0;
+    heater->on = 0;
+    heater->trail = false;
+
+    switch (heater->cfg.drive)
+    {
+    case HEATER_PWM:
+        if (heater->cfg.watts > 0.0f)
+        {
+            if (pwm.num_heaters >= HEATER_MAX_PWM)
+            {
+                return MOD_ERR_RESOURCE;
+            }
+
+            /* Every other rated heater of the timer switches on at the end of the period. */
+            for (uint8_t i = 0; i < pwm.num_heaters; i++)
+            {
+                if (pwm.heaters[i]->cfg.pwm_timer_handle->Instance == heater->cfg.pwm_timer_handle->Instance)
+                {
+                    heater->trail = !heater->trail;
+                }
+            }
+            pwm.heaters[pwm.num_heaters++] = heater;
+        }
+        pwm_compare(heater, 0);
+        __HAL_TIM_ENABLE_OCxPRELOAD(heater->cfg.pwm_timer_handle, heater->cfg.pwm_channel);
+        pwm_output_mode(heater, true);
+        return MOD_OK;
+
+    case HEATER_PWM_SCHED:
+    {
+        if (num_sched >= HEATER_MAX_SCHED)
+        {
+            return MOD_ERR_RESOURCE;
+        }
+        heater->sched_id = num_sched++;
+
+        TIM_HandleTypeDef *const htim = heater->cfg.pwm_timer_handle;
+        __HAL_TIM_SET_COMPARE(htim, heater->cfg.pwm_channel, 0);
+        __HAL_TIM_ENABLE_OCxPRELOAD(htim, heater->cfg.pwm_channel);
+
+        /* HEATER_SCHED_LEN periods per configured period, timer is stopped so load at once. */
+        uint32_t psc = (htim->Instance->PSC + 1U) / HEATER_SCHED_LEN;
+        htim->Instance->PSC = psc - 1U;
+        htim->Init.Prescaler = psc - 1U;
+        SET_BIT(htim->Instance->CR1, TIM_CR1_URS);
+        htim->Instance->EGR = TIM_EGR_UG;
+        CLEAR_BIT(htim->Instance->CR1, TIM_CR1_URS);
+
+        /* One compare value per update request, channel is reloaded by every Heater_Set(). */
+        DMA_TypeDef *const dma = heater->cfg.sched_dma;
+        uint32_t dma_channel = heater->cfg.sched_dma_channel;
+        LL_DMA_DisableChannel(dma, dma_channel);
+        LL_DMA_SetPeriphRequest(dma, dma_channel, heater->cfg.sched_dma_request);
+        LL_DMA_ConfigTransfer(dma, dma_channel,
+                              LL_DMA_DIRECTION_MEMORY_TO_PERIPH | LL_DMA_PRIORITY_LOW | LL_DMA_MODE_NORMAL |
+                                  LL_DMA_PERIPH_NOINCREMENT | LL_DMA_MEMORY_INCREMENT |
+                                  LL_DMA_PDATAALIGN_WORD | LL_DMA_MDATAALIGN_WORD);
+        LL_DMA_SetPeriphAddress(dma, dma_channel, (uint32_t)(&htim->Instance->CCR1 + heater->cfg.pwm_channel / 4U));
+        return MOD_OK;
+    }
+
+    case HEATER_BURST:
+    {
+        if (zc.num_burst >= HEATER_MAX_BURST)
+        {
+            return MOD_ERR_RESOURCE;
+        }
+        HAL_GPIO_WritePin(heater->cfg.ssr_port, heater->cfg.ssr_pin, GPIO_PIN_RESET);
+        GPIO_InitTypeDef gpio_init = {.Pin = heater->cfg.ssr_pin,
+                                      .Mode = GPIO_MODE_OUTPUT_PP,
+                                      .Pull = GPIO_NOPULL,
+                                      .Speed = GPIO_SPEED_FREQ_LOW};
+        HAL_GPIO_Init(heater->cfg.ssr_port, &gpio_init);
+
+        HAL_NVIC_DisableIRQ(EXTI0_IRQn);
+        zc.burst[zc.num_burst++] = heater;
+        if (zc.num_enabled > 0)
+        {
+            HAL_NVIC_EnableIRQ(EXTI0_IRQn);
+        }
+        return MOD_OK;
+    }
+
+    case HEATER_PHASE:
+    {
+        uint32_t channel = heater->cfg.phase_channel;
+        if (channel != TIM_CHANNEL_2 && channel != TIM_CHANNEL_3 && channel != TIM_CHANNEL_4)
+        {
+            return MOD_ERR_ARG;
+        }
+        if (phase.num_heaters >= HEATER_MAX_PHASE)
+        {
+            return MOD_ERR_RESOURCE;
+        }
+        if (phase.num_heaters == 0)
+        {
+            phase_timer_init();
+        }
+
+        /* Gate is inactive until enabled, then fires at compare value. */
+        *phase_ccr(channel) = PHASE_OFF;
+        phase_output_mode(channel, false);
+        SET_BIT(TIM2->CCER, TIM_CCER_CC1E << channel);
+
+        GPIO_InitTypeDef gpio_init = {.Pin = heater->cfg.ssr_pin,
+                                      .Mode = GPIO_MODE_AF_PP,
+                                      .Pull = GPIO_PULLDOWN,
+                                      .Speed = GPIO_SPEED_FREQ_LOW,
+                                      .Alternate = GPIO_AF1_TIM2};
+        HAL_GPIO_Init(heater->cfg.ssr_port, &gpio_init);
+        phase.heaters[phase.num_heaters++] = heater;
+        return MOD_OK;
+    }
+
+    default:
+        return MOD_ERR_ARG;
+    }
+}
+
+void Heater_Enable(Heater_t *const heater)
+{
+    if (heater->enabled || heater->tripped)
+    {
+        return;
+    }
+
+    if (heater->cfg.drive == HEATER_PWM)
+    {
+        heater->enabled = true;
+        if (heater->cfg.watts > 0.0f)
+        {
+            pwm_budget_apply();
+        }
+        HAL_TIM_PWM_Start(heater->cfg.pwm_timer_handle, heater->cfg.pwm_channel);
+        return;
+    }
+
+    if (heater->cfg.drive == HEATER_PWM_SCHED)
+    {
+        heater->enabled = true;
+        heater->sched_prev = (uint16_t)__HAL_TIM_GET_COMPARE(heater->cfg.pwm_timer_handle, heater->cfg.pwm_channel);
+        __HAL_TIM_ENABLE_DMA(heater->cfg.pwm_timer_handle, TIM_DMA_UPDATE);
+        HAL_TIM_PWM_Start(heater->cfg.pwm_timer_handle, heater->cfg.pwm_channel);
+        sched_load(heater);
+        return;
+    }
+
+    if (heater->cfg.drive == HEATER_PHASE)
+    {
+        if (phase.num_enabled++ == 0)
+        {
+            /* Counts microseconds at the system clock of the run, which holds a clock boost throughout. */
+            TIM2->PSC = timer_clock_hz(TIM2) / PHASE_TIMER_HZ - 1U;
+            TIM2->EGR = TIM_EGR_UG;
+        }
+        *phase_ccr(heater->cfg.phase_channel) = phase_delay_us(heater->out);
+        phase_output_mode(heater->cfg.phase_channel, true);
+        heater->enabled = true;
+        if (heater->tripped)
+        {
+            phase_output_mode(heater->cfg.phase_channel, false); // Tripped while gate was switched on.
+        }
+        return;
+    }
+
+    HAL_NVIC_DisableIRQ(EXTI0_IRQn);
+    heater->acc = 0;
+    heater->enabled = true;
+    if (zc.num_enabled++ == 0)
+    {
+        /* First edge after start is accepted without period check, timeout runs from now. */
+        zc.count = 0;
+        zc.lost = false;
+        zc.last_ms = HAL_GetTick();
+        __HAL_GPIO_EXTI_CLEAR_IT(HEATER_ZC_PIN);
+        HAL_NVIC_ClearPendingIRQ(EXTI0_IRQn);
+    }
+    HAL_NVIC_EnableIRQ(EXTI0_IRQn);
+}
+
+void Heater_Disable(Heater_t *const heater)
+{
+    if (heater->cfg.drive == HEATER_PWM)
+    {
+        pwm_compare(heater, 0);
+        HAL_TIM_PWM_Stop(heater->cfg.pwm_timer_handle, heater->cfg.pwm_channel);
+        heater->enabled = false;
+        if (heater->cfg.watts > 0.0f)
+        {
+            pwm_budget_apply(); // Others may take the power given up.
+        }
+        return;
+    }
+
+    if (heater->cfg.drive == HEATER_PWM_SCHED)
+    {
+        LL_DMA_DisableChannel(heater->cfg.sched_dma, heater->cfg.sched_dma_channel);
+        __HAL_TIM_DISABLE_DMA(heater->cfg.pwm_timer_handle, TIM_DMA_UPDATE);
+        __HAL_TIM_SET_COMPARE(heater->cfg.pwm_timer_handle, heater->cfg.pwm_channel, 0);
+        HAL_TIM_PWM_Stop(heater->cfg.pwm_timer_handle, heater->cfg.pwm_channel);
+        heater->sched_prev = 0;
+        heater->enabled = false;
+        return;
+    }
+
+    if (heater->cfg.drive == HEATER_PHASE)
+    {
+        /* Forced inactive at once, half cycle in progress is not completed. */
+        phase_output_mode(heater->cfg.phase_channel, false);
+        *phase_ccr(heater->cfg.phase_channel) = PHASE_OFF;
+        if (heater->enabled)
+        {
+            heater->enabled = false;
+            phase.num_enabled--;
+        }
+        return;
+    }
+
+    HAL_NVIC_DisableIRQ(EXTI0_IRQn);
+    HAL_GPIO_WritePin(heater->cfg.ssr_port, heater->cfg.ssr_pin, GPIO_PIN_RESET);
+    if (heater->enabled)
+    {
+        heater->enabled = false;
+        zc.num_enabled--;
+    }
+    if (zc.num_enabled > 0)
+    {
+        HAL_NVIC_EnableIRQ(EXTI0_IRQn);
+    }
+}
+
+void Heater_Set(Heater_t *const heater, uint16_t out)
+{
+    heater->out = out > HEATER_OUT_MAX ? HEATER_OUT_MAX : out;
+    if (heater->cfg.drive == HEATER_PWM || heater->cfg.drive == HEATER_PWM_SCHED)
+    {
+        heater->duty = heater->lin != NULL ? Pwmlin_Apply(heater->lin, heater->out) : heater->out;
+    }
+
+    if (heater->cfg.drive == HEATER_PWM)
+    {
+        if (heater->cfg.watts > 0.0f)
+        {
+            pwm_budget_apply();
+        }
+        else
+        {
+            pwm_compare(heater, heater->duty);
+        }
+    }
+    else if (heater->cfg.drive == HEATER_PWM_SCHED)
+    {
+        if (heater->enabled)
+        {
+            sched_load(heater);
+        }
+        else
+        {
+            __HAL_TIM_SET_COMPARE(heater->cfg.pwm_timer_handle, heater->cfg.pwm_channel, heater->duty);
+        }
+    }
+    else if (heater->cfg.drive == HEATER_PHASE)
+    {
+        *phase_ccr(heater->cfg.phase_channel) = heater->enabled ? phase_delay_us(heater->out) : PHASE_OFF;
+    }
+    else if (heater->enabled)
+    {
+        zc_check();
+    }
+}
+
+void Heater_Linearize(Heater_t *const heater, Pwmlin_t const *const lin)
+{
+    heater->lin = lin;
+}
+
+mod_err_t Heater_Set_Period(Heater_t *const heater, float period)
+{
+    if (heater->cfg.drive != HEATER_PWM && heater->cfg.drive != HEATER_PWM_SCHED)
+    {
+        return MOD_ERR_ARG;
+    }
+
+    TIM_HandleTypeDef *const htim = heater->cfg.pwm_timer_handle;
+    uint32_t tim_hz = timer_clock_hz(htim->Instance);
+    float ticks = period * (float)tim_hz / (float)(htim->Instance->ARR + 1U);
+    if (heater->cfg.drive == HEATER_PWM_SCHED)
+    {
+        ticks /= (float)HEATER_SCHED_LEN;
+    }
+    if (!(ticks >= 1.0f && ticks <= 65536.0f))
+    {
+        return MOD_ERR_ARG;
+    }
+
+    /* Prescaler is preloaded, the current period completes first. */
+    uint32_t psc = (uint32_t)lroundf(ticks);
+    htim->Instance->PSC = psc - 1U;
+    htim->Init.Prescaler = psc - 1U;
+    return MOD_OK;
+}
+
+void Heater_Trip(Heater_t *const heater)
+{
+    heater->tripped = true;
+    switch (heater->cfg.drive)
+    {
+    case HEATER_PWM_SCHED:
+        LL_DMA_DisableChannel(heater->cfg.sched_dma, heater->cfg.sched_dma_channel);
+        // Fall through, channel is forced inactive like plain PWM.
+    case HEATER_PWM:
+        pwm_output_mode(heater, false);
+        break;
+
+    case HEATER_BURST:
+        /* Zero-crossing interrupt skips tripped heaters from now on. */
+        heater->cfg.ssr_port->BSRR = (uint32_t)heater->cfg.ssr_pin << 16U;
+        break;
+
+    case HEATER_PHASE:
+        phase_output_mode(heater->cfg.phase_channel, false);
+        break;
+
+    default:
+        break;
+    }
+}
+
+mod_err_t Heater_Clear_Trip(Heater_t *const heater)
+{
+    if (heater->enabled)
+    {
+        return MOD_ERR;
+    }
+    if (heater->cfg.drive == HEATER_PWM || heater->cfg.drive == HEATER_PWM_SCHED)
+    {
+        /* Channel is disabled, compare was cleared by Heater_Disable(). */
+        pwm_output_mode(heater, true);
+    }
+    heater->tripped = false;
+    return MOD_OK;
+}
+
+mod_err_t Heater_Set_Budget(float watts)
+{
+    if (!(watts >= 0.0f))
+    {
+        return MOD_ERR_ARG;
+    }
+    pwm.budget = watts;
+    return MOD_OK;
+}
+
+const char *Heater_Drive_Name(Heater_drive_t drive)
+{
+    return drive < HEATER_NUM_DRIVES ? drive_names[drive] : "invalid";
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Private (static) functions
+////////////////////////////////////////////////////////////////////////////////
+
+/**
+ * @brief Display burst-fire heater outputs, conducted half cycles and mains zero-crossing timing.
+ *
+ * @param argc Number of arguments.
+ * @param argv Argument values.
+ *
+ * @return 0 if successful, 1 otherwise.
+ */
+static uint32_t cmd_heater_status(uint32_t argc, const char **argv)
+{
+    uint32_t half_cycle_us = zc.half_cycle_us;
+    cmd_out_str("zero crossing", zc.num_enabled == 0 ? "off" : (zc.lost ? "lost" : "on"));
+    cmd_out_u32("zero crossings", zc.count);
+    cmd_out_u32("half cycle us", half_cycle_us);
+    cmd_out_u32("mains mhz", half_cycle_us != 0 ? 500000000U / half_cycle_us : 0);
+    cmd_out_u32("glitches", zc.glitches);
+    cmd_out_u32("faults", zc.faults);
+
+    LOG("%-6s %8s %7s %10s\r\n", "Burst", "Output", "Enabled", "Fired");
+    for (uint8_t i = 0; i < zc.num_burst; i++)
+    {
+        Heater_t const *const heater = zc.burst[i];
+        LOG("%-6u %8u %7s %10lu\r\n", i, heater->out, heater->enabled ? "yes" : "no", heater->fired);
+    }
+
+    LOG("%-6s %8s %7s %10s\r\n", "Phase", "Output", "Enabled", "Delay us");
+    for (uint8_t i = 0; i < phase.num_heaters; i++)
+    {
+        Heater_t const *const heater = phase.heaters[i];
+        LOG("%-6u %8u %7s %10lu\r\n", i, heater->out, heater->enabled ? "yes" : "no", phase_delay_us(heater->out));
+    }
+
+    LOG("%-6s %8s %7s %10s %6s %8s\r\n", "PWM", "Output", "Enabled", "On ticks", "Align", "Watts");
+    for (uint8_t i = 0; i < pwm.num_heaters; i++)
+    {
+        Heater_t const *const heater = pwm.heaters[i];
+        LOG("%-6u %8u %7s %10u %6s %8.0f\r\n", i, heater->out, heater->enabled ? "yes" : "no", heater->on,
+            heater->trail ? "end" : "start", heater->cfg.watts);
+    }
+    return 0;
+}
+
+/**
+ * @brief Show or set total power budget of rated PWM heaters.
+ *
+ * @param argc Number of arguments.
+ * @param argv Argument values.
+ *
+ * @return 0 if successful, 1 otherwise.
+ */
+static uint32_t cmd_heater_budget(uint32_t argc, const char **argv)
+{
+    if (argc > 0)
+    {
+        cmd_arg_val arg_vals[1];
+        if (cmd_parse_args(argc, argv, "f", arg_vals) != 1)
+        {
+            return 1;
+        }
+        if (Heater_Set_Budget(arg_vals[0].val.f) != MOD_OK)
+        {
+            LOG("Budget must not be negative\r\n");
+            return 1;
+        }
+    }
+
+    cmd_out_float("budget w", pwm.budget);
+    cmd_out_float("peak w", pwm_peak(pwm.scale));
+    cmd_out_float("scale", pwm.scale);
+    return 0;
+}
+
+/**
+ * @brief Switch burst heaters off if no zero crossing was seen for HEATER_ZC_TIMEOUT_MS.
+ *
+ * GPIOs are set again by the zero-crossing interrupt once zero crossings return.
+ */
+static void zc_check(void)
+{
+    if (zc.lost || HAL_GetTick() - zc.last_ms <= HEATER_ZC_TIMEOUT_MS)
+    {
+        return;
+    }
+
+    HAL_NVIC_DisableIRQ(EXTI0_IRQn);
+    if (HAL_GetTick() - zc.last_ms > HEATER_ZC_TIMEOUT_MS)
+    {
+        zc.lost = true;
+        for (uint8_t i = 0; i < zc.num_burst; i++)
+        {
+            HAL_GPIO_WritePin(zc.burst[i]->cfg.ssr_port, zc.burst[i]->cfg.ssr_pin, GPIO_PIN_RESET);
+        }
+    }
+    HAL_NVIC_EnableIRQ(EXTI0_IRQn);
+
+    if (zc.lost)
+    {
+        zc.faults++;
+        LOGE(TAG, "No mains zero crossing for %u ms, burst heaters off", HEATER_ZC_TIMEOUT_MS);
+    }
+}
+
+/**
+ * @brief Write duty schedule ramping linearly from the previous duty to the current one
+ * and restart its DMA transfer, starting at the next timer update.
+ *
+ * The channel is disabled while the schedule is written, so DMA never streams a partly
+ * written schedule. Compare values are preloaded, each applies for one whole period.
+ *
+ * @param heater Scheduled PWM heater instance.
+ */
+static void sched_load(Heater_t *const heater)
+{
+    DMA_TypeDef *const dma = heater->cfg.sched_dma;
+    uint32_t dma_channel = heater->cfg.sched_dma_channel;
+    uint32_t *const sched = sched_bufs[heater->sched_id];
+    LL_DMA_DisableChannel(dma, dma_channel);
+
+    int32_t from = heater->sched_prev;
+    int32_t step = (int32_t)heater->duty - from;
+    for (int32_t i = 0; i < (int32_t)HEATER_SCHED_LEN; i++)
+    {
+        sched[i] = (uint32_t)(from + step * (i + 1) / (int32_t)HEATER_SCHED_LEN);
+    }
+    heater->sched_prev = heater->duty;
+
+    LL_DMA_SetMemoryAddress(dma, dma_channel, (uint32_t)sched);
+    LL_DMA_SetDataLength(dma, dma_channel, HEATER_SCHED_LEN);
+    LL_DMA_EnableChannel(dma, dma_channel);
+}
+
+/**
+ * @brief Scale on time of rated PWM heaters into power budget and write their compares.
+ *
+ * Disabled heaters are written off, Heater_Enable() applies the budget again.
+ *
+ * Peak power rises with the scale, so the largest scale within budget is found by
+ * bisection. Compares are preloaded, all heaters take theirs at the end of the period.
+ */
+static void pwm_budget_apply(void)
+{
+    float budget = pwm.budget;
+    float scale = 1.0f;
+    if (budget > 0.0f && pwm_peak(1.0f) > budget)
+    {
+        float lo = 0.0f;
+        float hi = 1.0f;
+        for (uint32_t i = 0; i < PWM_BUDGET_ITERATIONS; i++)
+        {
+            float mid = 0.5f * (lo + hi);
+            if (pwm_peak(mid) > budget)
+            {
+                hi = mid;
+            }
+            else
+            {
+                lo = mid;
+            }
+        }
+        scale = lo;
+    }
+    pwm.scale = scale;
+
+    for (uint8_t i = 0; i < pwm.num_heaters; i++)
+    {
+        Heater_t *const heater = pwm.heaters[i];
+        pwm_compare(heater, heater->enabled ? (uint16_t)((float)heater->duty * scale) : 0U);
+    }
+}
+
+/**
+ * @brief Peak rated power of the staggered schedule, enabled heaters at scaled duty.
+ *
+ * On a timer, heaters aligned to the start of the period are on from 0 to their on time,
+ * those aligned to its end from the period less their on time. Power falls as start
+ * aligned heaters switch off and only rises where an end aligned one switches on, so the
+ * peak is at the start of the period or at one of those instants. Timers run
+ * unsynchronized, their peaks add.
+ *
+ * @param scale On time scale, 0 to 1.
+ *
+ * @return Peak power (W).
+ */
+static float pwm_peak(float scale)
+{
+    float total = 0.0f;
+    for (uint8_t i = 0; i < pwm.num_heaters; i++)
+    {
+        TIM_TypeDef *const tim = pwm.heaters[i]->cfg.pwm_timer_handle->Instance;
+        bool first = true;
+        for (uint8_t j = 0; j < i; j++)
+        {
+            first = first && pwm.heaters[j]->cfg.pwm_timer_handle->Instance != tim;
+        }
+        if (!first)
+        {
+            continue; // Timer already counted.
+        }
+
+        uint32_t period = tim->ARR + 1U;
+        float tim_peak = 0.0f;
+        for (uint8_t j = i; j < pwm.num_heaters; j++)
+        {
+            /* Instants: start of period (j == i) and switch-on of each end aligned heater. */
+            Heater_t const *const at = pwm.heaters[j];
+            uint32_t at_on = (uint32_t)((float)at->duty * scale);
+            if (j != i && (at->cfg.pwm_timer_handle->Instance != tim || !at->trail || at_on == 0))
+            {
+                continue;
+            }
+            uint32_t t = j == i ? 0U : period - at_on;
+
+            float power = 0.0f;
+            for (uint8_t k = i; k < pwm.num_heaters; k++)
+            {
+                Heater_t const *const heater = pwm.heaters[k];
+                uint32_t on = (uint32_t)((float)heater->duty * scale);
+                if (heater->cfg.pwm_timer_handle->Instance == tim && heater->enabled && !heater->tripped && on > 0 &&
+                    (heater->trail ? t + on >= period : t < on))
+                {
+                    power += heater->cfg.watts;
+                }
+            }
+            tim_peak = power > tim_peak ? power : tim_peak;
+        }
+        total += tim_peak;
+    }
+    return total;
+}
+
+/**
+ * @brief Write compare of a PWM heater for on ticks per period, by its alignment.
+ *
+ * @param heater PWM heater instance.
+ * @param on On ticks, 0 for off.
+ */
+static void pwm_compare(Heater_t *const heater, uint16_t on)
+{
+    TIM_HandleTypeDef *const htim = heater->cfg.pwm_timer_handle;
+    heater->on = on;
+    __HAL_TIM_SET_COMPARE(htim, heater->cfg.pwm_channel, heater->trail ? htim->Instance->ARR + 1U - on : on);
+}
+
+/**
+ * @brief Configure TIM2 to fire gates once per half cycle, triggered by the zero-crossing detector.
+ *
+ * Falling edges on TI1 start the counter (trigger mode), which counts PHASE_END_US and stops
+ * (one-pulse mode). Triggers while counting are ignored, so noise within the half cycle
+ * cannot fire the gates twice. The zero-crossing pin keeps its EXTI line for burst heaters.
+ */
+static void phase_timer_init(void)
+{
+    __HAL_RCC_TIM2_CLK_ENABLE();
+
+    GPIO_InitTypeDef gpio_init = {.Pin = HEATER_ZC_PIN,
+                                  .Mode = GPIO_MODE_AF_PP,
+                                  .Pull = GPIO_PULLUP,
+                                  .Speed = GPIO_SPEED_FREQ_LOW,
+                                  .Alternate = GPIO_AF1_TIM2};
+    HAL_GPIO_Init(HEATER_ZC_PORT, &gpio_init);
+
+    TIM2->CR1 = TIM_CR1_OPM | TIM_CR1_ARPE;
+    TIM2->ARR = PHASE_END_US;
+    TIM2->CCMR1 = TIM_CCMR1_CC1S_0 | (3U << TIM_CCMR1_IC1F_Pos); // TI1 input, 8 sample filter.
+    TIM2->CCER = TIM_CCER_CC1P;                                   // Falling edge.
+    TIM2->SMCR = (5U << TIM_SMCR_TS_Pos) | (6U << TIM_SMCR_SMS_Pos); // Trigger TI1FP1, trigger mode.
+    TIM2->EGR = TIM_EGR_UG;
+}
+
+/**
+ * @brief Set output compare mode of a TIM2 channel, with compare preload.
+ *
+ * @param channel TIM_CHANNEL_2 to TIM_CHANNEL_4.
+ * @param on PWM mode 2 (active from compare value to counter stop) if true, otherwise forced inactive.
+ */
+static void phase_output_mode(uint32_t channel, bool on)
+{
+    volatile uint32_t *ccmr = channel < TIM_CHANNEL_3 ? &TIM2->CCMR1 : &TIM2->CCMR2;
+    uint32_t shift = (channel & TIM_CHANNEL_2) ? 8U : 0U;
+    uint32_t mode = on ? (TIM_CCMR1_OC1M_2 | TIM_CCMR1_OC1M_1 | TIM_CCMR1_OC1M_0) : TIM_CCMR1_OC1M_2;
+    uint32_t primask = __get_PRIMASK();
+    __disable_irq(); // Heater_Trip() may change another channel's mode from any context.
+    MODIFY_REG(*ccmr, (TIM_CCMR1_CC1S | TIM_CCMR1_OC1M | TIM_CCMR1_OC1PE) << shift, (mode | TIM_CCMR1_OC1PE) << shift);
+    __set_PRIMASK(primask);
+}
+
+/**
+ * @brief Set output compare mode of a PWM heater channel, keeping compare preload.
+ *
+ * @param heater PWM heater instance.
+ * @param on PWM mode 1, or PWM mode 2 if aligned to the end of the period, if true,
+ *           otherwise forced inactive, which takes effect at once.
+ */
+static void pwm_output_mode(Heater_t const *const heater, bool on)
+{
+    TIM_TypeDef *const tim = heater->cfg.pwm_timer_handle->Instance;
+    uint32_t channel = heater->cfg.pwm_channel;
+    volatile uint32_t *ccmr = channel < TIM_CHANNEL_3 ? &tim->CCMR1 : &tim->CCMR2;
+    uint32_t shift = (channel & TIM_CHANNEL_2) ? 8U : 0U;
+    uint32_t mode = TIM_CCMR1_OC1M_2;
+    if (on)
+    {
+        mode |= heater->trail ? (TIM_CCMR1_OC1M_1 | TIM_CCMR1_OC1M_0) : TIM_CCMR1_OC1M_1;
+    }
+    uint32_t primask = __get_PRIMASK();
+    __disable_irq(); // Read-modify-write may race another channel's trip.
+    MODIFY_REG(*ccmr, TIM_CCMR1_OC1M << shift, mode << shift);
+    __set_PRIMASK(primask);
+}
+
+/**
+ * @brief Get compare register of a TIM2 channel, CCR1 to CCR4 are consecutive.
+ *
+ * @param channel TIM_CHANNEL_1 to TIM_CHANNEL_4.
+ *
+ * @return Compare register.
+ */
+static inline volatile uint32_t *phase_ccr(uint32_t channel)
+{
+    return &TIM2->CCR1 + channel / 4U;
+}
+
+/**
+ * @brief Get kernel clock of a timer, twice its APB clock if that is prescaled.
+ *
+ * @param tim Timer instance.
+ *
+ * @return Timer clock (Hz).
+ */
+static uint32_t timer_clock_hz(TIM_TypeDef *tim)
+{
+    if (tim == TIM1 || tim == TIM8 || tim == TIM15 || tim == TIM16 || tim == TIM17)
+    {
+        uint32_t hz = HAL_RCC_GetPCLK2Freq();
+        return (RCC->CFGR & RCC_CFGR_PPRE2) != RCC_CFGR_PPRE2_DIV1 ? 2U * hz : hz;
+    }
+    uint32_t hz = HAL_RCC_GetPCLK1Freq();
+    return (RCC->CFGR & RCC_CFGR_PPRE1) != RCC_CFGR_PPRE1_DIV1 ? 2U * hz : hz;
+}
+
+/**
+ * @brief Firing delay after zero crossing for output, interpolated from phase_lut.
+ *
+ * @param out Output, at most HEATER_OUT_MAX.
+ *
+ * @return Compare value (us), PHASE_OFF for zero output.
+ */
+static uint32_t phase_delay_us(uint16_t out)
+{
+    if (out == 0)
+    {
+        return PHASE_OFF;
+    }
+
+    uint32_t pos = (uint32_t)out * (PHASE_LUT_SIZE - 1U);
+    uint32_t i = pos / HEATER_OUT_MAX;
+    uint32_t frac = pos % HEATER_OUT_MAX;
+    uint32_t angle = phase_lut[i];
+    if (i < PHASE_LUT_SIZE - 1U)
+    {
+        angle -= (phase_lut[i] - phase_lut[i + 1U]) * frac / HEATER_OUT_MAX;
+    }
+
+    uint32_t delay = angle * PHASE_HALF_CYCLE_US / 65536U;
+    return delay < HEATER_PHASE_MIN_US ? HEATER_PHASE_MIN_US : (delay > PHASE_END_US ? PHASE_END_US : delay);
+}
+
+/**
+ * @brief Check that firing delay never rises with output, from the latest firing at the lowest
+ *        output to the earliest at full output.
+ *
+ * Conducted power falls with the firing angle, so delivered power then never falls with output.
+ *
+ * @return true if the mapping is monotonic.
+ */
+static bool phase_monotonic(void)
+{
+    uint32_t prev = phase_delay_us(1U);
+    if (prev != PHASE_END_US || phase_delay_us(HEATER_OUT_MAX) != HEATER_PHASE_MIN_US)
+    {
+        return false;
+    }
+    for (uint32_t out = 2U; out <= HEATER_OUT_MAX; out++)
+    {
+        uint32_t const delay = phase_delay_us((uint16_t)out);
+        if (delay > prev)
+        {
+            return false;
+        }
+        prev = delay;
+    }
+    return true;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Interrupt handlers
+////////////////////////////////////////////////////////////////////////////////
+
+void EXTI0_IRQHandler(void)
+{
+    IRQ_LATENCY(IRQ_SRC_ZC);
+    if (!(EXTI->PR1 & EXTI_PR1_PIF0))
+    {
+        return; // Latency probe, no edge.
+    }
+    TRACE_ISR_ENTER(TRACE_ISR_ZC);
+    WRITE_REG(EXTI->PR1, EXTI_PR1_PIF0);
+
+    uint32_t now = DWT->CYCCNT;
+    uint32_t elapsed_us = (now - zc.last_cycles) / (SystemCoreClock / 1000000U);
+    if (zc.count != 0 && elapsed_us < HEATER_ZC_MIN_US)
+    {
+        zc.glitches++;
+        TRACE_ISR_EXIT(TRACE_ISR_ZC);
+        return;
+    }
+    if (zc.count != 0)
+    {
+        zc.half_cycle_us = elapsed_us;
+    }
+    zc.last_cycles = now;
+    zc.last_ms = HAL_GetTick();
+    zc.lost = false;
+    zc.count++;
+
+    /* Conduct next half cycle once accumulated output reaches full scale. */
+    for (uint8_t i = 0; i < zc.num_burst; i++)
+    {
+        Heater_t *const heater = zc.burst[i];
+        bool fire = false;
+        if (heater->enabled && !heater->tripped)
+        {
+            heater->acc += heater->out;
+            if (heater->acc >= HEATER_OUT_MAX)
+            {
+                heater->acc -= HEATER_OUT_MAX;
+                heater->fired++;
+                fire = true;
+            }
+        }
+        heater->cfg.ssr_port->BSRR = fire ? (uint32_t)heater->cfg.ssr_pin : (uint32_t)heater->cfg.ssr_pin << 16U;
+    }
+
+    TRACE_ISR_EXIT(TRACE_ISR_ZC);
+}
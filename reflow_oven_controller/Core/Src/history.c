@@ -0,0 +1,84 @@
+/**
+ * @file history.c
+ * @author Timothy Nguyen
+ * @brief Run recorder: delta-encoded sample history in a fixed RAM ring.
+ * @version 0.1
+ * @date 2021-08-27
+ */
+
+#include <math.h>
+
+#include "history.h"
+
+/* Bit position of state in out_state. */
+#define HISTORY_STATE_SHIFT 12U
+
+void History_Reset(History_t * const hist, float period)
+{
+	hist->count = 0;
+	hist->last = 0;
+	hist->period = period;
+}
+
+void History_Add(History_t * const hist, float temp, float out, uint8_t state)
+{
+	float scaled = fminf(fmaxf(roundf(temp * HISTORY_TEMP_SCALE), (float)INT16_MIN), (float)INT16_MAX);
+	int16_t value = (int16_t)scaled;
+	uint16_t out_code = (uint16_t)fminf(fmaxf(out, 0.0f), (float)HISTORY_OUT_MAX);
+	uint8_t state_code = state < HISTORY_STATE_MAX ? state : HISTORY_STATE_MAX;
+
+	uint32_t slot = hist->count % HISTORY_BLOCK_SAMPLES;
+	History_block_t *const block = &hist->blocks[(hist->count / HISTORY_BLOCK_SAMPLES) % HISTORY_NUM_BLOCKS];
+	if (slot == 0)
+	{
+		/* First sample of a block is stored whole, so the block decodes on its own. */
+		block->temp = value;
+		block->delta[0] = 0;
+		hist->last = value;
+	}
+	else
+	{
+		int32_t delta = (int32_t)value - hist->last;
+		delta = delta > INT8_MAX ? INT8_MAX : (delta < INT8_MIN ? INT8_MIN : delta);
+		block->delta[slot] = (int8_t)delta;
+		hist->last = (int16_t)(hist->last + delta);
+	}
+	block->out_state[slot] = (uint16_t)(out_code | ((uint16_t)state_code << HISTORY_STATE_SHIFT));
+	hist->count++;
+}
+
+uint32_t History_First(History_t const * const hist)
+{
+	if (hist->count <= HISTORY_MAX_SAMPLES)
+	{
+		return 0;
+	}
+
+	/* Oldest held block is the one after the block being written. */
+	uint32_t write_block = hist->count / HISTORY_BLOCK_SAMPLES;
+	if (hist->count % HISTORY_BLOCK_SAMPLES == 0)
+	{
+		return (write_block - HISTORY_NUM_BLOCKS) * HISTORY_BLOCK_SAMPLES;
+	}
+	return (write_block - HISTORY_NUM_BLOCKS + 1U) * HISTORY_BLOCK_SAMPLES;
+}
+
+bool History_Get(History_t const * const hist, uint32_t index, float * const temp, uint16_t * const out, uint8_t * const state)
+{
+	if (index >= hist->count || index < History_First(hist))
+	{
+		return false;
+	}
+
+	uint32_t slot = index % HISTORY_BLOCK_SAMPLES;
+	History_block_t const *const block = &hist->blocks[(index / HISTORY_BLOCK_SAMPLES) % HISTORY_NUM_BLOCKS];
+	int32_t value = block->temp;
+	for (uint32_t i = 1; i <= slot; i++)
+	{
+		value += block->delta[i];
+	}
+	*temp = (float)value / HISTORY_TEMP_SCALE;
+	*out = block->out_state[slot] & HISTORY_OUT_MAX;
+	*state = (uint8_t)(block->out_state[slot] >> HISTORY_STATE_SHIFT);
+	return true;
+}
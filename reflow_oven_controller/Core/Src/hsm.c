@@ -0,0 +1,182 @@
+/**
+ * @file hsm.c
+ * @author Timothy Nguyen
+ * @brief Hierarchical state machine engine for active objects.
+ * @version 0.1
+ * @date 2021-08-10
+ */
+
+#include "hsm.h"
+#include "log.h"
+
+////////////////////////////////////////////////////////////////////////////////
+// Private (static) function declarations
+////////////////////////////////////////////////////////////////////////////////
+
+static void Hsm_transition(Hsm *const hsm, Hsm_State const *source);        // Take transition from source to hsm->target.
+static void Hsm_enter(Hsm *const hsm, Hsm_State const *lca);               // Enter states down to hsm->target and drill into initial states.
+static inline uint8_t Hsm_depth(Hsm_State const *state);                  // Number of states from state up to top level.
+static inline Hsm_Status Hsm_trigger(Hsm *const hsm, Hsm_State const *state, Event const *evt); // Call state handler.
+
+////////////////////////////////////////////////////////////////////////////////
+// Private (static) variables
+////////////////////////////////////////////////////////////////////////////////
+
+/* Reserved events */
+static const Event entry_evt = {.sig = ENTRY_SIG};
+static const Event exit_evt = {.sig = EXIT_SIG};
+static const Event init_evt = {.sig = INIT_SIG};
+
+////////////////////////////////////////////////////////////////////////////////
+// Public (global) functions
+////////////////////////////////////////////////////////////////////////////////
+
+void Hsm_ctor(Hsm *const hsm, void *me)
+{
+    hsm->state = NULL;
+    hsm->target = NULL;
+    hsm->me = me;
+}
+
+void Hsm_init(Hsm *const hsm, Hsm_State const *initial)
+{
+    hsm->target = initial;
+    Hsm_enter(hsm, NULL);
+}
+
+void Hsm_dispatch(Hsm *const hsm, Event const *const evt)
+{
+    /* Pass unhandled event up to superstates. */
+    Hsm_State const *s = hsm->state;
+    Hsm_Status status = HSM_UNHANDLED;
+    while (s != NULL)
+    {
+        status = Hsm_trigger(hsm, s, evt);
+        if (status != HSM_UNHANDLED)
+        {
+            break;
+        }
+        s = s->parent;
+    }
+
+    if (status == HSM_TRAN)
+    {
+        Hsm_transition(hsm, s);
+    }
+}
+
+bool Hsm_is_in(Hsm const *const hsm, Hsm_State const *state)
+{
+    for (Hsm_State const *s = hsm->state; s != NULL; s = s->parent)
+    {
+        if (s == state)
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Private (static) functions
+////////////////////////////////////////////////////////////////////////////////
+
+/**
+ * @brief Take transition from source state to hsm->target.
+ *
+ * A transition to the source itself or to one of its superstates exits and
+ * re-enters the target. A transition to a substate of the source does not
+ * exit the source.
+ *
+ * @param hsm State machine instance.
+ * @param source State whose handler requested the transition, current state or one of its superstates.
+ */
+static void Hsm_transition(Hsm *const hsm, Hsm_State const *source)
+{
+    Hsm_State const *target = hsm->target;
+
+    /* Least common ancestor, found by levelling both paths first. */
+    Hsm_State const *a = source;
+    Hsm_State const *b = target;
+    uint8_t depth_a = Hsm_depth(a);
+    uint8_t depth_b = Hsm_depth(b);
+    for (; depth_a > depth_b; depth_a--)
+    {
+        a = a->parent;
+    }
+    for (; depth_b > depth_a; depth_b--)
+    {
+        b = b->parent;
+    }
+    while (a != b)
+    {
+        a = a->parent;
+        b = b->parent;
+    }
+    Hsm_State const *lca = (a == target) ? target->parent : a;
+
+    /* Exit current state up to, but excluding, least common ancestor. */
+    for (Hsm_State const *s = hsm->state; s != lca; s = s->parent)
+    {
+        Hsm_trigger(hsm, s, &exit_evt);
+    }
+
+    Hsm_enter(hsm, lca);
+}
+
+/**
+ * @brief Enter states from below lca down to hsm->target, then follow initial transitions.
+ *
+ * @param hsm State machine instance.
+ * @param lca State already entered, target's ancestor or NULL.
+ */
+static void Hsm_enter(Hsm *const hsm, Hsm_State const *lca)
+{
+    Hsm_State const *path[HSM_MAX_DEPTH];
+
+    while (1)
+    {
+        Hsm_State const *target = hsm->target;
+
+        /* Path is recorded upwards and entered downwards. */
+        uint8_t n = 0;
+        for (Hsm_State const *s = target; s != lca; s = s->parent)
+        {
+            ASSERT(s != NULL && n < HSM_MAX_DEPTH);
+            path[n++] = s;
+        }
+        while (n > 0)
+        {
+            Hsm_trigger(hsm, path[--n], &entry_evt);
+        }
+        hsm->state = target;
+
+        /* Drill down into initial substate, if any. */
+        if (Hsm_trigger(hsm, target, &init_evt) != HSM_TRAN)
+        {
+            break;
+        }
+        lca = target;
+    }
+}
+
+/**
+ * @brief Number of states from state up to top-level state, 0 for NULL.
+ */
+static inline uint8_t Hsm_depth(Hsm_State const *state)
+{
+    uint8_t depth = 0;
+    for (; state != NULL; state = state->parent)
+    {
+        depth++;
+    }
+    return depth;
+}
+
+/**
+ * @brief Call state handler with owning object.
+ */
+static inline Hsm_Status Hsm_trigger(Hsm *const hsm, Hsm_State const *state, Event const *evt)
+{
+    return state->handler(hsm->me, evt);
+}
@@ -0,0 +1,342 @@
+/**
+ * @file irq.c
+ * @author Timothy Nguyen
+ * @brief Interrupt priority map and entry latency probe.
+ * @version 0.1
+ * @date 2021-09-02
+ */
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+
+#include "irq.h"
+#include "cmd.h"
+#include "log.h"
+#include "printf.h"
+#include "FreeRTOS.h"
+
+////////////////////////////////////////////////////////////////////////////////
+// Common macros
+////////////////////////////////////////////////////////////////////////////////
+
+/* Interrupts using the FreeRTOS API must be masked by kernel critical sections. */
+_Static_assert(IRQ_PRIO_SAMPLE >= configLIBRARY_MAX_SYSCALL_INTERRUPT_PRIORITY, "Sampling interrupts use FreeRTOS API");
+_Static_assert(IRQ_PRIO_CYCLIC >= configLIBRARY_MAX_SYSCALL_INTERRUPT_PRIORITY, "Rate group timer uses FreeRTOS API");
+_Static_assert(IRQ_PRIO_CONSOLE >= configLIBRARY_MAX_SYSCALL_INTERRUPT_PRIORITY, "Console interrupts use FreeRTOS API");
+_Static_assert(IRQ_PRIO_ARCHIVE >= configLIBRARY_MAX_SYSCALL_INTERRUPT_PRIORITY, "Archive interrupts use FreeRTOS API");
+_Static_assert(IRQ_PRIO_MODBUS >= configLIBRARY_MAX_SYSCALL_INTERRUPT_PRIORITY, "Modbus interrupt uses FreeRTOS API");
+_Static_assert(IRQ_PRIO_CAN >= configLIBRARY_MAX_SYSCALL_INTERRUPT_PRIORITY, "CAN interrupt uses FreeRTOS API");
+_Static_assert(IRQ_PRIO_WAKEUP >= configLIBRARY_MAX_SYSCALL_INTERRUPT_PRIORITY, "Wakeup interrupts use FreeRTOS API");
+_Static_assert(IRQ_PRIO_PROBE < IRQ_PRIO_ZC, "Probe timer must preempt every probed interrupt");
+
+#define IRQ_PROBE_TIMER_HZ 1000000U // Probe timer counter clock, 1 us resolution.
+
+////////////////////////////////////////////////////////////////////////////////
+// Type definitions
+////////////////////////////////////////////////////////////////////////////////
+
+/* Probed interrupt source */
+typedef struct
+{
+    const char *name; // Name used by "irq probe".
+    IRQn_Type irqn;   // Interrupt pended by probe.
+    uint8_t prio;     // Priority from map.
+} irq_src_info_t;
+
+/* Probe state */
+typedef struct
+{
+    irq_src_t src;      // Interrupt source being probed.
+    uint32_t remaining; // Probes left to send.
+    uint32_t start;     // DWT cycle counter when pending probe was sent.
+    uint16_t lfsr;      // Interval jitter shift register, never 0.
+    volatile bool busy; // Probe timer running.
+} irq_probe_t;
+
+/* Performance measurements */
+typedef enum
+{
+    CNT_PROBES_SENT,   // Probes sent.
+    CNT_PROBES_MISSED, // Probes still pending when the next one was due.
+
+    NUM_U32_PMS
+} irq_pms_t;
+
+////////////////////////////////////////////////////////////////////////////////
+// Private (static) function declarations
+////////////////////////////////////////////////////////////////////////////////
+
+static void irq_probe_start(irq_src_t src, uint32_t count); // Start probe timer.
+static void irq_probe_stop(void);                           // Stop probe timer.
+
+/* Command callback functions */
+static uint32_t cmd_irq_status(uint32_t argc, const char **argv); // Display priority map and latencies.
+static uint32_t cmd_irq_probe(uint32_t argc, const char **argv);  // Measure entry latency.
+
+////////////////////////////////////////////////////////////////////////////////
+// Private (static) variables
+////////////////////////////////////////////////////////////////////////////////
+
+/* Probed interrupt sources, indexed by irq_src_t. Interrupt numbers follow board wiring in main.c. */
+static const irq_src_info_t irq_srcs[IRQ_NUM_SRCS] = {
+    [IRQ_SRC_ZC] = {.name = "zc", .irqn = EXTI0_IRQn, .prio = IRQ_PRIO_ZC},
+    [IRQ_SRC_SAMPLE] = {.name = "sample", .irqn = TIM6_DAC_IRQn, .prio = IRQ_PRIO_SAMPLE},
+    [IRQ_SRC_SPI_DMA] = {.name = "spi", .irqn = DMA1_Channel4_IRQn, .prio = IRQ_PRIO_SAMPLE},
+    [IRQ_SRC_UART] = {.name = "uart", .irqn = USART2_IRQn, .prio = IRQ_PRIO_CONSOLE},
+    [IRQ_SRC_USB] = {.name = "usb", .irqn = OTG_FS_IRQn, .prio = IRQ_PRIO_CONSOLE}};
+
+/* Probe state */
+static irq_probe_t probe = {.lfsr = 1U};
+
+/* Performance measurement counters */
+static uint32_t irq_pms[NUM_U32_PMS];
+static cmd_pm_hist_t irq_latency[IRQ_NUM_SRCS]; // Entry latency (CPU cycles).
+
+/* Performance measurement info */
+static const cmd_pm_info irq_pm_info[] = {
+    {"probes sent", CMD_PM_U32, &irq_pms[CNT_PROBES_SENT]},
+    {"probes missed", CMD_PM_U32, &irq_pms[CNT_PROBES_MISSED]},
+    {"zc latency cycles", CMD_PM_HIST, &irq_latency[IRQ_SRC_ZC]},
+    {"sample latency cycles", CMD_PM_HIST, &irq_latency[IRQ_SRC_SAMPLE]},
+    {"spi latency cycles", CMD_PM_HIST, &irq_latency[IRQ_SRC_SPI_DMA]},
+    {"uart latency cycles", CMD_PM_HIST, &irq_latency[IRQ_SRC_UART]},
+    {"usb latency cycles", CMD_PM_HIST, &irq_latency[IRQ_SRC_USB]}};
+
+/* IRQ command information. */
+static cmd_cmd_info irq_cmds[] = {
+    {.cmd_name = "status",
+     .cb = cmd_irq_status,
+     .help = "Display interrupt priorities and measured entry latencies."},
+    {.cmd_name = "probe",
+     .cb = cmd_irq_probe,
+     .help = "Measure entry latency of an interrupt, usage: irq probe <zc|sample|spi|uart|usb> [count].\r\n"
+             "Results are reported by \"cmd pm irq\"."}};
+
+/* IRQ module client info */
+CMD_CLIENT_DEFINE(irq,
+                  .num_cmds = sizeof(irq_cmds) / sizeof(irq_cmds[0]),
+                  .cmds = irq_cmds,
+                  .num_pms = sizeof(irq_pm_info) / sizeof(irq_pm_info[0]),
+                  .pms = irq_pm_info);
+
+/* Unique tag for IRQ module. */
+LOG_TAG_DEFINE("IRQ");
+
+////////////////////////////////////////////////////////////////////////////////
+// Public (global) variables and externs
+////////////////////////////////////////////////////////////////////////////////
+
+volatile uint32_t _irq_probe_pending;
+
+////////////////////////////////////////////////////////////////////////////////
+// Public (global) functions
+////////////////////////////////////////////////////////////////////////////////
+
+mod_err_t irq_init(void)
+{
+    /* Priorities of interrupts enabled by generated initialization code. */
+    HAL_NVIC_SetPriority(TIM6_DAC_IRQn, IRQ_PRIO_SAMPLE, 0);
+    HAL_NVIC_SetPriority(DMA1_Channel4_IRQn, IRQ_PRIO_SAMPLE, 0);
+    HAL_NVIC_SetPriority(DMA1_Channel5_IRQn, IRQ_PRIO_SAMPLE, 0);
+    HAL_NVIC_SetPriority(DMA2_Channel2_IRQn, IRQ_PRIO_ARCHIVE, 0);
+
+    /* Probe timer counts microseconds, its interrupt stays disabled until "irq probe". */
+    __HAL_RCC_TIM16_CLK_ENABLE();
+    TIM16->CR1 = TIM_CR1_URS; // Only counter overflow raises update interrupt.
+    TIM16->DIER = TIM_DIER_UIE;
+    HAL_NVIC_SetPriority(TIM1_UP_TIM16_IRQn, IRQ_PRIO_PROBE, 0);
+
+#if IRQ_PROBE_PIN_ENABLE
+    __HAL_RCC_GPIOC_CLK_ENABLE();
+    GPIO_InitTypeDef pin = {.Pin = IRQ_PROBE_PIN, .Mode = GPIO_MODE_OUTPUT_PP, .Pull = GPIO_NOPULL, .Speed = GPIO_SPEED_FREQ_VERY_HIGH};
+    HAL_GPIO_Init(IRQ_PROBE_PORT, &pin);
+#endif
+
+    CoreDebug->DEMCR |= CoreDebug_DEMCR_TRCENA_Msk;
+    DWT->CTRL |= DWT_CTRL_CYCCNTENA_Msk;
+
+    LOGI(TAG, "Applied interrupt priority map");
+    return MOD_OK;
+}
+
+void irq_probe_hit(irq_src_t src)
+{
+    uint32_t cycles = DWT->CYCCNT - probe.start;
+    _irq_probe_pending = 0;
+#if IRQ_PROBE_PIN_ENABLE
+    IRQ_PROBE_PORT->BRR = IRQ_PROBE_PIN;
+#endif
+    cmd_pm_record_hist(&irq_latency[src], cycles);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Interrupt handlers
+////////////////////////////////////////////////////////////////////////////////
+
+/**
+ * @brief Probe timer, sends next probe after a pseudo-random interval.
+ */
+void TIM1_UP_TIM16_IRQHandler(void)
+{
+    WRITE_REG(TIM16->SR, ~(uint32_t)TIM_SR_UIF); // Flags clear on writing 0.
+
+    /* Previous probe is left pending, its handler ignores it once it runs. */
+    if (_irq_probe_pending != 0)
+    {
+        _irq_probe_pending = 0;
+        INC_SAT_U32(irq_pms[CNT_PROBES_MISSED]);
+    }
+    if (probe.remaining == 0)
+    {
+        irq_probe_stop();
+        return;
+    }
+    probe.remaining--;
+
+    /* Jitter keeps probes from locking onto periodic activity, 16-bit Galois LFSR. */
+    probe.lfsr = (probe.lfsr >> 1) ^ (-(probe.lfsr & 1U) & 0xB400U);
+    TIM16->ARR = IRQ_PROBE_INTERVAL_US + (probe.lfsr & IRQ_PROBE_JITTER_US) - 1U;
+
+#if IRQ_PROBE_PIN_ENABLE
+    IRQ_PROBE_PORT->BSRR = IRQ_PROBE_PIN;
+#endif
+    INC_SAT_U32(irq_pms[CNT_PROBES_SENT]);
+    probe.start = DWT->CYCCNT;
+    _irq_probe_pending = (uint32_t)probe.src + 1U;
+    NVIC_SetPendingIRQ(irq_srcs[probe.src].irqn);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Private (static) functions
+////////////////////////////////////////////////////////////////////////////////
+
+/**
+ * @brief Start sending probes to interrupt source.
+ *
+ * @param src Interrupt source.
+ * @param count Number of probes.
+ */
+static void irq_probe_start(irq_src_t src, uint32_t count)
+{
+    /* Timer clock is twice the APB2 clock unless APB2 is undivided. */
+    uint32_t tim_hz = HAL_RCC_GetPCLK2Freq();
+    if ((RCC->CFGR & RCC_CFGR_PPRE2) != RCC_CFGR_PPRE2_DIV1)
+    {
+        tim_hz *= 2U;
+    }
+
+    probe.src = src;
+    probe.remaining = count;
+    probe.busy = true;
+    _irq_probe_pending = 0;
+
+    TIM16->PSC = tim_hz / IRQ_PROBE_TIMER_HZ - 1U;
+    TIM16->ARR = IRQ_PROBE_INTERVAL_US - 1U;
+    TIM16->EGR = TIM_EGR_UG; // Load prescaler, URS keeps this from raising an interrupt.
+    TIM16->CNT = 0;
+    NVIC_ClearPendingIRQ(TIM1_UP_TIM16_IRQn);
+    NVIC_EnableIRQ(TIM1_UP_TIM16_IRQn);
+    SET_BIT(TIM16->CR1, TIM_CR1_CEN);
+}
+
+/**
+ * @brief Stop probe timer (ISR context or with probe timer interrupt disabled).
+ */
+static void irq_probe_stop(void)
+{
+    CLEAR_BIT(TIM16->CR1, TIM_CR1_CEN);
+    NVIC_DisableIRQ(TIM1_UP_TIM16_IRQn);
+    probe.busy = false;
+}
+
+/**
+ * @brief Display interrupt priority map and measured entry latencies.
+ *
+ * @param argc Number of arguments.
+ * @param argv Argument values.
+ *
+ * @return 0 if successful, 1 otherwise.
+ *
+ * TTYS command format: > irq status.
+ */
+static uint32_t cmd_irq_status(uint32_t argc, const char **argv)
+{
+    LOG("Kernel masks priorities %u and above\r\n", configLIBRARY_MAX_SYSCALL_INTERRUPT_PRIORITY);
+    LOG("Source\tIRQn\tPrio\tEnabled\tProbes\tMax latency (us)\r\n");
+    for (uint32_t i = 0; i < IRQ_NUM_SRCS; i++)
+    {
+        const irq_src_info_t *const info = &irq_srcs[i];
+        uint32_t prio = NVIC_GetPriority(info->irqn);
+        uint32_t max_cycles = irq_latency[i].max;
+        LOG("%s\t%d\t%lu%s\t%s\t%lu\t%.2f\r\n", info->name, (int)info->irqn, prio, prio == info->prio ? "" : " (!)",
+            NVIC_GetEnableIRQ(info->irqn) ? "yes" : "no", irq_latency[i].count,
+            (float)max_cycles * 1e6f / (float)SystemCoreClock);
+    }
+    if (probe.busy)
+    {
+        LOG("Probing %s, %lu probes left\r\n", irq_srcs[probe.src].name, probe.remaining);
+    }
+    return 0;
+}
+
+/**
+ * @brief Measure entry latency of an interrupt.
+ *
+ * @param argc Number of arguments.
+ * @param argv Argument values.
+ *
+ * @return 0 if successful, 1 otherwise.
+ *
+ * TTYS command format: > irq probe <zc|sample|spi|uart|usb> [count].
+ */
+static uint32_t cmd_irq_probe(uint32_t argc, const char **argv)
+{
+    if (argc < 1 || argc > 2)
+    {
+        LOG("Usage: irq probe <zc|sample|spi|uart|usb> [count]\r\n");
+        return 1;
+    }
+
+    uint32_t src = 0;
+    while (src < IRQ_NUM_SRCS && strcasecmp(argv[0], irq_srcs[src].name) != 0)
+    {
+        src++;
+    }
+    if (src == IRQ_NUM_SRCS)
+    {
+        LOGW(TAG, "Unknown interrupt source (%s)", argv[0]);
+        return 1;
+    }
+
+    uint32_t count = IRQ_PROBE_DEFAULT;
+    if (argc == 2)
+    {
+        char *end;
+        count = strtoul(argv[1], &end, 10);
+        if (*end != '\0' || count == 0 || count > IRQ_PROBE_MAX)
+        {
+            LOGW(TAG, "Count must be 1 to %lu", IRQ_PROBE_MAX);
+            return 1;
+        }
+    }
+
+    if (probe.busy)
+    {
+        LOGW(TAG, "Still probing %s", irq_srcs[probe.src].name);
+        return 1;
+    }
+    if (!NVIC_GetEnableIRQ(irq_srcs[src].irqn))
+    {
+        LOGW(TAG, "Interrupt of %s is not enabled", irq_srcs[src].name);
+        return 1;
+    }
+
+    memset(&irq_latency[src], 0, sizeof(irq_latency[src]));
+    irq_probe_start((irq_src_t)src, count);
+    LOG("Probing %s with %lu probes, about %lu ms\r\n", irq_srcs[src].name, count,
+        count * (IRQ_PROBE_INTERVAL_US + IRQ_PROBE_JITTER_US / 2U) / 1000U);
+    return 0;
+}
@@ -9,14 +9,25 @@
 #include <stdbool.h>
 #include <stdarg.h>
 #include <string.h>
+#include <strings.h>
 #include <sys/queue.h>
-#include <stdlib.h>
 
 #include "log.h"
 #include "common.h"
 #include "stm32l4xx_hal.h"
 #include "printf.h"
 #include "cmd.h"
+#include "prof.h"
+#include "cmsis_os.h"
+#include "nvs.h"
+#include "prio.h"
+#include "sections.h"
+#include "rtc.h"
+#include "console.h"
+#include "bgjob.h"
+#include "frame.h"
+#include "work.h"
+#include "rtt.h"
 
 ////////////////////////////////////////////////////////////////////////////////
 // Common macros
@@ -26,8 +37,27 @@
 #define LOG_LEVEL_NAMES "OFF, ERROR, WARNING, INFO, DEBUG, VERBOSE"
 #define LOG_LEVEL_NAMES_CSV "OFF", "ERROR", "WARNING", "INFO", "DEBUG", "VERBOSE"
 
-/* Number of tags to be cached. Must be 2**n - 1, n >= 2. */
-#define TAG_CACHE_SIZE 31
+/* Capturing raw argument words relies on the AAPCS va_list layout. */
+#if LOG_DEFERRED && defined(__arm__)
+#define LOG_DEFERRED_CAPTURE 1
+#else
+#define LOG_DEFERRED_CAPTURE 0
+#endif
+
+/* Log thread flag, set when deferred log records need to be printed. */
+#define LOG_FLUSH_FLAG 0x01U
+
+/* Longest timestamp, "YYYY-MM-DD hh:mm:ss.mmm" including terminator. */
+#define LOG_TIMESTAMP_LEN (RTC_TEXT_LEN + 4U)
+
+/* Longest message text, prefix with colour, level and timestamp followed by message. */
+#define LOG_TEXT_LEN (16U + LOG_TIMESTAMP_LEN + LOG_LINE_LEN)
+
+/* End of a message cut short, replaces the end of its line. */
+#define LOG_CUT_SHORT "...\r\n"
+
+/* Bytes of encoded arguments of an interned message, those of a deferred record. */
+#define LOG_ARGS_SIZE (LOG_DEFERRED_ARG_WORDS * sizeof(uint32_t))
 
 ////////////////////////////////////////////////////////////////////////////////
 // Type definitions
@@ -36,39 +66,150 @@
 /**
  * @brief Linked list tag node.
  *
- * Tag entries in their linked list form are considered "uncached".
- * Since traversing the list each time a log message is slow,
- * each tag entry is replicated in a binary min-heap cache.
+ * An entry's tag may be a pattern with '*' and '?' wildcards. Entries are kept most recently
+ * set first, and a tag takes the level of the first entry it matches. Levels of all tags are
+ * resolved from the list whenever it changes, so filtering messages never walks it.
  */
 typedef struct Log_entry
 {
     SLIST_ENTRY(Log_entry)
     entries;           // Required structure connecting elements in list.
     log_level_t level; // Module's logging level.
-    char tag[10];      // Unique module tag.
+    char tag[10];      // Unique module tag or tag pattern.
 } Log_entry;
 
 /**
- * @brief Cached log entry.
+ * @brief Deferred log record.
+ *
+ * Arguments are copied as raw words from the caller's variadic argument area,
+ * starting at the 8-byte boundary below the first argument so that double
+ * arguments keep their alignment. String arguments are copied into strs, their argument
+ * words then hold offsets into strs instead of pointers. Interned messages hold their
+ * encoded arguments.
+ */
+typedef struct
+{
+    volatile uint32_t seq;                     // Ring position + 1 once completely written by producer.
+    log_level_t level;                         // Message's log level.
+    uint32_t tick;                             // Kernel tick when message was logged.
+#if LOG_INTERNED
+    uint32_t site;                             // Call site, see LOG_SITE().
+    uint32_t len;                              // Number of encoded argument bytes.
+#else
+    const char *fmt;                           // Format string.
+    uint32_t arg_offset;                       // Byte offset of first argument into args.
+    uint32_t str_words;                        // Argument words holding offsets into strs, bit per word.
+    char strs[LOG_DEFERRED_STR_LEN];           // Copies of string arguments.
+#endif
+    uint64_t args[LOG_DEFERRED_ARG_WORDS / 2]; // Raw argument words, or encoded arguments.
+} Log_record_t;
+
+/**
+ * @brief Interrupt handler log record.
+ *
+ * Fixed size, arguments are integers or pointers only, so writing one copies a few words.
+ */
+typedef struct
+{
+    volatile uint32_t seq;           // Ring position + 1 once completely written by producer.
+    uint32_t tick;                   // Kernel tick when message was logged.
+    uint32_t nargs;                  // Number of arguments.
+#if LOG_INTERNED
+    uint32_t site;                   // Call site, see LOG_SITE().
+#else
+    const log_tag_t *tag;            // Module tag.
+    log_level_t level;               // Message's log level.
+    const char *fmt;                 // Format string.
+#endif
+    uint32_t args[LOG_ISR_MAX_ARGS]; // Arguments.
+} Log_isr_record_t;
+
+/* Interned log frame payload header, encoded arguments follow */
+typedef struct __attribute__((packed))
+{
+    uint8_t type;  // LOG_TELEMETRY_TYPE.
+    uint8_t level; // log_level_t.
+    uint8_t tag;   // Position of tag in log_tags section.
+    uint16_t fmt;  // Address of format string in log_fmt section.
+    uint32_t tick; // Kernel tick when message was logged (ms).
+} Log_frame_hdr;
+
+/* Performance measurements */
+typedef enum
+{
+    CNT_RECORDS_DROPPED, // Messages dropped by overflow policy, all levels.
+    CNT_DROPPED_ERROR,   // ERROR messages dropped, followed by one counter per level up to VERBOSE.
+    CNT_DROPPED_WARNING,
+    CNT_DROPPED_INFO,
+    CNT_DROPPED_DEBUG,
+    CNT_DROPPED_VERBOSE,
+    CNT_ITM_DROPPED,     // Messages cut short because ITM stimulus port stayed busy.
+    CNT_RATE_LIMITED,    // Messages suppressed by call site rate limits.
+    CNT_REPEATS,         // Messages counted as repeats of the previous one instead of printed.
+    CNT_ISR_DROPPED,     // Interrupt handler messages dropped because their ring was full.
+
+    NUM_U16_PMS // Number of performance measurements
+} Log_pms_t;
+
+/**
+ * @brief Log sink backend, outputs one formatted message.
+ */
+typedef struct
+{
+    const char *name;                           // Name used by "log sink".
+    bool (*write)(const char *text, size_t len); // Output message whole, false if it was dropped.
+} Log_sink_backend;
+
+/**
+ * @brief Timestamp formatter state.
  *
- * Tag entries are cached in a binary min-heap for faster access.
+ * Holds the text of the second last formatted, up to and including its decimal point,
+ * so messages within that second only append their milliseconds.
  */
 typedef struct
 {
-    uint32_t generation : 29;
-    uint32_t level : 3; // Module's logging level.
-    const char *tag;    // Tag unique to module
-} Log_cached_entry;
+    bool valid;                    // text holds the second starting at sec_tick.
+    uint32_t sec_tick;             // Kernel tick at start of formatted second.
+    uint32_t len;                  // Length of text up to and including decimal point.
+    char text[LOG_TIMESTAMP_LEN];  // Formatted second, followed by milliseconds.
+} Log_clock;
+
+/**
+ * @brief Repeated message collapsing state.
+ *
+ * Messages are formatted into one of two lines, the other holds the previous message. Interned
+ * messages are compared by call site and encoded arguments instead.
+ */
+typedef struct
+{
+    char lines[2][LOG_LINE_LEN]; // Formatted messages, without level and timestamp.
+    uint32_t len;                // Length of interned previous message.
+    uint32_t prev;               // Index of line holding previous message.
+    bool prev_valid;             // Previous message fit its line uncut.
+    log_level_t level;           // Log level of previous message.
+    uint32_t count;              // Repeats of previous message not reported yet.
+    uint32_t tick;               // Kernel tick of last repeat.
+} Log_repeat;
+
+/* ITM sink output state for one message */
+typedef struct
+{
+    bool dropped; // Stimulus port stayed busy, rest of message is discarded.
+} Log_itm_out;
 
 /**
- * @brief View state of cache.
+ * @brief Log levels persisted with NVS_KEY_LOG_LEVELS.
  */
 typedef struct
 {
-    uint32_t max_generation;                // Highest generation value currently in heap.
-    uint32_t entry_count;                   // Number of entries in cache.
-    Log_cached_entry cache[TAG_CACHE_SIZE]; // Binary min-heap acting as a cache.
-} Log_cache_state_t;
+    int32_t global_level; // Global log level.
+    uint32_t num_tags;    // Number of tag levels.
+    struct
+    {
+        char tag[10];      // Unique module tag.
+        uint8_t level;     // Module's logging level.
+    } tags[LOG_MAX_TAG_ENTRIES];
+} Log_stored_levels;
 
 /**
  * @brief Structure named Log_head_t containing a pointer to head log_entry node.
@@ -82,20 +223,63 @@ SLIST_HEAD(Log_head_t, Log_entry);
 /* Command callback functions */
 static uint32_t cmd_log_status(uint32_t argc, const char **argv); // Get log levels callback.
 static uint32_t cmd_log_set(uint32_t argc, const char **argv); // Set log level callback.
+static uint32_t cmd_log_sink(uint32_t argc, const char **argv); // Get or set log sink callback.
+static uint32_t cmd_log_overflow(uint32_t argc, const char **argv); // Get or set overflow policy callback.
 
 static inline void log_level_set(const char *tag, log_level_t level); // Set tag's log level.
+static void log_levels_save(void);                                     // Store global and tag log levels.
 
 static const char *log_level_str(int32_t level);      // Convert log level from integer to string.
 static int32_t log_level_int(const char *level_name); // Convert log level from string to integer.
 
-static inline log_level_t get_log_level(const char *tag);                       // Get log level, either from heap (cache) or linked list (uncached).
-static inline bool get_cached_log_level(const char *tag, log_level_t *level);   // Get cached log level.
-static inline bool get_uncached_log_level(const char *tag, log_level_t *level); // Get uncached log level.
-
-static inline void log_add_cache(const char *tag, log_level_t log_level); // Add tag and log level to cache.
-
-static inline void heap_bubble_down(int index);       // Heapify min-heap.
-static inline void heap_swap(uint32_t i, uint32_t j); // Swap heap array elements.
+static bool log_tag_match(const char *pattern, const char *tag); // Match tag against pattern.
+static void log_levels_resolve(void);                            // Resolve level of every tag from entries.
+
+static inline Log_entry *log_entry_alloc(void);      // Take entry from tag entry pool.
+static inline void log_entry_free(Log_entry *entry); // Return entry to tag entry pool.
+
+#if !LOG_INTERNED
+static void log_sink_print(log_level_t level, uint32_t tick, const char *fmt, va_list args); // Print message on current log sink.
+static void log_sink_write(log_level_t level, uint32_t tick, const char *line); // Prefix and commit message to current log sink.
+static void log_timestamp(uint32_t tick, char *buf);             // Format timestamp of kernel tick.
+static void log_clock_sync(uint32_t tick);                       // Format second of kernel tick.
+#else
+static uint32_t log_args_encode(uint32_t shape, va_list args, uint8_t *out); // Encode arguments of interned message.
+static void log_sink_send(uint32_t tick, uint32_t site, const uint8_t *args, uint32_t len); // Send interned message on current log sink.
+static void log_frame_write(uint32_t tick, uint32_t site, const uint8_t *args, uint32_t len); // Frame and commit interned message to current log sink.
+#endif
+static Log_isr_record_t *log_isr_reserve(log_level_t level, uint32_t *put); // Reserve interrupt handler record.
+static void log_isr_commit(Log_isr_record_t *rec, uint32_t put);  // Publish interrupt handler record.
+static void log_isr_drain(void);                                 // Print pending interrupt handler records.
+#if LOG_DEFERRED_CAPTURE
+static void log_isr_wake(void *arg);                             // Wake log thread, work item of log_isr_commit().
+#endif
+#if !LOG_INTERNED
+static void log_sink_printw(log_level_t level, uint32_t tick, const char *fmt, ...); // Print message of interrupt handler record.
+#endif
+static void log_repeat_flush(void);                              // Report repeats of previous message.
+static void log_drop(log_level_t level);                         // Count message dropped by overflow policy.
+static bool log_may_wait(void);                                  // Whether caller may wait for room.
+static bool sink_console_write(const char *text, size_t len);    // Console sink backend.
+static bool sink_itm_write(const char *text, size_t len);        // ITM sink backend.
+static bool sink_rtt_write(const char *text, size_t len);        // RTT sink backend.
+static bool sink_null_write(const char *text, size_t len);       // Null sink backend.
+static void sink_itm_putc(char c, Log_itm_out *out);             // Write character to ITM stimulus port, non-blocking.
+
+#if LOG_DEFERRED_CAPTURE
+#if !LOG_INTERNED
+static inline void log_record_post(log_level_t level, uint32_t tick, const char *fmt, va_list args); // Capture deferred log record.
+static void log_record_strings(Log_record_t *rec, uint32_t len); // Copy string arguments into record.
+#else
+static inline void log_record_post_interned(uint32_t tick, uint32_t site, uint32_t shape, va_list args); // Capture deferred interned record.
+#endif
+static Log_record_t *log_record_reserve(log_level_t level, uint32_t *put); // Reserve record in ring.
+static void log_record_commit(Log_record_t *rec, uint32_t put); // Publish reserved record to log thread.
+static bool log_record_make_room(uint32_t *waited_ms);       // Apply overflow policy to full record ring.
+static bool log_record_evict(void);                          // Drop oldest record.
+static bool log_record_release(uint32_t get);                // Release record after copying it.
+static void Log_thread(void *argument);                      // Print deferred log records.
+#endif
 
 ////////////////////////////////////////////////////////////////////////////////
 // Private (static) variables
@@ -112,26 +296,111 @@ static cmd_cmd_info log_cmds[] = {
      .help = "Display log levels.\r\nPossible log levels: " LOG_LEVEL_NAMES},
     {.cmd_name = "set",
      .cb = cmd_log_set,
-     .help = "Set tag's log level, usage: log set <tag> <level>.\r\nPossible log levels: " LOG_LEVEL_NAMES}};
+     .help = "Set tag's log level, usage: log set <tag> <level>.\r\n"
+             "Tag may be a pattern with * and ?, eg. RE*, the most recently set match wins. * alone sets global level.\r\n"
+             "Possible log levels: " LOG_LEVEL_NAMES},
+    {.cmd_name = "sink",
+     .cb = cmd_log_sink,
+     .help = "Display or select output of log messages, usage: log sink [console|itm|rtt|null]."},
+    {.cmd_name = "overflow",
+     .cb = cmd_log_overflow,
+     .help = "Display or select what happens to messages finding no room, usage: log overflow [newest|oldest|block].\r\n"
+             "newest drops the new message, oldest overwrites the oldest queued one, block waits then drops."}};
+
+/* Performance measurement counters */
+static uint16_t log_pms[NUM_U16_PMS];
+
+/* Performance measurement names */
+static const char *pm_names[] = {
+    "RECORDS DROPPED",
+    "DROPPED ERROR",
+    "DROPPED WARNING",
+    "DROPPED INFO",
+    "DROPPED DEBUG",
+    "DROPPED VERBOSE",
+    "ITM DROPPED",
+    "RATE LIMITED",
+    "REPEATS",
+    "ISR DROPPED"};
 
 /* Log module client info */
-static cmd_client_info log_client_info =
-    {
-        .client_name = "log",
-        .num_cmds = 2,
-        .cmds = log_cmds,
-        .num_u16_pms = 0,
-        .u16_pms = NULL,
-        .u16_pm_names = NULL};
+CMD_CLIENT_DEFINE(log,
+                  .num_cmds = sizeof(log_cmds) / sizeof(log_cmds[0]),
+                  .cmds = log_cmds,
+                  .num_u16_pms = NUM_U16_PMS,
+                  .u16_pms = log_pms,
+                  .u16_pm_names = pm_names);
 
 /* Unique tag for logging module. */
-static const char *TAG = "LOG";
+LOG_TAG_DEFINE("LOG");
+
+/* Log sink backends, indexed by log_sink_t */
+static const Log_sink_backend log_sinks[LOG_NUM_SINKS] = {
+    [LOG_SINK_CONSOLE] = {.name = "console", .write = sink_console_write},
+    [LOG_SINK_ITM] = {.name = "itm", .write = sink_itm_write},
+    [LOG_SINK_RTT] = {.name = "rtt", .write = sink_rtt_write},
+    [LOG_SINK_NULL] = {.name = "null", .write = sink_null_write}};
+
+/* Overflow policy names used by "log overflow", indexed by log_overflow_t */
+static const char *const log_overflow_names[LOG_NUM_OVERFLOW_POLICIES] = {
+    [LOG_OVERFLOW_DROP_NEWEST] = "newest",
+    [LOG_OVERFLOW_DROP_OLDEST] = "oldest",
+    [LOG_OVERFLOW_BLOCK] = "block"};
+
+#if !LOG_INTERNED
+/* Message prefix up to timestamp, indexed by log_level_t */
+static const char *const log_prefixes[] = {
+    [LOG_NONE] = "\r",
+    [LOG_ERROR] = "\r" LOG_COLOUR_E "E (",
+    [LOG_WARNING] = "\r" LOG_COLOUR_W "W (",
+    [LOG_INFO] = "\r" LOG_COLOUR_I "I (",
+    [LOG_DEBUG] = "\r" LOG_COLOUR_D "D (",
+    [LOG_VERBOSE] = "\r" LOG_COLOUR_V "V ("};
+
+/* Timestamp formatter, only used by whoever prints messages */
+static Log_clock log_clock;
+#endif
+
+/* Repeated message collapsing, only used by whoever prints messages */
+static Log_repeat log_repeat;
+
+/* Message text committed to sink, only used by whoever prints messages */
+static char log_text[LOG_TEXT_LEN];
+
+/* Current log sink */
+static volatile log_sink_t log_sink = LOG_SINK_CONSOLE;
+
+/* Current overflow policy */
+static volatile log_overflow_t log_overflow = LOG_OVERFLOW_DEFAULT;
 
 /* Declare a Log_head_t object containing a pointer to first log_tag_entry node. */
 static struct Log_head_t log_head;
 
-/* Cache of tags and their log levels */
-static Log_cache_state_t cache_state;
+/* Fixed pool of tag entries, unused entries are kept in a free list. */
+static Log_entry entry_pool[LOG_MAX_TAG_ENTRIES];
+static struct Log_head_t free_head;
+
+/* Interrupt handler record ring. Put index is reserved by producers with exclusive access
+ * instructions, get index is only advanced by the consumer. */
+static Log_isr_record_t isr_records[LOG_ISR_RECORDS];
+static volatile uint32_t isr_put;
+static volatile uint32_t isr_get;
+
+#if LOG_DEFERRED_CAPTURE
+/* Deferred log record ring. Put index is reserved by producers, get index is advanced by the
+ * log thread and by producers overwriting the oldest record, all with exclusive access instructions. */
+static Log_record_t records[LOG_DEFERRED_RECORDS];
+static volatile uint32_t records_put;
+static volatile uint32_t records_get;
+
+/* Thread printing deferred log records */
+static osThreadId_t log_thread_id;
+static StaticTask_t log_thread_cb;
+static uint64_t SRAM2_BSS log_stack[LOG_THREAD_STACK_SIZE / sizeof(uint64_t)];
+
+/* End of main stack, argument words are never copied past it. */
+extern uint32_t _estack;
+#endif
 
 ////////////////////////////////////////////////////////////////////////////////
 // Public (global) variables and externs
@@ -148,15 +417,82 @@ bool _log_active = true;
  */
 int32_t _global_log_level = LOG_DEFAULT;
 
+/*
+ * @brief Level of every tag, indexed by position in log_tags section.
+ *
+ * Starts at the default level, so tags log before log_init() and stored levels are restored.
+ * Written by the command thread and read by every thread and ISR that logs. Each entry is
+ * one byte stored at once, so readers see the old or the new level, never a torn value.
+ */
+volatile uint8_t _log_tag_levels[LOG_MAX_TAGS] = {[0 ... LOG_MAX_TAGS - 1] = LOG_DEFAULT};
+
 ////////////////////////////////////////////////////////////////////////////////
 // Public (global) functions
 ////////////////////////////////////////////////////////////////////////////////
 
 mod_err_t log_init(void)
 {
+    ASSERT(__stop_log_tags - __start_log_tags <= LOG_MAX_TAGS);
     SLIST_INIT(&log_head); // Initialize linked list by setting head pointer to NULL.
+    SLIST_INIT(&free_head);
+    for (uint32_t i = 0; i < LOG_MAX_TAG_ENTRIES; i++)
+    {
+        SLIST_INSERT_HEAD(&free_head, &entry_pool[i], entries);
+    }
     LOGI(TAG, "Initialized log module");
-    return cmd_register(&log_client_info);
+    return MOD_OK;
+}
+
+mod_err_t log_load_levels(void)
+{
+    static Log_stored_levels stored;
+    mod_err_t err = nvs_get(NVS_KEY_LOG_LEVELS, &stored, sizeof(stored));
+    if (err != MOD_OK)
+    {
+        return err;
+    }
+    if (stored.num_tags > LOG_MAX_TAG_ENTRIES || (uint32_t)stored.global_level >= ARRAY_SIZE(log_level_names))
+    {
+        return MOD_ERR_ARG;
+    }
+
+    /* Levels were saved in list order, inserting at head in reverse restores it. */
+    _global_log_level = stored.global_level;
+    for (uint32_t i = stored.num_tags; i-- > 0;)
+    {
+        if (stored.tags[i].level >= ARRAY_SIZE(log_level_names))
+        {
+            continue;
+        }
+        Log_entry *entry = log_entry_alloc();
+        if (entry == NULL)
+        {
+            break;
+        }
+        memcpy(entry->tag, stored.tags[i].tag, sizeof(entry->tag));
+        entry->tag[sizeof(entry->tag) - 1] = '\0';
+        entry->level = (log_level_t)stored.tags[i].level;
+        SLIST_INSERT_HEAD(&log_head, entry, entries);
+    }
+
+    log_levels_resolve();
+    LOGI(TAG, "Restored stored log levels");
+    return MOD_OK;
+}
+
+mod_err_t log_start(void)
+{
+#if LOG_DEFERRED_CAPTURE
+    static const osThreadAttr_t thread_attr = {.name = "log",
+                                               .cb_mem = &log_thread_cb,
+                                               .cb_size = sizeof(log_thread_cb),
+                                               .stack_mem = log_stack,
+                                               .stack_size = sizeof(log_stack),
+                                               .priority = PRIO_LOG};
+    log_thread_id = osThreadNew(Log_thread, NULL, &thread_attr);
+    ASSERT(log_thread_id != NULL);
+#endif
+    return MOD_OK;
 }
 
 bool log_toggle(void)
@@ -170,17 +506,146 @@ bool log_is_active(void)
     return _log_active;
 }
 
-void log_printf(const char *tag, log_level_t level, const char *fmt, ...)
+#if !LOG_INTERNED
+void log_printf(const log_tag_t *tag, log_level_t level, const char *fmt, ...)
+{
+    PROF_BEGIN(log_printf);
+    uint32_t tick = HAL_GetTick();
+    va_list args;
+    va_start(args, fmt);
+#if LOG_DEFERRED_CAPTURE
+    log_record_post(level, tick, fmt, args);
+#else
+    log_isr_drain();
+    log_sink_print(level, tick, fmt, args);
+#endif
+    va_end(args);
+    PROF_END(log_printf);
+}
+#else
+void log_interned(uint32_t site, uint32_t shape, ...)
+{
+    PROF_BEGIN(log_printf);
+    uint32_t tick = HAL_GetTick();
+    va_list args;
+    va_start(args, shape);
+#if LOG_DEFERRED_CAPTURE
+    log_record_post_interned(tick, site, shape, args);
+#else
+    uint8_t encoded[LOG_ARGS_SIZE];
+    uint32_t len = log_args_encode(shape, args, encoded);
+    log_isr_drain();
+    log_sink_send(tick, site, encoded, len);
+#endif
+    va_end(args);
+    PROF_END(log_printf);
+}
+#endif
+
+#if !LOG_INTERNED
+void log_printf_isr(const log_tag_t *tag, log_level_t level, const char *fmt, uint32_t nargs, ...)
 {
-    log_level_t tag_level = get_log_level(tag);
-    if (level > tag_level)
+    uint32_t put;
+    Log_isr_record_t *rec = log_isr_reserve(level, &put);
+    if (rec == NULL)
     {
         return;
     }
+    rec->tick = HAL_GetTick();
+    rec->tag = tag;
+    rec->level = level;
+    rec->fmt = fmt;
+    rec->nargs = nargs;
     va_list args;
-    va_start(args, fmt);
-    vprintf(fmt, args);
+    va_start(args, nargs);
+    for (uint32_t i = 0; i < nargs; i++)
+    {
+        rec->args[i] = (uint32_t)va_arg(args, unsigned long);
+    }
+    va_end(args);
+    log_isr_commit(rec, put);
+}
+#else
+void log_interned_isr(uint32_t site, uint32_t nargs, ...)
+{
+    uint32_t put;
+    Log_isr_record_t *rec = log_isr_reserve(LOG_SITE_LEVEL(site), &put);
+    if (rec == NULL)
+    {
+        return;
+    }
+    rec->tick = HAL_GetTick();
+    rec->site = site;
+    rec->nargs = nargs;
+    va_list args;
+    va_start(args, nargs);
+    for (uint32_t i = 0; i < nargs; i++)
+    {
+        rec->args[i] = (uint32_t)va_arg(args, unsigned long);
+    }
     va_end(args);
+    log_isr_commit(rec, put);
+}
+#endif
+
+bool log_rate_allow(log_rate_t *const rate, const log_tag_t *tag)
+{
+    static const uint32_t burst_ms = LOG_RATE_BURST * LOG_RATE_PERIOD_MS;
+    uint32_t now = HAL_GetTick();
+    uint32_t elapsed = rate->primed ? now - rate->last_tick : burst_ms;
+    rate->primed = true;
+    rate->last_tick = now;
+    rate->credit = elapsed >= burst_ms - rate->credit ? burst_ms : rate->credit + elapsed;
+    if (rate->credit < LOG_RATE_PERIOD_MS)
+    {
+        rate->suppressed++;
+        INC_SAT_U16(log_pms[CNT_RATE_LIMITED]);
+        return false;
+    }
+    rate->credit -= LOG_RATE_PERIOD_MS;
+
+    if (rate->suppressed != 0)
+    {
+        uint32_t suppressed = rate->suppressed;
+        rate->suppressed = 0;
+        LOG_MESSAGE(TAG, LOG_WARNING, "%lu %s messages suppressed by rate limit", suppressed, tag->name);
+    }
+    return true;
+}
+
+mod_err_t log_sink_set(log_sink_t sink)
+{
+    if (sink >= LOG_NUM_SINKS)
+    {
+        return MOD_ERR_ARG;
+    }
+    log_sink = sink;
+    return MOD_OK;
+}
+
+log_sink_t log_sink_get(void)
+{
+    return log_sink;
+}
+
+mod_err_t log_overflow_set(log_overflow_t policy)
+{
+    if (policy >= LOG_NUM_OVERFLOW_POLICIES)
+    {
+        return MOD_ERR_ARG;
+    }
+    log_overflow = policy;
+    return MOD_OK;
+}
+
+log_overflow_t log_overflow_get(void)
+{
+    return log_overflow;
+}
+
+log_level_t log_level_get(const log_tag_t *tag)
+{
+    return LOG_TAG_LEVEL(tag);
 }
 
 /**
@@ -230,10 +695,13 @@ static int32_t log_level_int(const char *level_name)
  *
  * @return 0 if successful, 1 otherwise.
  *
- * Log levels include global log level and individual tag log levels that override global level.
+ * Log levels include global log level and individual tag log levels that override global level,
+ * followed by the level every tag of the image resolves to.
  */
 static uint32_t cmd_log_status(uint32_t argc, const char **argv)
 {
+    LOG("Log sink: (%s)\r\n", log_sinks[log_sink].name);
+    LOG("Overflow policy: (%s)\r\n", log_overflow_names[log_overflow]);
     LOG("Global log level: (%s)\r\n", log_level_str(_global_log_level));
 
     if (!SLIST_EMPTY(&log_head))
@@ -245,6 +713,11 @@ static uint32_t cmd_log_status(uint32_t argc, const char **argv)
         }
     }
 
+    LOG("Tags of image:\r\n");
+    for (const log_tag_t *tag = __start_log_tags; tag < __stop_log_tags; tag++)
+    {
+        LOG("  %s: (%s)\r\n", tag->name, log_level_str(LOG_TAG_LEVEL(tag)));
+    }
     return 0;
 }
 
@@ -276,18 +749,84 @@ static uint32_t cmd_log_set(uint32_t argc, const char **argv)
         else
         { // tag , level
             log_level_set(argv[0], new_log_level);
+            log_levels_save();
+            return 0;
+        }
+    }
+}
+
+/**
+ * @brief Log sink command.
+ *
+ * @param argc Number of arguments.
+ * @param argv Argument values.
+ *
+ * @return 0 if successful, 1 otherwise.
+ *
+ * TTYS command format: > log sink [console|itm|null]. Without argument, current sink is displayed.
+ */
+static uint32_t cmd_log_sink(uint32_t argc, const char **argv)
+{
+    if (argc == 0)
+    {
+        LOG("Log sink: (%s)\r\n", log_sinks[log_sink].name);
+        return 0;
+    }
+
+    for (uint32_t i = 0; argc == 1 && i < LOG_NUM_SINKS; i++)
+    {
+        if (strcasecmp(argv[0], log_sinks[i].name) == 0)
+        {
+            log_sink_set((log_sink_t)i);
+            LOG("Log sink: (%s)\r\n", log_sinks[i].name);
+            return 0;
+        }
+    }
+
+    LOG("Usage: log sink [console|itm|null]\r\n");
+    return 1;
+}
+
+/**
+ * @brief Log overflow command.
+ *
+ * @param argc Number of arguments.
+ * @param argv Argument values.
+ *
+ * @return 0 if successful, 1 otherwise.
+ *
+ * TTYS command format: > log overflow [newest|oldest|block]. Without argument, current policy is displayed.
+ */
+static uint32_t cmd_log_overflow(uint32_t argc, const char **argv)
+{
+    if (argc == 0)
+    {
+        LOG("Overflow policy: (%s)\r\n", log_overflow_names[log_overflow]);
+        return 0;
+    }
+
+    for (uint32_t i = 0; argc == 1 && i < LOG_NUM_OVERFLOW_POLICIES; i++)
+    {
+        if (strcasecmp(argv[0], log_overflow_names[i]) == 0)
+        {
+            log_overflow_set((log_overflow_t)i);
+            LOG("Overflow policy: (%s)\r\n", log_overflow_names[i]);
             return 0;
         }
     }
+
+    LOG("Usage: log overflow [newest|oldest|block]\r\n");
+    return 1;
 }
 
 /**
  * @brief Set log level.
  * 
- * @param tag Tag unique to module or wild-card "*" if referring to all modules.
+ * @param tag Tag unique to module, tag pattern, or wild-card "*" if referring to all modules.
  * @param level Desired log level.
  *
- * @note Wild-card tag resets log level of all tags to given value.
+ * @note Wild-card tag resets log level of all tags to given value. Patterns with '*' and '?'
+ *       wildcards are resolved here, so filtering messages never matches patterns.
  */
 static inline void log_level_set(const char *tag, log_level_t level)
 {
@@ -298,27 +837,28 @@ static inline void log_level_set(const char *tag, log_level_t level)
     {
         _global_log_level = level;
 
-        LOGI(TAG, "Clearing list and cache");
+        LOGI(TAG, "Clearing list");
         while (!SLIST_EMPTY(&log_head))
         {
             p = SLIST_FIRST(&log_head);
             SLIST_REMOVE_HEAD(&log_head, entries);
-            free(p);
+            log_entry_free(p);
         }
 
-        cache_state.entry_count = 0;
-        cache_state.max_generation = 0;
+        log_levels_resolve();
 
         LOG("Global log level set to (%s)\r\n", log_level_str(_global_log_level));
         return;
     }
 
-    /* Check if tag is already saved in linked list. */
+    /* Most recently set entry wins, so an existing entry moves to the head of the list. */
     SLIST_FOREACH(p, &log_head, entries)
     {
         if (strcmp(p->tag, tag) == 0)
         {
+            SLIST_REMOVE(&log_head, p, Log_entry, entries);
             p->level = level;
+            SLIST_INSERT_HEAD(&log_head, p, entries);
             LOG("%s log level set to (%s)\r\n", p->tag, log_level_str(p->level));
             break;
         }
@@ -327,169 +867,1057 @@ static inline void log_level_set(const char *tag, log_level_t level)
     /* Tag not found in linked list, add new entry. */
     if (p == NULL)
     {
-        Log_entry *new_entry = (Log_entry *)malloc(sizeof(Log_entry));
-        if (new_entry == NULL)
+        p = log_entry_alloc();
+        if (p == NULL)
         {
-            LOGW(TAG, "Insufficient heap memory for new list entry.");
+            LOGW(TAG, "All %d tag entries in use, reset with \"log set * <level>\".", LOG_MAX_TAG_ENTRIES);
             return;
         }
-        new_entry->level = level;
-        strncpy(new_entry->tag, tag, sizeof(new_entry->tag));
-        SLIST_INSERT_HEAD(&log_head, new_entry, entries);
-        LOG("Added tag (%s) to list with level (%s)\r\n", new_entry->tag, log_level_str(new_entry->level));
+        p->level = level;
+        strncpy(p->tag, tag, sizeof(p->tag) - 1);
+        p->tag[sizeof(p->tag) - 1] = '\0';
+        SLIST_INSERT_HEAD(&log_head, p, entries);
+        LOG("Added tag (%s) to list with level (%s)\r\n", p->tag, log_level_str(p->level));
     }
 
-    /* Update entry in cache if it exists.
-     * search in the cache and update the entry it if exists */
-    for (uint32_t i = 0; i < cache_state.entry_count; ++i)
+    /* Pattern is matched once here against every tag of the image, several of which may share
+     * a name. */
+    log_levels_resolve();
+    bool matched = false;
+    for (const log_tag_t *t = __start_log_tags; t < __stop_log_tags && !matched; t++)
     {
-        if (strcmp(cache_state.cache[i].tag, tag) == 0)
-        {
-            cache_state.cache[i].level = level;
-            break;
-        }
+        matched = log_tag_match(p->tag, t->name);
+    }
+    if (!matched)
+    {
+        LOG("No tag of image matches (%s), see \"log status\"\r\n", p->tag);
     }
-
     return;
 }
 
 /**
- * Get log level.
- *
- * @param tag Tag to find level of.
- *
- * @return Tag's log level or global log level if not found.
+ * @brief Store global and tag log levels, so they are restored by log_load_levels() after reset.
  */
-static inline log_level_t get_log_level(const char *tag)
+static void log_levels_save(void)
 {
-    log_level_t tag_lvl = 0;
-    if (!get_cached_log_level(tag, &tag_lvl))
+    static Log_stored_levels stored;
+    memset(&stored, 0, sizeof(stored));
+    stored.global_level = _global_log_level;
+
+    Log_entry *p = NULL;
+    SLIST_FOREACH(p, &log_head, entries)
     {
-        if (!get_uncached_log_level(tag, &tag_lvl))
-        {
-            /* Log level not found, default to global log level. */
-            tag_lvl = _global_log_level;
-        }
+        memcpy(stored.tags[stored.num_tags].tag, p->tag, sizeof(p->tag));
+        stored.tags[stored.num_tags].level = (uint8_t)p->level;
+        stored.num_tags++;
+    }
 
-        /* Add to cache for faster access */
-        log_add_cache(tag, tag_lvl);
+    if (nvs_set(NVS_KEY_LOG_LEVELS, &stored, sizeof(stored)) != MOD_OK)
+    {
+        LOGW(TAG, "Log levels will not persist across resets");
     }
+}
 
-    return tag_lvl;
+#if LOG_DEFERRED_CAPTURE
+/**
+ * @brief Capture log record into deferred log record ring. Safe to call from ISRs.
+ *
+ * @param level Message's log level.
+ * @param tick Kernel tick when message was logged.
+ * @param fmt Format string.
+ * @param args Variable arguments.
+ */
+#if !LOG_INTERNED
+static inline void log_record_post(log_level_t level, uint32_t tick, const char *fmt, va_list args)
+{
+    uint32_t put;
+    Log_record_t *rec = log_record_reserve(level, &put);
+    if (rec == NULL)
+    {
+        return;
+    }
+    rec->level = level;
+    rec->tick = tick;
+    rec->fmt = fmt;
+
+    /* Copy raw argument words, preserving 8-byte alignment of argument area. */
+    uintptr_t ap = (uintptr_t)args.__ap;
+    uintptr_t src = ap & ~(uintptr_t)7U;
+    uint32_t len = sizeof(rec->args);
+    if (src + len > (uintptr_t)&_estack)
+    {
+        len = (uintptr_t)&_estack - src;
+    }
+    rec->arg_offset = ap - src;
+    memcpy(rec->args, (const void *)src, len);
+    log_record_strings(rec, len);
+    log_record_commit(rec, put);
 }
 
 /**
- * @brief Get the cached log level corresponding to tag.
- * 
- * @param[in] tag Tag to find cached level of.
- * @param[out] level Log level corresponding to tag.
- * @return true Level found in cache.
- *         false Level not found in cache.
+ * @brief Copy string arguments of captured record into it, so they need not outlive the call.
+ *
+ * Walks the format string as vprintf() would to find the argument word of every %s, and
+ * replaces the pointer there with the offset of its copy in strs. Strings that find no
+ * room left print as empty strings.
+ *
+ * @param rec Record with format string and raw argument words.
+ * @param len Number of argument bytes captured.
  */
-static inline bool get_cached_log_level(const char *tag, log_level_t *level)
+static void log_record_strings(Log_record_t *rec, uint32_t len)
 {
+    _Static_assert(LOG_DEFERRED_ARG_WORDS <= 32, "str_words has a bit per argument word");
+    uint32_t *const words = (uint32_t *)rec->args;
+    uint32_t pos = rec->arg_offset; // Byte offset of next argument.
+    uint32_t used = 0;
 
-    /* Assumes tag stored as static variable */
-    uint32_t i;
-    for (i = 0; i < cache_state.entry_count; ++i)
+    rec->str_words = 0;
+    for (const char *f = rec->fmt; *f != '\0'; f++)
     {
-        if (cache_state.cache[i].tag == tag)
+        if (*f != '%')
         {
-            break;
+            continue;
         }
-    }
 
-    /* Could not find log level */
-    if (i == cache_state.entry_count)
-    {
-        return false;
-    }
+        /* Flags, width and precision, '*' takes an int argument. */
+        f += strspn(f + 1, "-+ #0") + 1;
+        if (*f == '*')
+        {
+            pos += sizeof(int);
+            f++;
+        }
+        f += strspn(f, "0123456789");
+        if (*f == '.')
+        {
+            f++;
+            if (*f == '*')
+            {
+                pos += sizeof(int);
+                f++;
+            }
+            f += strspn(f, "0123456789");
+        }
 
-    /* Return level */
-    *level = (log_level_t)cache_state.cache[i].level;
+        /* Length and specifier, 64-bit arguments are 8-byte aligned. */
+        uint32_t size = sizeof(uint32_t);
+        if (f[0] == 'l' && f[1] == 'l')
+        {
+            size = sizeof(long long);
+            f += 2;
+        }
+        else if (*f == 'j')
+        {
+            size = sizeof(intmax_t);
+            f++;
+        }
+        else
+        {
+            f += strspn(f, "lhzt");
+        }
+        if (*f == '\0')
+        {
+            return;
+        }
+        if (*f == '%')
+        {
+            continue;
+        }
+        if (strchr("fFeEgG", *f) != NULL)
+        {
+            size = sizeof(double);
+        }
+        if (size == 8U)
+        {
+            pos = (pos + 7U) & ~7U;
+        }
 
-    /* If cache is full, increment generation with each cache hit and heapify */
-    if (cache_state.entry_count == TAG_CACHE_SIZE)
+        if (*f == 's' && pos + sizeof(uint32_t) <= len && words[pos / 4U] != 0U)
+        {
+            const char *str = (const char *)words[pos / 4U];
+            uint32_t room = sizeof(rec->strs) - used;
+            if (room == 0)
+            {
+                words[pos / 4U] = (uint32_t)"";
+            }
+            else
+            {
+                size_t n = strnlen(str, room - 1U);
+                memcpy(&rec->strs[used], str, n);
+                rec->strs[used + n] = '\0';
+                words[pos / 4U] = used;
+                rec->str_words |= 1UL << (pos / 4U);
+                used += n + 1U;
+            }
+        }
+        pos += size;
+    }
+}
+#else
+/**
+ * @brief Capture interned log record into deferred log record ring. Safe to call from ISRs.
+ *
+ * @param tick Kernel tick when message was logged.
+ * @param site Call site, see LOG_SITE().
+ * @param shape Kinds of arguments, see LOG_SHAPE().
+ * @param args Variable arguments.
+ */
+static inline void log_record_post_interned(uint32_t tick, uint32_t site, uint32_t shape, va_list args)
+{
+    uint32_t put;
+    Log_record_t *rec = log_record_reserve(LOG_SITE_LEVEL(site), &put);
+    if (rec == NULL)
     {
-        cache_state.cache[i].generation = cache_state.max_generation++;
-        heap_bubble_down(i);
+        return;
     }
-
-    return true;
+    rec->level = LOG_SITE_LEVEL(site);
+    rec->tick = tick;
+    rec->site = site;
+    rec->len = log_args_encode(shape, args, (uint8_t *)rec->args);
+    log_record_commit(rec, put);
 }
+#endif
 
 /**
- * @brief Get uncached log level.
+ * @brief Reserve record in deferred log record ring, making room by overflow policy while it is full.
  *
- * @param[in] tag Unique module tag.
- * @param[out] level Log level corresponding to tag.
+ * @param level Message's log level, counted if it is dropped.
+ * @param[out] put Ring position of record.
  *
- * @return true if log level found, false otherwise.
+ * @return Record to fill in, NULL if the message is dropped.
  */
-static inline bool get_uncached_log_level(const char *tag, log_level_t *level)
+static Log_record_t *log_record_reserve(log_level_t level, uint32_t *put)
 {
-    Log_entry *p = NULL;
-
-    SLIST_FOREACH(p, &log_head, entries)
+    uint32_t waited_ms = 0;
+    while (1)
     {
-        if (strcmp(p->tag, tag) == 0)
+        *put = __LDREXW(&records_put);
+        if (*put - records_get < LOG_DEFERRED_RECORDS)
+        {
+            if (__STREXW(*put + 1, &records_put) == 0)
+            {
+                return &records[*put & (LOG_DEFERRED_RECORDS - 1)];
+            }
+            continue;
+        }
+        __CLREX();
+        if (!log_record_make_room(&waited_ms))
         {
-            *level = p->level;
-            return true;
+            log_drop(level);
+            return NULL;
         }
     }
-
-    return false;
 }
 
 /**
- * @brief Add tag and its log level to cache.
+ * @brief Publish filled in record to log thread, waking it if needed.
  *
- * @param tag Unique tag corresponding to module
- * @param log_level Module's log level.
- *
- * Cache is implemented using a binary min-heap.
+ * @param rec Record reserved with log_record_reserve().
+ * @param put Ring position of record.
  */
-static inline void log_add_cache(const char *tag, log_level_t log_level)
+static void log_record_commit(Log_record_t *rec, uint32_t put)
 {
-    uint32_t generation = cache_state.max_generation++;
+    __DMB(); // Record must be visible before log thread observes its sequence.
+    rec->seq = put + 1;
 
-    /* No need to sort since min-heap. */
-    if (cache_state.entry_count < TAG_CACHE_SIZE)
+    /* Wake log thread when ring was empty, as it then waits without timeout, or is filling up.
+     * Otherwise it flushes periodically. */
+    uint32_t queued = put - records_get;
+    if ((queued == 0 || queued >= LOG_DEFERRED_RECORDS / 2) && log_thread_id != NULL)
     {
-        cache_state.cache[cache_state.entry_count] = (Log_cached_entry){
-            .generation = generation,
-            .level = log_level,
-            .tag = tag};
-        ++cache_state.entry_count;
-        return;
+        osThreadFlagsSet(log_thread_id, LOG_FLUSH_FLAG);
     }
-
-    // Cache is full, replace first element
-    // and do bubble-down sorting to restore
-    // binary min-heap.
-    cache_state.cache[0] = (Log_cached_entry){
-        .tag = tag,
-        .level = log_level,
-        .generation = generation};
-    heap_bubble_down(0);
 }
 
-static inline void heap_bubble_down(int index)
+/**
+ * @brief Apply overflow policy to full record ring.
+ *
+ * @param[in,out] waited_ms Time the caller has waited for room so far (ms).
+ *
+ * @return true if caller should try to reserve a record again, false to drop its message.
+ */
+static bool log_record_make_room(uint32_t *waited_ms)
 {
-    while (index < TAG_CACHE_SIZE / 2)
+    switch (log_overflow)
     {
-        uint32_t left_index = index * 2 + 1;
-        uint32_t right_index = left_index + 1;
-        uint32_t next = (cache_state.cache[left_index].generation < cache_state.cache[right_index].generation) ? left_index : right_index;
-        heap_swap(index, next); // cache[index] always greater than cache[next]
-        index = next;
+    case LOG_OVERFLOW_DROP_OLDEST:
+        return log_record_evict();
+    case LOG_OVERFLOW_BLOCK:
+        if (!log_may_wait() || osThreadGetId() == log_thread_id || *waited_ms >= LOG_BLOCK_TIMEOUT_MS)
+        {
+            return false;
+        }
+        osThreadFlagsSet(log_thread_id, LOG_FLUSH_FLAG);
+        osDelay(1);
+        (*waited_ms)++;
+        return true;
+    default:
+        return false;
     }
 }
 
-static inline void heap_swap(uint32_t i, uint32_t j)
+/**
+ * @brief Drop oldest record of full ring, unless its producer is still writing it.
+ *
+ * @return true if there is room now, false otherwise.
+ */
+static bool log_record_evict(void)
+{
+    uint32_t get;
+    log_level_t level;
+    do
+    {
+        get = __LDREXW(&records_get);
+        Log_record_t const *rec = &records[get & (LOG_DEFERRED_RECORDS - 1)];
+        if (records_put - get < LOG_DEFERRED_RECORDS || rec->seq != get + 1)
+        {
+            __CLREX();
+            return records_put - get < LOG_DEFERRED_RECORDS;
+        }
+        level = rec->level;
+    } while (__STREXW(get + 1, &records_get) != 0);
+
+    log_drop(level);
+    return true;
+}
+
+/**
+ * @brief Release record at ring position get after log thread copied it.
+ *
+ * @param get Ring position of record.
+ *
+ * @return true if released, false if a producer overwrote it meanwhile and the copy may be torn.
+ */
+static bool log_record_release(uint32_t get)
+{
+    do
+    {
+        if (__LDREXW(&records_get) != get)
+        {
+            __CLREX();
+            return false;
+        }
+    } while (__STREXW(get + 1, &records_get) != 0);
+    return true;
+}
+
+/**
+ * @brief Log thread, formats and prints deferred log records in order.
+ *
+ * Each record is copied out of the ring before it is printed, so producers may overwrite
+ * the oldest record at any time and are not held up while the log thread waits for the sink.
+ *
+ * @param argument Unused.
+ */
+static void Log_thread(void *argument)
+{
+    static Log_record_t rec;
+    while (1)
+    {
+        /* Without pending records, wait for the next one so idle time is not cut into periods,
+         * unless repeats of the last message are still to be reported. */
+        uint32_t timeout = records_get != records_put || isr_get != isr_put ? LOG_FLUSH_PERIOD_MS
+                           : log_repeat.count != 0    ? LOG_REPEAT_FLUSH_MS
+                                                      : osWaitForever;
+        osThreadFlagsWait(LOG_FLUSH_FLAG, osFlagsWaitAny, timeout);
+
+        log_isr_drain();
+
+        /* Records are printed in reservation order, so stop at first record still being written. */
+        while (1)
+        {
+            uint32_t get = records_get;
+            Log_record_t const *slot = &records[get & (LOG_DEFERRED_RECORDS - 1)];
+            if (get == records_put || slot->seq != get + 1)
+            {
+                break;
+            }
+            __DMB(); // Read sequence before reading record.
+            memcpy(&rec, slot, sizeof(rec));
+            __DMB(); // Finish copying before releasing record.
+            if (!log_record_release(get))
+            {
+                continue;
+            }
+
+#if LOG_INTERNED
+            log_sink_send(rec.tick, rec.site, (const uint8_t *)rec.args, rec.len);
+#else
+            uint32_t *const words = (uint32_t *)rec.args;
+            for (uint32_t i = 0; i < LOG_DEFERRED_ARG_WORDS; i++)
+            {
+                if (rec.str_words & (1UL << i))
+                {
+                    words[i] = (uint32_t)&rec.strs[words[i]]; // Offset of copied string to pointer.
+                }
+            }
+            va_list args;
+            args.__ap = (uint8_t *)rec.args + rec.arg_offset;
+            log_sink_print(rec.level, rec.tick, rec.fmt, args);
+#endif
+        }
+
+        if (log_repeat.count != 0 && HAL_GetTick() - log_repeat.tick >= LOG_REPEAT_FLUSH_MS)
+        {
+            log_repeat_flush();
+        }
+    }
+}
+#endif
+
+#if !LOG_INTERNED
+/**
+ * @brief Format and print message on current log sink, prefixed with level and timestamp.
+ *
+ * A message identical to the previous one, level included, is only counted. Messages too
+ * long for LOG_LINE_LEN are cut short and never collapsed.
+ *
+ * @param level Message's log level.
+ * @param tick Kernel tick when message was logged.
+ * @param fmt Format string.
+ * @param args Variable arguments.
+ */
+static void log_sink_print(log_level_t level, uint32_t tick, const char *fmt, va_list args)
+{
+    if (log_sink == LOG_SINK_NULL)
+    {
+        return; // Discarded without formatting.
+    }
+
+    uint32_t next = log_repeat.prev ^ 1U;
+    char *const line = log_repeat.lines[next];
+    int len = vsnprintf(line, LOG_LINE_LEN, fmt, args);
+    bool fits = len >= 0 && len < (int)LOG_LINE_LEN;
+    if (len < 0)
+    {
+        line[0] = '\0';
+    }
+    else if (!fits)
+    {
+        memcpy(&line[LOG_LINE_LEN - sizeof(LOG_CUT_SHORT)], LOG_CUT_SHORT, sizeof(LOG_CUT_SHORT));
+    }
+
+    if (fits && log_repeat.prev_valid && level == log_repeat.level &&
+        strcmp(line, log_repeat.lines[log_repeat.prev]) == 0)
+    {
+        log_repeat.count++;
+        log_repeat.tick = tick;
+        INC_SAT_U16(log_pms[CNT_REPEATS]);
+        return;
+    }
+
+    log_repeat_flush();
+    log_repeat.prev = next;
+    log_repeat.prev_valid = fits;
+    log_repeat.level = level;
+    log_sink_write(level, tick, line);
+}
+
+#else
+/**
+ * @brief Encode arguments of interned message, see log_arg_kind_t.
+ *
+ * Numbers always fit, strings share the remaining room and are cut short to fit it.
+ *
+ * @param shape Kinds of arguments, see LOG_SHAPE().
+ * @param args Variable arguments.
+ * @param[out] out Encoded arguments, LOG_ARGS_SIZE bytes.
+ *
+ * @return Number of encoded bytes.
+ */
+static uint32_t log_args_encode(uint32_t shape, va_list args, uint8_t *out)
+{
+    /* Encoded size of each kind, a string's is its terminator. */
+    static const uint8_t kind_sizes[] = {
+        [LOG_ARG_END] = 0U, [LOG_ARG_U32] = 4U, [LOG_ARG_U64] = 8U, [LOG_ARG_DOUBLE] = 4U, [LOG_ARG_STR] = 1U};
+    _Static_assert(LOG_INTERNED_MAX_ARGS * 8U <= LOG_ARGS_SIZE, "Numbers of a message always fit");
+
+    uint32_t room = LOG_ARGS_SIZE;
+    for (uint32_t s = shape; (s & 0xFU) != LOG_ARG_END; s >>= 4)
+    {
+        room -= kind_sizes[s & 0xFU];
+    }
+
+    uint32_t len = 0;
+    for (; (shape & 0xFU) != LOG_ARG_END; shape >>= 4)
+    {
+        switch (shape & 0xFU)
+        {
+        case LOG_ARG_U32:
+        {
+            uint32_t v = (uint32_t)va_arg(args, unsigned long);
+            memcpy(&out[len], &v, sizeof(v));
+            len += sizeof(v);
+            break;
+        }
+        case LOG_ARG_U64:
+        {
+            uint64_t v = va_arg(args, unsigned long long);
+            memcpy(&out[len], &v, sizeof(v));
+            len += sizeof(v);
+            break;
+        }
+        case LOG_ARG_DOUBLE:
+        {
+            float v = (float)va_arg(args, double);
+            memcpy(&out[len], &v, sizeof(v));
+            len += sizeof(v);
+            break;
+        }
+        case LOG_ARG_STR:
+        {
+            const char *str = va_arg(args, const char *);
+            if (str == NULL)
+            {
+                str = "(null)";
+            }
+            uint32_t n = strnlen(str, room < LOG_INTERNED_STR_LEN ? room : LOG_INTERNED_STR_LEN);
+            memcpy(&out[len], str, n);
+            out[len + n] = '\0';
+            room -= n;
+            len += n + 1U;
+            break;
+        }
+        default:
+            return len;
+        }
+    }
+    return len;
+}
+
+/**
+ * @brief Send interned message on current log sink as a frame.
+ *
+ * Like log_sink_print(), a message identical to the previous one, level included, is only
+ * counted.
+ *
+ * @param tick Kernel tick when message was logged.
+ * @param site Call site, see LOG_SITE().
+ * @param args Encoded arguments.
+ * @param len Number of encoded argument bytes.
+ */
+static void log_sink_send(uint32_t tick, uint32_t site, const uint8_t *args, uint32_t len)
+{
+    if (log_sink == LOG_SINK_NULL)
+    {
+        return; // Discarded without framing.
+    }
+
+    uint32_t next = log_repeat.prev ^ 1U;
+    char *const line = log_repeat.lines[next];
+    memcpy(line, &site, sizeof(site));
+    memcpy(&line[sizeof(site)], args, len);
+    uint32_t line_len = sizeof(site) + len;
+
+    if (log_repeat.prev_valid && line_len == log_repeat.len &&
+        memcmp(line, log_repeat.lines[log_repeat.prev], line_len) == 0)
+    {
+        log_repeat.count++;
+        log_repeat.tick = tick;
+        INC_SAT_U16(log_pms[CNT_REPEATS]);
+        return;
+    }
+
+    log_repeat_flush();
+    log_repeat.prev = next;
+    log_repeat.prev_valid = true;
+    log_repeat.len = line_len;
+    log_repeat.level = LOG_SITE_LEVEL(site);
+    log_frame_write(tick, site, args, len);
+}
+
+/**
+ * @brief Frame interned message and commit it whole to current log sink.
+ *
+ * The frame is preceded by a delimiter, so the host tells it apart from console text
+ * written before it.
+ *
+ * @param tick Kernel tick when message was logged.
+ * @param site Call site, see LOG_SITE().
+ * @param args Encoded arguments.
+ * @param len Number of encoded argument bytes.
+ */
+static void log_frame_write(uint32_t tick, uint32_t site, const uint8_t *args, uint32_t len)
+{
+    uint8_t payload[sizeof(Log_frame_hdr) + LOG_ARGS_SIZE];
+    const Log_frame_hdr hdr = {.type = LOG_TELEMETRY_TYPE,
+                               .level = (uint8_t)LOG_SITE_LEVEL(site),
+                               .tag = (uint8_t)LOG_SITE_TAG(site),
+                               .fmt = (uint16_t)LOG_SITE_FMT(site),
+                               .tick = tick};
+    memcpy(payload, &hdr, sizeof(hdr));
+    memcpy(&payload[sizeof(hdr)], args, len);
+
+    /* Message text buffer is not needed for text, it holds the frame. */
+    _Static_assert(sizeof(log_text) >= 1U + FRAME_ENCODED_SIZE(sizeof(payload)), "Log frame fits text buffer");
+    uint8_t *const frame = (uint8_t *)log_text;
+    frame[0] = FRAME_DELIMITER;
+    size_t frame_len = 1U + frame_encode(payload, sizeof(hdr) + len, &frame[1], sizeof(log_text) - 1U);
+    if (!log_sinks[log_sink].write(log_text, frame_len))
+    {
+        log_drop(LOG_SITE_LEVEL(site));
+    }
+}
+#endif
+
+/**
+ * @brief Report repeats of previous message, if any, with the level and time of the last one.
+ */
+static void log_repeat_flush(void)
+{
+    if (log_repeat.count == 0)
+    {
+        return;
+    }
+#if LOG_INTERNED
+    uint32_t count = log_repeat.count;
+    log_repeat.count = 0;
+    log_frame_write(log_repeat.tick, LOG_SITE(TAG, log_repeat.level, "Last message repeated %lu times"),
+                    (const uint8_t *)&count, sizeof(count));
+#else
+    char line[48];
+    snprintf(line, sizeof(line), "%s: Last message repeated %lu times\r\n", TAG->name, log_repeat.count);
+    log_repeat.count = 0;
+    log_sink_write(log_repeat.level, log_repeat.tick, line);
+#endif
+}
+
+#if !LOG_INTERNED
+/**
+ * @brief Prefix message with level and timestamp and commit it whole to current log sink.
+ *
+ * @param level Message's log level.
+ * @param tick Kernel tick when message was logged.
+ * @param line Formatted message.
+ */
+static void log_sink_write(log_level_t level, uint32_t tick, const char *line)
+{
+    char stamp[LOG_TIMESTAMP_LEN];
+    log_timestamp(tick, stamp);
+    int len = snprintf(log_text, sizeof(log_text), "%s%s) %s", log_prefixes[level], stamp, line);
+    if (len < 0 || (size_t)len >= sizeof(log_text))
+    {
+        len = (int)strlen(log_text);
+    }
+    if (!log_sinks[log_sink].write(log_text, (size_t)len))
+    {
+        log_drop(level);
+    }
+}
+#endif
+
+/**
+ * @brief Reserve record in interrupt handler record ring, never waits.
+ *
+ * @param level Message's log level, counted if it is dropped.
+ * @param[out] put Ring position of record.
+ *
+ * @return Record to fill in, NULL if the ring is full and the message is dropped.
+ */
+static Log_isr_record_t *log_isr_reserve(log_level_t level, uint32_t *put)
+{
+    do
+    {
+        *put = __LDREXW(&isr_put);
+        if (*put - isr_get >= LOG_ISR_RECORDS)
+        {
+            __CLREX();
+            INC_SAT_U16(log_pms[CNT_ISR_DROPPED]);
+            log_drop(level);
+            return NULL;
+        }
+    } while (__STREXW(*put + 1, &isr_put) != 0);
+    return &isr_records[*put & (LOG_ISR_RECORDS - 1)];
+}
+
+/**
+ * @brief Publish filled in interrupt handler record, waking the log thread if the ring was empty.
+ *
+ * @param rec Record reserved with log_isr_reserve().
+ * @param put Ring position of record.
+ */
+static void log_isr_commit(Log_isr_record_t *rec, uint32_t put)
+{
+    __DMB(); // Record must be visible before consumer observes its sequence.
+    rec->seq = put + 1;
+#if LOG_DEFERRED_CAPTURE
+    if (put == isr_get)
+    {
+        (void)work_submit(log_isr_wake, NULL);
+    }
+#endif
+}
+
+#if LOG_DEFERRED_CAPTURE
+/**
+ * @brief Wake log thread to print interrupt handler records.
+ *
+ * @param arg Unused.
+ */
+static void log_isr_wake(void *arg)
+{
+    (void)arg;
+    if (log_thread_id != NULL)
+    {
+        osThreadFlagsSet(log_thread_id, LOG_FLUSH_FLAG);
+    }
+}
+#endif
+
+/**
+ * @brief Print pending interrupt handler records in order, up to the first still being written.
+ *
+ * Called by the log thread, or by the thread logging next without LOG_DEFERRED_CAPTURE. Each
+ * record is copied before it is released, so handlers may reuse its slot while it prints.
+ */
+static void log_isr_drain(void)
+{
+    _Static_assert(LOG_ISR_MAX_ARGS == 4, "Text records pass every argument to log_sink_printw()");
+    static bool draining;
+    if (draining || __get_IPSR() != 0U)
+    {
+        return;
+    }
+    draining = true;
+    while (1)
+    {
+        uint32_t get = isr_get;
+        Log_isr_record_t const *slot = &isr_records[get & (LOG_ISR_RECORDS - 1)];
+        if (get == isr_put || slot->seq != get + 1)
+        {
+            break;
+        }
+        __DMB(); // Read sequence before reading record.
+        Log_isr_record_t rec = *slot;
+        __DMB(); // Finish copying before releasing record.
+        isr_get = get + 1;
+
+#if LOG_INTERNED
+        log_sink_send(rec.tick, rec.site, (const uint8_t *)rec.args, rec.nargs * sizeof(rec.args[0]));
+#else
+        log_sink_printw(rec.level, rec.tick, rec.fmt, rec.tag->name, (unsigned long)rec.args[0],
+                        (unsigned long)rec.args[1], (unsigned long)rec.args[2], (unsigned long)rec.args[3]);
+#endif
+    }
+    draining = false;
+}
+
+#if !LOG_INTERNED
+/**
+ * @brief Print message of interrupt handler record, see log_sink_print().
+ *
+ * Passes every argument slot, the format string consumes as many as the message had.
+ *
+ * @param level Message's log level.
+ * @param tick Kernel tick when message was logged.
+ * @param fmt Format string.
+ * @param ... Variable arguments.
+ */
+static void log_sink_printw(log_level_t level, uint32_t tick, const char *fmt, ...)
+{
+    va_list args;
+    va_start(args, fmt);
+    log_sink_print(level, tick, fmt, args);
+    va_end(args);
+}
+#endif
+
+/**
+ * @brief Count message dropped by overflow policy, in total and per level.
+ *
+ * @param level Message's log level.
+ */
+static void log_drop(log_level_t level)
+{
+    INC_SAT_U16(log_pms[CNT_RECORDS_DROPPED]);
+    if (level >= LOG_ERROR && level <= LOG_VERBOSE)
+    {
+        INC_SAT_U16(log_pms[CNT_DROPPED_ERROR + level - LOG_ERROR]);
+    }
+}
+
+/**
+ * @brief Check whether caller may wait for room.
+ *
+ * @return true for the log thread, which paces the deferred record ring, and for other threads
+ *         with the blocking overflow policy. Never from ISRs or before the scheduler started.
+ */
+static bool log_may_wait(void)
+{
+    if (__get_IPSR() != 0U || osKernelGetState() != osKernelRunning || bgjob_in_idle())
+    {
+        return false;
+    }
+#if LOG_DEFERRED_CAPTURE
+    if (osThreadGetId() == log_thread_id)
+    {
+        return true;
+    }
+#endif
+    return log_overflow == LOG_OVERFLOW_BLOCK;
+}
+
+#if !LOG_INTERNED
+/**
+ * @brief Format timestamp of kernel tick.
+ *
+ * Messages are printed in about the order they were logged, so most fall into the second
+ * formatted last and only append their milliseconds. Divisions, and RTC reads once it is
+ * set, are only needed once per second of messages, in log_clock_sync().
+ *
+ * @param tick Kernel tick when message was logged.
+ * @param buf Buffer of at least LOG_TIMESTAMP_LEN characters receiving the timestamp.
+ *
+ * @note Not reentrant, the second formatted last is shared. Only whoever prints messages
+ *       calls it: the log thread, or callers of log_printf() if LOG_DEFERRED is disabled.
+ */
+static void log_timestamp(uint32_t tick, char *buf)
+{
+    uint32_t ms = tick - log_clock.sec_tick;
+    if (!log_clock.valid || ms >= 1000U)
+    {
+        log_clock_sync(tick);
+        ms = tick - log_clock.sec_tick;
+    }
+
+    /* Divisions by constants compile to multiplications. */
+    memcpy(buf, log_clock.text, log_clock.len);
+    char *const p = &buf[log_clock.len];
+    p[0] = (char)('0' + ms / 100U);
+    p[1] = (char)('0' + ms / 10U % 10U);
+    p[2] = (char)('0' + ms % 10U);
+    p[3] = '\0';
+}
+
+/**
+ * @brief Format second of kernel tick as wall-clock time, or as uptime while the RTC is not set.
+ *
+ * @param tick Kernel tick when message was logged.
+ */
+static void log_clock_sync(uint32_t tick)
+{
+    uint32_t sec, ms;
+    uint32_t len;
+    if (rtc_read(&sec, &ms))
+    {
+        /* Message was logged before the RTC was read by the time it has waited since. */
+        uint64_t wall_ms = (uint64_t)sec * 1000U + ms - (HAL_GetTick() - tick);
+        sec = (uint32_t)(wall_ms / 1000U);
+        ms = (uint32_t)(wall_ms % 1000U);
+        rtc_format(sec, log_clock.text, RTC_TEXT_LEN);
+        len = RTC_TEXT_LEN - 1U;
+    }
+    else
+    {
+        sec = tick / 1000U;
+        ms = tick % 1000U;
+        len = (uint32_t)snprintf(log_clock.text, sizeof(log_clock.text), "%lu", sec);
+    }
+    log_clock.text[len] = '.';
+    log_clock.len = len + 1U;
+    log_clock.sec_tick = tick - ms;
+    log_clock.valid = true;
+}
+#endif
+
+/**
+ * @brief Console sink, commits message whole to the transmit buffers of sessions subscribed to logs.
+ *
+ * Sessions with room take the message at once. Sessions without room are waited for if log_may_wait()
+ * allows, at most LOG_BLOCK_TIMEOUT_MS, and only those still full drop it. While command output
+ * is captured for a JSON response, the message goes through printf() to be captured with it,
+ * unless it is an interned log frame.
+ */
+static bool sink_console_write(const char *text, size_t len)
+{
+    if (!LOG_INTERNED && printf_capturing())
+    {
+        printf("%s", text);
+        return true;
+    }
+
+    uint32_t waiting = console_sub_offer(CONSOLE_SUB_LOG, CONSOLE_SESSIONS_ALL, text, len);
+    for (uint32_t waited_ms = 0; waiting != 0U; waited_ms++)
+    {
+        if (waited_ms >= LOG_BLOCK_TIMEOUT_MS || !log_may_wait())
+        {
+            return false;
+        }
+        osDelay(1);
+        waiting = console_sub_offer(CONSOLE_SUB_LOG, waiting, text, len);
+    }
+    return true;
+}
+
+/* ITM sink, silent unless a debugger enabled the stimulus port. */
+static bool sink_itm_write(const char *text, size_t len)
+{
+    if (!(ITM->TCR & ITM_TCR_ITMENA_Msk) || !(ITM->TER & (1UL << LOG_ITM_PORT)))
+    {
+        return true;
+    }
+
+    Log_itm_out out = {.dropped = false};
+    for (size_t i = 0; i < len && !out.dropped; i++)
+    {
+        sink_itm_putc(text[i], &out);
+    }
+    if (out.dropped)
+    {
+        INC_SAT_U16(log_pms[CNT_ITM_DROPPED]);
+    }
+    return true;
+}
+
+/**
+ * @brief RTT sink, commits message whole to RTT up buffer.
+ *
+ * Waits for room like the console sink, but only while a debugger is attached to read it.
+ */
+static bool sink_rtt_write(const char *text, size_t len)
+{
+#if RTT_ENABLE
+    for (uint32_t waited_ms = 0; rtt_tx_free() < len; waited_ms++)
+    {
+        if (waited_ms >= LOG_BLOCK_TIMEOUT_MS || !log_may_wait() ||
+            !(CoreDebug->DHCSR & CoreDebug_DHCSR_C_DEBUGEN_Msk))
+        {
+            return false;
+        }
+        osDelay(1);
+    }
+    return rtt_write(text, len) == MOD_OK;
+#else
+    (void)text;
+    (void)len;
+    return false;
+#endif
+}
+
+/* Null sink, message is discarded. */
+static bool sink_null_write(const char *text, size_t len)
+{
+    (void)text;
+    (void)len;
+    return true;
+}
+
+/**
+ * @brief Write character to ITM stimulus port.
+ *
+ * Polls at most LOG_ITM_WAIT_POLLS times for the stimulus port FIFO, otherwise drops the
+ * character and the rest of the message.
+ *
+ * @param c Character to write.
+ * @param out Output state of message.
+ */
+static void sink_itm_putc(char c, Log_itm_out *out)
+{
+    if (out->dropped)
+    {
+        return;
+    }
+
+    /* Polls are counted rather than timed, the cycle counter may not be running yet. */
+    for (uint32_t polls = 0; ITM->PORT[LOG_ITM_PORT].u32 == 0; polls++)
+    {
+        if (polls >= LOG_ITM_WAIT_POLLS)
+        {
+            out->dropped = true;
+            return;
+        }
+    }
+    ITM->PORT[LOG_ITM_PORT].u8 = (uint8_t)c;
+}
+
+/**
+ * @brief Match tag against pattern.
+ *
+ * @param pattern Tag pattern, '*' matches any run of characters and '?' any one character.
+ * @param tag Unique module tag.
+ *
+ * @return true if tag matches pattern, false otherwise.
+ *
+ * Backtracks to the last '*' only, which suffices since '*' never has to match
+ * differently once a later '*' matched.
+ */
+static bool log_tag_match(const char *pattern, const char *tag)
+{
+    const char *star = NULL;  // Last '*' seen in pattern.
+    const char *resume = tag; // Tag position the last '*' currently matches up to.
+    while (*tag != '\0')
+    {
+        if (*pattern == '*')
+        {
+            star = pattern++;
+            resume = tag;
+        }
+        else if (*pattern == '?' || *pattern == *tag)
+        {
+            pattern++;
+            tag++;
+        }
+        else if (star != NULL)
+        {
+            pattern = star + 1;
+            tag = ++resume;
+        }
+        else
+        {
+            return false;
+        }
+    }
+    while (*pattern == '*')
+    {
+        pattern++;
+    }
+    return *pattern == '\0';
+}
+
+/**
+ * @brief Resolve level of every tag of the image, from the first entry it matches or the
+ * global level.
+ *
+ * Each level is a single byte, so a message filtered meanwhile sees the old or new level.
+ */
+static void log_levels_resolve(void)
+{
+    for (const log_tag_t *tag = __start_log_tags; tag < __stop_log_tags; tag++)
+    {
+        log_level_t level = (log_level_t)_global_log_level;
+        Log_entry *p = NULL;
+        SLIST_FOREACH(p, &log_head, entries)
+        {
+            if (log_tag_match(p->tag, tag->name))
+            {
+                level = p->level;
+                break;
+            }
+        }
+        _log_tag_levels[tag - __start_log_tags] = (uint8_t)level;
+    }
+}
+
+/**
+ * @brief Take entry from tag entry pool.
+ *
+ * @return Tag entry, NULL if pool is exhausted.
+ */
+static inline Log_entry *log_entry_alloc(void)
+{
+    Log_entry *entry = SLIST_FIRST(&free_head);
+    if (entry != NULL)
+    {
+        SLIST_REMOVE_HEAD(&free_head, entries);
+    }
+    return entry;
+}
+
+/**
+ * @brief Return entry to tag entry pool.
+ *
+ * @param entry Tag entry previously taken with log_entry_alloc().
+ */
+static inline void log_entry_free(Log_entry *entry)
 {
-    Log_cached_entry tmp = cache_state.cache[i];
-    cache_state.cache[i] = cache_state.cache[j];
-    cache_state.cache[j] = tmp;
+    SLIST_INSERT_HEAD(&free_head, entry, entries);
 }
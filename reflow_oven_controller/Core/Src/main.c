@@ -26,10 +26,38 @@
 #include "string.h"
 #include "printf.h"
 #include "uart.h"
+#include "usb_cdc.h"
+#include "rtt.h"
 #include "console.h"
 #include "cmd.h"
 #include "log.h"
 #include "reflow.h"
+#include "prof.h"
+#include "scope.h"
+#include "param.h"
+#include "sys.h"
+#include "trace.h"
+#include "evlog.h"
+#include "rtc.h"
+#include "irq.h"
+#include "power.h"
+#include "clock.h"
+#include "active.h"
+#include "nvs.h"
+#include "heater.h"
+#include "wdg.h"
+#include "safety.h"
+#include "archive.h"
+#include "bench.h"
+#include "spibus.h"
+#include "work.h"
+#include "cyclic.h"
+#include "bgjob.h"
+#include "modbus.h"
+#include "can.h"
+#include "fwup.h"
+#include "stackguard.h"
+#include "telemetry.h"
 /* USER CODE END Includes */
 
 /* Private typedef -----------------------------------------------------------*/
@@ -48,8 +76,14 @@
 
 /* Private variables ---------------------------------------------------------*/
 SPI_HandleTypeDef hspi2;
+DMA_HandleTypeDef hdma_spi2_rx;
+DMA_HandleTypeDef hdma_spi2_tx;
+SPI_HandleTypeDef hspi3;
+DMA_HandleTypeDef hdma_spi3_tx;
 
 TIM_HandleTypeDef htim3;
+TIM_HandleTypeDef htim6;
+TIM_HandleTypeDef htim15;
 
 /* Definitions for defaultTask */
 osThreadId_t defaultTaskHandle;
@@ -60,27 +94,100 @@ const osThreadAttr_t defaultTask_attributes = {
 };
 /* USER CODE BEGIN PV */
 
-static const Reflow_cfg_t reflow_cfg =
+static const Reflow_cfg_t reflow_cfg[] =
 {
-		.pwm_timer_handle = &htim3,   // PWM Timer handle.
-		.pwm_channel = TIM_CHANNEL_1,					// PWM Timer channel.
-		.max_cfg = { // MAX31855K Thermocouple IC configuration structure.
-						.hspi = &hspi2,
-						.max_cs_port = MAX_CS_GPIO_Port,
-						.max_cs_pin = MAX_CS_Pin
-					}
+	{ // Oven 0.
+			.num_zones = 1,
+			.zones = { // Heater zones.
+						{
+							.name = "MAIN",
+							.heater = {
+								.drive = HEATER_PWM,              // HEATER_PWM_SCHED, or HEATER_BURST/HEATER_PHASE for AC heaters with zero-cross detector.
+								.pwm_timer_handle = &htim3,       // PWM Timer handle.
+								.pwm_channel = TIM_CHANNEL_1,     // PWM Timer channel.
+								.sched_dma = DMA1,                // TIM3_UP DMA request (HEATER_PWM_SCHED).
+								.sched_dma_channel = LL_DMA_CHANNEL_3,
+								.sched_dma_request = LL_DMA_REQUEST_5,
+								.phase_channel = TIM_CHANNEL_2,   // Phase-angle gate channel (HEATER_PHASE), TIM2_CH2 on PA1.
+								.ssr_port = GPIOA,                // Burst-fire SSR GPIO on TIM3_CH1 pin, GPIO_PIN_1 for phase-angle gate.
+								.ssr_pin = GPIO_PIN_6,
+								.watts = 0.0f                     // Rated power (W) to stagger and budget with other PWM zones.
+							},
+							.thermocouple = 0
+						}
+					 },
+			.has_fan = true,
+			.fan = { // Convection fan SSR or driver on spare TIM3 channel.
+						.drive = HEATER_PWM,
+						.pwm_timer_handle = &htim3,
+						.pwm_channel = TIM_CHANNEL_2      // TIM3_CH2 on PA7 (D11 on Nucleo header).
+				   },
+			.sample_timer_handle = &htim6, // Hardware sampling timer handle.
+			.num_thermocouples = 1,
+			.max_cfg = { // MAX31855K Thermocouple IC configuration structures.
+						{
+							.hspi = &hspi2,
+	#if MAX31855K_HW_NSS
+							.max_cs_port = NULL // SPI2 NSS output frames each read.
+	#else
+							.max_cs_port = MAX_CS_GPIO_Port,
+							.max_cs_pin = MAX_CS_Pin
+	#endif
+						}
+					   }
+	}
+};
+_Static_assert(ARRAY_SIZE(reflow_cfg) == REFLOW_NUM_OVENS, "Configure every oven");
+
+/* Peripherals whose timing the clock manager keeps when the system clock changes. */
+static const clock_cfg_t clock_cfg =
+{
+		.uarts = {USART2,          // Console.
+#if UART_TELEMETRY_ENABLE
+		          USART1,          // Telemetry.
+#endif
+#if MODBUS_ENABLE
+		          USART3,          // Modbus line.
+#endif
+		         },
+		.spis = {&hspi2, &hspi3},  // Thermocouples and archive flash.
+		.tims = {&htim3, &htim6, &htim15}, // Heater PWM, sampling timer and rate group base timer.
+#if CAN_ENABLE
+		.can = CAN1                // Supervisor bus.
+#endif
+};
+
+/* External SPI NOR flash holding the run archive. */
+static const archive_cfg_t archive_cfg =
+{
+		.hspi = &hspi3,
+		.cs_port = FLASH_CS_GPIO_Port,
+		.cs_pin = FLASH_CS_Pin
+};
+
+/* Rate groups, released by TIM15 updates. */
+static const cyclic_cfg_t cyclic_cfg =
+{
+		.timer_handle = &htim15 // 10 kHz count, 100 Hz update (MX_TIM15_Init()).
 };
 /* USER CODE END PV */
 
 /* Private function prototypes -----------------------------------------------*/
 void SystemClock_Config(void);
 static void MX_GPIO_Init(void);
+static void MX_DMA_Init(void);
 static void MX_USART2_UART_Init(void);
 static void MX_TIM3_Init(void);
 static void MX_SPI2_Init(void);
+static void MX_TIM6_Init(void);
+static void MX_TIM15_Init(void);
+static void MX_SPI3_Init(void);
 void StartDefaultTask(void *argument);
 
 /* USER CODE BEGIN PFP */
+#if UART_TELEMETRY_ENABLE
+static void telemetry_uart_init(void);
+#endif
 
 /* USER CODE END PFP */
 
@@ -117,13 +224,53 @@ int main(void)
 
   /* Initialize all configured peripherals */
   MX_GPIO_Init();
+  MX_DMA_Init();
   MX_USART2_UART_Init();
   MX_TIM3_Init();
   MX_SPI2_Init();
+  MX_TIM6_Init();
+  MX_TIM15_Init();
+  MX_SPI3_Init();
   /* USER CODE BEGIN 2 */
-  uart_config_t uart_cfg = {.uart_reg_base = USART2, .irq_num = USART2_IRQn};
-  uart_init(&uart_cfg);
-  uart_start();
+  irq_init();
+  spibus_init(&hspi2); // Thermocouples, archive flash keeps SPI3 to itself.
+  uart_config_t uart_cfg = {.uart_reg_base = USART2,
+                            .irq_num = USART2_IRQn,
+                            .irq_prio = IRQ_PRIO_CONSOLE,
+                            .rx_post = console_uart_post,
+                            .rx_idle = console_uart_rx_idle,
+                            .tx_dma = DMA1,
+                            .tx_dma_channel = LL_DMA_CHANNEL_7,
+                            .tx_dma_request = LL_DMA_REQUEST_2,
+                            .tx_dma_irq_num = DMA1_Channel7_IRQn,
+                            .rx_dma = DMA1,
+                            .rx_dma_channel = LL_DMA_CHANNEL_6,
+                            .rx_dma_request = LL_DMA_REQUEST_2,
+                            .rx_dma_irq_num = DMA1_Channel6_IRQn};
+#if RTT_ENABLE
+  rtt_init(); // Log sink from the first message, console transport with CONSOLE_RTT.
+#endif
+#if CONSOLE_USB_CDC
+  usb_cdc_init();
+#endif
+#if CONSOLE_UART
+  uart_init(UART_CONSOLE, &uart_cfg);
+  uart_start(UART_CONSOLE);
+#else
+  (void)uart_cfg; // USART2 stays configured but idle, console is on USB or the debug probe.
+#endif
+#if UART_TELEMETRY_ENABLE
+  telemetry_uart_init();
+  uart_config_t telemetry_cfg = {.uart_reg_base = USART1,
+                                 .irq_num = USART1_IRQn,
+                                 .irq_prio = IRQ_PRIO_TELEMETRY,
+                                 .tx_dma = DMA2,
+                                 .tx_dma_channel = LL_DMA_CHANNEL_6,
+                                 .tx_dma_request = LL_DMA_REQUEST_2,
+                                 .tx_dma_irq_num = DMA2_Channel6_IRQn}; // Transmit only.
+  uart_init(UART_TELEMETRY, &telemetry_cfg);
+  uart_start(UART_TELEMETRY);
+#endif
   HAL_GPIO_WritePin(LD2_GPIO_Port, LD2_Pin, GPIO_PIN_SET);
   /* USER CODE END 2 */
 
@@ -250,7 +397,7 @@ static void MX_SPI2_Init(void)
   hspi2.Init.CLKPolarity = SPI_POLARITY_LOW;
   hspi2.Init.CLKPhase = SPI_PHASE_1EDGE;
   hspi2.Init.NSS = SPI_NSS_SOFT;
-  hspi2.Init.BaudRatePrescaler = SPI_BAUDRATEPRESCALER_64;
+  hspi2.Init.BaudRatePrescaler = SPI_BAUDRATEPRESCALER_16;
   hspi2.Init.FirstBit = SPI_FIRSTBIT_MSB;
   hspi2.Init.TIMode = SPI_TIMODE_DISABLE;
   hspi2.Init.CRCCalculation = SPI_CRCCALCULATION_DISABLE;
@@ -262,11 +409,60 @@ static void MX_SPI2_Init(void)
     Error_Handler();
   }
   /* USER CODE BEGIN SPI2_Init 2 */
+#if MAX31855K_HW_NSS
+  /* NSS output low while SPI2 is enabled, without pulses between frames. */
+  hspi2.Init.NSS = SPI_NSS_HARD_OUTPUT;
+  hspi2.Init.NSSPMode = SPI_NSS_PULSE_DISABLE;
+  if (HAL_SPI_Init(&hspi2) != HAL_OK)
+  {
+    Error_Handler();
+  }
+#endif
 
   /* USER CODE END SPI2_Init 2 */
 
 }
 
+/**
+  * @brief SPI3 Initialization Function
+  * @param None
+  * @retval None
+  */
+static void MX_SPI3_Init(void)
+{
+
+  /* USER CODE BEGIN SPI3_Init 0 */
+
+  /* USER CODE END SPI3_Init 0 */
+
+  /* USER CODE BEGIN SPI3_Init 1 */
+
+  /* USER CODE END SPI3_Init 1 */
+  /* SPI3 parameter configuration*/
+  hspi3.Instance = SPI3;
+  hspi3.Init.Mode = SPI_MODE_MASTER;
+  hspi3.Init.Direction = SPI_DIRECTION_2LINES;
+  hspi3.Init.DataSize = SPI_DATASIZE_8BIT;
+  hspi3.Init.CLKPolarity = SPI_POLARITY_LOW;
+  hspi3.Init.CLKPhase = SPI_PHASE_1EDGE;
+  hspi3.Init.NSS = SPI_NSS_SOFT;
+  hspi3.Init.BaudRatePrescaler = SPI_BAUDRATEPRESCALER_4;
+  hspi3.Init.FirstBit = SPI_FIRSTBIT_MSB;
+  hspi3.Init.TIMode = SPI_TIMODE_DISABLE;
+  hspi3.Init.CRCCalculation = SPI_CRCCALCULATION_DISABLE;
+  hspi3.Init.CRCPolynomial = 7;
+  hspi3.Init.CRCLength = SPI_CRC_LENGTH_DATASIZE;
+  hspi3.Init.NSSPMode = SPI_NSS_PULSE_DISABLE;
+  if (HAL_SPI_Init(&hspi3) != HAL_OK)
+  {
+    Error_Handler();
+  }
+  /* USER CODE BEGIN SPI3_Init 2 */
+
+  /* USER CODE END SPI3_Init 2 */
+
+}
+
 /**
   * @brief TIM3 Initialization Function
   * @param None
@@ -320,12 +516,94 @@ static void MX_TIM3_Init(void)
     Error_Handler();
   }
   /* USER CODE BEGIN TIM3_Init 2 */
+  /* Cooling fan output, same PWM settings as heater channel. */
+  if (HAL_TIM_PWM_ConfigChannel(&htim3, &sConfigOC, TIM_CHANNEL_2) != HAL_OK)
+  {
+    Error_Handler();
+  }
 
   /* USER CODE END TIM3_Init 2 */
   HAL_TIM_MspPostInit(&htim3);
 
 }
 
+/**
+  * @brief TIM6 Initialization Function
+  * @param None
+  * @retval None
+  */
+static void MX_TIM6_Init(void)
+{
+
+  /* USER CODE BEGIN TIM6_Init 0 */
+
+  /* USER CODE END TIM6_Init 0 */
+
+  TIM_MasterConfigTypeDef sMasterConfig = {0};
+
+  /* USER CODE BEGIN TIM6_Init 1 */
+
+  /* USER CODE END TIM6_Init 1 */
+  htim6.Instance = TIM6;
+  htim6.Init.Prescaler = 8000 - 1;
+  htim6.Init.CounterMode = TIM_COUNTERMODE_UP;
+  htim6.Init.Period = 5000 - 1;
+  htim6.Init.AutoReloadPreload = TIM_AUTORELOAD_PRELOAD_DISABLE;
+  if (HAL_TIM_Base_Init(&htim6) != HAL_OK)
+  {
+    Error_Handler();
+  }
+  sMasterConfig.MasterOutputTrigger = TIM_TRGO_UPDATE;
+  sMasterConfig.MasterSlaveMode = TIM_MASTERSLAVEMODE_DISABLE;
+  if (HAL_TIMEx_MasterConfigSynchronization(&htim6, &sMasterConfig) != HAL_OK)
+  {
+    Error_Handler();
+  }
+  /* USER CODE BEGIN TIM6_Init 2 */
+
+  /* USER CODE END TIM6_Init 2 */
+
+}
+
+/**
+  * @brief TIM15 Initialization Function
+  * @param None
+  * @retval None
+  */
+static void MX_TIM15_Init(void)
+{
+
+  /* USER CODE BEGIN TIM15_Init 0 */
+
+  /* USER CODE END TIM15_Init 0 */
+
+  TIM_ClockConfigTypeDef sClockSourceConfig = {0};
+
+  /* USER CODE BEGIN TIM15_Init 1 */
+
+  /* USER CODE END TIM15_Init 1 */
+  htim15.Instance = TIM15;
+  htim15.Init.Prescaler = 8000 - 1;
+  htim15.Init.CounterMode = TIM_COUNTERMODE_UP;
+  htim15.Init.Period = 100 - 1;
+  htim15.Init.ClockDivision = TIM_CLOCKDIVISION_DIV1;
+  htim15.Init.RepetitionCounter = 0;
+  htim15.Init.AutoReloadPreload = TIM_AUTORELOAD_PRELOAD_DISABLE;
+  if (HAL_TIM_Base_Init(&htim15) != HAL_OK)
+  {
+    Error_Handler();
+  }
+  sClockSourceConfig.ClockSource = TIM_CLOCKSOURCE_INTERNAL;
+  if (HAL_TIM_ConfigClockSource(&htim15, &sClockSourceConfig) != HAL_OK)
+  {
+    Error_Handler();
+  }
+  /* USER CODE BEGIN TIM15_Init 2 */
+
+  /* USER CODE END TIM15_Init 2 */
+
+}
+
 /**
   * @brief USART2 Initialization Function
   * @param None
@@ -377,6 +655,29 @@ static void MX_USART2_UART_Init(void)
 
 }
 
+/**
+  * Enable DMA controller clock
+  */
+static void MX_DMA_Init(void)
+{
+
+  /* DMA controller clock enable */
+  __HAL_RCC_DMA1_CLK_ENABLE();
+  __HAL_RCC_DMA2_CLK_ENABLE();
+
+  /* DMA interrupt init */
+  /* DMA1_Channel4_IRQn interrupt configuration */
+  HAL_NVIC_SetPriority(DMA1_Channel4_IRQn, 5, 0);
+  HAL_NVIC_EnableIRQ(DMA1_Channel4_IRQn);
+  /* DMA1_Channel5_IRQn interrupt configuration */
+  HAL_NVIC_SetPriority(DMA1_Channel5_IRQn, 5, 0);
+  HAL_NVIC_EnableIRQ(DMA1_Channel5_IRQn);
+  /* DMA2_Channel2_IRQn interrupt configuration */
+  HAL_NVIC_SetPriority(DMA2_Channel2_IRQn, 5, 0);
+  HAL_NVIC_EnableIRQ(DMA2_Channel2_IRQn);
+
+}
+
 /**
   * @brief GPIO Initialization Function
   * @param None
@@ -398,6 +699,9 @@ static void MX_GPIO_Init(void)
   /*Configure GPIO pin Output Level */
   HAL_GPIO_WritePin(MAX_CS_GPIO_Port, MAX_CS_Pin, GPIO_PIN_RESET);
 
+  /*Configure GPIO pin Output Level */
+  HAL_GPIO_WritePin(FLASH_CS_GPIO_Port, FLASH_CS_Pin, GPIO_PIN_SET);
+
   /*Configure GPIO pin : B1_Pin */
   GPIO_InitStruct.Pin = B1_Pin;
   GPIO_InitStruct.Mode = GPIO_MODE_IT_FALLING;
@@ -418,9 +722,55 @@ static void MX_GPIO_Init(void)
   GPIO_InitStruct.Speed = GPIO_SPEED_FREQ_LOW;
   HAL_GPIO_Init(MAX_CS_GPIO_Port, &GPIO_InitStruct);
 
+  /*Configure GPIO pin : FLASH_CS_Pin */
+  GPIO_InitStruct.Pin = FLASH_CS_Pin;
+  GPIO_InitStruct.Mode = GPIO_MODE_OUTPUT_PP;
+  GPIO_InitStruct.Pull = GPIO_NOPULL;
+  GPIO_InitStruct.Speed = GPIO_SPEED_FREQ_HIGH;
+  HAL_GPIO_Init(FLASH_CS_GPIO_Port, &GPIO_InitStruct);
+
 }
 
 /* USER CODE BEGIN 4 */
+#if UART_TELEMETRY_ENABLE
+/**
+  * @brief USART1 Initialization Function, binary telemetry port
+  * @param None
+  * @retval None
+  */
+static void telemetry_uart_init(void)
+{
+  LL_USART_InitTypeDef USART_InitStruct = {0};
+
+  LL_GPIO_InitTypeDef GPIO_InitStruct = {0};
+
+  /* Peripheral clock enable */
+  LL_APB2_GRP1_EnableClock(LL_APB2_GRP1_PERIPH_USART1);
+
+  LL_AHB2_GRP1_EnableClock(LL_AHB2_GRP1_PERIPH_GPIOB);
+  /**USART1 GPIO Configuration
+  PB6   ------> USART1_TX
+  */
+  GPIO_InitStruct.Pin = LL_GPIO_PIN_6;
+  GPIO_InitStruct.Mode = LL_GPIO_MODE_ALTERNATE;
+  GPIO_InitStruct.Speed = LL_GPIO_SPEED_FREQ_VERY_HIGH;
+  GPIO_InitStruct.OutputType = LL_GPIO_OUTPUT_PUSHPULL;
+  GPIO_InitStruct.Pull = LL_GPIO_PULL_NO;
+  GPIO_InitStruct.Alternate = LL_GPIO_AF_7;
+  LL_GPIO_Init(GPIOB, &GPIO_InitStruct);
+
+  USART_InitStruct.BaudRate = UART_TELEMETRY_BAUD;
+  USART_InitStruct.DataWidth = LL_USART_DATAWIDTH_8B;
+  USART_InitStruct.StopBits = LL_USART_STOPBITS_1;
+  USART_InitStruct.Parity = LL_USART_PARITY_NONE;
+  USART_InitStruct.TransferDirection = LL_USART_DIRECTION_TX;
+  USART_InitStruct.HardwareFlowControl = LL_USART_HWCONTROL_NONE;
+  USART_InitStruct.OverSampling = LL_USART_OVERSAMPLING_16;
+  LL_USART_Init(USART1, &USART_InitStruct);
+  LL_USART_ConfigAsyncMode(USART1);
+  LL_USART_Enable(USART1);
+}
+#endif
 
 /* USER CODE END 4 */
 
@@ -435,15 +785,59 @@ void StartDefaultTask(void *argument)
 {
   /* USER CODE BEGIN 5 */
 
+    /* Reflow controller first, so heater outputs are driven again soon after a reset.
+       Log records are captured until the log thread starts. */
+    sys_boot_begin(SYS_BOOT_CONTROL);
+    Active_init();
+    work_init();
+    cyclic_init(&cyclic_cfg);
+    wdg_init();
+    stackguard_init();
+    nvs_init();
+    param_init();
+    heater_init();
+    analog_init();
+    safety_init();
+    for (uint8_t oven = 0; oven < REFLOW_NUM_OVENS; oven++)
+    {
+        reflow_init(oven, &reflow_cfg[oven]);
+        reflow_start(oven);
+    }
+    sys_boot_end(SYS_BOOT_CONTROL);
+
+    sys_boot_begin(SYS_BOOT_CONSOLE);
+    log_init();
+    log_load_levels();
+    param_load();
     console_init();
+#if UART_TELEMETRY_ENABLE
+    telemetry_init();
+#endif
     cmd_init();
-    log_init();
-
-    reflow_init(&reflow_cfg);
-
     console_start();
     cmd_start();
-    reflow_start();
+    modbus_port_init(); // Frames are posted to the command active object.
+    can_init();         // Likewise, at the node ID loaded above.
+    log_start();
+    sys_boot_end(SYS_BOOT_CONSOLE);
+
+    /* Clock drops to CLOCK_LOW last, boot stages are timed at full speed. */
+    sys_boot_begin(SYS_BOOT_SERVICES);
+    prof_init();
+    scope_init();
+    bgjob_init();
+    fwup_init();
+    bench_init();
+    sys_init();
+    trace_init();
+    evlog_init();
+    archive_init(&archive_cfg);
+    rtc_init();
+    power_init();
+    clock_init(&clock_cfg);
+    sys_boot_end(SYS_BOOT_SERVICES);
+
+    sys_boot_report();
 
     osThreadTerminate(defaultTaskHandle);
     /* Infinite loop */
@@ -472,6 +866,8 @@ void HAL_TIM_PeriodElapsedCallback(TIM_HandleTypeDef *htim)
     HAL_IncTick();
   }
   /* USER CODE BEGIN Callback 1 */
+  reflow_sample_timer_elapsed(htim);
+  cyclic_timer_elapsed(htim);
 
   /* USER CODE END Callback 1 */
 }
@@ -0,0 +1,506 @@
+/**
+ * @file modbus.c
+ * @author Timothy Nguyen
+ * @brief Modbus RTU slave: register map of the parameter registry and controller status.
+ * @version 0.1
+ * @date 2021-09-06
+ */
+
+#include <ctype.h>
+#include <math.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "modbus.h"
+#include "reflow.h"
+#include "safety.h"
+#include "MAX31855K.h"
+#include "param.h"
+#include "cmd.h"
+#include "log.h"
+
+////////////////////////////////////////////////////////////////////////////////
+// Common macros
+////////////////////////////////////////////////////////////////////////////////
+
+#define MODBUS_NUM_COILS 1U           // Coils mapped.
+#define MODBUS_NUM_DISCRETE 3U        // Discrete inputs mapped.
+#define MODBUS_NUM_HOLDING (2U * NUM_PARAMS) // Holding registers mapped, a pair per parameter ID.
+#define MODBUS_MAX_READ_BITS 2000U    // Most coils or discrete inputs read per request.
+#define MODBUS_MAX_READ_REGS 125U     // Most registers read per request.
+#define MODBUS_MAX_WRITE_BITS 1968U   // Most coils written per request.
+#define MODBUS_MAX_WRITE_REGS 123U    // Most registers written per request.
+#define MODBUS_COIL_ON 0xFF00U        // Value of a single coil write setting it.
+
+_Static_assert(REFLOW_MAX_ZONES == MODBUS_IR_ZONE_OUT - MODBUS_IR_ZONE_TEMP, "Input register map holds every zone");
+_Static_assert(2U + 2U * MODBUS_MAX_READ_REGS + 3U <= MODBUS_ADU_MAX, "Largest response fits a frame");
+
+////////////////////////////////////////////////////////////////////////////////
+// Private (static) function declarations
+////////////////////////////////////////////////////////////////////////////////
+
+static uint32_t modbus_req_cmd(uint32_t argc, const char **argv); // Execute request given in hex, print response.
+
+static uint8_t modbus_read_bits(uint8_t fc, const uint8_t *pdu, size_t len, uint8_t *data, size_t *data_len);
+static uint8_t modbus_read_regs(uint8_t fc, const uint8_t *pdu, size_t len, uint8_t *data, size_t *data_len);
+static uint8_t modbus_write_coils(uint8_t fc, const uint8_t *pdu, size_t len, uint8_t *data, size_t *data_len);
+static uint8_t modbus_write_regs(uint8_t fc, const uint8_t *pdu, size_t len, uint8_t *data, size_t *data_len);
+static void modbus_input_regs(uint16_t *regs, bool *bits);          // Fill input registers and discrete inputs from status.
+static uint16_t modbus_temp(float temp);                             // Temperature as input register.
+static inline uint16_t get16(const uint8_t *p);                      // Big-endian register.
+static inline void put16(uint8_t *p, uint16_t val);
+
+////////////////////////////////////////////////////////////////////////////////
+// Private (static) variables
+////////////////////////////////////////////////////////////////////////////////
+
+/* Slave address, 32-bit so the port's interrupt reads it atomically */
+static uint32_t slave_addr = MODBUS_ADDR;
+PARAM_DEFINE(PARAM_MODBUS_ADDR, "modbus.addr", PARAM_U32, &slave_addr, PARAM_FLAG_PERSIST,
+             .def.u = MODBUS_ADDR, .min.u = 1U, .max.u = 247U);
+
+/* CRC-16 of a nibble, reflected polynomial 0xA001 */
+static const uint16_t crc_nibble[16] = {0x0000U, 0xCC01U, 0xD801U, 0x1400U, 0xF001U, 0x3C00U, 0x2800U, 0xE401U,
+                                        0xA001U, 0x6C00U, 0x7800U, 0xB401U, 0x5000U, 0x9C01U, 0x8801U, 0x4400U};
+
+/* Response of the request being executed */
+static uint8_t rsp_buf[MODBUS_ADU_MAX];
+
+/* Frame counters, indexed by modbus_cnt_t */
+static uint32_t cnts[MODBUS_NUM_CNTS];
+
+static cmd_cmd_info modbus_cmds[] = {
+    {.cmd_name = "req",
+     .cb = modbus_req_cmd,
+     .help = "Execute request as if received from the line and print the response, CRC is appended.\r\n"
+             "Usage: modbus req <hex bytes from address>, eg. modbus req 01040000000b"}};
+
+static const cmd_pm_info modbus_pm_info[] = {
+    {"requests", CMD_PM_U32, &cnts[MODBUS_CNT_REQUESTS]},
+    {"exceptions", CMD_PM_U32, &cnts[MODBUS_CNT_EXCEPTIONS]},
+    {"CRC errors", CMD_PM_U32, &cnts[MODBUS_CNT_CRC]},
+    {"other slaves", CMD_PM_U32, &cnts[MODBUS_CNT_OTHER]},
+    {"RX errors", CMD_PM_U32, &cnts[MODBUS_CNT_RX_ERR]},
+    {"RX drops", CMD_PM_U32, &cnts[MODBUS_CNT_RX_DROP]},
+    {"TX drops", CMD_PM_U32, &cnts[MODBUS_CNT_TX_DROP]},
+};
+
+_Static_assert(ARRAY_SIZE(modbus_pm_info) == MODBUS_NUM_CNTS, "modbus_pm_info out of sync with modbus_cnt_t");
+
+CMD_CLIENT_DEFINE(modbus,
+                  .num_cmds = ARRAY_SIZE(modbus_cmds),
+                  .cmds = modbus_cmds,
+                  .num_pms = ARRAY_SIZE(modbus_pm_info),
+                  .pms = modbus_pm_info);
+
+/* Unique tag for logging module */
+LOG_TAG_DEFINE("MODBUS");
+
+////////////////////////////////////////////////////////////////////////////////
+// Public (global) functions
+////////////////////////////////////////////////////////////////////////////////
+
+uint8_t modbus_addr(void)
+{
+    return (uint8_t)slave_addr;
+}
+
+void modbus_count(modbus_cnt_t cnt)
+{
+    INC_SAT_U32(cnts[cnt]);
+}
+
+void modbus_execute(Modbus_Event const *const evt)
+{
+    size_t len = modbus_process(evt->adu, evt->len, rsp_buf);
+    if (len > 0 && modbus_port_send(rsp_buf, len) != MOD_OK)
+    {
+        modbus_count(MODBUS_CNT_TX_DROP);
+    }
+}
+
+size_t modbus_process(const uint8_t *req, size_t len, uint8_t *rsp)
+{
+    if (len < 4U || len > MODBUS_ADU_MAX ||
+        modbus_crc16(req, len - 2U) != (uint16_t)(req[len - 2U] | (req[len - 1U] << 8)))
+    {
+        modbus_count(MODBUS_CNT_CRC);
+        return 0;
+    }
+    uint8_t addr = req[0];
+    if (addr != 0U && addr != slave_addr)
+    {
+        return 0;
+    }
+    modbus_count(MODBUS_CNT_REQUESTS);
+
+    /* Function code and its data, without address and CRC. */
+    uint8_t fc = req[1];
+    const uint8_t *pdu = &req[2];
+    size_t pdu_len = len - 4U;
+    size_t data_len = 0;
+    uint8_t ex;
+    switch (fc)
+    {
+    case MODBUS_FC_READ_COILS:
+    case MODBUS_FC_READ_DISCRETE:
+        ex = modbus_read_bits(fc, pdu, pdu_len, &rsp[2], &data_len);
+        break;
+    case MODBUS_FC_READ_HOLDING:
+    case MODBUS_FC_READ_INPUT:
+        ex = modbus_read_regs(fc, pdu, pdu_len, &rsp[2], &data_len);
+        break;
+    case MODBUS_FC_WRITE_COIL:
+    case MODBUS_FC_WRITE_COILS:
+        ex = modbus_write_coils(fc, pdu, pdu_len, &rsp[2], &data_len);
+        break;
+    case MODBUS_FC_WRITE_REGISTER:
+    case MODBUS_FC_WRITE_REGISTERS:
+        ex = modbus_write_regs(fc, pdu, pdu_len, &rsp[2], &data_len);
+        break;
+    default:
+        ex = MODBUS_EX_ILLEGAL_FUNCTION;
+        break;
+    }
+
+    if (addr == 0U)
+    {
+        return 0;
+    }
+    rsp[0] = addr;
+    rsp[1] = fc;
+    if (ex != 0U)
+    {
+        modbus_count(MODBUS_CNT_EXCEPTIONS);
+        rsp[1] |= 0x80U;
+        rsp[2] = ex;
+        data_len = 1U;
+    }
+    size_t rsp_len = 2U + data_len;
+    uint16_t crc = modbus_crc16(rsp, rsp_len);
+    rsp[rsp_len++] = (uint8_t)crc;
+    rsp[rsp_len++] = (uint8_t)(crc >> 8);
+    return rsp_len;
+}
+
+uint16_t modbus_crc16(const uint8_t *data, size_t len)
+{
+    uint16_t crc = 0xFFFFU;
+    for (size_t i = 0; i < len; i++)
+    {
+        crc ^= data[i];
+        crc = (crc >> 4) ^ crc_nibble[crc & 0x0FU];
+        crc = (crc >> 4) ^ crc_nibble[crc & 0x0FU];
+    }
+    return crc;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Private (static) function definitions
+////////////////////////////////////////////////////////////////////////////////
+
+/**
+ * @brief Read coils or discrete inputs, packed LSB first.
+ *
+ * @param fc Function code.
+ * @param pdu Request data after the function code.
+ * @param len Length of request data (bytes).
+ * @param[out] data Response data after the function code.
+ * @param[out] data_len Length of response data (bytes).
+ *
+ * @return 0 if successful, otherwise the exception code.
+ */
+static uint8_t modbus_read_bits(uint8_t fc, const uint8_t *pdu, size_t len, uint8_t *data, size_t *data_len)
+{
+    if (len != 4U)
+    {
+        return MODBUS_EX_ILLEGAL_VALUE;
+    }
+    uint16_t start = get16(&pdu[0]);
+    uint16_t qty = get16(&pdu[2]);
+    uint32_t num = fc == MODBUS_FC_READ_COILS ? MODBUS_NUM_COILS : MODBUS_NUM_DISCRETE;
+    if (qty == 0U || qty > MODBUS_MAX_READ_BITS)
+    {
+        return MODBUS_EX_ILLEGAL_VALUE;
+    }
+    if ((uint32_t)start + qty > num)
+    {
+        return MODBUS_EX_ILLEGAL_ADDRESS;
+    }
+
+    /* The RUN coil reads as the running discrete input. */
+    uint16_t regs[MODBUS_NUM_IR];
+    bool bits[MODBUS_NUM_DISCRETE];
+    modbus_input_regs(regs, bits);
+    uint8_t num_bytes = (uint8_t)((qty + 7U) / 8U);
+    data[0] = num_bytes;
+    memset(&data[1], 0, num_bytes);
+    for (uint16_t i = 0; i < qty; i++)
+    {
+        if (bits[start + i])
+        {
+            data[1U + i / 8U] |= (uint8_t)(1U << (i % 8U));
+        }
+    }
+    *data_len = 1U + num_bytes;
+    return 0;
+}
+
+/**
+ * @brief Read holding registers, from parameters, or input registers, from the status snapshot.
+ *
+ * @return 0 if successful, otherwise the exception code.
+ */
+static uint8_t modbus_read_regs(uint8_t fc, const uint8_t *pdu, size_t len, uint8_t *data, size_t *data_len)
+{
+    if (len != 4U)
+    {
+        return MODBUS_EX_ILLEGAL_VALUE;
+    }
+    uint16_t start = get16(&pdu[0]);
+    uint16_t qty = get16(&pdu[2]);
+    uint32_t num = fc == MODBUS_FC_READ_HOLDING ? MODBUS_NUM_HOLDING : MODBUS_NUM_IR;
+    if (qty == 0U || qty > MODBUS_MAX_READ_REGS)
+    {
+        return MODBUS_EX_ILLEGAL_VALUE;
+    }
+    if ((uint32_t)start + qty > num)
+    {
+        return MODBUS_EX_ILLEGAL_ADDRESS;
+    }
+
+    data[0] = (uint8_t)(2U * qty);
+    if (fc == MODBUS_FC_READ_INPUT)
+    {
+        uint16_t regs[MODBUS_NUM_IR];
+        bool bits[MODBUS_NUM_DISCRETE];
+        modbus_input_regs(regs, bits);
+        for (uint16_t i = 0; i < qty; i++)
+        {
+            put16(&data[1U + 2U * i], regs[start + i]);
+        }
+    }
+    else
+    {
+        for (uint16_t i = 0; i < qty; i++)
+        {
+            uint32_t reg = (uint32_t)start + i;
+            param_def_t const *def = param_find(reg / 2U);
+            if (def == NULL)
+            {
+                return MODBUS_EX_ILLEGAL_ADDRESS;
+            }
+            uint32_t raw = param_get(def).u;
+            put16(&data[1U + 2U * i], (uint16_t)((reg & 1U) ? raw : raw >> 16));
+        }
+    }
+    *data_len = 1U + 2U * qty;
+    return 0;
+}
+
+/**
+ * @brief Write RUN coil, starting or stopping a reflow process.
+ *
+ * @return 0 if successful, otherwise the exception code.
+ */
+static uint8_t modbus_write_coils(uint8_t fc, const uint8_t *pdu, size_t len, uint8_t *data, size_t *data_len)
+{
+    if (len < 4U)
+    {
+        return MODBUS_EX_ILLEGAL_VALUE;
+    }
+    uint16_t start = get16(&pdu[0]);
+    bool run;
+    if (fc == MODBUS_FC_WRITE_COIL)
+    {
+        uint16_t val = get16(&pdu[2]);
+        if (len != 4U || (val != MODBUS_COIL_ON && val != 0U))
+        {
+            return MODBUS_EX_ILLEGAL_VALUE;
+        }
+        if (start >= MODBUS_NUM_COILS)
+        {
+            return MODBUS_EX_ILLEGAL_ADDRESS;
+        }
+        run = val == MODBUS_COIL_ON;
+    }
+    else
+    {
+        uint16_t qty = get16(&pdu[2]);
+        if (len < 5U || qty == 0U || qty > MODBUS_MAX_WRITE_BITS || pdu[4] != (qty + 7U) / 8U || len != 5U + pdu[4])
+        {
+            return MODBUS_EX_ILLEGAL_VALUE;
+        }
+        if ((uint32_t)start + qty > MODBUS_NUM_COILS)
+        {
+            return MODBUS_EX_ILLEGAL_ADDRESS;
+        }
+        run = (pdu[5] & 1U) != 0U;
+    }
+
+    if (reflow_post_run(MODBUS_OVEN, run) != MOD_OK)
+    {
+        return MODBUS_EX_DEVICE_FAILURE;
+    }
+    LOGI(TAG, "%s requested", run ? "Start" : "Stop");
+
+    /* Both responses echo the first four bytes: address and value, or address and quantity. */
+    memcpy(data, pdu, 4U);
+    *data_len = 4U;
+    return 0;
+}
+
+/**
+ * @brief Write parameters, each a whole register pair.
+ *
+ * Pairs are set in order, a pair out of range ends the request with the pairs before it set.
+ *
+ * @return 0 if successful, otherwise the exception code.
+ */
+static uint8_t modbus_write_regs(uint8_t fc, const uint8_t *pdu, size_t len, uint8_t *data, size_t *data_len)
+{
+    if (fc == MODBUS_FC_WRITE_REGISTER)
+    {
+        return len == 4U ? MODBUS_EX_ILLEGAL_ADDRESS : MODBUS_EX_ILLEGAL_VALUE;
+    }
+    if (len < 5U)
+    {
+        return MODBUS_EX_ILLEGAL_VALUE;
+    }
+    uint16_t start = get16(&pdu[0]);
+    uint16_t qty = get16(&pdu[2]);
+    if (qty == 0U || qty > MODBUS_MAX_WRITE_REGS || pdu[4] != 2U * qty || len != 5U + pdu[4])
+    {
+        return MODBUS_EX_ILLEGAL_VALUE;
+    }
+    if ((start & 1U) != 0U || (qty & 1U) != 0U || (uint32_t)start + qty > MODBUS_NUM_HOLDING)
+    {
+        return MODBUS_EX_ILLEGAL_ADDRESS;
+    }
+    for (uint16_t i = 0; i < qty; i += 2U)
+    {
+        if (param_find((start + i) / 2U) == NULL)
+        {
+            return MODBUS_EX_ILLEGAL_ADDRESS;
+        }
+    }
+
+    for (uint16_t i = 0; i < qty; i += 2U)
+    {
+        param_def_t const *def = param_find((start + i) / 2U);
+        param_val_t val = {.u = ((uint32_t)get16(&pdu[5U + 2U * i]) << 16) | get16(&pdu[7U + 2U * i])};
+        mod_err_t err = param_set(def, val);
+        if (err == MOD_ERR_ARG)
+        {
+            return MODBUS_EX_ILLEGAL_VALUE;
+        }
+        else if (err != MOD_OK)
+        {
+            return MODBUS_EX_DEVICE_FAILURE;
+        }
+    }
+    memcpy(data, pdu, 4U);
+    *data_len = 4U;
+    return 0;
+}
+
+/**
+ * @brief Fill input registers and discrete inputs from the status snapshot.
+ *
+ * @param[out] regs Input registers, MODBUS_NUM_IR.
+ * @param[out] bits Discrete inputs, MODBUS_NUM_DISCRETE.
+ */
+static void modbus_input_regs(uint16_t *regs, bool *bits)
+{
+    Reflow_Status snap;
+    reflow_status_get(MODBUS_OVEN, &snap);
+
+    regs[MODBUS_IR_STATE] = snap.state;
+    regs[MODBUS_IR_SEGMENT] = snap.segment;
+    regs[MODBUS_IR_SETPOINT] = modbus_temp(snap.setpoint);
+    regs[MODBUS_IR_TEMP] = modbus_temp(snap.temp);
+    regs[MODBUS_IR_ERR] = snap.err;
+    regs[MODBUS_IR_NUM_ZONES] = snap.num_zones;
+    regs[MODBUS_IR_ACQ_HI] = (uint16_t)(snap.acq_count >> 16);
+    regs[MODBUS_IR_ACQ_LO] = (uint16_t)snap.acq_count;
+    regs[MODBUS_IR_COOLING] = isnan(snap.cooling_out) ? MODBUS_NAN : (uint16_t)lrintf(fmaxf(snap.cooling_out, 0.0f));
+    for (uint8_t z = 0; z < REFLOW_MAX_ZONES; z++)
+    {
+        regs[MODBUS_IR_ZONE_TEMP + z] = modbus_temp(snap.zone_temp[z]);
+        regs[MODBUS_IR_ZONE_OUT + z] = (uint16_t)lrintf(fmaxf(snap.zone_out[z], 0.0f));
+    }
+
+    bits[0] = snap.state != REFLOW_STATE_RESET;
+    bits[1] = safety_tripped(MODBUS_OVEN);
+    bits[2] = snap.err != MAX_OK;
+}
+
+/**
+ * @brief Convert temperature to signed tenths of a deg C, MODBUS_NAN if not read or out of range.
+ */
+static uint16_t modbus_temp(float temp)
+{
+    float tenths = temp * 10.0f;
+    if (!(tenths > (float)INT16_MIN && tenths <= (float)INT16_MAX))
+    {
+        return MODBUS_NAN;
+    }
+    return (uint16_t)(int16_t)lrintf(tenths);
+}
+
+static inline uint16_t get16(const uint8_t *p)
+{
+    return (uint16_t)((p[0] << 8) | p[1]);
+}
+
+static inline void put16(uint8_t *p, uint16_t val)
+{
+    p[0] = (uint8_t)(val >> 8);
+    p[1] = (uint8_t)val;
+}
+
+/**
+ * @brief Execute request given in hex, as received from the line, and output the response in hex.
+ *
+ * Hex digits may be split across arguments at byte boundaries, eg. "01 04 0000 000b".
+ */
+static uint32_t modbus_req_cmd(uint32_t argc, const char **argv)
+{
+    static uint8_t req[MODBUS_ADU_MAX];
+    size_t len = 0;
+    for (uint32_t i = 0; i < argc; i++)
+    {
+        for (const char *c = argv[i]; *c != '\0'; c += 2)
+        {
+            if (!isxdigit((unsigned char)c[0]) || !isxdigit((unsigned char)c[1]) || len >= sizeof(req) - 2U)
+            {
+                LOG("Usage: modbus req <hex bytes from address>\r\n");
+                return 1;
+            }
+            char byte[3] = {c[0], c[1], '\0'};
+            req[len++] = (uint8_t)strtoul(byte, NULL, 16);
+        }
+    }
+    if (len < 2U)
+    {
+        LOG("Usage: modbus req <hex bytes from address>\r\n");
+        return 1;
+    }
+    uint16_t crc = modbus_crc16(req, len);
+    req[len++] = (uint8_t)crc;
+    req[len++] = (uint8_t)(crc >> 8);
+
+    size_t rsp_len = modbus_process(req, len, rsp_buf);
+    static char hex[2U * MODBUS_ADU_MAX + 1U];
+    for (size_t i = 0; i < rsp_len; i++)
+    {
+        static const char digits[] = "0123456789abcdef";
+        hex[2U * i] = digits[rsp_buf[i] >> 4];
+        hex[2U * i + 1U] = digits[rsp_buf[i] & 0x0FU];
+    }
+    hex[2U * rsp_len] = '\0';
+    cmd_out_str("rsp", rsp_len > 0U ? hex : "none");
+    return 0;
+}
@@ -0,0 +1,257 @@
+/**
+ * @file modbus_port.c
+ * @author Timothy Nguyen
+ * @brief Modbus RTU line: USART3 in RS485 mode, frames received and sent by DMA.
+ * @version 0.1
+ * @date 2021-09-06
+ *
+ * The receive DMA channel fills a frame buffer while the USART receiver timeout, counting
+ * from the last stop bit, ends the frame after MODBUS_RTO_BITS of silence. Its interrupt is
+ * the only one per frame: it takes the length from the DMA channel, drops frames with line
+ * errors or for other slaves, posts the rest to the command active object and restarts the
+ * channel. Responses leave by the transmit DMA channel, the USART drives the RS485
+ * transceiver's driver enable (DE) for each character in hardware.
+ *
+ * Notes:
+ * - USART3 is configured with LL, it is not enabled within CubeMX. The uart module leaves
+ *   USART3 to this one while MODBUS_ENABLE.
+ * - The transceiver's receiver is expected to be disabled while driving (RE tied to DE),
+ *   otherwise responses are received back and dropped as frames for another slave.
+ * - The 1.5 character inter-character limit is not checked, a frame with a gap shorter
+ *   than the receiver timeout is taken whole, and one with a longer gap fails its CRC.
+ * - USART3 stops in STOP2, so the port holds a stop lock.
+ */
+
+#include <string.h>
+
+#include "modbus.h"
+#include "cmd.h"
+#include "power.h"
+#include "sections.h"
+#include "trace.h"
+#include "irq.h"
+#include "stm32l4xx_ll_usart.h"
+#include "stm32l4xx_ll_dma.h"
+#include "stm32l4xx_ll_bus.h"
+#include "stm32l4xx_ll_gpio.h"
+#include "stm32l4xx_hal.h"
+
+#if MODBUS_ENABLE
+
+////////////////////////////////////////////////////////////////////////////////
+// Common macros
+////////////////////////////////////////////////////////////////////////////////
+
+/* Receiver timeout ending a frame (bits): 3.5 characters of 11 bits, fixed 1.75 ms above 19200 baud. */
+#define MODBUS_RTO_BITS (MODBUS_BAUD > 19200U ? (1750U * MODBUS_BAUD + 999999U) / 1000000U : 39U)
+
+#define MODBUS_DE_TIME 8U // Driver enable lead and lag around each character (1/16 bit).
+
+#define MODBUS_USART USART3
+#define MODBUS_DMA DMA1
+#define MODBUS_TX_CHANNEL LL_DMA_CHANNEL_2 // USART3_TX, request 2.
+#define MODBUS_RX_CHANNEL LL_DMA_CHANNEL_3 // USART3_RX, request 2.
+
+////////////////////////////////////////////////////////////////////////////////
+// Private (static) variables
+////////////////////////////////////////////////////////////////////////////////
+
+/* Frame buffers */
+static uint8_t SRAM1_DMA rx_buf[MODBUS_ADU_MAX];
+static uint8_t SRAM1_DMA tx_buf[MODBUS_ADU_MAX];
+
+/* Line error seen in the frame being received */
+static volatile bool rx_bad;
+
+/* Port initialized */
+static bool port_ready;
+
+////////////////////////////////////////////////////////////////////////////////
+// Public (global) functions
+////////////////////////////////////////////////////////////////////////////////
+
+mod_err_t modbus_port_init(void)
+{
+    LL_APB1_GRP1_EnableClock(LL_APB1_GRP1_PERIPH_USART3);
+    LL_AHB1_GRP1_EnableClock(LL_AHB1_GRP1_PERIPH_DMA1);
+    LL_AHB2_GRP1_EnableClock(LL_AHB2_GRP1_PERIPH_GPIOB);
+    LL_AHB2_GRP1_EnableClock(LL_AHB2_GRP1_PERIPH_GPIOC);
+
+    /**USART3 GPIO Configuration
+    PC4   ------> USART3_TX
+    PC5   ------> USART3_RX
+    PB14  ------> USART3_DE
+    */
+    LL_GPIO_InitTypeDef GPIO_InitStruct = {0};
+    GPIO_InitStruct.Pin = LL_GPIO_PIN_4 | LL_GPIO_PIN_5;
+    GPIO_InitStruct.Mode = LL_GPIO_MODE_ALTERNATE;
+    GPIO_InitStruct.Speed = LL_GPIO_SPEED_FREQ_HIGH;
+    GPIO_InitStruct.OutputType = LL_GPIO_OUTPUT_PUSHPULL;
+    GPIO_InitStruct.Pull = LL_GPIO_PULL_UP; // Idle line high with the transceiver's receiver off.
+    GPIO_InitStruct.Alternate = LL_GPIO_AF_7;
+    LL_GPIO_Init(GPIOC, &GPIO_InitStruct);
+    GPIO_InitStruct.Pin = LL_GPIO_PIN_14;
+    GPIO_InitStruct.Pull = LL_GPIO_PULL_DOWN; // Driver off while the USART is not driving.
+    LL_GPIO_Init(GPIOB, &GPIO_InitStruct);
+
+    /* Modbus default framing 8E1, the parity bit makes a 9-bit word. */
+    LL_USART_InitTypeDef USART_InitStruct = {0};
+    USART_InitStruct.BaudRate = MODBUS_BAUD;
+    USART_InitStruct.DataWidth = LL_USART_DATAWIDTH_9B;
+    USART_InitStruct.StopBits = LL_USART_STOPBITS_1;
+    USART_InitStruct.Parity = LL_USART_PARITY_EVEN;
+    USART_InitStruct.TransferDirection = LL_USART_DIRECTION_TX_RX;
+    USART_InitStruct.HardwareFlowControl = LL_USART_HWCONTROL_NONE;
+    USART_InitStruct.OverSampling = LL_USART_OVERSAMPLING_16;
+    LL_USART_Disable(MODBUS_USART);
+    if (LL_USART_Init(MODBUS_USART, &USART_InitStruct) != SUCCESS)
+    {
+        return MOD_ERR_PERIPH;
+    }
+    LL_USART_ConfigAsyncMode(MODBUS_USART);
+    LL_USART_EnableDEMode(MODBUS_USART);
+    LL_USART_SetDESignalPolarity(MODBUS_USART, LL_USART_DE_POLARITY_HIGH);
+    LL_USART_SetDEAssertionTime(MODBUS_USART, MODBUS_DE_TIME);
+    LL_USART_SetDEDeassertionTime(MODBUS_USART, MODBUS_DE_TIME);
+    LL_USART_SetRxTimeout(MODBUS_USART, MODBUS_RTO_BITS);
+    LL_USART_EnableRxTimeout(MODBUS_USART);
+
+    /* Receive into the frame buffer until the timeout, transmit channel armed per response. */
+    LL_DMA_DisableChannel(MODBUS_DMA, MODBUS_RX_CHANNEL);
+    LL_DMA_SetPeriphRequest(MODBUS_DMA, MODBUS_RX_CHANNEL, LL_DMA_REQUEST_2);
+    LL_DMA_ConfigTransfer(MODBUS_DMA, MODBUS_RX_CHANNEL,
+                          LL_DMA_DIRECTION_PERIPH_TO_MEMORY |
+                              LL_DMA_PRIORITY_HIGH |
+                              LL_DMA_MODE_NORMAL |
+                              LL_DMA_PERIPH_NOINCREMENT |
+                              LL_DMA_MEMORY_INCREMENT |
+                              LL_DMA_PDATAALIGN_BYTE |
+                              LL_DMA_MDATAALIGN_BYTE);
+    LL_DMA_ConfigAddresses(MODBUS_DMA, MODBUS_RX_CHANNEL,
+                           LL_USART_DMA_GetRegAddr(MODBUS_USART, LL_USART_DMA_REG_DATA_RECEIVE),
+                           (uint32_t)rx_buf, LL_DMA_DIRECTION_PERIPH_TO_MEMORY);
+    LL_DMA_SetDataLength(MODBUS_DMA, MODBUS_RX_CHANNEL, MODBUS_ADU_MAX);
+
+    LL_DMA_DisableChannel(MODBUS_DMA, MODBUS_TX_CHANNEL);
+    LL_DMA_SetPeriphRequest(MODBUS_DMA, MODBUS_TX_CHANNEL, LL_DMA_REQUEST_2);
+    LL_DMA_ConfigTransfer(MODBUS_DMA, MODBUS_TX_CHANNEL,
+                          LL_DMA_DIRECTION_MEMORY_TO_PERIPH |
+                              LL_DMA_PRIORITY_LOW |
+                              LL_DMA_MODE_NORMAL |
+                              LL_DMA_PERIPH_NOINCREMENT |
+                              LL_DMA_MEMORY_INCREMENT |
+                              LL_DMA_PDATAALIGN_BYTE |
+                              LL_DMA_MDATAALIGN_BYTE);
+    LL_DMA_ConfigAddresses(MODBUS_DMA, MODBUS_TX_CHANNEL, (uint32_t)tx_buf,
+                           LL_USART_DMA_GetRegAddr(MODBUS_USART, LL_USART_DMA_REG_DATA_TRANSMIT),
+                           LL_DMA_DIRECTION_MEMORY_TO_PERIPH);
+
+    LL_USART_EnableDMAReq_RX(MODBUS_USART);
+    LL_USART_EnableDMAReq_TX(MODBUS_USART);
+    LL_USART_EnableIT_RTO(MODBUS_USART);
+    LL_USART_EnableIT_PE(MODBUS_USART);
+    LL_USART_EnableIT_ERROR(MODBUS_USART); // FE, NE and ORE, RXNE is serviced by DMA.
+    LL_DMA_EnableChannel(MODBUS_DMA, MODBUS_RX_CHANNEL);
+    LL_USART_Enable(MODBUS_USART);
+
+    __NVIC_SetPriority(USART3_IRQn, NVIC_EncodePriority(NVIC_GetPriorityGrouping(), IRQ_PRIO_MODBUS, 0));
+    __NVIC_EnableIRQ(USART3_IRQn);
+
+    power_stop_lock();
+    port_ready = true;
+    return MOD_OK;
+}
+
+mod_err_t modbus_port_send(const uint8_t *buf, size_t len)
+{
+    if (!port_ready)
+    {
+        return MOD_ERR_NOT_INIT;
+    }
+    if (len > sizeof(tx_buf) || LL_DMA_GetDataLength(MODBUS_DMA, MODBUS_TX_CHANNEL) != 0U ||
+        !LL_USART_IsActiveFlag_TC(MODBUS_USART))
+    {
+        return MOD_ERR_BUF_OVERRUN;
+    }
+
+    memcpy(tx_buf, buf, len);
+    LL_DMA_DisableChannel(MODBUS_DMA, MODBUS_TX_CHANNEL);
+    LL_DMA_SetDataLength(MODBUS_DMA, MODBUS_TX_CHANNEL, len);
+    LL_USART_ClearFlag_TC(MODBUS_USART);
+    LL_DMA_EnableChannel(MODBUS_DMA, MODBUS_TX_CHANNEL);
+    return MOD_OK;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Interrupt handlers
+////////////////////////////////////////////////////////////////////////////////
+
+/**
+ * @brief Line error or end of frame.
+ *
+ * A frame is the bytes the receive DMA channel moved before the timeout. Only frames for
+ * this slave or broadcasts are copied into an event, their CRC is checked by the command
+ * thread.
+ */
+void USART3_IRQHandler(void)
+{
+    TRACE_ISR_ENTER(TRACE_ISR_UART);
+    uint32_t isr = MODBUS_USART->ISR;
+    if (isr & (USART_ISR_PE | USART_ISR_FE | USART_ISR_NE | USART_ISR_ORE))
+    {
+        MODBUS_USART->ICR = USART_ICR_PECF | USART_ICR_FECF | USART_ICR_NCF | USART_ICR_ORECF;
+        rx_bad = true;
+    }
+    if (isr & USART_ISR_RTOF)
+    {
+        MODBUS_USART->ICR = USART_ICR_RTOCF;
+        LL_DMA_DisableChannel(MODBUS_DMA, MODBUS_RX_CHANNEL);
+        uint32_t len = MODBUS_ADU_MAX - LL_DMA_GetDataLength(MODBUS_DMA, MODBUS_RX_CHANNEL);
+        uint8_t addr = rx_buf[0];
+
+        if (rx_bad || len < 4U || len >= MODBUS_ADU_MAX)
+        {
+            modbus_count(MODBUS_CNT_RX_ERR); // Line error, runt or overlong frame.
+        }
+        else if (addr != 0U && addr != modbus_addr())
+        {
+            modbus_count(MODBUS_CNT_OTHER);
+        }
+        else
+        {
+            Modbus_Event *const evt = (Modbus_Event *)Event_new(MODBUS_EVENT_SIZE(len), CMD_MODBUS_SIG);
+            if (evt == NULL)
+            {
+                modbus_count(MODBUS_CNT_RX_DROP);
+            }
+            else
+            {
+                evt->len = (uint16_t)len;
+                memcpy(evt->adu, rx_buf, len);
+                if (Active_post(cmd_base, &evt->base) != MOD_OK)
+                {
+                    modbus_count(MODBUS_CNT_RX_DROP);
+                }
+            }
+        }
+
+        rx_bad = false;
+        LL_DMA_SetDataLength(MODBUS_DMA, MODBUS_RX_CHANNEL, MODBUS_ADU_MAX);
+        LL_DMA_EnableChannel(MODBUS_DMA, MODBUS_RX_CHANNEL);
+    }
+    TRACE_ISR_EXIT(TRACE_ISR_UART);
+}
+
+#else
+
+mod_err_t modbus_port_init(void)
+{
+    return MOD_DID_NOTHING;
+}
+
+mod_err_t modbus_port_send(const uint8_t *buf, size_t len)
+{
+    return MOD_ERR_NOT_INIT;
+}
+
+#endif
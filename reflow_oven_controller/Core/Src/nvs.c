@@ -0,0 +1,734 @@
+/**
+ * @file nvs.c
+ * @author Timothy Nguyen
+ * @brief Flash-backed key/value store for persistent parameters.
+ * @version 0.1
+ * @date 2021-08-12
+ *
+ * Page layout, every field is programmed one 64-bit double-word at a time:
+ *
+ * | Page header (8) | Record header (8) | Value, padded to 8 | Record header (8) | ... | Erased (0xFF) |
+ *
+ * A record header holds a CRC-16 over the rest of the header and the value, so
+ * a record torn by a reset is detected and the page is compacted on next write.
+ */
+
+#include <string.h>
+#include <stdbool.h>
+
+#include "nvs.h"
+#include "cmd.h"
+#include "log.h"
+#include "frame.h"
+#include "bgjob.h"
+#include "cmsis_os.h"
+#include "stm32l4xx_hal.h"
+
+////////////////////////////////////////////////////////////////////////////////
+// Common macros
+////////////////////////////////////////////////////////////////////////////////
+
+#define NVS_PAGE_SIZE FLASH_PAGE_SIZE // Size of each store page.
+#define NVS_MAGIC 0x3153564EU         // "NVS1", marks formatted page.
+#define NVS_KEY_ERASED 0xFFFFU        // Key of erased record header, end of records.
+
+/* Round length up to flash programming granularity (double-word). */
+#define NVS_ALIGN(len) (((len) + 7U) & ~7U)
+
+////////////////////////////////////////////////////////////////////////////////
+// Type definitions
+////////////////////////////////////////////////////////////////////////////////
+
+/* Page header, first double-word of page */
+typedef struct
+{
+    uint32_t magic; // NVS_MAGIC once page is complete.
+    uint32_t seq;   // Incremented on every compaction, newer page wins.
+} nvs_page_hdr_t;
+
+/* Record header, followed by value */
+typedef struct
+{
+    uint16_t crc;      // CRC-16 over remaining header fields and value.
+    uint16_t key;      // nvs_key_t, NVS_KEY_ERASED if unwritten.
+    uint16_t len;      // Value length (bytes).
+    uint16_t reserved; // Always 0xFFFF.
+} nvs_rec_hdr_t;
+
+/* Staging slot of nvs_set_deferred() */
+typedef struct
+{
+    bool staged;   // Value waits for the background job.
+    nvs_key_t key; // Key of value.
+    uint16_t len;  // Value length (bytes).
+    uint64_t value[NVS_MAX_VALUE_LEN / sizeof(uint64_t)];
+} nvs_slot_t;
+
+////////////////////////////////////////////////////////////////////////////////
+// Private (static) function declarations
+////////////////////////////////////////////////////////////////////////////////
+
+static bool nvs_scan(uint8_t page);                                                 // Index records of page.
+static mod_err_t nvs_append(uint8_t page, uint32_t offset, nvs_key_t key, const void *value, size_t len); // Program record.
+static mod_err_t nvs_compact(nvs_key_t key, const void *value, size_t len);          // Move latest records to other page.
+static mod_err_t nvs_format(uint8_t page, uint32_t seq);                             // Erase page and write header.
+static mod_err_t nvs_erase(uint8_t page);                                            // Erase page.
+static mod_err_t nvs_erase_at(uint32_t addr);                                        // Erase page at address.
+static mod_err_t nvs_copy(uint32_t dst, uint32_t src);                               // Copy store region to erased flash.
+static mod_err_t nvs_program(uint32_t addr, const uint64_t *data, uint32_t num_dwords); // Program double-words.
+static inline uint8_t *nvs_page_addr(uint8_t page);                                  // Address of page.
+static inline nvs_rec_hdr_t const *nvs_rec(uint8_t page, uint32_t offset);           // Record header at offset.
+static inline uint16_t nvs_rec_crc(nvs_rec_hdr_t const *hdr);                        // Compute record CRC.
+static mod_err_t nvs_write(nvs_key_t key, const void *value, size_t len);             // Write value, mutex held.
+static bgjob_status_t nvs_commit_step(void *arg);                                    // Write one staged value.
+static bool nvs_commit_one(void);                                                    // Write one staged value, mutex held.
+
+/* Command callback functions */
+static uint32_t cmd_nvs_status(uint32_t argc, const char **argv); // Display store usage.
+static uint32_t cmd_nvs_erase(uint32_t argc, const char **argv);  // Erase store.
+
+////////////////////////////////////////////////////////////////////////////////
+// Private (static) variables
+////////////////////////////////////////////////////////////////////////////////
+
+/* Store region, defined by linker script */
+extern uint8_t _snvs[];
+extern uint8_t _envs[];
+
+/* Active page index, 0 or 1 */
+static uint8_t active_page;
+
+/* Active page sequence number */
+static uint32_t active_seq;
+
+/* Offset of first erased byte of active page */
+static uint32_t write_offset;
+
+/* Offset of latest record of every key in active page, 0 if key has no value */
+static uint16_t rec_offset[NUM_NVS_KEYS];
+
+/* Record staging buffer, double-word aligned for programming */
+static uint64_t rec_buf[(sizeof(nvs_rec_hdr_t) + NVS_MAX_VALUE_LEN) / sizeof(uint64_t)];
+
+/* Serializes writers */
+static osMutexId_t nvs_mutex;
+static StaticSemaphore_t nvs_mutex_cb;
+
+/* Values staged by nvs_set_deferred(), shared by threads and the idle task under kernel lock */
+static nvs_slot_t defer_slots[NVS_DEFER_SLOTS];
+static uint64_t defer_buf[NVS_MAX_VALUE_LEN / sizeof(uint64_t)]; // Value being committed.
+static bgjob_t nvs_job = {.name = "nvs", .step = nvs_commit_step};
+
+/* Unique tag for logging module */
+LOG_TAG_DEFINE("NVS");
+
+/* Store command information */
+static cmd_cmd_info nvs_cmds[] = {
+    {.cmd_name = "status",
+     .cb = cmd_nvs_status,
+     .help = "Display parameter store usage."},
+    {.cmd_name = "erase",
+     .cb = cmd_nvs_erase,
+     .help = "Erase all stored parameters, defaults apply after reset."}};
+
+/* Store client info */
+CMD_CLIENT_DEFINE(nvs,
+                  .num_cmds = 2,
+                  .cmds = nvs_cmds,
+                  .num_u16_pms = 0,
+                  .u16_pms = NULL,
+                  .u16_pm_names = NULL);
+
+////////////////////////////////////////////////////////////////////////////////
+// Public (global) functions
+////////////////////////////////////////////////////////////////////////////////
+
+mod_err_t nvs_init(void)
+{
+    ASSERT(_envs - _snvs == 2 * NVS_PAGE_SIZE);
+
+    static const osMutexAttr_t mutex_attr = {.name = "nvs", .cb_mem = &nvs_mutex_cb, .cb_size = sizeof(nvs_mutex_cb)};
+    nvs_mutex = osMutexNew(&mutex_attr);
+    ASSERT(nvs_mutex != NULL);
+
+    /* Newest formatted page is active, the other is left from the last compaction. */
+    nvs_page_hdr_t const *hdr0 = (nvs_page_hdr_t const *)nvs_page_addr(0);
+    nvs_page_hdr_t const *hdr1 = (nvs_page_hdr_t const *)nvs_page_addr(1);
+    bool valid0 = hdr0->magic == NVS_MAGIC;
+    bool valid1 = hdr1->magic == NVS_MAGIC;
+
+    /* A store left in the other bank, by a bank swap whose copy did not complete or by
+     * firmware keeping the store at the end of bank 2, is adopted. */
+    uint32_t other = (uint32_t)_snvs + FLASH_BANK_SIZE;
+    if (!valid0 && !valid1 &&
+        (((nvs_page_hdr_t const *)other)->magic == NVS_MAGIC ||
+         ((nvs_page_hdr_t const *)(other + NVS_PAGE_SIZE))->magic == NVS_MAGIC) &&
+        nvs_erase(0) == MOD_OK && nvs_erase(1) == MOD_OK && nvs_copy((uint32_t)_snvs, other) == MOD_OK)
+    {
+        LOGW(TAG, "Adopted parameter store of the other bank.");
+        valid0 = hdr0->magic == NVS_MAGIC;
+        valid1 = hdr1->magic == NVS_MAGIC;
+    }
+
+    mod_err_t err = MOD_OK;
+    if (!valid0 && !valid1)
+    {
+        LOGW(TAG, "Parameter store not formatted, formatting.");
+        err = nvs_format(0, 0);
+        active_page = 0;
+        active_seq = 0;
+        write_offset = sizeof(nvs_page_hdr_t);
+    }
+    else
+    {
+        active_page = (valid1 && (!valid0 || (int32_t)(hdr1->seq - hdr0->seq) > 0)) ? 1U : 0U;
+        active_seq = ((nvs_page_hdr_t const *)nvs_page_addr(active_page))->seq;
+        if (!nvs_scan(active_page))
+        {
+            LOGW(TAG, "Torn record in page %u, compacting on next write.", active_page);
+        }
+    }
+
+    LOGI(TAG, "Initialized parameter store, page %u, %lu of %lu bytes used.",
+         active_page, write_offset, NVS_PAGE_SIZE);
+    return err;
+}
+
+mod_err_t nvs_get(nvs_key_t key, void *value, size_t len)
+{
+    if (key >= NUM_NVS_KEYS)
+    {
+        return MOD_ERR_ARG;
+    }
+
+    uint16_t offset = rec_offset[key];
+    if (offset == 0U)
+    {
+        return MOD_DID_NOTHING;
+    }
+
+    nvs_rec_hdr_t const *hdr = nvs_rec(active_page, offset);
+    if (hdr->len != len)
+    {
+        return MOD_ERR_ARG;
+    }
+    memcpy(value, hdr + 1, len);
+    return MOD_OK;
+}
+
+mod_err_t nvs_set(nvs_key_t key, const void *value, size_t len)
+{
+    if (key >= NUM_NVS_KEYS || len > NVS_MAX_VALUE_LEN)
+    {
+        return MOD_ERR_ARG;
+    }
+
+    osMutexAcquire(nvs_mutex, osWaitForever);
+    mod_err_t err = nvs_write(key, value, len);
+    osMutexRelease(nvs_mutex);
+    return err;
+}
+
+mod_err_t nvs_set_deferred(nvs_key_t key, const void *value, size_t len)
+{
+    if (key >= NUM_NVS_KEYS || len > NVS_MAX_VALUE_LEN)
+    {
+        return MOD_ERR_ARG;
+    }
+
+    /* Slot staging the key already, else a free one. */
+    osKernelLock();
+    nvs_slot_t *slot = NULL;
+    for (uint32_t i = 0; i < NVS_DEFER_SLOTS; i++)
+    {
+        if (defer_slots[i].staged && defer_slots[i].key == key)
+        {
+            slot = &defer_slots[i];
+            break;
+        }
+        if (!defer_slots[i].staged && slot == NULL)
+        {
+            slot = &defer_slots[i];
+        }
+    }
+    if (slot != NULL)
+    {
+        slot->key = key;
+        slot->len = (uint16_t)len;
+        memcpy(slot->value, value, len);
+        slot->staged = true;
+    }
+    osKernelUnlock();
+
+    if (slot == NULL)
+    {
+        return nvs_set(key, value, len);
+    }
+    bgjob_submit(&nvs_job);
+    return MOD_OK;
+}
+
+uint32_t nvs_flash_bank(uint32_t addr)
+{
+    bool upper = addr >= FLASH_BASE + FLASH_BANK_SIZE;
+    bool swapped = READ_BIT(SYSCFG->MEMRMP, SYSCFG_MEMRMP_FB_MODE) != 0U;
+    return upper != swapped ? FLASH_BANK_2 : FLASH_BANK_1;
+}
+
+mod_err_t nvs_flash_acquire(uint32_t timeout_ms)
+{
+    return osMutexAcquire(nvs_mutex, timeout_ms) == osOK ? MOD_OK : MOD_ERR_TIMEOUT;
+}
+
+void nvs_flash_release(void)
+{
+    osMutexRelease(nvs_mutex);
+}
+
+mod_err_t nvs_mirror(void)
+{
+    while (nvs_commit_one())
+    {
+    }
+
+    uint32_t other = (uint32_t)_snvs + FLASH_BANK_SIZE;
+    mod_err_t err = MOD_OK;
+    for (uint32_t addr = other; addr < other + 2U * NVS_PAGE_SIZE && err == MOD_OK; addr += NVS_PAGE_SIZE)
+    {
+        err = nvs_erase_at(addr);
+    }
+    return err == MOD_OK ? nvs_copy(other, (uint32_t)_snvs) : err;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Private (static) functions
+////////////////////////////////////////////////////////////////////////////////
+
+/**
+ * @brief Index records of page in one sequential pass and find its first erased byte.
+ *
+ * @param page Page index.
+ *
+ * @return true if page ends in erased flash, false if a corrupt record was found.
+ */
+static bool nvs_scan(uint8_t page)
+{
+    memset(rec_offset, 0, sizeof(rec_offset));
+
+    uint32_t offset = sizeof(nvs_page_hdr_t);
+    while (offset + sizeof(nvs_rec_hdr_t) <= NVS_PAGE_SIZE)
+    {
+        nvs_rec_hdr_t const *hdr = nvs_rec(page, offset);
+        if (hdr->key == NVS_KEY_ERASED && hdr->crc == 0xFFFFU)
+        {
+            write_offset = offset;
+            return true;
+        }
+
+        uint32_t rec_size = sizeof(nvs_rec_hdr_t) + NVS_ALIGN(hdr->len);
+        if (hdr->len > NVS_MAX_VALUE_LEN || offset + rec_size > NVS_PAGE_SIZE ||
+            hdr->crc != nvs_rec_crc(hdr))
+        {
+            break;
+        }
+
+        /* Unknown keys of newer firmware are skipped. */
+        if (hdr->key < NUM_NVS_KEYS)
+        {
+            rec_offset[hdr->key] = (uint16_t)offset;
+        }
+        offset += rec_size;
+    }
+
+    /* Page full or corrupt, programming is only safe on a fresh page. */
+    write_offset = NVS_PAGE_SIZE;
+    return offset >= NVS_PAGE_SIZE;
+}
+
+/**
+ * @brief Program record at offset of page.
+ *
+ * @param page Page index.
+ * @param offset Offset of record, erased and double-word aligned.
+ * @param key Key.
+ * @param value Value.
+ * @param len Value length (bytes).
+ *
+ * @return MOD_OK if successful, MOD_ERR_PERIPH otherwise.
+ */
+static mod_err_t nvs_append(uint8_t page, uint32_t offset, nvs_key_t key, const void *value, size_t len)
+{
+    /* Padding stays erased. */
+    uint8_t *const buf = (uint8_t *)rec_buf;
+    memset(buf, 0xFF, sizeof(nvs_rec_hdr_t) + NVS_ALIGN(len));
+
+    nvs_rec_hdr_t *const hdr = (nvs_rec_hdr_t *)buf;
+    hdr->key = (uint16_t)key;
+    hdr->len = (uint16_t)len;
+    hdr->reserved = 0xFFFFU;
+    memcpy(hdr + 1, value, len);
+    hdr->crc = nvs_rec_crc(hdr);
+
+    return nvs_program((uint32_t)(nvs_page_addr(page) + offset), rec_buf,
+                       (sizeof(nvs_rec_hdr_t) + NVS_ALIGN(len)) / sizeof(uint64_t));
+}
+
+/**
+ * @brief Copy latest record of every key to the other page, replacing one key's value.
+ *
+ * The other page's header is programmed last, so the active page remains valid
+ * until the copy is complete.
+ *
+ * @param key Key being written.
+ * @param value New value of key.
+ * @param len New value length (bytes).
+ *
+ * @return MOD_OK if successful, MOD_ERR_PERIPH otherwise.
+ */
+static mod_err_t nvs_compact(nvs_key_t key, const void *value, size_t len)
+{
+    uint8_t new_page = active_page ^ 1U;
+    if (nvs_erase(new_page) != MOD_OK)
+    {
+        return MOD_ERR_PERIPH;
+    }
+
+    uint16_t new_offsets[NUM_NVS_KEYS] = {0};
+    uint32_t offset = sizeof(nvs_page_hdr_t);
+    for (uint8_t k = 0; k < NUM_NVS_KEYS; k++)
+    {
+        const void *v = value;
+        size_t l = len;
+        if (k != key)
+        {
+            if (rec_offset[k] == 0U)
+            {
+                continue;
+            }
+            nvs_rec_hdr_t const *hdr = nvs_rec(active_page, rec_offset[k]);
+            v = hdr + 1;
+            l = hdr->len;
+        }
+
+        /* Latest values of all keys always fit, each is at most NVS_MAX_VALUE_LEN. */
+        if (nvs_append(new_page, offset, (nvs_key_t)k, v, l) != MOD_OK)
+        {
+            return MOD_ERR_PERIPH;
+        }
+        new_offsets[k] = (uint16_t)offset;
+        offset += sizeof(nvs_rec_hdr_t) + NVS_ALIGN(l);
+    }
+
+    nvs_page_hdr_t page_hdr = {.magic = NVS_MAGIC, .seq = active_seq + 1U};
+    uint64_t dword;
+    memcpy(&dword, &page_hdr, sizeof(dword));
+    if (nvs_program((uint32_t)nvs_page_addr(new_page), &dword, 1) != MOD_OK)
+    {
+        return MOD_ERR_PERIPH;
+    }
+
+    active_page = new_page;
+    active_seq++;
+    write_offset = offset;
+    memcpy(rec_offset, new_offsets, sizeof(rec_offset));
+    LOGI(TAG, "Compacted parameter store into page %u.", active_page);
+    return MOD_OK;
+}
+
+/**
+ * @brief Erase page and program its header, leaving it without records.
+ *
+ * @param page Page index.
+ * @param seq Page sequence number.
+ *
+ * @return MOD_OK if successful, MOD_ERR_PERIPH otherwise.
+ */
+static mod_err_t nvs_format(uint8_t page, uint32_t seq)
+{
+    memset(rec_offset, 0, sizeof(rec_offset));
+    if (nvs_erase(page) != MOD_OK)
+    {
+        return MOD_ERR_PERIPH;
+    }
+
+    nvs_page_hdr_t page_hdr = {.magic = NVS_MAGIC, .seq = seq};
+    uint64_t dword;
+    memcpy(&dword, &page_hdr, sizeof(dword));
+    return nvs_program((uint32_t)nvs_page_addr(page), &dword, 1);
+}
+
+/**
+ * @brief Erase one store page.
+ *
+ * @param page Page index.
+ *
+ * @return MOD_OK if successful, MOD_ERR_PERIPH otherwise.
+ */
+static mod_err_t nvs_erase(uint8_t page)
+{
+    return nvs_erase_at((uint32_t)nvs_page_addr(page));
+}
+
+/**
+ * @brief Erase flash page at address.
+ *
+ * @param addr Page address.
+ *
+ * @return MOD_OK if successful, MOD_ERR_PERIPH otherwise.
+ */
+static mod_err_t nvs_erase_at(uint32_t addr)
+{
+    FLASH_EraseInitTypeDef erase = {.TypeErase = FLASH_TYPEERASE_PAGES,
+                                    .Banks = nvs_flash_bank(addr),
+                                    .Page = ((addr - FLASH_BASE) % FLASH_BANK_SIZE) / NVS_PAGE_SIZE,
+                                    .NbPages = 1};
+    uint32_t page_err;
+
+    HAL_FLASH_Unlock();
+    __HAL_FLASH_CLEAR_FLAG(FLASH_FLAG_ALL_ERRORS);
+    HAL_StatusTypeDef status = HAL_FLASHEx_Erase(&erase, &page_err);
+    HAL_FLASH_Lock();
+
+    return status == HAL_OK ? MOD_OK : MOD_ERR_PERIPH;
+}
+
+/**
+ * @brief Program double-words into erased flash.
+ *
+ * @param addr Destination address, double-word aligned.
+ * @param data Double-words to program.
+ * @param num_dwords Number of double-words.
+ *
+ * @return MOD_OK if successful, MOD_ERR_PERIPH otherwise.
+ */
+static mod_err_t nvs_program(uint32_t addr, const uint64_t *data, uint32_t num_dwords)
+{
+    HAL_StatusTypeDef status = HAL_OK;
+
+    HAL_FLASH_Unlock();
+    __HAL_FLASH_CLEAR_FLAG(FLASH_FLAG_ALL_ERRORS);
+    for (uint32_t i = 0; i < num_dwords && status == HAL_OK; i++)
+    {
+        status = HAL_FLASH_Program(FLASH_TYPEPROGRAM_DOUBLEWORD, addr + i * sizeof(uint64_t), data[i]);
+    }
+    HAL_FLASH_Lock();
+
+    return status == HAL_OK ? MOD_OK : MOD_ERR_PERIPH;
+}
+
+/**
+ * @brief Copy both store pages to erased flash, skipping erased double-words.
+ *
+ * Headers and records keep their offsets, so the copy holds the same active page.
+ *
+ * @param dst Destination region, erased.
+ * @param src Source region.
+ *
+ * @return MOD_OK if successful, MOD_ERR_PERIPH otherwise.
+ */
+static mod_err_t nvs_copy(uint32_t dst, uint32_t src)
+{
+    mod_err_t err = MOD_OK;
+    for (uint32_t offset = 0; offset < 2U * NVS_PAGE_SIZE && err == MOD_OK; offset += sizeof(uint64_t))
+    {
+        uint64_t dword;
+        memcpy(&dword, (const void *)(src + offset), sizeof(dword));
+        if (dword != UINT64_MAX)
+        {
+            err = nvs_program(dst + offset, &dword, 1);
+        }
+    }
+    return err;
+}
+
+/**
+ * @brief Get start address of store page.
+ */
+static inline uint8_t *nvs_page_addr(uint8_t page)
+{
+    return _snvs + (uint32_t)page * NVS_PAGE_SIZE;
+}
+
+/**
+ * @brief Get record header at offset of page.
+ */
+static inline nvs_rec_hdr_t const *nvs_rec(uint8_t page, uint32_t offset)
+{
+    return (nvs_rec_hdr_t const *)(nvs_page_addr(page) + offset);
+}
+
+/**
+ * @brief Compute CRC of record over key, length, reserved field and value.
+ *
+ * @param hdr Record header, immediately followed by hdr->len value bytes.
+ *
+ * @return Record CRC.
+ */
+static inline uint16_t nvs_rec_crc(nvs_rec_hdr_t const *hdr)
+{
+    return frame_crc16((const uint8_t *)&hdr->key, sizeof(nvs_rec_hdr_t) - sizeof(hdr->crc) + hdr->len);
+}
+
+/**
+ * @brief Display store usage to user.
+ *
+ * @param argc Number of arguments.
+ * @param argv Argument values.
+ *
+ * @return 0 if successful, 1 otherwise.
+ */
+static uint32_t cmd_nvs_status(uint32_t argc, const char **argv)
+{
+    static const char *key_names[NVS_KEY_OVENS] = {"PID_GAINS", "PROFILE", "LOG_LEVELS", "PID_SCHEDULE",
+                                                  "ARCHIVE_BATCH", "PWM_CAL", "TIMING", "RECIPE", "PARAMS", "TC_CAL"};
+
+    LOG("Active page: %u (seq %lu), %lu of %lu bytes used\r\n", active_page, active_seq, write_offset, NVS_PAGE_SIZE);
+    for (uint8_t k = 0; k < NUM_NVS_KEYS; k++)
+    {
+        if (k >= NVS_KEY_OVENS)
+        {
+            /* Per oven keys of further ovens are only listed once stored, as OVEN<oven>_<key>. */
+            if (rec_offset[k] != 0U)
+            {
+                LOG("OVEN%u_%-6u %4u bytes at offset %u\r\n", 1U + (k - NVS_KEY_OVENS) / NVS_OVEN_KEYS,
+                    (k - NVS_KEY_OVENS) % NVS_OVEN_KEYS, nvs_rec(active_page, rec_offset[k])->len, rec_offset[k]);
+            }
+        }
+        else if (rec_offset[k] != 0U)
+        {
+            LOG("%-12s %4u bytes at offset %u\r\n", key_names[k], nvs_rec(active_page, rec_offset[k])->len, rec_offset[k]);
+        }
+        else
+        {
+            LOG("%-12s not stored\r\n", key_names[k]);
+        }
+    }
+    return 0;
+}
+
+/**
+ * @brief Erase both store pages and format the first one.
+ *
+ * @param argc Number of arguments.
+ * @param argv Argument values.
+ *
+ * @return 0 if successful, 1 otherwise.
+ */
+static uint32_t cmd_nvs_erase(uint32_t argc, const char **argv)
+{
+    osMutexAcquire(nvs_mutex, osWaitForever);
+    mod_err_t err = nvs_erase(active_page ^ 1U);
+    if (err == MOD_OK)
+    {
+        err = nvs_format(active_page, 0);
+    }
+    active_seq = 0;
+    write_offset = sizeof(nvs_page_hdr_t);
+    osMutexRelease(nvs_mutex);
+
+    if (err != MOD_OK)
+    {
+        LOG("Could not erase parameter store\r\n");
+        return 1;
+    }
+    LOG("Erased parameter store, defaults apply after reset\r\n");
+    return 0;
+}
+
+/**
+ * @brief Write value of key, unless it is unchanged, with the store mutex held.
+ *
+ * @return MOD_OK if successful, MOD_ERR_PERIPH if flash could not be programmed.
+ */
+static mod_err_t nvs_write(nvs_key_t key, const void *value, size_t len)
+{
+    /* Unchanged values cost no flash wear. */
+    uint16_t offset = rec_offset[key];
+    if (offset != 0U)
+    {
+        nvs_rec_hdr_t const *hdr = nvs_rec(active_page, offset);
+        if (hdr->len == len && memcmp(hdr + 1, value, len) == 0)
+        {
+            return MOD_OK;
+        }
+    }
+
+    mod_err_t err;
+    uint32_t rec_size = sizeof(nvs_rec_hdr_t) + NVS_ALIGN(len);
+    if (write_offset + rec_size <= NVS_PAGE_SIZE)
+    {
+        err = nvs_append(active_page, write_offset, key, value, len);
+        if (err == MOD_OK)
+        {
+            rec_offset[key] = (uint16_t)write_offset;
+            write_offset += rec_size;
+        }
+    }
+    else
+    {
+        err = nvs_compact(key, value, len);
+    }
+
+    if (err != MOD_OK)
+    {
+        LOGE(TAG, "Could not store key %u.", key);
+    }
+    return err;
+}
+
+/**
+ * @brief Write one staged value (background job step, idle task).
+ *
+ * The value is copied out of its slot first, so it may be staged again meanwhile.
+ *
+ * @return BGJOB_MORE while values remain staged or the store is busy.
+ */
+static bgjob_status_t nvs_commit_step(void *arg)
+{
+    (void)arg;
+    if (osMutexAcquire(nvs_mutex, 0) != osOK)
+    {
+        return BGJOB_MORE; // Idle task must not block, a thread is writing.
+    }
+    bool more = nvs_commit_one();
+    osMutexRelease(nvs_mutex);
+    return more ? BGJOB_MORE : BGJOB_DONE;
+}
+
+/**
+ * @brief Write one staged value with the store mutex held.
+ *
+ * @return true if more values remain staged.
+ */
+static bool nvs_commit_one(void)
+{
+    bool found = false;
+    nvs_key_t key = NUM_NVS_KEYS;
+    uint16_t len = 0;
+    bool more = false;
+    osKernelLock();
+    for (uint32_t i = 0; i < NVS_DEFER_SLOTS; i++)
+    {
+        if (!defer_slots[i].staged)
+        {
+            continue;
+        }
+        if (found)
+        {
+            more = true;
+            break;
+        }
+        found = true;
+        key = defer_slots[i].key;
+        len = defer_slots[i].len;
+        memcpy(defer_buf, defer_slots[i].value, len);
+        defer_slots[i].staged = false;
+    }
+    osKernelUnlock();
+
+    if (found)
+    {
+        nvs_write(key, defer_buf, len);
+    }
+    return more;
+}
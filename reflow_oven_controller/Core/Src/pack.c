@@ -0,0 +1,45 @@
+/**
+ * @file pack.c
+ * @author Timothy Nguyen
+ * @brief Packed streams: deltas as zigzag varints, for compact dumps over the console.
+ * @version 0.1
+ * @date 2021-09-06
+ */
+
+#include "pack.h"
+
+////////////////////////////////////////////////////////////////////////////////
+// Public (global) functions
+////////////////////////////////////////////////////////////////////////////////
+
+void pack_init(pack_t *const p, uint8_t *buf, size_t size)
+{
+    p->buf = buf;
+    p->size = size;
+    p->len = 0;
+}
+
+bool pack_u32(pack_t *const p, uint32_t v)
+{
+    size_t n = 1;
+    for (uint32_t rest = v >> 7; rest != 0U; rest >>= 7)
+    {
+        n++;
+    }
+    if (p->size - p->len < n)
+    {
+        return false;
+    }
+
+    for (; v >= 0x80U; v >>= 7)
+    {
+        p->buf[p->len++] = (uint8_t)(v | 0x80U);
+    }
+    p->buf[p->len++] = (uint8_t)v;
+    return true;
+}
+
+bool pack_i32(pack_t *const p, int32_t v)
+{
+    return pack_u32(p, pack_zigzag(v));
+}
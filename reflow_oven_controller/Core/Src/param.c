@@ -0,0 +1,386 @@
+/**
+ * @file param.c
+ * @author Timothy Nguyen
+ * @brief Parameter registry: tunables addressed by ID, range checked, persisted and set alike from text and RPC.
+ * @version 0.1
+ * @date 2021-09-06
+ */
+
+#include <ctype.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+#include <strings.h>
+
+#include "param.h"
+#include "cmd.h"
+#include "log.h"
+#include "nvs.h"
+#include "printf.h"
+
+////////////////////////////////////////////////////////////////////////////////
+// Type definitions
+////////////////////////////////////////////////////////////////////////////////
+
+/* Persisted parameters, stored with NVS_KEY_PARAMS */
+typedef struct
+{
+    uint32_t num_params; // Number of stored parameters.
+    struct
+    {
+        uint16_t id;  // param_id_t.
+        uint16_t rsv; // Reserved, 0.
+        uint32_t raw; // Value bits.
+    } params[PARAM_MAX_STORED];
+} param_stored_t;
+
+////////////////////////////////////////////////////////////////////////////////
+// Private (static) function declarations
+////////////////////////////////////////////////////////////////////////////////
+
+/* Command callback functions */
+static uint32_t cmd_param_list(uint32_t argc, const char **argv);  // List parameters.
+static uint32_t cmd_param_get(uint32_t argc, const char **argv);   // Output parameter value.
+static uint32_t cmd_param_set(uint32_t argc, const char **argv);   // Set parameter.
+static uint32_t cmd_param_reset(uint32_t argc, const char **argv); // Set parameters to default.
+
+static param_def_t const *param_lookup(const char *token);                              // Find parameter by ID or name.
+static bool param_in_range(param_def_t const *def, param_val_t val);                    // Check value against range.
+static void param_store_value(param_def_t const *def, param_val_t val);                 // Store value and notify owner.
+static int param_format(char *buf, size_t size, param_def_t const *def, param_val_t val); // Format value of type.
+static mod_err_t param_save(void);                                                      // Store persistent parameters.
+
+////////////////////////////////////////////////////////////////////////////////
+// Private (static) variables
+////////////////////////////////////////////////////////////////////////////////
+
+/* Descriptors indexed by ID, built by param_init() */
+static param_def_t const *params_by_id[NUM_PARAMS];
+
+/* Names of value types, cmd_parse_args() format letters match them */
+static const char *const type_names[NUM_PARAM_TYPES] = {"u32", "i32", "float"};
+static const char *const type_fmts[NUM_PARAM_TYPES] = {"u", "i", "f"};
+
+/* Stored set, static as it is too large for the command thread stack */
+static param_stored_t stored;
+
+/* Parameter command information. */
+static cmd_cmd_info param_cmds[] = {
+    {.cmd_name = "list",
+     .cb = cmd_param_list,
+     .help = "List parameters with value, default and range, P marks persistent ones."},
+    {.cmd_name = "get",
+     .cb = cmd_param_get,
+     .help = "Output parameter value.\r\nUsage: param get <id|name>"},
+    {.cmd_name = "set",
+     .cb = cmd_param_set,
+     .help = "Set parameter, persistent ones are stored.\r\nUsage: param set <id|name> <value>"},
+    {.cmd_name = "reset",
+     .cb = cmd_param_reset,
+     .help = "Set parameters to default.\r\nUsage: param reset <id|name> | all"}};
+
+/* Parameter module client info */
+CMD_CLIENT_DEFINE(param,
+                  .num_cmds = ARRAY_SIZE(param_cmds),
+                  .cmds = param_cmds,
+                  .num_u16_pms = 0,
+                  .u16_pms = NULL,
+                  .u16_pm_names = NULL);
+
+/* Unique tag for parameter module. */
+LOG_TAG_DEFINE("PARAM");
+
+_Static_assert(sizeof(param_stored_t) <= NVS_MAX_VALUE_LEN, "Stored parameters must fit an NVS value");
+
+////////////////////////////////////////////////////////////////////////////////
+// Public (global) functions
+////////////////////////////////////////////////////////////////////////////////
+
+mod_err_t param_init(void)
+{
+    uint32_t num_persist = 0;
+    for (param_def_t const *def = __start_params; def < __stop_params; def++)
+    {
+        /* IDs are defined once each, every stored parameter fits the stored set. */
+        ASSERT(def->id < NUM_PARAMS && params_by_id[def->id] == NULL);
+        ASSERT(def->type < NUM_PARAM_TYPES);
+        params_by_id[def->id] = def;
+        num_persist += (def->flags & PARAM_FLAG_PERSIST) ? 1U : 0U;
+    }
+    ASSERT(num_persist <= PARAM_MAX_STORED);
+
+    LOGI(TAG, "Initialized parameter registry, %u parameters", (unsigned)(__stop_params - __start_params));
+    return MOD_OK;
+}
+
+mod_err_t param_load(void)
+{
+    mod_err_t err = nvs_get(NVS_KEY_PARAMS, &stored, sizeof(stored));
+    if (err != MOD_OK)
+    {
+        return err;
+    }
+
+    /* Parameters of an older image may be gone or have a narrower range now, they keep their default. */
+    for (uint32_t i = 0; i < stored.num_params && i < PARAM_MAX_STORED; i++)
+    {
+        param_def_t const *def = param_find(stored.params[i].id);
+        param_val_t val = {.u = stored.params[i].raw};
+        if (def == NULL || !(def->flags & PARAM_FLAG_PERSIST) || !param_in_range(def, val))
+        {
+            LOGW(TAG, "Stored parameter %u dropped.", stored.params[i].id);
+            continue;
+        }
+        param_store_value(def, val);
+    }
+    return MOD_OK;
+}
+
+param_def_t const *param_find(uint32_t id)
+{
+    return id < NUM_PARAMS ? params_by_id[id] : NULL;
+}
+
+param_val_t param_get(param_def_t const *def)
+{
+    return (param_val_t){.u = *(volatile uint32_t *)def->addr};
+}
+
+mod_err_t param_set(param_def_t const *def, param_val_t val)
+{
+    if (!param_in_range(def, val))
+    {
+        return MOD_ERR_ARG;
+    }
+    param_store_value(def, val);
+    return (def->flags & PARAM_FLAG_PERSIST) ? param_save() : MOD_OK;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Private (static) functions
+////////////////////////////////////////////////////////////////////////////////
+
+/**
+ * @brief Find parameter by ID, if token is a number, else by name case insensitively.
+ *
+ * @return Descriptor, NULL if there is none.
+ */
+static param_def_t const *param_lookup(const char *token)
+{
+    if (isdigit((unsigned char)token[0]))
+    {
+        cmd_arg_val arg;
+        return cmd_parse_args(1, &token, "u", &arg) == 1 ? param_find(arg.val.u) : NULL;
+    }
+    for (param_def_t const *def = __start_params; def < __stop_params; def++)
+    {
+        if (strcasecmp(def->name, token) == 0)
+        {
+            return def;
+        }
+    }
+    return NULL;
+}
+
+/**
+ * @brief Check value against range of parameter.
+ */
+static bool param_in_range(param_def_t const *def, param_val_t val)
+{
+    switch (def->type)
+    {
+    case PARAM_U32:
+        return val.u >= def->min.u && val.u <= def->max.u;
+    case PARAM_I32:
+        return val.i >= def->min.i && val.i <= def->max.i;
+    default:
+        return val.f >= def->min.f && val.f <= def->max.f; // NAN is out of range.
+    }
+}
+
+/**
+ * @brief Store value with a single 32-bit write and call change callback.
+ */
+static void param_store_value(param_def_t const *def, param_val_t val)
+{
+    *(volatile uint32_t *)def->addr = val.u;
+    if (def->on_change != NULL)
+    {
+        def->on_change(def);
+    }
+}
+
+/**
+ * @brief Format value of parameter's type.
+ *
+ * @return Number of characters as snprintf().
+ */
+static int param_format(char *buf, size_t size, param_def_t const *def, param_val_t val)
+{
+    switch (def->type)
+    {
+    case PARAM_U32:
+        return snprintf(buf, size, "%lu", val.u);
+    case PARAM_I32:
+        return snprintf(buf, size, "%ld", val.i);
+    default:
+        return snprintf(buf, size, "%.3f", val.f);
+    }
+}
+
+/**
+ * @brief Store persistent parameters that differ from their default, so a later default applies to the others.
+ *
+ * @return MOD_OK if stored, otherwise as nvs_set().
+ */
+static mod_err_t param_save(void)
+{
+    memset(&stored, 0, sizeof(stored));
+    for (param_def_t const *def = __start_params; def < __stop_params; def++)
+    {
+        param_val_t val = param_get(def);
+        if ((def->flags & PARAM_FLAG_PERSIST) && val.u != def->def.u)
+        {
+            stored.params[stored.num_params].id = def->id;
+            stored.params[stored.num_params].raw = val.u;
+            stored.num_params++;
+        }
+    }
+    return nvs_set(NVS_KEY_PARAMS, &stored, sizeof(stored));
+}
+
+/**
+ * @brief List parameters.
+ *
+ * @param argc Number of arguments.
+ * @param argv Argument values.
+ *
+ * @return 0 if successful, 1 otherwise.
+ */
+static uint32_t cmd_param_list(uint32_t argc, const char **argv)
+{
+    LOG("%-4s %-24s %-6s %12s %12s %12s %12s %s\r\n", "ID", "Name", "Type", "Value", "Default", "Min", "Max", "Flags");
+    for (uint32_t id = 0; id < NUM_PARAMS; id++)
+    {
+        param_def_t const *def = params_by_id[id];
+        if (def == NULL)
+        {
+            continue;
+        }
+        char vals[4][16];
+        param_format(vals[0], sizeof(vals[0]), def, param_get(def));
+        param_format(vals[1], sizeof(vals[1]), def, def->def);
+        param_format(vals[2], sizeof(vals[2]), def, def->min);
+        param_format(vals[3], sizeof(vals[3]), def, def->max);
+        LOG("%-4lu %-24s %-6s %12s %12s %12s %12s %s\r\n", id, def->name, type_names[def->type],
+            vals[0], vals[1], vals[2], vals[3], (def->flags & PARAM_FLAG_PERSIST) ? "P" : "");
+    }
+    return 0;
+}
+
+/**
+ * @brief Output parameter value as a field of its type, named after the parameter.
+ *
+ * @param argc Number of arguments.
+ * @param argv Argument values.
+ *
+ * @return 0 if successful, 1 otherwise.
+ */
+static uint32_t cmd_param_get(uint32_t argc, const char **argv)
+{
+    param_def_t const *def = argc == 1 ? param_lookup(argv[0]) : NULL;
+    if (def == NULL)
+    {
+        LOG("Format: param get <id|name>, see \"param list\"\r\n");
+        return 1;
+    }
+
+    param_val_t val = param_get(def);
+    switch (def->type)
+    {
+    case PARAM_U32:
+        cmd_out_u32(def->name, val.u);
+        break;
+    case PARAM_I32:
+        cmd_out_i32(def->name, val.i);
+        break;
+    default:
+        cmd_out_float(def->name, val.f);
+        break;
+    }
+    return 0;
+}
+
+/**
+ * @brief Set parameter.
+ *
+ * @param argc Number of arguments.
+ * @param argv Argument values.
+ *
+ * @return 0 if successful, 1 otherwise.
+ */
+static uint32_t cmd_param_set(uint32_t argc, const char **argv)
+{
+    param_def_t const *def = argc == 2 ? param_lookup(argv[0]) : NULL;
+    if (def == NULL)
+    {
+        LOG("Format: param set <id|name> <value>, see \"param list\"\r\n");
+        return 1;
+    }
+
+    cmd_arg_val arg;
+    if (cmd_parse_args(1, &argv[1], type_fmts[def->type], &arg) != 1)
+    {
+        LOG("%s takes a %s value\r\n", def->name, type_names[def->type]);
+        return 1;
+    }
+    param_val_t val = {.u = arg.val.u};
+    mod_err_t err = param_set(def, val);
+    if (err == MOD_ERR_ARG)
+    {
+        char lo[16], hi[16];
+        param_format(lo, sizeof(lo), def, def->min);
+        param_format(hi, sizeof(hi), def, def->max);
+        LOG("%s must be %s to %s\r\n", def->name, lo, hi);
+        return 1;
+    }
+    if (err != MOD_OK)
+    {
+        LOG("%s set, but not stored\r\n", def->name);
+        return 1;
+    }
+    return 0;
+}
+
+/**
+ * @brief Set parameters to default.
+ *
+ * @param argc Number of arguments.
+ * @param argv Argument values.
+ *
+ * @return 0 if successful, 1 otherwise.
+ */
+static uint32_t cmd_param_reset(uint32_t argc, const char **argv)
+{
+    bool all = argc == 1 && strcasecmp(argv[0], "all") == 0;
+    param_def_t const *one = argc == 1 && !all ? param_lookup(argv[0]) : NULL;
+    if (!all && one == NULL)
+    {
+        LOG("Format: param reset <id|name> | all\r\n");
+        return 1;
+    }
+
+    for (param_def_t const *def = __start_params; def < __stop_params; def++)
+    {
+        if ((all || def == one) && param_get(def).u != def->def.u)
+        {
+            param_store_value(def, def->def);
+        }
+    }
+    if (param_save() != MOD_OK)
+    {
+        LOG("Defaults set, but not stored\r\n");
+        return 1;
+    }
+    return 0;
+}
@@ -13,53 +13,232 @@
 
 #include "PID.h"
 #include "log.h"
+#include "prof.h"
+#include "trace.h"
+#include "sections.h"
 
 #define SAMESIGN(X, Y) ((X) <= 0) == ((Y) <= 0)
 
+/* Recompute coefficients derived from gains and sample time. */
+static inline void pid_update_coeffs(PID_t * const pid)
+{
+	float inv_denom = 1.0f / (2.0f * pid->tau + pid->Ts);
+	pid->ki_ts = 0.5f * pid->Ki * pid->Ts;
+	pid->kd_coeff = 2.0f * pid->Kd * inv_denom;
+	pid->lpf_coeff = (2.0f * pid->tau - pid->Ts) * inv_denom;
+	pid->kff_ts = pid->Kff / pid->Ts;
+	pid->kt_ts = pid->antiwindup == PID_ANTIWINDUP_BACKCALC ? pid->Ts / pid->Tt : 0.0f;
+	float kd_ts = pid->Kd / pid->Ts;
+	pid->A0 = pid->Kp + pid->Ki * pid->Ts + kd_ts;
+	pid->A1 = -pid->Kp - 2.0f * kd_ts;
+	pid->A2 = kd_ts;
+}
+
+/* Incremental form iteration, see PID_FORM_INCREMENTAL. */
+static inline float pid_calculate_incremental(PID_t * const pid, float error)
+{
+	float out = pid->out + pid->A0 * error + pid->A1 * pid->prev_error + pid->A2 * pid->prev_error2;
+	if (out > pid->out_lim_max)
+	{
+		out = pid->out_lim_max;
+	}
+	else if (out < pid->out_lim_min)
+	{
+		out = pid->out_lim_min;
+	}
+
+	/* Split output into terms for logging, the integral term holds the rest. */
+	pid->proportional = pid->Kp * error;
+	pid->derivative = pid->A2 * (error - pid->prev_error);
+	pid->integral = out - pid->proportional - pid->derivative;
+	pid->feedforward = 0.0f;
+	pid->out = out;
+
+	pid->prev_error2 = pid->prev_error;
+	pid->prev_error = error;
+	return out;
+}
+
+/* Apply gains and recompute derived coefficients. */
+static inline void pid_apply_gains(PID_t * const pid, PID_gains_t const * const gains)
+{
+	pid->Kp = gains->Kp;
+	pid->Ki = gains->Ki;
+	pid->Kd = gains->Kd;
+	pid->Kff = gains->Kff;
+	pid_update_coeffs(pid);
+}
+
+/* Apply gains of schedule band containing setpoint, if it is not applied already. */
+static inline void pid_schedule_update(PID_t * const pid, float setpoint)
+{
+	PID_schedule_t const * const schedule = pid->schedule;
+	uint8_t band = 0;
+	while (band < schedule->num_bands - 1 && setpoint >= schedule->bands[band].upper)
+	{
+		band++;
+	}
+	if (band != pid->band)
+	{
+		/* Integral term is kept in output units, so a Ki change does not bump output. */
+		pid->band = band;
+		pid_apply_gains(pid, &schedule->bands[band].gains);
+	}
+}
+
+/* Saturate 64-bit intermediate to Q16.16 range. */
+static inline q16_t q16_sat(int64_t x)
+{
+	return (x > INT32_MAX) ? INT32_MAX : ((x < INT32_MIN) ? INT32_MIN : (q16_t)x);
+}
+
+/* Multiply two Q16.16 values with saturation. */
+static inline q16_t q16_mul(q16_t a, q16_t b)
+{
+	return q16_sat(((int64_t)a * b) >> 16);
+}
+
 void PID_Init(PID_t * const pid, PID_cfg_t const * const pid_cfg)
 {
+	ASSERT(pid_cfg->antiwindup != PID_ANTIWINDUP_BACKCALC || pid_cfg->Tt > 0.0f);
 
 	/* Clear controller memory */
 	PID_Reset(pid);
 
     /* Store controller parameters */
-    pid->Kp = pid_cfg->Kp;
-    pid->Ki = pid_cfg->Ki;
-    pid->Kd = pid_cfg->Kd;
+    pid->base = (PID_gains_t){.Kp = pid_cfg->Kp, .Ki = pid_cfg->Ki, .Kd = pid_cfg->Kd, .Kff = pid_cfg->Kff};
+    pid->schedule = NULL;
+    pid->band = PID_NO_BAND;
     pid->tau = pid_cfg->tau;
     pid->Ts = pid_cfg->Ts;
     pid->out_lim_max = pid_cfg->out_max;
     pid->out_lim_min = pid_cfg->out_min;
+    pid->form = pid_cfg->form;
+    pid->antiwindup = pid_cfg->antiwindup;
+    pid->Tt = pid_cfg->Tt;
+    pid->b = pid_cfg->b;
+    pid->c = pid_cfg->c;
+    pid_apply_gains(pid, &pid->base);
+}
+
+void PID_SetGains(PID_t * const pid, float Kp, float Ki, float Kd, float tau)
+{
+    pid->base.Kp = Kp;
+    pid->base.Ki = Ki;
+    pid->base.Kd = Kd;
+    pid->tau = tau;
+    if (pid->schedule == NULL)
+    {
+        pid_apply_gains(pid, &pid->base);
+    }
+    else
+    {
+        pid_update_coeffs(pid);
+    }
+}
+
+void PID_SetFeedForward(PID_t * const pid, float Kff)
+{
+    pid->base.Kff = Kff;
+    if (pid->schedule == NULL)
+    {
+        pid_apply_gains(pid, &pid->base);
+    }
+}
+
+void PID_SetLimits(PID_t * const pid, float out_min, float out_max)
+{
+	ASSERT(out_max > out_min);
+
+	pid->out_lim_min = out_min;
+	pid->out_lim_max = out_max;
+}
+
+void PID_SetSchedule(PID_t * const pid, PID_schedule_t const * const schedule)
+{
+    ASSERT(schedule == NULL || schedule->num_bands > 0);
+
+    pid->schedule = schedule;
+    pid->band = PID_NO_BAND; // Band is selected by next iteration.
+    if (schedule == NULL)
+    {
+        pid_apply_gains(pid, &pid->base);
+    }
 }
 
-float PID_Calculate(PID_t * const pid, float setpoint, float measurement)
+void PID_SetSampleTime(PID_t * const pid, float Ts)
 {
+    float delta = Ts - pid->Ts;
+    float tolerance = PID_TS_TOLERANCE * pid->Ts;
+    if (delta > tolerance || delta < -tolerance)
+    {
+        pid->Ts = Ts;
+        pid_update_coeffs(pid);
+    }
+}
+
+void PID_SetRate(PID_t * const pid, float rate)
+{
+    pid->rate = rate;
+    pid->rate_valid = true;
+}
+
+float RAMFUNC PID_Calculate(PID_t * const pid, float setpoint, float measurement)
+{
+    PROF_BEGIN(pid_calc);
+    TRACE_MARK_BEGIN(TRACE_MARK_PID);
+
+    if (pid->schedule != NULL)
+    {
+        pid_schedule_update(pid, setpoint);
+    }
+
     /* Compute error */
     float error = setpoint - measurement; 
 
-    /* Compute proportional term */
-    pid->proportional = pid->Kp * error;
+    if (pid->form == PID_FORM_INCREMENTAL)
+    {
+        float out = pid_calculate_incremental(pid, error);
+        pid->prev_measurement = measurement;
+        pid->prev_setpoint = setpoint;
+        pid->prev_setpoint_valid = true;
+        pid->rate_valid = false;
+        TRACE_MARK_END(TRACE_MARK_PID);
+        PROF_END(pid_calc);
+        return out;
+    }
+
+    /* Compute proportional term on weighted setpoint */
+    pid->proportional = pid->Kp * (pid->b * setpoint - measurement);
 
-    /* Compute integral term */
-    if ((pid->out == pid->out_lim_max || pid->out == pid->out_lim_min) && SAMESIGN(pid->out, error)) 
+    /* Compute integral term, back-calculation corrects it once output is known. */
+    if (pid->antiwindup == PID_ANTIWINDUP_CLAMP &&
+        (pid->out == pid->out_lim_max || pid->out == pid->out_lim_min) && SAMESIGN(pid->out, error))
     {
         pid->integral = pid->integral; /* Clamp integral term to avoid wind-up. */
     }
     else
     {
-    	pid->integral = pid->integral + 0.5f * pid->Ki * pid->Ts * (error + pid->prev_error);
+    	pid->integral = pid->integral + pid->ki_ts * (error + pid->prev_error);
     }
 
-	/* Compute filtered derivative term. 
-     * Note: Taking derivative on measurement only. */
-    pid->derivative = -(2.0f * pid->Kd * (measurement - pid->prev_measurement) 	
-                        + (2.0f * pid->tau - pid->Ts) * pid->derivative)
-                        / (2.0f * pid->tau + pid->Ts);
+	/* Compute filtered derivative term of weighted setpoint minus measurement, of
+     * measurement only with c = 0. First iteration after reset sees no setpoint change.
+     * A supplied rate replaces the measurement difference. */
+    float prev_setpoint = pid->prev_setpoint_valid ? pid->prev_setpoint : setpoint;
+    float meas_change = pid->rate_valid ? pid->rate * pid->Ts : measurement - pid->prev_measurement;
+    pid->rate_valid = false;
+    pid->derivative = -(pid->kd_coeff * (meas_change - pid->c * (setpoint - prev_setpoint))
+                        + pid->lpf_coeff * pid->derivative);
+
+	/* Compute feed-forward term from setpoint slope, skipping first iteration after reset. */
+    pid->feedforward = pid->prev_setpoint_valid ? pid->kff_ts * (setpoint - pid->prev_setpoint) : 0.0f;
 
 	/* Compute output */
-    pid->out = pid->proportional + pid->integral + pid->derivative;
+    pid->out = pid->proportional + pid->integral + pid->derivative + pid->feedforward;
 
     /* Floor output */
+    float unsaturated = pid->out;
     if (pid->out > pid->out_lim_max) 
     {
         pid->out = pid->out_lim_max;
@@ -69,9 +248,17 @@ float PID_Calculate(PID_t * const pid, float setpoint, float measurement)
         pid->out = pid->out_lim_min;
     }
 
+    /* Track saturated output, kt_ts is 0 without back-calculation. */
+    pid->integral += pid->kt_ts * (pid->out - unsaturated);
+
 	/* Store error and measurement for next PID calculation. */
     pid->prev_error       = error;
     pid->prev_measurement = measurement;
+    pid->prev_setpoint    = setpoint;
+    pid->prev_setpoint_valid = true;
+
+    TRACE_MARK_END(TRACE_MARK_PID);
+    PROF_END(pid_calc);
 
 	/* Return controller output */
     return pid->out;
@@ -81,8 +268,105 @@ void PID_Reset(PID_t * const pid)
 {
     pid->integral = 0.0f;
 	pid->prev_error = 0.0f;
+	pid->prev_error2 = 0.0f;
 	pid->derivative = 0.0f;
 	pid->prev_measurement = 0.0f;
 	pid->out = 0.0f;
     pid->proportional = 0.0f;
+	pid->prev_setpoint = 0.0f;
+	pid->prev_setpoint_valid = false;
+	pid->rate_valid = false;
+	pid->feedforward = 0.0f;
+}
+
+void PIDq_Init(PIDq_t * const pid, PID_cfg_t const * const pid_cfg)
+{
+	/* Clear controller memory */
+	PIDq_Reset(pid);
+
+	/* Fold sample time and filter constant into coefficients, avoiding divisions per iteration. */
+	float denom = 2.0f * pid_cfg->tau + pid_cfg->Ts;
+	pid->Kp = Q16_FROM_FLOAT(pid_cfg->Kp);
+	pid->ki_ts = Q16_FROM_FLOAT(0.5f * pid_cfg->Ki * pid_cfg->Ts);
+	pid->kd_coeff = Q16_FROM_FLOAT(2.0f * pid_cfg->Kd / denom);
+	pid->lpf_coeff = Q16_FROM_FLOAT((2.0f * pid_cfg->tau - pid_cfg->Ts) / denom);
+	pid->out_lim_max = Q16_FROM_FLOAT(pid_cfg->out_max);
+	pid->out_lim_min = Q16_FROM_FLOAT(pid_cfg->out_min);
+}
+
+q16_t PIDq_Calculate(PIDq_t * const pid, q16_t setpoint, q16_t measurement)
+{
+	/* Compute error */
+	q16_t error = q16_sat((int64_t)setpoint - measurement);
+
+	/* Compute proportional term */
+	pid->proportional = q16_mul(pid->Kp, error);
+
+	/* Compute integral term, clamp to avoid wind-up. */
+	if (!((pid->out == pid->out_lim_max || pid->out == pid->out_lim_min) && SAMESIGN(pid->out, error)))
+	{
+		q16_t error_sum = q16_sat((int64_t)error + pid->prev_error);
+		pid->integral = q16_sat((int64_t)pid->integral + q16_mul(pid->ki_ts, error_sum));
+	}
+
+	/* Compute filtered derivative term.
+	 * Note: Taking derivative on measurement only. */
+	q16_t delta = q16_sat((int64_t)measurement - pid->prev_measurement);
+	pid->derivative = q16_sat(-((int64_t)q16_mul(pid->kd_coeff, delta) + q16_mul(pid->lpf_coeff, pid->derivative)));
+
+	/* Compute output */
+	int64_t out = (int64_t)pid->proportional + pid->integral + pid->derivative;
+
+	/* Floor output */
+	if (out > pid->out_lim_max)
+	{
+		out = pid->out_lim_max;
+	}
+	else if (out < pid->out_lim_min)
+	{
+		out = pid->out_lim_min;
+	}
+	pid->out = (q16_t)out;
+
+	/* Store error and measurement for next PID calculation. */
+	pid->prev_error = error;
+	pid->prev_measurement = measurement;
+
+	/* Return controller output */
+	return pid->out;
+}
+
+void PIDq_Reset(PIDq_t * const pid)
+{
+	pid->integral = 0;
+	pid->prev_error = 0;
+	pid->derivative = 0;
+	pid->prev_measurement = 0;
+	pid->out = 0;
+	pid->proportional = 0;
+}
+
+float PIDq_Compare(PID_cfg_t const * const pid_cfg, const float *setpoints, const float *measurements, uint32_t len)
+{
+	PID_t pid;
+	PIDq_t pidq;
+	PID_Init(&pid, pid_cfg);
+	PIDq_Init(&pidq, pid_cfg);
+
+	float max_err = 0.0f;
+	for (uint32_t i = 0; i < len; i++)
+	{
+		float out = PID_Calculate(&pid, setpoints[i], measurements[i]);
+		q16_t outq = PIDq_Calculate(&pidq, Q16_FROM_FLOAT(setpoints[i]), Q16_FROM_FLOAT(measurements[i]));
+		float err = out - Q16_TO_FLOAT(outq);
+		if (err < 0.0f)
+		{
+			err = -err;
+		}
+		if (err > max_err)
+		{
+			max_err = err;
+		}
+	}
+	return max_err;
 }
@@ -0,0 +1,470 @@
+/**
+ * @file power.c
+ * @author Timothy Nguyen
+ * @brief Low-power idle: tickless kernel idle with sleep or STOP2 entry, LPTIM1 wake-up timebase.
+ * @version 0.1
+ * @date 2021-08-21
+ */
+
+#include <stdbool.h>
+#include <string.h>
+#include <strings.h>
+
+#include "power.h"
+#include "cmd.h"
+#include "irq.h"
+#include "log.h"
+#include "console.h"
+#include "uart.h"
+#include "bgjob.h"
+#include "FreeRTOS.h"
+#include "task.h"
+#include "stm32l4xx_hal.h"
+
+////////////////////////////////////////////////////////////////////////////////
+// Common macros
+////////////////////////////////////////////////////////////////////////////////
+
+#define US_PER_TICK (1000000U / configTICK_RATE_HZ) // Kernel tick period (us).
+#define MS_PER_TICK (1000U / configTICK_RATE_HZ)    // Kernel tick period (ms), HAL tick is 1 ms.
+
+#define LPTIM_MIN_COUNTS 2U // Shortest sleep (LPTIM1 counts), compare must lie ahead of counter.
+
+////////////////////////////////////////////////////////////////////////////////
+// Type definitions
+////////////////////////////////////////////////////////////////////////////////
+
+/* Power module state */
+typedef struct
+{
+    bool running;            // LPTIM1 timebase started, idle task may sleep.
+    bool stop_enabled;       // STOP2 may be entered.
+    bool lse;                // LPTIM1 is clocked by LSE, else by LSI.
+    uint32_t lptim_hz;       // LPTIM1 counter clock.
+    uint32_t max_idle_ticks; // Longest sleep (kernel ticks).
+    uint32_t carry_us;       // Time slept but not yet stepped into kernel tick count.
+    uint32_t stop_locks;     // Number of stop locks held.
+    uint32_t hold_until;     // HAL tick before which STOP2 is not entered.
+
+    /* Statistics */
+    uint32_t sleeps;   // Number of sleep mode entries.
+    uint32_t stops;    // Number of STOP2 entries.
+    uint64_t sleep_us; // Time spent in sleep mode.
+    uint64_t stop_us;  // Time spent in STOP2.
+} power_t;
+
+////////////////////////////////////////////////////////////////////////////////
+// Private (static) function declarations
+////////////////////////////////////////////////////////////////////////////////
+
+/* Command callback functions */
+static uint32_t cmd_power_status(uint32_t argc, const char **argv); // Display sleep statistics.
+static uint32_t cmd_power_stop(uint32_t argc, const char **argv);   // Enable or disable STOP2.
+
+static mod_err_t lptim_init(void);                 // Select LPTIM1 clock and start free-running counter.
+static inline uint16_t lptim_count(void);          // Read LPTIM1 counter.
+static bool lptim_set_wakeup(uint16_t start, uint16_t counts); // Program LPTIM1 compare match.
+static bool stop_allowed(uint32_t expected_idle_ticks);       // Check conditions for STOP2 entry.
+static void enter_stop2(void);                                 // Enter STOP2 and restore system clock.
+
+////////////////////////////////////////////////////////////////////////////////
+// Private (static) variables
+////////////////////////////////////////////////////////////////////////////////
+
+/* Power module state */
+static power_t power;
+
+/* Power command information. */
+static cmd_cmd_info power_cmds[] = {
+    {.cmd_name = "status",
+     .cb = cmd_power_status,
+     .help = "Display low-power idle state and time spent in sleep and STOP2 modes."},
+    {.cmd_name = "stop",
+     .cb = cmd_power_stop,
+     .help = "Allow STOP2 while idle, otherwise only sleep mode is used. Format: power stop <on|off>"}};
+
+/* Power module client info */
+CMD_CLIENT_DEFINE(power,
+                  .num_cmds = sizeof(power_cmds) / sizeof(power_cmds[0]),
+                  .cmds = power_cmds);
+
+/* Unique tag for power module. */
+LOG_TAG_DEFINE("POWER");
+
+////////////////////////////////////////////////////////////////////////////////
+// Public (global) functions
+////////////////////////////////////////////////////////////////////////////////
+
+mod_err_t power_init(void)
+{
+    memset(&power, 0, sizeof(power));
+    power.stop_enabled = true;
+    power.hold_until = HAL_GetTick() + POWER_RX_HOLD_MS;
+
+    mod_err_t err = lptim_init();
+    if (err != MOD_OK)
+    {
+        LOGE(TAG, "LPTIM1 timebase failed to start, CPU does not sleep");
+        return err;
+    }
+    power.max_idle_ticks = pdMS_TO_TICKS(POWER_MAX_IDLE_MS);
+
+    /* Console receive pin wakes CPU from STOP2, line is only unmasked while stopped. */
+    __HAL_RCC_SYSCFG_CLK_ENABLE();
+    MODIFY_REG(SYSCFG->EXTICR[0], SYSCFG_EXTICR1_EXTI3, SYSCFG_EXTICR1_EXTI3_PA);
+    SET_BIT(EXTI->FTSR1, EXTI_FTSR1_FT3);
+    CLEAR_BIT(EXTI->IMR1, EXTI_IMR1_IM3);
+    HAL_NVIC_SetPriority(EXTI3_IRQn, IRQ_PRIO_WAKEUP, 0);
+    HAL_NVIC_EnableIRQ(EXTI3_IRQn);
+
+    power.running = true;
+    LOGI(TAG, "Initialized power module, LPTIM1 on %s at %lu Hz", power.lse ? "LSE" : "LSI", power.lptim_hz);
+    return MOD_OK;
+}
+
+void power_suppress_ticks_and_sleep(uint32_t expected_idle_ticks)
+{
+    if (!power.running || bgjob_pending())
+    {
+        return; // Idle hook keeps running background jobs.
+    }
+    if (expected_idle_ticks > power.max_idle_ticks)
+    {
+        expected_idle_ticks = power.max_idle_ticks;
+    }
+
+    /* Sleep for one tick less than expected, restarted SysTick completes the last one. */
+    uint16_t counts = (uint16_t)(((uint64_t)(expected_idle_ticks - 1U) * power.lptim_hz) / configTICK_RATE_HZ);
+    if (counts < LPTIM_MIN_COUNTS)
+    {
+        return;
+    }
+
+    __disable_irq();
+    __DSB();
+    __ISB();
+
+    /* A pending tick or an interrupt that readied a thread cancels sleep. */
+    if (eTaskConfirmSleepModeStatus() == eAbortSleep || (SCB->ICSR & SCB_ICSR_PENDSTSET_Msk))
+    {
+        __enable_irq();
+        return;
+    }
+
+    /* Stop kernel and HAL ticks, time asleep is measured by LPTIM1 instead. */
+    uint32_t systick_cycles = SysTick->LOAD - SysTick->VAL; // Part of current tick already elapsed.
+    CLEAR_BIT(SysTick->CTRL, SysTick_CTRL_ENABLE_Msk);
+    HAL_SuspendTick();
+
+    uint16_t start = lptim_count();
+    bool stop = false;
+    if (lptim_set_wakeup(start, counts))
+    {
+        stop = stop_allowed(expected_idle_ticks);
+        if (stop)
+        {
+            enter_stop2();
+        }
+        else
+        {
+            __DSB();
+            __WFI();
+            __ISB();
+        }
+    }
+    uint16_t elapsed = lptim_count() - start;
+
+    /* Step ticks by whole periods slept, keep the remainder for the next sleep. */
+    uint64_t slept_us = ((uint64_t)elapsed * 1000000U) / power.lptim_hz;
+    uint64_t total_us = power.carry_us + systick_cycles / (SystemCoreClock / 1000000U) + slept_us;
+    uint32_t ticks = (uint32_t)(total_us / US_PER_TICK);
+    if (ticks > expected_idle_ticks - 1U)
+    {
+        ticks = expected_idle_ticks - 1U;
+    }
+    total_us -= (uint64_t)ticks * US_PER_TICK;
+    power.carry_us = total_us < US_PER_TICK ? (uint32_t)total_us : US_PER_TICK - 1U;
+
+    if (stop)
+    {
+        power.stops++;
+        power.stop_us += slept_us;
+    }
+    else
+    {
+        power.sleeps++;
+        power.sleep_us += slept_us;
+    }
+
+    SysTick->VAL = 0U;
+    SET_BIT(SysTick->CTRL, SysTick_CTRL_ENABLE_Msk);
+    uwTick += ticks * MS_PER_TICK;
+    HAL_ResumeTick();
+    vTaskStepTick(ticks);
+
+    __enable_irq();
+}
+
+void power_stop_lock(void)
+{
+    uint32_t primask = __get_PRIMASK();
+    __disable_irq();
+    power.stop_locks++;
+    __set_PRIMASK(primask);
+}
+
+void power_stop_unlock(void)
+{
+    uint32_t primask = __get_PRIMASK();
+    __disable_irq();
+    if (power.stop_locks > 0)
+    {
+        power.stop_locks--;
+    }
+    __set_PRIMASK(primask);
+}
+
+void power_stop_hold(uint32_t ms)
+{
+    uint32_t until = HAL_GetTick() + ms;
+
+    uint32_t primask = __get_PRIMASK();
+    __disable_irq();
+    if ((int32_t)(until - power.hold_until) > 0)
+    {
+        power.hold_until = until;
+    }
+    __set_PRIMASK(primask);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Private (static) functions
+////////////////////////////////////////////////////////////////////////////////
+
+/**
+ * @brief Display low-power idle state and statistics.
+ *
+ * @param argc Number of arguments.
+ * @param argv Argument values.
+ *
+ * @return 0 if successful, 1 otherwise.
+ */
+static uint32_t cmd_power_status(uint32_t argc, const char **argv)
+{
+    uint32_t primask = __get_PRIMASK();
+    __disable_irq();
+    power_t snap = power;
+    __set_PRIMASK(primask);
+
+    cmd_out_str("timebase", !snap.running ? "off" : (snap.lse ? "LSE" : "LSI"));
+    cmd_out_str("stop2", snap.stop_enabled ? "on" : "off");
+    cmd_out_u32("stop locks", snap.stop_locks);
+    cmd_out_u32("uptime ms", HAL_GetTick());
+    cmd_out_u32("sleeps", snap.sleeps);
+    cmd_out_u32("sleep ms", (uint32_t)(snap.sleep_us / 1000U));
+    cmd_out_u32("stops", snap.stops);
+    cmd_out_u32("stop ms", (uint32_t)(snap.stop_us / 1000U));
+    return 0;
+}
+
+/**
+ * @brief Enable or disable STOP2 entry.
+ *
+ * @param argc Number of arguments.
+ * @param argv Argument values.
+ *
+ * @return 0 if successful, 1 otherwise.
+ */
+static uint32_t cmd_power_stop(uint32_t argc, const char **argv)
+{
+    if (argc == 1 && strcasecmp(argv[0], "on") == 0)
+    {
+        power.stop_enabled = true;
+    }
+    else if (argc == 1 && strcasecmp(argv[0], "off") == 0)
+    {
+        power.stop_enabled = false;
+    }
+    else
+    {
+        LOG("Format: power stop <on|off>\r\n");
+        return 1;
+    }
+    return 0;
+}
+
+/**
+ * @brief Start LSE, or LSI if it fails, as LPTIM1 clock and start LPTIM1 counting freely.
+ *
+ * @return MOD_OK if successful, MOD_ERR_PERIPH if no low-speed oscillator started.
+ */
+static mod_err_t lptim_init(void)
+{
+    RCC_OscInitTypeDef osc = {0};
+    RCC_PeriphCLKInitTypeDef clk = {0};
+
+    HAL_PWR_EnableBkUpAccess();
+    power.lse = true;
+    osc.OscillatorType = RCC_OSCILLATORTYPE_LSE;
+    osc.LSEState = RCC_LSE_ON;
+    osc.PLL.PLLState = RCC_PLL_NONE;
+    if (HAL_RCC_OscConfig(&osc) != HAL_OK)
+    {
+        LOGW(TAG, "LSE did not start, LPTIM1 timebase falls back to LSI");
+        power.lse = false;
+        osc.OscillatorType = RCC_OSCILLATORTYPE_LSI;
+        osc.LSIState = RCC_LSI_ON;
+        if (HAL_RCC_OscConfig(&osc) != HAL_OK)
+        {
+            return MOD_ERR_PERIPH;
+        }
+    }
+    power.lptim_hz = (power.lse ? LSE_VALUE : LSI_VALUE) / POWER_LPTIM_PRESC_DIV;
+
+    clk.PeriphClockSelection = RCC_PERIPHCLK_LPTIM1;
+    clk.Lptim1ClockSelection = power.lse ? RCC_LPTIM1CLKSOURCE_LSE : RCC_LPTIM1CLKSOURCE_LSI;
+    if (HAL_RCCEx_PeriphCLKConfig(&clk) != HAL_OK)
+    {
+        return MOD_ERR_PERIPH;
+    }
+    __HAL_RCC_LPTIM1_CLK_ENABLE();
+
+    /* Configuration and interrupt enable registers may only be written while disabled. */
+    LPTIM1->CR = 0U;
+    LPTIM1->CFGR = LPTIM_CFGR_PRESC_2; // Divide by 16 (POWER_LPTIM_PRESC_DIV).
+    LPTIM1->IER = LPTIM_IER_CMPMIE;
+    LPTIM1->CR = LPTIM_CR_ENABLE;
+
+    uint32_t start = HAL_GetTick();
+    LPTIM1->ARR = 0xFFFFU;
+    while (!(LPTIM1->ISR & LPTIM_ISR_ARROK))
+    {
+        if (HAL_GetTick() - start > 10U)
+        {
+            return MOD_ERR_PERIPH;
+        }
+    }
+    LPTIM1->ICR = LPTIM_ICR_ARROKCF;
+    SET_BIT(LPTIM1->CR, LPTIM_CR_CNTSTRT);
+
+    /* Compare match wakes CPU from STOP2 through EXTI line 32. */
+    SET_BIT(EXTI->IMR2, EXTI_IMR2_IM32);
+    HAL_NVIC_SetPriority(LPTIM1_IRQn, IRQ_PRIO_WAKEUP, 0);
+    HAL_NVIC_EnableIRQ(LPTIM1_IRQn);
+    return MOD_OK;
+}
+
+/**
+ * @brief Read LPTIM1 counter, which is clocked asynchronously and must read the same twice.
+ *
+ * @return Counter value.
+ */
+static inline uint16_t lptim_count(void)
+{
+    uint32_t cnt;
+    do
+    {
+        cnt = LPTIM1->CNT;
+    } while (cnt != LPTIM1->CNT);
+    return (uint16_t)cnt;
+}
+
+/**
+ * @brief Program LPTIM1 compare match counts after start.
+ *
+ * @param start Counter value sleep is measured from.
+ * @param counts Sleep length (LPTIM1 counts).
+ *
+ * @return true if compare lies ahead of counter, false if time already passed while writing it.
+ */
+static bool lptim_set_wakeup(uint16_t start, uint16_t counts)
+{
+    LPTIM1->ICR = LPTIM_ICR_CMPMCF | LPTIM_ICR_CMPOKCF;
+    NVIC_ClearPendingIRQ(LPTIM1_IRQn);
+    LPTIM1->CMP = (uint16_t)(start + counts);
+    while (!(LPTIM1->ISR & LPTIM_ISR_CMPOK))
+    {
+    }
+
+    uint16_t elapsed = lptim_count() - start;
+    return elapsed + 1U < counts && !(LPTIM1->ISR & LPTIM_ISR_CMPM);
+}
+
+/**
+ * @brief Check whether CPU may enter STOP2, see power.h.
+ *
+ * @param expected_idle_ticks Kernel ticks until the next thread unblocks.
+ *
+ * @return true if STOP2 may be entered, false for sleep mode.
+ */
+static bool stop_allowed(uint32_t expected_idle_ticks)
+{
+    if (!power.stop_enabled || power.stop_locks > 0 || expected_idle_ticks < pdMS_TO_TICKS(POWER_STOP_MIN_MS))
+    {
+        return false;
+    }
+    if ((int32_t)(HAL_GetTick() - power.hold_until) < 0)
+    {
+        return false;
+    }
+    if (CoreDebug->DHCSR & CoreDebug_DHCSR_C_DEBUGEN_Msk)
+    {
+        return false;
+    }
+#if CONSOLE_USB_CDC
+    return false; // USB needs its 48 MHz clock to stay connected.
+#else
+    return uart_tx_idle(UART_CONSOLE) && uart_tx_idle(UART_TELEMETRY);
+#endif
+}
+
+/**
+ * @brief Enter STOP2, woken by LPTIM1 compare match, console receive pin or any EXTI interrupt.
+ *
+ * Wakes on HSI16, which is the PLL source, and switches back to the PLL before returning
+ * if it was the system clock.
+ * Must be called with interrupts masked.
+ */
+static void enter_stop2(void)
+{
+    bool pll = READ_BIT(RCC->CFGR, RCC_CFGR_SWS) == RCC_CFGR_SWS_PLL; // Clock manager may run from HSI16.
+
+    WRITE_REG(EXTI->PR1, EXTI_PR1_PIF3);
+    SET_BIT(EXTI->IMR1, EXTI_IMR1_IM3);
+    SET_BIT(RCC->CFGR, RCC_CFGR_STOPWUCK);
+
+    HAL_PWREx_EnterSTOP2Mode(PWR_STOPENTRY_WFI);
+
+    CLEAR_BIT(EXTI->IMR1, EXTI_IMR1_IM3);
+
+    if (!pll)
+    {
+        return;
+    }
+
+    /* PLL configuration, flash latency and voltage range are kept, only the PLL is off. */
+    SET_BIT(RCC->CR, RCC_CR_PLLON);
+    while (!READ_BIT(RCC->CR, RCC_CR_PLLRDY))
+    {
+    }
+    MODIFY_REG(RCC->CFGR, RCC_CFGR_SW, RCC_CFGR_SW_PLL);
+    while (READ_BIT(RCC->CFGR, RCC_CFGR_SWS) != RCC_CFGR_SWS_PLL)
+    {
+    }
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Interrupt handlers
+////////////////////////////////////////////////////////////////////////////////
+
+void LPTIM1_IRQHandler(void)
+{
+    LPTIM1->ICR = LPTIM_ICR_CMPMCF;
+}
+
+void EXTI3_IRQHandler(void)
+{
+    /* Console receive line woke CPU from STOP2, stay awake for the rest of the input. */
+    WRITE_REG(EXTI->PR1, EXTI_PR1_PIF3);
+    power_stop_hold(POWER_RX_HOLD_MS);
+}
@@ -33,7 +33,7 @@
 #include <stdbool.h>
 #include <stdint.h>
 
-#include "uart.h"
+#include "console.h"
 #include "printf.h"
 
 
@@ -65,6 +65,21 @@
 #define PRINTF_SUPPORT_FLOAT
 #endif
 
+// fast path for %f using single-precision scaling and integer digit conversion,
+// which the Cortex-M4F FPU handles in hardware. Values above PRINTF_MAX_FLOAT fall
+// back to the double-precision _ftoa. Output matches the value rounded to float,
+// with halfway cases rounded away from zero instead of to even.
+// default: activated
+#ifndef PRINTF_DISABLE_SUPPORT_FAST_FLOAT
+#define PRINTF_SUPPORT_FAST_FLOAT
+#endif
+
+// largest precision handled by the %f fast path
+// default: 6 digits
+#ifndef PRINTF_FAST_FLOAT_MAX_PRECISION
+#define PRINTF_FAST_FLOAT_MAX_PRECISION  6U
+#endif
+
 // support for exponential floating point notation (%e/%g)
 // default: activated
 #ifndef PRINTF_DISABLE_SUPPORT_EXPONENTIAL
@@ -77,6 +92,15 @@
 #define PRINTF_DEFAULT_FLOAT_PRECISION  6U
 #endif
 
+// 'uart' output buffer size, characters are collected on the caller's stack and
+// handed to console_write() in blocks of this size. console_write() commits each block
+// atomically, so output of concurrent printf() calls only interleaves if a call
+// produces more than this many characters. Sized to hold a full log line.
+// default: 128 byte
+#ifndef PRINTF_OUT_BUFFER_SIZE
+#define PRINTF_OUT_BUFFER_SIZE  128U
+#endif
+
 // define the largest float suitable to print with %f
 // default: 1e9
 #ifndef PRINTF_MAX_FLOAT
@@ -146,12 +170,29 @@ static inline void _out_null(char character, void* buffer, size_t idx, size_t ma
 }
 
 
-// internal _putchar wrapper
-static inline void _out_char(char character, void* buffer, size_t idx, size_t maxlen)
+// buffered uart output, buffer is flushed once full and on termination
+typedef struct {
+  size_t len;
+  char   buf[PRINTF_OUT_BUFFER_SIZE];
+} out_uart_buf_type;
+
+// printf() output capture hook, NULL if disabled
+static int (*volatile _capture)(char character) = NULL;
+
+static inline void _out_uart(char character, void* buffer, size_t idx, size_t maxlen)
 {
-  (void)buffer; (void)idx; (void)maxlen;
+  (void)idx; (void)maxlen;
+  out_uart_buf_type* out = (out_uart_buf_type*)buffer;
+  int (*capture)(char) = _capture;
+  if (character && capture && capture(character)) {
+    return;
+  }
   if (character) {
-    uart_putc(character);
+    out->buf[out->len++] = character;
+  }
+  if ((out->len == PRINTF_OUT_BUFFER_SIZE) || (!character && out->len)) {
+    console_write(out->buf, out->len);
+    out->len = 0U;
   }
 }
 
@@ -463,6 +504,80 @@ static size_t _ftoa(out_fct_type out, char* buffer, size_t idx, size_t maxlen, d
 }
 
 
+#if defined(PRINTF_SUPPORT_FAST_FLOAT)
+// internal ftoa fast path, scales in single precision and converts digits as integers
+static size_t _ftoa_fast(out_fct_type out, char* buffer, size_t idx, size_t maxlen, double dvalue, unsigned int prec, unsigned int width, unsigned int flags)
+{
+  // powers of 10
+  static const uint32_t pow10[] = { 1U, 10U, 100U, 1000U, 10000U, 100000U, 1000000U };
+
+  // set default precision, if not set explicitly
+  if (!(flags & FLAGS_PRECISION)) {
+    prec = PRINTF_DEFAULT_FLOAT_PRECISION;
+  }
+
+  const float value = (float)dvalue;
+  const bool negative = value < 0.0f;
+  const float magnitude = negative ? -value : value;
+
+  // nan, inf, large values and high precisions take the double-precision path
+  if ((prec > PRINTF_FAST_FLOAT_MAX_PRECISION) || !(magnitude < (float)PRINTF_MAX_FLOAT)) {
+    return _ftoa(out, buffer, idx, maxlen, dvalue, prec, width, flags);
+  }
+
+  // split off whole part first so the fraction keeps all mantissa bits when scaled
+  char buf[PRINTF_FTOA_BUFFER_SIZE];
+  size_t len = 0U;
+  uint32_t whole = (uint32_t)magnitude;
+  uint32_t frac = (uint32_t)((magnitude - (float)whole) * (float)pow10[prec] + 0.5f);
+  if (frac >= pow10[prec]) {
+    // handle rollover, e.g. case 0.99 with prec 1 is 1.0
+    frac = 0U;
+    ++whole;
+  }
+
+  // fractional part, number is reversed
+  if (prec > 0U) {
+    for (unsigned int count = 0U; count < prec; count++) {
+      buf[len++] = (char)('0' + (frac % 10U));
+      frac /= 10U;
+    }
+    buf[len++] = '.';
+  }
+
+  // whole part, number is reversed
+  do {
+    buf[len++] = (char)('0' + (whole % 10U));
+    whole /= 10U;
+  } while (whole && (len < PRINTF_FTOA_BUFFER_SIZE));
+
+  // pad leading zeros
+  if (!(flags & FLAGS_LEFT) && (flags & FLAGS_ZEROPAD)) {
+    if (width && (negative || (flags & (FLAGS_PLUS | FLAGS_SPACE)))) {
+      width--;
+    }
+    while ((len < width) && (len < PRINTF_FTOA_BUFFER_SIZE)) {
+      buf[len++] = '0';
+    }
+  }
+
+  if (len < PRINTF_FTOA_BUFFER_SIZE) {
+    if (negative) {
+      buf[len++] = '-';
+    }
+    else if (flags & FLAGS_PLUS) {
+      buf[len++] = '+';  // ignore the space if the '+' exists
+    }
+    else if (flags & FLAGS_SPACE) {
+      buf[len++] = ' ';
+    }
+  }
+
+  return _out_rev(out, buffer, idx, maxlen, buf, len, width, flags);
+}
+#endif  // PRINTF_SUPPORT_FAST_FLOAT
+
+
 #if defined(PRINTF_SUPPORT_EXPONENTIAL)
 // internal ftoa variant for exponential floating-point type, contributed by Martijn Jasperse <m.jasperse@gmail.com>
 static size_t _etoa(out_fct_type out, char* buffer, size_t idx, size_t maxlen, double value, unsigned int prec, unsigned int width, unsigned int flags)
@@ -759,7 +874,11 @@ static int _vsnprintf(out_fct_type out, char* buffer, const size_t maxlen, const
       case 'f' :
       case 'F' :
         if (*format == 'F') flags |= FLAGS_UPPERCASE;
+#if defined(PRINTF_SUPPORT_FAST_FLOAT)
+        idx = _ftoa_fast(out, buffer, idx, maxlen, va_arg(va, double), precision, width, flags);
+#else
         idx = _ftoa(out, buffer, idx, maxlen, va_arg(va, double), precision, width, flags);
+#endif
         format++;
         break;
 #if defined(PRINTF_SUPPORT_EXPONENTIAL)
@@ -860,17 +979,46 @@ static int _vsnprintf(out_fct_type out, char* buffer, const size_t maxlen, const
 
 ///////////////////////////////////////////////////////////////////////////////
 
+void printf_set_capture(int (*capture)(char character))
+{
+  _capture = capture;
+}
+
+
+int printf_capturing(void)
+{
+  return _capture != NULL;
+}
+
+
 int printf_(const char* format, ...)
 {
   va_list va;
   va_start(va, format);
-  char buffer[1];
-  const int ret = _vsnprintf(_out_char, buffer, (size_t)-1, format, va);
+  out_uart_buf_type buffer = { 0U };
+  const int ret = _vsnprintf(_out_uart, (char*)&buffer, (size_t)-1, format, va);
   va_end(va);
   return ret;
 }
 
 
+int printf_puts(const char* str)
+{
+  const unsigned int len = _strnlen_s(str, (size_t)-1);
+  if (_capture) {
+    out_uart_buf_type buffer = { 0U };
+    for (unsigned int i = 0U; i < len; i++) {
+      _out_uart(str[i], &buffer, i, (size_t)-1);
+    }
+    _out_uart('\0', &buffer, len, (size_t)-1);
+  }
+  else if (len) {
+    console_write(str, len);
+  }
+  return (int)len;
+}
+
+
 int sprintf_(char* buffer, const char* format, ...)
 {
   va_list va;
@@ -893,8 +1041,8 @@ int snprintf_(char* buffer, size_t count, const char* format, ...)
 
 int vprintf_(const char* format, va_list va)
 {
-  char buffer[1];
-  return _vsnprintf(_out_char, buffer, (size_t)-1, format, va);
+  out_uart_buf_type buffer = { 0U };
+  return _vsnprintf(_out_uart, (char*)&buffer, (size_t)-1, format, va);
 }
 
 
@@ -913,3 +1061,10 @@ int fctprintf(void (*out)(char character, void* arg), void* arg, const char* for
   va_end(va);
   return ret;
 }
+
+
+int vfctprintf(void (*out)(char character, void* arg), void* arg, const char* format, va_list va)
+{
+  const out_fct_wrap_type out_fct_wrap = { out, arg };
+  return _vsnprintf(_out_fct, (char*)(uintptr_t)&out_fct_wrap, (size_t)-1, format, va);
+}
@@ -0,0 +1,181 @@
+/**
+ * @file prof.c
+ * @author Timothy Nguyen
+ * @brief Cycle-accurate code profiling using the DWT cycle counter.
+ * @version 0.1
+ * @date 2021-08-04
+ */
+
+#include <string.h>
+
+#include "prof.h"
+#include "common.h"
+#include "cmd.h"
+#include "log.h"
+#include "stm32l4xx.h"
+
+////////////////////////////////////////////////////////////////////////////////
+// Private (static) function declarations
+////////////////////////////////////////////////////////////////////////////////
+
+/* Command callback functions */
+static uint32_t cmd_prof_status(uint32_t argc, const char **argv); // Display probe statistics.
+static uint32_t cmd_prof_clear(uint32_t argc, const char **argv);  // Reset probe statistics.
+
+////////////////////////////////////////////////////////////////////////////////
+// Private (static) variables
+////////////////////////////////////////////////////////////////////////////////
+
+/* Probe table */
+static prof_probe_t probes[PROF_MAX_PROBES];
+
+/* Number of probes in probe table */
+static uint32_t num_probes;
+
+/* Profiling command information. */
+static cmd_cmd_info prof_cmds[] = {
+    {.cmd_name = "status",
+     .cb = cmd_prof_status,
+     .help = "Display probe statistics in CPU cycles."},
+    {.cmd_name = "clear",
+     .cb = cmd_prof_clear,
+     .help = "Reset probe statistics."}};
+
+/* Profiling module client info */
+CMD_CLIENT_DEFINE(prof,
+                  .num_cmds = 2,
+                  .cmds = prof_cmds,
+                  .num_u16_pms = 0,
+                  .u16_pms = NULL,
+                  .u16_pm_names = NULL);
+
+/* Unique tag for profiling module. */
+LOG_TAG_DEFINE("PROF");
+
+////////////////////////////////////////////////////////////////////////////////
+// Public (global) functions
+////////////////////////////////////////////////////////////////////////////////
+
+mod_err_t prof_init(void)
+{
+    /* Enable DWT cycle counter */
+    CoreDebug->DEMCR |= CoreDebug_DEMCR_TRCENA_Msk;
+    DWT->CTRL |= DWT_CTRL_CYCCNTENA_Msk;
+
+    LOGI(TAG, "Initialized profiling module");
+    return MOD_OK;
+}
+
+prof_probe_t *prof_probe_get(const char *name)
+{
+    prof_probe_t *probe = NULL;
+
+    /* Probes may register from ISRs, so search and insert atomically. */
+    uint32_t primask = __get_PRIMASK();
+    __disable_irq();
+    for (uint32_t i = 0; i < num_probes; i++)
+    {
+        if (strcmp(probes[i].name, name) == 0)
+        {
+            probe = &probes[i];
+            break;
+        }
+    }
+    if (probe == NULL && num_probes < PROF_MAX_PROBES)
+    {
+        probe = &probes[num_probes++];
+        probe->name = name;
+        probe->count = 0;
+        probe->min = UINT32_MAX;
+        probe->max = 0;
+        probe->total = 0;
+    }
+    __set_PRIMASK(primask);
+
+    return probe;
+}
+
+void prof_probe_record(prof_probe_t *probe, uint32_t cycles)
+{
+    if (probe == NULL)
+    {
+        return;
+    }
+
+    uint32_t primask = __get_PRIMASK();
+    __disable_irq();
+    probe->count++;
+    probe->total += cycles;
+    if (cycles < probe->min)
+    {
+        probe->min = cycles;
+    }
+    if (cycles > probe->max)
+    {
+        probe->max = cycles;
+    }
+    __set_PRIMASK(primask);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Private (static) functions
+////////////////////////////////////////////////////////////////////////////////
+
+/**
+ * @brief Display probe statistics to user.
+ *
+ * @param argc Number of arguments.
+ * @param argv Argument values.
+ *
+ * @return 0 if successful, 1 otherwise.
+ */
+static uint32_t cmd_prof_status(uint32_t argc, const char **argv)
+{
+    uint32_t cycles_per_us = SystemCoreClock / 1000000U;
+
+    LOG("%-16s %10s %10s %10s %10s %10s\r\n", "Probe", "Count", "Min", "Max", "Avg", "Avg (us)");
+    for (uint32_t i = 0; i < num_probes; i++)
+    {
+        /* Take snapshot so ISR probes do not change values mid-print. */
+        uint32_t primask = __get_PRIMASK();
+        __disable_irq();
+        prof_probe_t probe = probes[i];
+        __set_PRIMASK(primask);
+
+        uint32_t avg = probe.count ? (uint32_t)(probe.total / probe.count) : 0;
+        LOG("%-16s %10lu %10lu %10lu %10lu %10lu\r\n",
+            probe.name,
+            probe.count,
+            probe.count ? probe.min : 0,
+            probe.max,
+            avg,
+            avg / cycles_per_us);
+    }
+
+    return 0;
+}
+
+/**
+ * @brief Reset probe statistics, probes remain registered.
+ *
+ * @param argc Number of arguments.
+ * @param argv Argument values.
+ *
+ * @return 0 if successful, 1 otherwise.
+ */
+static uint32_t cmd_prof_clear(uint32_t argc, const char **argv)
+{
+    for (uint32_t i = 0; i < num_probes; i++)
+    {
+        uint32_t primask = __get_PRIMASK();
+        __disable_irq();
+        probes[i].count = 0;
+        probes[i].min = UINT32_MAX;
+        probes[i].max = 0;
+        probes[i].total = 0;
+        __set_PRIMASK(primask);
+    }
+
+    LOG("Cleared %lu probes\r\n", num_probes);
+    return 0;
+}
@@ -0,0 +1,168 @@
+/**
+ * @file profopt.c
+ * @author Timothy Nguyen
+ * @brief Profile optimizer: fastest segment table an oven model can follow within paste limits.
+ * @version 0.1
+ * @date 2021-09-06
+ */
+
+#include <math.h>
+#include <stdbool.h>
+
+#include "profopt.h"
+
+/* Heating ramp planner state */
+typedef struct
+{
+	Profopt_t *plan;   // Plan segments are added to.
+	float reach;       // Temperature the oven settles at with planned output (deg C).
+	float reach_full;  // Temperature the oven settles at with full output (deg C).
+	float T;           // Model time constant (s).
+	float liquidus;    // Paste liquidus temperature (deg C).
+	float time;        // Time of ramps planned so far (s).
+	float above;       // Time of ramps planned so far spent above liquidus (s).
+} profopt_heat_t;
+
+static Profopt_status_t profopt_heat(profopt_heat_t * const h, float from, float to, float rate_max);
+
+static const char *const status_names[] = {"OK", "invalid model or plan", "peak unreachable",
+                                           "soak too long", "time above liquidus too long"};
+
+Profopt_status_t Profopt_Solve(Profopt_t * const plan, Profopt_cfg_t const * const cfg, Conform_cfg_t const * const limits)
+{
+	float liquidus = limits->liquidus;
+	float amb = cfg->ambient;
+	if (!(cfg->model.T > 0.0f) || !(cfg->model.K > 0.0f) || !(cfg->model.L >= 0.0f) ||
+	    !(cfg->headroom > 0.0f && cfg->headroom <= 1.0f) || !(cfg->margin >= 0.0f && cfg->margin <= 0.5f) ||
+	    !(cfg->start < limits->soak_lo) || !(limits->soak_lo < limits->soak_hi && limits->soak_hi < liquidus) ||
+	    !(cfg->end > amb && cfg->end < liquidus) || !(limits->max[CONFORM_RAMP] > 0.0f))
+	{
+		return PROFOPT_ERR_ARG;
+	}
+
+	/* Planned values sit margin of their band inside it. */
+	float soak_plan = limits->min[CONFORM_SOAK] + cfg->margin * (limits->max[CONFORM_SOAK] - limits->min[CONFORM_SOAK]);
+	float tal_plan = limits->min[CONFORM_TAL] + cfg->margin * (limits->max[CONFORM_TAL] - limits->min[CONFORM_TAL]);
+	float peak = limits->min[CONFORM_PEAK] + cfg->margin * (limits->max[CONFORM_PEAK] - limits->min[CONFORM_PEAK]);
+	float ramp_max = (1.0f - cfg->margin) * limits->max[CONFORM_RAMP];
+	if (!(peak > liquidus) || !(soak_plan > 0.0f))
+	{
+		return PROFOPT_ERR_ARG;
+	}
+
+	plan->num_segments = 0;
+	profopt_heat_t h = {.plan = plan,
+	                    .reach = amb + cfg->headroom * cfg->model.K * cfg->out_max,
+	                    .reach_full = amb + cfg->model.K * cfg->out_max,
+	                    .T = cfg->model.T,
+	                    .liquidus = liquidus};
+	if (!(h.reach_full > peak + PROFOPT_REACH_MARGIN))
+	{
+		return PROFOPT_ERR_PEAK;
+	}
+
+	/* Preheat, then soak at the rate crossing the band in the planned soak time. */
+	Profopt_status_t status = profopt_heat(&h, cfg->start, limits->soak_lo, ramp_max);
+	if (status != PROFOPT_OK)
+	{
+		return status;
+	}
+	float soak_start = h.time;
+	float soak_rate = fminf((limits->soak_hi - limits->soak_lo) / soak_plan, ramp_max);
+	status = profopt_heat(&h, limits->soak_lo, limits->soak_hi, soak_rate);
+	if (status != PROFOPT_OK)
+	{
+		return status;
+	}
+	plan->soak = h.time - soak_start;
+	if (plan->soak > limits->max[CONFORM_SOAK])
+	{
+		return PROFOPT_ERR_SOAK;
+	}
+
+	/* Ramp to peak, dwell there for what rise and fall leave of planned time above liquidus.
+	 * Heaters take effect a dead time late, so the oven holds its peak that long after the
+	 * setpoint drops, then cools towards ambient. */
+	status = profopt_heat(&h, limits->soak_hi, peak, ramp_max);
+	if (status != PROFOPT_OK)
+	{
+		return status;
+	}
+	float fall = cfg->model.L + cfg->model.T * logf((peak - amb) / (liquidus - amb));
+	if (h.above + fall > limits->max[CONFORM_TAL])
+	{
+		return PROFOPT_ERR_TAL;
+	}
+	float dwell = ceilf(fmaxf(tal_plan - h.above - fall, 0.0f));
+	plan->segments[plan->num_segments - 1U].dwell = (uint32_t)dwell;
+	plan->tal = h.above + dwell + fall;
+	plan->peak = peak;
+
+	/* Cool down with heaters off, the segment completes once the oven reaches end. */
+	if (plan->num_segments >= PROFOPT_MAX_SEGMENTS)
+	{
+		return PROFOPT_ERR_ARG;
+	}
+	plan->segments[plan->num_segments++] = (Profopt_segment_t){.ramp_rate = 0.0f, .target = cfg->end, .dwell = 0};
+	float cool = cfg->model.L + cfg->model.T * logf((peak - amb) / (cfg->end - amb));
+	plan->duration = h.time + dwell + cool;
+	return PROFOPT_OK;
+}
+
+const char *Profopt_Status_Str(Profopt_status_t status)
+{
+	return (uint32_t)status < sizeof(status_names) / sizeof(status_names[0]) ? status_names[status] : "?";
+}
+
+/**
+ * @brief Plan heating ramp, stepped where full output heats no faster than rate_max.
+ *
+ * A step heats at full output, the fastest the oven can, and full output heats slower as
+ * the oven gets hotter, so once it is within rate_max the rest of the ramp is one step.
+ * Below that the ramp runs at rate_max, or where the oven cannot follow rate_max with
+ * planned output, in pieces each at the rate the oven can follow at the piece's end.
+ *
+ * @param h Planner state, advanced by the ramp.
+ * @param from Temperature ramp starts at (deg C).
+ * @param to Target of ramp, below h->reach_full (deg C).
+ * @param rate_max Highest rate planned (deg C/s).
+ *
+ * @return PROFOPT_OK if planned, PROFOPT_ERR_PEAK if planned output cannot heat a piece,
+ *         PROFOPT_ERR_ARG if the plan has no room for the segments.
+ */
+static Profopt_status_t profopt_heat(profopt_heat_t * const h, float from, float to, float rate_max)
+{
+	float lo = from;
+	while (lo < to)
+	{
+		if (h->plan->num_segments >= PROFOPT_MAX_SEGMENTS)
+		{
+			return PROFOPT_ERR_ARG;
+		}
+		Profopt_segment_t *const seg = &h->plan->segments[h->plan->num_segments++];
+
+		/* Full output, the oven's step response to reach_full from lo. */
+		if ((h->reach_full - lo) / h->T <= rate_max)
+		{
+			*seg = (Profopt_segment_t){.ramp_rate = 0.0f, .target = to, .dwell = 0};
+			h->time += h->T * logf((h->reach_full - lo) / (h->reach_full - to));
+			if (to > h->liquidus)
+			{
+				h->above += h->T * logf((h->reach_full - fmaxf(lo, h->liquidus)) / (h->reach_full - to));
+			}
+			return PROFOPT_OK;
+		}
+
+		float hi = (h->reach - to) / h->T >= rate_max ? to : fminf(lo + PROFOPT_PIECE_SPAN, to);
+		float rate = fminf((h->reach - hi) / h->T, rate_max);
+		if (!(rate > 0.0f))
+		{
+			return PROFOPT_ERR_PEAK;
+		}
+		*seg = (Profopt_segment_t){.ramp_rate = rate, .target = hi, .dwell = 0};
+		h->time += (hi - lo) / rate;
+		h->above += fmaxf(hi - fmaxf(lo, h->liquidus), 0.0f) / rate;
+		lo = hi;
+	}
+	return PROFOPT_OK;
+}
@@ -0,0 +1,167 @@
+/**
+ * @file pwmlin.c
+ * @author Timothy Nguyen
+ * @brief Heater PWM power linearization table and its calibration experiment.
+ * @version 0.1
+ * @date 2021-09-04
+ */
+
+#include <math.h>
+
+#include "pwmlin.h"
+#include "log.h"
+
+/* Duty of calibration point. */
+static inline float pwmlin_point_duty(uint8_t point)
+{
+	return roundf((float)PWMLIN_OUT_MAX * (float)point / (float)(PWMLIN_CAL_POINTS - 1U));
+}
+
+/* Derive power curve from rises over window, full duty being full power. */
+static inline void pwmlin_cal_finish(Pwmlin_cal_t * const cal)
+{
+	cal->out = 0.0f;
+	float full = cal->rise[PWMLIN_CAL_POINTS - 1U] - cal->rise[0];
+	if (!(full >= PWMLIN_MIN_RISE))
+	{
+		cal->status = PWMLIN_CAL_ERR_CURVE;
+		return;
+	}
+	for (uint8_t k = 0; k < PWMLIN_CAL_POINTS; k++)
+	{
+		cal->power[k] = (cal->rise[k] - cal->rise[0]) / full;
+	}
+	cal->status = PWMLIN_CAL_DONE;
+}
+
+void Pwmlin_Identity(Pwmlin_t * const lin)
+{
+	for (uint32_t i = 0; i < PWMLIN_LUT_SIZE; i++)
+	{
+		lin->duty[i] = (uint16_t)((i * PWMLIN_OUT_MAX + (PWMLIN_LUT_SIZE - 1U) / 2U) / (PWMLIN_LUT_SIZE - 1U));
+	}
+}
+
+bool Pwmlin_Build(Pwmlin_t * const lin, float const power[PWMLIN_CAL_POINTS])
+{
+	if (!(power[0] == 0.0f && power[PWMLIN_CAL_POINTS - 1U] == 1.0f))
+	{
+		return false;
+	}
+
+	/* Measurement noise may dip the curve, which then holds its level. */
+	float p[PWMLIN_CAL_POINTS];
+	float level = 0.0f;
+	for (uint8_t k = 0; k < PWMLIN_CAL_POINTS; k++)
+	{
+		level = fmaxf(level, fminf(power[k], 1.0f));
+		p[k] = level;
+	}
+
+	/* Outputs increase, so the segment holding each one is found by walking forward. */
+	uint8_t k = 0;
+	for (uint32_t i = 0; i < PWMLIN_LUT_SIZE - 1U; i++)
+	{
+		float target = (float)i / (float)(PWMLIN_LUT_SIZE - 1U);
+		while (k < PWMLIN_CAL_POINTS - 2U && p[k + 1U] < target)
+		{
+			k++;
+		}
+		float span = p[k + 1U] - p[k];
+		float frac = span > 0.0f ? fminf(fmaxf((target - p[k]) / span, 0.0f), 1.0f) : 0.0f;
+		lin->duty[i] = (uint16_t)lroundf(((float)k + frac) * (float)PWMLIN_OUT_MAX / (float)(PWMLIN_CAL_POINTS - 1U));
+	}
+	lin->duty[PWMLIN_LUT_SIZE - 1U] = PWMLIN_OUT_MAX; // Full output is full duty, even past a saturated curve.
+	return true;
+}
+
+uint16_t Pwmlin_Apply(Pwmlin_t const * const lin, uint16_t out)
+{
+	uint32_t pos = (uint32_t)(out > PWMLIN_OUT_MAX ? PWMLIN_OUT_MAX : out) * (PWMLIN_LUT_SIZE - 1U);
+	uint32_t i = pos / PWMLIN_OUT_MAX;
+	uint32_t frac = pos % PWMLIN_OUT_MAX;
+	uint32_t duty = lin->duty[i];
+	if (i < PWMLIN_LUT_SIZE - 1U)
+	{
+		duty += (lin->duty[i + 1U] - duty) * frac / PWMLIN_OUT_MAX;
+	}
+	return (uint16_t)duty;
+}
+
+void Pwmlin_Cal_Init(Pwmlin_cal_t * const cal, Pwmlin_cal_cfg_t const * const cfg)
+{
+	ASSERT(cfg->preheat >= 0.0f && cfg->window > 0.0f && cfg->timeout > 0.0f);
+
+	cal->cfg = *cfg;
+	cal->status = PWMLIN_CAL_RUNNING;
+	cal->phase = PWMLIN_PHASE_HEAT;
+	cal->out = (float)PWMLIN_OUT_MAX;
+	cal->point = 0;
+	cal->time = 0.0f;
+	cal->rise_start = 0.0f;
+	for (uint8_t k = 0; k < PWMLIN_CAL_POINTS; k++)
+	{
+		cal->rise[k] = 0.0f;
+		cal->power[k] = 0.0f;
+	}
+}
+
+Pwmlin_cal_status_t Pwmlin_Cal_Step(Pwmlin_cal_t * const cal, float measurement, float Ts)
+{
+	if (cal->status != PWMLIN_CAL_RUNNING)
+	{
+		return cal->status;
+	}
+
+	cal->time += Ts;
+	if (measurement >= cal->cfg.limit)
+	{
+		cal->out = 0.0f;
+		cal->status = PWMLIN_CAL_ERR_LIMIT;
+		return cal->status;
+	}
+
+	switch (cal->phase)
+	{
+	case PWMLIN_PHASE_HEAT:
+		if (measurement >= cal->cfg.start + cal->cfg.preheat)
+		{
+			cal->phase = PWMLIN_PHASE_COOL;
+			cal->time = 0.0f;
+			cal->out = 0.0f;
+		}
+		break;
+
+	case PWMLIN_PHASE_COOL:
+		if (measurement <= cal->cfg.start)
+		{
+			cal->phase = PWMLIN_PHASE_MEASURE;
+			cal->time = 0.0f;
+			cal->rise_start = measurement;
+			cal->out = pwmlin_point_duty(cal->point);
+		}
+		break;
+
+	default:
+		if (cal->time >= cal->cfg.window)
+		{
+			cal->rise[cal->point] = measurement - cal->rise_start;
+			if (++cal->point == PWMLIN_CAL_POINTS)
+			{
+				pwmlin_cal_finish(cal);
+				return cal->status;
+			}
+			cal->phase = PWMLIN_PHASE_HEAT;
+			cal->time = 0.0f;
+			cal->out = (float)PWMLIN_OUT_MAX;
+		}
+		return cal->status;
+	}
+
+	if (cal->time >= cal->cfg.timeout)
+	{
+		cal->out = 0.0f;
+		cal->status = PWMLIN_CAL_ERR_TIMEOUT;
+	}
+	return cal->status;
+}
@@ -0,0 +1,53 @@
+/**
+ * @file rate.c
+ * @author Timothy Nguyen
+ * @brief Adaptive control rate: slower sampling while the oven tracks a steady setpoint.
+ * @version 0.1
+ * @date 2021-09-05
+ */
+
+#include <math.h>
+
+#include "rate.h"
+#include "log.h"
+
+void Rate_Init(Rate_t * const rate, Rate_cfg_t const * const cfg)
+{
+	ASSERT(cfg->div_max >= 1U && cfg->band >= 0.0f && cfg->slope >= 0.0f && cfg->settle > 0.0f);
+
+	rate->cfg = *cfg;
+	Rate_Reset(rate);
+}
+
+void Rate_Reset(Rate_t * const rate)
+{
+	rate->div = 1U;
+	rate->steady_time = 0.0f;
+	rate->prev_valid = false;
+}
+
+uint8_t Rate_Update(Rate_t * const rate, float error, float setpoint, float Ts)
+{
+	bool steady = error <= rate->cfg.band;
+	if (rate->prev_valid && Ts > 0.0f)
+	{
+		steady = steady && fabsf(setpoint - rate->prev_setpoint) <= rate->cfg.slope * Ts;
+	}
+	rate->prev_setpoint = setpoint;
+	rate->prev_valid = true;
+
+	if (!steady)
+	{
+		rate->div = 1U;
+		rate->steady_time = 0.0f;
+		return rate->div;
+	}
+
+	rate->steady_time += Ts;
+	if (rate->steady_time >= rate->cfg.settle && rate->div < rate->cfg.div_max)
+	{
+		rate->div = (uint8_t)(2U * rate->div > rate->cfg.div_max ? rate->cfg.div_max : 2U * rate->div);
+		rate->steady_time = 0.0f;
+	}
+	return rate->div;
+}
@@ -0,0 +1,214 @@
+/**
+ * @file recipe.c
+ * @author Timothy Nguyen
+ * @brief Reflow recipes: uploaded bytecode programs run by a bounded interpreter, one slice per sample.
+ * @version 0.1
+ * @date 2021-09-06
+ */
+
+#include <math.h>
+#include <stddef.h>
+
+#include "recipe.h"
+#include "log.h"
+
+/* Unique tag for logging module */
+LOG_TAG_DEFINE("RECIPE");
+
+/* Source names, indexed by Recipe_src_t */
+static const char *const src_names[NUM_RECIPE_SRCS] = {"temp", "spread", "setpoint", "elapsed"};
+
+/* Value of condition source, in operand units. */
+static float recipe_src(Script_t const *const s, uint8_t src)
+{
+	switch (src)
+	{
+	case RECIPE_SRC_TEMP:
+		return s->temp * 10.0f;
+	case RECIPE_SRC_SPREAD:
+		return s->spread * 10.0f;
+	case RECIPE_SRC_SETPOINT:
+		return s->setpoint * 10.0f;
+	default:
+		return Script_Since(s);
+	}
+}
+
+/* Check whether condition holds against a. */
+static bool recipe_cond(Script_t const *const s, Recipe_insn_t const *const insn)
+{
+	float val = recipe_src(s, insn->arg & RECIPE_COND_SRC);
+	return (insn->arg & RECIPE_COND_LT) ? val < (float)insn->a : val >= (float)insn->a;
+}
+
+mod_err_t Recipe_Check(Recipe_t const *const prog, float max_target, uint32_t *const bad)
+{
+	if (prog->num_insns == 0U || prog->num_insns > RECIPE_MAX_INSNS)
+	{
+		*bad = prog->num_insns;
+		return MOD_ERR_ARG;
+	}
+	for (uint32_t i = 0; i < prog->num_insns; i++)
+	{
+		Recipe_insn_t const *const insn = &prog->insns[i];
+		bool cond_ok = (insn->arg & ~(RECIPE_COND_SRC | RECIPE_COND_LT)) == 0U &&
+		               (insn->arg & RECIPE_COND_SRC) < NUM_RECIPE_SRCS;
+		bool jump_ok = insn->jump < prog->num_insns;
+		bool valid;
+		switch (insn->op)
+		{
+		case RECIPE_OP_END:
+		case RECIPE_OP_MARK:
+		case RECIPE_OP_ABORT:
+			valid = true;
+			break;
+		case RECIPE_OP_RAMP:
+			valid = insn->a >= 0 && (float)insn->a <= max_target * 10.0f && insn->b >= 0;
+			break;
+		case RECIPE_OP_HOLD:
+			valid = insn->a >= 0;
+			break;
+		case RECIPE_OP_WAIT:
+			valid = cond_ok && insn->b >= 0 && (insn->b == 0 || jump_ok);
+			break;
+		case RECIPE_OP_BRANCH:
+			valid = cond_ok && jump_ok;
+			break;
+		case RECIPE_OP_JUMP:
+			valid = jump_ok;
+			break;
+		case RECIPE_OP_SET:
+			valid = insn->arg < NUM_RECIPE_ACTS;
+			break;
+		default:
+			valid = false;
+			break;
+		}
+		if (!valid)
+		{
+			*bad = i;
+			return MOD_ERR_ARG;
+		}
+	}
+	return MOD_OK;
+}
+
+void Recipe_Start(Recipe_vm_t *const vm, Recipe_t const *const prog)
+{
+	*vm = (Recipe_vm_t){.prog = prog};
+}
+
+pt_status_t Recipe_Script(Script_t *const s)
+{
+	Recipe_vm_t *const vm = s->ctx;
+	for (uint32_t n = 0; n < RECIPE_INSNS_PER_TICK; n++)
+	{
+		if (vm->pc >= vm->prog->num_insns)
+		{
+			return PT_ENDED;
+		}
+		Recipe_insn_t const *const insn = &vm->prog->insns[vm->pc];
+		if (!vm->waiting)
+		{
+			vm->waiting = true;
+			vm->wait_start = s->time;
+		}
+		float waited = s->time - vm->wait_start;
+		uint8_t next = vm->pc + 1U;
+
+		switch (insn->op)
+		{
+		case RECIPE_OP_END:
+			return PT_ENDED;
+		case RECIPE_OP_RAMP:
+			Script_Ramp(s, (float)insn->a * 0.1f, (float)insn->b * 0.01f);
+			break;
+		case RECIPE_OP_HOLD:
+			if (waited < (float)insn->a)
+			{
+				return PT_WAITING;
+			}
+			break;
+		case RECIPE_OP_WAIT:
+			if (!recipe_cond(s, insn))
+			{
+				if (insn->b == 0 || waited < (float)insn->b)
+				{
+					return PT_WAITING;
+				}
+				LOGI(TAG, "Wait at %u timed out after %d s.", vm->pc, insn->b);
+				next = insn->jump;
+			}
+			break;
+		case RECIPE_OP_BRANCH:
+			if (recipe_cond(s, insn))
+			{
+				next = insn->jump;
+			}
+			break;
+		case RECIPE_OP_JUMP:
+			next = insn->jump;
+			break;
+		case RECIPE_OP_SET:
+			s->cooling = insn->a != 0;
+			break;
+		case RECIPE_OP_MARK:
+			Script_Mark(s);
+			break;
+		default:
+			LOGW(TAG, "Recipe aborted at %u.", vm->pc);
+			return PT_EXITED;
+		}
+		vm->pc = next;
+		vm->waiting = false;
+	}
+	return PT_WAITING; // Budget spent, go on next sample.
+}
+
+void Recipe_Print(Recipe_t const *const prog)
+{
+	for (uint32_t i = 0; i < prog->num_insns && i < RECIPE_MAX_INSNS; i++)
+	{
+		Recipe_insn_t const *const insn = &prog->insns[i];
+		const char *src = src_names[(insn->arg & RECIPE_COND_SRC) % NUM_RECIPE_SRCS];
+		const char *cmp = (insn->arg & RECIPE_COND_LT) ? "<" : ">=";
+		float val = (insn->arg & RECIPE_COND_SRC) == RECIPE_SRC_ELAPSED ? (float)insn->a : (float)insn->a * 0.1f;
+		switch (insn->op)
+		{
+		case RECIPE_OP_END:
+			LOG("%2lu: END\r\n", i);
+			break;
+		case RECIPE_OP_RAMP:
+			LOG("%2lu: RAMP   to %.1f at %.2f\r\n", i, (float)insn->a * 0.1f, (float)insn->b * 0.01f);
+			break;
+		case RECIPE_OP_HOLD:
+			LOG("%2lu: HOLD   %d s\r\n", i, insn->a);
+			break;
+		case RECIPE_OP_WAIT:
+			if (insn->b > 0)
+			{
+				LOG("%2lu: WAIT   %s %s %.1f, after %d s to %u\r\n", i, src, cmp, val, insn->b, insn->jump);
+			}
+			else
+			{
+				LOG("%2lu: WAIT   %s %s %.1f\r\n", i, src, cmp, val);
+			}
+			break;
+		case RECIPE_OP_BRANCH:
+			LOG("%2lu: BRANCH %s %s %.1f to %u\r\n", i, src, cmp, val, insn->jump);
+			break;
+		case RECIPE_OP_JUMP:
+			LOG("%2lu: JUMP   to %u\r\n", i, insn->jump);
+			break;
+		case RECIPE_OP_SET:
+			LOG("%2lu: SET    cooling %s\r\n", i, insn->a != 0 ? "on" : "off");
+			break;
+		case RECIPE_OP_MARK:
+			LOG("%2lu: MARK\r\n", i);
+			break;
+		default:
+			LOG("%2lu: ABORT\r\n", i);
+			break;
+		}
+	}
+}
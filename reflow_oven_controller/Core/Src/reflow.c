@@ -7,8 +7,10 @@
  */
 
 #include <string.h>
+#include <stddef.h>
 #include <stdbool.h>
 #include <stdlib.h>
+#include <math.h>
 
 #include "reflow.h"
 #include "pid.h"
@@ -18,103 +20,877 @@
 #include "cmsis_os.h"
 #include "stm32l4xx.h"
 #include "MAX31855K.h"
+#include "console.h"
+#include "frame.h"
+#include "hsm.h"
+#include "nvs.h"
+#include "autotune.h"
+#include "excite.h"
+#include "smith.h"
+#include "rls.h"
+#include "filter.h"
+#include "cooling.h"
+#include "power.h"
+#include "clock.h"
+#include "printf.h"
+#include "prio.h"
+#include "sections.h"
+#include "wdg.h"
+#include "safety.h"
+#include "history.h"
+#include "pack.h"
+#include "archive.h"
+#include "conform.h"
+#include "simd.h"
+#include "pwmlin.h"
+#include "rate.h"
+#include "seqlock.h"
+#include "script.h"
+#include "recipe.h"
+#include "scope.h"
+#include "param.h"
+#include "tccal.h"
+#include "fuse.h"
+#include "board.h"
+#include "profopt.h"
 
-#define REFLOW_PROFILE_PHASES_CSV "RESET", "PREHEAT", "SOAK", "RAMPUP", "PEAK", "COOLDOWN"
+/* Reflow oven leaf states: id, name, state, parent state, handler. The enum, reflow_names
+ * and the leaf states of the state machine are all generated from this list.
+ */
+#define REFLOW_STATES(X)                                                                                                                      \
+    X(RESET_STATE, "RESET", reflow_reset_state, NULL, Reflow_reset)                  /* No reflow process running. */                         \
+    X(RAMP_STATE, "RAMP", reflow_ramp_state, &reflow_running_state, Reflow_ramp)     /* Ramping setpoint of current segment to its target. */ \
+    X(DWELL_STATE, "DWELL", reflow_dwell_state, &reflow_running_state, Reflow_dwell) /* Holding target of current segment. */                 \
+    X(AUTOTUNE_STATE, "AUTOTUNE", reflow_autotune_state, NULL, Reflow_autotune)      /* Running relay autotune experiment. */                 \
+    X(STEPRESP_STATE, "STEPRESP", reflow_stepresp_state, NULL, Reflow_stepresp)      /* Running open-loop step response experiment. */ \
+    X(CONVEYOR_STATE, "CONVEYOR", reflow_conveyor_state, NULL, Reflow_conveyor)      /* Holding zone setpoints of a conveyor oven. */ \
+    X(PREHEAT_STATE, "PREHEAT", reflow_preheat_state, NULL, Reflow_preheat)          /* Holding oven warm ahead of a scheduled run. */ \
+    X(CALIBRATE_STATE, "CALIBRATE", reflow_calibrate_state, NULL, Reflow_calibrate)  /* Running PWM power calibration experiment. */ \
+    X(SCRIPT_STATE, "SCRIPT", reflow_script_state, &reflow_running_state, Reflow_script) /* Running scripted profile, see script.h. */
+
+#define REFLOW_STATE_ID(id, name, state, parent, handler) id,
+#define REFLOW_STATE_NAME(id, name, state, parent, handler) name,
+#define REFLOW_STATE_DECL(id, name, state, parent, handler) static const Hsm_State state;
+#define REFLOW_STATE_DEF(id, name, state, parent, handler) static const Hsm_State state = HSM_STATE(parent, handler, id);
 
-/* Reflow oven states. */
+/* Reflow oven states, ids of leaf states. */
 typedef enum
 {
-    RESET_STATE,
+    REFLOW_STATES(REFLOW_STATE_ID)
 
-    /* Reflow profile phases. */
-    PREHEAT_STATE,
-    SOAK_STATE,
-    RAMPUP_STATE,
-    PEAK_STATE,
-    COOLDOWN_STATE,
-
-    NUM_REFLOW_STATES,
-    NUM_PROFILE_PHASES = NUM_REFLOW_STATES - 1
+    NUM_REFLOW_STATES
 } Reflow_State;
 
-/* Status code when returning from event handler. */
+/* Hardware-in-the-loop modes, see reflow_hil_cmd(). */
 typedef enum
 {
-    TRAN_STATUS,    // State transition was taken.
-    HANDLED_STATUS, // Event was handled but not state transition was taken.
-    IGNORE_STATUS,  // Event was ignored.
-    INIT_STATUS,    // Initial state transition was taken.
-} Reflow_Status;
+    REFLOW_HIL_OFF,  // Samples come from thermocouples.
+    REFLOW_HIL_STEP, // Each "reflow inject" is one sample, the host paces the control loop.
+    REFLOW_HIL_FREE, // Sampling timer samples last injected temperatures, in virtual time.
+} Reflow_Hil_Mode;
+
+/* Profile configuration parameters */
+#define REFLOW_MAX_SEGMENTS 16       // Maximum number of segments in a reflow profile, stored profile must fit NVS_MAX_VALUE_LEN.
+#define REFLOW_PROFILE_NAME_LEN 16   // Profile name buffer size, including terminator.
+#define REFLOW_TARGET_MAX 300.0f     // Highest allowed segment target (deg C).
+#define REFLOW_TARGET_TOLERANCE 2.0f // Oven temperature within this of target or past it reaches it (deg C).
+#define REFLOW_TARGET_HYSTERESIS 1.0f // Falling back further than tolerance plus this restarts qualification (deg C).
+#define REFLOW_TARGET_SAMPLES 3U      // Samples target must stay reached before segment ramp completes.
+
+/* Autotune configuration parameters */
+#define REFLOW_AUTOTUNE_HYSTERESIS 1.0f // Default relay hysteresis (deg C).
+#define REFLOW_AUTOTUNE_CYCLES 3U       // Default number of averaged limit cycles.
+#define REFLOW_AUTOTUNE_TIMEOUT 3600.0f // Longest relay experiment (s).
+
+/* Step response experiment defaults */
+#define REFLOW_STEPRESP_HOLD 60.0f // Step or PRBS bit hold time (s).
+#define REFLOW_STEPRESP_STEPS 4U   // Number of steps after baseline.
+#define REFLOW_STEPRESP_ORDER 7U   // PRBS order, one period is 127 bits.
+
+/* PWM power calibration defaults */
+#define REFLOW_CALIBRATE_START 100.0f    // Temperature every window starts at (deg C).
+#define REFLOW_CALIBRATE_PREHEAT 10.0f   // Rise above start heated to before cooling to it (deg C).
+#define REFLOW_CALIBRATE_WINDOW 60.0f    // Time every duty is applied (s).
+#define REFLOW_CALIBRATE_WINDOW_MAX 600.0f // Longest window accepted (s).
+#define REFLOW_CALIBRATE_TIMEOUT 1800.0f // Longest heat or cool phase (s).
+
+/* Conveyor mode defaults */
+#define REFLOW_CONVEYOR_SP 150.0f    // Zone setpoint until set (deg C).
+#define REFLOW_CONVEYOR_WINDOW 60.0f // Time constant of zone error statistics (s).
+#define REFLOW_CONVEYOR_BAND 2.0f    // Zone is stable while its error stays within this (deg C), parameter default.
+#define REFLOW_CONVEYOR_SETTLE 30.0f // Time within band before zone is stable (s), parameter default.
+
+/* Run scheduler defaults */
+#define REFLOW_MAX_JOBS 4U            // Jobs queued at once.
+#define REFLOW_SCHEDULE_TICK_MS 1000U // Period of schedule checks while jobs are queued (ms).
+#define REFLOW_PREHEAT_LEAD 300U      // Time preheat starts ahead of a run until set (s).
+
+/* Status push rate limit */
+#define REFLOW_WATCH_MAX_HZ 10U // Highest rate of "reflow watch" (Hz).
+
+/* Online model identification parameters */
+#define REFLOW_MODEL_LAMBDA 0.999f // RLS forgetting factor, about 1000 samples of memory.
+#define REFLOW_MODEL_P0 1000.0f    // Initial RLS covariance.
+
+/* Thermocouple filter defaults */
+#define REFLOW_FILTER_MEDIAN 3        // Median window length (samples).
+#define REFLOW_FILTER_ALPHA 1.0f      // IIR coefficient, 1 leaves IIR stage off.
+#define REFLOW_FILTER_OUTLIER 10.0f   // Largest accepted deviation from median (deg C).
+#define REFLOW_TC_NIST true           // Correct thermocouple readings with NIST type K tables.
+
+/* Board temperature observer defaults */
+#define REFLOW_BOARD_CLASS 1U         // Index of board mass class until set, medium.
+#define REFLOW_BOARD_GAIN 0.05f       // Probe correction gain per sample until set.
+#define REFLOW_BOARD_TAU_MAX 600.0f   // Longest board time constant accepted (s).
+
+/* Thermal mass scaling of profiles, see reflow_trajectory_scale() */
+#define REFLOW_MASS_MIN 0.25f         // Lightest board, relative to the board profiles are written for.
+#define REFLOW_MASS_MAX 4.0f          // Heaviest board, relative to the board profiles are written for.
+#define REFLOW_MASS_LAG_REF 10.0f     // Lag of the profiles' board behind the first heating ramp until set (s).
+#define REFLOW_MASS_RATE_MAX 3.0f     // Fastest ramp scaling produces, solder paste limit (deg C/s).
+
+/* Profile optimizer defaults */
+#define REFLOW_OPT_AMBIENT 25.0f  // Ambient temperature without an identified one (deg C).
+#define REFLOW_OPT_END 50.0f      // Cool-down target (deg C).
+#define REFLOW_OPT_HEADROOM 0.8f  // Fraction of heater output planned with.
+#define REFLOW_OPT_MARGIN 0.1f    // Fraction of every limit band kept clear.
+
+/* Conformance limit defaults, eutectic Sn63/Pb37 paste */
+#define REFLOW_LIQUIDUS 183.0f  // Liquidus temperature (deg C).
+#define REFLOW_SOAK_LO 100.0f   // Soak band lower bound (deg C).
+#define REFLOW_SOAK_HI 150.0f   // Soak band upper bound (deg C).
+#define REFLOW_PEAK_MIN 205.0f  // Lowest peak temperature (deg C).
+#define REFLOW_PEAK_MAX 225.0f  // Highest peak temperature (deg C).
+#define REFLOW_TAL_MIN 30.0f    // Shortest time above liquidus (s).
+#define REFLOW_TAL_MAX 90.0f    // Longest time above liquidus (s).
+#define REFLOW_SOAK_MIN 60.0f   // Shortest soak (s).
+#define REFLOW_SOAK_MAX 150.0f  // Longest soak (s).
+#define REFLOW_RAMP_MAX 3.0f    // Highest ramp rate (deg C/s).
+#define REFLOW_RMS_MAX 10.0f    // Highest RMS tracking error (deg C).
+
+/* Cooling actuator controller defaults */
+#define REFLOW_FAN_KP 400.0f    // Output per deg C above setpoint, full output 10 deg C above.
+#define REFLOW_FAN_SLEW 1000.0f // Largest output change per second, about 4 s from off to full.
+
+/* Adaptive control rate defaults */
+#define REFLOW_RATE_DIV_MAX 4U     // Nominal sampling periods per iteration once steady.
+#define REFLOW_RATE_DIV_LIMIT 8U   // Largest divider settable, scan period must fit the sampling timer.
+#define REFLOW_RATE_BAND 2.0f      // Largest zone error of a steady oven (deg C).
+#define REFLOW_RATE_SLOPE 0.5f     // Largest setpoint rate of a steady oven (deg C/s), soak ramps are steady.
+#define REFLOW_RATE_SETTLE 10.0f   // Time steady before every halving of the rate (s).
+
+/* Control loop heartbeat, three missed samples trip the watchdog, no sooner than its second check. */
+#define REFLOW_WDG_TIMEOUT_MS(Ts) ((uint32_t)fmaxf(3.0f * (Ts) * 1000.0f, 2.0f * (float)WDG_CHECK_MS))
+
+/* Oldest sample acted on, a sample queued for a nominal period has a newer one behind it (us). */
+#define REFLOW_SAMPLE_MAX_AGE_US(Ts) ((uint32_t)((Ts) * 1000000.0f))
+
+/* Control loop timing limits, see reflow_timing_check() */
+#define REFLOW_SCAN_MIN MAX31855K_CONVERSION_S // Shortest scan period, faster scans would repeat conversions (s).
+#define REFLOW_TIMING_BUDGET 0.5f // Share of scan period a scan and of sampling period a PID iteration may take.
+
+/* Conversion-aligned sampling, see "reflow align" */
+#define REFLOW_TC_ALIGN false         // Pace thermocouple reads by conversions of the first MAX31855K.
+#define REFLOW_ALIGN_PROBE_MS 400U    // Longest search for conversion boundaries before sampling starts (ms).
+#define REFLOW_ALIGN_STEP 20U         // Read delay after a read returned the conversion read before (sampling timer counts).
+#define REFLOW_ALIGN_LOCK_READS 64U   // Reads without such a repeat before the read period is shortened.
+
+/* Gain schedule configuration parameters */
+#define REFLOW_MAX_BANDS 4 // Maximum number of setpoint bands in PID gain schedule.
+
+/* Reflow profile segment: ramp to target temperature, then dwell there. */
+typedef struct
+{
+    float ramp_rate; // Setpoint ramp rate (deg C/s), 0 steps setpoint and waits for oven to reach target.
+    float target;    // Target temperature (deg C).
+    uint32_t dwell;  // Time held at target once reached (s), 0 to continue immediately.
+} Reflow_Segment;
 
-/* Reflow profile phase characteristic. */
+/* Reflow profile, segments are run in order. */
 typedef struct
 {
-    enum
-    {
-        REACHTEMP,      // Attain a specific temperature with maximum gradient.
-        REACHTIME,      // Run profile element for specified time.
-    } const phase_type; // REACHTEMP or REACHTIME
+    char name[REFLOW_PROFILE_NAME_LEN];           // Profile name, eg. solder paste.
+    uint8_t num_segments;                         // Number of segments, 1 to REFLOW_MAX_SEGMENTS.
+    Reflow_Segment segments[REFLOW_MAX_SEGMENTS]; // Profile segments.
+} Reflow_Profile;
 
-    uint32_t reach_temp;
-    uint32_t reach_time;
-} Reflow_Phase;
+/* Precomputed setpoint trajectory of a segment ramp, setpoint of ramp sample k is start + k * step. */
+typedef struct
+{
+    float start;          // Setpoint when ramp begins (deg C).
+    float step;           // Setpoint change per nominal sampling period (deg C).
+    uint32_t num_samples; // Samples until setpoint reaches target, 0 if setpoint steps to target.
+    bool cooling;         // Target is below ramp start, cooling actuator is driven.
+    uint32_t dwell;       // Time held at target once reached (s), scaled to board thermal mass.
+} Reflow_Ramp;
 
-/* Reflow controller active object */
+/* Zone controller gains persisted with NVS_KEY_PID_GAINS. */
+typedef struct
+{
+    float Kp;
+    float Ki;
+    float Kd;
+    float tau;
+    float Kff;
+} Reflow_Gains;
+
+/* Parameter set double-buffered between command thread (writer) and reflow thread (reader).
+ * The writer fills the back buffer and publishes it by incrementing seq. A published
+ * buffer is only rewritten after the next one is published, so the reader copies it
+ * without a lock and retries if seq moved meanwhile, see reflow_params_fetch().
+ */
+typedef struct
+{
+    void *buf[2];          // Buffers, buf[seq % 2] holds the published set.
+    size_t size;           // Size of a set (bytes).
+    volatile uint32_t seq; // Publish count, only incremented by the writer.
+} Reflow_Params;
+
+/* Conveyor mode zone setpoints and belt output, double-buffered with Reflow_Params. */
+typedef struct
+{
+    float setpoint[REFLOW_MAX_ZONES]; // Zone setpoints (deg C).
+    float belt;                       // Belt drive output (PWM counts).
+} Reflow_Conveyor;
+
+/* Zone stability in conveyor mode, error statistics are exponentially weighted over REFLOW_CONVEYOR_WINDOW. */
+typedef struct
+{
+    float mean;     // Mean error, setpoint minus temperature (deg C).
+    float var;      // Error variance (deg C^2).
+    float in_band;  // Time error has stayed within conveyor_band (s).
+    bool stable;    // Error stayed within band for conveyor_settle.
+} Reflow_Stability;
+
+/* Scheduled job added with "reflow schedule add", runs its profile runs times. */
+typedef struct
+{
+    Reflow_Profile profile; // Profile loaded when job was added.
+    uint32_t start_ms;      // Earliest start of next run (ms since reset).
+    uint32_t runs;          // Runs left, 0 in a Reflow_Job_Event clears the schedule.
+    uint32_t idle_ms;       // Time from end of one run to earliest start of the next (ms).
+    float preheat;          // Temperature zones hold ahead of every run (deg C), 0 for none.
+    uint32_t lead_ms;       // Time preheat starts ahead of every run (ms).
+} Reflow_Job;
+
+/* Job event posted with SCHEDULE_SIG by "reflow schedule", allocated from event pool. */
+typedef struct
+{
+    Event base;     // Inherit base Event class.
+    Reflow_Job job; // Job to add, clears the schedule if it has no runs.
+} Reflow_Job_Event;
+_Static_assert(sizeof(Reflow_Job_Event) <= EVENT_POOL_LINE_BLOCK_SZ, "Job event must fit an event pool block");
+
+/* PID gain schedule persisted with NVS_KEY_PID_SCHEDULE. */
+typedef struct
+{
+    uint32_t num_bands;                   // Number of bands, 0 for fixed gains.
+    PID_band_t bands[REFLOW_MAX_BANDS];   // Bands, sorted by upper setpoint bound.
+} Reflow_Schedule;
+
+/* Heater PWM power curve persisted with NVS_KEY_PWM_CAL. */
+typedef struct
+{
+    uint32_t valid;                 // Curve was calibrated, zone heaters are linearized.
+    float power[PWMLIN_CAL_POINTS]; // Power of every calibrated duty, fraction of full power.
+} Reflow_Pwm_Curve;
+
+/* Control loop timing set with "reflow set", persisted with NVS_KEY_TIMING. */
+typedef struct
+{
+    float sample_period; // Nominal sampling period (s), TS_MIN to TS_MAX.
+    float pwm_period;    // Zone heater PWM period (s), PWM_PERIOD_MIN to sample_period.
+} Reflow_Timing;
+
+/* Performance measurements: id, name. Timing values are in microseconds. */
+#define REFLOW_PMS(X)                                                                                                        \
+    X(CNT_SAMPLES, "SAMPLES")                   /* Samples processed. */                                                     \
+    X(CNT_MISSED_DEADLINES, "MISSED DEADLINES") /* Samples late by over half a period or processed past the next trigger. */ \
+    X(CNT_FAULTS_RIDDEN, "FAULTS RIDDEN")       /* Samples with transient thermocouple errors held on the model. */          \
+    X(JITTER_MIN_US, "JITTER MIN US")           /* Minimum |measured - nominal| sampling period. */                          \
+    X(JITTER_MAX_US, "JITTER MAX US")           /* Maximum |measured - nominal| sampling period. */                          \
+    X(JITTER_MEAN_US, "JITTER MEAN US")         /* Mean |measured - nominal| sampling period. */                             \
+    X(PID_TIME_MAX_US, "PID MAX US")            /* Maximum PID iteration compute time for all zones. */                      \
+    X(SPI_TIME_MAX_US, "SPI MAX US")            /* Maximum thermocouple scan time (trigger to last DMA complete). */         \
+    X(SPI_TIME_LAST_US, "SPI LAST US")          /* Most recent thermocouple scan time. */
+
+#define REFLOW_PM_ID(id, name) id,
+#define REFLOW_PM_NAME(id, name) name,
+
+typedef enum
+{
+    REFLOW_PMS(REFLOW_PM_ID)
+
+    NUM_U16_PMS // Number of performance measurements
+} Reflow_pms_t;
+
+/* Number of recent samples kept for fixed-point PID self-check. */
+#define REFLOW_TRACE_LEN 64U
+
+/* Telemetry record type identifiers, first payload byte of a telemetry frame. */
+#define REFLOW_TELEMETRY_TYPE 0x01U
+#define REFLOW_HISTORY_TYPE 0x03U
+#define REFLOW_RUN_TYPE 0x04U
+#define REFLOW_HISTORY_PACK_TYPE 0x09U
+
+/* Most packed sample bytes per "reflow history pack" frame, so a frame fits CMD_ASYNC_CHUNK. */
+#define REFLOW_HISTORY_PACK_SIZE 224U
+
+/* Longest line of "reflow status brief", with every zone. */
+#define REFLOW_STATUS_LINE_LEN 192U
+
+/* Longest wait of "reflow status" for the reflow thread to read thermocouples while idle. */
+#define REFLOW_REFRESH_TIMEOUT_MS 100U
+
+/* Latest thermocouple acquisition, written once per sample and read through a seqlock, so
+ * status readers never touch the SPI bus or the thermocouple instances. */
+typedef struct
+{
+    uint32_t count;                       // Acquisitions since boot, 0 if none yet.
+    uint32_t tick;                        // Kernel tick count of acquisition (ms).
+    MAX31855K_err_t err;                  // First thermocouple read error.
+    uint8_t err_tc;                       // Index of thermocouple that reported err.
+    uint8_t num_thermocouples;            // Number of thermocouples in temp and cj.
+    float temp[REFLOW_MAX_THERMOCOUPLES]; // Hot junction temperatures (deg C), NIST-corrected if enabled, calibrated.
+    float raw[REFLOW_MAX_THERMOCOUPLES];  // Hot junction temperatures before calibration (deg C).
+    float cj[REFLOW_MAX_THERMOCOUPLES];   // Cold junction temperatures (deg C), NAN if injected.
+    Analog_t analog;                      // Heater current, ambient and supply at acquisition.
+} Reflow_Latest;
+
+/* Conversion-aligned sampling, set up by the reflow thread while the sampling timer is stopped,
+ * then updated by the sampling timer and scan ISRs only. Periods are in sampling timer counts. */
+typedef struct
+{
+    bool active;              // Reads are paced by conversions of thermocouple 0.
+    bool track_only;          // In-flight read only tracks conversions, it is not accumulated.
+    uint32_t period;          // Read period, kept just below the conversion period.
+    uint32_t scan_period;     // Nominal scan period, reads are accumulated at this rate on average.
+    uint32_t due;             // Time accumulated towards the next accumulated read.
+    uint32_t prev_data;       // Frame of thermocouple 0 at previous read.
+    uint32_t since_repeat;    // Reads since the last repeat.
+    uint32_t repeat_interval; // Reads between the last two repeats, 0 until measured.
+    uint32_t repeats;         // Reads that returned the conversion read before.
+    uint32_t aged;            // Accumulated reads with an age estimate.
+    float age_sum;            // Sum of estimated ages of accumulated reads (ms).
+    float age_max;            // Largest estimated age of an accumulated read (ms).
+} Reflow_Align;
+
+/* Search for conversion boundaries of thermocouple 0 before aligned sampling starts, one read
+ * per ALIGN_TICK_SIG while the sampling timer counts freely. Times are in sampling timer counts. */
+typedef struct
+{
+    bool active;         // Search runs, the sampling timer starts once it finished.
+    uint32_t prev_data;  // Frame of thermocouple 0 at previous read.
+    uint32_t first;      // Time of first boundary.
+    uint32_t last;       // Time of last boundary.
+    uint32_t gap;        // Shortest time between two boundaries.
+    uint32_t boundaries; // Boundaries found.
+} Reflow_Probe;
+
+/* Binary PID telemetry record, COBS-framed with CRC-16 while streaming is on. */
+typedef struct __attribute__((packed))
+{
+    uint8_t type;       // REFLOW_TELEMETRY_TYPE.
+    uint32_t timestamp; // Sample time (ms).
+    uint8_t state;      // Reflow_State.
+    uint8_t segment;    // Profile segment index.
+    uint8_t zone;       // Heater zone index.
+    float setpoint;     // Setpoint temperature (deg C).
+    float temp;         // Zone temperature (deg C).
+    float proportional; // PID proportional term.
+    float integral;     // PID integral term.
+    float derivative;   // PID derivative term.
+    uint16_t pwm;       // PWM compare value.
+    uint8_t oven;       // Oven index, see reflow_init().
+} Reflow_Telemetry;
+
+/* Run history dump frame, one encoded block per frame (see history.h). */
+typedef struct __attribute__((packed))
+{
+    uint8_t type;          // REFLOW_HISTORY_TYPE.
+    uint32_t first;        // Index of block's first sample within run.
+    uint16_t num_samples;  // Samples held in block, at most HISTORY_BLOCK_SAMPLES.
+    float period;          // Sampling period (s).
+    History_block_t block; // Encoded samples, out is mean zone output.
+    uint8_t oven;          // Oven index, see reflow_init().
+} Reflow_History_Frame;
+
+/* Run history dump frame of "reflow history pack", as many samples as fit its data.
+ * Every sample is, as varints (see pack.h): zigzag temperature change in 1/HISTORY_TEMP_SCALE
+ * deg C, then zigzag output change shifted left once with bit 0 set if the state changed,
+ * then the new state if it did. The first sample of a frame changes from 0 and state 0. */
+typedef struct __attribute__((packed))
+{
+    uint8_t type;                           // REFLOW_HISTORY_PACK_TYPE.
+    uint32_t first;                         // Index of frame's first sample within run.
+    uint16_t num_samples;                   // Samples packed in data.
+    float period;                           // Sampling period (s).
+    uint8_t data[REFLOW_HISTORY_PACK_SIZE]; // Packed samples, not sent past the last one.
+} Reflow_History_Pack_Frame;
+
+_Static_assert(FRAME_ENCODED_SIZE(sizeof(Reflow_History_Pack_Frame)) <= CMD_ASYNC_CHUNK, "Packed history frame fits a command step");
+
+/* Run history dump formats */
+typedef enum
+{
+    REFLOW_HISTORY_CSV,  // CSV lines.
+    REFLOW_HISTORY_BIN,  // Binary frame per block.
+    REFLOW_HISTORY_PACK, // Binary frames of packed samples.
+} Reflow_History_Format;
+
+/* Run history dump in progress, resumed by the command module in steps. */
 typedef struct
+{
+    Reflow_History_Format format; // Output format.
+    bool header;    // CSV header written.
+    uint32_t first; // First dumped sample.
+    uint32_t next;  // Next sample to write.
+    uint32_t count; // Samples of run when dump started.
+    struct Reflow_Active *ao; // Controller whose run is dumped.
+} Reflow_History_Dump;
+
+/* Run start record, archived ahead of the run's history blocks. */
+typedef struct __attribute__((packed))
+{
+    uint8_t type;                          // REFLOW_RUN_TYPE.
+    uint32_t timestamp;                    // Run start time (ms since reset).
+    uint8_t state;                         // First Reflow_State of run, RAMP_STATE, AUTOTUNE_STATE, STEPRESP_STATE, CONVEYOR_STATE, PREHEAT_STATE, CALIBRATE_STATE or SCRIPT_STATE.
+    char profile[REFLOW_PROFILE_NAME_LEN]; // Profile name.
+    char batch[ARCHIVE_BATCH_LEN];         // Batch label, see archive_batch().
+    uint8_t oven;                          // Oven index, see reflow_init().
+} Reflow_Run_Record;
+
+/* Reflow controller active object */
+typedef struct Reflow_Active
 {
     Active reflow_base; // Inherited base Active object class.
+    uint8_t oven;       // Index of oven controlled, see reflow_init().
+
+    /* Heater zones, PID state is kept in its own array so the batched
+     * control tick iterates over contiguous controller memory.
+     */
+    uint8_t num_zones;
+    Reflow_zone_cfg_t zones[REFLOW_MAX_ZONES];
+    Heater_t zone_heater[REFLOW_MAX_ZONES]; // Zone heater outputs.
+    PID_t zone_pid[REFLOW_MAX_ZONES];  // Zone PID controllers.
+    float zone_temp[REFLOW_MAX_ZONES]; // Most recent zone temperature samples.
+    float zone_out[REFLOW_MAX_ZONES];  // Most recent zone PWM outputs.
+    uint8_t num_thermocouples;         // Number of scanned thermocouples.
+
+    /* Cooling actuator */
+    bool has_fan;      // Cooling actuator fitted.
+    Heater_t fan;      // Cooling actuator output.
+    Cooling_t cooling; // Cooling actuator controller.
+
+    /* Conveyor mode */
+    bool has_belt;                                  // Conveyor belt drive fitted.
+    Heater_t belt;                                  // Conveyor belt drive output.
+    Reflow_Conveyor conveyor;                       // Applied zone setpoints and belt output.
+    uint32_t conveyor_seq;                          // Publish count of conveyor settings applied.
+    Reflow_Stability zone_stability[REFLOW_MAX_ZONES]; // Zone stability since conveyor mode started.
+    ActiveCond zones_stable;                        // Flag per stable zone, raises ZONES_STABLE_SIG.
 
-    /* PWM attributes */
-    TIM_HandleTypeDef *pwm_timer_handle;
-    uint32_t pwm_channel;
+    /* Run scheduler, jobs[0] starts next, see Reflow_job_tick() */
+    Reflow_Job jobs[REFLOW_MAX_JOBS]; // Queued jobs, in order added.
+    uint32_t num_jobs;                // Number of queued jobs.
+    bool job_running;                 // Preheat or reflow process in progress belongs to jobs[0].
+    bool job_held;                    // jobs[0] is due but held back, reason logged once.
 
     /* Timer instances */
     TimeEvent reflow_time_evt; // Time event for REACHTIME reflow phases.
-    osTimerId_t pid_timer_id;  // 1/Ts Hz timer for PID calculations.
+    TimeEvent schedule_time_evt; // Periodic schedule check while jobs are queued.
+    TimeEvent watch_time_evt;    // Periodic status push while watched.
+    TimeEvent align_time_evt;    // Reads of the conversion boundary search.
+    osTimerId_t pid_timer_id;  // scans/Ts Hz timer triggering thermocouple DMA reads for PID calculations.
+    TIM_HandleTypeDef *sample_timer_handle; // Hardware sampling timer, replaces pid_timer_id if not NULL.
+    uint8_t wdg_id;                         // Control loop heartbeat, checked in on every sample.
 
     /* Other variables */
-    Reflow_State state;                                   // State variable for state machine.
-    PID_t pid_params;                                     // PID parameters.
-    float step_size;                                      // Temperature step size for REACHTIME phases (deg C / sample).
+    Hsm hsm;                                              // Reflow state machine.
     float setpoint;                                       // Setpoint temperature.
-    const Reflow_Phase reflow_phases[NUM_PROFILE_PHASES]; // Reflow phase characteristics.
-} Reflow_Active;
+    float temp;                                           // Most recent oven temperature, mean of zone temperatures.
+    float sample_period;                                  // Nominal sampling period (s), PID Ts is measured per sample.
+    uint8_t scans;                                        // Thermocouple scans per nominal sampling period, see reflow_scans().
+    float pwm_period;                                     // Zone heater PWM period (s).
+    float acq_period;                                     // Nominal period of published samples (s), scan period in step response experiments.
+    uint32_t prev_timestamp;                              // DWT cycle count of previous sample.
+    bool prev_sample_valid;                               // prev_timestamp belongs to current reflow process.
+    uint32_t gain_seq;                                    // Publish count of zone gains applied to controllers.
+    uint32_t profile_seq;                                 // Publish count of profile applied.
+    volatile uint32_t stream_decimation;                  // Stream telemetry every Nth sample, 0 if streaming is off.
+    uint32_t stream_count;                                // Samples since last telemetry frame.
+    volatile uint32_t watch_period_ms;                    // Period of status push (ms), 0 if nobody watches.
+    float trace_setpoint[REFLOW_TRACE_LEN];               // Recent setpoints, oldest overwritten first.
+    float trace_temp[REFLOW_MAX_ZONES][REFLOW_TRACE_LEN]; // Recent zone temperature samples.
+    uint32_t trace_count;                                 // Samples recorded into trace since reflow start.
+    Reflow_Profile profile;                               // Active reflow profile.
+    uint8_t segment;                                      // Index of current profile segment.
+    Reflow_Ramp ramps[REFLOW_MAX_SEGMENTS];               // Setpoint trajectory of every profile segment.
+    uint32_t ramp_sample;                                 // Samples since current ramp began.
+    uint32_t reach_count;                                 // Samples target was reached, ramps without rate.
+    Reflow_Schedule schedule;                             // PID gain schedule shared by all zones.
+    PID_schedule_t pid_schedule;                          // Zone controller view of schedule.
+    Autotune_t autotune;                                  // Relay autotune experiment.
+    Excite_t excite;                                      // Step response experiment.
+    Pwmlin_cal_t pwm_cal;                                 // PWM power calibration experiment.
+    Script_t script;                                      // Scripted profile of SCRIPT_STATE.
+    Recipe_t recipe;                                      // Recipe run by "reflow recipe run".
+    Recipe_vm_t recipe_vm;                                // Interpreter of recipe, context of its script.
+    uint32_t recipe_seq;                                  // Publish count of recipe.
+    Reflow_Pwm_Curve pwm_curve;                           // Calibrated power curve of zone heaters.
+    Pwmlin_t pwm_lin;                                     // Zone heater linearization table, built from pwm_curve.
+    bool smith_enabled;                                   // Zone PIDs act through Smith predictors.
+    Rate_t rate;                                          // Adaptive control rate of reflow processes.
+    bool rate_enabled;                                    // Rate adapts, see reflow_rate_active().
+    uint8_t sample_div;                                   // Nominal sampling periods per sample the timer runs at.
+    Smith_model_t smith_model;                            // Oven FOPDT model shared by zone predictors.
+    Smith_t zone_smith[REFLOW_MAX_ZONES];                 // Zone Smith predictors.
+
+    /* Cascade control, zone_pid output is the heater element setpoint of zone_inner in cascade zones */
+    bool cascade_enabled;                                 // Cascade zones run both loops.
+    uint32_t cascade_div;                                 // Outer loop runs every Nth sample.
+    uint32_t cascade_count;                               // Samples since sampling started.
+    float cascade_Ts;                                     // Time since outer loop last ran (s).
+    PID_t zone_inner[REFLOW_MAX_ZONES];                   // Heater element controllers.
+    float zone_element_temp[REFLOW_MAX_ZONES];            // Most recent heater element temperature samples.
+    float zone_element_sp[REFLOW_MAX_ZONES];              // Heater element setpoints of outer loops.
+
+    /* Online oven model, temp[k] = a * temp[k-1] + b * out[k-1-delay] / OUT_MAX_INIT + c */
+    RLS_t model_rls;                                      // Estimate of (a, b, c).
+    float model_out[SMITH_MAX_DELAY + 1];                 // Past mean zone outputs, oldest at model_head.
+    uint32_t model_head;                                  // Index of oldest past output.
+    uint32_t model_delay;                                 // Modelled dead time (samples), from Smith model.
+    uint32_t model_samples;                               // Samples since sampling started.
+    float model_prev_temp;                                // Previous oven temperature.
+
+    Conform_t conform;                                    // Profile conformance of reflow process in progress.
+    float conform_last[CONFORM_NUM_METRICS];              // Metrics of last completed reflow process.
+    float conform_prev[CONFORM_NUM_METRICS];              // Metrics of the one before, compared against.
+    uint32_t conform_failed;                              // Failed metrics of last completed reflow process.
+    uint32_t conform_runs;                                // Completed reflow processes since reset.
+
+    Filter_cfg_t filter_cfg;                              // Thermocouple filter configuration.
+    float filter_lowpass;                                 // Butterworth cutoff replacing IIR (Hz), 0 for IIR.
+    Filter_t tc_filter[REFLOW_MAX_THERMOCOUPLES];         // Thermocouple filters, in scan order.
+
+    /* Sensor fusion, zone temperatures are Kalman estimates of voted readings while fuse_enabled */
+    bool fuse_enabled;                                    // Zone temperatures and PID derivatives come from zone_fuse.
+    Fuse_cfg_t fuse_cfg;                                  // Noise configuration of zone filters.
+    Fuse_t zone_fuse[REFLOW_MAX_ZONES];                   // Zone temperature and rate estimators.
+    float zone_rate[REFLOW_MAX_ZONES];                    // Zone temperature rate estimates (deg C/s), 0 without fusion.
+    uint32_t fuse_timestamp;                              // Timestamp of previous fused sample.
+
+    /* Sensor fault ride-through, see reflow_fault_ride() */
+    uint8_t tc_faults;                                    // Consecutive samples held on the model.
+
+    /* Board temperature observer, ramps without a rate may complete on its estimate */
+    Board_t board;                                        // Joint temperature observer of board class in use.
+    const char *board_class;                              // Name of board class in use.
+    int8_t board_probe;                                   // Board probe thermocouple correcting observer, -1 for none.
+    bool board_reach;                                     // Ramps without a rate reach target on estimated board temperature.
+    float board_temp;                                     // Latest joint temperature estimate (deg C).
+
+    /* Thermal mass scaling of profile ramps and dwells, see reflow_trajectory_scale() */
+    float mass;                                           // Board thermal mass relative to the profiles' board, 0 to estimate.
+    float mass_lag_ref;                                   // Lag of the profiles' board behind first heating ramp (s).
+    float mass_scale;                                     // Thermal mass current run is scaled to.
+    bool mass_estimating;                                 // First heating ramp with a rate has not completed yet.
+    float mass_lag_sum;                                   // Sum of lags over second half of first heating ramp (s).
+    uint32_t mass_lag_count;                              // Number of lags summed.
+    float mass_lag;                                       // Lag measured by last estimate (s), NAN if none.
+
+    /* Hardware-in-the-loop mode, samples are injected by host (see reflow_hil_cmd()) */
+    Reflow_Hil_Mode hil;                                  // Samples come from "reflow inject", heaters stay disabled.
+    volatile bool hil_sampling;                           // Injected samples are published to subscribers (step mode).
+    bool hil_temp_valid;                                  // hil_temp was injected since HIL mode was turned on.
+    float hil_temp[REFLOW_MAX_THERMOCOUPLES];             // Last injected thermocouple temperatures (deg C).
+    volatile uint32_t hil_ms;                             // Virtual time of last injected sample (ms), step mode.
+    uint32_t hil_cycles;                                  // Timestamp of last injected sample (cycles), step mode.
+    uint32_t dwell_samples;                               // Samples left in dwell, step mode counts samples instead of time.
+
+    /* Status snapshot, see reflow_status_put() */
+    Reflow_Status status_snap;                            // Snapshot after latest event.
+    seqlock_t status_lock;                                // Guards status_snap.
+
+    /* Thermocouple acquisition, scan ISR and sampling trigger */
+    MAX31855K_t *thermocouples;                           // Thermocouple instances of oven, scanned in index order.
+    MAX31855K_scan_t scan;                                // Scan of thermocouples, completes in reflow_sample_ready().
+    uint32_t sample_timestamp;                            // DWT cycle count when in-flight scan was triggered.
+
+    /* Oversampling accumulator, scans since last sample event (scan ISR, trigger with interrupts masked). */
+    uint8_t acq_oversample;                               // Scans averaged per sample, set when sampling starts.
+    uint32_t acq_sum_hj[REFLOW_MAX_THERMOCOUPLES / 2];    // Hot junction sums (0.25 deg C), packed pairs.
+    uint32_t acq_sum_cj[REFLOW_MAX_THERMOCOUPLES / 2];    // Cold junction sums (0.0625 deg C), packed pairs.
+    uint8_t acq_scans;                                    // Scans accumulated.
+    MAX31855K_err_t acq_err;                              // First read error of accumulated scans.
+    uint8_t acq_err_tc;                                   // Index of thermocouple that reported acq_err.
+    uint8_t acq_err_mask;                                 // Thermocouples with a read error in any accumulated scan.
+
+    /* Conversion-aligned sampling, only changed while sampling is stopped, and its tracking state. */
+    bool tc_align;                                        // Reads are aligned to conversions of thermocouple 0.
+    Reflow_Align align;                                   // Tracking state of aligned reads.
+    Reflow_Probe probe;                                   // Conversion boundary search before aligned reads.
+
+    /* Latest acquisition, written by scan ISR, or by reflow thread with interrupts masked. */
+    Reflow_Latest latest;                                 // Latest acquisition.
+    seqlock_t latest_lock;                                // Guards latest.
+
+    /* Thermocouple corrections, only changed while sampling is stopped or with interrupts masked. */
+    bool tc_nist;                                         // Readings are NIST-corrected.
+    Tccal_points_t tc_cal_points[REFLOW_MAX_THERMOCOUPLES]; // Reference points, persisted with NVS_KEY_TC_CAL.
+    Tccal_t tc_cal[REFLOW_MAX_THERMOCOUPLES];             // Corrections built from tc_cal_points, applied by scan ISR.
 
-/* Callback function prototype for event handler. */
-typedef Reflow_Status (*ReflowAction)(Reflow_Active *const ao, Event const *const evt);
+    /* Parameter sets double-buffered from the command thread, see Reflow_Params */
+    Reflow_Profile profile_upload;                        // Profile being uploaded with "reflow profile".
+    Reflow_Profile profile_bufs[2];                       // Profiles loaded with "reflow profile load".
+    Reflow_Params profile_params;                         // Publishes profile_bufs.
+    Reflow_Gains gain_bufs[2][REFLOW_MAX_ZONES];          // Zone gains set with "reflow set".
+    Reflow_Params gain_params;                            // Publishes gain_bufs.
+    Reflow_Conveyor conveyor_bufs[2];                     // Conveyor settings set with "reflow conveyor".
+    Reflow_Params conveyor_params;                        // Publishes conveyor_bufs.
+    Recipe_t recipe_upload;                               // Recipe being uploaded with "reflow recipe".
+    Recipe_t recipe_bufs[2];                              // Recipes loaded with "reflow recipe load".
+    Reflow_Params recipe_params;                          // Publishes recipe_bufs.
+
+    /* Requests of commands, started by reflow thread */
+    Autotune_cfg_t autotune_request;                      // Relay experiment requested by "reflow autotune".
+    Excite_cfg_t stepresp_request;                        // Excitation requested by "reflow stepresp".
+    Pwmlin_cal_cfg_t calibrate_request;                   // Calibration requested by "reflow calibrate".
+    bool calibrate_clear;                                 // Calibration table is dropped instead.
+    Script_def_t const *script_request;                   // Script requested by "reflow script".
+    Reflow_Timing timing_request;                         // Timing set by "reflow set", unless a run started meanwhile.
+
+    History_t run_history;                                // Samples of the current or last run, restarted when sampling starts.
+
+    /* Performance measurements */
+    uint16_t pms[NUM_U16_PMS];                            // Counters, indexed by Reflow_pms_t.
+    uint32_t jitter_sum_us;                               // Jitter sum for mean jitter, restarted when pms are cleared.
+    uint32_t jitter_cnt;                                  // Jitter samples summed.
+    cmd_pm_hist_t period_us;                              // Control loop period between sample triggers (us).
+} Reflow_Active;
 
 static void reflow_evt_handler(Reflow_Active *const ao, Event const *const evt); // Event handler.
-static inline void displayPIDParams();                                           // Display PID parameters.
-static inline void displayProfileParams();                                       // Display reflow profile phase parameters.
-static inline void displayState();                                               // Display current state.
+static void reflow_evt_process(Reflow_Active *const ao, Event const *const evt); // Handle event, snapshot not yet updated.
+static Hsm_Status Reflow_stop(Reflow_Active *const ao);                          // Abort reflow process.
+static Hsm_Status Reflow_sample(Reflow_Active *const ao, Event const *const evt); // Run PID iteration on sample.
+static inline Reflow_State reflow_state(Reflow_Active const *const ao);          // Current reflow state.
+static Hsm_Status Reflow_next_segment(Reflow_Active *const ao);                  // Advance to next profile segment.
+static Hsm_Status Reflow_script_done(Reflow_Active *const ao, Script_status_t status); // Complete or abort scripted profile.
+static Hsm_Status Reflow_run_start(Reflow_Active *const ao, float current_temp);  // Start reflow process with active profile.
+static void reflow_trajectory_build(Reflow_Active *const ao, float start_temp);  // Precompute segment ramps.
+static void reflow_trajectory_scale(Reflow_Active *const ao, uint8_t first);     // Scale ramps and dwells to board mass.
+static void reflow_mass_estimate(Reflow_Active *const ao);                       // Scale rest of run to first ramp's lag.
+static bool reflow_target_reached(Reflow_Active *const ao, float temp, float target); // Qualify oven reaching target.
+static inline void displayPIDParams(Reflow_Active const *const ao);                                           // Display PID parameters.
+static inline void displayProfileParams(Reflow_Active const *const ao);                                       // Display reflow profile segments.
+static inline void displayState(Reflow_Active const *const ao);                                               // Display current state.
+static void reflow_status_fields(Reflow_Active *const ao);                                          // Output status as structured fields.
 static uint32_t reflow_status_cmd(uint32_t argc, const char **argv);             // Display various reflow parameters and state.
 static uint32_t reflow_start_cmd(uint32_t argc, const char **argv);              // Start reflow process command handler.
 static uint32_t reflow_stop_cmd(uint32_t argc, const char **argv); 			     // Stop reflow process command handler.
-static uint32_t reflow_set_cmd(uint32_t argc, const char **argv);                // Set PID parameters.
-static void reflow_pid_iteration(void *argument);                                // Discrete PID controller iteration.
-static inline bool readTemperature(float *const temp);                           // Read thermocouple temperature.
-
-
-/* Reflow active object. */
-static Reflow_Active reflow_ao = {
-    .reflow_phases = {{.phase_type = REACHTEMP, .reach_temp = 100},                       // Pre-heat
-                      {.phase_type = REACHTIME, .reach_temp = 150, .reach_time = 120},    // Soak
-                      {.phase_type = REACHTEMP, .reach_temp = 215},                       // Ramp-up
-                      {.phase_type = REACHTIME, .reach_temp = 215, .reach_time = 5},      // Peak
-                      {.phase_type = REACHTEMP, .reach_temp = 35}}                        // Cool-down
+static uint32_t reflow_set_cmd(uint32_t argc, const char **argv);                // Set PID parameters and control loop timing.
+static uint32_t reflow_stream_cmd(uint32_t argc, const char **argv);             // Turn binary telemetry streaming on or off.
+static uint32_t reflow_watch_cmd(uint32_t argc, const char **argv);              // Set or stop periodic status push.
+static uint32_t reflow_pidcheck_cmd(uint32_t argc, const char **argv);           // Compare fixed-point and float PID on recorded trace.
+static uint32_t reflow_profile_cmd(uint32_t argc, const char **argv);            // Show, upload or load reflow profile.
+static uint32_t reflow_sched_cmd(uint32_t argc, const char **argv);              // Show or edit PID gain schedule.
+static uint32_t reflow_autotune_cmd(uint32_t argc, const char **argv);           // Start relay autotune experiment.
+static uint32_t reflow_smith_cmd(uint32_t argc, const char **argv);              // Show or set Smith predictor mode and model.
+static uint32_t reflow_cascade_cmd(uint32_t argc, const char **argv);            // Show or set cascade control.
+static uint32_t reflow_fuse_cmd(uint32_t argc, const char **argv);               // Show or set zone sensor fusion.
+static uint32_t reflow_board_cmd(uint32_t argc, const char **argv);              // Show or set board temperature observer.
+static uint32_t reflow_optimize_cmd(uint32_t argc, const char **argv);           // Plan fastest profile within paste limits.
+static void reflow_cascade_apply(Reflow_Active *const ao);                       // Set zone controller limits for cascade mode.
+static bool reflow_cascade_due(Reflow_Active *const ao, float Ts, float *const outer_Ts); // Cascade outer loops run on sample.
+static float reflow_zone_control(Reflow_Active *const ao, uint8_t z, float setpoint, float Ts, bool outer_due, float outer_Ts); // Zone output.
+static uint32_t reflow_conveyor_cmd(uint32_t argc, const char **argv);           // Show, set or start conveyor mode.
+static Hsm_Status Reflow_conveyor_sample(Reflow_Active *const ao, Event const *const evt); // Hold zone setpoints on sample.
+static void reflow_stability_update(Reflow_Active *const ao, uint8_t zone, float error, float Ts); // Update zone stability.
+static uint32_t reflow_jobs_cmd(uint32_t argc, const char **argv);               // Show, add or clear scheduled jobs.
+static void reflow_job_request(Reflow_Active *const ao, Reflow_Job const *const job); // Add requested job or clear schedule.
+static Hsm_Status Reflow_job_tick(Reflow_Active *const ao, bool preheated);       // Preheat or start due job.
+static void reflow_job_done(Reflow_Active *const ao);                            // Count completed run of jobs[0].
+static void reflow_jobs_clear(Reflow_Active *const ao);                          // Drop all scheduled jobs.
+static Hsm_Status Reflow_preheat_sample(Reflow_Active *const ao, Event const *const evt); // Hold preheat temperature on sample.
+static Hsm_Status Reflow_autotune_sample(Reflow_Active *const ao, Event const *const evt); // Run relay on sample.
+static uint32_t reflow_stepresp_cmd(uint32_t argc, const char **argv);           // Start step response experiment.
+static Hsm_Status Reflow_stepresp_sample(Reflow_Active *const ao, Event const *const evt); // Run excitation on sample.
+static uint32_t reflow_calibrate_cmd(uint32_t argc, const char **argv);          // Show, start or drop PWM power calibration.
+static Hsm_Status Reflow_calibrate_sample(Reflow_Active *const ao, Event const *const evt); // Run calibration on sample.
+static void reflow_pwm_lin_apply(Reflow_Active *const ao);                       // Linearize zone heaters if calibrated.
+static inline uint8_t reflow_scans(float Ts);                                    // Thermocouple scans per sampling period.
+static mod_err_t reflow_timing_check(Reflow_Active const *const ao, Reflow_Timing const *const timing); // Validate timing.
+static void reflow_timing_apply(Reflow_Active *const ao, Reflow_Timing const *const timing); // Apply control loop timing.
+static void reflow_schedule_apply(Reflow_Active *const ao);                      // Apply gain schedule to zone controllers.
+static uint32_t reflow_model_cmd(uint32_t argc, const char **argv);              // Show, apply or reset identified oven model.
+static void reflow_model_update(Reflow_Active *const ao);                        // Feed sample to oven model estimator.
+static bool reflow_model_get(Reflow_Active const *const ao, Smith_model_t *const model, float *const ambient); // Derive FOPDT model.
+static inline void displayModel(Reflow_Active const *const ao);                                               // Display identified oven model.
+static inline void displayPwmCurve(Reflow_Active const *const ao);                                            // Display heater PWM power curve.
+static float reflow_temps_update(Reflow_Active *const ao, Sample_Event const *const sample); // Filter sample into zone temperatures.
+static float reflow_temps_hold(Reflow_Active *const ao, Sample_Event const *const sample);   // Predict zone temperatures over faulty sample.
+static bool reflow_fault_ride(Reflow_Active *const ao, Sample_Event const *const sample);   // Ride through transient thermocouple error.
+static void reflow_filter_show(Reflow_Active const *const ao, Filter_cfg_t const *const cfg);                   // Display thermocouple filter configuration.
+static uint32_t reflow_filter_cmd(uint32_t argc, const char **argv);             // Show or set thermocouple filter.
+static uint32_t reflow_history_cmd(uint32_t argc, const char **argv);            // Dump recorded run as CSV or binary frames.
+static uint32_t reflow_script_cmd(uint32_t argc, const char **argv);             // List or start scripted profiles.
+static uint32_t reflow_recipe_cmd(uint32_t argc, const char **argv);             // Show, upload, load or run recipe.
+static uint32_t reflow_conform_cmd(uint32_t argc, const char **argv);            // Show conformance of last run or set limits.
+static void reflow_conform_finish(Reflow_Active *const ao);                      // Score completed run and display summary.
+static inline void displayConform(Reflow_Active const *const ao);                                             // Display conformance limits and last run.
+static void reflow_history_add(Reflow_Active *const ao, float oven_temp);        // Record sample into run history.
+static void reflow_history_frame(Reflow_Active const *const ao, Reflow_History_Frame *const record, uint32_t first); // Copy history block into frame.
+static void reflow_archive_block(Reflow_Active const *const ao, uint32_t first); // Append history block to run archive.
+static cmd_async_status_t reflow_history_step(void *ctx, bool cancel);           // Write next chunk of history dump.
+static mod_err_t reflow_history_send(const void *record, size_t len);            // Queue binary dump frame by reference.
+static void reflow_history_sent(void *ctx);                                       // Release sent dump frame.
+static uint32_t reflow_hil_cmd(uint32_t argc, const char **argv);                // Show or set hardware-in-the-loop mode.
+static uint32_t reflow_inject_cmd(uint32_t argc, const char **argv);             // Inject thermocouple sample in HIL mode.
+static mod_err_t reflow_hil_post(Reflow_Active *const ao);                       // Publish injected sample event.
+static inline bool reflow_time_ok(Reflow_Active const *const ao);                // Virtual time scale allows closed-loop control.
+static mod_err_t reflow_profile_check(Reflow_Profile const *const profile);      // Validate reflow profile.
+static void reflow_params_load(Reflow_Active *const ao);                         // Restore stored gains and profile.
+static nvs_key_t reflow_nvs_key(Reflow_Active const *const ao, nvs_key_t key);  // Key of oven's setting.
+static void reflow_gains_save(Reflow_Active const *const ao, Reflow_Gains const *const gains); // Store zone gains.
+static void reflow_gains_apply(Reflow_Active *const ao);                         // Apply newly published zone gains.
+static void *reflow_params_edit(Reflow_Params *const params);                    // Back buffer, holding a copy of published set.
+static void reflow_params_publish(Reflow_Params *const params);                  // Publish back buffer.
+static bool reflow_params_fetch(Reflow_Params const *const params, uint32_t *const seq, void *const dst); // Copy set if newer.
+static void reflow_stream_sample(Reflow_Active *const ao, uint8_t zone);          // Send zone telemetry frame.
+static void reflow_sampling_start(Reflow_Active *const ao, uint8_t oversample);   // Start periodic sampling.
+static void reflow_sampling_stop(Reflow_Active *const ao);                        // Stop periodic sampling.
+static void reflow_sampling_timer_start(Reflow_Active *const ao, uint32_t period, uint32_t since); // Start hardware sampling timer.
+static void reflow_sampling_div(Reflow_Active *const ao, uint8_t div);           // Sample every div nominal periods.
+static uint32_t reflow_rate_cmd(uint32_t argc, const char **argv);               // Show or set adaptive control rate.
+static inline bool reflow_rate_active(Reflow_Active const *const ao);            // Control rate may adapt.
+static void reflow_rate_reset(Reflow_Active *const ao);                          // Return to full control rate.
+static void reflow_wdg_update(Reflow_Active const *const ao);                    // Fit heartbeat timeout to slowest rate.
+static void reflow_sample_age_update(Reflow_Active *const ao);                   // Fit stale sample age to nominal period.
+static void reflow_sample_trigger(void *argument);                               // Start thermocouple DMA scan.
+static inline float reflow_tc_temp(Reflow_Active const *const ao, MAX31855K_t const *const max); // Hot junction temperature of read thermocouple.
+static inline float reflow_tc_cal(Reflow_Active const *const ao, uint8_t tc, float reading); // Apply thermocouple calibration (any context).
+static uint32_t reflow_tc_calibrate_cmd(uint32_t argc, const char **argv);      // Show, add or drop thermocouple reference points.
+static void reflow_sample_ready(void *ctx, MAX31855K_t const *devs, uint8_t num_devs); // Thermocouple DMA scan complete callback.
+static void reflow_align_probe_start(Reflow_Active *const ao);                   // Start search for conversion period and phase.
+static void reflow_align_probe_step(Reflow_Active *const ao);                    // Take next read of the search.
+static bool reflow_align_next(Reflow_Active *const ao);                          // Account read, true if it only tracks conversions.
+static bool reflow_align_track(Reflow_Active *const ao, MAX31855K_t const *const max); // Detect repeated conversion, true if read is accumulated.
+static uint32_t reflow_align_cmd(uint32_t argc, const char **argv);              // Show or set conversion-aligned sampling.
+static void reflow_sample_accumulate(Reflow_Active *const ao, MAX31855K_err_t err, uint8_t err_tc, MAX31855K_t const *devs, uint8_t num_devs); // Add scan to sample.
+static void reflow_sample_post(Reflow_Active *const ao);                         // Publish sample event.
+static inline bool readTemperature(Reflow_Active *const ao, float *const temp);                           // Read thermocouple temperature.
+static void reflow_latest_put(Reflow_Active *const ao, Reflow_Latest const *const src); // Store latest acquisition (any context).
+static void reflow_latest_get(Reflow_Active const *const ao, Reflow_Latest *const dst); // Copy latest acquisition (thread).
+static bool reflow_latest_refresh(Reflow_Active *const ao, Reflow_Latest *const dst);                     // Copy latest acquisition, read while idle.
+static bool reflow_latest_oven_temp(Reflow_Active const *const ao, Reflow_Latest const *const src, float *const temp); // Mean of zone thermocouples.
+static float reflow_zone_vote(Reflow_Active const *const ao, Reflow_zone_cfg_t const *const zone, float const *const tc_temp); // Median of zone thermocouples.
+static void reflow_status_put(Reflow_Active *const ao);                          // Store status snapshot (reflow thread).
+static void reflow_watch_send(Reflow_Active *const ao);                          // Send status snapshot as telemetry frame (reflow thread).
+static void reflow_status_read(Reflow_Active *const ao, Reflow_Status *const dst); // Copy status snapshot (thread).
+static void reflow_status_brief(Reflow_Active const *const ao, Reflow_Status const *const snap);                // Print snapshot as one line.
+static void reflow_update_pms(Reflow_Active *const ao, Sample_Event const *const sample, uint32_t pid_cycles, uint32_t periods);
+static inline uint16_t cycles_to_us(uint32_t cycles);                            // Convert DWT cycles to saturated microseconds.
+
+
+_Static_assert(REFLOW_NUM_OVENS > 0 && REFLOW_NUM_OVENS <= NVS_MAX_OVENS, "Every oven needs its own stored settings");
+
+/* Reflow active objects, one per oven. */
+static Reflow_Active reflow_ovens[REFLOW_NUM_OVENS] = {
+    [0 ... REFLOW_NUM_OVENS - 1] = {
+        .profile = {.name = "DEFAULT",
+                    .num_segments = 5,
+                    .segments = {{.ramp_rate = 0.0f, .target = 100.0f},             // Pre-heat
+                                 {.ramp_rate = 50.0f / 120.0f, .target = 150.0f},   // Soak
+                                 {.ramp_rate = 0.0f, .target = 215.0f},             // Ramp-up
+                                 {.ramp_rate = 0.0f, .target = 215.0f, .dwell = 5}, // Peak
+                                 {.ramp_rate = 0.0f, .target = 35.0f}}},            // Cool-down
+        .tc_align = REFLOW_TC_ALIGN,
+        .tc_nist = REFLOW_TC_NIST,
+        .tc_cal = {[0 ... REFLOW_MAX_THERMOCOUPLES - 1] = {.num_segments = 1, .gain = {1.0f}}}}};
+
+/* Variables for "scope add" of the first oven, zone ones are of the first zone, or the second. */
+SCOPE_VAR(setpoint, &reflow_ovens[0].setpoint, SCOPE_FLOAT);
+SCOPE_VAR(temp, &reflow_ovens[0].temp, SCOPE_FLOAT);
+SCOPE_VAR(segment, &reflow_ovens[0].segment, SCOPE_U8);
+SCOPE_VAR(zone0_temp, &reflow_ovens[0].zone_temp[0], SCOPE_FLOAT);
+SCOPE_VAR(zone0_out, &reflow_ovens[0].zone_out[0], SCOPE_FLOAT);
+SCOPE_VAR(zone0_p, &reflow_ovens[0].zone_pid[0].proportional, SCOPE_FLOAT);
+SCOPE_VAR(zone0_i, &reflow_ovens[0].zone_pid[0].integral, SCOPE_FLOAT);
+SCOPE_VAR(zone0_d, &reflow_ovens[0].zone_pid[0].derivative, SCOPE_FLOAT);
+SCOPE_VAR(zone0_rate, &reflow_ovens[0].zone_rate[0], SCOPE_FLOAT);
+SCOPE_VAR(zone1_temp, &reflow_ovens[0].zone_temp[1], SCOPE_FLOAT);
+SCOPE_VAR(zone1_out, &reflow_ovens[0].zone_out[1], SCOPE_FLOAT);
+SCOPE_VAR(fan_out, &reflow_ovens[0].cooling.out, SCOPE_FLOAT);
+SCOPE_VAR(board_temp, &reflow_ovens[0].board_temp, SCOPE_FLOAT);
+SCOPE_VAR(script_time, &reflow_ovens[0].script.time, SCOPE_FLOAT);
+
+/* Statically allocated threads, event rings and sample timers, one per oven */
+static StaticTask_t reflow_thread_cb[REFLOW_NUM_OVENS];
+static uint64_t SRAM2_BSS reflow_stack[REFLOW_NUM_OVENS][ACTIVE_STACK_STORAGE_SZ(REFLOW_THREAD_STACK_SZ) / sizeof(uint64_t)];
+static Active_msg reflow_ring[REFLOW_NUM_OVENS][REFLOW_EVENT_MSG_COUNT];
+static StaticTimer_t pid_timer_cb[REFLOW_NUM_OVENS];
+
+/* Thread, heartbeat and sample timer names of every oven, numbered if there are several. */
+static const struct
+{
+    const char *thread; // Reflow thread.
+    const char *wdg;    // Control loop heartbeat.
+    const char *timer;  // Software sample timer.
+} oven_names[] = {
+#if REFLOW_NUM_OVENS == 1
+    {"reflow", "control", "pid"},
+#else
+    {"reflow0", "control0", "pid0"},
+    {"reflow1", "control1", "pid1"},
+    {"reflow2", "control2", "pid2"},
+    {"reflow3", "control3", "pid3"},
+#endif
+};
+_Static_assert(ARRAY_SIZE(oven_names) >= REFLOW_NUM_OVENS, "oven_names must name every oven");
+
+/* Board mass classes of "reflow board", lightest first. */
+static const struct
+{
+    const char *name;  // Class name.
+    Board_class_t cls; // Time constants of class.
+} board_classes[] = {
+    {"light", {.tau_surface = 15.0f, .tau_joint = 5.0f}},  // Thin boards, small parts.
+    {"medium", {.tau_surface = 30.0f, .tau_joint = 15.0f}},
+    {"heavy", {.tau_surface = 60.0f, .tau_joint = 40.0f}}, // Thick boards, inner planes, large parts.
 };
 
+/* Binary run history dump frames, one sent by reference while the next is encoded. */
+static uint8_t SRAM1_DMA history_tx[2][FRAME_ENCODED_SIZE(sizeof(Reflow_History_Pack_Frame))];
+static volatile bool history_tx_busy[2];
+static uint8_t history_tx_next;
+
+_Static_assert(sizeof(Reflow_History_Frame) <= sizeof(Reflow_History_Pack_Frame), "Run history frames fit history_tx");
+
+_Static_assert(sizeof(Recipe_t) <= NVS_MAX_VALUE_LEN, "Recipe must fit a stored value");
+
+/* Script requested by "reflow recipe run", its body interprets the recipe. */
+static const Script_def_t recipe_script = {.name = "recipe", .help = "Uploaded recipe, see recipe.h.", .fn = Recipe_Script};
+
+/* Run history dump in progress, of one oven at a time. */
+static Reflow_History_Dump history_dump;
+
 /* Unique module tag for logging information */
-static const char *TAG = "REFLOW";
+LOG_TAG_DEFINE("REFLOW");
+
+/* Names of reflow states, indexed by Reflow_State. */
+static const char *const reflow_names[] = {REFLOW_STATES(REFLOW_STATE_NAME)};
+_Static_assert(ARRAY_SIZE(reflow_names) == NUM_REFLOW_STATES, "reflow_names out of sync with Reflow_State");
+_Static_assert(RESET_STATE == REFLOW_STATE_RESET, "Idle state of status snapshot out of sync with Reflow_State");
 
-/* Names of reflow profile phases as null-terminated string constants. */
-static const char *reflow_names[NUM_REFLOW_STATES] = {REFLOW_PROFILE_PHASES_CSV};
+/* Conformance metric names and units, indexed by Conform_metric_t. */
+static const char *conform_names[CONFORM_NUM_METRICS] = {"peak", "tal", "soak", "ramp", "rms"};
+static const char *conform_units[CONFORM_NUM_METRICS] = {"deg C", "s", "s", "deg C/s", "deg C"};
 
 /* Information about reflow commands. */
 static const cmd_cmd_info reflow_cmd_infos[] = {
 { .cmd_name = "status",
   .cb = &reflow_status_cmd,
-  .help = "Dump information about reflow oven controller." },
+  .help = "Dump information about reflow oven controller, or its status snapshot as one line or binary frame.\r\nUsage: reflow status [brief | bin]" },
 { .cmd_name = "start",
 .cb = &reflow_start_cmd,
 .help = "Start reflow process." },
@@ -123,403 +899,6003 @@ static const cmd_cmd_info reflow_cmd_infos[] = {
   .help = "Stop reflow process." },
   { .cmd_name = "set",
     .cb = &reflow_set_cmd,
-    .help = "Set pid parameters (Kp, Ki, Kd, Tau)\r\nUsage: reflow set <param> <value> [<param2> <value2> ...] "}};
+    .help = "Set pid parameters (Kp, Ki, Kd, Tau, Kff) of all zones, or of one zone if selected, all or none are applied.\r\n"
+            "Ts sets the sampling period (s) and pwm the zone heater PWM period (s), at most Ts, while no reflow process runs.\r\n"
+            "PWM period follows Ts if equal, or is shortened to it. Timing must fit worst scan and PID times measured so far.\r\n"
+            "Usage: reflow set [zone=<n>] <param>=<value> [<param2>=<value2> ...], \"<param> <value>\" also accepted"},
+  { .cmd_name = "stream",
+    .cb = &reflow_stream_cmd,
+    .help = "Stream COBS-framed binary PID telemetry instead of log lines.\r\nUsage: reflow stream <on|off> [decimation]" },
+  { .cmd_name = "watch",
+    .cb = &reflow_watch_cmd,
+    .help = "Push the status snapshot as telemetry frame, as \"reflow status bin\", at a rate of at most 10 Hz instead of polling.\r\n"
+            "Usage: reflow watch [<hz> | off]" },
+  { .cmd_name = "pidcheck",
+    .cb = &reflow_pidcheck_cmd,
+    .help = "Compare fixed-point PID against float PID over the most recent samples." },
+  { .cmd_name = "profile",
+    .cb = &reflow_profile_cmd,
+    .help = "Show reflow profile, or upload and load a new one segment by segment.\r\n"
+            "Usage: reflow profile [new <name> [<ramp> <target> <dwell> ...] | add <ramp deg C/s> <target deg C> <dwell s> ... | load]" },
+  { .cmd_name = "optimize",
+    .cb = &reflow_optimize_cmd,
+    .help = "Plan the fastest profile the oven model can follow within the conformance limits and upload it, load it\r\n"
+            "with \"reflow profile load\". Uses the identified model if stable, else the Smith model. Start defaults to ambient.\r\n"
+            "Usage: reflow optimize [amb=<deg C>] [start=<deg C>] [end=<deg C>] [headroom=<0..1>] [margin=<0..0.5>]" },
+  { .cmd_name = "sched",
+    .cb = &reflow_sched_cmd,
+    .help = "Show PID gain schedule, or edit it while no reflow process runs. Bands are added in increasing order.\r\n"
+            "Usage: reflow sched [clear | add <upper deg C> <Kp> <Ki> <Kd> <Kff>]" },
+  { .cmd_name = "autotune",
+    .cb = &reflow_autotune_cmd,
+    .help = "Oscillate oven around setpoint with full-on/off relay output and propose PID gains. Stop aborts it.\r\n"
+            "Usage: reflow autotune <setpoint deg C> [hysteresis deg C] [cycles]" },
+  { .cmd_name = "stepresp",
+    .cb = &reflow_stepresp_cmd,
+    .help = "Drive every zone open-loop with a step or PRBS output sequence, sampling at the scan rate. Samples are\r\n"
+            "streamed as binary telemetry and recorded into run history. Stop aborts it. Outputs are PWM counts.\r\n"
+            "Usage: reflow stepresp <step | prbs> [lo=<out>] [hi=<out>] [hold=<s>] [steps=<n>] [order=<3..15>] [limit=<deg C>]" },
+  { .cmd_name = "smith",
+    .cb = &reflow_smith_cmd,
+    .help = "Show or set Smith predictor dead time compensation, settable while no reflow process runs.\r\n"
+            "Usage: reflow smith [on | off | model <K deg C/count> <T s> <L s>]" },
+  { .cmd_name = "cascade",
+    .cb = &reflow_cascade_cmd,
+    .help = "Show or set cascade control of zones with a heater element thermocouple, settable while no reflow process runs.\r\n"
+            "Zone gains then set the element setpoint (deg C) every div samples, inner gains drive the heater every sample.\r\n"
+            "Usage: reflow cascade [on | off | div <1..20> | inner <Kp> <Ki> <Kd>]" },
+  { .cmd_name = "fuse",
+    .cb = &reflow_fuse_cmd,
+    .help = "Show or set zone sensor fusion, settable while no reflow process runs. Zone temperatures are then Kalman\r\n"
+            "estimates of their voted thermocouples through the Smith model, if set, and PID derivatives act on their rates.\r\n"
+            "Usage: reflow fuse [on | off | noise <q (deg C/s)^2/s> <r deg C^2>]" },
+  { .cmd_name = "board",
+    .cb = &reflow_board_cmd,
+    .help = "Show or set board temperature observer, settable while no reflow process runs. With reach on, ramps without\r\n"
+            "a rate complete once the estimated board temperature reaches target. A probe thermocouple corrects the estimate.\r\n"
+            "Mass scales ramp rates down and dwells up by the board's thermal mass relative to the profile's board, 1 runs\r\n"
+            "profiles as written. Auto estimates it from the oven's lag behind the first heating ramp against the reference lag.\r\n"
+            "Usage: reflow board [class <light | medium | heavy | <tau surface s> <tau joint s>> | reach <on | off> |\r\n"
+            "                    probe <tc | none> [gain] | mass <relative mass | auto [<reference lag s>]>]" },
+  { .cmd_name = "conveyor",
+    .cb = &reflow_conveyor_cmd,
+    .help = "Show zone stability of conveyor mode, set zone setpoints and belt output, or start conveyor mode.\r\n"
+            "Zones hold their setpoints until \"reflow stop\", settings apply on the next sample. Belt output is in PWM counts.\r\n"
+            "Usage: reflow conveyor [start] [zone=<n>] [sp=<deg C>] [belt=<out>]" },
+  { .cmd_name = "schedule",
+    .cb = &reflow_jobs_cmd,
+    .help = "Show scheduled jobs, add a job running the loaded profile <runs> times, or clear the schedule.\r\n"
+            "Runs start <in> s from now and at least <idle> s after the previous one ends, once the oven has cooled.\r\n"
+            "With preheat, zones hold <preheat> deg C from <lead> s ahead of every run, which then starts warm.\r\n"
+            "Usage: reflow schedule [add <in s> [runs=<n>] [idle=<s>] [preheat=<deg C>] [lead=<s>] | clear]" },
+  { .cmd_name = "model",
+    .cb = &reflow_model_cmd,
+    .help = "Show oven model identified during reflow and autotune runs, copy it to the Smith predictor or restart identification.\r\n"
+            "Usage: reflow model [apply | reset]" },
+  { .cmd_name = "filter",
+    .cb = &reflow_filter_cmd,
+    .help = "Show or set thermocouple filter, settable while no reflow process runs.\r\n"
+            "Usage: reflow filter [median <1..7, odd>] [alpha <0..1>] [outlier <deg C, 0 off>] [nist <0 | 1>]\r\n"
+            "                    [lowpass <Hz, 0 for alpha IIR>]" },
+  { .cmd_name = "align",
+    .cb = &reflow_align_cmd,
+    .help = "Show or set conversion-aligned sampling: thermocouples are read just after each conversion of the first\r\n"
+            "MAX31855K, instead of at any phase, up to a conversion late. Shows the estimated age of the readings.\r\n"
+            "Settable while no reflow process runs. Usage: reflow align [on | off]" },
+  { .cmd_name = "history",
+    .cb = &reflow_history_cmd,
+    .help = "Dump oven temperature, mean zone output and state of the last run, oldest sample first.\r\n"
+            "Usage: reflow history [csv | bin | pack], pack sends delta-encoded frames, several times shorter than csv" },
+  { .cmd_name = "conform",
+    .cb = &reflow_conform_cmd,
+    .help = "Show profile conformance of the last completed run against the one before, or set limits.\r\n"
+            "Usage: reflow conform [liquidus|soak_lo|soak_hi|<peak|tal|soak|ramp|rms>_<min|max>=<value> ...]" },
+  { .cmd_name = "hil",
+    .cb = &reflow_hil_cmd,
+    .help = "Show or set hardware-in-the-loop mode, settable while no reflow process runs. Heaters stay off,\r\n"
+            "samples come from \"reflow inject\" and are answered with a telemetry frame per zone.\r\n"
+            "Usage: reflow hil [on | free | off]" },
+  { .cmd_name = "inject",
+    .cb = &reflow_inject_cmd,
+    .help = "Inject temperature of every thermocouple in hardware-in-the-loop mode, one sampling period apart.\r\n"
+            "Usage: reflow inject <deg C> [<deg C> ...]" },
+  { .cmd_name = "script",
+    .cb = &reflow_script_cmd,
+    .help = "List built-in scripted profiles, or run one. Scripts wait for the oven, time out and branch on what they\r\n"
+            "measure, see script.h. Stop aborts them.\r\n"
+            "Usage: reflow script [<name>]" },
+  { .cmd_name = "recipe",
+    .cb = &reflow_recipe_cmd,
+    .help = "Show loaded recipe, upload one, load it or run it. Instructions are 16 hex digits each, 8 bytes\r\n"
+            "little-endian as laid out in recipe.h. Loaded recipes persist across resets, stop aborts a run.\r\n"
+            "Usage: reflow recipe [new [<insn> ...] | add <insn> ... | load | run]" },
+  { .cmd_name = "calibrate",
+    .cb = &reflow_calibrate_cmd,
+    .help = "Show heater PWM power curve, measure it or drop it. Calibration heats every zone past start, lets it cool\r\n"
+            "to start and applies each duty for window, then linearizes PWM zone heaters with the curve. Stop aborts it.\r\n"
+            "Usage: reflow calibrate [pwm [start=<deg C>] [preheat=<deg C>] [window=<s>] | pwm clear]" },
+  { .cmd_name = "rate",
+    .cb = &reflow_rate_cmd,
+    .help = "Show or set adaptive control rate of reflow processes. While zone errors stay within band and the setpoint\r\n"
+            "moves no faster than slope, sampling slows down by half every settle time, to 1/div of the nominal rate.\r\n"
+            "Segment changes and larger errors return to full rate. Held at full rate with Smith predictors or low-pass on.\r\n"
+            "Usage: reflow rate [on [div=<n>] [band=<deg C>] [slope=<deg C/s>] [settle=<s>] | off]" }};
 
-/* Client information for command module */
-static cmd_client_info reflow_client_info = {.client_name = "reflow", // Client name (first command line token)
-                                             .num_cmds = 4,
-                                             .cmds = reflow_cmd_infos,
-                                             .num_u16_pms = 0,
-                                             .u16_pms = NULL,
-                                             .u16_pm_names = NULL};
+/* Performance measurement names, indexed by Reflow_pms_t */
+static const char *const pm_names[] = {REFLOW_PMS(REFLOW_PM_NAME)};
+_Static_assert(ARRAY_SIZE(pm_names) == NUM_U16_PMS, "pm_names out of sync with Reflow_pms_t");
+
+/* Thermocouple command information */
+static cmd_cmd_info tc_cmd_infos[] = {
+  { .cmd_name = "calibrate",
+    .cb = &reflow_tc_calibrate_cmd,
+    .help = "Show thermocouple calibrations, or pair a reference temperature with the latest reading of a thermocouple.\r\n"
+            "One point corrects offset, two offset and gain, up to four make the correction piecewise linear.\r\n"
+            "A reading within 5 deg C of a point replaces it. Points persist across resets.\r\n"
+            "Usage: tc calibrate [<tc> <reference deg C> | <tc> clear]" }};
+
+/* Typed performance measurement info and client information for command module of oven n, whose
+ * commands are "reflow<suffix>" and "tc<suffix>". Handlers find their oven through cmd_ctx(). */
+#define REFLOW_OVEN_CLIENTS(n, suffix)                                   \
+    static const cmd_pm_info reflow_pm_info##suffix[] = {                \
+        {"PERIOD US", CMD_PM_HIST, &reflow_ovens[n].period_us}};         \
+    CMD_CLIENT_DEFINE(reflow##suffix,                                    \
+                      .num_cmds = ARRAY_SIZE(reflow_cmd_infos),          \
+                      .cmds = reflow_cmd_infos,                          \
+                      .num_u16_pms = NUM_U16_PMS,                        \
+                      .u16_pms = reflow_ovens[n].pms,                    \
+                      .u16_pm_names = pm_names,                          \
+                      .num_pms = 1,                                      \
+                      .pms = reflow_pm_info##suffix,                     \
+                      .ctx = &reflow_ovens[n]);                          \
+    CMD_CLIENT_DEFINE(tc##suffix,                                        \
+                      .num_cmds = ARRAY_SIZE(tc_cmd_infos),              \
+                      .cmds = tc_cmd_infos,                              \
+                      .ctx = &reflow_ovens[n])
+
+#if REFLOW_NUM_OVENS == 1
+REFLOW_OVEN_CLIENTS(0, );
+#else
+REFLOW_OVEN_CLIENTS(0, 0);
+REFLOW_OVEN_CLIENTS(1, 1);
+#if REFLOW_NUM_OVENS > 2
+REFLOW_OVEN_CLIENTS(2, 2);
+#endif
+#if REFLOW_NUM_OVENS > 3
+REFLOW_OVEN_CLIENTS(3, 3);
+#endif
+#endif
 
 /* Stop reflow process event signal */
 static const Event stop_evt = { .sig = STOP_REFLOW_SIG };
 
+/* Reflow states, defined with the state handlers. */
+static const Hsm_State reflow_running_state;
+REFLOW_STATES(REFLOW_STATE_DECL)
+
+/* Thermocouple instances of every oven, scanned in index order. */
+static MAX31855K_t SRAM1_DMA thermocouples[REFLOW_NUM_OVENS][REFLOW_MAX_THERMOCOUPLES];
+
+_Static_assert((REFLOW_MAX_THERMOCOUPLES & 1U) == 0, "Accumulator packs thermocouples in pairs");
+_Static_assert(REFLOW_OVERSAMPLE * 1372 * 4 <= INT16_MAX, "Sum of type K range readings must fit a packed lane");
+
+/* Conveyor zone stability, parameters read by the reflow thread on every sample. */
+static float conveyor_band = REFLOW_CONVEYOR_BAND;
+static float conveyor_settle = REFLOW_CONVEYOR_SETTLE;
+PARAM_DEFINE(PARAM_CONVEYOR_BAND, "reflow.conveyor_band", PARAM_FLOAT, &conveyor_band, PARAM_FLAG_PERSIST,
+             .def.f = REFLOW_CONVEYOR_BAND, .min.f = 0.1f, .max.f = 20.0f);
+PARAM_DEFINE(PARAM_CONVEYOR_SETTLE, "reflow.conveyor_settle", PARAM_FLOAT, &conveyor_settle, PARAM_FLAG_PERSIST,
+             .def.f = REFLOW_CONVEYOR_SETTLE, .min.f = 0.0f, .max.f = 600.0f);
+
 /*---------------------------------------------------------------------------*/
 /* State machine facilities... */
 
-static Reflow_Status Reflow_reset_INIT(Reflow_Active *const ao, Event const *const evt)
+/**
+ * @brief Reset state: heaters off, waiting for a start request.
+ */
+static Hsm_Status Reflow_reset(Reflow_Active *const ao, Event const *const evt)
+{
+    switch (evt->sig)
+    {
+    case ENTRY_SIG:
+        /* Disable PWM output signals and clear PID memory */
+        LOGI(TAG, "Turning PWM off.");
+        for(uint8_t z = 0; z < ao->num_zones; z++)
+        {
+            Heater_Set(&ao->zone_heater[z], 0);
+            Heater_Disable(&ao->zone_heater[z]);
+            PID_Reset(&ao->zone_pid[z]);
+            PID_Reset(&ao->zone_inner[z]);
+            Smith_Reset(&ao->zone_smith[z]);
+        }
+        if (ao->has_fan)
+        {
+            Heater_Set(&ao->fan, 0);
+            Heater_Disable(&ao->fan);
+        }
+        if (ao->has_belt)
+        {
+            Heater_Set(&ao->belt, 0);
+            Heater_Disable(&ao->belt);
+        }
+        Cooling_Reset(&ao->cooling);
+        if (ao->job_running)
+        {
+            /* Completed runs were counted before leaving, so a scheduled run or its preheat was aborted. */
+            LOGW(TAG, "Scheduled run aborted, schedule cleared.");
+            reflow_jobs_clear(ao);
+        }
+
+        LOGI(TAG, "Reflow oven controller initialized.");
+
+        /* Start requested during previous reflow process is handled now. */
+        if (!Active_recall(&ao->reflow_base))
+        {
+            LOGI(TAG, "Enter command \"reflow start\" to start reflow process.");
+        }
+        return HSM_HANDLED;
+
+    case START_REFLOW_SIG:
+    {
+        if (safety_tripped(ao->oven))
+        {
+            LOGW(TAG, "Safety trip latched, enter \"safety clear\" before starting reflow process.");
+            return HSM_HANDLED;
+        }
+        if (!reflow_time_ok(ao))
+        {
+            LOGW(TAG, "Time scale is %lu, enter \"ao timescale 1\" or \"reflow hil\" before starting reflow process.",
+                 Active_time_scale());
+            return HSM_HANDLED;
+        }
+
+        /* Check that oven temperature has cooled down. */
+        float current_temp = 0;
+        if (readTemperature(ao, &current_temp) != true)
+        {
+            LOGW(TAG, "MAX31855K Read Error, unable to start reflow process.");
+            return HSM_HANDLED;
+        }
+
+        float final_temp = ao->profile.segments[ao->profile.num_segments - 1].target;
+        if (current_temp > final_temp)
+        {
+            LOGW(TAG, "Oven temperature must cool to below %.0f before starting another run.", final_temp);
+            return HSM_HANDLED;
+        }
+        return Reflow_run_start(ao, current_temp);
+    }
+
+    case SCRIPT_SIG:
+    {
+        if (safety_tripped(ao->oven))
+        {
+            LOGW(TAG, "Safety trip latched, enter \"safety clear\" before starting script.");
+            return HSM_HANDLED;
+        }
+        if (!reflow_time_ok(ao))
+        {
+            LOGW(TAG, "Time scale is %lu, enter \"ao timescale 1\" or \"reflow hil\" before starting script.",
+                 Active_time_scale());
+            return HSM_HANDLED;
+        }
+        float current_temp = 0;
+        if (readTemperature(ao, &current_temp) != true)
+        {
+            LOGW(TAG, "MAX31855K Read Error, unable to start script.");
+            return HSM_HANDLED;
+        }
+        void *ctx = NULL;
+        if (ao->script_request == &recipe_script)
+        {
+            reflow_params_fetch(&ao->recipe_params, &ao->recipe_seq, &ao->recipe);
+            if (ao->recipe.num_insns == 0U)
+            {
+                LOGW(TAG, "No recipe loaded, enter \"reflow recipe load\" first.");
+                return HSM_HANDLED;
+            }
+            Recipe_Start(&ao->recipe_vm, &ao->recipe);
+            ctx = &ao->recipe_vm;
+        }
+        LOG("Starting script %s\r\n", ao->script_request->name);
+        Script_Init(&ao->script, ao->script_request, ctx, current_temp);
+        ao->setpoint = current_temp;
+        return Hsm_tran(&ao->hsm, &reflow_script_state);
+    }
+
+    case AUTOTUNE_SIG:
+        if (safety_tripped(ao->oven))
+        {
+            LOGW(TAG, "Safety trip latched, enter \"safety clear\" before starting autotune.");
+            return HSM_HANDLED;
+        }
+        if (!reflow_time_ok(ao))
+        {
+            LOGW(TAG, "Time scale is %lu, enter \"ao timescale 1\" or \"reflow hil\" before starting autotune.",
+                 Active_time_scale());
+            return HSM_HANDLED;
+        }
+        LOG("Starting autotune around %.1f deg C\r\n", ao->autotune_request.setpoint);
+        return Hsm_tran(&ao->hsm, &reflow_autotune_state);
+
+    case STEPRESP_SIG:
+        if (safety_tripped(ao->oven))
+        {
+            LOGW(TAG, "Safety trip latched, enter \"safety clear\" before starting step response.");
+            return HSM_HANDLED;
+        }
+        if (!reflow_time_ok(ao))
+        {
+            LOGW(TAG, "Time scale is %lu, enter \"ao timescale 1\" or \"reflow hil\" before starting step response.",
+                 Active_time_scale());
+            return HSM_HANDLED;
+        }
+        LOG("Starting step response, %s sequence of %u steps held %.1f s\r\n",
+            ao->stepresp_request.type == EXCITE_PRBS ? "PRBS" : "step", ao->stepresp_request.num_steps, ao->stepresp_request.hold);
+        return Hsm_tran(&ao->hsm, &reflow_stepresp_state);
+
+    case CALIBRATE_SIG:
+        if (ao->calibrate_clear)
+        {
+            ao->pwm_curve.valid = 0U;
+            reflow_pwm_lin_apply(ao);
+            if (nvs_set_deferred(reflow_nvs_key(ao, NVS_KEY_PWM_CAL), &ao->pwm_curve, sizeof(ao->pwm_curve)) != MOD_OK)
+            {
+                LOGW(TAG, "Dropped PWM power curve may return after reset.");
+            }
+            LOG("PWM power curve dropped, duty is the output\r\n");
+            return HSM_HANDLED;
+        }
+        if (safety_tripped(ao->oven))
+        {
+            LOGW(TAG, "Safety trip latched, enter \"safety clear\" before starting calibration.");
+            return HSM_HANDLED;
+        }
+        if (!reflow_time_ok(ao))
+        {
+            LOGW(TAG, "Time scale is %lu, enter \"ao timescale 1\" or \"reflow hil\" before starting calibration.",
+                 Active_time_scale());
+            return HSM_HANDLED;
+        }
+        LOG("Starting PWM calibration, %u duties held %.0f s from %.1f deg C\r\n",
+            PWMLIN_CAL_POINTS, ao->calibrate_request.window, ao->calibrate_request.start);
+        return Hsm_tran(&ao->hsm, &reflow_calibrate_state);
+
+    case CONVEYOR_SIG:
+        if (safety_tripped(ao->oven))
+        {
+            LOGW(TAG, "Safety trip latched, enter \"safety clear\" before starting conveyor mode.");
+            return HSM_HANDLED;
+        }
+        if (!reflow_time_ok(ao))
+        {
+            LOGW(TAG, "Time scale is %lu, enter \"ao timescale 1\" or \"reflow hil\" before starting conveyor mode.",
+                 Active_time_scale());
+            return HSM_HANDLED;
+        }
+        LOG("Starting conveyor mode, enter \"reflow stop\" to stop\r\n");
+        return Hsm_tran(&ao->hsm, &reflow_conveyor_state);
+
+    case PROFILE_LOAD_SIG:
+        /* Profile was validated by "reflow profile load", loads deferred meanwhile apply the latest once. */
+        if (reflow_params_fetch(&ao->profile_params, &ao->profile_seq, &ao->profile))
+        {
+            LOG("Loaded profile %s with %u segments\r\n", ao->profile.name, ao->profile.num_segments);
+            if (nvs_set_deferred(reflow_nvs_key(ao, NVS_KEY_PROFILE), &ao->profile, sizeof(ao->profile)) != MOD_OK)
+            {
+                LOGW(TAG, "Profile %s will not persist across resets.", ao->profile.name);
+            }
+        }
+        Active_recall(&ao->reflow_base); // Start deferred after load, if any.
+        return HSM_HANDLED;
+
+    case SCHEDULE_TICK_SIG:
+        return Reflow_job_tick(ao, false);
+
+    default:
+        return HSM_UNHANDLED;
+    }
+}
+
+/**
+ * @brief Running superstate of every reflow profile phase.
+ *
+ * Heaters and sampling run for as long as the reflow process is in this state,
+ * so every way out of it (completion, stop or sampling fault) turns them off.
+ */
+static Hsm_Status Reflow_running(Reflow_Active *const ao, Event const *const evt)
+{
+    switch (evt->sig)
+    {
+    case ENTRY_SIG:
+        clock_boost_acquire(); // Switch to full speed before timers start.
+        for(uint8_t z = 0; z < ao->num_zones && ao->hil == REFLOW_HIL_OFF; z++)
+        {
+            Heater_Enable(&ao->zone_heater[z]);
+        }
+        if (ao->has_fan && ao->hil == REFLOW_HIL_OFF)
+        {
+            Heater_Enable(&ao->fan);
+        }
+        ao->segment = 0;
+        ao->cascade_count = 0;
+        ao->cascade_Ts = ao->sample_period * (float)(ao->cascade_div - 1U); // First outer iteration sees a nominal period.
+        Conform_Reset(&ao->conform);
+        power_stop_lock(); // Heater PWM and sampling timer halt in STOP2.
+        reflow_sampling_start(ao, ao->scans);
+        return HSM_HANDLED;
+
+    case EXIT_SIG:
+        reflow_sampling_stop(ao);
+        power_stop_unlock();
+        clock_boost_release();
+        TimeEvent_disarm(&ao->reflow_time_evt);
+        return HSM_HANDLED;
+
+    case INIT_SIG:
+        return Hsm_tran(&ao->hsm, &reflow_ramp_state);
+
+    case START_REFLOW_SIG:
+    case PROFILE_LOAD_SIG:
+        /* Defer until reflow process in progress completes. */
+        if (Active_defer(&ao->reflow_base, evt) != MOD_OK)
+        {
+            LOGW(TAG, "Reflow process in progress, request dropped.");
+            return HSM_HANDLED;
+        }
+        LOG("Reflow process in progress, %s once it completes\r\n",
+            evt->sig == START_REFLOW_SIG ? "starting again" : "loading profile");
+        return HSM_HANDLED;
+
+    case CONVEYOR_SIG:
+    case CALIBRATE_SIG:
+    case SCRIPT_SIG:
+        LOGW(TAG, "Reflow process in progress, request dropped.");
+        return HSM_HANDLED;
+
+    case STOP_REFLOW_SIG:
+        return Reflow_stop(ao);
+
+    case SAFETY_TRIP_SIG:
+        LOGE(TAG, "Safety supervisor tripped, aborting reflow process.");
+        return Reflow_stop(ao);
+
+    case SAMPLE_READY_SIG:
+        return Reflow_sample(ao, evt);
+
+    default:
+        return HSM_UNHANDLED;
+    }
+}
+
+/**
+ * @brief Autotune state: relay experiment drives heaters, see Reflow_autotune_sample().
+ */
+static Hsm_Status Reflow_autotune(Reflow_Active *const ao, Event const *const evt)
+{
+    switch (evt->sig)
+    {
+    case ENTRY_SIG:
+        clock_boost_acquire(); // Switch to full speed before timers start.
+        for(uint8_t z = 0; z < ao->num_zones && ao->hil == REFLOW_HIL_OFF; z++)
+        {
+            Heater_Enable(&ao->zone_heater[z]);
+        }
+        Autotune_Init(&ao->autotune, &ao->autotune_request);
+        ao->setpoint = ao->autotune_request.setpoint;
+        power_stop_lock();
+        reflow_sampling_start(ao, ao->scans);
+        return HSM_HANDLED;
+
+    case EXIT_SIG:
+        reflow_sampling_stop(ao);
+        power_stop_unlock();
+        clock_boost_release();
+        return HSM_HANDLED;
+
+    case START_REFLOW_SIG:
+    case PROFILE_LOAD_SIG:
+    case AUTOTUNE_SIG:
+    case STEPRESP_SIG:
+    case CONVEYOR_SIG:
+    case CALIBRATE_SIG:
+    case SCRIPT_SIG:
+        LOGW(TAG, "Autotune in progress, request dropped.");
+        return HSM_HANDLED;
+
+    case STOP_REFLOW_SIG:
+        return Reflow_stop(ao);
+
+    case SAFETY_TRIP_SIG:
+        LOGE(TAG, "Safety supervisor tripped, aborting autotune.");
+        return Reflow_stop(ao);
+
+    case SAMPLE_READY_SIG:
+        return Reflow_autotune_sample(ao, evt);
+
+    default:
+        return HSM_UNHANDLED;
+    }
+}
+
+/**
+ * @brief Advance relay experiment on oven temperature and apply relay output to every zone.
+ *
+ * Zones share the relay so the experiment measures the whole oven, proposed gains apply to all zones.
+ */
+static Hsm_Status Reflow_autotune_sample(Reflow_Active *const ao, Event const *const evt)
+{
+    Sample_Event const *const sample = (Sample_Event const *)evt;
+    if (ao->hil != REFLOW_HIL_STEP)
+    {
+        wdg_checkin(ao->wdg_id);
+    }
+    if (!reflow_time_ok(ao))
+    {
+        LOGE(TAG, "Time scale changed to %lu without hardware-in-the-loop mode, aborting autotune.",
+             Active_time_scale());
+        return Reflow_stop(ao);
+    }
+    if (sample->err != MAX_OK && !reflow_fault_ride(ao, sample))
+    {
+        LOGE(TAG, "Could not read thermocouple %u temperature (%s), aborting autotune.",
+             sample->err_tc, MAX31855K_Err_Str(sample->err));
+        return Reflow_stop(ao);
+    }
+
+    float oven_temp = reflow_temps_update(ao, sample);
+
+    float Ts = ao->prev_sample_valid ? Active_cycles_to_s(sample->timestamp - ao->prev_timestamp)
+                                     : ao->sample_period;
+    ao->prev_timestamp = sample->timestamp;
+    ao->prev_sample_valid = true;
+
+    Autotune_t *const at = &ao->autotune;
+    uint8_t cycles = at->cycles;
+    Autotune_status_t status = Autotune_Step(at, oven_temp, Ts);
+    for (uint8_t z = 0; z < ao->num_zones; z++)
+    {
+        ao->zone_out[z] = at->out;
+        Heater_Set(&ao->zone_heater[z], (uint16_t)at->out);
+        if (ao->hil == REFLOW_HIL_STEP)
+        {
+            reflow_stream_sample(ao, z);
+        }
+    }
+    reflow_model_update(ao);
+    reflow_history_add(ao, oven_temp);
+    if (at->cycles != cycles)
+    {
+        LOGI(TAG, "Autotune cycle %u of %u complete.", at->cycles, AUTOTUNE_SETTLE_CYCLES + at->cfg.num_cycles);
+    }
+
+    switch (status)
+    {
+    case AUTOTUNE_RUNNING:
+        return HSM_HANDLED;
+
+    case AUTOTUNE_DONE:
+        LOG("Autotune complete: Ku %.3f, Tu %.1f s\r\n"
+            "Proposed gains, apply with: reflow set Kp %.3f Ki %.4f Kd %.3f\r\n",
+            at->Ku, at->Tu, at->gains.Kp, at->gains.Ki, at->gains.Kd);
+        break;
+
+    case AUTOTUNE_ERR_LIMIT:
+        LOGE(TAG, "Autotune aborted, oven reached %.1f deg C.", oven_temp);
+        break;
+
+    default:
+        LOGE(TAG, "Autotune aborted, no steady oscillation within %.0f s.", at->cfg.timeout);
+        break;
+    }
+    return Hsm_tran(&ao->hsm, &reflow_reset_state);
+}
+
+/**
+ * @brief Step response state: excitation sequence drives heaters open-loop, see Reflow_stepresp_sample().
+ *
+ * Scans are published as samples without averaging, so the response is recorded at the
+ * oversampled rate.
+ */
+static Hsm_Status Reflow_stepresp(Reflow_Active *const ao, Event const *const evt)
+{
+    switch (evt->sig)
+    {
+    case ENTRY_SIG:
+        clock_boost_acquire(); // Switch to full speed before timers start.
+        for(uint8_t z = 0; z < ao->num_zones && ao->hil == REFLOW_HIL_OFF; z++)
+        {
+            Heater_Enable(&ao->zone_heater[z]);
+        }
+        Excite_Init(&ao->excite, &ao->stepresp_request);
+        ao->setpoint = 0.0f; // Open loop, telemetry setpoint is unused.
+        power_stop_lock();
+        reflow_sampling_start(ao, 1U);
+        return HSM_HANDLED;
+
+    case EXIT_SIG:
+        reflow_sampling_stop(ao);
+        power_stop_unlock();
+        clock_boost_release();
+        return HSM_HANDLED;
+
+    case START_REFLOW_SIG:
+    case PROFILE_LOAD_SIG:
+    case AUTOTUNE_SIG:
+    case STEPRESP_SIG:
+    case CONVEYOR_SIG:
+    case CALIBRATE_SIG:
+    case SCRIPT_SIG:
+        LOGW(TAG, "Step response in progress, request dropped.");
+        return HSM_HANDLED;
+
+    case STOP_REFLOW_SIG:
+        return Reflow_stop(ao);
+
+    case SAFETY_TRIP_SIG:
+        LOGE(TAG, "Safety supervisor tripped, aborting step response.");
+        return Reflow_stop(ao);
+
+    case SAMPLE_READY_SIG:
+        return Reflow_stepresp_sample(ao, evt);
+
+    default:
+        return HSM_UNHANDLED;
+    }
+}
+
+/**
+ * @brief Advance excitation sequence and apply its output to every zone, recording and streaming the response.
+ *
+ * Zones share the output so the experiment measures the whole oven. Every sample is streamed
+ * as one telemetry frame per zone, whatever "reflow stream" is set to.
+ */
+static Hsm_Status Reflow_stepresp_sample(Reflow_Active *const ao, Event const *const evt)
+{
+    Sample_Event const *const sample = (Sample_Event const *)evt;
+    if (ao->hil != REFLOW_HIL_STEP)
+    {
+        wdg_checkin(ao->wdg_id);
+    }
+    if (!reflow_time_ok(ao))
+    {
+        LOGE(TAG, "Time scale changed to %lu without hardware-in-the-loop mode, aborting step response.",
+             Active_time_scale());
+        return Reflow_stop(ao);
+    }
+    if (sample->err != MAX_OK && !reflow_fault_ride(ao, sample))
+    {
+        LOGE(TAG, "Could not read thermocouple %u temperature (%s), aborting step response.",
+             sample->err_tc, MAX31855K_Err_Str(sample->err));
+        return Reflow_stop(ao);
+    }
+
+    float oven_temp = reflow_temps_update(ao, sample);
+
+    float Ts = ao->prev_sample_valid ? Active_cycles_to_s(sample->timestamp - ao->prev_timestamp)
+                                     : ao->acq_period;
+    ao->prev_timestamp = sample->timestamp;
+    ao->prev_sample_valid = true;
+
+    Excite_t *const ex = &ao->excite;
+    uint16_t step = ex->step;
+    Excite_status_t status = Excite_Step(ex, oven_temp, Ts);
+    for (uint8_t z = 0; z < ao->num_zones; z++)
+    {
+        ao->zone_out[z] = ex->out;
+        Heater_Set(&ao->zone_heater[z], (uint16_t)ex->out);
+        reflow_stream_sample(ao, z);
+    }
+    reflow_history_add(ao, oven_temp);
+    if (ex->step != step && status == EXCITE_RUNNING)
+    {
+        LOGD(TAG, "Step %u of %u, output %.0f.", ex->step, ex->cfg.num_steps, ex->out);
+    }
+
+    switch (status)
+    {
+    case EXCITE_RUNNING:
+        return HSM_HANDLED;
+
+    case EXCITE_DONE:
+        LOG("Step response complete, %lu samples of %.3f s recorded, dump with: reflow history bin\r\n",
+            ao->run_history.count, ao->acq_period);
+        break;
+
+    default:
+        LOGE(TAG, "Step response aborted, oven reached %.1f deg C.", oven_temp);
+        break;
+    }
+    return Hsm_tran(&ao->hsm, &reflow_reset_state);
+}
+
+/**
+ * @brief Calibration state: PWM power calibration drives heaters raw, see Reflow_calibrate_sample().
+ */
+static Hsm_Status Reflow_calibrate(Reflow_Active *const ao, Event const *const evt)
+{
+    switch (evt->sig)
+    {
+    case ENTRY_SIG:
+        clock_boost_acquire(); // Switch to full speed before timers start.
+        for(uint8_t z = 0; z < ao->num_zones; z++)
+        {
+            Heater_Linearize(&ao->zone_heater[z], NULL); // Duties are measured as applied.
+            if (ao->hil == REFLOW_HIL_OFF)
+            {
+                Heater_Enable(&ao->zone_heater[z]);
+            }
+        }
+        Pwmlin_Cal_Init(&ao->pwm_cal, &ao->calibrate_request);
+        ao->setpoint = ao->calibrate_request.start;
+        power_stop_lock();
+        reflow_sampling_start(ao, ao->scans);
+        return HSM_HANDLED;
+
+    case EXIT_SIG:
+        reflow_sampling_stop(ao);
+        power_stop_unlock();
+        clock_boost_release();
+        reflow_pwm_lin_apply(ao); // Restores table of previous curve if aborted.
+        return HSM_HANDLED;
+
+    case START_REFLOW_SIG:
+    case PROFILE_LOAD_SIG:
+    case AUTOTUNE_SIG:
+    case STEPRESP_SIG:
+    case CONVEYOR_SIG:
+    case CALIBRATE_SIG:
+    case SCRIPT_SIG:
+        LOGW(TAG, "Calibration in progress, request dropped.");
+        return HSM_HANDLED;
+
+    case STOP_REFLOW_SIG:
+        return Reflow_stop(ao);
+
+    case SAFETY_TRIP_SIG:
+        LOGE(TAG, "Safety supervisor tripped, aborting calibration.");
+        return Reflow_stop(ao);
+
+    case SAMPLE_READY_SIG:
+        return Reflow_calibrate_sample(ao, evt);
+
+    default:
+        return HSM_UNHANDLED;
+    }
+}
+
+/**
+ * @brief Advance PWM power calibration on oven temperature and apply its duty to every zone.
+ *
+ * Zones share the duty so the experiment measures the whole oven, the curve linearizes all zones.
+ * A completed curve is stored and applied when leaving the state.
+ */
+static Hsm_Status Reflow_calibrate_sample(Reflow_Active *const ao, Event const *const evt)
+{
+    Sample_Event const *const sample = (Sample_Event const *)evt;
+    if (ao->hil != REFLOW_HIL_STEP)
+    {
+        wdg_checkin(ao->wdg_id);
+    }
+    if (!reflow_time_ok(ao))
+    {
+        LOGE(TAG, "Time scale changed to %lu without hardware-in-the-loop mode, aborting calibration.",
+             Active_time_scale());
+        return Reflow_stop(ao);
+    }
+    if (sample->err != MAX_OK && !reflow_fault_ride(ao, sample))
+    {
+        LOGE(TAG, "Could not read thermocouple %u temperature (%s), aborting calibration.",
+             sample->err_tc, MAX31855K_Err_Str(sample->err));
+        return Reflow_stop(ao);
+    }
+
+    float oven_temp = reflow_temps_update(ao, sample);
+
+    float Ts = ao->prev_sample_valid ? Active_cycles_to_s(sample->timestamp - ao->prev_timestamp)
+                                     : ao->sample_period;
+    ao->prev_timestamp = sample->timestamp;
+    ao->prev_sample_valid = true;
+
+    Pwmlin_cal_t *const cal = &ao->pwm_cal;
+    uint8_t point = cal->point;
+    Pwmlin_cal_status_t status = Pwmlin_Cal_Step(cal, oven_temp, Ts);
+    for (uint8_t z = 0; z < ao->num_zones; z++)
+    {
+        ao->zone_out[z] = cal->out;
+        Heater_Set(&ao->zone_heater[z], (uint16_t)cal->out);
+        if (ao->hil == REFLOW_HIL_STEP)
+        {
+            reflow_stream_sample(ao, z);
+        }
+    }
+    reflow_history_add(ao, oven_temp);
+    if (cal->point != point)
+    {
+        LOGI(TAG, "Calibrated duty %u of %u, rise %.2f deg C.", point + 1U, PWMLIN_CAL_POINTS, cal->rise[point]);
+    }
+
+    switch (status)
+    {
+    case PWMLIN_CAL_RUNNING:
+        return HSM_HANDLED;
+
+    case PWMLIN_CAL_DONE:
+        ao->pwm_curve.valid = 1U;
+        memcpy(ao->pwm_curve.power, cal->power, sizeof(ao->pwm_curve.power));
+        if (nvs_set_deferred(reflow_nvs_key(ao, NVS_KEY_PWM_CAL), &ao->pwm_curve, sizeof(ao->pwm_curve)) != MOD_OK)
+        {
+            LOGW(TAG, "PWM power curve will not persist across resets.");
+        }
+        reflow_pwm_lin_apply(ao);
+        LOG("Calibration complete, PWM zone heaters are linearized:\r\n");
+        displayPwmCurve(ao);
+        break;
+
+    case PWMLIN_CAL_ERR_LIMIT:
+        LOGE(TAG, "Calibration aborted, oven reached %.1f deg C.", oven_temp);
+        break;
+
+    case PWMLIN_CAL_ERR_TIMEOUT:
+        LOGE(TAG, "Calibration aborted, %.1f deg C not reached within %.0f s.",
+             cal->phase == PWMLIN_PHASE_HEAT ? cal->cfg.start + cal->cfg.preheat : cal->cfg.start, cal->cfg.timeout);
+        break;
+
+    default:
+        LOGE(TAG, "Calibration failed, full duty heated %.2f deg C more than zero duty over window.",
+             cal->rise[PWMLIN_CAL_POINTS - 1U] - cal->rise[0]);
+        break;
+    }
+    return Hsm_tran(&ao->hsm, &reflow_reset_state);
+}
+
+/**
+ * @brief Conveyor state: zones hold their setpoints until stopped, see Reflow_conveyor_sample().
+ */
+static Hsm_Status Reflow_conveyor(Reflow_Active *const ao, Event const *const evt)
+{
+    switch (evt->sig)
+    {
+    case ENTRY_SIG:
+        clock_boost_acquire(); // Switch to full speed before timers start.
+        for(uint8_t z = 0; z < ao->num_zones && ao->hil == REFLOW_HIL_OFF; z++)
+        {
+            Heater_Enable(&ao->zone_heater[z]);
+        }
+        reflow_params_fetch(&ao->conveyor_params, &ao->conveyor_seq, &ao->conveyor);
+        if (ao->has_belt && ao->hil == REFLOW_HIL_OFF)
+        {
+            Heater_Enable(&ao->belt);
+            Heater_Set(&ao->belt, (uint16_t)ao->conveyor.belt);
+        }
+        memset(ao->zone_stability, 0, sizeof(ao->zone_stability));
+        ActiveCond_clear(&ao->zones_stable, ao->zones_stable.mask);
+        ao->setpoint = 0.0f; // Zones have their own setpoints.
+        ao->cascade_count = 0;
+        ao->cascade_Ts = ao->sample_period * (float)(ao->cascade_div - 1U);
+        power_stop_lock();
+        reflow_sampling_start(ao, ao->scans);
+        return HSM_HANDLED;
+
+    case EXIT_SIG:
+        reflow_sampling_stop(ao);
+        power_stop_unlock();
+        clock_boost_release();
+        return HSM_HANDLED;
+
+    case START_REFLOW_SIG:
+    case PROFILE_LOAD_SIG:
+    case AUTOTUNE_SIG:
+    case STEPRESP_SIG:
+    case CONVEYOR_SIG:
+    case CALIBRATE_SIG:
+    case SCRIPT_SIG:
+        LOGW(TAG, "Conveyor mode running, request dropped.");
+        return HSM_HANDLED;
+
+    case STOP_REFLOW_SIG:
+        return Reflow_stop(ao);
+
+    case SAFETY_TRIP_SIG:
+        LOGE(TAG, "Safety supervisor tripped, stopping conveyor mode.");
+        return Reflow_stop(ao);
+
+    case SAMPLE_READY_SIG:
+        return Reflow_conveyor_sample(ao, evt);
+
+    case ZONES_STABLE_SIG:
+        if (ActiveCond_met(&ao->zones_stable))
+        {
+            LOGI(TAG, "All zones stable, conveyor ready for boards.");
+        }
+        return HSM_HANDLED;
+
+    default:
+        return HSM_UNHANDLED;
+    }
+}
+
+/**
+ * @brief Run zone controllers on their own setpoints and track zone stability.
+ *
+ * Runs never end by themselves, so samples are not recorded into run history, which would
+ * keep archiving blocks to flash.
+ */
+static Hsm_Status Reflow_conveyor_sample(Reflow_Active *const ao, Event const *const evt)
+{
+    Sample_Event const *const sample = (Sample_Event const *)evt;
+    if (ao->hil != REFLOW_HIL_STEP)
+    {
+        wdg_checkin(ao->wdg_id);
+    }
+    if (!reflow_time_ok(ao))
+    {
+        LOGE(TAG, "Time scale changed to %lu without hardware-in-the-loop mode, stopping conveyor mode.",
+             Active_time_scale());
+        return Reflow_stop(ao);
+    }
+    if (sample->err != MAX_OK && !reflow_fault_ride(ao, sample))
+    {
+        LOGE(TAG, "Could not read thermocouple %u temperature (%s), stopping conveyor mode.",
+             sample->err_tc, MAX31855K_Err_Str(sample->err));
+        return Reflow_stop(ao);
+    }
+
+    reflow_temps_update(ao, sample);
+
+    float Ts = ao->prev_sample_valid ? Active_cycles_to_s(sample->timestamp - ao->prev_timestamp)
+                                     : ao->sample_period;
+    ao->prev_timestamp = sample->timestamp;
+    ao->prev_sample_valid = true;
+
+    /* Settings published since the previous sample apply from this one on. */
+    reflow_gains_apply(ao);
+    if (reflow_params_fetch(&ao->conveyor_params, &ao->conveyor_seq, &ao->conveyor) && ao->has_belt)
+    {
+        Heater_Set(&ao->belt, (uint16_t)ao->conveyor.belt);
+    }
+
+    float outer_Ts;
+    bool outer_due = reflow_cascade_due(ao, Ts, &outer_Ts);
+    uint32_t decimation = ao->hil == REFLOW_HIL_STEP ? 1U : ao->stream_decimation;
+    bool stream = decimation != 0 && ++ao->stream_count >= decimation;
+    if (stream)
+    {
+        ao->stream_count = 0;
+    }
+    for (uint8_t z = 0; z < ao->num_zones; z++)
+    {
+        float setpoint = ao->conveyor.setpoint[z];
+        ao->zone_out[z] = reflow_zone_control(ao, z, setpoint, Ts, outer_due, outer_Ts);
+        Heater_Set(&ao->zone_heater[z], (uint16_t)ao->zone_out[z]);
+        reflow_stability_update(ao, z, setpoint - ao->zone_temp[z], Ts);
+        if (stream)
+        {
+            reflow_stream_sample(ao, z);
+        }
+    }
+    return HSM_HANDLED;
+}
+
+/**
+ * @brief Update zone error statistics and stable flag, logging changes of the flag.
+ *
+ * Changes of the flag also update the zone's flag of the all-zones-stable condition.
+ *
+ * @param ao Reflow active object.
+ * @param zone Zone index.
+ * @param error Setpoint minus zone temperature (deg C).
+ * @param Ts Time since previous sample (s).
+ */
+static void reflow_stability_update(Reflow_Active *const ao, uint8_t zone, float error, float Ts)
+{
+    Reflow_Stability *const st = &ao->zone_stability[zone];
+    float alpha = Ts < REFLOW_CONVEYOR_WINDOW ? Ts / REFLOW_CONVEYOR_WINDOW : 1.0f;
+    float delta = error - st->mean;
+    st->mean += alpha * delta;
+    st->var = (1.0f - alpha) * (st->var + alpha * delta * delta);
+
+    st->in_band = fabsf(error) <= conveyor_band ? st->in_band + Ts : 0.0f;
+    bool stable = st->in_band >= conveyor_settle;
+    if (stable != st->stable)
+    {
+        st->stable = stable;
+        LOGI(TAG, "Zone %s %s.", ao->zones[zone].name, stable ? "stable" : "left setpoint band");
+        if (stable)
+        {
+            ActiveCond_set(&ao->zones_stable, 1UL << zone);
+        }
+        else
+        {
+            ActiveCond_clear(&ao->zones_stable, 1UL << zone);
+        }
+    }
+}
+
+/**
+ * @brief Preheat state: zones hold the preheat temperature of jobs[0] until its run is due,
+ * see Reflow_job_tick().
+ */
+static Hsm_Status Reflow_preheat(Reflow_Active *const ao, Event const *const evt)
+{
+    switch (evt->sig)
+    {
+    case ENTRY_SIG:
+        clock_boost_acquire(); // Switch to full speed before timers start.
+        for(uint8_t z = 0; z < ao->num_zones && ao->hil == REFLOW_HIL_OFF; z++)
+        {
+            Heater_Enable(&ao->zone_heater[z]);
+        }
+        ao->setpoint = ao->jobs[0].preheat;
+        ao->cascade_count = 0;
+        ao->cascade_Ts = ao->sample_period * (float)(ao->cascade_div - 1U);
+        power_stop_lock();
+        reflow_sampling_start(ao, ao->scans);
+        return HSM_HANDLED;
+
+    case EXIT_SIG:
+        reflow_sampling_stop(ao);
+        power_stop_unlock();
+        clock_boost_release();
+        return HSM_HANDLED;
+
+    case PROFILE_LOAD_SIG:
+        Active_defer(&ao->reflow_base, evt); // Applies once the scheduled run is over.
+        return HSM_HANDLED;
+
+    case START_REFLOW_SIG:
+    case AUTOTUNE_SIG:
+    case STEPRESP_SIG:
+    case CONVEYOR_SIG:
+    case CALIBRATE_SIG:
+    case SCRIPT_SIG:
+        LOGW(TAG, "Preheating for scheduled run, request dropped.");
+        return HSM_HANDLED;
+
+    case SCHEDULE_SIG:
+        if (ao->num_jobs == 0U)
+        {
+            LOG("Preheat stopped\r\n");
+            return Hsm_tran(&ao->hsm, &reflow_reset_state);
+        }
+        return HSM_HANDLED;
+
+    case SCHEDULE_TICK_SIG:
+        return Reflow_job_tick(ao, true);
+
+    case STOP_REFLOW_SIG:
+        return Reflow_stop(ao);
+
+    case SAFETY_TRIP_SIG:
+        LOGE(TAG, "Safety supervisor tripped, stopping preheat.");
+        return Reflow_stop(ao);
+
+    case SAMPLE_READY_SIG:
+        return Reflow_preheat_sample(ao, evt);
+
+    default:
+        return HSM_UNHANDLED;
+    }
+}
+
+/**
+ * @brief Run zone controllers on the preheat temperature.
+ *
+ * The run starts warm, so preheat samples are neither recorded into run history nor scored.
+ */
+static Hsm_Status Reflow_preheat_sample(Reflow_Active *const ao, Event const *const evt)
+{
+    Sample_Event const *const sample = (Sample_Event const *)evt;
+    if (ao->hil != REFLOW_HIL_STEP)
+    {
+        wdg_checkin(ao->wdg_id);
+    }
+    if (!reflow_time_ok(ao))
+    {
+        LOGE(TAG, "Time scale changed to %lu without hardware-in-the-loop mode, stopping preheat.",
+             Active_time_scale());
+        return Reflow_stop(ao);
+    }
+    if (sample->err != MAX_OK && !reflow_fault_ride(ao, sample))
+    {
+        LOGE(TAG, "Could not read thermocouple %u temperature (%s), stopping preheat.",
+             sample->err_tc, MAX31855K_Err_Str(sample->err));
+        return Reflow_stop(ao);
+    }
+
+    reflow_temps_update(ao, sample);
+
+    float Ts = ao->prev_sample_valid ? Active_cycles_to_s(sample->timestamp - ao->prev_timestamp)
+                                     : ao->sample_period;
+    ao->prev_timestamp = sample->timestamp;
+    ao->prev_sample_valid = true;
+
+    reflow_gains_apply(ao);
+    float outer_Ts;
+    bool outer_due = reflow_cascade_due(ao, Ts, &outer_Ts);
+    for (uint8_t z = 0; z < ao->num_zones; z++)
+    {
+        ao->zone_out[z] = reflow_zone_control(ao, z, ao->setpoint, Ts, outer_due, outer_Ts);
+        Heater_Set(&ao->zone_heater[z], (uint16_t)ao->zone_out[z]);
+    }
+    return HSM_HANDLED;
+}
+
+/**
+ * @brief Preheat for or start scheduled run of jobs[0] once due, on every schedule check.
+ *
+ * Runs start from RESET_STATE only once the oven has cooled below the final target of the
+ * profile, like "reflow start", or straight from PREHEAT_STATE, where the oven is warm on
+ * purpose. A due run held back by a latched safety trip, time scale or hot oven logs why once
+ * and starts on the first check that allows it.
+ *
+ * @param ao Reflow active object.
+ * @param preheated Oven is held at the preheat temperature of jobs[0].
+ */
+static Hsm_Status Reflow_job_tick(Reflow_Active *const ao, bool preheated)
+{
+    if (ao->num_jobs == 0U)
+    {
+        return HSM_HANDLED;
+    }
+    Reflow_Job const *const job = &ao->jobs[0];
+    int32_t until_ms = (int32_t)(job->start_ms - Active_time_ms());
+    bool preheat_due = job->preheat > 0.0f && until_ms <= (int32_t)job->lead_ms;
+    if (until_ms > 0 && (preheated || !preheat_due))
+    {
+        return HSM_HANDLED;
+    }
+
+    if (safety_tripped(ao->oven) || !reflow_time_ok(ao))
+    {
+        if (!ao->job_held)
+        {
+            LOGW(TAG, "Scheduled run of %s held, safety trip latched or time scale is %lu.",
+                 job->profile.name, Active_time_scale());
+            ao->job_held = true;
+        }
+        return HSM_HANDLED;
+    }
+    if (until_ms > 0)
+    {
+        LOG("Preheating to %.0f deg C, scheduled run of %s starts in %ld s\r\n",
+            job->preheat, job->profile.name, until_ms / 1000);
+        ao->job_held = false;
+        ao->job_running = true;
+        return Hsm_tran(&ao->hsm, &reflow_preheat_state);
+    }
+
+    float current_temp = ao->temp;
+    if (!preheated)
+    {
+        float final_temp = job->profile.segments[job->profile.num_segments - 1].target;
+        if (readTemperature(ao, &current_temp) != true)
+        {
+            if (!ao->job_held)
+            {
+                LOGW(TAG, "MAX31855K Read Error, scheduled run of %s held.", job->profile.name);
+                ao->job_held = true;
+            }
+            return HSM_HANDLED;
+        }
+        if (current_temp > final_temp)
+        {
+            if (!ao->job_held)
+            {
+                LOGI(TAG, "Scheduled run of %s waits for oven to cool below %.0f.", job->profile.name, final_temp);
+                ao->job_held = true;
+            }
+            return HSM_HANDLED;
+        }
+    }
+    ao->job_held = false;
+    ao->job_running = true;
+    ao->profile = job->profile;
+    LOG("Scheduled run of %s, %lu left including this one\r\n", job->profile.name, job->runs);
+    return Reflow_run_start(ao, current_temp);
+}
+
+/**
+ * @brief Queue job of a Reflow_Job_Event or clear the schedule if it has no runs, on the reflow thread.
+ *
+ * A run in progress continues when the schedule is cleared, but no longer counts as scheduled.
+ */
+static void reflow_job_request(Reflow_Active *const ao, Reflow_Job const *const job)
+{
+    if (job->runs == 0U)
+    {
+        reflow_jobs_clear(ao);
+        LOG("Schedule cleared\r\n");
+        return;
+    }
+    if (ao->num_jobs == REFLOW_MAX_JOBS)
+    {
+        LOGW(TAG, "Schedule full, job dropped.");
+        return;
+    }
+    ao->jobs[ao->num_jobs++] = *job;
+    if (ao->num_jobs == 1U)
+    {
+        TimeEvent_arm(&ao->schedule_time_evt, REFLOW_SCHEDULE_TICK_MS, REFLOW_SCHEDULE_TICK_MS);
+    }
+    LOG("Scheduled %lu runs of %s\r\n", job->runs, job->profile.name);
+}
+
+/**
+ * @brief Count completed run towards jobs[0] if it was scheduled, its next run waits idle_ms.
+ */
+static void reflow_job_done(Reflow_Active *const ao)
+{
+    if (!ao->job_running)
+    {
+        return;
+    }
+    ao->job_running = false;
+
+    Reflow_Job *const job = &ao->jobs[0];
+    if (--job->runs > 0U)
+    {
+        job->start_ms = Active_time_ms() + job->idle_ms;
+        LOGI(TAG, "Next run of %s in %lu s.", job->profile.name, job->idle_ms / 1000U);
+        return;
+    }
+    memmove(&ao->jobs[0], &ao->jobs[1], --ao->num_jobs * sizeof(ao->jobs[0]));
+    if (ao->num_jobs == 0U)
+    {
+        TimeEvent_disarm(&ao->schedule_time_evt);
+        LOGI(TAG, "Schedule completed.");
+    }
+}
+
+/**
+ * @brief Drop all scheduled jobs and stop schedule checks.
+ */
+static void reflow_jobs_clear(Reflow_Active *const ao)
+{
+    TimeEvent_disarm(&ao->schedule_time_evt);
+    ao->num_jobs = 0;
+    ao->job_running = false;
+    ao->job_held = false;
+}
+
+/**
+ * @brief Ramp state: setpoint moves to segment target, see Reflow_sample().
+ */
+static Hsm_Status Reflow_ramp(Reflow_Active *const ao, Event const *const evt)
+{
+    switch (evt->sig)
+    {
+    case ENTRY_SIG:
+    {
+        Reflow_Segment const *const seg = &ao->profile.segments[ao->segment];
+        Reflow_Ramp const *const ramp = &ao->ramps[ao->segment];
+        LOGI(TAG, "Segment %u: %s to %.1f deg C at %.2f deg C/s.", ao->segment, ramp->cooling ? "cooling" : "ramping",
+             seg->target, fabsf(ramp->step) / ao->sample_period);
+        ao->ramp_sample = 0;
+        ao->reach_count = 0;
+        reflow_rate_reset(ao);
+        if (seg->ramp_rate == 0.0f)
+        {
+            ao->setpoint = seg->target;
+        }
+        return HSM_HANDLED;
+    }
+
+    default:
+        return HSM_UNHANDLED;
+    }
+}
+
+/**
+ * @brief Dwell state: setpoint held at segment target until dwell time expires.
+ */
+static Hsm_Status Reflow_dwell(Reflow_Active *const ao, Event const *const evt)
+{
+    switch (evt->sig)
+    {
+    case ENTRY_SIG:
+    {
+        Reflow_Segment const *const seg = &ao->profile.segments[ao->segment];
+        uint32_t const dwell = ao->ramps[ao->segment].dwell;
+        LOGI(TAG, "Segment %u: dwelling at %.1f deg C for %lu s.", ao->segment, seg->target, dwell);
+        ao->setpoint = seg->target;
+        reflow_rate_reset(ao);
+        if (ao->hil == REFLOW_HIL_STEP)
+        {
+            /* Host sets the pace of injected samples, so dwell lasts a number of them. */
+            ao->dwell_samples = (uint32_t)ceilf((float)dwell / ao->sample_period);
+            return HSM_HANDLED;
+        }
+        TimeEvent_arm(&ao->reflow_time_evt, TIME_EVENT_SEC(dwell), 0);
+        return HSM_HANDLED;
+    }
+
+    case REACH_TIME_SIG:
+        return Reflow_next_segment(ao);
+
+    default:
+        return HSM_UNHANDLED;
+    }
+}
+
+/**
+ * @brief Script state: scripted profile moves setpoint, resumed on every sample, see Reflow_sample().
+ */
+static Hsm_Status Reflow_script(Reflow_Active *const ao, Event const *const evt)
+{
+    switch (evt->sig)
+    {
+    case ENTRY_SIG:
+        LOGI(TAG, "Running script %s.", ao->script.def->name);
+        reflow_rate_reset(ao);
+        return HSM_HANDLED;
+
+    default:
+        return HSM_UNHANDLED;
+    }
+}
+
+/**
+ * @brief Start reflow process with active profile, first ramp starts from oven temperature.
+ *
+ * @param ao Reflow active object.
+ * @param current_temp Oven temperature (deg C).
+ */
+static Hsm_Status Reflow_run_start(Reflow_Active *const ao, float current_temp)
+{
+    LOG("Starting reflow process with profile %s\r\n", ao->profile.name);
+    ao->setpoint = current_temp;
+    ao->mass_scale = ao->mass > 0.0f ? ao->mass : 1.0f;
+    ao->mass_estimating = ao->mass == 0.0f;
+    ao->mass_lag_sum = 0.0f;
+    ao->mass_lag_count = 0;
+    reflow_trajectory_build(ao, current_temp);
+    if (ao->mass_scale != 1.0f)
+    {
+        LOG("Ramps and dwells scaled to board thermal mass %.2f\r\n", ao->mass_scale);
+    }
+    return Hsm_tran(&ao->hsm, &reflow_running_state);
+}
+
+/**
+ * @brief Advance to next profile segment, completing reflow process after the last one.
+ */
+static Hsm_Status Reflow_next_segment(Reflow_Active *const ao)
+{
+    if (++ao->segment >= ao->profile.num_segments)
+    {
+        LOGI(TAG, "Reflow process completed!");
+        reflow_conform_finish(ao);
+        reflow_job_done(ao);
+        return Hsm_tran(&ao->hsm, &reflow_reset_state);
+    }
+    return Hsm_tran(&ao->hsm, &reflow_ramp_state);
+}
+
+/**
+ * @brief Complete scripted profile that ended, stop one that gave up.
+ */
+static Hsm_Status Reflow_script_done(Reflow_Active *const ao, Script_status_t status)
+{
+    if (status == SCRIPT_ABORTED)
+    {
+        return Reflow_stop(ao);
+    }
+    LOGI(TAG, "Script %s completed!", ao->script.def->name);
+    reflow_conform_finish(ao);
+    return Hsm_tran(&ao->hsm, &reflow_reset_state);
+}
+
+/**
+ * @brief Precompute setpoint trajectory of every profile segment for the nominal sampling period.
+ *
+ * Every ramp begins at the previous segment's target, the first one at oven temperature. Ramps
+ * are split into whole samples, so the setpoint of every sample is computed from the ramp start
+ * without accumulating rounding error and lands exactly on target on the last one. Rates and
+ * dwells are scaled to the board thermal mass of the run, see reflow_trajectory_scale().
+ *
+ * @param ao Reflow active object.
+ * @param start_temp Oven temperature at start of reflow process (deg C).
+ */
+static void reflow_trajectory_build(Reflow_Active *const ao, float start_temp)
+{
+    float start = start_temp;
+    for (uint8_t i = 0; i < ao->profile.num_segments; i++)
+    {
+        Reflow_Segment const *const seg = &ao->profile.segments[i];
+        Reflow_Ramp *const ramp = &ao->ramps[i];
+        ramp->start = start;
+        ramp->cooling = seg->target < start;
+        start = seg->target;
+    }
+    reflow_trajectory_scale(ao, 0);
+}
+
+/**
+ * @brief Scale ramps and dwells from a segment on to the board thermal mass of the run.
+ *
+ * Profiles are written for one board. A board of relative thermal mass m heats up m times
+ * as fast or as slow as that one, so its joints keep up with ramps m times as steep and
+ * soak through in dwells m times as short:
+ *
+ *      rate' = rate / m, at most REFLOW_MASS_RATE_MAX or the profile's own rate if steeper
+ *      dwell' = dwell * m, at least 1 s where the profile dwells
+ *
+ * Targets are the solder paste's limits and stay as written, as do ramps without a rate,
+ * which wait for the oven to reach target.
+ *
+ * @param ao Reflow active object, ramp starts built.
+ * @param first First segment to scale, later segments of an estimating run.
+ */
+static void reflow_trajectory_scale(Reflow_Active *const ao, uint8_t first)
+{
+    float const m = ao->mass_scale;
+    for (uint8_t i = first; i < ao->profile.num_segments; i++)
+    {
+        Reflow_Segment const *const seg = &ao->profile.segments[i];
+        Reflow_Ramp *const ramp = &ao->ramps[i];
+        ramp->step = 0.0f;
+        ramp->num_samples = 0;
+        if (seg->ramp_rate > 0.0f)
+        {
+            float rate = fminf(seg->ramp_rate / m, fmaxf(seg->ramp_rate, REFLOW_MASS_RATE_MAX));
+            float span = seg->target - ramp->start;
+            ramp->num_samples = (uint32_t)ceilf(fabsf(span) / (rate * ao->sample_period));
+            if (ramp->num_samples > 0)
+            {
+                ramp->step = span / (float)ramp->num_samples;
+            }
+        }
+        ramp->dwell = seg->dwell;
+        if (seg->dwell > 0 && m != 1.0f)
+        {
+            ramp->dwell = (uint32_t)fmaxf(roundf((float)seg->dwell * m), 1.0f);
+        }
+    }
+}
+
+/**
+ * @brief Estimate board thermal mass once the first heating ramp completed, scale the rest of the run.
+ *
+ * An oven loaded with more thermal mass trails a setpoint ramp further, so the mean lag of the
+ * oven behind the setpoint over the second half of the ramp, once the tracking error settled,
+ * relative to the lag of the profiles' board, is the board's relative thermal mass.
+ *
+ * @param ao Reflow active object, current segment is the completed ramp.
+ */
+static void reflow_mass_estimate(Reflow_Active *const ao)
+{
+    ao->mass_estimating = false;
+    if (ao->mass_lag_count == 0)
+    {
+        return;
+    }
+    ao->mass_lag = ao->mass_lag_sum / (float)ao->mass_lag_count;
+    ao->mass_scale = fminf(fmaxf(ao->mass_lag / ao->mass_lag_ref, REFLOW_MASS_MIN), REFLOW_MASS_MAX);
+    reflow_trajectory_scale(ao, ao->segment + 1U);
+    LOGI(TAG, "Oven lagged first ramp by %.1f s, rest of run scaled to board thermal mass %.2f.",
+         ao->mass_lag, ao->mass_scale);
+}
+
+/**
+ * @brief Qualify oven temperature crossing segment target in the direction of the ramp.
+ *
+ * A heating ramp reaches target once the oven is within REFLOW_TARGET_TOLERANCE below it or
+ * anywhere above it, a cooling ramp mirrors that, so overshoot does not hold the ramp back. The
+ * crossing must hold for REFLOW_TARGET_SAMPLES samples, so one noisy sample cannot complete the
+ * ramp. Samples falling back past the threshold by more than REFLOW_TARGET_HYSTERESIS restart
+ * qualification, samples in between neither count nor restart it.
+ *
+ * @param ao Reflow active object.
+ * @param temp Oven temperature, or estimated board temperature with "reflow board reach on" (deg C).
+ * @param target Segment target (deg C).
+ * @return true on every sample from the qualifying one on, the caller leaves the ramp on the first.
+ */
+static bool reflow_target_reached(Reflow_Active *const ao, float temp, float target)
+{
+    float past = ao->ramps[ao->segment].cooling ? target - temp : temp - target; // Signed distance past target.
+    if (past > -REFLOW_TARGET_TOLERANCE)
+    {
+        ao->reach_count++;
+    }
+    else if (past < -(REFLOW_TARGET_TOLERANCE + REFLOW_TARGET_HYSTERESIS))
+    {
+        ao->reach_count = 0;
+    }
+    return ao->reach_count >= REFLOW_TARGET_SAMPLES;
+}
+
+/**
+ * @brief Abort reflow process, cancelling deferred start and profile load requests.
+ */
+static Hsm_Status Reflow_stop(Reflow_Active *const ao)
+{
+    LOG("Reflow process stopped\r\n");
+    Active_flush_deferred(&ao->reflow_base);
+    return Hsm_tran(&ao->hsm, &reflow_reset_state);
+}
+
+/**
+ * @brief Count sample towards cascade outer loops, which run every cascade_div samples.
+ *
+ * @param ao Reflow active object.
+ * @param Ts Time since previous sample (s).
+ * @param outer_Ts Set to time since outer loops last ran (s).
+ * @return true if outer loops run on this sample.
+ */
+static bool reflow_cascade_due(Reflow_Active *const ao, float Ts, float *const outer_Ts)
+{
+	ao->cascade_Ts += Ts;
+	*outer_Ts = ao->cascade_Ts;
+	bool outer_due = ao->cascade_count++ % ao->cascade_div == 0;
+	if(outer_due)
+	{
+		ao->cascade_Ts = 0.0f;
+	}
+	return outer_due;
+}
+
+/**
+ * @brief Compute zone output of a sample, through its cascade loops if cascade control is on.
+ *
+ * @param ao Reflow active object.
+ * @param z Zone index.
+ * @param setpoint Zone setpoint (deg C).
+ * @param Ts Time since previous sample (s).
+ * @param outer_due Cascade outer loops run on this sample.
+ * @param outer_Ts Time since cascade outer loops last ran (s).
+ * @return float Zone PWM output.
+ */
+static float reflow_zone_control(Reflow_Active *const ao, uint8_t z, float setpoint, float Ts, bool outer_due, float outer_Ts)
+{
+	if(ao->cascade_enabled && ao->zones[z].cascade)
+	{
+		if(outer_due)
+		{
+			PID_SetSampleTime(&ao->zone_pid[z], outer_Ts);
+			if(ao->fuse_enabled)
+			{
+				PID_SetRate(&ao->zone_pid[z], ao->zone_rate[z]);
+			}
+			ao->zone_element_sp[z] = PID_Calculate(&ao->zone_pid[z], setpoint, ao->zone_temp[z]);
+		}
+		PID_SetSampleTime(&ao->zone_inner[z], Ts);
+		return PID_Calculate(&ao->zone_inner[z], ao->zone_element_sp[z], ao->zone_element_temp[z]);
+	}
+
+	PID_SetSampleTime(&ao->zone_pid[z], Ts);
+	if(ao->fuse_enabled && !ao->smith_enabled)
+	{
+		PID_SetRate(&ao->zone_pid[z], ao->zone_rate[z]); // Smith feedback is not the fused temperature.
+	}
+	return ao->smith_enabled
+	           ? Smith_Calculate(&ao->zone_smith[z], &ao->zone_pid[z], setpoint, ao->zone_temp[z])
+	           : PID_Calculate(&ao->zone_pid[z], setpoint, ao->zone_temp[z]);
+}
+
+/**
+ * @brief Perform PID iteration on newly acquired thermocouple sample.
+ */
+static Hsm_Status Reflow_sample(Reflow_Active *const ao, Event const *const evt)
+{
+	Sample_Event const *const sample = (Sample_Event const *)evt;
+	if(ao->hil != REFLOW_HIL_STEP)
+	{
+		wdg_checkin(ao->wdg_id);
+	}
+	if(!reflow_time_ok(ao))
+	{
+		LOGE(TAG, "Time scale changed to %lu without hardware-in-the-loop mode, aborting reflow process.",
+		     Active_time_scale());
+		return Reflow_stop(ao);
+	}
+	if(sample->err != MAX_OK && !reflow_fault_ride(ao, sample))
+	{
+		LOGE(TAG, "Could not read thermocouple %u temperature (%s), aborting reflow process.",
+		     sample->err_tc, MAX31855K_Err_Str(sample->err));
+		return Reflow_stop(ao);
+	}
+
+	float oven_temp = reflow_temps_update(ao, sample);
+
+	/* Use measured sample-to-sample period so derivative and integral terms
+	 * are scaled by the time that actually elapsed.
+	 */
+	float Ts = ao->sample_period;
+	if(ao->prev_sample_valid)
+	{
+		Ts = Active_cycles_to_s(sample->timestamp - ao->prev_timestamp);
+	}
+
+	/* Board lags the air, a probe on a board of the same class corrects the estimate. */
+	ao->board_temp = Board_Update(&ao->board, oven_temp, Ts);
+	if(ao->board_probe >= 0 && sample->err == MAX_OK)
+	{
+		ao->board_temp = Board_Correct(&ao->board, sample->temp[ao->board_probe]);
+	}
+
+	/* Nominal periods the sample stands for, several while the control rate is slowed down. */
+	bool adapt = reflow_rate_active(ao);
+	uint32_t periods = adapt ? (uint32_t)fmaxf(roundf(Ts / ao->sample_period), 1.0f) : 1U;
+
+	/* Move setpoint along precomputed segment ramp. A ramp with a rate completes once the
+	 * setpoint gets to target, a ramp without one once the oven temperature does.
+	 */
+	bool ramp_done = false;
+	bool tracked = false; // Setpoint follows a heating ramp with a set rate, scored for tracking error.
+	if(reflow_state(ao) == RAMP_STATE)
+	{
+		Reflow_Segment const *const seg = &ao->profile.segments[ao->segment];
+		if(seg->ramp_rate > 0.0f)
+		{
+			Reflow_Ramp const *const ramp = &ao->ramps[ao->segment];
+			tracked = !ramp->cooling;
+
+			/* Lag behind the setpoint the oven followed, once tracking settled, estimates board mass. */
+			if(ao->mass_estimating && !ramp->cooling && ramp->num_samples > 0 && 2U * ao->ramp_sample >= ramp->num_samples)
+			{
+				ao->mass_lag_sum += (ao->setpoint - oven_temp) / (fabsf(ramp->step) / ao->sample_period);
+				ao->mass_lag_count++;
+			}
+			ao->ramp_sample += periods;
+			if(ao->ramp_sample >= ramp->num_samples)
+			{
+				ao->setpoint = seg->target;
+				ramp_done = true;
+				if(ao->mass_estimating && !ramp->cooling)
+				{
+					reflow_mass_estimate(ao);
+				}
+			}
+			else
+			{
+				ao->setpoint = ramp->start + ramp->step * (float)ao->ramp_sample;
+			}
+		}
+		else
+		{
+			ramp_done = reflow_target_reached(ao, ao->board_reach ? ao->board_temp : oven_temp, seg->target);
+		}
+	}
+	Script_status_t script_status = SCRIPT_RUNNING;
+	if(reflow_state(ao) == SCRIPT_STATE)
+	{
+		float lo = ao->zone_temp[0], hi = ao->zone_temp[0];
+		for(uint8_t z = 1; z < ao->num_zones; z++)
+		{
+			lo = fminf(lo, ao->zone_temp[z]);
+			hi = fmaxf(hi, ao->zone_temp[z]);
+		}
+		script_status = Script_Step(&ao->script, oven_temp, hi - lo, Ts);
+		ao->setpoint = ao->script.setpoint;
+		tracked = ao->script.rate > 0.0f && !ao->script.cooling;
+	}
+	bool dwell_done = ao->hil == REFLOW_HIL_STEP && reflow_state(ao) == DWELL_STATE && --ao->dwell_samples == 0;
+
+	/* Gains published since the previous iteration apply from this one on. */
+	reflow_gains_apply(ao);
+
+	Conform_Update(&ao->conform, oven_temp, ao->setpoint, Ts, tracked);
+
+	/* Record sample for fixed-point PID self-check. */
+	uint32_t trace_idx = ao->trace_count++ % REFLOW_TRACE_LEN;
+	ao->trace_setpoint[trace_idx] = ao->setpoint;
+	for(uint8_t z = 0; z < ao->num_zones; z++)
+	{
+		ao->trace_temp[z][trace_idx] = ao->zone_temp[z];
+	}
+
+	float outer_Ts;
+	bool outer_due = reflow_cascade_due(ao, Ts, &outer_Ts);
+
+	/* Acquire new PWM output signals of all zones through feedback control. */
+	uint32_t pid_start = DWT->CYCCNT;
+	for(uint8_t z = 0; z < ao->num_zones; z++)
+	{
+		ao->zone_out[z] = reflow_zone_control(ao, z, ao->setpoint, Ts, outer_due, outer_Ts);
+	}
+	if(ao->hil != REFLOW_HIL_STEP)
+	{
+		/* Stepped samples carry virtual timestamps, timing measurements would be meaningless. */
+		reflow_update_pms(ao, sample, DWT->CYCCNT - pid_start, periods);
+	}
+	ao->prev_timestamp = sample->timestamp;
+	ao->prev_sample_valid = true;
+
+	/* Set PWM signals */
+	for(uint8_t z = 0; z < ao->num_zones; z++)
+	{
+		Heater_Set(&ao->zone_heater[z], (uint16_t)ao->zone_out[z]);
+	}
+	if(ao->has_fan)
+	{
+		/* Cooling segments run until target is reached, dwell included. */
+		bool cooling = reflow_state(ao) == SCRIPT_STATE ? ao->script.cooling : ao->ramps[ao->segment].cooling;
+		Heater_Set(&ao->fan, (uint16_t)Cooling_Calculate(&ao->cooling, cooling, ao->setpoint, oven_temp, Ts));
+	}
+
+	/* Model regresses on nominal periods, its output history restarts after slower samples.
+	 * History holds the sample for every period it stands for.
+	 */
+	if(periods == 1U)
+	{
+		reflow_model_update(ao);
+	}
+	else
+	{
+		ao->model_head = 0;
+		ao->model_samples = 0;
+	}
+	for(uint32_t i = 0; i < periods; i++)
+	{
+		reflow_history_add(ao, oven_temp);
+	}
+	if(adapt)
+	{
+		float error = 0.0f;
+		for(uint8_t z = 0; z < ao->num_zones; z++)
+		{
+			error = fmaxf(error, fabsf(ao->setpoint - ao->zone_temp[z]));
+		}
+		reflow_sampling_div(ao, Rate_Update(&ao->rate, error, ao->setpoint, Ts));
+	}
+
+	uint32_t decimation = ao->hil == REFLOW_HIL_STEP ? 1U : ao->stream_decimation; // Host waits for outputs of every injected sample.
+	if(decimation != 0)
+	{
+		/* Binary telemetry replaces log line, skipping float formatting. */
+		if(++ao->stream_count >= decimation)
+		{
+			ao->stream_count = 0;
+			for(uint8_t z = 0; z < ao->num_zones; z++)
+			{
+				reflow_stream_sample(ao, z);
+			}
+		}
+	}
+	else
+	{
+		for(uint8_t z = 0; z < ao->num_zones; z++)
+		{
+			LOGI(TAG, "%s %s %.2f %.2f %.2f %.2f %.2f %.2f",
+													 reflow_names[reflow_state(ao)],
+													 ao->zones[z].name,
+													 ao->setpoint,
+													 ao->zone_temp[z],
+													 ao->zone_pid[z].proportional,
+													 ao->zone_pid[z].integral,
+													 ao->zone_pid[z].derivative,
+													 ao->zone_out[z]);
+		}
+	}
+	if(ramp_done)
+	{
+		return ao->ramps[ao->segment].dwell > 0 ? Hsm_tran(&ao->hsm, &reflow_dwell_state) : Reflow_next_segment(ao);
+	}
+	if(dwell_done)
+	{
+		return Reflow_next_segment(ao);
+	}
+	if(script_status != SCRIPT_RUNNING)
+	{
+		return Reflow_script_done(ao, script_status);
+	}
+	return HSM_HANDLED;
+}
+
+/* State hierarchy, ids index reflow_names */
+static const Hsm_State reflow_running_state = HSM_STATE(NULL, Reflow_running, RAMP_STATE); // Never a leaf state.
+REFLOW_STATES(REFLOW_STATE_DEF)
+
+void reflow_init(uint8_t oven, Reflow_cfg_t const *const reflow_cfg)
+{
+    ASSERT(oven < REFLOW_NUM_OVENS);
+    Reflow_Active *const ao = &reflow_ovens[oven];
+    ao->oven = oven;
+    ao->profile_params = (Reflow_Params){.buf = {&ao->profile_bufs[0], &ao->profile_bufs[1]}, .size = sizeof(Reflow_Profile)};
+    ao->gain_params = (Reflow_Params){.buf = {ao->gain_bufs[0], ao->gain_bufs[1]}, .size = sizeof(ao->gain_bufs[0])};
+    ao->conveyor_params = (Reflow_Params){.buf = {&ao->conveyor_bufs[0], &ao->conveyor_bufs[1]}, .size = sizeof(Reflow_Conveyor)};
+    ao->recipe_params = (Reflow_Params){.buf = {&ao->recipe_bufs[0], &ao->recipe_bufs[1]}, .size = sizeof(Recipe_t)};
+
+    /* Call active object constructor */
+    Active_ctor((Active *)ao, (EventHandler)reflow_evt_handler);
+    Hsm_ctor(&ao->hsm, ao);
+
+    /* Thermocouple samples are published, so other active objects may subscribe as well. Every
+     * oven's controller takes its own samples without subscribing, see reflow_sample_post(), and
+     * trips of other ovens are dropped, see reflow_evt_handler().
+     */
+    Active_subscribe((Active *)ao, SAFETY_TRIP_SIG);
+
+    /* A sample or schedule check already queued covers the next one, so backlogs never crowd out stop requests.
+     * Samples carry their timestamp, so a skipped one only lengthens the measured period. A sample
+     * queued longer than a nominal period is stale and dropped, see reflow_sample_age_update().
+     */
+    Active_coalesce((Active *)ao, SAMPLE_READY_SIG);
+    Active_coalesce((Active *)ao, SCHEDULE_TICK_SIG);
+    Active_coalesce((Active *)ao, WATCH_TICK_SIG);
+    Active_coalesce((Active *)ao, ALIGN_TICK_SIG);
+
+    /* Setup PID parameters */
+    static const PID_cfg_t reflow_pid_cfg = {.Kp = KP_INIT,
+                                             .Ki = KI_INIT,
+                                             .Kd = KD_INIT,
+                                             .tau = TAU_INIT,
+                                             .Ts = TS_INIT,
+                                             .out_max = OUT_MAX_INIT,
+                                             .out_min = OUT_MIN_INIT,
+                                             .form = FORM_INIT,
+                                             .antiwindup = ANTIWINDUP_INIT,
+                                             .Tt = TT_INIT,
+                                             .b = B_INIT,
+                                             .c = C_INIT};
+
+    static const PID_cfg_t reflow_inner_cfg = {.Kp = CASCADE_KP_INIT,
+                                               .Ki = CASCADE_KI_INIT,
+                                               .Kd = CASCADE_KD_INIT,
+                                               .tau = TAU_INIT,
+                                               .Ts = TS_INIT,
+                                               .out_max = OUT_MAX_INIT,
+                                               .out_min = OUT_MIN_INIT,
+                                               .form = FORM_INIT,
+                                               .antiwindup = ANTIWINDUP_INIT,
+                                               .Tt = TT_INIT,
+                                               .b = B_INIT,
+                                               .c = C_INIT};
+
+    /* Initialize zone heaters, outputs off, and setup zone controllers */
+    ASSERT(reflow_cfg->num_zones > 0 && reflow_cfg->num_zones <= REFLOW_MAX_ZONES);
+    ASSERT(reflow_cfg->num_thermocouples > 0 && reflow_cfg->num_thermocouples <= REFLOW_MAX_THERMOCOUPLES);
+    ao->num_zones = reflow_cfg->num_zones;
+    ao->num_thermocouples = reflow_cfg->num_thermocouples;
+    for (uint8_t z = 0; z < ao->num_zones; z++)
+    {
+        ASSERT(reflow_cfg->zones[z].thermocouple < ao->num_thermocouples);
+        ASSERT((reflow_cfg->zones[z].vote_mask >> ao->num_thermocouples) == 0U);
+        ASSERT(!reflow_cfg->zones[z].cascade || reflow_cfg->zones[z].element_thermocouple < ao->num_thermocouples);
+        ao->zones[z] = reflow_cfg->zones[z];
+        ASSERT(Heater_Init(&ao->zone_heater[z], &reflow_cfg->zones[z].heater) == MOD_OK);
+        ASSERT(safety_watch(oven, &ao->zone_heater[z], reflow_cfg->zones[z].thermocouple) == MOD_OK);
+        PID_Init(&ao->zone_pid[z], &reflow_pid_cfg);
+        PID_Init(&ao->zone_inner[z], &reflow_inner_cfg);
+    }
+    ao->cascade_div = CASCADE_DIV_INIT;
+
+    /* Cooling actuator, off until a cooling segment */
+    static const Cooling_cfg_t reflow_cooling_cfg = {.Kp = REFLOW_FAN_KP,
+                                                     .slew_rate = REFLOW_FAN_SLEW,
+                                                     .out_max = OUT_MAX_INIT};
+    ao->has_fan = reflow_cfg->has_fan;
+    if (ao->has_fan)
+    {
+        ASSERT(Heater_Init(&ao->fan, &reflow_cfg->fan) == MOD_OK);
+    }
+    Cooling_Init(&ao->cooling, &reflow_cooling_cfg);
+    ao->has_belt = reflow_cfg->has_belt;
+    if (ao->has_belt)
+    {
+        ASSERT(Heater_Init(&ao->belt, &reflow_cfg->belt) == MOD_OK);
+    }
+    for (uint8_t z = 0; z < ao->num_zones; z++)
+    {
+        ao->conveyor_bufs[0].setpoint[z] = REFLOW_CONVEYOR_SP;
+    }
+    ao->conveyor = ao->conveyor_bufs[0];
+    ao->sample_period = TS_INIT;
+    ao->scans = reflow_scans(TS_INIT);
+    ao->pwm_period = TS_INIT;
+    ao->sample_div = 1U;
+    static const Rate_cfg_t reflow_rate_cfg = {.div_max = REFLOW_RATE_DIV_MAX,
+                                               .band = REFLOW_RATE_BAND,
+                                               .slope = REFLOW_RATE_SLOPE,
+                                               .settle = REFLOW_RATE_SETTLE};
+    Rate_Init(&ao->rate, &reflow_rate_cfg);
+
+    /* Samples must keep coming while sampling runs, timeout follows a restored period. */
+    ASSERT(wdg_register(oven_names[oven].wdg, REFLOW_WDG_TIMEOUT_MS(TS_INIT), &ao->wdg_id) == MOD_OK);
+    reflow_sample_age_update(ao);
+    reflow_params_load(ao);
+    reflow_schedule_apply(ao);
+    for (uint8_t z = 0; z < ao->num_zones; z++)
+    {
+        PID_t const *const pid = &ao->zone_pid[z];
+        ao->gain_bufs[0][z] = (Reflow_Gains){.Kp = pid->base.Kp, .Ki = pid->base.Ki, .Kd = pid->base.Kd, .tau = pid->tau, .Kff = pid->base.Kff};
+    }
+    ao->profile_bufs[0] = ao->profile;
+    ao->recipe_bufs[0] = ao->recipe;
+    RLS_Init(&ao->model_rls, REFLOW_MODEL_LAMBDA, REFLOW_MODEL_P0);
+    ao->filter_cfg = (Filter_cfg_t){.median_len = REFLOW_FILTER_MEDIAN,
+                                          .alpha = REFLOW_FILTER_ALPHA,
+                                          .outlier_limit = REFLOW_FILTER_OUTLIER};
+    for (uint8_t i = 0; i < ao->num_thermocouples; i++)
+    {
+        Filter_Init(&ao->tc_filter[i], &ao->filter_cfg);
+    }
+    ao->fuse_cfg = (Fuse_cfg_t){.q = FUSE_Q_DEFAULT, .r = FUSE_R_DEFAULT};
+    ao->board_class = board_classes[REFLOW_BOARD_CLASS].name;
+    ao->board_probe = -1;
+    ao->mass = 1.0f;
+    ao->mass_lag_ref = REFLOW_MASS_LAG_REF;
+    ao->mass_scale = 1.0f;
+    ao->mass_lag = NAN;
+    Board_Init(&ao->board, &board_classes[REFLOW_BOARD_CLASS].cls, REFLOW_BOARD_GAIN);
+    static const Conform_cfg_t reflow_conform_cfg = {
+        .liquidus = REFLOW_LIQUIDUS,
+        .soak_lo = REFLOW_SOAK_LO,
+        .soak_hi = REFLOW_SOAK_HI,
+        .min = {[CONFORM_PEAK] = REFLOW_PEAK_MIN, [CONFORM_TAL] = REFLOW_TAL_MIN, [CONFORM_SOAK] = REFLOW_SOAK_MIN},
+        .max = {[CONFORM_PEAK] = REFLOW_PEAK_MAX, [CONFORM_TAL] = REFLOW_TAL_MAX, [CONFORM_SOAK] = REFLOW_SOAK_MAX,
+                [CONFORM_RAMP] = REFLOW_RAMP_MAX, [CONFORM_RMS] = REFLOW_RMS_MAX}};
+    Conform_Init(&ao->conform, &reflow_conform_cfg);
+
+    /* Enable DWT cycle counter for sample timestamps */
+    CoreDebug->DEMCR |= CoreDebug_DEMCR_TRCENA_Msk;
+    DWT->CTRL |= DWT_CTRL_CYCCNTENA_Msk;
+
+    /* Initialize timer instances. */
+    TimeEvent_ctor(&ao->reflow_time_evt, REACH_TIME_SIG, (Active *)ao);
+    TimeEvent_ctor(&ao->schedule_time_evt, SCHEDULE_TICK_SIG, (Active *)ao);
+    TimeEvent_ctor(&ao->watch_time_evt, WATCH_TICK_SIG, (Active *)ao);
+    TimeEvent_ctor(&ao->align_time_evt, ALIGN_TICK_SIG, (Active *)ao);
+    ActiveCond_ctor(&ao->zones_stable, ZONES_STABLE_SIG, (Active *)ao, (1UL << ao->num_zones) - 1UL);
+    ao->sample_timer_handle = reflow_cfg->sample_timer_handle;
+    if (ao->sample_timer_handle == NULL)
+    {
+        const osTimerAttr_t timer_attr = {.name = oven_names[oven].timer,
+                                          .cb_mem = &pid_timer_cb[oven],
+                                          .cb_size = sizeof(pid_timer_cb[oven])};
+        ao->pid_timer_id = osTimerNew(reflow_sample_trigger, osTimerPeriodic, ao, &timer_attr);
+    }
+
+    /* Initialize thermocouple ICs, scans are delivered to reflow_sample_ready(). */
+    ao->thermocouples = thermocouples[oven];
+    for (uint8_t i = 0; i < ao->num_thermocouples; i++)
+    {
+        MAX31855K_Init(&ao->thermocouples[i], &reflow_cfg->max_cfg[i]);
+    }
+    MAX31855K_Scan_Init(&ao->scan, ao->thermocouples, ao->num_thermocouples, reflow_sample_ready, ao);
+
+    LOGI(TAG, "Initialized reflow module of oven %u.", oven);
+}
+
+void reflow_start(uint8_t oven)
+{
+    ASSERT(oven < REFLOW_NUM_OVENS);
+    const osThreadAttr_t reflow_thread_attr = {.name = oven_names[oven].thread,
+                                               .cb_mem = &reflow_thread_cb[oven],
+                                               .cb_size = sizeof(reflow_thread_cb[oven]),
+                                               .stack_mem = reflow_stack[oven],
+                                               .stack_size = sizeof(reflow_stack[oven])};
+
+    /* Samples are posted every period, so they take the notification ring rather than a kernel queue. */
+    Active_start_ring((Active *)&reflow_ovens[oven], PRIO_CONTROL, &reflow_thread_attr, reflow_ring[oven], REFLOW_EVENT_MSG_COUNT);
+}
+
+void reflow_sample_timer_elapsed(TIM_HandleTypeDef *htim)
+{
+	for(uint8_t oven = 0; oven < REFLOW_NUM_OVENS; oven++)
+	{
+		Reflow_Active *const ao = &reflow_ovens[oven];
+		if (ao->sample_timer_handle != NULL && htim->Instance == ao->sample_timer_handle->Instance)
+		{
+			reflow_sample_trigger(ao);
+		}
+	}
+}
+
+mod_err_t reflow_post_run(uint8_t oven, bool run)
+{
+	static const Event start_evt = { .sig = START_REFLOW_SIG };
+	ASSERT(oven < REFLOW_NUM_OVENS);
+	return run ? Active_post(&reflow_ovens[oven].reflow_base, &start_evt)
+	           : Active_postUrgent(&reflow_ovens[oven].reflow_base, &stop_evt);
+}
+
+/**
+ * @brief Start periodic thermocouple sampling, scans run ao->scans times per nominal sampling period.
+ *
+ * @param ao Reflow active object.
+ * @param oversample Scans averaged per published sample, ao->scans or 1 to publish every scan.
+ */
+static void reflow_sampling_start(Reflow_Active *const ao, uint8_t oversample)
+{
+	ao->prev_sample_valid = false;
+	ao->tc_faults = 0;
+	ao->trace_count = 0;
+	ao->acq_period = ao->sample_period * (float)oversample / (float)ao->scans;
+	ao->acq_oversample = oversample;
+	History_Reset(&ao->run_history, ao->acq_period);
+	Reflow_Run_Record run = {.type = REFLOW_RUN_TYPE, .timestamp = HAL_GetTick(), .state = (uint8_t)reflow_state(ao), .oven = ao->oven};
+	bool scripted = ao->hsm.target == &reflow_script_state; // Sampling starts while entering the state.
+	strncpy(run.profile, scripted ? ao->script.def->name : ao->profile.name, sizeof(run.profile));
+	snprintf(run.batch, sizeof(run.batch), "%s", archive_batch());
+	archive_append(&run, sizeof(run));
+
+	/* Estimate carries over between runs, output history does not. */
+	float delay = roundf(ao->smith_model.L / ao->sample_period);
+	ao->model_delay = delay < (float)SMITH_MAX_DELAY ? (uint32_t)delay : SMITH_MAX_DELAY;
+	ao->model_head = 0;
+	ao->model_samples = 0;
+	for(uint8_t i = 0; i < ao->num_thermocouples; i++)
+	{
+		Filter_Reset(&ao->tc_filter[i]);
+	}
+	for(uint8_t z = 0; z < ao->num_zones; z++)
+	{
+		if(Fuse_Init(&ao->zone_fuse[z], &ao->fuse_cfg, &ao->smith_model, ao->sample_period) != MOD_OK)
+		{
+			Fuse_Init(&ao->zone_fuse[z], &ao->fuse_cfg, NULL, ao->sample_period); // Dead time too long at this period.
+		}
+		ao->zone_rate[z] = 0.0f;
+	}
+	Board_Reset(&ao->board);
+	ao->sample_div = 1U;
+	Rate_Reset(&ao->rate);
+	memset(ao->acq_sum_hj, 0, sizeof(ao->acq_sum_hj));
+	memset(ao->acq_sum_cj, 0, sizeof(ao->acq_sum_cj));
+	ao->acq_scans = 0;
+	ao->acq_err = MAX_OK;
+	ao->acq_err_tc = 0;
+	ao->acq_err_mask = 0;
+
+	/* Host paces stepped samples, a stalled host must not reset the controller. */
+	if (ao->hil == REFLOW_HIL_STEP)
+	{
+		ao->hil_sampling = true;
+		return;
+	}
+
+	ao->align = (Reflow_Align){0};
+	if (ao->sample_timer_handle == NULL)
+	{
+		/* Software timer runs in virtual time, like time events. */
+		float scan_period = ao->sample_period / (float)(ao->scans * Active_time_scale());
+		wdg_checkin(ao->wdg_id); // Arm control loop heartbeat.
+		osTimerStart(ao->pid_timer_id, (uint32_t)(scan_period * 1000));
+	}
+	else if(ao->tc_align && ao->hil == REFLOW_HIL_OFF && Active_time_scale() == 1U)
+	{
+		reflow_align_probe_start(ao); // Sampling timer starts once the search finished.
+	}
+	else
+	{
+		reflow_sampling_timer_start(ao, 0U, 0U);
+	}
+}
+
+/**
+ * @brief Start hardware sampling timer, aligned to conversions if their period was found.
+ *
+ * The control loop heartbeat is armed here, the first sample is then a sample period away.
+ *
+ * @param ao Reflow active object, sampling timer stopped.
+ * @param period Conversion period (sampling timer counts), 0 if reads are not aligned.
+ * @param since Time since the last conversion boundary (sampling timer counts).
+ */
+static void reflow_sampling_timer_start(Reflow_Active *const ao, uint32_t period, uint32_t since)
+{
+	wdg_checkin(ao->wdg_id); // Arm control loop heartbeat.
+
+	/* Sampling timer runs in virtual time, like time events. Rate may have changed during the search. */
+	float scan_period = ao->sample_period * (float)ao->sample_div / (float)(ao->scans * Active_time_scale());
+	TIM_HandleTypeDef *htim = ao->sample_timer_handle;
+	uint32_t first = (uint32_t)(scan_period * SAMPLE_TIMER_CLK_HZ);
+	if(period != 0U)
+	{
+		/* First read just after the next conversion, then every conversion. */
+		ao->align = (Reflow_Align){.active = true, .period = period - 1U, .scan_period = first, .due = first};
+		first = period - since % period + REFLOW_ALIGN_STEP;
+		LOGI(TAG, "Thermocouple reads aligned to %.1f ms conversions.", (float)period * 1000.0f / SAMPLE_TIMER_CLK_HZ);
+	}
+	else if(ao->tc_align)
+	{
+		LOGW(TAG, "No conversion boundaries found, thermocouple reads not aligned.");
+	}
+	htim->Instance->CR1 &= ~TIM_CR1_ARPE;
+	__HAL_TIM_SET_AUTORELOAD(htim, first - 1U);
+	htim->Instance->CR1 |= TIM_CR1_ARPE; // Later rate changes take effect once the current scan period ends.
+	if(ao->align.active)
+	{
+		__HAL_TIM_SET_AUTORELOAD(htim, ao->align.period - 1U);
+	}
+	__HAL_TIM_SET_COUNTER(htim, 0);
+	__HAL_TIM_CLEAR_FLAG(htim, TIM_FLAG_UPDATE); // Update flag is set by HAL_TIM_Base_Init().
+	HAL_TIM_Base_Start_IT(htim);
+}
+
+/**
+ * @brief Change period of running thermocouple sampling to div nominal sampling periods per sample.
+ *
+ * Scans per sample are kept, so scans slow down as well. Hardware timer changes take effect
+ * once the current scan period ends, the sample being accumulated straddles both rates.
+ *
+ * @param ao Reflow active object.
+ * @param div Nominal sampling periods per sample.
+ */
+static void reflow_sampling_div(Reflow_Active *const ao, uint8_t div)
+{
+	if(div == ao->sample_div || ao->hil == REFLOW_HIL_STEP)
+	{
+		return;
+	}
+	LOGI(TAG, "Control rate 1/%u, sampling every %.2f s.", div, ao->sample_period * (float)div);
+	ao->sample_div = div;
+	if(ao->probe.active)
+	{
+		return; // Sampling timer counts for the search, it starts at this rate.
+	}
+	float scan_period = ao->sample_period * (float)div / (float)(ao->scans * Active_time_scale());
+	if(ao->align.active)
+	{
+		uint32_t primask = __get_PRIMASK();
+		__disable_irq();
+		ao->align.scan_period = (uint32_t)(scan_period * SAMPLE_TIMER_CLK_HZ); // Reads stay paced by conversions.
+		__set_PRIMASK(primask);
+	}
+	else if(ao->sample_timer_handle != NULL)
+	{
+		__HAL_TIM_SET_AUTORELOAD(ao->sample_timer_handle, (uint32_t)(scan_period * SAMPLE_TIMER_CLK_HZ) - 1U);
+	}
+	else
+	{
+		osTimerStart(ao->pid_timer_id, (uint32_t)(scan_period * 1000));
+	}
+}
+
+/**
+ * @brief Stop periodic thermocouple sampling.
+ */
+static void reflow_sampling_stop(Reflow_Active *const ao)
+{
+	wdg_suspend(ao->wdg_id);
+	uint32_t tail = ao->run_history.count % HISTORY_BLOCK_SAMPLES;
+	if (tail != 0)
+	{
+		reflow_archive_block(ao, ao->run_history.count - tail);
+	}
+	archive_flush();
+	if (ao->hil == REFLOW_HIL_STEP)
+	{
+		ao->hil_sampling = false;
+	}
+	else if (ao->sample_timer_handle != NULL)
+	{
+		TimeEvent_disarm(&ao->align_time_evt);
+		ao->probe.active = false; // A read already queued finds no search.
+		HAL_TIM_Base_Stop_IT(ao->sample_timer_handle);
+		ao->align.active = false;
+	}
+	else
+	{
+		osTimerStop(ao->pid_timer_id);
+	}
+}
+
+/**
+ * @brief Start thermocouple DMA scan (sampling timer ISR or timer daemon task).
+ *
+ * The PID iteration runs within the reflow active object once
+ * all thermocouples are sampled, so this callback never blocks on SPI.
+ */
+static void reflow_sample_trigger(void *argument)
+{
+	Reflow_Active *const ao = argument;
+	if(ao->hil == REFLOW_HIL_FREE)
+	{
+		/* Injected temperatures stand in for scans, already averaged by the host. */
+		if(++ao->acq_scans >= ao->acq_oversample)
+		{
+			ao->acq_scans = 0;
+			reflow_hil_post(ao);
+		}
+		return;
+	}
+
+	if(ao->align.active && reflow_align_next(ao))
+	{
+		(void)MAX31855K_Scan_Start(&ao->scan); // Tracking only, a failed read is caught up with at the next conversion.
+		return;
+	}
+
+	ao->sample_timestamp = DWT->CYCCNT;
+	MAX31855K_err_t err = MAX31855K_Scan_Start(&ao->scan);
+	if(err != MAX_OK)
+	{
+		/* Timer daemon task may race a late scan ISR for the accumulator. */
+		uint32_t primask = __get_PRIMASK();
+		__disable_irq();
+		reflow_sample_accumulate(ao, err, 0, NULL, 0);
+		__set_PRIMASK(primask);
+	}
+}
+
+/**
+ * @brief Add thermocouple scan to in-progress sample (SPI DMA ISR).
+ *
+ * @param ctx Reflow active object of oven scanned.
+ * @param devs Scanned thermocouples.
+ * @param num_devs Number of scanned thermocouples.
+ */
+static void reflow_sample_ready(void *ctx, MAX31855K_t const *devs, uint8_t num_devs)
+{
+	Reflow_Active *const ao = ctx;
+	if(ao->align.active && !reflow_align_track(ao, &devs[0]))
+	{
+		return;
+	}
+
+	MAX31855K_err_t err = MAX_OK;
+	uint8_t err_tc = 0;
+	for(uint8_t i = 0; i < num_devs; i++)
+	{
+		if(devs[i].err != MAX_OK)
+		{
+			err = devs[i].err;
+			err_tc = i;
+			break;
+		}
+	}
+	reflow_sample_accumulate(ao, err, err_tc, devs, num_devs);
+}
+
+/**
+ * @brief Start search for conversion period and phase of thermocouple 0 (reflow thread).
+ *
+ * Thermocouple 0 is then read every millisecond on ALIGN_TICK_SIG, see reflow_align_probe_step().
+ * Boundaries are timed with the sampling timer counting freely, its interrupt disabled.
+ *
+ * @param ao Reflow active object, sampling timer stopped.
+ */
+static void reflow_align_probe_start(Reflow_Active *const ao)
+{
+	TIM_TypeDef *const tim = ao->sample_timer_handle->Instance;
+	tim->CR1 &= ~TIM_CR1_ARPE;
+	tim->ARR = 0xFFFFU;
+	tim->CNT = 0;
+	tim->CR1 |= TIM_CR1_CEN;
+
+	MAX31855K_t *const max = &ao->thermocouples[0];
+	if(MAX31855K_RxBlocking(max) != MAX_OK)
+	{
+		tim->CR1 &= ~TIM_CR1_CEN;
+		reflow_sampling_timer_start(ao, 0U, 0U);
+		return;
+	}
+	ao->probe = (Reflow_Probe){.active = true, .prev_data = max->data32, .gap = UINT32_MAX};
+	TimeEvent_arm(&ao->align_time_evt, TIME_EVENT_MS(1), TIME_EVENT_MS(1));
+}
+
+/**
+ * @brief Read thermocouple 0 once for the conversion boundary search, starting sampling once it ended.
+ *
+ * A conversion completed before a read whose frame differs from the previous one. The conversion
+ * period is the time from the first to the last boundary over the conversions in between, counted
+ * with the shortest time between two boundaries: conversions repeating the previous frame hide theirs.
+ * Reads are aligned if at least two boundaries a plausible conversion time apart were found within
+ * REFLOW_ALIGN_PROBE_MS.
+ *
+ * @param ao Reflow active object.
+ */
+static void reflow_align_probe_step(Reflow_Active *const ao)
+{
+	Reflow_Probe *const probe = &ao->probe;
+	if(!probe->active)
+	{
+		return; // Read queued before sampling stopped.
+	}
+
+	const uint32_t probe_end = REFLOW_ALIGN_PROBE_MS * SAMPLE_TIMER_CLK_HZ / 1000U;
+	const uint32_t gap_min = (uint32_t)(MAX31855K_CONVERSION_MIN_S * SAMPLE_TIMER_CLK_HZ);
+	const uint32_t gap_max = (uint32_t)(MAX31855K_CONVERSION_S * SAMPLE_TIMER_CLK_HZ) + REFLOW_ALIGN_STEP; // Read jitter.
+	MAX31855K_t *const max = &ao->thermocouples[0];
+	TIM_TypeDef *const tim = ao->sample_timer_handle->Instance;
+	uint32_t now = tim->CNT;
+	bool ok = MAX31855K_RxBlocking(max) == MAX_OK;
+	if(ok && max->data32 != probe->prev_data)
+	{
+		if(probe->boundaries == 0)
+		{
+			probe->first = now;
+		}
+		else if(now - probe->last < probe->gap)
+		{
+			probe->gap = now - probe->last;
+		}
+		probe->last = now;
+		probe->prev_data = max->data32;
+		probe->boundaries++;
+	}
+	if(ok && tim->CNT < probe_end)
+	{
+		return;
+	}
+
+	TimeEvent_disarm(&ao->align_time_evt);
+	probe->active = false;
+	uint32_t since = tim->CNT - probe->last;
+	tim->CR1 &= ~TIM_CR1_CEN;
+	uint32_t period = 0;
+	if(ok && probe->boundaries >= 2 && probe->gap >= gap_min && probe->gap <= gap_max)
+	{
+		uint32_t conversions = (probe->last - probe->first + probe->gap / 2U) / probe->gap;
+		period = (probe->last - probe->first + conversions / 2U) / conversions;
+	}
+	reflow_sampling_timer_start(ao, period, since);
+}
+
+/**
+ * @brief Account a conversion-paced read, deciding whether it is accumulated (sampling timer ISR).
+ *
+ * Reads run every conversion, they are accumulated at the nominal scan rate on average.
+ *
+ * @param ao Reflow active object.
+ *
+ * @return true if the read only tracks conversions.
+ */
+static bool reflow_align_next(Reflow_Active *const ao)
+{
+	ao->align.due += ao->align.period;
+	ao->align.track_only = ao->align.due < ao->align.scan_period;
+	if(!ao->align.track_only)
+	{
+		ao->align.due -= ao->align.scan_period;
+	}
+	return ao->align.track_only;
+}
+
+/**
+ * @brief Keep reads just after conversions of thermocouple 0 complete (scan ISR).
+ *
+ * The read period is kept below the conversion period, so reads drift earlier, closer to the
+ * conversion they read, until one comes before it and returns the conversion read before. The
+ * read after that repeat is delayed by REFLOW_ALIGN_STEP, so reading ages saw-tooth from
+ * REFLOW_ALIGN_STEP down to zero, and are estimated from the reads between repeats. Reads
+ * drifting early fast lengthen the period, long runs without a repeat shorten it.
+ *
+ * A conversion equal to the previous one also counts as repeat, ages are overestimated at
+ * steady temperatures.
+ *
+ * @param ao Reflow active object.
+ * @param max Thermocouple 0 as read.
+ *
+ * @return true if the read is accumulated.
+ */
+static bool reflow_align_track(Reflow_Active *const ao, MAX31855K_t const *const max)
+{
+	bool repeat = max->err == MAX_OK && max->data32 == ao->align.prev_data;
+	if(max->err == MAX_OK)
+	{
+		ao->align.prev_data = max->data32;
+	}
+	ao->align.since_repeat++;
+
+	TIM_HandleTypeDef *const htim = ao->sample_timer_handle;
+	if(repeat)
+	{
+		if(ao->align.since_repeat * 2U < REFLOW_ALIGN_STEP)
+		{
+			ao->align.period++; // Drifting over two counts per read.
+		}
+		htim->Instance->CR1 &= ~TIM_CR1_ARPE;
+		__HAL_TIM_SET_AUTORELOAD(htim, ao->align.period + REFLOW_ALIGN_STEP - 1U); // Current period, read just started.
+		htim->Instance->CR1 |= TIM_CR1_ARPE;
+		__HAL_TIM_SET_AUTORELOAD(htim, ao->align.period - 1U);
+		INC_SAT_U32(ao->align.repeats);
+		ao->align.repeat_interval = ao->align.since_repeat;
+		ao->align.since_repeat = 0;
+	}
+	else if(ao->align.since_repeat % REFLOW_ALIGN_LOCK_READS == 0U)
+	{
+		ao->align.period--;
+		__HAL_TIM_SET_AUTORELOAD(htim, ao->align.period - 1U);
+	}
+
+	if(ao->align.track_only)
+	{
+		return false;
+	}
+	float age;
+	if(repeat)
+	{
+		age = (float)ao->align.period * 1000.0f / SAMPLE_TIMER_CLK_HZ; // A conversion old.
+	}
+	else if(ao->align.repeat_interval != 0U && ao->align.since_repeat < ao->align.repeat_interval)
+	{
+		age = (float)(REFLOW_ALIGN_STEP * (ao->align.repeat_interval - ao->align.since_repeat)) * 1000.0f /
+		      (float)(ao->align.repeat_interval * SAMPLE_TIMER_CLK_HZ);
+	}
+	else
+	{
+		return true; // Drift not measured yet, or past the previous repeat interval.
+	}
+	ao->align.age_sum += age;
+	ao->align.age_max = fmaxf(ao->align.age_max, age);
+	ao->align.aged++;
+	return true;
+}
+
+/**
+ * @brief Hot junction temperature of successfully read thermocouple, NIST-corrected if enabled.
+ */
+static inline float reflow_tc_temp(Reflow_Active const *const ao, MAX31855K_t const *const max)
+{
+	return ao->tc_nist ? MAX31855K_Get_HJ_NIST(max) : MAX31855K_Get_HJ(max);
+}
+
+/**
+ * @brief Apply calibration of thermocouple to its reading, interrupts masked so it is not rebuilt meanwhile.
+ */
+static inline float reflow_tc_cal(Reflow_Active const *const ao, uint8_t tc, float reading)
+{
+	uint32_t primask = __get_PRIMASK();
+	__disable_irq();
+	float temp = Tccal_Apply(&ao->tc_cal[tc], reading);
+	__set_PRIMASK(primask);
+	return temp;
+}
+
+/**
+ * @brief Accumulate one scan, publishing the sample every acq_oversample scans.
+ *
+ * The MAX31855K converts continuously, so averaging scans taken at its conversion
+ * rate lowers quantization and noise without raising the control rate. The mean
+ * lags the last scan by (acq_oversample - 1) / 2 scan periods.
+ *
+ * Raw readings are summed as integers, two thermocouples per packed add, so a scan
+ * costs no float math. The NIST correction is applied once per sample to the mean
+ * hot and cold junction temperatures, the correction is smooth over the spread of
+ * the scans averaged.
+ *
+ * @param ao Reflow active object.
+ * @param err First thermocouple read error of scan.
+ * @param err_tc Index of thermocouple that reported err.
+ * @param devs Scanned thermocouples, NULL if scan could not be started.
+ * @param num_devs Number of scanned thermocouples.
+ */
+static void reflow_sample_accumulate(Reflow_Active *const ao, MAX31855K_err_t err, uint8_t err_tc, MAX31855K_t const *devs, uint8_t num_devs)
+{
+	if(err != MAX_OK && ao->acq_err == MAX_OK)
+	{
+		ao->acq_err = err;
+		ao->acq_err_tc = err_tc;
+	}
+	for(uint8_t i = 0; i < num_devs; i += 2)
+	{
+		/* Thermocouple pairs are summed as raw readings, both in one instruction. */
+		int16_t hj[2] = {0, 0};
+		int16_t cj[2] = {0, 0};
+		for(uint8_t k = 0; k < 2 && i + k < num_devs; k++)
+		{
+			if(devs[i + k].err == MAX_OK)
+			{
+				hj[k] = MAX31855K_Get_HJ_q2(&devs[i + k]);
+				cj[k] = MAX31855K_Get_CJ_q4(&devs[i + k]);
+			}
+			else
+			{
+				ao->acq_err_mask |= (uint8_t)(1U << (i + k));
+			}
+		}
+		ao->acq_sum_hj[i / 2] = simd_qadd16(ao->acq_sum_hj[i / 2], simd_pack16(hj[0], hj[1]));
+		ao->acq_sum_cj[i / 2] = simd_qadd16(ao->acq_sum_cj[i / 2], simd_pack16(cj[0], cj[1]));
+	}
+
+	if(++ao->acq_scans >= ao->acq_oversample)
+	{
+		reflow_sample_post(ao);
+		memset(ao->acq_sum_hj, 0, sizeof(ao->acq_sum_hj));
+		memset(ao->acq_sum_cj, 0, sizeof(ao->acq_sum_cj));
+		ao->acq_scans = 0;
+		ao->acq_err = MAX_OK;
+		ao->acq_err_tc = 0;
+		ao->acq_err_mask = 0;
+	}
+}
+
+/**
+ * @brief Allocate sample event from accumulated scans and publish it to subscribers and the oven's controller (ISR-safe).
+ *
+ * Each sample is a separate pool event, so a scan completing while the previous
+ * sample is still being processed cannot modify it. Samples are dropped if the
+ * event pool is exhausted, which shows up as a missed deadline on the next sample.
+ *
+ * @param ao Reflow active object of oven sampled.
+ */
+static void reflow_sample_post(Reflow_Active *const ao)
+{
+	Sample_Event *const sample = (Sample_Event *)Event_new(sizeof(Sample_Event), SAMPLE_READY_SIG);
+	if(sample == NULL)
+	{
+		return;
+	}
+
+	sample->timestamp = ao->sample_timestamp;
+	sample->ready_timestamp = DWT->CYCCNT;
+	sample->err = ao->acq_err;
+	sample->err_tc = ao->acq_err_tc;
+	sample->err_mask = ao->acq_err_mask;
+	sample->num_scans = ao->acq_scans;
+	sample->num_thermocouples = ao->num_thermocouples;
+	sample->oven = ao->oven;
+	Reflow_Latest acq = {.err = ao->acq_err, .err_tc = ao->acq_err_tc, .num_thermocouples = ao->num_thermocouples};
+	float hj_scale = MAX31855K_HJ_RES / (float)ao->acq_scans;
+	float cj_scale = MAX31855K_CJ_RES / (float)ao->acq_scans;
+	for(uint8_t i = 0; i < REFLOW_MAX_THERMOCOUPLES; i++)
+	{
+		uint32_t hj_sum = ao->acq_sum_hj[i / 2];
+		uint32_t cj_sum = ao->acq_sum_cj[i / 2];
+		float hj = (float)((i & 1U) ? simd_hi16(hj_sum) : simd_lo16(hj_sum)) * hj_scale;
+		float cj = (float)((i & 1U) ? simd_hi16(cj_sum) : simd_lo16(cj_sum)) * cj_scale;
+		if(ao->tc_nist && i < ao->num_thermocouples)
+		{
+			hj = MAX31855K_NIST(hj, cj);
+		}
+		acq.raw[i] = hj;
+		hj = Tccal_Apply(&ao->tc_cal[i], hj);
+		sample->temp[i] = hj;
+		acq.temp[i] = hj;
+		acq.cj[i] = cj;
+	}
+	analog_read(&sample->analog);
+	acq.analog = sample->analog;
+	reflow_latest_put(ao, &acq);
+	Active_publish_to(&ao->reflow_base, &sample->base);
+}
+
+/**
+ * @brief Display PID, profile parameters, or both to user.
+ *
+ * "brief" and "bin" print the status snapshot as one line or send it as one telemetry frame,
+ * cheap enough for periodic polling by a supervisory host.
+ */
+static uint32_t reflow_status_cmd(uint32_t argc, const char **argv)
+{
+	Reflow_Active *const ao = cmd_ctx();
+	if(argc > 0)
+	{
+		Reflow_Status snap;
+		if(strcasecmp(argv[0], "brief") == 0 && argc == 1)
+		{
+			reflow_status_read(ao, &snap);
+			reflow_status_brief(ao, &snap);
+		}
+		else if(strcasecmp(argv[0], "bin") == 0 && argc == 1)
+		{
+			reflow_status_read(ao, &snap);
+			uint8_t frame[FRAME_ENCODED_SIZE(sizeof(snap))];
+			size_t len = frame_encode((const uint8_t *)&snap, sizeof(snap), frame, sizeof(frame));
+			console_telemetry_write((const char *)frame, len);
+		}
+		else
+		{
+			LOG("Usage: reflow status [brief | bin]\r\n");
+			return -1;
+		}
+		return 0;
+	}
+	if(cmd_get_mode() != CMD_MODE_TEXT)
+	{
+		reflow_status_fields(ao);
+		return 0;
+	}
+	displayPIDParams(ao);
+	displayProfileParams(ao);
+	displayModel(ao);
+	displayState(ao);
+	if(reflow_state(ao) != RESET_STATE)
+	{
+		/* Thermocouple is sampled through DMA during a reflow process. */
+		LOG("Oven temperature: %.2f\r\n", ao->temp);
+		for(uint8_t z = 0; z < ao->num_zones; z++)
+		{
+			LOG("Zone %s temperature: %.2f\tOutput: %.2f\r\n",
+			    ao->zones[z].name, ao->zone_temp[z], ao->zone_out[z]);
+		}
+		if(ao->has_fan)
+		{
+			LOG("Cooling output: %.2f (demand %.2f)\r\n", ao->cooling.out, ao->cooling.demand);
+		}
+		return 0;
+	}
+	Reflow_Latest acq;
+	if(!reflow_latest_refresh(ao, &acq))
+	{
+		LOG("No thermocouple reading yet\r\n");
+		return 0;
+	}
+	float oven_temp = 0;
+	if(reflow_latest_oven_temp(ao, &acq, &oven_temp))
+	{
+		LOG("Oven temperature: %.2f\r\n", oven_temp);
+		for(uint8_t i = 0; i < acq.num_thermocouples; i++)
+		{
+			LOG("Thermocouple %u: %.2f (cold junction %.2f)\r\n", i, acq.temp[i], acq.cj[i]);
+		}
+	}
+	else
+	{
+		LOG("Thermocouple %u read error: %s\r\n", acq.err_tc, MAX31855K_Err_Str(acq.err));
+	}
+	if(!isnan(acq.analog.current))
+	{
+		LOG("Heater current: %.2f A (%.0f W)\r\n", acq.analog.current, acq.analog.power);
+	}
+	if(!isnan(acq.analog.ambient))
+	{
+		LOG("Ambient: %.1f\r\n", acq.analog.ambient);
+	}
+	LOG("Read %lu ms ago (acquisition %lu)\r\n", osKernelGetTickCount() - acq.tick, acq.count);
+    return 0;
+}
+
+static uint32_t reflow_start_cmd(uint32_t argc, const char **argv)
+{
+	Reflow_Active *const ao = cmd_ctx();
+	(void)reflow_post_run(ao->oven, true);
+	LOG("Posted START signal to reflow active object.\r\n");
+	return 0;
+}
+
+static uint32_t reflow_stop_cmd(uint32_t argc, const char **argv)
+{
+	Reflow_Active *const ao = cmd_ctx();
+	(void)reflow_post_run(ao->oven, false);
+	LOG("Posted STOP signal to reflow active object.\r\n");
+	return 0;
+}
+
+static uint32_t reflow_set_cmd(uint32_t argc, const char **argv)
+{
+	Reflow_Active *const ao = cmd_ctx();
+	/* Optional zone key selects a single zone, otherwise all zones are updated. */
+	enum {SET_ZONE, SET_KP, SET_KI, SET_KD, SET_TAU, SET_KFF, SET_TS, SET_PWM, NUM_SET_KEYS};
+	static const cmd_kv_spec specs[NUM_SET_KEYS] = {{"zone", 'u'}, {"Kp", 'f'}, {"Ki", 'f'}, {"Kd", 'f'},
+	                                                {"Tau", 'f'}, {"Kff", 'f'}, {"Ts", 'f'}, {"pwm", 'f'}};
+	cmd_arg_val vals[NUM_SET_KEYS];
+	int32_t num_keys = cmd_parse_kv(argc, argv, specs, NUM_SET_KEYS, vals);
+	if(num_keys < 0)
+	{
+		return -1;
+	}
+	bool timing_given = vals[SET_TS].type != '\0' || vals[SET_PWM].type != '\0';
+	int32_t num_gains = num_keys - (vals[SET_ZONE].type != '\0' ? 1 : 0) - (vals[SET_TS].type != '\0' ? 1 : 0) -
+	                    (vals[SET_PWM].type != '\0' ? 1 : 0);
+	if(num_gains == 0 && !timing_given)
+	{
+		LOG("No parameter given\r\n");
+		return -1;
+	}
+
+	uint8_t first_zone = 0;
+	uint8_t last_zone = ao->num_zones;
+	if(vals[SET_ZONE].type != '\0')
+	{
+		if(vals[SET_ZONE].val.u >= ao->num_zones)
+		{
+			LOG("Invalid zone: %lu\r\n", vals[SET_ZONE].val.u);
+			return -1;
+		}
+		if(timing_given)
+		{
+			LOG("Ts and pwm apply to all zones\r\n");
+			return -1;
+		}
+		first_zone = (uint8_t)vals[SET_ZONE].val.u;
+		last_zone = first_zone + 1;
+	}
+	for(uint8_t k = SET_KP; k < NUM_SET_KEYS; k++)
+	{
+		if(vals[k].type != '\0' && vals[k].val.f < 0.0f)
+		{
+			LOG("Invalid value for %s: %.4f, must not be negative\r\n", specs[k].key, vals[k].val.f);
+			return -1;
+		}
+	}
+
+	/* PWM period follows Ts unless set apart from it, and never exceeds it. */
+	if(timing_given)
+	{
+		Reflow_Timing timing = {.sample_period = ao->sample_period, .pwm_period = ao->pwm_period};
+		if(vals[SET_TS].type != '\0')
+		{
+			timing.sample_period = vals[SET_TS].val.f;
+			timing.pwm_period = ao->pwm_period == ao->sample_period ? timing.sample_period
+			                                                                    : fminf(ao->pwm_period, timing.sample_period);
+		}
+		if(vals[SET_PWM].type != '\0')
+		{
+			timing.pwm_period = vals[SET_PWM].val.f;
+		}
+		if(reflow_timing_check(ao, &timing) != MOD_OK)
+		{
+			return -1;
+		}
+		ao->timing_request = timing;
+	}
+
+	if(num_gains > 0)
+	{
+		/* Every key is valid, publish them as one set so no sample sees a partial update. */
+		Reflow_Gains *const gains = reflow_params_edit(&ao->gain_params);
+		for(uint8_t z = first_zone; z < last_zone; z++)
+		{
+			Reflow_Gains *const g = &gains[z];
+			g->Kp = vals[SET_KP].type != '\0' ? vals[SET_KP].val.f : g->Kp;
+			g->Ki = vals[SET_KI].type != '\0' ? vals[SET_KI].val.f : g->Ki;
+			g->Kd = vals[SET_KD].type != '\0' ? vals[SET_KD].val.f : g->Kd;
+			g->tau = vals[SET_TAU].type != '\0' ? vals[SET_TAU].val.f : g->tau;
+			g->Kff = vals[SET_KFF].type != '\0' ? vals[SET_KFF].val.f : g->Kff;
+		}
+		reflow_params_publish(&ao->gain_params);
+		static const Event gains_evt = { .sig = GAINS_SIG };
+		Active_post(&ao->reflow_base, &gains_evt);
+
+		reflow_gains_save(ao, gains);
+		for(uint8_t k = SET_KP; k < SET_TS; k++)
+		{
+			if(vals[k].type != '\0')
+			{
+				LOG("Updated %s to %.4f\r\n", specs[k].key, vals[k].val.f);
+			}
+		}
+	}
+
+	/* Reflow thread applies timing, refusing it if a reflow process started since the check. */
+	if(timing_given)
+	{
+		static const Event timing_evt = { .sig = TIMING_SIG };
+		Active_post(&ao->reflow_base, &timing_evt);
+	}
+
+	return 0;
+}
+
+static uint32_t reflow_stream_cmd(uint32_t argc, const char **argv)
+{
+	Reflow_Active *const ao = cmd_ctx();
+	cmd_arg_val arg_vals[2];
+	int32_t num_args = cmd_parse_args(argc, argv, "s[u", arg_vals);
+	if(num_args < 0)
+	{
+		return -1;
+	}
+
+	if(strcasecmp(arg_vals[0].val.s, "on") == 0)
+	{
+		uint32_t decimation = num_args == 2 ? arg_vals[1].val.u : 1;
+		if(decimation == 0)
+		{
+			LOG("Decimation must be at least 1\r\n");
+			return -1;
+		}
+		ao->stream_count = 0;
+		ao->stream_decimation = decimation;
+		LOG("Streaming telemetry every %lu samples\r\n", decimation);
+	}
+	else if(strcasecmp(arg_vals[0].val.s, "off") == 0)
+	{
+		ao->stream_decimation = 0;
+		LOG("Telemetry streaming off\r\n");
+	}
+	else
+	{
+		LOG("Usage: reflow stream <on|off> [decimation]\r\n");
+		return -1;
+	}
+	return 0;
+}
+
+/**
+ * The reflow thread pushes the snapshot after its own event at the set rate, so a
+ * supervisory host only listens instead of sending "reflow status bin" for every record.
+ */
+static uint32_t reflow_watch_cmd(uint32_t argc, const char **argv)
+{
+	Reflow_Active *const ao = cmd_ctx();
+	if(argc == 0)
+	{
+		uint32_t period = ao->watch_period_ms;
+		if(period == 0)
+		{
+			LOG("Status push off\r\n");
+		}
+		else
+		{
+			LOG("Status push every %lu ms\r\n", period);
+		}
+		return 0;
+	}
+
+	uint32_t period;
+	if(argc == 1 && strcasecmp(argv[0], "off") == 0)
+	{
+		period = 0;
+	}
+	else
+	{
+		cmd_arg_val arg_vals[1];
+		if(cmd_parse_args(argc, argv, "u", arg_vals) != 1)
+		{
+			LOG("Usage: reflow watch [<hz> | off]\r\n");
+			return -1;
+		}
+		uint32_t hz = arg_vals[0].val.u;
+		if(hz == 0 || hz > REFLOW_WATCH_MAX_HZ)
+		{
+			LOG("Rate must be 1 to %u Hz\r\n", REFLOW_WATCH_MAX_HZ);
+			return -1;
+		}
+		period = 1000U / hz;
+	}
+
+	ao->watch_period_ms = period;
+	static const Event watch_evt = { .sig = WATCH_SIG };
+	if(Active_post(&ao->reflow_base, &watch_evt) != MOD_OK)
+	{
+		LOG("Reflow queue full, try again\r\n");
+		return -1;
+	}
+	return 0;
+}
+
+static uint32_t reflow_pidcheck_cmd(uint32_t argc, const char **argv)
+{
+	Reflow_Active *const ao = cmd_ctx();
+	uint32_t len = ao->trace_count < REFLOW_TRACE_LEN ? ao->trace_count : REFLOW_TRACE_LEN;
+	if(len == 0)
+	{
+		LOG("No samples recorded, start reflow process first\r\n");
+		return -1;
+	}
+
+	/* Unroll ring into chronological order. Trace may be updated by reflow thread
+	 * meanwhile, which only perturbs the sequence being compared.
+	 */
+	static float setpoints[REFLOW_TRACE_LEN];
+	static float temps[REFLOW_TRACE_LEN];
+	uint32_t start = ao->trace_count - len;
+	for(uint8_t z = 0; z < ao->num_zones; z++)
+	{
+		for(uint32_t i = 0; i < len; i++)
+		{
+			setpoints[i] = ao->trace_setpoint[(start + i) % REFLOW_TRACE_LEN];
+			temps[i] = ao->trace_temp[z][(start + i) % REFLOW_TRACE_LEN];
+		}
+
+		/* Fixed-point controller folds Ts into its coefficients, so compare at nominal period. */
+		PID_t const *const pid = &ao->zone_pid[z];
+		const PID_cfg_t cfg = {.Kp = pid->Kp,
+		                       .Ki = pid->Ki,
+		                       .Kd = pid->Kd,
+		                       .tau = pid->tau,
+		                       .Ts = ao->sample_period,
+		                       .out_max = pid->out_lim_max,
+		                       .out_min = pid->out_lim_min,
+		                       .b = 1.0f}; // Fixed-point controller has no setpoint weights or back-calculation.
+		float max_err = PIDq_Compare(&cfg, setpoints, temps, len);
+		LOG("Zone %s: compared %lu samples, max output deviation %.4f\r\n", ao->zones[z].name, len, max_err);
+	}
+	return 0;
+}
+
+static uint32_t reflow_profile_cmd(uint32_t argc, const char **argv)
+{
+	Reflow_Active *const ao = cmd_ctx();
+	if(argc == 0)
+	{
+		displayProfileParams(ao);
+		return 0;
+	}
+
+	/* New profile may carry its segments, so a whole profile uploads in one line. */
+	bool new_profile = strcasecmp(argv[0], "new") == 0 && argc >= 2;
+	uint32_t first_seg_arg = new_profile ? 2 : 1;
+	if((new_profile || (strcasecmp(argv[0], "add") == 0 && argc >= 4)) && (argc - first_seg_arg) % 3 == 0)
+	{
+		uint32_t num_new = (argc - first_seg_arg) / 3;
+		uint32_t num_kept = new_profile ? 0 : ao->profile_upload.num_segments;
+		if(num_kept + num_new > REFLOW_MAX_SEGMENTS)
+		{
+			LOG("Profile can have at most %u segments\r\n", REFLOW_MAX_SEGMENTS);
+			return -1;
+		}
+
+		/* Parse every segment before changing upload, a bad line adds nothing. */
+		Reflow_Segment segs[REFLOW_MAX_SEGMENTS];
+		for(uint32_t i = 0; i < num_new; i++)
+		{
+			const char *const *const seg_args = &argv[first_seg_arg + 3 * i];
+			char *end;
+			segs[i].ramp_rate = strtof(seg_args[0], &end);
+			bool valid = *end == '\0';
+			segs[i].target = strtof(seg_args[1], &end);
+			valid = valid && *end == '\0';
+			segs[i].dwell = strtoul(seg_args[2], &end, 0);
+			valid = valid && *end == '\0';
+			if(!valid)
+			{
+				LOG("Invalid segment %lu, usage: <ramp deg C/s> <target deg C> <dwell s>\r\n", num_kept + i);
+				return -1;
+			}
+		}
+
+		if(new_profile)
+		{
+			memset(&ao->profile_upload, 0, sizeof(ao->profile_upload));
+			strncpy(ao->profile_upload.name, argv[1], REFLOW_PROFILE_NAME_LEN - 1);
+			LOG("Uploading profile %s, add segments then load it\r\n", ao->profile_upload.name);
+		}
+		memcpy(&ao->profile_upload.segments[num_kept], segs, num_new * sizeof(segs[0]));
+		ao->profile_upload.num_segments = (uint8_t)(num_kept + num_new);
+		if(num_new > 0)
+		{
+			LOG("Added segments %lu to %lu\r\n", num_kept, num_kept + num_new - 1);
+		}
+		return 0;
+	}
+	else if(strcasecmp(argv[0], "load") == 0 && argc == 1)
+	{
+		if(reflow_profile_check(&ao->profile_upload) != MOD_OK)
+		{
+			return -1;
+		}
+
+		/* Reflow thread applies profile, deferring it while a reflow process runs. Uploads
+		 * may go on meanwhile, as only the published copy is applied.
+		 */
+		Reflow_Profile *const profile = reflow_params_edit(&ao->profile_params);
+		*profile = ao->profile_upload;
+		reflow_params_publish(&ao->profile_params);
+		static const Event load_evt = { .sig = PROFILE_LOAD_SIG };
+		Active_post(&ao->reflow_base, &load_evt);
+		return 0;
+	}
+
+	LOG("Usage: reflow profile [new <name> [<ramp> <target> <dwell> ...] | add <ramp deg C/s> <target deg C> <dwell s> ... | load]\r\n");
+	return -1;
+}
+
+static uint32_t reflow_optimize_cmd(uint32_t argc, const char **argv)
+{
+	Reflow_Active *const ao = cmd_ctx();
+	enum {OPT_AMB, OPT_START, OPT_END, OPT_HEADROOM, OPT_MARGIN, NUM_OPT_KEYS};
+	static const cmd_kv_spec specs[NUM_OPT_KEYS] = {{"amb", 'f'}, {"start", 'f'}, {"end", 'f'}, {"headroom", 'f'},
+	                                                {"margin", 'f'}};
+	cmd_arg_val vals[NUM_OPT_KEYS];
+	if(cmd_parse_kv(argc, argv, specs, NUM_OPT_KEYS, vals) < 0)
+	{
+		return -1;
+	}
+
+	/* Identified model comes with its ambient temperature, a Smith model set by hand does not. */
+	Profopt_cfg_t cfg = {.ambient = REFLOW_OPT_AMBIENT,
+	                     .out_max = OUT_MAX_INIT,
+	                     .headroom = REFLOW_OPT_HEADROOM,
+	                     .margin = REFLOW_OPT_MARGIN,
+	                     .end = REFLOW_OPT_END};
+	bool identified = reflow_model_get(ao, &cfg.model, &cfg.ambient);
+	if(!identified)
+	{
+		cfg.model = ao->smith_model;
+		cfg.ambient = REFLOW_OPT_AMBIENT;
+	}
+	if(!(cfg.model.T > 0.0f))
+	{
+		LOG("No oven model, identify one with a run or set it with: reflow smith model <K> <T> <L>\r\n");
+		return -1;
+	}
+	float *const fields[NUM_OPT_KEYS] = {&cfg.ambient, &cfg.start, &cfg.end, &cfg.headroom, &cfg.margin};
+	cfg.start = vals[OPT_AMB].type != '\0' ? vals[OPT_AMB].val.f : cfg.ambient;
+	for(uint8_t i = 0; i < NUM_OPT_KEYS; i++)
+	{
+		if(vals[i].type != '\0')
+		{
+			*fields[i] = vals[i].val.f;
+		}
+	}
+
+	_Static_assert(PROFOPT_MAX_SEGMENTS <= REFLOW_MAX_SEGMENTS, "Plans fit a profile");
+	static Profopt_t plan; // Off the command thread's stack.
+	Profopt_status_t status = Profopt_Solve(&plan, &cfg, &ao->conform.cfg);
+	LOG("Model K: %.4f deg C/count\tT: %.1f s\tL: %.1f s (%s)\tambient: %.1f deg C\r\n", cfg.model.K, cfg.model.T,
+	    cfg.model.L, identified ? "identified" : "Smith", cfg.ambient);
+	if(status != PROFOPT_OK)
+	{
+		LOG("No profile meets the limits: %s\r\n", Profopt_Status_Str(status));
+		return -1;
+	}
+
+	memset(&ao->profile_upload, 0, sizeof(ao->profile_upload));
+	strncpy(ao->profile_upload.name, "OPTIMIZED", REFLOW_PROFILE_NAME_LEN - 1);
+	ao->profile_upload.num_segments = plan.num_segments;
+	for(uint8_t i = 0; i < plan.num_segments; i++)
+	{
+		Profopt_segment_t const *const seg = &plan.segments[i];
+		ao->profile_upload.segments[i] = (Reflow_Segment){.ramp_rate = seg->ramp_rate, .target = seg->target, .dwell = seg->dwell};
+		LOG("Segment %u\tRamp: %.2f deg C/s\tTarget: %.1f deg C\tDwell: %lu s\r\n", i, seg->ramp_rate, seg->target, seg->dwell);
+	}
+	LOG("Predicted run %.0f s, soak %.0f s, %.0f s above liquidus, peak %.1f deg C\r\n", plan.duration, plan.soak,
+	    plan.tal, plan.peak);
+	LOG("Uploaded profile %s, load it with: reflow profile load\r\n", ao->profile_upload.name);
+	return 0;
+}
+
+static uint32_t reflow_sched_cmd(uint32_t argc, const char **argv)
+{
+	Reflow_Active *const ao = cmd_ctx();
+	Reflow_Schedule *const schedule = &ao->schedule;
+	if(argc == 0)
+	{
+		if(schedule->num_bands == 0)
+		{
+			LOG("No gain schedule, fixed gains apply\r\n");
+		}
+		for(uint32_t i = 0; i < schedule->num_bands; i++)
+		{
+			PID_band_t const *const band = &schedule->bands[i];
+			LOG("Band %lu\tBelow: %.1f deg C\tKp: %.2f\tKi: %.2f\tKd: %.2f\tKff: %.2f\r\n",
+			    i, band->upper, band->gains.Kp, band->gains.Ki, band->gains.Kd, band->gains.Kff);
+		}
+		return 0;
+	}
+
+	/* Zone controllers read bands on every sample, so only edit them while sampling is stopped. */
+	if(reflow_state(ao) != RESET_STATE)
+	{
+		LOG("Stop reflow process before editing gain schedule\r\n");
+		return -1;
+	}
+
+	if(strcasecmp(argv[0], "clear") == 0 && argc == 1)
+	{
+		schedule->num_bands = 0;
+	}
+	else if(strcasecmp(argv[0], "add") == 0 && argc == 6)
+	{
+		if(schedule->num_bands >= REFLOW_MAX_BANDS)
+		{
+			LOG("Schedule already has %u bands\r\n", REFLOW_MAX_BANDS);
+			return -1;
+		}
+
+		char *end;
+		bool valid = true;
+		float values[5];
+		for(uint8_t i = 0; i < 5; i++)
+		{
+			values[i] = strtof(argv[i + 1], &end);
+			valid = valid && *end == '\0';
+		}
+		if(!valid || (schedule->num_bands > 0 && !(values[0] > schedule->bands[schedule->num_bands - 1].upper)))
+		{
+			LOG("Invalid band, upper bounds must increase\r\n");
+			return -1;
+		}
+		schedule->bands[schedule->num_bands++] = (PID_band_t){.upper = values[0],
+		                                                     .gains = {.Kp = values[1], .Ki = values[2],
+		                                                               .Kd = values[3], .Kff = values[4]}};
+	}
+	else
+	{
+		LOG("Usage: reflow sched [clear | add <upper deg C> <Kp> <Ki> <Kd> <Kff>]\r\n");
+		return -1;
+	}
+
+	reflow_schedule_apply(ao);
+	if(nvs_set(reflow_nvs_key(ao, NVS_KEY_PID_SCHEDULE), schedule, sizeof(*schedule)) != MOD_OK)
+	{
+		LOG("Gain schedule will not persist across resets\r\n");
+	}
+	LOG("Gain schedule has %lu bands\r\n", schedule->num_bands);
+	return 0;
+}
+
+static uint32_t reflow_autotune_cmd(uint32_t argc, const char **argv)
+{
+	Reflow_Active *const ao = cmd_ctx();
+	if(argc < 1 || argc > 3)
+	{
+		LOG("Usage: reflow autotune <setpoint deg C> [hysteresis deg C] [cycles]\r\n");
+		return -1;
+	}
+
+	char *end;
+	bool valid = true;
+	Autotune_cfg_t cfg = {.setpoint = strtof(argv[0], &end),
+	                      .hysteresis = REFLOW_AUTOTUNE_HYSTERESIS,
+	                      .out_high = OUT_MAX_INIT,
+	                      .out_low = OUT_MIN_INIT,
+	                      .limit = REFLOW_TARGET_MAX,
+	                      .timeout = REFLOW_AUTOTUNE_TIMEOUT,
+	                      .num_cycles = REFLOW_AUTOTUNE_CYCLES};
+	valid = *end == '\0';
+	if(argc > 1)
+	{
+		cfg.hysteresis = strtof(argv[1], &end);
+		valid = valid && *end == '\0';
+	}
+	if(argc > 2)
+	{
+		cfg.num_cycles = (uint8_t)strtoul(argv[2], &end, 0);
+		valid = valid && *end == '\0';
+	}
+	if(!valid || !(cfg.setpoint > 0.0f && cfg.setpoint + cfg.hysteresis < REFLOW_TARGET_MAX) ||
+	   !(cfg.hysteresis >= 0.0f) || cfg.num_cycles == 0)
+	{
+		LOG("Invalid autotune parameters\r\n");
+		return -1;
+	}
+	if(reflow_state(ao) != RESET_STATE)
+	{
+		LOG("Stop reflow process before autotuning\r\n");
+		return -1;
+	}
+
+	/* Reflow thread copies request when entering autotune state. */
+	static const Event autotune_evt = { .sig = AUTOTUNE_SIG };
+	ao->autotune_request = cfg;
+	Active_post(&ao->reflow_base, &autotune_evt);
+	return 0;
+}
+
+static uint32_t reflow_stepresp_cmd(uint32_t argc, const char **argv)
+{
+	Reflow_Active *const ao = cmd_ctx();
+	enum {STEPRESP_LO, STEPRESP_HI, STEPRESP_HOLD, STEPRESP_STEPS, STEPRESP_ORDER, STEPRESP_LIMIT, NUM_STEPRESP_KEYS};
+	static const cmd_kv_spec specs[NUM_STEPRESP_KEYS] = {{"lo", 'f'}, {"hi", 'f'}, {"hold", 'f'}, {"steps", 'u'},
+	                                                     {"order", 'u'}, {"limit", 'f'}};
+	if(argc < 1)
+	{
+		LOG("Usage: reflow stepresp <step | prbs> [lo=<out>] [hi=<out>] [hold=<s>] [steps=<n>] [order=<3..15>] [limit=<deg C>]\r\n");
+		return -1;
+	}
+
+	Excite_cfg_t cfg = {.out_low = OUT_MIN_INIT,
+	                    .out_high = OUT_MAX_INIT,
+	                    .hold = REFLOW_STEPRESP_HOLD,
+	                    .limit = REFLOW_TARGET_MAX,
+	                    .num_steps = REFLOW_STEPRESP_STEPS,
+	                    .order = REFLOW_STEPRESP_ORDER};
+	if(strcasecmp(argv[0], "step") == 0)
+	{
+		cfg.type = EXCITE_STEP;
+	}
+	else if(strcasecmp(argv[0], "prbs") == 0)
+	{
+		cfg.type = EXCITE_PRBS;
+	}
+	else
+	{
+		LOG("Unknown sequence: %s\r\n", argv[0]);
+		return -1;
+	}
+
+	cmd_arg_val vals[NUM_STEPRESP_KEYS];
+	if(cmd_parse_kv(argc - 1, argv + 1, specs, NUM_STEPRESP_KEYS, vals) < 0)
+	{
+		return -1;
+	}
+	if(vals[STEPRESP_LO].type != '\0')
+	{
+		cfg.out_low = vals[STEPRESP_LO].val.f;
+	}
+	if(vals[STEPRESP_HI].type != '\0')
+	{
+		cfg.out_high = vals[STEPRESP_HI].val.f;
+	}
+	if(vals[STEPRESP_HOLD].type != '\0')
+	{
+		cfg.hold = vals[STEPRESP_HOLD].val.f;
+	}
+	if(vals[STEPRESP_ORDER].type != '\0')
+	{
+		cfg.order = (uint8_t)vals[STEPRESP_ORDER].val.u;
+		if(vals[STEPRESP_ORDER].val.u < EXCITE_PRBS_ORDER_MIN || vals[STEPRESP_ORDER].val.u > EXCITE_PRBS_ORDER_MAX)
+		{
+			LOG("PRBS order must be %u to %u\r\n", EXCITE_PRBS_ORDER_MIN, EXCITE_PRBS_ORDER_MAX);
+			return -1;
+		}
+	}
+	if(cfg.type == EXCITE_PRBS)
+	{
+		cfg.num_steps = Excite_PRBS_Period(cfg.order); // One period unless given.
+	}
+	if(vals[STEPRESP_STEPS].type != '\0')
+	{
+		cfg.num_steps = vals[STEPRESP_STEPS].val.u <= UINT16_MAX ? (uint16_t)vals[STEPRESP_STEPS].val.u : 0U;
+	}
+	if(vals[STEPRESP_LIMIT].type != '\0')
+	{
+		cfg.limit = vals[STEPRESP_LIMIT].val.f;
+	}
+
+	/* Every step must last at least one sample, which is a scan here. */
+	float scan_period = ao->sample_period / (float)ao->scans;
+	if(!(cfg.out_low >= OUT_MIN_INIT && cfg.out_high > cfg.out_low && cfg.out_high <= OUT_MAX_INIT) ||
+	   !(cfg.hold >= scan_period) || cfg.num_steps == 0 || !(cfg.limit > 0.0f && cfg.limit <= REFLOW_TARGET_MAX))
+	{
+		LOG("Invalid step response parameters\r\n");
+		return -1;
+	}
+	if(reflow_state(ao) != RESET_STATE)
+	{
+		LOG("Stop reflow process before running step response\r\n");
+		return -1;
+	}
+
+	/* Reflow thread copies request when entering step response state. */
+	static const Event stepresp_evt = { .sig = STEPRESP_SIG };
+	ao->stepresp_request = cfg;
+	Active_post(&ao->reflow_base, &stepresp_evt);
+	return 0;
+}
+
+static uint32_t reflow_calibrate_cmd(uint32_t argc, const char **argv)
+{
+	Reflow_Active *const ao = cmd_ctx();
+	enum {CALIBRATE_START, CALIBRATE_PREHEAT, CALIBRATE_WINDOW, NUM_CALIBRATE_KEYS};
+	static const cmd_kv_spec specs[NUM_CALIBRATE_KEYS] = {{"start", 'f'}, {"preheat", 'f'}, {"window", 'f'}};
+	if(argc == 0)
+	{
+		displayPwmCurve(ao);
+		return 0;
+	}
+	if(strcasecmp(argv[0], "pwm") != 0)
+	{
+		LOG("Usage: reflow calibrate [pwm [start=<deg C>] [preheat=<deg C>] [window=<s>] | pwm clear]\r\n");
+		return -1;
+	}
+
+	bool clear = argc == 2 && strcasecmp(argv[1], "clear") == 0;
+	Pwmlin_cal_cfg_t cfg = {.start = REFLOW_CALIBRATE_START,
+	                        .preheat = REFLOW_CALIBRATE_PREHEAT,
+	                        .window = REFLOW_CALIBRATE_WINDOW,
+	                        .limit = REFLOW_TARGET_MAX,
+	                        .timeout = REFLOW_CALIBRATE_TIMEOUT};
+	if(!clear)
+	{
+		cmd_arg_val vals[NUM_CALIBRATE_KEYS];
+		if(cmd_parse_kv(argc - 1, argv + 1, specs, NUM_CALIBRATE_KEYS, vals) < 0)
+		{
+			return -1;
+		}
+		float *const fields[NUM_CALIBRATE_KEYS] = {&cfg.start, &cfg.preheat, &cfg.window};
+		for(uint8_t i = 0; i < NUM_CALIBRATE_KEYS; i++)
+		{
+			if(vals[i].type != '\0')
+			{
+				*fields[i] = vals[i].val.f;
+			}
+		}
+		if(!(cfg.start > 0.0f && cfg.preheat >= 0.0f && cfg.start + cfg.preheat < REFLOW_TARGET_MAX) ||
+		   !(cfg.window >= ao->sample_period && cfg.window <= REFLOW_CALIBRATE_WINDOW_MAX))
+		{
+			LOG("Invalid calibration parameters\r\n");
+			return -1;
+		}
+	}
+	if(reflow_state(ao) != RESET_STATE)
+	{
+		LOG("Stop reflow process before calibrating\r\n");
+		return -1;
+	}
+
+	/* Reflow thread copies request when entering calibration state, or drops the table. */
+	static const Event calibrate_evt = { .sig = CALIBRATE_SIG };
+	ao->calibrate_request = cfg;
+	ao->calibrate_clear = clear;
+	Active_post(&ao->reflow_base, &calibrate_evt);
+	return 0;
+}
+
+static uint32_t reflow_smith_cmd(uint32_t argc, const char **argv)
+{
+	Reflow_Active *const ao = cmd_ctx();
+	Smith_model_t *const model = &ao->smith_model;
+	if(argc == 0)
+	{
+		LOG("Smith predictor: %s\r\nModel K: %.4f deg C/count\tT: %.1f s\tL: %.1f s\r\n",
+		    ao->smith_enabled ? "on" : "off", model->K, model->T, model->L);
+		return 0;
+	}
+
+	/* Predictors are advanced on every sample, so only change them while sampling is stopped. */
+	if(reflow_state(ao) != RESET_STATE)
+	{
+		LOG("Stop reflow process before changing Smith predictor\r\n");
+		return -1;
+	}
+
+	if(strcasecmp(argv[0], "model") == 0 && argc == 4)
+	{
+		char *end;
+		bool valid = true;
+		float values[3];
+		for(uint8_t i = 0; i < 3; i++)
+		{
+			values[i] = strtof(argv[i + 1], &end);
+			valid = valid && *end == '\0';
+		}
+		Smith_model_t new_model = {.K = values[0], .T = values[1], .L = values[2]};
+		if(!valid || !(new_model.T > 0.0f) || !(new_model.L >= 0.0f) ||
+		   new_model.L > SMITH_MAX_DELAY * ao->sample_period)
+		{
+			LOG("Invalid model, T must be positive and L at most %.0f s\r\n",
+			    SMITH_MAX_DELAY * ao->sample_period);
+			return -1;
+		}
+		*model = new_model;
+	}
+	else if(strcasecmp(argv[0], "on") == 0 && argc == 1)
+	{
+		if(!(model->T > 0.0f))
+		{
+			LOG("Set model first with: reflow smith model <K> <T> <L>\r\n");
+			return -1;
+		}
+		if(ao->cascade_enabled)
+		{
+			LOG("Turn cascade control off first, Smith predictors model heater output to air temperature\r\n");
+			return -1;
+		}
+		ao->smith_enabled = true;
+	}
+	else if(strcasecmp(argv[0], "off") == 0 && argc == 1)
+	{
+		ao->smith_enabled = false;
+	}
+	else
+	{
+		LOG("Usage: reflow smith [on | off | model <K deg C/count> <T s> <L s>]\r\n");
+		return -1;
+	}
+
+	for(uint8_t z = 0; z < ao->num_zones && model->T > 0.0f; z++)
+	{
+		Smith_Init(&ao->zone_smith[z], model, ao->sample_period);
+	}
+	LOG("Smith predictor %s\r\n", ao->smith_enabled ? "on" : "off");
+	return 0;
+}
+
+static uint32_t reflow_cascade_cmd(uint32_t argc, const char **argv)
+{
+	Reflow_Active *const ao = cmd_ctx();
+	if(argc == 0)
+	{
+		PID_t const *const inner = &ao->zone_inner[0];
+		LOG("Cascade control: %s\r\nOuter loop every %lu samples (%.2f s)\tInner Kp: %.3f\tKi: %.4f\tKd: %.3f\r\n",
+		    ao->cascade_enabled ? "on" : "off", ao->cascade_div,
+		    ao->sample_period * (float)ao->cascade_div, inner->Kp, inner->Ki, inner->Kd);
+		for(uint8_t z = 0; z < ao->num_zones; z++)
+		{
+			if(ao->zones[z].cascade)
+			{
+				LOG("Zone %s: element thermocouple %u, element %.1f deg C, setpoint %.1f deg C\r\n",
+				    ao->zones[z].name, ao->zones[z].element_thermocouple,
+				    ao->zone_element_temp[z], ao->zone_element_sp[z]);
+			}
+		}
+		return 0;
+	}
+
+	/* Loops and controller limits change together, so only while sampling is stopped. */
+	if(reflow_state(ao) != RESET_STATE)
+	{
+		LOG("Stop reflow process before changing cascade control\r\n");
+		return -1;
+	}
+
+	if(strcasecmp(argv[0], "on") == 0 && argc == 1)
+	{
+		bool fitted = false;
+		for(uint8_t z = 0; z < ao->num_zones; z++)
+		{
+			fitted = fitted || ao->zones[z].cascade;
+		}
+		if(!fitted)
+		{
+			LOG("No zone has a heater element thermocouple\r\n");
+			return -1;
+		}
+		if(ao->smith_enabled)
+		{
+			LOG("Turn Smith predictor off first\r\n");
+			return -1;
+		}
+		ao->cascade_enabled = true;
+	}
+	else if(strcasecmp(argv[0], "off") == 0 && argc == 1)
+	{
+		ao->cascade_enabled = false;
+	}
+	else if(strcasecmp(argv[0], "div") == 0 && argc == 2)
+	{
+		char *end;
+		unsigned long div = strtoul(argv[1], &end, 10);
+		if(*end != '\0' || div < 1 || div > CASCADE_DIV_MAX)
+		{
+			LOG("Invalid divider, must be 1 to %u\r\n", CASCADE_DIV_MAX);
+			return -1;
+		}
+		ao->cascade_div = (uint32_t)div;
+	}
+	else if(strcasecmp(argv[0], "inner") == 0 && argc == 4)
+	{
+		char *end;
+		bool valid = true;
+		float values[3];
+		for(uint8_t i = 0; i < 3; i++)
+		{
+			values[i] = strtof(argv[i + 1], &end);
+			valid = valid && *end == '\0' && values[i] >= 0.0f;
+		}
+		if(!valid)
+		{
+			LOG("Invalid gains, must be non-negative numbers\r\n");
+			return -1;
+		}
+		for(uint8_t z = 0; z < ao->num_zones; z++)
+		{
+			PID_SetGains(&ao->zone_inner[z], values[0], values[1], values[2], ao->zone_inner[z].tau);
+		}
+	}
+	else
+	{
+		LOG("Usage: reflow cascade [on | off | div <1..%u> | inner <Kp> <Ki> <Kd>]\r\n", CASCADE_DIV_MAX);
+		return -1;
+	}
+
+	reflow_cascade_apply(ao);
+	LOG("Cascade control %s, outer loop every %lu samples\r\n", ao->cascade_enabled ? "on" : "off",
+	    ao->cascade_div);
+	return 0;
+}
+
+static uint32_t reflow_fuse_cmd(uint32_t argc, const char **argv)
+{
+	Reflow_Active *const ao = cmd_ctx();
+	Fuse_cfg_t *const cfg = &ao->fuse_cfg;
+	if(argc == 0)
+	{
+		LOG("Sensor fusion: %s\tq: %.4f (deg C/s)^2/s\tr: %.4f deg C^2\tmodel: %s\r\n",
+		    ao->fuse_enabled ? "on" : "off", cfg->q, cfg->r, ao->smith_model.T > 0.0f ? "yes" : "no");
+		for(uint8_t z = 0; z < ao->num_zones; z++)
+		{
+			Fuse_t const *const f = &ao->zone_fuse[z];
+			LOG("Zone %s: thermocouple %u, voted with mask 0x%02x, %.2f deg C +- %.2f, %.3f deg C/s\r\n",
+			    ao->zones[z].name, ao->zones[z].thermocouple, ao->zones[z].vote_mask,
+			    f->temp, sqrtf(f->p00), f->rate);
+		}
+		return 0;
+	}
+
+	/* Estimators are advanced on every sample, so only change them while sampling is stopped. */
+	if(reflow_state(ao) != RESET_STATE)
+	{
+		LOG("Stop reflow process before changing sensor fusion\r\n");
+		return -1;
+	}
+
+	if(strcasecmp(argv[0], "on") == 0 && argc == 1)
+	{
+		ao->fuse_enabled = true;
+	}
+	else if(strcasecmp(argv[0], "off") == 0 && argc == 1)
+	{
+		ao->fuse_enabled = false;
+	}
+	else if(strcasecmp(argv[0], "noise") == 0 && argc == 3)
+	{
+		char *end_q, *end_r;
+		Fuse_cfg_t new_cfg = {.q = strtof(argv[1], &end_q), .r = strtof(argv[2], &end_r)};
+		if(*end_q != '\0' || *end_r != '\0' || !(new_cfg.q > 0.0f) || !(new_cfg.r > 0.0f))
+		{
+			LOG("Invalid noise, q and r must be positive\r\n");
+			return -1;
+		}
+		*cfg = new_cfg;
+	}
+	else
+	{
+		LOG("Usage: reflow fuse [on | off | noise <q (deg C/s)^2/s> <r deg C^2>]\r\n");
+		return -1;
+	}
+
+	for(uint8_t z = 0; z < ao->num_zones; z++)
+	{
+		ao->zone_rate[z] = 0.0f;
+	}
+	LOG("Sensor fusion %s\r\n", ao->fuse_enabled ? "on" : "off");
+	return 0;
+}
+
+static uint32_t reflow_board_cmd(uint32_t argc, const char **argv)
+{
+	Reflow_Active *const ao = cmd_ctx();
+	Board_t *const obs = &ao->board;
+	if(argc == 0)
+	{
+		LOG("Board class: %s\ttau surface: %.1f s\ttau joint: %.1f s\treach: %s\r\n", ao->board_class,
+		    obs->cls.tau_surface, obs->cls.tau_joint, ao->board_reach ? "board" : "oven");
+		if(ao->board_probe >= 0)
+		{
+			LOG("Probe: thermocouple %d\tgain: %.3f\r\n", ao->board_probe, obs->gain);
+		}
+		LOG("Estimate: surface %.2f deg C\tjoint %.2f deg C\r\n", obs->surface, obs->joint);
+		if(ao->mass == 0.0f)
+		{
+			LOG("Thermal mass: auto\treference lag: %.1f s\tlast lag: %.1f s\tlast mass: %.2f\r\n",
+			    ao->mass_lag_ref, ao->mass_lag, ao->mass_scale);
+		}
+		else
+		{
+			LOG("Thermal mass: %.2f\r\n", ao->mass);
+		}
+		return 0;
+	}
+
+	/* Observer is advanced on every sample and keys ramps, so only change it while sampling is stopped. */
+	if(reflow_state(ao) != RESET_STATE)
+	{
+		LOG("Stop reflow process before changing board observer\r\n");
+		return -1;
+	}
+
+	char *end;
+	if(strcasecmp(argv[0], "class") == 0 && argc == 2)
+	{
+		uint8_t i = 0;
+		while(i < ARRAY_SIZE(board_classes) && strcasecmp(argv[1], board_classes[i].name) != 0)
+		{
+			i++;
+		}
+		if(i == ARRAY_SIZE(board_classes))
+		{
+			LOG("Unknown board class %s\r\n", argv[1]);
+			return -1;
+		}
+		ao->board_class = board_classes[i].name;
+		Board_Init(obs, &board_classes[i].cls, obs->gain);
+	}
+	else if(strcasecmp(argv[0], "class") == 0 && argc == 3)
+	{
+		bool valid = true;
+		float values[2];
+		for(uint8_t i = 0; i < 2; i++)
+		{
+			values[i] = strtof(argv[i + 1], &end);
+			valid = valid && *end == '\0' && values[i] > 0.0f && values[i] <= REFLOW_BOARD_TAU_MAX;
+		}
+		if(!valid)
+		{
+			LOG("Invalid time constants, must be positive and at most %.0f s\r\n", REFLOW_BOARD_TAU_MAX);
+			return -1;
+		}
+		ao->board_class = "custom";
+		Board_Init(obs, &(Board_class_t){.tau_surface = values[0], .tau_joint = values[1]}, obs->gain);
+	}
+	else if(strcasecmp(argv[0], "reach") == 0 && argc == 2 &&
+	        (strcasecmp(argv[1], "on") == 0 || strcasecmp(argv[1], "off") == 0))
+	{
+		ao->board_reach = strcasecmp(argv[1], "on") == 0;
+	}
+	else if(strcasecmp(argv[0], "probe") == 0 && argc == 2 && strcasecmp(argv[1], "none") == 0)
+	{
+		ao->board_probe = -1;
+	}
+	else if(strcasecmp(argv[0], "probe") == 0 && (argc == 2 || argc == 3))
+	{
+		unsigned long tc = strtoul(argv[1], &end, 10);
+		if(*end != '\0' || tc >= ao->num_thermocouples)
+		{
+			LOG("Invalid thermocouple, must be below %u\r\n", ao->num_thermocouples);
+			return -1;
+		}
+		float gain = obs->gain;
+		if(argc == 3)
+		{
+			gain = strtof(argv[2], &end);
+			if(*end != '\0' || !(gain > 0.0f && gain <= 1.0f))
+			{
+				LOG("Invalid gain, must be above 0 and at most 1\r\n");
+				return -1;
+			}
+		}
+		ao->board_probe = (int8_t)tc;
+		obs->gain = gain;
+	}
+	else if(strcasecmp(argv[0], "mass") == 0 && argc >= 2 && argc <= 3 && strcasecmp(argv[1], "auto") == 0)
+	{
+		float lag_ref = ao->mass_lag_ref;
+		if(argc == 3)
+		{
+			lag_ref = strtof(argv[2], &end);
+			if(*end != '\0' || !(lag_ref > 0.0f && lag_ref <= REFLOW_BOARD_TAU_MAX))
+			{
+				LOG("Invalid reference lag, must be positive and at most %.0f s\r\n", REFLOW_BOARD_TAU_MAX);
+				return -1;
+			}
+		}
+		ao->mass = 0.0f;
+		ao->mass_lag_ref = lag_ref;
+	}
+	else if(strcasecmp(argv[0], "mass") == 0 && argc == 2)
+	{
+		float mass = strtof(argv[1], &end);
+		if(*end != '\0' || !(mass >= REFLOW_MASS_MIN && mass <= REFLOW_MASS_MAX))
+		{
+			LOG("Invalid thermal mass, must be %.2f to %.2f\r\n", REFLOW_MASS_MIN, REFLOW_MASS_MAX);
+			return -1;
+		}
+		ao->mass = mass;
+	}
+	else
+	{
+		LOG("Usage: reflow board [class <light | medium | heavy | <tau surface s> <tau joint s>> | reach <on | off> |\r\n"
+		    "                    probe <tc | none> [gain] | mass <relative mass | auto [<reference lag s>]>]\r\n");
+		return -1;
+	}
+
+	LOG("Board class %s, ramps reach target on %s temperature\r\n", ao->board_class,
+	    ao->board_reach ? "board" : "oven");
+	return 0;
+}
+
+/**
+ * @brief Set zone controller output limits, the element setpoint range in cascade zones.
+ */
+static void reflow_cascade_apply(Reflow_Active *const ao)
+{
+	for(uint8_t z = 0; z < ao->num_zones; z++)
+	{
+		bool cascade = ao->cascade_enabled && ao->zones[z].cascade;
+		PID_SetLimits(&ao->zone_pid[z], cascade ? 0.0f : OUT_MIN_INIT, cascade ? CASCADE_ELEMENT_MAX : OUT_MAX_INIT);
+	}
+}
+
+static uint32_t reflow_conveyor_cmd(uint32_t argc, const char **argv)
+{
+	Reflow_Active *const ao = cmd_ctx();
+	enum {CONVEYOR_ZONE, CONVEYOR_SP, CONVEYOR_BELT, NUM_CONVEYOR_KEYS};
+	static const cmd_kv_spec specs[NUM_CONVEYOR_KEYS] = {{"zone", 'u'}, {"sp", 'f'}, {"belt", 'f'}};
+	if(argc == 0)
+	{
+		bool running = reflow_state(ao) == CONVEYOR_STATE;
+		Reflow_Conveyor const *const conveyor = ao->conveyor_params.buf[ao->conveyor_params.seq % 2U];
+		LOG("Conveyor mode: %s\tBelt output: %.0f%s\r\n", running ? "running" : "stopped", conveyor->belt,
+		    ao->has_belt ? "" : " (no belt drive)");
+		if(running)
+		{
+			LOG("All zones stable: %s\r\n", ActiveCond_met(&ao->zones_stable) ? "yes" : "no");
+		}
+		for(uint8_t z = 0; z < ao->num_zones; z++)
+		{
+			Reflow_Stability const *const st = &ao->zone_stability[z];
+			if(!running)
+			{
+				LOG("Zone %u %-8s setpoint %6.1f deg C\r\n", z, ao->zones[z].name, conveyor->setpoint[z]);
+				continue;
+			}
+			LOG("Zone %u %-8s setpoint %6.1f  temp %6.1f  error mean %6.2f  std %5.2f deg C  in band %6.1f s  %s\r\n",
+			    z, ao->zones[z].name, conveyor->setpoint[z], ao->zone_temp[z], st->mean, sqrtf(st->var),
+			    st->in_band, st->stable ? "stable" : "settling");
+		}
+		return 0;
+	}
+
+	bool start = strcasecmp(argv[0], "start") == 0;
+	cmd_arg_val vals[NUM_CONVEYOR_KEYS];
+	if(cmd_parse_kv(argc - start, argv + start, specs, NUM_CONVEYOR_KEYS, vals) < 0)
+	{
+		return -1;
+	}
+	uint32_t first = 0;
+	uint32_t last = ao->num_zones;
+	if(vals[CONVEYOR_ZONE].type != '\0')
+	{
+		if(vals[CONVEYOR_ZONE].val.u >= ao->num_zones)
+		{
+			LOG("Zone must be below %u\r\n", ao->num_zones);
+			return -1;
+		}
+		first = vals[CONVEYOR_ZONE].val.u;
+		last = first + 1U;
+	}
+	if(vals[CONVEYOR_SP].type != '\0' &&
+	   !(vals[CONVEYOR_SP].val.f > 0.0f && vals[CONVEYOR_SP].val.f <= REFLOW_TARGET_MAX))
+	{
+		LOG("Setpoint must be above 0 and at most %.0f deg C\r\n", REFLOW_TARGET_MAX);
+		return -1;
+	}
+	if(vals[CONVEYOR_BELT].type != '\0' &&
+	   !(vals[CONVEYOR_BELT].val.f >= OUT_MIN_INIT && vals[CONVEYOR_BELT].val.f <= OUT_MAX_INIT))
+	{
+		LOG("Belt output must be %.0f to %.0f\r\n", OUT_MIN_INIT, OUT_MAX_INIT);
+		return -1;
+	}
+
+	if(vals[CONVEYOR_SP].type != '\0' || vals[CONVEYOR_BELT].type != '\0')
+	{
+		Reflow_Conveyor *const conveyor = reflow_params_edit(&ao->conveyor_params);
+		for(uint32_t z = first; z < last && vals[CONVEYOR_SP].type != '\0'; z++)
+		{
+			conveyor->setpoint[z] = vals[CONVEYOR_SP].val.f;
+		}
+		if(vals[CONVEYOR_BELT].type != '\0')
+		{
+			conveyor->belt = vals[CONVEYOR_BELT].val.f;
+		}
+		reflow_params_publish(&ao->conveyor_params);
+		LOG("Conveyor settings updated\r\n");
+	}
+	if(start)
+	{
+		static const Event conveyor_evt = { .sig = CONVEYOR_SIG };
+		Active_post(&ao->reflow_base, &conveyor_evt);
+	}
+	return 0;
+}
+
+static uint32_t reflow_jobs_cmd(uint32_t argc, const char **argv)
+{
+	Reflow_Active *const ao = cmd_ctx();
+	enum {JOB_RUNS, JOB_IDLE, JOB_PREHEAT, JOB_LEAD, NUM_JOB_KEYS};
+	static const cmd_kv_spec specs[NUM_JOB_KEYS] = {{"runs", 'u'}, {"idle", 'u'}, {"preheat", 'f'}, {"lead", 'u'}};
+	if(argc == 0)
+	{
+		uint32_t now = Active_time_ms();
+		LOG("Scheduled jobs: %lu of %u\r\n", ao->num_jobs, REFLOW_MAX_JOBS);
+		for(uint32_t i = 0; i < ao->num_jobs; i++)
+		{
+			Reflow_Job const *const job = &ao->jobs[i];
+			int32_t until_ms = (int32_t)(job->start_ms - now);
+			LOG("%lu: %-16s runs left %lu  next in %ld s  idle %lu s  preheat %.0f deg C from %lu s ahead%s\r\n",
+			    i, job->profile.name, job->runs, until_ms > 0 ? until_ms / 1000 : 0L, job->idle_ms / 1000U,
+			    job->preheat, job->lead_ms / 1000U, i == 0 && ao->job_running ? "  (running)" : "");
+		}
+		return 0;
+	}
+
+	/* Every request carries its own job, so requests added back to back are all queued. */
+	Reflow_Job_Event *evt;
+	if(strcasecmp(argv[0], "clear") == 0 && argc == 1)
+	{
+		evt = (Reflow_Job_Event *)Event_new(sizeof(Reflow_Job_Event), SCHEDULE_SIG);
+		if(evt == NULL)
+		{
+			LOG("No event memory, schedule not cleared\r\n");
+			return -1;
+		}
+		evt->job.runs = 0;
+		return Active_post(&ao->reflow_base, &evt->base) == MOD_OK ? 0 : -1;
+	}
+	if(strcasecmp(argv[0], "add") != 0 || argc < 2)
+	{
+		return -1;
+	}
+
+	char *end;
+	unsigned long in = strtoul(argv[1], &end, 10);
+	if(*end != '\0' || in > UINT32_MAX / 1000U)
+	{
+		LOG("Start must be a number of seconds from now\r\n");
+		return -1;
+	}
+	cmd_arg_val vals[NUM_JOB_KEYS];
+	if(cmd_parse_kv(argc - 2, argv + 2, specs, NUM_JOB_KEYS, vals) < 0)
+	{
+		return -1;
+	}
+	uint32_t runs = vals[JOB_RUNS].type != '\0' ? vals[JOB_RUNS].val.u : 1U;
+	uint32_t idle = vals[JOB_IDLE].type != '\0' ? vals[JOB_IDLE].val.u : 0U;
+	float preheat = vals[JOB_PREHEAT].type != '\0' ? vals[JOB_PREHEAT].val.f : 0.0f;
+	uint32_t lead = vals[JOB_LEAD].type != '\0' ? vals[JOB_LEAD].val.u : REFLOW_PREHEAT_LEAD;
+	if(runs == 0U)
+	{
+		LOG("Job needs at least one run\r\n");
+		return -1;
+	}
+	if(idle > UINT32_MAX / 1000U || lead > INT32_MAX / 1000U)
+	{
+		LOG("Idle and lead times are too long\r\n");
+		return -1;
+	}
+	if(!(preheat >= 0.0f && preheat <= REFLOW_TARGET_MAX))
+	{
+		LOG("Preheat must be 0 (off) to %.0f deg C\r\n", REFLOW_TARGET_MAX);
+		return -1;
+	}
+
+	evt = (Reflow_Job_Event *)Event_new(sizeof(Reflow_Job_Event), SCHEDULE_SIG);
+	if(evt == NULL)
+	{
+		LOG("No event memory, job not added\r\n");
+		return -1;
+	}
+	/* The command thread publishes profiles, so the published one is stable here. */
+	evt->job.profile = *(Reflow_Profile const *)ao->profile_params.buf[ao->profile_params.seq % 2U];
+	evt->job.start_ms = Active_time_ms() + (uint32_t)in * 1000U;
+	evt->job.runs = runs;
+	evt->job.idle_ms = idle * 1000U;
+	evt->job.preheat = preheat;
+	evt->job.lead_ms = lead * 1000U;
+	return Active_post(&ao->reflow_base, &evt->base) == MOD_OK ? 0 : -1;
+}
+
+static uint32_t reflow_model_cmd(uint32_t argc, const char **argv)
+{
+	Reflow_Active *const ao = cmd_ctx();
+	if(argc == 0)
+	{
+		displayModel(ao);
+		return 0;
+	}
+
+	/* Estimator and predictors are advanced on every sample, so only change them while sampling is stopped. */
+	if(reflow_state(ao) != RESET_STATE)
+	{
+		LOG("Stop reflow process before changing oven model\r\n");
+		return -1;
+	}
+
+	if(strcasecmp(argv[0], "reset") == 0 && argc == 1)
+	{
+		RLS_Init(&ao->model_rls, REFLOW_MODEL_LAMBDA, REFLOW_MODEL_P0);
+		LOG("Restarted oven model identification\r\n");
+		return 0;
+	}
+	else if(strcasecmp(argv[0], "apply") == 0 && argc == 1)
+	{
+		Smith_model_t model;
+		if(!reflow_model_get(ao, &model, NULL))
+		{
+			LOG("No stable oven model identified yet\r\n");
+			return -1;
+		}
+		ao->smith_model = model;
+		for(uint8_t z = 0; z < ao->num_zones; z++)
+		{
+			Smith_Init(&ao->zone_smith[z], &model, ao->sample_period);
+		}
+		LOG("Smith predictor model set to K: %.4f deg C/count\tT: %.1f s\tL: %.1f s\r\n", model.K, model.T, model.L);
+		return 0;
+	}
+
+	LOG("Usage: reflow model [apply | reset]\r\n");
+	return -1;
+}
+
+/**
+ * @brief Filter thermocouple readings of sample and update zone temperatures, oven temperature is their mean.
+ *
+ * A sample with an error ridden through (see reflow_fault_ride()) is not read, zones are
+ * predicted over it instead.
+ *
+ * @param ao Reflow active object.
+ * @param sample Sample without thermocouple errors, or with a ridden-through error.
+ *
+ * @return Oven temperature (deg C).
+ */
+static float reflow_temps_update(Reflow_Active *const ao, Sample_Event const *const sample)
+{
+	if(sample->err != MAX_OK)
+	{
+		return reflow_temps_hold(ao, sample);
+	}
+	ao->tc_faults = 0;
+
+	float tc_temp[REFLOW_MAX_THERMOCOUPLES];
+	for(uint8_t i = 0; i < ao->num_thermocouples; i++)
+	{
+		tc_temp[i] = Filter_Update(&ao->tc_filter[i], sample->temp[i]);
+	}
+
+	/* Fused zones advance by the measured sample period, zone_out holds the outputs applied over it. */
+	float Ts = ao->sample_period;
+	if(ao->fuse_enabled && ao->zone_fuse[0].primed)
+	{
+		Ts = Active_cycles_to_s(sample->timestamp - ao->fuse_timestamp);
+	}
+	ao->fuse_timestamp = sample->timestamp;
+
+	float oven_temp = 0.0f;
+	for(uint8_t z = 0; z < ao->num_zones; z++)
+	{
+		ao->zone_temp[z] = reflow_zone_vote(ao, &ao->zones[z], tc_temp);
+		if(ao->fuse_enabled)
+		{
+			ao->zone_temp[z] = Fuse_Update(&ao->zone_fuse[z], ao->zone_temp[z], ao->zone_out[z], Ts);
+			ao->zone_rate[z] = ao->zone_fuse[z].rate;
+		}
+		oven_temp += ao->zone_temp[z];
+		if(ao->zones[z].cascade)
+		{
+			ao->zone_element_temp[z] = tc_temp[ao->zones[z].element_thermocouple];
+		}
+	}
+	oven_temp /= (float)ao->num_zones;
+	ao->temp = oven_temp;
+	return oven_temp;
+}
+
+/**
+ * @brief Predict zone temperatures over a sample whose thermocouples could not be read.
+ *
+ * Fused zones advance their Kalman estimate along the oven model with the outputs applied,
+ * its covariance grows so the next reading pulls the estimate back harder. Other zones, and
+ * thermocouple filters, hold their last values.
+ *
+ * @param ao Reflow active object.
+ * @param sample Sample with a ridden-through error, timestamp only.
+ *
+ * @return Oven temperature (deg C).
+ */
+static float reflow_temps_hold(Reflow_Active *const ao, Sample_Event const *const sample)
+{
+	float Ts = Active_cycles_to_s(sample->timestamp - ao->fuse_timestamp);
+	ao->fuse_timestamp = sample->timestamp;
+
+	float oven_temp = 0.0f;
+	for(uint8_t z = 0; z < ao->num_zones; z++)
+	{
+		if(ao->fuse_enabled && ao->zone_fuse[z].primed)
+		{
+			ao->zone_temp[z] = Fuse_Predict(&ao->zone_fuse[z], ao->zone_out[z], Ts);
+			ao->zone_rate[z] = ao->zone_fuse[z].rate;
+		}
+		oven_temp += ao->zone_temp[z];
+	}
+	oven_temp /= (float)ao->num_zones;
+	ao->temp = oven_temp;
+	return oven_temp;
+}
+
+/**
+ * @brief Ride through thermocouple error of sample instead of stopping the process.
+ *
+ * Transient errors (see MAX31855K_Err_Transient()), eg. a one-off read of only zeros from
+ * SPI noise, are held on the model for up to REFLOW_RIDE_SAMPLES consecutive samples once
+ * the run has a good sample. Hard faults and longer runs of errors stop the process, and the
+ * safety supervisor, which rides through the same errors, trips on them.
+ *
+ * @param ao Reflow active object.
+ * @param sample Sample with a thermocouple error.
+ *
+ * @return true if the sample is handled with predicted zone temperatures, false if the process must stop.
+ */
+static bool reflow_fault_ride(Reflow_Active *const ao, Sample_Event const *const sample)
+{
+	if(!MAX31855K_Err_Transient(sample->err) || !ao->prev_sample_valid || ao->tc_faults >= REFLOW_RIDE_SAMPLES)
+	{
+		return false;
+	}
+	ao->tc_faults++;
+	INC_SAT_U16(ao->pms[CNT_FAULTS_RIDDEN]);
+	LOGW(TAG, "Could not read thermocouple %u temperature (%s), holding zones on model (%u of %u).",
+	     sample->err_tc, MAX31855K_Err_Str(sample->err), ao->tc_faults, REFLOW_RIDE_SAMPLES);
+	return true;
+}
+
+/**
+ * @brief Display thermocouple filter configuration.
+ */
+static void reflow_filter_show(Reflow_Active const *const ao, Filter_cfg_t const *const cfg)
+{
+	LOG("Filter median: %u\talpha: %.3f\toutlier: %.1f deg C\tNIST type K correction: %s\r\n",
+	    cfg->median_len, cfg->alpha, cfg->outlier_limit, ao->tc_nist ? "on" : "off");
+	if(cfg->num_biquads > 0)
+	{
+		LOG("Butterworth low-pass at %.3f Hz replaces alpha IIR\r\n", ao->filter_lowpass);
+	}
+}
+
+static uint32_t reflow_filter_cmd(uint32_t argc, const char **argv)
+{
+	Reflow_Active *const ao = cmd_ctx();
+	Filter_cfg_t cfg = ao->filter_cfg;
+	if(argc == 0)
+	{
+		reflow_filter_show(ao, &cfg);
+		for(uint8_t i = 0; i < ao->num_thermocouples; i++)
+		{
+			LOG("Thermocouple %u: %lu outliers rejected\r\n", i, ao->tc_filter[i].num_rejected);
+		}
+		return 0;
+	}
+
+	/* Filters run on every sample, so only reconfigure them while sampling is stopped. */
+	if(reflow_state(ao) != RESET_STATE)
+	{
+		LOG("Stop reflow process before changing filter\r\n");
+		return -1;
+	}
+	if(argc % 2 != 0)
+	{
+		LOG("Invalid number of arguments\r\n");
+		return -1;
+	}
+
+	bool nist = ao->tc_nist;
+	float lowpass = ao->filter_lowpass;
+	for(uint32_t i = 0; i < argc; i += 2)
+	{
+		char *end;
+		float value = strtof(argv[i + 1], &end);
+		bool valid = *end == '\0';
+		if(strcasecmp(argv[i], "median") == 0)
+		{
+			valid = valid && value >= 1.0f && value <= (float)FILTER_MAX_MEDIAN && ((uint8_t)value & 1U);
+			cfg.median_len = (uint8_t)value;
+		}
+		else if(strcasecmp(argv[i], "alpha") == 0)
+		{
+			valid = valid && value > 0.0f && value <= 1.0f;
+			cfg.alpha = value;
+		}
+		else if(strcasecmp(argv[i], "outlier") == 0)
+		{
+			valid = valid && value >= 0.0f;
+			cfg.outlier_limit = value;
+		}
+		else if(strcasecmp(argv[i], "nist") == 0)
+		{
+			valid = valid && (value == 0.0f || value == 1.0f);
+			nist = value == 1.0f;
+		}
+		else if(strcasecmp(argv[i], "lowpass") == 0)
+		{
+			valid = valid && Filter_LowPass(&cfg, value, ao->sample_period);
+			lowpass = value;
+		}
+		else
+		{
+			valid = false;
+		}
+		if(!valid)
+		{
+			LOG("Invalid filter parameter: %s %s\r\n", argv[i], argv[i + 1]);
+			return -1;
+		}
+	}
+
+	ao->filter_cfg = cfg;
+	ao->filter_lowpass = lowpass;
+	ao->tc_nist = nist;
+	for(uint8_t i = 0; i < ao->num_thermocouples; i++)
+	{
+		Filter_Init(&ao->tc_filter[i], &cfg);
+	}
+	reflow_filter_show(ao, &cfg);
+	return 0;
+}
+
+/**
+ * Alignment is set up when sampling starts, so it only changes while no reflow process runs.
+ * Reading ages are estimates of the accumulated reads of the current or last aligned run.
+ */
+static uint32_t reflow_align_cmd(uint32_t argc, const char **argv)
+{
+	Reflow_Active *const ao = cmd_ctx();
+	if(argc > 1 || (argc == 1 && strcasecmp(argv[0], "on") != 0 && strcasecmp(argv[0], "off") != 0))
+	{
+		LOG("Usage: reflow align [on | off]\r\n");
+		return -1;
+	}
+	if(argc == 1)
+	{
+		if(reflow_state(ao) != RESET_STATE)
+		{
+			LOG("Stop reflow process before changing alignment\r\n");
+			return -1;
+		}
+		ao->tc_align = strcasecmp(argv[0], "on") == 0;
+	}
+
+	LOG("Conversion-aligned sampling: %s%s\r\n", ao->tc_align ? "on" : "off",
+	    ao->sample_timer_handle == NULL ? " (needs hardware sampling timer)" : "");
+	uint32_t primask = __get_PRIMASK();
+	__disable_irq();
+	Reflow_Align snap = ao->align;
+	__set_PRIMASK(primask);
+	if(snap.period == 0U)
+	{
+		LOG("No aligned run yet, readings are up to %.0f ms old\r\n", MAX31855K_CONVERSION_S * 1000.0f);
+		return 0;
+	}
+	LOG("%s run: read period %.1f ms, %lu repeated conversions\r\n", snap.active ? "Current" : "Last",
+	    (float)snap.period * 1000.0f / SAMPLE_TIMER_CLK_HZ, snap.repeats);
+	if(snap.aged != 0U)
+	{
+		LOG("Reading age mean %.1f ms, max %.1f ms, over %lu readings\r\n", snap.age_sum / (float)snap.aged, snap.age_max,
+		    snap.aged);
+	}
+	else
+	{
+		LOG("Reading age not measured yet\r\n");
+	}
+	return 0;
+}
+
+/**
+ * @brief Show thermocouple calibrations, add a reference point to one or drop its points.
+ *
+ * The point pairs the reference with the thermocouple's latest reading before calibration, so the
+ * probe and reference should have settled together, eg. during a dwell or with the oven idle.
+ */
+static uint32_t reflow_tc_calibrate_cmd(uint32_t argc, const char **argv)
+{
+	Reflow_Active *const ao = cmd_ctx();
+	if(argc == 0)
+	{
+		Reflow_Latest acq;
+		bool read = reflow_latest_refresh(ao, &acq) && acq.err == MAX_OK;
+		for(uint8_t i = 0; i < ao->num_thermocouples; i++)
+		{
+			Tccal_points_t const *const pts = &ao->tc_cal_points[i];
+			LOG("Thermocouple %u: %lu points", i, pts->num_points);
+			for(uint32_t k = 0; k < pts->num_points; k++)
+			{
+				LOG("  %.2f -> %.2f", pts->reading[k], pts->ref[k]);
+			}
+			if(read)
+			{
+				LOG("\treading %.2f, calibrated %.2f", acq.raw[i], acq.temp[i]);
+			}
+			LOG("\r\n");
+		}
+		return 0;
+	}
+
+	cmd_arg_val arg_vals[2];
+	bool clear = argc == 2 && strcasecmp(argv[1], "clear") == 0;
+	if((clear ? cmd_parse_args(1, argv, "u", arg_vals) : cmd_parse_args(argc, argv, "uf", arg_vals)) < 0 ||
+	   arg_vals[0].val.u >= ao->num_thermocouples)
+	{
+		LOG("Format: tc calibrate [<tc> <reference deg C> | <tc> clear], tc below %u\r\n", ao->num_thermocouples);
+		return 1;
+	}
+	uint8_t tc = (uint8_t)arg_vals[0].val.u;
+
+	Tccal_points_t pts = ao->tc_cal_points[tc];
+	if(clear)
+	{
+		pts.num_points = 0;
+	}
+	else
+	{
+		Reflow_Latest acq;
+		if(!reflow_latest_refresh(ao, &acq) || (acq.err != MAX_OK && acq.err_tc == tc))
+		{
+			LOG("No reading of thermocouple %u\r\n", tc);
+			return 1;
+		}
+		if(!Tccal_Add(&pts, acq.raw[tc], arg_vals[1].val.f))
+		{
+			LOG("Reading %.2f does not fit, at most %u points, %.1f deg C apart, with gains %.2f to %.2f "
+			    "and corrections up to %.1f deg C\r\n", acq.raw[tc], TCCAL_MAX_POINTS, TCCAL_MIN_SPAN,
+			    TCCAL_GAIN_MIN, TCCAL_GAIN_MAX, TCCAL_OFFSET_MAX);
+			return 1;
+		}
+		LOG("Paired reading %.2f with %.2f deg C\r\n", acq.raw[tc], arg_vals[1].val.f);
+	}
+
+	Tccal_t cal;
+	Tccal_Build(&cal, &pts);
+	uint32_t primask = __get_PRIMASK();
+	__disable_irq();
+	ao->tc_cal[tc] = cal;
+	__set_PRIMASK(primask);
+	ao->tc_cal_points[tc] = pts;
+
+	if(nvs_set(reflow_nvs_key(ao, NVS_KEY_TC_CAL), ao->tc_cal_points, sizeof(ao->tc_cal_points)) != MOD_OK)
+	{
+		LOG("Calibration applied but could not be stored\r\n");
+		return 1;
+	}
+	LOG("Thermocouple %u: %lu points, applied from the next sample\r\n", tc, pts.num_points);
+	return 0;
+}
+
+static uint32_t reflow_script_cmd(uint32_t argc, const char **argv)
+{
+	Reflow_Active *const ao = cmd_ctx();
+	if(argc == 0)
+	{
+		Script_def_t const *def;
+		for(uint32_t i = 0; (def = Script_Get(i)) != NULL; i++)
+		{
+			LOG("%s: %s\r\n", def->name, def->help);
+		}
+		return 0;
+	}
+	Script_def_t const *def = argc == 1 ? Script_Find(argv[0]) : NULL;
+	if(def == NULL)
+	{
+		LOG("Usage: reflow script [<name>], enter \"reflow script\" for names\r\n");
+		return -1;
+	}
+	if(reflow_state(ao) != RESET_STATE)
+	{
+		LOG("Stop reflow process before starting script\r\n");
+		return -1;
+	}
+
+	/* Reflow thread reads request when it starts the script. */
+	static const Event script_evt = { .sig = SCRIPT_SIG };
+	ao->script_request = def;
+	Active_post(&ao->reflow_base, &script_evt);
+	LOG("Posted SCRIPT signal to reflow active object.\r\n");
+	return 0;
+}
+
+/**
+ * @brief Decode recipe instruction from 16 hex digits, its bytes in memory order.
+ *
+ * @return MOD_OK if successful, MOD_ERR_ARG if hex is malformed.
+ */
+static mod_err_t reflow_recipe_decode(const char *hex, Recipe_insn_t *const insn)
+{
+	uint8_t bytes[sizeof(Recipe_insn_t)];
+	if(strlen(hex) != 2U * sizeof(bytes))
+	{
+		return MOD_ERR_ARG;
+	}
+	for(uint32_t i = 0; i < sizeof(bytes); i++)
+	{
+		char digits[3] = {hex[2U * i], hex[2U * i + 1U], '\0'};
+		char *end;
+		bytes[i] = (uint8_t)strtoul(digits, &end, 16);
+		if(*end != '\0' || digits[0] == '+' || digits[0] == '-' || digits[0] == ' ')
+		{
+			return MOD_ERR_ARG;
+		}
+	}
+	memcpy(insn, bytes, sizeof(bytes));
+	return MOD_OK;
+}
+
+static uint32_t reflow_recipe_cmd(uint32_t argc, const char **argv)
+{
+	Reflow_Active *const ao = cmd_ctx();
+	if(argc == 0)
+	{
+		Recipe_t const *const recipe = ao->recipe_params.buf[ao->recipe_params.seq % 2U];
+		if(recipe->num_insns == 0U)
+		{
+			LOG("No recipe loaded\r\n");
+			return 0;
+		}
+		Recipe_Print(recipe);
+		return 0;
+	}
+
+	bool new_recipe = strcasecmp(argv[0], "new") == 0;
+	if(new_recipe || (strcasecmp(argv[0], "add") == 0 && argc >= 2))
+	{
+		uint32_t num_new = argc - 1;
+		uint32_t num_kept = new_recipe ? 0 : ao->recipe_upload.num_insns;
+		if(num_kept + num_new > RECIPE_MAX_INSNS)
+		{
+			LOG("Recipe can have at most %u instructions\r\n", RECIPE_MAX_INSNS);
+			return -1;
+		}
+
+		/* Decode every instruction before changing upload, a bad line adds nothing. */
+		Recipe_insn_t insns[RECIPE_MAX_INSNS];
+		for(uint32_t i = 0; i < num_new; i++)
+		{
+			if(reflow_recipe_decode(argv[1 + i], &insns[i]) != MOD_OK)
+			{
+				LOG("Invalid instruction %lu, expected 16 hex digits\r\n", num_kept + i);
+				return -1;
+			}
+		}
+
+		if(new_recipe)
+		{
+			memset(&ao->recipe_upload, 0, sizeof(ao->recipe_upload));
+		}
+		memcpy(&ao->recipe_upload.insns[num_kept], insns, num_new * sizeof(insns[0]));
+		ao->recipe_upload.num_insns = (uint8_t)(num_kept + num_new);
+		LOG("Recipe has %u instructions, add more or load it\r\n", ao->recipe_upload.num_insns);
+		return 0;
+	}
+	else if(strcasecmp(argv[0], "load") == 0 && argc == 1)
+	{
+		uint32_t bad;
+		if(Recipe_Check(&ao->recipe_upload, REFLOW_TARGET_MAX, &bad) != MOD_OK)
+		{
+			LOG("Invalid recipe at instruction %lu\r\n", bad);
+			return -1;
+		}
+
+		/* Reflow thread fetches the latest recipe whenever it starts one. */
+		Recipe_t *const recipe = reflow_params_edit(&ao->recipe_params);
+		*recipe = ao->recipe_upload;
+		reflow_params_publish(&ao->recipe_params);
+		LOG("Loaded recipe with %u instructions\r\n", ao->recipe_upload.num_insns);
+		if(nvs_set(reflow_nvs_key(ao, NVS_KEY_RECIPE), &ao->recipe_upload, sizeof(ao->recipe_upload)) != MOD_OK)
+		{
+			LOG("Recipe will not persist across resets\r\n");
+		}
+		return 0;
+	}
+	else if(strcasecmp(argv[0], "run") == 0 && argc == 1)
+	{
+		if(reflow_state(ao) != RESET_STATE)
+		{
+			LOG("Stop reflow process before running recipe\r\n");
+			return -1;
+		}
+		static const Event recipe_evt = { .sig = SCRIPT_SIG };
+		ao->script_request = &recipe_script;
+		Active_post(&ao->reflow_base, &recipe_evt);
+		LOG("Posted SCRIPT signal to reflow active object.\r\n");
+		return 0;
+	}
+
+	LOG("Usage: reflow recipe [new [<insn> ...] | add <insn> ... | load | run]\r\n");
+	return -1;
+}
+
+static uint32_t reflow_history_cmd(uint32_t argc, const char **argv)
+{
+	Reflow_Active *const ao = cmd_ctx();
+	Reflow_History_Format format = REFLOW_HISTORY_CSV;
+	if(argc == 1 && strcasecmp(argv[0], "bin") == 0)
+	{
+		format = REFLOW_HISTORY_BIN;
+	}
+	else if(argc == 1 && strcasecmp(argv[0], "pack") == 0)
+	{
+		format = REFLOW_HISTORY_PACK;
+	}
+	else if(argc > 1 || (argc == 1 && strcasecmp(argv[0], "csv") != 0))
+	{
+		LOG("Usage: reflow history [csv | bin | pack]\r\n");
+		return -1;
+	}
+
+	/* Ring is written on every sample, so only dump it once the run is over. */
+	if(reflow_state(ao) != RESET_STATE)
+	{
+		LOG("Stop reflow process before dumping history\r\n");
+		return -1;
+	}
+	uint32_t count = ao->run_history.count;
+	uint32_t first = History_First(&ao->run_history);
+	if(count == 0)
+	{
+		LOG("No samples recorded, start reflow process first\r\n");
+		return -1;
+	}
+
+	history_dump = (Reflow_History_Dump){ .format = format, .first = first, .next = first, .count = count, .ao = ao };
+	return cmd_async_start(reflow_history_step, &history_dump) == MOD_OK ? 0 : -1;
+}
+
+/**
+ * @brief Write next binary frame, next packed frame or next CSV lines of history dump.
+ *
+ * Lines received meanwhile run between steps, a run started by one of them ends the dump.
+ * Output that does not fit the transmit buffer is retried on the next step.
+ */
+static cmd_async_status_t reflow_history_step(void *ctx, bool cancel)
+{
+	Reflow_History_Dump *const dump = ctx;
+	if(cancel)
+	{
+		LOG("Dump cancelled at sample %lu\r\n", dump->next);
+		return CMD_ASYNC_DONE;
+	}
+	if(reflow_state(dump->ao) != RESET_STATE || dump->ao->run_history.count != dump->count)
+	{
+		LOG("Reflow process started, dump aborted at sample %lu\r\n", dump->next);
+		return CMD_ASYNC_DONE;
+	}
+
+	if(dump->format == REFLOW_HISTORY_BIN)
+	{
+		static Reflow_History_Frame record;
+		reflow_history_frame(dump->ao, &record, dump->next);
+		if(reflow_history_send(&record, sizeof(record)) != MOD_OK)
+		{
+			return CMD_ASYNC_MORE;
+		}
+		dump->next += HISTORY_BLOCK_SAMPLES;
+	}
+	else if(dump->format == REFLOW_HISTORY_PACK)
+	{
+		static Reflow_History_Pack_Frame record;
+		pack_t pack;
+		pack_init(&pack, record.data, sizeof(record.data));
+		int32_t prev_temp = 0;
+		int32_t prev_out = 0;
+		uint8_t prev_state = 0;
+		uint32_t i = dump->next;
+		for(; i < dump->count; i++)
+		{
+			float temp;
+			uint16_t out;
+			uint8_t state;
+			History_Get(&dump->ao->run_history, i, &temp, &out, &state);
+			int32_t t = (int32_t)lroundf(temp * HISTORY_TEMP_SCALE); // Exact, as recorded.
+			uint32_t out_changed = (pack_zigzag((int32_t)out - prev_out) << 1) | (state != prev_state ? 1U : 0U);
+			size_t mark = pack_mark(&pack);
+			if(!pack_i32(&pack, t - prev_temp) || !pack_u32(&pack, out_changed) ||
+			   (state != prev_state && !pack_u32(&pack, state)))
+			{
+				pack_rewind(&pack, mark);
+				break; // Sample goes into next frame.
+			}
+			prev_temp = t;
+			prev_out = out;
+			prev_state = state;
+		}
+		record.type = REFLOW_HISTORY_PACK_TYPE;
+		record.first = dump->next;
+		record.num_samples = (uint16_t)(i - dump->next);
+		record.period = dump->ao->run_history.period;
+		if(reflow_history_send(&record, offsetof(Reflow_History_Pack_Frame, data) + pack.len) != MOD_OK)
+		{
+			return CMD_ASYNC_MORE;
+		}
+		dump->next = i;
+	}
+	else
+	{
+		static const char header[] = "time_s,temp_c,out,state\r\n";
+		static char chunk[CMD_ASYNC_CHUNK];
+		size_t len = 0;
+		uint32_t i = dump->next;
+		if(!dump->header)
+		{
+			memcpy(chunk, header, sizeof(header) - 1);
+			len = sizeof(header) - 1;
+		}
+		for(; i < dump->count; i++)
+		{
+			float temp;
+			uint16_t out;
+			uint8_t state;
+			History_Get(&dump->ao->run_history, i, &temp, &out, &state);
+			int n = snprintf(&chunk[len], sizeof(chunk) - len, "%.2f,%.2f,%u,%s\r\n", (float)i * dump->ao->run_history.period, temp,
+			                 out, state < NUM_REFLOW_STATES ? reflow_names[state] : "?");
+			if(n < 0 || (size_t)n >= sizeof(chunk) - len)
+			{
+				break; // Line goes into next chunk.
+			}
+			len += (size_t)n;
+		}
+		if(console_write(chunk, len) != MOD_OK)
+		{
+			return CMD_ASYNC_MORE;
+		}
+		dump->header = true;
+		dump->next = i;
+	}
+
+	if(dump->next < dump->count)
+	{
+		return CMD_ASYNC_MORE;
+	}
+	LOG("Dumped %lu samples\r\n", dump->count - dump->first);
+	return CMD_ASYNC_DONE;
+}
+
+/**
+ * @brief Encode run history dump frame into a free transmit frame and queue it by reference.
+ *
+ * @param record Frame payload.
+ * @param len Number of payload bytes.
+ *
+ * @return MOD_OK if queued, MOD_ERR_BUF_OVERRUN if both frames are still being sent or the console is busy.
+ */
+static mod_err_t reflow_history_send(const void *record, size_t len)
+{
+	uint8_t i = history_tx_next;
+	if(history_tx_busy[i])
+	{
+		return MOD_ERR_BUF_OVERRUN; // Frame before last still draining.
+	}
+	size_t n = frame_encode(record, len, history_tx[i], sizeof(history_tx[i]));
+	history_tx_busy[i] = true;
+	if(console_write_ref(history_tx[i], n, reflow_history_sent, (void *)(uintptr_t)i) != MOD_OK)
+	{
+		history_tx_busy[i] = false;
+		return MOD_ERR_BUF_OVERRUN;
+	}
+	history_tx_next = i ^ 1U;
+	return MOD_OK;
+}
+
+/**
+ * @brief Release transmit frame of run history dump once sent (interrupt context).
+ *
+ * @param ctx Index of frame within history_tx.
+ */
+static void reflow_history_sent(void *ctx)
+{
+	history_tx_busy[(uintptr_t)ctx] = false;
+}
+
+/**
+ * @brief Record oven temperature, mean zone output and state of latest sample into run history.
+ *
+ * @param ao Reflow active object.
+ * @param oven_temp Oven temperature (deg C).
+ */
+static void reflow_history_add(Reflow_Active *const ao, float oven_temp)
+{
+	float out = 0.0f;
+	for(uint8_t z = 0; z < ao->num_zones; z++)
+	{
+		out += ao->zone_out[z];
+	}
+	History_Add(&ao->run_history, oven_temp, out / (float)ao->num_zones, (uint8_t)reflow_state(ao));
+	if(ao->run_history.count % HISTORY_BLOCK_SAMPLES == 0)
+	{
+		reflow_archive_block(ao, ao->run_history.count - HISTORY_BLOCK_SAMPLES);
+	}
+}
+
+/**
+ * @brief Copy run history block into dump or archive frame.
+ *
+ * @param ao Reflow active object whose run is copied.
+ * @param record Frame to fill.
+ * @param first Index of block's first sample.
+ */
+static void reflow_history_frame(Reflow_Active const *const ao, Reflow_History_Frame *const record, uint32_t first)
+{
+	uint32_t n = ao->run_history.count - first;
+	record->type = REFLOW_HISTORY_TYPE;
+	record->oven = ao->oven;
+	record->first = first;
+	record->num_samples = (uint16_t)(n < HISTORY_BLOCK_SAMPLES ? n : HISTORY_BLOCK_SAMPLES);
+	record->period = ao->run_history.period;
+	record->block = ao->run_history.blocks[(first / HISTORY_BLOCK_SAMPLES) % HISTORY_NUM_BLOCKS];
+}
+
+/**
+ * @brief Append run history block to run archive, never waits on the flash.
+ *
+ * @param ao Reflow active object whose run is archived.
+ * @param first Index of block's first sample.
+ */
+static void reflow_archive_block(Reflow_Active const *const ao, uint32_t first)
+{
+	Reflow_History_Frame record;
+	reflow_history_frame(ao, &record, first);
+	archive_append(&record, sizeof(record));
+}
+
+static uint32_t reflow_conform_cmd(uint32_t argc, const char **argv)
+{
+	Reflow_Active *const ao = cmd_ctx();
+	if(argc == 0)
+	{
+		displayConform(ao);
+		return 0;
+	}
+
+	/* Limits are read on every sample, so only change them while no reflow process runs. */
+	if(reflow_state(ao) != RESET_STATE)
+	{
+		LOG("Stop reflow process before changing conformance limits\r\n");
+		return -1;
+	}
+
+	/* Keys follow the layout of Conform_cfg_t: band, then min and max of every metric. */
+	enum {KEY_LIQUIDUS, KEY_SOAK_LO, KEY_SOAK_HI, KEY_MIN, KEY_MAX = KEY_MIN + CONFORM_NUM_METRICS,
+	      NUM_CONFORM_KEYS = KEY_MAX + CONFORM_NUM_METRICS};
+	static const cmd_kv_spec specs[NUM_CONFORM_KEYS] = {
+		{"liquidus", 'f'}, {"soak_lo", 'f'}, {"soak_hi", 'f'},
+		{"peak_min", 'f'}, {"tal_min", 'f'}, {"soak_min", 'f'}, {"ramp_min", 'f'}, {"rms_min", 'f'},
+		{"peak_max", 'f'}, {"tal_max", 'f'}, {"soak_max", 'f'}, {"ramp_max", 'f'}, {"rms_max", 'f'}};
+	cmd_arg_val vals[NUM_CONFORM_KEYS];
+	if(cmd_parse_kv(argc, argv, specs, NUM_CONFORM_KEYS, vals) < 0)
+	{
+		return -1;
+	}
+
+	Conform_cfg_t cfg = ao->conform.cfg;
+	float *const fields[NUM_CONFORM_KEYS] = {
+		&cfg.liquidus, &cfg.soak_lo, &cfg.soak_hi,
+		&cfg.min[CONFORM_PEAK], &cfg.min[CONFORM_TAL], &cfg.min[CONFORM_SOAK], &cfg.min[CONFORM_RAMP], &cfg.min[CONFORM_RMS],
+		&cfg.max[CONFORM_PEAK], &cfg.max[CONFORM_TAL], &cfg.max[CONFORM_SOAK], &cfg.max[CONFORM_RAMP], &cfg.max[CONFORM_RMS]};
+	for(uint8_t k = 0; k < NUM_CONFORM_KEYS; k++)
+	{
+		if(vals[k].type != '\0')
+		{
+			*fields[k] = vals[k].val.f;
+		}
+	}
+	if(cfg.soak_lo >= cfg.soak_hi)
+	{
+		LOG("Soak band lower bound must be below upper bound\r\n");
+		return -1;
+	}
+
+	ao->conform.cfg = cfg;
+	displayConform(ao);
+	return 0;
+}
+
+/**
+ * @brief Score completed reflow process and display its metrics next to the previous run's.
+ *
+ * @param ao Reflow active object.
+ */
+static void reflow_conform_finish(Reflow_Active *const ao)
+{
+	memcpy(ao->conform_prev, ao->conform_last, sizeof(ao->conform_prev));
+	ao->conform_failed = Conform_Finish(&ao->conform, ao->conform_last);
+	ao->conform_runs++;
+	displayConform(ao);
+}
+
+/**
+ * @brief Show or set hardware-in-the-loop mode.
+ *
+ * "reflow inject" sets the thermocouple temperatures, read by "reflow start". With "on" the
+ * host runs a plant model in lock-step with the controller:
+ * - While a reflow or autotune process runs, each "reflow inject" is one sample, taken one
+ *   nominal sampling period after the previous one. Sample timestamps, dwell times and
+ *   telemetry timestamps follow this virtual time, so runs go as fast as the host injects.
+ * - Each processed sample is answered with one telemetry frame per zone, whose pwm is the
+ *   output to apply to the plant before injecting the next sample. The "sampled" field of
+ *   the response to "reflow inject" tells whether telemetry follows, it is 0 once the run ended.
+ * - The control loop heartbeat is not armed.
+ * With "free" the sampling timer samples the last injected temperatures instead of the
+ * thermocouples, and runs in the virtual time of "ao timescale" along with dwell times, so
+ * an accelerated plant model can be injected at its own pace. Telemetry is decimated as set
+ * with "reflow stream". A time scale other than 1 is refused without HIL mode, as heater and
+ * oven would not follow the accelerated control loop.
+ * Heater outputs stay disabled in both modes. Samples pass the safety supervisor like
+ * thermocouple samples. Hosts usually send "reflow inject" as binary requests with float
+ * args (see cmd.h), so no text is parsed per sample.
+ */
+static uint32_t reflow_hil_cmd(uint32_t argc, const char **argv)
+{
+	Reflow_Active *const ao = cmd_ctx();
+	static const char *const hil_names[] = {"off", "on", "free"}; // Indexed by Reflow_Hil_Mode.
+	if(argc == 0)
+	{
+		LOG("Hardware-in-the-loop mode: %s\r\n", hil_names[ao->hil]);
+		return 0;
+	}
+
+	/* Sampling source is chosen when sampling starts. */
+	if(reflow_state(ao) != RESET_STATE)
+	{
+		LOG("Stop reflow process before changing hardware-in-the-loop mode\r\n");
+		return -1;
+	}
+
+	Reflow_Hil_Mode mode = REFLOW_HIL_OFF;
+	while(argc != 1 || strcasecmp(argv[0], hil_names[mode]) != 0)
+	{
+		if(++mode > REFLOW_HIL_FREE)
+		{
+			LOG("Usage: reflow hil [on | free | off]\r\n");
+			return -1;
+		}
+	}
+	if(mode != REFLOW_HIL_OFF && ao->hil == REFLOW_HIL_OFF)
+	{
+		ao->hil_temp_valid = false;
+	}
+	ao->hil_ms = 0;
+	ao->hil_cycles = 0;
+	ao->hil = mode;
+	reflow_sample_age_update(ao);
+	LOG("Hardware-in-the-loop mode %s\r\n", hil_names[ao->hil]);
+	return 0;
+}
+
+static uint32_t reflow_inject_cmd(uint32_t argc, const char **argv)
+{
+	Reflow_Active *const ao = cmd_ctx();
+	if(ao->hil == REFLOW_HIL_OFF)
+	{
+		LOG("Turn on hardware-in-the-loop mode first with: reflow hil on\r\n");
+		return -1;
+	}
+
+	cmd_arg_val arg_vals[REFLOW_MAX_THERMOCOUPLES];
+	int32_t num_args = cmd_parse_args(argc, argv, "f[f[f[f", arg_vals);
+	if(num_args < 0)
+	{
+		return -1;
+	}
+	if(num_args != ao->num_thermocouples)
+	{
+		LOG("Expected %u temperatures, one per thermocouple\r\n", ao->num_thermocouples);
+		return -1;
+	}
+
+	/* Free-running sampling timer copies temperatures, it must not see half of them updated. */
+	uint32_t primask = __get_PRIMASK();
+	__disable_irq();
+	for(uint8_t i = 0; i < ao->num_thermocouples; i++)
+	{
+		ao->hil_temp[i] = arg_vals[i].val.f;
+	}
+	__set_PRIMASK(primask);
+	ao->hil_temp_valid = true;
+	bool sampling = ao->hil == REFLOW_HIL_STEP && ao->hil_sampling;
+	if(sampling && reflow_hil_post(ao) != MOD_OK)
+	{
+		LOG("Sample dropped, wait for telemetry before injecting the next one\r\n");
+		return -1;
+	}
+	cmd_out_u32("sampled", sampling); // Telemetry follows only if set.
+	return 0;
+}
+
+/**
+ * @brief Publish injected temperatures as a sample (ISR-safe).
+ *
+ * In step mode the sample is taken one nominal sample period after the previous one,
+ * otherwise it is taken now.
+ *
+ * @param ao Reflow active object.
+ *
+ * @return MOD_OK if published, MOD_ERR_RESOURCE if the event pool is exhausted.
+ */
+static mod_err_t reflow_hil_post(Reflow_Active *const ao)
+{
+	Sample_Event *const sample = (Sample_Event *)Event_new(sizeof(Sample_Event), SAMPLE_READY_SIG);
+	if(sample == NULL)
+	{
+		return MOD_ERR_RESOURCE;
+	}
+
+	if(ao->hil == REFLOW_HIL_STEP)
+	{
+		/* Timestamps wrap like the DWT cycle counter, so sample periods still come out right.
+		 * They count cycles like it too, which Active_cycles_to_s() scales to virtual time.
+		 */
+		ao->hil_ms += (uint32_t)(ao->acq_period * 1000.0f);
+		ao->hil_cycles += (uint32_t)(ao->acq_period * (float)SystemCoreClock) / Active_time_scale();
+		sample->timestamp = ao->hil_cycles;
+	}
+	else
+	{
+		sample->timestamp = DWT->CYCCNT;
+	}
+	sample->ready_timestamp = sample->timestamp;
+	sample->err = MAX_OK;
+	sample->err_tc = 0;
+	sample->err_mask = 0;
+	sample->num_scans = 1;
+	sample->num_thermocouples = ao->num_thermocouples;
+	sample->oven = ao->oven;
+	Reflow_Latest acq = {.err = MAX_OK, .num_thermocouples = ao->num_thermocouples};
+	uint32_t primask = __get_PRIMASK();
+	__disable_irq();
+	for(uint8_t i = 0; i < REFLOW_MAX_THERMOCOUPLES; i++)
+	{
+		sample->temp[i] = i < ao->num_thermocouples ? ao->hil_temp[i] : 0.0f;
+		acq.temp[i] = sample->temp[i];
+		acq.raw[i] = sample->temp[i];
+		acq.cj[i] = NAN;
+	}
+	__set_PRIMASK(primask);
+	analog_read(&sample->analog);
+	acq.analog = sample->analog;
+	reflow_latest_put(ao, &acq);
+	Active_publish_to(&ao->reflow_base, &sample->base);
+	return MOD_OK;
+}
+
+/**
+ * @brief Check that control loop runs in wall-clock time, or on injected samples.
+ *
+ * Heaters and oven do not speed up with the virtual time scale, so an accelerated
+ * control loop would mistune and the safety supervisor would underestimate rates of rise.
+ */
+static inline bool reflow_time_ok(Reflow_Active const *const ao)
+{
+	return ao->hil != REFLOW_HIL_OFF || Active_time_scale() == 1U;
+}
+
+/**
+ * @brief Feed latest oven temperature and mean zone output to oven model estimator.
+ *
+ * Called once per sample after outputs are applied. Outputs are scaled to [0, 1] to keep
+ * the covariance matrix well conditioned in single precision.
+ *
+ * @param ao Reflow active object.
+ */
+static void reflow_model_update(Reflow_Active *const ao)
+{
+	float out = 0.0f;
+	for(uint8_t z = 0; z < ao->num_zones; z++)
+	{
+		out += ao->zone_out[z];
+	}
+	out /= (float)ao->num_zones * OUT_MAX_INIT;
+
+	/* Regress once the ring holds the output applied delay + 1 samples ago. */
+	uint32_t len = ao->model_delay + 1;
+	if(ao->model_samples >= len)
+	{
+		const float phi[RLS_N] = {ao->model_prev_temp, ao->model_out[ao->model_head], 1.0f};
+		RLS_Update(&ao->model_rls, phi, ao->temp);
+	}
+	else
+	{
+		ao->model_samples++;
+	}
+	ao->model_out[ao->model_head] = out;
+	ao->model_head = (ao->model_head + 1 == len) ? 0 : ao->model_head + 1;
+	ao->model_prev_temp = ao->temp;
+}
+
+/**
+ * @brief Convert identified discrete model into a first-order-plus-dead-time model.
+ *
+ * @param[in] ao Reflow active object.
+ * @param[out] model FOPDT model, dead time is the one identification assumed.
+ * @param[out] ambient Steady-state temperature with heaters off (deg C), may be NULL.
+ *
+ * @return true if the identified model is stable and heats with output, false otherwise.
+ */
+static bool reflow_model_get(Reflow_Active const *const ao, Smith_model_t *const model, float *const ambient)
+{
+	float a = ao->model_rls.theta[0];
+	float b = ao->model_rls.theta[1];
+	float c = ao->model_rls.theta[2];
+	if(ao->model_rls.updates == 0 || !(a > 0.0f && a < 1.0f) || !(b > 0.0f))
+	{
+		return false;
+	}
+
+	model->T = -ao->sample_period / logf(a);
+	model->K = b / ((1.0f - a) * OUT_MAX_INIT);
+	model->L = (float)ao->model_delay * ao->sample_period;
+	if(ambient != NULL)
+	{
+		*ambient = c / (1.0f - a);
+	}
+	return true;
+}
+
+/**
+ * @brief Schedule zone gains by setpoint band, or return zones to fixed gains if the schedule is empty.
+ *
+ * @param ao Reflow active object.
+ */
+static void reflow_schedule_apply(Reflow_Active *const ao)
+{
+	ao->pid_schedule.num_bands = (uint8_t)ao->schedule.num_bands;
+	ao->pid_schedule.bands = ao->schedule.bands;
+	for(uint8_t z = 0; z < ao->num_zones; z++)
+	{
+		PID_SetSchedule(&ao->zone_pid[z], ao->schedule.num_bands > 0 ? &ao->pid_schedule : NULL);
+	}
+}
+
+/**
+ * @brief Check that reflow profile can be run.
+ *
+ * @param profile Reflow profile.
+ *
+ * @return MOD_OK if profile is valid, MOD_ERR_ARG otherwise.
+ */
+static mod_err_t reflow_profile_check(Reflow_Profile const *const profile)
+{
+	if(profile->num_segments == 0 || profile->num_segments > REFLOW_MAX_SEGMENTS)
+	{
+		LOG("Profile must have 1 to %u segments\r\n", REFLOW_MAX_SEGMENTS);
+		return MOD_ERR_ARG;
+	}
+	for(uint8_t i = 0; i < profile->num_segments; i++)
+	{
+		Reflow_Segment const *const seg = &profile->segments[i];
+		if(!(seg->ramp_rate >= 0.0f) || !(seg->target >= 0.0f && seg->target <= REFLOW_TARGET_MAX))
+		{
+			LOG("Segment %u is out of range\r\n", i);
+			return MOD_ERR_ARG;
+		}
+	}
+	return MOD_OK;
+}
+
+/**
+ * @brief Map key of a reflow setting to the oven's own key, the first oven keeps the original keys.
+ *
+ * @param ao Reflow active object.
+ * @param key Key commented "per oven" in nvs.h.
+ *
+ * @return Key of the setting of oven.
+ */
+static nvs_key_t reflow_nvs_key(Reflow_Active const *const ao, nvs_key_t key)
+{
+	static const nvs_key_t oven_keys[NVS_OVEN_KEYS] = {NVS_KEY_PID_GAINS, NVS_KEY_PROFILE, NVS_KEY_PID_SCHEDULE, NVS_KEY_PWM_CAL,
+	                                                   NVS_KEY_TIMING, NVS_KEY_RECIPE, NVS_KEY_TC_CAL};
+	if(ao->oven == 0U)
+	{
+		return key;
+	}
+	uint32_t slot = 0;
+	while(oven_keys[slot] != key)
+	{
+		slot++;
+		ASSERT(slot < NVS_OVEN_KEYS);
+	}
+	return (nvs_key_t)(NVS_KEY_OVENS + (ao->oven - 1U) * NVS_OVEN_KEYS + slot);
+}
+
+/**
+ * @brief Restore zone gains, timing, active profile and thermocouple calibrations from parameter store,
+ *        defaults are kept if absent or invalid.
+ *
+ * @param ao Reflow active object.
+ */
+static void reflow_params_load(Reflow_Active *const ao)
+{
+	Reflow_Gains gains[REFLOW_MAX_ZONES];
+	if(nvs_get(reflow_nvs_key(ao, NVS_KEY_PID_GAINS), gains, sizeof(gains)) == MOD_OK)
+	{
+		for(uint8_t z = 0; z < ao->num_zones; z++)
+		{
+			PID_SetGains(&ao->zone_pid[z], gains[z].Kp, gains[z].Ki, gains[z].Kd, gains[z].tau);
+			PID_SetFeedForward(&ao->zone_pid[z], gains[z].Kff);
+		}
+		LOGI(TAG, "Restored stored PID gains.");
+	}
+
+	Reflow_Schedule schedule;
+	if(nvs_get(reflow_nvs_key(ao, NVS_KEY_PID_SCHEDULE), &schedule, sizeof(schedule)) == MOD_OK)
+	{
+		if(schedule.num_bands <= REFLOW_MAX_BANDS)
+		{
+			ao->schedule = schedule;
+			LOGI(TAG, "Restored stored PID gain schedule with %lu bands.", ao->schedule.num_bands);
+		}
+	}
+
+	Reflow_Pwm_Curve curve;
+	if(nvs_get(reflow_nvs_key(ao, NVS_KEY_PWM_CAL), &curve, sizeof(curve)) == MOD_OK && curve.valid != 0U)
+	{
+		ao->pwm_curve = curve;
+		reflow_pwm_lin_apply(ao);
+		LOGI(TAG, "Restored stored PWM power curve.");
+	}
+
+	Reflow_Timing timing;
+	if(nvs_get(reflow_nvs_key(ao, NVS_KEY_TIMING), &timing, sizeof(timing)) == MOD_OK &&
+	   timing.sample_period >= TS_MIN && timing.sample_period <= TS_MAX &&
+	   timing.pwm_period >= PWM_PERIOD_MIN && timing.pwm_period <= timing.sample_period)
+	{
+		reflow_timing_apply(ao, &timing);
+		LOGI(TAG, "Restored stored sampling period %.3f s.", ao->sample_period);
+	}
+
+	Reflow_Profile profile;
+	if(nvs_get(reflow_nvs_key(ao, NVS_KEY_PROFILE), &profile, sizeof(profile)) == MOD_OK)
+	{
+		profile.name[REFLOW_PROFILE_NAME_LEN - 1] = '\0';
+		if(reflow_profile_check(&profile) == MOD_OK)
+		{
+			ao->profile = profile;
+			LOGI(TAG, "Restored stored profile %s.", ao->profile.name);
+		}
+		else
+		{
+			LOGW(TAG, "Stored profile is invalid, using %s.", ao->profile.name);
+		}
+	}
+
+	Tccal_points_t points[REFLOW_MAX_THERMOCOUPLES];
+	if(nvs_get(reflow_nvs_key(ao, NVS_KEY_TC_CAL), points, sizeof(points)) == MOD_OK)
+	{
+		for(uint8_t i = 0; i < REFLOW_MAX_THERMOCOUPLES; i++)
+		{
+			if(Tccal_Check(&points[i]))
+			{
+				ao->tc_cal_points[i] = points[i];
+				Tccal_Build(&ao->tc_cal[i], &points[i]);
+			}
+			else
+			{
+				LOGW(TAG, "Stored calibration of thermocouple %u is invalid, dropped.", i);
+			}
+		}
+		LOGI(TAG, "Restored stored thermocouple calibrations.");
+	}
+
+	uint32_t bad;
+	if(nvs_get(reflow_nvs_key(ao, NVS_KEY_RECIPE), &ao->recipe, sizeof(ao->recipe)) == MOD_OK &&
+	   Recipe_Check(&ao->recipe, REFLOW_TARGET_MAX, &bad) != MOD_OK)
+	{
+		LOGW(TAG, "Stored recipe is invalid at instruction %lu, dropped.", bad);
+		memset(&ao->recipe, 0, sizeof(ao->recipe));
+	}
+}
+
+/**
+ * @brief Linearize PWM zone heaters with table built from calibrated power curve, or drive
+ * duty as output if not calibrated or the curve is invalid.
+ *
+ * @param ao Reflow active object.
+ */
+static void reflow_pwm_lin_apply(Reflow_Active *const ao)
+{
+	if(ao->pwm_curve.valid != 0U && !Pwmlin_Build(&ao->pwm_lin, ao->pwm_curve.power))
+	{
+		LOGW(TAG, "PWM power curve is invalid, dropped.");
+		ao->pwm_curve.valid = 0U;
+	}
+	for(uint8_t z = 0; z < ao->num_zones; z++)
+	{
+		Heater_Linearize(&ao->zone_heater[z], ao->pwm_curve.valid != 0U ? &ao->pwm_lin : NULL);
+	}
+}
+
+/**
+ * @brief Get thermocouple scans per sampling period, one per conversion up to REFLOW_OVERSAMPLE.
+ *
+ * Sampling periods shorter than REFLOW_SCAN_MIN scan once per sample, consecutive samples
+ * may then repeat a conversion while the setpoint and outputs still update every sample.
+ *
+ * @param Ts Nominal sampling period (s).
+ *
+ * @return Scans, 1 to REFLOW_OVERSAMPLE.
+ */
+static inline uint8_t reflow_scans(float Ts)
+{
+	float scans = floorf(Ts / REFLOW_SCAN_MIN + 0.001f);
+	return scans < 1.0f ? 1U : (scans > (float)REFLOW_OVERSAMPLE ? REFLOW_OVERSAMPLE : (uint8_t)scans);
+}
+
+/**
+ * @brief Validate control loop timing against its limits, the current configuration and the
+ * worst scan and PID iteration times measured so far, logging the first violation.
+ *
+ * @param ao Reflow active object.
+ * @param timing Sampling and PWM periods.
+ *
+ * @return MOD_OK if timing may be applied, MOD_ERR_ARG otherwise.
+ */
+static mod_err_t reflow_timing_check(Reflow_Active const *const ao, Reflow_Timing const *const timing)
+{
+	float Ts = timing->sample_period;
+	if(!(Ts >= TS_MIN && Ts <= TS_MAX))
+	{
+		LOG("Ts must be within %.2f to %.2f s\r\n", TS_MIN, TS_MAX);
+		return MOD_ERR_ARG;
+	}
+	if(!(timing->pwm_period >= PWM_PERIOD_MIN && timing->pwm_period <= Ts))
+	{
+		LOG("PWM period must be within %.2f s to Ts\r\n", PWM_PERIOD_MIN);
+		return MOD_ERR_ARG;
+	}
+	if(reflow_state(ao) != RESET_STATE)
+	{
+		LOG("Stop reflow process before changing Ts or PWM period\r\n");
+		return MOD_ERR_ARG;
+	}
+
+	/* Every PID iteration must fit Ts, cascade outer loops run at a multiple of it. */
+	float scan_us = Ts * 1e6f / (float)reflow_scans(Ts);
+	if((float)ao->pms[SPI_TIME_MAX_US] > REFLOW_TIMING_BUDGET * scan_us)
+	{
+		LOG("Scans took up to %u us, over %.0f%% of the %.0f us scan period\r\n", ao->pms[SPI_TIME_MAX_US],
+		    100.0f * REFLOW_TIMING_BUDGET, scan_us);
+		return MOD_ERR_ARG;
+	}
+	if((float)ao->pms[PID_TIME_MAX_US] > REFLOW_TIMING_BUDGET * Ts * 1e6f)
+	{
+		LOG("PID iterations took up to %u us, over %.0f%% of Ts\r\n", ao->pms[PID_TIME_MAX_US],
+		    100.0f * REFLOW_TIMING_BUDGET);
+		return MOD_ERR_ARG;
+	}
+
+	/* Designs in samples must remain valid at the new period. */
+	if(ao->smith_model.T > 0.0f && ao->smith_model.L > SMITH_MAX_DELAY * Ts)
+	{
+		LOG("Smith model dead time %.1f s exceeds %u samples\r\n", ao->smith_model.L, SMITH_MAX_DELAY);
+		return MOD_ERR_ARG;
+	}
+	Filter_cfg_t cfg = ao->filter_cfg;
+	if(ao->filter_lowpass > 0.0f && !Filter_LowPass(&cfg, ao->filter_lowpass, Ts))
+	{
+		LOG("Low-pass cutoff %.3f Hz does not fit Ts\r\n", ao->filter_lowpass);
+		return MOD_ERR_ARG;
+	}
+	return MOD_OK;
+}
+
+static uint32_t reflow_rate_cmd(uint32_t argc, const char **argv)
+{
+	Reflow_Active *const ao = cmd_ctx();
+	enum {RATE_DIV, RATE_BAND, RATE_SLOPE, RATE_SETTLE, NUM_RATE_KEYS};
+	static const cmd_kv_spec specs[NUM_RATE_KEYS] = {{"div", 'u'}, {"band", 'f'}, {"slope", 'f'}, {"settle", 'f'}};
+	Rate_cfg_t const *const cur = &ao->rate.cfg;
+	if(argc == 0)
+	{
+		LOG("Adaptive control rate: %s%s\r\nDivider: %u (at most %u)\tBand: %.1f deg C\tSlope: %.2f deg C/s\tSettle: %.1f s\r\n",
+		    ao->rate_enabled ? "on" : "off",
+		    ao->rate_enabled && !reflow_rate_active(ao) ? ", held at full rate" : "",
+		    ao->sample_div, cur->div_max, cur->band, cur->slope, cur->settle);
+		return 0;
+	}
+
+	/* Sampling timer and watchdog follow the divider, so only change them while sampling is stopped. */
+	if(reflow_state(ao) != RESET_STATE)
+	{
+		LOG("Stop reflow process before changing adaptive control rate\r\n");
+		return -1;
+	}
+
+	if(strcasecmp(argv[0], "on") == 0)
+	{
+		cmd_arg_val vals[NUM_RATE_KEYS];
+		if(cmd_parse_kv(argc - 1, argv + 1, specs, NUM_RATE_KEYS, vals) < 0)
+		{
+			return -1;
+		}
+		Rate_cfg_t cfg = *cur;
+		if(vals[RATE_DIV].type != '\0')
+		{
+			cfg.div_max = vals[RATE_DIV].val.u > REFLOW_RATE_DIV_LIMIT ? 0U : (uint8_t)vals[RATE_DIV].val.u;
+		}
+		float *const fields[NUM_RATE_KEYS] = {NULL, &cfg.band, &cfg.slope, &cfg.settle};
+		for(uint8_t i = RATE_BAND; i < NUM_RATE_KEYS; i++)
+		{
+			if(vals[i].type != '\0')
+			{
+				*fields[i] = vals[i].val.f;
+			}
+		}
+		if(cfg.div_max < 1U || !(cfg.band >= 0.0f) || !(cfg.slope >= 0.0f) || !(cfg.settle >= ao->sample_period))
+		{
+			LOG("Invalid rate parameters, div must be 1 to %u and settle at least %.2f s\r\n",
+			    REFLOW_RATE_DIV_LIMIT, ao->sample_period);
+			return -1;
+		}
+		Rate_Init(&ao->rate, &cfg);
+		ao->rate_enabled = true;
+	}
+	else if(strcasecmp(argv[0], "off") == 0 && argc == 1)
+	{
+		ao->rate_enabled = false;
+	}
+	else
+	{
+		LOG("Usage: reflow rate [on [div=<n>] [band=<deg C>] [slope=<deg C/s>] [settle=<s>] | off]\r\n");
+		return -1;
+	}
+
+	reflow_wdg_update(ao);
+	LOG("Adaptive control rate %s\r\n", ao->rate_enabled ? "on" : "off");
+	return 0;
+}
+
+/**
+ * @brief Check whether control rate may adapt.
+ *
+ * Smith predictors and the low-pass filter are designed in nominal periods and the hardware
+ * in the loop paces samples itself, so these hold full rate.
+ */
+static inline bool reflow_rate_active(Reflow_Active const *const ao)
+{
+	return ao->rate_enabled && !ao->smith_enabled && ao->filter_lowpass == 0.0f && ao->hil == REFLOW_HIL_OFF;
+}
+
+/**
+ * @brief Return to full control rate, on a segment change.
+ */
+static void reflow_rate_reset(Reflow_Active *const ao)
+{
+	Rate_Reset(&ao->rate);
+	reflow_sampling_div(ao, 1U);
+}
+
+/**
+ * @brief Fit control loop heartbeat timeout to the slowest sampling period.
+ */
+static void reflow_wdg_update(Reflow_Active const *const ao)
+{
+	float slowest = ao->sample_period * (float)(ao->rate_enabled ? ao->rate.cfg.div_max : 1U);
+	ASSERT(wdg_set_timeout(ao->wdg_id, REFLOW_WDG_TIMEOUT_MS(slowest)) == MOD_OK);
+}
+
+/**
+ * @brief Fit age of samples dropped as stale to the nominal sampling period.
+ *
+ * A sample still queued a nominal period after it was taken, eg. behind a command backlog or
+ * a long handler, is dropped by the event loop so the zones are never driven from old
+ * temperatures. In step mode the host waits for the outputs of every injected sample, so none
+ * is dropped.
+ */
+static void reflow_sample_age_update(Reflow_Active *const ao)
+{
+	uint32_t max_age_us = ao->hil == REFLOW_HIL_STEP ? 0U : REFLOW_SAMPLE_MAX_AGE_US(ao->sample_period);
+	Active_max_age((Active *)ao, SAMPLE_READY_SIG, max_age_us);
+}
+
+/**
+ * @brief Apply checked control loop timing while sampling is stopped.
+ *
+ * Zone controllers take the new nominal period and designs in samples are redone: Smith
+ * predictors and low-pass filter at the new period, the oven model estimate restarts as its
+ * coefficients are per sample.
+ *
+ * @param ao Reflow active object.
+ * @param timing Sampling and PWM periods.
+ */
+static void reflow_timing_apply(Reflow_Active *const ao, Reflow_Timing const *const timing)
 {
-    LOGI(TAG, "Initializing reflow oven controller...");
-    ao->state = RESET_STATE; // Redundant, but just in case.
-    return INIT_STATUS;
+	ao->sample_period = timing->sample_period;
+	ao->scans = reflow_scans(ao->sample_period);
+	ao->pwm_period = timing->pwm_period;
+	for(uint8_t z = 0; z < ao->num_zones; z++)
+	{
+		PID_SetSampleTime(&ao->zone_pid[z], ao->sample_period);
+		PID_SetSampleTime(&ao->zone_inner[z], ao->sample_period);
+		if(ao->smith_model.T > 0.0f)
+		{
+			Smith_Init(&ao->zone_smith[z], &ao->smith_model, ao->sample_period);
+		}
+		Heater_drive_t drive = ao->zones[z].heater.drive;
+		if((drive == HEATER_PWM || drive == HEATER_PWM_SCHED) && Heater_Set_Period(&ao->zone_heater[z], ao->pwm_period) != MOD_OK)
+		{
+			LOGW(TAG, "Zone %s PWM period %.3f s does not fit its timer.", ao->zones[z].name, ao->pwm_period);
+		}
+	}
+	if(ao->filter_lowpass > 0.0f && Filter_LowPass(&ao->filter_cfg, ao->filter_lowpass, ao->sample_period))
+	{
+		for(uint8_t i = 0; i < ao->num_thermocouples; i++)
+		{
+			Filter_Init(&ao->tc_filter[i], &ao->filter_cfg);
+		}
+	}
+	RLS_Init(&ao->model_rls, REFLOW_MODEL_LAMBDA, REFLOW_MODEL_P0);
+	reflow_wdg_update(ao);
+	reflow_sample_age_update(ao);
 }
 
-static Reflow_Status Reflow_reset_ENTRY(Reflow_Active *const ao, Event const *const evt)
+/**
+ * @brief Store gains of every zone, unchanged gains are not rewritten.
+ *
+ * @param ao Reflow active object.
+ * @param gains Gains of REFLOW_MAX_ZONES zones, unused zones zeroed.
+ */
+static void reflow_gains_save(Reflow_Active const *const ao, Reflow_Gains const *const gains)
 {
-    /* Disable PWM output signal */
-	LOGI(TAG, "Turning PWM off.");
-	__HAL_TIM_SET_COMPARE(ao->pwm_timer_handle, ao->pwm_channel, 0);
-	HAL_TIM_PWM_Stop(ao->pwm_timer_handle, ao->pwm_channel);
-
-    /* Clear PID memory */
-    PID_Reset(&ao->pid_params);
-
-    /* Disarm timers */
-    osTimerStop(ao->pid_timer_id);
-    TimeEvent_disarm(&ao->reflow_time_evt);
-
-    LOGI(TAG, "Reflow oven controller initialized.");
-    LOGI(TAG, "Enter command \"reflow start\" to start reflow process.");
-    return HANDLED_STATUS;
+	if(nvs_set(reflow_nvs_key(ao, NVS_KEY_PID_GAINS), gains, sizeof(ao->gain_bufs[0])) != MOD_OK)
+	{
+		LOG("Gains will not persist across resets\r\n");
+	}
 }
 
-static Reflow_Status Reflow_preheat_ENTRY(Reflow_Active *const ao, Event const *const evt)
+/**
+ * @brief Apply zone gains published by "reflow set" to zone controllers, if any were published since last call.
+ *
+ * Called by the reflow thread only, so gains never change during a PID iteration.
+ *
+ * @param ao Reflow active object.
+ */
+static void reflow_gains_apply(Reflow_Active *const ao)
 {
-	HAL_TIM_PWM_Start(ao->pwm_timer_handle, ao->pwm_channel);
-	ao->setpoint = (float)ao->reflow_phases[PREHEAT_STATE - 1].reach_temp;
-    osTimerStart(ao->pid_timer_id, (uint32_t)(ao->pid_params.Ts*1000));
-    return HANDLED_STATUS;
+	Reflow_Gains gains[REFLOW_MAX_ZONES];
+	if(!reflow_params_fetch(&ao->gain_params, &ao->gain_seq, gains))
+	{
+		return;
+	}
+	for(uint8_t z = 0; z < ao->num_zones; z++)
+	{
+		PID_SetGains(&ao->zone_pid[z], gains[z].Kp, gains[z].Ki, gains[z].Kd, gains[z].tau);
+		PID_SetFeedForward(&ao->zone_pid[z], gains[z].Kff);
+	}
+	LOGD(TAG, "Applied gain set %lu.", ao->gain_seq);
 }
 
-static Reflow_Status Reflow_soak_ENTRY(Reflow_Active *const ao, Event const *const evt)
+/**
+ * @brief Get back buffer of parameter set for editing (writer only).
+ *
+ * @param params Double-buffered parameter set.
+ *
+ * @return Back buffer, holding a copy of the published set.
+ */
+static void *reflow_params_edit(Reflow_Params *const params)
 {
-	/* Set step size for slowest temperature rise. */
-    ao->step_size = (float)( ao->reflow_phases[SOAK_STATE - 1].reach_temp - ao->reflow_phases[PREHEAT_STATE-1].reach_temp )/
-    				       ( ao->reflow_phases[SOAK_STATE - 1].reach_time * (1 / ao->pid_params.Ts) );
-	TimeEvent_arm(&ao->reflow_time_evt, ao->reflow_phases[SOAK_STATE - 1].reach_time, 0);
-    return HANDLED_STATUS;
+	uint32_t seq = params->seq;
+	void *const back = params->buf[(seq + 1U) % 2U];
+	memcpy(back, params->buf[seq % 2U], params->size);
+	return back;
 }
 
-static Reflow_Status Reflow_rampup_ENTRY(Reflow_Active *const ao, Event const *const evt)
+/**
+ * @brief Publish back buffer of parameter set (writer only).
+ *
+ * @param params Double-buffered parameter set.
+ */
+static void reflow_params_publish(Reflow_Params *const params)
 {
-	ao->setpoint = (float)ao->reflow_phases[RAMPUP_STATE - 1].reach_temp;
-    return HANDLED_STATUS;
+	__DMB(); // Set must be complete before readers observe seq.
+	params->seq = params->seq + 1U;
 }
 
-static Reflow_Status Reflow_peak_ENTRY(Reflow_Active *const ao, Event const *const evt)
+/**
+ * @brief Copy published parameter set if it is newer than the one last copied (reader only).
+ *
+ * @param params Double-buffered parameter set.
+ * @param[in/out] seq Publish count of set last copied, updated if copied.
+ * @param dst Copy of set, unmodified if not newer.
+ *
+ * @return true if a newer set was copied, false otherwise.
+ */
+static bool reflow_params_fetch(Reflow_Params const *const params, uint32_t *const seq, void *const dst)
 {
-	ao->step_size = 0;
-	TimeEvent_arm(&ao->reflow_time_evt, ao->reflow_phases[PEAK_STATE - 1].reach_time, 0);
-    return HANDLED_STATUS;
+	uint32_t published = params->seq;
+	if(published == *seq)
+	{
+		return false;
+	}
+
+	/* Writer only edits the other buffer until it publishes again, so an unchanged seq means an intact copy. */
+	do
+	{
+		published = params->seq;
+		__DMB();
+		memcpy(dst, params->buf[published % 2U], params->size);
+		__DMB();
+	} while(params->seq != published);
+	*seq = published;
+	return true;
 }
 
-static Reflow_Status Reflow_cooldown_ENTRY(Reflow_Active *const ao, Event const *const evt)
+/**
+ * @brief Send zone PID telemetry record as a COBS frame with CRC-16.
+ *
+ * @param ao Reflow active object.
+ * @param zone Heater zone index.
+ */
+static void reflow_stream_sample(Reflow_Active *const ao, uint8_t zone)
 {
-	ao->setpoint = (float)ao->reflow_phases[COOLDOWN_STATE - 1].reach_temp;
-    return HANDLED_STATUS;
+	PID_t const *const pid = &ao->zone_pid[zone];
+	const Reflow_Telemetry record = {.type = REFLOW_TELEMETRY_TYPE,
+	                                 .timestamp = ao->hil == REFLOW_HIL_STEP ? ao->hil_ms : Active_time_ms(),
+	                                 .state = (uint8_t)reflow_state(ao),
+	                                 .segment = ao->segment,
+	                                 .zone = zone,
+	                                 .setpoint = reflow_state(ao) == CONVEYOR_STATE ? ao->conveyor.setpoint[zone] : ao->setpoint,
+	                                 .temp = ao->zone_temp[zone],
+	                                 .proportional = pid->proportional,
+	                                 .integral = pid->integral,
+	                                 .derivative = pid->derivative,
+	                                 .pwm = (uint16_t)ao->zone_out[zone],
+	                                 .oven = ao->oven};
+	uint8_t frame[FRAME_ENCODED_SIZE(sizeof(record))];
+	size_t len = frame_encode((const uint8_t *)&record, sizeof(record), frame, sizeof(frame));
+	console_telemetry_write((const char *)frame, len);
 }
 
-static Reflow_Status Reflow_reset_START(Reflow_Active *const ao, Event const *const evt)
+static void reflow_evt_handler(Reflow_Active *const ao, Event const *const evt)
 {
-    /* Check that oven temperature has cooled down. */
-    float current_temp = 0;
-    if (readTemperature(&current_temp) != true)
+    /* Trips are published to every oven's controller, each stops for its own oven only. */
+    if (evt->sig == SAFETY_TRIP_SIG && ((Trip_Event const *)evt)->oven != ao->oven)
     {
-        LOGW(TAG, "MAX31855K Read Error, unable to start reflow process.");
-        return HANDLED_STATUS;
+        return;
     }
-    else if ((uint32_t)current_temp > ao->reflow_phases[COOLDOWN_STATE - 1].reach_temp) // Subtract 1 due to RESET_STATE.)
+
+    reflow_evt_process(ao, evt);
+    reflow_status_put(ao); // Every change of state or sample shows in the next status poll.
+    if (evt->sig == WATCH_TICK_SIG)
     {
-    	LOGW(TAG, "Oven temperature must cool to below %lu before starting another run.",
-    	                 ao->reflow_phases[COOLDOWN_STATE - 1].reach_temp);
-    	return HANDLED_STATUS;
+        reflow_watch_send(ao);
+    }
+    if (evt->sig == SAMPLE_READY_SIG && ao->oven == 0U) // Scope variables are of the first oven.
+    {
+        scope_sample(ao->hil == REFLOW_HIL_STEP ? ao->hil_ms : Active_time_ms());
     }
-	else
-	{
-		LOG("Starting reflow process\r\n");
-		LOGI(TAG, "Entering pre-heat phase.");
-		ao->state = PREHEAT_STATE;
-		return TRAN_STATUS;
-	}
 }
 
-static Reflow_Status Reflow_preheat_REACHTEMP(Reflow_Active *const ao, Event const *const evt)
+static void reflow_evt_process(Reflow_Active *const ao, Event const *const evt)
 {
-    LOGI(TAG, "Entering soak phase.");
-    ao->state = SOAK_STATE;
-    return TRAN_STATUS;
-}
+    if (evt->sig == INIT_SIG)
+    {
+        LOGI(TAG, "Initializing reflow oven controller...");
+        Hsm_init(&ao->hsm, &reflow_reset_state);
+        return;
+    }
 
-static Reflow_Status Reflow_soak_REACHTIME(Reflow_Active *const ao, Event const *const evt)
-{
-    LOGI(TAG, "Entering ramp-up phase.");
-    ao->state = RAMPUP_STATE;
-    return TRAN_STATUS;
+    ASSERT(evt->sig < NUM_REFLOW_SIGS);
+    if (evt->sig == GAINS_SIG)
+    {
+        /* Same in every state, the next PID iteration would apply them otherwise. */
+        reflow_gains_apply(ao);
+        return;
+    }
+    if (evt->sig == TIMING_SIG)
+    {
+        if (reflow_state(ao) != RESET_STATE)
+        {
+            LOGW(TAG, "Reflow process started, timing unchanged.");
+            return;
+        }
+        reflow_timing_apply(ao, &ao->timing_request);
+        if (nvs_set_deferred(reflow_nvs_key(ao, NVS_KEY_TIMING), &ao->timing_request, sizeof(ao->timing_request)) != MOD_OK)
+        {
+            LOGW(TAG, "Failed to store timing.");
+        }
+        LOG("Sampling period %.3f s (%u scans), PWM period %.3f s\r\n", ao->sample_period, ao->scans, ao->pwm_period);
+        return;
+    }
+    if (evt->sig == ALIGN_TICK_SIG)
+    {
+        reflow_align_probe_step(ao);
+        return;
+    }
+    if (evt->sig == REFRESH_SIG)
+    {
+        /* Sampling stores every acquisition while it runs, the bus is free otherwise. */
+        float temp;
+        if (reflow_state(ao) == RESET_STATE)
+        {
+            (void)readTemperature(ao, &temp);
+        }
+        return;
+    }
+    if (evt->sig == WATCH_SIG)
+    {
+        uint32_t period = ao->watch_period_ms;
+        if (period == 0)
+        {
+            TimeEvent_disarm(&ao->watch_time_evt);
+            LOG("Status push off\r\n");
+        }
+        else
+        {
+            TimeEvent_arm(&ao->watch_time_evt, TIME_EVENT_MS(period), TIME_EVENT_MS(period));
+            LOG("Status push every %lu ms\r\n", period);
+        }
+        return;
+    }
+    if (evt->sig == WATCH_TICK_SIG)
+    {
+        /* Idle oven is read here, pushed records never wait on a poll to refresh it. */
+        float temp;
+        if (reflow_state(ao) == RESET_STATE)
+        {
+            (void)readTemperature(ao, &temp);
+        }
+        return;
+    }
+    if (evt->sig == SCHEDULE_SIG)
+    {
+        reflow_job_request(ao, &((Reflow_Job_Event const *)evt)->job); // Queue in every state, preheat also stops if schedule is cleared.
+    }
+    Hsm_dispatch(&ao->hsm, evt);
 }
 
-static Reflow_Status Reflow_rampup_REACHTEMP(Reflow_Active *const ao, Event const *const evt)
+static inline void displayPIDParams(Reflow_Active const *const ao)
 {
-    LOGI(TAG, "Entering peak phase.");
-    ao->state = PEAK_STATE;
-    return TRAN_STATUS;
+    for (uint8_t z = 0; z < ao->num_zones; z++)
+    {
+        PID_t const *const pid = &ao->zone_pid[z];
+        LOG("Zone %s (%s heater, thermocouple %u)\r\n"
+            "Kp: %.2f\tKi: %.2f\tKd: %.2f\tTau: %.2f\tKff: %.2f\tBand: %d\r\n"
+            "Sampling Period: %.2f s (measured %.4f s, %u scans, PWM %.2f s)\tMax Limit: %.2f\tMin Limit: %.2f\r\n",
+            ao->zones[z].name, Heater_Drive_Name(ao->zones[z].heater.drive), ao->zones[z].thermocouple,
+            pid->Kp, pid->Ki, pid->Kd,
+            pid->tau, pid->Kff, (pid->schedule == NULL || pid->band == PID_NO_BAND) ? -1 : (int)pid->band,
+            ao->sample_period, pid->Ts, ao->scans, ao->pwm_period,
+            pid->out_lim_max, pid->out_lim_min);
+    }
 }
 
-static Reflow_Status Reflow_peak_REACHTIME(Reflow_Active *const ao, Event const *const evt)
+static inline void displayConform(Reflow_Active const *const ao)
 {
-    LOGI(TAG, "Entering cool-down phase.");
-    ao->state = COOLDOWN_STATE;
-    return TRAN_STATUS;
+	Conform_cfg_t const *const cfg = &ao->conform.cfg;
+	LOG("Conformance: liquidus %.1f deg C, soak band %.1f to %.1f deg C\r\n", cfg->liquidus, cfg->soak_lo, cfg->soak_hi);
+	if(ao->conform_runs == 0)
+	{
+		for(uint8_t m = 0; m < CONFORM_NUM_METRICS; m++)
+		{
+			LOG("%-5s %8.2f to %8.2f %s\r\n", conform_names[m], cfg->min[m], cfg->max[m], conform_units[m]);
+		}
+		LOG("No reflow process completed yet\r\n");
+		return;
+	}
+
+	bool has_prev = ao->conform_runs > 1;
+	for(uint8_t m = 0; m < CONFORM_NUM_METRICS; m++)
+	{
+		float value = ao->conform_last[m];
+		LOG("%-5s %8.2f %-8s [%.2f, %.2f] %s", conform_names[m], value, conform_units[m], cfg->min[m], cfg->max[m],
+		    (ao->conform_failed & (1UL << m)) ? "FAIL" : "ok");
+		if(has_prev)
+		{
+			LOG("\t%+.2f vs previous run", value - ao->conform_prev[m]);
+		}
+		LOG("\r\n");
+	}
+	LOG("Run %lu: %s\r\n", ao->conform_runs, ao->conform_failed == 0 ? "PASS" : "FAIL");
 }
 
-static Reflow_Status Reflow_cooldown_REACHTEMP(Reflow_Active *const ao, Event const *const evt)
+static inline void displayModel(Reflow_Active const *const ao)
 {
-    LOGI(TAG, "Reflow process completed!");
-    ao->state = RESET_STATE;
-    return TRAN_STATUS;
+	Smith_model_t model;
+	float ambient;
+	if(!reflow_model_get(ao, &model, &ambient))
+	{
+		LOG("Oven model: not identified (%lu samples)\r\n", ao->model_rls.updates);
+		return;
+	}
+
+	/* SIMC PI tuning with closed-loop time constant equal to dead time, at least 4 samples. */
+	float tau_c = fmaxf(model.L, 4.0f * ao->sample_period);
+	float Kp = model.T / (model.K * (tau_c + model.L));
+	float Ti = fminf(model.T, 4.0f * (tau_c + model.L));
+	LOG("Oven model (%lu samples, error %.2f deg C): K: %.4f deg C/count\tT: %.1f s\tL: %.1f s\tAmbient: %.1f deg C\r\n"
+	    "Model-based PI gains: Kp %.3f Ki %.4f\r\n",
+	    ao->model_rls.updates, ao->model_rls.error, model.K, model.T, model.L, ambient, Kp, Kp / Ti);
 }
 
-static Reflow_Status Reflow_STOP(Reflow_Active *const ao, Event const *const evt)
+static inline void displayPwmCurve(Reflow_Active const *const ao)
 {
-    LOG("Reflow process stopped\r\n");
-    osTimerStop(ao->pid_timer_id);
-    ao->state = RESET_STATE; // Transition to RESET state.
-    return TRAN_STATUS;
+	Reflow_Pwm_Curve const *const curve = &ao->pwm_curve;
+	if(curve->valid == 0U)
+	{
+		LOG("PWM power curve: not calibrated, duty is the output\r\n");
+		return;
+	}
+	LOG("%-8s %8s %12s\r\n", "Duty %", "Power %", "Output duty");
+	for(uint8_t k = 0; k < PWMLIN_CAL_POINTS; k++)
+	{
+		uint16_t out = (uint16_t)(HEATER_OUT_MAX * k / (PWMLIN_CAL_POINTS - 1U));
+		LOG("%-8.1f %8.1f %12u\r\n", 100.0f * (float)k / (float)(PWMLIN_CAL_POINTS - 1U), 100.0f * curve->power[k],
+		    Pwmlin_Apply(&ao->pwm_lin, out));
+	}
 }
 
-static Reflow_Status Reflow_ignore(Reflow_Active *const ao, Event const *const evt)
+static inline void displayProfileParams(Reflow_Active const *const ao)
 {
-    return IGNORE_STATUS;
+    LOG("Profile: %s\r\n", ao->profile.name);
+    for (uint8_t i = 0; i < ao->profile.num_segments; i++)
+    {
+        Reflow_Segment const *const seg = &ao->profile.segments[i];
+        LOG("Segment %u\tRamp: %.2f deg C/s\tTarget: %.1f deg C\tDwell: %lu s\r\n",
+            i, seg->ramp_rate, seg->target, seg->dwell);
+    }
 }
 
-/* State machine table */
-static const ReflowAction Reflow_state_table[NUM_REFLOW_STATES][NUM_REFLOW_SIGS] = {
-    /*              INIT_SIG,    ENTRY_SIG,    START_REFLOW_SIG,    REACH_TIME_SIG,    REACH_TEMP_SIG,    STOP_REFLOW_SIG */
-    /* RESET  	*/ {Reflow_reset_INIT, Reflow_reset_ENTRY, Reflow_reset_START, Reflow_ignore, Reflow_ignore, Reflow_ignore},
-    /* PREHEAT 	*/ {Reflow_ignore, Reflow_preheat_ENTRY, Reflow_ignore, Reflow_ignore, Reflow_preheat_REACHTEMP, Reflow_STOP},
-    /* SOAK 	*/ {Reflow_ignore, Reflow_soak_ENTRY, Reflow_ignore, Reflow_soak_REACHTIME, Reflow_ignore, Reflow_STOP},
-    /* RAMPUP 	*/ {Reflow_ignore, Reflow_rampup_ENTRY, Reflow_ignore, Reflow_ignore, Reflow_rampup_REACHTEMP, Reflow_STOP},
-    /* PEAK 	*/ {Reflow_ignore, Reflow_peak_ENTRY, Reflow_ignore, Reflow_peak_REACHTIME, Reflow_ignore, Reflow_STOP},
-    /* COOLDOWN */ {Reflow_ignore, Reflow_cooldown_ENTRY, Reflow_ignore, Reflow_ignore, Reflow_cooldown_REACHTEMP, Reflow_STOP}};
-
-void reflow_init(Reflow_cfg_t const *const reflow_cfg)
+/**
+ * @brief Get current reflow state, RESET_STATE if no reflow process is running.
+ */
+static inline Reflow_State reflow_state(Reflow_Active const *const ao)
 {
-    /* Call active object constructor */
-    Active_ctor((Active *)&reflow_ao, (EventHandler)reflow_evt_handler);
-
-    /* Register PWM timer and enable preload register */
-    reflow_ao.pwm_timer_handle = reflow_cfg->pwm_timer_handle;
-    reflow_ao.pwm_channel = reflow_cfg->pwm_channel;
-    __HAL_TIM_ENABLE_OCxPRELOAD(reflow_ao.pwm_timer_handle, reflow_ao.pwm_channel);
-
-    /* Setup PID parameters */
-    static const PID_cfg_t reflow_pid_cfg = {.Kp = KP_INIT,
-                                             .Ki = KI_INIT,
-                                             .Kd = KD_INIT,
-                                             .tau = TAU_INIT,
-                                             .Ts = TS_INIT,
-                                             .out_max = OUT_MAX_INIT,
-                                             .out_min = OUT_MIN_INIT};
-    PID_Init(&reflow_ao.pid_params, &reflow_pid_cfg);
-
-    /* Initialize timer instances. */
-    TimeEvent_ctor(&reflow_ao.reflow_time_evt, REACH_TIME_SIG, (Active *)&reflow_ao);
-    reflow_ao.pid_timer_id = osTimerNew(reflow_pid_iteration, osTimerPeriodic, NULL, NULL);
-
-    /* Register reflow commands */
-    cmd_register(&reflow_client_info);
-
-    /* Initialize thermocouple IC */
-    MAX31855K_Init(&reflow_cfg->max_cfg);
-
-    LOGI(TAG, "Initialized reflow module.");
+    return (Reflow_State)ao->hsm.state->id;
 }
 
-void reflow_start()
+static inline void displayState(Reflow_Active const *const ao)
 {
-    osThreadAttr_t reflow_thread_attr = {.stack_size = REFLOW_THREAD_STACK_SZ};
-    Active_start((Active *)&reflow_ao, &reflow_thread_attr, 5, NULL);
+	if(reflow_state(ao) == RESET_STATE)
+	{
+		LOG("Current state: %s\r\n", reflow_names[RESET_STATE]);
+	}
+	else if(reflow_state(ao) == SCRIPT_STATE)
+	{
+		LOG("Current state: %s (%s, %.0f s)\r\n", reflow_names[SCRIPT_STATE], ao->script.def->name, ao->script.time);
+	}
+	else
+	{
+		LOG("Current state: %s (segment %u)\r\n", reflow_names[reflow_state(ao)], ao->segment);
+	}
 }
 
 /**
- * @brief Perform PID iteration.
+ * @brief Update control loop timing performance measurements.
+ *
+ * @param ao Reflow active object, prev_timestamp must not yet be updated.
+ * @param sample Sample being processed.
+ * @param pid_cycles DWT cycles spent in PID calculation.
  */
-static void reflow_pid_iteration(void *argument)
+static void reflow_update_pms(Reflow_Active *const ao, Sample_Event const *const sample, uint32_t pid_cycles, uint32_t periods)
 {
-	/* Read temperature */
-	float temp_reading = 0;
-	bool status = readTemperature(&temp_reading);
-	if(status == false)
+	/* Restart accumulators if pms were cleared through "reflow pm clear". */
+	if(ao->pms[CNT_SAMPLES] == 0)
 	{
-		LOGE(TAG, "Could not read temperature, aborting reflow process.");
-		Active_post(&reflow_ao.reflow_base, &stop_evt);
+		ao->jitter_sum_us = 0;
+		ao->jitter_cnt = 0;
 	}
+	INC_SAT_U16(ao->pms[CNT_SAMPLES]);
 
-	/* Check if temperature reached intended temperature of REACHTEMP phases.
-	 * If so, send REACHTEMP signal to reflow active object.
-	 */
-	if(reflow_ao.reflow_phases[reflow_ao.state - 1].phase_type == REACHTEMP)
+	uint32_t nominal_cycles = (uint32_t)(ao->sample_period * (float)periods * (float)SystemCoreClock) / Active_time_scale();
+
+	/* Read time */
+	uint16_t spi_us = cycles_to_us(sample->ready_timestamp - sample->timestamp);
+	ao->pms[SPI_TIME_LAST_US] = spi_us;
+	if(spi_us > ao->pms[SPI_TIME_MAX_US])
 	{
-		uint32_t reach_temp = reflow_ao.reflow_phases[reflow_ao.state - 1].reach_temp;
-		/* Give some leeway. */
-		if(reach_temp > (uint32_t)temp_reading - 2U && reach_temp < (uint32_t)temp_reading + 2U)
-		{
-			static const Event reachtemp_evt = { .sig = REACH_TEMP_SIG };
-			Active_post(&reflow_ao.reflow_base, &reachtemp_evt);
-		}
+		ao->pms[SPI_TIME_MAX_US] = spi_us;
 	}
-	else
+
+	/* PID compute time */
+	uint16_t pid_us = cycles_to_us(pid_cycles);
+	if(pid_us > ao->pms[PID_TIME_MAX_US])
 	{
-		/* Currently in a REACHTIME phase.
-	     * Update setpoint by a step to smooth out temperature change.
-	     */
-		reflow_ao.setpoint += reflow_ao.step_size;
+		ao->pms[PID_TIME_MAX_US] = pid_us;
 	}
 
-	/* Acquire new PWM output signal through feedback control. */
-	float pwm_value = PID_Calculate(&reflow_ao.pid_params, reflow_ao.setpoint, temp_reading);
+	/* Sample finished processing after next sample should have been triggered. */
+	bool missed = (DWT->CYCCNT - sample->timestamp) > nominal_cycles;
+
+	if(ao->prev_sample_valid)
+	{
+		uint32_t period_cycles = sample->timestamp - ao->prev_timestamp;
+		cmd_pm_record_hist(&ao->period_us, period_cycles / (SystemCoreClock / 1000000U));
+		uint32_t jitter_cycles = period_cycles > nominal_cycles ? period_cycles - nominal_cycles :
+		                                                          nominal_cycles - period_cycles;
+		uint16_t jitter_us = cycles_to_us(jitter_cycles);
 
-	/* Set PWM signal */
-	__HAL_TIM_SET_COMPARE(reflow_ao.pwm_timer_handle, reflow_ao.pwm_channel, (uint16_t)pwm_value);
+		if(ao->jitter_cnt == 0 || jitter_us < ao->pms[JITTER_MIN_US])
+		{
+			ao->pms[JITTER_MIN_US] = jitter_us;
+		}
+		if(jitter_us > ao->pms[JITTER_MAX_US])
+		{
+			ao->pms[JITTER_MAX_US] = jitter_us;
+		}
+		ao->jitter_sum_us += jitter_us;
+		ao->jitter_cnt++;
+		ao->pms[JITTER_MEAN_US] = (uint16_t)(ao->jitter_sum_us / ao->jitter_cnt);
 
+		/* Sample arrived more than half a period late. */
+		missed = missed || (period_cycles > nominal_cycles + nominal_cycles / 2);
+	}
 
-	LOGI(TAG, "%s %.2f %.2f %.2f %.2f %.2f %.2f",
-											 reflow_names[reflow_ao.state],
-											 reflow_ao.setpoint,
-											 temp_reading,
-											 reflow_ao.pid_params.proportional,
-											 reflow_ao.pid_params.integral,
-											 reflow_ao.pid_params.derivative,
-											 pwm_value);
+	if(missed)
+	{
+		INC_SAT_U16(ao->pms[CNT_MISSED_DEADLINES]);
+	}
 }
 
 /**
- * @brief Display PID, profile parameters, or both to user.
+ * @brief Output state, temperatures and zone controller parameters for host tooling.
+ *
+ * Zone fields are named <zone>.<field>. State and temperatures come from the status snapshot,
+ * so the reply never waits on a thermocouple read, age_ms is the age of its reading.
  */
-static uint32_t reflow_status_cmd(uint32_t argc, const char **argv)
+static void reflow_status_fields(Reflow_Active *const ao)
 {
-	displayPIDParams();
-	displayProfileParams();
-	displayState();
-	float oven_temp = 0;
-	if(readTemperature(&oven_temp))
+	Reflow_Status snap;
+	reflow_status_read(ao, &snap);
+	cmd_out_str("state", reflow_names[snap.state % NUM_REFLOW_STATES]);
+	cmd_out_u32("segment", snap.segment);
+	cmd_out_float("setpoint", snap.setpoint);
+	cmd_out_float("sample_period", ao->sample_period);
+	cmd_out_float("temp", snap.temp);
+	cmd_out_u32("age_ms", snap.acq_count != 0U ? osKernelGetTickCount() - snap.acq_tick : 0U);
+
+	char key[32];
+	for(uint8_t z = 0; z < snap.num_zones; z++)
 	{
-		LOG("Oven temperature: %.2f\r\n", oven_temp);
+		PID_t const *const pid = &ao->zone_pid[z];
+		const char *name = ao->zones[z].name;
+		snprintf(key, sizeof(key), "%s.temp", name);
+		cmd_out_float(key, snap.zone_temp[z]);
+		snprintf(key, sizeof(key), "%s.out", name);
+		cmd_out_float(key, snap.zone_out[z]);
+		snprintf(key, sizeof(key), "%s.Kp", name);
+		cmd_out_float(key, pid->Kp);
+		snprintf(key, sizeof(key), "%s.Ki", name);
+		cmd_out_float(key, pid->Ki);
+		snprintf(key, sizeof(key), "%s.Kd", name);
+		cmd_out_float(key, pid->Kd);
+		snprintf(key, sizeof(key), "%s.Kff", name);
+		cmd_out_float(key, pid->Kff);
+		snprintf(key, sizeof(key), "%s.Ts", name);
+		cmd_out_float(key, pid->Ts);
 	}
-	else
+	if(!isnan(snap.cooling_out))
 	{
-		LOG("Oven temperature read error: %s\r\n", MAX31855K_Err_Str());
+		cmd_out_float("fan.out", snap.cooling_out);
 	}
-    return 0;
-}
-
-static uint32_t reflow_start_cmd(uint32_t argc, const char **argv)
-{
-	static const Event start_evt = { .sig = START_REFLOW_SIG };
-	Active_post(&reflow_ao.reflow_base, &start_evt);
-	LOG("Posted START signal to reflow active object.\r\n");
-	return 0;
 }
 
-static uint32_t reflow_stop_cmd(uint32_t argc, const char **argv)
+/**
+ * @brief Convert DWT cycle count to microseconds, saturating at UINT16_MAX.
+ */
+static inline uint16_t cycles_to_us(uint32_t cycles)
 {
-	Active_post(&reflow_ao.reflow_base, &stop_evt);
-	LOG("Posted STOP signal to reflow active object.\r\n");
-	return 0;
+	uint32_t us = cycles / (SystemCoreClock / 1000000U);
+	return us > UINT16_MAX ? UINT16_MAX : (uint16_t)us;
 }
 
-static uint32_t reflow_set_cmd(uint32_t argc, const char **argv)
+/**
+ * @brief Read thermocouples into latest acquisition and get oven temperature, the mean of zone thermocouple
+ *        temperatures. Blocks on the SPI bus, only call from reflow thread while sampling is off.
+ *
+ * @param[in/out] temp Temperature reading if return value is true, unmodified otherwise.
+ *
+ * @return true if every thermocouple was read successfully, false otherwise.
+ */
+static inline bool readTemperature(Reflow_Active *const ao, float *const temp)
 {
-	if(argc % 2 != 0 || argc == 0)
+	if(ao->hil != REFLOW_HIL_OFF && !ao->hil_temp_valid)
 	{
-		LOG("Invalid number of arguments\r\n");
-		return -1;
+		return false;
 	}
 
-	/* Iterate through <param>,<value> pairs */
-	for(uint8_t i = 0; i < argc; i+=2)
+	Reflow_Latest acq = {.err = MAX_OK, .num_thermocouples = ao->num_thermocouples};
+	for(uint8_t i = 0; i < ao->num_thermocouples; i++)
 	{
-		const char *param = argv[i];
-		char** end_ptr;
-		uint32_t val = strtoul(argv[i + 1], end_ptr, 0);
-		if(strcasecmp(param, "Kp") == 0)
-		{
-
-			reflow_ao.pid_params.Kp = (float)val;
-			LOG("Updated Kp to %.2f\r\n", reflow_ao.pid_params.Kp);
-		}
-		else if(strcasecmp(param, "Kd") == 0)
+		if(ao->hil != REFLOW_HIL_OFF)
 		{
-
-			reflow_ao.pid_params.Kd = (float)val;
-			LOG("Updated Kd to %.2f\r\n", reflow_ao.pid_params.Kd);
+			acq.temp[i] = ao->hil_temp[i];
+			acq.raw[i] = acq.temp[i];
+			acq.cj[i] = NAN;
 		}
-		else if(strcasecmp(param, "Ki") == 0)
+		else if(MAX31855K_RxBlocking(&ao->thermocouples[i]) != MAX_OK)
 		{
-
-			reflow_ao.pid_params.Ki = (float)val;
-			LOG("Updated Ki to %.2f\r\n", reflow_ao.pid_params.Ki);
+			acq.err = ao->thermocouples[i].err;
+			acq.err_tc = i;
+			break;
 		}
-		else if(strcasecmp(param, "Tau") == 0)
+		else
 		{
-			reflow_ao.pid_params.tau = (float)val;
-			LOG("Updated tau to %.2f\r\n", reflow_ao.pid_params.tau);
+			acq.raw[i] = reflow_tc_temp(ao, &ao->thermocouples[i]);
+			acq.temp[i] = reflow_tc_cal(ao, i, acq.raw[i]);
+			acq.cj[i] = MAX31855K_Get_CJ(&ao->thermocouples[i]);
 		}
-		else
+	}
+	analog_read(&acq.analog);
+	reflow_latest_put(ao, &acq);
+	return reflow_latest_oven_temp(ao, &acq, temp);
+}
+
+/**
+ * @brief Store latest acquisition, stamped with its count and kernel tick.
+ *
+ * Interrupts are masked while writing, so thread readers never wait on a preempted writer.
+ *
+ * @param ao Reflow active object.
+ * @param src Acquisition, count and tick are ignored.
+ */
+static void reflow_latest_put(Reflow_Active *const ao, Reflow_Latest const *const src)
+{
+	uint32_t primask = __get_PRIMASK();
+	__disable_irq();
+	seqlock_write_begin(&ao->latest_lock);
+	uint32_t count = ao->latest.count + 1U;
+	ao->latest = *src;
+	ao->latest.count = count;
+	ao->latest.tick = osKernelGetTickCount();
+	seqlock_write_end(&ao->latest_lock);
+	__set_PRIMASK(primask);
+}
+
+/**
+ * @brief Copy latest acquisition without touching the SPI bus (thread context).
+ *
+ * @param ao Reflow active object.
+ * @param[out] dst Copy of latest acquisition, count is 0 if there was none yet.
+ */
+static void reflow_latest_get(Reflow_Active const *const ao, Reflow_Latest *const dst)
+{
+	uint32_t seq;
+	do
+	{
+		seq = seqlock_read_begin(&ao->latest_lock);
+		*dst = ao->latest;
+	} while(seqlock_read_retry(&ao->latest_lock, seq));
+}
+
+/**
+ * @brief Copy latest acquisition, having the reflow thread read thermocouples first while sampling is off.
+ *
+ * Only the reflow thread drives the SPI bus: while idle it takes one reading on REFRESH_SIG,
+ * which is waited for up to REFLOW_REFRESH_TIMEOUT_MS. While sampling, every sample is stored anyway.
+ *
+ * @param[out] dst Copy of latest acquisition.
+ *
+ * @return false if there was no acquisition yet.
+ */
+static bool reflow_latest_refresh(Reflow_Active *const ao, Reflow_Latest *const dst)
+{
+	reflow_latest_get(ao, dst);
+	if(reflow_state(ao) == RESET_STATE)
+	{
+		static const Event refresh_evt = {.sig = REFRESH_SIG};
+		uint32_t count = dst->count;
+		Active_post(&ao->reflow_base, &refresh_evt);
+		for(uint32_t waited = 0; dst->count == count && waited < REFLOW_REFRESH_TIMEOUT_MS; waited++)
 		{
-			LOG("Unrecognizable PID parameter: %s\r\n", param);
-			return -1;
+			osDelay(1);
+			reflow_latest_get(ao, dst);
 		}
 	}
+	return dst->count != 0U;
+}
 
-	return 0;
+/**
+ * @brief Store status snapshot of controller after an event.
+ *
+ * Interrupts are masked while writing, so a preempting reader never spins on a half-written snapshot.
+ *
+ * @param ao Reflow active object.
+ */
+static void reflow_status_put(Reflow_Active *const ao)
+{
+	Reflow_Latest acq;
+	reflow_latest_get(ao, &acq);
+	Reflow_State state = reflow_state(ao);
+	Reflow_Status snap = {.type = REFLOW_STATUS_TYPE,
+	                      .tick = osKernelGetTickCount(),
+	                      .state = (uint8_t)state,
+	                      .segment = ao->segment,
+	                      .num_zones = ao->num_zones,
+	                      .err = (uint8_t)acq.err,
+	                      .acq_count = acq.count,
+	                      .acq_tick = acq.tick,
+	                      .setpoint = ao->setpoint,
+	                      .script_time = state == SCRIPT_STATE ? ao->script.time : 0.0f,
+	                      .cooling_out = ao->has_fan ? ao->cooling.out : NAN,
+	                      .oven = ao->oven};
+	float temp = ao->temp;
+	if(state == RESET_STATE && !(acq.count != 0U && reflow_latest_oven_temp(ao, &acq, &temp)))
+	{
+		temp = NAN;
+	}
+	snap.temp = temp;
+	for(uint8_t z = 0; z < REFLOW_MAX_ZONES; z++)
+	{
+		snap.zone_temp[z] = z < ao->num_zones && state != RESET_STATE ? ao->zone_temp[z] : NAN;
+		snap.zone_out[z] = z < ao->num_zones ? ao->zone_out[z] : 0.0f;
+	}
+
+	uint32_t primask = __get_PRIMASK();
+	__disable_irq();
+	seqlock_write_begin(&ao->status_lock);
+	ao->status_snap = snap;
+	seqlock_write_end(&ao->status_lock);
+	__set_PRIMASK(primask);
 }
 
-static void reflow_evt_handler(Reflow_Active *const ao, Event const *const evt)
+/**
+ * @brief Send status snapshot as one telemetry frame, the record of "reflow status bin".
+ *
+ * @param ao Reflow active object.
+ */
+static void reflow_watch_send(Reflow_Active *const ao)
 {
-    /* Use state table to handle events */
-    ASSERT((ao->state < NUM_REFLOW_STATES) && (evt->sig < NUM_REFLOW_SIGS));
-    Reflow_Status stat = Reflow_state_table[ao->state][evt->sig](ao, evt);
+	/* Only the reflow thread writes the snapshot, no seqlock needed to copy it here. */
+	const Reflow_Status snap = ao->status_snap;
+	uint8_t frame[FRAME_ENCODED_SIZE(sizeof(snap))];
+	size_t len = frame_encode((const uint8_t *)&snap, sizeof(snap), frame, sizeof(frame));
+	console_telemetry_write((const char *)frame, len);
+}
 
-    /**
-	 * Execute entry action of current state if
-	 * state transition was taken.
-	 */
-    if (stat == TRAN_STATUS)
-    {
-        ASSERT(ao->state < NUM_REFLOW_STATES);
-        Reflow_state_table[ao->state][ENTRY_SIG](ao, (Event *)0);
-    }
-    else if (stat == INIT_STATUS)
-    {
-        /* Execute entry action of initial state. */
-        Reflow_state_table[ao->state][ENTRY_SIG](ao, (Event *)0);
-    }
+/**
+ * @brief Copy status snapshot of controller, requesting a reading for the next copy while idle (thread context).
+ *
+ * @param ao Reflow active object.
+ * @param[out] dst Copy of status snapshot.
+ */
+static void reflow_status_read(Reflow_Active *const ao, Reflow_Status *const dst)
+{
+	uint32_t seq;
+	do
+	{
+		seq = seqlock_read_begin(&ao->status_lock);
+		*dst = ao->status_snap;
+	} while(seqlock_read_retry(&ao->status_lock, seq));
+
+	if(dst->state == RESET_STATE)
+	{
+		static const Event refresh_evt = {.sig = REFRESH_SIG};
+		(void)Active_post(&ao->reflow_base, &refresh_evt);
+	}
 }
 
-static inline void displayPIDParams()
+void reflow_status_get(uint8_t oven, Reflow_Status *const dst)
 {
-    LOG("Kp: %.2f\tKi: %.2f\tKd: %.2f\tTau: %.2f\r\n"
-        "Sampling Period: %.2f s\tMax Limit: %.2f\tMin Limit: %.2f\r\n",
-        reflow_ao.pid_params.Kp, reflow_ao.pid_params.Ki, reflow_ao.pid_params.Kd,
-        reflow_ao.pid_params.tau, reflow_ao.pid_params.Ts,
-        reflow_ao.pid_params.out_lim_max, reflow_ao.pid_params.out_lim_min);
+	ASSERT(oven < REFLOW_NUM_OVENS);
+	reflow_status_read(&reflow_ovens[oven], dst);
 }
 
-static inline void displayProfileParams()
+bool reflow_idle(void)
 {
-    for (uint8_t i = 0; i < NUM_PROFILE_PHASES; i++)
-    {
-        LOG("Phase: %s\tType: %s\tReach Temp: %lu deg C\tReach Time: %lu s\r\n",
-            reflow_names[i + 1], reflow_ao.reflow_phases[i].phase_type == REACHTEMP ? "REACHTEMP" : "REACHTIME",
-            reflow_ao.reflow_phases[i].reach_temp,
-            reflow_ao.reflow_phases[i].reach_time);
-    }
+	for(uint8_t oven = 0; oven < REFLOW_NUM_OVENS; oven++)
+	{
+		Reflow_Active *const ao = &reflow_ovens[oven];
+		uint32_t seq;
+		uint8_t state;
+		do
+		{
+			seq = seqlock_read_begin(&ao->status_lock);
+			state = ao->status_snap.state;
+		} while(seqlock_read_retry(&ao->status_lock, seq));
+		if(state != RESET_STATE)
+		{
+			return false;
+		}
+	}
+	return true;
 }
 
-static inline void displayState()
+/**
+ * @brief Print status snapshot as a single line, formatted into one buffer and written at once.
+ *
+ * @param snap Status snapshot.
+ */
+static void reflow_status_brief(Reflow_Active const *const ao, Reflow_Status const *const snap)
 {
-	LOG("Current state: %s\r\n", reflow_names[reflow_ao.state]);
+	char line[REFLOW_STATUS_LINE_LEN];
+	size_t len = (size_t)snprintf(line, sizeof(line), "%s seg %u sp %.1f temp %.1f",
+	                              reflow_names[snap->state % NUM_REFLOW_STATES], snap->segment, snap->setpoint, snap->temp);
+	for(uint8_t z = 0; z < snap->num_zones && len < sizeof(line); z++)
+	{
+		len += (size_t)snprintf(&line[len], sizeof(line) - len, " %s %.1f/%.0f",
+		                        ao->zones[z].name, snap->zone_temp[z], snap->zone_out[z]);
+	}
+	if(len < sizeof(line) && !isnan(snap->cooling_out))
+	{
+		len += (size_t)snprintf(&line[len], sizeof(line) - len, " fan %.0f", snap->cooling_out);
+	}
+	if(len < sizeof(line))
+	{
+		(void)snprintf(&line[len], sizeof(line) - len, " acq %lu age %lu\r\n",
+		               snap->acq_count, snap->acq_count != 0U ? osKernelGetTickCount() - snap->acq_tick : 0U);
+	}
+	LOG("%s", line);
 }
 
 /**
- * @brief Read thermocouple temperature.
+ * @brief Oven temperature of acquisition, the mean of zone thermocouple temperatures.
  *
- * @param[in/out] temp Temperature reading if return value is true, unmodified otherwise.
+ * @param src Acquisition.
+ * @param[out] temp Oven temperature if return value is true, unmodified otherwise.
  *
- * @return true if successful read, false otherwise.
+ * @return true if every thermocouple was read successfully.
  */
-static inline bool readTemperature(float *const temp)
+static bool reflow_latest_oven_temp(Reflow_Active const *const ao, Reflow_Latest const *const src, float *const temp)
 {
-	MAX31855K_err_t err = MAX31855K_RxBlocking();
-	if(err)
+	if(src->err != MAX_OK)
 	{
 		return false;
 	}
-	else
+	float oven_temp = 0.0f;
+	for(uint8_t z = 0; z < ao->num_zones; z++)
+	{
+		oven_temp += reflow_zone_vote(ao, &ao->zones[z], src->temp);
+	}
+	*temp = oven_temp / (float)ao->num_zones;
+	return true;
+}
+
+/**
+ * @brief Median of zone thermocouple and its redundant thermocouples.
+ *
+ * @param zone Zone configuration.
+ * @param tc_temp Thermocouple temperatures, in scan order (deg C).
+ *
+ * @return Zone temperature (deg C), the zone thermocouple's without redundant ones.
+ */
+static float reflow_zone_vote(Reflow_Active const *const ao, Reflow_zone_cfg_t const *const zone, float const *const tc_temp)
+{
+	if(zone->vote_mask == 0U)
 	{
-		*temp = MAX31855K_Get_HJ();
-		return true;
+		return tc_temp[zone->thermocouple];
+	}
+	float vals[REFLOW_MAX_THERMOCOUPLES + 1];
+	uint32_t n = 0;
+	vals[n++] = tc_temp[zone->thermocouple];
+	for(uint8_t i = 0; i < ao->num_thermocouples; i++)
+	{
+		if((zone->vote_mask & (1U << i)) && i != zone->thermocouple)
+		{
+			vals[n++] = tc_temp[i];
+		}
 	}
+	return Fuse_Vote(vals, n);
 }
@@ -0,0 +1,70 @@
+/**
+ * @file rls.c
+ * @author Timothy Nguyen
+ * @brief Recursive least squares estimator with exponential forgetting.
+ * @version 0.1
+ * @date 2021-08-15
+ */
+
+#include <string.h>
+
+#include "rls.h"
+#include "log.h"
+#include "prof.h"
+
+void RLS_Init(RLS_t * const rls, float lambda, float p0)
+{
+	ASSERT(lambda > 0.0f && lambda <= 1.0f);
+
+	memset(rls, 0, sizeof(*rls));
+	rls->lambda = lambda;
+	for (uint32_t i = 0; i < RLS_N; i++)
+	{
+		rls->P[i][i] = p0;
+	}
+}
+
+void RLS_Update(RLS_t * const rls, const float phi[RLS_N], float y)
+{
+	PROF_BEGIN(rls_update);
+
+	/* P phi and phi' P phi */
+	float Pphi[RLS_N];
+	float denom = rls->lambda;
+	float prediction = 0.0f;
+	for (uint32_t i = 0; i < RLS_N; i++)
+	{
+		Pphi[i] = 0.0f;
+		for (uint32_t j = 0; j < RLS_N; j++)
+		{
+			Pphi[i] += rls->P[i][j] * phi[j];
+		}
+		denom += phi[i] * Pphi[i];
+		prediction += phi[i] * rls->theta[i];
+	}
+
+	/* Gain and parameter update */
+	float inv_denom = 1.0f / denom;
+	rls->error = y - prediction;
+	float trace = 0.0f;
+	for (uint32_t i = 0; i < RLS_N; i++)
+	{
+		rls->theta[i] += Pphi[i] * inv_denom * rls->error;
+		trace += rls->P[i][i];
+	}
+
+	/* Covariance update, forgetting only while covariance is bounded. */
+	float inv_lambda = trace < RLS_TRACE_MAX ? 1.0f / rls->lambda : 1.0f;
+	for (uint32_t i = 0; i < RLS_N; i++)
+	{
+		for (uint32_t j = i; j < RLS_N; j++)
+		{
+			float p = (rls->P[i][j] - Pphi[i] * Pphi[j] * inv_denom) * inv_lambda;
+			rls->P[i][j] = p;
+			rls->P[j][i] = p;
+		}
+	}
+	rls->updates++;
+
+	PROF_END(rls_update);
+}
@@ -0,0 +1,364 @@
+/**
+ * @file rtc.c
+ * @author Timothy Nguyen
+ * @brief Wall-clock time from the RTC calendar, clocked by the LSE.
+ * @version 0.1
+ * @date 2021-09-01
+ */
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+#include "rtc.h"
+#include "cmd.h"
+#include "log.h"
+#include "printf.h"
+#include "stm32l4xx.h"
+#include "stm32l4xx_hal.h"
+
+////////////////////////////////////////////////////////////////////////////////
+// Common macros
+////////////////////////////////////////////////////////////////////////////////
+
+/* Write protection keys */
+#define RTC_WPR_KEY1 0xCAU
+#define RTC_WPR_KEY2 0x53U
+#define RTC_WPR_LOCK 0xFFU
+
+#define RTC_SECS_PER_DAY 86400U
+#define RTC_DAYS_TO_2000 730425U // Days from 0000-03-01 to 2000-01-01, proleptic Gregorian.
+#define RTC_DAYS_MAX 36525U      // Days from 2000-01-01 to 2100-01-01.
+
+////////////////////////////////////////////////////////////////////////////////
+// Type definitions
+////////////////////////////////////////////////////////////////////////////////
+
+/* Broken-down calendar time */
+typedef struct
+{
+    uint32_t year;   // 2000 to 2099.
+    uint32_t month;  // 1 to 12.
+    uint32_t day;    // 1 to 31.
+    uint32_t hour;   // 0 to 23.
+    uint32_t minute; // 0 to 59.
+    uint32_t second; // 0 to 59.
+} rtc_civil_t;
+
+/* RTC state */
+typedef struct
+{
+    bool running; // LSE and RTC run, registers are accessible.
+    bool set;     // Calendar was set, now or before the last reset.
+} rtc_t;
+
+////////////////////////////////////////////////////////////////////////////////
+// Private (static) function declarations
+////////////////////////////////////////////////////////////////////////////////
+
+static mod_err_t rtc_wait(__IO uint32_t *reg, uint32_t mask, uint32_t timeout_ms); // Wait for bits to be set.
+static uint32_t rtc_days(uint32_t year, uint32_t month, uint32_t day);             // Days since 2000-01-01.
+static void rtc_civil(uint32_t sec, rtc_civil_t *const civil);                      // Break down seconds since 2000.
+static const char *rtc_parse_num(const char *s, char sep, uint32_t max, uint32_t *val); // Parse field followed by sep.
+
+static inline uint32_t bcd_to_bin(uint32_t bcd) { return (bcd >> 4) * 10U + (bcd & 0xFU); }
+static inline uint32_t bin_to_bcd(uint32_t bin) { return ((bin / 10U) << 4) | (bin % 10U); }
+
+/* Command callback functions */
+static uint32_t cmd_rtc_status(uint32_t argc, const char **argv); // Display wall-clock time.
+static uint32_t cmd_rtc_set(uint32_t argc, const char **argv);    // Set wall-clock time.
+
+////////////////////////////////////////////////////////////////////////////////
+// Private (static) variables
+////////////////////////////////////////////////////////////////////////////////
+
+/* RTC state */
+static rtc_t rtc;
+
+/* RTC command information. */
+static cmd_cmd_info rtc_cmds[] = {
+    {.cmd_name = "status",
+     .cb = cmd_rtc_status,
+     .help = "Display wall-clock time used by log timestamps."},
+    {.cmd_name = "set",
+     .cb = cmd_rtc_set,
+     .help = "Set wall-clock time, usage: rtc set <YYYY-MM-DD> <hh:mm:ss>."}};
+
+/* RTC module client info */
+CMD_CLIENT_DEFINE(rtc,
+                  .num_cmds = sizeof(rtc_cmds) / sizeof(rtc_cmds[0]),
+                  .cmds = rtc_cmds);
+
+/* Unique tag for RTC module. */
+LOG_TAG_DEFINE("RTC");
+
+////////////////////////////////////////////////////////////////////////////////
+// Public (global) functions
+////////////////////////////////////////////////////////////////////////////////
+
+mod_err_t rtc_init(void)
+{
+    SET_BIT(RCC->APB1ENR1, RCC_APB1ENR1_PWREN);
+    (void)RCC->APB1ENR1;
+    SET_BIT(PWR->CR1, PWR_CR1_DBP); // RTC lives in backup domain.
+
+    if (!(RCC->BDCR & RCC_BDCR_LSERDY))
+    {
+        SET_BIT(RCC->BDCR, RCC_BDCR_LSEON);
+        if (rtc_wait(&RCC->BDCR, RCC_BDCR_LSERDY, RTC_LSE_TIMEOUT_MS) != MOD_OK)
+        {
+            LOGW(TAG, "LSE did not start, log timestamps stay uptime.");
+            return MOD_ERR_PERIPH;
+        }
+    }
+
+    /* Changing the clock source takes a backup domain reset, which would also clear the
+     * watchdog record in the backup registers. */
+    uint32_t rtcsel = RCC->BDCR & RCC_BDCR_RTCSEL;
+    if (rtcsel != 0U && rtcsel != RCC_BDCR_RTCSEL_0)
+    {
+        LOGW(TAG, "RTC runs from another clock than the LSE, log timestamps stay uptime.");
+        return MOD_ERR_PERIPH;
+    }
+    MODIFY_REG(RCC->BDCR, RCC_BDCR_RTCSEL, RCC_BDCR_RTCSEL_0);
+    SET_BIT(RCC->BDCR, RCC_BDCR_RTCEN);
+
+    RTC->WPR = RTC_WPR_KEY1;
+    RTC->WPR = RTC_WPR_KEY2;
+    SET_BIT(RTC->CR, RTC_CR_BYPSHAD);
+    RTC->WPR = RTC_WPR_LOCK;
+
+    rtc.running = true;
+    rtc.set = (RTC->ISR & RTC_ISR_INITS) != 0U;
+    if (rtc.set)
+    {
+        char text[RTC_TEXT_LEN];
+        uint32_t sec, ms;
+        rtc_read(&sec, &ms);
+        rtc_format(sec, text, sizeof(text));
+        LOGI(TAG, "Wall-clock time %s", text);
+    }
+    else
+    {
+        LOGI(TAG, "RTC not set, enter \"rtc set\" for wall-clock log timestamps.");
+    }
+    return MOD_OK;
+}
+
+bool rtc_read(uint32_t *const sec, uint32_t *const ms)
+{
+    if (!rtc.running || !rtc.set)
+    {
+        return false;
+    }
+
+    /* Counters are read directly, so read until two reads agree. */
+    uint32_t ssr, tr, dr;
+    do
+    {
+        ssr = RTC->SSR;
+        tr = RTC->TR;
+        dr = RTC->DR;
+    } while (ssr != RTC->SSR || tr != RTC->TR || dr != RTC->DR);
+
+    uint32_t days = rtc_days(2000U + bcd_to_bin((dr >> 16) & 0xFFU), bcd_to_bin((dr >> 8) & 0x1FU),
+                             bcd_to_bin(dr & 0x3FU));
+    *sec = days * RTC_SECS_PER_DAY + bcd_to_bin((tr >> 16) & 0x3FU) * 3600U +
+           bcd_to_bin((tr >> 8) & 0x7FU) * 60U + bcd_to_bin(tr & 0x7FU);
+
+    /* Sub-second register counts down from PREDIV_S. */
+    uint32_t prediv_s = RTC->PRER & RTC_PRER_PREDIV_S;
+    *ms = ssr <= prediv_s ? (prediv_s - ssr) * 1000U / (prediv_s + 1U) : 0U;
+    return true;
+}
+
+mod_err_t rtc_set(uint32_t sec)
+{
+    if (sec / RTC_SECS_PER_DAY >= RTC_DAYS_MAX)
+    {
+        return MOD_ERR_ARG;
+    }
+    if (!rtc.running)
+    {
+        return MOD_ERR_PERIPH;
+    }
+
+    rtc_civil_t civil;
+    rtc_civil(sec, &civil);
+    uint32_t weekday = (sec / RTC_SECS_PER_DAY + 5U) % 7U + 1U; // 2000-01-01 was a Saturday, Monday is 1.
+
+    RTC->WPR = RTC_WPR_KEY1;
+    RTC->WPR = RTC_WPR_KEY2;
+    SET_BIT(RTC->ISR, RTC_ISR_INIT);
+    if (rtc_wait(&RTC->ISR, RTC_ISR_INITF, RTC_INIT_TIMEOUT_MS) != MOD_OK)
+    {
+        CLEAR_BIT(RTC->ISR, RTC_ISR_INIT);
+        RTC->WPR = RTC_WPR_LOCK;
+        return MOD_ERR_PERIPH;
+    }
+    RTC->TR = (bin_to_bcd(civil.hour) << 16) | (bin_to_bcd(civil.minute) << 8) | bin_to_bcd(civil.second);
+    RTC->DR = (bin_to_bcd(civil.year - 2000U) << 16) | (weekday << 13) | (bin_to_bcd(civil.month) << 8) |
+              bin_to_bcd(civil.day);
+    CLEAR_BIT(RTC->ISR, RTC_ISR_INIT); // Calendar starts counting.
+    RTC->WPR = RTC_WPR_LOCK;
+
+    rtc.set = true;
+    return MOD_OK;
+}
+
+void rtc_format(uint32_t sec, char *buf, size_t size)
+{
+    rtc_civil_t civil;
+    rtc_civil(sec, &civil);
+    snprintf(buf, size, "%04lu-%02lu-%02lu %02lu:%02lu:%02lu", civil.year, civil.month, civil.day,
+             civil.hour, civil.minute, civil.second);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Private (static) functions
+////////////////////////////////////////////////////////////////////////////////
+
+/**
+ * @brief Wait for register bits to be set.
+ *
+ * @return MOD_OK if set, MOD_ERR_TIMEOUT otherwise.
+ */
+static mod_err_t rtc_wait(__IO uint32_t *reg, uint32_t mask, uint32_t timeout_ms)
+{
+    uint32_t start = HAL_GetTick();
+    while ((*reg & mask) != mask)
+    {
+        if (HAL_GetTick() - start > timeout_ms)
+        {
+            return MOD_ERR_TIMEOUT;
+        }
+    }
+    return MOD_OK;
+}
+
+/**
+ * @brief Count days since 2000-01-01, years starting in March so leap days come last.
+ */
+static uint32_t rtc_days(uint32_t year, uint32_t month, uint32_t day)
+{
+    year -= month <= 2U;
+    uint32_t era = year / 400U;
+    uint32_t yoe = year - era * 400U;                                         // Year of era.
+    uint32_t doy = (153U * (month > 2U ? month - 3U : month + 9U) + 2U) / 5U + day - 1U; // Day of year.
+    uint32_t doe = yoe * 365U + yoe / 4U - yoe / 100U + doy;                  // Day of era.
+    return era * 146097U + doe - RTC_DAYS_TO_2000;
+}
+
+/**
+ * @brief Break down seconds since 2000-01-01 into calendar time, inverse of rtc_days().
+ */
+static void rtc_civil(uint32_t sec, rtc_civil_t *const civil)
+{
+    uint32_t days = sec / RTC_SECS_PER_DAY + RTC_DAYS_TO_2000;
+    uint32_t secs = sec % RTC_SECS_PER_DAY;
+    uint32_t era = days / 146097U;
+    uint32_t doe = days - era * 146097U;
+    uint32_t yoe = (doe - doe / 1460U + doe / 36524U - doe / 146096U) / 365U;
+    uint32_t doy = doe - (365U * yoe + yoe / 4U - yoe / 100U);
+    uint32_t mp = (5U * doy + 2U) / 153U;
+    civil->day = doy - (153U * mp + 2U) / 5U + 1U;
+    civil->month = mp < 10U ? mp + 3U : mp - 9U;
+    civil->year = yoe + era * 400U + (civil->month <= 2U);
+    civil->hour = secs / 3600U;
+    civil->minute = secs / 60U % 60U;
+    civil->second = secs % 60U;
+}
+
+/**
+ * @brief Parse decimal field of a date or time.
+ *
+ * @param s Field text.
+ * @param sep Character expected after field, '\0' for the last one.
+ * @param max Largest accepted value.
+ * @param[out] val Field value.
+ *
+ * @return Text after separator, NULL if field is malformed or above max.
+ */
+static const char *rtc_parse_num(const char *s, char sep, uint32_t max, uint32_t *val)
+{
+    char *end;
+    unsigned long num = strtoul(s, &end, 10);
+    if (end == s || *end != sep || num > max)
+    {
+        return NULL;
+    }
+    *val = (uint32_t)num;
+    return end + (sep != '\0');
+}
+
+/**
+ * @brief Display wall-clock time.
+ *
+ * @param argc Number of arguments.
+ * @param argv Argument values.
+ *
+ * @return 0 if successful.
+ */
+static uint32_t cmd_rtc_status(uint32_t argc, const char **argv)
+{
+    char text[RTC_TEXT_LEN];
+    uint32_t sec, ms;
+    if (!rtc_read(&sec, &ms))
+    {
+        cmd_out_str("time", rtc.running ? "not set" : "no RTC");
+        return 0;
+    }
+    rtc_format(sec, text, sizeof(text));
+    cmd_out_str("time", text);
+    return 0;
+}
+
+/**
+ * @brief Set wall-clock time.
+ *
+ * @param argc Number of arguments.
+ * @param argv Argument values.
+ *
+ * @return 0 if successful, 1 otherwise.
+ *
+ * TTYS command format: > rtc set <YYYY-MM-DD> <hh:mm:ss>.
+ */
+static uint32_t cmd_rtc_set(uint32_t argc, const char **argv)
+{
+    rtc_civil_t civil;
+    const char *s = argc == 2 ? argv[0] : NULL;
+    s = s != NULL ? rtc_parse_num(s, '-', 2099U, &civil.year) : NULL;
+    s = s != NULL ? rtc_parse_num(s, '-', 12U, &civil.month) : NULL;
+    s = s != NULL ? rtc_parse_num(s, '\0', 31U, &civil.day) : NULL;
+    const char *t = s != NULL ? argv[1] : NULL;
+    t = t != NULL ? rtc_parse_num(t, ':', 23U, &civil.hour) : NULL;
+    t = t != NULL ? rtc_parse_num(t, ':', 59U, &civil.minute) : NULL;
+    t = t != NULL ? rtc_parse_num(t, '\0', 59U, &civil.second) : NULL;
+    if (t == NULL || civil.year < 2000U || civil.month == 0U || civil.day == 0U)
+    {
+        LOG("Usage: rtc set <YYYY-MM-DD> <hh:mm:ss>, years 2000 to 2099\r\n");
+        return 1;
+    }
+
+    /* Day past the end of its month would roll over, reject it rather than surprise. */
+    uint32_t days = rtc_days(civil.year, civil.month, civil.day);
+    uint32_t sec = days * RTC_SECS_PER_DAY + civil.hour * 3600U + civil.minute * 60U + civil.second;
+    rtc_civil_t check;
+    rtc_civil(sec, &check);
+    if (check.day != civil.day)
+    {
+        LOG("Day %lu is past the end of month %lu\r\n", civil.day, civil.month);
+        return 1;
+    }
+
+    mod_err_t err = rtc_set(sec);
+    if (err != MOD_OK)
+    {
+        LOG("Could not set RTC (%d)\r\n", err);
+        return 1;
+    }
+    char text[RTC_TEXT_LEN];
+    rtc_format(sec, text, sizeof(text));
+    LOG("Wall-clock time set to %s\r\n", text);
+    return 0;
+}
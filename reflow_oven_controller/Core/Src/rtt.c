@@ -0,0 +1,270 @@
+/**
+ * @file rtt.c
+ * @author Timothy Nguyen
+ * @brief Memory-mapped console channel read and written by the debug probe (SEGGER RTT layout).
+ * @version 0.1
+ * @date 2021-09-14
+ */
+
+#include <stdbool.h>
+#include <string.h>
+
+#include "rtt.h"
+
+#if RTT_ENABLE
+
+#include "stm32l4xx_hal.h"
+#include "cmsis_os.h"
+#include "cmd.h"
+#include "log.h"
+#include "console.h"
+
+////////////////////////////////////////////////////////////////////////////////
+// Common macros
+////////////////////////////////////////////////////////////////////////////////
+
+#define RTT_MODE_NO_BLOCK_SKIP 0U // Buffer flags: host tools treat the buffer as dropping writes that do not fit.
+
+////////////////////////////////////////////////////////////////////////////////
+// Type definitions
+////////////////////////////////////////////////////////////////////////////////
+
+/**
+ * @brief Ring buffer descriptor, layout of SEGGER_RTT_BUFFER_UP/DOWN.
+ *
+ * The producer only writes wr, the consumer only rd, both are offsets into buf.
+ * The buffer is empty when they are equal and holds at most size - 1 bytes.
+ */
+typedef struct
+{
+    const char *name;     // Channel name shown by host tools.
+    char *buf;            // Storage.
+    uint32_t size;        // Bytes of storage.
+    volatile uint32_t wr; // Offset of next byte written by producer.
+    volatile uint32_t rd; // Offset of next byte read by consumer.
+    uint32_t flags;       // Behavior when full (RTT_MODE_x).
+} RTT_buffer_t;
+
+/**
+ * @brief Control block, layout of SEGGER_RTT_CB.
+ */
+typedef struct
+{
+    char id[16];          // "SEGGER RTT", written last so a probe never finds a partial block.
+    int32_t num_up;       // Number of up buffers.
+    int32_t num_down;     // Number of down buffers.
+    RTT_buffer_t up[1];   // Target to host.
+    RTT_buffer_t down[1]; // Host to target.
+} RTT_cb_t;
+
+/**
+ * @brief List of RTT performance measurements.
+ */
+typedef enum
+{
+    CNT_TX_BUF_OVERRUN, // Up buffer overrun count.
+    CNT_RX_BUF_OVERRUN, // Down buffer characters dropped because console buffer was full.
+
+    NUM_U32_PMS // Number of performance measurements
+} RTT_pms_t;
+
+////////////////////////////////////////////////////////////////////////////////
+// Private (static) function declarations
+////////////////////////////////////////////////////////////////////////////////
+
+static inline uint32_t buf_free(const RTT_buffer_t *b); // Free bytes of up buffer.
+#if CONSOLE_RTT
+static void rtt_poll(void *arg); // Post characters of down buffer to console, timer callback.
+#endif
+
+////////////////////////////////////////////////////////////////////////////////
+// Private (static) variables
+////////////////////////////////////////////////////////////////////////////////
+
+/* Buffer storage */
+static char up_buf[RTT_UP_BUF_SIZE];
+static char down_buf[RTT_DOWN_BUF_SIZE];
+
+/* Whether control block was initialized */
+static bool initialized;
+
+#if CONSOLE_RTT
+/* Down buffer poll timer */
+static osTimerId_t poll_timer;
+static StaticTimer_t poll_timer_cb;
+#endif
+
+/* Performance measurement counters */
+static uint32_t rtt_pms[NUM_U32_PMS];
+static uint64_t rtt_rx_bytes; // Received bytes passed to console.
+static uint64_t rtt_tx_bytes; // Bytes written to up buffer.
+
+/* Performance measurement info */
+static const cmd_pm_info rtt_pm_info[] = {
+    {"TX BUF ORE", CMD_PM_U32, &rtt_pms[CNT_TX_BUF_OVERRUN]},
+    {"RX BUF ORE", CMD_PM_U32, &rtt_pms[CNT_RX_BUF_OVERRUN]},
+    {"RX bytes", CMD_PM_U64, &rtt_rx_bytes},
+    {"TX bytes", CMD_PM_U64, &rtt_tx_bytes}};
+
+/* Command module client info */
+CMD_CLIENT_DEFINE(rtt,
+                  .num_cmds = 0,
+                  .cmds = NULL,
+                  .num_pms = sizeof(rtt_pm_info) / sizeof(rtt_pm_info[0]),
+                  .pms = rtt_pm_info);
+
+/* Unique tag for logging module */
+LOG_TAG_DEFINE("RTT");
+
+////////////////////////////////////////////////////////////////////////////////
+// Public (global) variables and externs
+////////////////////////////////////////////////////////////////////////////////
+
+/* Control block, named as SEGGER's so host tools locate it by symbol. */
+RTT_cb_t _SEGGER_RTT;
+
+////////////////////////////////////////////////////////////////////////////////
+// Public (global) functions
+////////////////////////////////////////////////////////////////////////////////
+
+mod_err_t rtt_init(void)
+{
+    RTT_cb_t *cb = &_SEGGER_RTT;
+    memset(cb, 0, sizeof(*cb));
+    cb->num_up = 1;
+    cb->num_down = 1;
+    cb->up[0] = (RTT_buffer_t){.name = "Terminal", .buf = up_buf, .size = sizeof(up_buf), .flags = RTT_MODE_NO_BLOCK_SKIP};
+    cb->down[0] = (RTT_buffer_t){.name = "Terminal", .buf = down_buf, .size = sizeof(down_buf), .flags = RTT_MODE_NO_BLOCK_SKIP};
+
+    /* Probes scan RAM for the whole ID, so it must not appear before the block is complete,
+     * nor anywhere else in RAM: it is assembled in place from two parts. */
+    __DMB();
+    memcpy(&cb->id[7], "RTT", 4);
+    __DMB();
+    memcpy(&cb->id[0], "SEGGER ", 7);
+    __DMB();
+
+    initialized = true;
+    return MOD_OK;
+}
+
+mod_err_t rtt_start(void)
+{
+    if (!initialized)
+    {
+        return MOD_ERR_NOT_INIT;
+    }
+#if CONSOLE_RTT
+    static const osTimerAttr_t timer_attr = {.name = "rtt", .cb_mem = &poll_timer_cb, .cb_size = sizeof(poll_timer_cb)};
+    poll_timer = osTimerNew(rtt_poll, osTimerPeriodic, NULL, &timer_attr);
+    ASSERT(poll_timer != NULL);
+    osTimerStart(poll_timer, pdMS_TO_TICKS(RTT_POLL_MS));
+#endif
+    LOGI(TAG, "Started RTT channel at %p", (void *)&_SEGGER_RTT);
+    return MOD_OK;
+}
+
+mod_err_t rtt_write(const char *buf, size_t len)
+{
+    if (!initialized)
+    {
+        return MOD_ERR_NOT_INIT;
+    }
+
+    RTT_buffer_t *up = &_SEGGER_RTT.up[0];
+    mod_err_t err = MOD_OK;
+
+    uint32_t primask = __get_PRIMASK();
+    __disable_irq();
+
+    /* Commit whole block or nothing, unless it could never fit. */
+    uint32_t room = buf_free(up);
+    uint32_t pushed = 0;
+    if (len <= room || len > up->size - 1U)
+    {
+        pushed = len < room ? len : room;
+    }
+    uint32_t wr = up->wr;
+    uint32_t first = up->size - wr < pushed ? up->size - wr : pushed;
+    memcpy(&up->buf[wr], buf, first);
+    memcpy(up->buf, buf + first, pushed - first);
+    __DMB(); // Bytes must be visible before the probe observes the write offset.
+    up->wr = (wr + pushed) % up->size;
+
+    rtt_tx_bytes += pushed; // Interrupts already masked.
+    if (pushed < len)
+    {
+        INC_SAT_U32(rtt_pms[CNT_TX_BUF_OVERRUN]);
+        err = MOD_ERR_BUF_OVERRUN;
+    }
+
+    __set_PRIMASK(primask);
+
+    return err;
+}
+
+size_t rtt_tx_free(void)
+{
+    if (!initialized)
+    {
+        return 0;
+    }
+    return buf_free(&_SEGGER_RTT.up[0]);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Private (static) functions
+////////////////////////////////////////////////////////////////////////////////
+
+/**
+ * @brief Get free bytes of buffer, from the view of its producer.
+ *
+ * @param b Buffer.
+ *
+ * @return Bytes that can be written without reaching the read offset.
+ */
+static inline uint32_t buf_free(const RTT_buffer_t *b)
+{
+    uint32_t rd = b->rd;
+    uint32_t wr = b->wr;
+    return rd > wr ? rd - wr - 1U : b->size - 1U - (wr - rd);
+}
+
+#if CONSOLE_RTT
+/**
+ * @brief Post characters the probe wrote to down buffer to the console.
+ *
+ * The end of the characters plays the role of an idle receive line.
+ *
+ * @param arg Unused.
+ */
+static void rtt_poll(void *arg)
+{
+    (void)arg;
+    RTT_buffer_t *down = &_SEGGER_RTT.down[0];
+    uint32_t rd = down->rd;
+    uint32_t wr = down->wr;
+    if (rd == wr)
+    {
+        return;
+    }
+    __DMB(); // Read write offset before the bytes it covers.
+
+    while (rd != wr)
+    {
+        if (console_post(CONSOLE_SESSION_RTT, down->buf[rd]) == MOD_ERR_TIMEOUT)
+        {
+            INC_SAT_U32(rtt_pms[CNT_RX_BUF_OVERRUN]);
+        }
+        else
+        {
+            cmd_pm_add_u64(&rtt_rx_bytes, 1);
+        }
+        rd = (rd + 1U) % down->size;
+    }
+    down->rd = rd;
+    console_rx_idle(CONSOLE_SESSION_RTT);
+}
+#endif
+
+#endif
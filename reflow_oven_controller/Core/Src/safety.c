@@ -0,0 +1,611 @@
+/**
+ * @file safety.c
+ * @author Timothy Nguyen
+ * @brief Safety supervisor: thermal runaway and sensor fault trips forcing heaters off.
+ * @version 0.1
+ * @date 2021-08-26
+ */
+
+#include <math.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "safety.h"
+#include "active.h"
+#include "reflow.h"
+#include "MAX31855K.h"
+#include "cmd.h"
+#include "log.h"
+#include "param.h"
+#include "prio.h"
+#include "sections.h"
+#include "cmsis_os.h"
+#include "stm32l4xx.h"
+
+////////////////////////////////////////////////////////////////////////////////
+// Common macros
+////////////////////////////////////////////////////////////////////////////////
+
+#define RISE_HIST_LEN (SAFETY_RISE_WINDOW + 1U) // Samples kept for rate of rise.
+
+////////////////////////////////////////////////////////////////////////////////
+// Type definitions
+////////////////////////////////////////////////////////////////////////////////
+
+/* Safety active object private signals, published signals must not collide. */
+enum SafetySignal
+{
+    SAFETY_CLEAR_SIG = NUM_REFLOW_SIGS, // Release latched trip.
+    SAFETY_MANUAL_SIG,                  // Trip on request.
+};
+
+/* Watched heater */
+typedef struct
+{
+    Heater_t *heater;     // Heater forced off on trip.
+    uint8_t thermocouple; // Thermocouple measuring heater.
+    float sat_time;       // Time at full output (s).
+    float sat_temp;       // Thermocouple temperature when full output began (deg C).
+} Safety_heater_t;
+
+/* Supervision of one oven, checked on its own samples and tripped on its own */
+typedef struct
+{
+    Safety_heater_t heaters[SAFETY_MAX_HEATERS]; // Watched heaters.
+    uint8_t num_heaters;                         // Number of watched heaters.
+
+    /* Rate of rise history, oldest sample at hist_head */
+    float hist_temp[RISE_HIST_LEN][REFLOW_MAX_THERMOCOUPLES]; // Thermocouple temperatures (deg C).
+    float hist_dt[RISE_HIST_LEN];                             // Time since preceding sample (s).
+    uint8_t hist_head;                                        // Index of oldest sample.
+    uint8_t hist_count;                                       // Number of samples held.
+    uint32_t prev_timestamp;                                  // DWT cycle count of previous sample.
+    float rise[REFLOW_MAX_THERMOCOUPLES];                     // Last rate of rise (deg C/s).
+
+    /* Latched trip */
+    volatile bool tripped;  // Heaters are forced off.
+    safety_reason_t reason; // Cause of trip.
+    uint8_t tc;             // Thermocouple that caused trip.
+    float value;            // Temperature, rate or rise that caused trip.
+    uint32_t trips;         // Trips since reset.
+    Trip_Event trip_evt;    // Published on trip.
+
+    /* Sensor fault ride-through */
+    uint8_t faults;  // Consecutive samples with transient thermocouple errors.
+    uint32_t ridden; // Samples with transient errors skipped since reset.
+} Safety_oven_t;
+
+/* Safety active object */
+typedef struct
+{
+    Active base; // Inherited base Active object class.
+
+    Safety_oven_t ovens[REFLOW_NUM_OVENS]; // Supervision of every oven.
+
+    /* Open heater check, one current sensor carries the heaters of every oven */
+    float open_time;         // Time with heater current too low for output (s).
+    uint32_t open_timestamp; // DWT cycle count of previous sample checked.
+    bool open_timed;         // open_timestamp belongs to a sample within SAFETY_GAP_S.
+} Safety_Active;
+
+////////////////////////////////////////////////////////////////////////////////
+// Private (static) function declarations
+////////////////////////////////////////////////////////////////////////////////
+
+static void safety_evt_handler(Safety_Active *const ao, Event const *const evt); // Event handler.
+static void safety_check(Safety_Active *const ao, Sample_Event const *const sample); // Check sample against limits.
+static void safety_open_check(Safety_Active *const ao, Sample_Event const *const sample); // Check heater current.
+static void safety_trip(Safety_Active *const ao, uint8_t oven, safety_reason_t reason, uint8_t tc, float value); // Force heaters off.
+static void safety_clear(Safety_Active *const ao, uint8_t oven);                  // Release latched trip.
+static void safety_history_reset(Safety_oven_t *const so);                        // Restart rate of rise window.
+
+/* Command callback functions */
+static uint32_t cmd_safety_status(uint32_t argc, const char **argv); // Display limits and trip state.
+static uint32_t cmd_safety_clear(uint32_t argc, const char **argv);  // Release latched trip.
+static uint32_t cmd_safety_trip(uint32_t argc, const char **argv);   // Trip on request.
+
+static void safety_limit_changed(param_def_t const *def); // Log changed limit.
+
+////////////////////////////////////////////////////////////////////////////////
+// Private (static) variables
+////////////////////////////////////////////////////////////////////////////////
+
+/* Safety active object. */
+static Safety_Active safety_ao;
+
+/* Statically allocated thread and event ring */
+static StaticTask_t safety_thread_cb;
+static uint64_t SRAM2_BSS safety_stack[ACTIVE_STACK_STORAGE_SZ(SAFETY_THREAD_STACK_SZ) / sizeof(uint64_t)];
+static Active_msg safety_ring[SAFETY_EVENT_MSG_COUNT];
+
+/* Static events, trip events are per oven */
+static const Event clear_evt = {.sig = SAFETY_CLEAR_SIG};
+static const Event manual_evt = {.sig = SAFETY_MANUAL_SIG};
+
+/* Limits, parameters read by the safety thread on every sample. They can only be made stricter than the defaults. */
+static float max_temp = SAFETY_MAX_TEMP;
+static float max_rise = SAFETY_MAX_RISE;
+static float sat_time = SAFETY_SAT_TIME_S;
+static float sat_min_rise = SAFETY_SAT_MIN_RISE;
+static float open_min_a = SAFETY_OPEN_MIN_A;
+
+PARAM_DEFINE(PARAM_SAFETY_MAX_TEMP, "safety.max_temp", PARAM_FLOAT, &max_temp, PARAM_FLAG_PERSIST,
+             .def.f = SAFETY_MAX_TEMP, .min.f = 100.0f, .max.f = SAFETY_MAX_TEMP, .on_change = safety_limit_changed);
+PARAM_DEFINE(PARAM_SAFETY_MAX_RISE, "safety.max_rise", PARAM_FLOAT, &max_rise, PARAM_FLAG_PERSIST,
+             .def.f = SAFETY_MAX_RISE, .min.f = 0.5f, .max.f = SAFETY_MAX_RISE, .on_change = safety_limit_changed);
+PARAM_DEFINE(PARAM_SAFETY_SAT_TIME, "safety.sat_time", PARAM_FLOAT, &sat_time, PARAM_FLAG_PERSIST,
+             .def.f = SAFETY_SAT_TIME_S, .min.f = 10.0f, .max.f = SAFETY_SAT_TIME_S, .on_change = safety_limit_changed);
+PARAM_DEFINE(PARAM_SAFETY_SAT_MIN_RISE, "safety.sat_min_rise", PARAM_FLOAT, &sat_min_rise, PARAM_FLAG_PERSIST,
+             .def.f = SAFETY_SAT_MIN_RISE, .min.f = SAFETY_SAT_MIN_RISE, .max.f = 4.0f * SAFETY_SAT_MIN_RISE, .on_change = safety_limit_changed);
+PARAM_DEFINE(PARAM_SAFETY_OPEN_MIN_A, "safety.open_min_a", PARAM_FLOAT, &open_min_a, PARAM_FLAG_PERSIST,
+             .def.f = SAFETY_OPEN_MIN_A, .min.f = SAFETY_OPEN_MIN_A, .max.f = 50.0f, .on_change = safety_limit_changed);
+
+/* Trip reason names, indexed by safety_reason_t */
+static const char *reason_names[SAFETY_NUM_REASONS] = {"none", "sensor fault", "over-temperature",
+                                                       "runaway", "no rise", "manual", "open heater"};
+
+/* Safety command information. */
+static cmd_cmd_info safety_cmds[] = {
+    {.cmd_name = "status",
+     .cb = cmd_safety_status,
+     .help = "Display safety limits, and rates of rise and latched trip of every oven."},
+    {.cmd_name = "clear",
+     .cb = cmd_safety_clear,
+     .help = "Release latched trip of every oven whose reflow process has stopped."},
+    {.cmd_name = "trip",
+     .cb = cmd_safety_trip,
+     .help = "Force heaters of every oven off through safety path, for testing."}};
+
+/* Safety module client info */
+CMD_CLIENT_DEFINE(safety,
+                  .num_cmds = sizeof(safety_cmds) / sizeof(safety_cmds[0]),
+                  .cmds = safety_cmds);
+
+/* Unique tag for safety module. */
+LOG_TAG_DEFINE("SAFETY");
+
+////////////////////////////////////////////////////////////////////////////////
+// Public (global) functions
+////////////////////////////////////////////////////////////////////////////////
+
+mod_err_t safety_init(void)
+{
+    mod_err_t err = Active_ctor((Active *)&safety_ao, (EventHandler)safety_evt_handler);
+    if (err != MOD_OK)
+    {
+        return err;
+    }
+    Active_subscribe((Active *)&safety_ao, SAMPLE_READY_SIG);
+    for (uint8_t oven = 0; oven < REFLOW_NUM_OVENS; oven++)
+    {
+        Safety_oven_t *const so = &safety_ao.ovens[oven];
+        so->trip_evt = (Trip_Event){.base = {.sig = SAFETY_TRIP_SIG}, .oven = oven};
+        safety_history_reset(so);
+    }
+
+    /* Above every other thread, samples are checked before the reflow controller uses them. */
+    static const osThreadAttr_t thread_attr = {.name = "safety",
+                                               .cb_mem = &safety_thread_cb,
+                                               .cb_size = sizeof(safety_thread_cb),
+                                               .stack_mem = safety_stack,
+                                               .stack_size = sizeof(safety_stack)};
+    err = Active_start_ring((Active *)&safety_ao, PRIO_SAFETY, &thread_attr, safety_ring, SAFETY_EVENT_MSG_COUNT);
+    if (err != MOD_OK)
+    {
+        return err;
+    }
+    return MOD_OK;
+}
+
+mod_err_t safety_watch(uint8_t oven, Heater_t *const heater, uint8_t thermocouple)
+{
+    ASSERT(oven < REFLOW_NUM_OVENS);
+    Safety_oven_t *const so = &safety_ao.ovens[oven];
+    if (so->num_heaters >= SAFETY_MAX_HEATERS)
+    {
+        return MOD_ERR_RESOURCE;
+    }
+    so->heaters[so->num_heaters++] = (Safety_heater_t){.heater = heater, .thermocouple = thermocouple};
+    LOGI(TAG, "Safety supervisor watching heater %u of oven %u, thermocouple %u.", so->num_heaters - 1U, oven, thermocouple);
+    return MOD_OK;
+}
+
+bool safety_tripped(uint8_t oven)
+{
+    ASSERT(oven < REFLOW_NUM_OVENS);
+    return safety_ao.ovens[oven].tripped;
+}
+
+void safety_force_off(void)
+{
+    for (uint8_t oven = 0; oven < REFLOW_NUM_OVENS; oven++)
+    {
+        Safety_oven_t const *const so = &safety_ao.ovens[oven];
+        for (uint8_t h = 0; h < so->num_heaters; h++)
+        {
+            Heater_Trip(so->heaters[h].heater);
+        }
+    }
+}
+
+safety_reason_t safety_reason(uint8_t oven)
+{
+    ASSERT(oven < REFLOW_NUM_OVENS);
+    return safety_ao.ovens[oven].reason;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Private (static) functions
+////////////////////////////////////////////////////////////////////////////////
+
+/**
+ * @brief Safety active object event handler.
+ */
+static void safety_evt_handler(Safety_Active *const ao, Event const *const evt)
+{
+    switch (evt->sig)
+    {
+    case SAMPLE_READY_SIG:
+        safety_check(ao, (Sample_Event const *)evt);
+        break;
+
+    case SAFETY_CLEAR_SIG:
+        for (uint8_t oven = 0; oven < REFLOW_NUM_OVENS; oven++)
+        {
+            safety_clear(ao, oven);
+        }
+        break;
+
+    case SAFETY_MANUAL_SIG:
+        for (uint8_t oven = 0; oven < REFLOW_NUM_OVENS; oven++)
+        {
+            safety_trip(ao, oven, SAFETY_MANUAL, 0, 0.0f);
+        }
+        break;
+
+    default:
+        break;
+    }
+}
+
+/**
+ * @brief Check thermocouple sample against the limits of its oven, tripping on the first violation.
+ *
+ * @param ao Safety active object.
+ * @param sample Published thermocouple sample.
+ */
+static void safety_check(Safety_Active *const ao, Sample_Event const *const sample)
+{
+    ASSERT(sample->oven < REFLOW_NUM_OVENS);
+    Safety_oven_t *const so = &ao->ovens[sample->oven];
+    uint8_t oven = sample->oven;
+
+    if (sample->err != MAX_OK)
+    {
+        if (!MAX31855K_Err_Transient(sample->err) || so->faults >= REFLOW_RIDE_SAMPLES)
+        {
+            safety_trip(ao, oven, SAFETY_SENSOR_FAULT, sample->err_tc, (float)sample->err);
+            return;
+        }
+        so->faults++;
+        so->ridden++;
+    }
+    else
+    {
+        so->faults = 0;
+    }
+
+    /* Thermocouples that read correctly are checked even in a sample with a transient error. */
+    uint8_t num_tcs = sample->num_thermocouples;
+    for (uint8_t i = 0; i < num_tcs; i++)
+    {
+        if (!(sample->err_mask & (1U << i)) && sample->temp[i] > max_temp)
+        {
+            safety_trip(ao, oven, SAFETY_OVER_TEMP, i, sample->temp[i]);
+            return;
+        }
+    }
+
+    /* The remaining checks span samples, a sample with an error is left out of their history. */
+    if (sample->err != MAX_OK)
+    {
+        return;
+    }
+
+    /* Sampling stops between runs, a gap starts a new window. */
+    float dt = Active_cycles_to_s(sample->timestamp - so->prev_timestamp);
+    so->prev_timestamp = sample->timestamp;
+    if (so->hist_count > 0 && dt > SAFETY_GAP_S)
+    {
+        safety_history_reset(so);
+    }
+
+    /* Rate of rise over the window ending at this sample. */
+    uint8_t idx = (so->hist_head + so->hist_count) % RISE_HIST_LEN;
+    if (so->hist_count == RISE_HIST_LEN)
+    {
+        so->hist_head = (so->hist_head + 1U) % RISE_HIST_LEN;
+    }
+    else
+    {
+        so->hist_count++;
+    }
+    so->hist_dt[idx] = so->hist_count > 1 ? dt : 0.0f;
+    for (uint8_t i = 0; i < num_tcs; i++)
+    {
+        so->hist_temp[idx][i] = sample->temp[i];
+    }
+    if (so->hist_count == RISE_HIST_LEN)
+    {
+        float span = 0.0f;
+        for (uint8_t k = 1; k < RISE_HIST_LEN; k++)
+        {
+            span += so->hist_dt[(so->hist_head + k) % RISE_HIST_LEN];
+        }
+        for (uint8_t i = 0; i < num_tcs && span > 0.0f; i++)
+        {
+            so->rise[i] = (sample->temp[i] - so->hist_temp[so->hist_head][i]) / span;
+            if (so->rise[i] > max_rise)
+            {
+                safety_trip(ao, oven, SAFETY_RUNAWAY, i, so->rise[i]);
+                return;
+            }
+        }
+    }
+
+    /* Saturated heaters must raise their temperature. */
+    for (uint8_t h = 0; h < so->num_heaters; h++)
+    {
+        Safety_heater_t *const sh = &so->heaters[h];
+        float temp = sample->temp[sh->thermocouple];
+        if (!sh->heater->enabled || sh->heater->out < HEATER_OUT_MAX)
+        {
+            sh->sat_time = 0.0f;
+            continue;
+        }
+        if (sh->sat_time == 0.0f)
+        {
+            sh->sat_temp = temp;
+        }
+        sh->sat_time += so->hist_count > 1 ? dt : 0.0f;
+        if (temp - sh->sat_temp >= sat_min_rise)
+        {
+            /* Heater is effective, restart from here. */
+            sh->sat_time = 0.0f;
+        }
+        else if (sh->sat_time > sat_time)
+        {
+            safety_trip(ao, oven, SAFETY_NO_RISE, sh->thermocouple, temp - sh->sat_temp);
+            return;
+        }
+    }
+
+    safety_open_check(ao, sample);
+}
+
+/**
+ * @brief Check heater current against the combined output of every oven's heaters.
+ *
+ * @param ao Safety active object.
+ * @param sample Published thermocouple sample, of any oven.
+ */
+static void safety_open_check(Safety_Active *const ao, Sample_Event const *const sample)
+{
+    /* Samples of every oven advance the check, a gap restarts it like the rate of rise window. */
+    float dt = Active_cycles_to_s(sample->timestamp - ao->open_timestamp);
+    dt = ao->open_timed && dt <= SAFETY_GAP_S ? dt : 0.0f;
+    ao->open_timestamp = sample->timestamp;
+    ao->open_timed = true;
+
+    /* One current sensor carries every heater, compare it with their combined output. */
+    float out = 0.0f;
+    uint8_t tc = 0;
+    for (uint8_t oven = 0; oven < REFLOW_NUM_OVENS; oven++)
+    {
+        Safety_oven_t const *const so = &ao->ovens[oven];
+        for (uint8_t h = 0; h < so->num_heaters; h++)
+        {
+            Heater_t const *const heater = so->heaters[h].heater;
+            if (heater->enabled && !heater->tripped)
+            {
+                out += (float)heater->out / (float)HEATER_OUT_MAX;
+                tc = so->heaters[h].thermocouple;
+            }
+        }
+    }
+    float full_a = sample->analog.current / out;
+    if (isnan(sample->analog.current) || out < SAFETY_OPEN_MIN_OUT || full_a >= open_min_a)
+    {
+        ao->open_time = 0.0f;
+    }
+    else
+    {
+        ao->open_time += dt;
+        if (ao->open_time > SAFETY_OPEN_TIME_S)
+        {
+            /* The sensor cannot tell which heater is open, every oven stops. */
+            for (uint8_t oven = 0; oven < REFLOW_NUM_OVENS; oven++)
+            {
+                safety_trip(ao, oven, SAFETY_OPEN_HEATER, tc, full_a);
+            }
+        }
+    }
+}
+
+/**
+ * @brief Force every watched heater of oven off at once, latch trip and notify its reflow controller.
+ *
+ * @param ao Safety active object.
+ * @param oven Oven tripped.
+ * @param reason Trip reason.
+ * @param tc Thermocouple that caused trip.
+ * @param value Temperature, rate, rise or error code that caused trip.
+ */
+static void safety_trip(Safety_Active *const ao, uint8_t oven, safety_reason_t reason, uint8_t tc, float value)
+{
+    Safety_oven_t *const so = &ao->ovens[oven];
+    for (uint8_t h = 0; h < so->num_heaters; h++)
+    {
+        Heater_Trip(so->heaters[h].heater);
+    }
+    if (so->tripped)
+    {
+        return; // First reason is kept.
+    }
+
+    so->tripped = true;
+    so->reason = reason;
+    so->tc = tc;
+    so->value = value;
+    so->trips++;
+    Active_publish(&so->trip_evt.base);
+
+    switch (reason)
+    {
+    case SAFETY_SENSOR_FAULT:
+        LOGE(TAG, "Oven %u tripped: thermocouple %u fault (%s), heaters off.", oven, tc, MAX31855K_Err_Str((MAX31855K_err_t)value));
+        break;
+    case SAFETY_OVER_TEMP:
+        LOGE(TAG, "Oven %u tripped: thermocouple %u at %.1f deg C, heaters off.", oven, tc, value);
+        break;
+    case SAFETY_RUNAWAY:
+        LOGE(TAG, "Oven %u tripped: thermocouple %u rising %.2f deg C/s, heaters off.", oven, tc, value);
+        break;
+    case SAFETY_NO_RISE:
+        LOGE(TAG, "Oven %u tripped: thermocouple %u rose %.1f deg C in %.0f s at full output, heaters off.",
+             oven, tc, value, sat_time);
+        break;
+    case SAFETY_OPEN_HEATER:
+        LOGE(TAG, "Oven %u tripped: heater current %.2f A at full output for %.0f s, heaters off.", oven, value, SAFETY_OPEN_TIME_S);
+        break;
+    default:
+        LOGE(TAG, "Oven %u tripped: %s, heaters off.", oven, reason_names[reason]);
+        break;
+    }
+}
+
+/**
+ * @brief Release latched trip of oven if every watched heater of it is disabled.
+ *
+ * @param ao Safety active object.
+ * @param oven Oven to clear.
+ */
+static void safety_clear(Safety_Active *const ao, uint8_t oven)
+{
+    Safety_oven_t *const so = &ao->ovens[oven];
+    if (!so->tripped)
+    {
+        return;
+    }
+    for (uint8_t h = 0; h < so->num_heaters; h++)
+    {
+        if (so->heaters[h].heater->enabled)
+        {
+            LOGW(TAG, "Oven %u heaters still enabled, trip not cleared.", oven);
+            return;
+        }
+    }
+    for (uint8_t h = 0; h < so->num_heaters; h++)
+    {
+        Heater_Clear_Trip(so->heaters[h].heater);
+        so->heaters[h].sat_time = 0.0f;
+    }
+    ao->open_time = 0.0f;
+    ao->open_timed = false;
+    safety_history_reset(so);
+    so->tripped = false;
+    so->reason = SAFETY_OK;
+    LOGI(TAG, "Oven %u trip cleared.", oven);
+}
+
+/**
+ * @brief Restart rate of rise window, next sample is its first.
+ *
+ * @param so Supervision of oven.
+ */
+static void safety_history_reset(Safety_oven_t *const so)
+{
+    so->hist_head = 0;
+    so->hist_count = 0;
+    for (uint8_t i = 0; i < REFLOW_MAX_THERMOCOUPLES; i++)
+    {
+        so->rise[i] = 0.0f;
+    }
+}
+
+/**
+ * @brief Log changed safety limit, limits apply from the next sample.
+ *
+ * @param def Changed parameter.
+ */
+static void safety_limit_changed(param_def_t const *def)
+{
+    LOGW(TAG, "Limit %s now %.2f.", def->name, param_get(def).f);
+}
+
+/**
+ * @brief Display safety limits, and rates of rise and latched trip of every oven.
+ *
+ * @param argc Number of arguments.
+ * @param argv Argument values.
+ *
+ * @return 0 if successful.
+ */
+static uint32_t cmd_safety_status(uint32_t argc, const char **argv)
+{
+    cmd_out_float("max temp", max_temp);
+    cmd_out_float("max rise", max_rise);
+    cmd_out_float("open min a", open_min_a);
+    cmd_out_float("open s", safety_ao.open_time);
+
+    for (uint8_t oven = 0; oven < REFLOW_NUM_OVENS; oven++)
+    {
+        Safety_oven_t const *const so = &safety_ao.ovens[oven];
+        cmd_out_u32("oven", oven);
+        cmd_out_str("state", so->tripped ? "tripped" : "armed");
+        cmd_out_str("reason", reason_names[so->reason]);
+        cmd_out_u32("thermocouple", so->tc);
+        cmd_out_float("value", so->value);
+        cmd_out_u32("trips", so->trips);
+        cmd_out_u32("faults ridden", so->ridden);
+
+        LOG("%-6s %10s\r\n", "TC", "Rise C/s");
+        for (uint8_t i = 0; i < REFLOW_MAX_THERMOCOUPLES; i++)
+        {
+            LOG("%-6u %10.2f\r\n", i, so->rise[i]);
+        }
+        LOG("%-6s %4s %7s %10s\r\n", "Heater", "TC", "Output", "Sat s");
+        for (uint8_t h = 0; h < so->num_heaters; h++)
+        {
+            Safety_heater_t const *const sh = &so->heaters[h];
+            LOG("%-6u %4u %7u %10.1f\r\n", h, sh->thermocouple, sh->heater->out, sh->sat_time);
+        }
+    }
+    return 0;
+}
+
+/**
+ * @brief Release latched trip, handled by safety active object.
+ *
+ * @param argc Number of arguments.
+ * @param argv Argument values.
+ *
+ * @return 0 if successful, 1 if request could not be posted.
+ */
+static uint32_t cmd_safety_clear(uint32_t argc, const char **argv)
+{
+    return Active_post((Active *)&safety_ao, &clear_evt) == MOD_OK ? 0 : 1;
+}
+
+/**
+ * @brief Trip through the same path as a detected fault.
+ *
+ * @param argc Number of arguments.
+ * @param argv Argument values.
+ *
+ * @return 0 if successful, 1 if request could not be posted.
+ */
+static uint32_t cmd_safety_trip(uint32_t argc, const char **argv)
+{
+    return Active_postUrgent((Active *)&safety_ao, &manual_evt) == MOD_OK ? 0 : 1;
+}
@@ -0,0 +1,313 @@
+/**
+ * @file scope.c
+ * @author Timothy Nguyen
+ * @brief Live variable scope: registered variables sampled once per control iteration into binary frames.
+ * @version 0.1
+ * @date 2021-09-06
+ */
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <string.h>
+#include <strings.h>
+
+#include "scope.h"
+#include "cmd.h"
+#include "log.h"
+#include "console.h"
+#include "frame.h"
+#include "stm32l4xx.h"
+
+////////////////////////////////////////////////////////////////////////////////
+// Type definitions
+////////////////////////////////////////////////////////////////////////////////
+
+/* Sample frame payload header, raw values follow */
+typedef struct __attribute__((packed))
+{
+    uint8_t type;       // SCOPE_TELEMETRY_TYPE.
+    uint32_t timestamp; // Sample time (ms).
+    uint8_t num_vars;   // Number of values.
+} scope_hdr_t;
+
+/* Selection, written by command thread and copied by sampling thread with interrupts masked */
+typedef struct
+{
+    uint8_t num_vars;             // Number of selected variables.
+    uint8_t div;                  // Sample every div calls, 0 when stopped.
+    uint8_t vars[SCOPE_MAX_VARS]; // Indices of selected variables in scope_vars, in frame order.
+} scope_sel_t;
+
+////////////////////////////////////////////////////////////////////////////////
+// Private (static) function declarations
+////////////////////////////////////////////////////////////////////////////////
+
+/* Command callback functions */
+static uint32_t cmd_scope_list(uint32_t argc, const char **argv);   // List registered variables.
+static uint32_t cmd_scope_add(uint32_t argc, const char **argv);    // Select variables.
+static uint32_t cmd_scope_remove(uint32_t argc, const char **argv); // Deselect variables.
+static uint32_t cmd_scope_rate(uint32_t argc, const char **argv);   // Show or set sampling divider.
+
+static const scope_var_t *scope_find(const char *name); // Find registered variable by name.
+
+////////////////////////////////////////////////////////////////////////////////
+// Private (static) variables
+////////////////////////////////////////////////////////////////////////////////
+
+/* Byte sizes of variable types */
+static const uint8_t type_sizes[NUM_SCOPE_TYPES] = {1, 2, 4, 2, 4, 4};
+
+/* Names of variable types, as listed to host tooling */
+static const char *const type_names[NUM_SCOPE_TYPES] = {"u8", "u16", "u32", "i16", "i32", "float"};
+
+/* Current selection */
+static scope_sel_t sel;
+
+/* Calls since last sample, sampling thread only. */
+static uint8_t div_count;
+
+/* Scope command information. */
+static cmd_cmd_info scope_cmds[] = {
+    {.cmd_name = "list",
+     .cb = cmd_scope_list,
+     .help = "List registered variables with their types, selected ones marked with their frame position."},
+    {.cmd_name = "add",
+     .cb = cmd_scope_add,
+     .help = "Append variables to frames.\r\nUsage: scope add <name>..."},
+    {.cmd_name = "remove",
+     .cb = cmd_scope_remove,
+     .help = "Remove variables from frames.\r\nUsage: scope remove <name>... | all"},
+    {.cmd_name = "rate",
+     .cb = cmd_scope_rate,
+     .help = "Show or set sampling, every div-th control iteration, 0 stops frames.\r\nUsage: scope rate [div]"}};
+
+/* Scope module client info */
+CMD_CLIENT_DEFINE(scope,
+                  .num_cmds = ARRAY_SIZE(scope_cmds),
+                  .cmds = scope_cmds,
+                  .num_u16_pms = 0,
+                  .u16_pms = NULL,
+                  .u16_pm_names = NULL);
+
+/* Unique tag for scope module. */
+LOG_TAG_DEFINE("SCOPE");
+
+////////////////////////////////////////////////////////////////////////////////
+// Public (global) functions
+////////////////////////////////////////////////////////////////////////////////
+
+mod_err_t scope_init(void)
+{
+    /* Selections hold indices in a byte, names must be unique to select by them. */
+    ASSERT(__stop_scope_vars - __start_scope_vars <= UINT8_MAX);
+    for (const scope_var_t *var = __start_scope_vars; var < __stop_scope_vars; var++)
+    {
+        ASSERT(var->type < NUM_SCOPE_TYPES);
+        ASSERT(scope_find(var->name) == var);
+    }
+
+    LOGI(TAG, "Initialized scope module, %u variables", (unsigned)(__stop_scope_vars - __start_scope_vars));
+    return MOD_OK;
+}
+
+void scope_sample(uint32_t timestamp)
+{
+    if (sel.div == 0U)
+    {
+        return;
+    }
+    if (++div_count < sel.div)
+    {
+        return;
+    }
+    div_count = 0;
+
+    uint32_t primask = __get_PRIMASK();
+    __disable_irq();
+    scope_sel_t cur = sel;
+    __set_PRIMASK(primask);
+
+    uint8_t payload[sizeof(scope_hdr_t) + SCOPE_MAX_VARS * sizeof(uint32_t)];
+    const scope_hdr_t hdr = {.type = SCOPE_TELEMETRY_TYPE, .timestamp = timestamp, .num_vars = cur.num_vars};
+    memcpy(payload, &hdr, sizeof(hdr));
+    size_t len = sizeof(hdr);
+    for (uint32_t i = 0; i < cur.num_vars; i++)
+    {
+        const scope_var_t *var = &__start_scope_vars[cur.vars[i]];
+        memcpy(&payload[len], var->addr, type_sizes[var->type]);
+        len += type_sizes[var->type];
+    }
+
+    uint8_t frame[FRAME_ENCODED_SIZE(sizeof(payload))];
+    size_t frame_len = frame_encode(payload, len, frame, sizeof(frame));
+    console_telemetry_write((const char *)frame, frame_len);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Private (static) functions
+////////////////////////////////////////////////////////////////////////////////
+
+/**
+ * @brief Find registered variable by name, case insensitively.
+ *
+ * @return Variable, NULL if none is registered under name.
+ */
+static const scope_var_t *scope_find(const char *name)
+{
+    for (const scope_var_t *var = __start_scope_vars; var < __stop_scope_vars; var++)
+    {
+        if (strcasecmp(var->name, name) == 0)
+        {
+            return var;
+        }
+    }
+    return NULL;
+}
+
+/**
+ * @brief List registered variables, selected ones with their position in frames.
+ *
+ * @param argc Number of arguments.
+ * @param argv Argument values.
+ *
+ * @return 0 if successful, 1 otherwise.
+ */
+static uint32_t cmd_scope_list(uint32_t argc, const char **argv)
+{
+    LOG("%-4s %-16s %-6s\r\n", "Pos", "Name", "Type");
+    for (const scope_var_t *var = __start_scope_vars; var < __stop_scope_vars; var++)
+    {
+        uint8_t idx = (uint8_t)(var - __start_scope_vars);
+        int32_t pos = -1;
+        for (uint32_t i = 0; i < sel.num_vars; i++)
+        {
+            if (sel.vars[i] == idx)
+            {
+                pos = (int32_t)i;
+            }
+        }
+        if (pos >= 0)
+        {
+            LOG("%-4ld %-16s %-6s\r\n", pos, var->name, type_names[var->type]);
+        }
+        else
+        {
+            LOG("%-4s %-16s %-6s\r\n", "-", var->name, type_names[var->type]);
+        }
+    }
+    return 0;
+}
+
+/**
+ * @brief Append variables to frames, none is added unless all are known and fit.
+ *
+ * @param argc Number of arguments.
+ * @param argv Argument values.
+ *
+ * @return 0 if successful, 1 otherwise.
+ */
+static uint32_t cmd_scope_add(uint32_t argc, const char **argv)
+{
+    if (argc == 0)
+    {
+        LOG("Format: scope add <name>...\r\n");
+        return 1;
+    }
+
+    scope_sel_t next = sel;
+    for (uint32_t a = 0; a < argc; a++)
+    {
+        const scope_var_t *var = scope_find(argv[a]);
+        if (var == NULL)
+        {
+            LOG("No variable named %s, see \"scope list\"\r\n", argv[a]);
+            return 1;
+        }
+        if (next.num_vars >= SCOPE_MAX_VARS)
+        {
+            LOG("At most %u variables\r\n", SCOPE_MAX_VARS);
+            return 1;
+        }
+        next.vars[next.num_vars++] = (uint8_t)(var - __start_scope_vars);
+    }
+
+    uint32_t primask = __get_PRIMASK();
+    __disable_irq();
+    sel.num_vars = next.num_vars;
+    memcpy(sel.vars, next.vars, sizeof(sel.vars));
+    __set_PRIMASK(primask);
+    return 0;
+}
+
+/**
+ * @brief Remove variables from frames, later ones move up.
+ *
+ * @param argc Number of arguments.
+ * @param argv Argument values.
+ *
+ * @return 0 if successful, 1 otherwise.
+ */
+static uint32_t cmd_scope_remove(uint32_t argc, const char **argv)
+{
+    if (argc == 0)
+    {
+        LOG("Format: scope remove <name>... | all\r\n");
+        return 1;
+    }
+
+    scope_sel_t next = sel;
+    if (argc == 1 && strcasecmp(argv[0], "all") == 0)
+    {
+        next.num_vars = 0;
+    }
+    for (uint32_t a = 0; a < argc && next.num_vars > 0U; a++)
+    {
+        const scope_var_t *var = scope_find(argv[a]);
+        uint8_t kept = 0;
+        for (uint32_t i = 0; i < next.num_vars; i++)
+        {
+            if (var == NULL || next.vars[i] != (uint8_t)(var - __start_scope_vars))
+            {
+                next.vars[kept++] = next.vars[i];
+            }
+        }
+        if (kept == next.num_vars)
+        {
+            LOG("%s is not selected\r\n", argv[a]);
+        }
+        next.num_vars = kept;
+    }
+
+    uint32_t primask = __get_PRIMASK();
+    __disable_irq();
+    sel.num_vars = next.num_vars;
+    memcpy(sel.vars, next.vars, sizeof(sel.vars));
+    __set_PRIMASK(primask);
+    return 0;
+}
+
+/**
+ * @brief Show or set sampling divider.
+ *
+ * @param argc Number of arguments.
+ * @param argv Argument values.
+ *
+ * @return 0 if successful, 1 otherwise.
+ */
+static uint32_t cmd_scope_rate(uint32_t argc, const char **argv)
+{
+    cmd_arg_val arg_vals[1];
+    if (cmd_parse_args(argc, argv, "[u", arg_vals) < 0 || (argc == 1 && arg_vals[0].val.u > UINT8_MAX))
+    {
+        LOG("Format: scope rate [div], div at most %u\r\n", UINT8_MAX);
+        return 1;
+    }
+    if (argc == 1)
+    {
+        sel.div = (uint8_t)arg_vals[0].val.u;
+    }
+
+    cmd_out_u32("div", sel.div);
+    cmd_out_u32("vars", sel.num_vars);
+    return 0;
+}
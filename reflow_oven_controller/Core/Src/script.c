@@ -0,0 +1,126 @@
+/**
+ * @file script.c
+ * @author Timothy Nguyen
+ * @brief Scripted reflow profiles: sequential profile logic run as a protothread, one step per sample.
+ * @version 0.1
+ * @date 2021-09-06
+ */
+
+#include <math.h>
+#include <stddef.h>
+#include <strings.h>
+
+#include "script.h"
+#include "common.h"
+#include "log.h"
+
+/* Unique tag for logging module */
+LOG_TAG_DEFINE("SCRIPT");
+
+static pt_status_t script_soak(Script_t *const s); // Adaptive soak profile.
+
+/* Built-in scripts */
+static const Script_def_t scripts[] = {
+	{.name = "soak",
+	 .help = "Sn63/Pb37 with timed-out preheat and peak, soak shortened after a slow preheat.",
+	 .fn = script_soak},
+};
+
+Script_def_t const *Script_Find(const char *name)
+{
+	for (uint32_t i = 0; i < ARRAY_SIZE(scripts); i++)
+	{
+		if (strcasecmp(scripts[i].name, name) == 0)
+		{
+			return &scripts[i];
+		}
+	}
+	return NULL;
+}
+
+Script_def_t const *Script_Get(uint32_t index)
+{
+	return index < ARRAY_SIZE(scripts) ? &scripts[index] : NULL;
+}
+
+void Script_Init(Script_t *const s, Script_def_t const *def, void *ctx, float start_temp)
+{
+	*s = (Script_t){.def = def, .ctx = ctx, .temp = start_temp, .setpoint = start_temp, .target = start_temp};
+	PT_INIT(&s->pt);
+}
+
+Script_status_t Script_Step(Script_t *const s, float temp, float spread, float Ts)
+{
+	s->temp = temp;
+	s->spread = spread;
+	s->time += Ts;
+	if (s->rate > 0.0f)
+	{
+		float step = s->rate * Ts;
+		float left = s->target - s->setpoint;
+		if (fabsf(left) <= step)
+		{
+			s->setpoint = s->target;
+			s->rate = 0.0f;
+		}
+		else
+		{
+			s->setpoint += copysignf(step, left);
+		}
+	}
+
+	switch (s->def->fn(s))
+	{
+	case PT_WAITING:
+		return SCRIPT_RUNNING;
+	case PT_ENDED:
+		return SCRIPT_DONE;
+	default:
+		return SCRIPT_ABORTED;
+	}
+}
+
+/**
+ * @brief Sn63/Pb37 profile that adapts its soak to the oven and gives up on a weak one.
+ *
+ * A board that spent long in the soak band while the oven crawled up to it is soaked already,
+ * so the hold there is shortened. Preheat and peak each time out, as a ramp table would wait
+ * forever on an oven that cannot keep up.
+ */
+static pt_status_t script_soak(Script_t *const s)
+{
+	PT_BEGIN(&s->pt);
+
+	/* Preheat into the soak band. */
+	Script_Ramp(s, 150.0f, 1.0f);
+	Script_Mark(s);
+	PT_WAIT_UNTIL(&s->pt, s->temp >= 145.0f || Script_Since(s) > 300.0f);
+	if (s->temp < 145.0f)
+	{
+		LOGW(TAG, "Oven did not reach soak within 300 s, aborting.");
+		PT_EXIT(&s->pt);
+	}
+	s->value = Script_Since(s) > 150.0f ? 30.0f : 90.0f;
+	LOGI(TAG, "Soak reached after %.0f s, holding %.0f s.", Script_Since(s), s->value);
+
+	Script_Mark(s);
+	PT_WAIT_UNTIL(&s->pt, Script_Since(s) >= s->value);
+
+	/* Heat to peak and hold briefly, time above liquidus includes the ramps either side. */
+	Script_Ramp(s, 220.0f, 2.0f);
+	Script_Mark(s);
+	PT_WAIT_UNTIL(&s->pt, s->temp >= 210.0f || Script_Since(s) > 120.0f);
+	if (s->temp < 210.0f)
+	{
+		LOGW(TAG, "Oven did not reach peak within 120 s, aborting.");
+		PT_EXIT(&s->pt);
+	}
+	Script_Mark(s);
+	PT_WAIT_UNTIL(&s->pt, Script_Since(s) >= 20.0f);
+
+	/* Cool until the joints solidified. */
+	Script_Ramp(s, 100.0f, 3.0f);
+	PT_WAIT_UNTIL(&s->pt, s->temp <= 105.0f);
+
+	PT_END(&s->pt);
+}
@@ -0,0 +1,63 @@
+/**
+ * @file smith.c
+ * @author Timothy Nguyen
+ * @brief Smith predictor for PID control of plants with dead time.
+ * @version 0.1
+ * @date 2021-08-15
+ */
+
+#include <math.h>
+#include <string.h>
+
+#include "smith.h"
+#include "prof.h"
+
+mod_err_t Smith_Init(Smith_t * const sp, Smith_model_t const * const model, float Ts)
+{
+	if (!(model->T > 0.0f) || !(model->L >= 0.0f) || !(Ts > 0.0f))
+	{
+		return MOD_ERR_ARG;
+	}
+
+	float delay = roundf(model->L / Ts);
+	if (delay > (float)SMITH_MAX_DELAY)
+	{
+		return MOD_ERR_ARG;
+	}
+
+	sp->model = *model;
+	sp->alpha = expf(-Ts / model->T);
+	sp->delay = (uint32_t)delay;
+	Smith_Reset(sp);
+	return MOD_OK;
+}
+
+float Smith_Calculate(Smith_t * const sp, PID_t * const pid, float setpoint, float measurement)
+{
+	PROF_BEGIN(smith_calc);
+
+	/* Model output one dead time ago, ring holds the last delay outputs. */
+	float y_delayed = sp->delay > 0 ? sp->history[sp->head] : sp->y_model;
+	sp->correction = sp->y_model - y_delayed;
+
+	float out = PID_Calculate(pid, setpoint, measurement + sp->correction);
+
+	/* Record current model output, then advance model with the applied (saturated) output. */
+	if (sp->delay > 0)
+	{
+		sp->history[sp->head] = sp->y_model;
+		sp->head = (sp->head + 1 == sp->delay) ? 0 : sp->head + 1;
+	}
+	sp->y_model = sp->alpha * sp->y_model + (1.0f - sp->alpha) * sp->model.K * out;
+
+	PROF_END(smith_calc);
+	return out;
+}
+
+void Smith_Reset(Smith_t * const sp)
+{
+	sp->y_model = 0.0f;
+	sp->head = 0;
+	sp->correction = 0.0f;
+	memset(sp->history, 0, sizeof(sp->history));
+}
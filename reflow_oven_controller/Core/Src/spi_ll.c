@@ -0,0 +1,161 @@
+/**
+ * @file spi_ll.c
+ * @author Timothy Nguyen
+ * @brief Lean polled SPI receive at register level, for short reads where HAL overhead dominates.
+ * @version 0.1
+ * @date 2021-09-02
+ */
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "spi_ll.h"
+#include "log.h"
+#include "stm32l4xx.h"
+#include "stm32l4xx_hal.h"
+
+////////////////////////////////////////////////////////////////////////////////
+// Common macros
+////////////////////////////////////////////////////////////////////////////////
+
+#define SPI_LL_FIFO_WORDS 2U // Depth of transmit and receive FIFOs in 16-bit words.
+
+////////////////////////////////////////////////////////////////////////////////
+// Private (static) function declarations
+////////////////////////////////////////////////////////////////////////////////
+
+static void spi_ll_disable(SPI_TypeDef *spi); // Disable SPI once idle, raising NSS output.
+
+////////////////////////////////////////////////////////////////////////////////
+// Public (global) variables and functions
+////////////////////////////////////////////////////////////////////////////////
+
+void spi_ll_select(SPI_HandleTypeDef *hspi, GPIO_TypeDef *cs_port, uint16_t cs_pin)
+{
+    if (cs_port == NULL)
+    {
+        ASSERT(hspi->Init.NSS == SPI_NSS_HARD_OUTPUT && hspi->Init.NSSPMode == SPI_NSS_PULSE_DISABLE);
+        SET_BIT(hspi->Instance->CR1, SPI_CR1_SPE);
+    }
+    else
+    {
+        cs_port->BRR = cs_pin;
+    }
+}
+
+void spi_ll_deselect(SPI_HandleTypeDef *hspi, GPIO_TypeDef *cs_port, uint16_t cs_pin)
+{
+    if (cs_port == NULL)
+    {
+        if (hspi->State != HAL_SPI_STATE_READY)
+        {
+            return; // Transfer that failed to start, NSS belongs to the one holding the handle.
+        }
+        spi_ll_disable(hspi->Instance);
+    }
+    else
+    {
+        cs_port->BSRR = cs_pin;
+    }
+}
+
+HAL_StatusTypeDef spi_ll_receive(SPI_HandleTypeDef *hspi, GPIO_TypeDef *cs_port, uint16_t cs_pin,
+                                 uint8_t *data, uint16_t size, uint32_t timeout_ms)
+{
+    ASSERT(size > 0U && (size & 1U) == 0U);
+    ASSERT(hspi->Init.DataSize == SPI_DATASIZE_8BIT);
+
+    /* Claim handle with interrupts masked, HAL transfers started from interrupts then see it busy. */
+    uint32_t primask = __get_PRIMASK();
+    __disable_irq();
+    bool ready = hspi->State == HAL_SPI_STATE_READY && hspi->Lock == HAL_UNLOCKED;
+    if (ready)
+    {
+        hspi->State = HAL_SPI_STATE_BUSY_RX;
+    }
+    __set_PRIMASK(primask);
+    if (!ready)
+    {
+        return HAL_BUSY;
+    }
+
+    SPI_TypeDef *spi = hspi->Instance;
+    __IO uint16_t *dr16 = (__IO uint16_t *)&spi->DR;
+    uint32_t cr2 = spi->CR2;
+    CLEAR_BIT(spi->CR2, SPI_CR2_FRXTH); // RXNE once two frames are received.
+    SET_BIT(spi->CR1, SPI_CR1_SPE); // Also selects device for NSS output.
+    spi_ll_select(hspi, cs_port, cs_pin);
+
+    /* Keep at most a FIFO's worth in flight, so receive FIFO never overruns. */
+    HAL_StatusTypeDef status = HAL_OK;
+    uint16_t words = size / 2U;
+    uint16_t sent = 0;
+    uint16_t received = 0;
+    uint32_t start = HAL_GetTick();
+    while (received < words)
+    {
+        if (sent < words && (uint16_t)(sent - received) < SPI_LL_FIFO_WORDS && READ_BIT(spi->SR, SPI_SR_TXE))
+        {
+            *dr16 = 0U;
+            sent++;
+        }
+        if (READ_BIT(spi->SR, SPI_SR_RXNE))
+        {
+            uint16_t word = *dr16;
+            data[2U * received] = (uint8_t)word;
+            data[2U * received + 1U] = (uint8_t)(word >> 8);
+            received++;
+        }
+        else if (HAL_GetTick() - start > timeout_ms)
+        {
+            status = HAL_TIMEOUT;
+            break;
+        }
+    }
+    while (READ_BIT(spi->SR, SPI_SR_BSY) && status == HAL_OK)
+    {
+        if (HAL_GetTick() - start > timeout_ms)
+        {
+            status = HAL_TIMEOUT;
+        }
+    }
+
+    if (cs_port == NULL)
+    {
+        spi_ll_disable(spi);
+    }
+    else
+    {
+        cs_port->BSRR = cs_pin;
+    }
+
+    /* Leave FIFO empty and frame format as found for the next HAL transfer. */
+    while (READ_BIT(spi->SR, SPI_SR_FRLVL))
+    {
+        (void)*(__IO uint8_t *)&spi->DR;
+    }
+    (void)spi->SR; // Reading DR then SR clears an overrun.
+    spi->CR2 = cr2;
+    hspi->State = HAL_SPI_STATE_READY;
+
+    return status;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Private (static) functions
+////////////////////////////////////////////////////////////////////////////////
+
+/**
+ * @brief Disable SPI once the last frame is shifted out, raising its NSS output.
+ *
+ * Disabling while busy would cut the last frame short, it ends within a frame time.
+ *
+ * @param spi SPI registers.
+ */
+static void spi_ll_disable(SPI_TypeDef *spi)
+{
+    while (READ_BIT(spi->SR, SPI_SR_FTLVL | SPI_SR_BSY))
+    {
+    }
+    CLEAR_BIT(spi->CR1, SPI_CR1_SPE);
+}
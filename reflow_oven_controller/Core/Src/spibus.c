@@ -0,0 +1,281 @@
+/**
+ * @file spibus.c
+ * @author Timothy Nguyen
+ * @brief SPI bus manager: queued transfers of devices sharing an SPI, chained by DMA interrupts.
+ * @version 0.1
+ * @date 2021-09-06
+ */
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "spibus.h"
+#include "log.h"
+#include "sections.h"
+#include "spi_ll.h"
+#include "stm32l4xx.h"
+#include "stm32l4xx_hal.h"
+#include "trace.h"
+
+////////////////////////////////////////////////////////////////////////////////
+// Common macros
+////////////////////////////////////////////////////////////////////////////////
+
+#define SPIBUS_BR_MAX 7U // Largest baud rate prescaler field, kernel clock divided by 256.
+
+////////////////////////////////////////////////////////////////////////////////
+// Type definitions
+////////////////////////////////////////////////////////////////////////////////
+
+/* Managed SPI */
+typedef struct
+{
+    SPI_HandleTypeDef *hspi;
+    spibus_xfer_t *head;  // Running or next transfer, NULL if none queued.
+    spibus_xfer_t *tail;  // Last queued transfer.
+    volatile bool busy;   // Transfer running, being started or completed, or bus claimed.
+} spibus_t;
+
+////////////////////////////////////////////////////////////////////////////////
+// Private (static) function prototypes
+////////////////////////////////////////////////////////////////////////////////
+
+static spibus_t *spibus_find(SPI_HandleTypeDef *hspi);           // Get bus of SPI, NULL if not managed.
+static void spibus_run(spibus_t *bus);                          // Start queued transfers until one runs.
+static void spibus_configure(spibus_t *bus, spibus_xfer_t *xfer); // Set prescaler and clock mode of device.
+static void spibus_finish(spibus_t *bus, bool ok);              // Dequeue head and call its callback.
+
+////////////////////////////////////////////////////////////////////////////////
+// Private (static) variables
+////////////////////////////////////////////////////////////////////////////////
+
+static spibus_t buses[SPIBUS_MAX_BUSES];
+
+////////////////////////////////////////////////////////////////////////////////
+// Public (global) functions
+////////////////////////////////////////////////////////////////////////////////
+
+HAL_StatusTypeDef spibus_init(SPI_HandleTypeDef *hspi)
+{
+    ASSERT(hspi != NULL);
+    for (uint32_t i = 0; i < SPIBUS_MAX_BUSES; i++)
+    {
+        if (buses[i].hspi == NULL || buses[i].hspi == hspi)
+        {
+            buses[i] = (spibus_t){.hspi = hspi};
+            return HAL_OK;
+        }
+    }
+    return HAL_ERROR;
+}
+
+HAL_StatusTypeDef spibus_submit(SPI_HandleTypeDef *hspi, spibus_xfer_t *xfer)
+{
+    ASSERT(xfer->rx != NULL && xfer->len > 0U);
+    spibus_t *bus = spibus_find(hspi);
+    if (bus == NULL)
+    {
+        return HAL_ERROR;
+    }
+
+    uint32_t primask = __get_PRIMASK();
+    __disable_irq();
+    if (xfer->queued)
+    {
+        __set_PRIMASK(primask);
+        return HAL_BUSY;
+    }
+    xfer->queued = true;
+    xfer->next = NULL;
+    if (bus->head == NULL)
+    {
+        bus->head = xfer;
+    }
+    else
+    {
+        bus->tail->next = xfer;
+    }
+    bus->tail = xfer;
+
+    /* Whoever sets busy starts the queue, anyone else only appends to it. */
+    bool start = !bus->busy;
+    bus->busy = true;
+    __set_PRIMASK(primask);
+
+    if (start)
+    {
+        spibus_run(bus);
+    }
+    return HAL_OK;
+}
+
+bool spibus_acquire(SPI_HandleTypeDef *hspi)
+{
+    spibus_t *bus = spibus_find(hspi);
+    if (bus == NULL)
+    {
+        return false;
+    }
+
+    uint32_t primask = __get_PRIMASK();
+    __disable_irq();
+    bool claimed = !bus->busy;
+    bus->busy = true;
+    __set_PRIMASK(primask);
+    return claimed;
+}
+
+void spibus_release(SPI_HandleTypeDef *hspi)
+{
+    spibus_t *bus = spibus_find(hspi);
+    ASSERT(bus != NULL && bus->busy);
+    spibus_run(bus);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Interrupt handlers
+////////////////////////////////////////////////////////////////////////////////
+
+/**
+ * @brief SPI full-duplex DMA transfer complete callback (overrides HAL weak function).
+ */
+void RAMFUNC HAL_SPI_TxRxCpltCallback(SPI_HandleTypeDef *hspi)
+{
+    spibus_t *bus = spibus_find(hspi);
+    if (bus == NULL || bus->head == NULL)
+    {
+        return;
+    }
+    TRACE_ISR_ENTER(TRACE_ISR_SPI_DMA);
+    spibus_finish(bus, true);
+    spibus_run(bus);
+    TRACE_ISR_EXIT(TRACE_ISR_SPI_DMA);
+}
+
+/**
+ * @brief SPI error callback (overrides HAL weak function).
+ */
+void HAL_SPI_ErrorCallback(SPI_HandleTypeDef *hspi)
+{
+    spibus_t *bus = spibus_find(hspi);
+    if (bus == NULL || bus->head == NULL)
+    {
+        return;
+    }
+    spibus_finish(bus, false);
+    spibus_run(bus);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Private (static) function definitions
+////////////////////////////////////////////////////////////////////////////////
+
+static spibus_t * RAMFUNC spibus_find(SPI_HandleTypeDef *hspi)
+{
+    for (uint32_t i = 0; i < SPIBUS_MAX_BUSES; i++)
+    {
+        if (buses[i].hspi == hspi)
+        {
+            return &buses[i];
+        }
+    }
+    return NULL;
+}
+
+/**
+ * @brief Start transfer at head of queue, completing those that fail to start, or idle the bus.
+ *
+ * @param bus Bus whose busy flag the caller set.
+ */
+static void RAMFUNC spibus_run(spibus_t *bus)
+{
+    for (;;)
+    {
+        uint32_t primask = __get_PRIMASK();
+        __disable_irq();
+        spibus_xfer_t *xfer = bus->head;
+        if (xfer == NULL)
+        {
+            bus->busy = false;
+            __set_PRIMASK(primask);
+            return;
+        }
+        __set_PRIMASK(primask);
+
+        spibus_configure(bus, xfer);
+        spi_ll_select(bus->hspi, xfer->cs_port, xfer->cs_pin);
+        uint8_t *tx = xfer->tx != NULL ? xfer->tx : xfer->rx;
+        if (HAL_SPI_TransmitReceive_DMA(bus->hspi, tx, xfer->rx, xfer->len) == HAL_OK)
+        {
+            return; // Transfer complete interrupt takes over.
+        }
+        spibus_finish(bus, false);
+    }
+}
+
+/**
+ * @brief Set baud rate prescaler and clock mode of device, if the bus runs otherwise.
+ *
+ * The SPI is idle between transfers, so it may be disabled to change them. With NSS output
+ * it is disabled already, spi_ll_select() enables it.
+ */
+static void RAMFUNC spibus_configure(spibus_t *bus, spibus_xfer_t *xfer)
+{
+    SPI_HandleTypeDef *hspi = bus->hspi;
+    uint32_t cr1 = hspi->Instance->CR1;
+    uint32_t br = (cr1 & SPI_CR1_BR) >> SPI_CR1_BR_Pos;
+    if (xfer->max_hz != SPIBUS_KEEP_HZ)
+    {
+        /* Fastest clock within the device limit, SPIs of this part are on APB1 but SPI1. */
+#ifdef SPI1
+        uint32_t kernel_hz = hspi->Instance == SPI1 ? HAL_RCC_GetPCLK2Freq() : HAL_RCC_GetPCLK1Freq();
+#else
+        uint32_t kernel_hz = HAL_RCC_GetPCLK1Freq();
+#endif
+        br = 0;
+        while (br < SPIBUS_BR_MAX && (kernel_hz >> (br + 1U)) > xfer->max_hz)
+        {
+            br++;
+        }
+    }
+    uint32_t mode = (xfer->mode & 2U ? SPI_CR1_CPOL : 0U) | (xfer->mode & 1U ? SPI_CR1_CPHA : 0U);
+
+    uint32_t new_cr1 = (cr1 & ~(SPI_CR1_BR | SPI_CR1_CPOL | SPI_CR1_CPHA)) | (br << SPI_CR1_BR_Pos) | mode;
+    if (new_cr1 == cr1)
+    {
+        return;
+    }
+    CLEAR_BIT(hspi->Instance->CR1, SPI_CR1_SPE);
+    hspi->Instance->CR1 = new_cr1 & ~SPI_CR1_SPE;
+    hspi->Init.BaudRatePrescaler = br << SPI_CR1_BR_Pos;
+    hspi->Init.CLKPolarity = mode & SPI_CR1_CPOL;
+    hspi->Init.CLKPhase = mode & SPI_CR1_CPHA;
+}
+
+/**
+ * @brief Deselect device of transfer at head of queue, dequeue it and call its callback.
+ *
+ * @param bus Bus whose busy flag the caller set.
+ * @param ok true if the transfer completed.
+ */
+static void RAMFUNC spibus_finish(spibus_t *bus, bool ok)
+{
+    spibus_xfer_t *xfer = bus->head;
+    spi_ll_deselect(bus->hspi, xfer->cs_port, xfer->cs_pin);
+
+    uint32_t primask = __get_PRIMASK();
+    __disable_irq();
+    bus->head = xfer->next;
+    if (bus->head == NULL)
+    {
+        bus->tail = NULL;
+    }
+    xfer->queued = false;
+    __set_PRIMASK(primask);
+
+    /* Bus stays busy, so transfers submitted by the callback queue behind the remaining ones. */
+    if (xfer->cb != NULL)
+    {
+        xfer->cb(xfer, ok);
+    }
+}
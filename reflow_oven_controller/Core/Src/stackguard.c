@@ -0,0 +1,258 @@
+/**
+ * @file stackguard.c
+ * @author Timothy Nguyen
+ * @brief Stack overflow guard: MPU region below the running thread's stack and the main stack.
+ * @version 0.1
+ * @date 2021-09-21
+ */
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "stackguard.h"
+#include "safety.h"
+#include "cmd.h"
+#include "log.h"
+#include "cmsis_os.h"
+#include "FreeRTOS.h"
+#include "task.h"
+#include "stm32l4xx.h"
+
+////////////////////////////////////////////////////////////////////////////////
+// Common macros
+////////////////////////////////////////////////////////////////////////////////
+
+_Static_assert(STACKGUARD_SIZE >= 32U && (STACKGUARD_SIZE & (STACKGUARD_SIZE - 1U)) == 0U,
+               "MPU regions are a power of two of at least 32 bytes");
+
+/* Guard attributes: read-only (AP 110), never executed, normal write-back memory, enabled. */
+#define GUARD_RASR ((6U << MPU_RASR_AP_Pos) | MPU_RASR_XN_Msk | MPU_RASR_C_Msk | MPU_RASR_B_Msk | \
+                    ((uint32_t)(__builtin_ctz(STACKGUARD_SIZE) - 1) << MPU_RASR_SIZE_Pos) | MPU_RASR_ENABLE_Msk)
+
+/* First guard-aligned address at or above addr. */
+#define GUARD_BASE(addr) (((uint32_t)(addr) + STACKGUARD_SIZE - 1U) & ~(STACKGUARD_SIZE - 1U))
+
+/* Backup register record of overflow: magic in BKP4R, thread name in BKP5R to BKP7R,
+ * faulting address in BKP8R. BKP0R to BKP3R hold the watchdog record (wdg.c). */
+#define STACKGUARD_BKP_MAGIC 0x53544B30U // "STK0"
+#define STACKGUARD_BKP_NAME_REGS (STACKGUARD_NAME_LEN / sizeof(uint32_t))
+
+////////////////////////////////////////////////////////////////////////////////
+// Type definitions
+////////////////////////////////////////////////////////////////////////////////
+
+/* Guard state */
+typedef struct
+{
+    volatile uint32_t thread_base;         // Base of running thread's guard.
+    uint32_t main_base;                    // Base of main stack guard.
+    bool enabled;                          // MPU enabled.
+    char culprit[STACKGUARD_NAME_LEN + 1]; // Thread overflowing its stack before previous reset.
+    uint32_t addr;                         // Faulting address of previous overflow, 0 if unknown.
+} stackguard_t;
+
+////////////////////////////////////////////////////////////////////////////////
+// Private (static) function declarations
+////////////////////////////////////////////////////////////////////////////////
+
+static void stackguard_backup_access(void);         // Enable write access to backup registers.
+static uint32_t stackguard_recurse(uint32_t depth); // Grow stack until guard is hit.
+
+/* Command callback functions */
+static uint32_t cmd_stackguard_status(uint32_t argc, const char **argv); // Display guards and last overflow.
+static uint32_t cmd_stackguard_test(uint32_t argc, const char **argv);   // Overflow command thread's stack.
+
+////////////////////////////////////////////////////////////////////////////////
+// Private (static) variables
+////////////////////////////////////////////////////////////////////////////////
+
+/* Guard state */
+static stackguard_t stackguard;
+
+/* Main stack reserved by the linker script. */
+extern uint8_t _estack;          // Top of main stack.
+extern uint32_t _Min_Stack_Size; // Main stack reserved below _estack, value is its address.
+
+/* Stack guard command information. */
+static cmd_cmd_info stackguard_cmds[] = {
+    {.cmd_name = "status",
+     .cb = cmd_stackguard_status,
+     .help = "Display guard regions and thread overflowing its stack before last reset."},
+    {.cmd_name = "test",
+     .cb = cmd_stackguard_test,
+     .help = "Overflow command thread's stack, forcing heaters off and resetting controller."}};
+
+/* Stack guard module client info */
+CMD_CLIENT_DEFINE(stackguard,
+                  .num_cmds = sizeof(stackguard_cmds) / sizeof(stackguard_cmds[0]),
+                  .cmds = stackguard_cmds);
+
+/* Unique tag for stack guard module. */
+LOG_TAG_DEFINE("STK");
+
+////////////////////////////////////////////////////////////////////////////////
+// Public (global) functions
+////////////////////////////////////////////////////////////////////////////////
+
+mod_err_t stackguard_init(void)
+{
+    /* Report thread overflowing its stack before previous reset, once. */
+    stackguard_backup_access();
+    if (RTC->BKP4R == STACKGUARD_BKP_MAGIC)
+    {
+        uint32_t name[STACKGUARD_BKP_NAME_REGS];
+        volatile uint32_t const *const bkp = &RTC->BKP5R;
+        for (uint32_t i = 0; i < STACKGUARD_BKP_NAME_REGS; i++)
+        {
+            name[i] = bkp[i];
+        }
+        memcpy(stackguard.culprit, name, STACKGUARD_NAME_LEN);
+        stackguard.culprit[STACKGUARD_NAME_LEN] = '\0';
+        stackguard.addr = RTC->BKP8R;
+        RTC->BKP4R = 0;
+        LOGW(TAG, "Previous reset by stack overflow of %s at 0x%08lx.", stackguard.culprit, stackguard.addr);
+    }
+
+    /* Thread guard already follows context switches, the MPU was off. */
+    stackguard.main_base = GUARD_BASE((uint32_t)&_estack - (uint32_t)&_Min_Stack_Size);
+    taskENTER_CRITICAL();
+    MPU->CTRL = 0;
+    MPU->RNR = STACKGUARD_REGION_MAIN;
+    MPU->RBAR = stackguard.main_base;
+    MPU->RASR = GUARD_RASR;
+    MPU->RNR = STACKGUARD_REGION_THREAD;
+    MPU->RBAR = stackguard.thread_base;
+    MPU->RASR = GUARD_RASR;
+    SET_BIT(SCB->SHCSR, SCB_SHCSR_MEMFAULTENA_Msk);
+    MPU->CTRL = MPU_CTRL_PRIVDEFENA_Msk | MPU_CTRL_ENABLE_Msk; // HardFault and NMI run unguarded.
+    __DSB();
+    __ISB();
+    stackguard.enabled = true;
+    taskEXIT_CRITICAL();
+
+    LOGI(TAG, "Stack guards enabled, %lu bytes", STACKGUARD_SIZE);
+    return MOD_OK;
+}
+
+void stackguard_switched_in(void *stack)
+{
+    uint32_t const base = GUARD_BASE(stack);
+    stackguard.thread_base = base;
+    MPU->RBAR = base | MPU_RBAR_VALID_Msk | STACKGUARD_REGION_THREAD; // Exception return synchronizes.
+}
+
+bool stackguard_hit(void)
+{
+    uint32_t const cfsr = SCB->CFSR;
+    if (cfsr & SCB_CFSR_MMARVALID_Msk)
+    {
+        uint32_t const addr = SCB->MMFAR;
+        return (cfsr & SCB_CFSR_DACCVIOL_Msk) && (addr - stackguard.main_base < STACKGUARD_SIZE ||
+                                                  addr - stackguard.thread_base < STACKGUARD_SIZE);
+    }
+    return (cfsr & (SCB_CFSR_MSTKERR_Msk | SCB_CFSR_MLSPERR_Msk)) != 0U;
+}
+
+void stackguard_fault(void)
+{
+    /* Neither the faulting stack nor the handler's own pushes may fault again. */
+    MPU->CTRL = 0;
+    __DSB();
+    __ISB();
+    safety_force_off();
+
+    /* A store reports its address. Failed exception entry stacking does not, the thread
+     * overflowed if its stack pointer reached its guard, otherwise an interrupt did. */
+    uint32_t const addr = (SCB->CFSR & SCB_CFSR_MMARVALID_Msk) ? SCB->MMFAR : 0U;
+    bool const main_stack = (addr != 0U) ? (addr - stackguard.main_base < STACKGUARD_SIZE)
+                                         : ((int32_t)(__get_PSP() - stackguard.thread_base) >= (int32_t)STACKGUARD_SIZE);
+    const char *culprit = main_stack ? "main" : pcTaskGetName(NULL);
+
+    uint32_t name[STACKGUARD_BKP_NAME_REGS] = {0};
+    memcpy(name, culprit, strnlen(culprit, STACKGUARD_NAME_LEN));
+    stackguard_backup_access();
+    volatile uint32_t *const bkp = &RTC->BKP5R;
+    for (uint32_t i = 0; i < STACKGUARD_BKP_NAME_REGS; i++)
+    {
+        bkp[i] = name[i];
+    }
+    RTC->BKP8R = addr;
+    RTC->BKP4R = STACKGUARD_BKP_MAGIC; // Written last, record is complete.
+
+    NVIC_SystemReset();
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Private (static) functions
+////////////////////////////////////////////////////////////////////////////////
+
+/**
+ * @brief Enable write access to backup domain, backup registers need no RTC clock.
+ */
+static void stackguard_backup_access(void)
+{
+    SET_BIT(RCC->APB1ENR1, RCC_APB1ENR1_PWREN);
+    SET_BIT(PWR->CR1, PWR_CR1_DBP);
+}
+
+/**
+ * @brief Recurse with a written frame per call until the stack guard faults.
+ *
+ * @param depth Calls so far.
+ *
+ * @return Never returns while the guard is enabled.
+ */
+static uint32_t __attribute__((noinline)) stackguard_recurse(uint32_t depth)
+{
+    volatile uint8_t frame[STACKGUARD_SIZE];
+    frame[0] = (uint8_t)depth;
+    if (depth == UINT32_MAX)
+    {
+        return 0;
+    }
+    return stackguard_recurse(depth + 1U) + frame[0];
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Command functions
+////////////////////////////////////////////////////////////////////////////////
+
+/**
+ * @brief Display guard regions and thread overflowing its stack before last reset.
+ *
+ * @param argc Number of arguments.
+ * @param argv Argument values.
+ *
+ * @return 0 if successful, 1 otherwise.
+ */
+static uint32_t cmd_stackguard_status(uint32_t argc, const char **argv)
+{
+    cmd_out_str("state", stackguard.enabled ? "enabled" : "disabled");
+    cmd_out_u32("guard size", STACKGUARD_SIZE);
+    cmd_out_u32("main guard", stackguard.main_base);
+    cmd_out_u32("thread guard", stackguard.thread_base);
+    cmd_out_str("previous reset culprit", stackguard.culprit[0] != '\0' ? stackguard.culprit : "none");
+    cmd_out_u32("previous reset address", stackguard.addr);
+    return 0;
+}
+
+/**
+ * @brief Overflow command thread's stack so the guard faults and the controller resets.
+ *
+ * @param argc Number of arguments.
+ * @param argv Argument values.
+ *
+ * @return 1 if guards are disabled, never returns otherwise.
+ */
+static uint32_t cmd_stackguard_test(uint32_t argc, const char **argv)
+{
+    if (!stackguard.enabled)
+    {
+        LOG("Stack guards disabled\r\n");
+        return 1;
+    }
+    LOG("Overflowing command thread's stack, resetting\r\n");
+    osDelay(100); // Let the console drain.
+    return stackguard_recurse(0);
+}
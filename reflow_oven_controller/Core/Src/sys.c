@@ -0,0 +1,441 @@
+/**
+ * @file sys.c
+ * @author Timothy Nguyen
+ * @brief System resource monitor: thread stacks and heaps.
+ * @version 0.1
+ * @date 2021-08-19
+ */
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "sys.h"
+#include "heap.h"
+#include "cmd.h"
+#include "log.h"
+#include "cmsis_os.h"
+#include "task.h"
+#include "stm32l4xx_hal.h"
+
+////////////////////////////////////////////////////////////////////////////////
+// Type definitions
+////////////////////////////////////////////////////////////////////////////////
+
+/* Run-time statistics of one thread */
+typedef struct
+{
+    UBaseType_t number; // Kernel task number.
+    uint32_t runtime;   // Run-time counter (CPU cycles).
+    uint32_t switches;  // Number of times switched in.
+} sys_thread_sample_t;
+
+/* Run-time statistics of all threads at one instant */
+typedef struct
+{
+    uint32_t total;                               // Run-time clock when sampled (CPU cycles).
+    uint32_t num_threads;                         // Number of valid thread entries.
+    sys_thread_sample_t threads[SYS_MAX_THREADS]; // Thread statistics.
+} sys_sample_t;
+
+/* Timing of one boot stage */
+typedef struct
+{
+    uint32_t start_cycles; // DWT cycle count at stage start.
+    uint32_t start_hz;     // System clock at stage start.
+    uint32_t us;           // Stage duration (us).
+    uint32_t end_ms;       // HAL tick at stage end, time since HAL_Init() (ms).
+    bool done;             // Stage ended.
+} sys_boot_stage_info_t;
+
+////////////////////////////////////////////////////////////////////////////////
+// Private (static) function declarations
+////////////////////////////////////////////////////////////////////////////////
+
+/* Command callback functions */
+static uint32_t cmd_sys_mem(uint32_t argc, const char **argv); // Display stack and heap usage.
+static uint32_t cmd_sys_top(uint32_t argc, const char **argv); // Display CPU usage per thread.
+static uint32_t cmd_sys_boot(uint32_t argc, const char **argv); // Display reset cause and boot stage times.
+
+/* Software timer callback sampling run-time statistics */
+static void sys_sample(void *argument);
+
+/* Find thread in sample, NULL if it did not exist then */
+static sys_thread_sample_t const *sample_find(sys_sample_t const *sample, UBaseType_t number);
+
+/* Thread state name */
+static const char *thread_state_str(eTaskState state);
+
+/* Reset cause name from RCC_CSR reset flags */
+static const char *reset_cause_str(uint32_t csr);
+
+////////////////////////////////////////////////////////////////////////////////
+// Private (static) variables
+////////////////////////////////////////////////////////////////////////////////
+
+/* Thread snapshot, static to keep it off the command thread's stack. */
+static TaskStatus_t threads[SYS_MAX_THREADS];
+
+/* Context switches into each kernel task number, written by the kernel only. */
+static volatile uint32_t switch_counts[SYS_MAX_TASK_NUMBER];
+
+/* Ring of run-time statistics samples, written by timer daemon only. */
+static sys_sample_t samples[SYS_TOP_WINDOW + 1];
+static uint32_t sample_head;  // Index of newest sample.
+static uint32_t num_samples;  // Number of valid samples.
+static TaskStatus_t sample_threads[SYS_MAX_THREADS]; // Timer daemon thread snapshot.
+
+/* Window end points copied for "sys top" */
+static sys_sample_t top_first;
+static sys_sample_t top_last;
+
+/* Boot stage timing and reset flags (RCC_CSR) captured at first stage. */
+static sys_boot_stage_info_t boot_stages[SYS_BOOT_NUM_STAGES];
+static uint32_t reset_flags;
+static bool reset_flags_captured;
+
+/* Boot stage names */
+static const char *boot_stage_names[SYS_BOOT_NUM_STAGES] = {"control", "console", "services"};
+
+/* Sampling timer */
+static osTimerId_t sample_timer;
+static StaticTimer_t sample_timer_cb;
+
+/* System command information. */
+static cmd_cmd_info sys_cmds[] = {
+    {.cmd_name = "mem",
+     .cb = cmd_sys_mem,
+     .help = "Display minimum free stack of each thread (bytes), FreeRTOS heap usage, spare RAM, SRAM2 and DMA section usage."},
+    {.cmd_name = "top",
+     .cb = cmd_sys_top,
+     .help = "Display priority, CPU usage and context switches of each thread over last seconds (priority plan in prio.h). Format: sys top [seconds]"},
+    {.cmd_name = "boot",
+     .cb = cmd_sys_boot,
+     .help = "Display reset cause and duration of each boot stage."}};
+
+/* System module client info */
+CMD_CLIENT_DEFINE(sys,
+                  .num_cmds = sizeof(sys_cmds) / sizeof(sys_cmds[0]),
+                  .cmds = sys_cmds);
+
+/* Unique tag for system module. */
+LOG_TAG_DEFINE("SYS");
+
+/* Linker script symbols bounding RAM left between .bss and main stack */
+extern uint8_t _end;            // End of .bss.
+extern uint8_t _estack;         // Top of main stack.
+extern uint32_t _Min_Stack_Size; // Main stack reserved below _estack, value is its address.
+
+/* Linker script symbols bounding placement sections, see sections.h */
+extern uint8_t _sram2;          // Start of SRAM2.
+extern uint8_t _eram2;          // End of SRAM2.
+extern uint8_t _esram2_bss;     // End of SRAM2_BSS, last SRAM2 section.
+extern uint8_t _ssram1_dma;     // Start of SRAM1_DMA.
+extern uint8_t _esram1_dma;     // End of SRAM1_DMA.
+
+////////////////////////////////////////////////////////////////////////////////
+// Public (global) functions
+////////////////////////////////////////////////////////////////////////////////
+
+mod_err_t sys_init(void)
+{
+    static const osTimerAttr_t timer_attr = {.name = "sys", .cb_mem = &sample_timer_cb, .cb_size = sizeof(sample_timer_cb)};
+    sample_timer = osTimerNew(sys_sample, osTimerPeriodic, NULL, &timer_attr);
+    ASSERT(sample_timer != NULL);
+    sys_sample(NULL); // First window starts now.
+    osTimerStart(sample_timer, SYS_TOP_PERIOD_MS);
+
+    LOGI(TAG, "Initialized system module");
+    return MOD_OK;
+}
+
+void sys_runtime_init(void)
+{
+    CoreDebug->DEMCR |= CoreDebug_DEMCR_TRCENA_Msk;
+    DWT->CTRL |= DWT_CTRL_CYCCNTENA_Msk;
+}
+
+void sys_task_switched_in(uint32_t task_number)
+{
+    if (task_number < SYS_MAX_TASK_NUMBER)
+    {
+        switch_counts[task_number]++;
+    }
+}
+
+void sys_boot_begin(sys_boot_stage_t stage)
+{
+    if (!reset_flags_captured)
+    {
+        reset_flags = RCC->CSR;
+        SET_BIT(RCC->CSR, RCC_CSR_RMVF);
+        reset_flags_captured = true;
+    }
+    boot_stages[stage].start_hz = SystemCoreClock;
+    boot_stages[stage].start_cycles = DWT->CYCCNT;
+}
+
+void sys_boot_end(sys_boot_stage_t stage)
+{
+    sys_boot_stage_info_t *info = &boot_stages[stage];
+    uint32_t cycles = DWT->CYCCNT - info->start_cycles;
+    info->us = (uint32_t)((uint64_t)cycles * 1000000U / info->start_hz);
+    info->end_ms = HAL_GetTick();
+    info->done = true;
+}
+
+void sys_boot_report(void)
+{
+    LOGI(TAG, "Reset cause: %s", reset_cause_str(reset_flags));
+    for (uint32_t i = 0; i < SYS_BOOT_NUM_STAGES; i++)
+    {
+        if (boot_stages[i].done)
+        {
+            LOGI(TAG, "Boot stage %s took %lu us, done at %lu ms", boot_stage_names[i], boot_stages[i].us, boot_stages[i].end_ms);
+        }
+    }
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Private (static) functions
+////////////////////////////////////////////////////////////////////////////////
+
+/**
+ * @brief Display stack high-water marks and heap usage.
+ *
+ * @param argc Number of arguments.
+ * @param argv Argument values.
+ *
+ * @return 0 if successful, 1 otherwise.
+ */
+static uint32_t cmd_sys_mem(uint32_t argc, const char **argv)
+{
+    UBaseType_t num_threads = uxTaskGetSystemState(threads, SYS_MAX_THREADS, NULL);
+    if (num_threads == 0)
+    {
+        LOG("More than %u threads, increase SYS_MAX_THREADS\r\n", SYS_MAX_THREADS);
+        return 1;
+    }
+
+    /* Thread names live in their control blocks, so deferred log records may refer to them. */
+    LOG("%-12s %4s %10s %10s\r\n", "Thread", "Prio", "State", "Stack free");
+    for (UBaseType_t i = 0; i < num_threads; i++)
+    {
+        LOG("%-12s %4lu %10s %10lu\r\n",
+            threads[i].pcTaskName,
+            (uint32_t)threads[i].uxCurrentPriority,
+            thread_state_str(threads[i].eCurrentState),
+            (uint32_t)(threads[i].usStackHighWaterMark * sizeof(StackType_t)));
+    }
+
+    /* FreeRTOS block pools, "heap status" shows each size class. */
+    cmd_out_u32("rtos heap size", HEAP_BYTES);
+    cmd_out_u32("rtos heap free", xPortGetFreeHeapSize());
+    cmd_out_u32("rtos heap min free", xPortGetMinimumEverFreeHeapSize());
+
+    /* malloc() shares the pools, RAM from _end up to the reserved main stack is spare. */
+    uint32_t stack_limit = (uint32_t)&_estack - (uint32_t)&_Min_Stack_Size;
+    cmd_out_u32("ram spare", stack_limit - (uint32_t)&_end);
+
+    /* SRAM2 holds the vector table copy, RAMFUNC code and SRAM2_BSS. */
+    cmd_out_u32("sram2 used", (uint32_t)&_esram2_bss - (uint32_t)&_sram2);
+    cmd_out_u32("sram2 free", (uint32_t)&_eram2 - (uint32_t)&_esram2_bss);
+    cmd_out_u32("sram1 dma used", (uint32_t)&_esram1_dma - (uint32_t)&_ssram1_dma);
+
+    return 0;
+}
+
+/**
+ * @brief Display CPU usage and context switches of each thread over a sliding window.
+ *
+ * @param argc Number of arguments.
+ * @param argv Argument values.
+ *
+ * @return 0 if successful, 1 otherwise.
+ */
+static uint32_t cmd_sys_top(uint32_t argc, const char **argv)
+{
+    cmd_arg_val arg_vals[1];
+    uint32_t window = SYS_TOP_WINDOW;
+    int32_t num_args = cmd_parse_args(argc, argv, "[u", arg_vals);
+    if (num_args < 0)
+    {
+        return 1;
+    }
+    else if (num_args == 1)
+    {
+        window = arg_vals[0].val.u * 1000U / SYS_TOP_PERIOD_MS;
+        if (window == 0 || window > SYS_TOP_WINDOW)
+        {
+            LOG("Window must be 1 to %lu seconds\r\n", (uint32_t)(SYS_TOP_WINDOW * SYS_TOP_PERIOD_MS / 1000U));
+            return 1;
+        }
+    }
+
+    /* Copy window end points, timer daemon cannot run while kernel is locked. */
+    osKernelLock();
+    if (window >= num_samples)
+    {
+        window = num_samples - 1;
+    }
+    top_first = samples[(sample_head + SYS_TOP_WINDOW + 1 - window) % (SYS_TOP_WINDOW + 1)];
+    top_last = samples[sample_head];
+    osKernelUnlock();
+
+    uint32_t total = top_last.total - top_first.total;
+    if (window == 0 || total == 0)
+    {
+        LOG("No samples yet, retry in %lu ms\r\n", (uint32_t)SYS_TOP_PERIOD_MS);
+        return 1;
+    }
+
+    /* Names are taken from a fresh snapshot, threads deleted since are not listed. */
+    UBaseType_t num_threads = uxTaskGetSystemState(threads, SYS_MAX_THREADS, NULL);
+    LOG("Window %lu ms\r\n", window * SYS_TOP_PERIOD_MS);
+    LOG("%-12s %4s %7s %10s\r\n", "Thread", "Prio", "CPU %", "Switches");
+    for (UBaseType_t i = 0; i < num_threads; i++)
+    {
+        sys_thread_sample_t const *last = sample_find(&top_last, threads[i].xTaskNumber);
+        if (last == NULL)
+        {
+            continue;
+        }
+        sys_thread_sample_t const *first = sample_find(&top_first, threads[i].xTaskNumber);
+        uint32_t runtime = last->runtime - (first ? first->runtime : 0);
+        uint32_t switches = last->switches - (first ? first->switches : 0);
+        uint32_t permille = (uint32_t)((uint64_t)runtime * 1000U / total);
+        LOG("%-12s %4lu %5lu.%lu %10lu\r\n",
+            threads[i].pcTaskName,
+            (uint32_t)threads[i].uxCurrentPriority,
+            permille / 10U,
+            permille % 10U,
+            switches);
+    }
+
+    return 0;
+}
+
+/**
+ * @brief Add run-time statistics sample to ring, runs in timer daemon.
+ *
+ * @param argument Unused.
+ */
+static void sys_sample(void *argument)
+{
+    (void)argument;
+
+    uint32_t next = (sample_head + 1) % (SYS_TOP_WINDOW + 1);
+    sys_sample_t *sample = &samples[next];
+    uint32_t total = 0;
+    UBaseType_t num_threads = uxTaskGetSystemState(sample_threads, SYS_MAX_THREADS, &total);
+
+    osKernelLock(); // Publish sample atomically to "sys top".
+    sample->total = total;
+    sample->num_threads = num_threads;
+    for (UBaseType_t i = 0; i < num_threads; i++)
+    {
+        UBaseType_t number = sample_threads[i].xTaskNumber;
+        sample->threads[i].number = number;
+        sample->threads[i].runtime = sample_threads[i].ulRunTimeCounter;
+        sample->threads[i].switches = number < SYS_MAX_TASK_NUMBER ? switch_counts[number] : 0;
+    }
+    sample_head = next;
+    if (num_samples < SYS_TOP_WINDOW + 1)
+    {
+        num_samples++;
+    }
+    osKernelUnlock();
+}
+
+static sys_thread_sample_t const *sample_find(sys_sample_t const *sample, UBaseType_t number)
+{
+    for (uint32_t i = 0; i < sample->num_threads; i++)
+    {
+        if (sample->threads[i].number == number)
+        {
+            return &sample->threads[i];
+        }
+    }
+    return NULL;
+}
+
+/**
+ * @brief Display reset cause and duration of each boot stage.
+ *
+ * @param argc Number of arguments.
+ * @param argv Argument values.
+ *
+ * @return 0 if successful, 1 otherwise.
+ */
+static uint32_t cmd_sys_boot(uint32_t argc, const char **argv)
+{
+    cmd_out_str("reset cause", reset_cause_str(reset_flags));
+    LOG("%-10s %10s %10s\r\n", "Stage", "Time (us)", "Done (ms)");
+    for (uint32_t i = 0; i < SYS_BOOT_NUM_STAGES; i++)
+    {
+        if (boot_stages[i].done)
+        {
+            LOG("%-10s %10lu %10lu\r\n", boot_stage_names[i], boot_stages[i].us, boot_stages[i].end_ms);
+        }
+    }
+    return 0;
+}
+
+/**
+ * @brief Name most specific reset cause. The pin reset flag is set by every reset, so it is checked last.
+ *
+ * @param csr RCC_CSR value.
+ *
+ * @return Reset cause name.
+ */
+static const char *reset_cause_str(uint32_t csr)
+{
+    if (csr & RCC_CSR_IWDGRSTF)
+    {
+        return "independent watchdog";
+    }
+    if (csr & RCC_CSR_WWDGRSTF)
+    {
+        return "window watchdog";
+    }
+    if (csr & RCC_CSR_LPWRRSTF)
+    {
+        return "low-power";
+    }
+    if (csr & RCC_CSR_SFTRSTF)
+    {
+        return "software";
+    }
+    if (csr & RCC_CSR_BORRSTF)
+    {
+        return "brown-out";
+    }
+    if (csr & (RCC_CSR_OBLRSTF | RCC_CSR_FWRSTF))
+    {
+        return "option byte or firewall";
+    }
+    if (csr & RCC_CSR_PINRSTF)
+    {
+        return "pin";
+    }
+    return "unknown";
+}
+
+static const char *thread_state_str(eTaskState state)
+{
+    switch (state)
+    {
+    case eRunning:
+        return "running";
+    case eReady:
+        return "ready";
+    case eBlocked:
+        return "blocked";
+    case eSuspended:
+        return "suspended";
+    case eDeleted:
+        return "deleted";
+    default:
+        return "invalid";
+    }
+}
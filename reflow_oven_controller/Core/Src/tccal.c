@@ -0,0 +1,97 @@
+/**
+ * @file tccal.c
+ * @author Timothy Nguyen
+ * @brief Thermocouple calibration: reading corrected through reference points, one multiply-add per reading.
+ * @version 0.1
+ * @date 2021-09-06
+ */
+
+#include <math.h>
+
+#include "tccal.h"
+
+bool Tccal_Add(Tccal_points_t * const pts, float reading, float ref)
+{
+	Tccal_points_t next = *pts;
+
+	/* A point near the reading is re-measured, others are inserted in order. */
+	uint32_t k = 0;
+	while (k < next.num_points && next.reading[k] < reading - TCCAL_MIN_SPAN)
+	{
+		k++;
+	}
+	if (k >= next.num_points || next.reading[k] > reading + TCCAL_MIN_SPAN)
+	{
+		if (next.num_points >= TCCAL_MAX_POINTS)
+		{
+			return false;
+		}
+		for (uint32_t j = next.num_points; j > k; j--)
+		{
+			next.reading[j] = next.reading[j - 1U];
+			next.ref[j] = next.ref[j - 1U];
+		}
+		next.num_points++;
+	}
+	next.reading[k] = reading;
+	next.ref[k] = ref;
+
+	if (!Tccal_Check(&next))
+	{
+		return false;
+	}
+	*pts = next;
+	return true;
+}
+
+bool Tccal_Check(Tccal_points_t const * const pts)
+{
+	if (pts->num_points > TCCAL_MAX_POINTS)
+	{
+		return false;
+	}
+	for (uint32_t k = 0; k < pts->num_points; k++)
+	{
+		if (!(fabsf(pts->ref[k] - pts->reading[k]) <= TCCAL_OFFSET_MAX))
+		{
+			return false;
+		}
+		if (k == 0U)
+		{
+			continue;
+		}
+		float span = pts->reading[k] - pts->reading[k - 1U];
+		if (!(span >= TCCAL_MIN_SPAN))
+		{
+			return false;
+		}
+		float gain = (pts->ref[k] - pts->ref[k - 1U]) / span;
+		if (!(gain >= TCCAL_GAIN_MIN && gain <= TCCAL_GAIN_MAX))
+		{
+			return false;
+		}
+	}
+	return true;
+}
+
+void Tccal_Build(Tccal_t * const cal, Tccal_points_t const * const pts)
+{
+	if (pts->num_points < 2U)
+	{
+		cal->num_segments = 1;
+		cal->gain[0] = 1.0f;
+		cal->offset[0] = pts->num_points == 1U ? pts->ref[0] - pts->reading[0] : 0.0f;
+		return;
+	}
+
+	cal->num_segments = (uint8_t)(pts->num_points - 1U);
+	for (uint32_t s = 0; s < cal->num_segments; s++)
+	{
+		cal->gain[s] = (pts->ref[s + 1U] - pts->ref[s]) / (pts->reading[s + 1U] - pts->reading[s]);
+		cal->offset[s] = pts->ref[s] - cal->gain[s] * pts->reading[s];
+		if (s > 0U)
+		{
+			cal->bound[s - 1U] = pts->reading[s];
+		}
+	}
+}
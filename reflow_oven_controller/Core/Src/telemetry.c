@@ -0,0 +1,210 @@
+/**
+ * @file telemetry.c
+ * @author Timothy Nguyen
+ * @brief Telemetry pipeline: framed records batched in a stream buffer, sent in chunks by DMA.
+ * @version 0.1
+ * @date 2021-09-22
+ */
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "telemetry.h"
+#include "cmd.h"
+#include "log.h"
+#include "prio.h"
+#include "sections.h"
+#include "uart.h"
+#include "cmsis_os.h"
+#include "FreeRTOS.h"
+#include "stream_buffer.h"
+
+////////////////////////////////////////////////////////////////////////////////
+// Common macros
+////////////////////////////////////////////////////////////////////////////////
+
+#define TELEMETRY_CHUNKS 2U // Chunk buffers, one on the line while the next fills.
+
+_Static_assert(TELEMETRY_TRIGGER_LEVEL <= TELEMETRY_CHUNK_SZ && TELEMETRY_CHUNK_SZ <= TELEMETRY_BUF_SZ,
+               "Trigger level fits a chunk, a chunk fits the stream buffer");
+_Static_assert(TELEMETRY_CHUNKS <= UART_TX_REFS, "Every chunk can be queued by reference");
+
+////////////////////////////////////////////////////////////////////////////////
+// Type definitions
+////////////////////////////////////////////////////////////////////////////////
+
+/* Performance measurements */
+typedef struct
+{
+    uint32_t frames;        // Writes queued.
+    uint32_t drops;         // Writes dropped, stream buffer full.
+    uint32_t ref_drops;     // Chunks dropped, UART block queue full.
+    uint64_t bytes;         // Bytes queued.
+    int32_t max_fill;       // Highest stream buffer fill (bytes).
+    cmd_pm_minmax_t chunks; // Chunk sizes (bytes).
+} telemetry_pms_t;
+
+////////////////////////////////////////////////////////////////////////////////
+// Private (static) function declarations
+////////////////////////////////////////////////////////////////////////////////
+
+static void Telemetry_thread(void *argument); // Drain stream buffer to UART in chunks.
+static void telemetry_chunk_done(void *ctx);  // Release chunk buffer sent by DMA.
+
+////////////////////////////////////////////////////////////////////////////////
+// Private (static) variables
+////////////////////////////////////////////////////////////////////////////////
+
+/* Stream buffer of encoded frames, one byte is kept free by FreeRTOS. */
+static StreamBufferHandle_t telemetry_sb;
+static StaticStreamBuffer_t telemetry_sb_cb;
+static uint8_t telemetry_sb_mem[TELEMETRY_BUF_SZ + 1U];
+
+/* Chunk buffers read by the transmit DMA, counted free by telemetry_free_sem. */
+static uint8_t SRAM1_DMA telemetry_chunks[TELEMETRY_CHUNKS][TELEMETRY_CHUNK_SZ];
+static osSemaphoreId_t telemetry_free_sem;
+static StaticSemaphore_t telemetry_free_sem_cb;
+
+/* Statically allocated sender thread */
+static osThreadId_t telemetry_thread_id;
+static StaticTask_t telemetry_thread_cb;
+static uint64_t SRAM2_BSS telemetry_stack[TELEMETRY_THREAD_STACK_SZ / sizeof(uint64_t)];
+
+/* Performance measurements */
+static telemetry_pms_t telemetry_pms;
+
+/* Performance measurement info */
+static const cmd_pm_info telemetry_pm_info[] = {
+    {"frames", CMD_PM_U32, &telemetry_pms.frames},
+    {"dropped", CMD_PM_U32, &telemetry_pms.drops},
+    {"chunks dropped", CMD_PM_U32, &telemetry_pms.ref_drops},
+    {"bytes", CMD_PM_U64, &telemetry_pms.bytes},
+    {"max fill", CMD_PM_GAUGE, &telemetry_pms.max_fill},
+    {"chunk bytes", CMD_PM_MINMAX, &telemetry_pms.chunks}};
+
+/* Telemetry pipeline client info, "telem" is the UART port */
+CMD_CLIENT_DEFINE(tlm,
+                  .num_cmds = 0,
+                  .cmds = NULL,
+                  .num_pms = sizeof(telemetry_pm_info) / sizeof(telemetry_pm_info[0]),
+                  .pms = telemetry_pm_info);
+
+////////////////////////////////////////////////////////////////////////////////
+// Public (global) functions
+////////////////////////////////////////////////////////////////////////////////
+
+mod_err_t telemetry_init(void)
+{
+    telemetry_sb = xStreamBufferCreateStatic(TELEMETRY_BUF_SZ, TELEMETRY_TRIGGER_LEVEL, telemetry_sb_mem, &telemetry_sb_cb);
+    ASSERT(telemetry_sb != NULL);
+
+    static const osSemaphoreAttr_t sem_attr = {.name = "telemetry",
+                                               .cb_mem = &telemetry_free_sem_cb,
+                                               .cb_size = sizeof(telemetry_free_sem_cb)};
+    telemetry_free_sem = osSemaphoreNew(TELEMETRY_CHUNKS, TELEMETRY_CHUNKS, &sem_attr);
+    ASSERT(telemetry_free_sem != NULL);
+
+    /* Beside the console, below the control loop producing most frames. */
+    static const osThreadAttr_t thread_attr = {.name = "telemetry",
+                                               .cb_mem = &telemetry_thread_cb,
+                                               .cb_size = sizeof(telemetry_thread_cb),
+                                               .stack_mem = telemetry_stack,
+                                               .stack_size = sizeof(telemetry_stack),
+                                               .priority = PRIO_CONSOLE};
+    telemetry_thread_id = osThreadNew(Telemetry_thread, NULL, &thread_attr);
+    ASSERT(telemetry_thread_id != NULL);
+
+    return MOD_OK;
+}
+
+mod_err_t telemetry_write(const void *buf, size_t len)
+{
+    if (telemetry_sb == NULL)
+    {
+        return MOD_ERR_NOT_INIT;
+    }
+
+    /* Writers are serialized, a frame goes in whole or not at all. */
+    BaseType_t woken = pdFALSE;
+    mod_err_t err = MOD_OK;
+    UBaseType_t mask = portSET_INTERRUPT_MASK_FROM_ISR();
+    if (len <= xStreamBufferSpacesAvailable(telemetry_sb))
+    {
+        xStreamBufferSendFromISR(telemetry_sb, buf, len, &woken);
+        INC_SAT_U32(telemetry_pms.frames);
+        cmd_pm_add_u64(&telemetry_pms.bytes, (uint32_t)len);
+        int32_t fill = (int32_t)xStreamBufferBytesAvailable(telemetry_sb);
+        if (fill > telemetry_pms.max_fill)
+        {
+            telemetry_pms.max_fill = fill;
+        }
+    }
+    else
+    {
+        INC_SAT_U32(telemetry_pms.drops);
+        err = MOD_ERR_BUF_OVERRUN;
+    }
+    portCLEAR_INTERRUPT_MASK_FROM_ISR(mask);
+    portYIELD_FROM_ISR(woken); // Only once the trigger level is reached.
+    return err;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Private (static) functions
+////////////////////////////////////////////////////////////////////////////////
+
+/**
+ * @brief Sender thread, moves the stream buffer to the telemetry UART a chunk at a time.
+ *
+ * A chunk buffer is claimed before draining, so bytes keep gathering in the stream buffer
+ * while both chunks are queued on the line. A busy line therefore finds the trigger level
+ * reached at once and sends full chunks.
+ */
+static void Telemetry_thread(void *argument)
+{
+    (void)argument;
+    uint32_t next = 0;
+    while (1)
+    {
+        osSemaphoreAcquire(telemetry_free_sem, osWaitForever); // Released by DMA completion.
+
+        /* Sleep until the first frame, then gather frames until the trigger level is reached
+         * or TELEMETRY_FLUSH_MS passed. Below the trigger level writes do not wake the thread. */
+        uint8_t *const chunk = telemetry_chunks[next];
+        xStreamBufferSetTriggerLevel(telemetry_sb, 1U);
+        size_t len = xStreamBufferReceive(telemetry_sb, chunk, TELEMETRY_CHUNK_SZ, portMAX_DELAY);
+        xStreamBufferSetTriggerLevel(telemetry_sb, TELEMETRY_TRIGGER_LEVEL);
+        uint32_t const start = osKernelGetTickCount();
+        while (len < TELEMETRY_TRIGGER_LEVEL)
+        {
+            uint32_t const waited = osKernelGetTickCount() - start;
+            if (waited >= pdMS_TO_TICKS(TELEMETRY_FLUSH_MS))
+            {
+                break;
+            }
+            len += xStreamBufferReceive(telemetry_sb, &chunk[len], TELEMETRY_CHUNK_SZ - len,
+                                        pdMS_TO_TICKS(TELEMETRY_FLUSH_MS) - waited);
+        }
+        cmd_pm_record(&telemetry_pms.chunks, len);
+
+        if (uart_write_ref(UART_TELEMETRY, chunk, len, telemetry_chunk_done, NULL) != MOD_OK)
+        {
+            INC_SAT_U32(telemetry_pms.ref_drops);
+            osSemaphoreRelease(telemetry_free_sem);
+        }
+        next = (next + 1U) % TELEMETRY_CHUNKS;
+    }
+}
+
+/**
+ * @brief Release chunk buffer once sent (interrupt context).
+ *
+ * Chunks complete in the order they were queued, so the next one claimed is always free.
+ *
+ * @param ctx Unused.
+ */
+static void telemetry_chunk_done(void *ctx)
+{
+    (void)ctx;
+    osSemaphoreRelease(telemetry_free_sem);
+}
@@ -0,0 +1,485 @@
+/**
+ * @file trace.c
+ * @author Timothy Nguyen
+ * @brief Binary event trace recorder: task switches, ISRs, active object dispatch and marks.
+ * @version 0.1
+ * @date 2021-08-20
+ */
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <string.h>
+#include <strings.h>
+
+#include "trace.h"
+#include "cmd.h"
+#include "log.h"
+#include "console.h"
+#include "frame.h"
+#include "pack.h"
+#include "sys.h"
+#include "cmsis_os.h"
+#include "task.h"
+#include "stm32l4xx.h"
+#include "sections.h"
+
+////////////////////////////////////////////////////////////////////////////////
+// Type definitions
+////////////////////////////////////////////////////////////////////////////////
+
+/* Dump frame payload */
+typedef struct __attribute__((packed))
+{
+    uint8_t type;                       // TRACE_TELEMETRY_TYPE.
+    uint16_t first;                     // Index of first record of frame within dump.
+    uint16_t total;                     // Number of records in dump.
+    uint32_t clock_hz;                  // Timestamp clock.
+    trace_rec_t recs[TRACE_DUMP_CHUNK]; // Records.
+} trace_dump_t;
+
+/* Packed dump frame payload, see trace.h */
+typedef struct __attribute__((packed))
+{
+    uint8_t type;                                           // TRACE_PACK_TYPE.
+    uint16_t first;                                         // Index of first record of frame within dump.
+    uint16_t count;                                         // Number of records in frame.
+    uint16_t total;                                         // Number of records in dump.
+    uint32_t clock_hz;                                      // Timestamp clock.
+    uint8_t data[TRACE_DUMP_CHUNK * sizeof(trace_rec_t)];   // Packed records.
+} trace_pack_t;
+
+_Static_assert(TRACE_REC_MARK_END < (1U << 3), "Record type fits below the id of a packed record");
+
+/* Dump in progress, one frame or task name line per command step */
+typedef struct
+{
+    uint32_t oldest;         // Free-running number of oldest record dumped.
+    uint32_t total;          // Number of records in dump.
+    uint32_t first;          // Index of first record of next frame within dump.
+    bool packed;             // Records are sent as packed frames.
+    UBaseType_t num_threads; // Number of task name lines, taken when the dump started.
+    UBaseType_t thread;      // Index of next task name line within dump_threads, once records are sent.
+} trace_dump_ctx_t;
+
+/* Trace recorder state */
+typedef struct
+{
+    volatile bool recording; // Records are added to ring.
+    bool dumping;            // "trace dump" is sending the ring, which must not be cleared.
+    bool once;               // Stop once ring is full instead of overwriting oldest records.
+    bool itm;                // Stream records to ITM stimulus port.
+    uint32_t put;            // Free-running number of records added since start.
+    uint32_t itm_drops;      // Records not streamed because ITM FIFO was busy.
+} trace_t;
+
+////////////////////////////////////////////////////////////////////////////////
+// Private (static) function declarations
+////////////////////////////////////////////////////////////////////////////////
+
+/* Command callback functions */
+static uint32_t cmd_trace_start(uint32_t argc, const char **argv);  // Clear ring and start recording.
+static uint32_t cmd_trace_stop(uint32_t argc, const char **argv);   // Freeze ring.
+static uint32_t cmd_trace_dump(uint32_t argc, const char **argv);   // Send ring as frames.
+static uint32_t cmd_trace_status(uint32_t argc, const char **argv); // Display recorder state.
+static uint32_t cmd_trace_itm(uint32_t argc, const char **argv);    // Switch ITM streaming.
+
+static inline void itm_write(trace_rec_t const *rec); // Stream record to ITM, dropped if FIFO is busy.
+static mod_err_t dump_send(const void *payload, size_t len); // Encode dump frame and queue it by reference, never waits.
+static void dump_sent(void *ctx);                     // Release sent dump frame.
+static size_t dump_pack_frame(trace_dump_ctx_t const *d);      // Pack records of next packed frame.
+static cmd_async_status_t dump_step(void *ctx, bool cancel);   // Send next dump frame or task name line.
+
+////////////////////////////////////////////////////////////////////////////////
+// Private (static) variables
+////////////////////////////////////////////////////////////////////////////////
+
+/* Recorder state and record ring */
+static trace_t trace;
+static trace_rec_t SRAM1_DMA ring[TRACE_BUF_RECORDS];
+
+/* Dump progress and buffers, static to keep them off the command thread's stack. */
+static trace_dump_ctx_t dump_ctx;
+static trace_dump_t dump;
+static trace_pack_t dump_pack;
+static uint8_t SRAM1_DMA dump_frames[2][FRAME_ENCODED_SIZE(sizeof(trace_pack_t))]; // One sent while the next is encoded.
+static volatile bool dump_busy[2];
+static uint8_t dump_next;
+static TaskStatus_t dump_threads[SYS_MAX_THREADS];
+
+/* Trace command information. */
+static cmd_cmd_info trace_cmds[] = {
+    {.cmd_name = "start",
+     .cb = cmd_trace_start,
+     .help = "Clear trace and start recording, keeping newest records. Format: trace start [once], once stops when full."},
+    {.cmd_name = "stop",
+     .cb = cmd_trace_stop,
+     .help = "Stop recording."},
+    {.cmd_name = "dump",
+     .cb = cmd_trace_dump,
+     .help = "Stop recording and send records as binary frames, followed by task names. Format: trace dump [pack], pack halves the bytes sent."},
+    {.cmd_name = "status",
+     .cb = cmd_trace_status,
+     .help = "Display recorder state."},
+    {.cmd_name = "itm",
+     .cb = cmd_trace_itm,
+     .help = "Stream records to ITM stimulus port while recording. Format: trace itm <on|off>"}};
+
+/* Trace module client info */
+CMD_CLIENT_DEFINE(trace,
+                  .num_cmds = sizeof(trace_cmds) / sizeof(trace_cmds[0]),
+                  .cmds = trace_cmds);
+
+/* Unique tag for trace module. */
+LOG_TAG_DEFINE("TRACE");
+
+////////////////////////////////////////////////////////////////////////////////
+// Public (global) functions
+////////////////////////////////////////////////////////////////////////////////
+
+mod_err_t trace_init(void)
+{
+    memset(&trace, 0, sizeof(trace));
+    LOGI(TAG, "Initialized trace module");
+    return MOD_OK;
+}
+
+void trace_record(uint8_t type, uint8_t id, uint16_t arg)
+{
+    if (!trace.recording)
+    {
+        return;
+    }
+
+    uint32_t primask = __get_PRIMASK();
+    __disable_irq();
+    if (trace.recording)
+    {
+        trace_rec_t *rec = &ring[trace.put & (TRACE_BUF_RECORDS - 1)];
+        rec->timestamp = DWT->CYCCNT;
+        rec->type = type;
+        rec->id = id;
+        rec->arg = arg;
+        trace.put++;
+        if (trace.once && trace.put == TRACE_BUF_RECORDS)
+        {
+            trace.recording = false;
+        }
+        if (trace.itm)
+        {
+            itm_write(rec);
+        }
+    }
+    __set_PRIMASK(primask);
+}
+
+void trace_task_switched_in(uint32_t task_number)
+{
+    trace_record(TRACE_REC_TASK_IN, (uint8_t)task_number, 0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Private (static) functions
+////////////////////////////////////////////////////////////////////////////////
+
+/**
+ * @brief Clear trace ring and start recording.
+ *
+ * @param argc Number of arguments.
+ * @param argv Argument values.
+ *
+ * @return 0 if successful, 1 otherwise.
+ */
+static uint32_t cmd_trace_start(uint32_t argc, const char **argv)
+{
+    bool once = argc == 1 && strcasecmp(argv[0], "once") == 0;
+    if (argc > 1 || (argc == 1 && !once))
+    {
+        LOG("Format: trace start [once]\r\n");
+        return 1;
+    }
+    if (trace.dumping)
+    {
+        LOG("Dump in progress, see \"cmd cancel\"\r\n");
+        return 1;
+    }
+
+    uint32_t primask = __get_PRIMASK();
+    __disable_irq();
+    trace.put = 0;
+    trace.itm_drops = 0;
+    trace.once = once;
+    trace.recording = true;
+    __set_PRIMASK(primask);
+
+    LOG("Trace recording%s\r\n", once ? " until full" : "");
+    return 0;
+}
+
+/**
+ * @brief Stop recording, ring keeps its records.
+ *
+ * @param argc Number of arguments.
+ * @param argv Argument values.
+ *
+ * @return 0 if successful, 1 otherwise.
+ */
+static uint32_t cmd_trace_stop(uint32_t argc, const char **argv)
+{
+    trace.recording = false;
+    LOG("Trace stopped, %lu records\r\n", trace.put < TRACE_BUF_RECORDS ? trace.put : TRACE_BUF_RECORDS);
+    return 0;
+}
+
+/**
+ * @brief Stop recording and send records oldest first as COBS frames, then task names as text,
+ *        one frame or line per command step.
+ *
+ * @param argc Number of arguments.
+ * @param argv Argument values.
+ *
+ * @return 0 if successful, 1 otherwise.
+ */
+static uint32_t cmd_trace_dump(uint32_t argc, const char **argv)
+{
+    bool packed = argc == 1 && strcasecmp(argv[0], "pack") == 0;
+    if (argc > 1 || (argc == 1 && !packed))
+    {
+        LOG("Format: trace dump [pack]\r\n");
+        return 1;
+    }
+    if (trace.dumping)
+    {
+        LOG("Dump in progress\r\n");
+        return 1;
+    }
+
+    trace.recording = false; // Ring is no longer written once stored to.
+
+    uint32_t total = trace.put < TRACE_BUF_RECORDS ? trace.put : TRACE_BUF_RECORDS;
+    uint32_t oldest = trace.put - total;
+
+    /* Thread names live in their control blocks, so deferred log records may refer to them. */
+    dump_ctx = (trace_dump_ctx_t){.oldest = oldest, .total = total, .packed = packed,
+                                  .num_threads = uxTaskGetSystemState(dump_threads, SYS_MAX_THREADS, NULL)};
+    if (cmd_async_start(dump_step, &dump_ctx) != MOD_OK)
+    {
+        return 1;
+    }
+    trace.dumping = true;
+    return 0;
+}
+
+/**
+ * @brief Display recorder state.
+ *
+ * @param argc Number of arguments.
+ * @param argv Argument values.
+ *
+ * @return 0 if successful, 1 otherwise.
+ */
+static uint32_t cmd_trace_status(uint32_t argc, const char **argv)
+{
+    uint32_t put = trace.put;
+    cmd_out_str("recording", trace.recording ? "yes" : "no");
+    cmd_out_u32("records", put < TRACE_BUF_RECORDS ? put : TRACE_BUF_RECORDS);
+    cmd_out_u32("overwritten", put > TRACE_BUF_RECORDS ? put - TRACE_BUF_RECORDS : 0);
+    cmd_out_str("itm", trace.itm ? "on" : "off");
+    cmd_out_u32("itm drops", trace.itm_drops);
+    return 0;
+}
+
+/**
+ * @brief Switch ITM streaming on or off.
+ *
+ * @param argc Number of arguments.
+ * @param argv Argument values.
+ *
+ * @return 0 if successful, 1 otherwise.
+ */
+static uint32_t cmd_trace_itm(uint32_t argc, const char **argv)
+{
+    if (argc == 1 && strcasecmp(argv[0], "on") == 0)
+    {
+        trace.itm = true;
+    }
+    else if (argc == 1 && strcasecmp(argv[0], "off") == 0)
+    {
+        trace.itm = false;
+    }
+    else
+    {
+        LOG("Format: trace itm <on|off>\r\n");
+        return 1;
+    }
+
+    if (trace.itm && (!(ITM->TCR & ITM_TCR_ITMENA_Msk) || !(ITM->TER & (1UL << TRACE_ITM_PORT))))
+    {
+        LOG("ITM port %u not enabled by debugger, records are not streamed\r\n", TRACE_ITM_PORT);
+    }
+    return 0;
+}
+
+/**
+ * @brief Write record to ITM stimulus port as two words, call with interrupts masked.
+ *
+ * Record is dropped if the port is disabled or its FIFO is busy. The second word waits
+ * for the FIFO, for at most one SWO word time, so that records are never split.
+ */
+static inline void itm_write(trace_rec_t const *rec)
+{
+    if (!(ITM->TCR & ITM_TCR_ITMENA_Msk) || !(ITM->TER & (1UL << TRACE_ITM_PORT)))
+    {
+        return;
+    }
+    if (ITM->PORT[TRACE_ITM_PORT].u32 == 0)
+    {
+        trace.itm_drops++;
+        return;
+    }
+
+    uint32_t words[2];
+    memcpy(words, rec, sizeof(words));
+    ITM->PORT[TRACE_ITM_PORT].u32 = words[0];
+    while (ITM->PORT[TRACE_ITM_PORT].u32 == 0)
+    {
+    }
+    ITM->PORT[TRACE_ITM_PORT].u32 = words[1];
+}
+
+/**
+ * @brief Encode dump frame and queue it on the console by reference, so it is not copied again.
+ *
+ * Frames alternate between two buffers, the next frame is encoded while the previous one is sent.
+ *
+ * @param payload Frame payload.
+ * @param len Number of payload bytes.
+ *
+ * @return MOD_OK if queued, MOD_ERR_RESOURCE if the next buffer is still being sent,
+ *         MOD_ERR_BUF_OVERRUN if the console did not take the frame.
+ */
+static mod_err_t dump_send(const void *payload, size_t len)
+{
+    uint8_t i = dump_next;
+    if (dump_busy[i])
+    {
+        return MOD_ERR_RESOURCE;
+    }
+
+    size_t frame_len = frame_encode(payload, len, dump_frames[i], sizeof(dump_frames[i]));
+    dump_busy[i] = true;
+    if (console_write_ref(dump_frames[i], frame_len, dump_sent, (void *)(uintptr_t)i) != MOD_OK)
+    {
+        dump_busy[i] = false;
+        return MOD_ERR_BUF_OVERRUN;
+    }
+    dump_next = i ^ 1U;
+    return MOD_OK;
+}
+
+/**
+ * @brief Release dump frame once sent (interrupt context).
+ *
+ * @param ctx Index of frame within dump_frames.
+ */
+static void dump_sent(void *ctx)
+{
+    dump_busy[(uintptr_t)ctx] = false;
+}
+
+/**
+ * @brief Pack records of the next packed frame into dump_pack, as many whole records as fit.
+ *
+ * @param d Dump progress.
+ *
+ * @return Number of payload bytes, dump_pack.count holds the number of records.
+ */
+static size_t dump_pack_frame(trace_dump_ctx_t const *d)
+{
+    pack_t pack;
+    pack_init(&pack, dump_pack.data, sizeof(dump_pack.data));
+    uint32_t prev = 0;
+    uint32_t i = d->first;
+    for (; i < d->total; i++)
+    {
+        trace_rec_t const *rec = &ring[(d->oldest + i) & (TRACE_BUF_RECORDS - 1)];
+        size_t mark = pack_mark(&pack);
+        if (!pack_u32(&pack, rec->timestamp - prev) || !pack_u32(&pack, ((uint32_t)rec->id << 3) | rec->type) ||
+            !pack_u32(&pack, rec->arg))
+        {
+            pack_rewind(&pack, mark);
+            break; // Record goes into next frame.
+        }
+        prev = rec->timestamp;
+    }
+    dump_pack.type = TRACE_PACK_TYPE;
+    dump_pack.first = (uint16_t)d->first;
+    dump_pack.count = (uint16_t)(i - d->first);
+    dump_pack.total = (uint16_t)d->total;
+    dump_pack.clock_hz = SystemCoreClock;
+    return offsetof(trace_pack_t, data) + pack.len;
+}
+
+/**
+ * @brief Send next dump frame, or once records are sent the next task name line.
+ *
+ * A frame is only built once a dump buffer is free, and is built again on the next step if
+ * the console did not take it, the step never waits.
+ *
+ * @param ctx Dump progress, trace_dump_ctx_t.
+ * @param cancel Stop the dump.
+ *
+ * @return CMD_ASYNC_MORE until every record and task name was sent.
+ */
+static cmd_async_status_t dump_step(void *ctx, bool cancel)
+{
+    trace_dump_ctx_t *const d = ctx;
+    if (cancel)
+    {
+        LOG("Dump cancelled after %lu records\r\n", d->first);
+        trace.dumping = false;
+        return CMD_ASYNC_DONE;
+    }
+
+    if (d->first < d->total)
+    {
+        if (dump_busy[dump_next])
+        {
+            return CMD_ASYNC_MORE;
+        }
+        if (d->packed)
+        {
+            size_t len = dump_pack_frame(d);
+            if (dump_send(&dump_pack, len) == MOD_OK)
+            {
+                d->first += dump_pack.count;
+            }
+            return CMD_ASYNC_MORE;
+        }
+
+        uint32_t n = d->total - d->first < TRACE_DUMP_CHUNK ? d->total - d->first : TRACE_DUMP_CHUNK;
+        dump.type = TRACE_TELEMETRY_TYPE;
+        dump.first = (uint16_t)d->first;
+        dump.total = (uint16_t)d->total;
+        dump.clock_hz = SystemCoreClock;
+        for (uint32_t i = 0; i < n; i++)
+        {
+            dump.recs[i] = ring[(d->oldest + d->first + i) & (TRACE_BUF_RECORDS - 1)];
+        }
+        if (dump_send(&dump, offsetof(trace_dump_t, recs) + n * sizeof(trace_rec_t)) == MOD_OK)
+        {
+            d->first += n;
+        }
+        return CMD_ASYNC_MORE;
+    }
+
+    if (d->thread < d->num_threads)
+    {
+        TaskStatus_t const *const t = &dump_threads[d->thread];
+        LOG("Task %lu: %s\r\n", (uint32_t)t->xTaskNumber, t->pcTaskName);
+        d->thread++;
+        return CMD_ASYNC_MORE;
+    }
+    LOG("Dumped %lu records\r\n", d->total);
+    trace.dumping = false;
+    return CMD_ASYNC_DONE;
+}
@@ -7,40 +7,47 @@
  */
 
 #include <stdio.h>
+#include <stdbool.h>
+#include <stdlib.h>
 
 #include "uart.h"
 #include "printf.h"
 #include "common.h"
 #include "cmd.h"
 #include "stm32l4xx_ll_usart.h"
+#include "stm32l4xx_ll_dma.h"
+#include "stm32l4xx_ll_bus.h"
 #include "stm32l4xx_hal.h"
 #include "string.h"
 #include "log.h"
-#include "console.h"
+#include "ringbuf.h"
+#include "prof.h"
+#include "power.h"
+#include "sections.h"
+#include "trace.h"
+#include "irq.h"
+#include "wdg.h"
+#include "modbus.h"
+#include "cmsis_os.h"
 
 ////////////////////////////////////////////////////////////////////////////////
 // Common macros
 ////////////////////////////////////////////////////////////////////////////////
 
+/* DMA interrupt flags of a given channel (LL_DMA_CHANNEL_x) within the ISR/IFCR registers. */
+#define DMA_FLAG_GI(ch) (DMA_ISR_GIF1 << ((ch)*4U))   // Global interrupt flag.
+#define DMA_FLAG_TC(ch) (DMA_ISR_TCIF1 << ((ch)*4U))  // Transfer complete flag.
+#define DMA_FLAG_HT(ch) (DMA_ISR_HTIF1 << ((ch)*4U))  // Half-transfer flag.
+#define DMA_FLAG_TE(ch) (DMA_ISR_TEIF1 << ((ch)*4U))  // Transfer error flag.
+
+#define UART_BENCH_BUDGET_MS (WDG_AO_TIMEOUT_MS / 2U) // Longest "uart bench" command, every mode and drain included (ms).
+
+#define UART_ABR_CHAR 0x55U // Character the host sends for auto baud rate detection, 'U'.
+
 ////////////////////////////////////////////////////////////////////////////////
 // Type definitions
 ////////////////////////////////////////////////////////////////////////////////
 
-/**
- * @brief UART peripheral structure.
- */
-typedef struct
-{
-    /* Configuration parameters */
-    USART_TypeDef *uart_reg_base; // Pointer to UART's base register address.
-    IRQn_Type irq_num;
-
-    /* Data */
-    uint16_t tx_buf_get_idx;       // Transmit buffer get index.
-    uint16_t tx_buf_put_idx;       // Transmit buffer put index.
-    char tx_buf[UART_TX_BUF_SIZE]; // Transmit circular buffer.
-} UART_t;
-
 /**
  * @brief List of UART performance measurements.
  */
@@ -52,62 +59,255 @@ typedef enum
     CNT_RX_UART_PE,     // Parity error count.
     CNT_TX_BUF_OVERRUN, // Tx buffer overrun count.
     CNT_RX_BUF_OVERRUN, // Rx buffer overrun count.
+    CNT_TX_DMA_TE,      // Tx DMA transfer error count.
+    CNT_RX_DMA_TE,      // Rx DMA transfer error count.
 
-    NUM_U16_PMS // Number of performance measurements
+    NUM_U32_PMS // Number of performance measurements
 } UART_pms_t;
 
-////////////////////////////////////////////////////////////////////////////////
-// Private (static) variables
-////////////////////////////////////////////////////////////////////////////////
+/**
+ * @brief Performance measurements of a UART port.
+ */
+typedef struct
+{
+    uint32_t cnt[NUM_U32_PMS];   // Counters.
+    uint64_t rx_bytes;           // Received bytes passed to receiver.
+    uint64_t tx_bytes;           // Bytes queued for transmission.
+    cmd_pm_hist_t isr_cycles;    // UART ISR duration (CPU cycles).
+    volatile uint32_t isr_total; // Time spent in UART and DMA ISRs (CPU cycles), wraps.
+} UART_stats_t;
 
-/* UART_t Instance */
-static UART_t uart;
+/**
+ * @brief Block queued by reference.
+ */
+typedef struct
+{
+    const uint8_t *buf;   // Bytes to transmit.
+    uint32_t len;         // Number of bytes.
+    uint32_t at;          // Transmit buffer put index when queued, the block goes out once get index reaches it.
+    uart_ref_done_t done; // Called once sent, may be NULL.
+    void *ctx;            // Argument of done.
+} UART_ref_t;
 
-/* Performance measurement counters */
-static uint16_t uart_pms[NUM_U16_PMS];
+/**
+ * @brief UART peripheral structure.
+ */
+typedef struct
+{
+    /* Configuration parameters */
+    USART_TypeDef *uart_reg_base; // Pointer to UART's base register address.
+    IRQn_Type irq_num;
+    uint32_t irq_prio;             // Priority of UART and DMA channel interrupts.
+    mod_err_t (*rx_post)(char c);  // Receiver of characters, NULL if receiver is off.
+    void (*rx_idle)(void);         // Receive line idle callback, may be NULL.
+    UART_stats_t *stats;           // Performance measurements of port.
+    DMA_TypeDef *tx_dma;      // DMA controller for transmission, NULL if TXE interrupts are used.
+    uint32_t tx_dma_channel;  // DMA channel for transmission.
+    IRQn_Type tx_dma_irq_num; // DMA channel interrupt request number.
+    DMA_TypeDef *rx_dma;      // DMA controller for reception, NULL if RXNE interrupts are used.
+    uint32_t rx_dma_channel;  // DMA channel for reception.
+    IRQn_Type rx_dma_irq_num; // DMA channel interrupt request number.
+
+    /* Data */
+    ringbuf_t tx_ring;                // Transmit circular buffer.
+    uint8_t tx_buf[UART_TX_BUF_SIZE]; // Transmit circular buffer storage.
 
-/* Performance measurement names */
-static const char *pm_names[] = {
-    "ORE",
-    "NE",
-    "FE",
-    "PE",
-    "TX BUF ORE",
-    "RX BUF ORE"};
+    /* DMA transfer in progress */
+    volatile bool tx_dma_busy; // DMA channel is currently transferring a region of tx_buf.
+    uint32_t tx_dma_len;       // Number of bytes in current DMA transfer.
+    uint32_t tx_dma_released;  // Number of bytes of current transfer already released back to tx_ring.
+    bool tx_dma_ref;           // Current DMA transfer is the head block queued by reference.
 
-/* Log module client info */
-static cmd_client_info uart_client_info =
-    {
-        .client_name = "uart",
-        .num_cmds = 0,
-        .cmds = NULL,
-        .num_u16_pms = NUM_U16_PMS,
-        .u16_pms = uart_pms,
-        .u16_pm_names = pm_names};
+    /* Blocks queued by reference, indexed by free-running counts modulo UART_TX_REFS */
+    UART_ref_t tx_refs[UART_TX_REFS];
+    uint32_t tx_ref_put; // Blocks queued.
+    uint32_t tx_ref_get; // Blocks sent or dropped.
+    uint32_t tx_ref_pos; // Bytes of head block sent with TXE interrupts.
 
-/* Unique tag for logging module */
-static const char *TAG = "UART";
+    /* Circular DMA reception */
+    uint8_t rx_dma_buf[UART_RX_DMA_BUF_SIZE]; // Circular DMA receive buffer.
+    uint32_t rx_dma_pos;                      // Position in rx_dma_buf up to which characters were passed to receiver.
+
+    /* Baud rate change awaiting confirmation */
+    uint32_t baud_revert;    // Baud rate restored unless the change is confirmed, 0 if none is pending.
+    volatile bool abr_armed; // Auto baud rate detection armed, its character is not passed to receiver.
+} UART_t;
 
 ////////////////////////////////////////////////////////////////////////////////
 // Private (static) function prototypes
 ////////////////////////////////////////////////////////////////////////////////
 
 /* UART interrupt service routine. */
-static void UART_ISR(void);
+static void UART_ISR(UART_t *uart);
+
+/* Dispatch interrupt of a UART peripheral to the port using it. */
+static inline void usart_irq(uint32_t slot);
+
+/* Dispatch interrupt of a DMA channel to the port using it. */
+static void dma_irq(DMA_TypeDef *dma, uint32_t channel);
 
 /* Read byte from receive data register. */
-static inline void read_rdr(void);
+static inline void read_rdr(UART_t *uart);
 
 /* Write byte to transmit data register. */
-static inline void write_tdr(void);
+static inline void write_tdr(UART_t *uart);
+
+/* UART transmit DMA channel interrupt service routine. */
+static void UART_TX_DMA_ISR(UART_t *uart);
+
+/* Hand next contiguous region of transmit buffer, or next block queued by reference, to DMA channel. */
+static void start_tx_dma(UART_t *uart);
+
+/* Get block queued by reference that is due, the transmit buffer having drained up to it. */
+static inline UART_ref_t *tx_ref_due(UART_t *uart);
+
+/* Release head block queued by reference and call its done callback. */
+static void tx_ref_finish(UART_t *uart);
+
+/* Release current DMA transfer, region of transmit buffer or block queued by reference. */
+static void tx_dma_release(UART_t *uart);
+
+/* Configure transmit DMA channel. */
+static void tx_dma_init(UART_t *uart, uint32_t request);
+
+/* Configure and start circular receive DMA channel. */
+static void rx_dma_init(UART_t *uart, uint32_t request);
+
+/* UART receive DMA channel interrupt service routine. */
+static void UART_RX_DMA_ISR(UART_t *uart);
+
+/* Pass characters written by receive DMA channel to receiver. */
+static void rx_dma_drain(UART_t *uart);
+
+/* Pass received character to receiver. */
+static inline void rx_post(UART_t *uart, char c);
+
+/* Enable clock of DMA controller. */
+static inline void dma_clock_enable(DMA_TypeDef *dma);
+
+/* Start transmission of characters placed in transmit buffer. */
+static inline void start_tx(UART_t *uart);
+
+/* Measure console port transmit path with "uart bench". */
+static uint32_t uart_bench_cmd(uint32_t argc, const char **argv);
+
+/* Measure telemetry port transmit path with "telem bench". */
+static uint32_t telem_bench_cmd(uint32_t argc, const char **argv);
+
+/* Measure transmit path of a port. */
+static uint32_t uart_bench(uart_port_t port, uint32_t argc, const char **argv);
+
+/* Write pattern through transmit path and print a row of results. */
+static bool uart_bench_run(uart_port_t port, bool block, uint32_t bytes, uint32_t deadline);
+
+/* Change console port baud rate with "uart baud". */
+static uint32_t uart_baud_cmd(uint32_t argc, const char **argv);
+
+/* Change telemetry port baud rate with "telem baud". */
+static uint32_t telem_baud_cmd(uint32_t argc, const char **argv);
+
+/* Show, change, arm detection of or confirm baud rate of a port. */
+static uint32_t uart_baud(uart_port_t port, uint32_t argc, const char **argv);
+
+/* Claim pending baud rate change of a port, returning the rate it would revert to. */
+static uint32_t baud_claim(UART_t *uart);
+
+/* Restore baud rate of a port whose change was not confirmed in time, timer callback. */
+static void baud_timeout(void *arg);
+
+/* Bus clock of a UART peripheral. */
+static inline uint32_t uart_clock_hz(USART_TypeDef *reg);
+
+////////////////////////////////////////////////////////////////////////////////
+// Private (static) variables
+////////////////////////////////////////////////////////////////////////////////
+
+/* UART_t Instances, indexed by port */
+static UART_t SRAM1_DMA uarts[UART_NUM_PORTS];
+
+/* Ports using USART1, USART2, USART3, UART4 and UART5, NULL if unused. */
+static UART_t *usart_ports[5];
+
+/* Performance measurement counters, indexed by port */
+static UART_stats_t uart_stats[UART_NUM_PORTS];
+
+/* Timers reverting unconfirmed baud rate changes, indexed by port */
+static osTimerId_t baud_timers[UART_NUM_PORTS];
+static StaticTimer_t baud_timer_cbs[UART_NUM_PORTS];
+
+/* Pattern of "uart bench", space and backspace pairs leave no trace on a terminal. Odd length,
+ * so a block may start at either character of a pair. */
+static const char bench_pattern[UART_BENCH_BLOCK + 1U] =
+    " \b \b \b \b \b \b \b \b \b \b \b \b \b \b \b \b ";
+
+/* Commands of each port */
+static cmd_cmd_info uart_cmds[] = {
+    {.cmd_name = "bench",
+     .cb = uart_bench_cmd,
+     .help = "Measure transmit rate and CPU cost of writing characters one at a time and in blocks.\r\n"
+             "Usage: uart bench <bytes> [char|block|all]"},
+    {.cmd_name = "baud",
+     .cb = uart_baud_cmd,
+     .help = "Show or change console baud rate, reverted unless confirmed at the new rate within 5 s.\r\n"
+             "\"auto\" detects the rate of a 'U' sent by the host.\r\n"
+             "Usage: uart baud [<rate>|auto|confirm]"}};
+
+static cmd_cmd_info telem_cmds[] = {
+    {.cmd_name = "bench",
+     .cb = telem_bench_cmd,
+     .help = "Measure transmit rate and CPU cost of the telemetry port, like \"uart bench\".\r\n"
+             "Usage: telem bench <bytes> [char|block|all]"},
+    {.cmd_name = "baud",
+     .cb = telem_baud_cmd,
+     .help = "Show or change telemetry baud rate, reverted unless confirmed within 5 s.\r\n"
+             "Usage: telem baud [<rate>|confirm]"}};
+
+/* Performance measurement info of a port */
+#define UART_PM_INFO(port)                                                     \
+    {                                                                          \
+        {"ORE", CMD_PM_U32, &uart_stats[port].cnt[CNT_RX_UART_ORE]},           \
+        {"NE", CMD_PM_U32, &uart_stats[port].cnt[CNT_RX_UART_NE]},             \
+        {"FE", CMD_PM_U32, &uart_stats[port].cnt[CNT_RX_UART_FE]},             \
+        {"PE", CMD_PM_U32, &uart_stats[port].cnt[CNT_RX_UART_PE]},             \
+        {"TX BUF ORE", CMD_PM_U32, &uart_stats[port].cnt[CNT_TX_BUF_OVERRUN]}, \
+        {"RX BUF ORE", CMD_PM_U32, &uart_stats[port].cnt[CNT_RX_BUF_OVERRUN]}, \
+        {"TX DMA TE", CMD_PM_U32, &uart_stats[port].cnt[CNT_TX_DMA_TE]},       \
+        {"RX DMA TE", CMD_PM_U32, &uart_stats[port].cnt[CNT_RX_DMA_TE]},       \
+        {"RX bytes", CMD_PM_U64, &uart_stats[port].rx_bytes},                  \
+        {"TX bytes", CMD_PM_U64, &uart_stats[port].tx_bytes},                  \
+        {"ISR cycles", CMD_PM_HIST, &uart_stats[port].isr_cycles},             \
+    }
+#define UART_NUM_PM_INFO 11U // Entries of UART_PM_INFO().
+
+static const cmd_pm_info uart_pm_info[UART_NUM_PORTS][UART_NUM_PM_INFO] = {
+    [UART_CONSOLE] = UART_PM_INFO(UART_CONSOLE),
+    [UART_TELEMETRY] = UART_PM_INFO(UART_TELEMETRY)};
+
+/* Client info of each port, "uart" is the console */
+CMD_CLIENT_DEFINE(uart,
+                  .num_cmds = sizeof(uart_cmds) / sizeof(uart_cmds[0]),
+                  .cmds = uart_cmds,
+                  .num_pms = UART_NUM_PM_INFO,
+                  .pms = uart_pm_info[UART_CONSOLE]);
+CMD_CLIENT_DEFINE(telem,
+                  .num_cmds = sizeof(telem_cmds) / sizeof(telem_cmds[0]),
+                  .cmds = telem_cmds,
+                  .num_pms = UART_NUM_PM_INFO,
+                  .pms = uart_pm_info[UART_TELEMETRY]);
+static const cmd_client_info *const uart_client_info[UART_NUM_PORTS] = {
+    [UART_CONSOLE] = &cmd_client_uart,
+    [UART_TELEMETRY] = &cmd_client_telem};
+
+/* Unique tag for logging module */
+LOG_TAG_DEFINE("UART");
 
 ////////////////////////////////////////////////////////////////////////////////
 // Public (global) functions
 ////////////////////////////////////////////////////////////////////////////////
 
-mod_err_t uart_init(uart_config_t *uart_cfg)
+mod_err_t uart_init(uart_port_t port, uart_config_t *uart_cfg)
 {
-    if (uart_cfg->uart_reg_base == NULL)
+    if (port >= UART_NUM_PORTS || uart_cfg->uart_reg_base == NULL)
     {
         return MOD_ERR_ARG;
     }
@@ -115,177 +315,1093 @@ mod_err_t uart_init(uart_config_t *uart_cfg)
     {
         return MOD_ERR_PERIPH;
     }
-    else
+
+    uint32_t slot;
+    switch (uart_cfg->irq_num)
     {
-        switch (uart_cfg->irq_num)
-        {
-        case USART1_IRQn:
-        case USART2_IRQn:
-        case USART3_IRQn:
-        case UART4_IRQn:
-        case UART5_IRQn:
-            memset(&uart, 0, sizeof(uart));
-            uart.irq_num = uart_cfg->irq_num;
-            uart.uart_reg_base = uart_cfg->uart_reg_base;
-            mod_err_t err = cmd_register(&uart_client_info);
-            LOGI(TAG, "Initialized UART");
-            return err;
-        default:
-            return MOD_ERR_ARG;
-        }
+    case USART1_IRQn:
+        slot = 0;
+        break;
+    case USART2_IRQn:
+        slot = 1;
+        break;
+    case USART3_IRQn:
+        slot = 2;
+        break;
+    case UART4_IRQn:
+        slot = 3;
+        break;
+    case UART5_IRQn:
+        slot = 4;
+        break;
+    default:
+        return MOD_ERR_ARG;
+    }
+
+    UART_t *uart = &uarts[port];
+    memset(uart, 0, sizeof(*uart));
+    ringbuf_init(&uart->tx_ring, uart->tx_buf, sizeof(uart->tx_buf));
+    uart->irq_num = uart_cfg->irq_num;
+    uart->irq_prio = uart_cfg->irq_prio;
+    uart->rx_post = uart_cfg->rx_post;
+    uart->rx_idle = uart_cfg->rx_idle;
+    uart->stats = &uart_stats[port];
+    uart->uart_reg_base = uart_cfg->uart_reg_base;
+    if (uart_cfg->tx_dma != NULL)
+    {
+        uart->tx_dma = uart_cfg->tx_dma;
+        uart->tx_dma_channel = uart_cfg->tx_dma_channel;
+        uart->tx_dma_irq_num = uart_cfg->tx_dma_irq_num;
+        tx_dma_init(uart, uart_cfg->tx_dma_request);
+    }
+    if (uart_cfg->rx_dma != NULL && uart->rx_post != NULL)
+    {
+        uart->rx_dma = uart_cfg->rx_dma;
+        uart->rx_dma_channel = uart_cfg->rx_dma_channel;
+        uart->rx_dma_irq_num = uart_cfg->rx_dma_irq_num;
+        rx_dma_init(uart, uart_cfg->rx_dma_request);
     }
+    usart_ports[slot] = uart;
+    LOGI(TAG, "Initialized %s port", uart_client_info[port]->client_name);
+    return MOD_OK;
 }
 
-mod_err_t uart_start(void)
+mod_err_t uart_start(uart_port_t port)
 {
-    if (uart.uart_reg_base == NULL)
+    if (port >= UART_NUM_PORTS || uarts[port].uart_reg_base == NULL)
     {
         LOGE(TAG, "UART not initialized");
         return MOD_ERR_NOT_INIT;
     }
 
-    LL_USART_EnableIT_TXE(uart.uart_reg_base);  // Generate interrupt whenever TXE flag is set.
-    LL_USART_EnableIT_RXNE(uart.uart_reg_base); // Generate interrupt whenever RXNE flag is set.
+    UART_t *uart = &uarts[port];
+    if (uart->tx_dma == NULL)
+    {
+        LL_USART_EnableIT_TXE(uart->uart_reg_base); // Generate interrupt whenever TXE flag is set.
+    }
+    if (uart->rx_post != NULL)
+    {
+        if (uart->rx_dma == NULL)
+        {
+            LL_USART_EnableIT_RXNE(uart->uart_reg_base); // Generate interrupt whenever RXNE flag is set.
+        }
+        else
+        {
+            LL_USART_EnableIT_ERROR(uart->uart_reg_base); // Generate interrupt on ORE/NE/FE flags, RXNE is serviced by DMA.
+        }
+        LL_USART_EnableIT_IDLE(uart->uart_reg_base); // Generate interrupt whenever receive line goes idle.
+    }
 
     /* Interrupt priority must be set greater than or
      * equal to configMAX_SYSCALL_INTERRUPT_PRIORITY
      * in order for ISR to use FreeRTOS API.
      * See https://www.freertos.org/RTOS-Cortex-M3-M4.html */
-    __NVIC_SetPriority(uart.irq_num, NVIC_EncodePriority(NVIC_GetPriorityGrouping(), 5, 0));
+    __NVIC_SetPriority(uart->irq_num, NVIC_EncodePriority(NVIC_GetPriorityGrouping(), uart->irq_prio, 0));
 
-    __NVIC_EnableIRQ(uart.irq_num);
+    __NVIC_EnableIRQ(uart->irq_num);
+
+    if (uart->rx_dma != NULL)
+    {
+        __NVIC_SetPriority(uart->rx_dma_irq_num, NVIC_EncodePriority(NVIC_GetPriorityGrouping(), uart->irq_prio, 0));
+        __NVIC_EnableIRQ(uart->rx_dma_irq_num);
+        LL_DMA_EnableChannel(uart->rx_dma, uart->rx_dma_channel);
+        LL_USART_EnableDMAReq_RX(uart->uart_reg_base);
+    }
+
+    if (uart->tx_dma != NULL)
+    {
+        __NVIC_SetPriority(uart->tx_dma_irq_num, NVIC_EncodePriority(NVIC_GetPriorityGrouping(), uart->irq_prio, 0));
+        __NVIC_EnableIRQ(uart->tx_dma_irq_num);
+
+        /* Flush characters placed in buffer before start. */
+        uint32_t primask = __get_PRIMASK();
+        __disable_irq();
+        start_tx_dma(uart);
+        __set_PRIMASK(primask);
+    }
 
     return MOD_OK;
 }
 
-mod_err_t uart_putc(char c)
+mod_err_t uart_putc(uart_port_t port, char c)
+{
+    return uart_write(port, &c, 1);
+}
+
+mod_err_t uart_write(uart_port_t port, const char *buf, size_t len)
 {
+    if (port >= UART_NUM_PORTS || uarts[port].uart_reg_base == NULL)
+    {
+        return MOD_ERR_NOT_INIT;
+    }
 
-    uint16_t next_put_idx = (uart.tx_buf_put_idx + 1) % UART_TX_BUF_SIZE;
+    UART_t *uart = &uarts[port];
+    mod_err_t err = MOD_OK;
+
+    uint32_t primask = __get_PRIMASK();
+    __disable_irq();
+
+    /* Copy block into Tx circular buffer, splitting at wrap-around.
+     * Commit whole block or nothing, unless it could never fit. */
+    uint32_t pushed = 0;
+    if (len <= ringbuf_free(&uart->tx_ring) || len > ringbuf_size(&uart->tx_ring))
+    {
+        pushed = ringbuf_push(&uart->tx_ring, buf, len);
+    }
+    uart->stats->tx_bytes += pushed; // Interrupts already masked.
+    if (pushed < len)
+    {
+        INC_SAT_U32(uart->stats->cnt[CNT_TX_BUF_OVERRUN]);
+        err = MOD_ERR_BUF_OVERRUN;
+    }
 
-    /* Tx circular buffer is full. */
-    if (next_put_idx == uart.tx_buf_get_idx)
+    if (pushed > 0)
     {
-        INC_SAT_U16(uart_pms[CNT_TX_BUF_OVERRUN]);
-        return MOD_ERR_BUF_OVERRUN;
+        start_tx(uart);
     }
 
-    /* Place char in buffer */
-    uart.tx_buf[uart.tx_buf_put_idx] = c;
-    uart.tx_buf_put_idx = next_put_idx;
+    __set_PRIMASK(primask);
 
-    // Ensure TXE interrupt is enabled.
-    if (uart.uart_reg_base != NULL && !LL_USART_IsEnabledIT_TXE(uart.uart_reg_base))
+    return err;
+}
+
+mod_err_t uart_write_ref(uart_port_t port, const void *buf, size_t len, uart_ref_done_t done, void *ctx)
+{
+    if (port >= UART_NUM_PORTS || uarts[port].uart_reg_base == NULL)
     {
-        __disable_irq();
-        LL_USART_EnableIT_TXE(uart.uart_reg_base);
-        __enable_irq();
+        return MOD_ERR_NOT_INIT;
+    }
+    else if (len == 0 || len > UINT16_MAX)
+    {
+        return MOD_ERR_ARG; // DMA transfers are at most 65535 bytes.
+    }
+
+    UART_t *uart = &uarts[port];
+    mod_err_t err = MOD_OK;
+
+    uint32_t primask = __get_PRIMASK();
+    __disable_irq();
+
+    if (uart->tx_ref_put - uart->tx_ref_get == UART_TX_REFS)
+    {
+        INC_SAT_U32(uart->stats->cnt[CNT_TX_BUF_OVERRUN]);
+        err = MOD_ERR_BUF_OVERRUN;
+    }
+    else
+    {
+        /* Anchor block at the current end of the stream, so it keeps its place among writes. */
+        UART_ref_t *ref = &uart->tx_refs[uart->tx_ref_put & (UART_TX_REFS - 1U)];
+        ref->buf = buf;
+        ref->len = len;
+        ref->at = uart->tx_ring.put_idx;
+        ref->done = done;
+        ref->ctx = ctx;
+        uart->tx_ref_put++;
+        uart->stats->tx_bytes += len;
+        start_tx(uart);
     }
 
+    __set_PRIMASK(primask);
+
+    return err;
+}
+
+bool uart_tx_idle(uart_port_t port)
+{
+    if (port >= UART_NUM_PORTS || uarts[port].uart_reg_base == NULL)
+    {
+        return true;
+    }
+    UART_t *uart = &uarts[port];
+    return ringbuf_is_empty(&uart->tx_ring) && uart->tx_ref_get == uart->tx_ref_put && !uart->tx_dma_busy &&
+           LL_USART_IsActiveFlag_TC(uart->uart_reg_base);
+}
+
+mod_err_t uart_baud_set(uart_port_t port, uint32_t baud)
+{
+    if (port >= UART_NUM_PORTS || uarts[port].uart_reg_base == NULL)
+    {
+        return MOD_ERR_NOT_INIT;
+    }
+    if (baud < UART_BAUD_MIN || baud > UART_BAUD_MAX)
+    {
+        return MOD_ERR_ARG;
+    }
+
+    /* Baud rate register can only be written while UART is disabled. Interrupts are masked so the
+     * clock manager cannot change the bus clock in between. */
+    USART_TypeDef *reg = uarts[port].uart_reg_base;
+    uint32_t primask = __get_PRIMASK();
+    __disable_irq();
+    uint32_t cr1 = reg->CR1;
+    CLEAR_BIT(reg->CR1, USART_CR1_UE);
+    LL_USART_SetBaudRate(reg, uart_clock_hz(reg), LL_USART_OVERSAMPLING_16, baud);
+    reg->CR1 = cr1;
+    __set_PRIMASK(primask);
     return MOD_OK;
 }
 
+uint32_t uart_baud_get(uart_port_t port)
+{
+    if (port >= UART_NUM_PORTS || uarts[port].uart_reg_base == NULL)
+    {
+        return 0;
+    }
+    USART_TypeDef *reg = uarts[port].uart_reg_base;
+    return LL_USART_GetBaudRate(reg, uart_clock_hz(reg), LL_USART_OVERSAMPLING_16);
+}
+
+size_t uart_tx_free(uart_port_t port)
+{
+    if (port >= UART_NUM_PORTS || uarts[port].uart_reg_base == NULL)
+    {
+        return 0;
+    }
+    return ringbuf_free(&uarts[port].tx_ring);
+}
+
 ////////////////////////////////////////////////////////////////////////////////
 // Interrupt handlers
 ////////////////////////////////////////////////////////////////////////////////
 
 void USART1_IRQHandler(void)
 {
-    UART_ISR();
+    TRACE_ISR_ENTER(TRACE_ISR_UART);
+    usart_irq(0);
+    TRACE_ISR_EXIT(TRACE_ISR_UART);
 }
 
 void USART2_IRQHandler(void)
 {
-    UART_ISR();
+    IRQ_LATENCY(IRQ_SRC_UART);
+    TRACE_ISR_ENTER(TRACE_ISR_UART);
+    usart_irq(1);
+    TRACE_ISR_EXIT(TRACE_ISR_UART);
 }
 
+#if !MODBUS_ENABLE // Otherwise USART3 is the Modbus line, see modbus_port.c.
 void USART3_IRQHandler(void)
 {
-    UART_ISR();
+    TRACE_ISR_ENTER(TRACE_ISR_UART);
+    usart_irq(2);
+    TRACE_ISR_EXIT(TRACE_ISR_UART);
 }
+#endif
 
 void UART4_IRQHandler(void)
 {
-    UART_ISR();
+    usart_irq(3);
 }
 
 void UART5_IRQHandler(void)
 {
-    UART_ISR();
+    usart_irq(4);
+}
+
+/* USART2_RX is mapped to DMA1 channel 6 (request 2). */
+void DMA1_Channel6_IRQHandler(void)
+{
+    dma_irq(DMA1, LL_DMA_CHANNEL_6);
+}
+
+/* USART2_TX is mapped to DMA1 channel 7 (request 2). */
+void DMA1_Channel7_IRQHandler(void)
+{
+    dma_irq(DMA1, LL_DMA_CHANNEL_7);
+}
+
+/* USART1_TX is mapped to DMA2 channel 6 (request 2). */
+void DMA2_Channel6_IRQHandler(void)
+{
+    dma_irq(DMA2, LL_DMA_CHANNEL_6);
 }
 
 ////////////////////////////////////////////////////////////////////////////////
 // Private (static) function definitions
 ////////////////////////////////////////////////////////////////////////////////
 
-static void UART_ISR(void)
+/**
+ * @brief Run UART ISR of the port using a UART peripheral.
+ *
+ * @param slot Peripheral, 0 for USART1 up to 4 for UART5.
+ */
+static inline void usart_irq(uint32_t slot)
+{
+    if (usart_ports[slot] != NULL)
+    {
+        UART_ISR(usart_ports[slot]);
+    }
+}
+
+/**
+ * @brief Run transmit or receive DMA ISR of the port using a DMA channel.
+ *
+ * @param dma DMA controller (DMA1 or DMA2).
+ * @param channel DMA channel (LL_DMA_CHANNEL_x).
+ */
+static void dma_irq(DMA_TypeDef *dma, uint32_t channel)
+{
+    for (uint32_t port = 0; port < UART_NUM_PORTS; port++)
+    {
+        UART_t *uart = &uarts[port];
+        if (uart->tx_dma == dma && uart->tx_dma_channel == channel)
+        {
+            UART_TX_DMA_ISR(uart);
+            return;
+        }
+        if (uart->rx_dma == dma && uart->rx_dma_channel == channel)
+        {
+            UART_RX_DMA_ISR(uart);
+            return;
+        }
+    }
+}
+
+static void RAMFUNC UART_ISR(UART_t *uart)
 {
+    PROF_BEGIN(uart_isr);
+    uint32_t start_cyc = DWT->CYCCNT;
+
     /* Read interrupt status register. */
-    uint32_t status_reg = uart.uart_reg_base->ISR;
+    uint32_t status_reg = uart->uart_reg_base->ISR;
 
     /* Service interrupt flags. */
-    if (status_reg & USART_ISR_RXNE_Msk)
+    if ((status_reg & USART_ISR_RXNE_Msk) && LL_USART_IsEnabledIT_RXNE(uart->uart_reg_base))
     {
-        read_rdr();
+        read_rdr(uart); // RXNE flag is also set while DMA owns the receiver, only service it in interrupt mode.
     }
-    if (status_reg & USART_ISR_TXE_Msk)
+    if ((status_reg & USART_ISR_TXE_Msk) && LL_USART_IsEnabledIT_TXE(uart->uart_reg_base))
     {
-        write_tdr();
+        write_tdr(uart); // TXE flag is also set while DMA owns the transmitter, only service it in interrupt mode.
+    }
+    if ((status_reg & USART_ISR_IDLE_Msk) && LL_USART_IsEnabledIT_IDLE(uart->uart_reg_base))
+    {
+        LL_USART_ClearFlag_IDLE(uart->uart_reg_base);
+        if (uart->rx_dma != NULL)
+        {
+            rx_dma_drain(uart);
+        }
+        if (uart->rx_idle != NULL)
+        {
+            uart->rx_idle();
+        }
     }
 
     /* Check error flags. */
     if (status_reg & (USART_ISR_ORE | USART_ISR_NE | USART_ISR_FE | USART_ISR_PE))
     {
+        LOGW_ISR(TAG, "Receive error flags 0x%lx", status_reg & (USART_ISR_ORE | USART_ISR_NE | USART_ISR_FE | USART_ISR_PE));
         if (status_reg & LL_USART_ISR_ORE)
         {   // An overrun error occurs if a character is received and RXNE has not been reset.
             // The RDR register content is not lost but the shift register is overwritten by incoming data.
-            INC_SAT_U16(uart_pms[CNT_RX_UART_ORE]);
-            LL_USART_ClearFlag_ORE(uart.uart_reg_base);
+            INC_SAT_U32(uart->stats->cnt[CNT_RX_UART_ORE]);
+            LL_USART_ClearFlag_ORE(uart->uart_reg_base);
         }
         if (status_reg & LL_USART_ISR_NE)
         {
-            INC_SAT_U16(uart_pms[CNT_RX_UART_NE]);
-            LL_USART_ClearFlag_NE(uart.uart_reg_base);
+            INC_SAT_U32(uart->stats->cnt[CNT_RX_UART_NE]);
+            LL_USART_ClearFlag_NE(uart->uart_reg_base);
         }
         if (status_reg & LL_USART_ISR_FE)
         {
-            INC_SAT_U16(uart_pms[CNT_RX_UART_FE]);
-            LL_USART_ClearFlag_FE(uart.uart_reg_base);
+            INC_SAT_U32(uart->stats->cnt[CNT_RX_UART_FE]);
+            LL_USART_ClearFlag_FE(uart->uart_reg_base);
         }
         if (status_reg & LL_USART_ISR_PE)
         {
-            INC_SAT_U16(uart_pms[CNT_RX_UART_PE]);
-            LL_USART_ClearFlag_PE(uart.uart_reg_base);
+            INC_SAT_U32(uart->stats->cnt[CNT_RX_UART_PE]);
+            LL_USART_ClearFlag_PE(uart->uart_reg_base);
         }
     }
+
+    uint32_t isr_cyc = DWT->CYCCNT - start_cyc;
+    uart->stats->isr_total += isr_cyc; // UART and DMA ISRs of a port share one priority.
+    cmd_pm_record_hist(&uart->stats->isr_cycles, isr_cyc);
+    PROF_END(uart_isr);
+}
+
+/**
+ * @brief Read character from receive data register (RDR) and pass it to receiver.
+ */
+static inline void read_rdr(UART_t *uart)
+{
+    char rx_char = uart->uart_reg_base->RDR & 0xFFU; // Clears RXNE flag.
+    power_stop_hold(POWER_RX_HOLD_MS);
+    rx_post(uart, rx_char);
 }
 
 /**
- * @brief Read character from receive data register (RDR) and send to console message queue.
+ * @brief Pass received character to receiver, counting characters it dropped.
  */
-static inline void read_rdr(void)
+static inline void rx_post(UART_t *uart, char c)
 {
-    char rx_char = uart.uart_reg_base->RDR & 0xFFU; // Clears RXNE flag.
-    mod_err_t err = console_post(rx_char);
-    if (err == MOD_ERR_TIMEOUT)
+    if (uart->abr_armed)
     {
-        INC_SAT_U16(uart_pms[CNT_RX_BUF_OVERRUN]);
+        uart->abr_armed = false;
+        if ((uint8_t)c == UART_ABR_CHAR)
+        {
+            return; // Auto baud rate detection character, not meant for receiver.
+        }
+    }
+    if (uart->rx_post(c) == MOD_ERR_TIMEOUT)
+    {
+        INC_SAT_U32(uart->stats->cnt[CNT_RX_BUF_OVERRUN]);
+    }
+    else
+    {
+        cmd_pm_add_u64(&uart->stats->rx_bytes, 1);
     }
 }
 
 /**
- * @brief Write character from transmit buffer to transmit data register (TDR).
+ * @brief Write character from transmit buffer, or from a due block queued by reference, to transmit data register (TDR).
  */
-static inline void write_tdr(void)
+static inline void write_tdr(UART_t *uart)
 {
-    if (uart.tx_buf_get_idx == uart.tx_buf_put_idx)
+    uint8_t tx_char = 0;
+    UART_ref_t *ref = tx_ref_due(uart);
+    if (ref != NULL)
+    {
+        uart->uart_reg_base->TDR = ref->buf[uart->tx_ref_pos++]; // Clears TXE flag.
+        if (uart->tx_ref_pos == ref->len)
+        {
+            uart->tx_ref_pos = 0;
+            tx_ref_finish(uart);
+        }
+    }
+    else if (!ringbuf_pop_byte(&uart->tx_ring, &tx_char))
     {
         /* Nothing to transmit, disable TXE flag from generating an interrupt. */
-        LL_USART_DisableIT_TXE(uart.uart_reg_base);
+        LL_USART_DisableIT_TXE(uart->uart_reg_base);
+    }
+    else
+    {
+        uart->uart_reg_base->TDR = tx_char; // Clears TXE flag.
+    }
+}
+
+/**
+ * @brief Start transmission of characters placed in transmit buffer.
+ *
+ * Kicks DMA channel if it is idle (the transfer complete ISR picks up new data otherwise),
+ * or ensures TXE interrupt is enabled.
+ *
+ * @note Must be called with interrupts disabled.
+ */
+static inline void start_tx(UART_t *uart)
+{
+    if (uart->tx_dma != NULL)
+    {
+        /* Transmission starts in uart_start() if DMA interrupt is not enabled yet. */
+        if (__NVIC_GetEnableIRQ(uart->tx_dma_irq_num))
+        {
+            start_tx_dma(uart);
+        }
+    }
+    else if (!LL_USART_IsEnabledIT_TXE(uart->uart_reg_base))
+    {
+        LL_USART_EnableIT_TXE(uart->uart_reg_base);
+    }
+}
+
+/**
+ * @brief Configure DMA channel for memory-to-peripheral transfers into the transmit data register (TDR).
+ *
+ * @param uart Port.
+ * @param request DMA channel request mapping (LL_DMA_REQUEST_x).
+ */
+static void tx_dma_init(UART_t *uart, uint32_t request)
+{
+    dma_clock_enable(uart->tx_dma);
+
+    LL_DMA_DisableChannel(uart->tx_dma, uart->tx_dma_channel);
+    LL_DMA_SetPeriphRequest(uart->tx_dma, uart->tx_dma_channel, request);
+    LL_DMA_ConfigTransfer(uart->tx_dma, uart->tx_dma_channel,
+                          LL_DMA_DIRECTION_MEMORY_TO_PERIPH |
+                              LL_DMA_PRIORITY_LOW |
+                              LL_DMA_MODE_NORMAL |
+                              LL_DMA_PERIPH_NOINCREMENT |
+                              LL_DMA_MEMORY_INCREMENT |
+                              LL_DMA_PDATAALIGN_BYTE |
+                              LL_DMA_MDATAALIGN_BYTE);
+    LL_DMA_SetPeriphAddress(uart->tx_dma, uart->tx_dma_channel,
+                            LL_USART_DMA_GetRegAddr(uart->uart_reg_base, LL_USART_DMA_REG_DATA_TRANSMIT));
+    LL_DMA_EnableIT_TC(uart->tx_dma, uart->tx_dma_channel);
+    LL_DMA_EnableIT_HT(uart->tx_dma, uart->tx_dma_channel);
+    LL_DMA_EnableIT_TE(uart->tx_dma, uart->tx_dma_channel);
+
+    LL_USART_EnableDMAReq_TX(uart->uart_reg_base);
+}
+
+/**
+ * @brief Hand next contiguous region of transmit buffer, or next block queued by reference, to DMA channel.
+ *
+ * Region ends at the put index, at the end of the buffer or where a block was queued by
+ * reference, whichever comes first, so a wrapped-around buffer is transmitted in two transfers.
+ *
+ * @note Must be called with interrupts disabled or from within the DMA channel ISR.
+ */
+static void start_tx_dma(UART_t *uart)
+{
+    if (uart->tx_dma_busy)
+    {
+        return;
+    }
+
+    const uint8_t *region = NULL;
+    uint32_t len;
+    UART_ref_t *ref = tx_ref_due(uart);
+    if (ref != NULL)
+    {
+        region = ref->buf;
+        len = ref->len;
+    }
+    else
+    {
+        len = ringbuf_peek_contig(&uart->tx_ring, &region);
+        if (uart->tx_ref_get != uart->tx_ref_put)
+        {
+            uint32_t before = uart->tx_refs[uart->tx_ref_get & (UART_TX_REFS - 1U)].at - uart->tx_ring.get_idx;
+            len = len < before ? len : before;
+        }
+    }
+    if (len == 0)
+    {
+        return;
+    }
+
+    uart->tx_dma_ref = ref != NULL;
+    uart->tx_dma_len = len;
+    uart->tx_dma_released = 0;
+    uart->tx_dma_busy = true;
+
+    LL_DMA_DisableChannel(uart->tx_dma, uart->tx_dma_channel);
+    LL_DMA_SetMemoryAddress(uart->tx_dma, uart->tx_dma_channel, (uint32_t)region);
+    LL_DMA_SetDataLength(uart->tx_dma, uart->tx_dma_channel, len);
+    LL_DMA_EnableChannel(uart->tx_dma, uart->tx_dma_channel);
+}
+
+/**
+ * @brief Transmit DMA channel interrupt service routine.
+ *
+ * Half-transfer releases the first half of the region back to the transmit buffer early,
+ * transfer complete releases the remainder and starts the next region.
+ */
+static void UART_TX_DMA_ISR(UART_t *uart)
+{
+    uint32_t start_cyc = DWT->CYCCNT;
+    uint32_t status_reg = uart->tx_dma->ISR;
+    uint32_t ch = uart->tx_dma_channel;
+
+    if (status_reg & DMA_FLAG_TE(ch))
+    {
+        /* Channel is disabled by hardware on transfer error, drop the region. */
+        INC_SAT_U32(uart->stats->cnt[CNT_TX_DMA_TE]);
+        uart->tx_dma->IFCR = DMA_FLAG_GI(ch);
+        tx_dma_release(uart);
+        start_tx_dma(uart);
+        uart->stats->isr_total += DWT->CYCCNT - start_cyc;
+        return;
+    }
+
+    if (status_reg & DMA_FLAG_HT(ch))
+    {
+        uart->tx_dma->IFCR = DMA_FLAG_HT(ch);
+        if (!uart->tx_dma_ref) // A block queued by reference is released whole.
+        {
+            uart->tx_dma_released = uart->tx_dma_len / 2;
+            ringbuf_advance(&uart->tx_ring, uart->tx_dma_released);
+        }
+    }
+
+    if (status_reg & DMA_FLAG_TC(ch))
+    {
+        uart->tx_dma->IFCR = DMA_FLAG_GI(ch);
+        tx_dma_release(uart);
+        start_tx_dma(uart);
+    }
+    uart->stats->isr_total += DWT->CYCCNT - start_cyc;
+}
+
+/**
+ * @brief Release current DMA transfer: the rest of its transmit buffer region, or its block queued by reference.
+ *
+ * @note Must be called from within the DMA channel ISR.
+ */
+static void tx_dma_release(UART_t *uart)
+{
+    if (uart->tx_dma_ref)
+    {
+        uart->tx_dma_ref = false;
+        tx_ref_finish(uart);
+    }
+    else
+    {
+        ringbuf_advance(&uart->tx_ring, uart->tx_dma_len - uart->tx_dma_released);
+    }
+    uart->tx_dma_busy = false;
+}
+
+/**
+ * @brief Get head block queued by reference if the transmit buffer drained up to where it was queued.
+ *
+ * @return Block, NULL if none is due.
+ */
+static inline UART_ref_t *tx_ref_due(UART_t *uart)
+{
+    if (uart->tx_ref_get == uart->tx_ref_put)
+    {
+        return NULL;
+    }
+    UART_ref_t *ref = &uart->tx_refs[uart->tx_ref_get & (UART_TX_REFS - 1U)];
+    return ref->at == uart->tx_ring.get_idx ? ref : NULL;
+}
+
+/**
+ * @brief Release head block queued by reference to its owner.
+ */
+static void tx_ref_finish(UART_t *uart)
+{
+    UART_ref_t ref = uart->tx_refs[uart->tx_ref_get & (UART_TX_REFS - 1U)];
+    uart->tx_ref_get++;
+    if (ref.done != NULL)
+    {
+        ref.done(ref.ctx);
+    }
+}
+
+/**
+ * @brief Configure DMA channel for circular peripheral-to-memory transfers from the receive data register (RDR).
+ *
+ * @param uart Port.
+ * @param request DMA channel request mapping (LL_DMA_REQUEST_x).
+ *
+ * @note Channel is enabled in uart_start().
+ */
+static void rx_dma_init(UART_t *uart, uint32_t request)
+{
+    dma_clock_enable(uart->rx_dma);
+
+    LL_DMA_DisableChannel(uart->rx_dma, uart->rx_dma_channel);
+    LL_DMA_SetPeriphRequest(uart->rx_dma, uart->rx_dma_channel, request);
+    LL_DMA_ConfigTransfer(uart->rx_dma, uart->rx_dma_channel,
+                          LL_DMA_DIRECTION_PERIPH_TO_MEMORY |
+                              LL_DMA_PRIORITY_HIGH |
+                              LL_DMA_MODE_CIRCULAR |
+                              LL_DMA_PERIPH_NOINCREMENT |
+                              LL_DMA_MEMORY_INCREMENT |
+                              LL_DMA_PDATAALIGN_BYTE |
+                              LL_DMA_MDATAALIGN_BYTE);
+    LL_DMA_ConfigAddresses(uart->rx_dma, uart->rx_dma_channel,
+                           LL_USART_DMA_GetRegAddr(uart->uart_reg_base, LL_USART_DMA_REG_DATA_RECEIVE),
+                           (uint32_t)uart->rx_dma_buf,
+                           LL_DMA_DIRECTION_PERIPH_TO_MEMORY);
+    LL_DMA_SetDataLength(uart->rx_dma, uart->rx_dma_channel, UART_RX_DMA_BUF_SIZE);
+    LL_DMA_EnableIT_TC(uart->rx_dma, uart->rx_dma_channel);
+    LL_DMA_EnableIT_HT(uart->rx_dma, uart->rx_dma_channel);
+    LL_DMA_EnableIT_TE(uart->rx_dma, uart->rx_dma_channel);
+    uart->rx_dma_pos = 0;
+}
+
+/**
+ * @brief Receive DMA channel interrupt service routine.
+ *
+ * Half-transfer and transfer complete events drain the half of the
+ * circular buffer that was just filled. IDLE line events (UART ISR)
+ * drain partially filled halves.
+ */
+static void UART_RX_DMA_ISR(UART_t *uart)
+{
+    uint32_t status_reg = uart->rx_dma->ISR;
+    uint32_t ch = uart->rx_dma_channel;
+
+    if (status_reg & DMA_FLAG_TE(ch))
+    {
+        INC_SAT_U32(uart->stats->cnt[CNT_RX_DMA_TE]);
+    }
+    if (status_reg & (DMA_FLAG_HT(ch) | DMA_FLAG_TC(ch)))
+    {
+        rx_dma_drain(uart);
+    }
+    uart->rx_dma->IFCR = DMA_FLAG_GI(ch);
+}
+
+/**
+ * @brief Pass characters written by receive DMA channel since the previous drain to receiver.
+ *
+ * @note Must only be called from UART or receive DMA channel ISRs, which share the same priority.
+ */
+static void rx_dma_drain(UART_t *uart)
+{
+    uint32_t pos = UART_RX_DMA_BUF_SIZE - LL_DMA_GetDataLength(uart->rx_dma, uart->rx_dma_channel);
+    if (pos == UART_RX_DMA_BUF_SIZE)
+    {
+        pos = 0;
+    }
+    if (uart->rx_dma_pos != pos)
+    {
+        power_stop_hold(POWER_RX_HOLD_MS);
+    }
+
+    while (uart->rx_dma_pos != pos)
+    {
+        rx_post(uart, (char)uart->rx_dma_buf[uart->rx_dma_pos]);
+        uart->rx_dma_pos = (uart->rx_dma_pos + 1) % UART_RX_DMA_BUF_SIZE;
+    }
+}
+
+/**
+ * @brief Enable clock of DMA controller.
+ *
+ * @param dma DMA controller (DMA1 or DMA2).
+ */
+static inline void dma_clock_enable(DMA_TypeDef *dma)
+{
+    if (dma == DMA1)
+    {
+        LL_AHB1_GRP1_EnableClock(LL_AHB1_GRP1_PERIPH_DMA1);
+    }
+    else
+    {
+        LL_AHB1_GRP1_EnableClock(LL_AHB1_GRP1_PERIPH_DMA2);
+    }
+}
+
+/**
+ * @brief Measure console port transmit path in character and/or block mode.
+ *
+ * @param argc Number of arguments.
+ * @param argv Argument values.
+ *
+ * @return 0 if successful, 1 otherwise.
+ */
+static uint32_t uart_bench_cmd(uint32_t argc, const char **argv)
+{
+    return uart_bench(UART_CONSOLE, argc, argv);
+}
+
+/**
+ * @brief Measure telemetry port transmit path in character and/or block mode.
+ *
+ * @param argc Number of arguments.
+ * @param argv Argument values.
+ *
+ * @return 0 if successful, 1 otherwise.
+ */
+static uint32_t telem_bench_cmd(uint32_t argc, const char **argv)
+{
+    return uart_bench(UART_TELEMETRY, argc, argv);
+}
+
+/**
+ * @brief Measure transmit path of a port in character and/or block mode.
+ *
+ * @param port Port.
+ * @param argc Number of arguments.
+ * @param argv Argument values.
+ *
+ * @return 0 if successful, 1 otherwise.
+ */
+static uint32_t uart_bench(uart_port_t port, uint32_t argc, const char **argv)
+{
+    cmd_arg_val arg_vals[2];
+    int32_t num_args = cmd_parse_args(argc, argv, "u[s", arg_vals);
+    if (num_args < 1)
+    {
+        return 1;
+    }
+    uint32_t bytes = arg_vals[0].val.u;
+    const char *mode = num_args >= 2 ? arg_vals[1].val.s : "all";
+    bool all = strcmp(mode, "all") == 0;
+    if (bytes == 0 || bytes > UART_BENCH_MAX_BYTES ||
+        (!all && strcmp(mode, "char") != 0 && strcmp(mode, "block") != 0))
+    {
+        LOG("Usage: %s bench <bytes, 1 to %lu> [char|block|all]\r\n",
+            uart_client_info[port]->client_name, (uint32_t)UART_BENCH_MAX_BYTES);
+        return 1;
+    }
+    if (uarts[port].uart_reg_base == NULL)
+    {
+        LOG("%s port not initialized\r\n", uart_client_info[port]->client_name);
+        return 1;
+    }
+
+    LOG("%-6s %4s %6s %9s %9s %9s %6s %9s\r\n",
+        "Mode", "Path", "Bytes", "Bytes/s", "Write", "ISR", "ISR", "Overruns");
+    LOG("%-6s %4s %6s %9s %9s %9s %6s %9s\r\n",
+        "", "", "", "", "(cyc/B)", "(cyc/B)", "(%)", "");
+    /* Modes share one budget, so the command thread stays within the active object watchdog timeout. */
+    uint32_t const deadline = osKernelGetTickCount() + UART_BENCH_BUDGET_MS;
+    bool ok = true;
+    if (all || strcmp(mode, "char") == 0)
+    {
+        ok &= uart_bench_run(port, false, bytes, deadline);
+    }
+    if (all || strcmp(mode, "block") == 0)
+    {
+        ok &= uart_bench_run(port, true, bytes, deadline);
+    }
+    return ok ? 0 : 1;
+}
+
+/**
+ * @brief Write pattern through transmit path whenever the buffer has room, wait until the line is idle,
+ *        and print a row of results.
+ *
+ * The run starts from an idle transmitter and ends by the deadline of the command; a run out
+ * of time reports the bytes sent so far.
+ *
+ * @param port Port.
+ * @param block Write UART_BENCH_BLOCK byte blocks with uart_write() rather than single characters.
+ * @param bytes Number of bytes to write.
+ * @param deadline Kernel tick by which the run ends, drain included.
+ *
+ * @return true if every byte was written and transmitted before the deadline.
+ */
+static bool uart_bench_run(uart_port_t port, bool block, uint32_t bytes, uint32_t deadline)
+{
+    UART_t *uart = &uarts[port];
+    while (!uart_tx_idle(port) && (int32_t)(osKernelGetTickCount() - deadline) < 0)
+    {
+        osDelay(1);
+    }
+
+    uint32_t overruns = uart->stats->cnt[CNT_TX_BUF_OVERRUN];
+    uint32_t isr_start = uart->stats->isr_total;
+    uint32_t write_cyc = 0;
+    uint32_t sent = 0;
+    uint32_t start = DWT->CYCCNT;
+    while (sent < bytes && (int32_t)(osKernelGetTickCount() - deadline) < 0)
+    {
+        uint32_t len = block ? (bytes - sent < UART_BENCH_BLOCK ? bytes - sent : UART_BENCH_BLOCK) : 1U;
+        if (uart_tx_free(port) < len)
+        {
+            osDelay(1); // Line drains UART_TX_BUF_SIZE bytes in far more than a tick.
+            continue;
+        }
+        uint32_t t = DWT->CYCCNT;
+        mod_err_t err = uart_write(port, &bench_pattern[sent % 2U], len);
+        write_cyc += DWT->CYCCNT - t;
+        sent += err == MOD_OK ? len : 0U;
+    }
+    while (!uart_tx_idle(port) && (int32_t)(osKernelGetTickCount() - deadline) < 0)
+    {
+        osDelay(1);
+    }
+    bool done = sent == bytes && uart_tx_idle(port);
+    uint32_t elapsed = DWT->CYCCNT - start;
+    uint32_t isr_cyc = uart->stats->isr_total - isr_start;
+
+    float elapsed_s = (float)elapsed / (float)SystemCoreClock;
+    LOG("%-6s %4s %6lu %9.0f %9.1f %9.1f %6.2f %9lu%s\r\n",
+        block ? "block" : "char",
+        uart->tx_dma != NULL ? "DMA" : "TXE",
+        sent,
+        elapsed_s > 0.0f ? (float)sent / elapsed_s : 0.0f,
+        sent ? (float)write_cyc / (float)sent : 0.0f,
+        sent ? (float)isr_cyc / (float)sent : 0.0f,
+        elapsed ? 100.0f * (float)isr_cyc / (float)elapsed : 0.0f,
+        uart->stats->cnt[CNT_TX_BUF_OVERRUN] - overruns,
+        done ? "" : " (out of time)");
+    return done;
+}
+
+/**
+ * @brief Show or change console port baud rate.
+ *
+ * @param argc Number of arguments.
+ * @param argv Argument values.
+ *
+ * @return 0 if successful, 1 otherwise.
+ */
+static uint32_t uart_baud_cmd(uint32_t argc, const char **argv)
+{
+    return uart_baud(UART_CONSOLE, argc, argv);
+}
+
+/**
+ * @brief Show or change telemetry port baud rate.
+ *
+ * @param argc Number of arguments.
+ * @param argv Argument values.
+ *
+ * @return 0 if successful, 1 otherwise.
+ */
+static uint32_t telem_baud_cmd(uint32_t argc, const char **argv)
+{
+    return uart_baud(UART_TELEMETRY, argc, argv);
+}
+
+/**
+ * @brief Show baud rate of a port, change it or arm its auto baud rate detection pending
+ *        confirmation, or confirm a pending change.
+ *
+ * A change waits for the port to finish transmitting, so the reply goes out at the old rate.
+ *
+ * @param port Port.
+ * @param argc Number of arguments.
+ * @param argv Argument values.
+ *
+ * @return 0 if successful, 1 otherwise.
+ */
+static uint32_t uart_baud(uart_port_t port, uint32_t argc, const char **argv)
+{
+    const char *name = uart_client_info[port]->client_name;
+    UART_t *uart = &uarts[port];
+    cmd_arg_val arg_vals[1];
+    int32_t num_args = cmd_parse_args(argc, argv, "[s", arg_vals);
+    if (num_args < 0)
+    {
+        return 1;
+    }
+    if (uart->uart_reg_base == NULL)
+    {
+        LOG("%s port not initialized\r\n", name);
+        return 1;
+    }
+    if (num_args == 0)
+    {
+        LOG("%lu baud%s\r\n", uart_baud_get(port), uart->baud_revert != 0 ? " (awaiting confirmation)" : "");
+        return 0;
+    }
+
+    const char *arg = arg_vals[0].val.s;
+    if (strcmp(arg, "confirm") == 0)
+    {
+        if (baud_claim(uart) == 0)
+        {
+            LOG("No baud rate change pending\r\n");
+            return 1;
+        }
+        LOGI(TAG, "%s port baud rate %lu confirmed", name, uart_baud_get(port));
+        return 0;
+    }
+
+    bool detect = strcmp(arg, "auto") == 0;
+    char *end;
+    uint32_t baud = detect ? 0U : strtoul(arg, &end, 10);
+    if (!detect && (*end != '\0' || baud < UART_BAUD_MIN || baud > UART_BAUD_MAX))
+    {
+        LOG("Usage: %s baud [<rate, %lu to %lu>|auto|confirm]\r\n", name, (uint32_t)UART_BAUD_MIN, (uint32_t)UART_BAUD_MAX);
+        return 1;
+    }
+    if (detect && uart->rx_post == NULL)
+    {
+        LOG("%s port has no receiver to detect a baud rate with\r\n", name);
+        return 1;
+    }
+    if (uart->baud_revert != 0)
+    {
+        LOG("Baud rate change pending, confirm it or wait for it to revert\r\n");
+        return 1;
+    }
+    if (baud_timers[port] == NULL)
+    {
+        /* Created on first use, ports are initialized before the kernel. */
+        const osTimerAttr_t timer_attr = {.name = "baud", .cb_mem = &baud_timer_cbs[port], .cb_size = sizeof(baud_timer_cbs[port])};
+        baud_timers[port] = osTimerNew(baud_timeout, osTimerOnce, uart, &timer_attr);
+        ASSERT(baud_timers[port] != NULL);
+    }
+
+    if (detect)
+    {
+        LOG("Send 'U' at the new rate, then \"%s baud confirm\" within %lu ms\r\n", name, (uint32_t)UART_BAUD_CONFIRM_MS);
     }
     else
     {
-        uart.uart_reg_base->TDR = uart.tx_buf[uart.tx_buf_get_idx]; // Clears TXE flag.
-        uart.tx_buf_get_idx = (uart.tx_buf_get_idx + 1) % UART_TX_BUF_SIZE;
+        LOG("Switching to %lu baud, confirm with \"%s baud confirm\" within %lu ms\r\n",
+            baud, name, (uint32_t)UART_BAUD_CONFIRM_MS);
     }
+    uint32_t deadline = osKernelGetTickCount() + UART_BAUD_DRAIN_MS;
+    while (!uart_tx_idle(port) && (int32_t)(osKernelGetTickCount() - deadline) < 0)
+    {
+        osDelay(1);
+    }
+
+    uart->baud_revert = uart_baud_get(port);
+    if (detect)
+    {
+        /* Auto baud rate settings can only be written while UART is disabled. Detection measures
+         * the next character and writes the baud rate register itself. */
+        USART_TypeDef *reg = uart->uart_reg_base;
+        uint32_t primask = __get_PRIMASK();
+        __disable_irq();
+        uint32_t cr1 = reg->CR1;
+        CLEAR_BIT(reg->CR1, USART_CR1_UE);
+        LL_USART_SetAutoBaudRateMode(reg, LL_USART_AUTOBAUD_DETECT_ON_55_FRAME);
+        LL_USART_EnableAutoBaudRate(reg);
+        uart->abr_armed = true;
+        reg->CR1 = cr1;
+        __set_PRIMASK(primask);
+    }
+    else
+    {
+        (void)uart_baud_set(port, baud);
+    }
+    osTimerStart(baud_timers[port], pdMS_TO_TICKS(UART_BAUD_CONFIRM_MS));
+    return 0;
+}
+
+/**
+ * @brief Claim pending baud rate change of a port, stopping its timer and auto baud rate detection.
+ *
+ * Confirmation and timeout race for the change, only the first one to claim it acts on it.
+ *
+ * @param uart Port.
+ *
+ * @return Baud rate before the change, 0 if none was pending.
+ */
+static uint32_t baud_claim(UART_t *uart)
+{
+    uint32_t primask = __get_PRIMASK();
+    __disable_irq();
+    uint32_t baud = uart->baud_revert;
+    uart->baud_revert = 0;
+    uart->abr_armed = false;
+    if (baud != 0 && LL_USART_IsEnabledAutoBaud(uart->uart_reg_base))
+    {
+        USART_TypeDef *reg = uart->uart_reg_base;
+        uint32_t cr1 = reg->CR1;
+        CLEAR_BIT(reg->CR1, USART_CR1_UE);
+        LL_USART_DisableAutoBaudRate(reg); // Keeps the detected rate.
+        reg->CR1 = cr1;
+    }
+    __set_PRIMASK(primask);
+
+    if (baud != 0)
+    {
+        (void)osTimerStop(baud_timers[uart - uarts]); // Fails harmlessly once the timer expired.
+    }
+    return baud;
+}
+
+/**
+ * @brief Restore baud rate of a port whose change was not confirmed in time.
+ *
+ * @param arg Port (UART_t).
+ */
+static void baud_timeout(void *arg)
+{
+    UART_t *uart = arg;
+    uint32_t baud = baud_claim(uart);
+    if (baud != 0)
+    {
+        uart_port_t port = (uart_port_t)(uart - uarts);
+        (void)uart_baud_set(port, baud);
+        LOGW(TAG, "%s port baud rate change not confirmed, back to %lu", uart_client_info[port]->client_name, baud);
+    }
+}
+
+/**
+ * @brief Get bus clock of a UART peripheral.
+ *
+ * USART1 is clocked from PCLK2, the others from PCLK1 (SystemClock_Config()).
+ *
+ * @param reg UART peripheral.
+ *
+ * @return Clock frequency (Hz).
+ */
+static inline uint32_t uart_clock_hz(USART_TypeDef *reg)
+{
+    return reg == USART1 ? HAL_RCC_GetPCLK2Freq() : HAL_RCC_GetPCLK1Freq();
 }
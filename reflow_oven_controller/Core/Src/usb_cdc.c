@@ -0,0 +1,980 @@
+/**
+ * @file usb_cdc.c
+ * @author Timothy Nguyen
+ * @brief USB CDC ACM virtual COM port on the USB OTG FS peripheral using registers.
+ * @version 0.1
+ * @date 2021-08-18
+ */
+
+#include <stdbool.h>
+#include <string.h>
+
+#include "usb_cdc.h"
+#include "console.h"
+
+#if CONSOLE_USB_CDC
+
+#include "stm32l4xx_hal.h"
+#include "cmd.h"
+#include "log.h"
+#include "ringbuf.h"
+#include "trace.h"
+#include "irq.h"
+
+////////////////////////////////////////////////////////////////////////////////
+// Common macros
+////////////////////////////////////////////////////////////////////////////////
+
+/* OTG FS device mode register blocks. */
+#define USB_DEV ((USB_OTG_DeviceTypeDef *)(USB_OTG_FS_PERIPH_BASE + USB_OTG_DEVICE_BASE))
+#define USB_INEP(ep) ((USB_OTG_INEndpointTypeDef *)(USB_OTG_FS_PERIPH_BASE + USB_OTG_IN_ENDPOINT_BASE + (ep)*USB_OTG_EP_REG_SIZE))
+#define USB_OUTEP(ep) ((USB_OTG_OUTEndpointTypeDef *)(USB_OTG_FS_PERIPH_BASE + USB_OTG_OUT_ENDPOINT_BASE + (ep)*USB_OTG_EP_REG_SIZE))
+#define USB_FIFO(ep) (*(__IO uint32_t *)(USB_OTG_FS_PERIPH_BASE + USB_OTG_FIFO_BASE + (ep)*USB_OTG_FIFO_SIZE))
+#define USB_PCGCCTL (*(__IO uint32_t *)(USB_OTG_FS_PERIPH_BASE + USB_OTG_PCGCCTL_BASE))
+
+/* Endpoints */
+#define EP0_SIZE 64U     // Control endpoint maximum packet size.
+#define EP_DATA 1U       // Bulk IN/OUT data endpoint number.
+#define EP_DATA_SIZE 64U // Bulk endpoint maximum packet size.
+#define EP_CMD 2U        // Interrupt IN notification endpoint number.
+#define EP_CMD_SIZE 8U   // Interrupt endpoint maximum packet size.
+
+/* FIFO RAM partition in 32-bit words, 320 words available. */
+#define RX_FIFO_WORDS 128U      // Shared receive FIFO.
+#define EP0_TX_FIFO_WORDS 32U   // Control IN FIFO.
+#define DATA_TX_FIFO_WORDS 128U // Bulk IN FIFO, also bounds length of one IN transfer.
+#define CMD_TX_FIFO_WORDS 16U   // Interrupt IN FIFO.
+
+/* Longest bulk IN transfer, written to FIFO at once so that no FIFO empty interrupt is needed. */
+#define DATA_TX_MAX_LEN (DATA_TX_FIFO_WORDS * 4U)
+
+/* Receive status packet types (GRXSTSP PKTSTS). */
+#define PKTSTS_OUT_DATA 2U   // OUT data packet received.
+#define PKTSTS_SETUP_DATA 6U // SETUP data packet received.
+
+/* Standard requests */
+#define REQ_GET_STATUS 0x00U
+#define REQ_CLEAR_FEATURE 0x01U
+#define REQ_SET_FEATURE 0x03U
+#define REQ_SET_ADDRESS 0x05U
+#define REQ_GET_DESCRIPTOR 0x06U
+#define REQ_GET_CONFIGURATION 0x08U
+#define REQ_SET_CONFIGURATION 0x09U
+#define REQ_GET_INTERFACE 0x0AU
+#define REQ_SET_INTERFACE 0x0BU
+
+/* CDC class requests */
+#define REQ_SET_LINE_CODING 0x20U
+#define REQ_GET_LINE_CODING 0x21U
+#define REQ_SET_CONTROL_LINE_STATE 0x22U
+#define REQ_SEND_BREAK 0x23U
+
+/* bmRequestType type field */
+#define REQ_TYPE_MASK 0x60U
+#define REQ_TYPE_STANDARD 0x00U
+#define REQ_TYPE_CLASS 0x20U
+
+/* Descriptor types */
+#define DESC_DEVICE 0x01U
+#define DESC_CONFIG 0x02U
+#define DESC_STRING 0x03U
+
+/* String descriptor indices */
+#define STR_LANG 0U
+#define STR_MANUFACTURER 1U
+#define STR_PRODUCT 2U
+#define STR_SERIAL 3U
+
+/* Startup timeouts */
+#define LSE_TIMEOUT_MS 5000U // LSE crystal startup.
+#define CLK_TIMEOUT_MS 10U   // MSI ready and core reset.
+
+#define LO(x) ((uint8_t)((x)&0xFFU))
+#define HI(x) ((uint8_t)(((x) >> 8) & 0xFFU))
+
+////////////////////////////////////////////////////////////////////////////////
+// Type definitions
+////////////////////////////////////////////////////////////////////////////////
+
+/**
+ * @brief Control endpoint transfer stage.
+ */
+typedef enum
+{
+    EP0_IDLE,     // Waiting for SETUP packet.
+    EP0_DATA_IN,  // Sending data stage of control read.
+    EP0_DATA_OUT, // Receiving data stage of control write.
+    EP0_STATUS,   // Status stage in progress.
+} EP0_state_t;
+
+/**
+ * @brief USB CDC device structure.
+ */
+typedef struct
+{
+    bool initialized;        // Core and clocks are configured.
+    volatile bool configured; // Host selected configuration, data endpoints active.
+
+    /* Transmission */
+    ringbuf_t tx_ring;                   // Transmit circular buffer.
+    uint8_t tx_buf[USB_CDC_TX_BUF_SIZE]; // Transmit circular buffer storage.
+    bool tx_busy;                        // Bulk IN transfer in progress.
+    uint32_t tx_len;                     // Number of bytes in current bulk IN transfer.
+
+    /* Control endpoint */
+    uint32_t setup[2];       // Last SETUP packet.
+    EP0_state_t ep0_state;   // Control transfer stage.
+    const uint8_t *ep0_data; // Remaining data stage of control read.
+    uint32_t ep0_remaining;  // Number of bytes remaining in data stage.
+    bool ep0_zlp;            // Data stage ends with a zero length packet.
+    uint8_t ep0_buf[EP0_SIZE]; // Control data buffer (string descriptors, short replies, OUT data).
+    uint32_t ep0_rx_len;       // Number of bytes received in OUT data stage.
+
+    /* CDC state */
+    uint8_t line_coding[7]; // Line coding set by host, only reported back.
+    uint16_t line_state;    // Control line state (bit 0 DTR, bit 1 RTS).
+    uint8_t config;         // Selected configuration value.
+} USB_CDC_t;
+
+/**
+ * @brief List of USB CDC performance measurements.
+ */
+typedef enum
+{
+    CNT_TX_BUF_OVERRUN, // Tx buffer overrun count.
+    CNT_RX_BUF_OVERRUN, // Rx characters dropped because console buffer was full.
+    CNT_BUS_RESET,      // USB bus reset count.
+    CNT_STALL,          // Unsupported control requests.
+
+    NUM_U32_PMS // Number of performance measurements
+} USB_CDC_pms_t;
+
+////////////////////////////////////////////////////////////////////////////////
+// Private (static) variables
+////////////////////////////////////////////////////////////////////////////////
+
+/* USB_CDC_t Instance */
+static USB_CDC_t usb;
+
+/* Performance measurement counters */
+static uint32_t usb_pms[NUM_U32_PMS];
+static uint64_t usb_rx_bytes; // Received bytes passed to console.
+static uint64_t usb_tx_bytes; // Bytes queued for transmission.
+
+/* Performance measurement info */
+static const cmd_pm_info usb_pm_info[] = {
+    {"TX BUF ORE", CMD_PM_U32, &usb_pms[CNT_TX_BUF_OVERRUN]},
+    {"RX BUF ORE", CMD_PM_U32, &usb_pms[CNT_RX_BUF_OVERRUN]},
+    {"BUS RESETS", CMD_PM_U32, &usb_pms[CNT_BUS_RESET]},
+    {"STALLS", CMD_PM_U32, &usb_pms[CNT_STALL]},
+    {"RX bytes", CMD_PM_U64, &usb_rx_bytes},
+    {"TX bytes", CMD_PM_U64, &usb_tx_bytes}};
+
+/* Command module client info */
+CMD_CLIENT_DEFINE(usb,
+                  .num_cmds = 0,
+                  .cmds = NULL,
+                  .num_pms = sizeof(usb_pm_info) / sizeof(usb_pm_info[0]),
+                  .pms = usb_pm_info);
+
+/* Device descriptor */
+static const uint8_t device_desc[] = {
+    18, DESC_DEVICE,
+    0x00, 0x02,                           // USB 2.0
+    0x02, 0x00, 0x00,                     // Class CDC, defined at interface level.
+    EP0_SIZE,                             // Control endpoint packet size.
+    LO(USB_CDC_VID), HI(USB_CDC_VID),     // Vendor ID.
+    LO(USB_CDC_PID), HI(USB_CDC_PID),     // Product ID.
+    0x00, 0x02,                           // Device release 2.00.
+    STR_MANUFACTURER, STR_PRODUCT, STR_SERIAL,
+    1};                                   // Number of configurations.
+
+/* Configuration descriptor: communication interface with notification endpoint and data interface with bulk endpoints. */
+static const uint8_t config_desc[] = {
+    /* Configuration */
+    9, DESC_CONFIG, 67, 0, 2, 1, 0, 0x80, 50, // 2 interfaces, bus powered, 100 mA.
+
+    /* Communication interface: CDC ACM, AT commands */
+    9, 0x04, 0, 0, 1, 0x02, 0x02, 0x01, 0,
+    5, 0x24, 0x00, 0x10, 0x01,    // Header functional descriptor, CDC 1.10.
+    5, 0x24, 0x01, 0x00, 1,       // Call management, data interface 1.
+    4, 0x24, 0x02, 0x02,          // ACM, supports line coding and control line state.
+    5, 0x24, 0x06, 0, 1,          // Union, master 0, slave 1.
+    7, 0x05, 0x80 | EP_CMD, 0x03, EP_CMD_SIZE, 0, 16, // Interrupt IN, 16 ms interval.
+
+    /* Data interface */
+    9, 0x04, 1, 0, 2, 0x0A, 0x00, 0x00, 0,
+    7, 0x05, EP_DATA, 0x02, EP_DATA_SIZE, 0, 0,        // Bulk OUT.
+    7, 0x05, 0x80 | EP_DATA, 0x02, EP_DATA_SIZE, 0, 0, // Bulk IN.
+};
+
+/* Language ID string descriptor (US English) */
+static const uint8_t lang_desc[] = {4, DESC_STRING, 0x09, 0x04};
+
+/* Unique tag for logging module */
+LOG_TAG_DEFINE("USB");
+
+////////////////////////////////////////////////////////////////////////////////
+// Private (static) function prototypes
+////////////////////////////////////////////////////////////////////////////////
+
+/* USB OTG FS interrupt service routine. */
+static void USB_CDC_ISR(void);
+
+/* Select 48 MHz MSI trimmed by LSE as USB clock. */
+static mod_err_t clock_init(void);
+
+/* Wait until register bits are all set or all cleared. */
+static mod_err_t wait_bits(__IO uint32_t *reg, uint32_t mask, bool set, uint32_t timeout_ms);
+
+/* Bus reset: back to default address and control endpoint only. */
+static void bus_reset(void);
+
+/* Pop receive status and read packet from receive FIFO. */
+static void read_rx_fifo(void);
+
+/* Service OUT endpoint interrupts. */
+static void out_ep_isr(void);
+
+/* Service IN endpoint interrupts. */
+static void in_ep_isr(void);
+
+/* Write packet(s) to endpoint's transmit FIFO. */
+static void write_tx_fifo(uint32_t ep, const uint8_t *data, uint32_t len);
+
+/* Start IN transfer of len bytes on endpoint, data must fit in its FIFO. */
+static void ep_in_start(uint32_t ep, const uint8_t *data, uint32_t len, uint32_t mps);
+
+/* Prepare control OUT endpoint for SETUP, data or status packet. */
+static void ep0_out_arm(void);
+
+/* Prepare bulk OUT endpoint for next packet. */
+static void data_out_arm(void);
+
+/* Decode and answer SETUP packet. */
+static void ep0_setup(void);
+
+/* Standard device request, returns false if unsupported. */
+static bool std_request(uint8_t req, uint16_t value, uint16_t length);
+
+/* CDC class request, returns false if unsupported. */
+static bool class_request(uint8_t req, uint16_t value, uint16_t length);
+
+/* Start data stage of control read with at most length bytes. */
+static void ep0_send(const uint8_t *data, uint32_t len, uint16_t length);
+
+/* Send next packet of control read data stage. */
+static void ep0_send_next(void);
+
+/* Send zero length status packet of control write. */
+static void ep0_status_in(void);
+
+/* Build string descriptor in control buffer, returns its length or 0 if index is unknown. */
+static uint32_t string_desc(uint8_t index);
+
+/* Activate (config 1) or deactivate (config 0) data endpoints. */
+static void set_config(uint8_t config);
+
+/* Start bulk IN transfer of characters placed in transmit buffer. */
+static void start_tx(void);
+
+////////////////////////////////////////////////////////////////////////////////
+// Public (global) functions
+////////////////////////////////////////////////////////////////////////////////
+
+mod_err_t usb_cdc_init(void)
+{
+    memset(&usb, 0, sizeof(usb));
+    ringbuf_init(&usb.tx_ring, usb.tx_buf, sizeof(usb.tx_buf));
+    static const uint8_t default_line_coding[] = {0x00, 0xC2, 0x01, 0x00, 0, 0, 8}; // 115200 8N1.
+    memcpy(usb.line_coding, default_line_coding, sizeof(usb.line_coding));
+
+    mod_err_t err = clock_init();
+    if (err != MOD_OK)
+    {
+        LOGE(TAG, "USB clock not ready");
+        return err;
+    }
+
+    /* PA11 (DM) and PA12 (DP) */
+    __HAL_RCC_GPIOA_CLK_ENABLE();
+    GPIO_InitTypeDef gpio = {.Pin = GPIO_PIN_11 | GPIO_PIN_12,
+                             .Mode = GPIO_MODE_AF_PP,
+                             .Pull = GPIO_NOPULL,
+                             .Speed = GPIO_SPEED_FREQ_VERY_HIGH,
+                             .Alternate = GPIO_AF10_OTG_FS};
+    HAL_GPIO_Init(GPIOA, &gpio);
+
+    /* USB supply is an independent supply domain, declare it valid. */
+    RCC->AHB2ENR |= RCC_AHB2ENR_OTGFSEN;
+    (void)RCC->AHB2ENR;
+    PWR->CR2 |= PWR_CR2_USV;
+
+    /* Core soft reset */
+    if (wait_bits(&USB_OTG_FS->GRSTCTL, USB_OTG_GRSTCTL_AHBIDL, true, CLK_TIMEOUT_MS) != MOD_OK)
+    {
+        return MOD_ERR_PERIPH;
+    }
+    USB_OTG_FS->GRSTCTL |= USB_OTG_GRSTCTL_CSRST;
+    if (wait_bits(&USB_OTG_FS->GRSTCTL, USB_OTG_GRSTCTL_CSRST, false, CLK_TIMEOUT_MS) != MOD_OK)
+    {
+        return MOD_ERR_PERIPH;
+    }
+
+    /* Transceiver on, VBUS not sensed: B-session valid is forced. */
+    USB_OTG_FS->GCCFG = USB_OTG_GCCFG_PWRDWN;
+    USB_OTG_FS->GOTGCTL |= USB_OTG_GOTGCTL_BVALOEN | USB_OTG_GOTGCTL_BVALOVAL;
+
+    /* Forced device mode, turnaround time for HCLK >= 32 MHz. */
+    USB_OTG_FS->GUSBCFG = (USB_OTG_FS->GUSBCFG & ~(USB_OTG_GUSBCFG_FHMOD | USB_OTG_GUSBCFG_TRDT)) |
+                          USB_OTG_GUSBCFG_FDMOD | (6U << USB_OTG_GUSBCFG_TRDT_Pos);
+    HAL_Delay(25); // Mode change takes effect after 25 ms.
+
+    /* Full speed, soft disconnected until started. */
+    USB_PCGCCTL = 0;
+    USB_DEV->DCFG |= USB_OTG_DCFG_DSPD;
+    USB_DEV->DCTL |= USB_OTG_DCTL_SDIS;
+
+    /* FIFO RAM partition */
+    USB_OTG_FS->GRXFSIZ = RX_FIFO_WORDS;
+    USB_OTG_FS->DIEPTXF0_HNPTXFSIZ = (EP0_TX_FIFO_WORDS << USB_OTG_TX0FD_Pos) | (RX_FIFO_WORDS << USB_OTG_TX0FSA_Pos);
+    USB_OTG_FS->DIEPTXF[EP_DATA - 1] = (DATA_TX_FIFO_WORDS << USB_OTG_DIEPTXF_INEPTXFD_Pos) |
+                                       ((RX_FIFO_WORDS + EP0_TX_FIFO_WORDS) << USB_OTG_DIEPTXF_INEPTXSA_Pos);
+    USB_OTG_FS->DIEPTXF[EP_CMD - 1] = (CMD_TX_FIFO_WORDS << USB_OTG_DIEPTXF_INEPTXFD_Pos) |
+                                      ((RX_FIFO_WORDS + EP0_TX_FIFO_WORDS + DATA_TX_FIFO_WORDS) << USB_OTG_DIEPTXF_INEPTXSA_Pos);
+    USB_OTG_FS->GRSTCTL = USB_OTG_GRSTCTL_TXFFLSH | (0x10U << USB_OTG_GRSTCTL_TXFNUM_Pos); // All Tx FIFOs.
+    wait_bits(&USB_OTG_FS->GRSTCTL, USB_OTG_GRSTCTL_TXFFLSH, false, CLK_TIMEOUT_MS);
+    USB_OTG_FS->GRSTCTL = USB_OTG_GRSTCTL_RXFFLSH;
+    wait_bits(&USB_OTG_FS->GRSTCTL, USB_OTG_GRSTCTL_RXFFLSH, false, CLK_TIMEOUT_MS);
+
+    /* Interrupts, enabled at NVIC once started. */
+    USB_DEV->DIEPMSK = USB_OTG_DIEPMSK_XFRCM;
+    USB_DEV->DOEPMSK = USB_OTG_DOEPMSK_XFRCM | USB_OTG_DOEPMSK_STUPM;
+    USB_DEV->DAINTMSK = 0;
+    USB_OTG_FS->GINTSTS = 0xFFFFFFFFU;
+    USB_OTG_FS->GINTMSK = USB_OTG_GINTMSK_USBRST | USB_OTG_GINTMSK_ENUMDNEM | USB_OTG_GINTMSK_RXFLVLM |
+                          USB_OTG_GINTMSK_OEPINT | USB_OTG_GINTMSK_IEPINT;
+    USB_OTG_FS->GAHBCFG |= USB_OTG_GAHBCFG_GINT;
+
+    usb.initialized = true;
+    LOGI(TAG, "Initialized USB CDC");
+    return MOD_OK;
+}
+
+mod_err_t usb_cdc_start(void)
+{
+    if (!usb.initialized)
+    {
+        LOGE(TAG, "USB not initialized");
+        return MOD_ERR_NOT_INIT;
+    }
+
+    /* Interrupt priority must be set greater than or
+     * equal to configMAX_SYSCALL_INTERRUPT_PRIORITY
+     * in order for ISR to use FreeRTOS API. */
+    __NVIC_SetPriority(OTG_FS_IRQn, NVIC_EncodePriority(NVIC_GetPriorityGrouping(), IRQ_PRIO_CONSOLE, 0));
+    __NVIC_EnableIRQ(OTG_FS_IRQn);
+
+    USB_DEV->DCTL &= ~USB_OTG_DCTL_SDIS; // Connect DP pull-up.
+
+    return MOD_OK;
+}
+
+mod_err_t usb_cdc_putc(char c)
+{
+    return usb_cdc_write(&c, 1);
+}
+
+mod_err_t usb_cdc_write(const char *buf, size_t len)
+{
+    if (!usb.initialized)
+    {
+        return MOD_ERR_NOT_INIT;
+    }
+
+    mod_err_t err = MOD_OK;
+
+    uint32_t primask = __get_PRIMASK();
+    __disable_irq();
+
+    /* Commit whole block or nothing, unless it could never fit. */
+    uint32_t pushed = 0;
+    if (len <= ringbuf_free(&usb.tx_ring) || len > ringbuf_size(&usb.tx_ring))
+    {
+        pushed = ringbuf_push(&usb.tx_ring, buf, len);
+    }
+    usb_tx_bytes += pushed; // Interrupts already masked.
+    if (pushed < len)
+    {
+        INC_SAT_U32(usb_pms[CNT_TX_BUF_OVERRUN]);
+        err = MOD_ERR_BUF_OVERRUN;
+    }
+
+    if (pushed > 0)
+    {
+        start_tx();
+    }
+
+    __set_PRIMASK(primask);
+
+    return err;
+}
+
+size_t usb_cdc_tx_free(void)
+{
+    if (!usb.initialized)
+    {
+        return 0;
+    }
+    return ringbuf_free(&usb.tx_ring);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Interrupt handlers
+////////////////////////////////////////////////////////////////////////////////
+
+void OTG_FS_IRQHandler(void)
+{
+    IRQ_LATENCY(IRQ_SRC_USB);
+    TRACE_ISR_ENTER(TRACE_ISR_USB);
+    USB_CDC_ISR();
+    TRACE_ISR_EXIT(TRACE_ISR_USB);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Private (static) function definitions
+////////////////////////////////////////////////////////////////////////////////
+
+static void USB_CDC_ISR(void)
+{
+    uint32_t status = USB_OTG_FS->GINTSTS & USB_OTG_FS->GINTMSK;
+
+    if (status & USB_OTG_GINTSTS_USBRST)
+    {
+        USB_OTG_FS->GINTSTS = USB_OTG_GINTSTS_USBRST;
+        bus_reset();
+    }
+    if (status & USB_OTG_GINTSTS_ENUMDNE)
+    {
+        USB_OTG_FS->GINTSTS = USB_OTG_GINTSTS_ENUMDNE;
+        USB_INEP(0)->DIEPCTL &= ~USB_OTG_DIEPCTL_MPSIZ; // 64 byte control packets.
+        USB_DEV->DCTL |= USB_OTG_DCTL_CGINAK;
+        ep0_out_arm();
+    }
+    if (status & USB_OTG_GINTSTS_RXFLVL)
+    {
+        /* Flag is cleared by popping receive status. */
+        USB_OTG_FS->GINTMSK &= ~USB_OTG_GINTMSK_RXFLVLM;
+        read_rx_fifo();
+        USB_OTG_FS->GINTMSK |= USB_OTG_GINTMSK_RXFLVLM;
+    }
+    if (status & USB_OTG_GINTSTS_OEPINT)
+    {
+        out_ep_isr();
+    }
+    if (status & USB_OTG_GINTSTS_IEPINT)
+    {
+        in_ep_isr();
+    }
+}
+
+/**
+ * @brief Clock USB from MSI range 11 (48 MHz) with MSI PLL-mode calibration against LSE.
+ *
+ * STM32L476 has no HSI48, PLLQ cannot reach 48 MHz from the 80 MHz system clock configuration
+ * and PLLSAI1 would have to be set up in CubeMX, so MSI is used and kept accurate by the LSE.
+ */
+static mod_err_t clock_init(void)
+{
+    RCC->APB1ENR1 |= RCC_APB1ENR1_PWREN;
+    (void)RCC->APB1ENR1;
+    PWR->CR1 |= PWR_CR1_DBP; // LSE lives in backup domain.
+    if (!(RCC->BDCR & RCC_BDCR_LSERDY))
+    {
+        RCC->BDCR |= RCC_BDCR_LSEON;
+        if (wait_bits(&RCC->BDCR, RCC_BDCR_LSERDY, true, LSE_TIMEOUT_MS) != MOD_OK)
+        {
+            return MOD_ERR_PERIPH;
+        }
+    }
+
+    /* Range may only change while MSI is off or ready. */
+    RCC->CR |= RCC_CR_MSION;
+    if (wait_bits(&RCC->CR, RCC_CR_MSIRDY, true, CLK_TIMEOUT_MS) != MOD_OK)
+    {
+        return MOD_ERR_PERIPH;
+    }
+    RCC->CR = (RCC->CR & ~RCC_CR_MSIRANGE) | RCC_CR_MSIRANGE_11 | RCC_CR_MSIRGSEL;
+    RCC->CR |= RCC_CR_MSIPLLEN;
+    if (wait_bits(&RCC->CR, RCC_CR_MSIRDY, true, CLK_TIMEOUT_MS) != MOD_OK)
+    {
+        return MOD_ERR_PERIPH;
+    }
+
+    RCC->CCIPR |= RCC_CCIPR_CLK48SEL; // 11: MSI.
+    return MOD_OK;
+}
+
+static mod_err_t wait_bits(__IO uint32_t *reg, uint32_t mask, bool set, uint32_t timeout_ms)
+{
+    uint32_t start = HAL_GetTick();
+    while (((*reg & mask) == mask) != set)
+    {
+        if (HAL_GetTick() - start > timeout_ms)
+        {
+            return MOD_ERR_TIMEOUT;
+        }
+    }
+    return MOD_OK;
+}
+
+static void bus_reset(void)
+{
+    INC_SAT_U32(usb_pms[CNT_BUS_RESET]);
+    set_config(0);
+
+    USB_DEV->DCTL &= ~USB_OTG_DCTL_RWUSIG;
+    USB_OTG_FS->GRSTCTL = USB_OTG_GRSTCTL_TXFFLSH | (0x10U << USB_OTG_GRSTCTL_TXFNUM_Pos);
+    wait_bits(&USB_OTG_FS->GRSTCTL, USB_OTG_GRSTCTL_TXFFLSH, false, CLK_TIMEOUT_MS);
+
+    USB_DEV->DAINTMSK = (1U << USB_OTG_DAINTMSK_IEPM_Pos) | (1U << USB_OTG_DAINTMSK_OEPM_Pos); // Endpoint 0 only.
+    USB_DEV->DCFG &= ~USB_OTG_DCFG_DAD;
+    usb.ep0_state = EP0_IDLE;
+    ep0_out_arm();
+}
+
+static void read_rx_fifo(void)
+{
+    uint32_t status = USB_OTG_FS->GRXSTSP;
+    uint32_t ep = status & USB_OTG_GRXSTSP_EPNUM;
+    uint32_t len = (status & USB_OTG_GRXSTSP_BCNT) >> USB_OTG_GRXSTSP_BCNT_Pos;
+    uint32_t type = (status & USB_OTG_GRXSTSP_PKTSTS) >> USB_OTG_GRXSTSP_PKTSTS_Pos;
+
+    if (type == PKTSTS_SETUP_DATA)
+    {
+        usb.setup[0] = USB_FIFO(0);
+        usb.setup[1] = USB_FIFO(0);
+        return; // Decoded on SETUP done (STUP) interrupt.
+    }
+    else if (type != PKTSTS_OUT_DATA)
+    {
+        return; // Transfer/setup complete entries carry no data.
+    }
+
+    /* FIFO is read a word at a time, bytes beyond length are discarded. */
+    for (uint32_t i = 0; i < len; i += 4)
+    {
+        uint32_t word = USB_FIFO(0);
+        uint32_t n = (len - i < 4) ? len - i : 4;
+        if (ep == 0)
+        {
+            if (usb.ep0_rx_len + n <= sizeof(usb.ep0_buf))
+            {
+                memcpy(&usb.ep0_buf[usb.ep0_rx_len], &word, n);
+                usb.ep0_rx_len += n;
+            }
+        }
+        else if (ep == EP_DATA)
+        {
+            for (uint32_t j = 0; j < n; j++)
+            {
+                if (console_post(CONSOLE_SESSION_USB, (char)(word >> (8 * j))) == MOD_ERR_TIMEOUT)
+                {
+                    INC_SAT_U32(usb_pms[CNT_RX_BUF_OVERRUN]);
+                }
+                else
+                {
+                    usb_rx_bytes++;
+                }
+            }
+        }
+    }
+
+    if (ep == EP_DATA && len > 0)
+    {
+        console_rx_idle(CONSOLE_SESSION_USB); // End of packet plays the role of an idle receive line.
+    }
+}
+
+static void out_ep_isr(void)
+{
+    uint32_t daint = USB_DEV->DAINT & USB_DEV->DAINTMSK;
+
+    if (daint & (1U << (USB_OTG_DAINT_OEPINT_Pos + 0)))
+    {
+        uint32_t flags = USB_OUTEP(0)->DOEPINT;
+        USB_OUTEP(0)->DOEPINT = flags;
+        flags &= USB_DEV->DOEPMSK;
+        if (flags & USB_OTG_DOEPINT_XFRC)
+        {
+            if (usb.ep0_state == EP0_DATA_OUT)
+            {
+                if ((usb.setup[0] >> 8 & 0xFFU) == REQ_SET_LINE_CODING && usb.ep0_rx_len >= sizeof(usb.line_coding))
+                {
+                    memcpy(usb.line_coding, usb.ep0_buf, sizeof(usb.line_coding));
+                }
+                ep0_status_in();
+            }
+            else if (usb.ep0_state == EP0_STATUS)
+            {
+                usb.ep0_state = EP0_IDLE; // Host acknowledged control read.
+            }
+            ep0_out_arm();
+        }
+        if (flags & USB_OTG_DOEPINT_STUP)
+        {
+            ep0_setup();
+            ep0_out_arm();
+        }
+    }
+
+    if (daint & (1U << (USB_OTG_DAINT_OEPINT_Pos + EP_DATA)))
+    {
+        uint32_t flags = USB_OUTEP(EP_DATA)->DOEPINT;
+        USB_OUTEP(EP_DATA)->DOEPINT = flags;
+        if (flags & USB_OTG_DOEPINT_XFRC)
+        {
+            data_out_arm();
+        }
+    }
+}
+
+static void in_ep_isr(void)
+{
+    uint32_t daint = USB_DEV->DAINT & USB_DEV->DAINTMSK;
+
+    if (daint & (1U << 0))
+    {
+        uint32_t flags = USB_INEP(0)->DIEPINT;
+        USB_INEP(0)->DIEPINT = flags;
+        if (flags & USB_OTG_DIEPINT_XFRC)
+        {
+            if (usb.ep0_state == EP0_DATA_IN)
+            {
+                if (usb.ep0_remaining > 0 || usb.ep0_zlp)
+                {
+                    ep0_send_next();
+                }
+                else
+                {
+                    usb.ep0_state = EP0_STATUS; // Wait for status OUT from host.
+                }
+            }
+            else if (usb.ep0_state == EP0_STATUS)
+            {
+                usb.ep0_state = EP0_IDLE; // Status IN of control write sent.
+            }
+        }
+    }
+
+    if (daint & (1U << EP_DATA))
+    {
+        uint32_t flags = USB_INEP(EP_DATA)->DIEPINT;
+        USB_INEP(EP_DATA)->DIEPINT = flags;
+        if ((flags & USB_OTG_DIEPINT_XFRC) && usb.tx_busy)
+        {
+            usb.tx_busy = false;
+            ringbuf_advance(&usb.tx_ring, usb.tx_len);
+
+            /* A transfer ending on a full packet leaves host waiting, terminate with a zero length packet. */
+            if (usb.tx_len > 0 && usb.tx_len % EP_DATA_SIZE == 0 && ringbuf_is_empty(&usb.tx_ring))
+            {
+                usb.tx_busy = true;
+                usb.tx_len = 0;
+                ep_in_start(EP_DATA, NULL, 0, EP_DATA_SIZE);
+            }
+            else
+            {
+                start_tx();
+            }
+        }
+    }
+}
+
+static void write_tx_fifo(uint32_t ep, const uint8_t *data, uint32_t len)
+{
+    for (uint32_t i = 0; i < len; i += 4)
+    {
+        uint32_t word = 0;
+        memcpy(&word, &data[i], (len - i < 4) ? len - i : 4);
+        USB_FIFO(ep) = word;
+    }
+}
+
+static void ep_in_start(uint32_t ep, const uint8_t *data, uint32_t len, uint32_t mps)
+{
+    uint32_t pkts = (len == 0) ? 1 : (len + mps - 1) / mps;
+    USB_INEP(ep)->DIEPTSIZ = (pkts << USB_OTG_DIEPTSIZ_PKTCNT_Pos) | (len & USB_OTG_DIEPTSIZ_XFRSIZ);
+    USB_INEP(ep)->DIEPCTL |= USB_OTG_DIEPCTL_CNAK | USB_OTG_DIEPCTL_EPENA;
+    write_tx_fifo(ep, data, len);
+}
+
+static void ep0_out_arm(void)
+{
+    usb.ep0_rx_len = 0;
+    USB_OUTEP(0)->DOEPTSIZ = (3U << USB_OTG_DOEPTSIZ_STUPCNT_Pos) | (1U << USB_OTG_DOEPTSIZ_PKTCNT_Pos) | EP0_SIZE;
+    USB_OUTEP(0)->DOEPCTL |= USB_OTG_DOEPCTL_CNAK | USB_OTG_DOEPCTL_EPENA;
+}
+
+static void data_out_arm(void)
+{
+    USB_OUTEP(EP_DATA)->DOEPTSIZ = (1U << USB_OTG_DOEPTSIZ_PKTCNT_Pos) | EP_DATA_SIZE;
+    USB_OUTEP(EP_DATA)->DOEPCTL |= USB_OTG_DOEPCTL_CNAK | USB_OTG_DOEPCTL_EPENA;
+}
+
+static void ep0_setup(void)
+{
+    uint8_t type = usb.setup[0] & 0xFFU;
+    uint8_t req = (usb.setup[0] >> 8) & 0xFFU;
+    uint16_t value = usb.setup[0] >> 16;
+    uint16_t length = usb.setup[1] >> 16;
+
+    usb.ep0_state = EP0_IDLE;
+    bool ok = false;
+    switch (type & REQ_TYPE_MASK)
+    {
+    case REQ_TYPE_STANDARD:
+        ok = std_request(req, value, length);
+        break;
+    case REQ_TYPE_CLASS:
+        ok = class_request(req, value, length);
+        break;
+    default:
+        break;
+    }
+
+    if (!ok)
+    {
+        /* Core clears stall on next SETUP packet. */
+        INC_SAT_U32(usb_pms[CNT_STALL]);
+        USB_INEP(0)->DIEPCTL |= USB_OTG_DIEPCTL_STALL;
+        USB_OUTEP(0)->DOEPCTL |= USB_OTG_DOEPCTL_STALL;
+    }
+}
+
+static bool std_request(uint8_t req, uint16_t value, uint16_t length)
+{
+    switch (req)
+    {
+    case REQ_GET_DESCRIPTOR:
+        switch (HI(value))
+        {
+        case DESC_DEVICE:
+            ep0_send(device_desc, sizeof(device_desc), length);
+            return true;
+        case DESC_CONFIG:
+            ep0_send(config_desc, sizeof(config_desc), length);
+            return true;
+        case DESC_STRING:
+        {
+            uint32_t len = string_desc(LO(value));
+            if (len == 0)
+            {
+                return false;
+            }
+            ep0_send(usb.ep0_buf, len, length);
+            return true;
+        }
+        default:
+            return false; // Full speed only, no device qualifier.
+        }
+    case REQ_SET_ADDRESS:
+        /* OTG core applies address after status stage itself. */
+        USB_DEV->DCFG = (USB_DEV->DCFG & ~USB_OTG_DCFG_DAD) | ((value & 0x7FU) << USB_OTG_DCFG_DAD_Pos);
+        ep0_status_in();
+        return true;
+    case REQ_SET_CONFIGURATION:
+        if (value > 1)
+        {
+            return false;
+        }
+        set_config((uint8_t)value);
+        ep0_status_in();
+        return true;
+    case REQ_GET_CONFIGURATION:
+        usb.ep0_buf[0] = usb.config;
+        ep0_send(usb.ep0_buf, 1, length);
+        return true;
+    case REQ_GET_STATUS:
+        usb.ep0_buf[0] = 0; // Bus powered, no remote wakeup, endpoints not halted.
+        usb.ep0_buf[1] = 0;
+        ep0_send(usb.ep0_buf, 2, length);
+        return true;
+    case REQ_GET_INTERFACE:
+        usb.ep0_buf[0] = 0;
+        ep0_send(usb.ep0_buf, 1, length);
+        return true;
+    case REQ_CLEAR_FEATURE:
+    case REQ_SET_FEATURE:
+    case REQ_SET_INTERFACE:
+        ep0_status_in(); // Single alternate setting, halt feature is not kept.
+        return true;
+    default:
+        return false;
+    }
+}
+
+static bool class_request(uint8_t req, uint16_t value, uint16_t length)
+{
+    switch (req)
+    {
+    case REQ_SET_LINE_CODING:
+        if (length == 0 || length > sizeof(usb.ep0_buf))
+        {
+            return false;
+        }
+        usb.ep0_state = EP0_DATA_OUT; // Data stage follows, OUT endpoint is re-armed after SETUP.
+        return true;
+    case REQ_GET_LINE_CODING:
+        ep0_send(usb.line_coding, sizeof(usb.line_coding), length);
+        return true;
+    case REQ_SET_CONTROL_LINE_STATE:
+        usb.line_state = value;
+        ep0_status_in();
+        return true;
+    case REQ_SEND_BREAK:
+        ep0_status_in();
+        return true;
+    default:
+        return false;
+    }
+}
+
+static void ep0_send(const uint8_t *data, uint32_t len, uint16_t length)
+{
+    if (len > length)
+    {
+        len = length;
+    }
+    usb.ep0_data = data;
+    usb.ep0_remaining = len;
+    usb.ep0_zlp = len > 0 && len < length && len % EP0_SIZE == 0; // Host expects more unless a short packet ends stage.
+    usb.ep0_state = EP0_DATA_IN;
+    ep0_send_next();
+}
+
+static void ep0_send_next(void)
+{
+    uint32_t n = usb.ep0_remaining < EP0_SIZE ? usb.ep0_remaining : EP0_SIZE;
+    if (n == 0)
+    {
+        usb.ep0_zlp = false;
+    }
+    ep_in_start(0, usb.ep0_data, n, EP0_SIZE);
+    usb.ep0_data += n;
+    usb.ep0_remaining -= n;
+}
+
+static void ep0_status_in(void)
+{
+    usb.ep0_state = EP0_STATUS;
+    ep_in_start(0, NULL, 0, EP0_SIZE);
+}
+
+static uint32_t string_desc(uint8_t index)
+{
+    char serial[9];
+    const char *str;
+    switch (index)
+    {
+    case STR_LANG:
+        memcpy(usb.ep0_buf, lang_desc, sizeof(lang_desc));
+        return sizeof(lang_desc);
+    case STR_MANUFACTURER:
+        str = "Timothy Nguyen";
+        break;
+    case STR_PRODUCT:
+        str = "Reflow Oven Controller";
+        break;
+    case STR_SERIAL:
+    {
+        /* Hash of 96-bit unique device ID as hex. */
+        const uint32_t *uid = (const uint32_t *)UID_BASE;
+        uint32_t id = uid[0] ^ uid[1] ^ uid[2];
+        for (uint32_t i = 0; i < 8; i++)
+        {
+            serial[i] = "0123456789ABCDEF"[(id >> (28 - 4 * i)) & 0xFU];
+        }
+        serial[8] = '\0';
+        str = serial;
+        break;
+    }
+    default:
+        return 0;
+    }
+
+    /* ASCII to UTF-16LE */
+    uint32_t len = 2;
+    for (; *str != '\0' && len + 2 <= sizeof(usb.ep0_buf); str++)
+    {
+        usb.ep0_buf[len++] = (uint8_t)*str;
+        usb.ep0_buf[len++] = 0;
+    }
+    usb.ep0_buf[0] = (uint8_t)len;
+    usb.ep0_buf[1] = DESC_STRING;
+    return len;
+}
+
+static void set_config(uint8_t config)
+{
+    usb.config = config;
+    if (config == 0)
+    {
+        usb.configured = false;
+        usb.tx_busy = false; // Aborted transfer is sent again once configured.
+        for (uint32_t ep = EP_DATA; ep <= EP_CMD; ep++)
+        {
+            if (USB_INEP(ep)->DIEPCTL & USB_OTG_DIEPCTL_EPENA)
+            {
+                USB_INEP(ep)->DIEPCTL |= USB_OTG_DIEPCTL_EPDIS | USB_OTG_DIEPCTL_SNAK;
+            }
+            USB_INEP(ep)->DIEPCTL &= ~USB_OTG_DIEPCTL_USBAEP;
+        }
+        USB_OUTEP(EP_DATA)->DOEPCTL = (USB_OUTEP(EP_DATA)->DOEPCTL & ~USB_OTG_DOEPCTL_USBAEP) | USB_OTG_DOEPCTL_SNAK;
+        USB_DEV->DAINTMSK &= ~((1U << (USB_OTG_DAINTMSK_IEPM_Pos + EP_DATA)) | (1U << (USB_OTG_DAINTMSK_OEPM_Pos + EP_DATA)));
+        return;
+    }
+
+    USB_INEP(EP_DATA)->DIEPCTL = EP_DATA_SIZE | (2U << USB_OTG_DIEPCTL_EPTYP_Pos) | (EP_DATA << USB_OTG_DIEPCTL_TXFNUM_Pos) |
+                                 USB_OTG_DIEPCTL_SD0PID_SEVNFRM | USB_OTG_DIEPCTL_USBAEP | USB_OTG_DIEPCTL_SNAK;
+    USB_INEP(EP_CMD)->DIEPCTL = EP_CMD_SIZE | (3U << USB_OTG_DIEPCTL_EPTYP_Pos) | (EP_CMD << USB_OTG_DIEPCTL_TXFNUM_Pos) |
+                                USB_OTG_DIEPCTL_SD0PID_SEVNFRM | USB_OTG_DIEPCTL_USBAEP | USB_OTG_DIEPCTL_SNAK;
+    USB_OUTEP(EP_DATA)->DOEPCTL = EP_DATA_SIZE | (2U << USB_OTG_DOEPCTL_EPTYP_Pos) |
+                                  USB_OTG_DOEPCTL_SD0PID_SEVNFRM | USB_OTG_DOEPCTL_USBAEP;
+    USB_DEV->DAINTMSK |= (1U << (USB_OTG_DAINTMSK_IEPM_Pos + EP_DATA)) | (1U << (USB_OTG_DAINTMSK_OEPM_Pos + EP_DATA));
+    data_out_arm();
+
+    usb.configured = true;
+    usb.tx_busy = false;
+    start_tx(); // Flush characters placed in buffer before enumeration.
+}
+
+/**
+ * @brief Move next contiguous region of transmit buffer, up to one FIFO full, to bulk IN endpoint.
+ *
+ * @note Call with interrupts masked or from OTG FS ISR.
+ */
+static void start_tx(void)
+{
+    if (!usb.configured || usb.tx_busy)
+    {
+        return;
+    }
+
+    const uint8_t *region = NULL;
+    uint32_t len = ringbuf_peek_contig(&usb.tx_ring, &region);
+    if (len == 0)
+    {
+        return;
+    }
+    if (len > DATA_TX_MAX_LEN)
+    {
+        len = DATA_TX_MAX_LEN;
+    }
+
+    usb.tx_len = len;
+    usb.tx_busy = true;
+    ep_in_start(EP_DATA, region, len, EP_DATA_SIZE);
+}
+
+#endif
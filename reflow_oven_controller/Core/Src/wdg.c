@@ -0,0 +1,332 @@
+/**
+ * @file wdg.c
+ * @author Timothy Nguyen
+ * @brief Watchdog supervisor: IWDG fed only while every active object and heartbeat client is alive.
+ * @version 0.1
+ * @date 2021-08-25
+ */
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "wdg.h"
+#include "active.h"
+#include "cmd.h"
+#include "log.h"
+#include "prio.h"
+#include "sections.h"
+#include "cmsis_os.h"
+#include "stm32l4xx.h"
+
+////////////////////////////////////////////////////////////////////////////////
+// Common macros
+////////////////////////////////////////////////////////////////////////////////
+
+/* IWDG key register values */
+#define IWDG_KEY_RELOAD 0xAAAAU
+#define IWDG_KEY_ENABLE 0xCCCCU
+#define IWDG_KEY_WRITE_ACCESS 0x5555U
+
+#define IWDG_PR_DIV32 3U // LSI / 32, one counter tick per millisecond.
+
+/* Backup register record of culprit: magic in BKP0R, name in BKP1R to BKP3R. */
+#define WDG_BKP_MAGIC 0x57444730U // "WDG0"
+#define WDG_BKP_NAME_REGS (WDG_NAME_LEN / sizeof(uint32_t))
+
+////////////////////////////////////////////////////////////////////////////////
+// Type definitions
+////////////////////////////////////////////////////////////////////////////////
+
+/* Heartbeat client */
+typedef struct
+{
+    const char *name;            // Client name.
+    uint32_t timeout;            // Longest time between check-ins (ms).
+    volatile uint32_t last_tick; // Kernel tick of last check-in.
+    volatile bool armed;         // Client is checked.
+} wdg_client_t;
+
+/* Supervisor state */
+typedef struct
+{
+    wdg_client_t clients[WDG_MAX_CLIENTS]; // Heartbeat clients.
+    uint8_t num_clients;                   // Number of registered clients.
+    bool tripped;                          // Liveness check failed, IWDG is no longer fed.
+    char culprit[WDG_NAME_LEN + 1];        // Culprit of this trip, or of previous watchdog reset.
+    bool prev_reset;                       // culprit belongs to previous watchdog reset.
+    uint32_t feeds;                        // IWDG reloads since start.
+} wdg_t;
+
+////////////////////////////////////////////////////////////////////////////////
+// Private (static) function declarations
+////////////////////////////////////////////////////////////////////////////////
+
+static void Wdg_thread(void *argument);             // Check liveness and feed IWDG.
+static const char *wdg_check(void);                 // Name of first dead active object or client.
+static void wdg_trip(const char *culprit);          // Record culprit and stop feeding IWDG.
+static void wdg_backup_access(void);                // Enable write access to backup registers.
+static void wdg_iwdg_start(void);                   // Start IWDG with WDG_TIMEOUT_MS timeout.
+
+/* Command callback functions */
+static uint32_t cmd_wdg_status(uint32_t argc, const char **argv); // Display clients and last culprit.
+static uint32_t cmd_wdg_test(uint32_t argc, const char **argv);   // Stall command handler.
+
+////////////////////////////////////////////////////////////////////////////////
+// Private (static) variables
+////////////////////////////////////////////////////////////////////////////////
+
+/* Supervisor state */
+static wdg_t wdg;
+
+/* Statically allocated supervisor thread */
+static osThreadId_t wdg_thread_id;
+static StaticTask_t wdg_thread_cb;
+static uint64_t SRAM2_BSS wdg_stack[WDG_THREAD_STACK_SZ / sizeof(uint64_t)];
+
+/* Watchdog command information. */
+static cmd_cmd_info wdg_cmds[] = {
+    {.cmd_name = "status",
+     .cb = cmd_wdg_status,
+     .help = "Display heartbeat clients, stalled active object and culprit of last watchdog reset."},
+    {.cmd_name = "test",
+     .cb = cmd_wdg_test,
+     .help = "Stall command handler until watchdog resets controller."}};
+
+/* Watchdog module client info */
+CMD_CLIENT_DEFINE(wdg,
+                  .num_cmds = sizeof(wdg_cmds) / sizeof(wdg_cmds[0]),
+                  .cmds = wdg_cmds);
+
+/* Unique tag for watchdog module. */
+LOG_TAG_DEFINE("WDG");
+
+////////////////////////////////////////////////////////////////////////////////
+// Public (global) functions
+////////////////////////////////////////////////////////////////////////////////
+
+mod_err_t wdg_init(void)
+{
+    /* Report culprit of previous watchdog reset, once. */
+    wdg_backup_access();
+    if (RTC->BKP0R == WDG_BKP_MAGIC)
+    {
+        uint32_t name[WDG_BKP_NAME_REGS];
+        volatile uint32_t const *const bkp = &RTC->BKP1R;
+        for (uint32_t i = 0; i < WDG_BKP_NAME_REGS; i++)
+        {
+            name[i] = bkp[i];
+        }
+        memcpy(wdg.culprit, name, WDG_NAME_LEN);
+        wdg.culprit[WDG_NAME_LEN] = '\0';
+        wdg.prev_reset = true;
+        RTC->BKP0R = 0;
+        LOGW(TAG, "Previous reset by watchdog, %s stalled.", wdg.culprit);
+    }
+
+    /* Supervisor runs above every active object. */
+    static const osThreadAttr_t thread_attr = {.name = "wdg",
+                                               .cb_mem = &wdg_thread_cb,
+                                               .cb_size = sizeof(wdg_thread_cb),
+                                               .stack_mem = wdg_stack,
+                                               .stack_size = sizeof(wdg_stack),
+                                               .priority = PRIO_SUPERVISOR};
+    wdg_iwdg_start();
+    wdg_thread_id = osThreadNew(Wdg_thread, NULL, &thread_attr);
+    ASSERT(wdg_thread_id != NULL);
+
+    LOGI(TAG, "Watchdog started, %lu ms timeout", WDG_TIMEOUT_MS);
+    return MOD_OK;
+}
+
+mod_err_t wdg_register(const char *name, uint32_t timeout, uint8_t *const id)
+{
+    if (timeout <= WDG_CHECK_MS)
+    {
+        return MOD_ERR_ARG;
+    }
+    if (wdg.num_clients >= WDG_MAX_CLIENTS)
+    {
+        return MOD_ERR_RESOURCE;
+    }
+
+    wdg_client_t *const client = &wdg.clients[wdg.num_clients];
+    client->name = name;
+    client->timeout = timeout;
+    client->armed = false;
+    *id = wdg.num_clients++;
+    return MOD_OK;
+}
+
+mod_err_t wdg_set_timeout(uint8_t id, uint32_t timeout)
+{
+    if (timeout <= WDG_CHECK_MS)
+    {
+        return MOD_ERR_ARG;
+    }
+    wdg.clients[id].timeout = timeout;
+    return MOD_OK;
+}
+
+void wdg_checkin(uint8_t id)
+{
+    wdg_client_t *const client = &wdg.clients[id];
+    client->last_tick = osKernelGetTickCount();
+    client->armed = true;
+}
+
+void wdg_suspend(uint8_t id)
+{
+    wdg.clients[id].armed = false;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Private (static) functions
+////////////////////////////////////////////////////////////////////////////////
+
+/**
+ * @brief Supervisor thread, feeds IWDG every WDG_CHECK_MS while the system is alive.
+ */
+static void Wdg_thread(void *argument)
+{
+    (void)argument;
+    while (1)
+    {
+        if (!wdg.tripped)
+        {
+            const char *culprit = wdg_check();
+            if (culprit != NULL)
+            {
+                wdg_trip(culprit);
+            }
+            else
+            {
+                IWDG->KR = IWDG_KEY_RELOAD;
+                wdg.feeds++;
+            }
+        }
+        osDelay(WDG_CHECK_MS);
+    }
+}
+
+/**
+ * @brief Check active objects and armed heartbeat clients.
+ *
+ * @return Name of stalled active object or late client, NULL if all are alive.
+ */
+static const char *wdg_check(void)
+{
+    Active const *const ao = Active_stalled(WDG_AO_TIMEOUT_MS);
+    if (ao != NULL)
+    {
+        return ao->name;
+    }
+
+    uint32_t now = osKernelGetTickCount();
+    for (uint8_t i = 0; i < wdg.num_clients; i++)
+    {
+        wdg_client_t const *const client = &wdg.clients[i];
+        uint32_t last_tick = client->last_tick;
+        if (client->armed && now - last_tick > client->timeout)
+        {
+            return client->name;
+        }
+    }
+    return NULL;
+}
+
+/**
+ * @brief Latch failed liveness check: record culprit in backup registers and stop feeding.
+ *
+ * @param culprit Name of stalled active object or late client.
+ */
+static void wdg_trip(const char *culprit)
+{
+    wdg.tripped = true;
+    wdg.prev_reset = false;
+    strncpy(wdg.culprit, culprit, WDG_NAME_LEN);
+    wdg.culprit[WDG_NAME_LEN] = '\0';
+
+    uint32_t name[WDG_BKP_NAME_REGS] = {0};
+    memcpy(name, wdg.culprit, strlen(wdg.culprit));
+    volatile uint32_t *const bkp = &RTC->BKP1R;
+    for (uint32_t i = 0; i < WDG_BKP_NAME_REGS; i++)
+    {
+        bkp[i] = name[i];
+    }
+    RTC->BKP0R = WDG_BKP_MAGIC; // Written last, record is complete.
+
+    LOGE(TAG, "%s stalled, resetting in %lu ms.", wdg.culprit, WDG_TIMEOUT_MS);
+}
+
+/**
+ * @brief Enable write access to backup domain, backup registers need no RTC clock.
+ */
+static void wdg_backup_access(void)
+{
+    SET_BIT(RCC->APB1ENR1, RCC_APB1ENR1_PWREN);
+    SET_BIT(PWR->CR1, PWR_CR1_DBP);
+}
+
+/**
+ * @brief Start IWDG with WDG_TIMEOUT_MS timeout, frozen while core is halted.
+ */
+static void wdg_iwdg_start(void)
+{
+    SET_BIT(DBGMCU->APB1FZR1, DBGMCU_APB1FZR1_DBG_IWDG_STOP);
+
+    IWDG->KR = IWDG_KEY_ENABLE; // Starts LSI as well.
+    IWDG->KR = IWDG_KEY_WRITE_ACCESS;
+    IWDG->PR = IWDG_PR_DIV32;
+    IWDG->RLR = WDG_TIMEOUT_MS - 1U;
+    while (IWDG->SR != 0U)
+    {
+        // Wait for prescaler and reload values to be updated.
+    }
+    IWDG->KR = IWDG_KEY_RELOAD;
+}
+
+/**
+ * @brief Display heartbeat clients, stalled active object and culprit of last watchdog reset.
+ *
+ * @param argc Number of arguments.
+ * @param argv Argument values.
+ *
+ * @return 0 if successful.
+ */
+static uint32_t cmd_wdg_status(uint32_t argc, const char **argv)
+{
+    Active const *const ao = Active_stalled(WDG_AO_TIMEOUT_MS);
+    cmd_out_str("state", wdg.tripped ? "tripped" : "feeding");
+    cmd_out_u32("feeds", wdg.feeds);
+    cmd_out_str("stalled", ao != NULL ? ao->name : "none");
+    cmd_out_str(wdg.prev_reset ? "previous reset culprit" : "culprit", wdg.culprit[0] != '\0' ? wdg.culprit : "none");
+
+    uint32_t now = osKernelGetTickCount();
+    LOG("%-12s %8s %8s %6s\r\n", "Client", "Timeout", "Age ms", "Armed");
+    for (uint8_t i = 0; i < wdg.num_clients; i++)
+    {
+        wdg_client_t const *const client = &wdg.clients[i];
+        LOG("%-12s %8lu %8lu %6s\r\n", client->name, client->timeout,
+            client->armed ? now - client->last_tick : 0, client->armed ? "yes" : "no");
+    }
+    return 0;
+}
+
+/**
+ * @brief Stall command active object so the supervisor trips and IWDG resets the controller.
+ *
+ * @param argc Number of arguments.
+ * @param argv Argument values.
+ *
+ * @return Never returns.
+ */
+static uint32_t cmd_wdg_test(uint32_t argc, const char **argv)
+{
+    LOG("Stalling command handler, watchdog reset in about %lu ms\r\n", WDG_AO_TIMEOUT_MS + WDG_CHECK_MS + WDG_TIMEOUT_MS);
+    while (1)
+    {
+        osDelay(WDG_CHECK_MS); // Handler never completes, other threads keep running and logging.
+    }
+    return 0;
+}
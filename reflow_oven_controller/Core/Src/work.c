@@ -0,0 +1,218 @@
+/**
+ * @file work.c
+ * @author Timothy Nguyen
+ * @brief Deferred work queue: interrupt bottom halves run by a high-priority worker thread.
+ * @version 0.1
+ * @date 2021-09-06
+ */
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "work.h"
+#include "cmd.h"
+#include "irq.h"
+#include "log.h"
+#include "sections.h"
+#include "cmsis_os.h"
+#include "stm32l4xx.h"
+
+////////////////////////////////////////////////////////////////////////////////
+// Common macros
+////////////////////////////////////////////////////////////////////////////////
+
+#define WORK_WAKE_FLAG 0x1U // Worker thread flag, items were submitted.
+
+#if (WORK_RING_SIZE & (WORK_RING_SIZE - 1U)) != 0U
+#error "WORK_RING_SIZE must be a power of two"
+#endif
+
+////////////////////////////////////////////////////////////////////////////////
+// Type definitions
+////////////////////////////////////////////////////////////////////////////////
+
+/* Ring slot */
+typedef struct
+{
+    work_fn_t fn;          // Function to run.
+    void *arg;             // Argument of fn.
+    uint32_t stamp;        // DWT cycle counter at submission.
+    volatile uint32_t seq; // Ring position + 1 once published.
+} work_item_t;
+
+/* Counters */
+typedef enum
+{
+    CNT_SUBMITTED, // Items queued.
+    CNT_DROPPED,   // Items dropped, ring full.
+
+    NUM_U32_PMS
+} work_u32_pms_t;
+
+////////////////////////////////////////////////////////////////////////////////
+// Private (static) function prototypes
+////////////////////////////////////////////////////////////////////////////////
+
+static void Work_thread(void *argument); // Run queued items in order.
+static void work_wake(void);             // Wake worker thread from any context.
+
+////////////////////////////////////////////////////////////////////////////////
+// Private (static) variables
+////////////////////////////////////////////////////////////////////////////////
+
+/* Item ring, put index written by producers, get index by the worker only */
+static work_item_t work_ring[WORK_RING_SIZE];
+static volatile uint32_t work_put;
+static volatile uint32_t work_get;
+
+/* Statically allocated worker thread */
+static osThreadId_t work_thread_id;
+static StaticTask_t work_thread_cb;
+static uint64_t SRAM2_BSS work_stack[WORK_THREAD_STACK_SZ / sizeof(uint64_t)];
+
+/* Performance measurements */
+static uint32_t work_pms[NUM_U32_PMS];
+static cmd_pm_minmax_t work_depth;     // Items queued when the worker took one, itself included.
+static cmd_pm_hist_t work_latency;     // Cycles from submission until start of item.
+static cmd_pm_hist_t work_run_cycles;  // Cycles item ran.
+
+/* Performance measurement info */
+static const cmd_pm_info work_pm_info[] = {
+    {"submitted", CMD_PM_U32, &work_pms[CNT_SUBMITTED]},
+    {"dropped", CMD_PM_U32, &work_pms[CNT_DROPPED]},
+    {"depth", CMD_PM_MINMAX, &work_depth},
+    {"latency cycles", CMD_PM_HIST, &work_latency},
+    {"run cycles", CMD_PM_HIST, &work_run_cycles}};
+
+/* Work queue module client info */
+CMD_CLIENT_DEFINE(work,
+                  .num_cmds = 0,
+                  .cmds = NULL,
+                  .num_pms = ARRAY_SIZE(work_pm_info),
+                  .pms = work_pm_info);
+
+/* Unique tag for work queue module. */
+LOG_TAG_DEFINE("WORK");
+
+////////////////////////////////////////////////////////////////////////////////
+// Public (global) functions
+////////////////////////////////////////////////////////////////////////////////
+
+mod_err_t work_init(void)
+{
+    /* Worker runs above every active object, so bottom halves are not held up by handlers. */
+    static const osThreadAttr_t thread_attr = {.name = "work",
+                                               .cb_mem = &work_thread_cb,
+                                               .cb_size = sizeof(work_thread_cb),
+                                               .stack_mem = work_stack,
+                                               .stack_size = sizeof(work_stack),
+                                               .priority = WORK_THREAD_PRIO};
+    work_thread_id = osThreadNew(Work_thread, NULL, &thread_attr);
+    ASSERT(work_thread_id != NULL);
+
+    HAL_NVIC_SetPriority(WORK_WAKE_IRQn, IRQ_PRIO_WORK, 0);
+    HAL_NVIC_EnableIRQ(WORK_WAKE_IRQn);
+    osThreadFlagsSet(work_thread_id, WORK_WAKE_FLAG); // Items submitted before start.
+
+    LOGI(TAG, "Work queue started, %u items", WORK_RING_SIZE);
+    return MOD_OK;
+}
+
+mod_err_t RAMFUNC work_submit(work_fn_t fn, void *arg)
+{
+    ASSERT(fn != NULL);
+
+    /* Reserve slot, one ring length ahead of the worker at most. */
+    uint32_t put;
+    while (1)
+    {
+        put = __LDREXW(&work_put);
+        if (put - work_get >= WORK_RING_SIZE)
+        {
+            __CLREX();
+            INC_SAT_U32(work_pms[CNT_DROPPED]);
+            return MOD_ERR_BUF_OVERRUN;
+        }
+        if (__STREXW(put + 1U, &work_put) == 0)
+        {
+            break;
+        }
+    }
+
+    work_item_t *item = &work_ring[put & (WORK_RING_SIZE - 1U)];
+    item->fn = fn;
+    item->arg = arg;
+    item->stamp = DWT->CYCCNT;
+    __DMB(); // Item must be visible before the worker observes its sequence.
+    item->seq = put + 1U;
+
+    INC_SAT_U32(work_pms[CNT_SUBMITTED]);
+    work_wake();
+    return MOD_OK;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Interrupt handlers
+////////////////////////////////////////////////////////////////////////////////
+
+/**
+ * @brief Work queue wake interrupt, pended by work_submit() in interrupt context.
+ */
+void SWPMI1_IRQHandler(void)
+{
+    if (work_thread_id != NULL)
+    {
+        osThreadFlagsSet(work_thread_id, WORK_WAKE_FLAG);
+    }
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Private (static) function definitions
+////////////////////////////////////////////////////////////////////////////////
+
+/**
+ * @brief Worker thread, runs published items in ring order until the ring is empty.
+ */
+static void Work_thread(void *argument)
+{
+    (void)argument;
+    while (1)
+    {
+        osThreadFlagsWait(WORK_WAKE_FLAG, osFlagsWaitAny, osWaitForever);
+
+        uint32_t get = work_get;
+        work_item_t *item = &work_ring[get & (WORK_RING_SIZE - 1U)];
+        while (item->seq == get + 1U)
+        {
+            __DMB();
+            work_fn_t fn = item->fn;
+            void *arg = item->arg;
+            uint32_t start = DWT->CYCCNT;
+            cmd_pm_record_hist(&work_latency, start - item->stamp);
+            cmd_pm_record(&work_depth, work_put - get);
+            work_get = ++get; // Slot may be reused from here on.
+
+            fn(arg);
+            cmd_pm_record_hist(&work_run_cycles, DWT->CYCCNT - start);
+            item = &work_ring[get & (WORK_RING_SIZE - 1U)];
+        }
+    }
+}
+
+/**
+ * @brief Wake worker thread, through WORK_WAKE_IRQn in interrupt context.
+ *
+ * Pending an interrupt that is pending already does nothing, so a burst of submissions
+ * wakes the worker once.
+ */
+static inline void work_wake(void)
+{
+    if (__get_IPSR() != 0U)
+    {
+        NVIC_SetPendingIRQ(WORK_WAKE_IRQn);
+    }
+    else if (work_thread_id != NULL)
+    {
+        osThreadFlagsSet(work_thread_id, WORK_WAKE_FLAG);
+    }
+}
@@ -94,6 +94,64 @@ LoopFillZerobss:
 	cmp	r2, r3
 	bcc	FillZerobss
 
+/* Zero fill the SRAM2 bss and SRAM1 DMA sections */
+  movs r3, #0
+  ldr r0, =_ssram2_bss
+  ldr r1, =_esram2_bss
+  b LoopFillZeroSram2
+
+FillZeroSram2:
+  str r3, [r0], #4
+
+LoopFillZeroSram2:
+  cmp r0, r1
+  bcc FillZeroSram2
+
+  ldr r0, =_ssram1_dma
+  ldr r1, =_esram1_dma
+  b LoopFillZeroDma
+
+FillZeroDma:
+  str r3, [r0], #4
+
+LoopFillZeroDma:
+  cmp r0, r1
+  bcc FillZeroDma
+
+/* Copy time-critical code from flash to SRAM2 */
+  ldr r0, =_sramfunc
+  ldr r1, =_eramfunc
+  ldr r2, =_siramfunc
+  b LoopCopyRamFunc
+
+CopyRamFunc:
+  ldr r3, [r2], #4
+  str r3, [r0], #4
+
+LoopCopyRamFunc:
+  cmp r0, r1
+  bcc CopyRamFunc
+
+/* Copy vector table to SRAM2 and point VTOR to the copy */
+  ldr r0, =_sram_vectors
+  ldr r1, =_eram_vectors
+  ldr r2, =g_pfnVectors
+  b LoopCopyVectors
+
+CopyVectors:
+  ldr r3, [r2], #4
+  str r3, [r0], #4
+
+LoopCopyVectors:
+  cmp r0, r1
+  bcc CopyVectors
+
+  ldr r0, =0xE000ED08 /* SCB->VTOR */
+  ldr r1, =_sram_vectors
+  str r1, [r0]
+  dsb
+  isb
+
 /* Call static constructors */
     bl __libc_init_array
 /* Call the application's entry point.*/
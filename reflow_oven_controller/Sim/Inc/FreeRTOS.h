@@ -0,0 +1,60 @@
+/**
+ * @file FreeRTOS.h
+ * @author Timothy Nguyen
+ * @brief Host simulation stand-in for FreeRTOS.h: base types and static allocation buffers.
+ * @version 0.1
+ * @date 2021-08-30
+ *
+ * Kernel objects of the simulation kernel live in sim_os.c, so static control blocks passed
+ * through CMSIS-RTOS2 attributes are accepted and left unused.
+ */
+
+#ifndef _SIM_FREERTOS_H_
+#define _SIM_FREERTOS_H_
+
+#include <stdint.h>
+#include <stddef.h>
+
+typedef long BaseType_t;
+typedef unsigned long UBaseType_t;
+typedef uint32_t TickType_t;
+
+#define pdFALSE ((BaseType_t)0)
+#define pdTRUE ((BaseType_t)1)
+#define pdPASS (pdTRUE)
+#define pdFAIL (pdFALSE)
+#define errQUEUE_FULL ((BaseType_t)0)
+
+#define portMAX_DELAY ((TickType_t)0xFFFFFFFFUL)
+#define portYIELD_FROM_ISR(x) ((void)(x)) // Scheduler runs the highest priority ready thread after every interrupt.
+
+#define configTICK_RATE_HZ ((TickType_t)1000)
+#define configTIMER_TASK_PRIORITY (40) // PRIO_ACQUISITION, as on the target.
+
+/* Static allocation buffers, sized as on the target */
+typedef struct
+{
+    uint8_t dummy[92];
+} StaticTask_t;
+
+typedef struct
+{
+    uint8_t dummy[80];
+} StaticQueue_t;
+
+typedef struct
+{
+    uint8_t dummy[44];
+} StaticTimer_t;
+
+typedef struct
+{
+    uint8_t dummy[80];
+} StaticSemaphore_t;
+
+typedef struct
+{
+    uint8_t dummy[32];
+} StaticEventGroup_t;
+
+#endif
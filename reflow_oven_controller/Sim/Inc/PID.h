@@ -0,0 +1,10 @@
+/**
+ * @file PID.h
+ * @author Timothy Nguyen
+ * @brief pid.c includes its header as "PID.h", which only resolves on case-insensitive
+ *        file systems. Forwards to pid.h for host builds.
+ * @version 0.1
+ * @date 2021-08-30
+ */
+
+#include "pid.h"
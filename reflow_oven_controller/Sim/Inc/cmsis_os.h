@@ -0,0 +1,18 @@
+/**
+ * @file cmsis_os.h
+ * @author Timothy Nguyen
+ * @brief Host simulation stand-in for the CMSIS-RTOS2 FreeRTOS wrapper header.
+ * @version 0.1
+ * @date 2021-08-30
+ *
+ * The CMSIS-RTOS2 API is the unmodified cmsis_os2.h, implemented on virtual time by sim_os.c.
+ */
+
+#ifndef _SIM_CMSIS_OS_H_
+#define _SIM_CMSIS_OS_H_
+
+#include "FreeRTOS.h"
+#include "task.h"
+#include "cmsis_os2.h"
+
+#endif
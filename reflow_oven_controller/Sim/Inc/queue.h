@@ -0,0 +1,27 @@
+/**
+ * @file queue.h
+ * @author Timothy Nguyen
+ * @brief Host simulation stand-in for FreeRTOS queue.h: queue calls used on message queues.
+ * @version 0.1
+ * @date 2021-08-30
+ */
+
+#ifndef _SIM_QUEUE_H_
+#define _SIM_QUEUE_H_
+
+#include "FreeRTOS.h"
+
+/* Queue handles are CMSIS-RTOS2 message queue ids. */
+typedef struct sim_queue *QueueHandle_t;
+
+BaseType_t xQueueSendToBack(QueueHandle_t xQueue, const void *pvItemToQueue, TickType_t xTicksToWait);
+BaseType_t xQueueSendToFront(QueueHandle_t xQueue, const void *pvItemToQueue, TickType_t xTicksToWait);
+BaseType_t xQueueSendToBackFromISR(QueueHandle_t xQueue, const void *pvItemToQueue,
+                                   BaseType_t *pxHigherPriorityTaskWoken);
+BaseType_t xQueueSendToFrontFromISR(QueueHandle_t xQueue, const void *pvItemToQueue,
+                                    BaseType_t *pxHigherPriorityTaskWoken);
+BaseType_t xQueueReceive(QueueHandle_t xQueue, void *pvBuffer, TickType_t xTicksToWait);
+UBaseType_t uxQueueMessagesWaiting(QueueHandle_t xQueue);
+UBaseType_t uxQueueMessagesWaitingFromISR(QueueHandle_t xQueue);
+
+#endif
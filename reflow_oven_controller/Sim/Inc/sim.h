@@ -0,0 +1,173 @@
+/**
+ * @file sim.h
+ * @author Timothy Nguyen
+ * @brief Host simulation: virtual-time kernel, peripheral stand-ins and oven thermal model.
+ * @version 0.1
+ * @date 2021-08-30
+ *
+ * The simulation links the unmodified controller modules (reflow, PID, active objects, command
+ * module, ...) against stand-ins for the STM32 HAL, CMSIS-RTOS2 and the hardware-bound service
+ * modules:
+ *
+ * - sim_os.c: CMSIS-RTOS2 and the FreeRTOS calls used by active.c, on virtual time. Threads are
+ *   coroutines switched at kernel calls, the highest priority ready thread runs. Code takes no
+ *   virtual time to run, so time jumps straight to the next timeout or interrupt and a reflow
+ *   run completes in well under a second.
+ * - sim_hal.c: GPIO, SPI and TIM in RAM registers. SPI transfers to a chip select attached with
+ *   sim_spi_attach() read a MAX31855K frame of the oven model, DMA completion and timer updates
+ *   are interrupts scheduled on virtual time.
+ * - sim_oven.c: lumped thermal model of the oven, the heater driver API feeding it and the
+ *   "oven" commands to set model parameters and inject thermocouple faults.
+ * - sim_services.c: console, non-volatile storage, watchdog, power, clock, trace and archive
+ *   stand-ins. Console text goes to stdout, telemetry frames to the CSV file.
+ * - sim_replay.c: replays an "evlog dump" capture against the active objects that recorded it.
+ * - sim_main.c: boots the modules like StartDefaultTask() and feeds the command script.
+ */
+
+#ifndef _SIM_H_
+#define _SIM_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdio.h>
+
+#include "stm32l4xx_hal.h"
+
+/* Configuration parameters */
+#define SIM_MAX_THREADS 16U           // Maximum number of threads.
+#define SIM_MAX_QUEUES 16U            // Maximum number of message queues.
+#define SIM_MAX_TIMERS 8U             // Maximum number of software timers.
+#define SIM_MAX_EVENT_FLAGS 8U        // Maximum number of event flags objects.
+#define SIM_MAX_PENDS 10U             // Maximum number of pended timer daemon calls, configTIMER_QUEUE_LENGTH.
+#define SIM_MAX_ISRS 16U              // Maximum number of pending interrupts.
+#define SIM_STACK_SIZE (256U * 1024U) // Host stack per thread (bytes), target stack sizes are too small for host code.
+#define SIM_CORE_CLOCK_HZ 80000000U   // System clock of DWT cycle counts and timer clocks (Hz).
+#define SIM_SPI_CLOCK_HZ 80000000U    // SPI kernel clock before baud rate prescaler (Hz).
+
+#define SIM_HEATER_CHANNEL TIM_CHANNEL_1 // PWM channel of the oven heater.
+#define SIM_FAN_CHANNEL TIM_CHANNEL_2    // PWM channel of the convection fan.
+
+////////////////////////////////////////////////////////////////////////////////
+// Kernel (sim_os.c)
+////////////////////////////////////////////////////////////////////////////////
+
+/* Interrupt handler run on virtual time */
+typedef void (*sim_isr_t)(void *arg);
+
+/**
+ * @brief Get virtual time since simulation start.
+ *
+ * @return Virtual time (us).
+ */
+uint64_t sim_time_us(void);
+
+/**
+ * @brief Run interrupt handler once virtual time reaches a deadline.
+ *
+ * The handler runs in interrupt context, __get_IPSR() is non-zero.
+ *
+ * @param at_us Virtual time (us), handlers due in the past run at once.
+ * @param isr Interrupt handler.
+ * @param arg Handler argument.
+ */
+void sim_isr_at(uint64_t at_us, sim_isr_t isr, void *arg);
+
+/**
+ * @brief Limit virtual time, osKernelStart() returns once nothing is due before the limit.
+ *
+ * @param limit_us Virtual time limit (us).
+ */
+void sim_time_limit(uint64_t limit_us);
+
+/**
+ * @brief Stop simulation, osKernelStart() returns once the calling thread blocks or returns.
+ */
+void sim_stop(void);
+
+/**
+ * @brief Check whether simulation stopped at the time limit rather than by sim_stop().
+ *
+ * @return true if the time limit was reached.
+ */
+bool sim_timed_out(void);
+
+////////////////////////////////////////////////////////////////////////////////
+// Peripherals (sim_hal.c)
+////////////////////////////////////////////////////////////////////////////////
+
+/**
+ * @brief Attach emulated MAX31855K to chip select, transfers while it is low read its frame.
+ *
+ * @param port Chip select GPIO port.
+ * @param pin Chip select GPIO pin.
+ * @param tc Thermocouple index passed to sim_oven_max31855k_frame().
+ */
+void sim_spi_attach(GPIO_TypeDef *port, uint16_t pin, uint8_t tc);
+
+////////////////////////////////////////////////////////////////////////////////
+// Oven model (sim_oven.c)
+////////////////////////////////////////////////////////////////////////////////
+
+/**
+ * @brief Reset oven model to ambient temperature and register oven commands.
+ */
+void sim_oven_init(void);
+
+/**
+ * @brief Advance oven model to current virtual time and get oven temperature.
+ *
+ * @return Oven temperature (deg C).
+ */
+float sim_oven_temp(void);
+
+/**
+ * @brief Advance oven model to current virtual time and encode thermocouple reading.
+ *
+ * @param tc Thermocouple index.
+ *
+ * @return 32-bit MAX31855K frame, D31 first.
+ */
+uint32_t sim_oven_max31855k_frame(uint8_t tc);
+
+/**
+ * @brief Check whether any heater, the fan excluded, is enabled and not tripped.
+ *
+ * @return true while a heater is driven.
+ */
+bool sim_oven_heating(void);
+
+////////////////////////////////////////////////////////////////////////////////
+// Services (sim_services.c)
+////////////////////////////////////////////////////////////////////////////////
+
+/**
+ * @brief Set file receiving decoded reflow telemetry as CSV.
+ *
+ * @param csv Open file, NULL to drop telemetry.
+ */
+void sim_telemetry_file(FILE *csv);
+
+/**
+ * @brief Set file receiving every other frame written to the console, delimiters included.
+ *
+ * @param bin Open file, NULL to drop frames.
+ */
+void sim_frame_file(FILE *bin);
+
+////////////////////////////////////////////////////////////////////////////////
+// Replay (sim_replay.c)
+////////////////////////////////////////////////////////////////////////////////
+
+/**
+ * @brief Replay event log dump from file, returning once its last event was handled.
+ *
+ * Call from a simulation thread. The active objects of the dump take only recorded events
+ * while it runs, see evlog.h.
+ *
+ * @param path Capture holding "evlog dump" frames.
+ *
+ * @return Number of events replayed, -1 if file holds no dump.
+ */
+int32_t sim_replay(const char *path);
+
+#endif
@@ -0,0 +1,14 @@
+/**
+ * @file stm32l476xx.h
+ * @author Timothy Nguyen
+ * @brief Host simulation stand-in for the STM32L476 device header, see stm32l4xx.h.
+ * @version 0.1
+ * @date 2021-08-30
+ */
+
+#ifndef _SIM_STM32L476XX_H_
+#define _SIM_STM32L476XX_H_
+
+#include "stm32l4xx.h"
+
+#endif
@@ -0,0 +1,85 @@
+/**
+ * @file stm32l4xx.h
+ * @author Timothy Nguyen
+ * @brief Host simulation stand-in for the STM32L4 device header: core registers and intrinsics.
+ * @version 0.1
+ * @date 2021-08-30
+ *
+ * DWT->CYCCNT counts SystemCoreClock cycles of virtual time. Interrupts only run between
+ * thread steps of the simulation kernel, so masking them is bookkeeping only.
+ */
+
+#ifndef _SIM_STM32L4XX_H_
+#define _SIM_STM32L4XX_H_
+
+#include <stdint.h>
+
+/* Data watchpoint and trace unit, cycle counter only */
+typedef struct
+{
+    volatile uint32_t CTRL;
+    volatile uint32_t CYCCNT;
+} DWT_Type;
+
+/* Core debug, trace enable only */
+typedef struct
+{
+    volatile uint32_t DEMCR;
+} CoreDebug_Type;
+
+/* Instrumentation trace macrocell, never enabled since no debugger is attached */
+typedef struct
+{
+    volatile union
+    {
+        volatile uint8_t u8;
+        volatile uint16_t u16;
+        volatile uint32_t u32;
+    } PORT[32];
+    volatile uint32_t TER;
+    volatile uint32_t TCR;
+} ITM_Type;
+
+extern DWT_Type sim_dwt;
+extern CoreDebug_Type sim_core_debug;
+extern ITM_Type sim_itm;
+#define DWT (&sim_dwt)
+#define CoreDebug (&sim_core_debug)
+#define ITM (&sim_itm)
+
+#define DWT_CTRL_CYCCNTENA_Msk (1UL << 0)
+#define CoreDebug_DEMCR_TRCENA_Msk (1UL << 24)
+#define ITM_TCR_ITMENA_Msk (1UL << 0)
+
+/* Core clock frequency (Hz) */
+extern uint32_t SystemCoreClock;
+
+uint32_t __get_PRIMASK(void);
+void __set_PRIMASK(uint32_t priMask);
+void __disable_irq(void);
+void __enable_irq(void);
+uint32_t __get_IPSR(void); // Non-zero while a simulated interrupt runs.
+
+#define __DMB() __sync_synchronize()
+
+/* Exclusive access stand-ins. Simulated interrupts only run at kernel calls, never between
+ * the load and the store, so the store always succeeds. */
+static inline uint32_t __LDREXW(volatile uint32_t *addr)
+{
+    return *addr;
+}
+
+static inline uint32_t __STREXW(uint32_t value, volatile uint32_t *addr)
+{
+    *addr = value;
+    return 0U;
+}
+
+static inline void __CLREX(void)
+{
+}
+#define __CLZ(value) ((uint8_t)((value) == 0U ? 32U : (uint32_t)__builtin_clz(value)))
+
+#include "stm32l4xx_hal.h"
+
+#endif
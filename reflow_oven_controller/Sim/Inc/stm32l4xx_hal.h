@@ -0,0 +1,210 @@
+/**
+ * @file stm32l4xx_hal.h
+ * @author Timothy Nguyen
+ * @brief Host simulation stand-in for the STM32L4 HAL: the types, constants and calls used by
+ *        the simulated firmware modules, backed by RAM registers and sim_hal.c.
+ * @version 0.1
+ * @date 2021-08-30
+ *
+ * Only what the modules built by Sim/Makefile need is declared. A module using anything else
+ * fails to compile for the host, which marks the place to extend this header.
+ */
+
+#ifndef _SIM_STM32L4XX_HAL_H_
+#define _SIM_STM32L4XX_HAL_H_
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include "stm32l4xx.h"
+
+/* HAL return values */
+typedef enum
+{
+    HAL_OK = 0x00U,
+    HAL_ERROR = 0x01U,
+    HAL_BUSY = 0x02U,
+    HAL_TIMEOUT = 0x03U
+} HAL_StatusTypeDef;
+
+////////////////////////////////////////////////////////////////////////////////
+// GPIO
+////////////////////////////////////////////////////////////////////////////////
+
+typedef struct
+{
+    volatile uint32_t IDR;  // Input data register.
+    volatile uint32_t ODR;  // Output data register.
+    volatile uint32_t BSRR; // Bit set/reset register, written by heater trip path only.
+} GPIO_TypeDef;
+
+typedef enum
+{
+    GPIO_PIN_RESET = 0U,
+    GPIO_PIN_SET
+} GPIO_PinState;
+
+#define GPIO_PIN_0 ((uint16_t)0x0001)
+#define GPIO_PIN_1 ((uint16_t)0x0002)
+#define GPIO_PIN_2 ((uint16_t)0x0004)
+#define GPIO_PIN_3 ((uint16_t)0x0008)
+#define GPIO_PIN_4 ((uint16_t)0x0010)
+#define GPIO_PIN_5 ((uint16_t)0x0020)
+#define GPIO_PIN_6 ((uint16_t)0x0040)
+#define GPIO_PIN_7 ((uint16_t)0x0080)
+#define GPIO_PIN_8 ((uint16_t)0x0100)
+#define GPIO_PIN_9 ((uint16_t)0x0200)
+#define GPIO_PIN_10 ((uint16_t)0x0400)
+#define GPIO_PIN_11 ((uint16_t)0x0800)
+#define GPIO_PIN_12 ((uint16_t)0x1000)
+#define GPIO_PIN_13 ((uint16_t)0x2000)
+#define GPIO_PIN_14 ((uint16_t)0x4000)
+#define GPIO_PIN_15 ((uint16_t)0x8000)
+
+extern GPIO_TypeDef sim_gpioa, sim_gpiob, sim_gpioc;
+#define GPIOA (&sim_gpioa)
+#define GPIOB (&sim_gpiob)
+#define GPIOC (&sim_gpioc)
+
+void HAL_GPIO_WritePin(GPIO_TypeDef *GPIOx, uint16_t GPIO_Pin, GPIO_PinState PinState);
+GPIO_PinState HAL_GPIO_ReadPin(GPIO_TypeDef *GPIOx, uint16_t GPIO_Pin);
+
+////////////////////////////////////////////////////////////////////////////////
+// DMA, USART and CAN, referenced by configuration structures only
+////////////////////////////////////////////////////////////////////////////////
+
+typedef struct
+{
+    volatile uint32_t ISR;
+} DMA_TypeDef;
+
+typedef struct
+{
+    volatile uint32_t ISR;
+} USART_TypeDef;
+
+typedef struct
+{
+    volatile uint32_t MCR;
+} CAN_TypeDef;
+
+extern DMA_TypeDef sim_dma1;
+extern USART_TypeDef sim_usart2;
+#define DMA1 (&sim_dma1)
+#define USART2 (&sim_usart2)
+
+////////////////////////////////////////////////////////////////////////////////
+// SPI
+////////////////////////////////////////////////////////////////////////////////
+
+typedef struct
+{
+    volatile uint32_t CR1;
+    volatile uint32_t SR;
+} SPI_TypeDef;
+
+typedef enum
+{
+    HAL_SPI_STATE_RESET = 0x00U,
+    HAL_SPI_STATE_READY = 0x01U,
+    HAL_SPI_STATE_BUSY_TX_RX = 0x05U
+} HAL_SPI_StateTypeDef;
+
+typedef struct
+{
+    uint32_t CLKPolarity;       // SPI_CR1_CPOL or 0.
+    uint32_t CLKPhase;          // SPI_CR1_CPHA or 0.
+    uint32_t BaudRatePrescaler; // CR1 BR field, the clock is the 80 MHz bus clock divided by 2 << BR.
+} SPI_InitTypeDef;
+
+typedef struct __SPI_HandleTypeDef
+{
+    SPI_TypeDef *Instance;
+    SPI_InitTypeDef Init;
+    uint8_t *pRxBuffPtr;
+    uint16_t RxXferSize;
+    volatile HAL_SPI_StateTypeDef State;
+} SPI_HandleTypeDef;
+
+extern SPI_TypeDef sim_spi2;
+#define SPI2 (&sim_spi2)
+
+#define SPI_CR1_CPHA 0x00000001U
+#define SPI_CR1_CPOL 0x00000002U
+#define SPI_CR1_BR_Pos 3U
+#define SPI_CR1_BR 0x00000038U
+#define SPI_CR1_SPE 0x00000040U
+#define SPI_BAUDRATEPRESCALER_16 0x00000018U
+
+HAL_StatusTypeDef HAL_SPI_TransmitReceive_DMA(SPI_HandleTypeDef *hspi, uint8_t *pTxData, uint8_t *pRxData,
+                                              uint16_t Size);
+void HAL_SPI_TxRxCpltCallback(SPI_HandleTypeDef *hspi);
+void HAL_SPI_ErrorCallback(SPI_HandleTypeDef *hspi);
+
+////////////////////////////////////////////////////////////////////////////////
+// TIM
+////////////////////////////////////////////////////////////////////////////////
+
+typedef struct
+{
+    volatile uint32_t CR1;
+    volatile uint32_t SR;
+    volatile uint32_t CNT;
+    volatile uint32_t PSC;
+    volatile uint32_t ARR;
+    volatile uint32_t CCR1;
+    volatile uint32_t CCR2;
+    volatile uint32_t CCR3;
+    volatile uint32_t CCR4;
+} TIM_TypeDef;
+
+typedef struct
+{
+    uint32_t Prescaler; // Counter clock is the 80 MHz timer clock divided by Prescaler + 1.
+    uint32_t Period;    // Auto-reload value.
+} TIM_Base_InitTypeDef;
+
+typedef struct
+{
+    TIM_TypeDef *Instance;
+    TIM_Base_InitTypeDef Init;
+} TIM_HandleTypeDef;
+
+extern TIM_TypeDef sim_tim3, sim_tim6;
+#define TIM3 (&sim_tim3)
+#define TIM6 (&sim_tim6)
+
+#define TIM_CHANNEL_1 0x00000000U
+#define TIM_CHANNEL_2 0x00000004U
+#define TIM_CHANNEL_3 0x00000008U
+#define TIM_CHANNEL_4 0x0000000CU
+
+#define TIM_FLAG_UPDATE 0x00000001U
+#define TIM_CR1_CEN 0x00000001U
+#define TIM_CR1_ARPE 0x00000080U
+
+#define __HAL_TIM_SET_COUNTER(__HANDLE__, __COUNTER__) ((__HANDLE__)->Instance->CNT = (__COUNTER__))
+#define __HAL_TIM_SET_AUTORELOAD(__HANDLE__, __AUTORELOAD__) \
+    do                                                      \
+    {                                                       \
+        (__HANDLE__)->Instance->ARR = (__AUTORELOAD__);     \
+        (__HANDLE__)->Init.Period = (__AUTORELOAD__);       \
+    } while (0)
+#define __HAL_TIM_CLEAR_FLAG(__HANDLE__, __FLAG__) ((__HANDLE__)->Instance->SR = ~(uint32_t)(__FLAG__))
+
+HAL_StatusTypeDef HAL_TIM_Base_Init(TIM_HandleTypeDef *htim);
+HAL_StatusTypeDef HAL_TIM_Base_Start_IT(TIM_HandleTypeDef *htim);
+HAL_StatusTypeDef HAL_TIM_Base_Stop_IT(TIM_HandleTypeDef *htim);
+void HAL_TIM_PeriodElapsedCallback(TIM_HandleTypeDef *htim);
+
+////////////////////////////////////////////////////////////////////////////////
+// System
+////////////////////////////////////////////////////////////////////////////////
+
+#define CLEAR_BIT(REG, BIT) ((REG) &= ~(BIT))
+
+uint32_t HAL_GetTick(void);
+void HAL_Delay(uint32_t Delay);
+uint32_t HAL_RCC_GetPCLK1Freq(void);
+
+#endif
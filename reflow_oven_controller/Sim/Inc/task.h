@@ -0,0 +1,22 @@
+/**
+ * @file task.h
+ * @author Timothy Nguyen
+ * @brief Host simulation stand-in for FreeRTOS task.h: task notifications.
+ * @version 0.1
+ * @date 2021-08-30
+ */
+
+#ifndef _SIM_TASK_H_
+#define _SIM_TASK_H_
+
+#include "FreeRTOS.h"
+
+/* Task handles are CMSIS-RTOS2 thread ids. */
+typedef struct sim_thread *TaskHandle_t;
+
+BaseType_t xTaskNotifyGive(TaskHandle_t xTaskToNotify);
+void vTaskNotifyGiveFromISR(TaskHandle_t xTaskToNotify, BaseType_t *pxHigherPriorityTaskWoken);
+uint32_t ulTaskNotifyTake(BaseType_t xClearCountOnExit, TickType_t xTicksToWait);
+TickType_t xTaskGetTickCount(void);
+
+#endif
@@ -0,0 +1,22 @@
+/**
+ * @file timers.h
+ * @author Timothy Nguyen
+ * @brief Host simulation stand-in for FreeRTOS timers.h: function calls pended to the timer daemon.
+ * @version 0.1
+ * @date 2021-09-16
+ */
+
+#ifndef _SIM_TIMERS_H_
+#define _SIM_TIMERS_H_
+
+#include "FreeRTOS.h"
+
+/* Function run by the timer daemon */
+typedef void (*PendedFunction_t)(void *, uint32_t);
+
+BaseType_t xTimerPendFunctionCall(PendedFunction_t xFunctionToPend, void *pvParameter1, uint32_t ulParameter2,
+                                  TickType_t xTicksToWait);
+BaseType_t xTimerPendFunctionCallFromISR(PendedFunction_t xFunctionToPend, void *pvParameter1, uint32_t ulParameter2,
+                                         BaseType_t *pxHigherPriorityTaskWoken);
+
+#endif
@@ -0,0 +1,948 @@
+/**
+ * @file sim_farm.c
+ * @author Timothy Nguyen
+ * @brief Host simulation farm: fleets of simulated ovens with varied plant parameters and gain sweeps, run in parallel.
+ * @version 0.1
+ * @date 2021-09-16
+ *
+ * Usage: reflow_farm [-b simulator] [-n ovens] [-j jobs] [-v spread] [-r seed] [-g gains]
+ *                    [-k key=lo:hi:points]... [-x script]... [-o results.csv] [-t seconds]
+ *
+ * Every run is one reflow_sim process fed a generated script: "oven set" with its plant
+ * parameters, "reflow set <gains>" if given, "reflow set" with the candidate's swept gains, the
+ * lines of a profile script if given (eg. a profile or conformance limits), then "reflow stream
+ * on", "reflow start", "wait run" and "reflow conform". The controller modules and the RTOS shim
+ * keep their state in file-scope variables, so simulated controllers are processes, each with
+ * its own virtual time and shim. A pool of worker threads, one per core by default, keeps that
+ * many running, parses the conformance block of each output and scores the telemetry.
+ *
+ * Plant parameters are the sim_oven.c defaults, each scaled by a factor drawn uniformly from
+ * [1 - spread, 1 + spread] by a generator seeded with the seed and the oven number, so a fleet
+ * is reproduced by its seed whatever the number of jobs.
+ *
+ * Each -k adds a sweep axis over a "reflow set" key (Kp, Ki, Kd, Tau or Kff), points values
+ * spaced evenly from lo to hi. Candidates are the grid of all axes, each run on every oven with
+ * every -x profile. Without -k there is one candidate, the fleet itself.
+ *
+ * Besides conformance, every heating segment (final setpoint above the temperature it starts
+ * at) is scored from the telemetry: overshoot is the largest temperature above setpoint,
+ * settling time the time from segment start until the error stays within FARM_SETTLE_BAND.
+ * Runs keep their worst segment.
+ *
+ * A sweep ranks candidates by runs passed, then mean RMS error, and prints the best as a
+ * "reflow set" line, which persists the gains on a device like any console command. The best
+ * candidate (the fleet without -k) is then summarized: fleet minimum, mean and maximum of every
+ * metric with the runs failing it, and the failed runs with their parameters. -o writes one CSV
+ * row per run. The exit status is 0 if every run of the best candidate passed.
+ */
+
+#define _GNU_SOURCE // pipe2()
+
+#include <errno.h>
+#include <fcntl.h>
+#include <math.h>
+#include <pthread.h>
+#include <spawn.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "conform.h"
+
+////////////////////////////////////////////////////////////////////////////////
+// Common macros
+////////////////////////////////////////////////////////////////////////////////
+
+#define FARM_DEFAULT_OVENS 100U    // Default fleet size.
+#define FARM_DEFAULT_SPREAD 0.2f   // Default relative spread of plant parameters.
+#define FARM_DEFAULT_LIMIT_S 3600U // Default virtual time limit of each run (s).
+#define FARM_MAX_OVENS 100000U     // Largest fleet.
+#define FARM_MAX_RUNS 1000000U     // Most runs of a sweep, candidates x ovens x profiles.
+#define FARM_MAX_JOBS 256U         // Most simulations running at once.
+#define FARM_MAX_AXES 4U           // Swept gains.
+#define FARM_MAX_POINTS 64U        // Values of a swept gain.
+#define FARM_MAX_PROFILES 8U       // Profile scripts.
+#define FARM_PROFILE_LEN 2048U     // Longest profile script.
+#define FARM_SCRIPT_LEN 4096U      // Longest generated script, profile included.
+#define FARM_MAX_LISTED 20U        // Candidates and failed runs listed in the summary.
+#define FARM_NUM_PARAMS 6U         // Varied plant parameters, see farm_params.
+#define FARM_SETTLE_BAND 5.0f      // Error band of a settled segment (deg C).
+
+////////////////////////////////////////////////////////////////////////////////
+// Type definitions
+////////////////////////////////////////////////////////////////////////////////
+
+/* Varied plant parameter */
+typedef struct
+{
+    const char *key; // Key of "oven set".
+    float nominal;   // Default of sim_oven.c.
+} farm_param_t;
+
+/* Simulated oven */
+typedef struct
+{
+    float param[FARM_NUM_PARAMS]; // Plant parameters, indexed like farm_params.
+} farm_oven_t;
+
+/* Sweep axis */
+typedef struct
+{
+    const char *key; // Key of "reflow set".
+    float lo;        // First value.
+    float hi;        // Last value.
+    uint32_t points; // Number of values.
+} farm_axis_t;
+
+/* Gain candidate */
+typedef struct
+{
+    float gain[FARM_MAX_AXES]; // Swept gains, indexed like axes.
+    uint32_t passed;           // Runs passed.
+    uint32_t scored;           // Runs with a conformance verdict.
+    float overshoot;           // Worst overshoot (deg C).
+    float settle;              // Worst settling time (s).
+    double rms_sum;            // Sum of RMS errors of scored runs (deg C).
+} farm_cand_t;
+
+/* Simulation run of a candidate on one oven with one profile */
+typedef struct
+{
+    float value[CONFORM_NUM_METRICS]; // Metric values of the run.
+    bool failed[CONFORM_NUM_METRICS]; // Metric outside its limits.
+    bool scored;                      // Run ended with a conformance verdict.
+    bool passed;                      // Every metric within its limits and simulator exited normally.
+    int status;                       // Simulator exit status, -1 if it did not run.
+    float overshoot;                  // Largest overshoot of a heating segment (deg C).
+    float settle;                     // Longest settling time of a heating segment (s).
+} farm_run_t;
+
+////////////////////////////////////////////////////////////////////////////////
+// Private (static) function declarations
+////////////////////////////////////////////////////////////////////////////////
+
+static void *farm_worker(void *arg);                           // Run until no run is left.
+static void farm_run(uint32_t index);                          // Run one simulation.
+static size_t farm_script(uint32_t index, char *buf);          // Generate one run's script.
+static void farm_parse(farm_run_t *const run, FILE *out);      // Parse conformance block of output.
+static void farm_response(farm_run_t *const run, FILE *csv);   // Score overshoot and settling of telemetry.
+static void farm_draw(uint32_t index);                         // Draw plant parameters of an oven.
+static bool farm_parse_axis(const char *spec);                 // Add sweep axis.
+static bool farm_read_profile(const char *path);               // Add profile script.
+static void farm_gains(uint32_t cand, char *buf, size_t size); // Format swept gains of a candidate.
+static uint32_t farm_rank(void);                               // Score candidates, print ranking.
+static int farm_cand_cmp(const void *a, const void *b);        // Order candidates best first.
+static void farm_summary(uint32_t cand, double elapsed_s);     // Print summary of a candidate.
+static bool farm_write_csv(const char *path);                  // Write per-run results.
+static void farm_usage(const char *prog);                      // Print usage.
+
+////////////////////////////////////////////////////////////////////////////////
+// Private (static) variables
+////////////////////////////////////////////////////////////////////////////////
+
+/* Varied parameters, ambient, noise and the heater drive stay at their defaults. */
+static const farm_param_t farm_params[] = {{"gain", 300.0f}, {"tau", 180.0f}, {"elem_tau", 20.0f},
+                                           {"delay", 5.0f},  {"fan", 2.0f},   {"tc_tau", 1.0f}};
+_Static_assert(sizeof(farm_params) / sizeof(farm_params[0]) == FARM_NUM_PARAMS, "One entry per varied parameter");
+
+/* Metric names as printed by "reflow conform", indexed by Conform_metric_t */
+static const char *metric_names[CONFORM_NUM_METRICS] = {"peak", "tal", "soak", "ramp", "rms"};
+
+/* Gain keys of "reflow set" */
+static const char *gain_keys[] = {"Kp", "Ki", "Kd", "Tau", "Kff"};
+
+/* Farm configuration */
+static const char *sim_path = "build/reflow_sim";
+static uint32_t num_ovens = FARM_DEFAULT_OVENS;
+static float spread = FARM_DEFAULT_SPREAD;
+static uint64_t seed = 1U;
+static const char *gains;
+static uint32_t limit_s = FARM_DEFAULT_LIMIT_S;
+static farm_axis_t axes[FARM_MAX_AXES];
+static uint32_t num_axes;
+static char profiles[FARM_MAX_PROFILES][FARM_PROFILE_LEN]; // Profile script lines, one empty profile by default.
+static const char *profile_names[FARM_MAX_PROFILES];
+static uint32_t num_profiles;
+
+/* Ovens, candidates and runs, each run written by the worker that took it */
+static farm_oven_t *ovens;
+static farm_cand_t *cands;
+static uint32_t num_cands;
+static farm_run_t *runs;
+static uint32_t num_runs;
+
+/* Next run to start */
+static uint32_t next_run;
+
+extern char **environ;
+
+////////////////////////////////////////////////////////////////////////////////
+// Public (global) functions
+////////////////////////////////////////////////////////////////////////////////
+
+int main(int argc, char **argv)
+{
+    long cores = sysconf(_SC_NPROCESSORS_ONLN);
+    uint32_t jobs = cores > 0 ? (uint32_t)cores : 1U;
+    const char *csv_path = NULL;
+
+    int opt;
+    while ((opt = getopt(argc, argv, "b:n:j:v:r:g:k:x:o:t:h")) != -1)
+    {
+        switch (opt)
+        {
+        case 'b':
+            sim_path = optarg;
+            break;
+        case 'n':
+            num_ovens = (uint32_t)strtoul(optarg, NULL, 0);
+            break;
+        case 'j':
+            jobs = (uint32_t)strtoul(optarg, NULL, 0);
+            break;
+        case 'v':
+            spread = strtof(optarg, NULL);
+            break;
+        case 'r':
+            seed = strtoull(optarg, NULL, 0);
+            break;
+        case 'g':
+            gains = optarg;
+            break;
+        case 'k':
+            if (!farm_parse_axis(optarg))
+            {
+                farm_usage(argv[0]);
+                return 2;
+            }
+            break;
+        case 'x':
+            if (!farm_read_profile(optarg))
+            {
+                return 1;
+            }
+            break;
+        case 'o':
+            csv_path = optarg;
+            break;
+        case 't':
+            limit_s = (uint32_t)strtoul(optarg, NULL, 0);
+            break;
+        default:
+            farm_usage(argv[0]);
+            return 2;
+        }
+    }
+    if (num_ovens == 0U || num_ovens > FARM_MAX_OVENS || jobs == 0U || jobs > FARM_MAX_JOBS || spread < 0.0f ||
+        spread >= 1.0f || limit_s == 0U)
+    {
+        farm_usage(argv[0]);
+        return 2;
+    }
+    if (access(sim_path, X_OK) != 0)
+    {
+        perror(sim_path);
+        return 1;
+    }
+    if (num_profiles == 0U)
+    {
+        profile_names[0] = "default";
+        num_profiles = 1U;
+    }
+
+    uint64_t total = (uint64_t)num_ovens * num_profiles;
+    num_cands = 1U;
+    for (uint32_t a = 0; a < num_axes; a++)
+    {
+        num_cands *= axes[a].points; // At most FARM_MAX_POINTS^FARM_MAX_AXES.
+    }
+    total *= num_cands;
+    if (total > FARM_MAX_RUNS)
+    {
+        fprintf(stderr, "%llu runs, at most %u\n", (unsigned long long)total, FARM_MAX_RUNS);
+        return 2;
+    }
+    num_runs = (uint32_t)total;
+
+    ovens = calloc(num_ovens, sizeof(*ovens));
+    cands = calloc(num_cands, sizeof(*cands));
+    runs = calloc(num_runs, sizeof(*runs));
+    if (ovens == NULL || cands == NULL || runs == NULL)
+    {
+        perror("calloc");
+        return 1;
+    }
+    for (uint32_t i = 0; i < num_ovens; i++)
+    {
+        farm_draw(i);
+    }
+    for (uint32_t c = 0; c < num_cands; c++)
+    {
+        uint32_t rest = c; // Last axis varies fastest.
+        for (uint32_t a = num_axes; a-- > 0U;)
+        {
+            uint32_t k = rest % axes[a].points;
+            rest /= axes[a].points;
+            float step = axes[a].points > 1U ? (axes[a].hi - axes[a].lo) / (float)(axes[a].points - 1U) : 0.0f;
+            cands[c].gain[a] = axes[a].lo + step * (float)k;
+        }
+    }
+
+    if (jobs > num_runs)
+    {
+        jobs = num_runs;
+    }
+    printf("Simulating %lu candidates x %lu ovens x %lu profiles, spread %.0f %%, seed %llu, on %lu jobs\n",
+           (unsigned long)num_cands, (unsigned long)num_ovens, (unsigned long)num_profiles, spread * 100.0f,
+           (unsigned long long)seed, (unsigned long)jobs);
+
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    pthread_t workers[FARM_MAX_JOBS];
+    uint32_t started = 0;
+    for (; started < jobs; started++)
+    {
+        if (pthread_create(&workers[started], NULL, farm_worker, NULL) != 0)
+        {
+            break;
+        }
+    }
+    if (started == 0U)
+    {
+        fprintf(stderr, "No worker thread started\n");
+        return 1;
+    }
+    for (uint32_t i = 0; i < started; i++)
+    {
+        pthread_join(workers[i], NULL);
+    }
+    struct timespec end;
+    clock_gettime(CLOCK_MONOTONIC, &end);
+
+    uint32_t best = farm_rank();
+    farm_summary(best, (double)(end.tv_sec - start.tv_sec) + (double)(end.tv_nsec - start.tv_nsec) * 1e-9);
+    if (csv_path != NULL && !farm_write_csv(csv_path))
+    {
+        return 1;
+    }
+    return cands[best].passed == num_ovens * num_profiles ? 0 : 1;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Private (static) functions
+////////////////////////////////////////////////////////////////////////////////
+
+/**
+ * @brief Worker thread, takes the next run and runs it until every run was taken.
+ *
+ * @param arg Unused.
+ *
+ * @return NULL.
+ */
+static void *farm_worker(void *arg)
+{
+    (void)arg;
+    uint32_t i;
+    while ((i = __atomic_fetch_add(&next_run, 1U, __ATOMIC_RELAXED)) < num_runs)
+    {
+        farm_run(i);
+    }
+    return NULL;
+}
+
+/**
+ * @brief Run the simulator on one run's script, parse its conformance block and score its telemetry.
+ *
+ * The script goes to the simulator's standard input, console output and errors come back on
+ * one pipe, telemetry goes to a temporary file. Pipes are close-on-exec so simulators started
+ * by other workers do not hold them.
+ *
+ * @param index Run number: candidate, then oven, then profile.
+ */
+static void farm_run(uint32_t index)
+{
+    farm_run_t *const run = &runs[index];
+    run->status = -1;
+
+    char script[FARM_SCRIPT_LEN];
+    size_t len = farm_script(index, script);
+
+    char csv_path[] = "/tmp/reflow_farm_XXXXXX";
+    int csv_fd = mkstemp(csv_path);
+    if (csv_fd < 0)
+    {
+        return;
+    }
+    close(csv_fd); // Opened again by the simulator.
+
+    int in[2];
+    int out[2];
+    if (pipe2(in, O_CLOEXEC) != 0)
+    {
+        unlink(csv_path);
+        return;
+    }
+    if (pipe2(out, O_CLOEXEC) != 0)
+    {
+        close(in[0]);
+        close(in[1]);
+        unlink(csv_path);
+        return;
+    }
+
+    char limit[16];
+    snprintf(limit, sizeof(limit), "%lu", (unsigned long)limit_s);
+    char *const args[] = {(char *)sim_path, "-t", limit, "-o", csv_path, NULL};
+    posix_spawn_file_actions_t actions;
+    posix_spawn_file_actions_init(&actions);
+    posix_spawn_file_actions_adddup2(&actions, in[0], STDIN_FILENO);
+    posix_spawn_file_actions_adddup2(&actions, out[1], STDOUT_FILENO);
+    posix_spawn_file_actions_adddup2(&actions, out[1], STDERR_FILENO);
+    pid_t pid;
+    int err = posix_spawn(&pid, sim_path, &actions, NULL, args, environ);
+    posix_spawn_file_actions_destroy(&actions);
+    close(in[0]);
+    close(out[1]);
+    if (err != 0)
+    {
+        close(in[1]);
+        close(out[0]);
+        unlink(csv_path);
+        return;
+    }
+
+    /* The script fits in the pipe, so it is written whole before the output is read. */
+    const char *p = script;
+    while (len > 0U)
+    {
+        ssize_t n = write(in[1], p, len);
+        if (n < 0 && errno == EINTR)
+        {
+            continue;
+        }
+        if (n <= 0)
+        {
+            break;
+        }
+        p += n;
+        len -= (size_t)n;
+    }
+    close(in[1]);
+
+    FILE *f = fdopen(out[0], "r");
+    if (f != NULL)
+    {
+        farm_parse(run, f);
+        fclose(f);
+    }
+    else
+    {
+        close(out[0]);
+    }
+
+    int wstatus;
+    while (waitpid(pid, &wstatus, 0) < 0 && errno == EINTR)
+    {
+    }
+    run->status = WIFEXITED(wstatus) ? WEXITSTATUS(wstatus) : 128 + WTERMSIG(wstatus);
+    run->passed = run->passed && run->status == 0;
+
+    FILE *csv = fopen(csv_path, "r");
+    if (csv != NULL)
+    {
+        farm_response(run, csv);
+        fclose(csv);
+    }
+    unlink(csv_path);
+}
+
+/**
+ * @brief Generate one run's script.
+ *
+ * @param index Run number.
+ * @param[out] buf Script, FARM_SCRIPT_LEN bytes.
+ *
+ * @return Script length.
+ */
+static size_t farm_script(uint32_t index, char *buf)
+{
+    uint32_t cand = index / (num_ovens * num_profiles);
+    farm_oven_t const *const oven = &ovens[(index / num_profiles) % num_ovens];
+    size_t len = (size_t)snprintf(buf, FARM_SCRIPT_LEN, "oven set");
+    for (uint32_t i = 0; i < FARM_NUM_PARAMS; i++)
+    {
+        len += (size_t)snprintf(buf + len, FARM_SCRIPT_LEN - len, " %s=%.4g", farm_params[i].key, oven->param[i]);
+    }
+    len += (size_t)snprintf(buf + len, FARM_SCRIPT_LEN - len, "\n");
+    if (gains != NULL)
+    {
+        len += (size_t)snprintf(buf + len, FARM_SCRIPT_LEN - len, "reflow set %s\n", gains);
+    }
+    if (num_axes > 0U)
+    {
+        char swept[128];
+        farm_gains(cand, swept, sizeof(swept));
+        len += (size_t)snprintf(buf + len, FARM_SCRIPT_LEN - len, "reflow set %s\n", swept);
+    }
+    len += (size_t)snprintf(buf + len, FARM_SCRIPT_LEN - len,
+                            "%sreflow stream on\nreflow start\nwait run\nreflow conform\n",
+                            profiles[index % num_profiles]);
+    return len < FARM_SCRIPT_LEN ? len : FARM_SCRIPT_LEN - 1U;
+}
+
+/**
+ * @brief Read simulator output and keep the last conformance block and run verdict.
+ *
+ * A block is the "Conformance:" line, one line per metric in Conform_metric_t order and
+ * "Run <n>: PASS" or "FAIL". Lines start with colour reset and erase line sequences.
+ *
+ * @param run Run.
+ * @param out Simulator output.
+ */
+static void farm_parse(farm_run_t *const run, FILE *out)
+{
+    char *line = NULL;
+    size_t cap = 0;
+    uint32_t m = CONFORM_NUM_METRICS;
+    while (getline(&line, &cap, out) >= 0)
+    {
+        char *s = line;
+        while (s[0] == '\x1b' && s[1] == '[') // Skip control sequences up to their final byte.
+        {
+            s += 2;
+            while (*s != '\0' && (*s < 0x40 || *s > 0x7E))
+            {
+                s++;
+            }
+            s += *s != '\0' ? 1 : 0;
+        }
+
+        char name[16];
+        float value;
+        char verdict[8];
+        if (strncmp(s, "Conformance:", 12) == 0)
+        {
+            m = 0;
+        }
+        else if (m < CONFORM_NUM_METRICS && sscanf(s, "%15s %f", name, &value) == 2 &&
+                 strcmp(name, metric_names[m]) == 0 && strchr(s, '[') != NULL)
+        {
+            run->value[m] = value;
+            run->failed[m] = strstr(strchr(s, '['), "FAIL") != NULL;
+            m++;
+        }
+        else if (m == CONFORM_NUM_METRICS && sscanf(s, "Run %*u: %7s", verdict) == 1)
+        {
+            run->scored = true;
+            run->passed = strcmp(verdict, "PASS") == 0;
+        }
+    }
+    free(line);
+}
+
+/**
+ * @brief Score overshoot and settling time of the heating segments in zone 0 telemetry.
+ *
+ * @param run Run.
+ * @param csv Telemetry written by the simulator, see sim_telemetry_file().
+ */
+static void farm_response(farm_run_t *const run, FILE *csv)
+{
+    char line[256];
+    if (fgets(line, sizeof(line), csv) == NULL) // Header.
+    {
+        return;
+    }
+
+    bool in_seg = false;
+    unsigned seg = 0;
+    float seg_start = 0.0f;  // Time of first sample (s).
+    float first_temp = 0.0f; // Temperature at first sample (deg C).
+    float last_sp = 0.0f;    // Setpoint of last sample (deg C).
+    float max_err = 0.0f;    // Largest temperature above setpoint (deg C).
+    float last_out = 0.0f;   // Time of last sample outside the band (s).
+    bool more = true;
+    while (more)
+    {
+        float t;
+        unsigned state;
+        unsigned s;
+        unsigned zone;
+        float sp;
+        float temp;
+        more = fgets(line, sizeof(line), csv) != NULL;
+        bool valid = more && sscanf(line, "%f,%u,%u,%u,%f,%f", &t, &state, &s, &zone, &sp, &temp) == 6;
+        if (valid && zone != 0U)
+        {
+            continue;
+        }
+        if (in_seg && (!valid || s != seg) && last_sp > first_temp)
+        {
+            run->overshoot = fmaxf(run->overshoot, max_err);
+            run->settle = fmaxf(run->settle, last_out - seg_start);
+        }
+        if (!valid)
+        {
+            in_seg = false;
+            continue;
+        }
+        if (!in_seg || s != seg)
+        {
+            in_seg = true;
+            seg = s;
+            seg_start = t;
+            first_temp = temp;
+            max_err = 0.0f;
+            last_out = t;
+        }
+        last_sp = sp;
+        max_err = fmaxf(max_err, temp - sp);
+        if (fabsf(temp - sp) > FARM_SETTLE_BAND)
+        {
+            last_out = t;
+        }
+    }
+}
+
+/**
+ * @brief Draw plant parameters of an oven, from its own generator (splitmix64).
+ *
+ * @param index Oven number.
+ */
+static void farm_draw(uint32_t index)
+{
+    uint64_t state = seed * 0x9E3779B97F4A7C15ULL + index;
+    for (uint32_t i = 0; i < FARM_NUM_PARAMS; i++)
+    {
+        uint64_t z = (state += 0x9E3779B97F4A7C15ULL);
+        z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+        z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+        z ^= z >> 31;
+        float u = (float)(z >> 40) / (float)(1U << 24); // [0, 1)
+        ovens[index].param[i] = farm_params[i].nominal * (1.0f + spread * (2.0f * u - 1.0f));
+    }
+}
+
+/**
+ * @brief Add sweep axis "key=lo:hi:points".
+ *
+ * @param spec Axis specification, must remain valid.
+ *
+ * @return true if added.
+ */
+static bool farm_parse_axis(const char *spec)
+{
+    const char *eq = strchr(spec, '=');
+    if (num_axes >= FARM_MAX_AXES || eq == NULL)
+    {
+        return false;
+    }
+    const char *key = NULL;
+    for (uint32_t i = 0; i < sizeof(gain_keys) / sizeof(gain_keys[0]); i++)
+    {
+        if (strlen(gain_keys[i]) == (size_t)(eq - spec) && strncmp(spec, gain_keys[i], (size_t)(eq - spec)) == 0)
+        {
+            key = gain_keys[i];
+        }
+    }
+    farm_axis_t axis = {.key = key};
+    if (key == NULL || sscanf(eq + 1, "%f:%f:%u", &axis.lo, &axis.hi, &axis.points) != 3 || axis.points == 0U ||
+        axis.points > FARM_MAX_POINTS || axis.lo < 0.0f || axis.hi < axis.lo)
+    {
+        return false;
+    }
+    axes[num_axes++] = axis;
+    return true;
+}
+
+/**
+ * @brief Add profile script, lines run before "reflow start".
+ *
+ * @param path Script file, must remain valid.
+ *
+ * @return true if added.
+ */
+static bool farm_read_profile(const char *path)
+{
+    if (num_profiles >= FARM_MAX_PROFILES)
+    {
+        fprintf(stderr, "%s: at most %u profiles\n", path, FARM_MAX_PROFILES);
+        return false;
+    }
+    FILE *f = fopen(path, "r");
+    if (f == NULL)
+    {
+        perror(path);
+        return false;
+    }
+    char *buf = profiles[num_profiles];
+    size_t len = fread(buf, 1, FARM_PROFILE_LEN - 2U, f);
+    bool whole = feof(f);
+    fclose(f);
+    if (!whole)
+    {
+        fprintf(stderr, "%s: longer than %u bytes\n", path, FARM_PROFILE_LEN - 2U);
+        return false;
+    }
+    if (len > 0U && buf[len - 1U] != '\n')
+    {
+        buf[len] = '\n'; // Room was left for the line end and terminator.
+    }
+    profile_names[num_profiles++] = path;
+    return true;
+}
+
+/**
+ * @brief Format swept gains of a candidate as "reflow set" arguments.
+ *
+ * @param cand Candidate.
+ * @param[out] buf Arguments.
+ * @param size Size of buf.
+ */
+static void farm_gains(uint32_t cand, char *buf, size_t size)
+{
+    size_t len = 0;
+    buf[0] = '\0';
+    for (uint32_t a = 0; a < num_axes && len < size; a++)
+    {
+        len += (size_t)snprintf(buf + len, size - len, "%s%s=%.4g", a > 0U ? " " : "", axes[a].key, cands[cand].gain[a]);
+    }
+}
+
+/**
+ * @brief Collect run results per candidate and, for a sweep, print the best candidates.
+ *
+ * @return Best candidate.
+ */
+static uint32_t farm_rank(void)
+{
+    for (uint32_t r = 0; r < num_runs; r++)
+    {
+        farm_run_t const *const run = &runs[r];
+        farm_cand_t *const cand = &cands[r / (num_ovens * num_profiles)];
+        cand->passed += run->passed ? 1U : 0U;
+        if (run->scored)
+        {
+            cand->scored++;
+            cand->rms_sum += run->value[CONFORM_RMS];
+        }
+        cand->overshoot = fmaxf(cand->overshoot, run->overshoot);
+        cand->settle = fmaxf(cand->settle, run->settle);
+    }
+
+    uint32_t *order = malloc(num_cands * sizeof(*order));
+    if (order == NULL)
+    {
+        return 0;
+    }
+    for (uint32_t c = 0; c < num_cands; c++)
+    {
+        order[c] = c;
+    }
+    qsort(order, num_cands, sizeof(*order), farm_cand_cmp);
+    uint32_t best = order[0];
+
+    if (num_axes > 0U)
+    {
+        char swept[128];
+        printf("%-32s %9s %10s %10s %10s\n", "gains", "passed", "overshoot", "settle s", "mean rms");
+        for (uint32_t i = 0; i < num_cands && i < FARM_MAX_LISTED; i++)
+        {
+            farm_cand_t const *const cand = &cands[order[i]];
+            farm_gains(order[i], swept, sizeof(swept));
+            printf("%-32s %4lu/%-4lu %10.2f %10.1f %10.2f\n", swept, (unsigned long)cand->passed,
+                   (unsigned long)(num_ovens * num_profiles), cand->overshoot, cand->settle,
+                   cand->scored > 0U ? cand->rms_sum / cand->scored : NAN);
+        }
+        farm_gains(best, swept, sizeof(swept));
+        printf("Best gains, push with: reflow set %s\n", swept);
+    }
+    free(order);
+    return best;
+}
+
+/**
+ * @brief Order candidates by runs passed, then by mean RMS error, unscored last.
+ */
+static int farm_cand_cmp(const void *a, const void *b)
+{
+    farm_cand_t const *const x = &cands[*(const uint32_t *)a];
+    farm_cand_t const *const y = &cands[*(const uint32_t *)b];
+    if (x->passed != y->passed)
+    {
+        return x->passed > y->passed ? -1 : 1;
+    }
+    double xm = x->scored > 0U ? x->rms_sum / x->scored : INFINITY;
+    double ym = y->scored > 0U ? y->rms_sum / y->scored : INFINITY;
+    return xm < ym ? -1 : (xm > ym ? 1 : 0);
+}
+
+/**
+ * @brief Print statistics of every metric over a candidate's runs, verdicts and the failed runs.
+ *
+ * @param cand Candidate.
+ * @param elapsed_s Wall-clock time of all runs (s).
+ */
+static void farm_summary(uint32_t cand, double elapsed_s)
+{
+    const uint32_t per_cand = num_ovens * num_profiles;
+    farm_run_t const *const first = &runs[cand * per_cand];
+    farm_cand_t const *const c = &cands[cand];
+
+    /* Conformance metrics, then overshoot and settling time, which have no limits. */
+    printf("%-9s %10s %10s %10s %6s\n", "", "min", "mean", "max", "fail");
+    for (uint32_t m = 0; m < CONFORM_NUM_METRICS + 2U && c->scored > 0U; m++)
+    {
+        float lo = INFINITY;
+        float hi = -INFINITY;
+        double sum = 0.0;
+        uint32_t failed = 0;
+        for (uint32_t i = 0; i < per_cand; i++)
+        {
+            farm_run_t const *const run = &first[i];
+            if (run->scored)
+            {
+                float v = m < CONFORM_NUM_METRICS ? run->value[m]
+                                                  : (m == CONFORM_NUM_METRICS ? run->overshoot : run->settle);
+                lo = fminf(lo, v);
+                hi = fmaxf(hi, v);
+                sum += v;
+                failed += m < CONFORM_NUM_METRICS && run->failed[m] ? 1U : 0U;
+            }
+        }
+        const char *name = m < CONFORM_NUM_METRICS ? metric_names[m]
+                                                   : (m == CONFORM_NUM_METRICS ? "overshoot" : "settle s");
+        printf("%-9s %10.2f %10.2f %10.2f %6lu\n", name, lo, sum / c->scored, hi, (unsigned long)failed);
+    }
+    printf("%lu passed, %lu failed, %lu without verdict, %lu runs in %.1f s\n", (unsigned long)c->passed,
+           (unsigned long)(c->scored - c->passed), (unsigned long)(per_cand - c->scored), (unsigned long)num_runs,
+           elapsed_s);
+
+    uint32_t listed = 0;
+    for (uint32_t i = 0; i < per_cand && listed < FARM_MAX_LISTED; i++)
+    {
+        farm_run_t const *const run = &first[i];
+        if (run->passed)
+        {
+            continue;
+        }
+        farm_oven_t const *const oven = &ovens[i / num_profiles];
+        printf("oven %lu, %s:", (unsigned long)(i / num_profiles), profile_names[i % num_profiles]);
+        for (uint32_t p = 0; p < FARM_NUM_PARAMS; p++)
+        {
+            printf(" %s=%.4g", farm_params[p].key, oven->param[p]);
+        }
+        listed++;
+        if (!run->scored)
+        {
+            printf(" -> no verdict, exit status %d\n", run->status);
+            continue;
+        }
+        printf(" ->");
+        for (uint32_t m = 0; m < CONFORM_NUM_METRICS; m++)
+        {
+            if (run->failed[m])
+            {
+                printf(" %s %.2f", metric_names[m], run->value[m]);
+            }
+        }
+        printf("\n");
+    }
+    if (listed == FARM_MAX_LISTED && per_cand - c->passed > listed)
+    {
+        printf("... %lu more failed\n", (unsigned long)(per_cand - c->passed - listed));
+    }
+}
+
+/**
+ * @brief Write one CSV row per run: swept gains, profile, plant parameters, metrics and verdict.
+ *
+ * @param path CSV file.
+ *
+ * @return true if written.
+ */
+static bool farm_write_csv(const char *path)
+{
+    FILE *f = fopen(path, "w");
+    if (f == NULL)
+    {
+        perror(path);
+        return false;
+    }
+    fprintf(f, "candidate");
+    for (uint32_t a = 0; a < num_axes; a++)
+    {
+        fprintf(f, ",%s", axes[a].key);
+    }
+    fprintf(f, ",profile,oven");
+    for (uint32_t p = 0; p < FARM_NUM_PARAMS; p++)
+    {
+        fprintf(f, ",%s", farm_params[p].key);
+    }
+    for (uint32_t m = 0; m < CONFORM_NUM_METRICS; m++)
+    {
+        fprintf(f, ",%s", metric_names[m]);
+    }
+    fprintf(f, ",overshoot,settle,verdict\n");
+
+    for (uint32_t r = 0; r < num_runs; r++)
+    {
+        farm_run_t const *const run = &runs[r];
+        uint32_t cand = r / (num_ovens * num_profiles);
+        uint32_t oven = (r / num_profiles) % num_ovens;
+        fprintf(f, "%lu", (unsigned long)cand);
+        for (uint32_t a = 0; a < num_axes; a++)
+        {
+            fprintf(f, ",%.4g", cands[cand].gain[a]);
+        }
+        fprintf(f, ",%s,%lu", profile_names[r % num_profiles], (unsigned long)oven);
+        for (uint32_t p = 0; p < FARM_NUM_PARAMS; p++)
+        {
+            fprintf(f, ",%.4g", ovens[oven].param[p]);
+        }
+        for (uint32_t m = 0; m < CONFORM_NUM_METRICS; m++)
+        {
+            if (run->scored)
+            {
+                fprintf(f, ",%.2f", run->value[m]);
+            }
+            else
+            {
+                fprintf(f, ",");
+            }
+        }
+        fprintf(f, ",%.2f,%.1f,%s\n", run->overshoot, run->settle,
+                run->passed ? "PASS" : (run->scored ? "FAIL" : "NONE"));
+    }
+    fclose(f);
+    return true;
+}
+
+/**
+ * @brief Print usage.
+ *
+ * @param prog Program name.
+ */
+static void farm_usage(const char *prog)
+{
+    fprintf(stderr,
+            "Usage: %s [-b simulator] [-n ovens] [-j jobs] [-v spread] [-r seed] [-g gains]\n"
+            "          [-k key=lo:hi:points]... [-x script]... [-o results.csv] [-t seconds]\n"
+            "  -b  Simulator executable (default build/reflow_sim)\n"
+            "  -n  Number of ovens, up to %u (default %u)\n"
+            "  -j  Simulations run at once, up to %u (default: online cores)\n"
+            "  -v  Relative spread of plant parameters, below 1 (default %.2f)\n"
+            "  -r  Seed of plant parameters (default 1)\n"
+            "  -g  Fixed gains as \"reflow set\" arguments, eg. \"Kp=100 Ki=1.5\"\n"
+            "  -k  Sweep a gain (Kp, Ki, Kd, Tau, Kff) over points values from lo to hi, up to %u axes\n"
+            "  -x  Profile script run before \"reflow start\", up to %u\n"
+            "  -o  Write per-run gains, parameters, metrics and verdicts as CSV\n"
+            "  -t  Virtual time limit of each run in seconds (default %u)\n",
+            prog, FARM_MAX_OVENS, FARM_DEFAULT_OVENS, FARM_MAX_JOBS, FARM_DEFAULT_SPREAD, FARM_MAX_AXES,
+            FARM_MAX_PROFILES, FARM_DEFAULT_LIMIT_S);
+}
@@ -0,0 +1,309 @@
+/**
+ * @file sim_hal.c
+ * @author Timothy Nguyen
+ * @brief Host simulation stand-in for the STM32L4 HAL: GPIO, SPI and TIM on virtual time.
+ * @version 0.1
+ * @date 2021-08-30
+ *
+ * Peripheral registers are plain RAM. SPI transfers read the MAX31855K frame of the attached
+ * chip select that is low, or all zeros if none is, DMA transfers complete after the bit time
+ * of the transfer at the baud rate prescaler in CR1. The register-level spi_ll functions of the target are stood in for here as
+ * well, with GPIO chip selects only. Base timers raise update interrupts every
+ * (PSC + 1) * (ARR + 1) timer clocks, taking PSC and ARR at every update so auto-reload
+ * changes apply from the next period.
+ */
+
+#include <string.h>
+
+#include "sim.h"
+#include "cmsis_os.h"
+#include "spi_ll.h"
+
+////////////////////////////////////////////////////////////////////////////////
+// Common macros
+////////////////////////////////////////////////////////////////////////////////
+
+#define SIM_MAX_SPI_DEVS 4U // Maximum number of attached SPI devices.
+#define SIM_MAX_TIMS 4U     // Maximum number of running base timers.
+
+////////////////////////////////////////////////////////////////////////////////
+// Type definitions
+////////////////////////////////////////////////////////////////////////////////
+
+/* SPI device attached to chip select */
+typedef struct
+{
+    GPIO_TypeDef *port; // Chip select GPIO port.
+    uint16_t pin;       // Chip select GPIO pin.
+    uint8_t tc;         // Thermocouple index of oven model.
+} sim_spi_dev_t;
+
+/* Base timer interrupt state */
+typedef struct
+{
+    TIM_HandleTypeDef *htim; // Timer handle, NULL for a free slot.
+    uint32_t gen;            // Start count, interrupts of earlier starts are stale.
+    uint64_t next_us;        // Deadline of pending update interrupt (us).
+} sim_tim_t;
+
+////////////////////////////////////////////////////////////////////////////////
+// Private (static) function declarations
+////////////////////////////////////////////////////////////////////////////////
+
+static uint32_t sim_spi_frame(void);                       // Frame of selected device.
+static void sim_spi_fill(uint8_t *data, uint16_t size);    // Shift frame into receive buffer.
+static void sim_spi_complete(void *arg);                   // DMA transfer complete interrupt.
+static uint64_t sim_tim_period_us(TIM_TypeDef const *tim); // Update period of timer.
+static void sim_tim_schedule(sim_tim_t *const slot);       // Schedule next update interrupt.
+static void sim_tim_update(void *arg);                     // Update interrupt.
+
+////////////////////////////////////////////////////////////////////////////////
+// Private (static) variables
+////////////////////////////////////////////////////////////////////////////////
+
+static sim_spi_dev_t spi_devs[SIM_MAX_SPI_DEVS];
+static uint8_t num_spi_devs;
+static sim_tim_t tims[SIM_MAX_TIMS];
+
+////////////////////////////////////////////////////////////////////////////////
+// Public (global) variables and functions
+////////////////////////////////////////////////////////////////////////////////
+
+GPIO_TypeDef sim_gpioa, sim_gpiob, sim_gpioc;
+DMA_TypeDef sim_dma1;
+USART_TypeDef sim_usart2;
+SPI_TypeDef sim_spi2;
+TIM_TypeDef sim_tim3, sim_tim6;
+DWT_Type sim_dwt;
+CoreDebug_Type sim_core_debug;
+ITM_Type sim_itm;
+uint32_t SystemCoreClock = SIM_CORE_CLOCK_HZ;
+
+void sim_spi_attach(GPIO_TypeDef *port, uint16_t pin, uint8_t tc)
+{
+    if (num_spi_devs < SIM_MAX_SPI_DEVS)
+    {
+        spi_devs[num_spi_devs++] = (sim_spi_dev_t){.port = port, .pin = pin, .tc = tc};
+        port->ODR |= pin; // Chip select idles high.
+    }
+}
+
+void HAL_GPIO_WritePin(GPIO_TypeDef *GPIOx, uint16_t GPIO_Pin, GPIO_PinState PinState)
+{
+    if (PinState != GPIO_PIN_RESET)
+    {
+        GPIOx->ODR |= GPIO_Pin;
+    }
+    else
+    {
+        GPIOx->ODR &= ~(uint32_t)GPIO_Pin;
+    }
+}
+
+GPIO_PinState HAL_GPIO_ReadPin(GPIO_TypeDef *GPIOx, uint16_t GPIO_Pin)
+{
+    return (GPIOx->IDR & GPIO_Pin) != 0U ? GPIO_PIN_SET : GPIO_PIN_RESET;
+}
+
+void spi_ll_select(SPI_HandleTypeDef *hspi, GPIO_TypeDef *cs_port, uint16_t cs_pin)
+{
+    (void)hspi;
+    if (cs_port != NULL) // No device is attached to NSS output.
+    {
+        cs_port->ODR &= ~(uint32_t)cs_pin;
+    }
+}
+
+void spi_ll_deselect(SPI_HandleTypeDef *hspi, GPIO_TypeDef *cs_port, uint16_t cs_pin)
+{
+    (void)hspi;
+    if (cs_port != NULL)
+    {
+        cs_port->ODR |= cs_pin;
+    }
+}
+
+HAL_StatusTypeDef spi_ll_receive(SPI_HandleTypeDef *hspi, GPIO_TypeDef *cs_port, uint16_t cs_pin,
+                                 uint8_t *data, uint16_t size, uint32_t timeout_ms)
+{
+    (void)timeout_ms;
+    if (hspi->State == HAL_SPI_STATE_BUSY_TX_RX)
+    {
+        return HAL_BUSY;
+    }
+    spi_ll_select(hspi, cs_port, cs_pin);
+    sim_spi_fill(data, size);
+    spi_ll_deselect(hspi, cs_port, cs_pin);
+    return HAL_OK;
+}
+
+HAL_StatusTypeDef HAL_SPI_TransmitReceive_DMA(SPI_HandleTypeDef *hspi, uint8_t *pTxData, uint8_t *pRxData,
+                                              uint16_t Size)
+{
+    (void)pTxData;
+    if (hspi->State == HAL_SPI_STATE_BUSY_TX_RX)
+    {
+        return HAL_BUSY;
+    }
+    hspi->State = HAL_SPI_STATE_BUSY_TX_RX;
+    hspi->pRxBuffPtr = pRxData;
+    hspi->RxXferSize = Size;
+
+    uint32_t prescaler = 2U << ((hspi->Instance->CR1 & SPI_CR1_BR) >> SPI_CR1_BR_Pos);
+    uint64_t bit_ns = (uint64_t)prescaler * 1000000000U / SIM_SPI_CLOCK_HZ;
+    uint64_t xfer_us = (Size * 8U * bit_ns + 999U) / 1000U;
+    sim_isr_at(sim_time_us() + xfer_us, sim_spi_complete, hspi);
+    return HAL_OK;
+}
+
+HAL_StatusTypeDef HAL_TIM_Base_Init(TIM_HandleTypeDef *htim)
+{
+    htim->Instance->PSC = htim->Init.Prescaler;
+    htim->Instance->ARR = htim->Init.Period;
+    htim->Instance->SR |= TIM_FLAG_UPDATE; // Set by the update generated on init, as on the target.
+    return HAL_OK;
+}
+
+HAL_StatusTypeDef HAL_TIM_Base_Start_IT(TIM_HandleTypeDef *htim)
+{
+    sim_tim_t *slot = NULL;
+    for (uint32_t i = 0; i < SIM_MAX_TIMS && slot == NULL; i++)
+    {
+        if (tims[i].htim == htim || tims[i].htim == NULL)
+        {
+            slot = &tims[i];
+        }
+    }
+    if (slot == NULL || (htim->Instance->CR1 & TIM_CR1_CEN) != 0U)
+    {
+        return HAL_ERROR;
+    }
+
+    slot->htim = htim;
+    slot->gen++;
+    slot->next_us = sim_time_us();
+    htim->Instance->CR1 |= TIM_CR1_CEN;
+    sim_tim_schedule(slot);
+    return HAL_OK;
+}
+
+HAL_StatusTypeDef HAL_TIM_Base_Stop_IT(TIM_HandleTypeDef *htim)
+{
+    for (uint32_t i = 0; i < SIM_MAX_TIMS; i++)
+    {
+        if (tims[i].htim == htim)
+        {
+            tims[i].gen++; // Pending interrupt is stale.
+        }
+    }
+    htim->Instance->CR1 &= ~TIM_CR1_CEN;
+    return HAL_OK;
+}
+
+uint32_t HAL_GetTick(void)
+{
+    return (uint32_t)(sim_time_us() / 1000U);
+}
+
+void HAL_Delay(uint32_t Delay)
+{
+    osDelay(Delay);
+}
+
+uint32_t HAL_RCC_GetPCLK1Freq(void)
+{
+    return SIM_SPI_CLOCK_HZ;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Private (static) functions
+////////////////////////////////////////////////////////////////////////////////
+
+/**
+ * @brief Get frame of the attached device whose chip select is low.
+ *
+ * @return MAX31855K frame, 0 if no device is selected (MISO pulled low).
+ */
+static uint32_t sim_spi_frame(void)
+{
+    for (uint8_t i = 0; i < num_spi_devs; i++)
+    {
+        if ((spi_devs[i].port->ODR & spi_devs[i].pin) == 0U)
+        {
+            return sim_oven_max31855k_frame(spi_devs[i].tc);
+        }
+    }
+    return 0U;
+}
+
+/**
+ * @brief Shift frame of selected device into receive buffer, MSB first.
+ *
+ * @param[out] data Receive buffer.
+ * @param size Number of bytes, bytes past the frame read 0.
+ */
+static void sim_spi_fill(uint8_t *data, uint16_t size)
+{
+    uint32_t frame = sim_spi_frame();
+    memset(data, 0, size);
+    for (uint16_t i = 0; i < size && i < 4U; i++)
+    {
+        data[i] = (uint8_t)(frame >> (24U - 8U * i));
+    }
+}
+
+/**
+ * @brief DMA transfer complete interrupt, fills receive buffer and calls HAL callback.
+ *
+ * @param arg SPI handle.
+ */
+static void sim_spi_complete(void *arg)
+{
+    SPI_HandleTypeDef *const hspi = arg;
+    sim_spi_fill(hspi->pRxBuffPtr, hspi->RxXferSize);
+    hspi->State = HAL_SPI_STATE_READY;
+    HAL_SPI_TxRxCpltCallback(hspi);
+}
+
+/**
+ * @brief Get update period of base timer from its current prescaler and auto-reload values.
+ *
+ * @param tim Timer registers.
+ *
+ * @return Period (us), at least 1.
+ */
+static uint64_t sim_tim_period_us(TIM_TypeDef const *tim)
+{
+    uint64_t clocks = ((uint64_t)tim->PSC + 1U) * ((uint64_t)tim->ARR + 1U);
+    uint64_t period_us = clocks / (SIM_CORE_CLOCK_HZ / 1000000U);
+    return period_us > 0U ? period_us : 1U;
+}
+
+/**
+ * @brief Schedule next update interrupt one period after the previous one.
+ *
+ * @param slot Timer interrupt state.
+ */
+static void sim_tim_schedule(sim_tim_t *const slot)
+{
+    slot->next_us += sim_tim_period_us(slot->htim->Instance);
+    uintptr_t arg = (uintptr_t)(slot - tims) | ((uintptr_t)slot->gen << 8);
+    sim_isr_at(slot->next_us, sim_tim_update, (void *)arg);
+}
+
+/**
+ * @brief Update interrupt, calls HAL callback and schedules the next one unless stale.
+ *
+ * @param arg Slot index in bits 7:0, start count above.
+ */
+static void sim_tim_update(void *arg)
+{
+    sim_tim_t *const slot = &tims[(uintptr_t)arg & 0xFFU];
+    if ((uint32_t)((uintptr_t)arg >> 8) != slot->gen)
+    {
+        return; // Stopped or restarted since scheduled.
+    }
+    slot->htim->Instance->SR |= TIM_FLAG_UPDATE;
+    sim_tim_schedule(slot);
+    HAL_TIM_PeriodElapsedCallback(slot->htim);
+}
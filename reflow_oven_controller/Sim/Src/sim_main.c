@@ -0,0 +1,325 @@
+/**
+ * @file sim_main.c
+ * @author Timothy Nguyen
+ * @brief Host simulation entry point: boots the controller modules and feeds a command script.
+ * @version 0.1
+ * @date 2021-08-30
+ *
+ * Usage: reflow_sim [-s script] [-o telemetry.csv] [-f frames.bin] [-t seconds] [-q]
+ *
+ * Script lines are console commands, posted to the command module like typed lines, except:
+ * - Empty lines and lines starting with '#' are skipped.
+ * - "wait <seconds>" pauses the script for virtual time.
+ * - "wait run" pauses until heaters were switched on and off again, ie. a reflow run ended.
+ * - "replay <file>" replays an "evlog dump" capture, eg. one written with -f, and pauses until
+ *   its last event was handled.
+ *
+ * The script is read from stdin unless given. The simulation ends after the last line, or at
+ * the time limit (default SIM_DEFAULT_LIMIT_S), with a non-zero exit status in the latter case.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "sim.h"
+#include "cmsis_os.h"
+#include "active.h"
+#include "cmd.h"
+#include "log.h"
+#include "prof.h"
+#include "scope.h"
+#include "evlog.h"
+#include "can.h"
+#include "param.h"
+#include "safety.h"
+#include "spibus.h"
+#include "reflow.h"
+#include "nvs.h"
+#include "wdg.h"
+
+////////////////////////////////////////////////////////////////////////////////
+// Common macros
+////////////////////////////////////////////////////////////////////////////////
+
+#define SIM_DEFAULT_LIMIT_S 3600U  // Default virtual time limit (s).
+#define SIM_LINE_LEN 256U          // Longest script line.
+#define SIM_POLL_MS 100U           // Poll period of "wait run".
+#define SIM_POST_TIMEOUT_MS 1000U  // Longest wait for command queue space per line.
+
+#define SIM_MAX_CS_GPIO_Port GPIOC // Thermocouple chip select, MAX_CS of main.h.
+#define SIM_MAX_CS_Pin GPIO_PIN_4
+
+////////////////////////////////////////////////////////////////////////////////
+// Private (static) function declarations
+////////////////////////////////////////////////////////////////////////////////
+
+static void sim_boot(void *argument);          // Boot modules and run script.
+static void sim_post_line(const char *line);   // Post command line to command module.
+static void sim_wait_run(void);                // Wait until a reflow run ended.
+static void sim_usage(const char *prog);       // Print usage.
+
+////////////////////////////////////////////////////////////////////////////////
+// Private (static) variables
+////////////////////////////////////////////////////////////////////////////////
+
+/* Peripheral handles configured like MX_SPI2_Init(), MX_TIM3_Init() and MX_TIM6_Init(). */
+static SPI_HandleTypeDef hspi2 = {.Instance = SPI2, .Init = {.BaudRatePrescaler = SPI_BAUDRATEPRESCALER_16}};
+static TIM_HandleTypeDef htim3 = {.Instance = TIM3, .Init = {.Prescaler = 9, .Period = 4095}};
+static TIM_HandleTypeDef htim6 = {.Instance = TIM6, .Init = {.Prescaler = 8000 - 1, .Period = 5000 - 1}};
+
+/* Reflow configuration of main.c without the DMA and AC drive settings. */
+static const Reflow_cfg_t reflow_cfg[] =
+{
+    { // Oven 0.
+        .num_zones = 1,
+        .zones = {{.name = "MAIN",
+                   .heater = {.drive = HEATER_PWM, .pwm_timer_handle = &htim3, .pwm_channel = SIM_HEATER_CHANNEL},
+                   .thermocouple = 0}},
+        .has_fan = true,
+        .fan = {.drive = HEATER_PWM, .pwm_timer_handle = &htim3, .pwm_channel = SIM_FAN_CHANNEL},
+        .sample_timer_handle = &htim6,
+        .num_thermocouples = 1,
+        .max_cfg = {{.hspi = &hspi2, .max_cs_port = SIM_MAX_CS_GPIO_Port, .max_cs_pin = SIM_MAX_CS_Pin}}
+    }
+};
+_Static_assert(ARRAY_SIZE(reflow_cfg) == REFLOW_NUM_OVENS, "Configure every oven");
+
+static FILE *script;
+
+////////////////////////////////////////////////////////////////////////////////
+// Public (global) functions
+////////////////////////////////////////////////////////////////////////////////
+
+int main(int argc, char **argv)
+{
+    const char *script_path = NULL;
+    const char *csv_path = NULL;
+    const char *bin_path = NULL;
+    uint32_t limit_s = SIM_DEFAULT_LIMIT_S;
+    bool quiet = false;
+
+    int opt;
+    while ((opt = getopt(argc, argv, "s:o:f:t:qh")) != -1)
+    {
+        switch (opt)
+        {
+        case 's':
+            script_path = optarg;
+            break;
+        case 'o':
+            csv_path = optarg;
+            break;
+        case 'f':
+            bin_path = optarg;
+            break;
+        case 't':
+            limit_s = (uint32_t)strtoul(optarg, NULL, 0);
+            break;
+        case 'q':
+            quiet = true;
+            break;
+        default:
+            sim_usage(argv[0]);
+            return 2;
+        }
+    }
+
+    script = script_path != NULL ? fopen(script_path, "r") : stdin;
+    if (script == NULL)
+    {
+        perror(script_path);
+        return 1;
+    }
+    FILE *csv = NULL;
+    if (csv_path != NULL)
+    {
+        csv = fopen(csv_path, "w");
+        if (csv == NULL)
+        {
+            perror(csv_path);
+            return 1;
+        }
+    }
+    FILE *bin = NULL;
+    if (bin_path != NULL)
+    {
+        bin = fopen(bin_path, "wb");
+        if (bin == NULL)
+        {
+            perror(bin_path);
+            return 1;
+        }
+    }
+    if (quiet && freopen("/dev/null", "w", stdout) == NULL)
+    {
+        perror("/dev/null");
+        return 1;
+    }
+    setvbuf(stdout, NULL, _IOLBF, 0); // Assertion messages are printed before abort().
+
+    sim_time_limit((uint64_t)limit_s * 1000000U);
+    sim_telemetry_file(csv);
+    sim_frame_file(bin);
+    HAL_TIM_Base_Init(&htim3);
+    HAL_TIM_Base_Init(&htim6);
+    hspi2.Instance->CR1 = hspi2.Init.BaudRatePrescaler;
+    spibus_init(&hspi2);
+    sim_spi_attach(SIM_MAX_CS_GPIO_Port, SIM_MAX_CS_Pin, 0);
+
+    static const osThreadAttr_t boot_attr = {.name = "sim", .priority = osPriorityLow};
+    osKernelInitialize();
+    osThreadNew(sim_boot, NULL, &boot_attr);
+    osKernelStart();
+
+    if (csv != NULL)
+    {
+        fclose(csv);
+    }
+    if (bin != NULL)
+    {
+        fclose(bin);
+    }
+    if (sim_timed_out())
+    {
+        fprintf(stderr, "Time limit of %lu s reached\n", (unsigned long)limit_s);
+        return 1;
+    }
+    return 0;
+}
+
+void HAL_TIM_PeriodElapsedCallback(TIM_HandleTypeDef *htim)
+{
+    reflow_sample_timer_elapsed(htim);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Private (static) functions
+////////////////////////////////////////////////////////////////////////////////
+
+/**
+ * @brief Boot modules in StartDefaultTask() order, then run script and stop simulation.
+ *
+ * @param argument Unused.
+ */
+static void sim_boot(void *argument)
+{
+    (void)argument;
+
+    Active_init();
+    wdg_init();
+    nvs_init();
+    param_init();
+    heater_init();
+    analog_init();
+    sim_oven_init();
+    safety_init();
+    for (uint8_t oven = 0; oven < REFLOW_NUM_OVENS; oven++)
+    {
+        reflow_init(oven, &reflow_cfg[oven]);
+        reflow_start(oven);
+    }
+
+    log_init();
+    log_load_levels();
+    param_load();
+    cmd_init();
+    cmd_start();
+    can_init();
+    log_start();
+    prof_init();
+    scope_init();
+    evlog_init();
+
+    char line[SIM_LINE_LEN];
+    while (fgets(line, sizeof(line), script) != NULL)
+    {
+        line[strcspn(line, "\r\n")] = '\0';
+        const char *cmd = line + strspn(line, " \t");
+        if (cmd[0] == '\0' || cmd[0] == '#')
+        {
+            continue;
+        }
+
+        printf("> %s\n", cmd);
+        if (strncmp(cmd, "wait ", 5) == 0)
+        {
+            const char *arg = cmd + 5;
+            if (strcmp(arg, "run") == 0)
+            {
+                sim_wait_run();
+            }
+            else
+            {
+                osDelay((uint32_t)(strtof(arg, NULL) * 1000.0f));
+            }
+            continue;
+        }
+        if (strncmp(cmd, "replay ", 7) == 0)
+        {
+            sim_replay(cmd + 7);
+            continue;
+        }
+        sim_post_line(cmd);
+        osDelay(1); // Command runs before the next line.
+    }
+
+    sim_stop();
+}
+
+/**
+ * @brief Post command line to command module, waiting for event and queue space.
+ *
+ * @param line Command line.
+ */
+static void sim_post_line(const char *line)
+{
+    size_t len = strlen(line);
+    for (uint32_t waited = 0; waited <= SIM_POST_TIMEOUT_MS; waited++)
+    {
+        Cmd_Event *const evt = (Cmd_Event *)Event_new(CMD_EVENT_SIZE(len), CMD_RX_SIG);
+        if (evt != NULL)
+        {
+            evt->session = CONSOLE_SESSION_UART;
+            memcpy(evt->cmd_line, line, len + 1U);
+            if (Active_post(cmd_base, &evt->base) == MOD_OK)
+            {
+                return;
+            }
+        }
+        osDelay(1);
+    }
+    fprintf(stderr, "Command queue full, dropped: %s\n", line);
+}
+
+/**
+ * @brief Wait until heaters were switched on and off again.
+ */
+static void sim_wait_run(void)
+{
+    while (!sim_oven_heating())
+    {
+        osDelay(SIM_POLL_MS);
+    }
+    while (sim_oven_heating())
+    {
+        osDelay(SIM_POLL_MS);
+    }
+}
+
+/**
+ * @brief Print usage.
+ *
+ * @param prog Program name.
+ */
+static void sim_usage(const char *prog)
+{
+    fprintf(stderr,
+            "Usage: %s [-s script] [-o telemetry.csv] [-f frames.bin] [-t seconds] [-q]\n"
+            "  -s  Command script, stdin if not given\n"
+            "  -o  Write reflow telemetry as CSV, enable with \"reflow stream on\"\n"
+            "  -f  Write other console frames, eg. an \"evlog dump\" to replay\n"
+            "  -t  Virtual time limit in seconds (default %u)\n"
+            "  -q  Suppress console output\n",
+            prog, SIM_DEFAULT_LIMIT_S);
+}
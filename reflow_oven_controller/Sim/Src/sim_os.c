@@ -0,0 +1,1129 @@
+/**
+ * @file sim_os.c
+ * @author Timothy Nguyen
+ * @brief Host simulation kernel: CMSIS-RTOS2 and the FreeRTOS calls of active.c on virtual time.
+ * @version 0.1
+ * @date 2021-08-30
+ *
+ * Threads are ucontext coroutines. osKernelStart() runs the scheduler loop on the main stack:
+ * interrupts due at the current virtual time run first, then the highest priority ready thread
+ * (earliest ready first among equal priorities) runs until it blocks. A thread waking a higher
+ * priority one is preempted at that kernel call, unless the kernel is locked, as with FreeRTOS
+ * preemptive scheduling. Once nothing is ready, virtual time jumps to the next interrupt or
+ * timeout.
+ *
+ * Running code takes no virtual time, so handler run times and DWT cycle counts measured
+ * across it are zero. A thread spinning without kernel calls hangs the simulation.
+ *
+ * Software timer callbacks run on a timer daemon thread at configTIMER_TASK_PRIORITY, as on
+ * the target.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <ucontext.h>
+
+#include "sim.h"
+#include "cmsis_os.h"
+#include "queue.h"
+#include "task.h"
+#include "timers.h"
+
+////////////////////////////////////////////////////////////////////////////////
+// Common macros
+////////////////////////////////////////////////////////////////////////////////
+
+/* Kernel misuse is a simulation bug, stop with a message rather than carrying on. */
+#define SIM_CHECK(check)                                                                       \
+    do                                                                                         \
+    {                                                                                          \
+        if (!(check))                                                                          \
+        {                                                                                      \
+            fprintf(stderr, "sim_os: check failed at %s, line %d: %s\n", __FILE__, __LINE__, #check); \
+            abort();                                                                           \
+        }                                                                                      \
+    } while (0)
+
+#define SIM_FOREVER UINT64_MAX // Timeout of a wait without deadline.
+
+////////////////////////////////////////////////////////////////////////////////
+// Type definitions
+////////////////////////////////////////////////////////////////////////////////
+
+/* Thread states */
+typedef enum
+{
+    SIM_INACTIVE, // Free slot or terminated.
+    SIM_READY,    // Running or waiting to run.
+    SIM_BLOCKED   // Waiting for an object or timeout.
+} sim_thread_state_t;
+
+/* Thread control block, task handles and thread ids point here */
+struct sim_thread
+{
+    ucontext_t ctx;           // Saved context while not running.
+    osThreadFunc_t func;      // Thread function.
+    void *arg;                // Thread function argument.
+    const char *name;         // Thread name.
+    osPriority_t prio;        // Priority.
+    sim_thread_state_t state; // Scheduling state.
+    const void *wait_obj;     // Object waited for, NULL while delayed.
+    uint64_t wake_us;         // Timeout (us), SIM_FOREVER if none.
+    bool timed_out;           // Last wait ended by timeout.
+    uint32_t ready_seq;       // Order of becoming ready.
+    uint32_t flags;           // Thread flags.
+    uint32_t notify;          // Task notification count.
+    void *stack;              // Host stack.
+};
+
+/* Message queue, also the FreeRTOS queue handle of active.c */
+struct sim_queue
+{
+    uint8_t *buf;       // Message storage.
+    uint32_t msg_size;  // Message size (bytes).
+    uint32_t msg_count; // Capacity (messages).
+    uint32_t head;      // Index of oldest message.
+    uint32_t count;     // Messages queued.
+};
+
+/* Software timer */
+typedef struct
+{
+    bool used;            // Slot is allocated.
+    bool running;         // Timer is started.
+    osTimerFunc_t func;   // Callback function.
+    void *arg;            // Callback argument.
+    osTimerType_t type;   // One-shot or periodic.
+    uint32_t ticks;       // Period (ticks).
+    uint64_t deadline_us; // Next expiry (us).
+} sim_timer_t;
+
+/* Event flags object */
+typedef struct
+{
+    bool used;      // Slot is allocated.
+    uint32_t flags; // Flags set.
+} sim_event_flags_t;
+
+/* Function call pended to the timer daemon */
+typedef struct
+{
+    PendedFunction_t func; // Function.
+    void *arg1;            // First argument.
+    uint32_t arg2;         // Second argument.
+} sim_pend_t;
+
+/* Pending interrupt */
+typedef struct
+{
+    uint64_t at_us; // Deadline (us).
+    uint32_t seq;   // Order of scheduling, earlier first at equal deadlines.
+    sim_isr_t isr;  // Handler.
+    void *arg;      // Handler argument.
+} sim_isr_entry_t;
+
+////////////////////////////////////////////////////////////////////////////////
+// Private (static) function declarations
+////////////////////////////////////////////////////////////////////////////////
+
+static void sim_thread_context(struct sim_thread *const t);      // Set up coroutine of new thread.
+static void sim_thread_entry(void);                              // Coroutine entry, runs thread function.
+static struct sim_thread *sim_next_ready(void);                  // Highest priority ready thread.
+static bool sim_block(const void *obj, uint64_t wake_us);       // Block running thread.
+static void sim_make_ready(struct sim_thread *const t);          // Move thread to ready.
+static void sim_wake(const void *obj);                          // Make threads waiting for object ready.
+static void sim_preempt(void);                                  // Switch to higher priority ready thread.
+static void sim_yield(void);                                    // Switch to scheduler, staying ready.
+static uint64_t sim_deadline(uint32_t ticks);                   // Timeout in ticks to deadline.
+static bool sim_run_isr(void);                                  // Run one due interrupt.
+static uint64_t sim_next_event(void);                           // Earliest interrupt or timeout.
+static void sim_advance(uint64_t t_us);                         // Move virtual time forward.
+static bool sim_queue_put(struct sim_queue *q, const void *msg, bool front, uint32_t timeout); // Queue message.
+static bool sim_queue_get(struct sim_queue *q, void *msg, uint32_t timeout);                  // Dequeue message.
+static void sim_timer_daemon(void *argument);                   // Timer daemon thread function.
+
+////////////////////////////////////////////////////////////////////////////////
+// Private (static) variables
+////////////////////////////////////////////////////////////////////////////////
+
+static struct sim_thread threads[SIM_MAX_THREADS];
+static struct sim_queue queues[SIM_MAX_QUEUES];
+static uint32_t num_queues;
+static sim_timer_t timers[SIM_MAX_TIMERS];
+static sim_event_flags_t event_flags[SIM_MAX_EVENT_FLAGS];
+static sim_isr_entry_t isrs[SIM_MAX_ISRS];
+static sim_pend_t pends[SIM_MAX_PENDS]; // Pended calls in order, from pend_head.
+static uint32_t pend_head;
+static uint32_t num_pends;
+static uint32_t num_isrs;
+
+static struct sim_thread *current; // Running thread, NULL in scheduler and interrupt context.
+static ucontext_t sched_ctx;       // Scheduler context on the main stack.
+
+static uint64_t now_us;                // Virtual time (us).
+static uint64_t limit_us = SIM_FOREVER; // Virtual time limit (us).
+static uint32_t ready_seq;
+static uint32_t isr_seq;
+static uint32_t isr_depth;  // Nesting of running interrupt handlers.
+static uint32_t primask;    // Interrupt mask, bookkeeping only.
+static bool locked;         // Scheduler locked by osKernelLock().
+static bool stop_requested; // sim_stop() called.
+static bool limit_reached;  // Scheduler stopped at time limit.
+static osKernelState_t kernel_state = osKernelInactive;
+
+////////////////////////////////////////////////////////////////////////////////
+// Public (global) functions
+////////////////////////////////////////////////////////////////////////////////
+
+uint64_t sim_time_us(void)
+{
+    return now_us;
+}
+
+void sim_isr_at(uint64_t at_us, sim_isr_t isr, void *arg)
+{
+    SIM_CHECK(num_isrs < SIM_MAX_ISRS);
+    isrs[num_isrs++] = (sim_isr_entry_t){.at_us = at_us > now_us ? at_us : now_us,
+                                         .seq = isr_seq++,
+                                         .isr = isr,
+                                         .arg = arg};
+}
+
+void sim_time_limit(uint64_t t_us)
+{
+    limit_us = t_us;
+}
+
+void sim_stop(void)
+{
+    stop_requested = true;
+    if (current != NULL && isr_depth == 0U)
+    {
+        sim_yield();
+    }
+}
+
+bool sim_timed_out(void)
+{
+    return limit_reached;
+}
+
+uint32_t __get_PRIMASK(void)
+{
+    return primask;
+}
+
+void __set_PRIMASK(uint32_t priMask)
+{
+    primask = priMask;
+}
+
+void __disable_irq(void)
+{
+    primask = 1U;
+}
+
+void __enable_irq(void)
+{
+    primask = 0U;
+}
+
+uint32_t __get_IPSR(void)
+{
+    return isr_depth > 0U ? 16U : 0U; // First external interrupt.
+}
+
+/* Kernel */
+
+osStatus_t osKernelInitialize(void)
+{
+    if (kernel_state != osKernelInactive)
+    {
+        return osError;
+    }
+    kernel_state = osKernelReady;
+
+    static const osThreadAttr_t daemon_attr = {.name = "Tmr Svc", .priority = (osPriority_t)configTIMER_TASK_PRIORITY};
+    SIM_CHECK(osThreadNew(sim_timer_daemon, NULL, &daemon_attr) != NULL);
+    return osOK;
+}
+
+osStatus_t osKernelStart(void)
+{
+    if (kernel_state != osKernelReady)
+    {
+        return osError;
+    }
+    kernel_state = osKernelRunning;
+
+    while (!stop_requested)
+    {
+        if (sim_run_isr())
+        {
+            continue;
+        }
+
+        struct sim_thread *const t = sim_next_ready();
+        if (t != NULL)
+        {
+            current = t;
+            SIM_CHECK(swapcontext(&sched_ctx, &t->ctx) == 0);
+            current = NULL;
+            continue;
+        }
+
+        /* Nothing to run at this time, jump to the next event. */
+        uint64_t next = sim_next_event();
+        if (next == SIM_FOREVER || next > limit_us)
+        {
+            limit_reached = next != SIM_FOREVER;
+            break;
+        }
+        sim_advance(next);
+    }
+
+    kernel_state = osKernelInactive;
+    return osOK;
+}
+
+osKernelState_t osKernelGetState(void)
+{
+    return kernel_state;
+}
+
+int32_t osKernelLock(void)
+{
+    int32_t prev = locked ? 1 : 0;
+    locked = true;
+    return prev;
+}
+
+int32_t osKernelUnlock(void)
+{
+    int32_t prev = locked ? 1 : 0;
+    locked = false;
+    sim_preempt(); // Wake-ups while locked switch now.
+    return prev;
+}
+
+int32_t osKernelRestoreLock(int32_t lock)
+{
+    int32_t prev = locked ? 1 : 0;
+    locked = lock != 0;
+    if (!locked)
+    {
+        sim_preempt();
+    }
+    return prev;
+}
+
+uint32_t osKernelGetTickCount(void)
+{
+    return (uint32_t)(now_us / (1000000U / configTICK_RATE_HZ));
+}
+
+uint32_t osKernelGetTickFreq(void)
+{
+    return configTICK_RATE_HZ;
+}
+
+uint32_t osKernelGetSysTimerCount(void)
+{
+    return DWT->CYCCNT;
+}
+
+uint32_t osKernelGetSysTimerFreq(void)
+{
+    return SIM_CORE_CLOCK_HZ;
+}
+
+/* Threads */
+
+osThreadId_t osThreadNew(osThreadFunc_t func, void *argument, const osThreadAttr_t *attr)
+{
+    struct sim_thread *t = NULL;
+    for (uint32_t i = 0; i < SIM_MAX_THREADS && t == NULL; i++)
+    {
+        if (threads[i].state == SIM_INACTIVE && threads[i].stack == NULL)
+        {
+            t = &threads[i];
+        }
+    }
+    if (func == NULL || t == NULL)
+    {
+        return NULL;
+    }
+
+    t->func = func;
+    t->arg = argument;
+    t->name = (attr != NULL && attr->name != NULL) ? attr->name : "thread";
+    t->prio = (attr != NULL && attr->priority != osPriorityNone) ? attr->priority : osPriorityNormal;
+    t->flags = 0;
+    t->notify = 0;
+    sim_thread_context(t);
+    sim_make_ready(t);
+    sim_preempt();
+    return (osThreadId_t)t;
+}
+
+osThreadId_t osThreadGetId(void)
+{
+    return (osThreadId_t)current;
+}
+
+const char *osThreadGetName(osThreadId_t thread_id)
+{
+    return thread_id != NULL ? ((struct sim_thread *)thread_id)->name : NULL;
+}
+
+osStatus_t osThreadYield(void)
+{
+    if (current == NULL)
+    {
+        return osErrorISR;
+    }
+    sim_make_ready(current); // Behind threads of equal priority.
+    sim_yield();
+    return osOK;
+}
+
+osStatus_t osThreadTerminate(osThreadId_t thread_id)
+{
+    struct sim_thread *const t = (struct sim_thread *)thread_id;
+    if (t == NULL || t->state == SIM_INACTIVE)
+    {
+        return osErrorParameter;
+    }
+
+    t->state = SIM_INACTIVE;
+    if (t == current)
+    {
+        SIM_CHECK(swapcontext(&t->ctx, &sched_ctx) == 0); // Never resumed.
+    }
+    return osOK;
+}
+
+void osThreadExit(void)
+{
+    osThreadTerminate(osThreadGetId());
+    abort(); // Only reached from interrupt context.
+}
+
+osStatus_t osDelay(uint32_t ticks)
+{
+    if (current == NULL)
+    {
+        return osErrorISR;
+    }
+    if (ticks > 0U)
+    {
+        sim_block(NULL, sim_deadline(ticks));
+    }
+    return osOK;
+}
+
+osStatus_t osDelayUntil(uint32_t ticks)
+{
+    uint32_t delay = ticks - osKernelGetTickCount();
+    if (delay == 0U || delay > 0x7FFFFFFFU)
+    {
+        return osErrorParameter; // Deadline passed.
+    }
+    return osDelay(delay);
+}
+
+/* Thread flags */
+
+uint32_t osThreadFlagsSet(osThreadId_t thread_id, uint32_t flags)
+{
+    struct sim_thread *const t = (struct sim_thread *)thread_id;
+    if (t == NULL || (flags & osFlagsError) != 0U)
+    {
+        return osFlagsErrorParameter;
+    }
+    t->flags |= flags;
+    uint32_t result = t->flags;
+    sim_wake(&t->flags);
+    return result;
+}
+
+uint32_t osThreadFlagsClear(uint32_t flags)
+{
+    if (current == NULL)
+    {
+        return osFlagsErrorISR;
+    }
+    uint32_t prev = current->flags;
+    current->flags &= ~flags;
+    return prev;
+}
+
+uint32_t osThreadFlagsGet(void)
+{
+    return current != NULL ? current->flags : 0U;
+}
+
+uint32_t osThreadFlagsWait(uint32_t flags, uint32_t options, uint32_t timeout)
+{
+    if (current == NULL)
+    {
+        return osFlagsErrorISR;
+    }
+
+    struct sim_thread *const self = current;
+    uint64_t wake = sim_deadline(timeout);
+    for (;;)
+    {
+        uint32_t set = self->flags & flags;
+        bool done = (options & osFlagsWaitAll) != 0U ? set == flags : set != 0U;
+        if (done)
+        {
+            uint32_t result = self->flags;
+            if ((options & osFlagsNoClear) == 0U)
+            {
+                self->flags &= ~flags;
+            }
+            return result;
+        }
+        if (timeout == 0U)
+        {
+            return osFlagsErrorResource;
+        }
+        if (!sim_block(&self->flags, wake))
+        {
+            return osFlagsErrorTimeout;
+        }
+    }
+}
+
+/* Event flags */
+
+osEventFlagsId_t osEventFlagsNew(const osEventFlagsAttr_t *attr)
+{
+    (void)attr;
+    for (uint32_t i = 0; i < SIM_MAX_EVENT_FLAGS; i++)
+    {
+        if (!event_flags[i].used)
+        {
+            event_flags[i] = (sim_event_flags_t){.used = true};
+            return (osEventFlagsId_t)&event_flags[i];
+        }
+    }
+    return NULL;
+}
+
+uint32_t osEventFlagsSet(osEventFlagsId_t ef_id, uint32_t flags)
+{
+    sim_event_flags_t *const ef = (sim_event_flags_t *)ef_id;
+    if (ef == NULL || (flags & osFlagsError) != 0U)
+    {
+        return osFlagsErrorParameter;
+    }
+    ef->flags |= flags;
+    uint32_t result = ef->flags;
+    sim_wake(ef);
+    return result;
+}
+
+uint32_t osEventFlagsClear(osEventFlagsId_t ef_id, uint32_t flags)
+{
+    sim_event_flags_t *const ef = (sim_event_flags_t *)ef_id;
+    if (ef == NULL || (flags & osFlagsError) != 0U)
+    {
+        return osFlagsErrorParameter;
+    }
+    uint32_t prev = ef->flags;
+    ef->flags &= ~flags;
+    return prev;
+}
+
+uint32_t osEventFlagsGet(osEventFlagsId_t ef_id)
+{
+    return ef_id != NULL ? ((sim_event_flags_t *)ef_id)->flags : 0U;
+}
+
+uint32_t osEventFlagsWait(osEventFlagsId_t ef_id, uint32_t flags, uint32_t options, uint32_t timeout)
+{
+    sim_event_flags_t *const ef = (sim_event_flags_t *)ef_id;
+    if (ef == NULL || (flags & osFlagsError) != 0U)
+    {
+        return osFlagsErrorParameter;
+    }
+    if (current == NULL)
+    {
+        return osFlagsErrorISR;
+    }
+
+    uint64_t wake = sim_deadline(timeout);
+    for (;;)
+    {
+        uint32_t set = ef->flags & flags;
+        bool done = (options & osFlagsWaitAll) != 0U ? set == flags : set != 0U;
+        if (done)
+        {
+            uint32_t result = ef->flags;
+            if ((options & osFlagsNoClear) == 0U)
+            {
+                ef->flags &= ~flags;
+            }
+            return result;
+        }
+        if (timeout == 0U)
+        {
+            return osFlagsErrorResource;
+        }
+        if (!sim_block(ef, wake))
+        {
+            return osFlagsErrorTimeout;
+        }
+    }
+}
+
+/* Software timers */
+
+osTimerId_t osTimerNew(osTimerFunc_t func, osTimerType_t type, void *argument, const osTimerAttr_t *attr)
+{
+    (void)attr;
+    for (uint32_t i = 0; i < SIM_MAX_TIMERS && func != NULL; i++)
+    {
+        if (!timers[i].used)
+        {
+            timers[i] = (sim_timer_t){.used = true, .func = func, .arg = argument, .type = type};
+            return (osTimerId_t)&timers[i];
+        }
+    }
+    return NULL;
+}
+
+osStatus_t osTimerStart(osTimerId_t timer_id, uint32_t ticks)
+{
+    sim_timer_t *const timer = (sim_timer_t *)timer_id;
+    if (timer == NULL || ticks == 0U)
+    {
+        return osErrorParameter;
+    }
+    timer->ticks = ticks;
+    timer->deadline_us = sim_deadline(ticks);
+    timer->running = true;
+    sim_wake(timers);
+    return osOK;
+}
+
+osStatus_t osTimerStop(osTimerId_t timer_id)
+{
+    sim_timer_t *const timer = (sim_timer_t *)timer_id;
+    if (timer == NULL)
+    {
+        return osErrorParameter;
+    }
+    if (!timer->running)
+    {
+        return osErrorResource;
+    }
+    timer->running = false;
+    return osOK;
+}
+
+uint32_t osTimerIsRunning(osTimerId_t timer_id)
+{
+    sim_timer_t *const timer = (sim_timer_t *)timer_id;
+    return (timer != NULL && timer->running) ? 1U : 0U;
+}
+
+osStatus_t osTimerDelete(osTimerId_t timer_id)
+{
+    sim_timer_t *const timer = (sim_timer_t *)timer_id;
+    if (timer == NULL)
+    {
+        return osErrorParameter;
+    }
+    timer->used = false;
+    timer->running = false;
+    return osOK;
+}
+
+/* Message queues */
+
+osMessageQueueId_t osMessageQueueNew(uint32_t msg_count, uint32_t msg_size, const osMessageQueueAttr_t *attr)
+{
+    (void)attr;
+    if (num_queues >= SIM_MAX_QUEUES || msg_count == 0U || msg_size == 0U)
+    {
+        return NULL;
+    }
+    struct sim_queue *const q = &queues[num_queues++];
+    q->buf = malloc((size_t)msg_count * msg_size);
+    SIM_CHECK(q->buf != NULL);
+    q->msg_size = msg_size;
+    q->msg_count = msg_count;
+    q->head = 0;
+    q->count = 0;
+    return (osMessageQueueId_t)q;
+}
+
+osStatus_t osMessageQueuePut(osMessageQueueId_t mq_id, const void *msg_ptr, uint8_t msg_prio, uint32_t timeout)
+{
+    (void)msg_prio;
+    if (mq_id == NULL || msg_ptr == NULL || (current == NULL && timeout != 0U))
+    {
+        return osErrorParameter;
+    }
+    if (!sim_queue_put((struct sim_queue *)mq_id, msg_ptr, false, timeout))
+    {
+        return timeout == 0U ? osErrorResource : osErrorTimeout;
+    }
+    return osOK;
+}
+
+osStatus_t osMessageQueueGet(osMessageQueueId_t mq_id, void *msg_ptr, uint8_t *msg_prio, uint32_t timeout)
+{
+    if (mq_id == NULL || msg_ptr == NULL || (current == NULL && timeout != 0U))
+    {
+        return osErrorParameter;
+    }
+    if (!sim_queue_get((struct sim_queue *)mq_id, msg_ptr, timeout))
+    {
+        return timeout == 0U ? osErrorResource : osErrorTimeout;
+    }
+    if (msg_prio != NULL)
+    {
+        *msg_prio = 0U;
+    }
+    return osOK;
+}
+
+uint32_t osMessageQueueGetCount(osMessageQueueId_t mq_id)
+{
+    return mq_id != NULL ? ((struct sim_queue *)mq_id)->count : 0U;
+}
+
+uint32_t osMessageQueueGetSpace(osMessageQueueId_t mq_id)
+{
+    struct sim_queue *const q = (struct sim_queue *)mq_id;
+    return q != NULL ? q->msg_count - q->count : 0U;
+}
+
+/* FreeRTOS queue and task notification calls */
+
+BaseType_t xQueueSendToBack(QueueHandle_t xQueue, const void *pvItemToQueue, TickType_t xTicksToWait)
+{
+    return sim_queue_put(xQueue, pvItemToQueue, false, xTicksToWait) ? pdPASS : errQUEUE_FULL;
+}
+
+BaseType_t xQueueSendToFront(QueueHandle_t xQueue, const void *pvItemToQueue, TickType_t xTicksToWait)
+{
+    return sim_queue_put(xQueue, pvItemToQueue, true, xTicksToWait) ? pdPASS : errQUEUE_FULL;
+}
+
+BaseType_t xQueueSendToBackFromISR(QueueHandle_t xQueue, const void *pvItemToQueue,
+                                   BaseType_t *pxHigherPriorityTaskWoken)
+{
+    (void)pxHigherPriorityTaskWoken;
+    return sim_queue_put(xQueue, pvItemToQueue, false, 0U) ? pdPASS : errQUEUE_FULL;
+}
+
+BaseType_t xQueueSendToFrontFromISR(QueueHandle_t xQueue, const void *pvItemToQueue,
+                                    BaseType_t *pxHigherPriorityTaskWoken)
+{
+    (void)pxHigherPriorityTaskWoken;
+    return sim_queue_put(xQueue, pvItemToQueue, true, 0U) ? pdPASS : errQUEUE_FULL;
+}
+
+BaseType_t xQueueReceive(QueueHandle_t xQueue, void *pvBuffer, TickType_t xTicksToWait)
+{
+    return sim_queue_get(xQueue, pvBuffer, xTicksToWait) ? pdPASS : pdFAIL;
+}
+
+UBaseType_t uxQueueMessagesWaiting(QueueHandle_t xQueue)
+{
+    return xQueue->count;
+}
+
+UBaseType_t uxQueueMessagesWaitingFromISR(QueueHandle_t xQueue)
+{
+    return xQueue->count;
+}
+
+BaseType_t xTaskNotifyGive(TaskHandle_t xTaskToNotify)
+{
+    xTaskToNotify->notify++;
+    sim_wake(&xTaskToNotify->notify);
+    return pdPASS;
+}
+
+void vTaskNotifyGiveFromISR(TaskHandle_t xTaskToNotify, BaseType_t *pxHigherPriorityTaskWoken)
+{
+    (void)pxHigherPriorityTaskWoken;
+    xTaskNotifyGive(xTaskToNotify);
+}
+
+uint32_t ulTaskNotifyTake(BaseType_t xClearCountOnExit, TickType_t xTicksToWait)
+{
+    struct sim_thread *const self = current;
+    SIM_CHECK(self != NULL);
+    uint64_t wake = sim_deadline(xTicksToWait);
+    while (self->notify == 0U)
+    {
+        if (xTicksToWait == 0U || !sim_block(&self->notify, wake))
+        {
+            return 0U;
+        }
+    }
+    uint32_t value = self->notify;
+    self->notify = xClearCountOnExit != pdFALSE ? 0U : value - 1U;
+    return value;
+}
+
+TickType_t xTaskGetTickCount(void)
+{
+    return osKernelGetTickCount();
+}
+
+BaseType_t xTimerPendFunctionCall(PendedFunction_t xFunctionToPend, void *pvParameter1, uint32_t ulParameter2,
+                                  TickType_t xTicksToWait)
+{
+    (void)xTicksToWait;
+    if (num_pends >= SIM_MAX_PENDS)
+    {
+        return pdFALSE;
+    }
+    pends[(pend_head + num_pends) % SIM_MAX_PENDS] = (sim_pend_t){.func = xFunctionToPend,
+                                                                  .arg1 = pvParameter1,
+                                                                  .arg2 = ulParameter2};
+    num_pends++;
+    sim_wake(timers);
+    return pdPASS;
+}
+
+BaseType_t xTimerPendFunctionCallFromISR(PendedFunction_t xFunctionToPend, void *pvParameter1, uint32_t ulParameter2,
+                                         BaseType_t *pxHigherPriorityTaskWoken)
+{
+    (void)pxHigherPriorityTaskWoken;
+    return xTimerPendFunctionCall(xFunctionToPend, pvParameter1, ulParameter2, 0U);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Private (static) functions
+////////////////////////////////////////////////////////////////////////////////
+
+/**
+ * @brief Allocate host stack and set up coroutine of new thread.
+ *
+ * @param t Thread.
+ */
+static void sim_thread_context(struct sim_thread *const t)
+{
+    t->stack = malloc(SIM_STACK_SIZE);
+    SIM_CHECK(t->stack != NULL);
+    SIM_CHECK(getcontext(&t->ctx) == 0);
+    t->ctx.uc_stack.ss_sp = t->stack;
+    t->ctx.uc_stack.ss_size = SIM_STACK_SIZE;
+    t->ctx.uc_link = &sched_ctx; // Returning thread function ends up in the scheduler.
+    makecontext(&t->ctx, sim_thread_entry, 0);
+}
+
+/**
+ * @brief Coroutine entry, runs thread function and terminates thread when it returns.
+ */
+static void sim_thread_entry(void)
+{
+    struct sim_thread *const self = current;
+    self->func(self->arg);
+    self->state = SIM_INACTIVE; // uc_link switches to scheduler.
+}
+
+/**
+ * @brief Find highest priority ready thread, earliest ready first among equal priorities.
+ *
+ * @return Ready thread, NULL if none.
+ */
+static struct sim_thread *sim_next_ready(void)
+{
+    struct sim_thread *best = NULL;
+    for (uint32_t i = 0; i < SIM_MAX_THREADS; i++)
+    {
+        struct sim_thread *const t = &threads[i];
+        if (t->state != SIM_READY)
+        {
+            continue;
+        }
+        if (best == NULL || t->prio > best->prio || (t->prio == best->prio && t->ready_seq < best->ready_seq))
+        {
+            best = t;
+        }
+    }
+    return best;
+}
+
+/**
+ * @brief Block running thread until object is signalled or deadline passes.
+ *
+ * @param obj Object waited for, NULL to wait for deadline only.
+ * @param wake_us Deadline (us), SIM_FOREVER if none.
+ *
+ * @return true if woken by object, false on timeout.
+ */
+static bool sim_block(const void *obj, uint64_t wake_us)
+{
+    struct sim_thread *const self = current;
+    SIM_CHECK(self != NULL);
+    self->wait_obj = obj;
+    self->wake_us = wake_us;
+    self->timed_out = false;
+    self->state = SIM_BLOCKED;
+    SIM_CHECK(swapcontext(&self->ctx, &sched_ctx) == 0);
+    return !self->timed_out;
+}
+
+/**
+ * @brief Move thread to ready, behind ready threads of equal priority.
+ *
+ * @param t Thread.
+ */
+static void sim_make_ready(struct sim_thread *const t)
+{
+    t->state = SIM_READY;
+    t->wait_obj = NULL;
+    t->ready_seq = ready_seq++;
+}
+
+/**
+ * @brief Make every thread waiting for object ready, each checks its own condition again.
+ *
+ * @param obj Signalled object.
+ */
+static void sim_wake(const void *obj)
+{
+    for (uint32_t i = 0; i < SIM_MAX_THREADS; i++)
+    {
+        struct sim_thread *const t = &threads[i];
+        if (t->state == SIM_BLOCKED && t->wait_obj == obj)
+        {
+            sim_make_ready(t);
+        }
+    }
+    sim_preempt();
+}
+
+/**
+ * @brief Switch from running thread to a higher priority ready thread, if any.
+ */
+static void sim_preempt(void)
+{
+    if (current == NULL || isr_depth > 0U || locked)
+    {
+        return; // Scheduler picks after interrupt or unlock.
+    }
+    struct sim_thread *const next = sim_next_ready();
+    if (next != NULL && next->prio > current->prio)
+    {
+        sim_make_ready(current);
+        sim_yield();
+    }
+}
+
+/**
+ * @brief Switch from running thread to scheduler, thread stays ready.
+ */
+static void sim_yield(void)
+{
+    struct sim_thread *const self = current;
+    SIM_CHECK(swapcontext(&self->ctx, &sched_ctx) == 0);
+}
+
+/**
+ * @brief Convert timeout to deadline.
+ *
+ * @param ticks Timeout (ticks), osWaitForever for none.
+ *
+ * @return Deadline (us).
+ */
+static uint64_t sim_deadline(uint32_t ticks)
+{
+    return ticks == osWaitForever ? SIM_FOREVER : now_us + (uint64_t)ticks * (1000000U / configTICK_RATE_HZ);
+}
+
+/**
+ * @brief Run earliest interrupt due at current virtual time.
+ *
+ * @return true if an interrupt ran.
+ */
+static bool sim_run_isr(void)
+{
+    uint32_t due = num_isrs;
+    for (uint32_t i = 0; i < num_isrs; i++)
+    {
+        if (isrs[i].at_us <= now_us && (due == num_isrs || isrs[i].seq < isrs[due].seq))
+        {
+            due = i;
+        }
+    }
+    if (due == num_isrs)
+    {
+        return false;
+    }
+
+    sim_isr_entry_t entry = isrs[due];
+    isrs[due] = isrs[--num_isrs];
+    isr_depth++;
+    entry.isr(entry.arg);
+    isr_depth--;
+    return true;
+}
+
+/**
+ * @brief Find earliest pending interrupt or thread timeout.
+ *
+ * @return Virtual time (us), SIM_FOREVER if nothing is pending.
+ */
+static uint64_t sim_next_event(void)
+{
+    uint64_t next = SIM_FOREVER;
+    for (uint32_t i = 0; i < num_isrs; i++)
+    {
+        if (isrs[i].at_us < next)
+        {
+            next = isrs[i].at_us;
+        }
+    }
+    for (uint32_t i = 0; i < SIM_MAX_THREADS; i++)
+    {
+        if (threads[i].state == SIM_BLOCKED && threads[i].wake_us < next)
+        {
+            next = threads[i].wake_us;
+        }
+    }
+    return next;
+}
+
+/**
+ * @brief Move virtual time forward, timing out threads whose deadline passed.
+ *
+ * @param t_us New virtual time (us).
+ */
+static void sim_advance(uint64_t t_us)
+{
+    now_us = t_us;
+    DWT->CYCCNT = (uint32_t)(now_us * (SIM_CORE_CLOCK_HZ / 1000000U));
+    for (uint32_t i = 0; i < SIM_MAX_THREADS; i++)
+    {
+        struct sim_thread *const t = &threads[i];
+        if (t->state == SIM_BLOCKED && t->wake_us <= now_us)
+        {
+            t->timed_out = true;
+            sim_make_ready(t);
+        }
+    }
+}
+
+/**
+ * @brief Queue message, waiting for space from thread context.
+ *
+ * @param q Queue.
+ * @param msg Message.
+ * @param front Queue ahead of queued messages.
+ * @param timeout Longest wait (ticks), 0 from interrupts.
+ *
+ * @return true if queued.
+ */
+static bool sim_queue_put(struct sim_queue *q, const void *msg, bool front, uint32_t timeout)
+{
+    uint64_t wake = sim_deadline(timeout);
+    while (q->count == q->msg_count)
+    {
+        if (timeout == 0U || current == NULL || !sim_block(q, wake))
+        {
+            return false;
+        }
+    }
+
+    uint32_t idx;
+    if (front)
+    {
+        q->head = (q->head + q->msg_count - 1U) % q->msg_count;
+        idx = q->head;
+    }
+    else
+    {
+        idx = (q->head + q->count) % q->msg_count;
+    }
+    memcpy(&q->buf[idx * q->msg_size], msg, q->msg_size);
+    q->count++;
+    sim_wake(q);
+    return true;
+}
+
+/**
+ * @brief Dequeue oldest message, waiting for one from thread context.
+ *
+ * @param q Queue.
+ * @param[out] msg Message.
+ * @param timeout Longest wait (ticks), 0 from interrupts.
+ *
+ * @return true if a message was dequeued.
+ */
+static bool sim_queue_get(struct sim_queue *q, void *msg, uint32_t timeout)
+{
+    uint64_t wake = sim_deadline(timeout);
+    while (q->count == 0U)
+    {
+        if (timeout == 0U || current == NULL || !sim_block(q, wake))
+        {
+            return false;
+        }
+    }
+
+    memcpy(msg, &q->buf[q->head * q->msg_size], q->msg_size);
+    q->head = (q->head + 1U) % q->msg_count;
+    q->count--;
+    sim_wake(q);
+    return true;
+}
+
+/**
+ * @brief Timer daemon thread function, runs pended calls in order, then expired timer
+ *        callbacks in deadline order.
+ *
+ * @param argument Unused.
+ */
+static void sim_timer_daemon(void *argument)
+{
+    (void)argument;
+    for (;;)
+    {
+        if (num_pends > 0U)
+        {
+            sim_pend_t pend = pends[pend_head];
+            pend_head = (pend_head + 1U) % SIM_MAX_PENDS;
+            num_pends--;
+            pend.func(pend.arg1, pend.arg2);
+            continue;
+        }
+
+        sim_timer_t *next = NULL;
+        for (uint32_t i = 0; i < SIM_MAX_TIMERS; i++)
+        {
+            if (timers[i].running && (next == NULL || timers[i].deadline_us < next->deadline_us))
+            {
+                next = &timers[i];
+            }
+        }
+
+        if (next != NULL && next->deadline_us <= now_us)
+        {
+            if (next->type == osTimerPeriodic)
+            {
+                next->deadline_us += (uint64_t)next->ticks * (1000000U / configTICK_RATE_HZ);
+            }
+            else
+            {
+                next->running = false;
+            }
+            next->func(next->arg);
+            continue;
+        }
+
+        /* Pended calls, started and stopped timers wake the daemon to look again. */
+        sim_block(timers, next != NULL ? next->deadline_us : SIM_FOREVER);
+    }
+}
@@ -0,0 +1,554 @@
+/**
+ * @file sim_oven.c
+ * @author Timothy Nguyen
+ * @brief Host simulation: oven thermal model, heater driver stand-in and emulated thermocouples.
+ * @version 0.1
+ * @date 2021-08-30
+ *
+ * The model is integrated in SIM_OVEN_STEP_MS steps up to the virtual time of every heater
+ * change and thermocouple read:
+ *
+ * - The heater power fraction (sum of heater outputs, at most full power) reaches the element
+ *   after a dead time, the element follows it with a first-order lag (elem_tau). PWM heaters
+ *   deliver their duty less the fraction of every PWM period their SSR loses switching (ssr),
+ *   so duties up to it deliver nothing and full duty, never switching, delivers full power.
+ * - The oven is a single lumped mass, tau * dT/dt = gain * element - (1 + fan * f) * (T - ambient),
+ *   with f the fan output fraction. At full power without fan the oven settles gain above ambient.
+ * - Each thermocouple follows the oven with a first-order lag (tc_tau), readings add Gaussian
+ *   noise (noise is the standard deviation) from a seeded generator, so runs are reproducible.
+ *
+ * Thermocouple readings are encoded as the MAX31855K does it: the hot junction value is the
+ * cold junction temperature plus the thermocouple EMF divided by 41.276 uV/C, the EMF coming from
+ * the NIST type K reference function. The cold junction sits at ambient temperature.
+ *
+ * Heaters on the SIM_FAN_CHANNEL PWM channel drive the fan, all others heat the oven.
+ *
+ * The analog inputs stand in too, always with a heater current sensor: the current is the
+ * delivered heater power fraction times amps, the NTC reads ambient. amps=0 models an SSR
+ * that never closes while the oven still heats, to exercise the open heater trip.
+ */
+
+#include <math.h>
+#include <string.h>
+
+#include "sim.h"
+#include "heater.h"
+#include "analog.h"
+#include "cmd.h"
+#include "log.h"
+
+////////////////////////////////////////////////////////////////////////////////
+// Common macros
+////////////////////////////////////////////////////////////////////////////////
+
+#define SIM_OVEN_STEP_MS 10U         // Integration step (ms).
+#define SIM_OVEN_MAX_DELAY_S 60U     // Longest heater dead time (s).
+#define SIM_OVEN_MAX_HEATERS 4U      // Maximum number of heater instances.
+#define SIM_OVEN_MAX_TCS 4U          // Maximum number of thermocouples.
+#define SIM_OVEN_SEED 0x2545F491U    // Noise generator seed.
+#define K_SENSITIVITY 0.041276f      // Thermocouple sensitivity assumed by the MAX31855K (mV/C).
+
+#define SIM_OVEN_DELAY_LEN (SIM_OVEN_MAX_DELAY_S * 1000U / SIM_OVEN_STEP_MS)
+
+////////////////////////////////////////////////////////////////////////////////
+// Type definitions
+////////////////////////////////////////////////////////////////////////////////
+
+/* Thermocouple faults, as reported in the MAX31855K frame */
+typedef enum
+{
+    SIM_TC_OK,        // No fault.
+    SIM_TC_OPEN,      // Open circuit (OC).
+    SIM_TC_SHORT_GND, // Short to GND (SCG).
+    SIM_TC_SHORT_VCC, // Short to VCC (SCV).
+    SIM_TC_ZEROS,     // No device answering, frame reads all zeros.
+
+    SIM_TC_NUM_FAULTS
+} sim_tc_fault_t;
+
+/* Model parameters, settable with "oven set" */
+typedef struct
+{
+    float ambient;  // Ambient and cold junction temperature (C).
+    float gain;     // Settled rise at full power without fan (C).
+    float tau;      // Oven time constant (s).
+    float elem_tau; // Heating element time constant (s).
+    float delay;    // Heater dead time (s).
+    float fan;      // Extra heat loss at full fan, multiple of the natural loss.
+    float tc_tau;   // Thermocouple time constant (s).
+    float noise;    // Reading noise standard deviation (C).
+    float ssr;      // PWM period fraction lost by SSR switching.
+    float amps;     // Heater current at full power (A).
+} sim_oven_params_t;
+
+/* Model state */
+typedef struct
+{
+    sim_oven_params_t params;
+    uint64_t last_us;                    // Virtual time integrated to (us).
+    float temp;                          // Oven temperature (C).
+    float elem;                          // Element output fraction.
+    float tc[SIM_OVEN_MAX_TCS];          // Thermocouple junction temperatures (C).
+    sim_tc_fault_t fault[SIM_OVEN_MAX_TCS]; // Injected thermocouple faults.
+    float delay_buf[SIM_OVEN_DELAY_LEN]; // Heater power history for dead time.
+    uint32_t delay_idx;                  // Next history entry.
+    uint32_t rng;                        // Noise generator state.
+    Heater_t *heaters[SIM_OVEN_MAX_HEATERS];
+    uint8_t num_heaters;
+} sim_oven_t;
+
+////////////////////////////////////////////////////////////////////////////////
+// Private (static) function declarations
+////////////////////////////////////////////////////////////////////////////////
+
+static uint32_t cmd_oven_status(uint32_t argc, const char **argv); // Display model state and parameters.
+static uint32_t cmd_oven_set(uint32_t argc, const char **argv);    // Set model parameters.
+static uint32_t cmd_oven_fault(uint32_t argc, const char **argv);  // Inject thermocouple fault.
+
+static void oven_advance(void);                 // Integrate model to current virtual time.
+static void oven_step(float dt);                // Integrate one step.
+static float heater_power(bool fan);            // Driven heater or fan power fraction.
+static bool heater_is_fan(Heater_t const *const heater); // Heater instance drives the fan.
+static float oven_noise(void);                  // Gaussian noise sample.
+static float type_k_emf(float temp);            // NIST type K thermocouple EMF.
+
+////////////////////////////////////////////////////////////////////////////////
+// Private (static) variables
+////////////////////////////////////////////////////////////////////////////////
+
+/* Default parameters, a small convection oven reaching 325 C at full power. */
+static const sim_oven_params_t default_params = {.ambient = 25.0f,
+                                                 .gain = 300.0f,
+                                                 .tau = 180.0f,
+                                                 .elem_tau = 20.0f,
+                                                 .delay = 5.0f,
+                                                 .fan = 2.0f,
+                                                 .tc_tau = 1.0f,
+                                                 .noise = 0.25f,
+                                                 .ssr = 0.0f,
+                                                 .amps = 8.0f};
+
+static sim_oven_t oven;
+
+/* Fault names, indexed by sim_tc_fault_t */
+static const char *fault_names[SIM_TC_NUM_FAULTS] = {"none", "open", "gnd", "vcc", "zeros"};
+
+/* Oven command information. */
+static cmd_cmd_info oven_cmds[] = {
+    {.cmd_name = "status",
+     .cb = cmd_oven_status,
+     .help = "Display oven model state and parameters."},
+    {.cmd_name = "set",
+     .cb = cmd_oven_set,
+     .help = "Set model parameters: oven set [ambient=C] [gain=C] [tau=s] [elem_tau=s] [delay=s] [fan=x] [tc_tau=s] [noise=C] [ssr=x] [amps=A]"},
+    {.cmd_name = "fault",
+     .cb = cmd_oven_fault,
+     .help = "Inject thermocouple fault: oven fault none|open|gnd|vcc|zeros [tc]"}};
+
+/* Oven module client info */
+CMD_CLIENT_DEFINE(oven,
+                  .num_cmds = sizeof(oven_cmds) / sizeof(oven_cmds[0]),
+                  .cmds = oven_cmds);
+
+////////////////////////////////////////////////////////////////////////////////
+// Public (global) functions
+////////////////////////////////////////////////////////////////////////////////
+
+void sim_oven_init(void)
+{
+    oven.params = default_params;
+    oven.last_us = sim_time_us();
+    oven.temp = oven.params.ambient;
+    oven.elem = 0.0f;
+    for (uint8_t i = 0; i < SIM_OVEN_MAX_TCS; i++)
+    {
+        oven.tc[i] = oven.params.ambient;
+        oven.fault[i] = SIM_TC_OK;
+    }
+    memset(oven.delay_buf, 0, sizeof(oven.delay_buf));
+    oven.delay_idx = 0;
+    oven.rng = SIM_OVEN_SEED;
+}
+
+float sim_oven_temp(void)
+{
+    oven_advance();
+    return oven.temp;
+}
+
+uint32_t sim_oven_max31855k_frame(uint8_t tc)
+{
+    oven_advance();
+    if (tc >= SIM_OVEN_MAX_TCS)
+    {
+        return 0U;
+    }
+
+    float cj = oven.params.ambient;
+    int32_t cj_code = (int32_t)lroundf(cj / 0.0625f);
+    uint32_t frame = ((uint32_t)cj_code & 0xFFFU) << 4;
+    switch (oven.fault[tc])
+    {
+    case SIM_TC_OK:
+        break;
+    case SIM_TC_OPEN:
+        return frame | (1U << 16) | (1U << 0);
+    case SIM_TC_SHORT_GND:
+        return frame | (1U << 16) | (1U << 1);
+    case SIM_TC_SHORT_VCC:
+        return frame | (1U << 16) | (1U << 2);
+    default:
+        return 0U;
+    }
+
+    /* Reference function covers 0 to 1372 C, the oven never runs below freezing. */
+    float temp = fminf(fmaxf(oven.tc[tc] + oven.params.noise * oven_noise(), 0.0f), 1372.0f);
+    float hj = cj + (type_k_emf(temp) - type_k_emf(fmaxf(cj, 0.0f))) / K_SENSITIVITY;
+    int32_t hj_code = (int32_t)lroundf(hj / 0.25f);
+    hj_code = hj_code > 8191 ? 8191 : (hj_code < -8192 ? -8192 : hj_code);
+    return frame | (((uint32_t)hj_code & 0x3FFFU) << 18);
+}
+
+bool sim_oven_heating(void)
+{
+    for (uint8_t i = 0; i < oven.num_heaters; i++)
+    {
+        Heater_t const *const heater = oven.heaters[i];
+        if (!heater_is_fan(heater) && heater->enabled && !heater->tripped)
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+mod_err_t heater_init(void)
+{
+    return MOD_OK;
+}
+
+mod_err_t Heater_Init(Heater_t *const heater, Heater_cfg_t const *const heater_cfg)
+{
+    if (oven.num_heaters >= SIM_OVEN_MAX_HEATERS)
+    {
+        return MOD_ERR_RESOURCE;
+    }
+    memset(heater, 0, sizeof(*heater));
+    heater->cfg = *heater_cfg;
+    oven.heaters[oven.num_heaters++] = heater;
+    return MOD_OK;
+}
+
+void Heater_Enable(Heater_t *const heater)
+{
+    oven_advance();
+    if (!heater->tripped)
+    {
+        heater->enabled = true;
+    }
+}
+
+void Heater_Disable(Heater_t *const heater)
+{
+    oven_advance();
+    heater->enabled = false;
+    heater->out = 0;
+    heater->duty = 0;
+}
+
+void Heater_Set(Heater_t *const heater, uint16_t out)
+{
+    oven_advance();
+    heater->out = out > HEATER_OUT_MAX ? HEATER_OUT_MAX : out;
+    heater->duty = heater->lin != NULL ? Pwmlin_Apply(heater->lin, heater->out) : heater->out;
+}
+
+void Heater_Linearize(Heater_t *const heater, Pwmlin_t const *const lin)
+{
+    heater->lin = lin;
+}
+
+/* Oven integrates average power, the period only has to be valid. */
+mod_err_t Heater_Set_Period(Heater_t *const heater, float period)
+{
+    if ((heater->cfg.drive != HEATER_PWM && heater->cfg.drive != HEATER_PWM_SCHED) || !(period > 0.0f))
+    {
+        return MOD_ERR_ARG;
+    }
+    return MOD_OK;
+}
+
+void Heater_Trip(Heater_t *const heater)
+{
+    oven_advance();
+    heater->tripped = true;
+}
+
+mod_err_t Heater_Clear_Trip(Heater_t *const heater)
+{
+    if (heater->enabled)
+    {
+        return MOD_ERR;
+    }
+    heater->tripped = false;
+    return MOD_OK;
+}
+
+const char *Heater_Drive_Name(Heater_drive_t drive)
+{
+    static const char *drive_names[HEATER_NUM_DRIVES] = {"pwm", "sched", "burst", "phase"};
+    return drive < HEATER_NUM_DRIVES ? drive_names[drive] : "invalid";
+}
+
+mod_err_t analog_init(void)
+{
+    return MOD_OK;
+}
+
+void analog_read(Analog_t *const dst)
+{
+    oven_advance();
+    dst->current = heater_power(false) * oven.params.amps;
+    dst->power = dst->current * ANALOG_MAINS_V;
+    dst->ambient = oven.params.ambient;
+    dst->vdda = 3.3f;
+    dst->die_temp = oven.params.ambient + 10.0f;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Private (static) functions
+////////////////////////////////////////////////////////////////////////////////
+
+/**
+ * @brief Display oven model state and parameters.
+ */
+static uint32_t cmd_oven_status(uint32_t argc, const char **argv)
+{
+    oven_advance();
+    cmd_out_float("time s", (float)(sim_time_us() / 1000U) / 1000.0f);
+    cmd_out_float("oven C", oven.temp);
+    cmd_out_float("element", oven.elem);
+    cmd_out_float("heater", heater_power(false));
+    cmd_out_float("fan", heater_power(true));
+    for (uint8_t i = 0; i < SIM_OVEN_MAX_TCS; i++)
+    {
+        if (oven.fault[i] != SIM_TC_OK)
+        {
+            LOG("tc%u fault: %s\r\n", i, fault_names[oven.fault[i]]);
+        }
+    }
+    cmd_out_float("ambient", oven.params.ambient);
+    cmd_out_float("gain", oven.params.gain);
+    cmd_out_float("tau", oven.params.tau);
+    cmd_out_float("elem_tau", oven.params.elem_tau);
+    cmd_out_float("delay", oven.params.delay);
+    cmd_out_float("fan", oven.params.fan);
+    cmd_out_float("tc_tau", oven.params.tc_tau);
+    cmd_out_float("noise", oven.params.noise);
+    cmd_out_float("ssr", oven.params.ssr);
+    cmd_out_float("amps", oven.params.amps);
+    return 0;
+}
+
+/**
+ * @brief Set model parameters, time constants must be positive.
+ */
+static uint32_t cmd_oven_set(uint32_t argc, const char **argv)
+{
+    enum {SET_AMBIENT, SET_GAIN, SET_TAU, SET_ELEM_TAU, SET_DELAY, SET_FAN, SET_TC_TAU, SET_NOISE, SET_SSR, SET_AMPS,
+          NUM_SET_KEYS};
+    static const cmd_kv_spec specs[NUM_SET_KEYS] = {{"ambient", 'f'}, {"gain", 'f'}, {"tau", 'f'}, {"elem_tau", 'f'},
+                                                    {"delay", 'f'}, {"fan", 'f'}, {"tc_tau", 'f'}, {"noise", 'f'},
+                                                    {"ssr", 'f'}, {"amps", 'f'}};
+    cmd_arg_val vals[NUM_SET_KEYS];
+    int32_t num_keys = cmd_parse_kv(argc, argv, specs, NUM_SET_KEYS, vals);
+    if (num_keys <= 0)
+    {
+        if (num_keys == 0)
+        {
+            LOG("No parameter given\r\n");
+        }
+        return -1;
+    }
+
+    sim_oven_params_t params = oven.params;
+    float *const fields[NUM_SET_KEYS] = {&params.ambient, &params.gain, &params.tau, &params.elem_tau,
+                                         &params.delay, &params.fan, &params.tc_tau, &params.noise, &params.ssr,
+                                         &params.amps};
+    for (uint8_t i = 0; i < NUM_SET_KEYS; i++)
+    {
+        if (vals[i].type != '\0')
+        {
+            *fields[i] = vals[i].val.f;
+        }
+    }
+    if (params.tau <= 0.0f || params.elem_tau <= 0.0f || params.tc_tau <= 0.0f || params.delay < 0.0f ||
+        params.delay > (float)SIM_OVEN_MAX_DELAY_S || params.fan < 0.0f || params.noise < 0.0f ||
+        !(params.ssr >= 0.0f && params.ssr < 1.0f) || params.amps < 0.0f)
+    {
+        LOG("Invalid parameter, time constants must be positive, delay at most %u s, ssr below 1 and amps not negative\r\n",
+            SIM_OVEN_MAX_DELAY_S);
+        return -1;
+    }
+
+    oven_advance();
+    oven.params = params;
+    return 0;
+}
+
+/**
+ * @brief Inject thermocouple fault, thermocouple 0 unless given.
+ */
+static uint32_t cmd_oven_fault(uint32_t argc, const char **argv)
+{
+    cmd_arg_val arg_vals[2];
+    int32_t num_args = cmd_parse_args(argc, argv, "s[u", arg_vals);
+    if (num_args < 1)
+    {
+        return -1;
+    }
+
+    uint32_t tc = num_args > 1 ? arg_vals[1].val.u : 0U;
+    if (tc >= SIM_OVEN_MAX_TCS)
+    {
+        LOG("Thermocouple index out of range\r\n");
+        return -1;
+    }
+    for (uint8_t i = 0; i < SIM_TC_NUM_FAULTS; i++)
+    {
+        if (strcasecmp(arg_vals[0].val.s, fault_names[i]) == 0)
+        {
+            oven.fault[tc] = (sim_tc_fault_t)i;
+            return 0;
+        }
+    }
+    LOG("Unknown fault %s\r\n", arg_vals[0].val.s);
+    return -1;
+}
+
+/**
+ * @brief Integrate model in whole steps up to current virtual time.
+ */
+static void oven_advance(void)
+{
+    const uint64_t step_us = SIM_OVEN_STEP_MS * 1000U;
+    while (sim_time_us() - oven.last_us >= step_us)
+    {
+        oven_step(SIM_OVEN_STEP_MS / 1000.0f);
+        oven.last_us += step_us;
+    }
+}
+
+/**
+ * @brief Integrate model one step (forward Euler, step is far below every time constant).
+ *
+ * @param dt Step (s).
+ */
+static void oven_step(float dt)
+{
+    sim_oven_params_t const *const p = &oven.params;
+
+    /* Heater power reaches the element after the dead time. */
+    uint32_t delay_steps = (uint32_t)lroundf(p->delay / dt);
+    delay_steps = delay_steps < SIM_OVEN_DELAY_LEN ? delay_steps : SIM_OVEN_DELAY_LEN - 1U;
+    oven.delay_buf[oven.delay_idx] = heater_power(false);
+    uint32_t delayed_idx = (oven.delay_idx + SIM_OVEN_DELAY_LEN - delay_steps) % SIM_OVEN_DELAY_LEN;
+    float power = oven.delay_buf[delayed_idx];
+    oven.delay_idx = (oven.delay_idx + 1U) % SIM_OVEN_DELAY_LEN;
+
+    oven.elem += dt / p->elem_tau * (power - oven.elem);
+    float loss = (1.0f + p->fan * heater_power(true)) * (oven.temp - p->ambient);
+    oven.temp += dt / p->tau * (p->gain * oven.elem - loss);
+    for (uint8_t i = 0; i < SIM_OVEN_MAX_TCS; i++)
+    {
+        oven.tc[i] += dt / p->tc_tau * (oven.temp - oven.tc[i]);
+    }
+}
+
+/**
+ * @brief Get driven output fraction of heaters or fan, tripped and disabled ones are off.
+ *
+ * @param fan Fan instead of heaters.
+ *
+ * @return Power fraction from 0 to 1.
+ */
+static float heater_power(bool fan)
+{
+    float power = 0.0f;
+    for (uint8_t i = 0; i < oven.num_heaters; i++)
+    {
+        Heater_t const *const heater = oven.heaters[i];
+        if (heater_is_fan(heater) != fan || !heater->enabled || heater->tripped)
+        {
+            continue;
+        }
+        if (fan || (heater->cfg.drive != HEATER_PWM && heater->cfg.drive != HEATER_PWM_SCHED))
+        {
+            power += (float)heater->out / HEATER_OUT_MAX;
+        }
+        else if (heater->duty >= HEATER_OUT_MAX)
+        {
+            power += 1.0f;
+        }
+        else
+        {
+            power += fmaxf((float)heater->duty / HEATER_OUT_MAX - oven.params.ssr, 0.0f);
+        }
+    }
+    return fminf(power, 1.0f);
+}
+
+/**
+ * @brief Check whether heater instance drives the fan, a PWM output on SIM_FAN_CHANNEL.
+ *
+ * @param heater Heater instance.
+ *
+ * @return true for the fan.
+ */
+static bool heater_is_fan(Heater_t const *const heater)
+{
+    return heater->cfg.drive == HEATER_PWM && heater->cfg.pwm_channel == SIM_FAN_CHANNEL;
+}
+
+/**
+ * @brief Draw standard normal sample (xorshift32 and Box-Muller).
+ *
+ * @return Noise sample.
+ */
+static float oven_noise(void)
+{
+    float u[2];
+    for (uint8_t i = 0; i < 2; i++)
+    {
+        oven.rng ^= oven.rng << 13;
+        oven.rng ^= oven.rng >> 17;
+        oven.rng ^= oven.rng << 5;
+        u[i] = ((float)(oven.rng >> 8) + 0.5f) / 16777216.0f; // (0, 1)
+    }
+    return sqrtf(-2.0f * logf(u[0])) * cosf(2.0f * (float)M_PI * u[1]);
+}
+
+/**
+ * @brief Get type K thermocouple EMF from the NIST ITS-90 reference function, 0 to 1372 C.
+ *
+ * @param temp Junction temperature (C).
+ *
+ * @return EMF (mV) relative to 0 C.
+ */
+static float type_k_emf(float temp)
+{
+    static const double c[] = {-0.176004136860E-01, 0.389212049750E-01, 0.185587700320E-04,
+                               -0.994575928740E-07, 0.318409457190E-09, -0.560728448890E-12,
+                               0.560750590590E-15, -0.320207200030E-18, 0.971511471520E-22,
+                               -0.121047212750E-25};
+    const double a0 = 0.118597600000E+00, a1 = -0.118343200000E-03, a2 = 0.126968600000E+03;
+
+    double t = temp;
+    double emf = 0.0;
+    for (int8_t i = (int8_t)(sizeof(c) / sizeof(c[0])) - 1; i >= 0; i--)
+    {
+        emf = emf * t + c[i];
+    }
+    emf += a0 * exp(a1 * (t - a2) * (t - a2));
+    return (float)emf;
+}
@@ -0,0 +1,218 @@
+/**
+ * @file sim_replay.c
+ * @author Timothy Nguyen
+ * @brief Host simulation replay of an "evlog dump" against the active objects that recorded it.
+ * @version 0.1
+ * @date 2021-09-06
+ *
+ * The capture is a file holding the dump frames, either as written by the simulation with
+ * "-f" or as received by a terminal, text around the frames is skipped. Records are posted
+ * from an interrupt handler at their tick offset from the first record, those of one tick
+ * together and in recorded order, while evlog_replay() keeps live events from the replayed
+ * active objects. On virtual time with handlers taking no time, every replayed event is
+ * dispatched before the next is due, so a replay runs the handlers on the recorded event
+ * stream exactly and repeats identically.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "sim.h"
+#include "cmsis_os.h"
+#include "FreeRTOS.h"
+#include "active.h"
+#include "evlog.h"
+#include "frame.h"
+
+////////////////////////////////////////////////////////////////////////////////
+// Common macros
+////////////////////////////////////////////////////////////////////////////////
+
+#define SIM_REPLAY_POLL_MS 10U                          // Poll period while replay runs.
+#define SIM_REPLAY_FRAME_MAX 1024U                      // Largest decoded frame (bytes).
+#define SIM_REPLAY_DUMP_HDR_LEN 5U                      // Dump frame header: type, first, total.
+#define SIM_US_PER_TICK (1000000U / configTICK_RATE_HZ) // Virtual time per kernel tick (us).
+
+////////////////////////////////////////////////////////////////////////////////
+// Type definitions
+////////////////////////////////////////////////////////////////////////////////
+
+/* Recorded event */
+typedef struct
+{
+    evlog_hdr_t hdr;                    // Record header.
+    uint8_t payload[EVLOG_PAYLOAD_LEN]; // Payload, hdr.len bytes.
+} sim_replay_rec_t;
+
+/* Replay state, advanced by the replay interrupt handler */
+typedef struct
+{
+    uint32_t num_recs;   // Number of records loaded.
+    uint32_t next;       // Index of next record to post.
+    uint64_t start_us;   // Virtual time of first record.
+    uint32_t drops;      // Records not posted.
+    volatile bool done;  // All records posted.
+} sim_replay_t;
+
+////////////////////////////////////////////////////////////////////////////////
+// Private (static) function declarations
+////////////////////////////////////////////////////////////////////////////////
+
+static bool sim_replay_frame(const uint8_t *frame, size_t len); // Decode dump frame into records.
+static void sim_replay_isr(void *arg);                          // Post records due now.
+
+////////////////////////////////////////////////////////////////////////////////
+// Private (static) variables
+////////////////////////////////////////////////////////////////////////////////
+
+static sim_replay_rec_t recs[EVLOG_BUF_EVENTS];
+static sim_replay_t replay;
+
+////////////////////////////////////////////////////////////////////////////////
+// Public (global) functions
+////////////////////////////////////////////////////////////////////////////////
+
+int32_t sim_replay(const char *path)
+{
+    FILE *f = fopen(path, "rb");
+    if (f == NULL)
+    {
+        perror(path);
+        return -1;
+    }
+    fseek(f, 0, SEEK_END);
+    long size = ftell(f);
+    fseek(f, 0, SEEK_SET);
+    uint8_t *buf = malloc(size > 0 ? (size_t)size : 1U);
+    size_t len = buf != NULL ? fread(buf, 1, (size_t)size, f) : 0U;
+    fclose(f);
+
+    /* Frames end at a delimiter, text before one ends at a line feed. */
+    memset(&replay, 0, sizeof(replay));
+    size_t start = 0;
+    for (size_t i = 0; i < len; i++)
+    {
+        if (buf[i] != FRAME_DELIMITER)
+        {
+            continue;
+        }
+        for (size_t s = start; s < i && !sim_replay_frame(&buf[s], i - s);)
+        {
+            const uint8_t *lf = memchr(&buf[s], '\n', i - s);
+            s = lf != NULL ? (size_t)(lf - buf) + 1U : i;
+        }
+        start = i + 1U;
+    }
+    free(buf);
+    if (replay.num_recs == 0U)
+    {
+        fprintf(stderr, "%s: no event log dump\n", path);
+        return -1;
+    }
+
+    for (uint32_t i = 0; i < replay.num_recs; i++)
+    {
+        Active *const ao = Active_by_id(recs[i].hdr.ao_id);
+        if (ao != NULL)
+        {
+            evlog_replay(ao, true);
+        }
+    }
+    replay.start_us = sim_time_us();
+    sim_isr_at(replay.start_us, sim_replay_isr, NULL);
+    while (!replay.done)
+    {
+        osDelay(SIM_REPLAY_POLL_MS);
+    }
+    osDelay(SIM_REPLAY_POLL_MS); // Last records are handled before live events return.
+    for (uint32_t i = 0; i < replay.num_recs; i++)
+    {
+        Active *const ao = Active_by_id(recs[i].hdr.ao_id);
+        if (ao != NULL)
+        {
+            evlog_replay(ao, false);
+        }
+    }
+
+    printf("Replayed %lu events over %.3f s, %lu dropped\n", (unsigned long)(replay.num_recs - replay.drops),
+           (recs[replay.num_recs - 1U].hdr.tick - recs[0].hdr.tick) * (SIM_US_PER_TICK / 1e6),
+           (unsigned long)replay.drops);
+    return (int32_t)(replay.num_recs - replay.drops);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Private (static) functions
+////////////////////////////////////////////////////////////////////////////////
+
+/**
+ * @brief Decode event log dump frame and store its records, a dump's first frame drops earlier ones.
+ *
+ * @param frame Encoded frame without delimiter.
+ * @param len Number of encoded bytes.
+ *
+ * @return true if frame is an event log dump frame.
+ */
+static bool sim_replay_frame(const uint8_t *frame, size_t len)
+{
+    static uint8_t payload[SIM_REPLAY_FRAME_MAX];
+    size_t payload_len;
+    if (len > SIM_REPLAY_FRAME_MAX || frame_decode(frame, len, payload, &payload_len) != MOD_OK ||
+        payload_len < SIM_REPLAY_DUMP_HDR_LEN || payload[0] != EVLOG_TELEMETRY_TYPE)
+    {
+        return false;
+    }
+
+    uint16_t first;
+    uint16_t total;
+    memcpy(&first, &payload[1], sizeof(first));
+    memcpy(&total, &payload[3], sizeof(total));
+    if (first == 0U)
+    {
+        replay.num_recs = 0;
+    }
+
+    size_t pos = SIM_REPLAY_DUMP_HDR_LEN;
+    for (uint32_t i = first; pos + sizeof(evlog_hdr_t) <= payload_len && i < total && i < EVLOG_BUF_EVENTS; i++)
+    {
+        sim_replay_rec_t *const rec = &recs[i];
+        memcpy(&rec->hdr, &payload[pos], sizeof(rec->hdr));
+        pos += sizeof(rec->hdr);
+        if (rec->hdr.len > EVLOG_PAYLOAD_LEN || pos + rec->hdr.len > payload_len)
+        {
+            break; // Corrupt, keep records decoded so far.
+        }
+        memcpy(rec->payload, &payload[pos], rec->hdr.len);
+        pos += rec->hdr.len;
+        replay.num_recs = i + 1U;
+    }
+    return true;
+}
+
+/**
+ * @brief Post records of the current tick in recorded order and schedule the next tick.
+ *
+ * @param arg Unused.
+ */
+static void sim_replay_isr(void *arg)
+{
+    (void)arg;
+
+    uint32_t tick = recs[replay.next].hdr.tick;
+    while (replay.next < replay.num_recs && recs[replay.next].hdr.tick == tick)
+    {
+        sim_replay_rec_t const *const rec = &recs[replay.next++];
+        Active *const ao = Active_by_id(rec->hdr.ao_id);
+        if (ao == NULL || evlog_replay_post(ao, &rec->hdr, rec->payload) != MOD_OK)
+        {
+            replay.drops++;
+        }
+    }
+
+    if (replay.next >= replay.num_recs)
+    {
+        replay.done = true;
+        return;
+    }
+    uint32_t offset = recs[replay.next].hdr.tick - recs[0].hdr.tick;
+    sim_isr_at(replay.start_us + (uint64_t)offset * SIM_US_PER_TICK, sim_replay_isr, NULL);
+}
@@ -0,0 +1,378 @@
+/**
+ * @file sim_services.c
+ * @author Timothy Nguyen
+ * @brief Host simulation stand-ins for the hardware-bound service modules.
+ * @version 0.1
+ * @date 2021-08-30
+ *
+ * - Console: text goes to stdout. Writes ending in a frame delimiter are COBS frames, reflow
+ *   telemetry frames among them are decoded into CSV rows with the true oven temperature of
+ *   the model appended, other frames go to the frame file if one is set.
+ * - Non-volatile storage lives in RAM, every run starts from firmware defaults.
+ * - Watchdog, power, clock, trace and run archive calls do nothing.
+ * - There is no Modbus line, "modbus req" executes requests from the console.
+ * - CAN frames are sent to no bus, "can rx" injects received frames from the console.
+ * - The RTC is never set, so log timestamps are uptime.
+ */
+
+#include <string.h>
+
+#include "sim.h"
+#include "console.h"
+#include "nvs.h"
+#include "wdg.h"
+#include "power.h"
+#include "clock.h"
+#include "trace.h"
+#include "archive.h"
+#include "rtc.h"
+#include "frame.h"
+#include "printf.h"
+#include "bgjob.h"
+#include "modbus.h"
+#include "can.h"
+#include "log.h"
+
+////////////////////////////////////////////////////////////////////////////////
+// Common macros
+////////////////////////////////////////////////////////////////////////////////
+
+#define SIM_TELEMETRY_TYPE 0x01U // REFLOW_TELEMETRY_TYPE of reflow.c.
+#define SIM_FRAME_MAX 1024U      // Largest decoded frame (bytes).
+
+////////////////////////////////////////////////////////////////////////////////
+// Type definitions
+////////////////////////////////////////////////////////////////////////////////
+
+/* Reflow telemetry record, must match Reflow_Telemetry of reflow.c */
+typedef struct __attribute__((packed))
+{
+    uint8_t type;       // SIM_TELEMETRY_TYPE.
+    uint32_t timestamp; // Sample time (ms).
+    uint8_t state;      // Reflow_State.
+    uint8_t segment;    // Profile segment index.
+    uint8_t zone;       // Heater zone index.
+    float setpoint;     // Setpoint temperature (deg C).
+    float temp;         // Zone temperature (deg C).
+    float proportional; // PID proportional term.
+    float integral;     // PID integral term.
+    float derivative;   // PID derivative term.
+    uint16_t pwm;       // PWM compare value.
+} sim_telemetry_t;
+
+/* Stored value of a key */
+typedef struct
+{
+    bool set;                        // Key has a value.
+    size_t len;                      // Value length (bytes).
+    uint8_t value[NVS_MAX_VALUE_LEN]; // Value.
+} sim_nvs_entry_t;
+
+////////////////////////////////////////////////////////////////////////////////
+// Private (static) function declarations
+////////////////////////////////////////////////////////////////////////////////
+
+static void sim_console_frame(const uint8_t *frame, size_t len); // Decode frame written to console.
+
+////////////////////////////////////////////////////////////////////////////////
+// Private (static) variables
+////////////////////////////////////////////////////////////////////////////////
+
+static FILE *telemetry_csv;
+static FILE *frame_bin;
+static sim_nvs_entry_t nvs_entries[NUM_NVS_KEYS];
+static uint8_t num_wdg_clients;
+
+////////////////////////////////////////////////////////////////////////////////
+// Public (global) functions
+////////////////////////////////////////////////////////////////////////////////
+
+void sim_telemetry_file(FILE *csv)
+{
+    telemetry_csv = csv;
+    if (csv != NULL)
+    {
+        fprintf(csv, "time_s,state,segment,zone,setpoint,temp,proportional,integral,derivative,pwm,oven_temp\n");
+    }
+}
+
+void sim_frame_file(FILE *bin)
+{
+    frame_bin = bin;
+}
+
+mod_err_t console_write(const char *buf, size_t len)
+{
+    if (len > 0U && buf[len - 1U] == '\0')
+    {
+        /* Frames are written whole, possibly several per write. */
+        size_t start = 0;
+        for (size_t i = 0; i < len; i++)
+        {
+            if (buf[i] == '\0')
+            {
+                sim_console_frame((const uint8_t *)&buf[start], i - start);
+                start = i + 1U;
+            }
+        }
+        return MOD_OK;
+    }
+
+    fwrite(buf, 1, len, stdout);
+    return MOD_OK;
+}
+
+mod_err_t console_write_ref(const void *buf, size_t len, void (*done)(void *ctx), void *ctx)
+{
+    console_write(buf, len); // Written through at once.
+    if (done != NULL)
+    {
+        done(ctx);
+    }
+    return MOD_OK;
+}
+
+mod_err_t console_telemetry_write(const char *buf, size_t len)
+{
+    return console_write(buf, len);
+}
+
+bool console_tx_idle(void)
+{
+    return true;
+}
+
+void console_reply_set(console_session_t session)
+{
+    (void)session; // One session, on stdout.
+}
+
+console_session_t console_reply_get(void)
+{
+    return CONSOLE_SESSION_UART;
+}
+
+mod_err_t console_sub_write(uint8_t sub, const char *buf, size_t len)
+{
+    (void)sub; // The stdout session subscribes to everything.
+    return console_write(buf, len);
+}
+
+uint32_t console_sub_offer(uint8_t sub, uint32_t sessions, const char *buf, size_t len)
+{
+    (void)sub;
+    (void)sessions;
+    console_write(buf, len);
+    return 0; // stdout never fills.
+}
+
+size_t console_tx_free(void)
+{
+    return SIZE_MAX; // stdout never fills.
+}
+
+void _putchar(char character)
+{
+    fputc(character, stdout);
+}
+
+mod_err_t nvs_init(void)
+{
+    return MOD_OK;
+}
+
+mod_err_t nvs_get(nvs_key_t key, void *value, size_t len)
+{
+    if (key >= NUM_NVS_KEYS)
+    {
+        return MOD_ERR_ARG;
+    }
+    sim_nvs_entry_t const *const entry = &nvs_entries[key];
+    if (!entry->set)
+    {
+        return MOD_DID_NOTHING;
+    }
+    if (entry->len != len)
+    {
+        return MOD_ERR_ARG;
+    }
+    memcpy(value, entry->value, len);
+    return MOD_OK;
+}
+
+mod_err_t nvs_set(nvs_key_t key, const void *value, size_t len)
+{
+    if (key >= NUM_NVS_KEYS || value == NULL || len > NVS_MAX_VALUE_LEN)
+    {
+        return MOD_ERR_ARG;
+    }
+    sim_nvs_entry_t *const entry = &nvs_entries[key];
+    memcpy(entry->value, value, len);
+    entry->len = len;
+    entry->set = true;
+    return MOD_OK;
+}
+
+mod_err_t nvs_set_deferred(nvs_key_t key, const void *value, size_t len)
+{
+    return nvs_set(key, value, len); // No idle time to defer to, writes cost nothing here.
+}
+
+bool bgjob_in_idle(void)
+{
+    return false;
+}
+
+mod_err_t wdg_init(void)
+{
+    return MOD_OK;
+}
+
+mod_err_t wdg_register(const char *name, uint32_t timeout, uint8_t *const id)
+{
+    (void)name;
+    (void)timeout;
+    *id = num_wdg_clients++;
+    return MOD_OK;
+}
+
+mod_err_t wdg_set_timeout(uint8_t id, uint32_t timeout)
+{
+    (void)id;
+    (void)timeout;
+    return MOD_OK;
+}
+
+void wdg_checkin(uint8_t id)
+{
+    (void)id;
+}
+
+void wdg_suspend(uint8_t id)
+{
+    (void)id;
+}
+
+bool rtc_read(uint32_t *const sec, uint32_t *const ms)
+{
+    (void)sec;
+    (void)ms;
+    return false;
+}
+
+void rtc_format(uint32_t sec, char *buf, size_t size)
+{
+    (void)sec;
+    if (size > 0)
+    {
+        buf[0] = '\0';
+    }
+}
+
+void power_stop_lock(void)
+{
+}
+
+void power_stop_unlock(void)
+{
+}
+
+void clock_boost_acquire(void)
+{
+}
+
+void clock_boost_release(void)
+{
+}
+
+void trace_record(uint8_t type, uint8_t id, uint16_t arg)
+{
+    (void)type;
+    (void)id;
+    (void)arg;
+}
+
+mod_err_t archive_append(const void *rec, size_t len)
+{
+    (void)rec;
+    (void)len;
+    return MOD_ERR_NOT_INIT; // No flash attached.
+}
+
+void archive_flush(void)
+{
+}
+
+const char *archive_batch(void)
+{
+    return "";
+}
+
+mod_err_t modbus_port_send(const uint8_t *buf, size_t len)
+{
+    return MOD_ERR_NOT_INIT;
+}
+
+mod_err_t can_port_init(uint8_t node)
+{
+    return MOD_OK;
+}
+
+void can_port_filter(uint8_t node)
+{
+}
+
+mod_err_t can_port_send(can_frame_t const *const frame)
+{
+    return MOD_OK;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Private (static) functions
+////////////////////////////////////////////////////////////////////////////////
+
+/**
+ * @brief Decode frame written to console, reflow telemetry goes to the CSV file, others to the frame file.
+ *
+ * @param frame Encoded frame without delimiter.
+ * @param len Number of encoded bytes.
+ */
+static void sim_console_frame(const uint8_t *frame, size_t len)
+{
+    static uint8_t payload[SIM_FRAME_MAX];
+    size_t payload_len;
+    if (len == 0U)
+    {
+        return; // Delimiter ahead of an interned log frame.
+    }
+    if (len <= SIM_FRAME_MAX && frame_decode(frame, len, payload, &payload_len) == MOD_OK &&
+        payload[0] == LOG_TELEMETRY_TYPE)
+    {
+        /* Interned log messages stay on the console, in order with its text, for Tools/logdecode. */
+        fputc(FRAME_DELIMITER, stdout);
+        fwrite(frame, 1, len, stdout);
+        fputc(FRAME_DELIMITER, stdout);
+        return;
+    }
+    if (len > SIM_FRAME_MAX || frame_decode(frame, len, payload, &payload_len) != MOD_OK ||
+        payload[0] != SIM_TELEMETRY_TYPE || payload_len != sizeof(sim_telemetry_t))
+    {
+        /* Dumps and binary command responses. */
+        if (frame_bin != NULL)
+        {
+            fwrite(frame, 1, len, frame_bin);
+            fputc(FRAME_DELIMITER, frame_bin);
+        }
+        return;
+    }
+    if (telemetry_csv == NULL)
+    {
+        return;
+    }
+
+    sim_telemetry_t rec;
+    memcpy(&rec, payload, sizeof(rec));
+    fprintf(telemetry_csv, "%.3f,%u,%u,%u,%.2f,%.2f,%.3f,%.3f,%.3f,%u,%.2f\n", rec.timestamp / 1000.0,
+            rec.state, rec.segment, rec.zone, rec.setpoint, rec.temp, rec.proportional, rec.integral,
+            rec.derivative, rec.pwm, sim_oven_temp());
+}
@@ -0,0 +1,539 @@
+/**
+ * @file logdecode.c
+ * @author Timothy Nguyen
+ * @brief Host decoder of interned log frames, see LOG_INTERNED in log.h.
+ * @version 0.1
+ * @date 2021-09-06
+ *
+ * Reads the console byte stream of a firmware built with LOG_INTERNED, eg. a serial capture,
+ * and prints it with every interned log frame formatted as the firmware would have:
+ *
+ *      logdecode Debug/reflow_oven_controller.elf < /dev/ttyACM0
+ *      make -C Sim LOG_INTERNED=1 run | Tools/build/logdecode Sim/build/reflow_sim
+ *
+ * Format strings come from the .log_fmt section of the ELF file, indexed by the 16-bit address
+ * in each frame, and tag names from the log tag descriptors, indexed by tag position. The ELF
+ * file must be that of the running image, format string addresses change with every build.
+ *
+ * Console text passes through unchanged. A log frame follows a delimiter, so text is flushed
+ * whenever a line ends, a delimiter arrives or input pauses, and never mistaken for a frame:
+ * every log frame holds LOG_TELEMETRY_TYPE, a control character console text does not use.
+ * Other frames, eg. telemetry, are dropped.
+ */
+
+#include <elf.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "frame.h"
+
+////////////////////////////////////////////////////////////////////////////////
+// Common macros
+////////////////////////////////////////////////////////////////////////////////
+
+/* Interned log frames, as defined by log.h and log.c of the firmware */
+#define LOG_TELEMETRY_TYPE 0x0BU // First payload byte of an interned log frame.
+#define LOG_HDR_SIZE 9U          // Type, level, tag, format string address and tick.
+#define LOG_NUM_LEVELS 6U        // Log levels, LOG_NONE to LOG_VERBOSE.
+
+#define CHUNK_SIZE 4096U // Longest run of bytes between delimiters kept.
+#define SPEC_SIZE 32U    // Longest conversion specification.
+
+/* Logging text colours, as log.h */
+#define LOG_RESET_COLOUR "\033[0m\033[K"
+
+////////////////////////////////////////////////////////////////////////////////
+// Type definitions
+////////////////////////////////////////////////////////////////////////////////
+
+/* Strings of the image, read from its ELF file */
+typedef struct
+{
+    uint8_t *file;        // ELF file contents.
+    size_t file_size;     // Size of file (bytes).
+    bool is64;            // ELF64 rather than ELF32.
+    const char *fmts;     // Contents of .log_fmt section.
+    size_t fmts_size;     // Size of .log_fmt section (bytes).
+    const char **tags;    // Tag names, indexed by tag position.
+    size_t num_tags;      // Number of tags.
+} Image;
+
+/* Section header of either ELF class */
+typedef struct
+{
+    uint32_t name;   // Offset of name in section name table.
+    uint32_t type;   // SHT_ value.
+    uint64_t flags;  // SHF_ flags.
+    uint64_t addr;   // Load address.
+    uint64_t offset; // Offset of contents in file.
+    uint64_t size;   // Size of contents (bytes).
+} Section;
+
+/* Encoded arguments of a message being formatted */
+typedef struct
+{
+    const uint8_t *p; // Next argument.
+    size_t left;      // Bytes left.
+} Args;
+
+////////////////////////////////////////////////////////////////////////////////
+// Private (static) function declarations
+////////////////////////////////////////////////////////////////////////////////
+
+static void image_load(Image *img, const char *path);                                   // Read strings of image from ELF file.
+static bool image_section_at(const Image *img, uint32_t i, Section *sec);                // Read section header.
+static const uint8_t *image_section(const Image *img, const char *name, size_t *size);  // Find section contents by name.
+static const char *image_string(const Image *img, uint64_t addr);                       // Find string by its load address.
+static void chunk_done(const Image *img, const uint8_t *chunk, size_t len);            // Handle bytes up to a delimiter.
+static void message_print(const Image *img, const uint8_t *payload, size_t len);       // Format and print interned message.
+static void args_format(const char *fmt, Args *args);                                   // Format message arguments.
+static bool args_take(Args *args, void *dst, size_t size);                              // Take argument bytes.
+static bool is_text(uint8_t c);                                                         // Check whether console text uses byte.
+
+////////////////////////////////////////////////////////////////////////////////
+// Private (static) variables
+////////////////////////////////////////////////////////////////////////////////
+
+/* Message prefix up to timestamp, indexed by log level */
+static const char *const prefixes[LOG_NUM_LEVELS] = {"", "E (", "W (", "I (", "D (", "V ("};
+
+/* Message colour, indexed by log level, as LOG_COLOUR_E..LOG_COLOUR_V of log.h */
+static const char *const colours[LOG_NUM_LEVELS] = {"", "\033[0;31m", "\033[0;33m", "\033[0;32m", "\033[0;34m",
+                                                    "\033[0;36m"};
+
+/* Colour output, when writing to a terminal. */
+static bool colour;
+
+////////////////////////////////////////////////////////////////////////////////
+// Public (global) functions
+////////////////////////////////////////////////////////////////////////////////
+
+int main(int argc, char **argv)
+{
+    if (argc != 2)
+    {
+        fprintf(stderr, "Usage: %s <elf file> < console capture\n", argv[0]);
+        return 2;
+    }
+
+    static Image img;
+    image_load(&img, argv[1]);
+    colour = isatty(STDOUT_FILENO);
+
+    static uint8_t chunk[CHUNK_SIZE];
+    size_t len = 0;
+    bool text = true; // Chunk holds console text only so far.
+    uint8_t buf[256];
+    ssize_t n;
+    while ((n = read(STDIN_FILENO, buf, sizeof(buf))) > 0)
+    {
+        for (ssize_t i = 0; i < n; i++)
+        {
+            uint8_t c = buf[i];
+            if (c == FRAME_DELIMITER)
+            {
+                chunk_done(&img, chunk, len);
+                len = 0;
+                text = true;
+                continue;
+            }
+            chunk[len++] = c;
+            text = text && is_text(c);
+            if ((text && c == '\n') || len == sizeof(chunk))
+            {
+                fwrite(chunk, 1, len, stdout);
+                len = 0;
+                text = true;
+            }
+        }
+
+        /* Input paused, show text such as the prompt. A single byte may start a frame. */
+        if (text && len > 1U)
+        {
+            fwrite(chunk, 1, len, stdout);
+            len = 0;
+        }
+        fflush(stdout);
+    }
+    chunk_done(&img, chunk, len);
+    return 0;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Private (static) functions
+////////////////////////////////////////////////////////////////////////////////
+
+/**
+ * @brief Read format strings and tag names of image from its ELF file, exits on failure.
+ *
+ * @param[out] img Strings of image.
+ * @param path Path of ELF file.
+ */
+static void image_load(Image *img, const char *path)
+{
+    FILE *f = fopen(path, "rb");
+    if (f == NULL)
+    {
+        perror(path);
+        exit(1);
+    }
+    fseek(f, 0, SEEK_END);
+    img->file_size = (size_t)ftell(f);
+    fseek(f, 0, SEEK_SET);
+    img->file = malloc(img->file_size);
+    if (img->file == NULL || fread(img->file, 1, img->file_size, f) != img->file_size)
+    {
+        fprintf(stderr, "%s: read failed\n", path);
+        exit(1);
+    }
+    fclose(f);
+
+    if (img->file_size < sizeof(Elf32_Ehdr) || memcmp(img->file, ELFMAG, SELFMAG) != 0 ||
+        img->file[EI_DATA] != ELFDATA2LSB)
+    {
+        fprintf(stderr, "%s: not a little-endian ELF file\n", path);
+        exit(1);
+    }
+    img->is64 = img->file[EI_CLASS] == ELFCLASS64;
+
+    img->fmts = (const char *)image_section(img, ".log_fmt", &img->fmts_size);
+    if (img->fmts == NULL)
+    {
+        fprintf(stderr, "%s: no .log_fmt section, build with LOG_INTERNED\n", path);
+        exit(1);
+    }
+
+    /* Tag descriptors hold a name pointer each, the linker scripts name the section .log_tags,
+     * the host link keeps the input section name. */
+    size_t size;
+    const uint8_t *descs = image_section(img, ".log_tags", &size);
+    if (descs == NULL)
+    {
+        descs = image_section(img, "log_tags", &size);
+    }
+    size_t ptr_size = img->is64 ? sizeof(uint64_t) : sizeof(uint32_t);
+    img->num_tags = descs != NULL ? size / ptr_size : 0;
+    img->tags = calloc(img->num_tags + 1U, sizeof(*img->tags));
+    for (size_t i = 0; i < img->num_tags; i++)
+    {
+        uint64_t addr = 0;
+        memcpy(&addr, &descs[i * ptr_size], ptr_size);
+        img->tags[i] = image_string(img, addr);
+    }
+}
+
+/**
+ * @brief Read section header.
+ *
+ * @param img Image.
+ * @param i Section index.
+ * @param[out] sec Section header.
+ *
+ * @return true if successful, false if there is no such section or its contents are cut off.
+ */
+static bool image_section_at(const Image *img, uint32_t i, Section *sec)
+{
+    const uint8_t *f = img->file;
+    uint64_t shoff = img->is64 ? ((const Elf64_Ehdr *)f)->e_shoff : ((const Elf32_Ehdr *)f)->e_shoff;
+    uint32_t shnum = img->is64 ? ((const Elf64_Ehdr *)f)->e_shnum : ((const Elf32_Ehdr *)f)->e_shnum;
+    uint32_t shentsize = img->is64 ? ((const Elf64_Ehdr *)f)->e_shentsize : ((const Elf32_Ehdr *)f)->e_shentsize;
+    if (i >= shnum || shoff + (uint64_t)(i + 1U) * shentsize > img->file_size)
+    {
+        return false;
+    }
+
+    const uint8_t *sh = &f[shoff + (uint64_t)i * shentsize];
+    if (img->is64)
+    {
+        const Elf64_Shdr *s = (const Elf64_Shdr *)sh;
+        *sec = (Section){s->sh_name, s->sh_type, s->sh_flags, s->sh_addr, s->sh_offset, s->sh_size};
+    }
+    else
+    {
+        const Elf32_Shdr *s = (const Elf32_Shdr *)sh;
+        *sec = (Section){s->sh_name, s->sh_type, s->sh_flags, s->sh_addr, s->sh_offset, s->sh_size};
+    }
+    return sec->type == SHT_NOBITS || sec->offset + sec->size <= img->file_size;
+}
+
+/**
+ * @brief Find section contents by name.
+ *
+ * @param img Image.
+ * @param name Section name.
+ * @param[out] size Size of section (bytes).
+ *
+ * @return Section contents, NULL if there is no such section with contents.
+ */
+static const uint8_t *image_section(const Image *img, const char *name, size_t *size)
+{
+    uint32_t shstrndx = img->is64 ? ((const Elf64_Ehdr *)img->file)->e_shstrndx
+                                  : ((const Elf32_Ehdr *)img->file)->e_shstrndx;
+    Section names;
+    if (!image_section_at(img, shstrndx, &names))
+    {
+        return NULL;
+    }
+
+    Section sec;
+    for (uint32_t i = 1; image_section_at(img, i, &sec); i++)
+    {
+        if (sec.type != SHT_NOBITS && sec.name < names.size &&
+            strcmp((const char *)&img->file[names.offset + sec.name], name) == 0)
+        {
+            *size = (size_t)sec.size;
+            return &img->file[sec.offset];
+        }
+    }
+    return NULL;
+}
+
+/**
+ * @brief Find string by its load address, in the allocated section holding it.
+ *
+ * @param img Image.
+ * @param addr Load address of string.
+ *
+ * @return String, "?" if no section holds it.
+ */
+static const char *image_string(const Image *img, uint64_t addr)
+{
+    Section sec;
+    for (uint32_t i = 1; image_section_at(img, i, &sec); i++)
+    {
+        if ((sec.flags & SHF_ALLOC) && sec.type != SHT_NOBITS && addr >= sec.addr && addr < sec.addr + sec.size &&
+            memchr(&img->file[sec.offset + addr - sec.addr], '\0', sec.size - (addr - sec.addr)) != NULL)
+        {
+            return (const char *)&img->file[sec.offset + addr - sec.addr];
+        }
+    }
+    return "?";
+}
+
+/**
+ * @brief Handle bytes received up to a delimiter: console text, a log frame, or another frame.
+ *
+ * @param img Image.
+ * @param chunk Bytes, without delimiter.
+ * @param len Number of bytes.
+ */
+static void chunk_done(const Image *img, const uint8_t *chunk, size_t len)
+{
+    static uint8_t payload[CHUNK_SIZE];
+    size_t payload_len;
+    if (len == 0)
+    {
+        return;
+    }
+    if (frame_decode(chunk, len, payload, &payload_len) == MOD_OK)
+    {
+        if (payload_len >= LOG_HDR_SIZE && payload[0] == LOG_TELEMETRY_TYPE)
+        {
+            message_print(img, payload, payload_len);
+        }
+        return;
+    }
+
+    bool text = true;
+    for (size_t i = 0; i < len && text; i++)
+    {
+        text = is_text(chunk[i]);
+    }
+    if (text)
+    {
+        fwrite(chunk, 1, len, stdout);
+    }
+}
+
+/**
+ * @brief Format and print interned message like the firmware's text log, timestamp as uptime.
+ *
+ * @param img Image.
+ * @param payload Frame payload.
+ * @param len Number of payload bytes.
+ */
+static void message_print(const Image *img, const uint8_t *payload, size_t len)
+{
+    uint8_t level = payload[1];
+    uint8_t tag = payload[2];
+    uint16_t fmt;
+    uint32_t tick;
+    memcpy(&fmt, &payload[3], sizeof(fmt));
+    memcpy(&tick, &payload[5], sizeof(tick));
+    if (level >= LOG_NUM_LEVELS)
+    {
+        level = 0;
+    }
+
+    printf("\r%s%s%u.%03u) %s: ", colour ? colours[level] : "", prefixes[level], tick / 1000U, tick % 1000U,
+           tag < img->num_tags ? img->tags[tag] : "?");
+    if (fmt < img->fmts_size && memchr(&img->fmts[fmt], '\0', img->fmts_size - fmt) != NULL)
+    {
+        Args args = {.p = &payload[LOG_HDR_SIZE], .left = len - LOG_HDR_SIZE};
+        args_format(&img->fmts[fmt], &args);
+    }
+    else
+    {
+        printf("<unknown format string 0x%04x, ELF file of another build?>", fmt);
+    }
+    printf("%s\r\n", colour ? LOG_RESET_COLOUR : "");
+}
+
+/**
+ * @brief Format message arguments, see log_arg_kind_t in log.h.
+ *
+ * The firmware encodes arguments by their C type, which the conversion specification gives:
+ * strings for %s, floats for floating point conversions, 8 bytes with the ll length modifier
+ * and 4 bytes otherwise.
+ *
+ * @param fmt Format string.
+ * @param args Encoded arguments.
+ */
+static void args_format(const char *fmt, Args *args)
+{
+    while (*fmt != '\0')
+    {
+        if (*fmt != '%' || fmt[1] == '%')
+        {
+            putchar(*fmt);
+            fmt += *fmt == '%' ? 2 : 1;
+            continue;
+        }
+
+        /* Conversion specification without length modifier, '*' replaced by its argument. */
+        char spec[SPEC_SIZE] = "%";
+        size_t n = 1;
+        fmt++;
+        while (*fmt != '\0' && strchr("-+ #0123456789.*", *fmt) != NULL && n < SPEC_SIZE - 16U)
+        {
+            if (*fmt == '*')
+            {
+                int32_t v = 0;
+                args_take(args, &v, sizeof(v));
+                n += (size_t)snprintf(&spec[n], SPEC_SIZE - n, "%d", v);
+            }
+            else
+            {
+                spec[n++] = *fmt;
+            }
+            fmt++;
+        }
+        uint32_t longs = 0;
+        while (*fmt != '\0' && strchr("hlLqjzt", *fmt) != NULL)
+        {
+            longs += *fmt == 'l' ? 1U : 0U;
+            fmt++;
+        }
+        char conv = *fmt;
+        if (conv == '\0')
+        {
+            break;
+        }
+        fmt++;
+
+        bool ok = true;
+        if (conv == 's')
+        {
+            const char *s = (const char *)args->p;
+            size_t slen = strnlen(s, args->left);
+            ok = slen < args->left;
+            if (ok)
+            {
+                strcpy(&spec[n], "s");
+                printf(spec, s);
+                args->p += slen + 1U;
+                args->left -= slen + 1U;
+            }
+        }
+        else if (strchr("fFeEgGaA", conv) != NULL)
+        {
+            float v;
+            ok = args_take(args, &v, sizeof(v));
+            if (ok)
+            {
+                spec[n++] = conv;
+                spec[n] = '\0';
+                printf(spec, (double)v);
+            }
+        }
+        else if (strchr("diouxXc", conv) != NULL)
+        {
+            uint64_t v = 0;
+            bool wide = longs >= 2U;
+            ok = args_take(args, &v, wide ? sizeof(uint64_t) : sizeof(uint32_t));
+            if (ok && !wide && (conv == 'd' || conv == 'i'))
+            {
+                v = (uint64_t)(int64_t)(int32_t)v;
+            }
+            if (ok)
+            {
+                snprintf(&spec[n], SPEC_SIZE - n, conv == 'c' ? "c" : "ll%c", conv);
+                if (conv == 'c')
+                {
+                    printf(spec, (int)v);
+                }
+                else
+                {
+                    printf(spec, (long long)v);
+                }
+            }
+        }
+        else if (conv == 'p')
+        {
+            uint32_t v;
+            ok = args_take(args, &v, sizeof(v));
+            if (ok)
+            {
+                printf("0x%08x", v);
+            }
+        }
+        else
+        {
+            printf("<%%%c?>", conv);
+        }
+
+        if (!ok)
+        {
+            printf("<?>");
+            break;
+        }
+    }
+}
+
+/**
+ * @brief Take argument bytes.
+ *
+ * @param args Encoded arguments.
+ * @param[out] dst Argument, little-endian.
+ * @param size Number of bytes.
+ *
+ * @return true if successful, false if the message holds fewer bytes.
+ */
+static bool args_take(Args *args, void *dst, size_t size)
+{
+    if (args->left < size)
+    {
+        return false;
+    }
+    memcpy(dst, args->p, size);
+    args->p += size;
+    args->left -= size;
+    return true;
+}
+
+/**
+ * @brief Check whether console text uses byte: printable characters, line ends, tabs, backspace
+ * and escape sequences.
+ *
+ * @param c Byte.
+ *
+ * @return true if console text uses byte, false otherwise.
+ */
+static bool is_text(uint8_t c)
+{
+    return (c >= 0x20U && c != 0x7FU) || c == '\r' || c == '\n' || c == '\t' || c == '\b' || c == 0x1BU;
+}